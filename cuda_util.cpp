@@ -18,6 +18,10 @@
 
 #include "cuda_util.h"
 
+#if defined(CUDAU_ENABLE_NVTX)
+#   include <nvtx3/nvToolsExt.h>
+#endif
+
 #ifdef CUDAUPlatform_Windows_MSVC
 #   include <Windows.h>
 #   undef near
@@ -29,6 +33,24 @@
 
 
 namespace cudau {
+#if defined(CUDAU_ENABLE_NVTX)
+    class NvtxRange {
+    public:
+        NvtxRange(const char* funcName, const std::string &objName) {
+            const std::string message = objName.empty() ? funcName : std::string(funcName) + " (" + objName + ")";
+            nvtxRangePushA(message.c_str());
+        }
+        ~NvtxRange() {
+            nvtxRangePop();
+        }
+        NvtxRange(const NvtxRange &) = delete;
+        NvtxRange &operator=(const NvtxRange &) = delete;
+    };
+#   define CUDAU_NVTX_RANGE(FuncName, ObjName) NvtxRange nvtxRange(FuncName, ObjName)
+#else
+#   define CUDAU_NVTX_RANGE(FuncName, ObjName)
+#endif
+
 #ifdef CUDAUPlatform_Windows_MSVC
     void devPrintf(const char* fmt, ...) {
         va_list args;
@@ -70,10 +92,982 @@ namespace cudau {
 
 
 
+    void setMemoryPoolReleaseThreshold(CUmemoryPool memoryPool, uint64_t releaseThreshold) {
+        if (!memoryPool) {
+            CUdevice device;
+            CUDADRV_CHECK(cuCtxGetDevice(&device));
+            CUDADRV_CHECK(cuDeviceGetDefaultMemPool(&memoryPool, device));
+        }
+        cuuint64_t threshold = releaseThreshold;
+        CUDADRV_CHECK(cuMemPoolSetAttribute(memoryPool, CU_MEMPOOL_ATTR_RELEASE_THRESHOLD, &threshold));
+    }
+
+
+
+    void PinnedStagingPool::initialize(CUcontext context, size_t chunkSize, uint32_t numChunks) {
+        if (m_initialized)
+            throw std::runtime_error("Staging pool is already initialized.");
+        if (chunkSize == 0 || numChunks == 0)
+            throw std::runtime_error("Chunk size and the number of chunks must be > 0.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        m_chunkSize = chunkSize;
+        CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m_hostMemory), m_chunkSize * numChunks));
+        m_chunks.resize(numChunks);
+        for (uint32_t i = 0; i < numChunks; ++i) {
+            Chunk &chunk = m_chunks[i];
+            chunk.hostPointer = m_hostMemory + m_chunkSize * i;
+            CUDADRV_CHECK(cuEventCreate(&chunk.lastUse, CU_EVENT_DISABLE_TIMING));
+        }
+        m_nextChunkIndex = 0;
+
+        m_initialized = true;
+    }
+
+    void PinnedStagingPool::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_chunks.size()) - 1; i >= 0; --i) {
+            Chunk &chunk = m_chunks[i];
+            CUDADRV_CHECK(cuEventSynchronize(chunk.lastUse));
+            CUDADRV_CHECK(cuEventDestroy(chunk.lastUse));
+        }
+        m_chunks.clear();
+        CUDADRV_CHECK(cuMemFreeHost(m_hostMemory));
+        m_hostMemory = nullptr;
+
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    PinnedStagingPool::Chunk &PinnedStagingPool::acquireChunk(CUstream stream, bool waitOnHost) {
+        Chunk &chunk = m_chunks[m_nextChunkIndex];
+        m_nextChunkIndex = (m_nextChunkIndex + 1) % m_chunks.size();
+        // JP: チャンクの前回の使用の完了を待つ。
+        // EN: Wait for the previous use of the chunk to complete.
+        if (waitOnHost)
+            CUDADRV_CHECK(cuEventSynchronize(chunk.lastUse));
+        else
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, chunk.lastUse, 0));
+        return chunk;
+    }
+
+    TransferToken PinnedStagingPool::makeToken(CUstream stream) const {
+        CUevent event;
+        CUDADRV_CHECK(cuEventCreate(&event, CU_EVENT_DISABLE_TIMING));
+        CUDADRV_CHECK(cuEventRecord(event, stream));
+        return TransferToken(event);
+    }
+
+    TransferToken PinnedStagingPool::upload(CUdeviceptr dst, const void* src, size_t size, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Staging pool is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const uint8_t* srcBytes = reinterpret_cast<const uint8_t*>(src);
+        for (size_t offset = 0; offset < size; offset += m_chunkSize) {
+            const size_t chunkSize = std::min(m_chunkSize, size - offset);
+            Chunk &chunk = acquireChunk(stream, true);
+            std::memcpy(chunk.hostPointer, srcBytes + offset, chunkSize);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(dst + offset, chunk.hostPointer, chunkSize, stream));
+            CUDADRV_CHECK(cuEventRecord(chunk.lastUse, stream));
+        }
+
+        return makeToken(stream);
+    }
+
+    TransferToken PinnedStagingPool::uploadToArray(CUarray dst, const void* src, size_t widthInBytes,
+                                                   uint32_t height, uint32_t depth, CUstream stream,
+                                                   size_t dstXInBytes, uint32_t dstY) {
+        if (!m_initialized)
+            throw std::runtime_error("Staging pool is not initialized.");
+        if (widthInBytes > m_chunkSize)
+            throw std::runtime_error("A row does not fit in a staging chunk.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const uint32_t numRowsPerChunk = static_cast<uint32_t>(std::min<size_t>(m_chunkSize / widthInBytes, height));
+        const uint8_t* srcBytes = reinterpret_cast<const uint8_t*>(src);
+        for (uint32_t z = 0; z < depth; ++z) {
+            for (uint32_t y = 0; y < height; y += numRowsPerChunk) {
+                const uint32_t numRows = std::min(numRowsPerChunk, height - y);
+                const size_t chunkSize = widthInBytes * numRows;
+                Chunk &chunk = acquireChunk(stream, true);
+                std::memcpy(chunk.hostPointer, srcBytes + widthInBytes * (static_cast<size_t>(z) * height + y),
+                            chunkSize);
+
+                CUDA_MEMCPY3D params = {};
+                params.WidthInBytes = widthInBytes;
+                params.Height = numRows;
+                params.Depth = 1;
+
+                params.srcMemoryType = CU_MEMORYTYPE_HOST;
+                params.srcHost = chunk.hostPointer;
+                params.srcPitch = widthInBytes;
+                params.srcHeight = numRows;
+
+                params.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+                params.dstArray = dst;
+                params.dstXInBytes = dstXInBytes;
+                params.dstY = dstY + y;
+                params.dstZ = z;
+
+                CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+                CUDADRV_CHECK(cuEventRecord(chunk.lastUse, stream));
+            }
+        }
+
+        return makeToken(stream);
+    }
+
+    void fillDeviceMemory(CUdeviceptr dst, const void* pattern, uint32_t patternSize, size_t numValues,
+                          CUstream stream) {
+        if (numValues == 0)
+            return;
+
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pattern);
+        const auto repeats = [bytes, patternSize](uint32_t period) {
+            if (patternSize % period != 0)
+                return false;
+            for (uint32_t i = period; i < patternSize; ++i) {
+                if (bytes[i] != bytes[i % period])
+                    return false;
+            }
+            return true;
+        };
+
+        const size_t size = static_cast<size_t>(patternSize) * numValues;
+        if (repeats(1)) {
+            CUDADRV_CHECK(cuMemsetD8Async(dst, bytes[0], size, stream));
+        }
+        else if (repeats(2) && dst % 2 == 0) {
+            uint16_t v;
+            std::memcpy(&v, bytes, sizeof(v));
+            CUDADRV_CHECK(cuMemsetD16Async(dst, v, size / 2, stream));
+        }
+        else if (repeats(4) && dst % 4 == 0) {
+            uint32_t v;
+            std::memcpy(&v, bytes, sizeof(v));
+            CUDADRV_CHECK(cuMemsetD32Async(dst, v, size / 4, stream));
+        }
+        // JP: 各値を1行とみなし、パターンの列ごとにピッチ付きで塗る。
+        // EN: Regard each value as a row and fill per column of the pattern with a pitch.
+        else if (patternSize % 4 == 0 && dst % 4 == 0) {
+            for (uint32_t offset = 0; offset < patternSize; offset += 4) {
+                uint32_t v;
+                std::memcpy(&v, bytes + offset, sizeof(v));
+                CUDADRV_CHECK(cuMemsetD2D32Async(dst + offset, patternSize, v, 1, numValues, stream));
+            }
+        }
+        else if (patternSize % 2 == 0 && dst % 2 == 0) {
+            for (uint32_t offset = 0; offset < patternSize; offset += 2) {
+                uint16_t v;
+                std::memcpy(&v, bytes + offset, sizeof(v));
+                CUDADRV_CHECK(cuMemsetD2D16Async(dst + offset, patternSize, v, 1, numValues, stream));
+            }
+        }
+        else {
+            for (uint32_t offset = 0; offset < patternSize; ++offset)
+                CUDADRV_CHECK(cuMemsetD2D8Async(dst + offset, patternSize, bytes[offset], 1, numValues, stream));
+        }
+    }
+
+
+
+    bool enablePeerAccess(CUcontext context, CUcontext peerContext) {
+        CUdevice device, peerDevice;
+        CUDADRV_CHECK(cuCtxSetCurrent(peerContext));
+        CUDADRV_CHECK(cuCtxGetDevice(&peerDevice));
+        CUDADRV_CHECK(cuCtxSetCurrent(context));
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        if (device == peerDevice)
+            return true;
+
+        int32_t canAccessPeer = 0;
+        CUDADRV_CHECK(cuDeviceCanAccessPeer(&canAccessPeer, device, peerDevice));
+        if (!canAccessPeer)
+            return false;
+        CUresult res = cuCtxEnablePeerAccess(peerContext, 0);
+        if (res == CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED)
+            return true;
+        CUDADRV_CHECK(res);
+        return true;
+    }
+
+    void copyAcrossContexts(CUdeviceptr dst, CUcontext dstContext, CUdeviceptr src, CUcontext srcContext,
+                            size_t size, CUstream stream) {
+        if (size == 0)
+            return;
+
+        CUdevice dstDevice, srcDevice;
+        CUDADRV_CHECK(cuCtxSetCurrent(srcContext));
+        CUDADRV_CHECK(cuCtxGetDevice(&srcDevice));
+        CUDADRV_CHECK(cuCtxSetCurrent(dstContext));
+        CUDADRV_CHECK(cuCtxGetDevice(&dstDevice));
+
+        int32_t canAccessPeer = 1;
+        if (dstDevice != srcDevice)
+            CUDADRV_CHECK(cuDeviceCanAccessPeer(&canAccessPeer, dstDevice, srcDevice));
+        if (canAccessPeer) {
+            CUDADRV_CHECK(cuMemcpyPeerAsync(dst, dstContext, src, srcContext, size, stream));
+            return;
+        }
+
+        // JP: ピアアクセスが不可能な場合はピン留めメモリーを経由する。
+        // EN: Go through pinned memory when peer access is not possible.
+        void* stagingMemory;
+        CUDADRV_CHECK(cuMemAllocHost(&stagingMemory, size));
+        CUDADRV_CHECK(cuCtxSetCurrent(srcContext));
+        CUDADRV_CHECK(cuMemcpyDtoH(stagingMemory, src, size));
+        CUDADRV_CHECK(cuCtxSetCurrent(dstContext));
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(dst, stagingMemory, size, stream));
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        CUDADRV_CHECK(cuMemFreeHost(stagingMemory));
+    }
+
+
+
+    namespace {
+        struct StagedCopy {
+            void* dst;
+            const void* src;
+            size_t size;
+        };
+
+        void CUDA_CB executeStagedCopy(void* userData) {
+            StagedCopy* copy = reinterpret_cast<StagedCopy*>(userData);
+            std::memcpy(copy->dst, copy->src, copy->size);
+            delete copy;
+        }
+    }
+
+    TransferToken PinnedStagingPool::download(void* dst, CUdeviceptr src, size_t size, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Staging pool is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        uint8_t* dstBytes = reinterpret_cast<uint8_t*>(dst);
+        for (size_t offset = 0; offset < size; offset += m_chunkSize) {
+            const size_t chunkSize = std::min(m_chunkSize, size - offset);
+            Chunk &chunk = acquireChunk(stream, false);
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(chunk.hostPointer, src + offset, chunkSize, stream));
+            StagedCopy* copy = new StagedCopy{ dstBytes + offset, chunk.hostPointer, chunkSize };
+            CUDADRV_CHECK(cuLaunchHostFunc(stream, executeStagedCopy, copy));
+            CUDADRV_CHECK(cuEventRecord(chunk.lastUse, stream));
+        }
+
+        return makeToken(stream);
+    }
+
+
+
+    // JP: 占有率の問い合わせ結果はKernelのインスタンス間で共有する。
+    // EN: Share the occupancy query results among Kernel instances.
+    struct OccupancyQueryKey {
+        CUfunction function;
+        CUoccupancyB2DSize sharedMemSizeFunc;
+        uint32_t sharedMemSize;
+        uint32_t blockSize;
+
+        bool operator==(const OccupancyQueryKey &r) const {
+            return function == r.function && sharedMemSizeFunc == r.sharedMemSizeFunc &&
+                sharedMemSize == r.sharedMemSize && blockSize == r.blockSize;
+        }
+    };
+
+    struct OccupancyQueryKeyHash {
+        size_t operator()(const OccupancyQueryKey &key) const {
+            size_t seed = std::hash<const void*>()(key.function);
+            const auto combine = [&seed](size_t v) {
+                seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            };
+            combine(std::hash<const void*>()(reinterpret_cast<const void*>(key.sharedMemSizeFunc)));
+            combine(std::hash<uint32_t>()(key.sharedMemSize));
+            combine(std::hash<uint32_t>()(key.blockSize));
+            return seed;
+        }
+    };
+
+    static std::mutex s_occupancyCacheMutex;
+    // JP: blockSizeに上限値を入れてブロックサイズを、実際のブロックサイズを入れて常駐ブロック数を引く。
+    // EN: Look up a block size with the limit in blockSize, or the number of resident blocks with the actual block size.
+    static std::unordered_map<OccupancyQueryKey, uint32_t, OccupancyQueryKeyHash> s_maxPotentialBlockSizes;
+    static std::unordered_map<OccupancyQueryKey, uint32_t, OccupancyQueryKeyHash> s_numPersistentBlocks;
+
+    void Kernel::setBlockDimensionsForMaxOccupancy(CUoccupancyB2DSize sharedMemSizeFunc, uint32_t blockSizeLimit) {
+        if (!m_kernel)
+            throw std::runtime_error("Kernel is not set.");
+
+        const OccupancyQueryKey key{
+            m_kernel, sharedMemSizeFunc, sharedMemSizeFunc ? 0 : m_sharedMemSize, blockSizeLimit };
+        uint32_t blockSize;
+        {
+            std::lock_guard<std::mutex> lock(s_occupancyCacheMutex);
+            auto it = s_maxPotentialBlockSizes.find(key);
+            if (it != s_maxPotentialBlockSizes.end()) {
+                blockSize = it->second;
+            }
+            else {
+                int32_t minGridSize;
+                int32_t iBlockSize;
+                CUDADRV_CHECK(cuOccupancyMaxPotentialBlockSize(
+                    &minGridSize, &iBlockSize, m_kernel,
+                    sharedMemSizeFunc, sharedMemSizeFunc ? 0 : m_sharedMemSize,
+                    static_cast<int32_t>(blockSizeLimit)));
+                blockSize = static_cast<uint32_t>(iBlockSize);
+                s_maxPotentialBlockSizes[key] = blockSize;
+            }
+        }
+
+        m_blockDim = dim3(blockSize);
+        if (sharedMemSizeFunc)
+            m_sharedMemSize = static_cast<uint32_t>(sharedMemSizeFunc(static_cast<int32_t>(blockSize)));
+    }
+
+    uint32_t Kernel::getNumPersistentBlocks() const {
+        if (!m_kernel)
+            throw std::runtime_error("Kernel is not set.");
+
+        const uint32_t blockSize = m_blockDim.x * m_blockDim.y * m_blockDim.z;
+        const OccupancyQueryKey key{ m_kernel, nullptr, m_sharedMemSize, blockSize };
+        std::lock_guard<std::mutex> lock(s_occupancyCacheMutex);
+        auto it = s_numPersistentBlocks.find(key);
+        if (it != s_numPersistentBlocks.end())
+            return it->second;
+
+        int32_t numBlocksPerSM;
+        CUDADRV_CHECK(cuOccupancyMaxActiveBlocksPerMultiprocessor(
+            &numBlocksPerSM, m_kernel, static_cast<int32_t>(blockSize), m_sharedMemSize));
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        int32_t numSMs;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&numSMs, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT, device));
+        const uint32_t numBlocks = std::max(static_cast<uint32_t>(numBlocksPerSM * numSMs), 1u);
+        s_numPersistentBlocks[key] = numBlocks;
+        return numBlocks;
+    }
+
+
+
+    void GpuProfiler::initialize(CUcontext context, uint32_t numFramesInFlight, uint32_t maxNumHistoryFrames) {
+        if (m_initialized)
+            throw std::runtime_error("Profiler is already initialized.");
+        if (numFramesInFlight == 0)
+            throw std::runtime_error("numFramesInFlight must be larger than 0.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        m_frames.resize(numFramesInFlight);
+        for (Frame &frame : m_frames) {
+            frame.frameIndex = 0;
+            frame.beginEvent = nullptr;
+            frame.endEvent = nullptr;
+            frame.inFlight = false;
+        }
+        CUDADRV_CHECK(cuEventCreate(&m_originEvent, CU_EVENT_DEFAULT));
+        m_frameIndex = 0;
+        m_numDroppedFrames = 0;
+        m_maxNumHistoryFrames = maxNumHistoryFrames;
+        m_originRecorded = false;
+        m_inFrame = false;
+
+        m_initialized = true;
+    }
+
+    void GpuProfiler::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (Frame &frame : m_frames)
+            releaseFrameEvents(frame);
+        m_frames.clear();
+        for (CUevent event : m_freeEvents)
+            CUDADRV_CHECK(cuEventDestroy(event));
+        m_freeEvents.clear();
+        CUDADRV_CHECK(cuEventDestroy(m_originEvent));
+        m_originEvent = nullptr;
+        m_scopeStack.clear();
+        m_history.clear();
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    CUevent GpuProfiler::acquireEvent() {
+        if (m_freeEvents.empty()) {
+            CUevent event;
+            CUDADRV_CHECK(cuEventCreate(&event, CU_EVENT_DEFAULT));
+            return event;
+        }
+        CUevent event = m_freeEvents.back();
+        m_freeEvents.pop_back();
+        return event;
+    }
+
+    void GpuProfiler::releaseFrameEvents(Frame &frame) {
+        for (Scope &scope : frame.scopes) {
+            m_freeEvents.push_back(scope.beginEvent);
+            if (scope.endEvent)
+                m_freeEvents.push_back(scope.endEvent);
+        }
+        frame.scopes.clear();
+        if (frame.beginEvent)
+            m_freeEvents.push_back(frame.beginEvent);
+        if (frame.endEvent)
+            m_freeEvents.push_back(frame.endEvent);
+        frame.beginEvent = nullptr;
+        frame.endEvent = nullptr;
+        frame.inFlight = false;
+    }
+
+    bool GpuProfiler::tryResolve(Frame &frame) {
+        CUresult res = cuEventQuery(frame.endEvent);
+        if (res == CUDA_ERROR_NOT_READY)
+            return false;
+        CUDADRV_CHECK(res);
+
+        // JP: フレームの終了はフレーム内の全区間の後に記録されるが、
+        //     区間は別のストリームにあり得るので、個別に完了を確認する。
+        // EN: The frame end is recorded after all scopes in the frame,
+        //     but scopes may be on other streams, so check their completion individually.
+        for (const Scope &scope : frame.scopes) {
+            res = cuEventQuery(scope.endEvent);
+            if (res == CUDA_ERROR_NOT_READY)
+                return false;
+            CUDADRV_CHECK(res);
+        }
+
+        FrameStats stats;
+        stats.frameIndex = frame.frameIndex;
+        float frameStartTime;
+        CUDADRV_CHECK(cuEventElapsedTime(&frameStartTime, m_originEvent, frame.beginEvent));
+        stats.frameStartTime = frameStartTime;
+        CUDADRV_CHECK(cuEventElapsedTime(&stats.frameDuration, frame.beginEvent, frame.endEvent));
+        stats.scopes.resize(frame.scopes.size());
+        for (uint32_t i = 0; i < frame.scopes.size(); ++i) {
+            const Scope &scope = frame.scopes[i];
+            ScopeStats &scopeStats = stats.scopes[i];
+            scopeStats.name = scope.name;
+            scopeStats.depth = scope.depth;
+            CUDADRV_CHECK(cuEventElapsedTime(&scopeStats.startTime, frame.beginEvent, scope.beginEvent));
+            CUDADRV_CHECK(cuEventElapsedTime(&scopeStats.duration, scope.beginEvent, scope.endEvent));
+        }
+        m_history.push_back(std::move(stats));
+        while (m_history.size() > m_maxNumHistoryFrames)
+            m_history.pop_front();
+
+        releaseFrameEvents(frame);
+
+        return true;
+    }
+
+    void GpuProfiler::poll() {
+        if (!m_initialized)
+            throw std::runtime_error("Profiler is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: 古いフレームから順に解決して履歴の順序を保つ。
+        // EN: Resolve from older frames to keep the order of the history.
+        const uint32_t numFrames = static_cast<uint32_t>(m_frames.size());
+        for (uint32_t i = 0; i < numFrames; ++i) {
+            Frame &frame = m_frames[(m_frameIndex + i) % numFrames];
+            if (!frame.inFlight || (m_inFrame && frame.frameIndex == m_frameIndex))
+                continue;
+            if (!tryResolve(frame))
+                break;
+        }
+    }
+
+    void GpuProfiler::beginFrame(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Profiler is not initialized.");
+        if (m_inFrame)
+            throw std::runtime_error("beginFrame() has already been called.");
+
+        poll();
+
+        Frame &frame = m_frames[m_frameIndex % m_frames.size()];
+        if (frame.inFlight && !tryResolve(frame)) {
+            releaseFrameEvents(frame);
+            ++m_numDroppedFrames;
+        }
+
+        if (!m_originRecorded) {
+            CUDADRV_CHECK(cuEventRecord(m_originEvent, stream));
+            m_originRecorded = true;
+        }
+
+        frame.frameIndex = m_frameIndex;
+        frame.beginEvent = acquireEvent();
+        frame.endEvent = nullptr;
+        frame.inFlight = true;
+        CUDADRV_CHECK(cuEventRecord(frame.beginEvent, stream));
+        m_inFrame = true;
+    }
+
+    void GpuProfiler::endFrame(CUstream stream) {
+        if (!m_inFrame)
+            throw std::runtime_error("beginFrame() has not been called.");
+        if (!m_scopeStack.empty())
+            throw std::runtime_error("There are unclosed scopes.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Frame &frame = m_frames[m_frameIndex % m_frames.size()];
+        frame.endEvent = acquireEvent();
+        CUDADRV_CHECK(cuEventRecord(frame.endEvent, stream));
+        m_inFrame = false;
+        ++m_frameIndex;
+    }
+
+    void GpuProfiler::pushScope(const char* name, CUstream stream) {
+        // JP: フレーム外の区間は記録しない。
+        // EN: Scopes outside frames are not recorded.
+        if (!m_inFrame)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Frame &frame = m_frames[m_frameIndex % m_frames.size()];
+        Scope scope;
+        scope.name = name;
+        scope.depth = static_cast<uint32_t>(m_scopeStack.size());
+        scope.beginEvent = acquireEvent();
+        scope.endEvent = nullptr;
+        CUDADRV_CHECK(cuEventRecord(scope.beginEvent, stream));
+        m_scopeStack.push_back(static_cast<uint32_t>(frame.scopes.size()));
+        frame.scopes.push_back(std::move(scope));
+    }
+
+    void GpuProfiler::popScope(CUstream stream) {
+        if (!m_inFrame)
+            return;
+        if (m_scopeStack.empty())
+            throw std::runtime_error("No scope to pop.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Frame &frame = m_frames[m_frameIndex % m_frames.size()];
+        Scope &scope = frame.scopes[m_scopeStack.back()];
+        m_scopeStack.pop_back();
+        scope.endEvent = acquireEvent();
+        CUDADRV_CHECK(cuEventRecord(scope.endEvent, stream));
+    }
+
+    void GpuProfiler::writeChromeTrace(std::ostream &os) const {
+        os << "{\"traceEvents\":[";
+        bool first = true;
+        writeChromeTraceEvents(os, &first);
+        os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    void GpuProfiler::writeChromeTraceEvents(std::ostream &os, bool* first, uint32_t pid) const {
+        const auto writeEscaped = [&os](const std::string &str) {
+            for (char c : str) {
+                if (c == '"' || c == '\\')
+                    os << '\\';
+                os << c;
+            }
+        };
+
+        os << (*first ? "" : ",") << "\n";
+        os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+           << ",\"args\":{\"name\":\"GPU\"}}";
+        *first = false;
+        for (const FrameStats &frame : m_history) {
+            const double frameStart = frame.frameStartTime * 1000.0;
+            os << ",\n{\"name\":\"Frame " << frame.frameIndex << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":0,"
+               << "\"ts\":" << frameStart << ",\"dur\":" << frame.frameDuration * 1000.0 << "}";
+            for (const ScopeStats &scope : frame.scopes) {
+                os << ",\n{\"name\":\"";
+                writeEscaped(scope.name);
+                os << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":0,"
+                   << "\"ts\":" << frameStart + scope.startTime * 1000.0
+                   << ",\"dur\":" << scope.duration * 1000.0
+                   << ",\"args\":{\"depth\":" << scope.depth << "}}";
+            }
+        }
+    }
+
+
+
+    static CUexternalMemory importExternalMemory(const ExternalHandle &handle, size_t memorySize, bool dedicated) {
+        CUDA_EXTERNAL_MEMORY_HANDLE_DESC memDesc = {};
+        if (handle.type == ExternalHandleType::OpaqueFd) {
+            memDesc.type = CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD;
+            memDesc.handle.fd = handle.fd;
+        }
+        else {
+            memDesc.type = handle.type == ExternalHandleType::OpaqueWin32 ?
+                CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32 :
+                CU_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_KMT;
+            memDesc.handle.win32.handle = handle.win32Handle;
+        }
+        memDesc.size = memorySize;
+        memDesc.flags = dedicated ? CUDA_EXTERNAL_MEMORY_DEDICATED : 0;
+
+        CUexternalMemory externalMemory;
+        CUDADRV_CHECK(cuImportExternalMemory(&externalMemory, &memDesc));
+        return externalMemory;
+    }
+
+    void ExternalSemaphore::initialize(CUcontext context, const ExternalHandle &handle, bool timeline) {
+        if (m_initialized)
+            throw std::runtime_error("External semaphore is already initialized.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUDA_EXTERNAL_SEMAPHORE_HANDLE_DESC semDesc = {};
+        if (handle.type == ExternalHandleType::OpaqueFd) {
+            semDesc.type = timeline ?
+                CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_TIMELINE_SEMAPHORE_FD :
+                CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD;
+            semDesc.handle.fd = handle.fd;
+        }
+        else {
+            if (timeline)
+                semDesc.type = CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_TIMELINE_SEMAPHORE_WIN32;
+            else
+                semDesc.type = handle.type == ExternalHandleType::OpaqueWin32 ?
+                    CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32 :
+                    CU_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_WIN32_KMT;
+            semDesc.handle.win32.handle = handle.win32Handle;
+        }
+        CUDADRV_CHECK(cuImportExternalSemaphore(&m_semaphore, &semDesc));
+        m_timeline = timeline;
+
+        m_initialized = true;
+    }
+
+    void ExternalSemaphore::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuDestroyExternalSemaphore(m_semaphore));
+        m_semaphore = nullptr;
+        m_cuContext = nullptr;
+        m_timeline = false;
+
+        m_initialized = false;
+    }
+
+    void ExternalSemaphore::signal(CUstream stream, uint64_t value) const {
+        if (!m_initialized)
+            throw std::runtime_error("External semaphore is not initialized.");
+
+        CUDA_EXTERNAL_SEMAPHORE_SIGNAL_PARAMS params = {};
+        params.params.fence.value = m_timeline ? value : 0;
+        CUDADRV_CHECK(cuSignalExternalSemaphoresAsync(&m_semaphore, &params, 1, stream));
+    }
+
+    void ExternalSemaphore::wait(CUstream stream, uint64_t value) const {
+        if (!m_initialized)
+            throw std::runtime_error("External semaphore is not initialized.");
+
+        CUDA_EXTERNAL_SEMAPHORE_WAIT_PARAMS params = {};
+        params.params.fence.value = m_timeline ? value : 0;
+        CUDADRV_CHECK(cuWaitExternalSemaphoresAsync(&m_semaphore, &params, 1, stream));
+    }
+
+
+
+    static CUmemAllocationHandleType getShareableHandleType() {
+#if defined(CUDAUPlatform_Windows)
+        return CU_MEM_HANDLE_TYPE_WIN32;
+#else
+        return CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR;
+#endif
+    }
+
+    bool SharedDeviceMemory::map(CUdeviceptr fixedAddress, bool readOnly) {
+        CUDADRV_CHECK(cuMemAddressReserve(&m_devicePointer, m_size, 0, fixedAddress, 0));
+        if (fixedAddress != 0 && m_devicePointer != fixedAddress) {
+            CUDADRV_CHECK(cuMemAddressFree(m_devicePointer, m_size));
+            m_devicePointer = 0;
+            return false;
+        }
+        CUDADRV_CHECK(cuMemMap(m_devicePointer, m_size, 0, m_allocation, 0));
+
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        CUmemAccessDesc accessDesc = {};
+        accessDesc.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        accessDesc.location.id = device;
+        accessDesc.flags = readOnly ? CU_MEM_ACCESS_FLAGS_PROT_READ : CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+        CUDADRV_CHECK(cuMemSetAccess(m_devicePointer, m_size, &accessDesc, 1));
+
+        return true;
+    }
+
+    void SharedDeviceMemory::initialize(CUcontext context, size_t size) {
+        if (m_initialized)
+            throw std::runtime_error("Shared device memory is already initialized.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        CUmemAllocationProp prop = {};
+        prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+        prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+        prop.location.id = device;
+        prop.requestedHandleTypes = getShareableHandleType();
+        size_t granularity;
+        CUDADRV_CHECK(cuMemGetAllocationGranularity(&granularity, &prop, CU_MEM_ALLOC_GRANULARITY_RECOMMENDED));
+        m_size = (size + granularity - 1) / granularity * granularity;
+        CUDADRV_CHECK(cuMemCreate(&m_allocation, m_size, &prop, 0));
+        map(0, false);
+        m_imported = false;
+
+        m_initialized = true;
+    }
+
+    bool SharedDeviceMemory::initializeFromSharedHandle(CUcontext context, const ExternalHandle &handle, size_t size,
+                                                        CUdeviceptr fixedAddress) {
+        if (m_initialized)
+            throw std::runtime_error("Shared device memory is already initialized.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+#if defined(CUDAUPlatform_Windows)
+        void* osHandle = handle.win32Handle;
+#else
+        void* osHandle = reinterpret_cast<void*>(static_cast<uintptr_t>(handle.fd));
+#endif
+        CUDADRV_CHECK(cuMemImportFromShareableHandle(&m_allocation, osHandle, getShareableHandleType()));
+        m_size = size;
+        if (!map(fixedAddress, true)) {
+            CUDADRV_CHECK(cuMemRelease(m_allocation));
+            m_allocation = 0;
+            m_size = 0;
+            m_cuContext = nullptr;
+            return false;
+        }
+        m_imported = true;
+
+        m_initialized = true;
+
+        return true;
+    }
+
+    void SharedDeviceMemory::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuMemUnmap(m_devicePointer, m_size));
+        CUDADRV_CHECK(cuMemAddressFree(m_devicePointer, m_size));
+        CUDADRV_CHECK(cuMemRelease(m_allocation));
+        m_allocation = 0;
+        m_devicePointer = 0;
+        m_size = 0;
+        m_cuContext = nullptr;
+        m_imported = false;
+
+        m_initialized = false;
+    }
+
+    ExternalHandle SharedDeviceMemory::exportHandle() const {
+        if (!m_initialized)
+            throw std::runtime_error("Shared device memory is not initialized.");
+
+        ExternalHandle handle = {};
+#if defined(CUDAUPlatform_Windows)
+        handle.type = ExternalHandleType::OpaqueWin32;
+        CUDADRV_CHECK(cuMemExportToShareableHandle(&handle.win32Handle, m_allocation, getShareableHandleType(), 0));
+        handle.fd = -1;
+#else
+        handle.type = ExternalHandleType::OpaqueFd;
+        CUDADRV_CHECK(cuMemExportToShareableHandle(&handle.fd, m_allocation, getShareableHandleType(), 0));
+        handle.win32Handle = nullptr;
+#endif
+        return handle;
+    }
+
+
+
+    struct MemoryTrackerState {
+        std::mutex mutex;
+        bool enabled = false;
+        uint64_t nextId = 1;
+        std::unordered_map<uint64_t, MemoryTracker::Allocation> liveAllocations;
+        MemoryTracker::Statistics total = {};
+        MemoryTracker::Statistics perCategory[static_cast<uint32_t>(MemoryCategory::NumCategories)] = {};
+    };
+
+    static MemoryTrackerState &getMemoryTrackerState() {
+        static MemoryTrackerState state;
+        return state;
+    }
+
+    static void addToStatistics(MemoryTracker::Statistics &stats, size_t oldSize, size_t newSize) {
+        stats.liveSize = stats.liveSize - oldSize + newSize;
+        stats.highWaterMark = std::max(stats.highWaterMark, stats.liveSize);
+    }
+
+    static const char* getMemoryCategoryName(MemoryCategory category) {
+        static const char* names[] = {
+            "Device", "GL_Interop", "ZeroCopy", "Managed", "StreamOrdered", "VirtualMemory", "External", "WriteCombined",
+            "Array"
+        };
+        return names[static_cast<uint32_t>(category)];
+    }
+
+    void MemoryTracker::setEnabled(bool enable) {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.enabled = enable;
+    }
+
+    bool MemoryTracker::isEnabled() {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.enabled;
+    }
+
+    MemoryTracker::Statistics MemoryTracker::getStatistics() {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.total;
+    }
+
+    MemoryTracker::Statistics MemoryTracker::getStatistics(MemoryCategory category) {
+        if (category >= MemoryCategory::NumCategories)
+            throw std::runtime_error("Invalid memory category.");
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.perCategory[static_cast<uint32_t>(category)];
+    }
+
+    void MemoryTracker::resetHighWaterMarks() {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.total.highWaterMark = state.total.liveSize;
+        for (Statistics &stats : state.perCategory)
+            stats.highWaterMark = stats.liveSize;
+    }
+
+    std::vector<MemoryTracker::Allocation> MemoryTracker::getLiveAllocations() {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::vector<Allocation> ret;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            ret.reserve(state.liveAllocations.size());
+            for (const auto &it : state.liveAllocations)
+                ret.push_back(it.second);
+        }
+        std::sort(ret.begin(), ret.end(), [](const Allocation &a, const Allocation &b) {
+            if (a.size != b.size)
+                return a.size > b.size;
+            return a.id < b.id;
+        });
+        return ret;
+    }
+
+    void MemoryTracker::dump(std::ostream &os) {
+        const std::vector<Allocation> allocations = getLiveAllocations();
+        const Statistics total = getStatistics();
+        os << "Live: " << total.liveSize << " bytes in " << total.numLiveAllocations << " allocations"
+           << " (high-water mark: " << total.highWaterMark << " bytes)\n";
+        for (uint32_t i = 0; i < static_cast<uint32_t>(MemoryCategory::NumCategories); ++i) {
+            const Statistics stats = getStatistics(static_cast<MemoryCategory>(i));
+            if (stats.numTotalAllocations == 0)
+                continue;
+            os << "  " << getMemoryCategoryName(static_cast<MemoryCategory>(i)) << ": "
+               << stats.liveSize << " bytes in " << stats.numLiveAllocations << " allocations"
+               << " (high-water mark: " << stats.highWaterMark << " bytes)\n";
+        }
+        for (const Allocation &alloc : allocations) {
+            os << "  #" << alloc.id << " " << getMemoryCategoryName(alloc.category) << " "
+               << alloc.size << " bytes: " << (alloc.name.empty() ? "(unnamed)" : alloc.name.c_str()) << "\n";
+        }
+    }
+
+    uint64_t MemoryTracker::registerAllocation(MemoryCategory category, size_t size, const std::string &name) {
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!state.enabled)
+            return 0;
+
+        const uint64_t id = state.nextId++;
+        state.liveAllocations[id] = Allocation{ id, category, size, name };
+        Statistics &catStats = state.perCategory[static_cast<uint32_t>(category)];
+        for (Statistics* stats : { &state.total, &catStats }) {
+            addToStatistics(*stats, 0, size);
+            ++stats->numLiveAllocations;
+            ++stats->numTotalAllocations;
+        }
+        return id;
+    }
+
+    void MemoryTracker::updateAllocation(uint64_t id, size_t size) {
+        if (id == 0)
+            return;
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        auto it = state.liveAllocations.find(id);
+        if (it == state.liveAllocations.end())
+            return;
+        Allocation &alloc = it->second;
+        addToStatistics(state.total, alloc.size, size);
+        addToStatistics(state.perCategory[static_cast<uint32_t>(alloc.category)], alloc.size, size);
+        alloc.size = size;
+    }
+
+    void MemoryTracker::setAllocationName(uint64_t id, const std::string &name) {
+        if (id == 0)
+            return;
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        auto it = state.liveAllocations.find(id);
+        if (it != state.liveAllocations.end())
+            it->second.name = name;
+    }
+
+    void MemoryTracker::unregisterAllocation(uint64_t id) {
+        if (id == 0)
+            return;
+        MemoryTrackerState &state = getMemoryTrackerState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        auto it = state.liveAllocations.find(id);
+        if (it == state.liveAllocations.end())
+            return;
+        const Allocation &alloc = it->second;
+        Statistics &catStats = state.perCategory[static_cast<uint32_t>(alloc.category)];
+        for (Statistics* stats : { &state.total, &catStats }) {
+            stats->liveSize -= alloc.size;
+            --stats->numLiveAllocations;
+        }
+        state.liveAllocations.erase(it);
+    }
+
+
+
     Buffer::Buffer() :
         m_cuContext(nullptr),
+        m_numElements(0), m_stride(0), m_capacity(0), m_growthFactor(1.5f),
         m_hostPointer(nullptr), m_devicePointer(0), m_mappedPointer(nullptr), m_mapFlag(BufferMapFlag::ReadWrite),
         m_GLBufferID(0), m_cudaGfxResource(nullptr),
+        m_allocationStream(nullptr), m_memoryPool(nullptr),
+        m_maxNumElements(0), m_reservedSize(0), m_committedSize(0), m_allocationGranularity(0),
+        m_externalMemory(nullptr), m_externalMemoryOffset(0),
+        m_memoryTrackingId(0),
         m_initialized(false), m_persistentMappedMemory(false), m_mapped(false) {
     }
 
@@ -87,16 +1081,30 @@ namespace cudau {
         m_type = b.m_type;
         m_numElements = b.m_numElements;
         m_stride = b.m_stride;
+        m_capacity = b.m_capacity;
+        m_growthFactor = b.m_growthFactor;
         m_hostPointer = b.m_hostPointer;
         m_devicePointer = b.m_devicePointer;
         m_mappedPointer = b.m_mappedPointer;
         m_mapFlag = b.m_mapFlag;
         m_GLBufferID = b.m_GLBufferID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_allocationStream = b.m_allocationStream;
+        m_memoryPool = b.m_memoryPool;
+        m_maxNumElements = b.m_maxNumElements;
+        m_reservedSize = b.m_reservedSize;
+        m_committedSize = b.m_committedSize;
+        m_allocationGranularity = b.m_allocationGranularity;
+        m_physicalChunks = std::move(b.m_physicalChunks);
+        m_externalMemory = b.m_externalMemory;
+        m_externalMemoryOffset = b.m_externalMemoryOffset;
+        m_name = std::move(b.m_name);
+        m_memoryTrackingId = b.m_memoryTrackingId;
         m_initialized = b.m_initialized;
         m_persistentMappedMemory = b.m_persistentMappedMemory;
         m_mapped = b.m_mapped;
 
+        b.m_memoryTrackingId = 0;
         b.m_initialized = false;
     }
 
@@ -107,16 +1115,30 @@ namespace cudau {
         m_type = b.m_type;
         m_numElements = b.m_numElements;
         m_stride = b.m_stride;
+        m_capacity = b.m_capacity;
+        m_growthFactor = b.m_growthFactor;
         m_hostPointer = b.m_hostPointer;
         m_devicePointer = b.m_devicePointer;
         m_mappedPointer = b.m_mappedPointer;
         m_mapFlag = b.m_mapFlag;
         m_GLBufferID = b.m_GLBufferID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_allocationStream = b.m_allocationStream;
+        m_memoryPool = b.m_memoryPool;
+        m_maxNumElements = b.m_maxNumElements;
+        m_reservedSize = b.m_reservedSize;
+        m_committedSize = b.m_committedSize;
+        m_allocationGranularity = b.m_allocationGranularity;
+        m_physicalChunks = std::move(b.m_physicalChunks);
+        m_externalMemory = b.m_externalMemory;
+        m_externalMemoryOffset = b.m_externalMemoryOffset;
+        m_name = std::move(b.m_name);
+        m_memoryTrackingId = b.m_memoryTrackingId;
         m_initialized = b.m_initialized;
         m_persistentMappedMemory = b.m_persistentMappedMemory;
         m_mapped = b.m_mapped;
 
+        b.m_memoryTrackingId = 0;
         b.m_initialized = false;
 
         return *this;
@@ -124,6 +1146,7 @@ namespace cudau {
     
     void Buffer::initialize(CUcontext context, BufferType type,
                             uint32_t numElements, uint32_t stride, uint32_t glBufferID) {
+        CUDAU_NVTX_RANGE("cudau::Buffer::initialize", m_name);
         if (m_initialized)
             throw std::runtime_error("Buffer is already initialized.");
 
@@ -144,6 +1167,7 @@ namespace cudau {
 
         m_numElements = numElements;
         m_stride = stride;
+        m_capacity = numElements;
 
         m_GLBufferID = glBufferID;
 
@@ -152,6 +1176,34 @@ namespace cudau {
         if (m_type == BufferType::Device) {
             CUDADRV_CHECK(cuMemAlloc(&m_devicePointer, size));
         }
+        else if (m_type == BufferType::StreamOrdered) {
+            if (m_memoryPool)
+                CUDADRV_CHECK(cuMemAllocFromPoolAsync(&m_devicePointer, size, m_memoryPool, m_allocationStream));
+            else
+                CUDADRV_CHECK(cuMemAllocAsync(&m_devicePointer, size, m_allocationStream));
+        }
+        else if (m_type == BufferType::VirtualMemory) {
+            CUdevice device;
+            CUDADRV_CHECK(cuCtxGetDevice(&device));
+            CUmemAllocationProp prop = {};
+            prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+            prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+            prop.location.id = device;
+            CUDADRV_CHECK(cuMemGetAllocationGranularity(&m_allocationGranularity, &prop,
+                                                        CU_MEM_ALLOC_GRANULARITY_MINIMUM));
+            const size_t maxSize = static_cast<size_t>(m_maxNumElements) * m_stride;
+            m_reservedSize = (maxSize + m_allocationGranularity - 1) / m_allocationGranularity * m_allocationGranularity;
+            CUDADRV_CHECK(cuMemAddressReserve(&m_devicePointer, m_reservedSize, 0, 0, 0));
+            m_committedSize = 0;
+            commitVirtualMemory(size);
+            m_capacity = static_cast<uint32_t>(std::min<size_t>(m_committedSize / m_stride, m_maxNumElements));
+        }
+        else if (m_type == BufferType::External) {
+            CUDA_EXTERNAL_MEMORY_BUFFER_DESC bufferDesc = {};
+            bufferDesc.offset = m_externalMemoryOffset;
+            bufferDesc.size = size;
+            CUDADRV_CHECK(cuExternalMemoryGetMappedBuffer(&m_devicePointer, m_externalMemory, &bufferDesc));
+        }
         else  if (m_type == BufferType::GL_Interop) {
 #if defined(CUDA_UTIL_USE_GL_INTEROP)
             CUDADRV_CHECK(cuGraphicsGLRegisterBuffer(&m_cudaGfxResource, m_GLBufferID, CU_GRAPHICS_REGISTER_FLAGS_NONE));
@@ -159,8 +1211,11 @@ namespace cudau {
             throw std::runtime_error("Enable \"CUDA_UTIL_USE_GL_INTEROP\" at the top of the header if you use CUDA/OpenGL interoperability.");
 #endif
         }
-        else if (m_type == BufferType::ZeroCopy) {
-            CUDADRV_CHECK(cuMemHostAlloc(&m_hostPointer, size, CU_MEMHOSTALLOC_PORTABLE | CU_MEMHOSTALLOC_DEVICEMAP));
+        else if (m_type == BufferType::ZeroCopy || m_type == BufferType::WriteCombined) {
+            uint32_t flags = CU_MEMHOSTALLOC_PORTABLE | CU_MEMHOSTALLOC_DEVICEMAP;
+            if (m_type == BufferType::WriteCombined)
+                flags |= CU_MEMHOSTALLOC_WRITECOMBINED;
+            CUDADRV_CHECK(cuMemHostAlloc(&m_hostPointer, size, flags));
             CUDADRV_CHECK(cuMemHostGetDevicePointer(&m_devicePointer, m_hostPointer, 0));
         }
         else { // m_type == BufferType::Managed
@@ -168,9 +1223,28 @@ namespace cudau {
             m_hostPointer = reinterpret_cast<void*>(m_devicePointer);
         }
 
+        m_memoryTrackingId = MemoryTracker::registerAllocation(
+            static_cast<MemoryCategory>(m_type),
+            m_type == BufferType::VirtualMemory ? m_committedSize : size,
+            m_name);
+
         m_initialized = true;
     }
 
+    void Buffer::initializeFromExternalMemory(CUcontext context, const ExternalHandle &handle,
+                                              size_t memorySize, uint64_t offset,
+                                              uint32_t numElements, uint32_t stride, bool dedicated) {
+        if (m_initialized)
+            throw std::runtime_error("Buffer is already initialized.");
+        if (offset + static_cast<uint64_t>(numElements) * stride > memorySize)
+            throw std::runtime_error("The range exceeds the external memory.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(context));
+        m_externalMemory = importExternalMemory(handle, memorySize, dedicated);
+        m_externalMemoryOffset = offset;
+        initialize(context, BufferType::External, numElements, stride, 0);
+    }
+
     void Buffer::finalize() {
         if (!m_initialized)
             return;
@@ -180,7 +1254,9 @@ namespace cudau {
         if (m_mapped)
             unmap();
 
-        if ((m_type == BufferType::Device || m_type == BufferType::GL_Interop) &&
+        if ((m_type == BufferType::Device || m_type == BufferType::StreamOrdered ||
+             m_type == BufferType::VirtualMemory || m_type == BufferType::External ||
+             m_type == BufferType::GL_Interop) &&
             m_persistentMappedMemory)
             releaseHostMem(m_mappedPointer);
         m_mappedPointer = nullptr;
@@ -190,11 +1266,29 @@ namespace cudau {
             CUDADRV_CHECK(cuMemFree(m_devicePointer));
             m_devicePointer = 0;
         }
+        else if (m_type == BufferType::StreamOrdered) {
+            CUDADRV_CHECK(cuMemFreeAsync(m_devicePointer, m_allocationStream));
+            m_devicePointer = 0;
+        }
+        else if (m_type == BufferType::VirtualMemory) {
+            commitVirtualMemory(0);
+            CUDADRV_CHECK(cuMemAddressFree(m_devicePointer, m_reservedSize));
+            m_devicePointer = 0;
+            m_reservedSize = 0;
+            m_maxNumElements = 0;
+        }
+        else if (m_type == BufferType::External) {
+            CUDADRV_CHECK(cuMemFree(m_devicePointer));
+            CUDADRV_CHECK(cuDestroyExternalMemory(m_externalMemory));
+            m_devicePointer = 0;
+            m_externalMemory = nullptr;
+            m_externalMemoryOffset = 0;
+        }
         else if (m_type == BufferType::GL_Interop) {
             CUDADRV_CHECK(cuGraphicsUnregisterResource(m_cudaGfxResource));
             m_devicePointer = 0;
         }
-        else if (m_type == BufferType::ZeroCopy) {
+        else if (m_type == BufferType::ZeroCopy || m_type == BufferType::WriteCombined) {
             CUDADRV_CHECK(cuMemFreeHost(m_hostPointer));
             m_devicePointer = 0;
             m_hostPointer = nullptr;
@@ -205,28 +1299,96 @@ namespace cudau {
             m_hostPointer = nullptr;
         }
 
+        m_capacity = 0;
         m_stride = 0;
         m_numElements = 0;
 
         m_cuContext = nullptr;
 
+        MemoryTracker::unregisterAllocation(m_memoryTrackingId);
+        m_memoryTrackingId = 0;
+
         m_initialized = false;
     }
 
+    void Buffer::setName(const std::string &name) {
+        m_name = name;
+        MemoryTracker::setAllocationName(m_memoryTrackingId, m_name);
+    }
+
     void Buffer::resize(uint32_t numElements, uint32_t stride, CUstream stream) {
         if (!m_initialized)
             throw std::runtime_error("Buffer is not initialized.");
-        if (m_type == BufferType::GL_Interop)
-            throw std::runtime_error("Resize for GL-interop buffer is not supported.");
+        if (m_type == BufferType::GL_Interop || m_type == BufferType::External)
+            throw std::runtime_error("Resize for GL-interop or external buffer is not supported.");
         if (stride < m_stride)
             throw std::runtime_error("New stride must be >= the current stride.");
 
-        if (numElements == m_numElements && stride == m_stride)
+        if (stride == m_stride && numElements <= m_capacity) {
+            m_numElements = numElements;
+            return;
+        }
+
+        uint32_t capacity = numElements;
+        if (stride == m_stride) {
+            const double grownCapacity = static_cast<double>(m_capacity) * m_growthFactor;
+            capacity = static_cast<uint32_t>(std::min<double>(std::max<double>(grownCapacity, numElements),
+                                                              UINT32_MAX));
+        }
+        reallocate(capacity, numElements, stride, stream);
+    }
+
+    void Buffer::reserve(uint32_t numElements, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Buffer is not initialized.");
+        if (m_type == BufferType::GL_Interop || m_type == BufferType::External)
+            throw std::runtime_error("Reserve for GL-interop or external buffer is not supported.");
+        if (numElements <= m_capacity)
+            return;
+
+        reallocate(numElements, m_numElements, m_stride, stream);
+    }
+
+    void Buffer::shrinkToFit(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Buffer is not initialized.");
+        if (m_type == BufferType::GL_Interop || m_type == BufferType::External || m_capacity == m_numElements)
+            return;
+
+        reallocate(m_numElements, m_numElements, m_stride, stream);
+    }
+
+    void Buffer::reallocate(uint32_t capacity, uint32_t numElements, uint32_t stride, CUstream stream) {
+        CUDAU_NVTX_RANGE("cudau::Buffer::reallocate", m_name);
+        // JP: 仮想メモリーの場合は物理メモリーのマップを増減するだけでポインターが変わらない。
+        // EN: For virtual memory, just increase or decrease the physical memory mapping,
+        //     so the pointer doesn't change.
+        if (m_type == BufferType::VirtualMemory) {
+            if (stride != m_stride)
+                throw std::runtime_error("Stride of a virtual memory buffer cannot be changed.");
+            if (numElements > m_maxNumElements)
+                throw std::runtime_error("Number of elements exceeds the reserved range.");
+            capacity = std::min(capacity, m_maxNumElements);
+            commitVirtualMemory(static_cast<size_t>(capacity) * m_stride);
+            m_capacity = static_cast<uint32_t>(std::min<size_t>(m_committedSize / m_stride, m_maxNumElements));
+            m_numElements = numElements;
+            if (m_persistentMappedMemory && !m_mapped) {
+                releaseHostMem(m_mappedPointer);
+                m_mappedPointer = allocHostMem(static_cast<size_t>(m_capacity) * m_stride);
+            }
             return;
+        }
 
         Buffer newBuffer;
-        newBuffer.initialize(m_cuContext, m_type, numElements, stride, m_GLBufferID);
+        newBuffer.m_allocationStream = stream;
+        newBuffer.m_memoryPool = m_memoryPool;
+        newBuffer.m_name = m_name;
+        newBuffer.initialize(m_cuContext, m_type, capacity, stride, m_GLBufferID);
+        newBuffer.m_growthFactor = m_growthFactor;
+        // JP: 永続マップ用のホストメモリーは容量分確保される。
+        // EN: Host memory for persistent mapping is allocated for the capacity.
         newBuffer.setMappedMemoryPersistent(m_persistentMappedMemory);
+        newBuffer.m_numElements = numElements;
 
         uint32_t numElementsToCopy = std::min(m_numElements, numElements);
         if (stride == m_stride) {
@@ -237,16 +1399,61 @@ namespace cudau {
             auto src = map<const uint8_t>(stream, BufferMapFlag::ReadOnly);
             auto dst = newBuffer.map<uint8_t>(stream, BufferMapFlag::WriteOnlyDiscard);
             for (uint32_t i = 0; i < numElementsToCopy; ++i) {
-                std::memset(dst, 0, stride);
-                std::memcpy(dst, src, m_stride);
+                std::memset(dst + static_cast<size_t>(stride) * i, 0, stride);
+                std::memcpy(dst + static_cast<size_t>(stride) * i, src + static_cast<size_t>(m_stride) * i, m_stride);
             }
             newBuffer.unmap(stream);
             unmap(stream);
         }
 
+        // JP: ストリーム順のバッファーの場合、古い領域はコピーと同じストリーム上で解放する。
+        // EN: For a stream-ordered buffer, free the old memory on the same stream as the copy.
+        m_allocationStream = stream;
         *this = std::move(newBuffer);
     }
 
+    void Buffer::commitVirtualMemory(size_t size) {
+        const size_t alignedSize =
+            (size + m_allocationGranularity - 1) / m_allocationGranularity * m_allocationGranularity;
+
+        // JP: 必要なサイズを超える末尾のチャンクを解放する。
+        // EN: Release trailing chunks beyond the required size.
+        while (!m_physicalChunks.empty() &&
+               m_committedSize - m_physicalChunks.back().size >= alignedSize) {
+            const PhysicalMemoryChunk &chunk = m_physicalChunks.back();
+            m_committedSize -= chunk.size;
+            CUDADRV_CHECK(cuMemUnmap(m_devicePointer + m_committedSize, chunk.size));
+            CUDADRV_CHECK(cuMemRelease(chunk.handle));
+            m_physicalChunks.pop_back();
+        }
+
+        // JP: 不足分を一つのチャンクとして確保し、予約済みの範囲の続きにマップする。
+        // EN: Allocate the shortage as a single chunk and map it following the reserved range.
+        if (alignedSize > m_committedSize) {
+            CUdevice device;
+            CUDADRV_CHECK(cuCtxGetDevice(&device));
+            CUmemAllocationProp prop = {};
+            prop.type = CU_MEM_ALLOCATION_TYPE_PINNED;
+            prop.location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+            prop.location.id = device;
+
+            PhysicalMemoryChunk chunk;
+            chunk.size = alignedSize - m_committedSize;
+            CUDADRV_CHECK(cuMemCreate(&chunk.handle, chunk.size, &prop, 0));
+            CUDADRV_CHECK(cuMemMap(m_devicePointer + m_committedSize, chunk.size, 0, chunk.handle, 0));
+
+            CUmemAccessDesc accessDesc = {};
+            accessDesc.location = prop.location;
+            accessDesc.flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+            CUDADRV_CHECK(cuMemSetAccess(m_devicePointer + m_committedSize, chunk.size, &accessDesc, 1));
+
+            m_committedSize += chunk.size;
+            m_physicalChunks.push_back(chunk);
+        }
+
+        MemoryTracker::updateAllocation(m_memoryTrackingId, m_committedSize);
+    }
+
     void Buffer::beginCUDAAccess(CUstream stream) {
         if (m_type != BufferType::GL_Interop)
             throw std::runtime_error("This is not an OpenGL-interop buffer.");
@@ -267,14 +1474,52 @@ namespace cudau {
         CUDADRV_CHECK(cuGraphicsUnmapResources(1, &m_cudaGfxResource, stream));
     }
 
+    void Buffer::prefetchRange(uint32_t firstElement, uint32_t numElements, CUstream stream, CUdevice device) const {
+        if (m_type != BufferType::Managed)
+            throw std::runtime_error("Prefetch is only available for managed buffers.");
+        if (static_cast<uint64_t>(firstElement) + numElements > m_numElements)
+            throw std::runtime_error("Range is out of the buffer.");
+        if (numElements == 0)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuMemPrefetchAsync(getCUdeviceptrAt(firstElement),
+                                         static_cast<size_t>(numElements) * m_stride, device, stream));
+    }
+
+    void Buffer::adviseRange(uint32_t firstElement, uint32_t numElements,
+                             MemoryAdvice advice, CUdevice device, bool set) const {
+        if (m_type != BufferType::Managed)
+            throw std::runtime_error("Advice is only available for managed buffers.");
+        if (static_cast<uint64_t>(firstElement) + numElements > m_numElements)
+            throw std::runtime_error("Range is out of the buffer.");
+        if (numElements == 0)
+            return;
+
+        CUmem_advise cuAdvice;
+        if (advice == MemoryAdvice::ReadMostly)
+            cuAdvice = set ? CU_MEM_ADVISE_SET_READ_MOSTLY : CU_MEM_ADVISE_UNSET_READ_MOSTLY;
+        else if (advice == MemoryAdvice::PreferredLocation)
+            cuAdvice = set ? CU_MEM_ADVISE_SET_PREFERRED_LOCATION : CU_MEM_ADVISE_UNSET_PREFERRED_LOCATION;
+        else // advice == MemoryAdvice::AccessedBy
+            cuAdvice = set ? CU_MEM_ADVISE_SET_ACCESSED_BY : CU_MEM_ADVISE_UNSET_ACCESSED_BY;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuMemAdvise(getCUdeviceptrAt(firstElement),
+                                  static_cast<size_t>(numElements) * m_stride, cuAdvice, device));
+    }
+
     void Buffer::setMappedMemoryPersistent(bool b) {
         if (m_type != BufferType::Device &&
+            m_type != BufferType::StreamOrdered &&
+            m_type != BufferType::VirtualMemory &&
+            m_type != BufferType::External &&
             m_type != BufferType::GL_Interop)
             return;
 
         m_persistentMappedMemory = b;
         if (m_persistentMappedMemory && !m_mapped) {
-            size_t size = static_cast<size_t>(m_numElements) * m_stride;
+            size_t size = static_cast<size_t>(m_capacity) * m_stride;
             m_mappedPointer = allocHostMem(size);
         }
         if (!m_persistentMappedMemory && !m_mapped) {
@@ -291,6 +1536,9 @@ namespace cudau {
         m_mapFlag = flag;
 
         if (m_type == BufferType::Device ||
+            m_type == BufferType::StreamOrdered ||
+            m_type == BufferType::VirtualMemory ||
+            m_type == BufferType::External ||
             m_type == BufferType::GL_Interop) {
             CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
@@ -311,6 +1559,12 @@ namespace cudau {
             return m_mappedPointer;
         }
         else {
+            // JP: ゼロコピーのバッファーは先行するGPUの処理の結果が見えるようにストリームを同期する。
+            // EN: Synchronize the stream for a zero-copy buffer so that results of preceding GPU work are visible.
+            if (m_type == BufferType::ZeroCopy && m_mapFlag != BufferMapFlag::WriteOnlyDiscard) {
+                CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+                CUDADRV_CHECK(cuStreamSynchronize(stream));
+            }
             return m_hostPointer;
         }
     }
@@ -322,6 +1576,9 @@ namespace cudau {
         m_mapped = false;
 
         if (m_type == BufferType::Device ||
+            m_type == BufferType::StreamOrdered ||
+            m_type == BufferType::VirtualMemory ||
+            m_type == BufferType::External ||
             m_type == BufferType::GL_Interop) {
             CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
@@ -330,37 +1587,254 @@ namespace cudau {
             if (m_mapFlag != BufferMapFlag::ReadOnly)
                 CUDADRV_CHECK(cuMemcpyHtoDAsync(m_devicePointer, m_mappedPointer, size, stream));
 
-            if (m_type == BufferType::GL_Interop)
-                endCUDAAccess(stream);
+            if (m_type == BufferType::GL_Interop)
+                endCUDAAccess(stream);
+
+            if (!m_persistentMappedMemory) {
+                releaseHostMem(m_mappedPointer);
+                m_mappedPointer = nullptr;
+            }
+        }
+        else if (m_type == BufferType::WriteCombined) {
+            // JP: 書き込み結合バッファーに溜まった書き込みを後続のGPUの処理の前に吐き出す。
+            // EN: Flush writes pending in write-combining buffers before subsequent GPU work.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    Buffer Buffer::copy(CUstream stream) const {
+        if (m_GLBufferID != 0)
+            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+
+        // JP: 外部メモリーのコピーは通常のデバイスメモリーとして確保する。
+        // EN: A copy of external memory is allocated as regular device memory.
+        const BufferType type = m_type == BufferType::External ? BufferType::Device : m_type;
+        Buffer ret;
+        ret.m_allocationStream = stream;
+        ret.m_memoryPool = m_memoryPool;
+        ret.m_maxNumElements = m_maxNumElements;
+        ret.initialize(m_cuContext, type, m_numElements, m_stride, m_GLBufferID);
+        ret.m_growthFactor = m_growthFactor;
+        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        size_t size = static_cast<size_t>(m_numElements) * m_stride;
+        if (m_type == BufferType::Device || m_type == BufferType::StreamOrdered ||
+            m_type == BufferType::VirtualMemory || m_type == BufferType::External ||
+            m_type == BufferType::ZeroCopy || m_type == BufferType::WriteCombined) {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            // JP: マップされたホストメモリーもデバイスポインターを介してコピーできる。
+            // EN: Mapped host memory can also be copied via the device pointers.
+            CUDADRV_CHECK(cuMemcpyDtoDAsync(ret.m_devicePointer, m_devicePointer, size, stream));
+        }
+        else {
+            // TODO: Test copy with stream.
+            CUDAUAssert_NotImplemented();
+            std::memcpy(ret.m_hostPointer, m_hostPointer, size);
+        }
+
+        return ret;
+    }
+
+    Buffer Buffer::copyTo(CUcontext targetContext, CUstream stream) const {
+        if (m_GLBufferID != 0)
+            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+
+        // JP: メモリープールはデバイスごとなので引き継がずにデフォルトプールを使う。
+        // EN: Use the default pool without inheriting the memory pool since it is per device.
+        const BufferType type = m_type == BufferType::External ? BufferType::Device : m_type;
+        Buffer ret;
+        ret.m_allocationStream = stream;
+        ret.m_maxNumElements = m_maxNumElements;
+        ret.initialize(targetContext, type, m_numElements, m_stride, 0);
+        ret.m_growthFactor = m_growthFactor;
+        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+
+        copyAcrossContexts(ret.m_devicePointer, targetContext, m_devicePointer, m_cuContext, sizeInBytes(), stream);
+
+        return ret;
+    }
+
+
+
+    DeviceMemoryArena::DeviceMemoryArena() :
+        m_cuContext(nullptr), m_slabSize(0), m_alignment(1),
+        m_initialized(false) {
+    }
+
+    DeviceMemoryArena::~DeviceMemoryArena() {
+        if (m_initialized)
+            finalize();
+    }
+
+    void DeviceMemoryArena::initialize(CUcontext context, size_t slabSize, uint32_t alignment) {
+        if (m_initialized)
+            throw std::runtime_error("Arena is already initialized.");
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+            throw std::runtime_error("Alignment must be a power of two.");
+
+        m_cuContext = context;
+        m_alignment = alignment;
+        m_slabSize = (slabSize + m_alignment - 1) / m_alignment * m_alignment;
+
+        m_initialized = true;
+    }
+
+    void DeviceMemoryArena::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (int i = static_cast<int>(m_slabs.size()) - 1; i >= 0; --i) {
+            if (m_slabs[i].devicePointer)
+                CUDADRV_CHECK(cuMemFree(m_slabs[i].devicePointer));
+        }
+        m_slabs.clear();
+
+        m_slabSize = 0;
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    bool DeviceMemoryArena::allocateFromSlab(uint32_t slabIndex, size_t size, Allocation* alloc) {
+        Slab &slab = m_slabs[slabIndex];
+        for (auto it = slab.freeBlocks.begin(); it != slab.freeBlocks.end(); ++it) {
+            if (it->size < size)
+                continue;
+
+            alloc->devicePointer = slab.devicePointer + it->offset;
+            alloc->size = size;
+            alloc->slabIndex = slabIndex;
+            alloc->offset = it->offset;
+
+            it->offset += size;
+            it->size -= size;
+            if (it->size == 0)
+                slab.freeBlocks.erase(it);
+
+            slab.usedSize += size;
+            ++slab.numAllocations;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    DeviceMemoryArena::Allocation DeviceMemoryArena::allocate(size_t size) {
+        if (!m_initialized)
+            throw std::runtime_error("Arena is not initialized.");
+
+        Allocation ret;
+        if (size == 0)
+            return ret;
+
+        size = (size + m_alignment - 1) / m_alignment * m_alignment;
+
+        for (uint32_t slabIdx = 0; slabIdx < m_slabs.size(); ++slabIdx) {
+            if (m_slabs[slabIdx].devicePointer == 0)
+                continue;
+            if (allocateFromSlab(slabIdx, size, &ret))
+                return ret;
+        }
+
+        // JP: スラブサイズより大きな要求に対しては専用のスラブを確保する。
+        //     trim()で解放されたスラブのインデックスは再利用する。
+        // EN: Allocate a dedicated slab for a request larger than the slab size.
+        //     Reuse the index of a slab released by trim().
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Slab newSlab;
+        newSlab.size = std::max(m_slabSize, size);
+        CUDADRV_CHECK(cuMemAlloc(&newSlab.devicePointer, newSlab.size));
+        if (newSlab.devicePointer % m_alignment != 0) {
+            CUDADRV_CHECK(cuMemFree(newSlab.devicePointer));
+            throw std::runtime_error("Allocated slab does not satisfy the alignment.");
+        }
+        newSlab.usedSize = 0;
+        newSlab.numAllocations = 0;
+        newSlab.freeBlocks.push_back(FreeBlock{ 0, newSlab.size });
+
+        uint32_t slabIdx = 0;
+        for (; slabIdx < m_slabs.size(); ++slabIdx) {
+            if (m_slabs[slabIdx].devicePointer == 0)
+                break;
+        }
+        if (slabIdx < m_slabs.size())
+            m_slabs[slabIdx] = std::move(newSlab);
+        else
+            m_slabs.push_back(std::move(newSlab));
+
+        allocateFromSlab(slabIdx, size, &ret);
+
+        return ret;
+    }
 
-            if (!m_persistentMappedMemory) {
-                releaseHostMem(m_mappedPointer);
-                m_mappedPointer = nullptr;
+    void DeviceMemoryArena::release(const Allocation &alloc) {
+        if (!alloc.isValid())
+            return;
+        if (alloc.slabIndex >= m_slabs.size() ||
+            m_slabs[alloc.slabIndex].devicePointer + alloc.offset != alloc.devicePointer)
+            throw std::runtime_error("The allocation does not belong to this arena.");
+
+        Slab &slab = m_slabs[alloc.slabIndex];
+        auto it = std::lower_bound(slab.freeBlocks.begin(), slab.freeBlocks.end(), alloc.offset,
+                                   [](const FreeBlock &block, size_t offset) {
+                                       return block.offset < offset;
+                                   });
+        it = slab.freeBlocks.insert(it, FreeBlock{ alloc.offset, alloc.size });
+
+        // JP: 隣接する空き領域と結合する。
+        // EN: Merge with adjacent free regions.
+        auto next = it + 1;
+        if (next != slab.freeBlocks.end() && it->offset + it->size == next->offset) {
+            it->size += next->size;
+            slab.freeBlocks.erase(next);
+        }
+        if (it != slab.freeBlocks.begin()) {
+            auto prev = it - 1;
+            if (prev->offset + prev->size == it->offset) {
+                prev->size += it->size;
+                slab.freeBlocks.erase(it);
             }
         }
-    }
 
-    Buffer Buffer::copy(CUstream stream) const {
-        if (m_GLBufferID != 0)
-            throw std::runtime_error("Copying OpenGL buffer is not supported.");
+        slab.usedSize -= alloc.size;
+        --slab.numAllocations;
+    }
 
-        Buffer ret;
-        ret.initialize(m_cuContext, m_type, m_numElements, m_stride, m_GLBufferID);
-        ret.setMappedMemoryPersistent(m_persistentMappedMemory);
+    void DeviceMemoryArena::trim() {
+        if (!m_initialized)
+            return;
 
-        size_t size = static_cast<size_t>(m_numElements) * m_stride;
-        if (m_type == BufferType::Device) {
-            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
 
-            CUDADRV_CHECK(cuMemcpyDtoDAsync(ret.m_devicePointer, m_devicePointer, size, stream));
-        }
-        else {
-            // TODO: Test copy with stream.
-            CUDAUAssert_NotImplemented();
-            std::memcpy(ret.m_hostPointer, m_hostPointer, size);
+        for (Slab &slab : m_slabs) {
+            if (slab.devicePointer == 0 || slab.numAllocations > 0)
+                continue;
+            CUDADRV_CHECK(cuMemFree(slab.devicePointer));
+            slab.devicePointer = 0;
+            slab.size = 0;
+            slab.freeBlocks.clear();
         }
+        while (!m_slabs.empty() && m_slabs.back().devicePointer == 0)
+            m_slabs.pop_back();
+    }
 
-        return ret;
+    void DeviceMemoryArena::getStats(Stats* stats) const {
+        *stats = Stats{};
+        for (const Slab &slab : m_slabs) {
+            if (slab.devicePointer == 0)
+                continue;
+            ++stats->numSlabs;
+            stats->numAllocations += slab.numAllocations;
+            stats->reservedSize += slab.size;
+            stats->usedSize += slab.usedSize;
+            for (const FreeBlock &block : slab.freeBlocks)
+                stats->largestFreeBlockSize = std::max(stats->largestFreeBlockSize, block.size);
+        }
     }
 
 
@@ -487,6 +1961,8 @@ namespace cudau {
         m_array(0), m_mappedPointers(nullptr), m_mappedArrays(nullptr), m_surfObjs(nullptr),
         m_mapFlag(BufferMapFlag::ReadWrite),
         m_GLTexID(0), m_cudaGfxResource(nullptr),
+        m_externalMemory(nullptr), m_externalMipmappedArray(nullptr), m_externalMemoryOffset(0),
+        m_memoryTrackingId(0),
         m_surfaceLoadStore(false), m_cubemap(false), m_layered(false),
         m_initialized(false) {
     }
@@ -515,12 +1991,18 @@ namespace cudau {
         m_mapFlag = b.m_mapFlag;
         m_GLTexID = b.m_GLTexID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_externalMemory = b.m_externalMemory;
+        m_externalMipmappedArray = b.m_externalMipmappedArray;
+        m_externalMemoryOffset = b.m_externalMemoryOffset;
+        m_name = std::move(b.m_name);
+        m_memoryTrackingId = b.m_memoryTrackingId;
         m_surfaceLoadStore = b.m_surfaceLoadStore;
         m_useTextureGather = b.m_useTextureGather;
         m_cubemap = b.m_cubemap;
         m_layered = b.m_layered;
         m_initialized = b.m_initialized;
 
+        b.m_memoryTrackingId = 0;
         b.m_initialized = false;
     }
 
@@ -545,12 +2027,18 @@ namespace cudau {
         m_mapFlag = b.m_mapFlag;
         m_GLTexID = b.m_GLTexID;
         m_cudaGfxResource = b.m_cudaGfxResource;
+        m_externalMemory = b.m_externalMemory;
+        m_externalMipmappedArray = b.m_externalMipmappedArray;
+        m_externalMemoryOffset = b.m_externalMemoryOffset;
+        m_name = std::move(b.m_name);
+        m_memoryTrackingId = b.m_memoryTrackingId;
         m_surfaceLoadStore = b.m_surfaceLoadStore;
         m_useTextureGather = b.m_useTextureGather;
         m_cubemap = b.m_cubemap;
         m_layered = b.m_layered;
         m_initialized = b.m_initialized;
 
+        b.m_memoryTrackingId = 0;
         b.m_initialized = false;
 
         return *this;
@@ -559,6 +2047,7 @@ namespace cudau {
     void Array::initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
                            uint32_t width, uint32_t height, uint32_t depth, uint32_t numMipmapLevels,
                            bool surfaceLoadStore, bool useTextureGather, bool cubemap, bool layered, uint32_t glTexID) {
+        CUDAU_NVTX_RANGE("cudau::Array::initialize", m_name);
         if (m_initialized)
             throw std::runtime_error("Array is already initialized.");
         if (numChannels != 1 && numChannels != 2 && numChannels != 4)
@@ -669,6 +2158,18 @@ namespace cudau {
             throw std::runtime_error("Enable \"CUDA_UTIL_USE_GL_INTEROP\" at the top of the header if you use CUDA/OpenGL interoperability.");
 #endif
         }
+        else if (m_externalMemory) {
+            CUDA_EXTERNAL_MEMORY_MIPMAPPED_ARRAY_DESC mipmapDesc = {};
+            mipmapDesc.offset = m_externalMemoryOffset;
+            mipmapDesc.arrayDesc = arrayDesc;
+            mipmapDesc.numLevels = m_numMipmapLevels;
+            CUDADRV_CHECK(cuExternalMemoryGetMappedMipmappedArray(&m_externalMipmappedArray, m_externalMemory,
+                                                                  &mipmapDesc));
+            if (m_numMipmapLevels > 1)
+                m_mipmappedArray = m_externalMipmappedArray;
+            else
+                CUDADRV_CHECK(cuMipmappedArrayGetLevel(&m_array, m_externalMipmappedArray, 0));
+        }
         else {
             if (m_numMipmapLevels > 1)
                 CUDADRV_CHECK(cuMipmappedArrayCreate(&m_mipmappedArray, &arrayDesc, numMipmapLevels));
@@ -702,9 +2203,64 @@ namespace cudau {
             }
         }
 
+        // JP: ミップチェーン全体の大きさを概算する。実際の確保にはアラインメントによる余剰がある。
+        // EN: Estimate the size of the whole mip chain. The actual allocation has extra due to alignment.
+        size_t arraySize = 0;
+        for (uint32_t level = 0; level < m_numMipmapLevels; ++level) {
+            const size_t levelWidth = std::max<size_t>(1, m_width >> level);
+            const size_t levelHeight = std::max<size_t>(1, m_height >> level);
+            const size_t levelDepth = (m_layered || m_cubemap) ?
+                std::max<size_t>(1, m_depth) :
+                std::max<size_t>(1, m_depth >> level);
+            arraySize += levelWidth * levelHeight * levelDepth * m_stride;
+        }
+        m_memoryTrackingId = MemoryTracker::registerAllocation(MemoryCategory::Array, arraySize, m_name);
+
         m_initialized = true;
     }
 
+    void Array::initializeFromExternalMemory2D(CUcontext context, const ExternalHandle &handle,
+                                               size_t memorySize, uint64_t offset,
+                                               ArrayElementType elemType, uint32_t numChannels,
+                                               ArraySurface surfaceLoadStore, ArrayTextureGather useTextureGather,
+                                               uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                               bool dedicated) {
+        if (m_initialized)
+            throw std::runtime_error("Array is already initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(context));
+        m_externalMemory = importExternalMemory(handle, memorySize, dedicated);
+        m_externalMemoryOffset = offset;
+        initialize(context, elemType, numChannels, width, height, 0, numMipmapLevels,
+                   surfaceLoadStore == ArraySurface::Enable,
+                   useTextureGather == ArrayTextureGather::Enable,
+                   false, false, 0);
+    }
+
+    void Array::generateMipmaps(CUstream stream, const Kernel &downsampleKernel,
+                                MipmapFilter filter, bool sRGB) const {
+        CUDAU_NVTX_RANGE("cudau::Array::generateMipmaps", m_name);
+        if (!m_initialized)
+            throw std::runtime_error("Array is not initialized.");
+        if (!m_surfaceLoadStore)
+            throw std::runtime_error("Surface load/store is required for mipmap generation.");
+        if (m_height == 0 || m_depth > 0 || m_cubemap || m_layered || m_GLTexID != 0)
+            throw std::runtime_error("Mipmap generation is only supported for non-interop 2D arrays.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (uint32_t level = 1; level < m_numMipmapLevels; ++level) {
+            const uint32_t srcWidth = std::max<uint32_t>(1, m_width >> (level - 1));
+            const uint32_t srcHeight = std::max<uint32_t>(1, m_height >> (level - 1));
+            const uint32_t dstWidth = std::max<uint32_t>(1, m_width >> level);
+            const uint32_t dstHeight = std::max<uint32_t>(1, m_height >> level);
+            downsampleKernel(stream, downsampleKernel.calcGridDim(dstWidth, dstHeight),
+                             getSurfaceObject(level - 1), srcWidth, srcHeight,
+                             getSurfaceObject(level), dstWidth, dstHeight,
+                             filter, static_cast<uint32_t>(sRGB));
+        }
+    }
+
     void Array::finalize() {
         if (!m_initialized)
             return;
@@ -726,6 +2282,13 @@ namespace cudau {
             CUDADRV_CHECK(cuGraphicsUnregisterResource(m_cudaGfxResource));
             m_GLTexID = 0;
         }
+        else if (m_externalMemory) {
+            CUDADRV_CHECK(cuMipmappedArrayDestroy(m_externalMipmappedArray));
+            CUDADRV_CHECK(cuDestroyExternalMemory(m_externalMemory));
+            m_externalMipmappedArray = nullptr;
+            m_externalMemory = nullptr;
+            m_externalMemoryOffset = 0;
+        }
         else {
             if (m_numMipmapLevels > 1)
                 CUDADRV_CHECK(cuMipmappedArrayDestroy(m_mipmappedArray));
@@ -733,56 +2296,129 @@ namespace cudau {
                 CUDADRV_CHECK(cuArrayDestroy(m_array));
         }
 
+        MemoryTracker::unregisterAllocation(m_memoryTrackingId);
+        m_memoryTrackingId = 0;
+
         m_initialized = false;
     }
 
-    void Array::resize(uint32_t length, CUstream stream) {
-        if (m_height > 0 || m_depth > 0)
-            throw std::runtime_error("Array dimension cannot be changed.");
-        CUDAUAssert_NotImplemented();
+    void Array::setName(const std::string &name) {
+        m_name = name;
+        MemoryTracker::setAllocationName(m_memoryTrackingId, m_name);
     }
 
-    void Array::resize(uint32_t width, uint32_t height, CUstream stream) {
-        if (m_depth > 0)
-            throw std::runtime_error("Array dimension cannot be changed.");
-        if (m_numMipmapLevels > 1)
-            throw std::runtime_error("resize() is supported only on non-mipmapped array.");
-        
-        if (width == m_width && height == m_height)
+    void Array::resizeImpl(uint32_t width, uint32_t height, uint32_t depth, CUstream stream) {
+        CUDAU_NVTX_RANGE("cudau::Array::resize", m_name);
+        if (!m_initialized)
+            throw std::runtime_error("Array is not initialized.");
+
+        // JP: BCフォーマットの場合、内部の大きさはブロック単位。
+        // EN: For BC formats, the internal size is in units of blocks.
+        const bool isBC = isBCFormat(m_elemType);
+        const uint32_t blockShift = isBC ? 2 : 0;
+        if ((width >> blockShift) == m_width && (height >> blockShift) == m_height && depth == m_depth)
             return;
+        if (m_GLTexID != 0 || m_externalMemory)
+            throw std::runtime_error("resize() is not supported on an interop array or an array from external memory.");
+
+        // JP: 新しい大きさで作れないミップレベルは落とす。
+        // EN: Drop mip levels that cannot be made with the new size.
+        uint32_t maxNumMipmapLevels = 1;
+        while ((std::max({ width, height, (m_layered || m_cubemap) ? 0u : depth }) >> maxNumMipmapLevels) > 0)
+            ++maxNumMipmapLevels;
 
         Array newArray;
-        newArray.initialize(m_cuContext, m_elemType, m_numChannels, width, height, m_depth, m_numMipmapLevels,
+        newArray.m_name = m_name;
+        newArray.initialize(m_cuContext, m_elemType, isBC ? 1 : m_numChannels, width, height, depth,
+                            std::min(m_numMipmapLevels, maxNumMipmapLevels),
                             m_surfaceLoadStore, m_useTextureGather, m_cubemap, m_layered, 0);
+        newArray.copyFrom(*this, stream);
 
-        size_t sizePerRow = std::min(m_width, width) * static_cast<size_t>(m_stride);
+        // JP: 配列の解放はストリーム順にできないので、コピーの完了を待ってから古い配列を解放する。
+        // EN: Arrays cannot be freed in stream order, so wait for the copy to complete before freeing the old array.
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        *this = std::move(newArray);
+    }
 
-        CUDA_MEMCPY3D params = {};
-        params.WidthInBytes = sizePerRow;
-        params.Height = std::max<size_t>(1, std::min(m_height, height));
-        params.Depth = std::max<size_t>(1, m_depth);
+    void Array::resize(uint32_t length, CUstream stream) {
+        if (m_height > 0 || m_depth > 0)
+            throw std::runtime_error("Array dimension cannot be changed.");
+        resizeImpl(length, 0, 0, stream);
+    }
 
-        params.srcMemoryType = CU_MEMORYTYPE_ARRAY;
-        params.srcArray = m_array;
-        params.srcXInBytes = 0;
-        params.srcY = 0;
-        params.srcZ = 0;
-        // srcDevice, srcHeight, srcHost, srcLOD, srcPitch are not used in this case.
+    void Array::resize(uint32_t width, uint32_t height, CUstream stream) {
+        if (m_height == 0 || m_depth > 0)
+            throw std::runtime_error("Array dimension cannot be changed.");
+        resizeImpl(width, height, 0, stream);
+    }
 
-        params.dstMemoryType = CU_MEMORYTYPE_ARRAY;
-        params.dstArray = m_array;
-        params.dstXInBytes = 0;
-        params.dstY = 0;
-        params.dstZ = 0;
-        // dstDevice, dstHeight, dstHost, dstLOD, dstPitch are not used in this case.
+    void Array::resize(uint32_t width, uint32_t height, uint32_t depth, CUstream stream) {
+        if (m_height == 0 || m_depth == 0)
+            throw std::runtime_error("Array dimension cannot be changed.");
+        resizeImpl(width, height, depth, stream);
+    }
 
-        CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+    void Array::copyFrom(const Array &src, CUstream stream) {
+        CUDAU_NVTX_RANGE("cudau::Array::copyFrom", m_name);
+        if (!m_initialized || !src.m_initialized)
+            throw std::runtime_error("Array is not initialized.");
+        if (m_elemType != src.m_elemType || m_stride != src.m_stride)
+            throw std::runtime_error("Element formats of the arrays do not match.");
+        if (m_cuContext != src.m_cuContext)
+            throw std::runtime_error("Arrays must belong to the same context.");
 
-        *this = std::move(newArray);
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const bool perLayerDepth = m_layered || m_cubemap;
+        const uint32_t numLevels = std::min(m_numMipmapLevels, src.m_numMipmapLevels);
+        for (uint32_t level = 0; level < numLevels; ++level) {
+            const auto calcOverlap = [level](uint32_t dstSize, uint32_t srcSize, bool perLevel) {
+                if (!perLevel)
+                    return std::max<size_t>(1, std::min(dstSize, srcSize));
+                return std::max<size_t>(1, std::min(dstSize >> level, srcSize >> level));
+            };
+
+            CUDA_MEMCPY3D params = {};
+            params.WidthInBytes = calcOverlap(m_width, src.m_width, true) * m_stride;
+            params.Height = calcOverlap(m_height, src.m_height, true);
+            params.Depth = calcOverlap(m_depth, src.m_depth, !perLayerDepth);
+
+            params.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+            params.srcArray = src.getCUarray(level);
+            params.srcXInBytes = 0;
+            params.srcY = 0;
+            params.srcZ = 0;
+            // srcDevice, srcHeight, srcHost, srcLOD, srcPitch are not used in this case.
+
+            params.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+            params.dstArray = getCUarray(level);
+            params.dstXInBytes = 0;
+            params.dstY = 0;
+            params.dstZ = 0;
+            // dstDevice, dstHeight, dstHost, dstLOD, dstPitch are not used in this case.
+
+            CUDADRV_CHECK(cuMemcpy3DAsync(&params, stream));
+        }
     }
 
-    void Array::resize(uint32_t width, uint32_t height, uint32_t depth, CUstream stream) {
-        CUDAUAssert_NotImplemented();
+    Array Array::copy(CUstream stream) const {
+        if (!m_initialized)
+            throw std::runtime_error("Array is not initialized.");
+        if (m_GLTexID != 0)
+            throw std::runtime_error("Copying OpenGL array is not supported.");
+
+        // JP: 外部メモリーのコピーは通常の配列として確保する。
+        // EN: A copy of external memory is allocated as a regular array.
+        const bool isBC = isBCFormat(m_elemType);
+        const uint32_t blockShift = isBC ? 2 : 0;
+        Array ret;
+        ret.m_name = m_name;
+        ret.initialize(m_cuContext, m_elemType, isBC ? 1 : m_numChannels,
+                       m_width << blockShift, m_height << blockShift, m_depth, m_numMipmapLevels,
+                       m_surfaceLoadStore, m_useTextureGather, m_cubemap, m_layered, 0);
+        ret.copyFrom(*this, stream);
+
+        return ret;
     }
 
     void Array::beginCUDAAccess(CUstream stream, uint32_t mipmapLevel) {
@@ -869,6 +2505,90 @@ namespace cudau {
         return m_mappedPointers[mipmapLevel];
     }
 
+    void InteropMapBatch::add(Buffer* buffer) {
+        if (buffer->m_type != BufferType::GL_Interop)
+            throw std::runtime_error("This is not an OpenGL-interop buffer.");
+        if (m_cuContext && m_cuContext != buffer->m_cuContext)
+            throw std::runtime_error("All resources must belong to the same context.");
+        m_cuContext = buffer->m_cuContext;
+        m_buffers.push_back(buffer);
+    }
+
+    void InteropMapBatch::add(Array* array) {
+        if (array->m_GLTexID == 0)
+            throw std::runtime_error("This is not an OpenGL-interop object.");
+        if (m_cuContext && m_cuContext != array->m_cuContext)
+            throw std::runtime_error("All resources must belong to the same context.");
+        m_cuContext = array->m_cuContext;
+        m_arrays.push_back(array);
+    }
+
+    void InteropMapBatch::beginCUDAAccess(CUstream stream) {
+        if (m_buffers.empty() && m_arrays.empty())
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        // JP: リソースは再初期化で変わり得るので、マップの度に集め直す。
+        // EN: Resources can change by re-initialization, so collect them on every map.
+        m_resources.clear();
+        for (Buffer* buffer : m_buffers)
+            m_resources.push_back(buffer->m_cudaGfxResource);
+        for (Array* array : m_arrays)
+            m_resources.push_back(array->m_cudaGfxResource);
+        CUDADRV_CHECK(cuGraphicsMapResources(static_cast<uint32_t>(m_resources.size()), m_resources.data(), stream));
+
+        for (Buffer* buffer : m_buffers) {
+            size_t bufferSize = 0;
+            CUDADRV_CHECK(cuGraphicsResourceGetMappedPointer(&buffer->m_devicePointer, &bufferSize,
+                                                             buffer->m_cudaGfxResource));
+        }
+        for (Array* array : m_arrays) {
+            for (uint32_t level = 0; level < array->m_numMipmapLevels; ++level)
+                CUDADRV_CHECK(cuGraphicsSubResourceGetMappedArray(&array->m_mappedArrays[level],
+                                                                  array->m_cudaGfxResource, 0, level));
+        }
+    }
+
+    void InteropMapBatch::endCUDAAccess(CUstream stream) {
+        if (m_resources.empty())
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (Array* array : m_arrays) {
+            for (uint32_t level = 0; level < array->m_numMipmapLevels; ++level)
+                array->m_mappedArrays[level] = nullptr;
+        }
+        CUDADRV_CHECK(cuGraphicsUnmapResources(static_cast<uint32_t>(m_resources.size()), m_resources.data(), stream));
+        m_resources.clear();
+    }
+
+
+
+    TransferToken Array::writeAsync(const void* srcData, size_t size, uint32_t mipmapLevel,
+                                    PinnedStagingPool &pool, CUstream stream) const {
+        if (mipmapLevel >= m_numMipmapLevels)
+            throw std::runtime_error("Specified mip-map level is out of bounds.");
+        if (m_GLTexID != 0)
+            throw std::runtime_error("Asynchronous write is not supported for an array created from OpenGL object.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
+        uint32_t height = std::max<uint32_t>(1, m_height >> mipmapLevel);
+        uint32_t depth = std::max<uint32_t>(1, m_depth);
+        size_t sizePerRow = width * static_cast<size_t>(m_stride);
+        if (size != sizePerRow * height * depth)
+            throw std::runtime_error("Transfer size does not match the mip-map level size.");
+
+        CUarray array = m_array;
+        if (m_numMipmapLevels > 1)
+            CUDADRV_CHECK(cuMipmappedArrayGetLevel(&array, m_mipmappedArray, mipmapLevel));
+
+        return pool.uploadToArray(array, srcData, sizePerRow, height, depth, stream);
+    }
+
     void Array::unmap(uint32_t mipmapLevel, CUstream stream) {
         if (!m_mappedPointers[mipmapLevel])
             throw std::runtime_error("This mip-map level is not mapped.");
@@ -929,4 +2649,456 @@ namespace cudau {
 
         return ret;
     }
+
+
+
+    void TextureTable::initialize(CUcontext context, uint32_t maxNumTextures) {
+        if (m_initialized)
+            throw std::runtime_error("Texture table is already initialized.");
+        if (maxNumTextures == 0)
+            throw std::runtime_error("maxNumTextures must be larger than 0.");
+
+        m_cuContext = context;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const size_t tableSize = sizeof(CUtexObject) * maxNumTextures;
+        CUDADRV_CHECK(cuMemAlloc(&m_deviceTable, tableSize));
+        CUDADRV_CHECK(cuMemsetD8(m_deviceTable, 0, tableSize));
+        m_texObjects.resize(maxNumTextures, 0);
+        m_freeIndices.clear();
+        m_numSlotsInUse = 0;
+        m_dirtyBegin = UINT32_MAX;
+        m_dirtyEnd = 0;
+
+        m_initialized = true;
+    }
+
+    void TextureTable::finalize() {
+        if (!m_initialized)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        for (uint32_t i = 0; i < m_numSlotsInUse; ++i) {
+            if (m_texObjects[i])
+                CUDADRV_CHECK(cuTexObjectDestroy(m_texObjects[i]));
+        }
+        m_texObjects.clear();
+        m_freeIndices.clear();
+        m_numSlotsInUse = 0;
+        CUDADRV_CHECK(cuMemFree(m_deviceTable));
+        m_deviceTable = 0;
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    uint32_t TextureTable::allocate(CUtexObject texObj) {
+        if (!m_initialized)
+            throw std::runtime_error("Texture table is not initialized.");
+
+        uint32_t index;
+        if (!m_freeIndices.empty()) {
+            index = m_freeIndices.back();
+            m_freeIndices.pop_back();
+        }
+        else {
+            if (m_numSlotsInUse >= m_texObjects.size())
+                throw std::runtime_error("Texture table is full.");
+            index = m_numSlotsInUse++;
+        }
+        m_texObjects[index] = texObj;
+        markDirty(index);
+
+        return index;
+    }
+
+    void TextureTable::replace(uint32_t index, CUtexObject texObj) {
+        if (index >= m_numSlotsInUse || m_texObjects[index] == 0)
+            throw std::runtime_error("Invalid texture index.");
+
+        // JP: 古いオブジェクトを参照している処理が残っている可能性があるため、呼び出し側で同期を取る必要がある。
+        // EN: The caller needs to synchronize since work referring to the old object may remain.
+        CUDADRV_CHECK(cuTexObjectDestroy(m_texObjects[index]));
+        m_texObjects[index] = texObj;
+        markDirty(index);
+    }
+
+    void TextureTable::release(uint32_t index) {
+        if (index >= m_numSlotsInUse || m_texObjects[index] == 0)
+            throw std::runtime_error("Invalid texture index.");
+
+        CUDADRV_CHECK(cuTexObjectDestroy(m_texObjects[index]));
+        m_texObjects[index] = 0;
+        m_freeIndices.push_back(index);
+        markDirty(index);
+    }
+
+    void TextureTable::upload(CUstream stream) {
+        if (m_dirtyBegin >= m_dirtyEnd)
+            return;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const size_t offset = sizeof(CUtexObject) * m_dirtyBegin;
+        const size_t size = sizeof(CUtexObject) * (m_dirtyEnd - m_dirtyBegin);
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(m_deviceTable + offset, m_texObjects.data() + m_dirtyBegin, size, stream));
+        m_dirtyBegin = UINT32_MAX;
+        m_dirtyEnd = 0;
+    }
+
+
+
+    static uint64_t makeTileKey(const VirtualTextureRequest &request) {
+        return (static_cast<uint64_t>(request.textureId) << 32) | request.packedTile;
+    }
+
+    void VirtualTextureStreamer::initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
+                                            const TextureSampler &cacheSampler,
+                                            uint32_t tileSize, uint32_t pageBorder,
+                                            uint32_t numPagesX, uint32_t numPagesY,
+                                            uint32_t feedbackCapacity, const TileLoader &loader) {
+        if (m_initialized)
+            throw std::runtime_error("Virtual texture streamer is already initialized.");
+        if (tileSize == 0 || (tileSize & (tileSize - 1)) != 0)
+            throw std::runtime_error("tileSize must be a power of two.");
+        if (isBCFormat(elemType) && (tileSize % 4 != 0 || pageBorder % 4 != 0))
+            throw std::runtime_error("tileSize and pageBorder must be multiples of 4 for BC formats.");
+        if (numPagesX > 0xFFFF || numPagesY > 0x7FFF)
+            throw std::runtime_error("Too many physical pages.");
+
+        m_cuContext = context;
+        m_loader = loader;
+        m_tileSize = tileSize;
+        m_pageBorder = pageBorder;
+        m_pageSize = tileSize + 2 * pageBorder;
+        m_numPagesX = numPagesX;
+        m_numPagesY = numPagesY;
+
+        m_physicalCache.initialize2D(m_cuContext, elemType, numChannels,
+                                     ArraySurface::Disable, ArrayTextureGather::Disable,
+                                     m_numPagesX * m_pageSize, m_numPagesY * m_pageSize, 1);
+        m_cacheSampler = cacheSampler;
+        m_cacheSampler.setIndexingMode(TextureIndexingMode::NormalizedCoordinates);
+        m_cacheTexObj = m_cacheSampler.createTextureObject(m_physicalCache);
+        // JP: BCフォーマットの場合、配列の幅と高さの単位はブロックになる。
+        // EN: For BC formats, the width and height of the array are in units of blocks.
+        m_pageRowSize = static_cast<size_t>(m_physicalCache.getWidth() / m_numPagesX) * m_physicalCache.getStride();
+        m_numPageRows = m_physicalCache.getHeight() / m_numPagesY;
+
+        PhysicalPage emptyPage = {};
+        m_pages.assign(m_numPagesX * m_numPagesY, emptyPage);
+        m_stagingPool.initialize(m_cuContext, std::max<size_t>(m_pageRowSize * m_numPageRows, 1024 * 1024), 4);
+
+        m_feedbackBuffer.initialize(m_cuContext, BufferType::Device, feedbackCapacity, sizeof(VirtualTextureRequest));
+        m_feedbackCounter.initialize(m_cuContext, BufferType::Device, 1, sizeof(uint32_t));
+        CUDADRV_CHECK(cuMemsetD32(m_feedbackCounter.getCUdeviceptr(), 0, 1));
+        m_feedbackHost.resize(feedbackCapacity);
+
+        m_frameIndex = 0;
+        m_stopWorker = false;
+        m_worker = std::thread(&VirtualTextureStreamer::workerLoop, this);
+
+        m_initialized = true;
+    }
+
+    void VirtualTextureStreamer::finalize() {
+        if (!m_initialized)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopWorker = true;
+        }
+        m_condVar.notify_all();
+        m_worker.join();
+        m_loadQueue.clear();
+        m_loadedTiles.clear();
+        m_pendingTiles.clear();
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        m_feedbackHost.clear();
+        m_feedbackCounter.finalize();
+        m_feedbackBuffer.finalize();
+
+        for (std::unique_ptr<TextureInfo> &texture : m_textures) {
+            CUDADRV_CHECK(cuTexObjectDestroy(texture->pageTableTexObj));
+            texture->pageTable.finalize();
+        }
+        m_textures.clear();
+
+        m_stagingPool.finalize();
+        m_pages.clear();
+        CUDADRV_CHECK(cuTexObjectDestroy(m_cacheTexObj));
+        m_cacheTexObj = 0;
+        m_physicalCache.finalize();
+        m_loader = TileLoader();
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    void VirtualTextureStreamer::workerLoop() {
+        const size_t pageDataSize = m_pageRowSize * m_numPageRows;
+        while (true) {
+            VirtualTextureRequest request;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condVar.wait(lock, [this]() { return m_stopWorker || !m_loadQueue.empty(); });
+                if (m_stopWorker)
+                    break;
+                request = m_loadQueue.front();
+                m_loadQueue.pop_front();
+            }
+
+            LoadedTile tile;
+            tile.request = request;
+            tile.data.resize(pageDataSize);
+            const uint32_t mipLevel = request.packedTile >> 24;
+            const uint32_t tileY = (request.packedTile >> 12) & 0xFFF;
+            const uint32_t tileX = request.packedTile & 0xFFF;
+            if (!m_loader(request.textureId, mipLevel, tileX, tileY, tile.data.data()))
+                tile.data.clear();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_loadedTiles.push_back(std::move(tile));
+        }
+    }
+
+    uint32_t* VirtualTextureStreamer::findEntry(const VirtualTextureRequest &request) {
+        if (request.textureId >= m_textures.size())
+            return nullptr;
+        TextureInfo &texture = *m_textures[request.textureId];
+        const uint32_t mipLevel = request.packedTile >> 24;
+        if (mipLevel >= texture.numMipLevels)
+            return nullptr;
+        const uint32_t numTilesX = std::max(texture.numTilesX >> mipLevel, 1u);
+        const uint32_t numTilesY = std::max(texture.numTilesY >> mipLevel, 1u);
+        const uint32_t tileY = (request.packedTile >> 12) & 0xFFF;
+        const uint32_t tileX = request.packedTile & 0xFFF;
+        if (tileX >= numTilesX || tileY >= numTilesY)
+            return nullptr;
+        return &texture.entries[mipLevel][tileY * numTilesX + tileX];
+    }
+
+    uint32_t VirtualTextureStreamer::allocatePage() {
+        // JP: 空きページが無ければ、今のフレームで使われていない最も古いページを追い出す。
+        // EN: If there is no free page, evict the least recently used page not used in the current frame.
+        uint32_t victim = UINT32_MAX;
+        for (uint32_t i = 0; i < m_pages.size(); ++i) {
+            const PhysicalPage &page = m_pages[i];
+            if (!page.occupied)
+                return i;
+            if (page.locked || page.lastUsedFrame >= m_frameIndex)
+                continue;
+            if (victim == UINT32_MAX || page.lastUsedFrame < m_pages[victim].lastUsedFrame)
+                victim = i;
+        }
+        if (victim == UINT32_MAX)
+            return UINT32_MAX;
+
+        PhysicalPage &page = m_pages[victim];
+        VirtualTextureRequest owner = { page.textureId, page.packedTile };
+        if (uint32_t* entry = findEntry(owner)) {
+            *entry = 0;
+            m_textures[owner.textureId]->dirtyLevelMask |= 1u << (owner.packedTile >> 24);
+        }
+        page.occupied = false;
+        return victim;
+    }
+
+    void VirtualTextureStreamer::placeTile(const VirtualTextureRequest &request, const void* data, bool lock,
+                                           CUstream stream) {
+        uint32_t* entry = findEntry(request);
+        if (!entry)
+            return;
+        const uint32_t pageIndex = allocatePage();
+        if (pageIndex == UINT32_MAX)
+            return;
+
+        const uint32_t physX = pageIndex % m_numPagesX;
+        const uint32_t physY = pageIndex / m_numPagesX;
+        m_stagingPool.uploadToArray(m_physicalCache.getCUarray(0), data, m_pageRowSize, m_numPageRows, 1, stream,
+                                    physX * m_pageRowSize, physY * m_numPageRows);
+
+        PhysicalPage &page = m_pages[pageIndex];
+        page.lastUsedFrame = m_frameIndex;
+        page.textureId = request.textureId;
+        page.packedTile = request.packedTile;
+        page.occupied = true;
+        page.locked = lock;
+
+        *entry = VirtualTexturePageValidBit | (physY << 16) | physX;
+        m_textures[request.textureId]->dirtyLevelMask |= 1u << (request.packedTile >> 24);
+    }
+
+    void VirtualTextureStreamer::uploadPageTables(CUstream stream) {
+        for (std::unique_ptr<TextureInfo> &texture : m_textures) {
+            for (uint32_t level = 0; level < texture->numMipLevels; ++level) {
+                if ((texture->dirtyLevelMask & (1u << level)) == 0)
+                    continue;
+                const std::vector<uint32_t> &entries = texture->entries[level];
+                texture->pageTable.write<uint32_t>(entries.data(), static_cast<uint32_t>(entries.size()),
+                                                   level, stream);
+            }
+            texture->dirtyLevelMask = 0;
+        }
+    }
+
+    uint32_t VirtualTextureStreamer::addTexture(uint32_t width, uint32_t height, CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Virtual texture streamer is not initialized.");
+        const uint32_t numTilesX = width / m_tileSize;
+        const uint32_t numTilesY = height / m_tileSize;
+        if (numTilesX == 0 || numTilesY == 0 ||
+            numTilesX * m_tileSize != width || numTilesY * m_tileSize != height ||
+            (numTilesX & (numTilesX - 1)) != 0 || (numTilesY & (numTilesY - 1)) != 0)
+            throw std::runtime_error("Texture size must be a power-of-two multiple of the tile size.");
+        if (numTilesX > 0x1000 || numTilesY > 0x1000)
+            throw std::runtime_error("Too many tiles.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        const uint32_t textureId = static_cast<uint32_t>(m_textures.size());
+        m_textures.push_back(std::make_unique<TextureInfo>());
+        TextureInfo &texture = *m_textures.back();
+        texture.numTilesX = numTilesX;
+        texture.numTilesY = numTilesY;
+        texture.numMipLevels = 1;
+        while ((std::max(numTilesX, numTilesY) >> texture.numMipLevels) > 0)
+            ++texture.numMipLevels;
+
+        texture.pageTable.initialize2D(m_cuContext, ArrayElementType::UInt32, 1,
+                                       ArraySurface::Disable, ArrayTextureGather::Disable,
+                                       numTilesX, numTilesY, texture.numMipLevels);
+        TextureSampler pageTableSampler;
+        pageTableSampler.setXyFilterMode(TextureFilterMode::Point);
+        pageTableSampler.setMipMapFilterMode(TextureFilterMode::Point);
+        pageTableSampler.setWrapMode(0, TextureWrapMode::Clamp);
+        pageTableSampler.setWrapMode(1, TextureWrapMode::Clamp);
+        pageTableSampler.setIndexingMode(TextureIndexingMode::NormalizedCoordinates);
+        pageTableSampler.setReadMode(TextureReadMode::ElementType);
+        texture.pageTableTexObj = pageTableSampler.createTextureObject(texture.pageTable);
+
+        texture.entries.resize(texture.numMipLevels);
+        for (uint32_t level = 0; level < texture.numMipLevels; ++level) {
+            const uint32_t w = std::max(numTilesX >> level, 1u);
+            const uint32_t h = std::max(numTilesY >> level, 1u);
+            texture.entries[level].assign(w * h, 0);
+        }
+        texture.dirtyLevelMask = (1u << texture.numMipLevels) - 1;
+
+        // JP: フォールバック先として最も粗いレベルを常駐させる。
+        // EN: Make the coarsest level resident as the fallback.
+        const uint32_t coarsestLevel = texture.numMipLevels - 1;
+        const uint32_t coarsestNumTilesX = std::max(numTilesX >> coarsestLevel, 1u);
+        const uint32_t coarsestNumTilesY = std::max(numTilesY >> coarsestLevel, 1u);
+        std::vector<uint8_t> data(m_pageRowSize * m_numPageRows);
+        for (uint32_t tileY = 0; tileY < coarsestNumTilesY; ++tileY) {
+            for (uint32_t tileX = 0; tileX < coarsestNumTilesX; ++tileX) {
+                if (!m_loader(textureId, coarsestLevel, tileX, tileY, data.data()))
+                    throw std::runtime_error("Failed to load a tile of the coarsest level.");
+                VirtualTextureRequest request = {
+                    textureId, packVirtualTextureTile(coarsestLevel, tileX, tileY) };
+                placeTile(request, data.data(), true, stream);
+                if (*findEntry(request) == 0)
+                    throw std::runtime_error("Physical page cache is too small.");
+            }
+        }
+        uploadPageTables(stream);
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+        return textureId;
+    }
+
+    VirtualTextureDeviceData VirtualTextureStreamer::getDeviceData(uint32_t textureId) const {
+        const TextureInfo &texture = *m_textures[textureId];
+        VirtualTextureDeviceData ret = {};
+        ret.pageTable = texture.pageTableTexObj;
+        ret.physicalCache = m_cacheTexObj;
+        ret.feedbackBuffer = reinterpret_cast<VirtualTextureRequest*>(m_feedbackBuffer.getCUdeviceptr());
+        ret.feedbackCounter = reinterpret_cast<uint32_t*>(m_feedbackCounter.getCUdeviceptr());
+        ret.feedbackCapacity = static_cast<uint32_t>(m_feedbackHost.size());
+        ret.textureId = textureId;
+        ret.numTilesX = texture.numTilesX;
+        ret.numTilesY = texture.numTilesY;
+        ret.numMipLevels = texture.numMipLevels;
+        ret.tileSize = m_tileSize;
+        ret.pageSize = m_pageSize;
+        ret.pageBorder = m_pageBorder;
+        ret.invCacheWidth = 1.0f / (m_numPagesX * m_pageSize);
+        ret.invCacheHeight = 1.0f / (m_numPagesY * m_pageSize);
+        return ret;
+    }
+
+    void VirtualTextureStreamer::processFeedback(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Virtual texture streamer is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        uint32_t numRequests;
+        CUDADRV_CHECK(cuMemcpyDtoHAsync(&numRequests, m_feedbackCounter.getCUdeviceptr(), sizeof(uint32_t), stream));
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        numRequests = std::min(numRequests, static_cast<uint32_t>(m_feedbackHost.size()));
+        if (numRequests > 0) {
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(m_feedbackHost.data(), m_feedbackBuffer.getCUdeviceptr(),
+                                            sizeof(VirtualTextureRequest) * numRequests, stream));
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+        }
+        CUDADRV_CHECK(cuMemsetD32Async(m_feedbackCounter.getCUdeviceptr(), 0, 1, stream));
+
+        std::unordered_set<uint64_t> visited;
+        std::vector<VirtualTextureRequest> newRequests;
+        for (uint32_t i = 0; i < numRequests; ++i) {
+            const VirtualTextureRequest &request = m_feedbackHost[i];
+            const uint64_t key = makeTileKey(request);
+            if (!visited.insert(key).second)
+                continue;
+
+            const uint32_t* entry = findEntry(request);
+            if (!entry)
+                continue;
+            if (*entry & VirtualTexturePageValidBit) {
+                const uint32_t physX = *entry & 0xFFFF;
+                const uint32_t physY = (*entry >> 16) & 0x7FFF;
+                m_pages[physY * m_numPagesX + physX].lastUsedFrame = m_frameIndex;
+            }
+            else if (m_pendingTiles.insert(key).second) {
+                newRequests.push_back(request);
+            }
+        }
+
+        if (!newRequests.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_loadQueue.insert(m_loadQueue.end(), newRequests.begin(), newRequests.end());
+            }
+            m_condVar.notify_all();
+        }
+    }
+
+    void VirtualTextureStreamer::update(CUstream stream) {
+        if (!m_initialized)
+            throw std::runtime_error("Virtual texture streamer is not initialized.");
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        std::vector<LoadedTile> loadedTiles;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            loadedTiles.swap(m_loadedTiles);
+        }
+
+        for (const LoadedTile &tile : loadedTiles) {
+            m_pendingTiles.erase(makeTileKey(tile.request));
+            if (tile.data.empty())
+                continue;
+            placeTile(tile.request, tile.data.data(), false, stream);
+        }
+        uploadPageTables(stream);
+
+        ++m_frameIndex;
+    }
 }
@@ -52,10 +52,20 @@ typedef unsigned long long CUsurfObject;
 #if !defined(__CUDA_ARCH__)
 #   include <cstdio>
 #   include <cstdlib>
+#   include <cstring>
 
 #   include <algorithm>
 #   include <vector>
 #   include <sstream>
+#   include <memory>
+#   include <functional>
+#   include <deque>
+#   include <unordered_set>
+#   include <thread>
+#   include <mutex>
+#   include <condition_variable>
+#   include <atomic>
+#   include <unordered_map>
 
 // JP: CUDA/OpenGL連携機能が必要な場合はOpenGLの関数宣言の取得(例: gl3w.hのinclude)と
 //     CUDA_UTIL_USE_GL_INTEROPの定義を行う。
@@ -67,6 +77,10 @@ typedef unsigned long long CUsurfObject;
 #       include <cudaGL.h>
 #   endif
 
+// JP: 定義するとバッファーの確保や再確保などがNVTXレンジとして表示される。
+// EN: Defining this shows buffer allocations, reallocations and so on as NVTX ranges.
+//#   define CUDAU_ENABLE_NVTX
+
 #   undef min
 #   undef max
 #   undef near
@@ -139,6 +153,357 @@ typedef unsigned long long CUsurfObject;
 
 
 namespace cudau {
+    // JP: 半精度浮動小数点数(IEEE 754 binary16)との変換。
+    //     蓄積バッファーからデノイザーなどへの半精度の入力を作ったり、半精度の出力を読んだりするのに使う。
+    // EN: Conversion from/to half-precision floating point numbers (IEEE 754 binary16).
+    //     Use these to make half-precision inputs for the denoiser and others from accumulation buffers or
+    //     to read half-precision outputs.
+#if defined(__CUDA_ARCH__)
+#   define CUDAU_COMMON_FUNCTION __device__ __forceinline__
+    CUDAU_COMMON_FUNCTION uint16_t floatToHalf(float v) {
+        uint16_t ret;
+        asm("cvt.rn.f16.f32 %0, %1;" : "=h"(ret) : "f"(v));
+        return ret;
+    }
+    CUDAU_COMMON_FUNCTION float halfToFloat(uint16_t v) {
+        float ret;
+        asm("cvt.f32.f16 %0, %1;" : "=f"(ret) : "h"(v));
+        return ret;
+    }
+#else
+#   define CUDAU_COMMON_FUNCTION inline
+    CUDAU_COMMON_FUNCTION uint16_t floatToHalf(float v) {
+        uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        const uint32_t sign = (bits >> 16) & 0x8000;
+        const uint32_t absBits = bits & 0x7FFFFFFF;
+        if (absBits >= 0x7F800000) // Inf or NaN
+            return static_cast<uint16_t>(sign | 0x7C00 | (absBits > 0x7F800000 ? 0x0200 : 0));
+        if (absBits >= 0x477FF000) // Overflows to Inf after rounding.
+            return static_cast<uint16_t>(sign | 0x7C00);
+        if (absBits < 0x38800000) { // Subnormal or zero in half.
+            if (absBits < 0x33000000)
+                return static_cast<uint16_t>(sign);
+            const uint32_t exp = absBits >> 23;
+            const uint32_t mantissa = (absBits & 0x007FFFFF) | 0x00800000;
+            const uint32_t shift = 126 - exp;
+            uint32_t half = mantissa >> shift;
+            const uint32_t rem = mantissa & ((1u << shift) - 1);
+            const uint32_t halfway = 1u << (shift - 1);
+            if (rem > halfway || (rem == halfway && (half & 1)))
+                ++half;
+            return static_cast<uint16_t>(sign | half);
+        }
+        uint32_t half = (absBits - 0x38000000) >> 13;
+        const uint32_t rem = absBits & 0x1FFF;
+        if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+            ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+    CUDAU_COMMON_FUNCTION float halfToFloat(uint16_t v) {
+        const uint32_t sign = static_cast<uint32_t>(v & 0x8000) << 16;
+        uint32_t exp = (v >> 10) & 0x1F;
+        uint32_t mantissa = v & 0x03FF;
+        uint32_t bits;
+        if (exp == 0x1F) {
+            bits = sign | 0x7F800000 | (mantissa << 13);
+        }
+        else if (exp == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            }
+            else {
+                exp = 127 - 14;
+                while ((mantissa & 0x0400) == 0) {
+                    mantissa <<= 1;
+                    --exp;
+                }
+                bits = sign | (exp << 23) | ((mantissa & 0x03FF) << 13);
+            }
+        }
+        else {
+            bits = sign | ((exp + 127 - 15) << 23) | (mantissa << 13);
+        }
+        float ret;
+        std::memcpy(&ret, &bits, sizeof(ret));
+        return ret;
+    }
+#endif
+#undef CUDAU_COMMON_FUNCTION
+
+
+
+    // JP: ミップマップ生成のフィルター。
+    //     Boxは2x2の平均、Kaiserは4x4のカイザー窓付きsincでエイリアシングが少ない。
+    // EN: Filters for mipmap generation.
+    //     Box is 2x2 average, Kaiser is a 4x4 Kaiser-windowed sinc with less aliasing.
+    enum class MipmapFilter : uint32_t {
+        Box = 0,
+        Kaiser
+    };
+
+
+
+    // JP: 仮想テクスチャーがデバイスから記録するタイルの要求。
+    //     packedTileはミップレベル(8ビット)、タイルのY(12ビット)、X(12ビット)を詰めたもの。
+    // EN: A tile request recorded by a virtual texture from the device.
+    //     packedTile packs the mip level (8 bits), tile Y (12 bits) and X (12 bits).
+    struct VirtualTextureRequest {
+        uint32_t textureId;
+        uint32_t packedTile;
+    };
+
+    // JP: ページテーブルのエントリーは最上位ビットが有効フラグ、
+    //     その下の15ビットが物理ページのY、下位16ビットがXを表す。
+    // EN: A page table entry has the valid flag in the top bit,
+    //     physical page Y in the next 15 bits and X in the lower 16 bits.
+    static constexpr uint32_t VirtualTexturePageValidBit = 1u << 31;
+
+    struct VirtualTextureDeviceData {
+        CUtexObject pageTable;
+        CUtexObject physicalCache;
+        VirtualTextureRequest* feedbackBuffer;
+        uint32_t* feedbackCounter;
+        uint32_t feedbackCapacity;
+        uint32_t textureId;
+        uint32_t numTilesX;
+        uint32_t numTilesY;
+        uint32_t numMipLevels;
+        uint32_t tileSize;
+        uint32_t pageSize;
+        uint32_t pageBorder;
+        float invCacheWidth;
+        float invCacheHeight;
+    };
+
+    CUDA_DEVICE_FUNCTION constexpr uint32_t packVirtualTextureTile(uint32_t mipLevel, uint32_t tileX, uint32_t tileY) {
+        return (mipLevel << 24) | ((tileY & 0xFFF) << 12) | (tileX & 0xFFF);
+    }
+
+
+
+    namespace detail {
+        template <uint32_t I, typename Head, typename... Tail>
+        struct SoAFieldType {
+            using Type = typename SoAFieldType<I - 1, Tail...>::Type;
+        };
+        template <typename Head, typename... Tail>
+        struct SoAFieldType<0, Head, Tail...> {
+            using Type = Head;
+        };
+    }
+
+    // JP: SoABufferのデバイス側ビュー。カーネルに値渡しして各フィールドに型付きでアクセスする。
+    // EN: Device-side view of SoABuffer. Pass this to a kernel by value to access each field with its type.
+    template <typename... Fields>
+    struct SoAView {
+        static constexpr uint32_t numFields = sizeof...(Fields);
+        template <uint32_t I>
+        using FieldType = typename detail::SoAFieldType<I, Fields...>::Type;
+
+        void* fields[numFields];
+        uint32_t numElements;
+
+        template <uint32_t I>
+        CUDA_DEVICE_FUNCTION FieldType<I>* getField() const {
+            return static_cast<FieldType<I>*>(fields[I]);
+        }
+        template <uint32_t I>
+        CUDA_DEVICE_FUNCTION FieldType<I> &get(uint32_t idx) const {
+            return getField<I>()[idx];
+        }
+    };
+
+#if defined(__CUDA_ARCH__)
+    // JP: グリッドストライドループのためのヘルパー。
+    //     グリッドのサイズが要素数より小さくても(例: Kernel::launchPersistent())全要素を処理できる。
+    // EN: Helpers for grid-stride loops.
+    //     This can process all the items even when the grid is smaller than the number of items
+    //     (e.g. Kernel::launchPersistent()).
+    CUDA_DEVICE_FUNCTION uint32_t getGlobalThreadIndex() {
+        return blockDim.x * blockIdx.x + threadIdx.x;
+    }
+    CUDA_DEVICE_FUNCTION uint32_t getGridStride() {
+        return blockDim.x * gridDim.x;
+    }
+    template <typename Func>
+    CUDA_DEVICE_FUNCTION void forEachGridStride(uint32_t numItems, Func &&func) {
+        const uint32_t stride = getGridStride();
+        for (uint32_t i = getGlobalThreadIndex(); i < numItems; i += stride)
+            func(i);
+    }
+
+    namespace detail {
+        CUDA_DEVICE_FUNCTION float sRGBToLinear(float v) {
+            return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+        }
+        CUDA_DEVICE_FUNCTION float linearToSRGB(float v) {
+            return v <= 0.0031308f ? 12.92f * v : 1.055f * powf(v, 1 / 2.4f) - 0.055f;
+        }
+
+        template <typename T>
+        struct MipmapTexel;
+
+        template <>
+        struct MipmapTexel<float4> {
+            CUDA_DEVICE_FUNCTION static float4 load(CUsurfObject surf, uint32_t x, uint32_t y, bool sRGB) {
+                float4 v = surf2Dread<float4>(surf, x * sizeof(float4), y);
+                if (sRGB) {
+                    v.x = sRGBToLinear(v.x);
+                    v.y = sRGBToLinear(v.y);
+                    v.z = sRGBToLinear(v.z);
+                }
+                return v;
+            }
+            CUDA_DEVICE_FUNCTION static void store(CUsurfObject surf, uint32_t x, uint32_t y, float4 v, bool sRGB) {
+                if (sRGB) {
+                    v.x = linearToSRGB(v.x);
+                    v.y = linearToSRGB(v.y);
+                    v.z = linearToSRGB(v.z);
+                }
+                surf2Dwrite(v, surf, x * sizeof(float4), y);
+            }
+        };
+
+        template <>
+        struct MipmapTexel<uchar4> {
+            CUDA_DEVICE_FUNCTION static float4 load(CUsurfObject surf, uint32_t x, uint32_t y, bool sRGB) {
+                uchar4 v = surf2Dread<uchar4>(surf, x * sizeof(uchar4), y);
+                float4 ret = make_float4(v.x / 255.0f, v.y / 255.0f, v.z / 255.0f, v.w / 255.0f);
+                if (sRGB) {
+                    ret.x = sRGBToLinear(ret.x);
+                    ret.y = sRGBToLinear(ret.y);
+                    ret.z = sRGBToLinear(ret.z);
+                }
+                return ret;
+            }
+            CUDA_DEVICE_FUNCTION static void store(CUsurfObject surf, uint32_t x, uint32_t y, float4 v, bool sRGB) {
+                if (sRGB) {
+                    v.x = linearToSRGB(v.x);
+                    v.y = linearToSRGB(v.y);
+                    v.z = linearToSRGB(v.z);
+                }
+                const auto quantize = [](float c) {
+                    return static_cast<unsigned char>(fminf(fmaxf(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+                };
+                surf2Dwrite(make_uchar4(quantize(v.x), quantize(v.y), quantize(v.z), quantize(v.w)),
+                            surf, x * sizeof(uchar4), y);
+            }
+        };
+    }
+
+    // JP: ミップレベルの1テクセルを一つ上のレベルから縮小して書き込む。
+    //     sRGBの場合はRGBをリニアに変換してからフィルターする。Tはfloat4かuchar4。
+    // EN: Write a texel of a mip level by downsampling the level above.
+    //     For sRGB, RGB is converted to linear before filtering. T is float4 or uchar4.
+    template <typename T>
+    CUDA_DEVICE_FUNCTION void downsampleMipmapTexel(
+        CUsurfObject srcSurf, uint32_t srcWidth, uint32_t srcHeight,
+        CUsurfObject dstSurf, uint32_t dstX, uint32_t dstY,
+        MipmapFilter filter, bool sRGB) {
+        using Texel = detail::MipmapTexel<T>;
+
+        // JP: カイザー窓(alpha = 4)付きsincの2倍縮小用の正規化済み重み。
+        // EN: Normalized weights of Kaiser-windowed (alpha = 4) sinc for 2x downsampling.
+        constexpr float kaiserWeights[] = { 0.0540271f, 0.4459729f, 0.4459729f, 0.0540271f };
+        constexpr float boxWeights[] = { 0.5f, 0.5f };
+
+        const bool useKaiser = filter == MipmapFilter::Kaiser;
+        const int32_t numTaps = useKaiser ? 4 : 2;
+        const int32_t firstTap = useKaiser ? -1 : 0;
+        const float* weights = useKaiser ? kaiserWeights : boxWeights;
+
+        float4 sum = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        for (int32_t ty = 0; ty < numTaps; ++ty) {
+            const int32_t sy = min(max(static_cast<int32_t>(2 * dstY) + firstTap + ty, 0),
+                                   static_cast<int32_t>(srcHeight) - 1);
+            for (int32_t tx = 0; tx < numTaps; ++tx) {
+                const int32_t sx = min(max(static_cast<int32_t>(2 * dstX) + firstTap + tx, 0),
+                                       static_cast<int32_t>(srcWidth) - 1);
+                const float w = weights[tx] * weights[ty];
+                const float4 v = Texel::load(srcSurf, sx, sy, sRGB);
+                sum.x += w * v.x;
+                sum.y += w * v.y;
+                sum.z += w * v.z;
+                sum.w += w * v.w;
+            }
+        }
+        Texel::store(dstSurf, dstX, dstY, sum, sRGB);
+    }
+
+    // JP: TextureTableのデバイス上のテーブルからインデックスでテクスチャーをサンプルする。
+    // EN: Sample a texture by index from the device table of TextureTable.
+    template <typename T>
+    CUDA_DEVICE_FUNCTION T sampleTextureTable(const CUtexObject* textureTable, uint32_t index,
+                                              float u, float v, float lod) {
+        return tex2DLod<T>(textureTable[index], u, v, lod);
+    }
+
+    // JP: 仮想テクスチャーをサンプルする。要求したレベルのタイルが常駐していなければ、
+    //     常駐している粗いレベルにフォールバックする。recordFeedbackがtrueなら要求したタイルを記録する。
+    //     全てのスレッドが記録するとフィードバックバッファーが溢れやすいので、
+    //     一部のピクセルだけで記録することを推奨する。
+    // EN: Sample a virtual texture. If the tile of the requested level is not resident,
+    //     this falls back to a coarser resident level. Records the requested tile if recordFeedback is true.
+    //     Recording from all threads tends to overflow the feedback buffer,
+    //     so recording only on a subset of pixels is recommended.
+    template <typename T>
+    CUDA_DEVICE_FUNCTION T sampleVirtualTexture(const VirtualTextureDeviceData &vt, float u, float v, float lod,
+                                                bool recordFeedback = true) {
+        u -= floorf(u);
+        v -= floorf(v);
+        uint32_t mipLevel = min(static_cast<uint32_t>(fmaxf(lod, 0.0f)), vt.numMipLevels - 1);
+
+        if (recordFeedback) {
+            const uint32_t numTilesX = max(vt.numTilesX >> mipLevel, 1u);
+            const uint32_t numTilesY = max(vt.numTilesY >> mipLevel, 1u);
+            const uint32_t tileX = min(static_cast<uint32_t>(u * numTilesX), numTilesX - 1);
+            const uint32_t tileY = min(static_cast<uint32_t>(v * numTilesY), numTilesY - 1);
+            const uint32_t slot = atomicAdd(vt.feedbackCounter, 1u);
+            if (slot < vt.feedbackCapacity) {
+                VirtualTextureRequest req;
+                req.textureId = vt.textureId;
+                req.packedTile = packVirtualTextureTile(mipLevel, tileX, tileY);
+                vt.feedbackBuffer[slot] = req;
+            }
+        }
+
+        uint32_t entry = 0;
+        for (; mipLevel < vt.numMipLevels; ++mipLevel) {
+            entry = tex2DLod<uint32_t>(vt.pageTable, u, v, static_cast<float>(mipLevel));
+            if (entry & VirtualTexturePageValidBit)
+                break;
+        }
+        mipLevel = min(mipLevel, vt.numMipLevels - 1);
+
+        const float tu = u * max(vt.numTilesX >> mipLevel, 1u);
+        const float tv = v * max(vt.numTilesY >> mipLevel, 1u);
+        const uint32_t physX = entry & 0xFFFF;
+        const uint32_t physY = (entry >> 16) & 0x7FFF;
+        const float pu = (physX * vt.pageSize + vt.pageBorder + (tu - floorf(tu)) * vt.tileSize) * vt.invCacheWidth;
+        const float pv = (physY * vt.pageSize + vt.pageBorder + (tv - floorf(tv)) * vt.tileSize) * vt.invCacheHeight;
+        return tex2DLod<T>(vt.physicalCache, pu, pv, 0.0f);
+    }
+
+    // JP: Array::generateMipmaps()に渡すカーネルを定義する。
+    // EN: Define a kernel to pass to Array::generateMipmaps().
+#   define CUDAU_DEFINE_MIPMAP_KERNEL(Name, TexelType) \
+    CUDA_DEVICE_KERNEL void Name( \
+        CUsurfObject srcSurf, uint32_t srcWidth, uint32_t srcHeight, \
+        CUsurfObject dstSurf, uint32_t dstWidth, uint32_t dstHeight, \
+        cudau::MipmapFilter filter, uint32_t sRGB) { \
+        const uint32_t x = blockDim.x * blockIdx.x + threadIdx.x; \
+        const uint32_t y = blockDim.y * blockIdx.y + threadIdx.y; \
+        if (x >= dstWidth || y >= dstHeight) \
+            return; \
+        cudau::downsampleMipmapTexel<TexelType>(srcSurf, srcWidth, srcHeight, dstSurf, x, y, filter, sRGB != 0); \
+    }
+#else
+#   define CUDAU_DEFINE_MIPMAP_KERNEL(Name, TexelType)
+#endif
+
+
+
 #if !defined(__CUDA_ARCH__)
     void devPrintf(const char* fmt, ...);
 
@@ -175,6 +540,10 @@ namespace cudau {
 
 
 
+    // JP: Kernelのブロックサイズを占有率が最大となるようにドライバーに問い合わせて決めることを示すタグ。
+    // EN: A tag to indicate that Kernel determines the block size by querying the driver for maximum occupancy.
+    struct AutoBlockDim {};
+
     class Kernel {
         CUfunction m_kernel;
         dim3 m_blockDim;
@@ -186,12 +555,24 @@ namespace cudau {
             m_blockDim(blockDim), m_sharedMemSize(sharedMemSize) {
             CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
         }
+        Kernel(CUmodule module, const char* name, AutoBlockDim, uint32_t sharedMemSize,
+               CUoccupancyB2DSize sharedMemSizeFunc = nullptr, uint32_t blockSizeLimit = 0) :
+            m_sharedMemSize(sharedMemSize) {
+            CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
+            setBlockDimensionsForMaxOccupancy(sharedMemSizeFunc, blockSizeLimit);
+        }
 
         void set(CUmodule module, const char* name, const dim3 blockDim, uint32_t sharedMemSize) {
             m_blockDim = blockDim;
             m_sharedMemSize = sharedMemSize;
             CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
         }
+        void set(CUmodule module, const char* name, AutoBlockDim, uint32_t sharedMemSize,
+                 CUoccupancyB2DSize sharedMemSizeFunc = nullptr, uint32_t blockSizeLimit = 0) {
+            m_sharedMemSize = sharedMemSize;
+            CUDADRV_CHECK(cuModuleGetFunction(&m_kernel, module, name));
+            setBlockDimensionsForMaxOccupancy(sharedMemSizeFunc, blockSizeLimit);
+        }
 
         void setBlockDimensions(const dim3 &blockDim) {
             m_blockDim = blockDim;
@@ -199,6 +580,14 @@ namespace cudau {
         void setSharedMemorySize(uint32_t sharedMemSize) {
             m_sharedMemSize = sharedMemSize;
         }
+        // JP: 占有率が最大となる1次元のブロックサイズを設定する。結果はCUfunctionごとにキャッシュされる。
+        //     sharedMemSizeFuncを与えるとブロックサイズに応じた動的共有メモリサイズも設定する。
+        //     与えない場合は現在の共有メモリサイズを前提とする。
+        // EN: Set the 1D block size achieving the maximum occupancy. The result is cached per CUfunction.
+        //     Giving sharedMemSizeFunc sets also the dynamic shared memory size depending on the block size.
+        //     Otherwise the current shared memory size is assumed.
+        void setBlockDimensionsForMaxOccupancy(CUoccupancyB2DSize sharedMemSizeFunc = nullptr,
+                                               uint32_t blockSizeLimit = 0);
 
         uint32_t getBlockDimX() const { return m_blockDim.x; }
         uint32_t getBlockDimY() const { return m_blockDim.y; }
@@ -216,10 +605,28 @@ namespace cudau {
                         (numItemsZ + m_blockDim.z - 1) / m_blockDim.z);
         }
 
+        // JP: 現在のブロックサイズと共有メモリサイズでデバイス全体を同時に埋めるブロック数。
+        //     パーシステントスレッドやグリッドストライドループのグリッドサイズに使う。
+        // EN: The number of blocks filling the entire device concurrently with
+        //     the current block size and shared memory size.
+        //     Use this as the grid size for persistent threads or grid-stride loops.
+        uint32_t getNumPersistentBlocks() const;
+        dim3 calcGridDimForGridStride(uint32_t numItemsX) const {
+            return dim3(std::min(calcGridDim(numItemsX).x, getNumPersistentBlocks()));
+        }
+
         template <typename... ArgTypes>
         void operator()(CUstream stream, const dim3 &gridDim, ArgTypes&&... args) const {
             callKernel(stream, m_kernel, gridDim, m_blockDim, m_sharedMemSize, std::forward<ArgTypes>(args)...);
         }
+        // JP: デバイス全体を同時に埋めるグリッドでローンチする。カーネルはグリッドストライドループで書く必要がある。
+        // EN: Launch with a grid filling the entire device concurrently.
+        //     The kernel needs to be written with grid-stride loops.
+        template <typename... ArgTypes>
+        void launchPersistent(CUstream stream, ArgTypes&&... args) const {
+            callKernel(stream, m_kernel, dim3(getNumPersistentBlocks()), m_blockDim, m_sharedMemSize,
+                       std::forward<ArgTypes>(args)...);
+        }
     };
 
 
@@ -260,13 +667,827 @@ namespace cudau {
 
 
 
+    // JP: 名前付きの入れ子区間をGPU上で計測するプロファイラー。
+    //     イベントはフレーム数分のリングに記録され、完了したものだけが非同期に解決されるので
+    //     計測のためにパイプラインがストールしない。
+    // EN: A profiler measuring named nested scopes on the GPU.
+    //     Events are recorded into a ring of frames and only completed ones are resolved asynchronously,
+    //     so measurement doesn't stall the pipeline.
+    class GpuProfiler {
+    public:
+        struct ScopeStats {
+            std::string name;
+            uint32_t depth;
+            // JP: フレーム開始からの開始時刻と長さ(ミリ秒)。
+            // EN: Start time from the frame begin and duration in milliseconds.
+            float startTime;
+            float duration;
+        };
+        struct FrameStats {
+            uint64_t frameIndex;
+            // JP: 最初のフレームの開始からのフレーム開始時刻(ミリ秒)。
+            // EN: Frame begin time from the begin of the first frame in milliseconds.
+            double frameStartTime;
+            float frameDuration;
+            std::vector<ScopeStats> scopes;
+        };
+
+    private:
+        struct Scope {
+            std::string name;
+            uint32_t depth;
+            CUevent beginEvent;
+            CUevent endEvent;
+        };
+        struct Frame {
+            uint64_t frameIndex;
+            CUevent beginEvent;
+            CUevent endEvent;
+            std::vector<Scope> scopes;
+            unsigned int inFlight : 1;
+        };
+
+        CUcontext m_cuContext;
+        std::vector<Frame> m_frames;
+        std::vector<CUevent> m_freeEvents;
+        std::vector<uint32_t> m_scopeStack;
+        CUevent m_originEvent;
+        uint64_t m_frameIndex;
+        uint64_t m_numDroppedFrames;
+        uint32_t m_maxNumHistoryFrames;
+        std::deque<FrameStats> m_history;
+        struct {
+            unsigned int m_originRecorded : 1;
+            unsigned int m_inFrame : 1;
+            unsigned int m_initialized : 1;
+        };
+
+        GpuProfiler(const GpuProfiler &) = delete;
+        GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+        CUevent acquireEvent();
+        void releaseFrameEvents(Frame &frame);
+        bool tryResolve(Frame &frame);
+
+    public:
+        GpuProfiler() :
+            m_cuContext(nullptr), m_originEvent(nullptr), m_frameIndex(0), m_numDroppedFrames(0),
+            m_maxNumHistoryFrames(0), m_originRecorded(false), m_inFrame(false), m_initialized(false) {}
+        ~GpuProfiler() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, uint32_t numFramesInFlight = 4, uint32_t maxNumHistoryFrames = 256);
+        void finalize();
+
+        void beginFrame(CUstream stream);
+        void endFrame(CUstream stream);
+        void pushScope(const char* name, CUstream stream);
+        void popScope(CUstream stream);
+
+        // JP: 完了したフレームを待たずに解決する。beginFrame()でも呼ばれる。
+        //     リングが一周しても完了していないフレームは破棄される。
+        // EN: Resolve completed frames without waiting. This is also called by beginFrame().
+        //     A frame not completed when the ring wraps around is dropped.
+        void poll();
+
+        bool getLatestFrameStats(FrameStats* stats) const {
+            if (m_history.empty())
+                return false;
+            *stats = m_history.back();
+            return true;
+        }
+        const std::deque<FrameStats> &getHistory() const {
+            return m_history;
+        }
+        uint64_t getNumDroppedFrames() const {
+            return m_numDroppedFrames;
+        }
+
+        // JP: 解決済みの履歴をChromeのトレース形式(chrome://tracing)のJSONで書き出す。
+        // EN: Write the resolved history as JSON in Chrome's trace format (chrome://tracing).
+        void writeChromeTrace(std::ostream &os) const;
+        // JP: 外側の"traceEvents"配列無しでイベント列のみを書き出す。
+        //     firstは配列中で最初の要素かどうかを保持し、他のプロファイラーのイベントと一つのトレースにまとめるのに使う。
+        // EN: Write only the sequence of events without the enclosing "traceEvents" array.
+        //     first holds whether the next one is the first element in the array,
+        //     used to merge events with other profilers' into one trace.
+        void writeChromeTraceEvents(std::ostream &os, bool* first, uint32_t pid = 0) const;
+    };
+
+    // JP: スコープの間だけ区間を計測するヘルパー。
+    // EN: A helper to measure a range for the duration of the scope.
+    class GpuProfileScope {
+        GpuProfiler* m_profiler;
+        CUstream m_stream;
+
+    public:
+        GpuProfileScope(GpuProfiler* profiler, const char* name, CUstream stream) :
+            m_profiler(profiler), m_stream(stream) {
+            if (m_profiler)
+                m_profiler->pushScope(name, m_stream);
+        }
+        // JP: デストラクターから例外を投げないように、失敗は報告するだけに留める。
+        // EN: Only report a failure so as not to throw from the destructor.
+        ~GpuProfileScope() {
+            if (!m_profiler)
+                return;
+            try {
+                m_profiler->popScope(m_stream);
+            }
+            catch (const std::exception &e) {
+                devPrintf("GpuProfileScope: %s\n", e.what());
+            }
+        }
+    };
+
+
+
     enum class BufferType {
         Device = 0,
         GL_Interop = 1,
-        ZeroCopy = 2, // TODO: test
+        // JP: デバイスにマップされたピン留めホストメモリー。GPUからの読み書きはアクセスのたびにPCIeを経由する。
+        //     map()はホストポインターを直接返し、WriteOnlyDiscard以外ではストリームを同期してから返すので、
+        //     ピック結果のような小さな読み戻し用バッファーに向く。大きなデータや繰り返し読むデータには向かない。
+        // EN: Pinned host memory mapped to the device. Every GPU read and write goes over PCIe.
+        //     map() directly returns the host pointer after synchronizing the stream unless WriteOnlyDiscard,
+        //     so this is suitable for small readback buffers like pick results.
+        //     This is not suitable for large data or data read repeatedly.
+        ZeroCopy = 2,
         Managed = 3, // TODO: test
+        // JP: cuMemAllocAsync()/cuMemFreeAsync()によりストリーム順で確保・解放されるデバイスメモリー。
+        //     cuMemFree()のような暗黙のデバイス同期が起こらないので一時的なバッファーに向く。
+        // EN: Device memory allocated and freed in stream order by cuMemAllocAsync()/cuMemFreeAsync().
+        //     This is suitable for transient buffers since it doesn't implicitly synchronize the device
+        //     unlike cuMemFree().
+        StreamOrdered = 4,
+        // JP: 大きな仮想アドレス範囲を予約し、拡大時に物理メモリーを追加でマップするデバイスメモリー。
+        //     拡大してもデバイスポインターが変わらずコピーも起こらない。
+        // EN: Device memory that reserves a large virtual address range and maps additional physical memory
+        //     on growth.
+        //     The device pointer doesn't change and no copy happens on growth.
+        VirtualMemory = 5,
+        // JP: Vulkan等の他のAPIからインポートした外部メモリー。
+        // EN: External memory imported from another API like Vulkan.
+        External = 6,
+        // JP: 書き込み結合のピン留めホストメモリー(CU_MEMHOSTALLOC_WRITECOMBINED)をデバイスにマップしたもの。
+        //     ホストからの書き込みはキャッシュを経由せずまとめて転送されるが、ホストからの読み出しは非常に遅い。
+        //     GPUからの読み出しもアクセスのたびにPCIeを経由するので、起動パラメターのように毎フレーム更新して
+        //     GPUが一度だけ読むストリーミングデータに使う。map()はストリームを同期しないので、
+        //     GPUが読んでいる最中のデータを上書きしないようにバッファーをリングにして使う。
+        // EN: Write-combined pinned host memory (CU_MEMHOSTALLOC_WRITECOMBINED) mapped to the device.
+        //     Host writes bypass the cache and are transferred in bursts, but host reads are extremely slow.
+        //     GPU reads also go over PCIe on every access, so use this for streaming data updated every frame
+        //     and read only once by the GPU like launch parameters.
+        //     map() doesn't synchronize the stream, so use buffers as a ring
+        //     to avoid overwriting data the GPU is still reading.
+        WriteCombined = 7,
+    };
+
+    // JP: メモリートラッカーが集計する確保の種類。Array以外はBufferTypeに対応する。
+    // EN: Kinds of allocations aggregated by the memory tracker. Each except Array corresponds to a BufferType.
+    enum class MemoryCategory {
+        Device = 0,
+        GL_Interop,
+        ZeroCopy,
+        Managed,
+        StreamOrdered,
+        VirtualMemory,
+        External,
+        WriteCombined,
+        Array,
+        NumCategories
+    };
+
+    // JP: BufferとArrayの確保を記録するメモリートラッカー。setEnabled(true)以降の確保が記録対象になる。
+    //     名前(setName())とともに生存中の確保を列挙できるので、長時間動作するアプリケーションでのリークの発見に使う。
+    // EN: A memory tracker recording allocations of Buffer and Array.
+    //     Allocations after setEnabled(true) are recorded.
+    //     This can enumerate live allocations with their names (setName()),
+    //     so use this to find leaks in long-running applications.
+    class MemoryTracker {
+    public:
+        struct Allocation {
+            uint64_t id;
+            MemoryCategory category;
+            size_t size;
+            std::string name;
+        };
+        struct Statistics {
+            size_t liveSize;
+            size_t highWaterMark;
+            uint32_t numLiveAllocations;
+            uint64_t numTotalAllocations;
+        };
+
+        static void setEnabled(bool enable);
+        static bool isEnabled();
+
+        static Statistics getStatistics();
+        static Statistics getStatistics(MemoryCategory category);
+        static void resetHighWaterMarks();
+        // JP: 生存中の確保をサイズの降順で返す。
+        // EN: Return the live allocations in descending order of size.
+        static std::vector<Allocation> getLiveAllocations();
+        static void dump(std::ostream &os);
+
+        // JP: BufferとArrayが内部で呼ぶ。記録しない場合は0を返す。
+        // EN: Buffer and Array call these internally. registerAllocation() returns 0 when not recording.
+        static uint64_t registerAllocation(MemoryCategory category, size_t size, const std::string &name);
+        static void updateAllocation(uint64_t id, size_t size);
+        static void setAllocationName(uint64_t id, const std::string &name);
+        static void unregisterAllocation(uint64_t id);
+    };
+
+    // JP: Vulkan等の他のAPIがエクスポートしたメモリーやセマフォのハンドル。
+    //     POSIXではfd、Windowsではwin32Handleを使う。インポートに成功したfdの所有権はCUDAに移る。
+    // EN: A handle of memory or a semaphore exported by another API like Vulkan.
+    //     fd is used on POSIX and win32Handle on Windows.
+    //     Ownership of fd moves to CUDA on a successful import.
+    enum class ExternalHandleType {
+        OpaqueFd = 0,
+        OpaqueWin32,
+        OpaqueWin32Kmt,
+    };
+
+    struct ExternalHandle {
+        ExternalHandleType type;
+        int fd;
+        void* win32Handle;
+    };
+
+    // JP: 外部APIとの同期に使うセマフォ。タイムラインセマフォの場合はsignal/waitに値を与える。
+    // EN: A semaphore for synchronization with an external API.
+    //     For a timeline semaphore, give values to signal/wait.
+    class ExternalSemaphore {
+        CUcontext m_cuContext;
+        CUexternalSemaphore m_semaphore;
+        struct {
+            unsigned int m_timeline : 1;
+            unsigned int m_initialized : 1;
+        };
+
+        ExternalSemaphore(const ExternalSemaphore &) = delete;
+        ExternalSemaphore &operator=(const ExternalSemaphore &) = delete;
+
+    public:
+        ExternalSemaphore() : m_cuContext(nullptr), m_semaphore(nullptr), m_timeline(false), m_initialized(false) {}
+        ~ExternalSemaphore() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, const ExternalHandle &handle, bool timeline = false);
+        void finalize();
+
+        void signal(CUstream stream, uint64_t value = 0) const;
+        void wait(CUstream stream, uint64_t value = 0) const;
+
+        CUexternalSemaphore getCUexternalSemaphore() const {
+            return m_semaphore;
+        }
     };
 
+    // JP: 仮想メモリー管理APIのシェアラブルハンドルを通じて他のプロセスと共有するデバイスメモリー。
+    //     インポート側はエクスポート側と同じ仮想アドレスへのマップを試みるので、
+    //     絶対アドレスを含むデータ(例: ビルド済みのAS)をそのまま読み取り専用で使える。
+    //     POSIXではfd、WindowsではNTハンドルを使う。ハンドルの受け渡し(UNIXドメインソケット等)はアプリケーションが行う。
+    // EN: Device memory shared with other processes through a shareable handle of the virtual memory management API.
+    //     The importer tries to map it to the same virtual address as the exporter,
+    //     so data containing absolute addresses (e.g. a built AS) can be used read-only as is.
+    //     fd is used on POSIX and an NT handle on Windows.
+    //     The application passes the handle (e.g. via a UNIX domain socket).
+    class SharedDeviceMemory {
+        CUcontext m_cuContext;
+        CUmemGenericAllocationHandle m_allocation;
+        CUdeviceptr m_devicePointer;
+        size_t m_size;
+        struct {
+            unsigned int m_imported : 1;
+            unsigned int m_initialized : 1;
+        };
+
+        SharedDeviceMemory(const SharedDeviceMemory &) = delete;
+        SharedDeviceMemory &operator=(const SharedDeviceMemory &) = delete;
+
+        bool map(CUdeviceptr fixedAddress, bool readOnly);
+
+    public:
+        SharedDeviceMemory() :
+            m_cuContext(nullptr), m_allocation(0), m_devicePointer(0), m_size(0),
+            m_imported(false), m_initialized(false) {}
+        ~SharedDeviceMemory() {
+            if (m_initialized)
+                finalize();
+        }
+
+        // JP: 割り当て粒度に切り上げたサイズで共有可能なメモリーを確保する。
+        // EN: Allocate shareable memory with the size rounded up to the allocation granularity.
+        void initialize(CUcontext context, size_t size);
+        // JP: エクスポートされたハンドルからメモリーをインポートし、読み取り専用でfixedAddressにマップする。
+        //     そのアドレスを予約できなかった場合はfalseを返し、初期化されないままになる。
+        //     fdの所有権は呼び出し側に残る。
+        // EN: Import memory from an exported handle and map it read-only at fixedAddress.
+        //     Return false and stay uninitialized if the address cannot be reserved.
+        //     Ownership of fd stays with the caller.
+        bool initializeFromSharedHandle(CUcontext context, const ExternalHandle &handle, size_t size,
+                                        CUdeviceptr fixedAddress);
+        void finalize();
+
+        // JP: 他のプロセスに渡すハンドルを生成する。生成されたfd/ハンドルは呼び出し側が閉じる。
+        // EN: Create a handle to pass to another process. The caller closes the created fd/handle.
+        ExternalHandle exportHandle() const;
+
+        CUdeviceptr getCUdeviceptr() const {
+            return m_devicePointer;
+        }
+        size_t sizeInBytes() const {
+            return m_size;
+        }
+        bool isImported() const {
+            return m_imported;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+    };
+
+    // JP: メモリープール(nullptrの場合は現在のデバイスのデフォルトプール)が保持する未使用メモリーの上限を設定する。
+    //     これを超えない限りストリーム順の解放でメモリーがOSに返されず、次の確保が安価になる。
+    // EN: Set the upper limit of unused memory retained by a memory pool
+    //     (the default pool of the current device when nullptr).
+    //     Unless exceeding this, stream-ordered freeing doesn't return memory to the OS,
+    //     making subsequent allocations cheap.
+    void setMemoryPoolReleaseThreshold(CUmemoryPool memoryPool, uint64_t releaseThreshold);
+
+    // JP: patternSizeバイトのパターンをnumValues個デバイス上で敷き詰める。ホストとの転送は起こらない。
+    //     パターンが4, 2, 1バイトの繰り返しの場合はcuMemsetD32/D16/D8Async()を1回、
+    //     それ以外はパターンの4, 2, 1バイトの列ごとにピッチ付きのcuMemsetD2D*Async()を使う。
+    // EN: Tile a pattern of patternSize bytes numValues times on the device. No transfer from the host happens.
+    //     This uses a single cuMemsetD32/D16/D8Async() when the pattern is a repetition of 4, 2 or 1 bytes,
+    //     otherwise pitched cuMemsetD2D*Async() per 4, 2 or 1-byte column of the pattern.
+    void fillDeviceMemory(CUdeviceptr dst, const void* pattern, uint32_t patternSize, size_t numValues,
+                          CUstream stream = 0);
+
+    // JP: contextからpeerContextのメモリーへのピアアクセスを有効化する。既に有効の場合も含め、可能ならtrueを返す。
+    // EN: Enable peer access from context to memory of peerContext.
+    //     Return true if possible, including the case it is already enabled.
+    bool enablePeerAccess(CUcontext context, CUcontext peerContext);
+    // JP: 異なるコンテキスト間でメモリーをコピーする。streamはdstContextのストリーム。
+    //     デバイス間でピアアクセスが可能ならcuMemcpyPeerAsync()を使い、
+    //     そうでなければピン留めメモリーを経由してコピーする(この場合は呼び出し中に完了まで待つ)。
+    // EN: Copy memory between different contexts. stream is a stream of dstContext.
+    //     This uses cuMemcpyPeerAsync() when peer access is possible between the devices,
+    //     otherwise copies via pinned memory (waiting for completion during the call in this case).
+    void copyAcrossContexts(CUdeviceptr dst, CUcontext dstContext, CUdeviceptr src, CUcontext srcContext,
+                            size_t size, CUstream stream);
+
+
+
+    // JP: 非同期転送の完了を表すトークン。
+    // EN: Token representing completion of an asynchronous transfer.
+    class TransferToken {
+        CUevent m_event;
+
+        TransferToken(const TransferToken &) = delete;
+        TransferToken &operator=(const TransferToken &) = delete;
+
+    public:
+        TransferToken() : m_event(nullptr) {}
+        explicit TransferToken(CUevent event) : m_event(event) {}
+        ~TransferToken() {
+            if (m_event)
+                CUDADRV_CHECK(cuEventDestroy(m_event));
+        }
+        TransferToken(TransferToken &&b) : m_event(b.m_event) {
+            b.m_event = nullptr;
+        }
+        TransferToken &operator=(TransferToken &&b) {
+            if (m_event)
+                CUDADRV_CHECK(cuEventDestroy(m_event));
+            m_event = b.m_event;
+            b.m_event = nullptr;
+            return *this;
+        }
+
+        CUevent getEvent() const {
+            return m_event;
+        }
+        bool isComplete() const {
+            if (!m_event)
+                return true;
+            CUresult res = cuEventQuery(m_event);
+            if (res == CUDA_ERROR_NOT_READY)
+                return false;
+            CUDADRV_CHECK(res);
+            return true;
+        }
+        void wait() const {
+            if (m_event)
+                CUDADRV_CHECK(cuEventSynchronize(m_event));
+        }
+    };
+
+    // JP: 対話的な描画用の高優先度ストリームと、バックグラウンドのAS構築、コンパクション、テクスチャーの
+    //     アップロード用の低優先度ストリームの組。
+    //     低優先度ストリームの作業は高優先度ストリームの作業が無いときにスケジュールされるので、
+    //     バックグラウンドのストリーミングがフレーム時間を奪いにくくなる。
+    //     バックグラウンドの作業の完了はイベントで描画ストリームに引き渡す。
+    //
+    //     cudau::PriorityStreams streams;
+    //     streams.initialize(cuContext);
+    //     gas.rebuild(streams.getBackgroundStream(), ...);
+    //     gas.compact(streams.getBackgroundStream(), ...);
+    //     cudau::TransferToken gasReady = streams.recordBackgroundCompletion();
+    //     // 毎フレーム
+    //     if (!gasAdded && streams.handOffToRender(gasReady)) {
+    //         ias.addChild(inst); // 次のIASの構築からGASが見える。
+    //         gasAdded = true;
+    //     }
+    //     ias.rebuild(streams.getRenderStream(), ...);
+    //
+    // EN: A pair of a high-priority stream for interactive rendering and a low-priority stream for
+    //     background AS builds, compaction and texture uploads.
+    //     Work on the low-priority stream is scheduled when there is no work on the high-priority stream,
+    //     so background streaming hardly steals frame time.
+    //     Completion of background work is handed off to the render stream with an event.
+    //
+    //     cudau::PriorityStreams streams;
+    //     streams.initialize(cuContext);
+    //     gas.rebuild(streams.getBackgroundStream(), ...);
+    //     gas.compact(streams.getBackgroundStream(), ...);
+    //     cudau::TransferToken gasReady = streams.recordBackgroundCompletion();
+    //     // every frame
+    //     if (!gasAdded && streams.handOffToRender(gasReady)) {
+    //         ias.addChild(inst); // The GAS is visible from the next IAS build.
+    //         gasAdded = true;
+    //     }
+    //     ias.rebuild(streams.getRenderStream(), ...);
+    class PriorityStreams {
+        CUcontext m_cuContext;
+        CUstream m_renderStream;
+        CUstream m_backgroundStream;
+
+        PriorityStreams(const PriorityStreams &) = delete;
+        PriorityStreams &operator=(const PriorityStreams &) = delete;
+
+    public:
+        PriorityStreams() : m_cuContext(nullptr), m_renderStream(nullptr), m_backgroundStream(nullptr) {}
+        ~PriorityStreams() {
+            if (m_cuContext)
+                finalize();
+        }
+
+        void initialize(CUcontext context) {
+            m_cuContext = context;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            // JP: 数値が小さいほど優先度が高い。
+            // EN: A lower number means a higher priority.
+            int32_t leastPriority;
+            int32_t greatestPriority;
+            CUDADRV_CHECK(cuCtxGetStreamPriorityRange(&leastPriority, &greatestPriority));
+            CUDADRV_CHECK(cuStreamCreateWithPriority(&m_renderStream, CU_STREAM_NON_BLOCKING, greatestPriority));
+            CUDADRV_CHECK(cuStreamCreateWithPriority(&m_backgroundStream, CU_STREAM_NON_BLOCKING, leastPriority));
+        }
+        void finalize() {
+            if (!m_cuContext)
+                return;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            CUDADRV_CHECK(cuStreamSynchronize(m_backgroundStream));
+            CUDADRV_CHECK(cuStreamSynchronize(m_renderStream));
+            CUDADRV_CHECK(cuStreamDestroy(m_backgroundStream));
+            CUDADRV_CHECK(cuStreamDestroy(m_renderStream));
+            m_backgroundStream = nullptr;
+            m_renderStream = nullptr;
+            m_cuContext = nullptr;
+        }
+
+        CUstream getRenderStream() const {
+            return m_renderStream;
+        }
+        CUstream getBackgroundStream() const {
+            return m_backgroundStream;
+        }
+
+        // JP: これまでに低優先度ストリームに積まれた作業の完了を表すトークンを返す。
+        // EN: Return a token representing completion of the work enqueued to the low-priority stream so far.
+        TransferToken recordBackgroundCompletion() const {
+            CUevent event;
+            CUDADRV_CHECK(cuEventCreate(&event, CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventRecord(event, m_backgroundStream));
+            return TransferToken(event);
+        }
+
+        // JP: トークンが完了していれば描画ストリームの後続の作業をそれに依存させてtrueを返す。
+        //     完了していなければ何もせずにfalseを返すので、描画ストリームがバックグラウンドの作業を待つことは無い。
+        // EN: If the token has completed, make the subsequent work of the render stream depend on it and return true.
+        //     Otherwise return false without doing anything, so the render stream never waits for background work.
+        bool handOffToRender(const TransferToken &token) const {
+            if (!token.isComplete())
+                return false;
+            waitOnRender(token);
+            return true;
+        }
+        // JP: 完了を問わずに描画ストリームの後続の作業をトークンに依存させる。
+        //     未完了の場合はGPU上で描画ストリームがバックグラウンドの作業を待つことになる。
+        // EN: Make the subsequent work of the render stream depend on the token regardless of completion.
+        //     If not completed, the render stream waits for the background work on the GPU.
+        void waitOnRender(const TransferToken &token) const {
+            if (token.getEvent())
+                CUDADRV_CHECK(cuStreamWaitEvent(m_renderStream, token.getEvent(), 0));
+        }
+    };
+
+    // JP: ページ可能なホストメモリーとデバイス間の転送をピン留めメモリーのチャンク経由で行うためのプール。
+    //     アップロードではCPUによるチャンクへのコピーと前のチャンクの転送がオーバーラップし、
+    //     呼び出しから戻った時点で転送元のメモリーを再利用できる。
+    //     ダウンロードではチャンクから転送先へのコピーもホスト関数としてストリームに積まれるので、
+    //     呼び出しはすぐに戻り、転送先はトークンの完了まで読んではいけない。
+    //     optixuはcudauに依存しないので、optixuのパイプラインは独自のピン留めメモリーのリングを内部に持つ。
+    // EN: A pool to transfer between pageable host memory and device via chunks of pinned memory.
+    //     For uploads, copying to a chunk by the CPU overlaps with the transfer of the previous chunk,
+    //     and the source memory can be reused when the call returns.
+    //     For downloads, copying from a chunk to the destination is also enqueued to the stream as a host function,
+    //     so the call returns immediately and the destination must not be read until the token completes.
+    //     optixu's pipeline has its own pinned ring privately since optixu doesn't depend on cudau.
+    class PinnedStagingPool {
+        struct Chunk {
+            uint8_t* hostPointer;
+            CUevent lastUse;
+        };
+
+        CUcontext m_cuContext;
+        uint8_t* m_hostMemory;
+        size_t m_chunkSize;
+        std::vector<Chunk> m_chunks;
+        uint32_t m_nextChunkIndex;
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        PinnedStagingPool(const PinnedStagingPool &) = delete;
+        PinnedStagingPool &operator=(const PinnedStagingPool &) = delete;
+
+        Chunk &acquireChunk(CUstream stream, bool waitOnHost);
+        TransferToken makeToken(CUstream stream) const;
+
+    public:
+        PinnedStagingPool() : m_cuContext(nullptr), m_hostMemory(nullptr), m_chunkSize(0),
+            m_nextChunkIndex(0), m_initialized(false) {}
+        ~PinnedStagingPool() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, size_t chunkSize = 4 * 1024 * 1024, uint32_t numChunks = 4);
+        void finalize();
+
+        TransferToken upload(CUdeviceptr dst, const void* src, size_t size, CUstream stream);
+        TransferToken download(void* dst, CUdeviceptr src, size_t size, CUstream stream);
+        // JP: 密に詰まった行の並びをCUDA配列に転送する。チャンクには行単位で詰められる。
+        // EN: Transfer a tightly packed sequence of rows to a CUDA array. Chunks are filled in units of rows.
+        TransferToken uploadToArray(CUarray dst, const void* src, size_t widthInBytes, uint32_t height, uint32_t depth,
+                                    CUstream stream, size_t dstXInBytes = 0, uint32_t dstY = 0);
+    };
+
+    // JP: 小さな結果を返すGPUクエリー(ピックなど)をホストを止めずに読み出すためのリング。
+    //     各スロットはデバイスメモリーとピン留めメモリーの組で、カーネルはbeginQuery()が返すデバイスメモリーに書き込む。
+    //     endQuery()はピン留めメモリーへの非同期コピーとイベントをストリームに積み、数フレーム後にpoll()が完了した結果を渡す。
+    //     デバイス側の結果は通常のデバイスメモリーなので、同じフレームの後続のカーネルからも安価に参照できる。
+    //     全スロットが使用中の場合のみbeginQuery()が最も古いクエリーの完了を待つ。
+    //
+    //     cudau::QueryRing<PickInfo> pickQueries;
+    //     pickQueries.initialize(cuContext);
+    //     while (rendering) {
+    //         pickQueries.poll([](const PickInfo &info, uint64_t tag) { /* 結果を使う */ });
+    //         plp.pickInfo = pickQueries.beginQuery(frameIndex);
+    //         launch(stream, plp);
+    //         pickQueries.endQuery(stream);
+    //     }
+    // EN: A ring to read back GPU queries returning a small result (e.g. picking) without stalling the host.
+    //     Each slot is a pair of device memory and pinned memory, and a kernel writes into the device memory
+    //     returned by beginQuery().
+    //     endQuery() enqueues an asynchronous copy to the pinned memory and an event to the stream,
+    //     then poll() hands the completed result over a few frames later.
+    //     The result on the device is ordinary device memory, so subsequent kernels in the same frame can
+    //     refer it cheaply as well.
+    //     beginQuery() waits for the completion of the oldest query only when all the slots are in use.
+    //
+    //     cudau::QueryRing<PickInfo> pickQueries;
+    //     pickQueries.initialize(cuContext);
+    //     while (rendering) {
+    //         pickQueries.poll([](const PickInfo &info, uint64_t tag) { /* use the result */ });
+    //         plp.pickInfo = pickQueries.beginQuery(frameIndex);
+    //         launch(stream, plp);
+    //         pickQueries.endQuery(stream);
+    //     }
+    template <typename T>
+    class QueryRing {
+        struct Slot {
+            CUevent event;
+            uint64_t tag;
+            bool pending;
+        };
+        struct Completed {
+            T result;
+            uint64_t tag;
+        };
+
+        CUcontext m_cuContext;
+        CUdeviceptr m_deviceMemory;
+        T* m_hostMemory;
+        std::vector<Slot> m_slots;
+        std::vector<Completed> m_completed;
+        T m_latestResult;
+        uint64_t m_latestTag;
+        uint32_t m_nextSlotIndex;
+        uint32_t m_curSlotIndex;
+        struct {
+            unsigned int m_initialized : 1;
+            unsigned int m_hasResult : 1;
+            unsigned int m_inQuery : 1;
+        };
+
+        QueryRing(const QueryRing &) = delete;
+        QueryRing &operator=(const QueryRing &) = delete;
+
+        void retire(uint32_t slotIdx) {
+            Slot &slot = m_slots[slotIdx];
+            m_completed.push_back(Completed{ m_hostMemory[slotIdx], slot.tag });
+            m_latestResult = m_hostMemory[slotIdx];
+            m_latestTag = slot.tag;
+            m_hasResult = true;
+            slot.pending = false;
+        }
+
+    public:
+        QueryRing() : m_cuContext(nullptr), m_deviceMemory(0), m_hostMemory(nullptr),
+            m_latestResult{}, m_latestTag(0), m_nextSlotIndex(0), m_curSlotIndex(0),
+            m_initialized(false), m_hasResult(false), m_inQuery(false) {}
+        ~QueryRing() {
+            if (m_initialized)
+                finalize();
+        }
+
+        // JP: 結果が数フレーム遅れて届くので、numSlotsはCPUがGPUに先行するフレーム数+1程度あれば待ちは発生しない。
+        // EN: Results arrive a few frames later, so with numSlots about the number of frames
+        //     the CPU runs ahead of the GPU + 1, waiting never occurs.
+        void initialize(CUcontext context, uint32_t numSlots = 4) {
+            if (m_initialized)
+                throw std::runtime_error("Query ring is already initialized.");
+            if (numSlots == 0)
+                throw std::runtime_error("The number of slots must be > 0.");
+
+            m_cuContext = context;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            CUDADRV_CHECK(cuMemAlloc(&m_deviceMemory, sizeof(T) * numSlots));
+            CUDADRV_CHECK(cuMemsetD8(m_deviceMemory, 0, sizeof(T) * numSlots));
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m_hostMemory), sizeof(T) * numSlots));
+            m_slots.resize(numSlots);
+            for (uint32_t i = 0; i < numSlots; ++i) {
+                Slot &slot = m_slots[i];
+                CUDADRV_CHECK(cuEventCreate(&slot.event, CU_EVENT_DISABLE_TIMING));
+                slot.tag = 0;
+                slot.pending = false;
+            }
+            m_completed.clear();
+            m_latestResult = T{};
+            m_latestTag = 0;
+            m_nextSlotIndex = 0;
+            m_curSlotIndex = 0;
+            m_hasResult = false;
+            m_inQuery = false;
+
+            m_initialized = true;
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            for (int i = static_cast<int>(m_slots.size()) - 1; i >= 0; --i) {
+                Slot &slot = m_slots[i];
+                CUDADRV_CHECK(cuEventSynchronize(slot.event));
+                CUDADRV_CHECK(cuEventDestroy(slot.event));
+            }
+            m_slots.clear();
+            m_completed.clear();
+            CUDADRV_CHECK(cuMemFreeHost(m_hostMemory));
+            m_hostMemory = nullptr;
+            CUDADRV_CHECK(cuMemFree(m_deviceMemory));
+            m_deviceMemory = 0;
+
+            m_cuContext = nullptr;
+
+            m_initialized = false;
+        }
+
+        // JP: 次のスロットを確保し、カーネルが結果を書き込むデバイスメモリーを返す。
+        //     tagはpoll()で結果とともに返される(例: フレーム番号)。
+        // EN: Acquire the next slot and return the device memory into which a kernel writes the result.
+        //     tag is returned with the result by poll() (e.g. a frame index).
+        T* beginQuery(uint64_t tag = 0) {
+            if (!m_initialized)
+                throw std::runtime_error("Query ring is not initialized.");
+            if (m_inQuery)
+                throw std::runtime_error("beginQuery() has already been called.");
+
+            m_curSlotIndex = m_nextSlotIndex;
+            m_nextSlotIndex = (m_nextSlotIndex + 1) % m_slots.size();
+            Slot &slot = m_slots[m_curSlotIndex];
+            // JP: リングを一周した場合は最も古いクエリーの完了を待つ。結果は次のpoll()で渡される。
+            // EN: Wait for the completion of the oldest query when the ring wraps around.
+            //     The result is handed over in the next poll().
+            if (slot.pending) {
+                CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+                CUDADRV_CHECK(cuEventSynchronize(slot.event));
+                retire(m_curSlotIndex);
+            }
+            slot.tag = tag;
+            m_inQuery = true;
+            return reinterpret_cast<T*>(m_deviceMemory + sizeof(T) * m_curSlotIndex);
+        }
+        // JP: 結果を書き込むカーネルと同じストリームに、ピン留めメモリーへのコピーとイベントを積む。
+        // EN: Enqueue a copy to the pinned memory and an event to the same stream as the kernel writing the result.
+        void endQuery(CUstream stream) {
+            if (!m_inQuery)
+                throw std::runtime_error("beginQuery() has not been called.");
+
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            Slot &slot = m_slots[m_curSlotIndex];
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(m_hostMemory + m_curSlotIndex,
+                                            m_deviceMemory + sizeof(T) * m_curSlotIndex,
+                                            sizeof(T), stream));
+            CUDADRV_CHECK(cuEventRecord(slot.event, stream));
+            slot.pending = true;
+            m_inQuery = false;
+        }
+
+        // JP: 完了したクエリーの結果を発行順にonCompleteに渡し、その数を返す。イベントの問い合わせのみで待つことはない。
+        // EN: Pass the results of completed queries to onComplete in issue order and return the number of them.
+        //     This only queries events and never waits.
+        template <typename Func>
+        uint32_t poll(const Func &onComplete) {
+            poll();
+            uint32_t numCompleted = static_cast<uint32_t>(m_completed.size());
+            for (const Completed &completed : m_completed)
+                onComplete(completed.result, completed.tag);
+            m_completed.clear();
+            return numCompleted;
+        }
+        // JP: 完了したクエリーを回収して最新の結果を更新し、新しい結果があったかを返す。
+        // EN: Retire completed queries to update the latest result, and return whether there was a new result.
+        bool poll() {
+            if (!m_initialized)
+                throw std::runtime_error("Query ring is not initialized.");
+
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            const uint32_t numSlots = static_cast<uint32_t>(m_slots.size());
+            // JP: 最も古いスロットから順に調べ、未完了のものが見つかったら止める。
+            // EN: Check from the oldest slot, and stop when an incomplete one is found.
+            uint32_t numPreviouslyCompleted = static_cast<uint32_t>(m_completed.size());
+            for (uint32_t i = 0; i < numSlots; ++i) {
+                uint32_t slotIdx = (m_nextSlotIndex + i) % numSlots;
+                Slot &slot = m_slots[slotIdx];
+                if (!slot.pending || (m_inQuery && slotIdx == m_curSlotIndex))
+                    continue;
+                CUresult res = cuEventQuery(slot.event);
+                if (res == CUDA_ERROR_NOT_READY)
+                    break;
+                CUDADRV_CHECK(res);
+                retire(slotIdx);
+            }
+            return m_completed.size() > numPreviouslyCompleted;
+        }
+        // JP: 発行済みの全クエリーの完了を待つ。
+        // EN: Wait for the completion of all the issued queries.
+        void waitAll() {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            for (const Slot &slot : m_slots) {
+                if (slot.pending)
+                    CUDADRV_CHECK(cuEventSynchronize(slot.event));
+            }
+            poll();
+        }
+
+        // JP: 最後に完了したクエリーの結果を返す。まだ無い場合はfalseを返す。
+        // EN: Return the result of the last completed query. Return false if there is none yet.
+        bool getLatestResult(T* result, uint64_t* tag = nullptr) const {
+            *result = m_latestResult;
+            if (tag)
+                *tag = m_latestTag;
+            return m_hasResult;
+        }
+        uint32_t getNumSlots() const {
+            return static_cast<uint32_t>(m_slots.size());
+        }
+    };
+
+
+
     //        ReadWrite: Do bidirectional transfers when mapping and unmapping.
     //         ReadOnly: Do not issue a host-to-device transfer when unmapping.
     // WriteOnlyDiscard: Do not issue a device-to-host transfer when mapping and
@@ -277,12 +1498,22 @@ namespace cudau {
         WriteOnlyDiscard
     };
 
+    // JP: マネージドメモリーへのアドバイス。
+    // EN: Advice for managed memory.
+    enum class MemoryAdvice {
+        ReadMostly = 0,
+        PreferredLocation,
+        AccessedBy
+    };
+
     class Buffer {
         CUcontext m_cuContext;
         BufferType m_type;
 
         uint32_t m_numElements;
         uint32_t m_stride;
+        uint32_t m_capacity;
+        float m_growthFactor;
 
         void* m_hostPointer;
         CUdeviceptr m_devicePointer;
@@ -292,6 +1523,25 @@ namespace cudau {
         uint32_t m_GLBufferID;
         CUgraphicsResource m_cudaGfxResource;
 
+        CUstream m_allocationStream;
+        CUmemoryPool m_memoryPool;
+
+        struct PhysicalMemoryChunk {
+            CUmemGenericAllocationHandle handle;
+            size_t size;
+        };
+        uint32_t m_maxNumElements;
+        size_t m_reservedSize;
+        size_t m_committedSize;
+        size_t m_allocationGranularity;
+        std::vector<PhysicalMemoryChunk> m_physicalChunks;
+
+        CUexternalMemory m_externalMemory;
+        uint64_t m_externalMemoryOffset;
+
+        std::string m_name;
+        uint64_t m_memoryTrackingId;
+
         struct {
             unsigned int m_initialized : 1;
             unsigned int m_persistentMappedMemory : 1;
@@ -301,8 +1551,12 @@ namespace cudau {
         Buffer(const Buffer &) = delete;
         Buffer &operator=(const Buffer &) = delete;
 
+        friend class InteropMapBatch;
+
         void initialize(CUcontext context, BufferType type,
                         uint32_t numElements, uint32_t stride, uint32_t glBufferID);
+        void reallocate(uint32_t capacity, uint32_t numElements, uint32_t stride, CUstream stream);
+        void commitVirtualMemory(size_t size);
 
     public:
         Buffer();
@@ -318,6 +1572,32 @@ namespace cudau {
                         uint32_t numElements, uint32_t stride) {
             initialize(context, type, numElements, stride, 0);
         }
+        // JP: BufferType::StreamOrderedのバッファーとしてstream上で確保する。
+        //     memoryPoolがnullptrの場合はデバイスのデフォルトプールを使う。
+        //     finalize()と再確保は最後に設定されたストリーム(resize()ではその引数のストリーム)の順序で行われる。
+        // EN: Allocate as a buffer of BufferType::StreamOrdered on stream.
+        //     The default pool of the device is used when memoryPool is nullptr.
+        //     finalize() and reallocation are done in the order of the last set stream
+        //     (the stream argument for resize()).
+        void initializeStreamOrdered(CUcontext context, uint32_t numElements, uint32_t stride,
+                                     CUstream stream, CUmemoryPool memoryPool = nullptr) {
+            m_allocationStream = stream;
+            m_memoryPool = memoryPool;
+            initialize(context, BufferType::StreamOrdered, numElements, stride, 0);
+        }
+        // JP: BufferType::VirtualMemoryのバッファーとしてmaxNumElements個分の仮想アドレス範囲を予約する。
+        //     容量はmaxNumElementsまで再確保無しで増やすことができ、ストライドは変更できない。
+        //     BufferViewを取ったままジオメトリや命令バッファーを拡大できる。
+        // EN: Reserve a virtual address range for maxNumElements as a buffer of BufferType::VirtualMemory.
+        //     The capacity can be increased up to maxNumElements without reallocation,
+        //     and the stride cannot be changed.
+        //     Geometry or instance buffers can grow while their BufferViews are kept.
+        void initializeVirtual(CUcontext context, uint32_t numElements, uint32_t stride, uint32_t maxNumElements) {
+            if (numElements > maxNumElements)
+                throw std::runtime_error("numElements must be <= maxNumElements.");
+            m_maxNumElements = maxNumElements;
+            initialize(context, BufferType::VirtualMemory, numElements, stride, 0);
+        }
         void initializeFromGLBuffer(CUcontext context, uint32_t stride, uint32_t glBufferID) {
 #if defined(CUDA_UTIL_USE_GL_INTEROP)
             GLint size;
@@ -332,9 +1612,35 @@ namespace cudau {
             throw std::runtime_error("Enable \"CUDA_UTIL_USE_GL_INTEROP\" at the top of this file if you use CUDA/OpenGL interoperability.");
 #endif
         }
+        // JP: 外部メモリーのoffsetからの範囲をBufferType::Externalのバッファーとしてインポートする。
+        //     memorySizeは外部メモリー全体のサイズ。サイズ変更はできない。
+        // EN: Import a range from offset of external memory as a buffer of BufferType::External.
+        //     memorySize is the size of the whole external memory. Resizing is not possible.
+        void initializeFromExternalMemory(CUcontext context, const ExternalHandle &handle,
+                                          size_t memorySize, uint64_t offset,
+                                          uint32_t numElements, uint32_t stride, bool dedicated = true);
         void finalize();
 
+        // JP: 要素数が容量以下でストライドが変わらない場合は再確保しない。
+        //     容量を超える場合は容量を現在の容量とgrowthFactorの積と要素数の大きい方まで増やす。
+        // EN: This doesn't reallocate when the number of elements is within the capacity and the stride doesn't change.
+        //     When exceeding the capacity, this increases the capacity to the larger of the current capacity
+        //     multiplied by growthFactor and the number of elements.
         void resize(uint32_t numElements, uint32_t stride, CUstream stream = 0);
+        // JP: 要素数を変えずに少なくともnumElements個分の容量を確保する。
+        // EN: Reserve the capacity for at least numElements without changing the number of elements.
+        void reserve(uint32_t numElements, CUstream stream = 0);
+        // JP: 容量を要素数に合わせて余分なメモリーを解放する。
+        // EN: Match the capacity to the number of elements to release the excess memory.
+        void shrinkToFit(CUstream stream = 0);
+        // JP: 容量を超えるresize()時の容量の増加率。1で要素数ちょうどに確保する。デフォルトは1.5。
+        // EN: Growth rate of the capacity at resize() exceeding the capacity.
+        //     1 allocates exactly the number of elements. The default is 1.5.
+        void setGrowthFactor(float growthFactor) {
+            if (growthFactor < 1.0f)
+                throw std::runtime_error("Growth factor must be >= 1.");
+            m_growthFactor = growthFactor;
+        }
 
         CUcontext getCUcontext() const {
             return m_cuContext;
@@ -342,6 +1648,14 @@ namespace cudau {
         BufferType getBufferType() const {
             return m_type;
         }
+        // JP: BufferType::StreamOrderedの場合に解放を行うストリームを変更する。
+        // EN: Change the stream on which freeing happens for BufferType::StreamOrdered.
+        void setAllocationStream(CUstream stream) {
+            m_allocationStream = stream;
+        }
+        CUstream getAllocationStream() const {
+            return m_allocationStream;
+        }
 
         CUdeviceptr getCUdeviceptr() const {
             return m_devicePointer;
@@ -364,13 +1678,41 @@ namespace cudau {
         uint32_t numElements() const {
             return m_numElements;
         }
+        uint32_t capacity() const {
+            return m_capacity;
+        }
         bool isInitialized() const {
             return m_initialized;
         }
 
+        // JP: メモリートラッカーに表示される名前。
+        // EN: The name shown in the memory tracker.
+        void setName(const std::string &name);
+        const std::string &getName() const {
+            return m_name;
+        }
+
         void beginCUDAAccess(CUstream stream);
         void endCUDAAccess(CUstream stream);
 
+        // JP: BufferType::Managedのバッファーの内容をdevice(ホストの場合はCU_DEVICE_CPU)に前もって移動する。
+        //     ページ単位のフォールトを避けるため、GPUでアクセスする前に呼ぶ。
+        // EN: Move the contents of a BufferType::Managed buffer to device (CU_DEVICE_CPU for host) in advance.
+        //     Call this before accessing on the GPU to avoid page-by-page faults.
+        void prefetch(CUstream stream, CUdevice device) const {
+            prefetchRange(0, m_numElements, stream, device);
+        }
+        void prefetchRange(uint32_t firstElement, uint32_t numElements, CUstream stream, CUdevice device) const;
+        // JP: BufferType::Managedのバッファーにアクセスパターンのアドバイスを設定(set = falseで解除)する。
+        //     ReadMostlyではdeviceは無視される。
+        // EN: Set (unset for set = false) an access pattern advice to a BufferType::Managed buffer.
+        //     device is ignored for ReadMostly.
+        void advise(MemoryAdvice advice, CUdevice device, bool set = true) const {
+            adviseRange(0, m_numElements, advice, device, set);
+        }
+        void adviseRange(uint32_t firstElement, uint32_t numElements,
+                         MemoryAdvice advice, CUdevice device, bool set = true) const;
+
         void setMappedMemoryPersistent(bool b);
         void* map(CUstream stream = 0, BufferMapFlag flag = BufferMapFlag::ReadWrite);
         template <typename T>
@@ -413,22 +1755,97 @@ namespace cudau {
         void read(std::vector<T> &values, CUstream stream = 0) const {
             read(values.data(), values.size(), stream);
         }
+        // JP: ステージングプール経由の非同期転送。
+        // EN: Asynchronous transfers via a staging pool.
+        template <typename T>
+        TransferToken writeAsync(const T* srcValues, uint32_t numValues, PinnedStagingPool &pool,
+                                 CUstream stream = 0) const {
+            const size_t transferSize = sizeof(T) * numValues;
+            if (transferSize > sizeInBytes())
+                throw std::runtime_error("Too large transfer");
+            return pool.upload(getCUdeviceptr(), srcValues, transferSize, stream);
+        }
+        template <typename T>
+        TransferToken readAsync(T* dstValues, uint32_t numValues, PinnedStagingPool &pool,
+                                CUstream stream = 0) const {
+            const size_t transferSize = sizeof(T) * numValues;
+            if (transferSize > sizeInBytes())
+                throw std::runtime_error("Too large transfer");
+            return pool.download(dstValues, getCUdeviceptr(), transferSize, stream);
+        }
         template <typename T>
         void fill(const T &value, CUstream stream = 0) const {
             size_t numValues = (static_cast<size_t>(m_stride) * m_numElements) / sizeof(T);
-            if (m_persistentMappedMemory) {
-                T* values = reinterpret_cast<T*>(m_mappedPointer);
-                for (int i = 0; i < numValues; ++i)
-                    values[i] = value;
-                write(values, numValues, stream);
-            }
-            else {
-                std::vector<T> values(numValues, value);
-                write(values, stream);
-            }
+            fillDeviceMemory(getCUdeviceptr(), &value, sizeof(T), numValues, stream);
         }
 
         Buffer copy(CUstream stream = 0) const;
+        // JP: 別のコンテキスト(GPU)に同じ内容のバッファーを作る。streamはtargetContextのストリーム。
+        // EN: Create a buffer with the same contents on another context (GPU).
+        //     stream is a stream of targetContext.
+        Buffer copyTo(CUcontext targetContext, CUstream stream = 0) const;
+    };
+
+
+
+    // JP: 複数のコンテキスト(GPU)それぞれに同じサイズのバッファーを持ち、内容を同期するためのヘルパー。
+    // EN: Helper to hold buffers of the same size on each of multiple contexts (GPUs) and to sync their contents.
+    class ReplicatedBuffer {
+        std::vector<Buffer> m_replicas;
+
+        ReplicatedBuffer(const ReplicatedBuffer &) = delete;
+        ReplicatedBuffer &operator=(const ReplicatedBuffer &) = delete;
+
+    public:
+        ReplicatedBuffer() {}
+
+        void initialize(const CUcontext* contexts, uint32_t numContexts, BufferType type,
+                        uint32_t numElements, uint32_t stride) {
+            if (!m_replicas.empty())
+                throw std::runtime_error("ReplicatedBuffer is already initialized.");
+            m_replicas.resize(numContexts);
+            for (uint32_t i = 0; i < numContexts; ++i)
+                m_replicas[i].initialize(contexts[i], type, numElements, stride);
+            // JP: 可能な組み合わせでピアアクセスを有効化しておく。
+            // EN: Enable peer access for possible combinations.
+            for (uint32_t i = 0; i < numContexts; ++i) {
+                for (uint32_t j = 0; j < numContexts; ++j) {
+                    if (i != j)
+                        enablePeerAccess(contexts[i], contexts[j]);
+                }
+            }
+        }
+        void finalize() {
+            for (int i = static_cast<int>(m_replicas.size()) - 1; i >= 0; --i)
+                m_replicas[i].finalize();
+            m_replicas.clear();
+        }
+
+        uint32_t getNumReplicas() const {
+            return static_cast<uint32_t>(m_replicas.size());
+        }
+        Buffer &getReplica(uint32_t index) {
+            return m_replicas[index];
+        }
+        const Buffer &getReplica(uint32_t index) const {
+            return m_replicas[index];
+        }
+
+        // JP: srcIndex番目のレプリカの内容を他の全てのレプリカにコピーする。
+        //     streamsはレプリカごとのストリーム(各レプリカのコンテキストのもの)。srcIndex番目は使われない。
+        // EN: Copy the contents of the srcIndex-th replica to all the other replicas.
+        //     streams are streams per replica (of each replica's context). The srcIndex-th one is not used.
+        void broadcast(uint32_t srcIndex, const CUstream* streams) const {
+            const Buffer &src = m_replicas[srcIndex];
+            for (uint32_t i = 0; i < m_replicas.size(); ++i) {
+                if (i == srcIndex)
+                    continue;
+                const Buffer &dst = m_replicas[i];
+                copyAcrossContexts(dst.getCUdeviceptr(), dst.getCUcontext(),
+                                   src.getCUdeviceptr(), src.getCUcontext(),
+                                   src.sizeInBytes(), streams[i]);
+            }
+        }
     };
 
 
@@ -482,6 +1899,19 @@ namespace cudau {
             Buffer::resize(numElements, sizeof(T), stream);
             CUDADRV_CHECK(cuMemcpyHtoDAsync(Buffer::getCUdeviceptr(), values.data(), values.size() * sizeof(T), stream));
         }
+        // JP: 末尾に要素を追加する。容量が足りない場合のみ再確保が起こる。
+        // EN: Append elements to the end. Reallocation happens only when the capacity is not enough.
+        void pushBack(const T &value, CUstream stream = 0) {
+            append(&value, 1, stream);
+        }
+        void append(const T* values, uint32_t numValues, CUstream stream = 0) {
+            const uint32_t offset = numElements();
+            Buffer::resize(offset + numValues, sizeof(T), stream);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(getCUdeviceptrAt(offset), values, numValues * sizeof(T), stream));
+        }
+        void append(const std::vector<T> &values, CUstream stream = 0) {
+            append(values.data(), static_cast<uint32_t>(values.size()), stream);
+        }
 
         T* getDevicePointer() const {
             return reinterpret_cast<T*>(getCUdeviceptr());
@@ -511,6 +1941,14 @@ namespace cudau {
         void fill(const T &value, CUstream stream = 0) const {
             Buffer::fill<T>(value, stream);
         }
+        TransferToken writeAsync(const T* srcValues, uint32_t numValues, PinnedStagingPool &pool,
+                                 CUstream stream = 0) const {
+            return Buffer::writeAsync<T>(srcValues, numValues, pool, stream);
+        }
+        TransferToken readAsync(T* dstValues, uint32_t numValues, PinnedStagingPool &pool,
+                                CUstream stream = 0) const {
+            return Buffer::readAsync<T>(dstValues, numValues, pool, stream);
+        }
 
         // TODO: ? stream
         T operator[](uint32_t idx) {
@@ -530,6 +1968,248 @@ namespace cudau {
 
 
 
+    // JP: バッファー中の一部の範囲。optixu::BufferViewなどに変換できる。
+    // EN: A sub-range in a buffer. This can be converted to optixu::BufferView and so on.
+    struct BufferSubRange {
+        CUdeviceptr devicePointer;
+        uint32_t numElements;
+        uint32_t stride;
+
+        template <typename T>
+        inline operator T() const;
+    };
+
+    // JP: フィールドごとに連続した配列を持つStructure-of-Arraysのバッファー。
+    //     単一の確保をフィールドごとにアラインした部分範囲に分けて使う。
+    //     一部のフィールドしか触らないカーネルが不要なデータをキャッシュに読み込まずに済む。
+    // EN: A Structure-of-Arrays buffer which has a contiguous array per field.
+    //     This splits a single allocation into sub-ranges aligned per field.
+    //     Kernels touching only some fields don't need to pull unnecessary data through the cache.
+    template <typename... Fields>
+    class SoABuffer {
+    public:
+        static constexpr uint32_t numFields = sizeof...(Fields);
+        template <uint32_t I>
+        using FieldType = typename detail::SoAFieldType<I, Fields...>::Type;
+
+    private:
+        static constexpr size_t s_fieldAlignment = 256;
+
+        Buffer m_buffer;
+        uint32_t m_numElements;
+        size_t m_offsets[numFields];
+
+        size_t computeOffsets(uint32_t numElements, size_t* offsets) const {
+            constexpr size_t fieldSizes[] = { sizeof(Fields)... };
+            size_t offset = 0;
+            for (uint32_t i = 0; i < numFields; ++i) {
+                offsets[i] = offset;
+                offset += fieldSizes[i] * numElements;
+                offset = (offset + s_fieldAlignment - 1) / s_fieldAlignment * s_fieldAlignment;
+            }
+            return offset;
+        }
+
+    public:
+        SoABuffer() : m_numElements(0), m_offsets{} {}
+        SoABuffer(CUcontext context, BufferType type, uint32_t numElements) : SoABuffer() {
+            initialize(context, type, numElements);
+        }
+
+        SoABuffer(const SoABuffer &) = delete;
+        SoABuffer &operator=(const SoABuffer &) = delete;
+
+        void initialize(CUcontext context, BufferType type, uint32_t numElements) {
+            if (m_buffer.isInitialized())
+                throw std::runtime_error("Buffer is already initialized.");
+            if (type == BufferType::GL_Interop || type == BufferType::External)
+                throw std::runtime_error("SoABuffer doesn't support this buffer type.");
+            const size_t totalSize = computeOffsets(numElements, m_offsets);
+            if (totalSize > UINT32_MAX)
+                throw std::runtime_error("Total size exceeds the limit.");
+            m_buffer.initialize(context, type, static_cast<uint32_t>(std::max<size_t>(totalSize, 1)), 1);
+            m_numElements = numElements;
+        }
+        void finalize() {
+            m_buffer.finalize();
+            m_numElements = 0;
+        }
+
+        // JP: 各フィールドの先頭から小さい方の要素数分だけ内容を保持する。
+        // EN: Keep the contents of each field up to the smaller number of elements.
+        void resize(uint32_t numElements, CUstream stream = 0) {
+            if (!m_buffer.isInitialized())
+                throw std::runtime_error("Buffer is not initialized.");
+            if (numElements == m_numElements)
+                return;
+
+            size_t newOffsets[numFields];
+            const size_t totalSize = computeOffsets(numElements, newOffsets);
+            if (totalSize > UINT32_MAX)
+                throw std::runtime_error("Total size exceeds the limit.");
+            Buffer newBuffer;
+            newBuffer.initialize(m_buffer.getCUcontext(), m_buffer.getBufferType(),
+                                 static_cast<uint32_t>(std::max<size_t>(totalSize, 1)), 1);
+
+            constexpr size_t fieldSizes[] = { sizeof(Fields)... };
+            const uint32_t numElementsToCopy = std::min(numElements, m_numElements);
+            if (numElementsToCopy > 0) {
+                for (uint32_t i = 0; i < numFields; ++i)
+                    CUDADRV_CHECK(cuMemcpyDtoDAsync(newBuffer.getCUdeviceptr() + newOffsets[i],
+                                                    m_buffer.getCUdeviceptr() + m_offsets[i],
+                                                    fieldSizes[i] * numElementsToCopy, stream));
+                CUDADRV_CHECK(cuStreamSynchronize(stream));
+            }
+
+            m_buffer = std::move(newBuffer);
+            std::copy_n(newOffsets, numFields, m_offsets);
+            m_numElements = numElements;
+        }
+
+        bool isInitialized() const {
+            return m_buffer.isInitialized();
+        }
+        uint32_t numElements() const {
+            return m_numElements;
+        }
+        size_t sizeInBytes() const {
+            return m_buffer.sizeInBytes();
+        }
+
+        template <uint32_t I>
+        CUdeviceptr getCUdeviceptr() const {
+            static_assert(I < numFields, "Field index is out of range.");
+            return m_buffer.getCUdeviceptr() + m_offsets[I];
+        }
+        template <uint32_t I>
+        FieldType<I>* getDevicePointer() const {
+            return reinterpret_cast<FieldType<I>*>(getCUdeviceptr<I>());
+        }
+        // JP: フィールドの範囲。GeometryInstance::setVertexBuffer()などにそのまま渡せる。
+        // EN: The range of a field. This can be passed directly to GeometryInstance::setVertexBuffer() and so on.
+        template <uint32_t I>
+        BufferSubRange getFieldRange() const {
+            return BufferSubRange{ getCUdeviceptr<I>(), m_numElements, static_cast<uint32_t>(sizeof(FieldType<I>)) };
+        }
+        SoAView<Fields...> getView() const {
+            SoAView<Fields...> ret;
+            for (uint32_t i = 0; i < numFields; ++i)
+                ret.fields[i] = reinterpret_cast<void*>(m_buffer.getCUdeviceptr() + m_offsets[i]);
+            ret.numElements = m_numElements;
+            return ret;
+        }
+
+        template <uint32_t I>
+        void write(const FieldType<I>* srcValues, uint32_t numValues, CUstream stream = 0) const {
+            if (numValues > m_numElements)
+                throw std::runtime_error("Too many values.");
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(getCUdeviceptr<I>(), srcValues, numValues * sizeof(FieldType<I>), stream));
+        }
+        template <uint32_t I>
+        void write(const std::vector<FieldType<I>> &values, CUstream stream = 0) const {
+            write<I>(values.data(), static_cast<uint32_t>(values.size()), stream);
+        }
+        template <uint32_t I>
+        void read(FieldType<I>* dstValues, uint32_t numValues, CUstream stream = 0) const {
+            if (numValues > m_numElements)
+                throw std::runtime_error("Too many values.");
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(dstValues, getCUdeviceptr<I>(), numValues * sizeof(FieldType<I>), stream));
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+        }
+        template <uint32_t I>
+        void read(std::vector<FieldType<I>> &values, CUstream stream = 0) const {
+            read<I>(values.data(), static_cast<uint32_t>(values.size()), stream);
+        }
+    };
+
+
+
+    // JP: 大きなスラブから指定アラインメントの領域を切り出すデバイスメモリアリーナ。
+    //     小さなcuMemAllocを大量に行うことによるVRAMの断片化やヒッチを避ける。
+    //     解放された領域は隣接する空き領域と結合され、空になったスラブはtrim()で解放できる。
+    // EN: A device memory arena that cuts out regions with the specified alignment from large slabs.
+    //     This avoids VRAM fragmentation and hitches caused by a large number of small cuMemAlloc calls.
+    //     A released region is merged with adjacent free regions, and empty slabs can be released by trim().
+    class DeviceMemoryArena {
+    public:
+        struct Allocation {
+            CUdeviceptr devicePointer;
+            size_t size;
+            uint32_t slabIndex;
+            size_t offset;
+
+            Allocation() : devicePointer(0), size(0), slabIndex(0xFFFFFFFF), offset(0) {}
+
+            bool isValid() const {
+                return devicePointer != 0;
+            }
+
+            template <typename T>
+            inline operator T() const;
+        };
+
+        struct Stats {
+            uint32_t numSlabs;
+            uint32_t numAllocations;
+            size_t reservedSize;
+            size_t usedSize;
+            size_t largestFreeBlockSize;
+        };
+
+    private:
+        struct FreeBlock {
+            size_t offset;
+            size_t size;
+        };
+        struct Slab {
+            CUdeviceptr devicePointer;
+            size_t size;
+            size_t usedSize;
+            uint32_t numAllocations;
+            std::vector<FreeBlock> freeBlocks; // sorted by offset
+        };
+
+        CUcontext m_cuContext;
+        size_t m_slabSize;
+        uint32_t m_alignment;
+        std::vector<Slab> m_slabs;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        DeviceMemoryArena(const DeviceMemoryArena &) = delete;
+        DeviceMemoryArena &operator=(const DeviceMemoryArena &) = delete;
+
+        bool allocateFromSlab(uint32_t slabIndex, size_t size, Allocation* alloc);
+
+    public:
+        DeviceMemoryArena();
+        ~DeviceMemoryArena();
+
+        void initialize(CUcontext context, size_t slabSize, uint32_t alignment);
+        void finalize();
+
+        Allocation allocate(size_t size);
+        void release(const Allocation &alloc);
+        // JP: 使用中の領域を持たないスラブを解放する。
+        // EN: Release slabs which have no used region.
+        void trim();
+
+        CUcontext getCUcontext() const {
+            return m_cuContext;
+        }
+        uint32_t getAlignment() const {
+            return m_alignment;
+        }
+        bool isInitialized() const {
+            return m_initialized;
+        }
+        void getStats(Stats* stats) const;
+    };
+
+
+
     enum class ArrayElementType {
         UInt8,
         Int8,
@@ -588,6 +2268,13 @@ namespace cudau {
         uint32_t m_GLTexID;
         CUgraphicsResource m_cudaGfxResource;
 
+        CUexternalMemory m_externalMemory;
+        CUmipmappedArray m_externalMipmappedArray;
+        uint64_t m_externalMemoryOffset;
+
+        std::string m_name;
+        uint64_t m_memoryTrackingId;
+
         struct {
             unsigned int m_surfaceLoadStore : 1;
             unsigned int m_useTextureGather : 1;
@@ -599,9 +2286,12 @@ namespace cudau {
         Array(const Array &) = delete;
         Array &operator=(const Array &) = delete;
 
+        friend class InteropMapBatch;
+
         void initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
                         uint32_t width, uint32_t height, uint32_t depth, uint32_t numMipmapLevels,
                         bool writable, bool useTextureGather, bool cubemap, bool layered, uint32_t glTexID);
+        void resizeImpl(uint32_t width, uint32_t height, uint32_t depth, CUstream stream);
 
     public:
         Array();
@@ -627,9 +2317,19 @@ namespace cudau {
         void initialize3D(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
                           ArraySurface surfaceLoadStore,
                           uint32_t width, uint32_t height, uint32_t depth, uint32_t numMipmapLevels) {
-            initialize(context, elemType, numChannels, width, height, 0, numMipmapLevels,
+            initialize(context, elemType, numChannels, width, height, depth, numMipmapLevels,
                        surfaceLoadStore == ArraySurface::Enable, false, false, false, 0);
         }
+        // JP: 外部メモリー(例: Vulkanのイメージのメモリー)のoffsetの位置を2Dの配列としてインポートする。
+        //     要素の形式とサイズはエクスポート元のイメージと一致させる必要がある。
+        // EN: Import the location at offset of external memory (e.g. memory of a Vulkan image) as a 2D array.
+        //     The element format and size need to match the exporting image.
+        void initializeFromExternalMemory2D(CUcontext context, const ExternalHandle &handle,
+                                            size_t memorySize, uint64_t offset,
+                                            ArrayElementType elemType, uint32_t numChannels,
+                                            ArraySurface surfaceLoadStore, ArrayTextureGather useTextureGather,
+                                            uint32_t width, uint32_t height, uint32_t numMipmapLevels,
+                                            bool dedicated = true);
         void initializeFromGLTexture2D(CUcontext context, uint32_t glTexID,
                                        ArraySurface surfaceLoadStore, ArrayTextureGather useTextureGather) {
 #if defined(CUDA_UTIL_USE_GL_INTEROP)
@@ -657,10 +2357,30 @@ namespace cudau {
         }
         void finalize();
 
+        // JP: stream上で配列を作り直し、重なる領域の内容を各ミップレベルについてデバイス上でコピーする。
+        //     コピーはホストを経由しないが、配列はストリーム順に解放できないので古い配列の解放前にstreamを同期する。
+        //     大きさが変わらない場合は何もしない(インターロップの配列でも可)。
+        //     新しい大きさで作れないミップレベルは落とされる。大きさはBCフォーマットの場合もテクセル単位で指定する。
+        // EN: Recreate the array on stream and copy the contents of the overlapping region on the device
+        //     for each mip level. The copy doesn't go through the host, but arrays cannot be freed in stream order,
+        //     so stream is synchronized before freeing the old array.
+        //     This does nothing when the size doesn't change (allowed also for an interop array).
+        //     Mip levels that cannot be made with the new size are dropped.
+        //     The size is specified in texels also for BC formats.
         void resize(uint32_t length, CUstream stream = 0);
         void resize(uint32_t width, uint32_t height, CUstream stream = 0);
         void resize(uint32_t width, uint32_t height, uint32_t depth, CUstream stream = 0);
 
+        // JP: 同じ要素フォーマットの配列からデバイス上で非同期にコピーする。大きさやミップレベル数が異なる場合は
+        //     重なる領域だけをコピーする。
+        // EN: Copy asynchronously on the device from an array with the same element format.
+        //     If the sizes or numbers of mip levels differ, only the overlapping region is copied.
+        void copyFrom(const Array &src, CUstream stream = 0);
+        // JP: 同じ内容の配列を作る。外部メモリーの配列のコピーは通常の配列として確保される。
+        // EN: Create an array with the same contents.
+        //     A copy of an array from external memory is allocated as a regular array.
+        Array copy(CUstream stream = 0) const;
+
         CUarray getCUarray(uint32_t mipmapLevel) const {
             if (m_GLTexID) {
                 if (m_mappedArrays[mipmapLevel] == nullptr)
@@ -691,6 +2411,9 @@ namespace cudau {
         uint32_t getDepth() const {
             return m_depth;
         }
+        uint32_t getStride() const {
+            return m_stride;
+        }
         uint32_t getNumMipmapLevels() const {
             return m_numMipmapLevels;
         }
@@ -698,6 +2421,13 @@ namespace cudau {
             return m_initialized;
         }
 
+        // JP: メモリートラッカーに表示される名前。
+        // EN: The name shown in the memory tracker.
+        void setName(const std::string &name);
+        const std::string &getName() const {
+            return m_name;
+        }
+
         void beginCUDAAccess(CUstream stream, uint32_t mipmapLevel);
         void endCUDAAccess(CUstream stream, uint32_t mipmapLevel);
 
@@ -719,6 +2449,12 @@ namespace cudau {
             std::copy_n(srcValues, numValues, dstValues);
             unmap(mipmapLevel, stream);
         }
+        // JP: ステージングプール経由でミップレベルを非同期に書き込む。
+        //     トークンを使ってレベル単位で完了を確認できる。
+        // EN: Write a mip level asynchronously via a staging pool.
+        //     The token allows checking completion per level.
+        TransferToken writeAsync(const void* srcData, size_t size, uint32_t mipmapLevel,
+                                 PinnedStagingPool &pool, CUstream stream = 0) const;
         template <typename T>
         void read(T* dstValues, uint32_t numValues, uint32_t mipmapLevel = 0, CUstream stream = 0) {
             uint32_t width = std::max<uint32_t>(1, m_width >> mipmapLevel);
@@ -745,6 +2481,14 @@ namespace cudau {
 
         CUDA_RESOURCE_VIEW_DESC getResourceViewDesc() const;
 
+        // JP: レベル0から順に各ミップレベルをGPU上で生成する。サーフェスのロード/ストアを有効にした2Dの配列が必要。
+        //     downsampleKernelはCUDAU_DEFINE_MIPMAP_KERNELで定義したカーネル。
+        // EN: Generate each mip level from level 0 on the GPU.
+        //     This requires a 2D array with surface load/store enabled.
+        //     downsampleKernel is a kernel defined by CUDAU_DEFINE_MIPMAP_KERNEL.
+        void generateMipmaps(CUstream stream, const Kernel &downsampleKernel,
+                             MipmapFilter filter = MipmapFilter::Box, bool sRGB = false) const;
+
         CUsurfObject getSurfaceObject(uint32_t mipmapLevel) const {
             return m_surfObjs[mipmapLevel];
         }
@@ -769,6 +2513,34 @@ namespace cudau {
         }
     };
 
+    // JP: 複数のOpenGL連携リソースのマップとアンマップをそれぞれ一度の呼び出しにまとめる。
+    //     リソースごとに呼ぶとその度にOpenGLとCUDAのキューの同期が起こる。
+    // EN: Batch mapping and unmapping of multiple OpenGL-interop resources into a single call each.
+    //     Calling per resource synchronizes the OpenGL and CUDA queues every time.
+    class InteropMapBatch {
+        std::vector<Buffer*> m_buffers;
+        std::vector<Array*> m_arrays;
+        std::vector<CUgraphicsResource> m_resources;
+        CUcontext m_cuContext;
+
+    public:
+        InteropMapBatch() : m_cuContext(nullptr) {}
+
+        void add(Buffer* buffer);
+        void add(Array* array);
+        void clear() {
+            m_buffers.clear();
+            m_arrays.clear();
+            m_resources.clear();
+            m_cuContext = nullptr;
+        }
+
+        void beginCUDAAccess(CUstream stream);
+        void endCUDAAccess(CUstream stream);
+    };
+
+
+
     // MIP-level 0 only
     template <uint32_t NumBuffers>
     class InteropSurfaceObjectHolder {
@@ -810,6 +2582,92 @@ namespace cudau {
 
 
 
+    // JP: 複数のOpenGLテクスチャーを巡回して使う表示用のホルダー。
+    //     CUDAがバッファーNに描画している間、OpenGLはN-1を表示する。
+    //     OpenGLが読む前にアンマップが必要なためマップは毎フレーム行われるが、
+    //     描画先はOpenGLが既に使い終えたテクスチャーなのでマップに伴う待ちが生じにくい。
+    //     他のリソースと一緒にマップする場合はgetRenderArray()をInteropMapBatchに加え、
+    //     バッチのアンマップ後にpresent()を呼ぶ。
+    // EN: A holder for presentation rotating multiple OpenGL textures.
+    //     While CUDA renders into buffer N, OpenGL displays N-1.
+    //     Mapping still happens every frame since unmapping is required before OpenGL reads,
+    //     but the render target is a texture OpenGL has already finished with, so mapping rarely stalls.
+    //     To map together with other resources, add getRenderArray() to an InteropMapBatch
+    //     and call present() after unmapping the batch.
+    template <uint32_t NumBuffers>
+    class InteropSurfacePresenter {
+        static_assert(NumBuffers >= 2, "NumBuffers must be at least 2.");
+
+        Array* m_arrays[NumBuffers];
+        CUsurfObject m_surfObjs[NumBuffers];
+        uint32_t m_renderIndex;
+        uint32_t m_displayIndex;
+
+    public:
+        InteropSurfacePresenter() : m_renderIndex(0), m_displayIndex(0) {
+            for (int i = 0; i < NumBuffers; ++i) {
+                m_arrays[i] = nullptr;
+                m_surfObjs[i] = 0;
+            }
+        }
+
+        // JP: arraysはOpenGLテクスチャーから生成したNumBuffers個の配列。
+        // EN: arrays are NumBuffers arrays created from OpenGL textures.
+        void initialize(Array* arrays) {
+            for (int i = 0; i < NumBuffers; ++i) {
+                m_arrays[i] = &arrays[i];
+                m_surfObjs[i] = 0;
+            }
+            m_renderIndex = 0;
+            m_displayIndex = NumBuffers - 1;
+        }
+        void finalize() {
+            for (int i = 0; i < NumBuffers; ++i) {
+                if (m_surfObjs[i])
+                    CUDADRV_CHECK(cuSurfObjectDestroy(m_surfObjs[i]));
+                m_surfObjs[i] = 0;
+                m_arrays[i] = nullptr;
+            }
+            m_renderIndex = 0;
+            m_displayIndex = 0;
+        }
+
+        void beginCUDAAccess(CUstream stream) {
+            m_arrays[m_renderIndex]->beginCUDAAccess(stream, 0);
+        }
+        // JP: 描画先をアンマップし、それを表示用に回す。
+        // EN: Unmap the render target and pass it to presentation.
+        void endCUDAAccess(CUstream stream) {
+            m_arrays[m_renderIndex]->endCUDAAccess(stream, 0);
+            present();
+        }
+        void present() {
+            m_displayIndex = m_renderIndex;
+            m_renderIndex = (m_renderIndex + 1) % NumBuffers;
+        }
+        CUsurfObject getSurfaceObject() {
+            CUsurfObject &curSurfObj = m_surfObjs[m_renderIndex];
+            if (curSurfObj)
+                CUDADRV_CHECK(cuSurfObjectDestroy(curSurfObj));
+            curSurfObj = m_arrays[m_renderIndex]->createGLSurfaceObject(0);
+            return curSurfObj;
+        }
+
+        Array* getRenderArray() const {
+            return m_arrays[m_renderIndex];
+        }
+        uint32_t getRenderIndex() const {
+            return m_renderIndex;
+        }
+        // JP: OpenGLで表示すべき、最後に描画を終えたバッファーのインデックス。
+        // EN: The index of the most recently finished buffer to be displayed by OpenGL.
+        uint32_t getDisplayIndex() const {
+            return m_displayIndex;
+        }
+    };
+
+
+
     enum class TextureWrapMode {
         Repeat = CU_TR_ADDRESS_MODE_WRAP,
         Clamp = CU_TR_ADDRESS_MODE_CLAMP,
@@ -980,5 +2838,204 @@ namespace cudau {
             return curTexObj;
         }
     };
+
+
+
+    // JP: テクスチャーオブジェクトのデバイス上のテーブル。インデックスは解放されるまで変わらず、解放されたものは再利用される。
+    //     変更されたスロットはupload()でまとめて転送される。
+    //     SBTレコードには64ビットのハンドルではなく32ビットのインデックスを持たせられ、
+    //     テクスチャーの差し替えにSBTの再構築が要らない。
+    // EN: A device table of texture objects. Indices are stable until released, and released ones are reused.
+    //     Changed slots are transferred together by upload().
+    //     SBT records can hold a 32-bit index instead of a 64-bit handle,
+    //     and swapping a texture doesn't require rebuilding the SBT.
+    class TextureTable {
+        CUcontext m_cuContext;
+        CUdeviceptr m_deviceTable;
+        std::vector<CUtexObject> m_texObjects;
+        std::vector<uint32_t> m_freeIndices;
+        uint32_t m_numSlotsInUse;
+        uint32_t m_dirtyBegin;
+        uint32_t m_dirtyEnd;
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        TextureTable(const TextureTable &) = delete;
+        TextureTable &operator=(const TextureTable &) = delete;
+
+        void markDirty(uint32_t index) {
+            m_dirtyBegin = std::min(m_dirtyBegin, index);
+            m_dirtyEnd = std::max(m_dirtyEnd, index + 1);
+        }
+
+    public:
+        TextureTable() :
+            m_cuContext(nullptr), m_deviceTable(0), m_numSlotsInUse(0),
+            m_dirtyBegin(UINT32_MAX), m_dirtyEnd(0), m_initialized(false) {}
+        ~TextureTable() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, uint32_t maxNumTextures);
+        void finalize();
+
+        // JP: テクスチャーオブジェクトの所有権はテーブルに移る。
+        // EN: Ownership of the texture object moves to the table.
+        uint32_t allocate(CUtexObject texObj);
+        uint32_t allocate(TextureSampler &sampler, const Array &array) {
+            return allocate(sampler.createTextureObject(array));
+        }
+        void replace(uint32_t index, CUtexObject texObj);
+        void release(uint32_t index);
+
+        void upload(CUstream stream);
+
+        CUtexObject get(uint32_t index) const {
+            return m_texObjects[index];
+        }
+        uint32_t getMaxNumTextures() const {
+            return static_cast<uint32_t>(m_texObjects.size());
+        }
+        uint32_t getNumTextures() const {
+            return m_numSlotsInUse - static_cast<uint32_t>(m_freeIndices.size());
+        }
+        CUdeviceptr getCUdeviceptr() const {
+            return m_deviceTable;
+        }
+        const CUtexObject* getDevicePointer() const {
+            return reinterpret_cast<const CUtexObject*>(m_deviceTable);
+        }
+    };
+
+
+
+    // JP: VRAMより大きなテクスチャー群のための仮想テクスチャリング。
+    //     各テクスチャーはミップレベルごとのページテーブル(テクスチャー)を持ち、
+    //     タイルは全テクスチャーで共有する物理ページキャッシュ(Array)に置かれる。
+    //     デバイスはsampleVirtualTexture()で要求したタイルをフィードバックバッファーに記録し、
+    //     processFeedback()が不足タイルをワーカースレッドでのロードに回し、
+    //     update()がロード済みのタイルをキャッシュに転送してページテーブルを更新する。
+    //     タイル境界のフィルタリングのために、ローダーは周囲pageBorder分を含むページを書く必要がある。
+    //     BCフォーマットの場合、tileSizeとpageBorderは4の倍数である必要がある。
+    // EN: Virtual texturing for texture sets larger than VRAM.
+    //     Each texture has a page table (texture) per mip level,
+    //     and tiles are placed in a physical page cache (Array) shared by all textures.
+    //     The device records requested tiles into a feedback buffer with sampleVirtualTexture(),
+    //     processFeedback() sends missing tiles to be loaded by a worker thread,
+    //     and update() transfers loaded tiles into the cache and updates page tables.
+    //     For filtering across tile boundaries, the loader needs to write a page including pageBorder texels around.
+    //     For BC formats, tileSize and pageBorder need to be multiples of 4.
+    class VirtualTextureStreamer {
+    public:
+        // JP: ページ(pageSize x pageSize テクセル、行は密に詰める)をdstに書き込み、成功したらtrueを返す。
+        //     ワーカースレッドから呼ばれる。
+        // EN: Write a page (pageSize x pageSize texels, tightly packed rows) to dst and return true on success.
+        //     This is called from the worker thread.
+        using TileLoader = std::function<bool(uint32_t textureId, uint32_t mipLevel,
+                                              uint32_t tileX, uint32_t tileY, void* dst)>;
+
+    private:
+        struct TextureInfo {
+            Array pageTable;
+            CUtexObject pageTableTexObj;
+            uint32_t numTilesX;
+            uint32_t numTilesY;
+            uint32_t numMipLevels;
+            std::vector<std::vector<uint32_t>> entries;
+            uint32_t dirtyLevelMask;
+        };
+        struct PhysicalPage {
+            uint64_t lastUsedFrame;
+            uint32_t textureId;
+            uint32_t packedTile;
+            unsigned int occupied : 1;
+            unsigned int locked : 1;
+        };
+        struct LoadedTile {
+            VirtualTextureRequest request;
+            std::vector<uint8_t> data;
+        };
+
+        CUcontext m_cuContext;
+        TileLoader m_loader;
+
+        Array m_physicalCache;
+        TextureSampler m_cacheSampler;
+        CUtexObject m_cacheTexObj;
+        uint32_t m_tileSize;
+        uint32_t m_pageBorder;
+        uint32_t m_pageSize;
+        uint32_t m_numPagesX;
+        uint32_t m_numPagesY;
+        size_t m_pageRowSize;
+        uint32_t m_numPageRows;
+        std::vector<PhysicalPage> m_pages;
+        PinnedStagingPool m_stagingPool;
+
+        std::vector<std::unique_ptr<TextureInfo>> m_textures;
+        std::unordered_set<uint64_t> m_pendingTiles;
+        uint64_t m_frameIndex;
+
+        Buffer m_feedbackBuffer;
+        Buffer m_feedbackCounter;
+        std::vector<VirtualTextureRequest> m_feedbackHost;
+
+        std::thread m_worker;
+        std::mutex m_mutex;
+        std::condition_variable m_condVar;
+        std::deque<VirtualTextureRequest> m_loadQueue;
+        std::vector<LoadedTile> m_loadedTiles;
+        bool m_stopWorker;
+
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        VirtualTextureStreamer(const VirtualTextureStreamer &) = delete;
+        VirtualTextureStreamer &operator=(const VirtualTextureStreamer &) = delete;
+
+        void workerLoop();
+        uint32_t* findEntry(const VirtualTextureRequest &request);
+        uint32_t allocatePage();
+        void placeTile(const VirtualTextureRequest &request, const void* data, bool lock, CUstream stream);
+        void uploadPageTables(CUstream stream);
+
+    public:
+        VirtualTextureStreamer() :
+            m_cuContext(nullptr), m_cacheTexObj(0),
+            m_tileSize(0), m_pageBorder(0), m_pageSize(0), m_numPagesX(0), m_numPagesY(0),
+            m_pageRowSize(0), m_numPageRows(0), m_frameIndex(0), m_stopWorker(false),
+            m_initialized(false) {}
+        ~VirtualTextureStreamer() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext context, ArrayElementType elemType, uint32_t numChannels,
+                        const TextureSampler &cacheSampler,
+                        uint32_t tileSize, uint32_t pageBorder, uint32_t numPagesX, uint32_t numPagesY,
+                        uint32_t feedbackCapacity, const TileLoader &loader);
+        void finalize();
+
+        // JP: テクスチャーを登録してIDを返す。最も粗いレベルのタイルは同期的にロードされ常駐し続ける。
+        //     幅と高さはtileSizeの2のべき乗倍である必要がある。
+        // EN: Register a texture and return its ID. Tiles of the coarsest level are loaded synchronously
+        //     and stay resident. The width and height need to be power-of-two multiples of tileSize.
+        uint32_t addTexture(uint32_t width, uint32_t height, CUstream stream);
+        VirtualTextureDeviceData getDeviceData(uint32_t textureId) const;
+
+        // JP: フレームのレンダリング後に呼ぶ。要求を読み戻し、不足タイルのロードを開始する。
+        // EN: Call after rendering a frame. This reads back requests and starts loading missing tiles.
+        void processFeedback(CUstream stream);
+        // JP: ロード済みのタイルをキャッシュに転送し、ページテーブルを更新する。
+        // EN: Transfer loaded tiles into the cache and update page tables.
+        void update(CUstream stream);
+
+        uint32_t getNumPendingTiles() const {
+            return static_cast<uint32_t>(m_pendingTiles.size());
+        }
+    };
 #endif // #if !defined(__CUDA_ARCH__)
 } // namespace cudau
@@ -34,6 +34,230 @@ namespace optixu {
 
 
 
+    namespace {
+        // JP: FNV-1aによる64ビットハッシュ。
+        // EN: 64-bit hash by FNV-1a.
+        struct Hasher64 {
+            uint64_t value;
+
+            Hasher64() : value(0xcbf29ce484222325ull) {}
+            void add(const void* data, size_t size) {
+                auto bytes = reinterpret_cast<const uint8_t*>(data);
+                for (size_t i = 0; i < size; ++i) {
+                    value ^= bytes[i];
+                    value *= 0x100000001b3ull;
+                }
+            }
+            template <typename T>
+            void add(const T &data) {
+                add(&data, sizeof(T));
+            }
+        };
+
+        // JP: 可視性レイ用のミスプログラム。ペイロード0に1を書き込むだけ。
+        // EN: Miss program for visibility rays. It just writes 1 to payload 0.
+        const char* const visibilityMissPTX = R"PTX(
+.version 7.0
+.target sm_50
+.address_size 64
+
+.visible .entry __miss__optixu_visibility()
+{
+    .reg .b32 %r<3>;
+    mov.u32 %r1, 0;
+    mov.u32 %r2, 1;
+    call _optix_set_payload, (%r1, %r2);
+    ret;
+}
+)PTX";
+
+        // JP: デバイスバッファーの中身をホストに読み戻してハッシュに加える。
+        // EN: Read back the contents of a device buffer to the host and add them to the hash.
+        void addBufferContents(Hasher64* hasher, const BufferView &buffer) {
+            hasher->add(buffer.numElements());
+            hasher->add(buffer.stride());
+            if (!buffer.isValid())
+                return;
+            std::vector<uint8_t> contents(buffer.sizeInBytes());
+            CUDADRV_CHECK(cuMemcpyDtoH(contents.data(), buffer.getCUdeviceptr(), contents.size()));
+            hasher->add(contents.data(), contents.size());
+        }
+
+#if defined(OPTIXU_ENABLE_NVRTC)
+        // JP: ソースの#includeを再帰的に辿り、インクルードディレクトリーで見つかったヘッダーの内容をハッシュに加える。
+        //     条件付きのインクルードも辿るが、キーが余分に変わるだけなので安全側に倒れる。
+        //     見つからないヘッダー(NVRTCの組み込みヘッダーなど)はNVRTCのバージョンで代表させる。
+        // EN: Recursively follow #include in the source and add the contents of headers found in the include
+        //     directories to the hash. Conditional includes are followed as well, which only changes the key more
+        //     than necessary, so it errs on the safe side.
+        //     Headers not found (such as NVRTC's built-in ones) are represented by the NVRTC version.
+        void addIncludedHeaders(Hasher64* hasher, const std::string &source, const std::filesystem::path &sourceDir,
+                                const std::vector<std::filesystem::path> &includeDirs,
+                                std::unordered_set<std::string>* visited) {
+            size_t lineBegin = 0;
+            while (lineBegin < source.size()) {
+                size_t lineEnd = source.find('\n', lineBegin);
+                if (lineEnd == std::string::npos)
+                    lineEnd = source.size();
+                std::string_view line(source.data() + lineBegin, lineEnd - lineBegin);
+                lineBegin = lineEnd + 1;
+
+                size_t p = line.find_first_not_of(" \t");
+                if (p == std::string_view::npos || line[p] != '#')
+                    continue;
+                p = line.find_first_not_of(" \t", p + 1);
+                if (p == std::string_view::npos || line.substr(p, 7) != "include")
+                    continue;
+                p = line.find_first_not_of(" \t", p + 7);
+                if (p == std::string_view::npos || (line[p] != '"' && line[p] != '<'))
+                    continue;
+                bool quoted = line[p] == '"';
+                size_t nameEnd = line.find(quoted ? '"' : '>', p + 1);
+                if (nameEnd == std::string_view::npos)
+                    continue;
+                std::filesystem::path name(std::string(line.substr(p + 1, nameEnd - p - 1)));
+
+                std::vector<std::filesystem::path> candidates;
+                if (quoted && !sourceDir.empty())
+                    candidates.push_back(sourceDir / name);
+                for (const std::filesystem::path &dir : includeDirs)
+                    candidates.push_back(dir / name);
+                for (const std::filesystem::path &candidate : candidates) {
+                    std::error_code ec;
+                    if (!std::filesystem::is_regular_file(candidate, ec))
+                        continue;
+                    std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(candidate, ec);
+                    if (ec)
+                        canonicalPath = candidate;
+                    if (!visited->insert(canonicalPath.string()).second)
+                        break;
+
+                    std::ifstream ifs(canonicalPath, std::ios::in | std::ios::binary);
+                    std::stringstream ss;
+                    ss << ifs.rdbuf();
+                    const std::string header = ss.str();
+                    const std::string pathStr = canonicalPath.string();
+                    hasher->add(pathStr.c_str(), pathStr.size() + 1);
+                    hasher->add(header.size());
+                    hasher->add(header.c_str(), header.size());
+                    addIncludedHeaders(hasher, header, canonicalPath.parent_path(), includeDirs, visited);
+                    break;
+                }
+            }
+        }
+#endif
+
+        void readBackBuffer(const BufferView &buffer, std::vector<uint8_t>* contents) {
+            contents->resize(buffer.isValid() ? buffer.sizeInBytes() : 0);
+            if (!contents->empty())
+                CUDADRV_CHECK(cuMemcpyDtoH(contents->data(), buffer.getCUdeviceptr(), contents->size()));
+        }
+
+        float halfToFloat(uint16_t value) {
+            uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+            uint32_t exponent = (value >> 10) & 0x1F;
+            uint32_t mantissa = value & 0x03FF;
+            uint32_t bits;
+            if (exponent == 0) {
+                if (mantissa == 0) {
+                    bits = sign;
+                }
+                else {
+                    int32_t e = -1;
+                    do {
+                        ++e;
+                        mantissa <<= 1;
+                    } while ((mantissa & 0x0400) == 0);
+                    bits = sign | (static_cast<uint32_t>(127 - 15 - e) << 23) | ((mantissa & 0x03FF) << 13);
+                }
+            }
+            else if (exponent == 31) {
+                bits = sign | 0x7F800000 | (mantissa << 13);
+            }
+            else {
+                bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+            }
+            float ret;
+            std::memcpy(&ret, &bits, sizeof(ret));
+            return ret;
+        }
+
+        // JP: AABBを空にする。OptiXと同様にmin > maxのAABBを空とみなす。
+        // EN: Make an AABB empty. An AABB with min > max is regarded as empty as with OptiX.
+        void clearAabb(OptixAabb* aabb) {
+            aabb->minX = aabb->minY = aabb->minZ = INFINITY;
+            aabb->maxX = aabb->maxY = aabb->maxZ = -INFINITY;
+        }
+
+        bool isAabbEmpty(const OptixAabb &aabb) {
+            return aabb.minX > aabb.maxX || aabb.minY > aabb.maxY || aabb.minZ > aabb.maxZ;
+        }
+
+        void extendAabb(OptixAabb* aabb, const float p[3]) {
+            aabb->minX = std::min(aabb->minX, p[0]);
+            aabb->minY = std::min(aabb->minY, p[1]);
+            aabb->minZ = std::min(aabb->minZ, p[2]);
+            aabb->maxX = std::max(aabb->maxX, p[0]);
+            aabb->maxY = std::max(aabb->maxY, p[1]);
+            aabb->maxZ = std::max(aabb->maxZ, p[2]);
+        }
+
+        void unifyAabb(OptixAabb* aabb, const OptixAabb &b) {
+            aabb->minX = std::min(aabb->minX, b.minX);
+            aabb->minY = std::min(aabb->minY, b.minY);
+            aabb->minZ = std::min(aabb->minZ, b.minZ);
+            aabb->maxX = std::max(aabb->maxX, b.maxX);
+            aabb->maxY = std::max(aabb->maxY, b.maxY);
+            aabb->maxZ = std::max(aabb->maxZ, b.maxZ);
+        }
+
+        float calcSurfaceArea(const OptixAabb &aabb) {
+            if (isAabbEmpty(aabb))
+                return 0.0f;
+            float dx = aabb.maxX - aabb.minX;
+            float dy = aabb.maxY - aabb.minY;
+            float dz = aabb.maxZ - aabb.minZ;
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+
+        // JP: 行優先の3x4行列で点を変換する。
+        // EN: Transform a point by a row-major 3x4 matrix.
+        void transformPoint(const float m[12], const float p[3], float ret[3]) {
+            for (uint32_t r = 0; r < 3; ++r)
+                ret[r] = m[4 * r + 0] * p[0] + m[4 * r + 1] * p[1] + m[4 * r + 2] * p[2] + m[4 * r + 3];
+        }
+
+        // JP: 行優先の3x4行列の積a * bを求める。
+        // EN: Compute the product a * b of row-major 3x4 matrices.
+        void multiplyTransforms(const float a[12], const float b[12], float ret[12]) {
+            for (uint32_t r = 0; r < 3; ++r) {
+                for (uint32_t c = 0; c < 4; ++c) {
+                    ret[4 * r + c] =
+                        a[4 * r + 0] * b[c] + a[4 * r + 1] * b[4 + c] + a[4 * r + 2] * b[8 + c] +
+                        (c == 3 ? a[4 * r + 3] : 0.0f);
+                }
+            }
+        }
+
+        void transformAabb(const float m[12], const OptixAabb &aabb, OptixAabb* ret) {
+            clearAabb(ret);
+            if (isAabbEmpty(aabb))
+                return;
+            for (uint32_t i = 0; i < 8; ++i) {
+                float p[3] = {
+                    (i & 0b001) ? aabb.maxX : aabb.minX,
+                    (i & 0b010) ? aabb.maxY : aabb.minY,
+                    (i & 0b100) ? aabb.maxZ : aabb.minZ,
+                };
+                float tp[3];
+                transformPoint(m, p, tp);
+                extendAabb(ret, tp);
+            }
+        }
+    }
+
+
+
     // Define common interfaces.
 #define OPTIXU_PREPROCESS_OBJECT(Type) \
     Context Type::getContext() const { \
@@ -50,6 +274,494 @@ namespace optixu {
 
 
 
+    void AutoRebuildPolicy::set(uint32_t _maxNumUpdates, float _maxBoundsGrowth) {
+        maxNumUpdates = _maxNumUpdates;
+        maxBoundsGrowth = _maxBoundsGrowth;
+        if (tracksBounds() && aabbOnDevice == 0) {
+            CUDADRV_CHECK(cuMemAlloc(&aabbOnDevice, sizeof(OptixAabb)));
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&aabbOnHost), sizeof(OptixAabb)));
+            CUDADRV_CHECK(cuEventCreate(&aabbReadbackEvent,
+                                        CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+            propertyAabb.type = OPTIX_PROPERTY_TYPE_AABBS;
+            propertyAabb.result = aabbOnDevice;
+        }
+        referenceBoundsArea = 0.0f;
+        latestBoundsArea = 0.0f;
+    }
+
+    void AutoRebuildPolicy::readBackResult() {
+        const OptixAabb &aabb = *aabbOnHost;
+        float dx = std::max(aabb.maxX - aabb.minX, 0.0f);
+        float dy = std::max(aabb.maxY - aabb.minY, 0.0f);
+        float dz = std::max(aabb.maxZ - aabb.minZ, 0.0f);
+        float area = 2 * (dx * dy + dy * dz + dz * dx);
+        if (pendingIsReference)
+            referenceBoundsArea = area;
+        else
+            latestBoundsArea = area;
+        readbackPending = false;
+    }
+
+    void AutoRebuildPolicy::notifyBuild(CUstream stream, bool isRebuild) {
+        if (isRebuild) {
+            numUpdatesSinceRebuild = 0;
+            latestBoundsArea = 0.0f;
+        }
+        else {
+            ++numUpdatesSinceRebuild;
+        }
+
+        // JP: キャプチャー中は待機もクエリーもできないので、AABBの計測を行わない。
+        // EN: Don't measure the AABB during capture since neither waiting nor querying is possible.
+        if (!tracksBounds() || isStreamCapturing(stream))
+            return;
+
+        // JP: リビルド時のAABBは基準値として必ず読み戻す必要があるので、前回の読み戻しの完了を待つ。
+        //     アップデート時は前回の読み戻しが未完了であれば今回の計測はスキップする。
+        // EN: The AABB at rebuild must be read back as the reference, so wait for the completion of
+        //     the previous readback.
+        //     Skip the measurement this time at update if the previous readback has not completed.
+        if (readbackPending) {
+            if (isRebuild) {
+                CUDADRV_CHECK(cuEventSynchronize(aabbReadbackEvent));
+            }
+            else {
+                CUresult res = cuEventQuery(aabbReadbackEvent);
+                if (res == CUDA_ERROR_NOT_READY)
+                    return;
+                CUDADRV_CHECK(res);
+            }
+            readBackResult();
+        }
+
+        CUDADRV_CHECK(cuMemcpyDtoHAsync(aabbOnHost, aabbOnDevice, sizeof(OptixAabb), stream));
+        CUDADRV_CHECK(cuEventRecord(aabbReadbackEvent, stream));
+        readbackPending = true;
+        pendingIsReference = isRebuild;
+    }
+
+    bool AutoRebuildPolicy::shouldRebuild() {
+        if (maxNumUpdates > 0 && numUpdatesSinceRebuild >= maxNumUpdates)
+            return true;
+
+        if (!tracksBounds())
+            return false;
+
+        if (readbackPending) {
+            CUresult res = cuEventQuery(aabbReadbackEvent);
+            if (res != CUDA_ERROR_NOT_READY) {
+                CUDADRV_CHECK(res);
+                readBackResult();
+            }
+        }
+
+        return referenceBoundsArea > 0.0f &&
+            latestBoundsArea > referenceBoundsArea * (1.0f + maxBoundsGrowth);
+    }
+
+
+
+    void ASStatisticsRecorder::setEnabled(bool enable) {
+        enabled = enable;
+        if (!enabled || timings[0].beginEvent)
+            return;
+
+        for (Timing &timing : timings) {
+            CUDADRV_CHECK(cuEventCreate(&timing.beginEvent, CU_EVENT_BLOCKING_SYNC));
+            CUDADRV_CHECK(cuEventCreate(&timing.endEvent, CU_EVENT_BLOCKING_SYNC));
+            timing.timeInMs = 0.0f;
+            timing.pending = false;
+        }
+    }
+
+    void ASStatisticsRecorder::begin(CUstream stream, Operation op) {
+        // JP: キャプチャーされたイベントは時間計測に使えないので記録しない。
+        // EN: Don't record during capture since captured events cannot be used for timing.
+        if (!enabled || isStreamCapturing(stream))
+            return;
+        Timing &timing = timings[static_cast<uint32_t>(op)];
+        CUDADRV_CHECK(cuEventRecord(timing.beginEvent, stream));
+    }
+
+    void ASStatisticsRecorder::end(CUstream stream, Operation op) {
+        if (!enabled || isStreamCapturing(stream))
+            return;
+        Timing &timing = timings[static_cast<uint32_t>(op)];
+        CUDADRV_CHECK(cuEventRecord(timing.endEvent, stream));
+        timing.pending = true;
+        if (op == Operation::Build)
+            ++numBuilds;
+        else if (op == Operation::Update)
+            ++numUpdates;
+        else if (op == Operation::Compaction)
+            ++numCompactions;
+    }
+
+    void ASStatisticsRecorder::getTimes(float* buildTime, float* updateTime, float* compactionTime) {
+        for (Timing &timing : timings) {
+            if (!timing.pending)
+                continue;
+            CUDADRV_CHECK(cuEventSynchronize(timing.endEvent));
+            CUDADRV_CHECK(cuEventElapsedTime(&timing.timeInMs, timing.beginEvent, timing.endEvent));
+            timing.pending = false;
+        }
+        *buildTime = timings[static_cast<uint32_t>(Operation::Build)].timeInMs;
+        *updateTime = timings[static_cast<uint32_t>(Operation::Update)].timeInMs;
+        *compactionTime = timings[static_cast<uint32_t>(Operation::Compaction)].timeInMs;
+    }
+
+
+
+    PinnedStagingRing::~PinnedStagingRing() {
+        for (const Allocation &alloc : inFlightAllocations) {
+            cuEventSynchronize(alloc.event);
+            cuEventDestroy(alloc.event);
+        }
+        for (CUevent event : freeEvents)
+            cuEventDestroy(event);
+        if (buffer)
+            cuMemFreeHost(buffer);
+    }
+
+    void PinnedStagingRing::waitAll() {
+        for (const Allocation &alloc : inFlightAllocations) {
+            CUDADRV_CHECK(cuEventSynchronize(alloc.event));
+            freeEvents.push_back(alloc.event);
+        }
+        inFlightAllocations.clear();
+    }
+
+    void PinnedStagingRing::upload(CUstream stream, CUdeviceptr dst, const void* src, size_t size) {
+        if (size == 0)
+            return;
+
+        constexpr size_t alignment = 16;
+        size_t allocSize = (size + alignment - 1) / alignment * alignment;
+        if (allocSize > capacity) {
+            waitAll();
+            if (buffer)
+                CUDADRV_CHECK(cuMemFreeHost(buffer));
+            capacity = std::max(allocSize, 2 * capacity);
+            CUDADRV_CHECK(cuMemHostAlloc(reinterpret_cast<void**>(&buffer), capacity, 0));
+            head = 0;
+        }
+
+        size_t begin = head;
+        if (begin + allocSize > capacity)
+            begin = 0;
+        size_t end = begin + allocSize;
+
+        // JP: これから使う領域と重なる使用中の領域が無くなるまで、古い順にコピー完了を待つ。
+        // EN: Wait for the copy completion of in-flight regions, oldest first,
+        //     until none of them overlaps the region to be used.
+        const auto overlaps = [&]() {
+            for (const Allocation &alloc : inFlightAllocations) {
+                if (alloc.begin < end && alloc.end > begin)
+                    return true;
+            }
+            return false;
+        };
+        while (overlaps()) {
+            const Allocation &oldest = inFlightAllocations.front();
+            CUDADRV_CHECK(cuEventSynchronize(oldest.event));
+            freeEvents.push_back(oldest.event);
+            inFlightAllocations.pop_front();
+        }
+
+        std::memcpy(buffer + begin, src, size);
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(dst, buffer + begin, size, stream));
+
+        Allocation alloc;
+        alloc.begin = begin;
+        alloc.end = end;
+        if (freeEvents.empty()) {
+            CUDADRV_CHECK(cuEventCreate(&alloc.event, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+        }
+        else {
+            alloc.event = freeEvents.back();
+            freeEvents.pop_back();
+        }
+        CUDADRV_CHECK(cuEventRecord(alloc.event, stream));
+        inFlightAllocations.push_back(alloc);
+        head = end;
+    }
+
+
+
+    void Context::Priv::markSBTLayoutsDirtyForGeometryFlagInference() {
+        std::lock_guard<std::mutex> lock(sceneRegistryMutex);
+        for (_Scene* scene : scenes) {
+            if (scene->getGeometryFlagInference() != GeometryFlagInference::Disabled)
+                scene->markSBTLayoutDirty();
+        }
+    }
+
+    void Context::Priv::deferRelease(CUstream stream, DeferredReleaseFunction func, void* userData) {
+        std::lock_guard<std::mutex> lock(deferredReleaseMutex);
+        DeferredRelease release;
+        if (freeDeferredReleaseEvents.empty()) {
+            CUDADRV_CHECK(cuEventCreate(&release.event, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+        }
+        else {
+            release.event = freeDeferredReleaseEvents.back();
+            freeDeferredReleaseEvents.pop_back();
+        }
+        CUDADRV_CHECK(cuEventRecord(release.event, stream));
+        release.func = func;
+        release.userData = userData;
+        deferredReleases.push_back(release);
+    }
+
+    void Context::Priv::registerPipelineRecipe(const std::string &name, PipelineRecipeFunction recipe,
+                                               void* userData) {
+        throwRuntimeError(recipe, "Recipe function is not provided.");
+        std::lock_guard<std::mutex> lock(pipelineRecipeMutex);
+        throwRuntimeError(pipelineRecipes.count(name) == 0, "Pipeline recipe %s is already registered.",
+                          name.c_str());
+        PipelineRecipe &entry = pipelineRecipes[name];
+        entry.func = recipe;
+        entry.userData = userData;
+        // JP: レシピがバッファーなどを確保する場合に備えてワーカースレッドでもCUDAコンテキストを有効にする。
+        // EN: Make the CUDA context current also on the worker thread in case the recipe allocates buffers etc.
+        _Context* context = this;
+        entry.prewarmedPipeline = std::async(
+            std::launch::async,
+            [context, recipe, userData]() {
+                CUDADRV_CHECK(cuCtxPushCurrent(context->getCUcontext()));
+                auto pipeline = new _Pipeline(context);
+                try {
+                    recipe(userData, pipeline->getPublicType());
+                }
+                catch (...) {
+                    delete pipeline;
+                    cuCtxPopCurrent(nullptr);
+                    throw;
+                }
+                CUDADRV_CHECK(cuCtxPopCurrent(nullptr));
+                return pipeline;
+            });
+    }
+
+    bool Context::Priv::isPipelineRecipeReady(const std::string &name) const {
+        std::lock_guard<std::mutex> lock(pipelineRecipeMutex);
+        auto it = pipelineRecipes.find(name);
+        throwRuntimeError(it != pipelineRecipes.cend(), "Pipeline recipe %s is not registered.", name.c_str());
+        const std::future<_Pipeline*> &pending = it->second.prewarmedPipeline;
+        return !pending.valid() || pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    _Pipeline* Context::Priv::createPipelineFromRecipe(const std::string &name) {
+        PipelineRecipeFunction recipe;
+        void* userData;
+        std::future<_Pipeline*> pending;
+        {
+            std::lock_guard<std::mutex> lock(pipelineRecipeMutex);
+            auto it = pipelineRecipes.find(name);
+            throwRuntimeError(it != pipelineRecipes.cend(), "Pipeline recipe %s is not registered.", name.c_str());
+            recipe = it->second.func;
+            userData = it->second.userData;
+            pending = std::move(it->second.prewarmedPipeline);
+        }
+        if (pending.valid())
+            return pending.get();
+
+        auto pipeline = new _Pipeline(this);
+        try {
+            recipe(userData, pipeline->getPublicType());
+        }
+        catch (...) {
+            delete pipeline;
+            throw;
+        }
+        return pipeline;
+    }
+
+    void Context::Priv::destroyPipelineRecipes() {
+        std::lock_guard<std::mutex> lock(pipelineRecipeMutex);
+        for (std::pair<const std::string, PipelineRecipe> &entry : pipelineRecipes) {
+            std::future<_Pipeline*> &pending = entry.second.prewarmedPipeline;
+            if (!pending.valid())
+                continue;
+            try {
+                delete pending.get();
+            }
+            catch (...) {
+                // JP: 受け取られなかったレシピのエラーは破棄時には無視する。
+                // EN: Ignore errors of recipes never received at destruction.
+            }
+        }
+        pipelineRecipes.clear();
+    }
+
+    uint32_t Context::Priv::processDeferredReleases(bool wait) {
+        // JP: 異なるストリームのイベントは順不同で完了し得るので全エントリーを調べる。
+        //     解放関数は遅延破棄を再帰的に呼び得るのでロックの外で呼ぶ。
+        // EN: Events on different streams can complete in any order, so check all the entries.
+        //     Release functions may call deferred destruction recursively, so call them outside the lock.
+        std::vector<DeferredRelease> completed;
+        {
+            std::lock_guard<std::mutex> lock(deferredReleaseMutex);
+            auto it = deferredReleases.begin();
+            while (it != deferredReleases.end()) {
+                if (wait) {
+                    CUDADRV_CHECK(cuEventSynchronize(it->event));
+                }
+                else {
+                    CUresult res = cuEventQuery(it->event);
+                    if (res == CUDA_ERROR_NOT_READY) {
+                        ++it;
+                        continue;
+                    }
+                    CUDADRV_CHECK(res);
+                }
+                completed.push_back(*it);
+                freeDeferredReleaseEvents.push_back(it->event);
+                it = deferredReleases.erase(it);
+            }
+        }
+        for (const DeferredRelease &release : completed)
+            release.func(release.userData);
+
+        return static_cast<uint32_t>(completed.size());
+    }
+
+    std::string Context::Priv::compileCUDASource(const std::string &cudaSource,
+                                                 const std::vector<std::string> &options) {
+#if defined(OPTIXU_ENABLE_NVRTC)
+        Hasher64 hasher;
+        hasher.add(cudaSource.c_str(), cudaSource.size());
+        std::vector<std::filesystem::path> includeDirs;
+        for (const std::string &option : options) {
+            hasher.add(option.c_str(), option.size() + 1);
+            if (option.compare(0, 2, "-I") == 0)
+                includeDirs.push_back(option.substr(2));
+        }
+        int nvrtcMajor, nvrtcMinor;
+        nvrtcVersion(&nvrtcMajor, &nvrtcMinor);
+        hasher.add(nvrtcMajor);
+        hasher.add(nvrtcMinor);
+        // JP: ヘッダーだけを変更した場合にもディスク上の古いPTXを使わないように、
+        //     インクルードされるヘッダーの内容とOptiXのバージョンもキーに含める。
+        // EN: Include the contents of included headers and the OptiX version in the key as well
+        //     so that stale PTX on the disk is not used even when only headers are changed.
+        hasher.add(static_cast<uint32_t>(OPTIX_VERSION));
+        std::unordered_set<std::string> visitedHeaders;
+        addIncludedHeaders(&hasher, cudaSource, std::filesystem::path(), includeDirs, &visitedHeaders);
+        const uint64_t key = hasher.value;
+
+        char fileName[32];
+        snprintf(fileName, sizeof(fileName), "%016llx.ptx", static_cast<unsigned long long>(key));
+        std::string cacheFilePath;
+        {
+            std::lock_guard<std::mutex> lock(ptxCacheMutex);
+            auto it = ptxCache.find(key);
+            if (it != ptxCache.cend()) {
+                std::lock_guard<std::mutex> statsLock(moduleCacheStatsMutex);
+                ++moduleCacheStats.numPTXCacheHits;
+                return it->second;
+            }
+            if (!ptxCacheLocation.empty())
+                cacheFilePath = ptxCacheLocation + "/" + fileName;
+        }
+
+        // JP: ディスク上のキャッシュがあればコンパイルせずに読み込む。
+        // EN: Load the cache on the disk without compilation if exists.
+        if (!cacheFilePath.empty()) {
+            std::ifstream ifs(cacheFilePath, std::ios::in | std::ios::binary);
+            if (ifs) {
+                std::stringstream ss;
+                ss << ifs.rdbuf();
+                std::string ptx = ss.str();
+                std::lock_guard<std::mutex> lock(ptxCacheMutex);
+                ptxCache[key] = ptx;
+                std::lock_guard<std::mutex> statsLock(moduleCacheStatsMutex);
+                ++moduleCacheStats.numPTXCacheHits;
+                return ptx;
+            }
+        }
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        nvrtcProgram program;
+        NVRTC_CHECK(nvrtcCreateProgram(&program, cudaSource.c_str(), "optixu_module.cu", 0, nullptr, nullptr));
+        std::vector<const char*> optionPtrs(options.size());
+        for (uint32_t i = 0; i < options.size(); ++i)
+            optionPtrs[i] = options[i].c_str();
+        nvrtcResult compileResult = nvrtcCompileProgram(program, static_cast<int>(optionPtrs.size()),
+                                                        optionPtrs.data());
+        if (compileResult != NVRTC_SUCCESS) {
+            size_t logSize;
+            nvrtcGetProgramLogSize(program, &logSize);
+            std::string log(logSize, '\0');
+            nvrtcGetProgramLog(program, &log[0]);
+            nvrtcDestroyProgram(&program);
+            std::stringstream ss;
+            ss << "NVRTC compilation failed: " << nvrtcGetErrorString(compileResult) << "\n"
+               << "Log: " << log << "\n";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        size_t ptxSize;
+        NVRTC_CHECK(nvrtcGetPTXSize(program, &ptxSize));
+        std::string ptx(ptxSize, '\0');
+        NVRTC_CHECK(nvrtcGetPTX(program, &ptx[0]));
+        NVRTC_CHECK(nvrtcDestroyProgram(&program));
+        // JP: PTXサイズには終端文字が含まれる。
+        // EN: The PTX size includes the null terminator.
+        if (!ptx.empty() && ptx.back() == '\0')
+            ptx.pop_back();
+
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        float compileTimeInMs = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
+
+        // JP: 他のスレッドやプロセスが書きかけのファイルを読まないように、
+        //     一意な名前の一時ファイルに書き込んでから置き換える。
+        // EN: Write into a temporary file with a unique name and then replace
+        //     so that other threads or processes never read a partially written file.
+        if (!cacheFilePath.empty()) {
+            static std::atomic<uint64_t> tempFileCounter = 0;
+            Hasher64 tempHasher;
+            tempHasher.add(reinterpret_cast<uintptr_t>(this));
+            tempHasher.add(std::chrono::steady_clock::now().time_since_epoch().count());
+            tempHasher.add(tempFileCounter.fetch_add(1));
+            char tempSuffix[32];
+            snprintf(tempSuffix, sizeof(tempSuffix), ".%016llx.tmp", static_cast<unsigned long long>(tempHasher.value));
+            const std::string tempFilePath = cacheFilePath + tempSuffix;
+
+            bool written = false;
+            {
+                std::ofstream ofs(tempFilePath, std::ios::out | std::ios::binary | std::ios::trunc);
+                if (ofs) {
+                    ofs.write(ptx.c_str(), ptx.size());
+                    written = static_cast<bool>(ofs);
+                }
+            }
+            std::error_code ec;
+            if (written)
+                std::filesystem::rename(tempFilePath, cacheFilePath, ec);
+            if (!written || ec)
+                std::filesystem::remove(tempFilePath, ec);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(ptxCacheMutex);
+            ptxCache[key] = ptx;
+        }
+        {
+            std::lock_guard<std::mutex> lock(moduleCacheStatsMutex);
+            ++moduleCacheStats.numPTXCompilations;
+            moduleCacheStats.totalPTXCompileTimeInMs += compileTimeInMs;
+        }
+
+        return ptx;
+#else
+        (void)cudaSource;
+        (void)options;
+        throw std::runtime_error("Enable \"OPTIXU_ENABLE_NVRTC\" at the top of optix_util.h if you use runtime compilation of CUDA source.");
+#endif
+    }
+
+
+
     Context Context::create(CUcontext cuContext, uint32_t logLevel, bool enableValidation) {
         return (new _Context(cuContext, logLevel, enableValidation))->getPublicType();
     }
@@ -68,6 +780,66 @@ namespace optixu {
             OPTIX_CHECK(optixDeviceContextSetLogCallback(m->rawContext, &logCallBack, nullptr, logLevel));
     }
 
+    void Context::setProfileScopeCallbacks(ProfileScopeCallback beginScope, ProfileScopeCallback endScope,
+                                           void* userData) const {
+        m->throwRuntimeError((beginScope != nullptr) == (endScope != nullptr),
+                             "Both of begin/end callbacks must be set or unset together.");
+        m->profileBegin = beginScope;
+        m->profileEnd = endScope;
+        m->profileUserData = userData;
+    }
+
+    void Context::deferRelease(CUstream stream, DeferredReleaseFunction func, void* userData) const {
+        m->throwRuntimeError(func, "Release function must be set.");
+        m->deferRelease(stream, func, userData);
+    }
+
+    uint32_t Context::processDeferredReleases(bool wait) const {
+        return m->processDeferredReleases(wait);
+    }
+
+    uint32_t Context::getNumPendingDeferredReleases() const {
+        return m->getNumPendingDeferredReleases();
+    }
+
+
+
+    void Context::setDiskCacheEnabled(bool enable) const {
+        OPTIX_CHECK(optixDeviceContextSetCacheEnabled(m->rawContext, enable ? 1 : 0));
+    }
+
+    void Context::setDiskCacheLocation(const std::string &location) const {
+        OPTIX_CHECK(optixDeviceContextSetCacheLocation(m->rawContext, location.c_str()));
+    }
+
+    void Context::setDiskCacheDatabaseSizes(size_t lowWaterMark, size_t highWaterMark) const {
+        m->throwRuntimeError(highWaterMark == 0 || lowWaterMark <= highWaterMark,
+                             "Low water mark must not exceed high water mark.");
+        OPTIX_CHECK(optixDeviceContextSetCacheDatabaseSizes(m->rawContext, lowWaterMark, highWaterMark));
+    }
+
+    bool Context::getDiskCacheEnabled() const {
+        int enabled;
+        OPTIX_CHECK(optixDeviceContextGetCacheEnabled(m->rawContext, &enabled));
+        return enabled != 0;
+    }
+
+    void Context::getModuleCacheStatistics(ModuleCacheStatistics* stats) const {
+        *stats = m->getModuleCacheStatistics();
+    }
+
+    void Context::getRedundantUpdateStatistics(RedundantUpdateStatistics* stats) const {
+        m->getRedundantUpdateStatistics(stats);
+    }
+
+    void Context::resetRedundantUpdateStatistics() const {
+        m->resetRedundantUpdateStatistics();
+    }
+
+    void Context::setPTXCacheLocation(const std::string &location) const {
+        m->setPTXCacheLocation(location);
+    }
+
 
 
     Material Context::createMaterial() const {
@@ -82,26 +854,149 @@ namespace optixu {
         return (new _Pipeline(m))->getPublicType();
     }
 
+    void Context::registerPipelineRecipe(const std::string &name, PipelineRecipeFunction recipe, void* userData) const {
+        m->registerPipelineRecipe(name, recipe, userData);
+    }
+
+    bool Context::isPipelineRecipeReady(const std::string &name) const {
+        return m->isPipelineRecipeReady(name);
+    }
+
+    Pipeline Context::createPipeline(const std::string &recipeName) const {
+        return m->createPipelineFromRecipe(recipeName)->getPublicType();
+    }
+
     Denoiser Context::createDenoiser(OptixDenoiserModelKind modelKind, bool guideAlbedo, bool guideNormal) const {
         return (new _Denoiser(m, modelKind, guideAlbedo, guideNormal))->getPublicType();
     }
 
+    PipelineVariantCache Context::createPipelineVariantCache(PipelineVariantBuildFunction buildFunc,
+                                                             PipelineVariantDestroyFunction destroyFunc,
+                                                             void* userData, uint32_t maxNumVariants) const {
+        m->throwRuntimeError(buildFunc, "Build function must be specified.");
+        m->throwRuntimeError(maxNumVariants > 0, "The maximum number of variants must be at least one.");
+        return (new _PipelineVariantCache(m, buildFunc, destroyFunc, userData, maxNumVariants))->getPublicType();
+    }
+
     CUcontext Context::getCUcontext() const {
         return m->cuContext;
     }
 
 
 
-    void Material::Priv::setRecordData(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record, SizeAlign* curSizeAlign) const {
-        Key key{ pipeline, rayType };
-        throwRuntimeError(programs.count(key), "No hit group is set to the pipeline %s, ray type %u",
+    const Material::Priv::HeaderCache &Material::Priv::getHeaderCache(const _Pipeline* pipeline) const {
+        HeaderCache* staleCache = nullptr;
+        for (HeaderCache &cache : headerCaches) {
+            if (cache.pipeline == pipeline) {
+                if (cache.defaultHitGroupRevision == pipeline->getDefaultHitGroupRevision())
+                    return cache;
+                staleCache = &cache;
+                break;
+            }
+        }
+
+        uint32_t numRayTypes = pipeline->getNumDefaultHitGroupRayTypes();
+        for (const std::pair<const Key, _ProgramGroup*> &program : programs) {
+            if (program.first.pipeline == pipeline)
+                numRayTypes = std::max(numRayTypes, program.first.rayType + 1);
+        }
+
+        HeaderCache cache;
+        cache.pipeline = pipeline;
+        cache.defaultHitGroupRevision = pipeline->getDefaultHitGroupRevision();
+        cache.headers.resize(static_cast<size_t>(OPTIX_SBT_RECORD_HEADER_SIZE) * numRayTypes);
+        cache.isValid.resize(numRayTypes, 0);
+        for (const std::pair<const Key, _ProgramGroup*> &program : programs) {
+            if (program.first.pipeline != pipeline)
+                continue;
+            uint32_t rayType = program.first.rayType;
+            program.second->packHeader(cache.headers.data() + OPTIX_SBT_RECORD_HEADER_SIZE * rayType);
+            cache.isValid[rayType] = 1;
+        }
+        for (uint32_t rayType = 0; rayType < pipeline->getNumDefaultHitGroupRayTypes(); ++rayType) {
+            const _ProgramGroup* defaultHitGroup = pipeline->getDefaultHitGroup(rayType);
+            if (cache.isValid[rayType] || !defaultHitGroup)
+                continue;
+            defaultHitGroup->packHeader(cache.headers.data() + OPTIX_SBT_RECORD_HEADER_SIZE * rayType);
+            cache.isValid[rayType] = 1;
+        }
+        if (staleCache) {
+            *staleCache = std::move(cache);
+            return *staleCache;
+        }
+        headerCaches.push_back(std::move(cache));
+
+        return headerCaches.back();
+    }
+
+    void Material::Priv::replaceProgram(const _Pipeline* pipeline, uint32_t rayType, _ProgramGroup* program) {
+        programs[Key{ pipeline, rayType }] = program;
+        // JP: キャッシュ全体は捨てずに該当するヘッダーだけを詰め直す。
+        // EN: Repack only the corresponding header instead of discarding the entire cache.
+        for (HeaderCache &cache : headerCaches) {
+            if (cache.pipeline != pipeline)
+                continue;
+            if (rayType < cache.isValid.size())
+                program->packHeader(cache.headers.data() + OPTIX_SBT_RECORD_HEADER_SIZE * rayType);
+            break;
+        }
+    }
+
+    bool Material::Priv::mayInvokeAnyHit(uint32_t rayType) const {
+        if (programs.empty())
+            return true;
+
+        // JP: ヒットグループを持たないパイプラインでは既定のヒットグループが使われる。
+        // EN: The default hit group is used for pipelines without the hit group.
+        std::vector<const _Pipeline*> pipelines;
+        for (const std::pair<const Key, _ProgramGroup*> &program : programs) {
+            if (program.first.rayType == rayType && program.second) {
+                if (program.second->hasAnyHitProgram())
+                    return true;
+                continue;
+            }
+            if (std::find(pipelines.cbegin(), pipelines.cend(), program.first.pipeline) == pipelines.cend())
+                pipelines.push_back(program.first.pipeline);
+        }
+        for (const _Pipeline* pipeline : pipelines) {
+            auto it = programs.find(Key{ pipeline, rayType });
+            if (it != programs.cend() && it->second)
+                continue;
+            const _ProgramGroup* defaultHitGroup = pipeline->getDefaultHitGroup(rayType);
+            if (defaultHitGroup && defaultHitGroup->hasAnyHitProgram())
+                return true;
+        }
+
+        return false;
+    }
+
+    void Material::Priv::writeHeader(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record) const {
+        const HeaderCache &cache = getHeaderCache(pipeline);
+        throwRuntimeError(rayType < cache.isValid.size() && cache.isValid[rayType],
+                          "No hit group is set to the pipeline %s, ray type %u",
+                          pipeline->getName().c_str(), rayType);
+        std::memcpy(record, cache.headers.data() + OPTIX_SBT_RECORD_HEADER_SIZE * rayType,
+                    OPTIX_SBT_RECORD_HEADER_SIZE);
+    }
+
+    void Material::Priv::setRecordData(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record, SizeAlign* curSizeAlign,
+                                       CUdeviceptr outOfRecordUserData) const {
+        const HeaderCache &cache = getHeaderCache(pipeline);
+        throwRuntimeError(rayType < cache.isValid.size() && cache.isValid[rayType],
+                          "No hit group is set to the pipeline %s, ray type %u",
                           pipeline->getName().c_str(), rayType);
-        const _ProgramGroup* hitGroup = programs.at(key);
         *curSizeAlign = SizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
-        hitGroup->packHeader(record);
+        std::memcpy(record, cache.headers.data() + OPTIX_SBT_RECORD_HEADER_SIZE * rayType,
+                    OPTIX_SBT_RECORD_HEADER_SIZE);
         uint32_t offset;
-        curSizeAlign->add(userDataSizeAlign, &offset);
-        std::memcpy(record + offset, userData.data(), userDataSizeAlign.size);
+        if (outOfRecordUserData) {
+            curSizeAlign->add(SizeAlign(sizeof(CUdeviceptr), alignof(CUdeviceptr)), &offset);
+            std::memcpy(record + offset, &outOfRecordUserData, sizeof(CUdeviceptr));
+        }
+        else {
+            curSizeAlign->add(userDataSizeAlign, &offset);
+            std::memcpy(record + offset, userData.data(), userDataSizeAlign.size);
+        }
     }
 
     void Material::destroy() {
@@ -115,7 +1010,33 @@ namespace optixu {
         m->throwRuntimeError(_pipeline, "Invalid pipeline %p.", _pipeline);
 
         _Material::Key key{ _pipeline, rayType };
+        auto it = m->programs.find(key);
+        bool addsAnyHit = extract(hitGroup)->hasAnyHitProgram() &&
+            (it == m->programs.cend() || !it->second || !it->second->hasAnyHitProgram());
         m->programs[key] = extract(hitGroup);
+        m->invalidateHeaderCaches();
+        m->markSBTRecordDirty();
+        if (addsAnyHit)
+            m->getContext()->markSBTLayoutsDirtyForGeometryFlagInference();
+    }
+
+    void Material::replaceHitGroup(uint32_t rayType, ProgramGroup hitGroup) const {
+        const _Pipeline* _pipeline = extract(hitGroup)->getPipeline();
+        m->throwRuntimeError(_pipeline, "Invalid pipeline %p.", _pipeline);
+
+        _Material::Key key{ _pipeline, rayType };
+        m->throwRuntimeError(m->programs.count(key),
+                             "Hit group to be replaced is not set for the pipeline %s, rayType %u.",
+                             _pipeline->getName().c_str(), rayType);
+        _ProgramGroup* prevHitGroup = m->programs.at(key);
+        if (prevHitGroup == extract(hitGroup))
+            return;
+        bool addsAnyHit = extract(hitGroup)->hasAnyHitProgram() &&
+            (!prevHitGroup || !prevHitGroup->hasAnyHitProgram());
+        m->replaceProgram(_pipeline, rayType, extract(hitGroup));
+        m->markHeadersDirty();
+        if (addsAnyHit)
+            m->getContext()->markSBTLayoutsDirtyForGeometryFlagInference();
     }
 
     void Material::setUserData(const void* data, uint32_t size, uint32_t alignment) const {
@@ -123,9 +1044,14 @@ namespace optixu {
                              "Maximum user data size for Material is %u bytes.", s_maxMaterialUserDataSize);
         m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
                              "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
+        if (isSameUserData(m->userData, m->userDataSizeAlign, data, size, alignment)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::UserData);
+            return;
+        }
         m->userDataSizeAlign = SizeAlign(size, alignment);
         m->userData.resize(size);
         std::memcpy(m->userData.data(), data, size);
+        m->markSBTRecordDirty();
     }
 
     ProgramGroup Material::getHitGroup(Pipeline pipeline, uint32_t rayType) const {
@@ -150,50 +1076,899 @@ namespace optixu {
 
 
     void Scene::Priv::addGAS(_GeometryAccelerationStructure* gas) {
+        std::lock_guard<std::mutex> lock(registryMutex);
         geomASs[gas->getSerialID()] = gas;
+        bumpReadinessEpoch();
     }
 
     void Scene::Priv::removeGAS(_GeometryAccelerationStructure* gas) {
+        std::lock_guard<std::mutex> lock(registryMutex);
         geomASs.erase(gas->getSerialID());
+        bumpReadinessEpoch();
+        auto it = std::find(geomASsToBuild.cbegin(), geomASsToBuild.cend(), gas);
+        if (it != geomASsToBuild.cend())
+            geomASsToBuild.erase(it);
+        auto itLazy = std::find(lazilyBuiltGASs.cbegin(), lazilyBuiltGASs.cend(), gas);
+        if (itLazy != lazilyBuiltGASs.cend())
+            lazilyBuiltGASs.erase(itLazy);
+    }
+
+    void Scene::Priv::collectMaterials(std::vector<const _Material*>* mats) const {
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs)
+            gas.second->collectMaterials(mats);
     }
 
     void Scene::Priv::markSBTLayoutDirty() {
+        // JP: IASのdirty化は既存のオフセットが実際に変わったときにレイアウト生成時に行う。
+        // EN: IASs are marked dirty at the layout generation when existing offsets actually change.
         sbtLayoutIsUpToDate = false;
-
-        for (_InstanceAccelerationStructure* _ias : instASs)
-            _ias->markDirty(true);
+        bumpReadinessEpoch();
     }
 
-    uint32_t Scene::Priv::getSBTOffset(_GeometryAccelerationStructure* gas, uint32_t matSetIdx) {
-        SBTOffsetKey key = SBTOffsetKey{ gas->getSerialID(), matSetIdx };
-        throwRuntimeError(sbtOffsets.count(key), "GAS %s: material set index %u is out of bounds.",
-                          gas->getName().c_str(), matSetIdx);
-        return sbtOffsets.at(key);
-    }
+    void Scene::Priv::inferGeometryFlags() {
+        geometryFlagSuggestions.clear();
+        if (geometryFlagInference == GeometryFlagInference::Disabled && !hasInferredGeometryFlags)
+            return;
 
-    void Scene::Priv::setupHitGroupSBT(CUstream stream, const _Pipeline* pipeline, const BufferView &sbt, void* hostMem) {
-        throwRuntimeError(sbt.sizeInBytes() >= singleRecordSize * numSBTRecords,
-                          "Hit group shader binding table size is not enough.");
+        // JP: GeometryInstanceのフラグは複数のGASで共有されるので、全GASにわたって集計してから決める。
+        // EN: Flags of a geometry instance are shared among multiple GASs,
+        //     so accumulate over all GASs before deciding.
+        std::vector<_GeometryInstance*> geomInsts;
+        std::unordered_map<_GeometryInstance*, std::vector<uint8_t>> anyHitUsage;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs)
+            gas.second->accumulateAnyHitUsage(&geomInsts, &anyHitUsage);
+
+        bool apply = geometryFlagInference == GeometryFlagInference::Apply;
+        std::unordered_set<const _GeometryInstance*> changedGeomInsts;
+        hasInferredGeometryFlags = false;
+        for (_GeometryInstance* geomInst : geomInsts) {
+            const std::vector<uint8_t> &usage = anyHitUsage.at(geomInst);
+            for (uint32_t matIdx = 0; matIdx < usage.size(); ++matIdx) {
+                if (geomInst->isAnyHitFlagExplicit(matIdx))
+                    continue;
+                bool isCandidate = !usage[matIdx];
+                bool disable = apply && isCandidate;
+                if (geomInst->setAnyHitDisabledByInference(matIdx, disable))
+                    changedGeomInsts.insert(geomInst);
+                if (disable)
+                    hasInferredGeometryFlags = true;
+                if (isCandidate && geometryFlagInference != GeometryFlagInference::Disabled)
+                    geometryFlagSuggestions.push_back(
+                        GeometryFlagSuggestion{ geomInst->getPublicType(), matIdx, disable });
+            }
+        }
 
-        auto records = reinterpret_cast<uint8_t*>(hostMem);
+        // JP: ビルド入力が変わったGeometryInstanceを持つGASをそれぞれ一度だけdirty状態にする。
+        // EN: Mark each GAS having geometry instances with changed build inputs dirty only once.
+        if (changedGeomInsts.empty())
+            return;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            for (const _GeometryInstance* geomInst : changedGeomInsts) {
+                if (gas.second->hasChild(geomInst)) {
+                    gas.second->markDirty();
+                    break;
+                }
+            }
+        }
+    }
 
-        for (const std::pair<uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+    void Scene::Priv::generateSBTLayout() {
+        inferGeometryFlags();
+
+        struct Requirement {
+            SBTOffsetKey key;
+            uint32_t numRecords;
+            uint64_t contentHash;
+        };
+        std::vector<Requirement> requirements;
+        std::vector<_GeometryAccelerationStructure*> requirementGASs;
+        // JP: GASの仮想アドレスが実行の度に変わる環境でSBTのレイアウトを固定するため、
+        //     GASはアドレスではなくシリアルIDに紐付けられている。
+        // EN: A GAS is associated to its serial ID instead of its address to make SBT layout fixed
+        //     in an environment where GAS's virtual address changes run to run.
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
             uint32_t numMatSets = gas.second->getNumMaterialSets();
             for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
-                uint32_t numRecords = gas.second->fillSBTRecords(pipeline, matSetIdx, records);
-                records += numRecords * singleRecordSize;
+                requirements.push_back(Requirement{ SBTOffsetKey{ gas.first, matSetIdx }, 0, 0 });
+                requirementGASs.push_back(gas.second);
             }
         }
 
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(sbt.getCUdeviceptr(), hostMem, sbt.sizeInBytes(), stream));
-    }
+        // JP: 各範囲の要求は独立に計算できるのでタスクとして実行する。
+        // EN: Requirements of each range can be computed independently, so run them as tasks.
+        std::vector<SizeAlign> recordSizeAligns(requirements.size());
+        runTasks(static_cast<uint32_t>(requirements.size()), [&](uint32_t i) {
+            Requirement &req = requirements[i];
+            const _GeometryAccelerationStructure* gas = requirementGASs[i];
+            gas->calcSBTRequirements(req.key.matSetIndex, &recordSizeAligns[i], &req.numRecords);
+            if (sbtRecordSharing)
+                req.contentHash = gas->calcSBTRecordContentHash(req.key.matSetIndex);
+        });
+        SizeAlign maxRecordSizeAlign;
+        maxRecordSizeAlign += SizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+        for (const SizeAlign &recordSizeAlign : recordSizeAligns)
+            maxRecordSizeAlign = max(maxRecordSizeAlign, recordSizeAlign);
+        maxRecordSizeAlign.alignUp();
 
-    bool Scene::Priv::isReady(bool* hasMotionAS) {
-        *hasMotionAS = false;
-        for (const std::pair<uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
-            *hasMotionAS |= gas.second->hasMotion();
-            if (!gas.second->isReady())
-                return false;
+        // JP: レコードサイズが変わらなければ既存の範囲はそのまま残し、新規または大きさの変わった範囲を
+        //     末尾に追加する。削除された範囲は穴として残るが、穴が全体の半分を超えたら詰め直す。
+        // EN: If the record size doesn't change, keep existing ranges as is and append new or resized ranges
+        //     to the tail. Removed ranges remain as holes, but compact the layout when holes exceed half of the whole.
+        std::vector<SBTLayoutEntry> newLayout;
+        newLayout.reserve(requirements.size());
+        bool offsetsChanged = false;
+        bool incremental = !sbtRecordSharing && sbtLayoutGeneration > 0 && maxRecordSizeAlign.size == dataRecordSize;
+        if (incremental) {
+            uint32_t tail = numSBTRecords;
+            uint32_t numLiveRecords = 0;
+            auto itOld = sbtLayout.cbegin();
+            for (const Requirement &req : requirements) {
+                while (itOld != sbtLayout.cend() && itOld->key < req.key)
+                    ++itOld;
+                if (itOld != sbtLayout.cend() && itOld->key == req.key && itOld->numRecords == req.numRecords) {
+                    newLayout.push_back(*itOld);
+                }
+                else {
+                    if (itOld != sbtLayout.cend() && itOld->key == req.key)
+                        offsetsChanged = true;
+                    newLayout.push_back(SBTLayoutEntry{ req.key, tail, req.numRecords, false, false });
+                    tail += req.numRecords;
+                }
+                numLiveRecords += req.numRecords;
+            }
+            if (tail - numLiveRecords > tail / 2) {
+                incremental = false;
+            }
+            else {
+                numSBTRecords = tail;
+            }
+        }
+        if (!incremental) {
+            newLayout.clear();
+            // JP: 共有モードでは内容(ヘッダーを決めるマテリアルとユーザーデータ)が同一の範囲を一つにまとめ、
+            //     インスタンスのsbtOffsetを通じて共有させる。
+            // EN: In the sharing mode, merge ranges with identical contents (materials determining headers and
+            //     user data) into one, and let them be shared through instances' sbtOffset.
+            std::unordered_map<uint64_t, size_t> sharedRanges;
+            uint32_t sbtOffset = 0;
+            for (const Requirement &req : requirements) {
+                if (sbtRecordSharing && req.numRecords > 0) {
+                    auto it = sharedRanges.find(req.contentHash);
+                    if (it != sharedRanges.cend() && newLayout[it->second].numRecords == req.numRecords) {
+                        SBTLayoutEntry &owner = newLayout[it->second];
+                        owner.shared = true;
+                        newLayout.push_back(SBTLayoutEntry{ req.key, owner.offset, req.numRecords, true, true });
+                        continue;
+                    }
+                    sharedRanges[req.contentHash] = newLayout.size();
+                }
+                newLayout.push_back(SBTLayoutEntry{ req.key, sbtOffset, req.numRecords, false, false });
+                sbtOffset += req.numRecords;
+            }
+            numSBTRecords = sbtOffset;
+            offsetsChanged = true;
+        }
+        sbtLayout = std::move(newLayout);
+        dataRecordSize = maxRecordSizeAlign.size;
+        singleRecordSize = dataRecordSize;
+        if (recordDataSharing) {
+            // JP: パイプラインのレコードはヘッダーと共有データ中のレコードのアドレスのみとなる。
+            // EN: Records of pipelines consist only of the header and the address of the record in the shared data.
+            SizeAlign sharedRecordSizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+            sharedRecordSizeAlign += SizeAlign(sizeof(CUdeviceptr), alignof(CUdeviceptr));
+            sharedRecordSizeAlign.alignUp();
+            singleRecordSize = sharedRecordSizeAlign.size;
+
+            std::lock_guard<std::mutex> lock(sharedRecordDataMutex);
+            size_t sharedRecordDataSize = static_cast<size_t>(dataRecordSize) * std::max(numSBTRecords, 1u);
+            sharedRecordDataOnHost.resize(sharedRecordDataSize);
+            if (sharedRecordDataSize > sharedRecordDataTableCapacity) {
+                if (sharedRecordDataTable)
+                    CUDADRV_CHECK(cuMemFree(sharedRecordDataTable));
+                CUDADRV_CHECK(cuMemAlloc(&sharedRecordDataTable, sharedRecordDataSize));
+                sharedRecordDataTableCapacity = sharedRecordDataSize;
+            }
+        }
+
+        materialDataTableMaterials.clear();
+        materialDataOffsets.clear();
+        size_t materialDataTableSize = 0;
+        if (materialDataThreshold > 0) {
+            std::vector<const _Material*> mats;
+            for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs)
+                gas.second->collectMaterials(&mats);
+            for (const _Material* mat : mats) {
+                if (!isMaterialDataOutOfRecord(mat) || materialDataOffsets.count(mat))
+                    continue;
+                SizeAlign sizeAlign = mat->getUserDataSizeAlign();
+                materialDataTableSize = (materialDataTableSize + sizeAlign.alignment - 1)
+                    / sizeAlign.alignment * sizeAlign.alignment;
+                materialDataOffsets[mat] = materialDataTableSize;
+                materialDataTableMaterials.push_back(mat);
+                materialDataTableSize += sizeAlign.size;
+            }
+        }
+        materialDataTableOnHost.resize(materialDataTableSize);
+        if (materialDataTableSize > materialDataTableCapacity) {
+            if (materialDataTable)
+                CUDADRV_CHECK(cuMemFree(materialDataTable));
+            CUDADRV_CHECK(cuMemAlloc(&materialDataTable, materialDataTableSize));
+            materialDataTableCapacity = materialDataTableSize;
+        }
+        ++sbtLayoutGeneration;
+        sbtLayoutRecordStamp = context->getLatestSBTRecordStamp();
+        sbtLayoutIsUpToDate = true;
+
+        // JP: インスタンスのSBTオフセットが変わり得るのでIASをdirty状態にする。
+        // EN: Mark IASs dirty since SBT offsets of instances can change.
+        if (offsetsChanged) {
+            for (_InstanceAccelerationStructure* _ias : instASs)
+                _ias->markDirty(true);
+        }
+    }
+
+    uint32_t Scene::Priv::getSBTOffset(_GeometryAccelerationStructure* gas, uint32_t matSetIdx) {
+        SBTOffsetKey key = SBTOffsetKey{ gas->getSerialID(), matSetIdx };
+        auto it = std::lower_bound(sbtLayout.cbegin(), sbtLayout.cend(), key,
+                                   [](const SBTLayoutEntry &entry, const SBTOffsetKey &k) {
+                                       return entry.key < k;
+                                   });
+        throwRuntimeError(it != sbtLayout.cend() && it->key == key, "GAS %s: material set index %u is out of bounds.",
+                          gas->getName().c_str(), matSetIdx);
+        return it->offset;
+    }
+
+    void Scene::Priv::setupHitGroupSBT(CUstream stream, const _Pipeline* pipeline, const BufferView &sbt, void* hostMem) {
+        OPTIXU_NVTX_RANGE("optixu::Scene::setupHitGroupSBT", this);
+        throwRuntimeError(sbt.sizeInBytes() >= singleRecordSize * numSBTRecords,
+                          "Hit group shader binding table size is not enough.");
+
+        auto records = reinterpret_cast<uint8_t*>(hostMem);
+
+        if (taskExecutor) {
+            // JP: マテリアルのヘッダーキャッシュの構築は並列に行えないので事前に済ませる。
+            // EN: Building header caches of materials can't be done in parallel, so do it beforehand.
+            std::vector<const _Material*> mats;
+            for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs)
+                gas.second->collectMaterials(&mats);
+            for (const _Material* mat : mats)
+                mat->prepareHeaderCache(pipeline);
+        }
+
+        if (recordDataSharing) {
+            updateSharedRecordData(stream, pipeline);
+
+            // JP: パイプライン固有のヘッダーと共有データ中の対応するレコードのアドレスだけを書き込む。
+            // EN: Write only the pipeline-specific headers and the addresses of the corresponding records
+            //     in the shared data.
+            runTasks(static_cast<uint32_t>(sbtLayout.size()), [&](uint32_t i) {
+                const SBTLayoutEntry &entry = sbtLayout[i];
+                if (entry.isAlias)
+                    return;
+                auto it = geomASs.find(entry.key.gasSerialID);
+                if (it == geomASs.cend())
+                    return;
+                it->second->patchSBTRecordHeaders(pipeline, entry.key.matSetIndex, 0, true,
+                                                  records + static_cast<size_t>(entry.offset) * singleRecordSize,
+                                                  nullptr);
+            });
+            for (uint32_t recordIdx = 0; recordIdx < numSBTRecords; ++recordIdx) {
+                CUdeviceptr sharedRecord = sharedRecordDataTable + static_cast<size_t>(recordIdx) * dataRecordSize;
+                std::memcpy(records + static_cast<size_t>(recordIdx) * singleRecordSize + OPTIX_SBT_RECORD_HEADER_SIZE,
+                            &sharedRecord, sizeof(sharedRecord));
+            }
+        }
+        else {
+            // JP: 各範囲のオフセットはレイアウト生成時に決まっているので、範囲ごとに独立に書き込める。
+            // EN: Offsets of ranges are determined at the layout generation,
+            //     so each range can be filled independently.
+            runTasks(static_cast<uint32_t>(sbtLayout.size()), [&](uint32_t i) {
+                const SBTLayoutEntry &entry = sbtLayout[i];
+                if (entry.isAlias)
+                    return;
+                auto it = geomASs.find(entry.key.gasSerialID);
+                if (it == geomASs.cend())
+                    return;
+                it->second->fillSBTRecords(pipeline, entry.key.matSetIndex,
+                                           records + static_cast<size_t>(entry.offset) * singleRecordSize);
+            });
+        }
+
+        if (!materialDataTableOnHost.empty()) {
+            for (const _Material* mat : materialDataTableMaterials)
+                std::memcpy(materialDataTableOnHost.data() + materialDataOffsets.at(mat),
+                            mat->getUserData(), mat->getUserDataSizeAlign().size);
+            pipeline->upload(stream, materialDataTable, materialDataTableOnHost.data(),
+                             materialDataTableOnHost.size());
+        }
+
+        pipeline->upload(stream, sbt.getCUdeviceptr(), hostMem, sbt.sizeInBytes());
+    }
+
+    void Scene::Priv::updateHitGroupSBT(CUstream stream, const _Pipeline* pipeline, const BufferView &sbt, void* hostMem,
+                                        uint64_t lastStamp) {
+        throwRuntimeError(sbt.sizeInBytes() >= singleRecordSize * numSBTRecords,
+                          "Hit group shader binding table size is not enough.");
+
+        auto records = reinterpret_cast<uint8_t*>(hostMem);
+
+        if (recordDataSharing)
+            updateSharedRecordData(stream, pipeline);
+
+        // JP: 前回の転送以降に変更されたGASのレコードのみを書き直し、連続する範囲はまとめて転送する。
+        // EN: Refill only the records of GASs changed since the last transfer,
+        //     and transfer contiguous ranges together.
+        size_t rangeBegin = 0;
+        size_t rangeEnd = 0;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            if (recordDataSharing || gas.second->getSBTRecordStamp() <= lastStamp)
+                continue;
+
+            uint32_t numMatSets = gas.second->getNumMaterialSets();
+            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                size_t offset = static_cast<size_t>(getSBTOffset(gas.second, matSetIdx)) * singleRecordSize;
+                uint32_t numRecords = gas.second->fillSBTRecords(pipeline, matSetIdx, records + offset);
+                if (numRecords == 0)
+                    continue;
+
+                if (offset != rangeEnd) {
+                    if (rangeEnd > rangeBegin)
+                        pipeline->upload(stream, sbt.getCUdeviceptr() + rangeBegin, records + rangeBegin,
+                                         rangeEnd - rangeBegin);
+                    rangeBegin = offset;
+                }
+                rangeEnd = offset + static_cast<size_t>(numRecords) * singleRecordSize;
+            }
+        }
+        if (rangeEnd > rangeBegin)
+            pipeline->upload(stream, sbt.getCUdeviceptr() + rangeBegin, records + rangeBegin,
+                             rangeEnd - rangeBegin);
+
+        // JP: ヒットグループの差し替えのみのマテリアルはレイアウトもユーザーデータも変わらないので、
+        //     上で書き直されていないGASについて該当レコードのヘッダーだけをその場で書き換えて転送する。
+        //     共有モードではデータは共有データ側で更新済みなので、変更されたGASも全ヘッダーの書き換えだけで済む。
+        // EN: Materials with only hit group replacements change neither the layout nor user data,
+        //     so rewrite and transfer only the headers of the corresponding records in place
+        //     for GASs not refilled above.
+        //     In the sharing mode, data has already been updated on the shared data side,
+        //     so rewriting all the headers is enough also for changed GASs.
+        std::vector<uint8_t*> patchedRecords;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            bool recordsChanged = gas.second->getSBTRecordStamp() > lastStamp;
+            if ((recordsChanged && !recordDataSharing) ||
+                (!recordsChanged && gas.second->getHeaderStamp() <= lastStamp))
+                continue;
+
+            uint32_t numMatSets = gas.second->getNumMaterialSets();
+            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                size_t offset = static_cast<size_t>(getSBTOffset(gas.second, matSetIdx)) * singleRecordSize;
+                gas.second->patchSBTRecordHeaders(pipeline, matSetIdx, lastStamp, recordsChanged,
+                                                  records + offset, &patchedRecords);
+            }
+        }
+        if (!patchedRecords.empty()) {
+            // JP: 隣接するレコードは先頭のヘッダーから末尾のヘッダーまでまとめて転送する。
+            // EN: Transfer adjacent records together from the first header to the last header.
+            std::sort(patchedRecords.begin(), patchedRecords.end());
+            patchedRecords.erase(std::unique(patchedRecords.begin(), patchedRecords.end()), patchedRecords.end());
+            size_t spanBegin = patchedRecords[0] - records;
+            size_t spanLast = spanBegin;
+            for (size_t i = 1; i <= patchedRecords.size(); ++i) {
+                size_t offset = i < patchedRecords.size() ? patchedRecords[i] - records : SIZE_MAX;
+                if (offset == spanLast + singleRecordSize) {
+                    spanLast = offset;
+                    continue;
+                }
+                pipeline->upload(stream, sbt.getCUdeviceptr() + spanBegin, records + spanBegin,
+                                 spanLast - spanBegin + OPTIX_SBT_RECORD_HEADER_SIZE);
+                spanBegin = offset;
+                spanLast = offset;
+            }
+        }
+
+        for (const _Material* mat : materialDataTableMaterials) {
+            if (mat->getSBTRecordStamp() <= lastStamp)
+                continue;
+            size_t offset = materialDataOffsets.at(mat);
+            size_t size = mat->getUserDataSizeAlign().size;
+            std::memcpy(materialDataTableOnHost.data() + offset, mat->getUserData(), size);
+            pipeline->upload(stream, materialDataTable + offset, materialDataTableOnHost.data() + offset, size);
+        }
+    }
+
+    void Scene::Priv::updateSharedRecordData(CUstream stream, const _Pipeline* pipeline) {
+        // JP: ヘッダー部分にも書き込まれるが、デバイスはパイプラインのレコードのヘッダーを使うので影響しない。
+        // EN: Headers are also written, but this doesn't matter since the device uses headers of
+        //     the pipeline's records.
+        std::lock_guard<std::mutex> lock(sharedRecordDataMutex);
+        uint8_t* records = sharedRecordDataOnHost.data();
+        uint64_t latestStamp = context->getLatestSBTRecordStamp();
+        if (sharedRecordDataGeneration != sbtLayoutGeneration) {
+            runTasks(static_cast<uint32_t>(sbtLayout.size()), [&](uint32_t i) {
+                const SBTLayoutEntry &entry = sbtLayout[i];
+                if (entry.isAlias)
+                    return;
+                auto it = geomASs.find(entry.key.gasSerialID);
+                if (it == geomASs.cend())
+                    return;
+                it->second->fillSBTRecords(pipeline, entry.key.matSetIndex,
+                                           records + static_cast<size_t>(entry.offset) * dataRecordSize);
+            });
+            pipeline->upload(stream, sharedRecordDataTable, records, sharedRecordDataOnHost.size());
+        }
+        else if (sharedRecordDataStamp != latestStamp) {
+            size_t rangeBegin = 0;
+            size_t rangeEnd = 0;
+            for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+                if (gas.second->getSBTRecordStamp() <= sharedRecordDataStamp)
+                    continue;
+
+                uint32_t numMatSets = gas.second->getNumMaterialSets();
+                for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                    size_t offset = static_cast<size_t>(getSBTOffset(gas.second, matSetIdx)) * dataRecordSize;
+                    uint32_t numRecords = gas.second->fillSBTRecords(pipeline, matSetIdx, records + offset);
+                    if (numRecords == 0)
+                        continue;
+
+                    if (offset != rangeEnd) {
+                        if (rangeEnd > rangeBegin)
+                            pipeline->upload(stream, sharedRecordDataTable + rangeBegin, records + rangeBegin,
+                                             rangeEnd - rangeBegin);
+                        rangeBegin = offset;
+                    }
+                    rangeEnd = offset + static_cast<size_t>(numRecords) * dataRecordSize;
+                }
+            }
+            if (rangeEnd > rangeBegin)
+                pipeline->upload(stream, sharedRecordDataTable + rangeBegin, records + rangeBegin,
+                                 rangeEnd - rangeBegin);
+        }
+        sharedRecordDataGeneration = sbtLayoutGeneration;
+        sharedRecordDataStamp = latestStamp;
+    }
+
+    void Scene::Priv::setLazyBuildMemory(const BufferView &accelPool, const BufferView &scratchBuffer) {
+        // JP: プールは線形に割り当てるだけなので、再設定時はそこにビルドされたGASを全て無効化する。
+        // EN: The pool is only allocated linearly, so invalidate all the GASs built in it when resetting.
+        for (_GeometryAccelerationStructure* gas : lazilyBuiltGASs)
+            gas->markDirty();
+        lazilyBuiltGASs.clear();
+
+        lazyBuildAccelPool = accelPool;
+        lazyBuildScratchBuffer = scratchBuffer;
+        lazyBuildPoolOffset = 0;
+    }
+
+    void Scene::Priv::buildLazyGAS(CUstream stream, _GeometryAccelerationStructure* gas) {
+        throwRuntimeError(lazyBuildAccelPool.isValid() && lazyBuildScratchBuffer.isValid(),
+                          "Memory for lazy GAS builds has not been set.");
+
+        GeometryAccelerationStructure pubGas = gas->getPublicType();
+        OptixAccelBufferSizes memReq;
+        pubGas.prepareForBuild(&memReq);
+
+        size_t offset = (lazyBuildPoolOffset + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1)
+            / OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT * OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+        throwRuntimeError(offset + memReq.outputSizeInBytes <= lazyBuildAccelPool.sizeInBytes(),
+                          "Memory pool for lazy GAS builds is exhausted (GAS %s).", gas->getName().c_str());
+        throwRuntimeError(memReq.tempSizeInBytes <= lazyBuildScratchBuffer.sizeInBytes(),
+                          "Scratch buffer for lazy GAS builds is not enough (GAS %s).", gas->getName().c_str());
+
+        BufferView accelBuffer(lazyBuildAccelPool.getCUdeviceptr() + offset, memReq.outputSizeInBytes, 1);
+        pubGas.rebuild(stream, accelBuffer, lazyBuildScratchBuffer);
+        lazyBuildPoolOffset = offset + memReq.outputSizeInBytes;
+        lazilyBuiltGASs.push_back(gas);
+    }
+
+    void Scene::Priv::prepareResidency(CUstream stream, const std::vector<_Instance*> &instances) {
+        uint64_t curFrameIndex;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            curFrameIndex = frameIndex;
+        }
+        ++residencyStamp;
+
+        std::vector<_GeometryAccelerationStructure*> gasesToRestore;
+        size_t restoreSize = 0;
+        for (_Instance* inst : instances) {
+            // JP: Transformを経由して参照されるGASも同様に扱う。
+            // EN: Treat GASs referenced through transforms the same way.
+            _GeometryAccelerationStructure* gas = inst->getChildGAS();
+            if (!gas) {
+                if (_Transform* tr = inst->getChildTransform())
+                    gas = tr->getDescendantGAS();
+            }
+            if (!gas || !gas->isEvictable())
+                continue;
+            gas->touchResidency(curFrameIndex, residencyStamp);
+            if (gas->isEvicted() &&
+                std::find(gasesToRestore.cbegin(), gasesToRestore.cend(), gas) == gasesToRestore.cend()) {
+                gasesToRestore.push_back(gas);
+                restoreSize += gas->getCompactedSize();
+            }
+        }
+
+        // JP: 復帰の前に退避して、デバイスメモリーの使用量のピークを抑える。
+        // EN: Evict before restoration to keep the peak of device memory usage down.
+        if (residencyBudget > 0)
+            enforceResidencyBudget(stream, restoreSize);
+        for (_GeometryAccelerationStructure* gas : gasesToRestore) {
+            gas->restore(stream);
+            ++numRestorations;
+        }
+        if (gasesToRestore.empty())
+            return;
+
+        // JP: 復帰したGASのハンドルは変わるので、それを子孫に持つ準備済みのTransformをGASに近い側から作り直す。
+        //     Transformのデバイスメモリーは変わらないので、それを参照するインスタンスはそのままで良い。
+        // EN: The handles of restored GASs change, so rebuild ready transforms having them as descendants
+        //     from the side closer to the GAS.
+        //     The device memory of a transform doesn't change, so instances referencing it can stay as is.
+        std::vector<std::pair<uint32_t, _Transform*>> transformsToRebuild;
+        for (_Transform* tr : transforms) {
+            if (!tr->isReady() || !tr->getDeviceBuffer().isValid())
+                continue;
+            uint32_t distance = 0;
+            const _Transform* curTr = tr;
+            while (curTr && !curTr->getChildGAS()) {
+                curTr = curTr->getChildTransform();
+                ++distance;
+            }
+            if (!curTr ||
+                std::find(gasesToRestore.cbegin(), gasesToRestore.cend(), curTr->getChildGAS()) ==
+                gasesToRestore.cend())
+                continue;
+            transformsToRebuild.emplace_back(distance, tr);
+        }
+        std::sort(transformsToRebuild.begin(), transformsToRebuild.end(),
+                  [](const std::pair<uint32_t, _Transform*> &a, const std::pair<uint32_t, _Transform*> &b) {
+                      return a.first < b.first;
+                  });
+        for (const std::pair<uint32_t, _Transform*> &tr : transformsToRebuild)
+            tr.second->getPublicType().rebuild(stream, tr.second->getDeviceBuffer());
+    }
+
+    void Scene::Priv::enforceResidencyBudget(CUstream stream, size_t additionalSize) {
+        if (residencyBudget == 0)
+            return;
+
+        size_t residentSize = additionalSize;
+        std::vector<_GeometryAccelerationStructure*> candidates;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            if (!gas.second->isEvictable() || gas.second->isEvicted() || !gas.second->isReady())
+                continue;
+            residentSize += gas.second->getResidentSize();
+            if (gas.second->isEvictionCandidate())
+                candidates.push_back(gas.second);
+        }
+        if (residentSize <= residencyBudget || candidates.empty())
+            return;
+
+        // JP: 準備済みのIASから(Transformを経由して)参照されているGASは使われ得るので退避しない。
+        // EN: Don't evict GASs referenced (through transforms) by ready IASs since they may be in use.
+        std::unordered_set<const _GeometryAccelerationStructure*> referencedGASs;
+        for (const _InstanceAccelerationStructure* ias : instASs) {
+            if (!ias->isReady())
+                continue;
+            for (const _Instance* inst : ias->getChildren()) {
+                if (const _GeometryAccelerationStructure* gas = inst->getChildGAS()) {
+                    referencedGASs.insert(gas);
+                    continue;
+                }
+                for (const _Transform* tr = inst->getChildTransform(); tr; tr = tr->getChildTransform()) {
+                    if (const _GeometryAccelerationStructure* gas = tr->getChildGAS())
+                        referencedGASs.insert(gas);
+                }
+            }
+        }
+
+        uint64_t curFrameIndex;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            curFrameIndex = frameIndex;
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const _GeometryAccelerationStructure* a, const _GeometryAccelerationStructure* b) {
+                      return a->getLastReferencedStamp() < b->getLastReferencedStamp();
+                  });
+        for (_GeometryAccelerationStructure* gas : candidates) {
+            if (residentSize <= residencyBudget)
+                break;
+            // JP: 直近のprepareResidency()で参照されたGASは、minFramesToKeepが0でも構築中のIASが使うので退避しない。
+            // EN: Don't evict GASs referenced by the latest prepareResidency() even when minFramesToKeep is 0
+            //     since the IAS being built uses them.
+            if (gas->getLastReferencedFrameIndex() + residencyMinFramesToKeep > curFrameIndex ||
+                (residencyStamp > 0 && gas->getLastReferencedStamp() == residencyStamp) ||
+                referencedGASs.count(gas) > 0)
+                continue;
+            residentSize -= gas->getResidentSize();
+            gas->evict(stream);
+            ++numEvictions;
+        }
+    }
+
+    void Scene::Priv::getResidencyStatistics(GASResidencyStatistics* stats) const {
+        *stats = {};
+        stats->budgetInBytes = residencyBudget;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            if (!gas.second->isEvictable())
+                continue;
+            if (gas.second->isEvicted()) {
+                stats->evictedSizeInBytes += gas.second->getCompactedSize();
+                ++stats->numEvictedGASs;
+            }
+            else if (gas.second->isReady()) {
+                stats->residentSizeInBytes += gas.second->getResidentSize();
+                ++stats->numResidentGASs;
+            }
+        }
+        stats->numEvictions = numEvictions;
+        stats->numRestorations = numRestorations;
+    }
+
+    void Scene::Priv::deferDeviceMemoryRelease(CUdeviceptr memory) {
+        deferRelease(
+            [](void* userData) {
+                cuMemFree(static_cast<CUdeviceptr>(reinterpret_cast<uintptr_t>(userData)));
+            },
+            reinterpret_cast<void*>(static_cast<uintptr_t>(memory)));
+    }
+
+    void Scene::Priv::collectDirtyBuildTasks() {
+        dirtyBuildTasks.clear();
+        dirtyBuildScratchSize = 0;
+
+        // JP: IAS/Transformの子の参照から依存関係のDAGを辿り、各ノードの深さと作業の要否を求める。
+        //     子が作業を要するノードは自身も作業を要する(dirty状態が上方へ伝播する)。
+        // EN: Traverse the dependency DAG through child references of IASs/transforms,
+        //     and determine the depth of each node and whether it requires work.
+        //     A node whose child requires work also requires work (dirty state propagates upward).
+        struct NodeState {
+            uint32_t level;
+            bool needsWork;
+        };
+        struct DependencyResolver {
+            Scene::Priv* scene;
+            std::unordered_map<const void*, NodeState> states;
+
+            NodeState visit(_GeometryAccelerationStructure* gas) {
+                auto it = states.find(gas);
+                if (it != states.cend())
+                    return it->second;
+
+                // JP: 退避したGASは参照するIASのリビルド時に復帰する。
+                // EN: An evicted GAS is restored at the rebuild of an IAS referencing it.
+                NodeState state = { 0, !gas->isReady() && !gas->isEvicted() };
+                if (state.needsWork) {
+                    if (!gas->isLazyBuild()) {
+                        // JP: 前回のビルドで与えられたバッファー上にリビルドする。
+                        // EN: Rebuild on the buffer given in the previous build.
+                        OptixAccelBufferSizes memReq;
+                        gas->getPublicType().prepareForBuild(&memReq);
+                        scene->throwRuntimeError(gas->getAccelBuffer().isValid(),
+                                                 "GAS %s has never been built with an explicit buffer.",
+                                                 gas->getName().c_str());
+                        scene->throwRuntimeError(gas->getAccelBuffer().sizeInBytes() >= memReq.outputSizeInBytes,
+                                                 "GAS %s: the buffer of the previous build is not enough.",
+                                                 gas->getName().c_str());
+                        scene->dirtyBuildScratchSize = std::max(scene->dirtyBuildScratchSize, memReq.tempSizeInBytes);
+                    }
+                    scene->dirtyBuildTasks.push_back(DirtyBuildTask{ gas, nullptr, nullptr, state.level });
+                }
+                states[gas] = state;
+                return state;
+            }
+            NodeState visit(_Transform* tr) {
+                auto it = states.find(tr);
+                if (it != states.cend())
+                    return it->second;
+
+                NodeState childState = { 0, false };
+                if (_GeometryAccelerationStructure* gas = tr->getChildGAS())
+                    childState = visit(gas);
+                else if (_InstanceAccelerationStructure* ias = tr->getChildIAS())
+                    childState = visit(ias);
+                else if (_Transform* childTr = tr->getChildTransform())
+                    childState = visit(childTr);
+                else
+                    scene->throwRuntimeError(false, "Transform %s: child is invalid.", tr->getName().c_str());
+
+                if (childState.needsWork)
+                    tr->markDirty();
+                NodeState state = { childState.level + 1, !tr->isReady() };
+                if (state.needsWork) {
+                    const BufferView &deviceBuffer = tr->getDeviceBuffer();
+                    scene->throwRuntimeError(deviceBuffer.isValid(),
+                                             "Transform %s has never been built with explicit device memory.",
+                                             tr->getName().c_str());
+                    scene->throwRuntimeError(deviceBuffer.sizeInBytes() >= tr->getDataSize(),
+                                             "Transform %s: the device memory of the previous build is not enough.",
+                                             tr->getName().c_str());
+                    scene->dirtyBuildTasks.push_back(DirtyBuildTask{ nullptr, tr, nullptr, state.level });
+                }
+                states[tr] = state;
+                return state;
+            }
+            NodeState visit(_InstanceAccelerationStructure* ias) {
+                auto it = states.find(ias);
+                if (it != states.cend())
+                    return it->second;
+
+                NodeState state = { 1, !ias->isReady() || ias->hasPendingInstanceChanges() };
+                if (!ias->usesDeviceInstances()) {
+                    for (const _Instance* inst : ias->getChildren()) {
+                        NodeState childState = { 0, false };
+                        if (_GeometryAccelerationStructure* gas = inst->getChildGAS())
+                            childState = visit(gas);
+                        else if (_InstanceAccelerationStructure* childIas = inst->getChildIAS())
+                            childState = visit(childIas);
+                        else if (_Transform* tr = inst->getChildTransform())
+                            childState = visit(tr);
+                        state.level = std::max(state.level, childState.level + 1);
+                        state.needsWork |= childState.needsWork;
+                    }
+                }
+                if (state.needsWork) {
+                    OptixAccelBufferSizes memReq = ias->getMemoryRequirement();
+                    if (!ias->isReady() || !ias->isReadyToBuild())
+                        ias->getPublicType().prepareForBuild(&memReq);
+                    const BufferView &instBuffer = ias->getInstanceBuffer();
+                    const BufferView &accelBuffer = ias->getAccelBuffer();
+                    scene->throwRuntimeError(accelBuffer.isValid(),
+                                             "IAS %s has never been built with explicit buffers.",
+                                             ias->getName().c_str());
+                    scene->throwRuntimeError(accelBuffer.sizeInBytes() >= memReq.outputSizeInBytes &&
+                                             instBuffer.sizeInBytes() >= ias->getNumInstances() * sizeof(OptixInstance),
+                                             "IAS %s: the buffers of the previous build are not enough.",
+                                             ias->getName().c_str());
+                    // JP: リビルドとアップデートのどちらになるかは子のハンドルが確定するまで分からない。
+                    // EN: Whether it will be a rebuild or an update is unknown until the handles of children are fixed.
+                    scene->dirtyBuildScratchSize = std::max(
+                        scene->dirtyBuildScratchSize,
+                        std::max(memReq.tempSizeInBytes, memReq.tempUpdateSizeInBytes));
+                    scene->dirtyBuildTasks.push_back(DirtyBuildTask{ nullptr, nullptr, ias, state.level });
+                }
+                states[ias] = state;
+                return state;
+            }
+        };
+
+        DependencyResolver resolver{ this, {} };
+        for (_InstanceAccelerationStructure* ias : instASs)
+            resolver.visit(ias);
+        for (_Transform* tr : transforms)
+            resolver.visit(tr);
+        // JP: 遅延ビルドのGASは参照されている場合のみビルドする。
+        // EN: Build lazy-build GASs only when referenced.
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            if (!gas.second->isLazyBuild())
+                resolver.visit(gas.second);
+        }
+
+        std::stable_sort(dirtyBuildTasks.begin(), dirtyBuildTasks.end(),
+                         [](const DirtyBuildTask &a, const DirtyBuildTask &b) {
+                             return a.level < b.level;
+                         });
+    }
+
+    void Scene::Priv::retireFrames(bool wait, uint64_t untilFrameIndex,
+                                   std::vector<std::pair<DeferredReleaseFunction, void*>>* releases) {
+        // JP: フレームは古い順に完了させ、新しいフレームに遅延された解放がより古いフレームの完了も保証するようにする。
+        // EN: Retire frames from the oldest so that a release deferred to a newer frame
+        //     also guarantees the completion of older frames.
+        uint32_t numSlots = static_cast<uint32_t>(frameSlots.size());
+        for (; oldestFrameIndexInFlight < untilFrameIndex; ++oldestFrameIndexInFlight) {
+            FrameSlot &slot = frameSlots[oldestFrameIndexInFlight % numSlots];
+            if (wait) {
+                CUDADRV_CHECK(cuEventSynchronize(slot.finishEvent));
+            }
+            else {
+                CUresult res = cuEventQuery(slot.finishEvent);
+                if (res == CUDA_ERROR_NOT_READY)
+                    break;
+                CUDADRV_CHECK(res);
+            }
+            releases->insert(releases->end(), slot.deferredReleases.cbegin(), slot.deferredReleases.cend());
+            slot.deferredReleases.clear();
+        }
+    }
+
+    void Scene::Priv::setMaxFramesInFlight(uint32_t maxFramesInFlight) {
+        throwRuntimeError(maxFramesInFlight > 0, "maxFramesInFlight must be at least 1.");
+        std::vector<std::pair<DeferredReleaseFunction, void*>> releases;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            throwRuntimeError(!frameIsOpen, "Changing the number of frames in flight during a frame is not allowed.");
+            retireFrames(true, frameIndex, &releases);
+            for (FrameSlot &slot : frameSlots)
+                CUDADRV_CHECK(cuEventDestroy(slot.finishEvent));
+            frameSlots.resize(maxFramesInFlight);
+            for (FrameSlot &slot : frameSlots) {
+                CUDADRV_CHECK(cuEventCreate(&slot.finishEvent, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+                slot.deferredReleases.clear();
+            }
+        }
+        for (const std::pair<DeferredReleaseFunction, void*> &release : releases)
+            release.first(release.second);
+    }
+
+    void Scene::Priv::beginFrame(uint32_t* frameSlot) {
+        std::vector<std::pair<DeferredReleaseFunction, void*>> releases;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            throwRuntimeError(!frameIsOpen, "endFrame() has not been called for the previous frame.");
+            uint32_t numSlots = static_cast<uint32_t>(frameSlots.size());
+            if (frameIndex >= numSlots)
+                retireFrames(true, frameIndex - numSlots + 1, &releases);
+            frameIsOpen = true;
+            if (frameSlot)
+                *frameSlot = static_cast<uint32_t>(frameIndex % numSlots);
+        }
+        for (const std::pair<DeferredReleaseFunction, void*> &release : releases)
+            release.first(release.second);
+    }
+
+    void Scene::Priv::endFrame(CUstream stream) {
+        std::vector<std::pair<DeferredReleaseFunction, void*>> releases;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            throwRuntimeError(frameIsOpen, "beginFrame() has not been called.");
+            FrameSlot &slot = frameSlots[frameIndex % frameSlots.size()];
+            CUDADRV_CHECK(cuEventRecord(slot.finishEvent, stream));
+            ++frameIndex;
+            frameIsOpen = false;
+            retireFrames(false, frameIndex, &releases);
+        }
+        for (const std::pair<DeferredReleaseFunction, void*> &release : releases)
+            release.first(release.second);
+    }
+
+    void Scene::Priv::deferRelease(DeferredReleaseFunction func, void* userData) {
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            // JP: 開いているフレーム、無ければ最後に終了したフレームに関連付ける。
+            // EN: Associate with the open frame, or the last ended frame if there is none.
+            if (frameIsOpen || oldestFrameIndexInFlight < frameIndex) {
+                uint64_t targetFrameIndex = frameIsOpen ? frameIndex : frameIndex - 1;
+                frameSlots[targetFrameIndex % frameSlots.size()].deferredReleases.emplace_back(func, userData);
+                return;
+            }
+        }
+        func(userData);
+    }
+
+    void Scene::Priv::waitForAllFrames() {
+        std::vector<std::pair<DeferredReleaseFunction, void*>> releases;
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+            retireFrames(true, frameIndex, &releases);
+        }
+        for (const std::pair<DeferredReleaseFunction, void*> &release : releases)
+            release.first(release.second);
+    }
+
+    void Scene::Priv::joinWorkerStreams(const CUstream* workerStreams, uint32_t numWorkerStreams) {
+        // JP: 各ワーカーストリームに他の全ワーカーストリームのそれまでの処理を待たせる。
+        // EN: Make each worker stream wait for the preceding work of all the other worker streams.
+        for (uint32_t i = 0; i < numWorkerStreams; ++i) {
+            CUDADRV_CHECK(cuEventRecord(asBuildEvent, workerStreams[i]));
+            for (uint32_t j = 0; j < numWorkerStreams; ++j) {
+                if (workerStreams[j] != workerStreams[i])
+                    CUDADRV_CHECK(cuStreamWaitEvent(workerStreams[j], asBuildEvent, 0));
+            }
+        }
+    }
+
+    bool Scene::Priv::isReady(bool* hasMotionAS) {
+        *hasMotionAS = false;
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : geomASs) {
+            *hasMotionAS |= gas.second->hasMotion();
+            // JP: 遅延ビルドのGASはIASから参照された時点でビルドされるので、未ビルドでも問題ない。
+            // EN: A lazy-build GAS is built when referenced by an IAS, so it is fine that it is not built.
+            // JP: 退避したGASは準備済みのIASから参照されていない。
+            // EN: An evicted GAS is not referenced by ready IASs.
+            if (!gas.second->isReady() && !gas.second->isLazyBuild() && !gas.second->isEvicted())
+                return false;
         }
 
         for (_Transform* tr : transforms) {
@@ -210,6 +1985,106 @@ namespace optixu {
         if (!sbtLayoutIsUpToDate)
             return false;
 
+        // JP: 共有モードでは、共有されている範囲の内容がレイアウト生成後に変わった場合、
+        //     共有が成り立たなくなるのでレイアウトを無効化する。
+        // EN: In the sharing mode, invalidate the layout when the contents of a shared range changed
+        //     after the layout generation since the sharing no longer holds.
+        if (sbtRecordSharing && context->getLatestSBTRecordStamp() != sbtLayoutRecordStamp) {
+            for (const SBTLayoutEntry &entry : sbtLayout) {
+                if (!entry.shared)
+                    continue;
+                auto it = geomASs.find(entry.key.gasSerialID);
+                if (it != geomASs.cend() && it->second->getSBTRecordStamp() > sbtLayoutRecordStamp) {
+                    markSBTLayoutDirty();
+                    return false;
+                }
+            }
+            sbtLayoutRecordStamp = context->getLatestSBTRecordStamp();
+        }
+
+        return true;
+    }
+
+    uint32_t Scene::Priv::allocateCompactedSizeSlot() {
+        std::unique_lock<std::shared_mutex> storageLock(compactedSizeStorageMutex);
+        std::lock_guard<std::mutex> slotLock(compactedSizeSlotMutex);
+        if (!freeCompactedSizeSlots.empty()) {
+            uint32_t slot = freeCompactedSizeSlots.back();
+            freeCompactedSizeSlots.pop_back();
+            return slot;
+        }
+
+        if (numCompactedSizeSlots == compactedSizeSlotCapacity) {
+            // JP: 配列の拡張はAS生成時にしか起こらず、頻度も低いので単純に同期して中身を移す。
+            // EN: Expanding the arrays happens only at AS creation and is infrequent,
+            //     so simply synchronize and move the contents.
+            uint32_t newCapacity = std::max(2 * compactedSizeSlotCapacity, 64u);
+            CUdeviceptr newSizesOnDevice;
+            size_t* newSizesOnHost;
+            CUDADRV_CHECK(cuMemAlloc(&newSizesOnDevice, sizeof(size_t) * newCapacity));
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&newSizesOnHost), sizeof(size_t) * newCapacity));
+            if (compactedSizeSlotCapacity > 0) {
+                CUDADRV_CHECK(cuCtxSynchronize());
+                CUDADRV_CHECK(cuMemcpyDtoD(newSizesOnDevice, compactedSizesOnDevice,
+                                           sizeof(size_t) * numCompactedSizeSlots));
+                std::copy_n(compactedSizesOnHost, numCompactedSizeSlots, newSizesOnHost);
+                CUDADRV_CHECK(cuMemFreeHost(compactedSizesOnHost));
+                CUDADRV_CHECK(cuMemFree(compactedSizesOnDevice));
+            }
+            compactedSizesOnDevice = newSizesOnDevice;
+            compactedSizesOnHost = newSizesOnHost;
+            compactedSizeSlotCapacity = newCapacity;
+        }
+
+        return numCompactedSizeSlots++;
+    }
+
+    void Scene::Priv::releaseCompactedSizeSlot(uint32_t slot) {
+        std::lock_guard<std::mutex> slotLock(compactedSizeSlotMutex);
+        freeCompactedSizeSlots.push_back(slot);
+    }
+
+    uint64_t Scene::Priv::requestCompactedSizeReadback(CUstream stream) {
+        std::lock_guard<std::mutex> slotLock(compactedSizeSlotMutex);
+        auto it = std::find(streamsForCompactedSizeReadback.cbegin(), streamsForCompactedSizeReadback.cend(), stream);
+        if (it == streamsForCompactedSizeReadback.cend())
+            streamsForCompactedSizeReadback.push_back(stream);
+        return numCompactedSizeReadbacks + 1;
+    }
+
+    bool Scene::Priv::readCompactedSize(uint32_t slot, uint64_t readbackIndex, bool wait, size_t* size) {
+        // JP: 要求されている読み戻しがまだ発行されていない場合は、保留中の全ASのサイズをまとめて読み戻す。
+        //     ビルドが複数のストリームで行われた場合は、最初のストリームに他のストリームを待たせる。
+        // EN: Read back the sizes of all the pending ASs together if the requested readback has not been issued yet.
+        //     Make the first stream wait for the other streams in the case where builds were done in multiple streams.
+        std::shared_lock<std::shared_mutex> storageLock(compactedSizeStorageMutex);
+        std::unique_lock<std::mutex> slotLock(compactedSizeSlotMutex);
+        if (numCompactedSizeReadbacks < readbackIndex) {
+            optixuAssert(!streamsForCompactedSizeReadback.empty(), "No stream for readback.");
+            CUstream stream = streamsForCompactedSizeReadback[0];
+            for (uint32_t i = 1; i < streamsForCompactedSizeReadback.size(); ++i) {
+                CUDADRV_CHECK(cuEventRecord(compactedSizeReadbackEvent, streamsForCompactedSizeReadback[i]));
+                CUDADRV_CHECK(cuStreamWaitEvent(stream, compactedSizeReadbackEvent, 0));
+            }
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(compactedSizesOnHost, compactedSizesOnDevice,
+                                            sizeof(size_t) * numCompactedSizeSlots, stream));
+            CUDADRV_CHECK(cuEventRecord(compactedSizeReadbackEvent, stream));
+            streamsForCompactedSizeReadback.clear();
+            ++numCompactedSizeReadbacks;
+        }
+        slotLock.unlock();
+
+        if (wait) {
+            CUDADRV_CHECK(cuEventSynchronize(compactedSizeReadbackEvent));
+        }
+        else {
+            CUresult res = cuEventQuery(compactedSizeReadbackEvent);
+            if (res == CUDA_ERROR_NOT_READY)
+                return false;
+            CUDADRV_CHECK(res);
+        }
+        *size = compactedSizesOnHost[slot];
+
         return true;
     }
 
@@ -238,9 +2113,7 @@ namespace optixu {
                              "Invalid geometry type: %u.", static_cast<uint32_t>(geomType));
         // JP: GASを生成するだけならSBTレイアウトには影響を与えないので無効化は不要。
         // EN: Only generating a GAS doesn't affect a SBT layout, no need to invalidate it.
-        optixuAssert(m->geomASs.count(m->nextGeomASSerialID) == 0,
-                     "Too many GAS creation beyond expectation has been done.");
-        return (new _GeometryAccelerationStructure(m, m->nextGeomASSerialID++, geomType))->getPublicType();
+        return (new _GeometryAccelerationStructure(m, m->issueGASSerialID(), geomType))->getPublicType();
     }
 
     Transform Scene::createTransform() const {
@@ -251,54 +2124,904 @@ namespace optixu {
         return (new _Instance(m))->getPublicType();
     }
 
-    InstanceAccelerationStructure Scene::createInstanceAccelerationStructure() const {
-        return (new _InstanceAccelerationStructure(m))->getPublicType();
+    InstanceAccelerationStructure Scene::createInstanceAccelerationStructure() const {
+        return (new _InstanceAccelerationStructure(m))->getPublicType();
+    }
+
+    void Scene::createGeometryInstances(GeometryType geomType, uint32_t count, GeometryInstance* geomInsts) const {
+        m->throwRuntimeError(geomType == GeometryType::Triangles ||
+                             geomType == GeometryType::LinearSegments ||
+                             geomType == GeometryType::QuadraticBSplines ||
+                             geomType == GeometryType::CubicBSplines ||
+                             geomType == GeometryType::CustomPrimitives,
+                             "Invalid geometry type: %u.", static_cast<uint32_t>(geomType));
+        m->throwRuntimeError(geomInsts || count == 0, "geomInsts must not be null.");
+        if (count == 0)
+            return;
+
+        std::vector<void*> storage(count);
+        _GeometryInstance::allocateMultiple(count, storage.data());
+        for (uint32_t i = 0; i < count; ++i)
+            geomInsts[i] = (::new (storage[i]) _GeometryInstance(m, geomType))->getPublicType();
+    }
+
+    void Scene::createInstances(uint32_t count, const InstanceDesc* descs, Instance* instances) const {
+        m->throwRuntimeError(instances || count == 0, "instances must not be null.");
+        if (count == 0)
+            return;
+
+        // JP: 全ての設定を生成前に検証し、途中で失敗しても生成済みのオブジェクトが残らないようにする。
+        // EN: Validate all the settings before creation so that no created object remains on a failure midway.
+        if (descs) {
+            uint32_t maxInstanceID = m->getContext()->getMaxInstanceID();
+            uint32_t numVisibilityMaskBits = m->getContext()->getNumVisibilityMaskBits();
+            for (uint32_t i = 0; i < count; ++i) {
+                const InstanceDesc &desc = descs[i];
+                uint32_t numChildren = (desc.childGAS ? 1 : 0) + (desc.childIAS ? 1 : 0) + (desc.childTransform ? 1 : 0);
+                m->throwRuntimeError(numChildren <= 1, "descs[%u]: multiple children are specified.", i);
+                const _Scene* childScene =
+                    desc.childGAS ? extract(desc.childGAS)->getScene() :
+                    desc.childIAS ? extract(desc.childIAS)->getScene() :
+                    desc.childTransform ? extract(desc.childTransform)->getScene() : m;
+                m->throwRuntimeError(childScene == m, "descs[%u]: scene mismatch for the given child.", i);
+                m->throwRuntimeError(desc.id <= maxInstanceID,
+                                     "descs[%u]: max instance ID value is 0x%08x.", i, maxInstanceID);
+                m->throwRuntimeError((desc.visibilityMask >> numVisibilityMaskBits) == 0,
+                                     "descs[%u]: number of visibility mask bits is %u.", i, numVisibilityMaskBits);
+            }
+        }
+
+        std::vector<void*> storage(count);
+        _Instance::allocateMultiple(count, storage.data());
+        for (uint32_t i = 0; i < count; ++i) {
+            _Instance* inst = ::new (storage[i]) _Instance(m);
+            if (descs)
+                inst->applyDesc(descs[i]);
+            instances[i] = inst->getPublicType();
+        }
+    }
+
+    void Scene::markShaderBindingTableLayoutDirty() const {
+        m->markSBTLayoutDirty();
+    }
+
+    void Scene::enableShaderBindingTableRecordSharing(bool enable) const {
+        m->setSBTRecordSharing(enable);
+    }
+
+    void Scene::enableHitGroupRecordDataSharing(bool enable) const {
+        m->setRecordDataSharing(enable);
+    }
+
+    void Scene::setTaskExecutor(TaskExecutor executor, void* executorData) const {
+        m->setTaskExecutor(executor, executorData);
+    }
+
+    void Scene::setMaterialDataOutOfRecordThreshold(uint32_t threshold) const {
+        m->setMaterialDataThreshold(threshold);
+    }
+
+    void Scene::setGeometryFlagInference(GeometryFlagInference mode) const {
+        m->setGeometryFlagInference(mode);
+    }
+
+    void Scene::getGeometryFlagSuggestions(std::vector<GeometryFlagSuggestion>* suggestions) const {
+        *suggestions = m->geometryFlagSuggestions;
+    }
+
+    size_t Scene::getMaterialDataTableSize() const {
+        m->throwRuntimeError(m->sbtLayoutIsUpToDate, "Shader binding table layout generation has not been done.");
+        return m->getMaterialDataTableSize();
+    }
+
+    void Scene::generateShaderBindingTableLayout(size_t* memorySize) const {
+        OPTIXU_NVTX_RANGE("optixu::Scene::generateShaderBindingTableLayout", m);
+        if (m->sbtLayoutIsUpToDate) {
+            *memorySize = m->singleRecordSize * std::max(m->numSBTRecords, 1u);
+            return;
+        }
+
+        m->generateSBTLayout();
+
+        *memorySize = m->singleRecordSize * std::max(m->numSBTRecords, 1u);
+    }
+
+    bool Scene::shaderBindingTableLayoutIsReady() const {
+        return m->sbtLayoutIsUpToDate;
+    }
+
+    uint32_t Scene::getShaderBindingTableOffset(GeometryAccelerationStructure gas, uint32_t matSetIdx) const {
+        auto _gas = extract(gas);
+        m->throwRuntimeError(_gas, "Invalid GAS %p.", _gas);
+        m->throwRuntimeError(_gas->getScene() == m, "Scene mismatch for the given GAS %s.",
+                             _gas->getName().c_str());
+        m->throwRuntimeError(m->sbtLayoutIsUpToDate, "Shader binding table layout generation has not been done.");
+        return m->getSBTOffset(_gas, matSetIdx);
+    }
+
+    uint32_t Scene::Priv::calcVisibilityMask(const std::vector<std::string> &categories) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        uint32_t mask = 0;
+        for (const std::string &category : categories) {
+            auto it = std::find(visibilityCategories.cbegin(), visibilityCategories.cend(), category);
+            throwRuntimeError(it != visibilityCategories.cend(),
+                              "Unknown visibility category: %s.", category.c_str());
+            mask |= 1 << static_cast<uint32_t>(it - visibilityCategories.cbegin());
+        }
+        return mask;
+    }
+
+    uint32_t Scene::registerVisibilityCategory(const std::string &name) const {
+        std::lock_guard<std::mutex> lock(m->registryMutex);
+        auto it = std::find(m->visibilityCategories.cbegin(), m->visibilityCategories.cend(), name);
+        if (it != m->visibilityCategories.cend())
+            return static_cast<uint32_t>(it - m->visibilityCategories.cbegin());
+
+        uint32_t numVisibilityMaskBits = m->context->getNumVisibilityMaskBits();
+        m->throwRuntimeError(m->visibilityCategories.size() < numVisibilityMaskBits,
+                             "Number of visibility mask bits is %u.", numVisibilityMaskBits);
+        m->visibilityCategories.push_back(name);
+        return static_cast<uint32_t>(m->visibilityCategories.size() - 1);
+    }
+
+    uint32_t Scene::getNumVisibilityCategories() const {
+        std::lock_guard<std::mutex> lock(m->registryMutex);
+        return static_cast<uint32_t>(m->visibilityCategories.size());
+    }
+
+    uint32_t Scene::calcVisibilityMask(const std::vector<std::string> &categories) const {
+        return m->calcVisibilityMask(categories);
+    }
+
+    void Scene::setRayTypeVisibility(uint32_t rayType, const std::vector<std::string> &categories) const {
+        uint32_t mask = m->calcVisibilityMask(categories);
+        std::lock_guard<std::mutex> lock(m->registryMutex);
+        if (rayType >= m->rayTypeVisibilityMasks.size()) {
+            uint32_t allMask = (1u << m->context->getNumVisibilityMaskBits()) - 1;
+            m->rayTypeVisibilityMasks.resize(rayType + 1, allMask);
+        }
+        m->rayTypeVisibilityMasks[rayType] = mask;
+    }
+
+    uint32_t Scene::getRayTypeVisibilityMask(uint32_t rayType) const {
+        std::lock_guard<std::mutex> lock(m->registryMutex);
+        if (rayType < m->rayTypeVisibilityMasks.size())
+            return m->rayTypeVisibilityMasks[rayType];
+        return (1u << m->context->getNumVisibilityMaskBits()) - 1;
+    }
+
+    void Scene::getRayTypeVisibilityMasks(uint32_t* masks, uint32_t numRayTypes) const {
+        m->throwRuntimeError(masks || numRayTypes == 0, "masks must not be null.");
+        for (uint32_t rayType = 0; rayType < numRayTypes; ++rayType)
+            masks[rayType] = getRayTypeVisibilityMask(rayType);
+    }
+
+    namespace {
+        // JP: 平坦化後のインスタンスの元。静的Transformは行列に焼き込まれ、
+        //     焼き込めないモーションTransformはそのまま子として残る。
+        // EN: Source of a flattened instance. Static transforms are baked into the matrix,
+        //     and motion transforms which cannot be baked remain as the child.
+        struct FlatteningLeaf {
+            uint32_t topLevelIndex;
+            Instance sourceInstance;
+            GeometryAccelerationStructure gas;
+            Transform motionTransform;
+            float transform[12];
+            uint32_t visibilityMask;
+        };
+
+        void collectFlatteningLeaves(
+            const _Scene* scene, InstanceAccelerationStructure ias, const float parentTransform[12],
+            uint32_t parentMask, uint32_t topLevelIndex, uint32_t maxNumInstances,
+            std::vector<FlatteningLeaf>* leaves, bool* overBudget, bool* incompatibleMask) {
+            scene->throwRuntimeError(!ias.usesDeviceInstances(),
+                                     "IAS using device-side instances cannot be flattened.");
+            uint32_t numChildren = ias.getNumChildren();
+            for (uint32_t childIdx = 0; childIdx < numChildren && !*overBudget && !*incompatibleMask; ++childIdx) {
+                Instance inst = ias.getChild(childIdx);
+                uint32_t curTopLevelIndex = topLevelIndex == 0xFFFFFFFF ? childIdx : topLevelIndex;
+
+                FlatteningLeaf leaf = {};
+                leaf.topLevelIndex = curTopLevelIndex;
+                leaf.sourceInstance = inst;
+                float instTransform[12];
+                inst.getTransform(instTransform);
+                multiplyTransforms(parentTransform, instTransform, leaf.transform);
+                // JP: OptiXは階層ごとにレイのマスクとインスタンスのマスクを判定するので、経路上のマスクの論理積による
+                //     一回の判定と等価なのは、論理積が経路上のいずれかのマスクに一致する場合に限られる
+                //     (例: 全てが同じマスク、もしくは一つ以外が全ビット)。そうでない経路がある場合は平坦化しない。
+                // EN: OptiX tests the ray mask against the instance mask at each level, so a single test with
+                //     the logical AND of masks along the path is equivalent only when the AND equals one of the masks
+                //     along the path (e.g. all are the same mask or all but one have all bits set).
+                //     Don't flatten when there is a path not satisfying this.
+                uint32_t instMask = inst.getVisibilityMask();
+                leaf.visibilityMask = parentMask & instMask;
+                if (leaf.visibilityMask != parentMask && leaf.visibilityMask != instMask) {
+                    *incompatibleMask = true;
+                    return;
+                }
+
+                // JP: 静的Transformの連鎖を行列に焼き込みながら辿る。
+                // EN: Follow a chain of static transforms baking them into the matrix.
+                ChildType childType = inst.getChildType();
+                InstanceAccelerationStructure childIas;
+                if (childType == ChildType::GAS) {
+                    leaf.gas = inst.getChild<GeometryAccelerationStructure>();
+                }
+                else if (childType == ChildType::IAS) {
+                    childIas = inst.getChild<InstanceAccelerationStructure>();
+                }
+                else if (childType == ChildType::Transform) {
+                    Transform tr = inst.getChild<Transform>();
+                    while (tr) {
+                        TransformType trType;
+                        uint32_t numKeys;
+                        tr.getConfiguration(&trType, &numKeys);
+                        if (trType != TransformType::Static) {
+                            leaf.motionTransform = tr;
+                            break;
+                        }
+                        float staticTransform[12];
+                        tr.getStaticTransform(staticTransform);
+                        float curTransform[12];
+                        std::copy_n(leaf.transform, 12, curTransform);
+                        multiplyTransforms(curTransform, staticTransform, leaf.transform);
+
+                        ChildType trChildType = tr.getChildType();
+                        if (trChildType == ChildType::GAS)
+                            leaf.gas = tr.getChild<GeometryAccelerationStructure>();
+                        else if (trChildType == ChildType::IAS)
+                            childIas = tr.getChild<InstanceAccelerationStructure>();
+                        tr = trChildType == ChildType::Transform ? tr.getChild<Transform>() : Transform();
+                    }
+                }
+
+                if (childIas) {
+                    collectFlatteningLeaves(scene, childIas, leaf.transform, leaf.visibilityMask,
+                                            curTopLevelIndex, maxNumInstances, leaves, overBudget, incompatibleMask);
+                    continue;
+                }
+                if (!leaf.gas && !leaf.motionTransform)
+                    continue;
+                if (leaves->size() >= maxNumInstances) {
+                    *overBudget = true;
+                    return;
+                }
+                leaves->push_back(leaf);
+            }
+        }
+    }
+
+    InstanceAccelerationStructure Scene::flattenInstanceHierarchy(
+        InstanceAccelerationStructure ias, uint32_t maxNumInstances,
+        std::vector<FlattenedInstance>* indexMap) const {
+        m->throwRuntimeError(ias, "IAS must be valid.");
+        m->throwRuntimeError(indexMap, "indexMap must not be null.");
+        indexMap->clear();
+
+        const float identity[] = {
+            1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+        };
+        std::vector<FlatteningLeaf> leaves;
+        bool overBudget = false;
+        bool incompatibleMask = false;
+        collectFlatteningLeaves(m, ias, identity, 0xFFFFFFFF, 0xFFFFFFFF, maxNumInstances,
+                                &leaves, &overBudget, &incompatibleMask);
+        if (overBudget || incompatibleMask)
+            return InstanceAccelerationStructure();
+
+        InstanceAccelerationStructure flatIas = createInstanceAccelerationStructure();
+        ASTradeoff tradeoff;
+        bool allowUpdate;
+        bool allowCompaction;
+        ias.getConfiguration(&tradeoff, &allowUpdate, &allowCompaction);
+        flatIas.setConfiguration(tradeoff, allowUpdate, allowCompaction, false);
+
+        indexMap->resize(leaves.size());
+        for (uint32_t i = 0; i < leaves.size(); ++i) {
+            const FlatteningLeaf &leaf = leaves[i];
+            Instance inst = createInstance();
+            uint32_t matSetIdx = leaf.sourceInstance.getMaterialSetIndex();
+            if (leaf.gas)
+                inst.setChild(leaf.gas, matSetIdx);
+            else
+                inst.setChild(leaf.motionTransform, matSetIdx);
+            inst.setID(leaf.sourceInstance.getID());
+            inst.setVisibilityMask(leaf.visibilityMask);
+            inst.setFlags(leaf.sourceInstance.getFlags());
+            inst.setTransform(leaf.transform);
+            flatIas.addChild(inst);
+
+            FlattenedInstance &entry = (*indexMap)[i];
+            entry.instance = inst;
+            entry.topLevelIndex = leaf.topLevelIndex;
+            entry.sourceInstance = leaf.sourceInstance;
+        }
+
+        return flatIas;
+    }
+
+    void Scene::prepareForBuildDirtyGeometryASs(OptixAccelBufferSizes* memoryRequirement) const {
+        m->geomASsToBuild.clear();
+        m->batchedGASMemoryRequirement = {};
+        // JP: 個々のGASのアクセラレーションバッファーはアラインメントを満たすように一つのバッファー上に並べる。
+        //     ビルドは同じストリーム上で逐次実行されるので、スクラッチバッファーは最大値があれば共有できる。
+        // EN: Lay out the acceleration buffers of individual GASs in a single buffer satisfying the alignment.
+        //     Builds are executed serially on the same stream, so the scratch buffer can be shared with the max size.
+        for (const std::pair<const uint32_t, _GeometryAccelerationStructure*> &gas : m->geomASs) {
+            if (gas.second->isReady())
+                continue;
+
+            OptixAccelBufferSizes gasMemReq;
+            gas.second->getPublicType().prepareForBuild(&gasMemReq);
+            m->geomASsToBuild.push_back(gas.second);
+
+            OptixAccelBufferSizes &sumMemReq = m->batchedGASMemoryRequirement;
+            sumMemReq.outputSizeInBytes =
+                (sumMemReq.outputSizeInBytes + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1)
+                / OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT * OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+            sumMemReq.outputSizeInBytes += gasMemReq.outputSizeInBytes;
+            sumMemReq.tempSizeInBytes = std::max(sumMemReq.tempSizeInBytes, gasMemReq.tempSizeInBytes);
+            sumMemReq.tempUpdateSizeInBytes = std::max(sumMemReq.tempUpdateSizeInBytes, gasMemReq.tempUpdateSizeInBytes);
+        }
+
+        *memoryRequirement = m->batchedGASMemoryRequirement;
+    }
+
+    void Scene::buildDirtyGeometryASs(CUstream stream, const BufferView &accelBuffer, const BufferView &scratchBuffer) const {
+        buildDirtyGeometryASs(stream, &stream, 1, accelBuffer, scratchBuffer);
+    }
+
+    void Scene::buildDirtyGeometryASs(CUstream stream, const CUstream* workerStreams, uint32_t numWorkerStreams,
+                                      const BufferView &accelBuffer, const BufferView &scratchBuffer) const {
+        m->throwRuntimeError(workerStreams && numWorkerStreams > 0, "At least one worker stream is required.");
+        size_t scratchSliceSize =
+            (m->batchedGASMemoryRequirement.tempSizeInBytes + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1)
+            / OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT * OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+        m->throwRuntimeError(accelBuffer.sizeInBytes() >= m->batchedGASMemoryRequirement.outputSizeInBytes,
+                             "Size of the given buffer is not enough.");
+        m->throwRuntimeError(scratchBuffer.sizeInBytes() >= scratchSliceSize * (numWorkerStreams - 1) +
+                             m->batchedGASMemoryRequirement.tempSizeInBytes,
+                             "Size of the given scratch buffer is not enough.");
+        for (_GeometryAccelerationStructure* gas : m->geomASsToBuild)
+            m->throwRuntimeError(gas->isReadyToBuild(),
+                                 "GAS %s has been modified after prepareForBuildDirtyGeometryASs().",
+                                 gas->getName().c_str());
+
+        // JP: ワーカーストリームは与えられたストリーム上のそれまでの処理(例: 頂点のアップロード)を待つ。
+        // EN: Worker streams wait for the preceding work (e.g. uploading vertices) on the given stream.
+        CUDADRV_CHECK(cuEventRecord(m->asBuildEvent, stream));
+        for (uint32_t i = 0; i < numWorkerStreams; ++i) {
+            if (workerStreams[i] != stream)
+                CUDADRV_CHECK(cuStreamWaitEvent(workerStreams[i], m->asBuildEvent, 0));
+        }
+
+        // JP: 各GASは積算出力サイズが最小のワーカーストリームに割り当てる。
+        //     各ワーカーストリームは自身専用のスクラッチバッファー領域を使う。
+        // EN: Assign each GAS to the worker stream with the least accumulated output size.
+        //     Each worker stream uses its own dedicated slice of the scratch buffer.
+        std::vector<size_t> accumSizes(numWorkerStreams, 0);
+        size_t offset = 0;
+        for (_GeometryAccelerationStructure* gas : m->geomASsToBuild) {
+            offset = (offset + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1)
+                / OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT * OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+            const OptixAccelBufferSizes &gasMemReq = gas->getMemoryRequirement();
+            uint32_t workerIdx = static_cast<uint32_t>(
+                std::min_element(accumSizes.cbegin(), accumSizes.cend()) - accumSizes.cbegin());
+            BufferView gasAccelBuffer(accelBuffer.getCUdeviceptr() + offset, gasMemReq.outputSizeInBytes, 1);
+            BufferView gasScratchBuffer(scratchBuffer.getCUdeviceptr() + scratchSliceSize * workerIdx,
+                                        m->batchedGASMemoryRequirement.tempSizeInBytes, 1);
+            gas->getPublicType().rebuild(workerStreams[workerIdx], gasAccelBuffer, gasScratchBuffer);
+            accumSizes[workerIdx] += gasMemReq.outputSizeInBytes;
+            offset += gasMemReq.outputSizeInBytes;
+        }
+
+        // JP: 与えられたストリームに全ワーカーストリームを待たせ、後続のIASのビルドなどが正しく順序付けられるようにする。
+        // EN: Make the given stream wait for all the worker streams so that the subsequent work like IAS builds
+        //     is ordered correctly.
+        for (uint32_t i = 0; i < numWorkerStreams; ++i) {
+            if (workerStreams[i] == stream)
+                continue;
+            CUDADRV_CHECK(cuEventRecord(m->asBuildEvent, workerStreams[i]));
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, m->asBuildEvent, 0));
+        }
+
+        m->geomASsToBuild.clear();
+        m->batchedGASMemoryRequirement = {};
+    }
+
+    void Scene::prepareForBuildDirtyTransforms(size_t* memorySize) const {
+        m->transformsToBuild.clear();
+        m->transformOffsets.clear();
+        size_t offset = 0;
+        for (_Transform* tr : m->transforms) {
+            if (tr->isReady())
+                continue;
+            Transform pubTr = tr->getPublicType();
+            TransformType type;
+            uint32_t numKeys;
+            pubTr.getConfiguration(&type, &numKeys);
+            m->throwRuntimeError(type != TransformType::Invalid, "Transform %s: type is invalid.",
+                                 tr->getName().c_str());
+            m->throwRuntimeError(pubTr.getChildType() != ChildType::Invalid, "Transform %s: child is invalid.",
+                                 tr->getName().c_str());
+            offset = (offset + OPTIX_TRANSFORM_BYTE_ALIGNMENT - 1)
+                / OPTIX_TRANSFORM_BYTE_ALIGNMENT * OPTIX_TRANSFORM_BYTE_ALIGNMENT;
+            m->transformsToBuild.push_back(tr);
+            m->transformOffsets.push_back(offset);
+            offset += tr->getDataSize();
+        }
+        m->batchedTransformSize = offset;
+
+        *memorySize = m->batchedTransformSize;
+    }
+
+    void Scene::buildDirtyTransforms(CUstream stream, const BufferView &trDeviceMem) const {
+        m->throwRuntimeError(trDeviceMem.sizeInBytes() >= m->batchedTransformSize,
+                             "Size of the given buffer is not enough.");
+        m->throwRuntimeError((trDeviceMem.getCUdeviceptr() % OPTIX_TRANSFORM_BYTE_ALIGNMENT) == 0,
+                             "The given buffer must be aligned to %u bytes.", OPTIX_TRANSFORM_BYTE_ALIGNMENT);
+        if (m->transformsToBuild.empty())
+            return;
+
+        // JP: ハンドルはアドレスのみから決まるので先に全て求めておき、
+        //     Transformの子が同じバッチ内のTransformであっても正しく参照できるようにする。
+        // EN: Handles are determined only by addresses, so compute all of them first
+        //     so that a transform can correctly refer to its child transform in the same batch.
+        for (uint32_t i = 0; i < m->transformsToBuild.size(); ++i) {
+            _Transform* tr = m->transformsToBuild[i];
+            OptixTraversableHandle handle;
+            OPTIX_CHECK(optixConvertPointerToTraversableHandle(m->getRawContext(),
+                                                               trDeviceMem.getCUdeviceptr() + m->transformOffsets[i],
+                                                               tr->getTraversableType(),
+                                                               &handle));
+            tr->setHandle(handle);
+            tr->setDeviceBuffer(BufferView(trDeviceMem.getCUdeviceptr() + m->transformOffsets[i],
+                                           tr->getDataSize(), 1));
+        }
+
+        // JP: 前回のアップロードの完了を待ってからステージングバッファーを再利用する。
+        // EN: Wait for the completion of the previous upload before reusing the staging buffer.
+        CUDADRV_CHECK(cuEventSynchronize(m->transformUploadEvent));
+        if (m->transformStagingBufferSize < m->batchedTransformSize) {
+            if (m->transformStagingBuffer)
+                CUDADRV_CHECK(cuMemFreeHost(m->transformStagingBuffer));
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m->transformStagingBuffer),
+                                         m->batchedTransformSize));
+            m->transformStagingBufferSize = m->batchedTransformSize;
+        }
+        for (uint32_t i = 0; i < m->transformsToBuild.size(); ++i)
+            m->transformsToBuild[i]->fillData(m->transformStagingBuffer + m->transformOffsets[i]);
+
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(trDeviceMem.getCUdeviceptr(), m->transformStagingBuffer,
+                                        m->batchedTransformSize, stream));
+        CUDADRV_CHECK(cuEventRecord(m->transformUploadEvent, stream));
+
+        m->transformsToBuild.clear();
+        m->transformOffsets.clear();
+        m->batchedTransformSize = 0;
+    }
+
+    void Scene::prepareForBuildDirty(size_t* scratchBufferSize) const {
+        m->collectDirtyBuildTasks();
+        *scratchBufferSize = m->dirtyBuildScratchSize;
+    }
+
+    void Scene::buildDirty(CUstream stream, const BufferView &scratchBuffer) const {
+        buildDirty(stream, &stream, 1, scratchBuffer);
+    }
+
+    void Scene::buildDirty(CUstream stream, const CUstream* workerStreams, uint32_t numWorkerStreams,
+                           const BufferView &scratchBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::Scene::buildDirty", stream);
+        m->throwRuntimeError(workerStreams && numWorkerStreams > 0, "At least one worker stream is required.");
+        size_t scratchSliceSize =
+            (m->dirtyBuildScratchSize + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1)
+            / OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT * OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT;
+        m->throwRuntimeError(m->dirtyBuildTasks.empty() ||
+                             scratchBuffer.sizeInBytes() >= scratchSliceSize * (numWorkerStreams - 1) +
+                             m->dirtyBuildScratchSize,
+                             "Size of the given scratch buffer is not enough.");
+        for (const Priv::DirtyBuildTask &task : m->dirtyBuildTasks) {
+            if (task.gas && !task.gas->isLazyBuild())
+                m->throwRuntimeError(task.gas->isReadyToBuild(),
+                                     "GAS %s has been modified after prepareForBuildDirty().",
+                                     task.gas->getName().c_str());
+            if (task.ias)
+                m->throwRuntimeError(task.ias->isReadyToBuild(),
+                                     "IAS %s has been modified after prepareForBuildDirty().",
+                                     task.ias->getName().c_str());
+        }
+        if (m->dirtyBuildTasks.empty())
+            return;
+
+        CUDADRV_CHECK(cuEventRecord(m->asBuildEvent, stream));
+        for (uint32_t i = 0; i < numWorkerStreams; ++i) {
+            if (workerStreams[i] != stream)
+                CUDADRV_CHECK(cuStreamWaitEvent(workerStreams[i], m->asBuildEvent, 0));
+        }
+
+        // JP: 同じ深さのノードは互いに独立なので、ワーカーストリームに順番に割り当てる。
+        //     子のハンドルはホスト側で即座に決まるので、深さの境界ではデバイス側の同期のみを行う。
+        // EN: Nodes at the same depth are independent of each other, so assign them to worker streams in turn.
+        //     Handles of children are determined immediately on the host side,
+        //     so only device-side synchronization is done at the depth boundaries.
+        uint32_t numTasks = static_cast<uint32_t>(m->dirtyBuildTasks.size());
+        for (uint32_t taskIdx = 0; taskIdx < numTasks;) {
+            uint32_t level = m->dirtyBuildTasks[taskIdx].level;
+            if (taskIdx > 0)
+                m->joinWorkerStreams(workerStreams, numWorkerStreams);
+
+            uint32_t workerIdx = 0;
+            for (; taskIdx < numTasks && m->dirtyBuildTasks[taskIdx].level == level; ++taskIdx) {
+                const Priv::DirtyBuildTask &task = m->dirtyBuildTasks[taskIdx];
+                CUstream workerStream = workerStreams[workerIdx];
+                BufferView workerScratchBuffer(scratchBuffer.getCUdeviceptr() + scratchSliceSize * workerIdx,
+                                               m->dirtyBuildScratchSize, 1);
+                if (task.gas) {
+                    if (task.gas->isReady())
+                        continue;
+                    // JP: 遅延ビルドのGASはシーンのスクラッチバッファーを共有するので先頭のワーカーストリームで逐次ビルドする。
+                    // EN: Lazy-build GASs share the scene's scratch buffer,
+                    //     so build them serially on the first worker stream.
+                    if (task.gas->isLazyBuild())
+                        m->buildLazyGAS(workerStreams[0], task.gas);
+                    else
+                        task.gas->getPublicType().rebuild(workerStream, task.gas->getAccelBuffer(),
+                                                          workerScratchBuffer);
+                }
+                else if (task.transform) {
+                    task.transform->getPublicType().rebuild(workerStream, task.transform->getDeviceBuffer());
+                }
+                else {
+                    _InstanceAccelerationStructure* ias = task.ias;
+                    InstanceAccelerationStructure pubIas = ias->getPublicType();
+                    // JP: 子のハンドルが変わらなければ、インスタンスの変更や子の中身の変更はアップデートで反映できる。
+                    // EN: Changes of instances or contents of children can be reflected by an update
+                    //     unless handles of children change.
+                    bool doRebuild = !ias->isReady() || !ias->allowsUpdate() || ias->childHandlesChanged();
+                    if (doRebuild)
+                        pubIas.rebuild(workerStream, ias->getInstanceBuffer(), ias->getAccelBuffer(),
+                                       workerScratchBuffer);
+                    else
+                        pubIas.update(workerStream, workerScratchBuffer);
+                }
+                workerIdx = (workerIdx + 1) % numWorkerStreams;
+            }
+        }
+
+        for (uint32_t i = 0; i < numWorkerStreams; ++i) {
+            if (workerStreams[i] == stream)
+                continue;
+            CUDADRV_CHECK(cuEventRecord(m->asBuildEvent, workerStreams[i]));
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, m->asBuildEvent, 0));
+        }
+
+        m->dirtyBuildTasks.clear();
+        m->dirtyBuildScratchSize = 0;
+    }
+
+    void Scene::setLazyBuildMemory(const BufferView &accelPool, const BufferView &scratchBuffer) const {
+        m->setLazyBuildMemory(accelPool, scratchBuffer);
+    }
+
+    void Scene::setResidencyBudget(size_t budgetInBytes, uint32_t minFramesToKeep) const {
+        m->residencyBudget = budgetInBytes;
+        m->residencyMinFramesToKeep = minFramesToKeep;
+    }
+
+    void Scene::enforceResidencyBudget(CUstream stream) const {
+        m->enforceResidencyBudget(stream, 0);
+    }
+
+    void Scene::getResidencyStatistics(GASResidencyStatistics* stats) const {
+        m->getResidencyStatistics(stats);
+    }
+
+    void Scene::setMaxFramesInFlight(uint32_t maxFramesInFlight) const {
+        m->setMaxFramesInFlight(maxFramesInFlight);
+    }
+
+    void Scene::beginFrame(uint32_t* frameSlot) const {
+        m->beginFrame(frameSlot);
+    }
+
+    void Scene::endFrame(CUstream stream) const {
+        m->endFrame(stream);
+    }
+
+    void Scene::deferRelease(DeferredReleaseFunction func, void* userData) const {
+        m->throwRuntimeError(func, "Release function must be set.");
+        m->deferRelease(func, userData);
+    }
+
+    void Scene::waitForAllFrames() const {
+        m->waitForAllFrames();
+    }
+
+    uint64_t Scene::getFrameIndex() const {
+        std::lock_guard<std::mutex> lock(m->frameMutex);
+        return m->frameIndex;
+    }
+
+    uint32_t Scene::deduplicateGeometryASs(CUstream stream, std::vector<GeometryAccelerationStructure>* duplicateGASs) const {
+        // JP: バッファーのアップロードなど先行する処理の完了を待つ。
+        // EN: Wait for the completion of preceding work such as uploading buffers.
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+        // JP: シリアルIDの小さいGASを代表として残す。
+        // EN: Keep the GAS with the smallest serial ID as the representative.
+        std::vector<_GeometryAccelerationStructure*> gasList;
+        gasList.reserve(m->geomASs.size());
+        for (const auto &kv : m->geomASs)
+            gasList.push_back(kv.second);
+        std::sort(gasList.begin(), gasList.end(),
+                  [](const _GeometryAccelerationStructure* a, const _GeometryAccelerationStructure* b) {
+                      return a->getSerialID() < b->getSerialID();
+                  });
+
+        std::unordered_map<const _GeometryInstance*, uint64_t> geomInstHashes;
+        std::unordered_map<uint64_t, _GeometryAccelerationStructure*> representatives;
+        std::unordered_map<_GeometryAccelerationStructure*, _GeometryAccelerationStructure*> redirections;
+        for (_GeometryAccelerationStructure* gas : gasList) {
+            if (gas->getNumChildren() == 0)
+                continue;
+            uint64_t hash = gas->calcContentHash(&geomInstHashes);
+            auto it = representatives.find(hash);
+            if (it == representatives.cend()) {
+                representatives[hash] = gas;
+                continue;
+            }
+            redirections[gas] = it->second;
+            if (duplicateGASs)
+                duplicateGASs->push_back(gas->getPublicType());
+        }
+        if (redirections.empty())
+            return 0;
+
+        uint32_t numRedirectedRefs = 0;
+        for (_InstanceAccelerationStructure* ias : m->instASs) {
+            bool redirected = false;
+            for (_Instance* inst : ias->getChildren()) {
+                _GeometryAccelerationStructure* gas = inst->getChildGAS();
+                if (!gas)
+                    continue;
+                auto it = redirections.find(gas);
+                if (it == redirections.cend())
+                    continue;
+                inst->getPublicType().setChild(it->second->getPublicType(), inst->getMaterialSetIndex());
+                redirected = true;
+                ++numRedirectedRefs;
+            }
+            if (redirected)
+                ias->getPublicType().markDirty();
+        }
+        for (_Transform* tr : m->transforms) {
+            _GeometryAccelerationStructure* gas = tr->getChildGAS();
+            if (!gas)
+                continue;
+            auto it = redirections.find(gas);
+            if (it == redirections.cend())
+                continue;
+            tr->getPublicType().setChild(it->second->getPublicType());
+            ++numRedirectedRefs;
+        }
+
+        return numRedirectedRefs;
     }
 
-    void Scene::markShaderBindingTableLayoutDirty() const {
-        m->markSBTLayoutDirty();
+    void Scene::getMemoryReport(SceneMemoryReport* report) const {
+        *report = {};
+        report->numGASs = static_cast<uint32_t>(m->geomASs.size());
+        report->numIASs = static_cast<uint32_t>(m->instASs.size());
+
+        const auto accumulate = [report](const ASStatistics &stats) {
+            report->maxScratchSizeInBytes = std::max(report->maxScratchSizeInBytes, stats.scratchSizeInBytes);
+            report->maxUpdateScratchSizeInBytes = std::max(report->maxUpdateScratchSizeInBytes,
+                                                           stats.updateScratchSizeInBytes);
+            report->totalBuildTimeInMs += stats.buildTimeInMs;
+            report->totalUpdateTimeInMs += stats.updateTimeInMs;
+            report->totalCompactionTimeInMs += stats.compactionTimeInMs;
+        };
+
+        for (const auto &kv : m->geomASs) {
+            ASStatistics stats;
+            kv.second->getStatistics(&stats);
+            report->gasUncompactedSizeInBytes += stats.uncompactedSizeInBytes;
+            report->gasCompactedSizeInBytes += stats.compactedSizeInBytes;
+            if (kv.second->isReady()) {
+                report->gasResidentSizeInBytes += kv.second->getResidentSize();
+            }
+            accumulate(stats);
+        }
+        for (_InstanceAccelerationStructure* ias : m->instASs) {
+            ASStatistics stats;
+            ias->getStatistics(&stats);
+            report->iasUncompactedSizeInBytes += stats.uncompactedSizeInBytes;
+            report->iasCompactedSizeInBytes += stats.compactedSizeInBytes;
+            if (ias->isReady()) {
+                report->iasResidentSizeInBytes += ias->getResidentSize();
+                report->instanceBufferSizeInBytes += ias->getNumInstances() * sizeof(OptixInstance);
+            }
+            accumulate(stats);
+        }
     }
 
-    void Scene::generateShaderBindingTableLayout(size_t* memorySize) const {
-        if (m->sbtLayoutIsUpToDate) {
-            *memorySize = m->singleRecordSize * std::max(m->numSBTRecords, 1u);
-            return;
+
+
+    uint64_t GeometryInstance::Priv::calcContentHash() const {
+        Hasher64 hasher;
+        hasher.add(geomType);
+        hasher.add(numMotionSteps);
+        hasher.add(primitiveIndexOffset);
+        hasher.add(buildInputFlags.data(), sizeof(OptixGeometryFlags) * buildInputFlags.size());
+        hasher.add(userDataSizeAlign);
+        hasher.add(userData.data(), userData.size());
+        for (const std::vector<_Material*> &matSet : materials) {
+            hasher.add(matSet.size());
+            hasher.add(matSet.data(), sizeof(_Material*) * matSet.size());
         }
 
-        uint32_t sbtOffset = 0;
-        m->sbtOffsets.clear();
-        SizeAlign maxRecordSizeAlign;
-        maxRecordSizeAlign += SizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
-        // JP: GASの仮想アドレスが実行の度に変わる環境でSBTのレイアウトを固定するため、
-        //     GASはアドレスではなくシリアルIDに紐付けられている。
-        // EN: A GAS is associated to its serial ID instead of its address to make SBT layout fixed
-        //     in an environment where GAS's virtual address changes run to run.
-        for (const std::pair<uint32_t, _GeometryAccelerationStructure*> &gas : m->geomASs) {
-            uint32_t numMatSets = gas.second->getNumMaterialSets();
-            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
-                SizeAlign gasRecordSizeAlign;
-                uint32_t gasNumSBTRecords;
-                gas.second->calcSBTRequirements(matSetIdx, &gasRecordSizeAlign, &gasNumSBTRecords);
-                maxRecordSizeAlign = max(maxRecordSizeAlign, gasRecordSizeAlign);
-                _Scene::SBTOffsetKey key = { gas.first, matSetIdx };
-                m->sbtOffsets[key] = sbtOffset;
-                sbtOffset += gasNumSBTRecords;
+        if (std::holds_alternative<TriangleGeometry>(geometry)) {
+            auto &geom = std::get<TriangleGeometry>(geometry);
+            hasher.add(geom.vertexFormat);
+            hasher.add(geom.indexFormat);
+            hasher.add(geom.materialIndexSize);
+            for (uint32_t i = 0; i < numMotionSteps; ++i)
+                addBufferContents(&hasher, geom.vertexBuffers[i]);
+            addBufferContents(&hasher, geom.triangleBuffer);
+            addBufferContents(&hasher, geom.materialIndexBuffer);
+        }
+        else if (std::holds_alternative<CurveGeometry>(geometry)) {
+            auto &geom = std::get<CurveGeometry>(geometry);
+            for (uint32_t i = 0; i < numMotionSteps; ++i) {
+                addBufferContents(&hasher, geom.vertexBuffers[i]);
+                addBufferContents(&hasher, geom.widthBuffers[i]);
             }
+            addBufferContents(&hasher, geom.segmentIndexBuffer);
+        }
+        else if (std::holds_alternative<CustomPrimitiveGeometry>(geometry)) {
+            auto &geom = std::get<CustomPrimitiveGeometry>(geometry);
+            hasher.add(geom.materialIndexSize);
+            for (uint32_t i = 0; i < numMotionSteps; ++i)
+                addBufferContents(&hasher, geom.primitiveAabbBuffers[i]);
+            addBufferContents(&hasher, geom.materialIndexBuffer);
+        }
+        else {
+            optixuAssert_ShouldNotBeCalled();
         }
-        maxRecordSizeAlign.alignUp();
-        m->singleRecordSize = maxRecordSizeAlign.size;
-        m->numSBTRecords = sbtOffset;
-        m->sbtLayoutIsUpToDate = true;
 
-        *memorySize = m->singleRecordSize * std::max(m->numSBTRecords, 1u);
+        return hasher.value;
     }
 
-    bool Scene::shaderBindingTableLayoutIsReady() const {
-        return m->sbtLayoutIsUpToDate;
+    void GeometryInstance::Priv::accumulatePrimitiveBounds(
+        const float* preTransform, OptixAabb* bounds, double* sumSurfaceArea, uint32_t* numPrimitives) const {
+        std::vector<uint8_t> contents;
+        if (std::holds_alternative<TriangleGeometry>(geometry)) {
+            auto &geom = std::get<TriangleGeometry>(geometry);
+            throwRuntimeError(geom.vertexFormat == OPTIX_VERTEX_FORMAT_FLOAT3 ||
+                              geom.vertexFormat == OPTIX_VERTEX_FORMAT_HALF3,
+                              "Unsupported vertex format for cost estimation.");
+            std::vector<uint8_t> vertices;
+            readBackBuffer(geom.vertexBuffers[0], &vertices);
+            uint32_t vertexStride = geom.vertexBuffers[0].stride();
+            auto numVertices = static_cast<uint32_t>(geom.vertexBuffers[0].numElements());
+            const auto getPosition = [&](uint32_t vIdx, float p[3]) {
+                const uint8_t* v = vertices.data() + static_cast<size_t>(vertexStride) * vIdx;
+                float lp[3];
+                if (geom.vertexFormat == OPTIX_VERTEX_FORMAT_FLOAT3) {
+                    std::memcpy(lp, v, sizeof(lp));
+                }
+                else {
+                    uint16_t hp[3];
+                    std::memcpy(hp, v, sizeof(hp));
+                    for (uint32_t i = 0; i < 3; ++i)
+                        lp[i] = halfToFloat(hp[i]);
+                }
+                if (preTransform)
+                    transformPoint(preTransform, lp, p);
+                else
+                    std::copy_n(lp, 3, p);
+            };
+
+            uint32_t numTriangles = numVertices / 3;
+            if (geom.indexFormat != OPTIX_INDICES_FORMAT_NONE) {
+                readBackBuffer(geom.triangleBuffer, &contents);
+                numTriangles = static_cast<uint32_t>(geom.triangleBuffer.numElements());
+            }
+            for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+                uint32_t vIndices[3] = { 3 * triIdx + 0, 3 * triIdx + 1, 3 * triIdx + 2 };
+                const uint8_t* tri = contents.data() + static_cast<size_t>(geom.triangleBuffer.stride()) * triIdx;
+                if (geom.indexFormat == OPTIX_INDICES_FORMAT_UNSIGNED_INT3) {
+                    std::memcpy(vIndices, tri, sizeof(vIndices));
+                }
+                else if (geom.indexFormat == OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3) {
+                    uint16_t idx16[3];
+                    std::memcpy(idx16, tri, sizeof(idx16));
+                    std::copy_n(idx16, 3, vIndices);
+                }
+
+                OptixAabb triAabb;
+                clearAabb(&triAabb);
+                for (uint32_t i = 0; i < 3; ++i) {
+                    if (vIndices[i] >= numVertices)
+                        continue;
+                    float p[3];
+                    getPosition(vIndices[i], p);
+                    extendAabb(&triAabb, p);
+                }
+                unifyAabb(bounds, triAabb);
+                *sumSurfaceArea += calcSurfaceArea(triAabb);
+            }
+            *numPrimitives += numTriangles;
+        }
+        else if (std::holds_alternative<CurveGeometry>(geometry)) {
+            auto &geom = std::get<CurveGeometry>(geometry);
+            std::vector<uint8_t> vertices;
+            std::vector<uint8_t> widths;
+            readBackBuffer(geom.vertexBuffers[0], &vertices);
+            readBackBuffer(geom.widthBuffers[0], &widths);
+            readBackBuffer(geom.segmentIndexBuffer, &contents);
+            auto numVertices = static_cast<uint32_t>(geom.vertexBuffers[0].numElements());
+            uint32_t numControlPoints =
+                geomType == GeometryType::LinearSegments ? 2 :
+                geomType == GeometryType::QuadraticBSplines ? 3 : 4;
+
+            // JP: Bスプラインは制御点の凸包に含まれるので、制御点のAABBを最大の半径で広げたもので近似する。
+            // EN: A B-spline is contained in the convex hull of its control points,
+            //     so approximate by the AABB of control points expanded by the maximum radius.
+            auto numSegments = static_cast<uint32_t>(geom.segmentIndexBuffer.numElements());
+            for (uint32_t segIdx = 0; segIdx < numSegments; ++segIdx) {
+                uint32_t firstIdx;
+                std::memcpy(&firstIdx,
+                            contents.data() + static_cast<size_t>(geom.segmentIndexBuffer.stride()) * segIdx,
+                            sizeof(firstIdx));
+                OptixAabb segAabb;
+                clearAabb(&segAabb);
+                float maxRadius = 0.0f;
+                for (uint32_t i = 0; i < numControlPoints; ++i) {
+                    uint32_t vIdx = firstIdx + i;
+                    if (vIdx >= numVertices)
+                        continue;
+                    float p[3];
+                    float width;
+                    std::memcpy(p, vertices.data() + static_cast<size_t>(geom.vertexBuffers[0].stride()) * vIdx,
+                                sizeof(p));
+                    std::memcpy(&width, widths.data() + static_cast<size_t>(geom.widthBuffers[0].stride()) * vIdx,
+                                sizeof(width));
+                    extendAabb(&segAabb, p);
+                    maxRadius = std::max(maxRadius, width);
+                }
+                if (!isAabbEmpty(segAabb)) {
+                    segAabb.minX -= maxRadius; segAabb.minY -= maxRadius; segAabb.minZ -= maxRadius;
+                    segAabb.maxX += maxRadius; segAabb.maxY += maxRadius; segAabb.maxZ += maxRadius;
+                }
+                unifyAabb(bounds, segAabb);
+                *sumSurfaceArea += calcSurfaceArea(segAabb);
+            }
+            *numPrimitives += numSegments;
+        }
+        else if (std::holds_alternative<CustomPrimitiveGeometry>(geometry)) {
+            auto &geom = std::get<CustomPrimitiveGeometry>(geometry);
+            readBackBuffer(geom.primitiveAabbBuffers[0], &contents);
+            auto numPrims = static_cast<uint32_t>(geom.primitiveAabbBuffers[0].numElements());
+            for (uint32_t primIdx = 0; primIdx < numPrims; ++primIdx) {
+                OptixAabb primAabb;
+                std::memcpy(&primAabb,
+                            contents.data() + static_cast<size_t>(geom.primitiveAabbBuffers[0].stride()) * primIdx,
+                            sizeof(primAabb));
+                unifyAabb(bounds, primAabb);
+                *sumSurfaceArea += calcSurfaceArea(primAabb);
+            }
+            *numPrimitives += numPrims;
+        }
+        else {
+            optixuAssert_ShouldNotBeCalled();
+        }
     }
 
-
-
     void GeometryInstance::Priv::fillBuildInput(OptixBuildInput* input, CUdeviceptr preTransform) const {
         *input = OptixBuildInput{};
 
@@ -513,6 +3236,44 @@ namespace optixu {
         }
     }
 
+    void GeometryInstance::Priv::prefetchManagedInputs(CUstream stream, CUdevice device) const {
+        const auto prefetch = [stream, device](const BufferView &buffer) {
+            if (!buffer.isValid() || buffer.sizeInBytes() == 0)
+                return;
+            uint32_t isManaged = 0;
+            CUresult res = cuPointerGetAttribute(&isManaged, CU_POINTER_ATTRIBUTE_IS_MANAGED,
+                                                 buffer.getCUdeviceptr());
+            if (res != CUDA_SUCCESS || !isManaged)
+                return;
+            CUDADRV_CHECK(cuMemPrefetchAsync(buffer.getCUdeviceptr(), buffer.sizeInBytes(), device, stream));
+        };
+
+        if (std::holds_alternative<TriangleGeometry>(geometry)) {
+            auto &geom = std::get<TriangleGeometry>(geometry);
+            for (uint32_t i = 0; i < numMotionSteps; ++i)
+                prefetch(geom.vertexBuffers[i]);
+            prefetch(geom.triangleBuffer);
+            prefetch(geom.materialIndexBuffer);
+        }
+        else if (std::holds_alternative<CurveGeometry>(geometry)) {
+            auto &geom = std::get<CurveGeometry>(geometry);
+            for (uint32_t i = 0; i < numMotionSteps; ++i) {
+                prefetch(geom.vertexBuffers[i]);
+                prefetch(geom.widthBuffers[i]);
+            }
+            prefetch(geom.segmentIndexBuffer);
+        }
+        else if (std::holds_alternative<CustomPrimitiveGeometry>(geometry)) {
+            auto &geom = std::get<CustomPrimitiveGeometry>(geometry);
+            for (uint32_t i = 0; i < numMotionSteps; ++i)
+                prefetch(geom.primitiveAabbBuffers[i]);
+            prefetch(geom.materialIndexBuffer);
+        }
+        else {
+            optixuAssert_ShouldNotBeCalled();
+        }
+    }
+
     void GeometryInstance::Priv::calcSBTRequirements(uint32_t gasMatSetIdx, SizeAlign* maxRecordSizeAlign, uint32_t* numSBTRecords) const {
         *maxRecordSizeAlign = SizeAlign();
         for (int matIdx = 0; matIdx < materials.size(); ++matIdx) {
@@ -522,17 +3283,54 @@ namespace optixu {
             if (!mat)
                 mat = materials[matIdx][0];
             SizeAlign recordSizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
-            recordSizeAlign += mat->getUserDataSizeAlign();
+            recordSizeAlign += scene->getMaterialRecordSizeAlign(mat);
             *maxRecordSizeAlign = max(*maxRecordSizeAlign, recordSizeAlign);
         }
         *maxRecordSizeAlign += userDataSizeAlign;
         *numSBTRecords = static_cast<uint32_t>(buildInputFlags.size());
     }
 
+    uint64_t GeometryInstance::Priv::getSBTRecordStamp() const {
+        uint64_t stamp = sbtRecordStamp;
+        for (const std::vector<_Material*> &matSets : materials) {
+            for (const _Material* mat : matSets) {
+                if (mat)
+                    stamp = std::max(stamp, mat->getSBTRecordStamp());
+            }
+        }
+        return stamp;
+    }
+
+    uint64_t GeometryInstance::Priv::getHeaderStamp() const {
+        uint64_t stamp = 0;
+        for (const std::vector<_Material*> &matSets : materials) {
+            for (const _Material* mat : matSets) {
+                if (mat)
+                    stamp = std::max(stamp, mat->getHeaderStamp());
+            }
+        }
+        return stamp;
+    }
+
+    uint64_t GeometryInstance::Priv::calcSBTRecordContentHash(uint32_t gasMatSetIdx) const {
+        Hasher64 hasher;
+        hasher.add(materials.size());
+        for (const std::vector<_Material*> &matSets : materials) {
+            uint32_t matSetIdx = gasMatSetIdx < matSets.size() ? gasMatSetIdx : 0;
+            const _Material* mat = matSets[matSetIdx];
+            if (!mat)
+                mat = matSets[0];
+            hasher.add(mat);
+        }
+        hasher.add(userDataSizeAlign);
+        hasher.add(userData.data(), userData.size());
+        return hasher.value;
+    }
+
     uint32_t GeometryInstance::Priv::fillSBTRecords(const _Pipeline* pipeline, uint32_t gasMatSetIdx,
                                                     const void* gasChildUserData, const SizeAlign gasChildUserDataSizeAlign,
                                                     const void* gasUserData, const SizeAlign gasUserDataSizeAlign,
-                                                    uint32_t numRayTypes, uint8_t* records) const {
+                                                    const uint32_t* rayTypes, uint32_t numRayTypes, uint8_t* records) const {
         uint32_t numMaterials = static_cast<uint32_t>(materials.size());
         for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
             throwRuntimeError(materials[matIdx][0], "Default material (== material set 0) is not set for material %u.", matIdx);
@@ -540,9 +3338,9 @@ namespace optixu {
             const _Material* mat = materials[matIdx][matSetIdx];
             if (!mat)
                 mat = materials[matIdx][0];
-            for (uint32_t rIdx = 0; rIdx < numRayTypes; ++rIdx) {
+            for (uint32_t i = 0; i < numRayTypes; ++i) {
                 SizeAlign curSizeAlign;
-                mat->setRecordData(pipeline, rIdx, records, &curSizeAlign);
+                mat->setRecordData(pipeline, rayTypes[i], records, &curSizeAlign, scene->getOutOfRecordMaterialData(mat));
                 uint32_t offset;
                 curSizeAlign.add(userDataSizeAlign, &offset);
                 std::memcpy(records + offset, userData.data(), userDataSizeAlign.size);
@@ -550,6 +3348,31 @@ namespace optixu {
                 std::memcpy(records + offset, gasChildUserData, gasChildUserDataSizeAlign.size);
                 curSizeAlign.add(gasUserDataSizeAlign, &offset);
                 std::memcpy(records + offset, gasUserData, gasUserDataSizeAlign.size);
+                records += scene->getDataRecordSize();
+            }
+        }
+
+        return numMaterials * numRayTypes;
+    }
+
+    uint32_t GeometryInstance::Priv::patchSBTRecordHeaders(const _Pipeline* pipeline, uint32_t gasMatSetIdx,
+                                                           const uint32_t* rayTypes, uint32_t numRayTypes,
+                                                           uint64_t lastStamp, bool allHeaders,
+                                                           uint8_t* records, std::vector<uint8_t*>* patchedRecords) const {
+        uint32_t numMaterials = static_cast<uint32_t>(materials.size());
+        for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
+            uint32_t matSetIdx = gasMatSetIdx < materials[matIdx].size() ? gasMatSetIdx : 0;
+            const _Material* mat = materials[matIdx][matSetIdx];
+            if (!mat)
+                mat = materials[matIdx][0];
+            if (!allHeaders && mat->getHeaderStamp() <= lastStamp) {
+                records += static_cast<size_t>(numRayTypes) * scene->getSingleRecordSize();
+                continue;
+            }
+            for (uint32_t i = 0; i < numRayTypes; ++i) {
+                mat->writeHeader(pipeline, rayTypes[i], records);
+                if (patchedRecords)
+                    patchedRecords->push_back(records);
                 records += scene->getSingleRecordSize();
             }
         }
@@ -651,6 +3474,77 @@ namespace optixu {
         geom.primitiveAabbBuffers[motionStep] = primitiveAABBBuffer;
     }
 
+    BufferView GeometryInstance::rotateMotionStepBuffers() const {
+        // JP: ビルド入力のポインター配列はビルド/アップデートのたびにバッファーから作り直されるので、
+        //     バッファーの並びだけを回せば良い。
+        // EN: Pointer arrays of the build input are recreated from the buffers at every build/update,
+        //     so rotating only the order of the buffers is enough.
+        uint32_t numSteps = m->numMotionSteps;
+        if (std::holds_alternative<Priv::TriangleGeometry>(m->geometry)) {
+            auto &geom = std::get<Priv::TriangleGeometry>(m->geometry);
+            std::rotate(geom.vertexBuffers, geom.vertexBuffers + 1, geom.vertexBuffers + numSteps);
+            return geom.vertexBuffers[numSteps - 1];
+        }
+        else if (std::holds_alternative<Priv::CurveGeometry>(m->geometry)) {
+            auto &geom = std::get<Priv::CurveGeometry>(m->geometry);
+            std::rotate(geom.vertexBuffers, geom.vertexBuffers + 1, geom.vertexBuffers + numSteps);
+            std::rotate(geom.widthBuffers, geom.widthBuffers + 1, geom.widthBuffers + numSteps);
+            return geom.vertexBuffers[numSteps - 1];
+        }
+        else {
+            auto &geom = std::get<Priv::CustomPrimitiveGeometry>(m->geometry);
+            std::rotate(geom.primitiveAabbBuffers, geom.primitiveAabbBuffers + 1,
+                        geom.primitiveAabbBuffers + numSteps);
+            return geom.primitiveAabbBuffers[numSteps - 1];
+        }
+    }
+
+    void GeometryInstance::Priv::retargetBuffer(BufferView* dstBuffer, const BufferView &srcBuffer,
+                                                const char* bufferName) {
+        throwRuntimeError(dstBuffer->isValid(), "%s buffer has not been set.", bufferName);
+        throwRuntimeError(srcBuffer.numElements() == dstBuffer->numElements() &&
+                          srcBuffer.stride() == dstBuffer->stride(),
+                          "%s buffer is incompatible (%zu elements, stride %u) with the current one "
+                          "(%zu elements, stride %u).", bufferName,
+                          srcBuffer.numElements(), srcBuffer.stride(),
+                          dstBuffer->numElements(), dstBuffer->stride());
+        *dstBuffer = srcBuffer;
+    }
+
+    void GeometryInstance::retargetVertexBuffer(const BufferView &vertexBuffer, uint32_t motionStep) const {
+        m->throwRuntimeError(!std::holds_alternative<Priv::CustomPrimitiveGeometry>(m->geometry),
+                             "This geometry instance was created not for triangles or curves.");
+        m->throwRuntimeError(motionStep < m->numMotionSteps, "motionStep %u is out of bounds [0, %u).",
+                             motionStep, m->numMotionSteps);
+        if (std::holds_alternative<Priv::TriangleGeometry>(m->geometry)) {
+            auto &geom = std::get<Priv::TriangleGeometry>(m->geometry);
+            m->retargetBuffer(&geom.vertexBuffers[motionStep], vertexBuffer, "Vertex");
+        }
+        else if (std::holds_alternative<Priv::CurveGeometry>(m->geometry)) {
+            auto &geom = std::get<Priv::CurveGeometry>(m->geometry);
+            m->retargetBuffer(&geom.vertexBuffers[motionStep], vertexBuffer, "Vertex");
+        }
+    }
+
+    void GeometryInstance::retargetWidthBuffer(const BufferView &widthBuffer, uint32_t motionStep) const {
+        m->throwRuntimeError(std::holds_alternative<Priv::CurveGeometry>(m->geometry),
+                             "This geometry instance was created not for curves.");
+        m->throwRuntimeError(motionStep < m->numMotionSteps, "motionStep %u is out of bounds [0, %u).",
+                             motionStep, m->numMotionSteps);
+        auto &geom = std::get<Priv::CurveGeometry>(m->geometry);
+        m->retargetBuffer(&geom.widthBuffers[motionStep], widthBuffer, "Width");
+    }
+
+    void GeometryInstance::retargetCustomPrimitiveAABBBuffer(const BufferView &primitiveAABBBuffer,
+                                                             uint32_t motionStep) const {
+        m->throwRuntimeError(std::holds_alternative<Priv::CustomPrimitiveGeometry>(m->geometry),
+                             "This geometry instance was created not for custom primitives.");
+        m->throwRuntimeError(motionStep < m->numMotionSteps, "motionStep %u is out of bounds [0, %u).",
+                             motionStep, m->numMotionSteps);
+        auto &geom = std::get<Priv::CustomPrimitiveGeometry>(m->geometry);
+        m->retargetBuffer(&geom.primitiveAabbBuffers[motionStep], primitiveAABBBuffer, "AABB");
+    }
+
     void GeometryInstance::setPrimitiveIndexOffset(uint32_t offset) const {
         m->primitiveIndexOffset = offset;
     }
@@ -667,6 +3561,7 @@ namespace optixu {
             m->throwRuntimeError(matIndexBuffer.stride() >= indexSize,
                                  "Buffer's stride is smaller than the given index offset size.");
         m->buildInputFlags.resize(numMaterials, OPTIX_GEOMETRY_FLAG_NONE);
+        m->anyHitDisabledByInference.resize(numMaterials, false);
         if (std::holds_alternative<Priv::TriangleGeometry>(m->geometry)) {
             auto &geom = std::get<Priv::TriangleGeometry>(m->geometry);
             geom.materialIndexBuffer = matIndexBuffer;
@@ -692,6 +3587,7 @@ namespace optixu {
                              static_cast<uint32_t>(numMaterials));
 
         m->buildInputFlags[matIdx] = flags;
+        m->anyHitDisabledByInference[matIdx] = false;
     }
 
     void GeometryInstance::setMaterial(uint32_t matSetIdx, uint32_t matIdx, Material mat) const {
@@ -703,6 +3599,11 @@ namespace optixu {
         if (matSetIdx >= prevNumMatSets)
             m->materials[matIdx].resize(matSetIdx + 1, nullptr);
         m->materials[matIdx][matSetIdx] = extract(mat);
+        m->markSBTRecordDirty();
+        // JP: ジオメトリーフラグの推定をやり直す。
+        // EN: Redo the geometry flag inference.
+        if (m->scene->getGeometryFlagInference() != GeometryFlagInference::Disabled)
+            m->scene->markSBTLayoutDirty();
     }
 
     void GeometryInstance::setUserData(const void* data, uint32_t size, uint32_t alignment) const {
@@ -710,12 +3611,21 @@ namespace optixu {
                              "Maximum user data size for GeometryInstance is %u bytes.", s_maxGeometryInstanceUserDataSize);
         m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
                              "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
+        if (isSameUserData(m->userData, m->userDataSizeAlign, data, size, alignment)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::UserData);
+            return;
+        }
         if (m->userDataSizeAlign.size != size ||
             m->userDataSizeAlign.alignment != alignment)
             m->scene->markSBTLayoutDirty();
         m->userDataSizeAlign = SizeAlign(size, alignment);
         m->userData.resize(size);
         std::memcpy(m->userData.data(), data, size);
+        m->markSBTRecordDirty();
+    }
+
+    GeometryType GeometryInstance::getGeometryType() const {
+        return m->getGeometryType();
     }
 
     uint32_t GeometryInstance::getNumMotionSteps() const {
@@ -817,6 +3727,13 @@ namespace optixu {
         return m->buildInputFlags[matIdx];
     }
 
+    uint32_t GeometryInstance::getNumMaterialSets(uint32_t matIdx) const {
+        size_t numMaterials = m->materials.size();
+        m->throwRuntimeError(matIdx < numMaterials, "Out of material bounds [0, %u).",
+                             static_cast<uint32_t>(numMaterials));
+        return static_cast<uint32_t>(m->materials[matIdx].size());
+    }
+
     Material GeometryInstance::getMaterial(uint32_t matSetIdx, uint32_t matIdx) const {
         size_t numMaterials = m->materials.size();
         m->throwRuntimeError(matIdx < numMaterials, "Out of material bounds [0, %u).",
@@ -825,7 +3742,8 @@ namespace optixu {
         m->throwRuntimeError(matSetIdx < numMatSets, "Out of material set bounds [0, %u).",
                              static_cast<uint32_t>(numMatSets));
 
-        return m->materials[matIdx][matSetIdx]->getPublicType();
+        _Material* mat = m->materials[matIdx][matSetIdx];
+        return mat ? mat->getPublicType() : Material();
     }
 
     void GeometryInstance::getUserData(void* data, uint32_t* size, uint32_t* alignment) const {
@@ -839,46 +3757,429 @@ namespace optixu {
 
 
 
-    void GeometryAccelerationStructure::Priv::calcSBTRequirements(uint32_t matSetIdx, SizeAlign* maxRecordSizeAlign, uint32_t* numSBTRecords) const {
-        *maxRecordSizeAlign = SizeAlign();
-        *numSBTRecords = 0;
+    void GeometryAccelerationStructure::Priv::calcSBTRequirements(uint32_t matSetIdx, SizeAlign* maxRecordSizeAlign, uint32_t* numSBTRecords) const {
+        *maxRecordSizeAlign = SizeAlign();
+        *numSBTRecords = 0;
+        for (const Child &child : children) {
+            SizeAlign geomInstRecordSizeAlign;
+            uint32_t geomInstNumSBTRecords;
+            child.geomInst->calcSBTRequirements(matSetIdx, &geomInstRecordSizeAlign, &geomInstNumSBTRecords);
+            geomInstRecordSizeAlign += child.userDataSizeAlign;
+            *maxRecordSizeAlign = max(*maxRecordSizeAlign, geomInstRecordSizeAlign);
+            *numSBTRecords += geomInstNumSBTRecords;
+        }
+        *maxRecordSizeAlign += userDataSizeAlign;
+
+        // JP: 一様なレイタイプはGASあたり一つのレコードだけを持ち、ジオメトリごとのレコードの前に置かれる。
+        // EN: A uniform ray type has only one record per GAS placed before records per geometry.
+        uint32_t numUniformRayTypes = 0;
+        for (const _Material* mat : uniformRayTypeMaterials[matSetIdx]) {
+            if (!mat)
+                continue;
+            SizeAlign recordSizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+            recordSizeAlign += scene->getMaterialRecordSizeAlign(mat);
+            *maxRecordSizeAlign = max(*maxRecordSizeAlign, recordSizeAlign);
+            ++numUniformRayTypes;
+        }
+        *numSBTRecords *= numRayTypesPerMaterialSet[matSetIdx] - numUniformRayTypes;
+        *numSBTRecords += numUniformRayTypes;
+    }
+
+    void GeometryAccelerationStructure::Priv::accumulateAnyHitUsage(
+        std::vector<_GeometryInstance*>* geomInsts,
+        std::unordered_map<_GeometryInstance*, std::vector<uint8_t>>* usage) const {
+        uint32_t numMatSets = static_cast<uint32_t>(numRayTypesPerMaterialSet.size());
+        for (const Child &child : children) {
+            _GeometryInstance* geomInst = child.geomInst;
+            uint32_t numMaterials = geomInst->getNumMaterials();
+            auto it = usage->find(geomInst);
+            if (it == usage->cend()) {
+                it = usage->emplace(geomInst, std::vector<uint8_t>(numMaterials, 0)).first;
+                geomInsts->push_back(geomInst);
+            }
+            std::vector<uint8_t> &slotUsage = it->second;
+
+            for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
+                if (slotUsage[matIdx])
+                    continue;
+                // JP: レイタイプが無い、あるいはマテリアルが未設定の場合は判定できないので保守的に扱う。
+                // EN: Treat conservatively when there is no ray type or a material is not set
+                //     since it cannot be determined.
+                bool mayInvoke = false;
+                uint32_t numChecked = 0;
+                for (uint32_t matSetIdx = 0; matSetIdx < numMatSets && !mayInvoke; ++matSetIdx) {
+                    uint32_t numRayTypes = numRayTypesPerMaterialSet[matSetIdx];
+                    const std::vector<const _Material*> &uniformMats = uniformRayTypeMaterials[matSetIdx];
+                    const _Material* slotMat = geomInst->getMaterial(matSetIdx, matIdx);
+                    for (uint32_t rIdx = 0; rIdx < numRayTypes; ++rIdx) {
+                        const _Material* mat = uniformMats[rIdx] ? uniformMats[rIdx] : slotMat;
+                        ++numChecked;
+                        if (!mat || mat->mayInvokeAnyHit(rIdx)) {
+                            mayInvoke = true;
+                            break;
+                        }
+                    }
+                }
+                slotUsage[matIdx] = mayInvoke || numChecked == 0;
+            }
+        }
+    }
+
+    uint32_t GeometryAccelerationStructure::Priv::fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, uint8_t* records) const {
+        throwRuntimeError(matSetIdx < numRayTypesPerMaterialSet.size(),
+                          "Material set index %u is out of bounds [0, %u).",
+                          matSetIdx, static_cast<uint32_t>(numRayTypesPerMaterialSet.size()));
+
+        uint32_t numRayTypes = numRayTypesPerMaterialSet[matSetIdx];
+        uint32_t sumRecords = 0;
+        uint32_t rayTypes[32];
+        std::vector<uint32_t> rayTypesOnHeap;
+        uint32_t* nonUniformRayTypes = rayTypes;
+        if (numRayTypes > 32) {
+            rayTypesOnHeap.resize(numRayTypes);
+            nonUniformRayTypes = rayTypesOnHeap.data();
+        }
+        uint32_t numNonUniformRayTypes = 0;
+        const std::vector<const _Material*> &uniformMats = uniformRayTypeMaterials[matSetIdx];
+        for (uint32_t rIdx = 0; rIdx < numRayTypes; ++rIdx) {
+            const _Material* mat = uniformMats[rIdx];
+            if (!mat) {
+                nonUniformRayTypes[numNonUniformRayTypes++] = rIdx;
+                continue;
+            }
+            SizeAlign curSizeAlign;
+            mat->setRecordData(pipeline, rIdx, records, &curSizeAlign, scene->getOutOfRecordMaterialData(mat));
+            records += scene->getDataRecordSize();
+            ++sumRecords;
+        }
+
+        for (uint32_t sbtGasIdx = 0; sbtGasIdx < children.size(); ++sbtGasIdx) {
+            const Child &child = children[sbtGasIdx];
+            uint32_t numRecords = child.geomInst->fillSBTRecords(pipeline, matSetIdx,
+                                                                 child.userData.data(), child.userDataSizeAlign,
+                                                                 userData.data(), userDataSizeAlign,
+                                                                 nonUniformRayTypes, numNonUniformRayTypes, records);
+            records += numRecords * scene->getDataRecordSize();
+            sumRecords += numRecords;
+        }
+
+        return sumRecords;
+    }
+
+    void GeometryAccelerationStructure::Priv::patchSBTRecordHeaders(const _Pipeline* pipeline, uint32_t matSetIdx,
+                                                                    uint64_t lastStamp, bool allHeaders,
+                                                                    uint8_t* records,
+                                                                    std::vector<uint8_t*>* patchedRecords) const {
+        // JP: fillSBTRecords()と同じ順でレコードを辿り、ヘッダーのみが変わったマテリアルのヘッダーだけを書き換える。
+        //     allHeadersが真の場合は全ヘッダーを書き換える。
+        // EN: Traverse records in the same order as fillSBTRecords(),
+        //     and rewrite only the headers of materials whose headers only changed.
+        //     Rewrite all the headers when allHeaders is true.
+        uint32_t numRayTypes = numRayTypesPerMaterialSet[matSetIdx];
+        uint32_t rayTypes[32];
+        std::vector<uint32_t> rayTypesOnHeap;
+        uint32_t* nonUniformRayTypes = rayTypes;
+        if (numRayTypes > 32) {
+            rayTypesOnHeap.resize(numRayTypes);
+            nonUniformRayTypes = rayTypesOnHeap.data();
+        }
+        uint32_t numNonUniformRayTypes = 0;
+        const std::vector<const _Material*> &uniformMats = uniformRayTypeMaterials[matSetIdx];
+        for (uint32_t rIdx = 0; rIdx < numRayTypes; ++rIdx) {
+            const _Material* mat = uniformMats[rIdx];
+            if (!mat) {
+                nonUniformRayTypes[numNonUniformRayTypes++] = rIdx;
+                continue;
+            }
+            if (allHeaders || mat->getHeaderStamp() > lastStamp) {
+                mat->writeHeader(pipeline, rIdx, records);
+                if (patchedRecords)
+                    patchedRecords->push_back(records);
+            }
+            records += scene->getSingleRecordSize();
+        }
+
+        for (uint32_t sbtGasIdx = 0; sbtGasIdx < children.size(); ++sbtGasIdx) {
+            const Child &child = children[sbtGasIdx];
+            uint32_t numRecords = child.geomInst->patchSBTRecordHeaders(pipeline, matSetIdx,
+                                                                        nonUniformRayTypes, numNonUniformRayTypes,
+                                                                        lastStamp, allHeaders,
+                                                                        records, patchedRecords);
+            records += numRecords * scene->getSingleRecordSize();
+        }
+    }
+
+    uint64_t GeometryAccelerationStructure::Priv::getHeaderStamp() const {
+        uint64_t stamp = 0;
+        for (const std::vector<const _Material*> &uniformMats : uniformRayTypeMaterials) {
+            for (const _Material* mat : uniformMats) {
+                if (mat)
+                    stamp = std::max(stamp, mat->getHeaderStamp());
+            }
+        }
+        for (const Child &child : children)
+            stamp = std::max(stamp, child.geomInst->getHeaderStamp());
+        return stamp;
+    }
+
+    uint64_t GeometryAccelerationStructure::Priv::getSBTRecordStamp() const {
+        uint64_t stamp = sbtRecordStamp;
+        for (const std::vector<const _Material*> &uniformMats : uniformRayTypeMaterials) {
+            for (const _Material* mat : uniformMats) {
+                if (mat)
+                    stamp = std::max(stamp, mat->getSBTRecordStamp());
+            }
+        }
+        for (const Child &child : children)
+            stamp = std::max(stamp, child.geomInst->getSBTRecordStamp());
+        return stamp;
+    }
+
+    uint64_t GeometryAccelerationStructure::Priv::calcSBTRecordContentHash(uint32_t matSetIdx) const {
+        Hasher64 hasher;
+        hasher.add(numRayTypesPerMaterialSet[matSetIdx]);
+        hasher.add(uniformRayTypeMaterials[matSetIdx].data(),
+                   sizeof(const _Material*) * uniformRayTypeMaterials[matSetIdx].size());
+        hasher.add(userDataSizeAlign);
+        hasher.add(userData.data(), userData.size());
+        hasher.add(children.size());
+        for (const Child &child : children) {
+            hasher.add(child.geomInst->calcSBTRecordContentHash(matSetIdx));
+            hasher.add(child.userDataSizeAlign);
+            hasher.add(child.userData.data(), child.userData.size());
+        }
+        return hasher.value;
+    }
+
+    void GeometryAccelerationStructure::Priv::prefetchChildInputs(CUstream stream) const {
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        for (const Child &child : children)
+            child.geomInst->prefetchManagedInputs(stream, device);
+    }
+
+    void GeometryAccelerationStructure::Priv::markDirty() {
+        releaseResidencyStorage();
+        scene->bumpReadinessEpoch();
+        readyToBuild = false;
+        available = false;
+        readyToCompact = false;
+        compactedAvailable = false;
+    }
+
+    void GeometryAccelerationStructure::Priv::evict(CUstream stream) {
+        if (!evictedData)
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&evictedData), compactedSize));
+        if (!evictedDataIsValid) {
+            // JP: コピーが終わるまでデバイス側のバッファーは解放できないので、最初の退避のみホスト側で待つ。
+            //     内容が変わらない限り次回以降の退避ではコピーを省略する。
+            // EN: The device buffer cannot be released until the copy finishes,
+            //     so wait on the host only at the first eviction.
+            //     Copying is skipped in later evictions unless the contents change.
+            OPTIX_CHECK(optixAccelGetRelocationInfo(getRawContext(), compactedHandle, &evictedRelocationInfo));
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, finishEvent, 0));
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(evictedData, compactedAccelBuffer.getCUdeviceptr(), compactedSize, stream));
+            CUDADRV_CHECK(cuEventRecord(finishEvent, stream));
+            CUDADRV_CHECK(cuEventSynchronize(finishEvent));
+            evictedDataIsValid = true;
+        }
+        if (ownedAccelMemory) {
+            scene->deferDeviceMemoryRelease(ownedAccelMemory);
+            ownedAccelMemory = 0;
+        }
+
+        scene->bumpReadinessEpoch();
+        compactedHandle = 0;
+        compactedAccelBuffer = BufferView();
+        compactedAvailable = false;
+        evicted = true;
+    }
+
+    void GeometryAccelerationStructure::Priv::restore(CUstream stream) {
+        CUDADRV_CHECK(cuMemAlloc(&ownedAccelMemory, compactedSize));
+        CUDADRV_CHECK(cuStreamWaitEvent(stream, finishEvent, 0));
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(ownedAccelMemory, evictedData, compactedSize, stream));
+        OPTIX_CHECK(optixAccelRelocate(getRawContext(), stream, &evictedRelocationInfo, 0, 0,
+                                       ownedAccelMemory, compactedSize,
+                                       &compactedHandle));
+        CUDADRV_CHECK(cuEventRecord(finishEvent, stream));
+
+        compactedAccelBuffer = BufferView(ownedAccelMemory, compactedSize, 1);
+        compactedAvailable = true;
+        evicted = false;
+    }
+
+    void GeometryAccelerationStructure::Priv::releaseResidencyStorage() {
+        if (evictedData) {
+            CUDADRV_CHECK(cuEventSynchronize(finishEvent));
+            CUDADRV_CHECK(cuMemFreeHost(evictedData));
+            evictedData = nullptr;
+        }
+        evictedDataIsValid = false;
+        if (ownedAccelMemory) {
+            scene->deferDeviceMemoryRelease(ownedAccelMemory);
+            ownedAccelMemory = 0;
+        }
+        evicted = false;
+    }
+
+    bool GeometryAccelerationStructure::Priv::readCompactedSize(bool wait) {
+        // JP: コンパクション後のサイズはシーンがまとめてpinnedメモリへ非同期に読み戻す。
+        // EN: The scene reads back the sizes after compaction together to pinned memory asynchronously.
+        uint32_t numBuildInputs = static_cast<uint32_t>(buildInputs.size());
+        if (numBuildInputs > 0) {
+            if (!scene->readCompactedSize(compactedSizeSlot, compactedSizeReadbackIndex, wait, &compactedSize))
+                return false;
+        }
+        else {
+            compactedSize = 0;
+        }
+
+        readyToCompact = true;
+
+        return true;
+    }
+
+    namespace {
+        // JP: シリアライズしたASの先頭に置くヘッダー。
+        // EN: Header placed at the beginning of a serialized AS.
+        struct SerializedASHeader {
+            static constexpr uint32_t s_magic = 0x5341554F; // "OUAS"
+            static constexpr uint32_t s_version = 1;
+
+            uint32_t magic;
+            uint32_t version;
+            uint64_t buildInputHash;
+            OptixAccelRelocationInfo relocationInfo;
+            uint64_t accelSize;
+            uint32_t compacted;
+            uint32_t reserved;
+        };
+    }
+
+    uint64_t GeometryAccelerationStructure::Priv::calcBuildInputHash() const {
+        // JP: デバイスポインターは実行ごとに変わるので含めず、ビルド入力の構造のみをハッシュする。
+        // EN: Hash only the structure of the build inputs excluding device pointers
+        //     since they vary from run to run.
+        Hasher64 hasher;
+        hasher.add(buildOptions.buildFlags);
+        hasher.add(buildOptions.motionOptions.numKeys);
+        hasher.add(buildOptions.motionOptions.flags);
+        hasher.add(buildOptions.motionOptions.timeBegin);
+        hasher.add(buildOptions.motionOptions.timeEnd);
+        for (const OptixBuildInput &input : buildInputs) {
+            hasher.add(input.type);
+            const uint32_t* flags = nullptr;
+            uint32_t numSbtRecords = 0;
+            if (input.type == OPTIX_BUILD_INPUT_TYPE_TRIANGLES) {
+                const OptixBuildInputTriangleArray &triArray = input.triangleArray;
+                hasher.add(triArray.numVertices);
+                hasher.add(triArray.vertexFormat);
+                hasher.add(triArray.vertexStrideInBytes);
+                hasher.add(triArray.numIndexTriplets);
+                hasher.add(triArray.indexFormat);
+                hasher.add(triArray.indexStrideInBytes);
+                hasher.add(triArray.primitiveIndexOffset);
+                hasher.add(triArray.sbtIndexOffsetSizeInBytes);
+                hasher.add(triArray.sbtIndexOffsetStrideInBytes);
+                hasher.add(triArray.transformFormat);
+                flags = triArray.flags;
+                numSbtRecords = triArray.numSbtRecords;
+            }
+            else if (input.type == OPTIX_BUILD_INPUT_TYPE_CURVES) {
+                const OptixBuildInputCurveArray &curveArray = input.curveArray;
+                hasher.add(curveArray.curveType);
+                hasher.add(curveArray.numPrimitives);
+                hasher.add(curveArray.numVertices);
+                hasher.add(curveArray.vertexStrideInBytes);
+                hasher.add(curveArray.widthStrideInBytes);
+                hasher.add(curveArray.indexStrideInBytes);
+                hasher.add(curveArray.primitiveIndexOffset);
+                hasher.add(curveArray.flag);
+            }
+            else if (input.type == OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES) {
+                const OptixBuildInputCustomPrimitiveArray &customPrimArray = input.customPrimitiveArray;
+                hasher.add(customPrimArray.numPrimitives);
+                hasher.add(customPrimArray.strideInBytes);
+                hasher.add(customPrimArray.primitiveIndexOffset);
+                hasher.add(customPrimArray.sbtIndexOffsetSizeInBytes);
+                hasher.add(customPrimArray.sbtIndexOffsetStrideInBytes);
+                flags = customPrimArray.flags;
+                numSbtRecords = customPrimArray.numSbtRecords;
+            }
+            else {
+                optixuAssert_ShouldNotBeCalled();
+            }
+            hasher.add(numSbtRecords);
+            if (flags)
+                hasher.add(flags, sizeof(uint32_t) * numSbtRecords);
+        }
+
+        return hasher.value;
+    }
+
+    uint64_t GeometryAccelerationStructure::Priv::calcContentHash(
+        std::unordered_map<const _GeometryInstance*, uint64_t>* geomInstHashes) const {
+        Hasher64 hasher;
+        hasher.add(geomType);
+        hasher.add(tradeoff);
+        hasher.add(static_cast<uint32_t>(allowUpdate));
+        hasher.add(static_cast<uint32_t>(allowCompaction));
+        hasher.add(static_cast<uint32_t>(allowRandomVertexAccess));
+        hasher.add(buildOptions.motionOptions.numKeys);
+        hasher.add(buildOptions.motionOptions.flags);
+        hasher.add(buildOptions.motionOptions.timeBegin);
+        hasher.add(buildOptions.motionOptions.timeEnd);
+        hasher.add(numRayTypesPerMaterialSet.data(), sizeof(uint32_t) * numRayTypesPerMaterialSet.size());
+        for (const std::vector<const _Material*> &uniformMats : uniformRayTypeMaterials)
+            hasher.add(uniformMats.data(), sizeof(const _Material*) * uniformMats.size());
+        hasher.add(userDataSizeAlign);
+        hasher.add(userData.data(), userData.size());
         for (const Child &child : children) {
-            SizeAlign geomInstRecordSizeAlign;
-            uint32_t geomInstNumSBTRecords;
-            child.geomInst->calcSBTRequirements(matSetIdx, &geomInstRecordSizeAlign, &geomInstNumSBTRecords);
-            geomInstRecordSizeAlign += child.userDataSizeAlign;
-            *maxRecordSizeAlign = max(*maxRecordSizeAlign, geomInstRecordSizeAlign);
-            *numSBTRecords += geomInstNumSBTRecords;
+            // JP: 複数のGASで共有されるジオメトリインスタンスは一度だけ読み戻す。
+            // EN: Read back a geometry instance shared by multiple GASs only once.
+            auto it = geomInstHashes->find(child.geomInst);
+            if (it == geomInstHashes->cend())
+                it = geomInstHashes->emplace(child.geomInst, child.geomInst->calcContentHash()).first;
+            hasher.add(it->second);
+            addBufferContents(&hasher, BufferView(child.preTransform, child.preTransform ? 1 : 0, sizeof(float) * 12));
+            hasher.add(child.userDataSizeAlign);
+            hasher.add(child.userData.data(), child.userData.size());
         }
-        *maxRecordSizeAlign += userDataSizeAlign;
-        *numSBTRecords *= numRayTypesPerMaterialSet[matSetIdx];
-    }
 
-    uint32_t GeometryAccelerationStructure::Priv::fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, uint8_t* records) const {
-        throwRuntimeError(matSetIdx < numRayTypesPerMaterialSet.size(),
-                          "Material set index %u is out of bounds [0, %u).",
-                          matSetIdx, static_cast<uint32_t>(numRayTypesPerMaterialSet.size()));
+        return hasher.value;
+    }
 
-        uint32_t numRayTypes = numRayTypesPerMaterialSet[matSetIdx];
-        uint32_t sumRecords = 0;
-        for (uint32_t sbtGasIdx = 0; sbtGasIdx < children.size(); ++sbtGasIdx) {
-            const Child &child = children[sbtGasIdx];
-            uint32_t numRecords = child.geomInst->fillSBTRecords(pipeline, matSetIdx,
-                                                                 child.userData.data(), child.userDataSizeAlign,
-                                                                 userData.data(), userDataSizeAlign,
-                                                                 numRayTypes, records);
-            records += numRecords * scene->getSingleRecordSize();
-            sumRecords += numRecords;
+    void GeometryAccelerationStructure::Priv::getStatistics(ASStatistics* stats) {
+        *stats = {};
+        statsRecorder.getTimes(&stats->buildTimeInMs, &stats->updateTimeInMs, &stats->compactionTimeInMs);
+        statsRecorder.getCounts(&stats->numBuilds, &stats->numUpdates, &stats->numCompactions);
+        stats->numBuildInputs = static_cast<uint32_t>(children.size());
+        if (readyToBuild || isReady()) {
+            stats->uncompactedSizeInBytes = memoryRequirement.outputSizeInBytes;
+            stats->scratchSizeInBytes = memoryRequirement.tempSizeInBytes;
+            stats->updateScratchSizeInBytes = memoryRequirement.tempUpdateSizeInBytes;
         }
-
-        return sumRecords;
+        if (readyToCompact || compactedAvailable)
+            stats->compactedSizeInBytes = compactedSize;
     }
 
-    void GeometryAccelerationStructure::Priv::markDirty() {
-        readyToBuild = false;
-        available = false;
-        readyToCompact = false;
-        compactedAvailable = false;
+    float GeometryAccelerationStructure::Priv::estimateTraversalCost(OptixAabb* bounds) const {
+        clearAabb(bounds);
+        double sumSurfaceArea = 0.0;
+        uint32_t numPrimitives = 0;
+        for (const Child &child : children) {
+            float preTransform[12];
+            if (child.preTransform)
+                CUDADRV_CHECK(cuMemcpyDtoH(preTransform, child.preTransform, sizeof(preTransform)));
+            child.geomInst->accumulatePrimitiveBounds(child.preTransform ? preTransform : nullptr,
+                                                      bounds, &sumSurfaceArea, &numPrimitives);
+        }
+
+        float rootSurfaceArea = calcSurfaceArea(*bounds);
+        if (numPrimitives == 0 || rootSurfaceArea <= 0.0f)
+            return 0.0f;
+        return static_cast<float>(sumSurfaceArea / rootSurfaceArea);
     }
 
     void GeometryAccelerationStructure::destroy() {
@@ -909,6 +4210,18 @@ namespace optixu {
             m->markDirty();
     }
 
+    void GeometryAccelerationStructure::setLazyBuild(bool enable) const {
+        m->lazyBuild = enable;
+    }
+
+    void GeometryAccelerationStructure::setManagedInputPrefetch(bool enable) const {
+        m->prefetchManagedInputs = enable;
+    }
+
+    void GeometryAccelerationStructure::setEvictable(bool enable) const {
+        m->evictable = enable;
+    }
+
     void GeometryAccelerationStructure::setMotionOptions(uint32_t numKeys, float timeBegin, float timeEnd, OptixMotionFlags flags) const {
         m->buildOptions.motionOptions.numKeys = numKeys;
         m->buildOptions.motionOptions.timeBegin = timeBegin;
@@ -932,25 +4245,96 @@ namespace optixu {
         Priv::Child child;
         child.geomInst = _geomInst;
         child.preTransform = preTransform;
-        auto idx = std::find(m->children.cbegin(), m->children.cend(), child);
-        m->throwRuntimeError(idx == m->children.cend(), "Geometry instance %s with transform %p has been already added.",
+        Priv::ChildKey key{ _geomInst, preTransform };
+        m->throwRuntimeError(m->childIndices.count(key) == 0, "Geometry instance %s with transform %p has been already added.",
                              _geomInst->getName().c_str(), preTransform);
         child.userDataSizeAlign = SizeAlign(size, alignment);
         child.userData.resize(size);
         std::memcpy(child.userData.data(), data, size);
 
+        m->childIndices[key] = static_cast<uint32_t>(m->children.size());
         m->children.push_back(std::move(child));
 
         m->markDirty();
         m->scene->markSBTLayoutDirty();
     }
 
+    void GeometryAccelerationStructure::addChildren(const GeometryInstance* geomInsts, uint32_t count,
+                                                    const CUdeviceptr* preTransforms) const {
+        m->throwRuntimeError(geomInsts || count == 0, "geomInsts must not be null.");
+        if (count == 0)
+            return;
+
+        // JP: 途中で失敗しても子の状態が変わらないよう、追加の前に全て検証する。
+        // EN: Validate all before adding so that children don't change on a failure midway.
+        const char* geomTypeStrs[] = { "triangles", "curves", "custom primitives" };
+        size_t numChildren = m->children.size();
+        std::unordered_set<Priv::ChildKey, Priv::ChildKey::Hash> newKeys;
+        newKeys.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            auto _geomInst = extract(geomInsts[i]);
+            CUdeviceptr preTransform = preTransforms ? preTransforms[i] : 0;
+            m->throwRuntimeError(_geomInst, "Invalid geometry instance at %u.", i);
+            m->throwRuntimeError(_geomInst->getScene() == m->scene, "Scene mismatch for the given geometry instance %s.",
+                                 _geomInst->getName().c_str());
+            m->throwRuntimeError(_geomInst->getGeometryType() == m->geomType,
+                                 "This GAS was created for %s.", geomTypeStrs[static_cast<uint32_t>(m->geomType)]);
+            m->throwRuntimeError(m->geomType == GeometryType::Triangles || preTransform == 0,
+                                 "Pre-transform is valid only for triangles.");
+            Priv::ChildKey key{ _geomInst, preTransform };
+            m->throwRuntimeError(m->childIndices.count(key) == 0 && newKeys.insert(key).second,
+                                 "Geometry instance %s with transform %p has been already added.",
+                                 _geomInst->getName().c_str(), preTransform);
+        }
+
+        m->children.reserve(numChildren + count);
+        m->childIndices.reserve(numChildren + count);
+        for (uint32_t i = 0; i < count; ++i) {
+            Priv::Child child;
+            child.geomInst = extract(geomInsts[i]);
+            child.preTransform = preTransforms ? preTransforms[i] : 0;
+            child.userDataSizeAlign = SizeAlign(0, 1);
+            m->childIndices[Priv::ChildKey{ child.geomInst, child.preTransform }] =
+                static_cast<uint32_t>(m->children.size());
+            m->children.push_back(std::move(child));
+        }
+
+        m->markDirty();
+        m->scene->markSBTLayoutDirty();
+    }
+
     void GeometryAccelerationStructure::removeChildAt(uint32_t index) const {
         uint32_t numChildren = static_cast<uint32_t>(m->children.size());
         m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
                              numChildren);
 
+        // JP: 後続の子のインデックスを詰める。
+        // EN: Shift the indices of the subsequent children.
+        const Priv::Child &child = m->children[index];
+        m->childIndices.erase(Priv::ChildKey{ child.geomInst, child.preTransform });
         m->children.erase(m->children.cbegin() + index);
+        for (uint32_t i = index; i < numChildren - 1; ++i) {
+            const Priv::Child &movedChild = m->children[i];
+            m->childIndices[Priv::ChildKey{ movedChild.geomInst, movedChild.preTransform }] = i;
+        }
+
+        m->markDirty();
+        m->scene->markSBTLayoutDirty();
+    }
+
+    void GeometryAccelerationStructure::swapRemoveChildAt(uint32_t index) const {
+        uint32_t numChildren = static_cast<uint32_t>(m->children.size());
+        m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
+                             numChildren);
+
+        const Priv::Child &child = m->children[index];
+        m->childIndices.erase(Priv::ChildKey{ child.geomInst, child.preTransform });
+        if (index != numChildren - 1) {
+            m->children[index] = std::move(m->children.back());
+            const Priv::Child &movedChild = m->children[index];
+            m->childIndices[Priv::ChildKey{ movedChild.geomInst, movedChild.preTransform }] = index;
+        }
+        m->children.pop_back();
 
         m->markDirty();
         m->scene->markSBTLayoutDirty();
@@ -958,6 +4342,7 @@ namespace optixu {
 
     void GeometryAccelerationStructure::clearChildren() const {
         m->children.clear();
+        m->childIndices.clear();
 
         m->markDirty();
         m->scene->markSBTLayoutDirty();
@@ -970,6 +4355,7 @@ namespace optixu {
 
     void GeometryAccelerationStructure::setNumMaterialSets(uint32_t numMatSets) const {
         m->numRayTypesPerMaterialSet.resize(numMatSets, 0);
+        m->uniformRayTypeMaterials.resize(numMatSets);
 
         m->scene->markSBTLayoutDirty();
     }
@@ -980,11 +4366,27 @@ namespace optixu {
                              "Material set index %u is out of bounds [0, %u).",
                              matSetIdx, numMatSets);
         m->numRayTypesPerMaterialSet[matSetIdx] = numRayTypes;
+        m->uniformRayTypeMaterials[matSetIdx].resize(numRayTypes, nullptr);
+
+        m->scene->markSBTLayoutDirty();
+    }
+
+    void GeometryAccelerationStructure::setUniformRayTypeMaterial(uint32_t matSetIdx, uint32_t rayType, Material mat) const {
+        uint32_t numMatSets = static_cast<uint32_t>(m->numRayTypesPerMaterialSet.size());
+        m->throwRuntimeError(matSetIdx < numMatSets,
+                             "Material set index %u is out of bounds [0, %u).",
+                             matSetIdx, numMatSets);
+        uint32_t numRayTypes = m->numRayTypesPerMaterialSet[matSetIdx];
+        m->throwRuntimeError(rayType < numRayTypes,
+                             "Ray type %u is out of bounds [0, %u).",
+                             rayType, numRayTypes);
+        m->uniformRayTypeMaterials[matSetIdx][rayType] = extract(mat);
 
         m->scene->markSBTLayoutDirty();
     }
 
     void GeometryAccelerationStructure::prepareForBuild(OptixAccelBufferSizes* memoryRequirement) const {
+        OPTIXU_NVTX_RANGE("optixu::GAS::prepareForBuild", m);
         m->buildInputs.resize(m->children.size(), OptixBuildInput{});
         uint32_t childIdx = 0;
         uint32_t numMotionSteps = std::max<uint32_t>(m->buildOptions.motionOptions.numKeys, 1u);
@@ -1021,6 +4423,8 @@ namespace optixu {
     }
 
     OptixTraversableHandle GeometryAccelerationStructure::rebuild(CUstream stream, const BufferView &accelBuffer, const BufferView &scratchBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::GAS::rebuild", stream);
+        OPTIXU_NVTX_RANGE("optixu::GAS::rebuild", m);
         m->throwRuntimeError(m->readyToBuild, "You need to call prepareForBuild() before rebuild.");
         m->throwRuntimeError(accelBuffer.sizeInBytes() >= m->memoryRequirement.outputSizeInBytes,
                              "Size of the given buffer is not enough.");
@@ -1028,6 +4432,7 @@ namespace optixu {
                              "Size of the given scratch buffer is not enough.");
 
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+        m->releaseResidencyStorage();
 
         // JP: アップデートの意味でリビルドするときはprepareForBuild()を呼ばないため
         //     ビルド入力を更新する処理をここにも書いておく必要がある。
@@ -1036,17 +4441,31 @@ namespace optixu {
         uint32_t childIdx = 0;
         for (const Priv::Child &child : m->children)
             child.geomInst->updateBuildInput(&m->buildInputs[childIdx++], child.preTransform);
+        if (m->prefetchManagedInputs)
+            m->prefetchChildInputs(stream);
 
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
         uint32_t numBuildInputs = static_cast<uint32_t>(m->buildInputs.size());
         if (numBuildInputs > 0) {
+            auto compactedSizeStorageLock = m->scene->lockCompactedSizeStorage();
+            m->propertyCompactedSize.result = m->scene->getCompactedSizeAddress(m->compactedSizeSlot);
+            OptixAccelEmitDesc emitDescs[2];
+            uint32_t numEmitDescs = 0;
+            if (compactionEnabled)
+                emitDescs[numEmitDescs++] = m->propertyCompactedSize;
+            if (m->autoRebuildPolicy.tracksBounds())
+                emitDescs[numEmitDescs++] = m->autoRebuildPolicy.getAabbEmitDesc();
+            m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Build);
             OPTIX_CHECK(optixAccelBuild(m->getRawContext(), stream,
                                         &m->buildOptions, m->buildInputs.data(), numBuildInputs,
                                         scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes(),
                                         accelBuffer.getCUdeviceptr(), accelBuffer.sizeInBytes(),
                                         &m->handle,
-                                        compactionEnabled ? &m->propertyCompactedSize : nullptr,
-                                        compactionEnabled ? 1 : 0));
+                                        numEmitDescs > 0 ? emitDescs : nullptr, numEmitDescs));
+            m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Build);
+            if (compactionEnabled)
+                m->compactedSizeReadbackIndex = m->scene->requestCompactedSizeReadback(stream);
+            m->autoRebuildPolicy.notifyBuild(stream, true);
             CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
         }
         else {
@@ -1058,6 +4477,7 @@ namespace optixu {
         m->readyToCompact = false;
         m->compactedHandle = 0;
         m->compactedAvailable = false;
+        m->attachedShared = false;
 
         return m->handle;
     }
@@ -1072,34 +4492,45 @@ namespace optixu {
 
         // JP: リビルド・アップデートの完了を待ってコンパクション後のサイズ情報を取得。
         // EN: Wait the completion of rebuild/update then obtain the size after coompaction.
-        // TODO: ? stream
-        uint32_t numBuildInputs = static_cast<uint32_t>(m->buildInputs.size());
-        if (numBuildInputs > 0) {
-            CUDADRV_CHECK(cuEventSynchronize(m->finishEvent));
-            CUDADRV_CHECK(cuMemcpyDtoH(&m->compactedSize, m->propertyCompactedSize.result, sizeof(m->compactedSize)));
-        }
-        else {
-            m->compactedSize = 0;
-        }
+        m->readCompactedSize(true);
+
+        *compactedAccelBufferSize = m->compactedSize;
+    }
+
+    bool GeometryAccelerationStructure::tryPrepareForCompact(size_t* compactedAccelBufferSize) const {
+        bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+        m->throwRuntimeError(compactionEnabled, "This AS does not allow compaction.");
+        m->throwRuntimeError(m->available, "Uncompacted AS has not been built yet.");
+
+        if (m->compactedAvailable)
+            return true;
+
+        if (!m->readCompactedSize(false))
+            return false;
 
         *compactedAccelBufferSize = m->compactedSize;
 
-        m->readyToCompact = true;
+        return true;
     }
 
     OptixTraversableHandle GeometryAccelerationStructure::compact(CUstream stream, const BufferView &compactedAccelBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::GAS::compact", stream);
+        OPTIXU_NVTX_RANGE("optixu::GAS::compact", m);
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
         m->throwRuntimeError(compactionEnabled, "This AS does not allow compaction.");
         m->throwRuntimeError(m->readyToCompact, "You need to call prepareForCompact() before compaction.");
         m->throwRuntimeError(m->available, "Uncompacted AS has not been built yet.");
+        m->throwRuntimeError(!m->attachedShared, "A shared AS attached from another process cannot be compacted.");
         m->throwRuntimeError(compactedAccelBuffer.sizeInBytes() >= m->compactedSize,
                              "Size of the given buffer is not enough.");
 
         uint32_t numBuildInputs = static_cast<uint32_t>(m->buildInputs.size());
         if (numBuildInputs > 0) {
+            m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Compaction);
             OPTIX_CHECK(optixAccelCompact(m->getRawContext(), stream,
                                           m->handle, compactedAccelBuffer.getCUdeviceptr(), compactedAccelBuffer.sizeInBytes(),
                                           &m->compactedHandle));
+            m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Compaction);
             CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
         }
         else {
@@ -1127,34 +4558,239 @@ namespace optixu {
     }
 
     void GeometryAccelerationStructure::update(CUstream stream, const BufferView &scratchBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::GAS::update", stream);
+        OPTIXU_NVTX_RANGE("optixu::GAS::update", m);
         bool updateEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_UPDATE) != 0;
         m->throwRuntimeError(updateEnabled, "This AS does not allow update.");
         m->throwRuntimeError(m->available || m->compactedAvailable, "AS has not been built yet.");
+        m->throwRuntimeError(!m->attachedShared, "A shared AS attached from another process cannot be updated.");
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempUpdateSizeInBytes,
                              "Size of the given scratch buffer is not enough.");
 
         uint32_t childIdx = 0;
         for (const Priv::Child &child : m->children)
             child.geomInst->updateBuildInput(&m->buildInputs[childIdx++], child.preTransform);
+        if (m->prefetchManagedInputs)
+            m->prefetchChildInputs(stream);
 
         const BufferView &accelBuffer = m->compactedAvailable ? m->compactedAccelBuffer : m->accelBuffer;
         OptixTraversableHandle handle = m->compactedAvailable ? m->compactedHandle : m->handle;
+        m->invalidateEvictedData();
 
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_UPDATE;
         OptixTraversableHandle tempHandle = handle;
         uint32_t numBuildInputs = static_cast<uint32_t>(m->buildInputs.size());
-        if (numBuildInputs > 0)
+        if (numBuildInputs > 0) {
+            bool tracksBounds = m->autoRebuildPolicy.tracksBounds();
+            m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Update);
             OPTIX_CHECK(optixAccelBuild(m->getRawContext(), stream,
                                         &m->buildOptions, m->buildInputs.data(), numBuildInputs,
                                         scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes(),
                                         accelBuffer.getCUdeviceptr(), accelBuffer.sizeInBytes(),
                                         &tempHandle,
-                                        nullptr, 0));
-        else
+                                        tracksBounds ? &m->autoRebuildPolicy.getAabbEmitDesc() : nullptr,
+                                        tracksBounds ? 1 : 0));
+            m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Update);
+            m->autoRebuildPolicy.notifyBuild(stream, false);
+        }
+        else {
             tempHandle = 0;
+        }
         optixuAssert(tempHandle == handle, "GAS %s: Update should not change the handle itself, what's going on?", getName());
     }
 
+    void GeometryAccelerationStructure::setAutoRebuildPolicy(uint32_t maxNumUpdates, float maxBoundsGrowth) const {
+        m->throwRuntimeError(maxBoundsGrowth >= 0.0f, "maxBoundsGrowth must be non-negative.");
+        m->autoRebuildPolicy.set(maxNumUpdates, maxBoundsGrowth);
+    }
+
+    OptixTraversableHandle GeometryAccelerationStructure::updateOrRebuild(CUstream stream, const BufferView &scratchBuffer,
+                                                                          bool* rebuilt) const {
+        m->throwRuntimeError(m->autoRebuildPolicy.isEnabled(), "Auto rebuild policy is not set.");
+        // JP: コンパクト済みのASはバッファーが小さいためその場でリビルドできない。
+        // EN: A compacted AS cannot be rebuilt in place because its buffer is smaller.
+        bool doRebuild = m->readyToBuild && m->available && !m->compactedAvailable && !m->attachedShared &&
+            scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempSizeInBytes &&
+            m->autoRebuildPolicy.shouldRebuild();
+        if (rebuilt)
+            *rebuilt = doRebuild;
+        if (doRebuild)
+            return rebuild(stream, m->accelBuffer, scratchBuffer);
+
+        update(stream, scratchBuffer);
+        return m->getHandle();
+    }
+
+    void GeometryAccelerationStructure::enableStatistics(bool enable) const {
+        m->statsRecorder.setEnabled(enable);
+    }
+
+    void GeometryAccelerationStructure::getStatistics(ASStatistics* stats) const {
+        m->getStatistics(stats);
+    }
+
+    float GeometryAccelerationStructure::estimateTraversalCost() const {
+        OptixAabb bounds;
+        return m->estimateTraversalCost(&bounds);
+    }
+
+    uint64_t GeometryAccelerationStructure::getBuildInputHash() const {
+        m->throwRuntimeError(m->readyToBuild, "You need to call prepareForBuild() before computing the hash.");
+        return m->calcBuildInputHash();
+    }
+
+    void GeometryAccelerationStructure::serialize(std::vector<uint8_t>* data) const {
+        m->throwRuntimeError(m->isReady(), "AS has not been built yet.");
+        m->throwRuntimeError(m->children.size() > 0, "Serializing an empty AS is not supported.");
+
+        // JP: コンパクト済みのASがあればそちらを優先する。
+        // EN: Prefer the compacted AS if available.
+        OptixTraversableHandle handle = m->compactedAvailable ? m->compactedHandle : m->handle;
+        size_t accelSize = m->compactedAvailable ? m->compactedSize : m->memoryRequirement.outputSizeInBytes;
+        CUdeviceptr accelBuffer = m->compactedAvailable ?
+            m->compactedAccelBuffer.getCUdeviceptr() : m->accelBuffer.getCUdeviceptr();
+
+        SerializedASHeader header = {};
+        header.magic = SerializedASHeader::s_magic;
+        header.version = SerializedASHeader::s_version;
+        header.buildInputHash = m->calcBuildInputHash();
+        OPTIX_CHECK(optixAccelGetRelocationInfo(m->getRawContext(), handle, &header.relocationInfo));
+        header.accelSize = accelSize;
+        header.compacted = m->compactedAvailable;
+
+        CUDADRV_CHECK(cuEventSynchronize(m->finishEvent));
+        data->resize(sizeof(header) + accelSize);
+        std::memcpy(data->data(), &header, sizeof(header));
+        CUDADRV_CHECK(cuMemcpyDtoH(data->data() + sizeof(header), accelBuffer, accelSize));
+    }
+
+    bool GeometryAccelerationStructure::checkRelocatable(const void* data, size_t size, size_t* accelBufferSize) const {
+        m->throwRuntimeError(m->readyToBuild, "You need to call prepareForBuild() before relocation.");
+
+        if (size < sizeof(SerializedASHeader))
+            return false;
+        SerializedASHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != SerializedASHeader::s_magic ||
+            header.version != SerializedASHeader::s_version ||
+            size < sizeof(header) + header.accelSize)
+            return false;
+        if (header.buildInputHash != m->calcBuildInputHash())
+            return false;
+
+        int compatible = 0;
+        OPTIX_CHECK(optixAccelCheckRelocationCompatibility(m->getRawContext(), &header.relocationInfo, &compatible));
+        if (!compatible)
+            return false;
+
+        *accelBufferSize = static_cast<size_t>(header.accelSize);
+
+        return true;
+    }
+
+    OptixTraversableHandle GeometryAccelerationStructure::relocate(CUstream stream, const void* data, size_t size,
+                                                                   const BufferView &accelBuffer) const {
+        size_t accelSize;
+        m->throwRuntimeError(checkRelocatable(data, size, &accelSize),
+                             "The given data is not relocatable to this AS.");
+        m->throwRuntimeError(accelBuffer.sizeInBytes() >= accelSize,
+                             "Size of the given buffer is not enough.");
+
+        SerializedASHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        m->releaseResidencyStorage();
+
+        // JP: ホストのデータはこの関数から戻った後に解放され得るので同期コピーを行う。
+        // EN: Perform synchronous copy since the host data can be freed after returning from this function.
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        CUDADRV_CHECK(cuMemcpyHtoD(accelBuffer.getCUdeviceptr(),
+                                   reinterpret_cast<const uint8_t*>(data) + sizeof(header), accelSize));
+        OptixTraversableHandle handle;
+        OPTIX_CHECK(optixAccelRelocate(m->getRawContext(), stream, &header.relocationInfo, 0, 0,
+                                       accelBuffer.getCUdeviceptr(), accelBuffer.sizeInBytes(),
+                                       &handle));
+        CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
+
+        if (header.compacted) {
+            m->handle = 0;
+            m->available = false;
+            m->compactedSize = accelSize;
+            m->compactedHandle = handle;
+            m->compactedAccelBuffer = accelBuffer;
+            m->compactedAvailable = true;
+        }
+        else {
+            m->handle = handle;
+            m->accelBuffer = accelBuffer;
+            m->available = true;
+            m->compactedHandle = 0;
+            m->compactedAvailable = false;
+        }
+        m->readyToCompact = false;
+        m->attachedShared = false;
+
+        return handle;
+    }
+
+    void GeometryAccelerationStructure::exportShared(SharedASDesc* desc) const {
+        m->throwRuntimeError(m->isReady(), "AS has not been built yet.");
+        m->throwRuntimeError(m->children.size() > 0, "Sharing an empty AS is not supported.");
+
+        OptixTraversableHandle handle = m->compactedAvailable ? m->compactedHandle : m->handle;
+        const BufferView &accelBuffer = m->compactedAvailable ? m->compactedAccelBuffer : m->accelBuffer;
+
+        *desc = {};
+        desc->buildInputHash = m->calcBuildInputHash();
+        OPTIX_CHECK(optixAccelGetRelocationInfo(m->getRawContext(), handle, &desc->relocationInfo));
+        desc->accelBufferAddress = accelBuffer.getCUdeviceptr();
+        desc->accelSize = m->compactedAvailable ? m->compactedSize : m->memoryRequirement.outputSizeInBytes;
+        desc->handle = handle;
+        desc->compacted = m->compactedAvailable;
+
+        // JP: インポート側がすぐにトレースできるよう、ビルドの完了を待ってから返す。
+        // EN: Return after waiting for the build to finish so that the importer can trace immediately.
+        CUDADRV_CHECK(cuEventSynchronize(m->finishEvent));
+    }
+
+    OptixTraversableHandle GeometryAccelerationStructure::attachShared(const SharedASDesc &desc,
+                                                                       const BufferView &accelBuffer) const {
+        m->throwRuntimeError(m->readyToBuild, "You need to call prepareForBuild() before attaching.");
+        m->throwRuntimeError(desc.buildInputHash == m->calcBuildInputHash(),
+                             "Build inputs are inconsistent with the shared AS.");
+        // JP: ASは内部に絶対アドレスを持ち、共有メモリーは書き込めないためリロケートもできないので、
+        //     エクスポート側と同じアドレスにマップされている必要がある。
+        // EN: An AS holds absolute addresses internally, and the shared memory is not writable so relocation is
+        //     impossible. Therefore it needs to be mapped at the same address as the exporter.
+        m->throwRuntimeError(accelBuffer.getCUdeviceptr() == desc.accelBufferAddress,
+                             "The shared AS is not mapped at the same address as the exporter.");
+        m->throwRuntimeError(accelBuffer.sizeInBytes() >= desc.accelSize,
+                             "Size of the given buffer is not enough.");
+        int compatible = 0;
+        OPTIX_CHECK(optixAccelCheckRelocationCompatibility(m->getRawContext(), &desc.relocationInfo, &compatible));
+        m->throwRuntimeError(compatible, "The shared AS is not compatible with this device.");
+        m->releaseResidencyStorage();
+
+        if (desc.compacted) {
+            m->handle = 0;
+            m->available = false;
+            m->compactedSize = static_cast<size_t>(desc.accelSize);
+            m->compactedHandle = desc.handle;
+            m->compactedAccelBuffer = accelBuffer;
+            m->compactedAvailable = true;
+        }
+        else {
+            m->handle = desc.handle;
+            m->accelBuffer = accelBuffer;
+            m->available = true;
+            m->compactedHandle = 0;
+            m->compactedAvailable = false;
+        }
+        m->readyToCompact = false;
+        m->attachedShared = true;
+
+        return desc.handle;
+    }
+
     void GeometryAccelerationStructure::setChildUserData(uint32_t index, const void* data, uint32_t size, uint32_t alignment) const {
         uint32_t numChildren = static_cast<uint32_t>(m->children.size());
         m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
@@ -1164,12 +4800,17 @@ namespace optixu {
         m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
                              "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
         Priv::Child &child = m->children[index];
+        if (isSameUserData(child.userData, child.userDataSizeAlign, data, size, alignment)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::UserData);
+            return;
+        }
         if (child.userDataSizeAlign.size != size ||
             child.userDataSizeAlign.alignment != alignment)
             m->scene->markSBTLayoutDirty();
         child.userDataSizeAlign = SizeAlign(size, alignment);
         child.userData.resize(size);
         std::memcpy(child.userData.data(), data, size);
+        m->markSBTRecordDirty();
     }
 
     void GeometryAccelerationStructure::setUserData(const void* data, uint32_t size, uint32_t alignment) const {
@@ -1177,12 +4818,17 @@ namespace optixu {
                              "Maximum user data size for GAS is %u bytes.", s_maxGASUserDataSize);
         m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
                              "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
+        if (isSameUserData(m->userData, m->userDataSizeAlign, data, size, alignment)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::UserData);
+            return;
+        }
         if (m->userDataSizeAlign.size != size ||
             m->userDataSizeAlign.alignment != alignment)
             m->scene->markSBTLayoutDirty();
         m->userDataSizeAlign = SizeAlign(size, alignment);
         m->userData.resize(size);
         std::memcpy(m->userData.data(), data, size);
+        m->markSBTRecordDirty();
     }
 
     bool GeometryAccelerationStructure::isReady() const {
@@ -1193,6 +4839,10 @@ namespace optixu {
         return m->getHandle();
     }
 
+    GeometryType GeometryAccelerationStructure::getGeometryType() const {
+        return m->geomType;
+    }
+
     void GeometryAccelerationStructure::getConfiguration(ASTradeoff* tradeOff, bool* allowUpdate, bool* allowCompaction, bool* allowRandomVertexAccess) const {
         if (tradeOff)
             *tradeOff = m->tradeoff;
@@ -1204,6 +4854,18 @@ namespace optixu {
             *allowRandomVertexAccess = m->allowRandomVertexAccess;
     }
 
+    bool GeometryAccelerationStructure::getLazyBuild() const {
+        return m->lazyBuild;
+    }
+
+    bool GeometryAccelerationStructure::getEvictable() const {
+        return m->evictable;
+    }
+
+    bool GeometryAccelerationStructure::isResident() const {
+        return !m->isEvicted();
+    }
+
     void GeometryAccelerationStructure::getMotionOptions(uint32_t* numKeys, float* timeBegin, float* timeEnd, OptixMotionFlags* flags) const {
         if (numKeys)
             *numKeys = m->buildOptions.motionOptions.numKeys;
@@ -1224,14 +4886,11 @@ namespace optixu {
         m->throwRuntimeError(_geomInst, "Invalid geometry instance %p.", _geomInst);
         m->throwRuntimeError(_geomInst->getScene() == m->scene, "Scene mismatch for the given geometry instance %s.",
                              _geomInst->getName().c_str());
-        Priv::Child child;
-        child.geomInst = _geomInst;
-        child.preTransform = preTransform;
-        auto idx = std::find(m->children.cbegin(), m->children.cend(), child);
-        m->throwRuntimeError(idx != m->children.cend(), "Geometry instance %s with transform %p has not been added.",
+        auto idx = m->childIndices.find(Priv::ChildKey{ _geomInst, preTransform });
+        m->throwRuntimeError(idx != m->childIndices.cend(), "Geometry instance %s with transform %p has not been added.",
                              _geomInst->getName().c_str(), preTransform);
 
-        return static_cast<uint32_t>(std::distance(m->children.cbegin(), idx));
+        return idx->second;
     }
 
     GeometryInstance GeometryAccelerationStructure::getChild(uint32_t index, CUdeviceptr* preTransform) const {
@@ -1255,6 +4914,19 @@ namespace optixu {
         return m->numRayTypesPerMaterialSet[matSetIdx];
     }
 
+    Material GeometryAccelerationStructure::getUniformRayTypeMaterial(uint32_t matSetIdx, uint32_t rayType) const {
+        uint32_t numMatSets = static_cast<uint32_t>(m->numRayTypesPerMaterialSet.size());
+        m->throwRuntimeError(matSetIdx < numMatSets,
+                             "Material set index %u is out of bounds [0, %u).",
+                             matSetIdx, numMatSets);
+        uint32_t numRayTypes = m->numRayTypesPerMaterialSet[matSetIdx];
+        m->throwRuntimeError(rayType < numRayTypes,
+                             "Ray type %u is out of bounds [0, %u).",
+                             rayType, numRayTypes);
+        _Material* mat = const_cast<_Material*>(m->uniformRayTypeMaterials[matSetIdx][rayType]);
+        return mat ? mat->getPublicType() : Material();
+    }
+
     void GeometryAccelerationStructure::getChildUserData(uint32_t index, void* data, uint32_t* size, uint32_t* alignment) const {
         uint32_t numChildren = static_cast<uint32_t>(m->children.size());
         m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
@@ -1291,9 +4963,53 @@ namespace optixu {
     }
 
     void Transform::Priv::markDirty() {
+        scene->bumpReadinessEpoch();
         available = false;
     }
 
+    OptixTraversableType Transform::Priv::getTraversableType() const {
+        if (type == TransformType::MatrixMotion)
+            return OPTIX_TRAVERSABLE_TYPE_MATRIX_MOTION_TRANSFORM;
+        else if (type == TransformType::SRTMotion)
+            return OPTIX_TRAVERSABLE_TYPE_SRT_MOTION_TRANSFORM;
+        else if (type == TransformType::Static)
+            return OPTIX_TRAVERSABLE_TYPE_STATIC_TRANSFORM;
+        optixuAssert_ShouldNotBeCalled();
+        return OPTIX_TRAVERSABLE_TYPE_STATIC_TRANSFORM;
+    }
+
+    void Transform::Priv::fillData(uint8_t* dst) const {
+        OptixTraversableHandle childHandle = 0;
+        if (std::holds_alternative<_GeometryAccelerationStructure*>(child))
+            childHandle = std::get<_GeometryAccelerationStructure*>(child)->getHandle();
+        else if (std::holds_alternative<_InstanceAccelerationStructure*>(child))
+            childHandle = std::get<_InstanceAccelerationStructure*>(child)->getHandle();
+        else if (std::holds_alternative<_Transform*>(child))
+            childHandle = std::get<_Transform*>(child)->getHandle();
+        else 
+            optixuAssert_ShouldNotBeCalled();
+
+        if (dst != data)
+            std::memcpy(dst, data, dataSize);
+        if (type == TransformType::MatrixMotion) {
+            auto tr = reinterpret_cast<OptixMatrixMotionTransform*>(dst);
+            tr->child = childHandle;
+            tr->motionOptions = options;
+        }
+        else if (type == TransformType::SRTMotion) {
+            auto tr = reinterpret_cast<OptixSRTMotionTransform*>(dst);
+            tr->child = childHandle;
+            tr->motionOptions = options;
+        }
+        else if (type == TransformType::Static) {
+            auto tr = reinterpret_cast<OptixStaticTransform*>(dst);
+            tr->child = childHandle;
+        }
+        else {
+            optixuAssert_ShouldNotBeCalled();
+        }
+    }
+
     void Transform::destroy() {
         if (m)
             delete m;
@@ -1357,6 +5073,11 @@ namespace optixu {
     }
 
     void Transform::setMotionOptions(float timeBegin, float timeEnd, OptixMotionFlags flags) const {
+        if (m->options.timeBegin == timeBegin && m->options.timeEnd == timeEnd &&
+            m->options.flags == flags) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
         m->options.timeBegin = timeBegin;
         m->options.timeEnd = timeEnd;
         m->options.flags = flags;
@@ -1371,6 +5092,10 @@ namespace optixu {
                              "Number of motion keys was set to %u", m->options.numKeys);
         auto motionData = reinterpret_cast<float*>(m->data + offsetof(OptixMatrixMotionTransform, transform));
         float* dataPerKey = motionData + 12 * keyIdx;
+        if (std::equal(matrix, matrix + 12, dataPerKey)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
 
         std::copy_n(matrix, 12, dataPerKey);
 
@@ -1385,13 +5110,19 @@ namespace optixu {
         auto motionData = reinterpret_cast<OptixSRTData*>(m->data + offsetof(OptixSRTMotionTransform, srtData));
         OptixSRTData* dataPerKey = motionData + keyIdx;
 
-        dataPerKey->sx = scale[0];
-        dataPerKey->sy = scale[1];
-        dataPerKey->sz = scale[2];
-        dataPerKey->a = dataPerKey->b = dataPerKey->c = 0.0f;
-        dataPerKey->pvx = dataPerKey->pvy = dataPerKey->pvz = 0.0f;
-        std::copy_n(orientation, 4, &dataPerKey->qx);
-        std::copy_n(translation, 3, &dataPerKey->tx);
+        OptixSRTData srt;
+        srt.sx = scale[0];
+        srt.sy = scale[1];
+        srt.sz = scale[2];
+        srt.a = srt.b = srt.c = 0.0f;
+        srt.pvx = srt.pvy = srt.pvz = 0.0f;
+        std::copy_n(orientation, 4, &srt.qx);
+        std::copy_n(translation, 3, &srt.tx);
+        if (std::memcmp(dataPerKey, &srt, sizeof(srt)) == 0) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
+        *dataPerKey = srt;
 
         markDirty();
     }
@@ -1399,6 +5130,12 @@ namespace optixu {
     void Transform::setStaticTransform(const float matrix[12]) const {
         m->throwRuntimeError(m->type == TransformType::Static,
                              "This transform has been configured as static transform.");
+        auto xfm = reinterpret_cast<OptixStaticTransform*>(m->data);
+        if (std::equal(matrix, matrix + 12, xfm->transform)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
+
         float invDet = 1.0f / (matrix[ 0] * matrix[ 5] * matrix[10] +
                                matrix[ 1] * matrix[ 6] * matrix[ 8] +
                                matrix[ 2] * matrix[ 4] * matrix[ 9] -
@@ -1407,8 +5144,6 @@ namespace optixu {
                                matrix[ 0] * matrix[ 6] * matrix[ 9]);
         m->throwRuntimeError(invDet != 0.0f, "Given matrix is not invertible.");
 
-        auto xfm = reinterpret_cast<OptixStaticTransform*>(m->data);
-
         std::copy_n(matrix, 12, xfm->transform);
 
         float invMat[12];
@@ -1434,6 +5169,10 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid GAS %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given GAS %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
         m->child = _child;
 
         markDirty();
@@ -1444,6 +5183,10 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid IAS %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given IAS %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
         m->child = _child;
 
         markDirty();
@@ -1454,6 +5197,10 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid transform %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given transform %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Transform);
+            return;
+        }
         m->child = _child;
 
         markDirty();
@@ -1463,49 +5210,20 @@ namespace optixu {
         return m->markDirty();
     }
 
-    OptixTraversableHandle Transform::rebuild(CUstream stream, const BufferView &trDeviceMem) const {
-        m->throwRuntimeError(m->type != TransformType::Invalid, "Transform type is invalid.");
-        m->throwRuntimeError(trDeviceMem.sizeInBytes() >= m->dataSize,
-                             "Size of the given buffer is not enough.");
-        m->throwRuntimeError(!std::holds_alternative<void*>(m->child), "Child is invalid.");
-
-        OptixTraversableHandle childHandle = 0;
-        if (std::holds_alternative<_GeometryAccelerationStructure*>(m->child))
-            childHandle = std::get<_GeometryAccelerationStructure*>(m->child)->getHandle();
-        else if (std::holds_alternative<_InstanceAccelerationStructure*>(m->child))
-            childHandle = std::get<_InstanceAccelerationStructure*>(m->child)->getHandle();
-        else if (std::holds_alternative<_Transform*>(m->child))
-            childHandle = std::get<_Transform*>(m->child)->getHandle();
-        else 
-            optixuAssert_ShouldNotBeCalled();
-
-        OptixTraversableType travType;
-        if (m->type == TransformType::MatrixMotion) {
-            auto tr = reinterpret_cast<OptixMatrixMotionTransform*>(m->data);
-            tr->child = childHandle;
-            tr->motionOptions = m->options;
-            travType = OPTIX_TRAVERSABLE_TYPE_MATRIX_MOTION_TRANSFORM;
-        }
-        else if (m->type == TransformType::SRTMotion) {
-            auto tr = reinterpret_cast<OptixSRTMotionTransform*>(m->data);
-            tr->child = childHandle;
-            tr->motionOptions = m->options;
-            travType = OPTIX_TRAVERSABLE_TYPE_SRT_MOTION_TRANSFORM;
-        }
-        else if (m->type == TransformType::Static) {
-            auto tr = reinterpret_cast<OptixStaticTransform*>(m->data);
-            tr->child = childHandle;
-            travType = OPTIX_TRAVERSABLE_TYPE_STATIC_TRANSFORM;
-        }
-        else {
-            optixuAssert_ShouldNotBeCalled();
-        }
-
+    OptixTraversableHandle Transform::rebuild(CUstream stream, const BufferView &trDeviceMem) const {
+        m->throwRuntimeError(m->type != TransformType::Invalid, "Transform type is invalid.");
+        m->throwRuntimeError(trDeviceMem.sizeInBytes() >= m->dataSize,
+                             "Size of the given buffer is not enough.");
+        m->throwRuntimeError(!std::holds_alternative<void*>(m->child), "Child is invalid.");
+
+        m->fillData(m->data);
         CUDADRV_CHECK(cuMemcpyHtoDAsync(trDeviceMem.getCUdeviceptr(), m->data, m->dataSize, stream));
+        OptixTraversableHandle handle;
         OPTIX_CHECK(optixConvertPointerToTraversableHandle(m->getRawContext(), trDeviceMem.getCUdeviceptr(),
-                                                           travType,
-                                                           &m->handle));
-        m->available = true;
+                                                           m->getTraversableType(),
+                                                           &handle));
+        m->setHandle(handle);
+        m->setDeviceBuffer(trDeviceMem);
 
         return m->handle;
     }
@@ -1591,70 +5309,65 @@ namespace optixu {
 
 
 
-    void Instance::Priv::fillInstance(OptixInstance* instance) const {
+    void Instance::Priv::resolveChild(OptixTraversableHandle* handle, uint32_t* sbtOffset,
+                                      ChildResolveCache* cache) const {
         throwRuntimeError(!std::holds_alternative<void*>(child), "Child has not been set.");
 
-        *instance = {};
-        std::copy_n(instTransform, 12, instance->transform);
-        instance->instanceId = id;
+        const void* childPtr = std::visit([](auto ptr) { return static_cast<const void*>(ptr); }, child);
+        if (cache && cache->child == childPtr && cache->matSetIndex == matSetIndex) {
+            *handle = cache->handle;
+            *sbtOffset = cache->sbtOffset;
+            return;
+        }
 
         if (std::holds_alternative<_GeometryAccelerationStructure*>(child)) {
             auto gas = std::get<_GeometryAccelerationStructure*>(child);
             throwRuntimeError(gas->isReady(), "GAS %s is not ready.", gas->getName().c_str());
-            instance->traversableHandle = gas->getHandle();
-            instance->sbtOffset = scene->getSBTOffset(gas, matSetIndex);
+            *handle = gas->getHandle();
+            *sbtOffset = scene->getSBTOffset(gas, matSetIndex);
         }
         else if (std::holds_alternative<_InstanceAccelerationStructure*>(child)) {
             auto ias = std::get<_InstanceAccelerationStructure*>(child);
             throwRuntimeError(ias->isReady(), "IAS %s is not ready.", ias->getName().c_str());
-            instance->traversableHandle = ias->getHandle();
-            instance->sbtOffset = 0;
+            *handle = ias->getHandle();
+            *sbtOffset = 0;
         }
         else if (std::holds_alternative<_Transform*>(child)) {
             auto xfm = std::get<_Transform*>(child);
             throwRuntimeError(xfm->isReady(), "Transform %s is not ready.", xfm->getName().c_str());
-            instance->traversableHandle = xfm->getHandle();
+            *handle = xfm->getHandle();
             _GeometryAccelerationStructure* desGas = xfm->getDescendantGAS();
             if (desGas)
-                instance->sbtOffset = scene->getSBTOffset(desGas, matSetIndex);
+                *sbtOffset = scene->getSBTOffset(desGas, matSetIndex);
             else
-                instance->sbtOffset = 0;
+                *sbtOffset = 0;
         }
         else {
             optixuAssert_ShouldNotBeCalled();
         }
 
+        if (cache) {
+            cache->child = childPtr;
+            cache->matSetIndex = matSetIndex;
+            cache->handle = *handle;
+            cache->sbtOffset = *sbtOffset;
+        }
+    }
+
+    void Instance::Priv::fillInstance(OptixInstance* instance, ChildResolveCache* cache) const {
+        *instance = {};
+        std::copy_n(instTransform, 12, instance->transform);
+        instance->instanceId = id;
+        resolveChild(&instance->traversableHandle, &instance->sbtOffset, cache);
         instance->visibilityMask = visibilityMask;
         instance->flags = flags;
     }
 
-    void Instance::Priv::updateInstance(OptixInstance* instance) const {
+    void Instance::Priv::updateInstance(OptixInstance* instance, ChildResolveCache* cache) const {
         std::copy_n(instTransform, 12, instance->transform);
         instance->instanceId = id;
-
-        if (std::holds_alternative<_GeometryAccelerationStructure*>(child)) {
-            auto gas = std::get<_GeometryAccelerationStructure*>(child);
-            throwRuntimeError(gas->isReady(), "GAS %s is not ready.", gas->getName().c_str());
-            instance->sbtOffset = scene->getSBTOffset(gas, matSetIndex);
-        }
-        else if (std::holds_alternative<_InstanceAccelerationStructure*>(child)) {
-            auto ias = std::get<_InstanceAccelerationStructure*>(child);
-            throwRuntimeError(ias->isReady(), "IAS %s is not ready.", ias->getName().c_str());
-            instance->sbtOffset = 0;
-        }
-        else if (std::holds_alternative<_Transform*>(child)) {
-            auto xfm = std::get<_Transform*>(child);
-            throwRuntimeError(xfm->isReady(), "Transform %s is not ready.", xfm->getName().c_str());
-            _GeometryAccelerationStructure* desGas = xfm->getDescendantGAS();
-            if (desGas)
-                instance->sbtOffset = scene->getSBTOffset(desGas, matSetIndex);
-            else
-                instance->sbtOffset = 0;
-        }
-        else {
-            optixuAssert_ShouldNotBeCalled();
-        }
-
+        OptixTraversableHandle handle;
+        resolveChild(&handle, &instance->sbtOffset, cache);
         instance->visibilityMask = visibilityMask;
         instance->flags = flags;
     }
@@ -1671,6 +5384,26 @@ namespace optixu {
         return std::holds_alternative<_Transform*>(child);
     }
 
+    void Instance::Priv::applyDesc(const InstanceDesc &desc) {
+        if (desc.childGAS) {
+            child = extract(desc.childGAS);
+            matSetIndex = desc.matSetIndex;
+        }
+        else if (desc.childIAS) {
+            child = extract(desc.childIAS);
+            matSetIndex = 0;
+        }
+        else if (desc.childTransform) {
+            child = extract(desc.childTransform);
+            matSetIndex = desc.matSetIndex;
+        }
+        id = desc.id;
+        visibilityMask = desc.visibilityMask;
+        flags = desc.flags;
+        std::copy_n(desc.transform, 12, instTransform);
+        markDirty();
+    }
+
     void Instance::destroy() {
         if (m)
             delete m;
@@ -1682,8 +5415,13 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid GAS %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given GAS %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child) && m->matSetIndex == matSetIdx) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->child = _child;
         m->matSetIndex = matSetIdx;
+        m->markDirty();
     }
 
     void Instance::setChild(InstanceAccelerationStructure child) const {
@@ -1691,8 +5429,13 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid IAS %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given IAS %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child) && m->matSetIndex == 0) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->child = _child;
         m->matSetIndex = 0;
+        m->markDirty();
     }
 
     void Instance::setChild(Transform child, uint32_t matSetIdx) const {
@@ -1700,34 +5443,74 @@ namespace optixu {
         m->throwRuntimeError(_child, "Invalid transform %p.", _child);
         m->throwRuntimeError(_child->getScene() == m->scene, "Scene mismatch for the given transform %s.",
                              _child->getName().c_str());
+        if (m->child == decltype(m->child)(_child) && m->matSetIndex == matSetIdx) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->child = _child;
         m->matSetIndex = matSetIdx;
+        m->markDirty();
     }
 
     void Instance::setTransform(const float transform[12]) const {
+        if (std::equal(transform, transform + 12, m->instTransform)) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         std::copy_n(transform, 12, m->instTransform);
+        m->markDirty();
     }
 
     void Instance::setID(uint32_t value) const {
         uint32_t maxInstanceID = m->scene->getContext()->getMaxInstanceID();
         m->throwRuntimeError(value <= maxInstanceID,
                              "Max instance ID value is 0x%08x.", maxInstanceID);
+        if (m->id == value) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->id = value;
+        m->markDirty();
     }
 
     void Instance::setVisibilityMask(uint32_t mask) const {
         uint32_t numVisibilityMaskBits = m->scene->getContext()->getNumVisibilityMaskBits();
         m->throwRuntimeError((mask >> numVisibilityMaskBits) == 0,
                              "Number of visibility mask bits is %u.", numVisibilityMaskBits);
+        if (m->visibilityMask == mask) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
+        m->visibilityMask = mask;
+        m->markDirty();
+    }
+
+    void Instance::setVisibilityCategories(const std::vector<std::string> &categories) const {
+        uint32_t mask = m->scene->calcVisibilityMask(categories);
+        if (m->visibilityMask == mask) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->visibilityMask = mask;
+        m->markDirty();
     }
 
     void Instance::setFlags(OptixInstanceFlags flags) const {
+        if (m->flags == flags) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->flags = flags;
+        m->markDirty();
     }
 
     void Instance::setMaterialSetIndex(uint32_t matSetIdx) const {
+        if (m->matSetIndex == matSetIdx) {
+            m->getContext()->countRedundantUpdate(RedundantUpdateKind::Instance);
+            return;
+        }
         m->matSetIndex = matSetIdx;
+        m->markDirty();
     }
 
     ChildType Instance::getChildType() const {
@@ -1773,12 +5556,187 @@ namespace optixu {
 
 
     void InstanceAccelerationStructure::Priv::markDirty(bool readyToBuild) {
+        scene->bumpReadinessEpoch();
         readyToBuild = readyToBuild;
         available = false;
         readyToCompact = false;
         compactedAvailable = false;
     }
 
+    bool InstanceAccelerationStructure::Priv::readCompactedSize(bool wait) {
+        if (!scene->readCompactedSize(compactedSizeSlot, compactedSizeReadbackIndex, wait, &compactedSize))
+            return false;
+
+        readyToCompact = true;
+
+        return true;
+    }
+
+    void InstanceAccelerationStructure::Priv::uploadInstances(CUstream stream, const BufferView &instBuffer, bool forRebuild) {
+        OPTIXU_NVTX_RANGE("optixu::IAS::uploadInstances", this);
+        uint32_t numInstances = static_cast<uint32_t>(children.size());
+        // JP: インスタンス配列は既に連続したOptixInstanceの配列なので、チャンクごとに並列に書き込める。
+        // EN: The instance array is already a contiguous array of OptixInstance, so it can be written per chunk
+        //     in parallel.
+        if (!instancesUploaded || !(instBuffer == instanceBuffer)) {
+            runInstanceChunks([&](uint32_t beginIdx, uint32_t endIdx) {
+                _Instance::ChildResolveCache cache;
+                for (uint32_t i = beginIdx; i < endIdx; ++i) {
+                    if (forRebuild)
+                        children[i]->fillInstance(&instances[i], &cache);
+                    else
+                        children[i]->updateInstance(&instances[i], &cache);
+                    uploadedRevisions[i] = children[i]->getRevision();
+                }
+            });
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(instBuffer.getCUdeviceptr(), instances.data(),
+                                            instances.size() * sizeof(OptixInstance),
+                                            stream));
+            instancesUploaded = true;
+            return;
+        }
+
+        // JP: 変更されたインスタンスのみを、隣接する範囲をまとめてアップロードする。
+        //     リビルドでは子のハンドルが変わり得るので、インスタンスを作り直して内容を比較する。
+        //     変更の検出は並列に行い、範囲の結合のみ逐次に行う。
+        // EN: Upload only the changed instances merging adjacent ranges.
+        //     Handles of children can change in rebuild, so recreate instances and compare their contents.
+        //     Detecting changes is done in parallel, and only merging ranges is done sequentially.
+        instanceChangedFlags.resize(numInstances);
+        runInstanceChunks([&](uint32_t beginIdx, uint32_t endIdx) {
+            _Instance::ChildResolveCache cache;
+            for (uint32_t i = beginIdx; i < endIdx; ++i) {
+                const _Instance* child = children[i];
+                bool changed;
+                if (forRebuild) {
+                    OptixInstance instance;
+                    child->fillInstance(&instance, &cache);
+                    changed = std::memcmp(&instance, &instances[i], sizeof(OptixInstance)) != 0;
+                    if (changed)
+                        instances[i] = instance;
+                }
+                else {
+                    changed = child->getRevision() != uploadedRevisions[i];
+                    if (changed)
+                        child->updateInstance(&instances[i], &cache);
+                }
+                uploadedRevisions[i] = child->getRevision();
+                instanceChangedFlags[i] = changed;
+            }
+        });
+
+        const auto uploadRange = [&](uint32_t beginIdx, uint32_t endIdx) {
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(instBuffer.getCUdeviceptr() + sizeof(OptixInstance) * beginIdx,
+                                            &instances[beginIdx],
+                                            (endIdx - beginIdx) * sizeof(OptixInstance),
+                                            stream));
+        };
+        constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+        uint32_t rangeBeginIdx = InvalidIndex;
+        for (uint32_t i = 0; i < numInstances; ++i) {
+            if (instanceChangedFlags[i]) {
+                if (rangeBeginIdx == InvalidIndex)
+                    rangeBeginIdx = i;
+            }
+            else if (rangeBeginIdx != InvalidIndex) {
+                uploadRange(rangeBeginIdx, i);
+                rangeBeginIdx = InvalidIndex;
+            }
+        }
+        if (rangeBeginIdx != InvalidIndex)
+            uploadRange(rangeBeginIdx, numInstances);
+    }
+
+    bool InstanceAccelerationStructure::Priv::hasPendingInstanceChanges() const {
+        if (useDeviceInstances)
+            return false;
+        if (uploadedRevisions.size() != children.size())
+            return true;
+        for (uint32_t i = 0; i < children.size(); ++i) {
+            if (children[i]->getRevision() != uploadedRevisions[i])
+                return true;
+        }
+        return false;
+    }
+
+    bool InstanceAccelerationStructure::Priv::childHandlesChanged() const {
+        if (useDeviceInstances)
+            return false;
+        if (!instancesUploaded || instances.size() != children.size())
+            return true;
+        std::atomic<bool> changed = false;
+        runInstanceChunks([&](uint32_t beginIdx, uint32_t endIdx) {
+            _Instance::ChildResolveCache cache;
+            for (uint32_t i = beginIdx; i < endIdx && !changed.load(std::memory_order_relaxed); ++i) {
+                OptixTraversableHandle handle;
+                uint32_t sbtOffset;
+                children[i]->resolveChild(&handle, &sbtOffset, &cache);
+                if (handle != instances[i].traversableHandle)
+                    changed = true;
+            }
+        });
+        return changed;
+    }
+
+    void InstanceAccelerationStructure::Priv::getStatistics(ASStatistics* stats) {
+        *stats = {};
+        statsRecorder.getTimes(&stats->buildTimeInMs, &stats->updateTimeInMs, &stats->compactionTimeInMs);
+        statsRecorder.getCounts(&stats->numBuilds, &stats->numUpdates, &stats->numCompactions);
+        stats->numBuildInputs = 1;
+        if (readyToBuild || isReady()) {
+            stats->uncompactedSizeInBytes = memoryRequirement.outputSizeInBytes;
+            stats->scratchSizeInBytes = memoryRequirement.tempSizeInBytes;
+            stats->updateScratchSizeInBytes = memoryRequirement.tempUpdateSizeInBytes;
+        }
+        if (readyToCompact || compactedAvailable)
+            stats->compactedSizeInBytes = compactedSize;
+    }
+
+    float InstanceAccelerationStructure::Priv::estimateTraversalCost(OptixAabb* bounds) const {
+        throwRuntimeError(!useDeviceInstances, "Cost estimation is not supported for device-side instances.");
+        clearAabb(bounds);
+
+        // JP: 同じ子を参照するインスタンスが多いので、子ごとの推定値を使い回す。
+        // EN: Many instances refer to the same child, so reuse the estimate per child.
+        struct ChildEstimate {
+            OptixAabb bounds;
+            float cost;
+        };
+        std::unordered_map<const void*, ChildEstimate> childEstimates;
+        double sumWeightedSurfaceArea = 0.0;
+        for (const _Instance* inst : children) {
+            const void* child = nullptr;
+            if (_GeometryAccelerationStructure* gas = inst->getChildGAS())
+                child = gas;
+            else if (_InstanceAccelerationStructure* ias = inst->getChildIAS())
+                child = ias;
+            if (!child)
+                continue;
+
+            auto it = childEstimates.find(child);
+            if (it == childEstimates.cend()) {
+                ChildEstimate estimate;
+                if (_GeometryAccelerationStructure* gas = inst->getChildGAS())
+                    estimate.cost = gas->estimateTraversalCost(&estimate.bounds);
+                else
+                    estimate.cost = inst->getChildIAS()->estimateTraversalCost(&estimate.bounds);
+                it = childEstimates.emplace(child, estimate).first;
+            }
+
+            OptixAabb instBounds;
+            transformAabb(inst->getTransform(), it->second.bounds, &instBounds);
+            if (isAabbEmpty(instBounds))
+                continue;
+            unifyAabb(bounds, instBounds);
+            sumWeightedSurfaceArea += calcSurfaceArea(instBounds) * (1.0 + it->second.cost);
+        }
+
+        float rootSurfaceArea = calcSurfaceArea(*bounds);
+        if (rootSurfaceArea <= 0.0f)
+            return 0.0f;
+        return static_cast<float>(sumWeightedSurfaceArea / rootSurfaceArea);
+    }
+
     void InstanceAccelerationStructure::destroy() {
         if (m)
             delete m;
@@ -1813,31 +5771,84 @@ namespace optixu {
     }
 
     void InstanceAccelerationStructure::addChild(Instance instance) const {
+        m->throwRuntimeError(!m->useDeviceInstances, "This IAS uses instances written on the device.");
         _Instance* _inst = extract(instance);
         m->throwRuntimeError(_inst, "Invalid instance %p.");
         m->throwRuntimeError(_inst->getScene() == m->scene, "Scene mismatch for the given instance %s.",
                              _inst->getName().c_str());
-        auto idx = std::find(m->children.cbegin(), m->children.cend(), _inst);
-        m->throwRuntimeError(idx == m->children.cend(), "Instance %s has been already added.",
+        m->throwRuntimeError(m->childIndices.count(_inst) == 0, "Instance %s has been already added.",
                              _inst->getName().c_str());
 
+        m->childIndices[_inst] = static_cast<uint32_t>(m->children.size());
         m->children.push_back(_inst);
 
         m->markDirty(false);
     }
 
+    void InstanceAccelerationStructure::addChildren(const Instance* instances, uint32_t count) const {
+        m->throwRuntimeError(!m->useDeviceInstances, "This IAS uses instances written on the device.");
+        m->throwRuntimeError(instances || count == 0, "instances must not be null.");
+        if (count == 0)
+            return;
+
+        // JP: 途中で失敗しても子の状態が変わらないよう、追加の前に全て検証する。
+        // EN: Validate all before adding so that children don't change on a failure midway.
+        size_t numChildren = m->children.size();
+        std::unordered_set<const _Instance*> newChildren;
+        newChildren.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            _Instance* _inst = extract(instances[i]);
+            m->throwRuntimeError(_inst, "Invalid instance at %u.", i);
+            m->throwRuntimeError(_inst->getScene() == m->scene, "Scene mismatch for the given instance %s.",
+                                 _inst->getName().c_str());
+            m->throwRuntimeError(m->childIndices.count(_inst) == 0 && newChildren.insert(_inst).second,
+                                 "Instance %s has been already added.", _inst->getName().c_str());
+        }
+
+        m->children.reserve(numChildren + count);
+        m->childIndices.reserve(numChildren + count);
+        for (uint32_t i = 0; i < count; ++i) {
+            _Instance* _inst = extract(instances[i]);
+            m->childIndices[_inst] = static_cast<uint32_t>(m->children.size());
+            m->children.push_back(_inst);
+        }
+
+        m->markDirty(false);
+    }
+
     void InstanceAccelerationStructure::removeChildAt(uint32_t index) const {
         uint32_t numChildren = static_cast<uint32_t>(m->children.size());
         m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
                              numChildren);
 
+        // JP: 後続の子のインデックスを詰める。
+        // EN: Shift the indices of the subsequent children.
+        m->childIndices.erase(m->children[index]);
         m->children.erase(m->children.cbegin() + index);
+        for (uint32_t i = index; i < numChildren - 1; ++i)
+            m->childIndices[m->children[i]] = i;
+
+        m->markDirty(false);
+    }
+
+    void InstanceAccelerationStructure::swapRemoveChildAt(uint32_t index) const {
+        uint32_t numChildren = static_cast<uint32_t>(m->children.size());
+        m->throwRuntimeError(index < numChildren, "Index is out of bounds [0, %u).]",
+                             numChildren);
+
+        m->childIndices.erase(m->children[index]);
+        if (index != numChildren - 1) {
+            m->children[index] = m->children.back();
+            m->childIndices[m->children[index]] = index;
+        }
+        m->children.pop_back();
 
         m->markDirty(false);
     }
 
     void InstanceAccelerationStructure::clearChildren() const {
         m->children.clear();
+        m->childIndices.clear();
 
         m->markDirty(false);
     }
@@ -1846,8 +5857,29 @@ namespace optixu {
         m->markDirty(false);
     }
 
+    void InstanceAccelerationStructure::setDeviceInstances(bool enable, uint32_t numInstances) const {
+        m->throwRuntimeError(!enable || m->children.empty(),
+                             "Host-side children must be cleared to use instances written on the device.");
+        m->useDeviceInstances = enable;
+        m->numDeviceInstances = enable ? numInstances : 0;
+
+        m->markDirty(false);
+    }
+
+    void InstanceAccelerationStructure::setDeviceInstanceCount(CUdeviceptr numInstancesOnDevice) const {
+        m->throwRuntimeError(m->useDeviceInstances || numInstancesOnDevice == 0,
+                             "This IAS does not use instances written on the device.");
+        if (numInstancesOnDevice && !m->deviceInstanceCountOnHost)
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m->deviceInstanceCountOnHost), sizeof(uint32_t)));
+        m->deviceInstanceCount = numInstancesOnDevice;
+    }
+
     void InstanceAccelerationStructure::prepareForBuild(OptixAccelBufferSizes* memoryRequirement) const {
-        m->instances.resize(m->children.size());
+        OPTIXU_NVTX_RANGE("optixu::IAS::prepareForBuild", m);
+        uint32_t numHostInstances = m->useDeviceInstances ? 0 : static_cast<uint32_t>(m->children.size());
+        m->instances.resize(numHostInstances);
+        m->uploadedRevisions.resize(numHostInstances);
+        m->instancesUploaded = false;
 
         // Fill the build input.
         {
@@ -1855,7 +5887,7 @@ namespace optixu {
             m->buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
             OptixBuildInputInstanceArray &instArray = m->buildInput.instanceArray;
             instArray.instances = 0;
-            instArray.numInstances = static_cast<uint32_t>(m->children.size());
+            instArray.numInstances = m->getNumInstances();
         }
 
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
@@ -1880,33 +5912,73 @@ namespace optixu {
 
     OptixTraversableHandle InstanceAccelerationStructure::rebuild(CUstream stream, const BufferView &instanceBuffer,
                                                                   const BufferView &accelBuffer, const BufferView &scratchBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::IAS::rebuild", stream);
+        OPTIXU_NVTX_RANGE("optixu::IAS::rebuild", m);
         m->throwRuntimeError(m->readyToBuild, "You need to call prepareForBuild() before rebuild.");
         m->throwRuntimeError(accelBuffer.sizeInBytes() >= m->memoryRequirement.outputSizeInBytes,
                              "Size of the given buffer is not enough.");
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempSizeInBytes,
                              "Size of the given scratch buffer is not enough.");
-        m->throwRuntimeError(instanceBuffer.sizeInBytes() >= m->instances.size() * sizeof(OptixInstance),
+        m->throwRuntimeError(instanceBuffer.sizeInBytes() >= m->getNumInstances() * sizeof(OptixInstance),
                              "Size of the given instance buffer is not enough.");
         m->throwRuntimeError(m->scene->sbtLayoutGenerationDone(),
                              "Shader binding table layout generation has not been done.");
 
-        uint32_t childIdx = 0;
-        for (const _Instance* child : m->children)
-            child->fillInstance(&m->instances[childIdx++]);
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(instanceBuffer.getCUdeviceptr(), m->instances.data(),
-                                        m->instances.size() * sizeof(OptixInstance),
-                                        stream));
-        m->buildInput.instanceArray.instances = m->children.size() > 0 ? instanceBuffer.getCUdeviceptr() : 0;
+        // JP: デバイス上で書き込まれたインスタンスを使う場合はインスタンスの生成とアップロードをスキップする。
+        // EN: Skip creating and uploading instances when using instances written on the device.
+        if (!m->useDeviceInstances) {
+            // JP: 参照されている未ビルドの遅延ビルドGASをシーンのプール上にビルドする。
+            // EN: Build referenced lazy-build GASs that have not been built on the scene's pool.
+            for (_Instance* inst : m->children) {
+                _GeometryAccelerationStructure* gas = inst->getChildGAS();
+                if (gas && gas->isLazyBuild() && !gas->isReady())
+                    m->scene->buildLazyGAS(stream, gas);
+            }
+            // JP: 参照されている退避済みのGASを復帰する。インスタンスのアップロードとビルドは同じストリーム上で復帰を待つ。
+            // EN: Restore referenced evicted GASs. Uploading instances and the build wait on the restoration
+            //     on the same stream.
+            m->scene->prepareResidency(stream, m->children);
+            m->uploadInstances(stream, instanceBuffer, true);
+        }
+        m->buildInput.instanceArray.instances = m->getNumInstances() > 0 ? instanceBuffer.getCUdeviceptr() : 0;
+        if (m->useDeviceInstances) {
+            // JP: GPU上で詰めて書き込まれたインスタンスの実際の数を読み戻す。
+            //     メモリ要件は最大数で計算済みなので、それより少ない数でビルドしても問題ない。
+            // EN: Read back the actual number of instances packed on the GPU.
+            //     The memory requirement has been computed with the maximum, so building with fewer is fine.
+            uint32_t numInstances = m->numDeviceInstances;
+            if (m->deviceInstanceCount) {
+                m->throwRuntimeError(!isStreamCapturing(stream),
+                                     "Reading back the device instance count is not allowed during stream capture.");
+                CUDADRV_CHECK(cuMemcpyDtoHAsync(m->deviceInstanceCountOnHost, m->deviceInstanceCount,
+                                                sizeof(uint32_t), stream));
+                CUDADRV_CHECK(cuStreamSynchronize(stream));
+                numInstances = std::min(*m->deviceInstanceCountOnHost, m->numDeviceInstances);
+            }
+            m->buildInput.instanceArray.numInstances = numInstances;
+        }
 
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
 
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
+        auto compactedSizeStorageLock = m->scene->lockCompactedSizeStorage();
+        m->propertyCompactedSize.result = m->scene->getCompactedSizeAddress(m->compactedSizeSlot);
+        OptixAccelEmitDesc emitDescs[2];
+        uint32_t numEmitDescs = 0;
+        if (compactionEnabled)
+            emitDescs[numEmitDescs++] = m->propertyCompactedSize;
+        if (m->autoRebuildPolicy.tracksBounds())
+            emitDescs[numEmitDescs++] = m->autoRebuildPolicy.getAabbEmitDesc();
+        m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Build);
         OPTIX_CHECK(optixAccelBuild(m->getRawContext(), stream, &m->buildOptions, &m->buildInput, 1,
                                     scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes(),
                                     accelBuffer.getCUdeviceptr(), accelBuffer.sizeInBytes(),
                                     &m->handle,
-                                    compactionEnabled ? &m->propertyCompactedSize : nullptr,
-                                    compactionEnabled ? 1 : 0));
+                                    numEmitDescs > 0 ? emitDescs : nullptr, numEmitDescs));
+        m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Build);
+        if (compactionEnabled)
+            m->compactedSizeReadbackIndex = m->scene->requestCompactedSizeReadback(stream);
+        m->autoRebuildPolicy.notifyBuild(stream, true);
         CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
 
         m->instanceBuffer = instanceBuffer;
@@ -1929,16 +6001,30 @@ namespace optixu {
 
         // JP: リビルド・アップデートの完了を待ってコンパクション後のサイズ情報を取得。
         // EN: Wait the completion of rebuild/update then obtain the size after coompaction.
-        // TODO: ? stream
-        CUDADRV_CHECK(cuEventSynchronize(m->finishEvent));
-        CUDADRV_CHECK(cuMemcpyDtoH(&m->compactedSize, m->propertyCompactedSize.result, sizeof(m->compactedSize)));
+        m->readCompactedSize(true);
+
+        *compactedAccelBufferSize = m->compactedSize;
+    }
+
+    bool InstanceAccelerationStructure::tryPrepareForCompact(size_t* compactedAccelBufferSize) const {
+        bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
+        m->throwRuntimeError(compactionEnabled, "This AS does not allow compaction.");
+        m->throwRuntimeError(m->available, "Uncompacted AS has not been built yet.");
+
+        if (m->compactedAvailable)
+            return true;
+
+        if (!m->readCompactedSize(false))
+            return false;
 
         *compactedAccelBufferSize = m->compactedSize;
 
-        m->readyToCompact = true;
+        return true;
     }
 
     OptixTraversableHandle InstanceAccelerationStructure::compact(CUstream stream, const BufferView &compactedAccelBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::IAS::compact", stream);
+        OPTIXU_NVTX_RANGE("optixu::IAS::compact", m);
         bool compactionEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_COMPACTION) != 0;
         m->throwRuntimeError(compactionEnabled, "This AS does not allow compaction.");
         m->throwRuntimeError(m->readyToCompact, "You need to call prepareForCompact() before compaction.");
@@ -1946,9 +6032,11 @@ namespace optixu {
         m->throwRuntimeError(compactedAccelBuffer.sizeInBytes() >= m->compactedSize,
                              "Size of the given buffer is not enough.");
 
+        m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Compaction);
         OPTIX_CHECK(optixAccelCompact(m->getRawContext(), stream,
                                       m->handle, compactedAccelBuffer.getCUdeviceptr(), compactedAccelBuffer.sizeInBytes(),
                                       &m->compactedHandle));
+        m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Compaction);
         CUDADRV_CHECK(cuEventRecord(m->finishEvent, stream));
 
         m->compactedAccelBuffer = compactedAccelBuffer;
@@ -1970,33 +6058,69 @@ namespace optixu {
     }
 
     void InstanceAccelerationStructure::update(CUstream stream, const BufferView &scratchBuffer) const {
+        ProfileScope profileScope(m->getContext(), "optixu::IAS::update", stream);
+        OPTIXU_NVTX_RANGE("optixu::IAS::update", m);
         bool updateEnabled = (m->buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_UPDATE) != 0;
         m->throwRuntimeError(updateEnabled, "This AS does not allow update.");
         m->throwRuntimeError(m->available || m->compactedAvailable, "AS has not been built yet.");
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempUpdateSizeInBytes,
                              "Size of the given scratch buffer is not enough.");
 
-        uint32_t childIdx = 0;
-        for (const _Instance* child : m->children)
-            child->updateInstance(&m->instances[childIdx++]);
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(m->instanceBuffer.getCUdeviceptr(), m->instances.data(),
-                                        m->instances.size() * sizeof(OptixInstance),
-                                        stream));
+        if (!m->useDeviceInstances)
+            m->uploadInstances(stream, m->instanceBuffer, false);
 
         const BufferView &accelBuffer = m->compactedAvailable ? m->compactedAccelBuffer : m->accelBuffer;
         OptixTraversableHandle handle = m->compactedAvailable ? m->compactedHandle : m->handle;
 
         m->buildOptions.operation = OPTIX_BUILD_OPERATION_UPDATE;
         OptixTraversableHandle tempHandle = handle;
+        bool tracksBounds = m->autoRebuildPolicy.tracksBounds();
+        m->statsRecorder.begin(stream, ASStatisticsRecorder::Operation::Update);
         OPTIX_CHECK(optixAccelBuild(m->getRawContext(), stream,
                                     &m->buildOptions, &m->buildInput, 1,
                                     scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes(),
                                     accelBuffer.getCUdeviceptr(), accelBuffer.sizeInBytes(),
                                     &tempHandle,
-                                    nullptr, 0));
+                                    tracksBounds ? &m->autoRebuildPolicy.getAabbEmitDesc() : nullptr,
+                                    tracksBounds ? 1 : 0));
+        m->statsRecorder.end(stream, ASStatisticsRecorder::Operation::Update);
+        m->autoRebuildPolicy.notifyBuild(stream, false);
         optixuAssert(tempHandle == handle, "IAS %s: Update should not change the handle itself, what's going on?", getName());
     }
 
+    void InstanceAccelerationStructure::setAutoRebuildPolicy(uint32_t maxNumUpdates, float maxBoundsGrowth) const {
+        m->throwRuntimeError(maxBoundsGrowth >= 0.0f, "maxBoundsGrowth must be non-negative.");
+        m->autoRebuildPolicy.set(maxNumUpdates, maxBoundsGrowth);
+    }
+
+    OptixTraversableHandle InstanceAccelerationStructure::updateOrRebuild(CUstream stream, const BufferView &scratchBuffer,
+                                                                          bool* rebuilt) const {
+        m->throwRuntimeError(m->autoRebuildPolicy.isEnabled(), "Auto rebuild policy is not set.");
+        bool doRebuild = m->readyToBuild && m->available && !m->compactedAvailable &&
+            scratchBuffer.sizeInBytes() >= m->memoryRequirement.tempSizeInBytes &&
+            m->autoRebuildPolicy.shouldRebuild();
+        if (rebuilt)
+            *rebuilt = doRebuild;
+        if (doRebuild)
+            return rebuild(stream, m->instanceBuffer, m->accelBuffer, scratchBuffer);
+
+        update(stream, scratchBuffer);
+        return m->getHandle();
+    }
+
+    void InstanceAccelerationStructure::enableStatistics(bool enable) const {
+        m->statsRecorder.setEnabled(enable);
+    }
+
+    void InstanceAccelerationStructure::getStatistics(ASStatistics* stats) const {
+        m->getStatistics(stats);
+    }
+
+    float InstanceAccelerationStructure::estimateTraversalCost() const {
+        OptixAabb bounds;
+        return m->estimateTraversalCost(&bounds);
+    }
+
     bool InstanceAccelerationStructure::isReady() const {
         return m->isReady();
     }
@@ -2029,16 +6153,22 @@ namespace optixu {
         return static_cast<uint32_t>(m->children.size());
     }
 
+    bool InstanceAccelerationStructure::usesDeviceInstances(uint32_t* numInstances) const {
+        if (numInstances)
+            *numInstances = m->numDeviceInstances;
+        return m->useDeviceInstances;
+    }
+
     uint32_t InstanceAccelerationStructure::findChildIndex(Instance instance) const {
         _Instance* _inst = extract(instance);
         m->throwRuntimeError(_inst, "Invalid instance %p.", _inst);
         m->throwRuntimeError(_inst->getScene() == m->scene, "Scene mismatch for the given instance %s.",
                              _inst->getName().c_str());
-        auto idx = std::find(m->children.cbegin(), m->children.cend(), _inst);
-        m->throwRuntimeError(idx != m->children.cend(), "Instance %s has not been added.",
+        auto idx = m->childIndices.find(_inst);
+        m->throwRuntimeError(idx != m->childIndices.cend(), "Instance %s has not been added.",
                              _inst->getName().c_str());
 
-        return static_cast<uint32_t>(std::distance(m->children.cbegin(), idx));
+        return idx->second;
     }
 
     Instance InstanceAccelerationStructure::getChild(uint32_t index) const {
@@ -2051,20 +6181,103 @@ namespace optixu {
 
 
     Pipeline::Priv::~Priv() {
+        try {
+            resolvePendingLink(true);
+        }
+        catch (const std::exception &) {
+        }
+        if (visibilityHitGroup)
+            visibilityHitGroup->getPublicType().destroy();
+        if (visibilityMissProgram)
+            visibilityMissProgram->getPublicType().destroy();
+        if (visibilityModule)
+            visibilityModule->getPublicType().destroy();
         if (pipelineLinked)
             optixPipelineDestroy(rawPipeline);
         for (auto it = modulesForBuiltin.begin(); it != modulesForBuiltin.end(); ++it)
             it->second->getPublicType().destroy();
         modulesForBuiltin.clear();
+        setNumOwnedHitGroupSBTs(0);
         context->unregisterName(this);
     }
     
     void Pipeline::Priv::markDirty() {
+        resolvePendingLink(true);
         if (pipelineLinked)
             OPTIX_CHECK(optixPipelineDestroy(rawPipeline));
         pipelineLinked = false;
     }
 
+    bool Pipeline::Priv::resolvePendingLink(bool wait) {
+        if (!pipelineLinking)
+            return pipelineLinked;
+        if (!wait && pendingRawPipeline.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        pipelineLinking = false;
+        rawPipeline = pendingRawPipeline.get();
+        pipelineLinked = true;
+
+        return true;
+    }
+
+    void Pipeline::Priv::setNumOwnedHitGroupSBTs(uint32_t numBuffers) {
+        for (OwnedHitGroupSBT &ownedSbt : ownedHitGroupSbts) {
+            CUDADRV_CHECK(cuEventSynchronize(ownedSbt.fence));
+            CUDADRV_CHECK(cuEventDestroy(ownedSbt.fence));
+            if (ownedSbt.hostMem)
+                CUDADRV_CHECK(cuMemFreeHost(ownedSbt.hostMem));
+            if (ownedSbt.buffer)
+                CUDADRV_CHECK(cuMemFree(ownedSbt.buffer));
+        }
+        ownedHitGroupSbts.clear();
+        curOwnedHitGroupSbtIndex = 0;
+
+        ownedHitGroupSbts.resize(numBuffers);
+        for (OwnedHitGroupSBT &ownedSbt : ownedHitGroupSbts) {
+            ownedSbt = OwnedHitGroupSBT{};
+            CUDADRV_CHECK(cuEventCreate(&ownedSbt.fence, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+        }
+        hitGroupSbt = BufferView();
+        hitGroupSbtHostMem = nullptr;
+        hitGroupSbtIsUpToDate = false;
+    }
+
+    void Pipeline::Priv::acquireOwnedHitGroupSBT() {
+        curOwnedHitGroupSbtIndex = (curOwnedHitGroupSbtIndex + 1) % ownedHitGroupSbts.size();
+        OwnedHitGroupSBT &ownedSbt = ownedHitGroupSbts[curOwnedHitGroupSbtIndex];
+
+        // JP: このバッファーを使った前回のローンチ(とその転送)が終わるまで待つ。
+        // EN: Wait for the previous launch (and its transfer) that used this buffer to finish.
+        CUDADRV_CHECK(cuEventSynchronize(ownedSbt.fence));
+
+        size_t reqSize = static_cast<size_t>(scene->getSingleRecordSize()) * std::max(scene->getNumSBTRecords(), 1u);
+        if (ownedSbt.size < reqSize) {
+            if (ownedSbt.hostMem)
+                CUDADRV_CHECK(cuMemFreeHost(ownedSbt.hostMem));
+            if (ownedSbt.buffer)
+                CUDADRV_CHECK(cuMemFree(ownedSbt.buffer));
+            CUDADRV_CHECK(cuMemAlloc(&ownedSbt.buffer, reqSize));
+            CUDADRV_CHECK(cuMemAllocHost(&ownedSbt.hostMem, reqSize));
+            ownedSbt.size = reqSize;
+            ownedSbt.isUpToDate = false;
+        }
+
+        hitGroupSbt = BufferView(ownedSbt.buffer, reqSize, 1);
+        hitGroupSbtHostMem = ownedSbt.hostMem;
+        hitGroupSbtStamp = ownedSbt.stamp;
+        hitGroupSbtLayoutGeneration = ownedSbt.layoutGeneration;
+        hitGroupSbtIsUpToDate = ownedSbt.isUpToDate;
+    }
+
+    void Pipeline::Priv::releaseOwnedHitGroupSBT(CUstream stream) {
+        OwnedHitGroupSBT &ownedSbt = ownedHitGroupSbts[curOwnedHitGroupSbtIndex];
+        ownedSbt.stamp = hitGroupSbtStamp;
+        ownedSbt.layoutGeneration = hitGroupSbtLayoutGeneration;
+        ownedSbt.isUpToDate = hitGroupSbtIsUpToDate;
+        CUDADRV_CHECK(cuEventRecord(ownedSbt.fence, stream));
+    }
+
     OptixModule Pipeline::Priv::getModuleForBuiltin(OptixPrimitiveType primType) {
         if (primType == OPTIX_PRIMITIVE_TYPE_TRIANGLE)
             return nullptr;
@@ -2091,6 +6304,73 @@ namespace optixu {
         return modulesForBuiltin.at(primType)->getRawModule();
     }
     
+    void Pipeline::Priv::setDefaultHitGroup(uint32_t rayType, _ProgramGroup* hitGroup) {
+        if (rayType >= defaultHitGroups.size())
+            defaultHitGroups.resize(rayType + 1, nullptr);
+        bool addsAnyHit = hitGroup && hitGroup->hasAnyHitProgram() &&
+            (!defaultHitGroups[rayType] || !defaultHitGroups[rayType]->hasAnyHitProgram());
+        if (addsAnyHit)
+            context->markSBTLayoutsDirtyForGeometryFlagInference();
+        defaultHitGroups[rayType] = hitGroup;
+        ++defaultHitGroupRevision;
+        hitGroupSbtIsUpToDate = false;
+        markOwnedHitGroupSBTsDirty();
+    }
+
+    uint64_t Pipeline::Priv::calcModuleCacheKey(const std::string &ptxString,
+                                                const OptixModuleCompileOptions &moduleOptions) const {
+        // JP: OptiXのディスクキャッシュのエントリーを特定するのと同じ要素からキーを計算する。
+        // EN: Compute a key from the same elements identifying an entry of OptiX's disk cache.
+        Hasher64 hasher;
+        hasher.add(ptxString.c_str(), ptxString.size());
+        hasher.add(moduleOptions.maxRegisterCount);
+        hasher.add(moduleOptions.optLevel);
+        hasher.add(moduleOptions.debugLevel);
+        for (uint32_t i = 0; i < moduleOptions.numBoundValues; ++i) {
+            const OptixModuleCompileBoundValueEntry &entry = moduleOptions.boundValues[i];
+            hasher.add(entry.pipelineParamOffsetInBytes);
+            hasher.add(entry.sizeInBytes);
+            hasher.add(entry.boundValuePtr, entry.sizeInBytes);
+        }
+        const OptixPipelineCompileOptions &plOptions = pipelineCompileOptions;
+        hasher.add(plOptions.usesMotionBlur);
+        hasher.add(plOptions.traversableGraphFlags);
+        hasher.add(plOptions.numPayloadValues);
+        hasher.add(plOptions.numAttributeValues);
+        hasher.add(plOptions.exceptionFlags);
+        if (plOptions.pipelineLaunchParamsVariableName)
+            hasher.add(plOptions.pipelineLaunchParamsVariableName, std::strlen(plOptions.pipelineLaunchParamsVariableName));
+        hasher.add(plOptions.usesPrimitiveTypeFlags);
+        int driverVersion;
+        CUDADRV_CHECK(cuDriverGetVersion(&driverVersion));
+        hasher.add(driverVersion);
+        hasher.add(static_cast<uint32_t>(OPTIX_VERSION));
+
+        return hasher.value;
+    }
+
+    OptixModule Pipeline::Priv::compileModule(const std::string &ptxString,
+                                              const OptixModuleCompileOptions &moduleOptions,
+                                              const OptixPipelineCompileOptions &pipelineOptions,
+                                              uint64_t cacheKey) const {
+        OptixModule rawModule;
+
+        char log[4096];
+        size_t logSize = sizeof(log);
+        auto tStart = std::chrono::high_resolution_clock::now();
+        OPTIX_CHECK_LOG(optixModuleCreateFromPTX(getRawContext(),
+                                                 &moduleOptions,
+                                                 &pipelineOptions,
+                                                 ptxString.c_str(), ptxString.size(),
+                                                 log, &logSize,
+                                                 &rawModule));
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        float compileTimeInMs = std::chrono::duration<float, std::milli>(tEnd - tStart).count();
+        context->recordModuleCreation(cacheKey, compileTimeInMs);
+
+        return rawModule;
+    }
+
     void Pipeline::Priv::createProgram(const OptixProgramGroupDesc &desc, const OptixProgramGroupOptions &options, OptixProgramGroup* group) {
         char log[4096];
         size_t logSize = sizeof(log);
@@ -2112,6 +6392,112 @@ namespace optixu {
         markDirty();
     }
 
+    uint32_t Pipeline::Priv::materializeReferencedHitGroups() {
+        // JP: シーン中のマテリアルと既定のヒットグループから参照されている遅延ヒットグループのみを生成する。
+        // EN: Materialize only the deferred hit groups referenced from the materials in the scene
+        //     and the default hit groups.
+        std::vector<_ProgramGroup*> groups;
+        for (_ProgramGroup* group : defaultHitGroups) {
+            if (group)
+                groups.push_back(group);
+        }
+        if (scene) {
+            std::vector<const _Material*> mats;
+            scene->collectMaterials(&mats);
+            std::unordered_set<const _Material*> visitedMats;
+            for (const _Material* mat : mats) {
+                if (visitedMats.insert(mat).second)
+                    mat->collectProgramGroups(this, &groups);
+            }
+        }
+
+        uint32_t numMaterialized = 0;
+        for (_ProgramGroup* group : groups) {
+            if (group->materialize())
+                ++numMaterialized;
+        }
+
+        // JP: マテリアルのヘッダーキャッシュはリビジョンの不一致で作り直される。
+        // EN: Header caches of materials are rebuilt by the revision mismatch.
+        if (numMaterialized > 0) {
+            ++defaultHitGroupRevision;
+            hitGroupSbtIsUpToDate = false;
+            markOwnedHitGroupSBTsDirty();
+        }
+
+        return numMaterialized;
+    }
+
+    uint32_t Pipeline::Priv::materializeCallableTable() {
+        return callableTable ? callableTable->materialize() : 0;
+    }
+
+    void Pipeline::Priv::collectLinkedProgramGroups(std::vector<OptixProgramGroup>* groups,
+                                                    std::vector<_ProgramGroup*>* pruned) const {
+        groups->clear();
+        pruned->clear();
+        if (!pruneUnreachablePrograms) {
+            groups->resize(programGroups.size());
+            std::copy(programGroups.cbegin(), programGroups.cend(), groups->begin());
+            return;
+        }
+
+        // JP: レイ生成、例外、レイタイプごとのミス、コーラブルテーブル、既定のヒットグループ、
+        //     そしてシーン中のマテリアルが参照するヒットグループを到達可能とみなす。
+        // EN: Regard as reachable the ray generation, exception, miss per ray type, the callable table,
+        //     the default hit groups and hit groups referenced by materials in the scene.
+        std::unordered_set<const _ProgramGroup*> reachable;
+        auto addReachable = [&reachable](const _ProgramGroup* program) {
+            if (program)
+                reachable.insert(program);
+        };
+        addReachable(rayGenProgram);
+        addReachable(exceptionProgram);
+        for (const _ProgramGroup* program : missPrograms)
+            addReachable(program);
+        for (const _ProgramGroup* program : callablePrograms)
+            addReachable(program);
+        if (callableTable)
+            callableTable->collectProgramGroups(&reachable);
+        for (const _ProgramGroup* program : defaultHitGroups)
+            addReachable(program);
+        if (scene) {
+            std::vector<const _Material*> mats;
+            scene->collectMaterials(&mats);
+            std::vector<_ProgramGroup*> hitGroups;
+            std::unordered_set<const _Material*> visitedMats;
+            for (const _Material* mat : mats) {
+                if (visitedMats.insert(mat).second)
+                    mat->collectProgramGroups(this, &hitGroups);
+            }
+            for (const _ProgramGroup* program : hitGroups)
+                addReachable(program);
+        }
+
+        for (_ProgramGroup* program : registeredPrograms) {
+            if (!program->isMaterialized())
+                continue;
+            if (reachable.count(program))
+                groups->push_back(program->getRawProgramGroup());
+            else
+                pruned->push_back(program);
+        }
+    }
+
+    void Pipeline::Priv::createRawPipeline(const std::vector<OptixProgramGroup> &groups) {
+        char log[4096];
+        size_t logSize = sizeof(log);
+        OPTIX_CHECK_LOG(optixPipelineCreate(getRawContext(),
+                                            &pipelineCompileOptions,
+                                            &linkOptions,
+                                            groups.data(), static_cast<uint32_t>(groups.size()),
+                                            log, &logSize,
+                                            &rawPipeline));
+
+        linkedProgramGroups = std::unordered_set<OptixProgramGroup>(groups.cbegin(), groups.cend());
+        pipelineLinked = true;
+    }
+
     void Pipeline::Priv::setupShaderBindingTable(CUstream stream) {
         if (!sbtIsUpToDate) {
             throwRuntimeError(rayGenProgram, "Ray generation program is not set.");
@@ -2125,7 +6511,13 @@ namespace optixu {
 
             size_t rayGenRecordOffset = offset;
             rayGenProgram->packHeader(records + offset);
-            offset += OPTIX_SBT_RECORD_HEADER_SIZE;
+            if (rayGenUserDataSizeAlign.size > 0) {
+                uint32_t dataOffset;
+                SizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT).add(
+                    rayGenUserDataSizeAlign, &dataOffset);
+                std::memcpy(records + offset + dataOffset, rayGenUserData.data(), rayGenUserDataSizeAlign.size);
+            }
+            offset += calcRayGenRecordSize();
 
             size_t exceptionRecordOffset = offset;
             if (exceptionProgram)
@@ -2133,9 +6525,17 @@ namespace optixu {
             offset += OPTIX_SBT_RECORD_HEADER_SIZE;
 
             CUdeviceptr missRecordOffset = offset;
+            uint32_t missRecordStride = calcMissRecordStride();
             for (uint32_t i = 0; i < numMissRayTypes; ++i) {
                 missPrograms[i]->packHeader(records + offset);
-                offset += OPTIX_SBT_RECORD_HEADER_SIZE;
+                const SizeAlign &userDataSizeAlign = missUserDataSizeAligns[i];
+                if (userDataSizeAlign.size > 0) {
+                    uint32_t dataOffset;
+                    SizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT).add(
+                        userDataSizeAlign, &dataOffset);
+                    std::memcpy(records + offset + dataOffset, missUserData[i].data(), userDataSizeAlign.size);
+                }
+                offset += missRecordStride;
             }
 
             CUdeviceptr callableRecordOffset = offset;
@@ -2144,13 +6544,13 @@ namespace optixu {
                 offset += OPTIX_SBT_RECORD_HEADER_SIZE;
             }
 
-            CUDADRV_CHECK(cuMemcpyHtoDAsync(sbt.getCUdeviceptr(), sbtHostMem, sbt.sizeInBytes(), stream));
+            upload(stream, sbt.getCUdeviceptr(), sbtHostMem, sbt.sizeInBytes());
 
             CUdeviceptr baseAddress = sbt.getCUdeviceptr();
             sbtParams.raygenRecord = baseAddress + rayGenRecordOffset;
             sbtParams.exceptionRecord = exceptionProgram ? baseAddress + exceptionRecordOffset : 0;
             sbtParams.missRecordBase = baseAddress + missRecordOffset;
-            sbtParams.missRecordStrideInBytes = OPTIX_SBT_RECORD_HEADER_SIZE;
+            sbtParams.missRecordStrideInBytes = missRecordStride;
             sbtParams.missRecordCount = numMissRayTypes;
             sbtParams.callablesRecordBase = numCallablePrograms ? baseAddress + callableRecordOffset : 0;
             sbtParams.callablesRecordStrideInBytes = OPTIX_SBT_RECORD_HEADER_SIZE;
@@ -2159,15 +6559,33 @@ namespace optixu {
             sbtIsUpToDate = true;
         }
 
-        if (!hitGroupSbtIsUpToDate) {
-            scene->setupHitGroupSBT(stream, this, hitGroupSbt, hitGroupSbtHostMem);
+        // JP: テーブルのコーラブルの範囲はメインのSBTとは独立に変更のあったレコードだけを転送する。
+        // EN: The callable range of the table transfers only changed records independently of the main SBT.
+        if (callableTable)
+            callableTable->setup(stream, &sbtParams);
 
-            sbtParams.hitgroupRecordBase = hitGroupSbt.getCUdeviceptr();
-            sbtParams.hitgroupRecordStrideInBytes = scene->getSingleRecordSize();
-            sbtParams.hitgroupRecordCount = static_cast<uint32_t>(hitGroupSbt.sizeInBytes() / scene->getSingleRecordSize());
+        uint64_t latestStamp = context->getLatestSBTRecordStamp();
+        if (!hitGroupSbtIsUpToDate ||
+            hitGroupSbtLayoutGeneration != scene->getSBTLayoutGeneration()) {
+            scene->setupHitGroupSBT(stream, this, hitGroupSbt, hitGroupSbtHostMem);
 
+            hitGroupSbtStamp = latestStamp;
+            hitGroupSbtLayoutGeneration = scene->getSBTLayoutGeneration();
             hitGroupSbtIsUpToDate = true;
         }
+        else if (hitGroupSbtStamp != latestStamp) {
+            // JP: ユーザーデータなどの変更のみの場合は変更のあったレコードだけを更新する。
+            // EN: Update only changed records when there are only changes like user data.
+            scene->updateHitGroupSBT(stream, this, hitGroupSbt, hitGroupSbtHostMem, hitGroupSbtStamp);
+            hitGroupSbtStamp = latestStamp;
+        }
+
+        // JP: 所有SBTの場合はローンチごとにリングの別のバッファーを取得するので、再構築の有無に関わらず毎回設定する。
+        // EN: Owned SBTs acquire a different buffer of the ring for each launch,
+        //     so set these every time regardless of whether rebuilt or not.
+        sbtParams.hitgroupRecordBase = hitGroupSbt.getCUdeviceptr();
+        sbtParams.hitgroupRecordStrideInBytes = scene->getSingleRecordSize();
+        sbtParams.hitgroupRecordCount = static_cast<uint32_t>(hitGroupSbt.sizeInBytes() / scene->getSingleRecordSize());
     }
 
     void Pipeline::destroy() {
@@ -2201,6 +6619,7 @@ namespace optixu {
     Module Pipeline::createModuleFromPTXString(const std::string &ptxString, int32_t maxRegisterCount,
                                                OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
                                                OptixModuleCompileBoundValueEntry* boundValues, uint32_t numBoundValues) const {
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::createModuleFromPTXString", m);
         OptixModuleCompileOptions moduleCompileOptions = {};
         moduleCompileOptions.maxRegisterCount = maxRegisterCount;
         moduleCompileOptions.optLevel = optLevel;
@@ -2208,18 +6627,103 @@ namespace optixu {
         moduleCompileOptions.boundValues = boundValues;
         moduleCompileOptions.numBoundValues = numBoundValues;
 
-        OptixModule rawModule;
+        uint64_t cacheKey = m->calcModuleCacheKey(ptxString, moduleCompileOptions);
+        OptixModule rawModule = m->compileModule(ptxString, moduleCompileOptions, m->pipelineCompileOptions, cacheKey);
+
+        return (new _Module(m, rawModule, cacheKey))->getPublicType();
+    }
+
+    Module Pipeline::createModuleFromCUDASource(const std::string &cudaSource,
+                                                const std::vector<std::string> &includeDirs,
+                                                const std::vector<std::string> &defines,
+                                                int32_t maxRegisterCount,
+                                                OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
+                                                OptixModuleCompileBoundValueEntry* boundValues, uint32_t numBoundValues,
+                                                const std::vector<std::string> &extraCompileOptions) const {
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::createModuleFromCUDASource", m);
+        // JP: デバイスのアーキテクチャーもオプションに含まれるのでキャッシュのキーに反映される。
+        // EN: The device architecture is also included in the options, so it is reflected in the cache key.
+        CUdevice device;
+        CUDADRV_CHECK(cuCtxPushCurrent(m->context->getCUcontext()));
+        CUDADRV_CHECK(cuCtxGetDevice(&device));
+        CUDADRV_CHECK(cuCtxPopCurrent(nullptr));
+        int ccMajor, ccMinor;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&ccMajor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(&ccMinor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device));
+
+        std::vector<std::string> options;
+        options.push_back("--gpu-architecture=compute_" + std::to_string(ccMajor * 10 + ccMinor));
+        options.push_back("--std=c++17");
+        options.push_back("--relocatable-device-code=true");
+        options.push_back("--device-as-default-execution-space");
+        if (debugLevel != OPTIX_COMPILE_DEBUG_LEVEL_NONE)
+            options.push_back("--generate-line-info");
+        for (const std::string &dir : includeDirs)
+            options.push_back("-I" + dir);
+        for (const std::string &define : defines)
+            options.push_back("-D" + define);
+        options.insert(options.end(), extraCompileOptions.cbegin(), extraCompileOptions.cend());
+
+        std::string ptxString = m->context->compileCUDASource(cudaSource, options);
+
+        return createModuleFromPTXString(ptxString, maxRegisterCount, optLevel, debugLevel,
+                                         boundValues, numBoundValues);
+    }
+
+    Module Pipeline::createModuleFromPTXStringAsync(const std::string &ptxString, int32_t maxRegisterCount,
+                                                    OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
+                                                    OptixModuleCompileBoundValueEntry* boundValues, uint32_t numBoundValues) const {
+        OptixModuleCompileOptions moduleCompileOptions = {};
+        moduleCompileOptions.maxRegisterCount = maxRegisterCount;
+        moduleCompileOptions.optLevel = optLevel;
+        moduleCompileOptions.debugLevel = debugLevel;
+        moduleCompileOptions.boundValues = boundValues;
+        moduleCompileOptions.numBoundValues = numBoundValues;
 
-        char log[4096];
-        size_t logSize = sizeof(log);
-        OPTIX_CHECK_LOG(optixModuleCreateFromPTX(m->getRawContext(),
-                                                 &moduleCompileOptions,
-                                                 &m->pipelineCompileOptions,
-                                                 ptxString.c_str(), ptxString.size(),
-                                                 log, &logSize,
-                                                 &rawModule));
+        uint64_t cacheKey = m->calcModuleCacheKey(ptxString, moduleCompileOptions);
+
+        // JP: 呼び出し後に引数が破棄されても良いように、PTX、束縛値、パイプラインのコンパイルオプションを複製する。
+        // EN: Duplicate the PTX, bound values and pipeline compile options so that the arguments can be discarded
+        //     after the call.
+        struct CompileTask {
+            std::string ptxString;
+            OptixModuleCompileOptions moduleCompileOptions;
+            std::vector<OptixModuleCompileBoundValueEntry> boundValues;
+            std::vector<std::vector<uint8_t>> boundValueData;
+            OptixPipelineCompileOptions pipelineCompileOptions;
+            std::string launchParamsVariableName;
+        };
+        auto task = std::make_shared<CompileTask>();
+        task->ptxString = ptxString;
+        task->moduleCompileOptions = moduleCompileOptions;
+        task->boundValues.resize(numBoundValues);
+        task->boundValueData.resize(numBoundValues);
+        for (uint32_t i = 0; i < numBoundValues; ++i) {
+            const OptixModuleCompileBoundValueEntry &entry = boundValues[i];
+            auto data = reinterpret_cast<const uint8_t*>(entry.boundValuePtr);
+            task->boundValueData[i].assign(data, data + entry.sizeInBytes);
+            task->boundValues[i] = entry;
+            task->boundValues[i].boundValuePtr = task->boundValueData[i].data();
+        }
+        task->moduleCompileOptions.boundValues = task->boundValues.data();
+        task->moduleCompileOptions.numBoundValues = numBoundValues;
+        task->pipelineCompileOptions = m->pipelineCompileOptions;
+        if (m->pipelineCompileOptions.pipelineLaunchParamsVariableName) {
+            task->launchParamsVariableName = m->pipelineCompileOptions.pipelineLaunchParamsVariableName;
+            task->pipelineCompileOptions.pipelineLaunchParamsVariableName = task->launchParamsVariableName.c_str();
+        }
 
-        return (new _Module(m, rawModule))->getPublicType();
+        // JP: OptiX 7.3にはタスクベースのモジュール生成が無いため、1モジュールを1ワーカーでコンパイルする。
+        // EN: Compile one module per worker since OptiX 7.3 doesn't have task-based module creation.
+        const _Pipeline* pipeline = m;
+        std::future<OptixModule> pendingModule = std::async(
+            std::launch::async,
+            [pipeline, task, cacheKey]() {
+                return pipeline->compileModule(task->ptxString, task->moduleCompileOptions,
+                                               task->pipelineCompileOptions, cacheKey);
+            });
+
+        return (new _Module(m, std::move(pendingModule), cacheKey))->getPublicType();
     }
 
     ProgramGroup Pipeline::createRayGenProgram(Module module, const char* entryFunctionName) const {
@@ -2324,7 +6828,7 @@ namespace optixu {
         OptixProgramGroup group;
         m->createProgram(desc, options, &group);
 
-        return (new _ProgramGroup(m, group))->getPublicType();
+        return (new _ProgramGroup(m, group, entryFunctionNameAH != nullptr))->getPublicType();
     }
 
     ProgramGroup Pipeline::createHitProgramGroupForCustomIS(Module module_CH, const char* entryFunctionNameCH,
@@ -2371,7 +6875,43 @@ namespace optixu {
         OptixProgramGroup group;
         m->createProgram(desc, options, &group);
 
-        return (new _ProgramGroup(m, group))->getPublicType();
+        return (new _ProgramGroup(m, group, entryFunctionNameAH != nullptr))->getPublicType();
+    }
+
+    ProgramGroup Pipeline::createDeferredHitProgramGroup(const std::string &ptxString, int32_t maxRegisterCount,
+                                                         OptixCompileOptimizationLevel optLevel,
+                                                         OptixCompileDebugLevel debugLevel,
+                                                         OptixPrimitiveType primType,
+                                                         const char* entryFunctionNameCH,
+                                                         const char* entryFunctionNameAH,
+                                                         Module module_IS, const char* entryFunctionNameIS) const {
+        _Module* _module_IS = extract(module_IS);
+        m->throwRuntimeError(entryFunctionNameCH || entryFunctionNameAH,
+                             "Either of CH/AH entry function name must be provided.");
+        if (primType == OPTIX_PRIMITIVE_TYPE_CUSTOM) {
+            m->throwRuntimeError(_module_IS != nullptr && entryFunctionNameIS != nullptr,
+                                 "Intersection program must be provided for custom primitives.");
+            m->throwRuntimeError(_module_IS->getPipeline() == m,
+                                 "Pipeline mismatch for the given IS module %s.",
+                                 _module_IS->getName().c_str());
+        }
+
+        auto desc = std::make_unique<_ProgramGroup::DeferredDesc>();
+        desc->ptxString = ptxString;
+        desc->moduleCompileOptions = {};
+        desc->moduleCompileOptions.maxRegisterCount = maxRegisterCount;
+        desc->moduleCompileOptions.optLevel = optLevel;
+        desc->moduleCompileOptions.debugLevel = debugLevel;
+        desc->primType = primType;
+        if (entryFunctionNameCH)
+            desc->entryFunctionNameCH = entryFunctionNameCH;
+        if (entryFunctionNameAH)
+            desc->entryFunctionNameAH = entryFunctionNameAH;
+        desc->module_IS = primType == OPTIX_PRIMITIVE_TYPE_CUSTOM ? _module_IS : nullptr;
+        if (primType == OPTIX_PRIMITIVE_TYPE_CUSTOM)
+            desc->entryFunctionNameIS = entryFunctionNameIS;
+
+        return (new _ProgramGroup(m, std::move(desc)))->getPublicType();
     }
 
     ProgramGroup Pipeline::createEmptyHitProgramGroup() const {
@@ -2423,51 +6963,139 @@ namespace optixu {
         return (new _ProgramGroup(m, group))->getPublicType();
     }
 
-    void Pipeline::link(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel) const {
-        m->throwRuntimeError(!m->pipelineLinked, "This pipeline has been already linked.");
+    CallableProgramTable Pipeline::createCallableProgramTable() const {
+        return (new _CallableProgramTable(m))->getPublicType();
+    }
+
+    void Pipeline::link(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel,
+                        bool pruneUnreachablePrograms) const {
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::link", m);
+        m->throwRuntimeError(!m->pipelineLinked && !m->pipelineLinking, "This pipeline has been already linked.");
 
         OptixPipelineLinkOptions pipelineLinkOptions = {};
         pipelineLinkOptions.maxTraceDepth = maxTraceDepth;
         pipelineLinkOptions.debugLevel = debugLevel;
+        m->linkOptions = pipelineLinkOptions;
+        m->pruneUnreachablePrograms = pruneUnreachablePrograms;
+
+        m->materializeReferencedHitGroups();
+        m->materializeCallableTable();
 
         std::vector<OptixProgramGroup> groups;
-        groups.resize(m->programGroups.size());
-        std::copy(m->programGroups.cbegin(), m->programGroups.cend(), groups.begin());
+        m->collectLinkedProgramGroups(&groups, &m->prunedPrograms);
 
-        char log[4096];
-        size_t logSize = sizeof(log);
-        OPTIX_CHECK_LOG(optixPipelineCreate(m->getRawContext(),
-                                            &m->pipelineCompileOptions,
-                                            &pipelineLinkOptions,
-                                            groups.data(), static_cast<uint32_t>(groups.size()),
-                                            log, &logSize,
-                                            &m->rawPipeline));
+        m->createRawPipeline(groups);
+    }
+
+    void Pipeline::linkAsync(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel,
+                             bool pruneUnreachablePrograms) const {
+        m->throwRuntimeError(!m->pipelineLinked && !m->pipelineLinking, "This pipeline has been already linked.");
+
+        OptixPipelineLinkOptions pipelineLinkOptions = {};
+        pipelineLinkOptions.maxTraceDepth = maxTraceDepth;
+        pipelineLinkOptions.debugLevel = debugLevel;
+        m->linkOptions = pipelineLinkOptions;
+        m->pruneUnreachablePrograms = pruneUnreachablePrograms;
+
+        // JP: 遅延ヒットグループのコンパイルと到達可能性の判定は呼び出しスレッドで行う。
+        // EN: Compiling deferred hit groups and determining reachability are done on the calling thread.
+        m->materializeReferencedHitGroups();
+        m->materializeCallableTable();
+
+        std::vector<OptixProgramGroup> groups;
+        m->collectLinkedProgramGroups(&groups, &m->prunedPrograms);
+        m->linkedProgramGroups = std::unordered_set<OptixProgramGroup>(groups.cbegin(), groups.cend());
+
+        // JP: パイプラインのコンパイルオプションはリンク完了までPrivが保持し続ける。
+        // EN: Priv keeps holding the pipeline compile options until the link completes.
+        const _Pipeline* pipeline = m;
+        m->pendingRawPipeline = std::async(
+            std::launch::async,
+            [pipeline, pipelineLinkOptions, groups]() {
+                OptixPipeline rawPipeline;
+
+                char log[4096];
+                size_t logSize = sizeof(log);
+                OPTIX_CHECK_LOG(optixPipelineCreate(pipeline->getRawContext(),
+                                                    &pipeline->pipelineCompileOptions,
+                                                    &pipelineLinkOptions,
+                                                    groups.data(), static_cast<uint32_t>(groups.size()),
+                                                    log, &logSize,
+                                                    &rawPipeline));
+
+                return rawPipeline;
+            });
+        m->pipelineLinking = true;
+    }
+
+    bool Pipeline::isLinked() const {
+        return m->resolvePendingLink(false);
+    }
+
+    bool Pipeline::updateDeferredHitGroups() const {
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::updateDeferredHitGroups", m);
+        m->throwRuntimeError(m->resolvePendingLink(true), "This pipeline has not been linked yet.");
+
+        uint32_t numMaterialized = m->materializeReferencedHitGroups();
+        numMaterialized += m->materializeCallableTable();
+
+        // JP: 除外していたプログラムグループが到達可能になった場合も再リンクする。
+        // EN: Also re-link when a program group having been pruned becomes reachable.
+        std::vector<OptixProgramGroup> groups;
+        std::vector<_ProgramGroup*> pruned;
+        m->collectLinkedProgramGroups(&groups, &pruned);
+        bool needsRelink = numMaterialized > 0;
+        for (OptixProgramGroup group : groups) {
+            if (m->linkedProgramGroups.count(group) == 0) {
+                needsRelink = true;
+                break;
+            }
+        }
+        if (!needsRelink)
+            return false;
+
+        // JP: 同じオプションでパイプラインを作り直す。
+        // EN: Recreate the pipeline with the same options.
+        m->markDirty();
+        m->prunedPrograms = std::move(pruned);
+        m->createRawPipeline(groups);
 
-        m->pipelineLinked = true;
+        return true;
+    }
+
+    void Pipeline::getPrunedProgramGroups(std::vector<ProgramGroup>* groups) const {
+        groups->clear();
+        for (_ProgramGroup* program : m->prunedPrograms)
+            groups->push_back(program->getPublicType());
     }
 
     void Pipeline::setNumMissRayTypes(uint32_t numMissRayTypes) const {
         m->numMissRayTypes = numMissRayTypes;
         m->missPrograms.resize(m->numMissRayTypes);
+        m->missUserDataSizeAligns.resize(m->numMissRayTypes);
+        m->missUserData.resize(m->numMissRayTypes);
         m->sbtLayoutIsUpToDate = false;
     }
 
     void Pipeline::setNumCallablePrograms(uint32_t numCallablePrograms) const {
+        m->throwRuntimeError(!m->callableTable || numCallablePrograms == 0,
+                             "The fixed callable table cannot be used together with a callable program table.");
         m->numCallablePrograms = numCallablePrograms;
         m->callablePrograms.resize(m->numCallablePrograms);
         m->sbtLayoutIsUpToDate = false;
     }
 
     void Pipeline::generateShaderBindingTableLayout(size_t* memorySize) const {
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::generateShaderBindingTableLayout", m);
         if (m->sbtLayoutIsUpToDate) {
             *memorySize = m->sbtSize;
             return;
         }
 
         m->sbtSize = 0;
-        m->sbtSize += OPTIX_SBT_RECORD_HEADER_SIZE; // RayGen
+        m->sbtSize += m->calcRayGenRecordSize(); // RayGen
         m->sbtSize += OPTIX_SBT_RECORD_HEADER_SIZE; // Exception
-        m->sbtSize += OPTIX_SBT_RECORD_HEADER_SIZE * m->numMissRayTypes; // Miss
+        m->sbtSize += m->calcMissRecordStride() * m->numMissRayTypes; // Miss
         m->sbtSize += OPTIX_SBT_RECORD_HEADER_SIZE * m->numCallablePrograms; // Callable
         m->sbtLayoutIsUpToDate = true;
 
@@ -2490,118 +7118,640 @@ namespace optixu {
         m->throwRuntimeError(_program->getPipeline() == m, "Pipeline mismatch for the given program %s.",
                              _program->getName().c_str());
 
-        m->exceptionProgram = _program;
-        m->sbtIsUpToDate = false;
+        m->exceptionProgram = _program;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setMissProgram(uint32_t rayType, ProgramGroup program) const {
+        _ProgramGroup* _program = extract(program);
+        m->throwRuntimeError(rayType < m->numMissRayTypes, "Invalid ray type.");
+        m->throwRuntimeError(_program, "Invalid program %p.", _program);
+        m->throwRuntimeError(_program->getPipeline() == m, "Pipeline mismatch for the given program %s.",
+                             _program->getName().c_str());
+
+        m->missPrograms[rayType] = _program;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setRayGenerationUserData(const void* data, uint32_t size, uint32_t alignment) const {
+        m->throwRuntimeError(size <= s_maxProgramRecordUserDataSize,
+                             "Maximum user data size for a ray generation record is %u bytes.",
+                             s_maxProgramRecordUserDataSize);
+        m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
+                             "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
+        uint32_t prevRecordSize = m->calcRayGenRecordSize();
+        m->rayGenUserDataSizeAlign = SizeAlign(size, alignment);
+        m->rayGenUserData.resize(size);
+        std::memcpy(m->rayGenUserData.data(), data, size);
+        if (m->calcRayGenRecordSize() != prevRecordSize)
+            m->sbtLayoutIsUpToDate = false;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setMissUserData(uint32_t rayType, const void* data, uint32_t size, uint32_t alignment) const {
+        m->throwRuntimeError(rayType < m->numMissRayTypes, "Invalid ray type.");
+        m->throwRuntimeError(size <= s_maxProgramRecordUserDataSize,
+                             "Maximum user data size for a miss record is %u bytes.",
+                             s_maxProgramRecordUserDataSize);
+        m->throwRuntimeError(alignment > 0 && alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
+                             "Valid alignment range is [1, %u].", OPTIX_SBT_RECORD_ALIGNMENT);
+        uint32_t prevStride = m->calcMissRecordStride();
+        m->missUserDataSizeAligns[rayType] = SizeAlign(size, alignment);
+        m->missUserData[rayType].resize(size);
+        std::memcpy(m->missUserData[rayType].data(), data, size);
+        if (m->calcMissRecordStride() != prevStride)
+            m->sbtLayoutIsUpToDate = false;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setDefaultHitGroup(uint32_t rayType, ProgramGroup hitGroup) const {
+        _ProgramGroup* _hitGroup = extract(hitGroup);
+        if (_hitGroup)
+            m->throwRuntimeError(_hitGroup->getPipeline() == m, "Pipeline mismatch for the given hit group %s.",
+                                 _hitGroup->getName().c_str());
+        m->setDefaultHitGroup(rayType, _hitGroup);
+    }
+
+    void Pipeline::setVisibilityRayType(uint32_t rayType) const {
+        m->throwRuntimeError(!m->pipelineLinked && !m->pipelineLinking,
+                             "Visibility ray type must be set before linking.");
+        m->throwRuntimeError(rayType < m->numMissRayTypes, "Invalid ray type.");
+        m->throwRuntimeError(m->pipelineCompileOptions.numPayloadValues >= 1,
+                             "Visibility rays require at least one payload value.");
+
+        if (!m->visibilityModule) {
+            m->visibilityModule = extract(createModuleFromPTXString(
+                visibilityMissPTX, OPTIX_COMPILE_DEFAULT_MAX_REGISTER_COUNT,
+                OPTIX_COMPILE_OPTIMIZATION_DEFAULT, OPTIX_COMPILE_DEBUG_LEVEL_NONE));
+            m->visibilityMissProgram = extract(createMissProgram(
+                m->visibilityModule->getPublicType(), "__miss__optixu_visibility"));
+            m->visibilityHitGroup = extract(createEmptyHitProgramGroup());
+        }
+
+        m->missPrograms[rayType] = m->visibilityMissProgram;
+        m->sbtIsUpToDate = false;
+        m->setDefaultHitGroup(rayType, m->visibilityHitGroup);
+    }
+
+    void Pipeline::setCallableProgram(uint32_t index, ProgramGroup program) const {
+        _ProgramGroup* _program = extract(program);
+        m->throwRuntimeError(index < m->numCallablePrograms, "Invalid callable program index.");
+        m->throwRuntimeError(_program, "Invalid program %p.", _program);
+        m->throwRuntimeError(_program->getPipeline() == m, "Pipeline mismatch for the given program group %s.",
+                             _program->getName().c_str());
+
+        m->callablePrograms[index] = _program;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const {
+        m->throwRuntimeError(shaderBindingTable.sizeInBytes() >= m->sbtSize,
+                             "Hit group shader binding table size is not enough.");
+        m->throwRuntimeError(hostMem, "Host-side SBT counterpart must be provided.");
+        m->sbt = shaderBindingTable;
+        m->sbtHostMem = hostMem;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setCallableProgramTable(CallableProgramTable table) const {
+        _CallableProgramTable* _table = extract(table);
+        if (_table) {
+            m->throwRuntimeError(_table->getPipeline() == m, "Pipeline mismatch for the given callable program table %s.",
+                                 _table->getName().c_str());
+            m->throwRuntimeError(m->numCallablePrograms == 0,
+                                 "A callable program table cannot be used together with the fixed callable table.");
+        }
+
+        m->callableTable = _table;
+        m->sbtIsUpToDate = false;
+    }
+
+    void Pipeline::setScene(const Scene &scene) const {
+        m->scene = extract(scene);
+        m->validatedScene = nullptr;
+        if (!m->ownsHitGroupSBTs())
+            m->hitGroupSbt = BufferView();
+        m->hitGroupSbtIsUpToDate = false;
+        m->markOwnedHitGroupSBTsDirty();
+    }
+
+    void Pipeline::setHitGroupShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const {
+        m->throwRuntimeError(hostMem, "Host-side hit group SBT counterpart must be provided.");
+        if (m->ownsHitGroupSBTs())
+            m->setNumOwnedHitGroupSBTs(0);
+        m->hitGroupSbt = shaderBindingTable;
+        m->hitGroupSbtHostMem = hostMem;
+        m->hitGroupSbtIsUpToDate = false;
+    }
+
+    void Pipeline::setNumOwnedHitGroupShaderBindingTables(uint32_t numBuffers) const {
+        m->setNumOwnedHitGroupSBTs(numBuffers);
+    }
+
+    void Pipeline::enablePinnedStaging(bool enable) const {
+        m->setPinnedStagingEnabled(enable);
+    }
+
+    void Pipeline::uploadLaunchParams(CUstream stream, CUdeviceptr plpOnDevice, const void* params) const {
+        m->throwRuntimeError(m->sizeOfPipelineLaunchParams > 0, "Pipeline options have not been set.");
+        m->uploadLaunchParams(stream, plpOnDevice, params);
+    }
+
+    void Pipeline::markHitGroupShaderBindingTableDirty() const {
+        m->hitGroupSbtIsUpToDate = false;
+        m->markOwnedHitGroupSBTsDirty();
+    }
+
+    void Pipeline::setStackSize(uint32_t directCallableStackSizeFromTraversal,
+                                uint32_t directCallableStackSizeFromState,
+                                uint32_t continuationStackSize,
+                                uint32_t maxTraversableGraphDepth) const {
+        m->throwRuntimeError(m->resolvePendingLink(true), "Pipeline has not been linked yet.");
+        if (m->pipelineCompileOptions.traversableGraphFlags & OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING)
+            maxTraversableGraphDepth = 2;
+        else if (m->pipelineCompileOptions.traversableGraphFlags == OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS)
+            maxTraversableGraphDepth = 1;
+        OPTIX_CHECK(optixPipelineSetStackSize(m->rawPipeline,
+                                              directCallableStackSizeFromTraversal,
+                                              directCallableStackSizeFromState,
+                                              continuationStackSize,
+                                              maxTraversableGraphDepth));
+    }
+
+    void Pipeline::computeAndSetStackSize(uint32_t maxTraceDepth, uint32_t maxCCDepth, uint32_t maxDCDepth,
+                                          uint32_t maxTraversableGraphDepth) const {
+        m->throwRuntimeError(m->resolvePendingLink(true), "Pipeline has not been linked yet.");
+        bool depthIsDeterminable =
+            (m->pipelineCompileOptions.traversableGraphFlags & OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING) ||
+            m->pipelineCompileOptions.traversableGraphFlags == OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS;
+        m->throwRuntimeError(depthIsDeterminable || maxTraversableGraphDepth > 0,
+                             "Maximum traversable graph depth must be specified for arbitrary traversable graphs.");
+
+        // JP: 各プログラム種別のスタックサイズの最大値を求める。
+        // EN: Find the maximum stack size for each program kind.
+        OptixStackSizes maxSizes = {};
+        for (OptixProgramGroup group : m->programGroups) {
+            OptixStackSizes sizes;
+            OPTIX_CHECK(optixProgramGroupGetStackSize(group, &sizes));
+            maxSizes.cssRG = std::max(maxSizes.cssRG, sizes.cssRG);
+            maxSizes.cssMS = std::max(maxSizes.cssMS, sizes.cssMS);
+            maxSizes.cssCH = std::max(maxSizes.cssCH, sizes.cssCH);
+            maxSizes.cssAH = std::max(maxSizes.cssAH, sizes.cssAH);
+            maxSizes.cssIS = std::max(maxSizes.cssIS, sizes.cssIS);
+            maxSizes.cssCC = std::max(maxSizes.cssCC, sizes.cssCC);
+            maxSizes.dssDC = std::max(maxSizes.dssDC, sizes.dssDC);
+        }
+
+        // JP: optix_stack_size.hのoptixUtilComputeStackSizes()と同じ計算。
+        // EN: The same computation as optixUtilComputeStackSizes() in optix_stack_size.h.
+        uint32_t cssCCTree = maxCCDepth * maxSizes.cssCC;
+        uint32_t cssCHOrMSPlusCCTree = std::max(maxSizes.cssCH, maxSizes.cssMS) + cssCCTree;
+        uint32_t dcStackSizeFromTraversal = maxDCDepth * maxSizes.dssDC;
+        uint32_t dcStackSizeFromState = maxDCDepth * maxSizes.dssDC;
+        uint32_t continuationStackSize =
+            maxSizes.cssRG + cssCCTree +
+            (std::max(maxTraceDepth, 1u) - 1) * cssCHOrMSPlusCCTree +
+            std::min(maxTraceDepth, 1u) * std::max(cssCHOrMSPlusCCTree, maxSizes.cssIS + maxSizes.cssAH);
+
+        setStackSize(dcStackSizeFromTraversal, dcStackSizeFromState, continuationStackSize,
+                     maxTraversableGraphDepth);
+    }
+
+    void Pipeline::launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const {
+        ProfileScope profileScope(m->context, "optixu::Pipeline::launch", stream);
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::launch", m);
+        m->throwRuntimeError(m->sbtLayoutIsUpToDate, "Shader binding table layout is outdated.");
+        m->throwRuntimeError(m->sbt.isValid(), "Shader binding table is not set.");
+        m->throwRuntimeError(m->sbt.sizeInBytes() >= m->sbtSize, "Shader binding table size is not enough.");
+        m->throwRuntimeError(m->scene, "Scene is not set.");
+        // JP: シーンの検証はGASなどを走査するので、前回の成功から準備状態が失われうる変更が無ければ省略する。
+        // EN: Validating the scene walks GASs and others, so skip it when there has been no change
+        //     that may lose the readiness since the last success.
+        uint64_t sceneEpoch;
+        bool epochIsReliable = m->scene->getReadinessEpoch(&sceneEpoch);
+        if (!epochIsReliable || m->validatedScene != m->scene || m->validatedSceneEpoch != sceneEpoch) {
+            bool hasMotionAS;
+            m->validatedScene = nullptr;
+            m->throwRuntimeError(m->scene->isReady(&hasMotionAS), "Scene is not ready.");
+            m->throwRuntimeError(m->pipelineCompileOptions.usesMotionBlur || !hasMotionAS,
+                                 "Scene has a motion AS but the pipeline has not been configured for motion.");
+            m->validatedScene = m->scene;
+            m->validatedSceneEpoch = sceneEpoch;
+        }
+        m->throwRuntimeError(m->ownsHitGroupSBTs() || m->hitGroupSbt.isValid(),
+                             "Hitgroup shader binding table is not set.");
+        m->throwRuntimeError(m->resolvePendingLink(true), "Pipeline has not been linked yet.");
+        // JP: 所有SBTとピン留めステージングはGPUの使用完了をホストで待つのでキャプチャーと両立しない。
+        // EN: Owned SBTs and pinned staging wait on the host for the GPU to finish using them,
+        //     so they are incompatible with capture.
+        m->throwRuntimeError(!(m->ownsHitGroupSBTs() || m->usePinnedStaging) || !isStreamCapturing(stream),
+                             "Owned hit group SBTs and pinned staging are not allowed during stream capture.");
+
+        if (m->ownsHitGroupSBTs())
+            m->acquireOwnedHitGroupSBT();
+
+        m->setupShaderBindingTable(stream);
+
+        OPTIX_CHECK(optixLaunch(m->rawPipeline, stream, plpOnDevice, m->sizeOfPipelineLaunchParams,
+                                &m->sbtParams, dimX, dimY, dimZ));
+
+        if (m->ownsHitGroupSBTs())
+            m->releaseOwnedHitGroupSBT(stream);
+    }
+
+    void Pipeline::launchBatched(CUstream stream, CUdeviceptr plpOnDevice,
+                                 BatchedLaunchEntry* dispatchTableOnHost, CUdeviceptr dispatchTableOnDevice,
+                                 uint32_t numEntries) const {
+        ProfileScope profileScope(m->context, "optixu::Pipeline::launchBatched", stream);
+        OPTIXU_NVTX_RANGE("optixu::Pipeline::launchBatched", m);
+        m->throwRuntimeError(numEntries > 0 && dispatchTableOnHost && dispatchTableOnDevice,
+                             "Dispatch table must be specified.");
+
+        // JP: OptiXのローンチサイズの上限は2^30。
+        // EN: The upper limit of OptiX's launch size is 2^30.
+        uint64_t numThreads = 0;
+        for (uint32_t i = 0; i < numEntries; ++i) {
+            BatchedLaunchEntry &entry = dispatchTableOnHost[i];
+            m->throwRuntimeError(entry.dimX > 0 && entry.dimY > 0 && entry.dimZ > 0,
+                                 "Launch dimensions of entry %u must be non-zero.", i);
+            entry.threadOffset = static_cast<uint32_t>(numThreads);
+            numThreads += static_cast<uint64_t>(entry.dimX) * entry.dimY * entry.dimZ;
+            m->throwRuntimeError(numThreads <= (1u << 30), "Total launch size exceeds the limit.");
+        }
+
+        m->upload(stream, dispatchTableOnDevice, dispatchTableOnHost, sizeof(BatchedLaunchEntry) * numEntries);
+        launch(stream, plpOnDevice, static_cast<uint32_t>(numThreads), 1, 1);
+    }
+
+
+
+    uint64_t Module::getCacheKey() const {
+        return m->getCacheKey();
+    }
+
+    void Module::destroy() {
+        if (m) {
+            // JP: 非同期生成中の場合は完了を待つ。生成に失敗したモジュールは破棄するものが無い。
+            // EN: Wait for completion when under asynchronous creation. A module failed to be created has nothing to destroy.
+            OptixModule rawModule = nullptr;
+            try {
+                rawModule = m->getRawModule();
+            }
+            catch (const std::exception &) {
+            }
+            if (rawModule)
+                OPTIX_CHECK(optixModuleDestroy(rawModule));
+            delete m;
+        }
+        m = nullptr;
+    }
+
+    bool Module::isCompiled() const {
+        return m->isCompiled();
+    }
+
+
+
+    bool ProgramGroup::Priv::materialize() {
+        if (rawGroup || !deferredDesc)
+            return false;
+
+        const DeferredDesc &desc = *deferredDesc;
+        uint64_t cacheKey = pipeline->calcModuleCacheKey(desc.ptxString, desc.moduleCompileOptions);
+        deferredModule = pipeline->compileModule(desc.ptxString, desc.moduleCompileOptions,
+                                                 pipeline->getPipelineCompileOptions(), cacheKey);
+
+        OptixProgramGroupDesc groupDesc = {};
+        groupDesc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        if (!desc.entryFunctionNameCH.empty()) {
+            groupDesc.hitgroup.moduleCH = deferredModule;
+            groupDesc.hitgroup.entryFunctionNameCH = desc.entryFunctionNameCH.c_str();
+        }
+        if (!desc.entryFunctionNameAH.empty()) {
+            groupDesc.hitgroup.moduleAH = deferredModule;
+            groupDesc.hitgroup.entryFunctionNameAH = desc.entryFunctionNameAH.c_str();
+        }
+        if (desc.primType == OPTIX_PRIMITIVE_TYPE_CUSTOM) {
+            groupDesc.hitgroup.moduleIS = desc.module_IS->getRawModule();
+            groupDesc.hitgroup.entryFunctionNameIS = desc.entryFunctionNameIS.c_str();
+        }
+        else {
+            groupDesc.hitgroup.moduleIS = pipeline->getModuleForBuiltin(desc.primType);
+            groupDesc.hitgroup.entryFunctionNameIS = nullptr;
+        }
+
+        OptixProgramGroupOptions options = {};
+
+        pipeline->createProgram(groupDesc, options, &rawGroup);
+
+        return true;
+    }
+
+    void ProgramGroup::Priv::destroyRawObjects() {
+        if (rawGroup)
+            pipeline->destroyProgram(rawGroup);
+        rawGroup = nullptr;
+        if (deferredModule)
+            OPTIX_CHECK(optixModuleDestroy(deferredModule));
+        deferredModule = nullptr;
+    }
+
+    void ProgramGroup::destroy() {
+        if (m) {
+            m->destroyRawObjects();
+            delete m;
+        }
+        m = nullptr;
+    }
+
+    bool ProgramGroup::isMaterialized() const {
+        return m->isMaterialized();
+    }
+
+    void ProgramGroup::getStackSize(OptixStackSizes* sizes) const {
+        m->throwRuntimeError(m->isMaterialized(), "This deferred hit group has not been materialized.");
+        OPTIX_CHECK(optixProgramGroupGetStackSize(m->rawGroup, sizes));
+    }
+
+
+
+    CallableProgramTable::Priv::~Priv() {
+        pipeline->resetCallableTable(this);
+        for (Entry &entry : entries)
+            releaseEntry(entry);
+        for (_ProgramGroup* program : retiredPrograms)
+            program->getPublicType().destroy();
+        if (recordsOnDevice) {
+            // JP: ローンチ中のレコードを解放しないように同期する。
+            // EN: Synchronize so as not to free records used by in-flight launches.
+            CUDADRV_CHECK(cuCtxSynchronize());
+            CUDADRV_CHECK(cuMemFree(recordsOnDevice));
+        }
+        getContext()->unregisterName(this);
+    }
+
+    void CallableProgramTable::Priv::releaseEntry(Entry &entry) {
+        if (entry.ownsProgram && entry.program)
+            entry.program->getPublicType().destroy();
+        entry.program = nullptr;
+        entry.ownsProgram = false;
+    }
+
+    void CallableProgramTable::Priv::reserve(uint32_t newCapacity) {
+        if (newCapacity <= capacity)
+            return;
+
+        // JP: 拡張の頻度は低いので単純に同期して古いレコードを解放し、次のローンチで全体を転送し直す。
+        // EN: Expansion is infrequent, so simply synchronize to free the old records,
+        //     then transfer the whole range again at the next launch.
+        CUdeviceptr newRecordsOnDevice;
+        CUDADRV_CHECK(cuMemAlloc(&newRecordsOnDevice, OPTIX_SBT_RECORD_HEADER_SIZE * newCapacity));
+        if (recordsOnDevice) {
+            CUDADRV_CHECK(cuCtxSynchronize());
+            CUDADRV_CHECK(cuMemFree(recordsOnDevice));
+        }
+        recordsOnDevice = newRecordsOnDevice;
+        recordsOnHost.resize(OPTIX_SBT_RECORD_HEADER_SIZE * newCapacity);
+        capacity = newCapacity;
+        if (!entries.empty()) {
+            dirtyBegin = 0;
+            dirtyEnd = static_cast<uint32_t>(entries.size());
+        }
+    }
+
+    uint32_t CallableProgramTable::Priv::addEntry(Entry &&entry) {
+        if (entries.size() == capacity)
+            reserve(std::max(2 * capacity, 64u));
+
+        uint32_t index = static_cast<uint32_t>(entries.size());
+        if (!entry.program)
+            ++numPendingEntries;
+        entries.push_back(std::move(entry));
+        markEntryDirty(index);
+
+        return index;
+    }
+
+    void CallableProgramTable::Priv::setProgram(uint32_t index, _ProgramGroup* program) {
+        throwRuntimeError(index < entries.size(), "Invalid callable program index %u.", index);
+        Entry &entry = entries[index];
+        if (entry.ownsProgram && entry.program)
+            retiredPrograms.push_back(entry.program);
+        if (!entry.program)
+            --numPendingEntries;
+
+        entry = Entry{ program, nullptr, "", nullptr, "", false };
+        markEntryDirty(index);
+    }
+
+    uint32_t CallableProgramTable::Priv::materialize() {
+        if (numPendingEntries == 0)
+            return 0;
+
+        Pipeline pipelineObj = pipeline->getPublicType();
+        uint32_t numMaterialized = 0;
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            Entry &entry = entries[i];
+            if (entry.program)
+                continue;
+
+            Module module_DC = entry.module_DC ? entry.module_DC->getPublicType() : Module();
+            Module module_CC = entry.module_CC ? entry.module_CC->getPublicType() : Module();
+            ProgramGroup program = pipelineObj.createCallableProgramGroup(
+                module_DC, entry.module_DC ? entry.entryFunctionNameDC.c_str() : nullptr,
+                module_CC, entry.module_CC ? entry.entryFunctionNameCC.c_str() : nullptr);
+            entry.program = extract(program);
+            entry.ownsProgram = true;
+            markEntryDirty(i);
+            ++numMaterialized;
+        }
+        numPendingEntries = 0;
+
+        return numMaterialized;
+    }
+
+    void CallableProgramTable::Priv::setup(CUstream stream, OptixShaderBindingTable* sbtParams) {
+        if (dirtyBegin < dirtyEnd) {
+            for (uint32_t i = dirtyBegin; i < dirtyEnd; ++i) {
+                const Entry &entry = entries[i];
+                throwRuntimeError(entry.program, "Deferred callable program %u has not been materialized. "
+                                  "Link the pipeline or call updateDeferredHitGroups().", i);
+                entry.program->packHeader(recordsOnHost.data() + OPTIX_SBT_RECORD_HEADER_SIZE * i);
+            }
+            size_t offset = OPTIX_SBT_RECORD_HEADER_SIZE * dirtyBegin;
+            pipeline->upload(stream, recordsOnDevice + offset, recordsOnHost.data() + offset,
+                             OPTIX_SBT_RECORD_HEADER_SIZE * (dirtyEnd - dirtyBegin));
+            dirtyBegin = UINT32_MAX;
+            dirtyEnd = 0;
+        }
+
+        uint32_t numEntries = static_cast<uint32_t>(entries.size());
+        sbtParams->callablesRecordBase = numEntries ? recordsOnDevice : 0;
+        sbtParams->callablesRecordStrideInBytes = OPTIX_SBT_RECORD_HEADER_SIZE;
+        sbtParams->callablesRecordCount = numEntries;
+    }
+
+    void CallableProgramTable::destroy() {
+        if (m)
+            delete m;
+        m = nullptr;
+    }
+
+    void CallableProgramTable::reserve(uint32_t capacity) const {
+        m->reserve(capacity);
+    }
+
+    uint32_t CallableProgramTable::addProgram(ProgramGroup program) const {
+        _ProgramGroup* _program = extract(program);
+        m->throwRuntimeError(_program, "Invalid program %p.", _program);
+        m->throwRuntimeError(_program->getPipeline() == m->getPipeline(),
+                             "Pipeline mismatch for the given program group %s.",
+                             _program->getName().c_str());
+
+        return m->addEntry(_CallableProgramTable::Entry{ _program, nullptr, "", nullptr, "", false });
+    }
+
+    uint32_t CallableProgramTable::addDeferredProgram(Module module_DC, const char* entryFunctionNameDC,
+                                                      Module module_CC, const char* entryFunctionNameCC) const {
+        _Module* _module_DC = extract(module_DC);
+        _Module* _module_CC = extract(module_CC);
+        m->throwRuntimeError((_module_DC != nullptr) == (entryFunctionNameDC != nullptr),
+                             "Either of DC module or entry function name is not provided.");
+        m->throwRuntimeError((_module_CC != nullptr) == (entryFunctionNameCC != nullptr),
+                             "Either of CC module or entry function name is not provided.");
+        m->throwRuntimeError(entryFunctionNameDC || entryFunctionNameCC,
+                             "Either of CC/DC entry function name must be provided.");
+        if (_module_DC)
+            m->throwRuntimeError(_module_DC->getPipeline() == m->getPipeline(),
+                                 "Pipeline mismatch for the given DC module %s.",
+                                 _module_DC->getName().c_str());
+        if (_module_CC)
+            m->throwRuntimeError(_module_CC->getPipeline() == m->getPipeline(),
+                                 "Pipeline mismatch for the given CC module %s.",
+                                 _module_CC->getName().c_str());
+
+        return m->addEntry(_CallableProgramTable::Entry{
+            nullptr,
+            _module_DC, entryFunctionNameDC ? entryFunctionNameDC : "",
+            _module_CC, entryFunctionNameCC ? entryFunctionNameCC : "",
+            false });
     }
 
-    void Pipeline::setMissProgram(uint32_t rayType, ProgramGroup program) const {
+    void CallableProgramTable::setProgram(uint32_t index, ProgramGroup program) const {
         _ProgramGroup* _program = extract(program);
-        m->throwRuntimeError(rayType < m->numMissRayTypes, "Invalid ray type.");
         m->throwRuntimeError(_program, "Invalid program %p.", _program);
-        m->throwRuntimeError(_program->getPipeline() == m, "Pipeline mismatch for the given program %s.",
+        m->throwRuntimeError(_program->getPipeline() == m->getPipeline(),
+                             "Pipeline mismatch for the given program group %s.",
                              _program->getName().c_str());
 
-        m->missPrograms[rayType] = _program;
-        m->sbtIsUpToDate = false;
+        m->setProgram(index, _program);
     }
 
-    void Pipeline::setCallableProgram(uint32_t index, ProgramGroup program) const {
-        _ProgramGroup* _program = extract(program);
-        m->throwRuntimeError(index < m->numCallablePrograms, "Invalid callable program index.");
-        m->throwRuntimeError(_program, "Invalid program %p.", _program);
-        m->throwRuntimeError(_program->getPipeline() == m, "Pipeline mismatch for the given program group %s.",
-                             _program->getName().c_str());
-
-        m->callablePrograms[index] = _program;
-        m->sbtIsUpToDate = false;
+    uint32_t CallableProgramTable::getNumPrograms() const {
+        return m->getNumEntries();
     }
 
-    void Pipeline::setShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const {
-        m->throwRuntimeError(shaderBindingTable.sizeInBytes() >= m->sbtSize,
-                             "Hit group shader binding table size is not enough.");
-        m->throwRuntimeError(hostMem, "Host-side SBT counterpart must be provided.");
-        m->sbt = shaderBindingTable;
-        m->sbtHostMem = hostMem;
-        m->sbtIsUpToDate = false;
+    uint32_t CallableProgramTable::getCapacity() const {
+        return m->getCapacity();
     }
 
-    void Pipeline::setScene(const Scene &scene) const {
-        m->scene = extract(scene);
-        m->hitGroupSbt = BufferView();
-        m->hitGroupSbtIsUpToDate = false;
-    }
 
-    void Pipeline::setHitGroupShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const {
-        m->throwRuntimeError(hostMem, "Host-side hit group SBT counterpart must be provided.");
-        m->hitGroupSbt = shaderBindingTable;
-        m->hitGroupSbtHostMem = hostMem;
-        m->hitGroupSbtIsUpToDate = false;
-    }
 
-    void Pipeline::markHitGroupShaderBindingTableDirty() const {
-        m->hitGroupSbtIsUpToDate = false;
+    void PipelineVariantCache::Priv::setMaxNumVariants(uint32_t num) {
+        throwRuntimeError(num > 0, "The maximum number of variants must be at least one.");
+        maxNumVariants = num;
+        while (variants.size() > maxNumVariants)
+            evictLeastRecentlyUsed();
     }
 
-    void Pipeline::setStackSize(uint32_t directCallableStackSizeFromTraversal,
-                                uint32_t directCallableStackSizeFromState,
-                                uint32_t continuationStackSize,
-                                uint32_t maxTraversableGraphDepth) const {
-        if (m->pipelineCompileOptions.traversableGraphFlags & OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING)
-            maxTraversableGraphDepth = 2;
-        else if (m->pipelineCompileOptions.traversableGraphFlags == OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS)
-            maxTraversableGraphDepth = 1;
-        OPTIX_CHECK(optixPipelineSetStackSize(m->rawPipeline,
-                                              directCallableStackSizeFromTraversal,
-                                              directCallableStackSizeFromState,
-                                              continuationStackSize,
-                                              maxTraversableGraphDepth));
-    }
+    Pipeline PipelineVariantCache::Priv::getPipeline(const OptixModuleCompileBoundValueEntry* boundValues,
+                                                     uint32_t numBoundValues) {
+        throwRuntimeError(boundValues || numBoundValues == 0, "Bound values must be specified.");
 
-    void Pipeline::launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const {
-        m->throwRuntimeError(m->sbtLayoutIsUpToDate, "Shader binding table layout is outdated.");
-        m->throwRuntimeError(m->sbt.isValid(), "Shader binding table is not set.");
-        m->throwRuntimeError(m->sbt.sizeInBytes() >= m->sbtSize, "Shader binding table size is not enough.");
-        m->throwRuntimeError(m->scene, "Scene is not set.");
-        bool hasMotionAS;
-        m->throwRuntimeError(m->scene->isReady(&hasMotionAS), "Scene is not ready.");
-        m->throwRuntimeError(m->pipelineCompileOptions.usesMotionBlur || !hasMotionAS,
-                             "Scene has a motion AS but the pipeline has not been configured for motion.");
-        m->throwRuntimeError(m->hitGroupSbt.isValid(), "Hitgroup shader binding table is not set.");
-        m->throwRuntimeError(m->pipelineLinked, "Pipeline has not been linked yet.");
+        std::vector<uint8_t> key;
+        for (uint32_t i = 0; i < numBoundValues; ++i) {
+            const OptixModuleCompileBoundValueEntry &entry = boundValues[i];
+            auto offset = reinterpret_cast<const uint8_t*>(&entry.pipelineParamOffsetInBytes);
+            auto size = reinterpret_cast<const uint8_t*>(&entry.sizeInBytes);
+            auto data = reinterpret_cast<const uint8_t*>(entry.boundValuePtr);
+            key.insert(key.end(), offset, offset + sizeof(entry.pipelineParamOffsetInBytes));
+            key.insert(key.end(), size, size + sizeof(entry.sizeInBytes));
+            key.insert(key.end(), data, data + entry.sizeInBytes);
+        }
 
-        m->setupShaderBindingTable(stream);
+        auto it = variantMap.find(key);
+        if (it != variantMap.cend()) {
+            ++numHits;
+            variants.splice(variants.begin(), variants, it->second);
+            return it->second->pipeline;
+        }
 
-        OPTIX_CHECK(optixLaunch(m->rawPipeline, stream, plpOnDevice, m->sizeOfPipelineLaunchParams,
-                                &m->sbtParams, dimX, dimY, dimZ));
+        ++numMisses;
+        while (variants.size() >= maxNumVariants)
+            evictLeastRecentlyUsed();
+
+        Pipeline pipeline = context->getPublicType().createPipeline();
+        try {
+            buildFunc(userData, pipeline, boundValues, numBoundValues);
+        }
+        catch (...) {
+            if (destroyFunc)
+                destroyFunc(userData, pipeline);
+            pipeline.destroy();
+            throw;
+        }
+
+        variants.push_front(Variant{ key, pipeline });
+        variantMap[key] = variants.begin();
+
+        return pipeline;
     }
 
+    void PipelineVariantCache::Priv::evictLeastRecentlyUsed() {
+        Variant &variant = variants.back();
+        if (destroyFunc)
+            destroyFunc(userData, variant.pipeline);
+        variant.pipeline.destroy();
+        variantMap.erase(variant.key);
+        variants.pop_back();
+    }
 
+    void PipelineVariantCache::Priv::clear() {
+        while (!variants.empty())
+            evictLeastRecentlyUsed();
+    }
 
-    void Module::destroy() {
-        if (m) {
-            OPTIX_CHECK(optixModuleDestroy(m->rawModule));
+    void PipelineVariantCache::destroy() {
+        if (m)
             delete m;
-        }
         m = nullptr;
     }
 
+    void PipelineVariantCache::setMaxNumVariants(uint32_t maxNumVariants) const {
+        m->setMaxNumVariants(maxNumVariants);
+    }
 
+    Pipeline PipelineVariantCache::getPipeline(const OptixModuleCompileBoundValueEntry* boundValues,
+                                               uint32_t numBoundValues) const {
+        return m->getPipeline(boundValues, numBoundValues);
+    }
 
-    void ProgramGroup::destroy() {
-        if (m) {
-            m->pipeline->destroyProgram(m->rawGroup);
-            delete m;
-        }
-        m = nullptr;
+    void PipelineVariantCache::clear() const {
+        m->clear();
     }
 
-    void ProgramGroup::getStackSize(OptixStackSizes* sizes) const {
-        OPTIX_CHECK(optixProgramGroupGetStackSize(m->rawGroup, sizes));
+    uint32_t PipelineVariantCache::getNumVariants() const {
+        return m->getNumVariants();
+    }
+
+    void PipelineVariantCache::getStatistics(uint32_t* numHits, uint32_t* numMisses) const {
+        m->getStatistics(numHits, numMisses);
     }
 
 
 
     void Denoiser::Priv::invoke(CUstream stream,
+                                const BufferView &_stateBuffer, const BufferView &_scratchBuffer,
                                 bool denoiseAlpha, CUdeviceptr hdrIntensity, CUdeviceptr hdrAverageColor, float blendFactor,
                                 const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
                                 const BufferView* noisyAovs, OptixPixelFormat* aovFormats, uint32_t numAovs,
@@ -2613,7 +7763,10 @@ namespace optixu {
                                 const BufferView &denoisedBeauty,
                                 const BufferView* denoisedAovs,
                                 const DenoisingTask &task) const {
-        throwRuntimeError(stateIsReady, "You need to call setupState() before invoke.");
+        ProfileScope profileScope(context, "optixu::Denoiser::invoke", stream);
+        OPTIXU_NVTX_RANGE("optixu::Denoiser::invoke", this);
+
+        throwRuntimeError(_stateBuffer.isValid(), "You need to call setupState() before invoke.");
         throwRuntimeError(noisyBeauty.isValid(), "Input noisy beauty buffer must be provided.");
         throwRuntimeError(denoisedBeauty.isValid(), "Denoised beauty buffer must be provided.");
         throwRuntimeError(numAovs == 0 || (noisyAovs && denoisedAovs), "Both of noisy/denoised AOV buffers must be provided.");
@@ -2628,6 +7781,25 @@ namespace optixu {
         if (modelKind == OPTIX_DENOISER_MODEL_KIND_TEMPORAL)
             throwRuntimeError(flow.isValid() && previousDenoisedBeauty.isValid(),
                               "Denoiser requires flow buffer and the previous denoised beauty buffer.");
+        const auto checkBufferSize = [&](const BufferView &buffer, OptixPixelFormat format, const char* name) {
+            size_t requiredSize = static_cast<size_t>(imageWidth) * imageHeight * getPixelSize(format);
+            throwRuntimeError(buffer.sizeInBytes() >= requiredSize,
+                              "Size of %s buffer is not enough for the pixel format.", name);
+        };
+        checkBufferSize(noisyBeauty, beautyFormat, "noisy beauty");
+        checkBufferSize(denoisedBeauty, beautyFormat, "denoised beauty");
+        for (uint32_t i = 0; i < numAovs; ++i) {
+            checkBufferSize(noisyAovs[i], aovFormats[i], "noisy AOV");
+            checkBufferSize(denoisedAovs[i], aovFormats[i], "denoised AOV");
+        }
+        if (guideAlbedo)
+            checkBufferSize(albedo, albedoFormat, "albedo");
+        if (guideNormal)
+            checkBufferSize(normal, normalFormat, "normal");
+        if (modelKind == OPTIX_DENOISER_MODEL_KIND_TEMPORAL) {
+            checkBufferSize(flow, flowFormat, "flow");
+            checkBufferSize(previousDenoisedBeauty, beautyFormat, "previous denoised beauty");
+        }
         OptixDenoiserParams params = {};
         params.denoiseAlpha = denoiseAlpha;
         params.hdrIntensity = hdrIntensity;
@@ -2698,11 +7870,46 @@ namespace optixu {
         int32_t offsetY = _task.outputOffsetY - _task.inputOffsetY;
         OPTIX_CHECK(optixDenoiserInvoke(rawDenoiser, stream,
                                         &params,
-                                        stateBuffer.getCUdeviceptr(), stateBuffer.sizeInBytes(),
+                                        _stateBuffer.getCUdeviceptr(), _stateBuffer.sizeInBytes(),
                                         &guideLayer,
                                         denoiserLayers.data(), 1 + numAovs,
                                         offsetX, offsetY,
-                                        scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes()));
+                                        _scratchBuffer.getCUdeviceptr(), _scratchBuffer.sizeInBytes()));
+    }
+
+    void Denoiser::Priv::setImageSize(uint32_t width, uint32_t height) {
+        imageWidth = width;
+        imageHeight = height;
+        tileWidth = std::min(preparedTileWidth, width);
+        tileHeight = std::min(preparedTileHeight, height);
+        maxInputWidth = std::min(tileWidth + 2 * overlapWidth, imageWidth);
+        maxInputHeight = std::min(tileHeight + 2 * overlapWidth, imageHeight);
+        if (modelKind == OPTIX_DENOISER_MODEL_KIND_AOV)
+            scratchSizeForComputeAverageColor = sizeof(int32_t) * (3 + 3 * imageWidth * imageHeight);
+        else
+            scratchSizeForComputeIntensity = sizeof(int32_t) * (2 + imageWidth * imageHeight);
+    }
+
+    uint32_t Denoiser::Priv::calcNumTasks() const {
+        uint32_t numTasks = 0;
+        for (int32_t outputOffsetY = 0; outputOffsetY < static_cast<int32_t>(imageHeight);) {
+            int32_t outputHeight = tileHeight;
+            if (outputOffsetY == 0)
+                outputHeight += overlapWidth;
+
+            for (int32_t outputOffsetX = 0; outputOffsetX < static_cast<int32_t>(imageWidth);) {
+                int32_t outputWidth = tileWidth;
+                if (outputOffsetX == 0)
+                    outputWidth += overlapWidth;
+
+                ++numTasks;
+
+                outputOffsetX += outputWidth;
+            }
+
+            outputOffsetY += outputHeight;
+        }
+        return numTasks;
     }
 
     void Denoiser::destroy() {
@@ -2724,50 +7931,39 @@ namespace optixu {
 
         m->useTiling = tileWidth < imageWidth || tileHeight < imageHeight;
 
-        m->imageWidth = imageWidth;
-        m->imageHeight = imageHeight;
-        m->tileWidth = tileWidth;
-        m->tileHeight = tileHeight;
+        m->preparedImageWidth = imageWidth;
+        m->preparedImageHeight = imageHeight;
+        m->preparedTileWidth = tileWidth;
+        m->preparedTileHeight = tileHeight;
         OptixDenoiserSizes sizes;
         OPTIX_CHECK(optixDenoiserComputeMemoryResources(m->rawDenoiser, tileWidth, tileHeight, &sizes));
         m->stateSize = sizes.stateSizeInBytes;
         m->scratchSize = m->useTiling ?
             sizes.withOverlapScratchSizeInBytes : sizes.withoutOverlapScratchSizeInBytes;
-        if (m->modelKind == OPTIX_DENOISER_MODEL_KIND_AOV)
-            m->scratchSizeForComputeAverageColor = sizeof(int32_t) * (3 + 3 * m->imageWidth * m->imageHeight);
-        else
-            m->scratchSizeForComputeIntensity = sizeof(int32_t) * (2 + m->imageWidth * m->imageHeight);
         m->overlapWidth = sizes.overlapWindowSizeInPixels;
-        m->maxInputWidth = std::min(tileWidth + 2 * m->overlapWidth, imageWidth);
-        m->maxInputHeight = std::min(tileHeight + 2 * m->overlapWidth, imageHeight);
+        m->setImageSize(imageWidth, imageHeight);
 
         *stateBufferSize = m->stateSize;
         *scratchBufferSize = m->scratchSize;
         *scratchBufferSizeForComputeIntensity = m->scratchSizeForComputeIntensity;
 
-        *numTasks = 0;
-        for (int32_t outputOffsetY = 0; outputOffsetY < static_cast<int32_t>(imageHeight);) {
-            int32_t outputHeight = tileHeight;
-            if (outputOffsetY == 0)
-                outputHeight += m->overlapWidth;
-
-            for (int32_t outputOffsetX = 0; outputOffsetX < static_cast<int32_t>(imageWidth);) {
-                int32_t outputWidth = tileWidth;
-                if (outputOffsetX == 0)
-                    outputWidth += m->overlapWidth;
-
-                ++*numTasks;
-
-                outputOffsetX += outputWidth;
-            }
-
-            outputOffsetY += outputHeight;
-        }
+        *numTasks = m->calcNumTasks();
 
         m->stateIsReady = false;
+        m->concurrentStatesAreReady = false;
         m->imageSizeSet = true;
     }
 
+    void Denoiser::setImageSize(uint32_t imageWidth, uint32_t imageHeight, uint32_t* numTasks) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        m->throwRuntimeError(imageWidth > 0 && imageHeight > 0 &&
+                             imageWidth <= m->preparedImageWidth && imageHeight <= m->preparedImageHeight,
+                             "Image size %ux%u must be equal to or smaller than the prepared size %ux%u.",
+                             imageWidth, imageHeight, m->preparedImageWidth, m->preparedImageHeight);
+        m->setImageSize(imageWidth, imageHeight);
+        *numTasks = m->calcNumTasks();
+    }
+
     void Denoiser::getTasks(DenoisingTask* tasks) const {
         m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
 
@@ -2810,14 +8006,104 @@ namespace optixu {
         }
     }
 
+    size_t Denoiser::getSharedScratchBufferSize() const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        return std::max({ m->scratchSize, m->scratchSizeForComputeIntensity, m->scratchSizeForComputeAverageColor });
+    }
+
+    size_t Denoiser::getImageBufferSize(OptixPixelFormat format) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        return static_cast<size_t>(m->imageWidth) * m->imageHeight * getPixelSize(format);
+    }
+
+    void Denoiser::getTaskInputWindow(const DenoisingTask &task,
+                                      uint32_t* offsetX, uint32_t* offsetY, uint32_t* width, uint32_t* height) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        _DenoisingTask _task(task);
+        *offsetX = _task.inputOffsetX;
+        *offsetY = _task.inputOffsetY;
+        *width = m->maxInputWidth;
+        *height = m->maxInputHeight;
+    }
+
+    void Denoiser::getTaskOutputWindow(const DenoisingTask &task,
+                                       uint32_t* offsetX, uint32_t* offsetY, uint32_t* width, uint32_t* height) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        _DenoisingTask _task(task);
+        *offsetX = _task.outputOffsetX;
+        *offsetY = _task.outputOffsetY;
+        *width = _task.outputWidth;
+        *height = _task.outputHeight;
+    }
+
+    uint32_t Denoiser::getTasksInRegion(uint32_t regionOffsetX, uint32_t regionOffsetY,
+                                        uint32_t regionWidth, uint32_t regionHeight,
+                                        DenoisingTask* tasks) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        if (regionWidth == 0 || regionHeight == 0)
+            return 0;
+
+        std::vector<DenoisingTask> allTasks(m->calcNumTasks());
+        getTasks(allTasks.data());
+        uint64_t regionEndX = static_cast<uint64_t>(regionOffsetX) + regionWidth;
+        uint64_t regionEndY = static_cast<uint64_t>(regionOffsetY) + regionHeight;
+        uint32_t numSelected = 0;
+        for (const DenoisingTask &task : allTasks) {
+            _DenoisingTask _task(task);
+            if (regionOffsetX < static_cast<uint64_t>(_task.inputOffsetX) + m->maxInputWidth &&
+                regionEndX > static_cast<uint64_t>(_task.inputOffsetX) &&
+                regionOffsetY < static_cast<uint64_t>(_task.inputOffsetY) + m->maxInputHeight &&
+                regionEndY > static_cast<uint64_t>(_task.inputOffsetY))
+                tasks[numSelected++] = task;
+        }
+        return numSelected;
+    }
+
+    uint32_t Denoiser::getTasksInTileMask(const uint8_t* tileMask, uint32_t maskTileSize,
+                                          DenoisingTask* tasks) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        m->throwRuntimeError(maskTileSize > 0, "maskTileSize must be greater than 0.");
+        const uint32_t numMaskTilesX = (m->imageWidth + maskTileSize - 1) / maskTileSize;
+        const uint32_t numMaskTilesY = (m->imageHeight + maskTileSize - 1) / maskTileSize;
+
+        std::vector<DenoisingTask> allTasks(m->calcNumTasks());
+        getTasks(allTasks.data());
+        uint32_t numSelected = 0;
+        for (const DenoisingTask &task : allTasks) {
+            _DenoisingTask _task(task);
+            // JP: 入力領域に重なるマスクのタイルの範囲を調べる。
+            // EN: Examine the range of mask tiles overlapping the input region.
+            uint32_t tileBeginX = _task.inputOffsetX / maskTileSize;
+            uint32_t tileBeginY = _task.inputOffsetY / maskTileSize;
+            uint32_t tileEndX = std::min((_task.inputOffsetX + m->maxInputWidth + maskTileSize - 1) / maskTileSize,
+                                         numMaskTilesX);
+            uint32_t tileEndY = std::min((_task.inputOffsetY + m->maxInputHeight + maskTileSize - 1) / maskTileSize,
+                                         numMaskTilesY);
+            bool dirty = false;
+            for (uint32_t ty = tileBeginY; ty < tileEndY && !dirty; ++ty) {
+                const uint8_t* maskRow = tileMask + static_cast<size_t>(ty) * numMaskTilesX;
+                for (uint32_t tx = tileBeginX; tx < tileEndX; ++tx) {
+                    if (maskRow[tx]) {
+                        dirty = true;
+                        break;
+                    }
+                }
+            }
+            if (dirty)
+                tasks[numSelected++] = task;
+        }
+        return numSelected;
+    }
+
     void Denoiser::setupState(CUstream stream, const BufferView &stateBuffer, const BufferView &scratchBuffer) const {
         m->throwRuntimeError(m->imageSizeSet, "Call setImageSizes() before this function.");
         m->throwRuntimeError(stateBuffer.sizeInBytes() >= m->stateSize,
                              "Size of the given state buffer is not enough.");
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->scratchSize,
                              "Size of the given scratch buffer is not enough.");
-        uint32_t maxInputWidth = m->useTiling ? (m->tileWidth + 2 * m->overlapWidth) : m->imageWidth;
-        uint32_t maxInputHeight = m->useTiling ? (m->tileHeight + 2 * m->overlapWidth) : m->imageHeight;
+        uint32_t maxInputWidth;
+        uint32_t maxInputHeight;
+        m->getMaxInputSize(&maxInputWidth, &maxInputHeight);
         OPTIX_CHECK(optixDenoiserSetup(m->rawDenoiser, stream,
                                        maxInputWidth, maxInputHeight,
                                        stateBuffer.getCUdeviceptr(), stateBuffer.sizeInBytes(),
@@ -2828,9 +8114,37 @@ namespace optixu {
         m->stateIsReady = true;
     }
 
+    void Denoiser::setupConcurrentStates(CUstream stream,
+                                         const BufferView* stateBuffers, const BufferView* scratchBuffers,
+                                         uint32_t numSlots) const {
+        m->throwRuntimeError(m->imageSizeSet, "Call prepare() before this function.");
+        m->throwRuntimeError(numSlots > 0 && stateBuffers && scratchBuffers, "Buffers must be provided.");
+        uint32_t maxInputWidth;
+        uint32_t maxInputHeight;
+        m->getMaxInputSize(&maxInputWidth, &maxInputHeight);
+        for (uint32_t slotIdx = 0; slotIdx < numSlots; ++slotIdx) {
+            const BufferView &stateBuffer = stateBuffers[slotIdx];
+            const BufferView &scratchBuffer = scratchBuffers[slotIdx];
+            m->throwRuntimeError(stateBuffer.sizeInBytes() >= m->stateSize,
+                                 "Size of the state buffer %u is not enough.", slotIdx);
+            m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->scratchSize,
+                                 "Size of the scratch buffer %u is not enough.", slotIdx);
+            OPTIX_CHECK(optixDenoiserSetup(m->rawDenoiser, stream,
+                                           maxInputWidth, maxInputHeight,
+                                           stateBuffer.getCUdeviceptr(), stateBuffer.sizeInBytes(),
+                                           scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes()));
+        }
+
+        m->concurrentStateBuffers.assign(stateBuffers, stateBuffers + numSlots);
+        m->concurrentScratchBuffers.assign(scratchBuffers, scratchBuffers + numSlots);
+        m->concurrentStatesAreReady = true;
+    }
+
     void Denoiser::computeIntensity(CUstream stream,
                                     const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
                                     const BufferView &scratchBuffer, CUdeviceptr outputIntensity) const {
+        ProfileScope profileScope(m->context, "optixu::Denoiser::computeIntensity", stream);
+        OPTIXU_NVTX_RANGE("optixu::Denoiser::computeIntensity", m);
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->scratchSizeForComputeIntensity,
                              "Size of the given scratch buffer is not enough.");
 
@@ -2851,6 +8165,8 @@ namespace optixu {
     void Denoiser::computeAverageColor(CUstream stream,
                                        const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
                                        const BufferView &scratchBuffer, CUdeviceptr outputAverageColor) const {
+        ProfileScope profileScope(m->context, "optixu::Denoiser::computeAverageColor", stream);
+        OPTIXU_NVTX_RANGE("optixu::Denoiser::computeAverageColor", m);
         m->throwRuntimeError(scratchBuffer.sizeInBytes() >= m->scratchSizeForComputeAverageColor,
                              "Size of the given scratch buffer is not enough.");
 
@@ -2868,6 +8184,26 @@ namespace optixu {
             scratchBuffer.getCUdeviceptr(), scratchBuffer.sizeInBytes()));
     }
 
+    void Denoiser::computeIntensity(CUstream stream,
+                                    const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                                    CUdeviceptr outputIntensity) const {
+        m->throwRuntimeError(m->stateIsReady, "You need to call setupState() before this function.");
+        m->throwRuntimeError(m->scratchBuffer.sizeInBytes() >= m->scratchSizeForComputeIntensity,
+                             "Size of the scratch buffer given to setupState() is not enough. "
+                             "Use getSharedScratchBufferSize() to allocate it.");
+        computeIntensity(stream, noisyBeauty, beautyFormat, m->scratchBuffer, outputIntensity);
+    }
+
+    void Denoiser::computeAverageColor(CUstream stream,
+                                       const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                                       CUdeviceptr outputAverageColor) const {
+        m->throwRuntimeError(m->stateIsReady, "You need to call setupState() before this function.");
+        m->throwRuntimeError(m->scratchBuffer.sizeInBytes() >= m->scratchSizeForComputeAverageColor,
+                             "Size of the scratch buffer given to setupState() is not enough. "
+                             "Use getSharedScratchBufferSize() to allocate it.");
+        computeAverageColor(stream, noisyBeauty, beautyFormat, m->scratchBuffer, outputAverageColor);
+    }
+
     void Denoiser::invoke(CUstream stream,
                           bool denoiseAlpha, CUdeviceptr hdrIntensity, float blendFactor,
                           const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
@@ -2877,7 +8213,8 @@ namespace optixu {
                           const BufferView &previousDenoisedBeauty,
                           const BufferView &denoisedBeauty,
                           const DenoisingTask &task) const {
-        m->invoke(stream,
+        m->throwRuntimeError(m->stateIsReady, "You need to call setupState() before invoke.");
+        m->invoke(stream, m->stateBuffer, m->scratchBuffer,
                   denoiseAlpha, hdrIntensity, 0, blendFactor,
                   noisyBeauty, beautyFormat, nullptr, nullptr, 0,
                   albedo, albedoFormat,
@@ -2888,6 +8225,38 @@ namespace optixu {
                   task);
     }
 
+    void Denoiser::invokeConcurrently(const CUstream* streams, uint32_t numStreams, const CUevent* taskReadyEvents,
+                                      bool denoiseAlpha, CUdeviceptr hdrIntensity, float blendFactor,
+                                      const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                                      const BufferView &albedo, OptixPixelFormat albedoFormat,
+                                      const BufferView &normal, OptixPixelFormat normalFormat,
+                                      const BufferView &flow, OptixPixelFormat flowFormat,
+                                      const BufferView &previousDenoisedBeauty,
+                                      const BufferView &denoisedBeauty,
+                                      const DenoisingTask* tasks, uint32_t numTasks) const {
+        m->throwRuntimeError(m->concurrentStatesAreReady,
+                             "You need to call setupConcurrentStates() before invokeConcurrently.");
+        m->throwRuntimeError(streams && numStreams > 0, "Streams must be provided.");
+        m->throwRuntimeError(numStreams <= m->concurrentStateBuffers.size(),
+                             "Number of streams %u exceeds the number of set up states %u.",
+                             numStreams, static_cast<uint32_t>(m->concurrentStateBuffers.size()));
+        for (uint32_t taskIdx = 0; taskIdx < numTasks; ++taskIdx) {
+            uint32_t slotIdx = taskIdx % numStreams;
+            CUstream stream = streams[slotIdx];
+            if (taskReadyEvents)
+                CUDADRV_CHECK(cuStreamWaitEvent(stream, taskReadyEvents[taskIdx], 0));
+            m->invoke(stream, m->concurrentStateBuffers[slotIdx], m->concurrentScratchBuffers[slotIdx],
+                      denoiseAlpha, hdrIntensity, 0, blendFactor,
+                      noisyBeauty, beautyFormat, nullptr, nullptr, 0,
+                      albedo, albedoFormat,
+                      normal, normalFormat,
+                      flow, flowFormat,
+                      previousDenoisedBeauty, nullptr,
+                      denoisedBeauty, nullptr,
+                      tasks[taskIdx]);
+        }
+    }
+
     void Denoiser::invoke(CUstream stream,
                           bool denoiseAlpha, CUdeviceptr hdrAverageColor, float blendFactor,
                           const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
@@ -2898,7 +8267,8 @@ namespace optixu {
                           const BufferView &previousDenoisedBeauty, const BufferView* previousDenoisedAovs,*/
                           const BufferView &denoisedBeauty, const BufferView* denoisedAovs,
                           const DenoisingTask &task) const {
-        m->invoke(stream,
+        m->throwRuntimeError(m->stateIsReady, "You need to call setupState() before invoke.");
+        m->invoke(stream, m->stateBuffer, m->scratchBuffer,
                   denoiseAlpha, 0, hdrAverageColor, blendFactor,
                   noisyBeauty, beautyFormat, noisyAovs, aovFormats, numAovs,
                   albedo, albedoFormat,
@@ -2908,4 +8278,560 @@ namespace optixu {
                   denoisedBeauty, denoisedAovs,
                   task);
     }
+
+
+
+    void narrowTriangleIndices(const uint32_t* indices, uint32_t numTriangles,
+                               std::vector<uint16_t>* narrowedIndices, std::vector<TriangleIndexChunk>* chunks) {
+        constexpr uint32_t maxVertexRange = 1u << 16;
+
+        narrowedIndices->resize(3 * static_cast<size_t>(numTriangles));
+        chunks->clear();
+
+        // JP: 三角形を順に見て、頂点範囲が16ビットを超える直前でまとまりを区切る。
+        // EN: Look at triangles in order and split a chunk right before the vertex range exceeds 16 bits.
+        uint32_t chunkBegin = 0;
+        uint32_t minIndex = UINT32_MAX;
+        uint32_t maxIndex = 0;
+        const auto flushChunk = [&](uint32_t chunkEnd) {
+            TriangleIndexChunk chunk;
+            chunk.firstTriangle = chunkBegin;
+            chunk.numTriangles = chunkEnd - chunkBegin;
+            chunk.vertexOffset = minIndex;
+            chunk.numVertices = maxIndex - minIndex + 1;
+            for (uint32_t triIdx = chunkBegin; triIdx < chunkEnd; ++triIdx) {
+                for (uint32_t i = 0; i < 3; ++i)
+                    (*narrowedIndices)[3 * triIdx + i] = static_cast<uint16_t>(indices[3 * triIdx + i] - minIndex);
+            }
+            chunks->push_back(chunk);
+        };
+        for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+            uint32_t triMin = std::min({ indices[3 * triIdx + 0], indices[3 * triIdx + 1], indices[3 * triIdx + 2] });
+            uint32_t triMax = std::max({ indices[3 * triIdx + 0], indices[3 * triIdx + 1], indices[3 * triIdx + 2] });
+            uint32_t newMin = std::min(minIndex, triMin);
+            uint32_t newMax = std::max(maxIndex, triMax);
+            if (triIdx > chunkBegin && newMax - newMin >= maxVertexRange) {
+                flushChunk(triIdx);
+                chunkBegin = triIdx;
+                newMin = triMin;
+                newMax = triMax;
+            }
+            optixuAssert(newMax - newMin < maxVertexRange,
+                         "A single triangle spans more than 65536 vertices.");
+            minIndex = newMin;
+            maxIndex = newMax;
+        }
+        if (numTriangles > chunkBegin)
+            flushChunk(numTriangles);
+    }
+
+    namespace {
+        uint16_t floatToHalf(float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            uint32_t sign = (bits >> 16) & 0x8000;
+            int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+            uint32_t mantissa = bits & 0x007FFFFF;
+            if (exponent <= 0) {
+                // JP: 非正規化数もしくはゼロ。
+                // EN: Denormal or zero.
+                if (exponent < -10)
+                    return static_cast<uint16_t>(sign);
+                mantissa |= 0x00800000;
+                uint32_t shift = static_cast<uint32_t>(14 - exponent);
+                uint32_t halfMantissa = mantissa >> shift;
+                uint32_t rest = mantissa & ((1u << shift) - 1);
+                uint32_t halfway = 1u << (shift - 1);
+                if (rest > halfway || (rest == halfway && (halfMantissa & 1)))
+                    ++halfMantissa;
+                return static_cast<uint16_t>(sign | halfMantissa);
+            }
+            if (exponent >= 31)
+                return static_cast<uint16_t>(sign | 0x7C00);
+            uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+            uint32_t rest = mantissa & 0x1FFF;
+            // JP: 最近接偶数丸め。仮数の桁上がりは指数に正しく伝搬する。
+            // EN: Round to nearest even. A carry from the mantissa correctly propagates to the exponent.
+            if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+                ++half;
+            return static_cast<uint16_t>(half);
+        }
+    }
+
+    bool quantizeVerticesToHalf(const float* positions, uint32_t numVertices, uint32_t strideInBytes,
+                                float maxError, std::vector<uint16_t>* halfPositions) {
+        constexpr float maxHalfValue = 65504.0f;
+
+        std::vector<uint16_t> ret(3 * static_cast<size_t>(numVertices));
+        auto bytes = reinterpret_cast<const uint8_t*>(positions);
+        for (uint32_t vIdx = 0; vIdx < numVertices; ++vIdx) {
+            float p[3];
+            std::memcpy(p, bytes + static_cast<size_t>(strideInBytes) * vIdx, sizeof(p));
+            for (uint32_t i = 0; i < 3; ++i) {
+                if (!(std::fabs(p[i]) <= maxHalfValue))
+                    return false;
+                uint16_t h = floatToHalf(p[i]);
+                if (std::fabs(halfToFloat(h) - p[i]) > maxError)
+                    return false;
+                ret[3 * vIdx + i] = h;
+            }
+        }
+        *halfPositions = std::move(ret);
+
+        return true;
+    }
+
+    void packMaterialIndices(const uint32_t* materialIndices, uint32_t numPrimitives, uint32_t numMaterials,
+                             std::vector<uint8_t>* packedIndices, uint32_t* indexSize,
+                             std::vector<uint32_t>* primitiveOrder) {
+        if (numMaterials <= (1u << 8))
+            *indexSize = 1;
+        else if (numMaterials <= (1u << 16))
+            *indexSize = 2;
+        else
+            *indexSize = 4;
+
+        // JP: マテリアルごとの個数を数えて安定な計数ソートを行う。
+        // EN: Count primitives per material then perform a stable counting sort.
+        if (primitiveOrder) {
+            std::vector<uint32_t> offsets(numMaterials + 1, 0);
+            for (uint32_t primIdx = 0; primIdx < numPrimitives; ++primIdx) {
+                uint32_t matIdx = materialIndices[primIdx];
+                optixuAssert(matIdx < numMaterials, "Material index %u is out of bounds [0, %u).",
+                             matIdx, numMaterials);
+                ++offsets[matIdx + 1];
+            }
+            for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx)
+                offsets[matIdx + 1] += offsets[matIdx];
+            primitiveOrder->resize(numPrimitives);
+            for (uint32_t primIdx = 0; primIdx < numPrimitives; ++primIdx)
+                (*primitiveOrder)[offsets[materialIndices[primIdx]]++] = primIdx;
+        }
+
+        packedIndices->resize(static_cast<size_t>(*indexSize) * numPrimitives);
+        uint8_t* dst = packedIndices->data();
+        for (uint32_t i = 0; i < numPrimitives; ++i) {
+            uint32_t matIdx = materialIndices[primitiveOrder ? (*primitiveOrder)[i] : i];
+            optixuAssert(matIdx < numMaterials, "Material index %u is out of bounds [0, %u).",
+                         matIdx, numMaterials);
+            // JP: リトルエンディアンを前提に下位バイトをコピーする。
+            // EN: Copy the lower bytes assuming little endian.
+            std::memcpy(dst + static_cast<size_t>(*indexSize) * i, &matIdx, *indexSize);
+        }
+    }
+
+    void mergeTriangleMeshes(const TriangleMeshView* meshes, uint32_t numMeshes, uint32_t vertexStrideInBytes,
+                             std::vector<uint8_t>* mergedVertices, std::vector<uint32_t>* mergedIndices,
+                             std::vector<uint32_t>* primitiveOffsets) {
+        size_t numTotalVertices = 0;
+        size_t numTotalTriangles = 0;
+        for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
+            numTotalVertices += meshes[meshIdx].numVertices;
+            numTotalTriangles += meshes[meshIdx].numTriangles;
+        }
+        optixuAssert(numTotalVertices <= UINT32_MAX && numTotalTriangles <= UINT32_MAX,
+                     "Too many vertices or triangles to merge.");
+
+        mergedVertices->resize(numTotalVertices * vertexStrideInBytes);
+        mergedIndices->resize(3 * numTotalTriangles);
+        primitiveOffsets->resize(numMeshes + 1);
+
+        // JP: インデックスは結合後の頂点列での位置に付け替える。
+        // EN: Rebase indices to the positions in the merged vertex sequence.
+        uint32_t baseVertex = 0;
+        uint32_t baseTriangle = 0;
+        for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
+            const TriangleMeshView &mesh = meshes[meshIdx];
+            std::memcpy(mergedVertices->data() + static_cast<size_t>(vertexStrideInBytes) * baseVertex,
+                        mesh.vertices, static_cast<size_t>(vertexStrideInBytes) * mesh.numVertices);
+            for (uint32_t i = 0; i < 3 * mesh.numTriangles; ++i) {
+                optixuAssert(mesh.indices[i] < mesh.numVertices, "Mesh %u: index %u is out of bounds.",
+                             meshIdx, mesh.indices[i]);
+                (*mergedIndices)[3 * static_cast<size_t>(baseTriangle) + i] = baseVertex + mesh.indices[i];
+            }
+            (*primitiveOffsets)[meshIdx] = baseTriangle;
+            baseVertex += mesh.numVertices;
+            baseTriangle += mesh.numTriangles;
+        }
+        (*primitiveOffsets)[numMeshes] = baseTriangle;
+    }
+
+    namespace {
+        struct CurveControlPoint {
+            float x, y, z, w;
+
+            CurveControlPoint operator+(const CurveControlPoint &r) const {
+                return CurveControlPoint{ x + r.x, y + r.y, z + r.z, w + r.w };
+            }
+            CurveControlPoint operator*(float s) const {
+                return CurveControlPoint{ x * s, y * s, z * s, w * s };
+            }
+        };
+
+        bool curveSegmentNeedsSplit(const CurveControlPoint* cps, uint32_t numCPs,
+                                    float maxFlatness, float maxWidthRatio) {
+            float minWidth = cps[0].w;
+            float maxWidth = cps[0].w;
+            for (uint32_t i = 1; i < numCPs; ++i) {
+                minWidth = std::min(minWidth, cps[i].w);
+                maxWidth = std::max(maxWidth, cps[i].w);
+            }
+            if (maxWidthRatio > 0.0f && maxWidth > maxWidthRatio * std::max(minWidth, 1e-20f))
+                return true;
+
+            if (maxFlatness <= 0.0f || numCPs <= 2)
+                return false;
+
+            // JP: 制御点の弦からの最大距離を弦長で割ったものを曲がり具合とする。
+            // EN: Use the max distance of control points from the chord divided by the chord length as the bend.
+            const CurveControlPoint &a = cps[0];
+            const CurveControlPoint &b = cps[numCPs - 1];
+            float cx = b.x - a.x, cy = b.y - a.y, cz = b.z - a.z;
+            float chordLength2 = cx * cx + cy * cy + cz * cz;
+            if (chordLength2 <= 0.0f)
+                return false;
+            float maxDist2 = 0.0f;
+            for (uint32_t i = 1; i < numCPs - 1; ++i) {
+                float dx = cps[i].x - a.x, dy = cps[i].y - a.y, dz = cps[i].z - a.z;
+                float ex = dy * cz - dz * cy;
+                float ey = dz * cx - dx * cz;
+                float ez = dx * cy - dy * cx;
+                maxDist2 = std::max(maxDist2, (ex * ex + ey * ey + ez * ez) / chordLength2);
+            }
+            return maxDist2 > maxFlatness * maxFlatness * chordLength2;
+        }
+
+        // JP: B-スプラインの細分により、セグメントをパラメター中央で二つのセグメントに分割する。
+        // EN: Bisect a segment at the parameter center into two segments by B-spline subdivision.
+        void bisectCurveSegment(GeometryType curveType, const CurveControlPoint* cps,
+                                CurveControlPoint* left, CurveControlPoint* right) {
+            if (curveType == GeometryType::LinearSegments) {
+                CurveControlPoint mid = (cps[0] + cps[1]) * 0.5f;
+                left[0] = cps[0];
+                left[1] = mid;
+                right[0] = mid;
+                right[1] = cps[1];
+            }
+            else if (curveType == GeometryType::QuadraticBSplines) {
+                CurveControlPoint q0 = cps[0] * 0.75f + cps[1] * 0.25f;
+                CurveControlPoint q1 = cps[0] * 0.25f + cps[1] * 0.75f;
+                CurveControlPoint q2 = cps[1] * 0.75f + cps[2] * 0.25f;
+                CurveControlPoint q3 = cps[1] * 0.25f + cps[2] * 0.75f;
+                left[0] = q0;
+                left[1] = q1;
+                left[2] = q2;
+                right[0] = q1;
+                right[1] = q2;
+                right[2] = q3;
+            }
+            else if (curveType == GeometryType::CubicBSplines) {
+                CurveControlPoint e01 = (cps[0] + cps[1]) * 0.5f;
+                CurveControlPoint v1 = (cps[0] + cps[1] * 6.0f + cps[2]) * 0.125f;
+                CurveControlPoint e12 = (cps[1] + cps[2]) * 0.5f;
+                CurveControlPoint v2 = (cps[1] + cps[2] * 6.0f + cps[3]) * 0.125f;
+                CurveControlPoint e23 = (cps[2] + cps[3]) * 0.5f;
+                left[0] = e01;
+                left[1] = v1;
+                left[2] = e12;
+                left[3] = v2;
+                right[0] = v1;
+                right[1] = e12;
+                right[2] = v2;
+                right[3] = e23;
+            }
+            else {
+                optixuAssert_ShouldNotBeCalled();
+            }
+        }
+
+        void splitCurveSegmentRecursive(GeometryType curveType, const CurveControlPoint* cps, uint32_t numCPs,
+                                        float maxFlatness, float maxWidthRatio, uint32_t depth,
+                                        std::vector<CurveControlPoint>* dstCPs) {
+            if (depth == 0 || !curveSegmentNeedsSplit(cps, numCPs, maxFlatness, maxWidthRatio)) {
+                dstCPs->insert(dstCPs->end(), cps, cps + numCPs);
+                return;
+            }
+            CurveControlPoint left[4];
+            CurveControlPoint right[4];
+            bisectCurveSegment(curveType, cps, left, right);
+            splitCurveSegmentRecursive(curveType, left, numCPs, maxFlatness, maxWidthRatio, depth - 1, dstCPs);
+            splitCurveSegmentRecursive(curveType, right, numCPs, maxFlatness, maxWidthRatio, depth - 1, dstCPs);
+        }
+    }
+
+    void splitCurveSegments(GeometryType curveType,
+                            const float* positions, const float* widths,
+                            const uint32_t* segmentIndices, uint32_t numSegments,
+                            float maxFlatness, float maxWidthRatio, uint32_t maxDepth,
+                            std::vector<float>* splitPositions, std::vector<float>* splitWidths,
+                            std::vector<uint32_t>* splitSegmentIndices,
+                            std::vector<uint32_t>* sourceSegments) {
+        uint32_t numCPs;
+        if (curveType == GeometryType::LinearSegments)
+            numCPs = 2;
+        else if (curveType == GeometryType::QuadraticBSplines)
+            numCPs = 3;
+        else if (curveType == GeometryType::CubicBSplines)
+            numCPs = 4;
+        else
+            throw std::runtime_error("Geometry type must be one of curve types.");
+
+        splitPositions->clear();
+        splitWidths->clear();
+        splitSegmentIndices->clear();
+        if (sourceSegments)
+            sourceSegments->clear();
+
+        std::vector<CurveControlPoint> dstCPs;
+        for (uint32_t segIdx = 0; segIdx < numSegments; ++segIdx) {
+            CurveControlPoint cps[4];
+            uint32_t baseIndex = segmentIndices[segIdx];
+            for (uint32_t i = 0; i < numCPs; ++i) {
+                const float* p = positions + 3 * static_cast<size_t>(baseIndex + i);
+                cps[i] = CurveControlPoint{ p[0], p[1], p[2], widths[baseIndex + i] };
+            }
+
+            dstCPs.clear();
+            splitCurveSegmentRecursive(curveType, cps, numCPs, maxFlatness, maxWidthRatio, maxDepth, &dstCPs);
+            for (size_t i = 0; i < dstCPs.size(); i += numCPs) {
+                splitSegmentIndices->push_back(static_cast<uint32_t>(splitWidths->size()));
+                for (uint32_t j = 0; j < numCPs; ++j) {
+                    const CurveControlPoint &cp = dstCPs[i + j];
+                    splitPositions->push_back(cp.x);
+                    splitPositions->push_back(cp.y);
+                    splitPositions->push_back(cp.z);
+                    splitWidths->push_back(cp.w);
+                }
+                if (sourceSegments)
+                    sourceSegments->push_back(segIdx);
+            }
+        }
+    }
+
+
+
+    namespace {
+        // JP: キーはkeyWidth個のfloatの並びとして扱い、成分ごとに線形補間する。
+        //     normalizeは補間後のキーを整える(SRTの四元数の正規化など)。
+        // EN: A key is treated as a sequence of keyWidth floats and interpolated component-wise.
+        //     normalize fixes up an interpolated key (e.g. normalization of the quaternion of SRT).
+        template <typename NormalizeFunc>
+        void evaluateUniformMotionKeys(const float* keys, uint32_t keyWidth, uint32_t numKeys, float t,
+                                       NormalizeFunc &&normalize, float* dst) {
+            float ft = std::min(std::max(t, 0.0f), 1.0f) * (numKeys - 1);
+            uint32_t keyIdx = std::min(static_cast<uint32_t>(ft), numKeys - 2);
+            float frac = ft - keyIdx;
+            const float* keyA = keys + static_cast<size_t>(keyWidth) * keyIdx;
+            const float* keyB = keyA + keyWidth;
+            for (uint32_t i = 0; i < keyWidth; ++i)
+                dst[i] = (1 - frac) * keyA[i] + frac * keyB[i];
+            normalize(dst);
+        }
+
+        // JP: OptiXのモーションキーは時間方向に等間隔なので、キー数を2から増やしながら等間隔に再サンプリングし、
+        //     元の動きとの距離が許容誤差に収まる最小のキー数を探す。
+        //     距離は両方のキーの時刻とその中点で測る。
+        // EN: OptiX's motion keys are uniformly spaced in time, so resample uniformly while increasing the number
+        //     of keys from 2, and find the minimum number of keys for which the distance from the original motion
+        //     is within the tolerance.
+        //     The distance is measured at the times of keys of both and their midpoints.
+        template <typename NormalizeFunc, typename DistanceFunc>
+        uint32_t reduceUniformMotionKeys(const float* keys, uint32_t keyWidth, uint32_t numKeys, float tolerance,
+                                         NormalizeFunc &&normalize, DistanceFunc &&distance,
+                                         std::vector<float>* reducedKeys) {
+            if (numKeys <= 2) {
+                reducedKeys->assign(keys, keys + static_cast<size_t>(keyWidth) * numKeys);
+                return numKeys;
+            }
+
+            std::vector<float> candidate;
+            std::vector<float> valueOrg(keyWidth);
+            std::vector<float> valueRed(keyWidth);
+            std::vector<float> sampleTimes;
+            for (uint32_t numReduced = 2; numReduced < numKeys; ++numReduced) {
+                candidate.resize(static_cast<size_t>(keyWidth) * numReduced);
+                for (uint32_t keyIdx = 0; keyIdx < numReduced; ++keyIdx)
+                    evaluateUniformMotionKeys(keys, keyWidth, numKeys, static_cast<float>(keyIdx) / (numReduced - 1),
+                                              normalize, candidate.data() + static_cast<size_t>(keyWidth) * keyIdx);
+
+                sampleTimes.clear();
+                for (uint32_t i = 0; i < 2 * (numKeys - 1); ++i)
+                    sampleTimes.push_back(static_cast<float>(i) / (2 * (numKeys - 1)));
+                for (uint32_t i = 0; i < 2 * (numReduced - 1); ++i)
+                    sampleTimes.push_back(static_cast<float>(i) / (2 * (numReduced - 1)));
+                sampleTimes.push_back(1.0f);
+
+                bool withinTolerance = true;
+                for (float t : sampleTimes) {
+                    evaluateUniformMotionKeys(keys, keyWidth, numKeys, t, normalize, valueOrg.data());
+                    evaluateUniformMotionKeys(candidate.data(), keyWidth, numReduced, t, normalize, valueRed.data());
+                    if (distance(valueOrg.data(), valueRed.data()) > tolerance) {
+                        withinTolerance = false;
+                        break;
+                    }
+                }
+                if (withinTolerance) {
+                    *reducedKeys = std::move(candidate);
+                    return numReduced;
+                }
+            }
+
+            reducedKeys->assign(keys, keys + static_cast<size_t>(keyWidth) * numKeys);
+            return numKeys;
+        }
+
+        float calcToleranceInWorld(const float aabbMinP[3], const float aabbMaxP[3],
+                                   float tolerance, bool relativeToBounds) {
+            if (!relativeToBounds)
+                return tolerance;
+            float dx = aabbMaxP[0] - aabbMinP[0];
+            float dy = aabbMaxP[1] - aabbMinP[1];
+            float dz = aabbMaxP[2] - aabbMinP[2];
+            return tolerance * std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+
+        // JP: 2つの3x4行列でAABBの8頂点を変換した位置の距離の最大値。
+        // EN: Maximum distance between the 8 corners of the AABB transformed by two 3x4 matrices.
+        float calcMaxCornerDistance(const float matA[12], const float matB[12],
+                                    const float aabbMinP[3], const float aabbMaxP[3]) {
+            float maxSqDist = 0.0f;
+            for (uint32_t cornerIdx = 0; cornerIdx < 8; ++cornerIdx) {
+                float p[3] = {
+                    (cornerIdx & 0b001) ? aabbMaxP[0] : aabbMinP[0],
+                    (cornerIdx & 0b010) ? aabbMaxP[1] : aabbMinP[1],
+                    (cornerIdx & 0b100) ? aabbMaxP[2] : aabbMinP[2],
+                };
+                float sqDist = 0.0f;
+                for (uint32_t row = 0; row < 3; ++row) {
+                    const float* rA = matA + 4 * row;
+                    const float* rB = matB + 4 * row;
+                    float d = (rA[0] - rB[0]) * p[0] + (rA[1] - rB[1]) * p[1] + (rA[2] - rB[2]) * p[2] + (rA[3] - rB[3]);
+                    sqDist += d * d;
+                }
+                maxSqDist = std::max(maxSqDist, sqDist);
+            }
+            return std::sqrt(maxSqDist);
+        }
+
+        // JP: スケール(3), 四元数(4), 平行移動(3)を並べたキーから3x4行列(T * R * S)を作る。
+        // EN: Make a 3x4 matrix (T * R * S) from a key of scale (3), quaternion (4) and translation (3).
+        void srtKeyToMatrix(const float key[10], float mat[12]) {
+            float sx = key[0], sy = key[1], sz = key[2];
+            float qx = key[3], qy = key[4], qz = key[5], qw = key[6];
+            float r[3][3] = {
+                { 1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy - qz * qw), 2 * (qx * qz + qy * qw) },
+                { 2 * (qx * qy + qz * qw), 1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz - qx * qw) },
+                { 2 * (qx * qz - qy * qw), 2 * (qy * qz + qx * qw), 1 - 2 * (qx * qx + qy * qy) },
+            };
+            for (uint32_t row = 0; row < 3; ++row) {
+                mat[4 * row + 0] = r[row][0] * sx;
+                mat[4 * row + 1] = r[row][1] * sy;
+                mat[4 * row + 2] = r[row][2] * sz;
+                mat[4 * row + 3] = key[7 + row];
+            }
+        }
+    }
+
+    uint32_t reduceMatrixMotionKeys(const float* matrices, uint32_t numKeys,
+                                    const float aabbMinP[3], const float aabbMaxP[3],
+                                    float tolerance, bool relativeToBounds,
+                                    std::vector<float>* reducedMatrices) {
+        float toleranceInWorld = calcToleranceInWorld(aabbMinP, aabbMaxP, tolerance, relativeToBounds);
+        return reduceUniformMotionKeys(
+            matrices, 12, numKeys, toleranceInWorld,
+            [](float*) {},
+            [&](const float* keyA, const float* keyB) {
+                return calcMaxCornerDistance(keyA, keyB, aabbMinP, aabbMaxP);
+            },
+            reducedMatrices);
+    }
+
+    uint32_t reduceSRTMotionKeys(const float* scales, const float* orientations, const float* translations,
+                                 uint32_t numKeys,
+                                 const float aabbMinP[3], const float aabbMaxP[3],
+                                 float tolerance, bool relativeToBounds,
+                                 std::vector<float>* reducedScales, std::vector<float>* reducedOrientations,
+                                 std::vector<float>* reducedTranslations) {
+        std::vector<float> keys(10 * static_cast<size_t>(numKeys));
+        for (uint32_t keyIdx = 0; keyIdx < numKeys; ++keyIdx) {
+            float* key = keys.data() + 10 * keyIdx;
+            std::copy_n(scales + 3 * keyIdx, 3, key);
+            std::copy_n(orientations + 4 * keyIdx, 4, key + 3);
+            std::copy_n(translations + 3 * keyIdx, 3, key + 7);
+        }
+
+        // JP: OptiXと同様に四元数は線形補間後に正規化する。
+        // EN: Normalize the quaternion after linear interpolation as OptiX does.
+        float toleranceInWorld = calcToleranceInWorld(aabbMinP, aabbMaxP, tolerance, relativeToBounds);
+        std::vector<float> reducedKeys;
+        uint32_t numReduced = reduceUniformMotionKeys(
+            keys.data(), 10, numKeys, toleranceInWorld,
+            [](float* key) {
+                float* q = key + 3;
+                float length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+                if (length > 0.0f) {
+                    for (uint32_t i = 0; i < 4; ++i)
+                        q[i] /= length;
+                }
+            },
+            [&](const float* keyA, const float* keyB) {
+                float matA[12], matB[12];
+                srtKeyToMatrix(keyA, matA);
+                srtKeyToMatrix(keyB, matB);
+                return calcMaxCornerDistance(matA, matB, aabbMinP, aabbMaxP);
+            },
+            &reducedKeys);
+
+        reducedScales->resize(3 * numReduced);
+        reducedOrientations->resize(4 * numReduced);
+        reducedTranslations->resize(3 * numReduced);
+        for (uint32_t keyIdx = 0; keyIdx < numReduced; ++keyIdx) {
+            const float* key = reducedKeys.data() + 10 * keyIdx;
+            std::copy_n(key, 3, reducedScales->data() + 3 * keyIdx);
+            std::copy_n(key + 3, 4, reducedOrientations->data() + 4 * keyIdx);
+            std::copy_n(key + 7, 3, reducedTranslations->data() + 3 * keyIdx);
+        }
+        return numReduced;
+    }
+
+    uint32_t reduceVertexMotionSteps(const float* const* stepPositions, uint32_t numSteps,
+                                     uint32_t numVertices, uint32_t strideInBytes,
+                                     float tolerance, bool relativeToBounds,
+                                     std::vector<float>* reducedPositions) {
+        // JP: ステップごとのfloat3の頂点座標を1つのキーとして詰める。
+        // EN: Pack float3 vertex positions per step as a single key.
+        uint32_t keyWidth = 3 * numVertices;
+        std::vector<float> keys(static_cast<size_t>(keyWidth) * numSteps);
+        float minP[3] = { INFINITY, INFINITY, INFINITY };
+        float maxP[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (uint32_t stepIdx = 0; stepIdx < numSteps; ++stepIdx) {
+            auto src = reinterpret_cast<const uint8_t*>(stepPositions[stepIdx]);
+            float* key = keys.data() + static_cast<size_t>(keyWidth) * stepIdx;
+            for (uint32_t vIdx = 0; vIdx < numVertices; ++vIdx) {
+                auto p = reinterpret_cast<const float*>(src + static_cast<size_t>(strideInBytes) * vIdx);
+                for (uint32_t i = 0; i < 3; ++i) {
+                    key[3 * vIdx + i] = p[i];
+                    minP[i] = std::min(minP[i], p[i]);
+                    maxP[i] = std::max(maxP[i], p[i]);
+                }
+            }
+        }
+
+        float toleranceInWorld = numVertices > 0 ?
+            calcToleranceInWorld(minP, maxP, tolerance, relativeToBounds) : tolerance;
+        return reduceUniformMotionKeys(
+            keys.data(), keyWidth, numSteps, toleranceInWorld,
+            [](float*) {},
+            [numVertices](const float* keyA, const float* keyB) {
+                float maxSqDist = 0.0f;
+                for (uint32_t vIdx = 0; vIdx < numVertices; ++vIdx) {
+                    float dx = keyA[3 * vIdx + 0] - keyB[3 * vIdx + 0];
+                    float dy = keyA[3 * vIdx + 1] - keyB[3 * vIdx + 1];
+                    float dz = keyA[3 * vIdx + 2] - keyB[3 * vIdx + 2];
+                    maxSqDist = std::max(maxSqDist, dx * dx + dy * dy + dz * dz);
+                }
+                return std::sqrt(maxSqDist);
+            },
+            reducedPositions);
+    }
 }
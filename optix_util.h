@@ -31,6 +31,529 @@ EN:
 - In Visual Studio, does the CUDA property "Use Fast Math" not work for ptx compilation??
 
 変更履歴 / Update History:
+- JP: Instance, Transformのセッターとユーザーデータの設定で、値が現在と同じ場合はダーティーにしないようにし、
+      回避された更新の数を返すContext::getRedundantUpdateStatistics()を追加。
+  EN: Setters of Instance, Transform and user data settings no longer mark dirty when the value is the same
+      as the current one, and added Context::getRedundantUpdateStatistics() to return the number of avoided updates.
+
+- JP: cudau::Array::initialize3D()が奥行きを無視して2Dの配列を作っていた問題を修正。
+  EN: Fixed cudau::Array::initialize3D() ignoring the depth and creating a 2D array.
+
+- JP: 毎フレームのストリーミングデータ用に書き込み結合のピン留めホストメモリーによるcudau::BufferType::WriteCombinedを追加。
+      BufferType::ZeroCopyのmap()が先行するGPUの処理を待つようにし、copy()に対応。
+  EN: Added cudau::BufferType::WriteCombined backed by write-combined pinned host memory for per-frame streaming data.
+      map() of BufferType::ZeroCopy now waits for preceding GPU work, and copy() supports it.
+
+- JP: 変更のあった矩形やタイルマスクに重なるデノイズのタスクのみを選ぶDenoiser::getTasksInRegion(),
+      getTasksInTileMask()と、タスクの出力領域を返すgetTaskOutputWindow()を追加。
+  EN: Added Denoiser::getTasksInRegion(), getTasksInTileMask() to select only denoising tasks overlapping
+      a changed rectangle or tile mask, and getTaskOutputWindow() to return the output region of a task.
+
+- JP: 確率的透明度による可視性レイのtraceStochasticVisibility()と、Any-Hit用のstochasticTransparencyAnyHit(),
+      その不透明度状態を求めるcalcTriangleStochasticOpacityState()を追加。
+  EN: Added traceStochasticVisibility() for visibility rays with stochastic transparency, and
+      stochasticTransparencyAnyHit() for any-hit and calcTriangleStochasticOpacityState() to compute its opacity states.
+
+- JP: 1次元のローンチインデックスをBlockBuffer2Dと同じブロック配置のピクセルに写すgetRemappedLaunchIndex()と
+      launchWithRemappedIndices()、ヒルベルト曲線順のHilbertBlockLayoutを追加。
+  EN: Added getRemappedLaunchIndex() and launchWithRemappedIndices() mapping a 1D launch index to pixels in
+      the same block arrangement as BlockBuffer2D, and HilbertBlockLayout in Hilbert curve order.
+
+- JP: Pipeline::setRayGenerationUserData(), setMissUserData()を追加。
+      レイ生成・ミスのレコードにユーザーデータを持たせ、ミスレコードのストライドを自動で計算する。
+  EN: Added Pipeline::setRayGenerationUserData(), setMissUserData().
+      Ray generation and miss records can have user data, and the stride of miss records is computed automatically.
+
+- JP: オブジェクトをまとめて生成・追加するScene::createGeometryInstances(), createInstances()とInstanceDesc、
+      GAS/IAS::addChildren()を追加。内部データはプールからまとめて確保され、検証とdirty化は一度だけ行われる。
+  EN: Added Scene::createGeometryInstances(), createInstances() with InstanceDesc and GAS/IAS::addChildren()
+      to create and add objects together. Internal data are allocated from the pool together,
+      and validation and marking dirty happen only once.
+
+- JP: 多数のGASのビルドとコンパクションをcudau::DeviceMemoryArena上で行うGASBuildSchedulerを追加。
+      GASBuildSequencing::MinimizePeakMemoryでは小さなグループごとにビルド、コンパクト、removeUncompacted()を行い、
+      ピークメモリーをおおよそコンパクト後の合計と一グループ分の作業領域に抑える。
+  EN: Added GASBuildScheduler building and compacting many GASs on cudau::DeviceMemoryArena.
+      GASBuildSequencing::MinimizePeakMemory performs build, compaction and removeUncompacted() per small group
+      and keeps peak memory roughly at the compacted total plus one group's working set.
+
+- JP: デバイスメモリーの予算に基づいてGASを退避・復帰するScene::setResidencyBudget(), enforceResidencyBudget(),
+      getResidencyStatistics()とGAS::setEvictable(), isResident()を追加。
+      最近参照されていないコンパクト済みのGASをピン留めされたホストメモリーへ退避し、IASのリビルドで参照されたときに
+      アップロードとリロケーションで復帰する。
+  EN: Added Scene::setResidencyBudget(), enforceResidencyBudget(), getResidencyStatistics() and
+      GAS::setEvictable(), isResident() to evict and restore GASs based on a device memory budget.
+      Compacted GASs not referenced recently are evicted to pinned host memory, and restored by upload and relocation
+      when referenced at an IAS rebuild.
+
+- JP: OPTIXU_ENABLE_RAY_STATISTICSによるワープ単位で集約したレイの統計(レイタイプごとのトレース数、ミス数、
+      Any-Hitの呼び出し数)のカウンターとcountMiss()、HostRayStatisticsを追加。
+      ヒット数やプロファイラーの計測によるレイ数/秒をRayStatisticsSummaryから求められる。
+  EN: Added warp-aggregated ray statistics counters (traces per ray type, misses and any-hit invocations)
+      by OPTIXU_ENABLE_RAY_STATISTICS, countMiss() and HostRayStatistics.
+      The number of hits and rays per second by the profiler's measurement can be obtained from RayStatisticsSummary.
+
+- JP: SBTレイアウト生成時に各マテリアルスロットのヒットグループがエニーヒットを持つかを調べ、
+      OPTIX_GEOMETRY_FLAG_DISABLE_ANYHITを提案・自動設定するScene::setGeometryFlagInference()を追加。
+  EN: Added Scene::setGeometryFlagInference() that inspects at the SBT layout generation whether hit groups of
+      each material slot have any-hit programs, and suggests or automatically sets OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT.
+
+- JP: 要素を追加・差し替えで増分更新できる独立したコーラブルのSBT範囲CallableProgramTableを追加。
+      インデックスは安定しておりDirectCallableProgramIDにそのまま使え、プログラムグループの生成はリンクまで遅延できる。
+  EN: Added CallableProgramTable, a separate callable SBT range updated incrementally by appending and patching
+      entries. Indices are stable and directly usable for DirectCallableProgramID,
+      and creating program groups can be deferred until linking.
+
+- JP: ブロック幅を実行時に選べるoptixu::DynamicBlockBuffer2D/HostDynamicBlockBuffer2D、幅をコンパイル時の定数として
+      ディスパッチするdispatchLog2BlockWidth()、起動時に最速の幅を選ぶselectFastestLog2BlockWidth()を追加。
+  EN: Added optixu::DynamicBlockBuffer2D/HostDynamicBlockBuffer2D whose block width is chosen at runtime,
+      dispatchLog2BlockWidth() dispatching the width as a compile-time constant and
+      selectFastestLog2BlockWidth() choosing the fastest width at startup.
+
+- JP: cudau::Array::resize()がミップレベルごとに重なる領域の内容をデバイス上のコピーで保持するように変更。
+      配列間のデバイス上のコピーArray::copyFrom()とArray::copy()を追加。
+  EN: Changed cudau::Array::resize() to preserve the contents of the overlapping region by device-side copies
+      per mip level. Added Array::copyFrom() and Array::copy() for device-side copies between arrays.
+
+- JP: 描画用の高優先度ストリームとバックグラウンドのAS構築用の低優先度ストリームを管理し、
+      イベントで完了を引き渡すcudau::PriorityStreamsを追加。
+  EN: Added cudau::PriorityStreams managing a high-priority stream for rendering and a low-priority stream
+      for background AS builds, and handing completion off with an event.
+
+- JP: 複数のGeometryInstanceで1つの頂点スラブと三角形スラブを共有するoptixu::HostGeometryPoolと
+      デバイス側のビューGeometryPoolを追加。
+  EN: Added optixu::HostGeometryPool sharing a vertex slab and a triangle slab among geometry instances
+      and its device-side view GeometryPool.
+
+- JP: 入れ子のIASと静的Transformを展開して単一階層のIASを生成するScene::flattenInstanceHierarchy()を追加。
+  EN: Added Scene::flattenInstanceHierarchy() to create a single-level IAS by expanding nested IASs
+      and static transforms.
+
+- JP: 病的なアセットを検出するための走査コストの推定値を返すGAS/IASのestimateTraversalCost()を追加。
+  EN: Added estimateTraversalCost() to GAS/IAS returning an estimated traversal cost
+      to detect pathological assets.
+
+- JP: パイプラインのレシピを登録しワーカースレッドで事前に構築するContext::registerPipelineRecipe()と
+      構築済みのパイプラインを受け取るContext::createPipeline(recipeName)を追加。
+  EN: Added Context::registerPipelineRecipe() to register a pipeline recipe built in advance on a worker thread
+      and Context::createPipeline(recipeName) to receive the built pipeline.
+
+- JP: ヒットグループレコードのデータ部分を複数のパイプラインで共有するScene::enableHitGroupRecordDataSharing()と
+      デバイス側のgetHitGroupRecordDataPointer()を追加。
+      パイプラインごとのSBTはヘッダーと共有データへのアドレスのみを持つ。
+  EN: Added Scene::enableHitGroupRecordDataSharing() sharing the data part of hit group records among
+      multiple pipelines and getHitGroupRecordDataPointer() on the device side.
+      The SBT per pipeline holds only headers and addresses to the shared data.
+
+- JP: GASのアップデート(リフィット)専用に頂点/Width/AABBバッファーを互換なバッファーへ差し替える
+      GeometryInstance::retargetVertexBuffer(), retargetWidthBuffer(), retargetCustomPrimitiveAABBBuffer()を追加。
+  EN: Added GeometryInstance::retargetVertexBuffer(), retargetWidthBuffer(), retargetCustomPrimitiveAABBBuffer()
+      replacing vertex/width/AABB buffers with compatible ones dedicated to GAS updates (refits).
+
+- JP: 可視性マスクのビットを名前付きのカテゴリーに割り当てるScene::registerVisibilityCategory()などと
+      Instance::setVisibilityCategories()を追加。
+      Scene::setRayTypeVisibility()でレイタイプごとのマスクを定義し、デバイスコードに定数として渡せる。
+  EN: Added Scene::registerVisibilityCategory() and so on to allocate visibility mask bits to named categories
+      and Instance::setVisibilityCategories().
+      Scene::setRayTypeVisibility() defines per-ray-type masks which can be passed as constants to device code.
+
+- JP: 誤差の許容範囲内でモーションキーを削減するreduceMatrixMotionKeys(), reduceSRTMotionKeys(),
+      reduceVertexMotionSteps()を追加。
+  EN: Added reduceMatrixMotionKeys(), reduceSRTMotionKeys(), reduceVertexMotionSteps() reducing motion keys
+      within an error tolerance.
+
+- JP: モーションステップのバッファーをリングとして回すGeometryInstance::rotateMotionStepBuffers()を追加。
+  EN: Added GeometryInstance::rotateMotionStepBuffers() rotating buffers of motion steps as a ring.
+
+- JP: Pipeline::link(), linkAsync()に到達不能なプログラムグループをリンクから除外するオプションを追加。
+      除外されたものはPipeline::getPrunedProgramGroups()で得られる。
+  EN: Added an option to Pipeline::link(), linkAsync() to exclude unreachable program groups from the link.
+      Excluded ones can be obtained by Pipeline::getPrunedProgramGroups().
+
+- JP: モジュールとプログラムグループの生成をリンク時まで遅らせるPipeline::createDeferredHitProgramGroup()と
+      新たに参照されたものを生成して再リンクするPipeline::updateDeferredHitGroups()を追加。
+  EN: Added Pipeline::createDeferredHitProgramGroup() which defers creating the module and the program group
+      until link time and Pipeline::updateDeferredHitGroups() which creates newly referenced ones and re-links.
+
+- JP: CUDAソースをNVRTCで実行時にPTXへコンパイルするPipeline::createModuleFromCUDASource()と
+      PTXのディスクキャッシュを設定するContext::setPTXCacheLocation()を追加(OPTIXU_ENABLE_NVRTCが必要)。
+      ModuleCacheStatisticsにPTXコンパイルの統計を追加。
+  EN: Added Pipeline::createModuleFromCUDASource() compiling CUDA source to PTX at runtime by NVRTC and
+      Context::setPTXCacheLocation() to configure the disk cache of PTX (requires OPTIXU_ENABLE_NVRTC).
+      Added statistics of PTX compilation to ModuleCacheStatistics.
+
+- JP: ビルド済みのGASをプロセス間で共有するGeometryAccelerationStructure::exportShared(), attachShared()と
+      仮想メモリー管理APIのシェアラブルハンドルで共有するcudau::SharedDeviceMemoryを追加。
+  EN: Added GeometryAccelerationStructure::exportShared(), attachShared() to share a built GAS across processes
+      and cudau::SharedDeviceMemory shared via a shareable handle of the virtual memory management API.
+
+- JP: IASのインスタンス充填をScene::setTaskExecutor()のエグゼキューターでチャンクごとに並列に行うよう変更。
+      連続するインスタンスが同じ子を参照する場合はハンドルとSBTオフセットの解決を省くように。
+  EN: Changed instance filling of IAS to run per chunk in parallel on the executor of Scene::setTaskExecutor().
+      Resolving the handle and the SBT offset is skipped when consecutive instances refer to the same child.
+
+- JP: GeometryInstance::getGeometryType(), getNumMaterialSets(),
+      GeometryAccelerationStructure::getGeometryType(), getUniformRayTypeMaterial()を追加。
+      未設定のマテリアルセットに対するGeometryInstance::getMaterial()がMaterial()を返すよう修正。
+  EN: Added GeometryInstance::getGeometryType(), getNumMaterialSets(),
+      GeometryAccelerationStructure::getGeometryType(), getUniformRayTypeMaterial().
+      Fixed GeometryInstance::getMaterial() to return Material() for an unset material set.
+
+- JP: Material::replaceHitGroup()を追加。設定済みのヒットグループの差し替えを、SBTのレイアウトを変えずに
+      該当レコードのヘッダーのみのその場での更新として行う。
+  EN: Added Material::replaceHitGroup(). Replacement of an already set hit group is done as an in-place update
+      of only the headers of the corresponding records without changing the SBT layout.
+
+- JP: ローンチパラメターのシャドウコピーを持ち、変更されたバイト範囲だけをピン留めメモリーのリング経由で転送する
+      LaunchParameterBlockをoptixu_on_cudau.hに追加。
+  EN: Added LaunchParameterBlock to optixu_on_cudau.h holding a shadow copy of launch parameters and
+      transferring only changed byte ranges via a ring of pinned memory.
+
+- JP: 出力画像をタイルに分割し、タイルサイズの作業用バッファーでレンダリングと後処理・読み出しを
+      オーバーラップさせるTiledLauncherをoptixu_on_cudau.hに追加。
+  EN: Added TiledLauncher to optixu_on_cudau.h to split an output image into tiles and overlap rendering with
+      post-processing and readback using tile-sized working buffers.
+
+- JP: Welfordのアルゴリズムで平均色と輝度の分散を半精度または単精度で保持する累積バッファー
+      AccumulationBuffer2D, HostAccumulationBuffer2Dをoptixu_on_cudau.hに追加。
+  EN: Added accumulation buffers AccumulationBuffer2D, HostAccumulationBuffer2D to optixu_on_cudau.h
+      holding the mean color and luminance variance in half or single precision with Welford's algorithm.
+
+- JP: 小さな結果を返すGPUクエリーをホストを止めずに数フレーム遅れで読み出すcudau::QueryRingを追加。
+  EN: Added cudau::QueryRing to read back GPU queries returning a small result a few frames later
+      without stalling the host.
+
+- JP: 他のプロファイラーのイベントと一つのトレースにまとめるためにcudau::GpuProfiler::writeChromeTraceEvents()を追加。
+  EN: Added cudau::GpuProfiler::writeChromeTraceEvents() to merge events with other profilers' into one trace.
+
+- JP: ストリーム上のそれまでの処理の完了後にオブジェクトの破棄やバッファーの解放を行う遅延破棄キューを
+      Context::deferRelease(), deferDestroy(), processDeferredReleases()として追加。
+  EN: Added a deferred destruction queue as Context::deferRelease(), deferDestroy(), processDeferredReleases()
+      to destroy objects and free buffers after the completion of the preceding work on a stream.
+
+- JP: 処理中の各フレームの完了をイベントで追跡し、リソースの解放をそのフレームの完了まで遅延させる
+      Scene::beginFrame(), endFrame(), deferRelease()を追加。
+  EN: Added Scene::beginFrame(), endFrame(), deferRelease() to track completion of each frame in flight with events
+      and defer releasing resources until the frame completes.
+
+- JP: IAS/Transformの子の参照から依存関係を求め、dirty状態のGAS/Transform/IASを依存順に
+      必要最小限だけリビルド・アップデートするScene::prepareForBuildDirty(), buildDirty()を追加。
+  EN: Added Scene::prepareForBuildDirty(), buildDirty() which derive dependencies from child references of
+      IASs/transforms and rebuild/update only the minimal set of dirty GASs/transforms/IASs in dependency order.
+
+- JP: 複数GPUへのローンチの分割と結果の収集を行うMultiGPULauncherを追加。
+  EN: Added MultiGPULauncher splitting launches across multiple GPUs and gathering the results.
+
+- JP: シーン中のオブジェクトの内部データをプールから確保し、小さいユーザーデータをヒープ確保無しで保持するようにした。
+  EN: Internal data of objects in a scene are now allocated from pools,
+      and small user data is held without heap allocation.
+
+- JP: シーンの構築をスレッドセーフにした。オブジェクトの生成、設定、ASのビルドを複数スレッドから並行に行える。
+  EN: Made scene construction thread-safe.
+      Object creation, configuration and AS builds can be done concurrently from multiple threads.
+
+- JP: OPTIXU_ENABLE_NVTX, CUDAU_ENABLE_NVTXを定義すると高コストなAPIがNVTXレンジとして表示されるようにした。
+  EN: Defining OPTIXU_ENABLE_NVTX, CUDAU_ENABLE_NVTX shows expensive APIs as NVTX ranges.
+
+- JP: BufferとArrayの確保を記録するcudau::MemoryTrackerとBuffer/Array::setName()を追加。
+  EN: Added cudau::MemoryTracker recording allocations of Buffer and Array, and Buffer/Array::setName().
+
+- JP: フィールドごとに配列を持つcudau::SoABufferとデバイス側のcudau::SoAViewを追加。
+  EN: Added cudau::SoABuffer having an array per field and device-side cudau::SoAView.
+
+- JP: cudau::Kernelに占有率が最大となるブロックサイズを自動で設定するモードとパーシステントスレッドのローンチを追加。
+  EN: Added a mode to cudau::Kernel to automatically set the block size achieving the maximum occupancy
+      and a persistent-threads launch.
+
+- JP: Context::setProfileScopeCallbacks()を追加。ASのビルド、ローンチ、デノイズが自動的にプロファイラーのスコープとして記録される。
+      cudau::GpuProfilerとattachGpuProfiler()を追加。
+  EN: Added Context::setProfileScopeCallbacks(). AS builds, launches and denoising are automatically recorded as profiler scopes.
+      Added cudau::GpuProfiler and attachGpuProfiler().
+
+- JP: Vulkan等の外部メモリーをBuffer/Arrayにインポートする機能とExternalSemaphoreを追加。
+  EN: Added import of external memory (e.g. Vulkan) into Buffer/Array and ExternalSemaphore.
+
+- JP: 連携リソースをまとめてマップするInteropMapBatchと、複数バッファーで表示するInteropSurfacePresenterを追加。
+  EN: Added InteropMapBatch to map interop resources together and InteropSurfacePresenter for multi-buffered presentation.
+
+- JP: 仮想テクスチャリングのためのcudau::VirtualTextureStreamerとsampleVirtualTexture()を追加。
+  EN: Added cudau::VirtualTextureStreamer and sampleVirtualTexture() for virtual texturing.
+
+- JP: インデックスでテクスチャーを参照するためのcudau::TextureTableを追加。
+  EN: Added cudau::TextureTable to refer textures by index.
+
+- JP: ステージングプール経由でミップレベルを非同期に書き込むArray::writeAsync()を追加。
+  EN: Added Array::writeAsync() to write a mip level asynchronously via a staging pool.
+
+- JP: GPU上でミップマップを生成するArray::generateMipmaps()とカーネル定義用のCUDAU_DEFINE_MIPMAP_KERNELを追加。
+  EN: Added Array::generateMipmaps() generating mipmaps on the GPU and CUDAU_DEFINE_MIPMAP_KERNEL to define the kernel.
+
+- JP: 別のコンテキストにコピーするBuffer::copyTo()と、複数GPUのレプリカを同期するcudau::ReplicatedBufferを追加。
+  EN: Added Buffer::copyTo() copying to another context and cudau::ReplicatedBuffer syncing replicas on multiple GPUs.
+
+- JP: cudau::Bufferにマネージドメモリー用のprefetch(), advise()とその範囲指定版を追加。
+      GeometryAccelerationStructure::setManagedInputPrefetch()でビルド前にジオメトリ入力をプリフェッチできるように。
+  EN: Added prefetch(), advise() and their range variants for managed memory to cudau::Buffer.
+      GeometryAccelerationStructure::setManagedInputPrefetch() allows prefetching geometry inputs before a build.
+
+- JP: Buffer::fill()をホストからの転送無しにデバイス上のmemsetで行うようにし、cudau::fillDeviceMemory()を追加。
+  EN: Made Buffer::fill() use memset on the device without transfers from the host,
+      and added cudau::fillDeviceMemory().
+
+- JP: ピン留めメモリーのチャンク経由で転送するcudau::PinnedStagingPoolと、
+      完了トークンを返すBuffer::writeAsync(), readAsync()を追加。
+  EN: Added cudau::PinnedStagingPool transferring via chunks of pinned memory and
+      Buffer::writeAsync(), readAsync() returning a completion token.
+
+- JP: 仮想アドレス範囲を予約し拡大時に物理メモリーを追加でマップするBufferType::VirtualMemoryと
+      Buffer::initializeVirtual()を追加。拡大してもデバイスポインターが変わらない。
+  EN: Added BufferType::VirtualMemory and Buffer::initializeVirtual() which reserve a virtual address range
+      and map additional physical memory on growth. The device pointer doesn't change on growth.
+
+- JP: cuMemAllocAsync()/cuMemFreeAsync()でストリーム順に確保・解放するBufferType::StreamOrderedと
+      Buffer::initializeStreamOrdered(), cudau::setMemoryPoolReleaseThreshold()を追加。
+  EN: Added BufferType::StreamOrdered allocated and freed in stream order by cuMemAllocAsync()/cuMemFreeAsync(),
+      Buffer::initializeStreamOrdered() and cudau::setMemoryPoolReleaseThreshold().
+
+- JP: cudau::Bufferに容量の概念を追加し、reserve(), shrinkToFit(), setGrowthFactor()と
+      TypedBuffer::pushBack(), append()を追加。容量内のresize()は再確保しない。
+  EN: Added the concept of capacity to cudau::Buffer with reserve(), shrinkToFit(), setGrowthFactor() and
+      TypedBuffer::pushBack(), append(). resize() within the capacity doesn't reallocate.
+
+- JP: デノイザーの設定ごとの性能と品質を計測するサンプルdenoiser_benchmarkを追加。
+  EN: Added denoiser_benchmark sample to measure performance and quality of the denoiser per configuration.
+
+- JP: invoke()とcomputeIntensity(), computeAverageColor()でスクラッチバッファーを共有するための
+      Denoiser::getSharedScratchBufferSize()と、スクラッチバッファーを取らない版を追加。
+  EN: Added Denoiser::getSharedScratchBufferSize() and versions without a scratch buffer argument
+      to share a scratch buffer among invoke() and computeIntensity(), computeAverageColor().
+
+- JP: cuda_util.hに半精度との変換floatToHalf(), halfToFloat()を追加。
+      Denoiser::getImageBufferSize()を追加し、invoke()でバッファーサイズを検証するようにした。
+  EN: Added half-precision conversions floatToHalf(), halfToFloat() to cuda_util.h.
+      Added Denoiser::getImageBufferSize() and made invoke() validate buffer sizes.
+
+- JP: 蓄積バッファーから半精度のデノイザー入力とHDR強度用の部分和を1パスで求める
+      prepareDenoiserInputs(), finalizeDenoiserIntensity()をoptixu_on_cudau.hに追加。
+  EN: Added prepareDenoiserInputs(), finalizeDenoiserIntensity() to optixu_on_cudau.h to compute
+      half-precision denoiser inputs and partial sums for HDR intensity from accumulation buffers in one pass.
+
+- JP: 連番フレームのアップロード、デノイズ、ダウンロードをオーバーラップさせるDenoiseBatchを
+      optixu_on_cudau.hに追加。
+  EN: Added DenoiseBatch to optixu_on_cudau.h to overlap upload, denoising and download of frame sequences.
+
+- JP: 再prepare無しにより小さな画像サイズへ切り替えるDenoiser::setImageSize()を追加。
+  EN: Added Denoiser::setImageSize() to switch to a smaller image size without re-preparing.
+
+- JP: デノイズのタスクを複数ストリームで並行に実行するDenoiser::invokeConcurrently()と
+      setupConcurrentStates(), タスクの入力領域を返すgetTaskInputWindow()を追加。
+  EN: Added Denoiser::invokeConcurrently() and setupConcurrentStates() to run denoising tasks concurrently
+      on multiple streams, and getTaskInputWindow() to return the input region of a task.
+
+- JP: アルファテクスチャーから三角形ごとの不透明度を求めるcalcTriangleOpacityState()と
+      ビットマスクのOpacityStateMap, HostOpacityStateMapをoptixu_on_cudau.hに追加。
+  EN: Added calcTriangleOpacityState() to determine per-triangle opacity from an alpha texture and
+      bitmask OpacityStateMap, HostOpacityStateMap to optixu_on_cudau.h.
+
+- JP: OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATIONによるトラバーサルのコスト計測と、
+      カウンターからヒートマップと合計を求めるHostTraversalCountersをoptixu_on_cudau.hに追加。
+      reportIntersection()は交差が受け入れられたかを返すようにした。
+  EN: Added traversal cost instrumentation by OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION, and
+      HostTraversalCounters to optixu_on_cudau.h to compute heatmaps and totals from the counters.
+      reportIntersection() now returns whether the intersection was accepted.
+
+- JP: アサーションのレベルOPTIXU_ASSERT_LEVEL (NONE, CHEAP, FULL)と、
+      optixuAssertCheap(), 実行時に切り替え可能なoptixuAssertIf()を追加。
+  EN: Added assertion levels OPTIXU_ASSERT_LEVEL (NONE, CHEAP, FULL),
+      optixuAssertCheap() and runtime-toggleable optixuAssertIf().
+
+- JP: optixu_on_cudau.hにprintfの代わりに使えるリングバッファーのデバイスログDeviceLogger, HostDeviceLoggerと
+      optixuLog(), optixuLogAssert(), optixuLogAssertSampled()を追加。
+  EN: Added ring-buffer device log DeviceLogger, HostDeviceLogger usable instead of printf and
+      optixuLog(), optixuLogAssert(), optixuLogAssertSampled() to optixu_on_cudau.h.
+
+- JP: HostBlockBuffer2DにブロックレイアウトのままのreadRawAsync()と行単位のdeswizzleRows()を追加。
+  EN: Added readRawAsync() as-is in block layout and row-wise deswizzleRows() to HostBlockBuffer2D.
+
+- JP: optixu_on_cudau.hのブロックバッファーにブロック内レイアウト(行優先/Zオーダー)の指定、16バイト型の
+      ベクトル化されたロード・ストア、3次元版のBlockBuffer3D, HostBlockBuffer3Dを追加。
+  EN: Added in-block layout selection (row-major/Z-order), vectorized loads/stores for 16-byte types,
+      and 3D variants BlockBuffer3D, HostBlockBuffer3D to block buffers in optixu_on_cudau.h.
+
+- JP: 可視性レイ用のデバイス側optixu::traceVisibility()と、ミスプログラムと既定のヒットグループを自動登録する
+      Pipeline::setVisibilityRayType()、既定のヒットグループを設定するPipeline::setDefaultHitGroup()を追加。
+  EN: Added device-side optixu::traceVisibility() for visibility rays, Pipeline::setVisibilityRayType() to
+      register a miss program and a default hit group automatically, and Pipeline::setDefaultHitGroup().
+
+- JP: 量子化ペイロード用のOctahedralUnitVector, RGB9E5Color, Half2を追加。
+  EN: Added OctahedralUnitVector, RGB9E5Color and Half2 for quantized payloads.
+
+- JP: ビット幅の異なるフィールドを最小のDword数に詰めるペイロード・アトリビュート用のPackedValuesを追加。
+  EN: Added PackedValues for payloads and attributes packing fields of mixed bit widths into the minimum Dwords.
+
+- JP: ヒットレコードをマテリアルごとにまとめるカウンティングソートとdispatchSortedShading()を
+      optixu_on_cudau.hに追加。
+  EN: Added counting sort helpers to group hit records by material and dispatchSortedShading()
+      to optixu_on_cudau.h.
+
+- JP: ウェーブフロント型レンダリング用にoptixu_on_cudau.hにWorkQueue, HostWorkQueueとtraceFromQueue()を追加。
+  EN: Added WorkQueue, HostWorkQueue and traceFromQueue() to optixu_on_cudau.h for wavefront-style rendering.
+
+- JP: 小さなローンチをまとめるPipeline::launchBatched()とデバイス側のgetBatchedLaunchIndex()を追加。
+  EN: Added Pipeline::launchBatched() and device-side getBatchedLaunchIndex() to pack small launches.
+
+- JP: GAS/IASのrebuild(), update()とPipeline::launch()をCUDAグラフのストリームキャプチャーに対応させた。
+  EN: Made rebuild(), update() of GAS/IAS and Pipeline::launch() safe for stream capture into CUDA graphs.
+
+- JP: Pipeline::launch()でシーンの準備状態に変化が無ければシーンの検証を省略するようにした。
+  EN: Pipeline::launch() now skips scene validation when the readiness of the scene has not changed.
+
+- JP: プログラムグループからスタックサイズを計算して設定するPipeline::computeAndSetStackSize()を追加。
+  EN: Added Pipeline::computeAndSetStackSize() to compute and set stack sizes from program groups.
+
+- JP: 束縛値ごとに特殊化したパイプラインを記憶するPipelineVariantCacheを追加。
+  EN: Added PipelineVariantCache to memoize pipelines specialized for each set of bound values.
+
+- JP: パイプラインをワーカースレッドでリンクするPipeline::linkAsync()とPipeline::isLinked()を追加。
+  EN: Added Pipeline::linkAsync() and Pipeline::isLinked() to link a pipeline on a worker thread.
+
+- JP: モジュールをワーカースレッドでコンパイルするPipeline::createModuleFromPTXStringAsync()を追加。
+  EN: Added Pipeline::createModuleFromPTXStringAsync() to compile a module on a worker thread.
+
+- JP: OptiXのディスクキャッシュを設定するContext::setDiskCacheEnabled()などと、モジュールのキャッシュキー、
+      生成統計を取得するModule::getCacheKey(), Context::getModuleCacheStatistics()を追加。
+  EN: Added Context::setDiskCacheEnabled() and others to configure OptiX's disk cache, and
+      Module::getCacheKey(), Context::getModuleCacheStatistics() to obtain module cache keys and creation statistics.
+
+- JP: ヒットグループのSBTレコードのレイアウトをコンパイル時に計算し、型付きのデバイス側アクセサーを提供する
+      HitGroupRecord<>を追加。
+  EN: Added HitGroupRecord<> to compute the layout of a hit group SBT record at compile time and
+      provide typed device-side accessors.
+
+- JP: 全ジオメトリで一つのレコードを共有する一様なレイタイプを指定する
+      GAS::setUniformRayTypeMaterial()を追加。
+  EN: Added GAS::setUniformRayTypeMaterial() to specify a uniform ray type sharing one record
+      among all geometries.
+
+- JP: SBTとローンチパラメターの転送にページロックされたステージングリングを使う
+      Pipeline::enablePinnedStaging(), uploadLaunchParams()を追加。
+  EN: Added Pipeline::enablePinnedStaging(), uploadLaunchParams() to use a page-locked staging ring
+      for transfers of SBTs and launch parameters.
+
+- JP: SBTレイアウト生成とヒットグループSBTの書き込みをユーザーのタスクエグゼキューターで
+      並列実行するためのScene::setTaskExecutor()を追加。
+  EN: Added Scene::setTaskExecutor() to execute the SBT layout generation and the hit group SBT filling
+      in parallel with the user's task executor.
+
+- JP: マテリアルがパイプラインごとにパック済みのヒットグループヘッダーをキャッシュするようにし、
+      SBTレコード書き込み時のハッシュ探索を無くした。
+  EN: Materials now cache packed hit group headers per pipeline, removing hash lookups when filling SBT records.
+
+- JP: 大きなマテリアルのユーザーデータをレコード外のテーブルに置く
+      Scene::setMaterialDataOutOfRecordThreshold()とデバイス側のgetOutOfRecordMaterialData()を追加。
+  EN: Added Scene::setMaterialDataOutOfRecordThreshold() to place large material user data in a table
+      outside of records and getOutOfRecordMaterialData() on the device side.
+
+- JP: 内容が同一のSBTレコード範囲を共有させるScene::enableShaderBindingTableRecordSharing()を追加。
+  EN: Added Scene::enableShaderBindingTableRecordSharing() to let SBT record ranges with identical contents
+      be shared.
+
+- JP: SBTレイアウトをシリアルID順の配列で管理し、レコードサイズが変わらない限り既存のオフセットを保ったまま
+      追加分を末尾に割り当てるようにした。既存のオフセットが変わった場合のみIASがdirty状態になる。
+  EN: SBT layout is now managed as an array in serial ID order, and added ranges are allocated at the tail
+      keeping existing offsets as long as the record size doesn't change.
+      IASs are marked dirty only when existing offsets change.
+
+- JP: パイプラインが多重バッファリングされたヒットグループSBTを所有し、ローンチごとに
+      自動で切り替えるsetNumOwnedHitGroupShaderBindingTables()を追加。
+  EN: Added setNumOwnedHitGroupShaderBindingTables() to let a pipeline own multi-buffered hit group SBTs
+      and rotate them automatically at each launch.
+
+- JP: ヒットグループSBTのレコード変更を追跡し、ローンチ時に変更のあった範囲のみを更新・転送するようにした。
+  EN: Changes of hit group SBT records are now tracked, and only changed ranges are updated and
+      transferred at launch.
+
+- JP: カスタムプリミティブのAABBを全モーションステップ分まとめて計算するデバイス側ヘルパー
+      computeCustomPrimitiveAABBs()を追加。
+  EN: Added a device-side helper computeCustomPrimitiveAABBs() to compute AABBs of custom primitives
+      for all motion steps at once.
+
+- JP: カーブのセグメントを曲率と幅の変化に応じて適応的に分割するsplitCurveSegments()を追加。
+  EN: Added splitCurveSegments() to adaptively split curve segments according to curvature and width variation.
+
+- JP: 小さなメッシュを一つのビルド入力に結合するmergeTriangleMeshes()と、
+      デバイス側で元のメッシュを求めるfindMergedMeshIndex()を追加。
+  EN: Added mergeTriangleMeshes() to merge small meshes into a single build input and
+      findMergedMeshIndex() to recover the original mesh on the device.
+
+- JP: マテリアルインデックスを最小のサイズに詰め、必要に応じてマテリアル順に並べ替えるpackMaterialIndices()を追加。
+  EN: Added packMaterialIndices() to pack material indices into the smallest size and optionally sort
+      primitives by material.
+
+- JP: 三角形インデックスを16ビットに変換するnarrowTriangleIndices()と
+      頂点座標を半精度に変換するquantizeVerticesToHalf()を追加。
+  EN: Added narrowTriangleIndices() to convert triangle indices to 16-bit and
+      quantizeVerticesToHalf() to convert vertex positions to half precision.
+
+- JP: dirty状態のTransformを一つのバッファーにまとめてアップロードする
+      Scene::prepareForBuildDirtyTransforms(), buildDirtyTransforms()を追加。
+  EN: Added Scene::prepareForBuildDirtyTransforms(), buildDirtyTransforms() to upload dirty transforms
+      together into a single buffer.
+
+- JP: GPU上でカリング・LOD選択したインスタンスからIASをビルドするためのIAS::setDeviceInstanceCount()と
+      デバイス側ヘルパーisAabbInFrustum(), selectLevelOfDetail(), appendInstance()を追加。
+  EN: Added IAS::setDeviceInstanceCount() and device-side helpers isAabbInFrustum(), selectLevelOfDetail(),
+      appendInstance() to build an IAS from instances culled and LOD-selected on the GPU.
+
+- JP: 中身が同一のGASを検出してインスタンスの参照を共有GASに付け替えるScene::deduplicateGeometryASs()を追加。
+  EN: Added Scene::deduplicateGeometryASs() to detect GASs with identical contents and redirect
+      references of instances to a shared GAS.
+
+- JP: 子を定数時間で削除するGAS/IAS::swapRemoveChildAt()を追加。
+      GAS/IAS::findChildIndex()と子の重複チェックを定数時間に改善。
+  EN: Added GAS/IAS::swapRemoveChildAt() to remove a child in constant time.
+      Improved GAS/IAS::findChildIndex() and the duplication check of children to constant time.
+
+- JP: IASから参照された時点でシーンのプール上にビルドされる遅延ビルドGASのための
+      GAS::setLazyBuild(), Scene::setLazyBuildMemory()を追加。
+  EN: Added GAS::setLazyBuild(), Scene::setLazyBuildMemory() for lazy-build GASs which are built
+      on the scene's pool when referenced by an IAS.
+
+- JP: GAS/IASのビルド時間やサイズを取得するGAS/IAS::enableStatistics(), getStatistics()と
+      それらを集計するScene::getMemoryReport()を追加。
+  EN: Added GAS/IAS::enableStatistics(), getStatistics() to obtain build times and sizes of a GAS/IAS and
+      Scene::getMemoryReport() to aggregate them.
+
+- JP: ビルド済みのGASをディスクキャッシュ等に保存して再利用するためのGAS::getBuildInputHash(), serialize(),
+      checkRelocatable(), relocate()を追加。
+  EN: Added GAS::getBuildInputHash(), serialize(), checkRelocatable(), relocate() to store a built GAS
+      in such as a disk cache and reuse it.
+
+- JP: アップデート回数とAABBの拡大率に基づいて自動でリビルドを行うGAS/IAS::setAutoRebuildPolicy(),
+      updateOrRebuild()を追加。
+  EN: Added GAS/IAS::setAutoRebuildPolicy(), updateOrRebuild() to automatically rebuild based on
+      the number of updates and the growth of AABB.
+
+- JP: デバイス上で書き込まれたOptixInstanceからIASをビルドするIAS::setDeviceInstances()と
+      Scene::getShaderBindingTableOffset()を追加。
+  EN: Added IAS::setDeviceInstances() to build an IAS from OptixInstances written on the device and
+      Scene::getShaderBindingTableOffset().
+
+- JP: IASのリビルド・アップデート時に、変更されたインスタンスのみをまとめてアップロードするように変更。
+  EN: Changed IAS rebuild/update to upload only changed instances in merged ranges.
+
+- JP: ホスト側で待たずにコンパクション後のサイズを取得するGAS/IAS::tryPrepareForCompact()を追加。
+      コンパクション後のサイズはSceneがまとめて非同期に読み戻すようになった。
+  EN: Added GAS/IAS::tryPrepareForCompact() to obtain the size after compaction without waiting on the host.
+      The sizes after compaction are now read back asynchronously and together by the Scene.
+
+- JP: dirty状態の全GASを一つのアクセラレーションバッファーとスクラッチバッファーでまとめてビルドする
+      Scene::prepareForBuildDirtyGeometryASs(), buildDirtyGeometryASs()を追加。
+      複数のストリームに分散してビルドするオーバーロードも追加。
+  EN: Added Scene::prepareForBuildDirtyGeometryASs(), buildDirtyGeometryASs() to build all the dirty GASs
+      together with a single acceleration buffer and a single scratch buffer.
+      Also added an overload to distribute the builds among multiple streams.
+
 - !!BREAKING
   JP: OptiX 7.3.0をサポート。
       InstanceAccelerationStructure::setConfiguration()が一つ多くの引数を受け取るようになった。
@@ -154,6 +677,7 @@ TODO:
 #include <cstdint>
 #include <cfloat>
 #include <string>
+#include <vector>
 #endif
 #include <optix.h>
 
@@ -164,8 +688,41 @@ TODO:
 #ifdef _DEBUG
 #   define OPTIXU_ENABLE_ASSERT
 #endif
+
+// JP: アサーションのレベル。
+//     NONE: 全て無効、CHEAP: optixuAssertCheap()とoptixuAssertIf()のみ有効、FULL: optixuAssert()も含め全て有効。
+//     指定が無い場合はOPTIXU_ENABLE_ASSERTが定義されていればFULL、そうでなければCHEAPになる。
+// EN: Assertion levels.
+//     NONE: all disabled, CHEAP: only optixuAssertCheap() and optixuAssertIf() enabled,
+//     FULL: all enabled including optixuAssert().
+//     When not specified, this is FULL if OPTIXU_ENABLE_ASSERT is defined, otherwise CHEAP.
+#define OPTIXU_ASSERT_LEVEL_NONE 0
+#define OPTIXU_ASSERT_LEVEL_CHEAP 1
+#define OPTIXU_ASSERT_LEVEL_FULL 2
+#if !defined(OPTIXU_ASSERT_LEVEL)
+#   if defined(OPTIXU_ENABLE_ASSERT)
+#       define OPTIXU_ASSERT_LEVEL OPTIXU_ASSERT_LEVEL_FULL
+#   else
+#       define OPTIXU_ASSERT_LEVEL OPTIXU_ASSERT_LEVEL_CHEAP
+#   endif
+#endif
+#if OPTIXU_ASSERT_LEVEL >= OPTIXU_ASSERT_LEVEL_FULL && !defined(OPTIXU_ENABLE_ASSERT)
+#   define OPTIXU_ENABLE_ASSERT
+#endif
 #define OPTIXU_ENABLE_RUNTIME_ERROR
 
+// JP: 定義するとASのビルドやパイプラインのリンク、ローンチなどの高コストなAPIが
+//     オブジェクトの名前付きのNVTXレンジとしてNsight Systemsなどに表示される。
+// EN: Defining this shows expensive APIs like AS builds, pipeline linking and launches
+//     as NVTX ranges named with the object's name in Nsight Systems and so on.
+//#define OPTIXU_ENABLE_NVTX
+
+// JP: 定義するとPipeline::createModuleFromCUDASource()がNVRTCによる実行時コンパイルを行う。
+//     nvrtcライブラリーのリンクが必要になる。
+// EN: Defining this makes Pipeline::createModuleFromCUDASource() perform runtime compilation by NVRTC.
+//     Linking the nvrtc library is required.
+//#define OPTIXU_ENABLE_NVRTC
+
 #if defined(__CUDA_ARCH__)
 #   define RT_CALLABLE_PROGRAM extern "C" __device__
 #   define RT_DEVICE_FUNCTION __device__ __forceinline__
@@ -242,29 +799,52 @@ namespace optixu {
 #   define optixuPrintf(fmt, ...) printf(fmt, ##__VA_ARGS__)
 #endif
 
-#if defined(OPTIXU_ENABLE_ASSERT)
-#   if defined(__CUDA_ARCH__)
-#       define optixuAssert(expr, fmt, ...) \
-            do { \
-                if (!(expr)) { \
-                    printf("%s @%s: %u:\n", #expr, __FILE__, __LINE__); \
-                    printf(fmt"\n", ##__VA_ARGS__); \
-                    assert(0); \
-                } \
-            } while (0)
-#   else
-#       define optixuAssert(expr, fmt, ...) \
-            do { \
-                if (!(expr)) { \
-                    optixu::devPrintf("%s @%s: %u:\n", #expr, __FILE__, __LINE__); \
-                    optixu::devPrintf(fmt"\n", ##__VA_ARGS__); \
-                    abort(); \
-                } \
-            } while (0)
-#   endif
+#if defined(__CUDA_ARCH__)
+#   define OPTIXU_ASSERT_IMPL(expr, fmt, ...) \
+        do { \
+            if (!(expr)) { \
+                printf("%s @%s: %u:\n", #expr, __FILE__, __LINE__); \
+                printf(fmt"\n", ##__VA_ARGS__); \
+                assert(0); \
+            } \
+        } while (0)
+#else
+#   define OPTIXU_ASSERT_IMPL(expr, fmt, ...) \
+        do { \
+            if (!(expr)) { \
+                optixu::devPrintf("%s @%s: %u:\n", #expr, __FILE__, __LINE__); \
+                optixu::devPrintf(fmt"\n", ##__VA_ARGS__); \
+                abort(); \
+            } \
+        } while (0)
+#endif
+
+// JP: optixuAssert()はバウンドチェックなど頻繁に実行される全てのチェック用、
+//     optixuAssertCheap()はRay Generationプログラムなどで常に残したい安価なチェック用。
+//     optixuAssertIf()はenabledが真の場合のみチェックを行う。
+//     enabledにOptixModuleCompileBoundValueEntryで値を固定したローンチパラメターのメンバーを使うと、
+//     モジュールごとにチェックの有無を切り替えつつ、無効なモジュールではチェックが完全に取り除かれる。
+// EN: optixuAssert() is for all checks including frequently executed ones like bounds checks,
+//     optixuAssertCheap() is for cheap checks to always keep in ray generation programs and so on.
+//     optixuAssertIf() does the check only when enabled is true.
+//     Use a launch parameter member whose value is fixed by OptixModuleCompileBoundValueEntry as enabled
+//     to toggle checks per module while checks are completely removed in modules with them disabled.
+#if OPTIXU_ASSERT_LEVEL >= OPTIXU_ASSERT_LEVEL_FULL
+#   define optixuAssert(expr, fmt, ...) OPTIXU_ASSERT_IMPL(expr, fmt, ##__VA_ARGS__)
 #else
 #   define optixuAssert(expr, fmt, ...)
 #endif
+#if OPTIXU_ASSERT_LEVEL >= OPTIXU_ASSERT_LEVEL_CHEAP
+#   define optixuAssertCheap(expr, fmt, ...) OPTIXU_ASSERT_IMPL(expr, fmt, ##__VA_ARGS__)
+#   define optixuAssertIf(enabled, expr, fmt, ...) \
+        do { \
+            if (enabled) \
+                OPTIXU_ASSERT_IMPL(expr, fmt, ##__VA_ARGS__); \
+        } while (0)
+#else
+#   define optixuAssertCheap(expr, fmt, ...)
+#   define optixuAssertIf(enabled, expr, fmt, ...)
+#endif
 
 #define optixuAssert_ShouldNotBeCalled() optixuAssert(false, "Should not be called!")
 #define optixuAssert_NotImplemented() optixuAssert(false, "Not implemented yet!")
@@ -325,6 +905,377 @@ namespace optixu {
 #endif
     };
 
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ヒットグループレコードのヘッダー直後のデータへのポインターを返す。
+    //     Scene::enableHitGroupRecordDataSharing()を使う場合はOPTIXU_SHARED_HIT_GROUP_RECORD_DATAを定義して
+    //     optixGetSbtDataPointer()の代わりにこれを使う。
+    // EN: Return the pointer to the data right after the header of a hit group record.
+    //     When using Scene::enableHitGroupRecordDataSharing(), define OPTIXU_SHARED_HIT_GROUP_RECORD_DATA
+    //     and use this instead of optixGetSbtDataPointer().
+    RT_DEVICE_FUNCTION const void* getHitGroupRecordDataPointer() {
+#if defined(OPTIXU_SHARED_HIT_GROUP_RECORD_DATA)
+        auto sharedRecord = *reinterpret_cast<const uint8_t* const*>(optixGetSbtDataPointer());
+        return sharedRecord + OPTIX_SBT_RECORD_HEADER_SIZE;
+#else
+        return reinterpret_cast<const void*>(optixGetSbtDataPointer());
+#endif
+    }
+#endif
+
+    namespace detail {
+        template <typename T>
+        struct RecordFieldTraits {
+            static constexpr uint32_t size = sizeof(T);
+            static constexpr uint32_t alignment = alignof(T);
+        };
+        template <>
+        struct RecordFieldTraits<void> {
+            static constexpr uint32_t size = 0;
+            static constexpr uint32_t alignment = 1;
+        };
+
+        RT_DEVICE_FUNCTION constexpr uint32_t alignUpRecordOffset(uint32_t offset, uint32_t alignment) {
+            return (offset + alignment - 1) & ~(alignment - 1);
+        }
+    }
+
+    // JP: ヒットグループのSBTレコードのレイアウトをコンパイル時に計算する型。
+    //     レコードはヘッダー、マテリアル、GeometryInstance、GASの子、GASのユーザーデータの順に並ぶ。
+    //     オフセットはレコード先頭(ヘッダー含む)からのもので、ホストとデバイスで共通に使える。
+    //     シーン中の全マテリアル(と各ユーザーデータ)が同じ型を使うことを前提とする。
+    //     存在しないユーザーデータにはvoidを指定する。
+    // EN: A type to compute the layout of a hit group SBT record at compile time.
+    //     A record consists of the header, material, geometry instance, GAS child, GAS user data in this order.
+    //     Offsets are from the beginning of a record (including the header), and are usable on both host and device.
+    //     This assumes that all the materials (and each user data) in the scene use the same type.
+    //     Specify void for non-existent user data.
+    template <typename MaterialData, typename GeomInstData = void, typename GASChildData = void, typename GASData = void>
+    class HitGroupRecord {
+        using MatTraits = detail::RecordFieldTraits<MaterialData>;
+        using GeomInstTraits = detail::RecordFieldTraits<GeomInstData>;
+        using GASChildTraits = detail::RecordFieldTraits<GASChildData>;
+        using GASTraits = detail::RecordFieldTraits<GASData>;
+
+        static_assert(MatTraits::alignment <= OPTIX_SBT_RECORD_ALIGNMENT &&
+                      GeomInstTraits::alignment <= OPTIX_SBT_RECORD_ALIGNMENT &&
+                      GASChildTraits::alignment <= OPTIX_SBT_RECORD_ALIGNMENT &&
+                      GASTraits::alignment <= OPTIX_SBT_RECORD_ALIGNMENT,
+                      "Alignment of user data must not exceed OPTIX_SBT_RECORD_ALIGNMENT.");
+
+    public:
+        static constexpr uint32_t materialDataOffset =
+            detail::alignUpRecordOffset(OPTIX_SBT_RECORD_HEADER_SIZE, MatTraits::alignment);
+        static constexpr uint32_t geomInstDataOffset =
+            detail::alignUpRecordOffset(materialDataOffset + MatTraits::size, GeomInstTraits::alignment);
+        static constexpr uint32_t gasChildDataOffset =
+            detail::alignUpRecordOffset(geomInstDataOffset + GeomInstTraits::size, GASChildTraits::alignment);
+        static constexpr uint32_t gasDataOffset =
+            detail::alignUpRecordOffset(gasChildDataOffset + GASChildTraits::size, GASTraits::alignment);
+        static constexpr uint32_t recordSize =
+            detail::alignUpRecordOffset(gasDataOffset + GASTraits::size, OPTIX_SBT_RECORD_ALIGNMENT);
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        template <typename T = MaterialData>
+        RT_DEVICE_FUNCTION static const T &getMaterialData() {
+            return *reinterpret_cast<const T*>(getRecordPointer() + materialDataOffset);
+        }
+        template <typename T = GeomInstData>
+        RT_DEVICE_FUNCTION static const T &getGeometryInstanceData() {
+            return *reinterpret_cast<const T*>(getRecordPointer() + geomInstDataOffset);
+        }
+        template <typename T = GASChildData>
+        RT_DEVICE_FUNCTION static const T &getGASChildData() {
+            return *reinterpret_cast<const T*>(getRecordPointer() + gasChildDataOffset);
+        }
+        template <typename T = GASData>
+        RT_DEVICE_FUNCTION static const T &getGASData() {
+            return *reinterpret_cast<const T*>(getRecordPointer() + gasDataOffset);
+        }
+
+    private:
+        RT_DEVICE_FUNCTION static const uint8_t* getRecordPointer() {
+            return reinterpret_cast<const uint8_t*>(getHitGroupRecordDataPointer()) - OPTIX_SBT_RECORD_HEADER_SIZE;
+        }
+#endif
+    };
+
+    // JP: 一括ローンチのディスパッチテーブルのエントリー。threadOffsetはPipeline::launchBatched()が埋める。
+    // EN: Entry of the dispatch table for a batched launch. Pipeline::launchBatched() fills threadOffset.
+    struct BatchedLaunchEntry {
+        uint32_t dimX;
+        uint32_t dimY;
+        uint32_t dimZ;
+        uint32_t threadOffset;
+    };
+
+    // JP: トラバーサルのコスト計測で数えるイベント。
+    // EN: Events counted by the traversal cost instrumentation.
+    enum class TraversalEvent {
+        Trace = 0,
+        AnyHit,
+        Intersection,
+        ReportedHit,
+        NumEvents
+    };
+
+    // JP: 起動インデックスごとのトラバーサルイベントのカウンター。
+    //     counters[event * width * height + y * width + x]の平面レイアウト。
+    // EN: Counters of traversal events per launch index.
+    //     Planar layout of counters[event * width * height + y * width + x].
+    struct TraversalCounters {
+        uint32_t* counters;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // JP: ローンチ全体のレイの統計のカウンター。起動インデックスごとでは無くワープ単位で集約して加算するので
+    //     本番のレンダリングで有効にしたままでも安価である。
+    //     counters[0, numRayTypes)がレイタイプごとのトレース数、続いてミス数、Any-Hitの呼び出し数の順。
+    //     ヒット数はトレース数の総和からミス数を引いて求める。
+    // EN: Counters of ray statistics over the entire launch. These are cheap enough to be kept enabled
+    //     in production rendering since counts are aggregated per warp, not per launch index.
+    //     counters[0, numRayTypes) are the numbers of traces per ray type followed by the number of misses and
+    //     the number of any-hit invocations.
+    //     The number of hits is obtained by subtracting the number of misses from the sum of traces.
+    struct RayStatistics {
+        unsigned long long* counters;
+        uint32_t numRayTypes;
+    };
+
+    // JP: 任意のビット幅の符号無し整数フィールド。PackedValuesのフィールド型として使う。
+    // EN: Unsigned integer field of an arbitrary bit width. Use as a field type of PackedValues.
+    template <uint32_t numBits>
+    struct BitField {
+        static_assert(numBits > 0 && numBits <= 32, "Bit width must be in [1, 32].");
+        uint32_t value;
+    };
+
+    namespace detail {
+        // JP: フィールド型のビット幅と、ビット列との相互変換。既定ではsizeof(T)分のビット列をそのまま使う。
+        // EN: Bit width of a field type and conversion from/to a bit sequence.
+        //     The bits of sizeof(T) are used as is by default.
+        template <typename T>
+        struct PackedFieldTraits {
+            static_assert(sizeof(T) <= sizeof(uint32_t), "Field type larger than Dword is not supported.");
+            static constexpr uint32_t numBits = 8 * sizeof(T);
+            RT_DEVICE_FUNCTION static uint32_t toBits(const T &value) {
+                uint32_t bits = 0;
+                for (uint32_t i = 0; i < sizeof(T); ++i)
+                    reinterpret_cast<uint8_t*>(&bits)[i] = reinterpret_cast<const uint8_t*>(&value)[i];
+                return bits;
+            }
+            RT_DEVICE_FUNCTION static T fromBits(uint32_t bits) {
+                T value;
+                for (uint32_t i = 0; i < sizeof(T); ++i)
+                    reinterpret_cast<uint8_t*>(&value)[i] = reinterpret_cast<const uint8_t*>(&bits)[i];
+                return value;
+            }
+        };
+
+        template <>
+        struct PackedFieldTraits<bool> {
+            static constexpr uint32_t numBits = 1;
+            RT_DEVICE_FUNCTION static uint32_t toBits(bool value) {
+                return value ? 1 : 0;
+            }
+            RT_DEVICE_FUNCTION static bool fromBits(uint32_t bits) {
+                return bits != 0;
+            }
+        };
+
+        template <uint32_t _numBits>
+        struct PackedFieldTraits<BitField<_numBits>> {
+            static constexpr uint32_t numBits = _numBits;
+            RT_DEVICE_FUNCTION static uint32_t toBits(const BitField<_numBits> &value) {
+                return value.value;
+            }
+            RT_DEVICE_FUNCTION static BitField<_numBits> fromBits(uint32_t bits) {
+                return BitField<_numBits>{ bits };
+            }
+        };
+
+        template <uint32_t index, typename HeadType, typename... TailTypes>
+        struct PackedFieldType {
+            using Type = typename PackedFieldType<index - 1, TailTypes...>::Type;
+        };
+        template <typename HeadType, typename... TailTypes>
+        struct PackedFieldType<0, HeadType, TailTypes...> {
+            using Type = HeadType;
+        };
+
+        template <uint32_t index, typename HeadType, typename... TailTypes>
+        RT_DEVICE_FUNCTION constexpr uint32_t calcPackedFieldBitOffset() {
+            if constexpr (index == 0)
+                return 0;
+            else
+                return PackedFieldTraits<HeadType>::numBits + calcPackedFieldBitOffset<index - 1, TailTypes...>();
+        }
+    }
+
+    // JP: ビット幅の異なるフィールドを最小のDword数に詰めるペイロード・アトリビュート用の型。
+    //     サイズはDwordの倍数なのでoptixu::trace(), getPayloads(), setPayloads(), reportIntersection(),
+    //     getAttributes()にそのまま渡せ、calcSumDwords()も詰めた後のサイズを反映する。
+    //     フィールドは宣言順に隙間無く配置され、Dwordの境界をまたぐこともある。
+    // EN: Type for payloads and attributes packing fields of different bit widths into the minimum number of Dwords.
+    //     The size is a multiple of Dword, so this can be passed as is to optixu::trace(), getPayloads(),
+    //     setPayloads(), reportIntersection() and getAttributes(), and calcSumDwords() reflects the packed size.
+    //     Fields are placed without gaps in the declaration order and may straddle a Dword boundary.
+    template <typename... FieldTypes>
+    class PackedValues {
+        static_assert(sizeof...(FieldTypes) > 0, "At least one field is required.");
+        static constexpr uint32_t numBits = (0 + ... + detail::PackedFieldTraits<FieldTypes>::numBits);
+        static constexpr uint32_t numDwords = numBits > 0 ? (numBits + 31) / 32 : 1;
+        uint32_t m_dwords[numDwords];
+
+        template <uint32_t index>
+        static constexpr uint32_t bitOffset = detail::calcPackedFieldBitOffset<index, FieldTypes...>();
+
+    public:
+        template <uint32_t index>
+        using FieldType = typename detail::PackedFieldType<index, FieldTypes...>::Type;
+
+        RT_DEVICE_FUNCTION PackedValues() {
+            for (uint32_t i = 0; i < numDwords; ++i)
+                m_dwords[i] = 0;
+        }
+        RT_DEVICE_FUNCTION PackedValues(const FieldTypes &... values) : PackedValues() {
+            setAll<0>(values...);
+        }
+
+        template <uint32_t index>
+        RT_DEVICE_FUNCTION FieldType<index> get() const {
+            using Traits = detail::PackedFieldTraits<FieldType<index>>;
+            constexpr uint32_t offset = bitOffset<index>;
+            constexpr uint32_t dwIdx = offset / 32;
+            constexpr uint32_t shift = offset % 32;
+            constexpr uint64_t mask = (1ull << Traits::numBits) - 1;
+            uint64_t bits = m_dwords[dwIdx] >> shift;
+            if constexpr (shift + Traits::numBits > 32)
+                bits |= static_cast<uint64_t>(m_dwords[dwIdx + 1]) << (32 - shift);
+            return Traits::fromBits(static_cast<uint32_t>(bits & mask));
+        }
+
+        template <uint32_t index>
+        RT_DEVICE_FUNCTION void set(const FieldType<index> &value) {
+            using Traits = detail::PackedFieldTraits<FieldType<index>>;
+            constexpr uint32_t offset = bitOffset<index>;
+            constexpr uint32_t dwIdx = offset / 32;
+            constexpr uint32_t shift = offset % 32;
+            constexpr uint64_t mask = (1ull << Traits::numBits) - 1;
+            uint64_t bits = Traits::toBits(value) & mask;
+            m_dwords[dwIdx] = static_cast<uint32_t>(
+                (m_dwords[dwIdx] & ~static_cast<uint32_t>(mask << shift)) | (bits << shift));
+            if constexpr (shift + Traits::numBits > 32) {
+                constexpr uint32_t highShift = 32 - shift;
+                m_dwords[dwIdx + 1] = static_cast<uint32_t>(
+                    (m_dwords[dwIdx + 1] & ~static_cast<uint32_t>(mask >> highShift)) | (bits >> highShift));
+            }
+        }
+
+    private:
+        template <uint32_t index, typename HeadType, typename... TailTypes>
+        RT_DEVICE_FUNCTION void setAll(const HeadType &head, const TailTypes &... tails) {
+            set<index>(head);
+            if constexpr (sizeof...(tails) > 0)
+                setAll<index + 1>(tails...);
+        }
+    };
+
+    // JP: 量子化したペイロード用の型。いずれも1 Dwordなのでoptixu::trace()などにそのまま渡せる。
+    // EN: Types for quantized payloads. Each is one Dword, so they can be passed as is to optixu::trace() and others.
+
+    // JP: 八面体エンコーディングによる単位ベクトル(16ビットsnorm x 2)。
+    // EN: Unit vector by octahedral encoding (16-bit snorm x 2).
+    struct OctahedralUnitVector {
+        uint32_t bits;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION static OctahedralUnitVector encode(const float3 &v) {
+            float invL1 = 1.0f / (fabsf(v.x) + fabsf(v.y) + fabsf(v.z));
+            float px = v.x * invL1;
+            float py = v.y * invL1;
+            if (v.z < 0.0f) {
+                float tx = (1.0f - fabsf(py)) * (px >= 0.0f ? 1.0f : -1.0f);
+                float ty = (1.0f - fabsf(px)) * (py >= 0.0f ? 1.0f : -1.0f);
+                px = tx;
+                py = ty;
+            }
+            auto toSnorm16 = [](float x) {
+                return static_cast<uint32_t>(static_cast<int32_t>(rintf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f)) & 0xFFFF);
+            };
+            return OctahedralUnitVector{ toSnorm16(px) | (toSnorm16(py) << 16) };
+        }
+        RT_DEVICE_FUNCTION float3 decode() const {
+            float px = static_cast<int16_t>(bits & 0xFFFF) / 32767.0f;
+            float py = static_cast<int16_t>(bits >> 16) / 32767.0f;
+            float pz = 1.0f - fabsf(px) - fabsf(py);
+            float t = fmaxf(-pz, 0.0f);
+            px += px >= 0.0f ? -t : t;
+            py += py >= 0.0f ? -t : t;
+            float invLength = rsqrtf(px * px + py * py + pz * pz);
+            return make_float3(px * invLength, py * invLength, pz * invLength);
+        }
+#endif
+    };
+
+    // JP: 共有指数のRGB (仮数9ビット x 3、指数5ビット)。負の値は0に、大きすぎる値は最大値にクランプされる。
+    // EN: Shared exponent RGB (9-bit mantissa x 3, 5-bit exponent).
+    //     Negative values are clamped to 0 and too large values to the maximum.
+    struct RGB9E5Color {
+        uint32_t bits;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION static RGB9E5Color encode(const float3 &rgb) {
+            constexpr int32_t expBias = 15;
+            constexpr int32_t numMantissaBits = 9;
+            constexpr float maxValue = 65408.0f; // (511 / 512) * 2^16
+            float r = fminf(fmaxf(rgb.x, 0.0f), maxValue);
+            float g = fminf(fmaxf(rgb.y, 0.0f), maxValue);
+            float b = fminf(fmaxf(rgb.z, 0.0f), maxValue);
+            float maxComp = fmaxf(fmaxf(r, g), b);
+            int32_t sharedExp = static_cast<int32_t>(fmaxf(-expBias - 1, floorf(log2f(maxComp)))) + 1 + expBias;
+            float scale = exp2f(static_cast<float>(sharedExp - expBias - numMantissaBits));
+            if (static_cast<uint32_t>(floorf(maxComp / scale + 0.5f)) == (1u << numMantissaBits)) {
+                scale *= 2.0f;
+                ++sharedExp;
+            }
+            uint32_t rm = static_cast<uint32_t>(floorf(r / scale + 0.5f));
+            uint32_t gm = static_cast<uint32_t>(floorf(g / scale + 0.5f));
+            uint32_t bm = static_cast<uint32_t>(floorf(b / scale + 0.5f));
+            return RGB9E5Color{ rm | (gm << 9) | (bm << 18) | (static_cast<uint32_t>(sharedExp) << 27) };
+        }
+        RT_DEVICE_FUNCTION float3 decode() const {
+            float scale = exp2f(static_cast<float>(static_cast<int32_t>(bits >> 27) - 15 - 9));
+            return make_float3((bits & 0x1FF) * scale,
+                               ((bits >> 9) & 0x1FF) * scale,
+                               ((bits >> 18) & 0x1FF) * scale);
+        }
+#endif
+    };
+
+    // JP: 半精度浮動小数点数のペア。
+    // EN: Pair of half-precision floating point numbers.
+    struct Half2 {
+        uint32_t bits;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION static Half2 encode(const float2 &v) {
+            uint16_t x, y;
+            asm("cvt.rn.f16.f32 %0, %1;" : "=h"(x) : "f"(v.x));
+            asm("cvt.rn.f16.f32 %0, %1;" : "=h"(y) : "f"(v.y));
+            return Half2{ static_cast<uint32_t>(x) | (static_cast<uint32_t>(y) << 16) };
+        }
+        RT_DEVICE_FUNCTION float2 decode() const {
+            uint16_t x = static_cast<uint16_t>(bits & 0xFFFF);
+            uint16_t y = static_cast<uint16_t>(bits >> 16);
+            float2 v;
+            asm("cvt.f32.f16 %0, %1;" : "=f"(v.x) : "h"(x));
+            asm("cvt.f32.f16 %0, %1;" : "=f"(v.y) : "h"(y));
+            return v;
+        }
+#endif
+    };
+
     // END: Definitions of Host-/Device-shared classes
     // ----------------------------------------------------------------
 
@@ -487,6 +1438,102 @@ namespace optixu {
         };
     }
 
+    // JP: OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATIONを定義すると、trace()とreportIntersection()が
+    //     起動インデックスごとにイベントを数えるようになる。
+    //     その場合OPTIXU_TRAVERSAL_COUNTERSをTraversalCounters型の式(例: plp.traversalCounters)として定義しておく。
+    //     Any-Hit, Intersectionプログラムでは先頭でcountAnyHit(), countIntersection()を呼ぶ。
+    // EN: Defining OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION makes trace() and reportIntersection()
+    //     count events per launch index.
+    //     In that case, define OPTIXU_TRAVERSAL_COUNTERS as an expression of TraversalCounters type
+    //     (e.g. plp.traversalCounters).
+    //     Call countAnyHit(), countIntersection() at the beginning of any-hit, intersection programs.
+#if defined(OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION)
+#   if !defined(OPTIXU_TRAVERSAL_COUNTERS)
+#       error "Define OPTIXU_TRAVERSAL_COUNTERS to use traversal instrumentation."
+#   endif
+    namespace detail {
+        RT_DEVICE_FUNCTION void countTraversalEvent(TraversalEvent event) {
+            const TraversalCounters &tc = OPTIXU_TRAVERSAL_COUNTERS;
+            uint3 launchIndex = optixGetLaunchIndex();
+            if (tc.counters == nullptr || launchIndex.x >= tc.width || launchIndex.y >= tc.height)
+                return;
+            uint32_t index = (static_cast<uint32_t>(event) * tc.height + launchIndex.y) * tc.width + launchIndex.x;
+            atomicAdd(&tc.counters[index], 1u);
+        }
+    }
+#endif
+
+    // JP: OPTIXU_ENABLE_RAY_STATISTICSを定義すると、trace()がレイタイプ(SBToffset)ごとのトレース数を
+    //     RayStatisticsに数える。その場合OPTIXU_RAY_STATISTICSをRayStatistics型の式(例: plp.rayStats)として定義しておく。
+    //     Missプログラムでは先頭でcountMiss()を呼ぶ。traceVisibility()のミスは自動で数えられる。
+    //     アクティブなスレッドのうち同じカウンターに加算するスレッドをまとめ、代表のスレッドだけがアトミック加算を行う。
+    // EN: Defining OPTIXU_ENABLE_RAY_STATISTICS makes trace() count the number of traces per ray type (SBToffset)
+    //     into RayStatistics. In that case, define OPTIXU_RAY_STATISTICS as an expression of RayStatistics type
+    //     (e.g. plp.rayStats).
+    //     Call countMiss() at the beginning of miss programs. Misses of traceVisibility() are counted automatically.
+    //     Active threads adding to the same counter are grouped and only a leader thread performs an atomic add.
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+#   if !defined(OPTIXU_RAY_STATISTICS)
+#       error "Define OPTIXU_RAY_STATISTICS to use ray statistics."
+#   endif
+    namespace detail {
+        RT_DEVICE_FUNCTION void countRayStatistic(uint32_t counterIndex) {
+            const RayStatistics &rs = OPTIXU_RAY_STATISTICS;
+            if (rs.counters == nullptr)
+                return;
+            // JP: OptiXのプログラムではthreadIdxが意味を持たないのでレーン番号はレジスターから読む。
+            // EN: threadIdx is meaningless in OptiX programs, so read the lane index from the register.
+            uint32_t laneIndex;
+            asm volatile("mov.u32 %0, %%laneid;" : "=r"(laneIndex));
+            uint32_t activeMask = __activemask();
+#   if __CUDA_ARCH__ >= 700
+            uint32_t groupMask = __match_any_sync(activeMask, counterIndex);
+#   else
+            // JP: __match_any_sync()が無いアーキテクチャーではワープ全体が同じカウンターの場合だけ集約する。
+            // EN: Aggregate only when the entire warp shares the same counter on architectures
+            //     without __match_any_sync().
+            uint32_t leaderIndex = __shfl_sync(activeMask, counterIndex, __ffs(activeMask) - 1);
+            uint32_t groupMask = __ballot_sync(activeMask, counterIndex == leaderIndex) == activeMask ?
+                activeMask : (1u << laneIndex);
+#   endif
+            if (laneIndex == static_cast<uint32_t>(__ffs(groupMask) - 1))
+                atomicAdd(&rs.counters[counterIndex], static_cast<unsigned long long>(__popc(groupMask)));
+        }
+
+        RT_DEVICE_FUNCTION void countRayStatisticOfTrace(uint32_t rayType) {
+            const RayStatistics &rs = OPTIXU_RAY_STATISTICS;
+            // JP: 範囲外のレイタイプは最後のレイタイプに数える。
+            // EN: Count out-of-range ray types into the last ray type.
+            countRayStatistic(rayType < rs.numRayTypes ? rayType : rs.numRayTypes - 1);
+        }
+
+        RT_DEVICE_FUNCTION void countRayStatisticOfMiss() {
+            countRayStatistic((OPTIXU_RAY_STATISTICS).numRayTypes);
+        }
+    }
+#endif
+
+    RT_DEVICE_FUNCTION void countAnyHit() {
+#if defined(OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION)
+        detail::countTraversalEvent(TraversalEvent::AnyHit);
+#endif
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+        detail::countRayStatistic((OPTIXU_RAY_STATISTICS).numRayTypes + 1);
+#endif
+    }
+
+    RT_DEVICE_FUNCTION void countMiss() {
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+        detail::countRayStatisticOfMiss();
+#endif
+    }
+
+    RT_DEVICE_FUNCTION void countIntersection() {
+#if defined(OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION)
+        detail::countTraversalEvent(TraversalEvent::Intersection);
+#endif
+    }
+
     // JP: 右辺値参照でペイロードを受け取れば右辺値も受け取れて、かつ値の書き換えも反映できる。
     //     が、optixTraceに仕様をあわせることと、テンプレート引数の整合性チェックを簡単にするためただの参照で受け取る。
     // EN: Taking payloads as rvalue reference makes it possible to take rvalue while reflecting value changes.
@@ -501,6 +1548,12 @@ namespace optixu {
                                   PayloadTypes &... payloads) {
         constexpr size_t numDwords = detail::calcSumDwords<PayloadTypes...>();
         static_assert(numDwords <= 8, "Maximum number of payloads is 8 dwords.");
+#if defined(OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION)
+        detail::countTraversalEvent(TraversalEvent::Trace);
+#endif
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+        detail::countRayStatisticOfTrace(SBToffset);
+#endif
 
 #define OPTIXU_TRACE_ARGUMENTS \
     handle, \
@@ -538,6 +1591,57 @@ namespace optixu {
 
 
 
+    // JP: 可視性レイをトレースする。最初のヒットで終了し、Closest-Hitは呼ばれない。
+    //     ホスト側ではPipeline::setVisibilityRayType()でレイタイプを設定しておく。
+    // EN: Trace a visibility ray. It terminates on the first hit and closest-hit is not invoked.
+    //     Set the ray type up by Pipeline::setVisibilityRayType() on the host side.
+    RT_DEVICE_FUNCTION bool traceVisibility(OptixTraversableHandle handle,
+                                            const float3 &origin, const float3 &direction,
+                                            float tmin, float tmax, float rayTime,
+                                            OptixVisibilityMask visibilityMask,
+                                            uint32_t rayType, uint32_t numRayTypes,
+                                            OptixRayFlags additionalRayFlags = OPTIX_RAY_FLAG_NONE) {
+        uint32_t visible = 0;
+        trace(handle, origin, direction, tmin, tmax, rayTime, visibilityMask,
+              OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT | OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT | additionalRayFlags,
+              rayType, numRayTypes, rayType,
+              visible);
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+        if (visible != 0)
+            detail::countRayStatisticOfMiss();
+#endif
+        return visible != 0;
+    }
+
+    // JP: 確率的透明度による可視性レイをトレースする。thresholdはレイごとに1つの[0, 1)の乱数で、
+    //     ペイロード1に載せられ、Any-HitプログラムではoptixuのstochasticTransparencyAnyHit()で
+    //     各候補をアルファ値との1回の比較で受け入れるか無視する。最初に受け入れたヒットで終了するので、
+    //     半透明の候補ごとのAny-Hitの再入が透過率の累積に変わることはなく、呼び出し回数が抑えられる。
+    //     ホスト側ではPipeline::setVisibilityRayType()でレイタイプを設定し、ペイロードを2つ以上にしておく。
+    // EN: Trace a visibility ray with stochastic transparency. threshold is a random number in [0, 1) per ray
+    //     put on payload 1, and any-hit programs accept or ignore each candidate with a single comparison against
+    //     the alpha value by optixu's stochasticTransparencyAnyHit(). The ray terminates at the first accepted hit,
+    //     so any-hit re-entries per translucent candidate never turn into transmittance accumulation and
+    //     the number of calls is bounded.
+    //     Set the ray type up by Pipeline::setVisibilityRayType() and use two or more payloads on the host side.
+    RT_DEVICE_FUNCTION bool traceStochasticVisibility(OptixTraversableHandle handle,
+                                                      const float3 &origin, const float3 &direction,
+                                                      float tmin, float tmax, float rayTime,
+                                                      OptixVisibilityMask visibilityMask,
+                                                      uint32_t rayType, uint32_t numRayTypes, float threshold,
+                                                      OptixRayFlags additionalRayFlags = OPTIX_RAY_FLAG_NONE) {
+        uint32_t visible = 0;
+        trace(handle, origin, direction, tmin, tmax, rayTime, visibilityMask,
+              OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT | OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT | additionalRayFlags,
+              rayType, numRayTypes, rayType,
+              visible, threshold);
+#if defined(OPTIXU_ENABLE_RAY_STATISTICS)
+        if (visible != 0)
+            detail::countRayStatisticOfMiss();
+#endif
+        return visible != 0;
+    }
+
     template <typename... PayloadTypes>
     RT_DEVICE_FUNCTION void getPayloads(PayloadTypes*... payloads) {
         constexpr size_t numDwords = detail::calcSumDwords<PayloadTypes...>();
@@ -559,34 +1663,40 @@ namespace optixu {
 
 
     template <typename... AttributeTypes>
-    RT_DEVICE_FUNCTION void reportIntersection(float hitT, uint32_t hitKind,
+    RT_DEVICE_FUNCTION bool reportIntersection(float hitT, uint32_t hitKind,
                                                const AttributeTypes &... attributes) {
         constexpr size_t numDwords = detail::calcSumDwords<AttributeTypes...>();
         static_assert(numDwords <= 8, "Maximum number of attributes is 8 dwords.");
+        bool accepted = false;
         if constexpr (numDwords == 0) {
-            optixReportIntersection(hitT, hitKind);
+            accepted = optixReportIntersection(hitT, hitKind);
         }
         else {
             uint32_t a[numDwords];
             detail::packToUInts<0>(a, attributes...);
 
             if constexpr (numDwords == 1)
-                optixReportIntersection(hitT, hitKind, a[0]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0]);
             if constexpr (numDwords == 2)
-                optixReportIntersection(hitT, hitKind, a[0], a[1]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1]);
             if constexpr (numDwords == 3)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2]);
             if constexpr (numDwords == 4)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3]);
             if constexpr (numDwords == 5)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4]);
             if constexpr (numDwords == 6)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5]);
             if constexpr (numDwords == 7)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
             if constexpr (numDwords == 8)
-                optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+                accepted = optixReportIntersection(hitT, hitKind, a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
         }
+#if defined(OPTIXU_ENABLE_TRAVERSAL_INSTRUMENTATION)
+        if (accepted)
+            detail::countTraversalEvent(TraversalEvent::ReportedHit);
+#endif
+        return accepted;
     }
 
     template <typename... AttributeTypes>
@@ -640,6 +1750,135 @@ namespace optixu {
             detail::getValues<detail::ExceptionDetailFunc, 0>(details...);
     }
 
+
+
+
+    // JP: デバイス上でIASのインスタンスを生成する際のカリングとLOD選択のためのヘルパー。
+    //     ユーザーのカーネル内で候補インスタンスを選別し、生き残ったものをappendInstance()で
+    //     IASのインスタンスバッファーに詰めて書き込む。詳しくはIAS::setDeviceInstanceCount()を参照。
+    // EN: Helpers for culling and LOD selection when generating instances of an IAS on the device.
+    //     Filter candidate instances in a user kernel, then pack surviving ones into the instance buffer
+    //     of the IAS with appendInstance(). See IAS::setDeviceInstanceCount() for details.
+
+    // JP: 平面は内側が正となる(a, b, c, d)で表す。
+    // EN: Planes are represented as (a, b, c, d) with the inside positive.
+    RT_DEVICE_FUNCTION bool isAabbInFrustum(const float4 planes[6], const OptixAabb &aabb) {
+        for (int i = 0; i < 6; ++i) {
+            const float4 &p = planes[i];
+            float x = p.x >= 0.0f ? aabb.maxX : aabb.minX;
+            float y = p.y >= 0.0f ? aabb.maxY : aabb.minY;
+            float z = p.z >= 0.0f ? aabb.maxZ : aabb.minZ;
+            if (p.x * x + p.y * y + p.z * z + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // JP: 昇順のしきい値の列からLODレベルを選ぶ。最後のしきい値より遠い場合はnumLevelsを返す(カリング)。
+    // EN: Select a LOD level from ascending thresholds.
+    //     Return numLevels (culled) if farther than the last threshold.
+    RT_DEVICE_FUNCTION uint32_t selectLevelOfDetail(float distance, const float* lodDistances, uint32_t numLevels) {
+        uint32_t level = 0;
+        while (level < numLevels && distance > lodDistances[level])
+            ++level;
+        return level;
+    }
+
+    // JP: インスタンスをバッファーの末尾に追加する。容量を超えた場合はfalseを返すがカウンターは増え続ける。
+    // EN: Append an instance to the end of the buffer. Return false when exceeding the capacity,
+    //     but the counter keeps increasing.
+    RT_DEVICE_FUNCTION bool appendInstance(OptixInstance* instances, uint32_t* numInstances, uint32_t maxNumInstances,
+                                           const OptixInstance &instance) {
+        uint32_t index = atomicAdd(numInstances, 1u);
+        if (index >= maxNumInstances)
+            return false;
+        instances[index] = instance;
+        return true;
+    }
+
+    // JP: mergeTriangleMeshes()で結合したメッシュにおいて、プリミティブインデックスから元のメッシュのインデックスを求める。
+    //     primitiveOffsetsはnumMeshes + 1要素の累積和。
+    // EN: Find the index of the original mesh from a primitive index in meshes merged by mergeTriangleMeshes().
+    //     primitiveOffsets is the prefix sum with numMeshes + 1 elements.
+    RT_DEVICE_FUNCTION uint32_t findMergedMeshIndex(const uint32_t* primitiveOffsets, uint32_t numMeshes,
+                                                    uint32_t primIndex, uint32_t* localPrimIndex = nullptr) {
+        uint32_t lo = 0;
+        uint32_t hi = numMeshes;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (primitiveOffsets[mid] <= primIndex)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        if (localPrimIndex)
+            *localPrimIndex = primIndex - primitiveOffsets[lo];
+        return lo;
+    }
+
+    // JP: Scene::setMaterialDataOutOfRecordThreshold()によってレコード外に置かれたマテリアルのユーザーデータを取得する。
+    // EN: Fetch the user data of a material placed outside of the record by Scene::setMaterialDataOutOfRecordThreshold().
+    template <typename T>
+    RT_DEVICE_FUNCTION const T &getOutOfRecordMaterialData() {
+        auto data = *reinterpret_cast<const T* const*>(getHitGroupRecordDataPointer());
+        return *data;
+    }
+
+    // JP: Pipeline::launchBatched()による一括ローンチにおいて、現在のスレッドが属するエントリーと
+    //     そのエントリー内での起動インデックスを求める。dispatchTableはローンチパラメター経由で渡す。
+    // EN: Find the entry to which the current thread belongs and the launch index within the entry
+    //     in a batched launch by Pipeline::launchBatched(). Pass dispatchTable via launch parameters.
+    RT_DEVICE_FUNCTION uint32_t getBatchedLaunchIndex(
+        const BatchedLaunchEntry* dispatchTable, uint32_t numEntries, uint3* launchIndex) {
+        uint32_t threadIndex = optixGetLaunchIndex().x;
+        uint32_t lo = 0;
+        uint32_t hi = numEntries;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (dispatchTable[mid].threadOffset <= threadIndex)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        const BatchedLaunchEntry &entry = dispatchTable[lo];
+        uint32_t localIndex = threadIndex - entry.threadOffset;
+        launchIndex->x = localIndex % entry.dimX;
+        launchIndex->y = (localIndex / entry.dimX) % entry.dimY;
+        launchIndex->z = localIndex / (entry.dimX * entry.dimY);
+        return lo;
+    }
+
+    // JP: カスタムプリミティブのAABBを全モーションステップ分まとめて計算するヘルパー。
+    //     ユーザーカーネルから1スレッド1プリミティブで呼ぶ(スレッドインデックスはグローバルな1次元インデックス)。
+    //     boundsFuncは(uint32_t primIndex, float time, OptixAabb* aabb)の形で呼ばれる。
+    //     aabbBuffersはモーションステップごとのAABBバッファー(GeometryInstance::setCustomPrimitiveAABBBuffer()
+    //     に渡したもの)のポインター配列。timeはtimeBeginからtimeEndまでをステップ数で均等に分割した値。
+    //     ホスト側ではカーネル実行後に所属するGASのmarkDirty()もしくはアップデートを呼ぶ必要がある。
+    // EN: Helper to compute AABBs of custom primitives for all motion steps at once.
+    //     Call from a user kernel with one thread per primitive (thread index is the global 1D index).
+    //     boundsFunc is called in the form of (uint32_t primIndex, float time, OptixAabb* aabb).
+    //     aabbBuffers is an array of pointers to AABB buffers per motion step
+    //     (ones passed to GeometryInstance::setCustomPrimitiveAABBBuffer()).
+    //     time is a value evenly dividing timeBegin to timeEnd by the number of steps.
+    //     Host side needs to call markDirty() or update of the GAS to which the geometry instance belongs
+    //     after the kernel execution.
+    template <typename BoundsFunc>
+    RT_DEVICE_FUNCTION void computeCustomPrimitiveAABBs(
+        const BoundsFunc &boundsFunc, OptixAabb* const* aabbBuffers, uint32_t numMotionSteps,
+        float timeBegin, float timeEnd, uint32_t numPrimitives) {
+        uint32_t primIndex = blockDim.x * blockIdx.x + threadIdx.x;
+        if (primIndex >= numPrimitives)
+            return;
+
+        float timeStep = numMotionSteps > 1 ? (timeEnd - timeBegin) / (numMotionSteps - 1) : 0.0f;
+        for (uint32_t stepIdx = 0; stepIdx < numMotionSteps; ++stepIdx) {
+            float time = timeBegin + timeStep * stepIdx;
+            OptixAabb aabb;
+            boundsFunc(primIndex, time, &aabb);
+            aabbBuffers[stepIdx][primIndex] = aabb;
+        }
+    }
+
 #endif // #if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
     // END: Device-side function wrappers
     // ----------------------------------------------------------------
@@ -655,6 +1894,10 @@ namespace optixu {
     Context --+-- Pipeline --+-- Module
               |              |
               |              +-- ProgramGroup
+              |              |
+              |              +-- CallableProgramTable
+              |
+              +-- PipelineVariantCache
               |
               +-- Material
               |
@@ -689,6 +1932,8 @@ namespace optixu {
     OPTIXU_PREPROCESS_OBJECT(Pipeline); \
     OPTIXU_PREPROCESS_OBJECT(Module); \
     OPTIXU_PREPROCESS_OBJECT(ProgramGroup); \
+    OPTIXU_PREPROCESS_OBJECT(CallableProgramTable); \
+    OPTIXU_PREPROCESS_OBJECT(PipelineVariantCache); \
     OPTIXU_PREPROCESS_OBJECT(Denoiser);
 
     // Forward Declarations
@@ -724,6 +1969,138 @@ namespace optixu {
         Invalid
     };
 
+    // JP: SBTレイアウト生成時のジオメトリーフラグの推定の動作。
+    //     Report: エニーヒットを持つヒットグループが一つも結び付いていないのに
+    //             OPTIX_GEOMETRY_FLAG_DISABLE_ANYHITが設定されていないマテリアルスロットを報告する。
+    //     Apply: 報告に加えてそのスロットのビルド入力にフラグを設定し、該当するGASをdirty状態にする。
+    // EN: Behavior of the geometry flag inference at the SBT layout generation.
+    //     Report: Report material slots without OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT even though no hit group with
+    //             an any-hit program is bound to them.
+    //     Apply: In addition to reporting, set the flag to build inputs of the slots and mark the GASs dirty.
+    enum class GeometryFlagInference {
+        Disabled = 0,
+        Report,
+        Apply,
+    };
+
+    // JP: GAS/IASのビルドに関する統計情報。時間は各操作の直近の値(ミリ秒)。
+    // EN: Statistics about building a GAS/IAS. Times are the latest values of each operation in milliseconds.
+    struct ASStatistics {
+        float buildTimeInMs;
+        float updateTimeInMs;
+        float compactionTimeInMs;
+        size_t uncompactedSizeInBytes;
+        size_t compactedSizeInBytes;
+        size_t scratchSizeInBytes;
+        size_t updateScratchSizeInBytes;
+        uint32_t numBuildInputs;
+        uint32_t numBuilds;
+        uint32_t numUpdates;
+        uint32_t numCompactions;
+    };
+
+    // JP: 他のプロセスが読み取り専用でアタッチするための、ビルド済みASのメタデータ。
+    //     プロセス間で受け渡せるようにポインターを含まない。
+    // EN: Metadata of a built AS for another process to attach read-only.
+    //     This contains no pointers so that it can be passed between processes.
+    struct SharedASDesc {
+        uint64_t buildInputHash;
+        OptixAccelRelocationInfo relocationInfo;
+        CUdeviceptr accelBufferAddress;
+        uint64_t accelSize;
+        OptixTraversableHandle handle;
+        uint32_t compacted;
+    };
+
+    // JP: シーン中の全GAS/IASのメモリ使用量の集計。
+    //     residentはremoveUncompacted()されていないバッファーも含めた現在保持されている量。
+    // EN: Aggregation of memory usage of all the GASs/IASs in a scene.
+    //     "resident" is the amount currently held including buffers that are not removed by removeUncompacted().
+    struct SceneMemoryReport {
+        uint32_t numGASs;
+        uint32_t numIASs;
+        size_t gasUncompactedSizeInBytes;
+        size_t gasCompactedSizeInBytes;
+        size_t gasResidentSizeInBytes;
+        size_t iasUncompactedSizeInBytes;
+        size_t iasCompactedSizeInBytes;
+        size_t iasResidentSizeInBytes;
+        size_t instanceBufferSizeInBytes;
+        size_t maxScratchSizeInBytes;
+        size_t maxUpdateScratchSizeInBytes;
+        float totalBuildTimeInMs;
+        float totalUpdateTimeInMs;
+        float totalCompactionTimeInMs;
+    };
+
+    // JP: Scene::setResidencyBudget()によるGASのレジデンシー管理の状態。
+    //     サイズは退避可能なGASのコンパクト後のサイズの合計。
+    // EN: State of GAS residency management by Scene::setResidencyBudget().
+    //     Sizes are sums of compacted sizes of evictable GASs.
+    struct GASResidencyStatistics {
+        size_t budgetInBytes;
+        size_t residentSizeInBytes;
+        size_t evictedSizeInBytes;
+        uint32_t numResidentGASs;
+        uint32_t numEvictedGASs;
+        uint64_t numEvictions;
+        uint64_t numRestorations;
+    };
+
+    // JP: Context::getModuleCacheStatistics()が返すモジュール生成とキャッシュキーの一致の統計。
+    // EN: Statistics of module creations and cache key matches returned by Context::getModuleCacheStatistics().
+    struct ModuleCacheStatistics {
+        uint32_t numModuleCreations;
+        uint32_t numKeyHits;
+        uint32_t numKeyMisses;
+        float totalCompileTimeInMs;
+        // JP: createModuleFromCUDASource()によるCUDAソースからPTXへのコンパイルの統計。
+        // EN: Statistics of compilations from CUDA source to PTX by createModuleFromCUDASource().
+        uint32_t numPTXCompilations;
+        uint32_t numPTXCacheHits;
+        float totalPTXCompileTimeInMs;
+    };
+
+    // JP: 現在と同じ値による設定(変換、ID、ユーザーデータなど)を検出してdirty化を省いた回数。
+    // EN: Numbers of settings with the same values as the current ones (transforms, IDs, user data and so on)
+    //     detected and skipped dirtying.
+    struct RedundantUpdateStatistics {
+        uint64_t numSkippedInstanceUpdates;
+        uint64_t numSkippedTransformUpdates;
+        uint64_t numSkippedUserDataUpdates;
+    };
+
+    // JP: numTasks個のタスクtask(taskData, taskIndex)を(並列に)実行し、全て完了してから戻る関数。
+    // EN: A function which executes numTasks tasks task(taskData, taskIndex) (in parallel)
+    //     and returns after all of them complete.
+    typedef void (*TaskFunction)(void* taskData, uint32_t taskIndex);
+    typedef void (*TaskExecutor)(void* executorData, uint32_t numTasks, TaskFunction task, void* taskData);
+
+    // JP: ASのビルド、パイプラインのローンチ、デノイズの前後でストリームとともに呼ばれる関数。
+    //     GPUプロファイラーのスコープを開始、終了するのに使う。
+    // EN: A function called with the stream before and after AS builds, pipeline launches and denoising.
+    //     This is used to begin and end scopes of a GPU profiler.
+    typedef void (*ProfileScopeCallback)(void* userData, const char* name, CUstream stream);
+
+    // JP: パイプラインバリアントのキャッシュが新たなバリアントを構築、破棄するときに呼ぶ関数。
+    //     構築関数は与えられた束縛値でモジュールを生成し、プログラムの設定とリンクまで行う。
+    // EN: Functions called by a pipeline variant cache to build and destroy a variant.
+    //     The build function creates modules with the given bound values, then sets programs and links.
+    typedef void (*PipelineVariantBuildFunction)(void* userData, Pipeline pipeline,
+                                                 const OptixModuleCompileBoundValueEntry* boundValues,
+                                                 uint32_t numBoundValues);
+    typedef void (*PipelineVariantDestroyFunction)(void* userData, Pipeline pipeline);
+
+    // JP: パイプラインを事前構築するレシピ。与えられたパイプラインに対してパイプラインオプションの設定、
+    //     モジュールとプログラムの生成、リンクまで行う。ワーカースレッドから呼ばれる。
+    // EN: A recipe to build a pipeline in advance. Set pipeline options, create modules and programs,
+    //     then link the given pipeline. This is called from a worker thread.
+    typedef void (*PipelineRecipeFunction)(void* userData, Pipeline pipeline);
+
+    // JP: 遅延させたリソースの解放を、それを使い得るフレームの完了後に行う関数。
+    // EN: A function to release a deferred resource after the completion of frames that may use it.
+    typedef void (*DeferredReleaseFunction)(void* userData);
+
     class BufferView {
         CUdeviceptr m_devicePtr;
         size_t m_numElements;
@@ -793,15 +2170,92 @@ private: \
         CUcontext getCUcontext() const;
 
         void setLogCallback(OptixLogCallback callback, void* callbackData, uint32_t logLevel) const;
+        // JP: 両方にnullptrを渡すとフックを解除する。
+        // EN: Passing nullptr to both detaches the hooks.
+        void setProfileScopeCallbacks(ProfileScopeCallback beginScope, ProfileScopeCallback endScope,
+                                      void* userData) const;
+
+        // JP: stream上のそれまでの処理が完了した後、processDeferredReleases()の中で関数を呼ぶ。
+        //     GPUが使用中かもしれないリソースの解放を、同期を待たずに予約するのに使う。
+        // EN: Call the function in processDeferredReleases() after the preceding work on the stream completes.
+        //     This is used to schedule releasing resources the GPU may be using without waiting for synchronization.
+        void deferRelease(CUstream stream, DeferredReleaseFunction func, void* userData) const;
+        // JP: stream上のそれまでの処理が完了した後にオブジェクトのdestroy()を呼ぶ。
+        // EN: Call destroy() of the object after the preceding work on the stream completes.
+        template <typename T>
+        void deferDestroy(CUstream stream, T object) const {
+            deferRelease(
+                stream,
+                [](void* userData) {
+                    T* obj = static_cast<T*>(userData);
+                    obj->destroy();
+                    delete obj;
+                },
+                new T(object));
+        }
+        // JP: 完了した遅延解放を実行し、その数を返す。イベントの問い合わせのみなのでフレームごとに呼ぶことを想定している。
+        //     waitがtrueの場合は全ての遅延解放の完了を待つ。
+        // EN: Execute deferred releases that have completed and return the number of them.
+        //     This only queries events, so it is supposed to be called every frame.
+        //     When wait is true, wait for the completion of all the deferred releases.
+        uint32_t processDeferredReleases(bool wait = false) const;
+        uint32_t getNumPendingDeferredReleases() const;
+
+        // JP: OptiXのディスクキャッシュ(コンパイル済みモジュールのデータベース)を設定する。
+        //     複数のノードやサービスの再起動間でキャッシュを共有するには同じ場所を指定する。
+        // EN: Configure OptiX's disk cache (database of compiled modules).
+        //     Specify the same location to share the cache among multiple nodes or across service restarts.
+        void setDiskCacheEnabled(bool enable) const;
+        void setDiskCacheLocation(const std::string &location) const;
+        void setDiskCacheDatabaseSizes(size_t lowWaterMark, size_t highWaterMark) const;
+        bool getDiskCacheEnabled() const;
+
+        // JP: モジュール生成の統計を取得する。キーはPTX、コンパイルオプション、パイプラインのコンパイルオプション、
+        //     ドライバーとOptiXのバージョンから計算され、このコンテキストで既に生成したキーならヒットとする。
+        //     コンパイル時間にはディスクキャッシュの効果が現れる。
+        // EN: Get statistics of module creations. The key is computed from PTX, compile options,
+        //     pipeline compile options, driver and OptiX versions, and a key already created in this context counts
+        //     as a hit. The compile time reflects the effect of the disk cache.
+        void getModuleCacheStatistics(ModuleCacheStatistics* stats) const;
+        // JP: Instance, Transformのsetter, 各オブジェクトのsetUserData()は値が現在と同じ場合に何もdirty化しない。
+        //     それによってIASやTransformの再ビルド、SBTレコードの転送を省いた回数を取得する。
+        // EN: Setters of Instance, Transform and setUserData() of each object dirty nothing
+        //     when the values are the same as the current ones.
+        //     Get the numbers of times this skipped rebuilds of IASs and transforms and transfers of SBT records.
+        void getRedundantUpdateStatistics(RedundantUpdateStatistics* stats) const;
+        void resetRedundantUpdateStatistics() const;
+        // JP: createModuleFromCUDASource()が生成したPTXをソース、ヘッダー、オプションのハッシュをファイル名として保存する
+        //     ディレクトリーを設定する。空文字列の場合はメモリー上にのみキャッシュする。
+        // EN: Set a directory to store PTXes generated by createModuleFromCUDASource() with the hash of
+        //     the source, headers and the options as the file name. Cache only in memory when empty.
+        void setPTXCacheLocation(const std::string &location) const;
 
         [[nodiscard]]
         Pipeline createPipeline() const;
+        // JP: パイプラインのレシピを名前とともに登録し、即座にワーカースレッドで構築を開始する。
+        //     Context::create()の直後に登録すれば、コンパイルとリンクがアセットの読み込みと並行に進む。
+        //     createPipeline(recipeName)は構築の完了を待って構築済みのパイプラインを返す(破棄は呼び出し側が行う)。
+        //     2回目以降の呼び出しでは呼び出しスレッド上でレシピから新たに構築する。
+        //     構築中のエラーはcreatePipeline(recipeName)の時点で例外として送出される。
+        // EN: Register a pipeline recipe with a name and immediately start building it on a worker thread.
+        //     Registering right after Context::create() lets compilation and linking run in parallel with asset loading.
+        //     createPipeline(recipeName) waits for the build to complete and returns the built pipeline
+        //     (the caller destroys it). Subsequent calls build a new one from the recipe on the calling thread.
+        //     An error during the build is thrown as an exception at createPipeline(recipeName).
+        void registerPipelineRecipe(const std::string &name, PipelineRecipeFunction recipe, void* userData) const;
+        bool isPipelineRecipeReady(const std::string &name) const;
+        [[nodiscard]]
+        Pipeline createPipeline(const std::string &recipeName) const;
         [[nodiscard]]
         Material createMaterial() const;
         [[nodiscard]]
         Scene createScene() const;
         [[nodiscard]]
         Denoiser createDenoiser(OptixDenoiserModelKind modelKind, bool guideAlbedo, bool guideNormal) const;
+        [[nodiscard]]
+        PipelineVariantCache createPipelineVariantCache(PipelineVariantBuildFunction buildFunc,
+                                                        PipelineVariantDestroyFunction destroyFunc,
+                                                        void* userData, uint32_t maxNumVariants) const;
     };
 
 
@@ -824,6 +2278,21 @@ private: \
         //     a shader binding table, the invalidation of the layout is required as well by calling
         //     scene's markShaderBindingTableLayoutDirty().
         void setHitGroup(uint32_t rayType, ProgramGroup hitGroup) const;
+        // JP: 同じパイプライン・レイタイプに設定済みのヒットグループを差し替える。
+        //     レコードのサイズは変わらないので、SBTのレイアウトやオフセットは一切変化せず、ASのリビルドも不要。
+        //     ダーティー化の呼び出しも不要で、次のローンチ時にこのマテリアルを参照するレコードの
+        //     ヘッダーだけがその場で書き換えられて転送される。シェーダーの対話的な編集などに使う。
+        //     ただしエニーヒットを追加する差し替えでは、ジオメトリフラグの推定が有効なシーンのレイアウトが
+        //     無効化される。
+        // EN: Replace the hit group already set for the same pipeline and ray type.
+        //     The record size doesn't change, so the layout and offsets of the SBT are never changed,
+        //     and no AS rebuild is required.
+        //     No dirty marking call is required either, only the headers of records referring this material
+        //     are rewritten in place and transferred at the next launch.
+        //     Useful e.g. for interactive shader editing.
+        //     However a replacement adding any-hit invalidates the layouts of scenes with geometry flag inference
+        //     enabled.
+        void replaceHitGroup(uint32_t rayType, ProgramGroup hitGroup) const;
         void setUserData(const void* data, uint32_t size, uint32_t alignment) const;
         template <typename T>
         void setUserData(const T &data) const {
@@ -840,6 +2309,24 @@ private: \
 
 
 
+    // JP: スレッド安全性:
+    //     - シーンからのオブジェクト(GeometryInstance, GAS, Transform, Instance, IAS)の生成と破棄は
+    //       複数スレッドから並行に行える。
+    //     - 異なるオブジェクトの設定(バッファーやマテリアルの設定、子の追加など)とASのビルドは並行に行える。
+    //       同じオブジェクトを複数スレッドから設定する場合は呼び出し側での同期が必要。
+    //     - generateShaderBindingTableLayout(), isReady(), まとめてのASビルドは同期点であり、
+    //       他のスレッドでの生成や設定が完了した後に1つのスレッドから呼ぶ。
+    // EN: Thread safety:
+    //     - Creating and destroying objects (GeometryInstance, GAS, Transform, Instance, IAS) from a scene
+    //       can be done concurrently from multiple threads.
+    //     - Configuring different objects (setting buffers and materials, adding children and so on)
+    //       and building ASs can be done concurrently.
+    //       Configuring the same object from multiple threads requires synchronization by the caller.
+    //     - generateShaderBindingTableLayout(), isReady() and batched AS builds are sync points;
+    //       call them from a single thread after creation and configuration in other threads complete.
+    struct FlattenedInstance;
+    struct GeometryFlagSuggestion;
+    struct InstanceDesc;
     class Scene {
         OPTIXU_PIMPL();
 
@@ -858,13 +2345,284 @@ private: \
         [[nodiscard]]
         InstanceAccelerationStructure createInstanceAccelerationStructure() const;
 
+        // JP: 多数のオブジェクトをまとめて生成する。内部データはプールからまとめて確保され、
+        //     descsの検証は生成前に一度だけ行われる。descsにnullptrを渡すと既定値のインスタンスを生成する。
+        // EN: Create many objects together. Internal data are allocated from the pool together,
+        //     and descs are validated only once before creation.
+        //     Passing nullptr to descs creates instances with default values.
+        void createGeometryInstances(GeometryType geomType, uint32_t count, GeometryInstance* geomInsts) const;
+        void createInstances(uint32_t count, const InstanceDesc* descs, Instance* instances) const;
+
+        // JP: 入れ子のIASと静的Transformの連鎖を展開し、インスタンスの変換行列を焼き込んだ単一階層のIASを生成する。
+        //     走査の深さが減るので、setStackSize()のmaxTraversableGraphDepthも小さくできる。
+        //     展開後のインスタンス数がmaxNumInstancesを超える場合は何も生成せず無効なIASを返す。
+        //     indexMapのi番目が生成されたIASのi番目の子(optixGetInstanceIndex())に対応し、元の階層との対応を保持する。
+        //     インスタンスIDはGASを直接参照していた元のインスタンスのものを引き継ぐ。
+        //     可視性マスクは経路上のマスクの論理積、フラグとマテリアルセットはGASに最も近いインスタンスのものになる。
+        //     階層ごとのマスク判定と等価にするため、論理積が経路上のいずれのマスクとも一致しない経路
+        //     (例えば0x01と0x02のように包含関係の無いマスクを重ねた経路)がある場合も何も生成せず無効なIASを返す。
+        //     モーションTransformは焼き込めないので、生成されたインスタンスの子として残る。
+        //     生成されたIASとindexMap中のインスタンスの破棄は呼び出し側が行う。元の階層は変更しない。
+        // EN: Expand nested IASs and chains of static transforms, then create a single-level IAS
+        //     with baked instance transforms.
+        //     This reduces the traversal depth, so maxTraversableGraphDepth of setStackSize() can be smaller as well.
+        //     When the number of instances after the expansion exceeds maxNumInstances, create nothing and
+        //     return an invalid IAS.
+        //     The i-th element of indexMap corresponds to the i-th child (optixGetInstanceIndex()) of the created IAS
+        //     and holds the correspondence to the original hierarchy.
+        //     The instance ID is inherited from the original instance that directly referred to the GAS.
+        //     The visibility mask is the logical AND of masks along the path, and the flags and the material set
+        //     are those of the instance closest to the GAS.
+        //     To stay equivalent to the per-level mask test, when there is a path whose AND matches none of
+        //     the masks along it (e.g. a path stacking masks without inclusion like 0x01 and 0x02),
+        //     create nothing and return an invalid IAS as well.
+        //     Motion transforms cannot be baked, so they remain as children of created instances.
+        //     The caller destroys the created IAS and the instances in indexMap.
+        //     The original hierarchy is not modified.
+        [[nodiscard]]
+        InstanceAccelerationStructure flattenInstanceHierarchy(
+            InstanceAccelerationStructure ias, uint32_t maxNumInstances,
+            std::vector<FlattenedInstance>* indexMap) const;
+
         // JP: シェーダーバインディングテーブルレイアウトをdirty状態にする。
         // EN: Mark the layout of shader binding table dirty.
         void markShaderBindingTableLayoutDirty() const;
 
+        // JP: 有効にすると、レイアウト生成時にGASとマテリアルセットに対応するレコード範囲の内容
+        //     (マテリアルとユーザーデータ)をハッシュし、同一の範囲をインスタンスのsbtOffsetを通じて共有させる。
+        //     共有された範囲の内容がレイアウト生成後に変わった場合はレイアウトが自動で無効化される。
+        // EN: When enabled, hash the contents (materials and user data) of record ranges corresponding to a GAS
+        //     and a material set at the layout generation, and let identical ranges be shared through
+        //     instances' sbtOffset.
+        //     The layout is automatically invalidated when the contents of a shared range change after
+        //     the layout generation.
+        void enableShaderBindingTableRecordSharing(bool enable) const;
+
+        // JP: 有効にすると、ヒットグループレコードのデータ部分(マテリアル、GeometryInstance、GASの子、GASの
+        //     ユーザーデータ)をシーンが管理するデバイス上のテーブルに一度だけ書き込み、全パイプラインで共有する。
+        //     各パイプラインのSBTレコードはヘッダーとテーブル中の対応するレコードのアドレスのみを持つので、
+        //     レコードのメモリはマテリアル数×パイプライン数ではなくマテリアル数に比例する。
+        //     デバイス側ではOPTIXU_SHARED_HIT_GROUP_RECORD_DATAを定義し、
+        //     optixGetSbtDataPointer()の代わりにgetHitGroupRecordDataPointer()を使う必要がある。
+        //     テーブルはいずれかのパイプラインのローンチ時に、そのストリーム上で更新される。
+        // EN: When enabled, write the data part of hit group records (material, geometry instance, GAS child,
+        //     GAS user data) only once into a device table managed by the scene, and share it among all pipelines.
+        //     SBT records of each pipeline hold only the header and the address of the corresponding record in the table,
+        //     so record memory scales with the number of materials instead of materials times pipelines.
+        //     On the device side, defining OPTIXU_SHARED_HIT_GROUP_RECORD_DATA and using
+        //     getHitGroupRecordDataPointer() instead of optixGetSbtDataPointer() is required.
+        //     The table is updated at a launch of any pipeline on its stream.
+        void enableHitGroupRecordDataSharing(bool enable) const;
+
+        // JP: SBTレイアウト生成とヒットグループSBTの書き込みをGASの範囲ごとのタスクに分けて
+        //     ユーザーのエグゼキューター(スレッドプールなど)で実行させる。nullptrで逐次実行に戻る。
+        //     エグゼキューターはシーンのAPIを呼んだスレッドからのみ呼ばれる。
+        // EN: Split the SBT layout generation and the hit group SBT filling into tasks per GAS range
+        //     and let the user's executor (e.g. a thread pool) execute them. nullptr returns to sequential execution.
+        //     The executor is called only from the thread that called the scene's API.
+        void setTaskExecutor(TaskExecutor executor, void* executorData) const;
+
+        // JP: サイズがthresholdバイトを超えるマテリアルのユーザーデータを、シーンが管理する密に詰めたデバイス上の
+        //     テーブルに置き、SBTレコードにはそのアドレス(CUdeviceptr)のみを持たせる。
+        //     一部の大きなマテリアルによって全レコードのサイズが膨らむのを防ぐ。0を指定すると無効になる。
+        //     デバイス側ではgetOutOfRecordMaterialData<T>()で取得できる。
+        //     テーブルはヒットグループSBTのセットアップ時に転送される。
+        // EN: Place user data of materials whose size exceeds threshold bytes in a densely packed device table
+        //     managed by the scene, and let SBT records hold only its address (CUdeviceptr).
+        //     This prevents a few large materials from inflating the size of all records. Specifying 0 disables it.
+        //     Use getOutOfRecordMaterialData<T>() on the device side to fetch it.
+        //     The table is transferred at the setup of the hit group SBT.
+        void setMaterialDataOutOfRecordThreshold(uint32_t threshold) const;
+        size_t getMaterialDataTableSize() const;
+
+        // JP: レイアウト生成時に、各GeometryInstanceのマテリアルスロットに全マテリアルセットで結び付いた
+        //     マテリアル(とGASの一様なレイタイプのマテリアル)のヒットグループを調べ、どのレイタイプにも
+        //     エニーヒットプログラムが無ければOPTIX_GEOMETRY_FLAG_DISABLE_ANYHITを提案または設定する。
+        //     マテリアルがヒットグループを持たないレイタイプでは、マテリアルにヒットグループを登録した
+        //     パイプラインの既定のヒットグループを調べる。
+        //     フラグはGASのビルド入力に反映されるので、Applyの場合はレイアウト生成をGASのビルドより前に行うと
+        //     ビルドが一度で済む。推定で設定したフラグはエニーヒットが必要になった場合や
+        //     モードを変えた場合に外される。setGeometryFlags()で明示したスロットは推定の対象外となる。
+        //     マテリアルのsetHitGroup()やreplaceHitGroup()、パイプラインのsetDefaultHitGroup()で
+        //     エニーヒットが追加された場合は、推定が有効な全シーンのレイアウトが自動的に無効化される。
+        // EN: At the layout generation, inspect hit groups of materials bound to each material slot of geometry
+        //     instances across all material sets (and materials of uniform ray types of GASs), then suggest or set
+        //     OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT if there is no any-hit program for any ray type.
+        //     For ray types for which a material doesn't have a hit group, inspect the default hit groups of
+        //     pipelines with which the material has registered hit groups.
+        //     The flag is reflected to the build inputs of GASs, so for Apply, generating the layout before building
+        //     GASs makes a single build suffice. Flags set by the inference are removed when any-hit becomes necessary
+        //     or the mode is changed. Slots explicitly set by setGeometryFlags() are excluded from the inference.
+        //     When any-hit is added by material's setHitGroup() or replaceHitGroup() or pipeline's
+        //     setDefaultHitGroup(), the layouts of all scenes with the inference enabled are invalidated automatically.
+        void setGeometryFlagInference(GeometryFlagInference mode) const;
+        // JP: 直近のレイアウト生成で見つかったスロットを返す。
+        // EN: Return slots found at the latest layout generation.
+        void getGeometryFlagSuggestions(std::vector<GeometryFlagSuggestion>* suggestions) const;
+
         void generateShaderBindingTableLayout(size_t* memorySize) const;
 
         bool shaderBindingTableLayoutIsReady() const;
+
+        // JP: シェーダーバインディングテーブルレイアウト中の、GASとマテリアルセットに対応するオフセットを返す。
+        //     デバイス上でOptixInstanceを書き込む場合に、これを使ってsbtOffsetのテーブルを用意できる。
+        // EN: Return the offset corresponding to a GAS and a material set in the shader binding table layout.
+        //     Use this to prepare a table of sbtOffsets in the case writing OptixInstances on the device.
+        uint32_t getShaderBindingTableOffset(GeometryAccelerationStructure gas, uint32_t matSetIdx) const;
+
+        // JP: 可視性マスクのビットを名前付きのカテゴリー(例: "camera", "shadow", "light")に割り当て、ビット位置を返す。
+        //     登録済みの名前に対しては既存のビット位置を返す。
+        //     ビット数はContext::getNumVisibilityMaskBits()が上限となる。
+        // EN: Allocate a visibility mask bit to a named category (e.g. "camera", "shadow", "light")
+        //     and return the bit position.
+        //     Return the existing bit position for an already registered name.
+        //     The number of bits is limited by Context::getNumVisibilityMaskBits().
+        uint32_t registerVisibilityCategory(const std::string &name) const;
+        uint32_t getNumVisibilityCategories() const;
+        uint32_t calcVisibilityMask(const std::vector<std::string> &categories) const;
+        // JP: レイタイプごとに可視とするカテゴリーを定義する。未定義のレイタイプは全ビットが立ったマスクとなる。
+        //     getRayTypeVisibilityMasks()の結果をローンチパラメターなどに置いてoptixTrace()のマスクに使う。
+        // EN: Define categories visible for each ray type. An undefined ray type has a mask with all bits set.
+        //     Place the result of getRayTypeVisibilityMasks() in launch parameters or similar
+        //     and use it as the mask for optixTrace().
+        void setRayTypeVisibility(uint32_t rayType, const std::vector<std::string> &categories) const;
+        uint32_t getRayTypeVisibilityMask(uint32_t rayType) const;
+        void getRayTypeVisibilityMasks(uint32_t* masks, uint32_t numRayTypes) const;
+
+        // JP: dirty状態(未ビルド)の全GASに対してprepareForBuild()を呼び、まとめてビルドするのに必要なメモリ量を返す。
+        //     outputSizeInBytesは各GASのアクセラレーションバッファーをアラインメントを考慮して並べた合計、
+        //     tempSizeInBytesは全GAS中の最大値となる。
+        // EN: Call prepareForBuild() for all the dirty (not built) GASs and return the memory requirement
+        //     to build them together.
+        //     outputSizeInBytes is the sum of acceleration buffers of the GASs laid out with alignment,
+        //     and tempSizeInBytes is the maximum among all the GASs.
+        void prepareForBuildDirtyGeometryASs(OptixAccelBufferSizes* memoryRequirement) const;
+        // JP: prepareForBuildDirtyGeometryASs()で集めたGASを、与えられたバッファーを分割・共有して連続でリビルドする。
+        //     各GASのハンドルはGASのgetHandle()で取得する。
+        // EN: Rebuild GASs collected by prepareForBuildDirtyGeometryASs() back-to-back by splitting/sharing
+        //     the given buffers.
+        //     Obtain the handle of each GAS by the GAS's getHandle().
+        void buildDirtyGeometryASs(CUstream stream, const BufferView &accelBuffer, const BufferView &scratchBuffer) const;
+        // JP: GASのビルドを複数のワーカーストリームに分散して並列に行う。
+        //     ワーカーストリームはstream上のそれまでの処理を待ち、streamは全ワーカーストリームの完了を待つ。
+        //     スクラッチバッファーにはワーカーストリームの数だけ
+        //     (OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENTに切り上げた)tempSizeInBytesが必要。
+        // EN: Build GASs in parallel by distributing them among multiple worker streams.
+        //     Worker streams wait for the preceding work on the stream, and the stream waits for all the worker streams.
+        //     The scratch buffer requires tempSizeInBytes (rounded up to OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT)
+        //     times the number of worker streams.
+        void buildDirtyGeometryASs(CUstream stream, const CUstream* workerStreams, uint32_t numWorkerStreams,
+                                   const BufferView &accelBuffer, const BufferView &scratchBuffer) const;
+
+        // JP: dirty状態(未ビルド)の全Transformを一つの連続したデバイスメモリにOPTIX_TRANSFORM_BYTE_ALIGNMENTで
+        //     並べるのに必要なサイズを返す。
+        // EN: Return the size required to lay out all the dirty (not built) transforms in a single contiguous
+        //     device memory with OPTIX_TRANSFORM_BYTE_ALIGNMENT.
+        void prepareForBuildDirtyTransforms(size_t* memorySize) const;
+        // JP: prepareForBuildDirtyTransforms()で集めたTransformをpinnedメモリ経由の一回のコピーでまとめてアップロードし、
+        //     全てのハンドルを求める。子のGAS/IASは先にビルドされている必要がある。
+        // EN: Upload the transforms collected by prepareForBuildDirtyTransforms() together with a single copy
+        //     via pinned memory, then compute all the handles. Child GASs/IASs must have been built beforehand.
+        void buildDirtyTransforms(CUstream stream, const BufferView &trDeviceMem) const;
+
+        // JP: IAS/Transformの子の参照から依存関係を辿り、dirty状態のノードとその上位のノードを
+        //     buildDirty()で処理するために集め、必要なスクラッチバッファーのサイズを返す。
+        //     各GAS/Transform/IASは前回のビルドで与えられたバッファー上にビルドし直されるため、
+        //     一度は明示的なバッファーでビルド(遅延ビルドのGASを除く)されていて、それが有効である必要がある。
+        // EN: Traverse dependencies through child references of IASs/transforms, collect dirty nodes and
+        //     nodes above them to be processed by buildDirty(), then return the required scratch buffer size.
+        //     Each GAS/transform/IAS is rebuilt on the buffers given in its previous build,
+        //     so it must have been built once with explicit buffers (except for lazy-build GASs)
+        //     and the buffers must remain valid.
+        void prepareForBuildDirty(size_t* scratchBufferSize) const;
+        // JP: prepareForBuildDirty()で集めたノードを依存の深さ順に処理する。
+        //     IASは子のハンドルが変わらずアップデートが許可されていればアップデート、そうでなければリビルドする。
+        // EN: Process the nodes collected by prepareForBuildDirty() in order of dependency depth.
+        //     An IAS is updated when its children's handles don't change and update is allowed, otherwise rebuilt.
+        void buildDirty(CUstream stream, const BufferView &scratchBuffer) const;
+        // JP: 同じ深さの互いに独立なノードを複数のワーカーストリームに分散して処理する。
+        //     スクラッチバッファーにはワーカーストリームの数だけ
+        //     (OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENTに切り上げた)prepareForBuildDirty()のサイズが必要。
+        // EN: Process mutually independent nodes at the same depth by distributing them among worker streams.
+        //     The scratch buffer requires the size from prepareForBuildDirty()
+        //     (rounded up to OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT) times the number of worker streams.
+        void buildDirty(CUstream stream, const CUstream* workerStreams, uint32_t numWorkerStreams,
+                        const BufferView &scratchBuffer) const;
+
+        // JP: シーン中の全GAS/IASのサイズと(統計が有効なものの)ビルド時間を集計する。
+        //     計測中の操作がある場合はその完了をホスト側で待つ。
+        // EN: Aggregate the sizes and build times (of ones with statistics enabled) of all the GASs/IASs in the scene.
+        //     Wait on the host for the completion of operations being measured if any.
+        void getMemoryReport(SceneMemoryReport* report) const;
+
+        // JP: 遅延ビルドのGASをビルドするためのアクセラレーションバッファーのプールとスクラッチバッファーを設定する。
+        //     プールは線形に割り当てられるだけで、再設定するとそこにビルドされたGASは全てdirty状態になる。
+        // EN: Set the pool of acceleration buffers and the scratch buffer to build lazy-build GASs.
+        //     The pool is only allocated linearly, and resetting it marks all the GASs built in it dirty.
+        void setLazyBuildMemory(const BufferView &accelPool, const BufferView &scratchBuffer) const;
+
+        // JP: 退避可能なGAS(GAS::setEvictable())のデバイス上の合計サイズの予算を設定する(0で無効)。
+        //     IASのリビルド時に予算を超える場合、準備済みのIASから参照されておらず、
+        //     直近minFramesToKeepフレームで参照されていないものから最も長く参照されていない順に
+        //     ピン留めされたホストメモリへ退避する。退避したGASはIASのリビルドで参照されたときに
+        //     アップロードとリロケーションで再びデバイス上に戻され、IASのビルドはそれを待つ。
+        //     Transformを経由して参照されるGASも同様に扱い、復帰したGASを子孫に持つ準備済みのTransformは
+        //     最後にビルドしたデバイスメモリー上に作り直される。
+        //     デバイスメモリーの解放は処理中のフレームの完了まで遅延されるので、beginFrame(), endFrame()と併用する。
+        // EN: Set the budget of the total device size of evictable GASs (GAS::setEvictable()) (0 to disable).
+        //     When the budget is exceeded at an IAS rebuild, GASs neither referenced by ready IASs
+        //     nor referenced in the last minFramesToKeep frames are evicted to pinned host memory
+        //     in least recently referenced order. An evicted GAS is brought back to the device by upload and relocation
+        //     when referenced at an IAS rebuild, and the IAS build waits on it.
+        //     GASs referenced through transforms are treated the same way, and ready transforms having a restored GAS
+        //     as a descendant are rebuilt on the device memory of their last build.
+        //     Releasing device memory is deferred until frames in flight complete, so use with beginFrame(), endFrame().
+        void setResidencyBudget(size_t budgetInBytes, uint32_t minFramesToKeep = 1) const;
+        // JP: IASのリビルドを待たずに予算を超えている分を退避する。
+        // EN: Evict the amount exceeding the budget without waiting for an IAS rebuild.
+        void enforceResidencyBudget(CUstream stream) const;
+        void getResidencyStatistics(GASResidencyStatistics* stats) const;
+
+        // JP: 同時に処理中にできるフレームの最大数を設定する(デフォルトは2)。処理中のフレームは全て完了を待たれる。
+        // EN: Set the maximum number of frames that can be in flight at once (default is 2).
+        //     All the frames in flight are waited for completion.
+        void setMaxFramesInFlight(uint32_t maxFramesInFlight) const;
+        // JP: フレームを開始する。同じスロットを使っていたフレームがまだ処理中であればその完了をホスト側で待つ。
+        //     frameSlotにはフレームごとに多重化したリソース(インスタンスバッファー、SBT、ローンチパラメター等)を選ぶための
+        //     [0, maxFramesInFlight)のインデックスが返る。
+        // EN: Begin a frame. Wait on the host for the completion of the frame that used the same slot if it is still in flight.
+        //     frameSlot receives an index in [0, maxFramesInFlight) to select resources multiplexed per frame
+        //     (instance buffers, SBTs, launch parameters, etc.).
+        void beginFrame(uint32_t* frameSlot = nullptr) const;
+        // JP: フレームを終了し、そのフレームの完了を示すイベントをstreamに記録する。
+        //     完了済みのフレームに遅延されていた解放はここで実行される。
+        // EN: End the frame and record an event indicating the completion of the frame on the stream.
+        //     Releases deferred to frames that have completed are executed here.
+        void endFrame(CUstream stream) const;
+        // JP: 現在のフレームと処理中の全フレームが完了するまで関数の呼び出しを遅延させる。
+        //     処理中のフレームが無い場合は即座に呼び出す。
+        // EN: Defer calling the function until the current frame and all the frames in flight complete.
+        //     The function is called immediately if no frame is in flight.
+        void deferRelease(DeferredReleaseFunction func, void* userData) const;
+        // JP: 処理中の全フレームの完了を待ち、遅延されていた解放を全て実行する。
+        // EN: Wait for the completion of all the frames in flight and execute all the deferred releases.
+        void waitForAllFrames() const;
+        uint64_t getFrameIndex() const;
+
+        // JP: 子のジオメトリインスタンスの中身(頂点・インデックスバッファー等)、マテリアル、設定が同一のGASを検出し、
+        //     IAS中のインスタンスとTransformの参照をシリアルIDの最も小さいGASへと付け替える。
+        //     バッファーの中身はホストに読み戻してハッシュするので、ロード時などに一度だけ呼ぶことを想定している。
+        //     参照が付け替えられなくなった重複GASはduplicateGASsに返されるが破棄はされない。
+        //     返り値は付け替えた参照の数。付け替えが起きたIASはdirty状態になり、Transformはリビルドが必要になる。
+        // EN: Detect GASs whose children's contents (vertex/index buffers, etc.), materials and settings are identical,
+        //     then redirect references of instances in IASs and transforms to the GAS with the smallest serial ID.
+        //     Buffer contents are read back to the host for hashing, so this is intended to be called once such as
+        //     at load time.
+        //     Duplicate GASs that are no longer referenced are returned in duplicateGASs but not destroyed.
+        //     The return value is the number of redirected references. An IAS in which redirection happens is
+        //     marked dirty, and a transform requires rebuild.
+        uint32_t deduplicateGeometryASs(CUstream stream,
+                                        std::vector<GeometryAccelerationStructure>* duplicateGASs = nullptr) const;
     };
 
 
@@ -888,6 +2646,24 @@ private: \
         void setTriangleBuffer(const BufferView &triangleBuffer, OptixIndicesFormat format = OPTIX_INDICES_FORMAT_UNSIGNED_INT3) const;
         void setSegmentIndexBuffer(const BufferView &segmentIndexBuffer) const;
         void setCustomPrimitiveAABBBuffer(const BufferView &primitiveAABBBuffer, uint32_t motionStep = 0) const;
+        // JP: モーションステップkの頂点(と幅)またはAABBバッファーをステップk + 1のものにずらし、
+        //     最後のステップに元のステップ0のバッファーを回す。戻り値は最後のステップの頂点またはAABBバッファー。
+        //     アニメーションでは毎フレーム最新のステップだけを書き込み、GASのアップデートで済ませられる。
+        // EN: Shift the vertex (and width) or AABB buffer of motion step k to that of step k + 1,
+        //     and recycle the original buffer of step 0 to the last step. Returns the vertex or AABB buffer
+        //     of the last step. An animation can write only the newest step every frame and finish with a GAS update.
+        BufferView rotateMotionStepBuffers() const;
+        // JP: 現在のバッファーと要素数とストライドが同じバッファーに差し替える。
+        //     GASのアップデートのみで反映でき、変形結果をダブルバッファリングして
+        //     前フレームのGASをトレース中に次のバッファーへ書き込むといった用途に使える。
+        //     互換でないバッファーを渡すと例外を投げる。
+        // EN: Replace with a buffer having the same number of elements and stride as the current buffer.
+        //     This can be reflected with only a GAS update, and can be used for e.g. double buffering
+        //     deformation results to write into the next buffer while the GAS of the previous frame is being traced.
+        //     Throws an exception when an incompatible buffer is given.
+        void retargetVertexBuffer(const BufferView &vertexBuffer, uint32_t motionStep = 0) const;
+        void retargetWidthBuffer(const BufferView &widthBuffer, uint32_t motionStep = 0) const;
+        void retargetCustomPrimitiveAABBBuffer(const BufferView &primitiveAABBBuffer, uint32_t motionStep = 0) const;
         void setPrimitiveIndexOffset(uint32_t offset) const;
         void setNumMaterials(uint32_t numMaterials, const BufferView &matIndexBuffer, uint32_t indexSize = sizeof(uint32_t)) const;
         void setGeometryFlags(uint32_t matIdx, OptixGeometryFlags flags) const;
@@ -907,6 +2683,7 @@ private: \
             setUserData(&data, sizeof(T), alignof(T));
         }
 
+        GeometryType getGeometryType() const;
         uint32_t getNumMotionSteps() const;
         OptixVertexFormat getVertexFormat() const;
         BufferView getVertexBuffer(uint32_t motionStep = 0);
@@ -917,6 +2694,11 @@ private: \
         uint32_t getPrimitiveIndexOffset() const;
         uint32_t getNumMaterials(BufferView* matIndexBuffer = nullptr, uint32_t* indexSize = nullptr) const;
         OptixGeometryFlags getGeometryFlags(uint32_t matIdx) const;
+        // JP: マテリアルに設定されたマテリアルセットの数(最大のマテリアルセットインデックス + 1)を返す。
+        //     未設定のマテリアルセットのgetMaterial()はMaterial()を返す。
+        // EN: Return the number of material sets set for the material (the max material set index + 1).
+        //     getMaterial() for an unset material set returns Material().
+        uint32_t getNumMaterialSets(uint32_t matIdx) const;
         Material getMaterial(uint32_t matSetIdx, uint32_t matIdx) const;
         void getUserData(void* data, uint32_t* size, uint32_t* alignment) const;
         template <typename T>
@@ -934,6 +2716,29 @@ private: \
         void destroy();
         OPTIXU_COMMON_FUNCTIONS(GeometryAccelerationStructure);
 
+        // JP: 遅延ビルドを有効化する。遅延ビルドのGASは未ビルドでもシーンのready判定を妨げず、
+        //     IASのリビルド時に参照されていればScene::setLazyBuildMemory()で与えたプール上に自動でビルドされる。
+        // EN: Enable lazy build. A lazy-build GAS does not prevent the scene from being ready even if not built,
+        //     and is built automatically on the pool given by Scene::setLazyBuildMemory()
+        //     when referenced at IAS rebuild.
+        void setLazyBuild(bool enable) const;
+        // JP: 有効にするとrebuild(), update()の前に子のジオメトリ入力のうちマネージドメモリー上のものを
+        //     ビルドするデバイスにプリフェッチする。ビルド中のページ単位のフォールトを避けられる。
+        // EN: When enabled, geometry inputs of children on managed memory are prefetched to the device
+        //     performing the build before rebuild(), update().
+        //     This avoids page-by-page faults during the build.
+        void setManagedInputPrefetch(bool enable) const;
+        // JP: Scene::setResidencyBudget()による退避の対象にする。退避されるのはコンパクト済みで
+        //     removeUncompacted()されたGASのみ。退避・復帰でハンドルは変わる。
+        //     復帰時のバッファーはoptixuが確保し、最初の退避以後compact()に渡したバッファーは参照されない。
+        //     デバイス上で書き込まれたインスタンスから参照されるGASは追跡できないため対象にしてはいけない。
+        // EN: Make the GAS a target of eviction by Scene::setResidencyBudget(). Only compacted GASs
+        //     on which removeUncompacted() has been called are evicted. The handle changes by eviction and restoration.
+        //     optixu allocates the buffer at restoration,
+        //     and the buffer given to compact() is no longer referenced after the first eviction.
+        //     GASs referenced from instances written on the device cannot be tracked, so don't make them evictable.
+        void setEvictable(bool enable) const;
+
         // JP: 以下のAPIを呼んだ場合はGASが自動でdirty状態になる。
         //     子の数が変更される場合はヒットグループのシェーダーバインディングテーブルレイアウトも無効化される。
         // EN: Calling the following APIs automatically marks the GAS dirty.
@@ -947,7 +2752,17 @@ private: \
             addChild(geomInst, preTransform, &data, sizeof(T), alignof(T));
         }
         void removeChildAt(uint32_t index) const;
+        // JP: 末尾の子を削除位置に移動して定数時間で子を削除する。子の順序は保たれない。
+        // EN: Remove a child in constant time by moving the last child to the removed position.
+        //     The order of children is not preserved.
+        void swapRemoveChildAt(uint32_t index) const;
         void clearChildren() const;
+        // JP: 複数の子をまとめて追加する。dirty化とSBTレイアウトの無効化は一度だけ行われる。
+        //     preTransformsにnullptrを渡すと全て0として扱う。
+        // EN: Add multiple children together. Marking dirty and invalidating the SBT layout happen only once.
+        //     Passing nullptr to preTransforms treats all of them as 0.
+        void addChildren(const GeometryInstance* geomInsts, uint32_t count,
+                         const CUdeviceptr* preTransforms = nullptr) const;
 
         // JP: GASをdirty状態にする。
         //     ヒットグループのシェーダーバインディングテーブルレイアウトも無効化される。
@@ -959,6 +2774,19 @@ private: \
         // EN: Calling the following APIs automatically invalidates the shader binding table layout of hit group.
         void setNumMaterialSets(uint32_t numMatSets) const;
         void setNumRayTypes(uint32_t matSetIdx, uint32_t numRayTypes) const;
+        // JP: レイタイプを一様(全ジオメトリで一つのレコード)にし、そのレコードのマテリアルを指定する。
+        //     Material()を渡すと一様でなくなる。GASのレコード範囲は一様なレイタイプのレコードが
+        //     レイタイプ順に先頭に並び、その後にジオメトリごとのレコードが一様でないレイタイプのみ並ぶ。
+        //     したがってoptixTrace()では、一様なレイタイプは(一様なもの中での順番)をSBTオフセット、0をストライドに、
+        //     一様でないレイタイプは(一様なレイタイプ数 + 一様でないもの中での順番)をSBTオフセット、
+        //     一様でないレイタイプ数をストライドに指定する。
+        // EN: Make a ray type uniform (one record for all geometries) and specify the material of the record.
+        //     Passing Material() makes it non-uniform. In the record range of the GAS, records of uniform ray types
+        //     come first in ray type order, followed by records per geometry only for non-uniform ray types.
+        //     Therefore in optixTrace(), specify (the order among uniform ones) as the SBT offset and 0 as the stride
+        //     for a uniform ray type, and (the number of uniform ray types + the order among non-uniform ones)
+        //     as the SBT offset and the number of non-uniform ray types as the stride for a non-uniform ray type.
+        void setUniformRayTypeMaterial(uint32_t matSetIdx, uint32_t rayType, Material mat) const;
 
         // JP: リビルド・コンパクトを行った場合はこのGASが(間接的に)所属するTraversable (例: IAS)
         //     のmarkDirty()を呼ぶ必要がある。
@@ -967,8 +2795,15 @@ private: \
         void prepareForBuild(OptixAccelBufferSizes* memoryRequirement) const;
         OptixTraversableHandle rebuild(CUstream stream, const BufferView &accelBuffer, const BufferView &scratchBuffer) const;
         // JP: リビルドが完了するのをホスト側で待つ。
+        //     保留中の全GAS/IASのコンパクション後のサイズが一度にまとめて読み戻される。
         // EN: Wait on the host until rebuild operation finishes.
+        //     The sizes after compaction of all the pending GASs/IASs are read back together at once.
         void prepareForCompact(size_t* compactedAccelBufferSize) const;
+        // JP: ホスト側で待たずにリビルドの完了を確認する。
+        //     完了していればprepareForCompact()と同様にサイズを返してtrueを返す。未完了の場合はfalseを返す。
+        // EN: Check the completion of rebuild without waiting on the host.
+        //     Return the size and true as prepareForCompact() does if completed, otherwise return false.
+        bool tryPrepareForCompact(size_t* compactedAccelBufferSize) const;
         OptixTraversableHandle compact(CUstream stream, const BufferView &compactedAccelBuffer) const;
         // JP: コンパクトが完了するのをホスト側で待つ。
         // EN: Wait on the host until compact operation finishes.
@@ -980,6 +2815,83 @@ private: \
         //     is required when performing update.
         void update(CUstream stream, const BufferView &scratchBuffer) const;
 
+        // JP: アップデート回数(0で無効)とリビルド時からのAABB表面積の拡大率(0で無効)の閾値を設定する。
+        //     updateOrRebuild()はいずれかの閾値を超えた場合に、アップデートの代わりにその場でリビルドを行う。
+        //     AABBは非同期に読み戻されるので判断は数フレーム遅れ得る。
+        // EN: Set thresholds for the number of updates (0 to disable) and the growth ratio of AABB surface area
+        //     since the last rebuild (0 to disable).
+        //     updateOrRebuild() performs in-place rebuild instead of update when either threshold is exceeded.
+        //     The decision may lag several frames because the AABB is read back asynchronously.
+        void setAutoRebuildPolicy(uint32_t maxNumUpdates, float maxBoundsGrowth) const;
+        // JP: リビルドを行った場合はハンドルが変わり得るので、所属するTraversableのmarkDirty()を呼ぶ必要がある。
+        //     スクラッチバッファーがリビルドに足りない場合やコンパクト済みの場合は常にアップデートを行う。
+        // EN: Handle can change when rebuild is performed, so calling markDirty() of a traversable to which
+        //     this AS belongs is required.
+        //     Always perform update when the scratch buffer is not enough for rebuild or the AS has been compacted.
+        OptixTraversableHandle updateOrRebuild(CUstream stream, const BufferView &scratchBuffer,
+                                               bool* rebuilt = nullptr) const;
+
+        // JP: CUDAイベントによるリビルド・アップデート・コンパクトのGPU時間計測を有効化する。
+        //     統計の取得は計測中の操作の完了をホスト側で待つ。サイズ等は計測を有効化しなくても取得できる。
+        // EN: Enable GPU time measurement of rebuild/update/compact by CUDA events.
+        //     Getting statistics waits on the host for the completion of operations being measured.
+        //     Sizes and the like are available without enabling the measurement.
+        void enableStatistics(bool enable) const;
+        void getStatistics(ASStatistics* stats) const;
+        // JP: 走査コストの推定値を返す。各プリミティブのAABBの表面積の和をGAS全体のAABBの表面積で割った値で、
+        //     GAS全体のAABBを通る一様なレイが交差するプリミティブのAABBの期待数である。
+        //     どのようなBVHを構築してもSAHのプリミティブ交差コストはこれを下回らないので、
+        //     細長く重なり合う三角形などを含む病的なアセットでは非常に大きくなる。
+        //     入力バッファーをホストに読み戻すので、ビルドとは別の診断用途で使う。最初のモーションステップのみを見る。
+        // EN: Return the estimated traversal cost. The value is the sum of the surface areas of AABBs of primitives
+        //     divided by the surface area of the AABB of the whole GAS, which is the expected number of primitive
+        //     AABBs intersected by a uniformly distributed ray passing the AABB of the whole GAS.
+        //     The SAH primitive intersection cost of any BVH cannot go below this,
+        //     so this becomes very large for pathological assets e.g. including long overlapping triangles.
+        //     This reads back input buffers to the host, so use this for diagnostics apart from builds.
+        //     Only the first motion step is considered.
+        float estimateTraversalCost() const;
+
+        // JP: prepareForBuild()後のビルド入力の構造(デバイスポインターや中身は含まない)とビルド設定のハッシュを返す。
+        //     ディスクキャッシュのキーとして使う場合はアプリケーション側でジオメトリ内容の識別子と組み合わせる必要がある。
+        // EN: Return the hash of the build settings and the structure of the build inputs after prepareForBuild()
+        //     (not including device pointers and contents).
+        //     Application needs to combine it with an identifier of geometry contents when using as a disk cache key.
+        uint64_t getBuildInputHash() const;
+        // JP: ビルド済み(コンパクト済みがあればそちら)のASをリロケーション情報とともにホストメモリにコピーする。
+        //     ビルドの完了をホスト側で待つ。
+        // EN: Copy the built AS (compacted one if available) with the relocation information to host memory.
+        //     Wait on the host until the build finishes.
+        void serialize(std::vector<uint8_t>* data) const;
+        // JP: シリアライズされたデータがこのASのビルド入力と現在のデバイスに適合するかを確かめ、
+        //     必要なバッファーサイズを返す。prepareForBuild()を先に呼ぶ必要がある。
+        // EN: Check if the serialized data matches the build inputs of this AS and the current device,
+        //     then return the required buffer size. Calling prepareForBuild() beforehand is required.
+        bool checkRelocatable(const void* data, size_t size, size_t* accelBufferSize) const;
+        // JP: リビルドの代わりにシリアライズされたASをバッファーにコピーしてリロケートする。
+        //     リビルドと同様に所属するTraversableのmarkDirty()を呼ぶ必要がある。
+        // EN: Copy the serialized AS to the buffer and relocate it instead of rebuilding.
+        //     Calling markDirty() of a traversable to which this GAS belongs is required as with rebuild.
+        OptixTraversableHandle relocate(CUstream stream, const void* data, size_t size,
+                                        const BufferView &accelBuffer) const;
+        // JP: ビルド済み(コンパクト済みがあればそちら)のASを他のプロセスがアタッチするための情報を返す。
+        //     ASのバッファーはプロセス間で同じ仮想アドレスにマップできるメモリー(cudau::SharedDeviceMemory等)
+        //     上にある必要がある。ビルドの完了をホスト側で待つ。
+        // EN: Return information for another process to attach the built AS (compacted one if available).
+        //     The buffer of the AS needs to be on memory which can be mapped to the same virtual address across
+        //     processes (e.g. cudau::SharedDeviceMemory). Wait on the host until the build finishes.
+        void exportShared(SharedASDesc* desc) const;
+        // JP: 他のプロセスがエクスポートしたASを、同じ仮想アドレスにマップしたバッファー上でビルドせずに使う。
+        //     子やマテリアル等の設定はエクスポート側と同一にしてprepareForBuild()を先に呼ぶ必要がある。
+        //     アタッチしたASはアップデート・コンパクトできない。
+        //     リビルドと同様に所属するTraversableのmarkDirty()を呼ぶ必要がある。
+        // EN: Use an AS exported by another process without building on a buffer mapped to the same virtual address.
+        //     Settings like children and materials need to be identical to the exporter,
+        //     and calling prepareForBuild() beforehand is required.
+        //     An attached AS cannot be updated or compacted.
+        //     Calling markDirty() of a traversable to which this GAS belongs is required as with rebuild.
+        OptixTraversableHandle attachShared(const SharedASDesc &desc, const BufferView &accelBuffer) const;
+
         // JP: 以下のAPIを呼んだ場合はシェーダーバインディングテーブルを更新する必要がある。
         //     パイプラインのmarkHitGroupShaderBindingTableDirty()を呼べばローンチ時にセットアップされる。
         //     シェーダーバインディングテーブルのレイアウト生成後に、再度ユーザーデータのサイズや
@@ -1002,13 +2914,22 @@ private: \
         bool isReady() const;
         OptixTraversableHandle getHandle() const;
 
+        GeometryType getGeometryType() const;
         void getConfiguration(ASTradeoff* tradeOff, bool* allowUpdate, bool* allowCompaction, bool* allowRandomVertexAccess) const;
+        bool getLazyBuild() const;
+        bool getEvictable() const;
+        // JP: 退避されていればfalseを返す。
+        // EN: Return false if evicted.
+        bool isResident() const;
         void getMotionOptions(uint32_t* numKeys, float* timeBegin, float* timeEnd, OptixMotionFlags* flags) const;
         uint32_t getNumChildren() const;
         uint32_t findChildIndex(GeometryInstance geomInst, CUdeviceptr preTransform = 0) const;
         GeometryInstance getChild(uint32_t index, CUdeviceptr* preTransform = nullptr) const;
         uint32_t getNumMaterialSets() const;
         uint32_t getNumRayTypes(uint32_t matSetIdx) const;
+        // JP: レイタイプが一様でない場合はMaterial()を返す。
+        // EN: Return Material() if the ray type is not uniform.
+        Material getUniformRayTypeMaterial(uint32_t matSetIdx, uint32_t rayType) const;
         void getChildUserData(uint32_t index, void* data, uint32_t* size, uint32_t* alignment) const;
         template <typename T>
         void getChildUserData(uint32_t index, T* data, uint32_t* size = nullptr, uint32_t* alignment = nullptr) const {
@@ -1023,6 +2944,16 @@ private: \
 
 
 
+    struct GeometryFlagSuggestion {
+        GeometryInstance geomInst;
+        uint32_t matIdx;
+        // JP: GeometryFlagInference::Applyによってフラグが設定されたか。
+        // EN: Whether the flag has been set by GeometryFlagInference::Apply.
+        bool applied;
+    };
+
+
+
     class Transform {
         OPTIXU_PIMPL();
 
@@ -1083,6 +3014,9 @@ private: \
         // EN: Rebulding or Updating of a IAS to which the instance belongs is required.
         void setID(uint32_t value) const;
         void setVisibilityMask(uint32_t mask) const;
+        // JP: Scene::registerVisibilityCategory()で登録したカテゴリーからマスクを設定する。
+        // EN: Set the mask from categories registered by Scene::registerVisibilityCategory().
+        void setVisibilityCategories(const std::vector<std::string> &categories) const;
         void setFlags(OptixInstanceFlags flags) const;
         void setTransform(const float transform[12]) const;
         void setMaterialSetIndex(uint32_t matSetIdx) const;
@@ -1097,6 +3031,39 @@ private: \
         uint32_t getMaterialSetIndex() const;
     };
 
+    // JP: Scene::flattenInstanceHierarchy()が生成したインスタンスと元の階層の対応。
+    //     topLevelIndexは元のIASの子のインデックス、
+    //     sourceInstanceは元の階層でGAS(もしくはモーションTransform)を直接参照していたインスタンス。
+    // EN: Correspondence between an instance created by Scene::flattenInstanceHierarchy() and the original hierarchy.
+    //     topLevelIndex is the index of the child in the original IAS,
+    //     and sourceInstance is the instance that directly referred to the GAS (or the motion transform)
+    //     in the original hierarchy.
+    struct FlattenedInstance {
+        Instance instance;
+        uint32_t topLevelIndex;
+        Instance sourceInstance;
+    };
+
+    // JP: Scene::createInstances()に渡すインスタンスの設定。子はいずれか一つを指定する(全て無効なら子無し)。
+    //     既定値はInstanceを個別に生成した場合と同じ。matSetIndexはIASを子に持つ場合は無視される。
+    // EN: Instance settings passed to Scene::createInstances(). Specify one of the children
+    //     (no child if all are invalid). Default values are the same as creating an Instance individually.
+    //     matSetIndex is ignored when the child is an IAS.
+    struct InstanceDesc {
+        GeometryAccelerationStructure childGAS;
+        InstanceAccelerationStructure childIAS;
+        Transform childTransform;
+        uint32_t matSetIndex = 0;
+        uint32_t id = 0;
+        uint32_t visibilityMask = 0xFF;
+        OptixInstanceFlags flags = OPTIX_INSTANCE_FLAG_NONE;
+        float transform[12] = {
+            1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+        };
+    };
+
 
 
     // TODO: インスタンスバッファーもユーザー管理にしたいため、rebuild()が今の形になっているが微妙かもしれない。
@@ -1118,9 +3085,35 @@ private: \
         void setConfiguration(ASTradeoff tradeoff, bool allowUpdate, bool allowCompaction, bool allowRandomInstanceAccess) const;
         void setMotionOptions(uint32_t numKeys, float timeBegin, float timeEnd, OptixMotionFlags flags) const;
         void addChild(Instance instance) const;
+        // JP: 複数の子をまとめて追加する。dirty化は一度だけ行われる。
+        // EN: Add multiple children together. Marking dirty happens only once.
+        void addChildren(const Instance* instances, uint32_t count) const;
         void removeChildAt(uint32_t index) const;
+        // JP: 末尾の子を削除位置に移動して定数時間で子を削除する。子の順序は保たれない。
+        // EN: Remove a child in constant time by moving the last child to the removed position.
+        //     The order of children is not preserved.
+        void swapRemoveChildAt(uint32_t index) const;
         void clearChildren() const;
 
+        // JP: ホスト側のInstanceを使わず、ユーザーがデバイス上で直接書き込んだOptixInstanceからIASをビルドする。
+        //     インスタンスはrebuild()に渡すinstanceBufferに書き込み、optixuはインスタンスの生成とアップロードをスキップする。
+        //     有効化する際は子を持っていてはならない。
+        // EN: Build the IAS from OptixInstances the user directly writes on the device without host-side Instances.
+        //     Write instances into instanceBuffer passed to rebuild(), optixu skips creating and uploading instances.
+        //     The IAS must not have children when enabling this.
+        void setDeviceInstances(bool enable, uint32_t numInstances = 0) const;
+        // JP: デバイス上のインスタンス数を格納したuint32_tを設定する(0で解除)。
+        //     設定した場合、setDeviceInstances()のnumInstancesは最大数として扱われ、
+        //     rebuild()は実際の数をストリーム上で読み戻して(ホスト側で待つ)最大数で制限してビルドする。
+        //     GPU上のカリングやLOD選択でインスタンスを詰めて書き込む場合に使う。
+        //     アップデートは直近のリビルド時の数を使う。
+        // EN: Set a uint32_t that holds the number of instances on the device (0 to unset).
+        //     When set, numInstances of setDeviceInstances() is treated as the maximum, and rebuild() reads back
+        //     the actual number on the stream (waits on the host), clamps it to the maximum and builds.
+        //     Use this when packing instances by culling and LOD selection on the GPU.
+        //     Update uses the number at the latest rebuild.
+        void setDeviceInstanceCount(CUdeviceptr numInstancesOnDevice) const;
+
         // JP: IASをdirty状態にする。
         // EN: Mark the IAS dirty.
         void markDirty() const;
@@ -1133,8 +3126,15 @@ private: \
         OptixTraversableHandle rebuild(CUstream stream, const BufferView &instanceBuffer,
                                        const BufferView &accelBuffer, const BufferView &scratchBuffer) const;
         // JP: リビルドが完了するのをホスト側で待つ。
+        //     保留中の全GAS/IASのコンパクション後のサイズが一度にまとめて読み戻される。
         // EN: Wait on the host until rebuild operation finishes.
+        //     The sizes after compaction of all the pending GASs/IASs are read back together at once.
         void prepareForCompact(size_t* compactedAccelBufferSize) const;
+        // JP: ホスト側で待たずにリビルドの完了を確認する。
+        //     完了していればprepareForCompact()と同様にサイズを返してtrueを返す。未完了の場合はfalseを返す。
+        // EN: Check the completion of rebuild without waiting on the host.
+        //     Return the size and true as prepareForCompact() does if completed, otherwise return false.
+        bool tryPrepareForCompact(size_t* compactedAccelBufferSize) const;
         OptixTraversableHandle compact(CUstream stream, const BufferView &compactedAccelBuffer) const;
         // JP: コンパクトが完了するのをホスト側で待つ。
         // EN: Wait on the host until compact operation finishes.
@@ -1146,12 +3146,48 @@ private: \
         //     is required when performing update.
         void update(CUstream stream, const BufferView &scratchBuffer) const;
 
+        // JP: アップデート回数(0で無効)とリビルド時からのAABB表面積の拡大率(0で無効)の閾値を設定する。
+        //     updateOrRebuild()はいずれかの閾値を超えた場合に、アップデートの代わりにその場でリビルドを行う。
+        //     AABBは非同期に読み戻されるので判断は数フレーム遅れ得る。
+        // EN: Set thresholds for the number of updates (0 to disable) and the growth ratio of AABB surface area
+        //     since the last rebuild (0 to disable).
+        //     updateOrRebuild() performs in-place rebuild instead of update when either threshold is exceeded.
+        //     The decision may lag several frames because the AABB is read back asynchronously.
+        void setAutoRebuildPolicy(uint32_t maxNumUpdates, float maxBoundsGrowth) const;
+        // JP: リビルドを行った場合はハンドルが変わり得るので、所属するTraversableのmarkDirty()を呼ぶ必要がある。
+        //     スクラッチバッファーがリビルドに足りない場合やコンパクト済みの場合は常にアップデートを行う。
+        // EN: Handle can change when rebuild is performed, so calling markDirty() of a traversable to which
+        //     this AS belongs is required.
+        //     Always perform update when the scratch buffer is not enough for rebuild or the AS has been compacted.
+        OptixTraversableHandle updateOrRebuild(CUstream stream, const BufferView &scratchBuffer,
+                                               bool* rebuilt = nullptr) const;
+
+        // JP: CUDAイベントによるリビルド・アップデート・コンパクトのGPU時間計測を有効化する。
+        //     統計の取得は計測中の操作の完了をホスト側で待つ。サイズ等は計測を有効化しなくても取得できる。
+        // EN: Enable GPU time measurement of rebuild/update/compact by CUDA events.
+        //     Getting statistics waits on the host for the completion of operations being measured.
+        //     Sizes and the like are available without enabling the measurement.
+        void enableStatistics(bool enable) const;
+        void getStatistics(ASStatistics* stats) const;
+        // JP: 走査コストの推定値を返す。各インスタンスのワールド空間のAABBの表面積に(1 + 子の推定値)を掛けたものの和を
+        //     IAS全体のAABBの表面積で割った値で、インスタンスへの進入と子の中のプリミティブとの交差の期待数を表す。
+        //     子のGAS/IASの推定値は再帰的に求める。Transformを子に持つインスタンスは含まれない。
+        //     デバイス側のインスタンスを使う場合は使えない。
+        // EN: Return the estimated traversal cost. The value is the sum of the surface areas of world-space AABBs
+        //     of instances multiplied by (1 + the child's estimate) divided by the surface area of the AABB of
+        //     the whole IAS, representing the expected number of entering instances and primitive intersections
+        //     in children. The estimates of child GASs/IASs are computed recursively.
+        //     Instances having a Transform as the child are not included.
+        //     This is not available when using device-side instances.
+        float estimateTraversalCost() const;
+
         bool isReady() const;
         OptixTraversableHandle getHandle() const;
 
         void getConfiguration(ASTradeoff* tradeOff, bool* allowUpdate, bool* allowCompaction) const;
         void getMotionOptions(uint32_t* numKeys, float* timeBegin, float* timeEnd, OptixMotionFlags* flags) const;
         uint32_t getNumChildren() const;
+        bool usesDeviceInstances(uint32_t* numInstances = nullptr) const;
         uint32_t findChildIndex(Instance instance) const;
         Instance getChild(uint32_t index) const;
     };
@@ -1176,6 +3212,35 @@ private: \
         Module createModuleFromPTXString(const std::string &ptxString, int32_t maxRegisterCount,
                                          OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
                                          OptixModuleCompileBoundValueEntry* boundValues = nullptr, uint32_t numBoundValues = 0) const;
+        // JP: モジュールをワーカースレッドでコンパイルし、即座にハンドルを返す。
+        //     プログラム生成など生のモジュールが必要になった時点で透過的に完了を待つ。
+        //     コンパイルのエラーはその時点で例外として送出される。
+        // EN: Compile a module on a worker thread and return the handle immediately.
+        //     Completion is waited transparently when the raw module is needed such as at program creation.
+        //     A compile error is thrown as an exception at that point.
+        [[nodiscard]]
+        Module createModuleFromPTXStringAsync(const std::string &ptxString, int32_t maxRegisterCount,
+                                              OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
+                                              OptixModuleCompileBoundValueEntry* boundValues = nullptr, uint32_t numBoundValues = 0) const;
+        // JP: CUDAソースをNVRTCでPTXにコンパイルしてからモジュールを生成する(OPTIXU_ENABLE_NVRTCが必要)。
+        //     includeDirsには少なくともOptiXとCUDAのインクルードディレクトリーを与える。definesは"NAME"か"NAME=VALUE"。
+        //     PTXはソース、インクルードされるヘッダーの内容、インクルードディレクトリー、定義、追加オプション、
+        //     デバイスのアーキテクチャーから計算したハッシュでコンテキストにキャッシュされ、同じ組み合わせではNVRTCを呼ばない。
+        //     実行時に生成する専用シェーダーをユーバーシェーダーの代わりに使うためのもの。
+        // EN: Compile CUDA source to PTX by NVRTC, then create a module (requires OPTIXU_ENABLE_NVRTC).
+        //     Give at least the OptiX and CUDA include directories to includeDirs. defines are "NAME" or "NAME=VALUE".
+        //     PTX is cached in the context by a hash computed from the source, the contents of included headers,
+        //     include directories, defines, extra options and the device architecture,
+        //     and NVRTC is not called for the same combination.
+        //     This is intended for using specialized shaders generated at runtime instead of uber shaders.
+        [[nodiscard]]
+        Module createModuleFromCUDASource(const std::string &cudaSource,
+                                          const std::vector<std::string> &includeDirs,
+                                          const std::vector<std::string> &defines,
+                                          int32_t maxRegisterCount,
+                                          OptixCompileOptimizationLevel optLevel, OptixCompileDebugLevel debugLevel,
+                                          OptixModuleCompileBoundValueEntry* boundValues = nullptr, uint32_t numBoundValues = 0,
+                                          const std::vector<std::string> &extraCompileOptions = {}) const;
 
         [[nodiscard]]
         ProgramGroup createRayGenProgram(Module module, const char* entryFunctionName) const;
@@ -1191,13 +3256,63 @@ private: \
         ProgramGroup createHitProgramGroupForCustomIS(Module module_CH, const char* entryFunctionNameCH,
                                                       Module module_AH, const char* entryFunctionNameAH,
                                                       Module module_IS, const char* entryFunctionNameIS) const;
+        // JP: PTXを保持するだけでモジュールとプログラムグループの生成はリンク時まで遅らせる。
+        //     リンク時にシーン中のGASのマテリアル(または既定のヒットグループ)から参照されているものだけが
+        //     マテリアルごとのモジュールとしてコンパイルされるため、巨大なマテリアルライブラリーのうち
+        //     実際に使う一部だけのコンパイル時間で済む。CHとAHは同じPTXに含まれている必要がある。
+        //     カスタムプリミティブの場合はmodule_ISをリンク時まで生存させる必要がある。それ以外ではModule()とnullptrを渡す。
+        // EN: This only holds the PTX and defers creating the module and the program group until link time.
+        //     Only those referenced from materials of GASs in the scene (or default hit groups) at link time
+        //     are compiled as per-material modules, so only the compile time for the part actually used
+        //     from a huge material library is spent. CH and AH need to be contained in the same PTX.
+        //     For custom primitives, module_IS needs to live until link time. Pass Module() and nullptr otherwise.
+        [[nodiscard]]
+        ProgramGroup createDeferredHitProgramGroup(const std::string &ptxString, int32_t maxRegisterCount,
+                                                   OptixCompileOptimizationLevel optLevel,
+                                                   OptixCompileDebugLevel debugLevel,
+                                                   OptixPrimitiveType primType,
+                                                   const char* entryFunctionNameCH,
+                                                   const char* entryFunctionNameAH,
+                                                   Module module_IS, const char* entryFunctionNameIS) const;
         [[nodiscard]]
         ProgramGroup createEmptyHitProgramGroup() const;
         [[nodiscard]]
         ProgramGroup createCallableProgramGroup(Module module_DC, const char* entryFunctionNameDC,
                                                 Module module_CC, const char* entryFunctionNameCC) const;
-
-        void link(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel) const;
+        [[nodiscard]]
+        CallableProgramTable createCallableProgramTable() const;
+
+        // JP: pruneUnreachableProgramsが真の場合、レイ生成、レイタイプごとのミス、コーラブルテーブル、
+        //     既定のヒットグループ、シーン中のマテリアルが参照するヒットグループから到達できない
+        //     プログラムグループをリンクから除外する。除外されたものはgetPrunedProgramGroups()で得られる。
+        //     リンク後に除外されたプログラムを設定した場合はupdateDeferredHitGroups()で再リンクする必要がある。
+        // EN: When pruneUnreachablePrograms is true, program groups unreachable from the ray generation,
+        //     the miss per ray type, the callable table, the default hit groups and hit groups referenced by
+        //     materials in the scene are excluded from the link. Excluded ones can be obtained by
+        //     getPrunedProgramGroups(). Setting a pruned program after linking requires re-linking by
+        //     updateDeferredHitGroups().
+        void link(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel,
+                  bool pruneUnreachablePrograms = false) const;
+        // JP: ワーカースレッドでリンクを行い即座に戻る。launch()はリンクの完了を待つ。
+        //     別のパイプラインで描画を続けながら新たなパイプラインのバリアントを構築し、
+        //     isLinked()がtrueを返したらローンチの合間に差し替える、という使い方ができる。
+        //     リンクのエラーはlaunch()の時点で例外として送出される。
+        // EN: Link on a worker thread and return immediately. launch() waits for the link to complete.
+        //     This allows building a new pipeline variant while rendering continues with another pipeline,
+        //     then swapping them between launches once isLinked() returns true.
+        //     A link error is thrown as an exception at launch().
+        void linkAsync(uint32_t maxTraceDepth, OptixCompileDebugLevel debugLevel,
+                       bool pruneUnreachablePrograms = false) const;
+        bool isLinked() const;
+        // JP: リンク後にシーンから新たに参照されるようになった遅延ヒットグループを生成し、
+        //     生成したもの、あるいは到達可能になった除外済みのものがあれば同じオプションで再リンクしてtrueを返す。
+        //     再リンクした場合はスタックサイズを設定し直す必要がある。
+        // EN: Create deferred hit groups newly referenced from the scene after linking,
+        //     then re-link with the same options and return true if any were created
+        //     or any pruned ones became reachable.
+        //     The stack size needs to be set again when re-linked.
+        bool updateDeferredHitGroups() const;
+        void getPrunedProgramGroups(std::vector<ProgramGroup>* groups) const;
 
         // JP: 以下のAPIを呼んだ場合は(非ヒットグループの)シェーダーバインディングテーブルレイアウトが自動で無効化される。
         // EN: Calling the following APIs automatically invalidates the (non-hit group) shader binding table layout.
@@ -1218,9 +3333,52 @@ private: \
         void setRayGenerationProgram(ProgramGroup program) const;
         void setExceptionProgram(ProgramGroup program) const;
         void setMissProgram(uint32_t rayType, ProgramGroup program) const;
+        // JP: レイ生成・ミスのレコードのヘッダー直後に置くユーザーデータを設定する。
+        //     デバイス側ではoptixGetSbtDataPointer()で読める。
+        //     レコードのサイズが変わる場合はSBTレイアウトも無効化されるので
+        //     generateShaderBindingTableLayout()を再度呼ぶ必要がある。
+        //     ミスレコードのストライドは全レイタイプのユーザーデータの最大サイズで決まる。
+        // EN: Set user data placed right after the header of the ray generation or miss record.
+        //     It can be read by optixGetSbtDataPointer() on the device side.
+        //     The SBT layout is also invalidated when the record size changes,
+        //     so generateShaderBindingTableLayout() needs to be called again.
+        //     The stride of miss records is determined by the maximum user data size over all ray types.
+        void setRayGenerationUserData(const void* data, uint32_t size, uint32_t alignment) const;
+        template <typename T>
+        void setRayGenerationUserData(const T &data) const {
+            setRayGenerationUserData(&data, sizeof(T), alignof(T));
+        }
+        void setMissUserData(uint32_t rayType, const void* data, uint32_t size, uint32_t alignment) const;
+        template <typename T>
+        void setMissUserData(uint32_t rayType, const T &data) const {
+            setMissUserData(rayType, &data, sizeof(T), alignof(T));
+        }
+        // JP: マテリアルが指定したレイタイプのヒットグループを持たない場合に使われるヒットグループを設定する。
+        //     エニーヒットを追加する場合はジオメトリフラグの推定が有効なシーンのレイアウトが無効化される。
+        // EN: Set the hit group used when a material doesn't have a hit group for the specified ray type.
+        //     Adding any-hit invalidates the layouts of scenes with geometry flag inference enabled.
+        void setDefaultHitGroup(uint32_t rayType, ProgramGroup hitGroup) const;
+        // JP: 指定したレイタイプを可視性レイ用に設定する。リンク前に呼ぶ。
+        //     共有のミスプログラム(ペイロード0に1を書き込む)と既定の空のヒットグループが自動で登録される。
+        //     アルファテストなどが必要なマテリアルは通常通りsetHitGroup()でヒットグループを設定する。
+        //     デバイス側ではoptixu::traceVisibility()と組み合わせて使う。
+        // EN: Set the specified ray type up for visibility rays. Call this before linking.
+        //     A shared miss program (writing 1 to payload 0) and a default empty hit group are registered
+        //     automatically. Set a hit group by setHitGroup() as usual for materials requiring alpha test or similar.
+        //     Use this with optixu::traceVisibility() on the device side.
+        void setVisibilityRayType(uint32_t rayType) const;
         void setCallableProgram(uint32_t index, ProgramGroup program) const;
         void setShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const;
 
+        // JP: コーラブルのSBT範囲としてsetNumCallablePrograms()による固定のテーブルの代わりにテーブルを使う。
+        //     テーブルへの変更はメインのSBTを再セットアップせずにローンチ時に変更のあったレコードだけ転送される。
+        //     固定のテーブルとは併用できない。空のCallableProgramTable()を渡すと固定のテーブルに戻る。
+        // EN: Use the table instead of the fixed table by setNumCallablePrograms() as the callable SBT range.
+        //     Changes to the table transfer only changed records at launch without re-setting up the main SBT.
+        //     This cannot be used together with the fixed table. Passing an empty CallableProgramTable() returns
+        //     to the fixed table.
+        void setCallableProgramTable(CallableProgramTable table) const;
+
         // JP: 以下のAPIを呼んだ場合はヒットグループのシェーダーバインディングテーブルが自動でdirty状態になり
         //     ローンチ時に再セットアップされる。
         //     ただしローンチ時のセットアップはSBTバッファーの内容変更・転送を伴うので、
@@ -1233,19 +3391,82 @@ private: \
         void setScene(const Scene &scene) const;
         void setHitGroupShaderBindingTable(const BufferView &shaderBindingTable, void* hostMem) const;
 
+        // JP: ヒットグループのシェーダーバインディングテーブルとホスト側の対応物をパイプライン自身に
+        //     numBuffers個確保・管理させる。ローンチごとに順番に使い、各バッファーはCUDAイベントで
+        //     GPUの使用終了を待ってから書き換えられるため、ローンチ中のSBTを上書きせずに編集を続けられる。
+        //     0を指定するかsetHitGroupShaderBindingTable()を呼ぶとユーザー管理のSBTに戻る。
+        // EN: Let the pipeline itself allocate and manage numBuffers hit group shader binding tables
+        //     and their host-side counterparts. They are used in turn for each launch, and each buffer is rewritten
+        //     after waiting with a CUDA event for the GPU to finish using it, so edits can continue
+        //     without overwriting an SBT of an in-flight launch.
+        //     Specifying 0 or calling setHitGroupShaderBindingTable() returns to a user-managed SBT.
+        void setNumOwnedHitGroupShaderBindingTables(uint32_t numBuffers) const;
+
+        // JP: 有効にすると、SBTの転送をパイプラインが所有するページロックされたステージングリングを経由して行う。
+        //     ユーザーのホストメモリーがページャブルでも転送が非同期になり前のフレームの処理と重なる。
+        // EN: When enabled, transfer SBTs via a page-locked staging ring owned by the pipeline.
+        //     Transfer becomes asynchronous and overlaps the previous frame's work even if the user's host memory
+        //     is pageable.
+        void enablePinnedStaging(bool enable) const;
+
+        // JP: ステージングリングを経由してローンチパラメターをデバイスへ非同期に転送する。
+        //     サイズはsetPipelineOptions()で指定したものが使われる。
+        // EN: Asynchronously transfer launch parameters to the device via the staging ring.
+        //     The size specified by setPipelineOptions() is used.
+        void uploadLaunchParams(CUstream stream, CUdeviceptr plpOnDevice, const void* params) const;
+
         // JP: ヒットグループのシェーダーバインディングテーブルをdirty状態にする。
+        //     マテリアルのヒットグループやユーザーデータ、GeometryInstanceのマテリアルやユーザーデータ、
+        //     GASとその子のユーザーデータの変更はレコード単位で追跡され、これを呼ばなくても
+        //     ローンチ時に変更のあった範囲のみが書き直され転送される。
+        //     これを呼んだ場合やSBTレイアウトが再生成された場合はテーブル全体が再セットアップされる。
         // EN: Mark the hit group's shader binding table dirty.
+        //     Changes of a material's hit groups and user data, a geometry instance's materials and user data,
+        //     and user data of a GAS and its children are tracked per record, and only changed ranges are refilled
+        //     and transferred at launch even without calling this.
+        //     The whole table is set up again when calling this or when the SBT layout is regenerated.
         void markHitGroupShaderBindingTableDirty() const;
 
         void setStackSize(uint32_t directCallableStackSizeFromTraversal,
                           uint32_t directCallableStackSizeFromState,
                           uint32_t continuationStackSize,
                           uint32_t maxTraversableGraphDepth) const;
+        // JP: パイプラインで生成された全プログラムグループのスタックサイズから標準的な方法で
+        //     必要なスタックサイズを計算して設定する。リンク後に呼ぶ。
+        //     トラバーサブルグラフの最大深さはシングルGASかシングルレベルインスタンシングの場合は自動で決まる。
+        // EN: Compute the required stack sizes in the standard way from the stack sizes of all program groups
+        //     created on the pipeline, then set them. Call this after linking.
+        //     The maximum traversable graph depth is automatically determined for single GAS or
+        //     single level instancing.
+        void computeAndSetStackSize(uint32_t maxTraceDepth, uint32_t maxCCDepth, uint32_t maxDCDepth,
+                                    uint32_t maxTraversableGraphDepth = 0) const;
 
         // JP: セットされたシーンを基にシェーダーバインディングテーブルのセットアップを行い、
         //     Ray Generationシェーダーを起動する。
+        //     GAS/IASのrebuild(), update()と同様にCUDAグラフへのストリームキャプチャー中に呼ぶことができる。
+        //     ただしキャプチャー中はホストで待機する機能(所有SBT、ピン留めステージング、
+        //     デバイスインスタンス数の読み戻し)は使えず、自動リビルドのAABB計測と統計の記録は省略される。
+        //     SBTのホスト側の転送元はグラフの実行時に読まれる。
         // EN: Setup the shader binding table based on the scene set, then launch the ray generation shader.
+        //     This can be called during stream capture into a CUDA graph similarly to rebuild(), update() of GAS/IAS.
+        //     However, features waiting on the host (owned SBTs, pinned staging, reading back the device instance
+        //     count) cannot be used during capture, and AABB measurement for auto rebuild and statistics
+        //     recording are skipped.
+        //     Host-side sources of SBT transfers are read when the graph is executed.
         void launch(CUstream stream, CUdeviceptr plpOnDevice, uint32_t dimX, uint32_t dimY, uint32_t dimZ) const;
+        // JP: 小さなローンチの列を1次元の単一ローンチにまとめる。各エントリーの次元を設定したホスト側の
+        //     ディスパッチテーブルにスレッドオフセットを埋めてデバイスへ転送した後にローンチする。
+        //     Ray Generationプログラムではデバイス側のテーブルを使ってgetBatchedLaunchIndex()で
+        //     エントリーとその中での起動インデックスを求め、エントリーごとのパラメターと出力先を選ぶ。
+        //     ホスト側のテーブルは転送が完了するまで保持する必要がある。
+        // EN: Pack a sequence of small launches into a single 1D launch. Fill the thread offsets of the host-side
+        //     dispatch table in which the dimensions of each entry are set, transfer it to the device, then launch.
+        //     The ray generation program finds the entry and the launch index within it by getBatchedLaunchIndex()
+        //     with the device-side table, then selects per-entry parameters and output destinations.
+        //     The host-side table must be kept until the transfer completes.
+        void launchBatched(CUstream stream, CUdeviceptr plpOnDevice,
+                           BatchedLaunchEntry* dispatchTableOnHost, CUdeviceptr dispatchTableOnDevice,
+                           uint32_t numEntries) const;
     };
 
 
@@ -1258,6 +3479,15 @@ private: \
     public:
         void destroy();
         OPTIXU_COMMON_FUNCTIONS(Module);
+
+        // JP: モジュール生成時に計算したキャッシュキーを返す。アプリケーションが再起動をまたいで
+        //     独自にキャッシュの索引を持つのに使える。
+        // EN: Return the cache key computed at the module creation. Applications can use this to keep
+        //     their own cache index across restarts.
+        uint64_t getCacheKey() const;
+        // JP: 非同期生成のコンパイルが完了しているかを返す。
+        // EN: Return whether the compilation of asynchronous creation has completed.
+        bool isCompiled() const;
     };
 
 
@@ -1269,11 +3499,85 @@ private: \
         void destroy();
         OPTIXU_COMMON_FUNCTIONS(ProgramGroup);
 
+        // JP: 遅延ヒットグループの場合はリンクされるまでfalseを返す。
+        // EN: Return false until linked for a deferred hit group.
+        bool isMaterialized() const;
         void getStackSize(OptixStackSizes* sizes) const;
     };
 
 
 
+    // JP: 要素を追加・差し替えで増分更新できるコーラブルプログラムのテーブル。
+    //     ノードベースのマテリアルグラフのように大量のコーラブルを扱う場合に、編集のたびに
+    //     コーラブルの範囲全体やメインのSBTを作り直さずに済む。
+    //     返されるインデックスはテーブルの寿命の間変わらず、デバイス側でDirectCallableProgramIDや
+    //     ContinuationCallableProgramIDのSBTインデックスとしてそのまま使える。
+    //     レコードはローンチ時にローンチのストリームで転送され、容量が足りなくなった場合は倍に拡張される。
+    //     リンク後に生成したプログラムグループや遅延要素を追加した場合は
+    //     Pipeline::updateDeferredHitGroups()で再リンクする必要がある。
+    // EN: Table of callable programs updated incrementally by appending and patching entries.
+    //     When handling a large number of callables like node-based material graphs,
+    //     this avoids rebuilding the whole callable range or the main SBT on every edit.
+    //     Returned indices never change during the lifetime of the table and can be used directly
+    //     as SBT indices of DirectCallableProgramID or ContinuationCallableProgramID on the device side.
+    //     Records are transferred on the stream of a launch at launch time, and the capacity is doubled
+    //     when it runs out.
+    //     Adding program groups created after linking or deferred entries requires re-linking
+    //     by Pipeline::updateDeferredHitGroups().
+    class CallableProgramTable {
+        OPTIXU_PIMPL();
+
+    public:
+        void destroy();
+        OPTIXU_COMMON_FUNCTIONS(CallableProgramTable);
+
+        void reserve(uint32_t capacity) const;
+        // JP: 要素を末尾に追加しそのインデックスを返す。
+        // EN: Append an entry and return its index.
+        uint32_t addProgram(ProgramGroup program) const;
+        // JP: プログラムグループの生成をリンク時(またはupdateDeferredHitGroups())まで遅らせる要素を追加する。
+        //     生成されたプログラムグループはテーブルが所有する。モジュールはテーブルより長く生存させる必要がある。
+        // EN: Append an entry deferring the creation of its program group until linking
+        //     (or updateDeferredHitGroups()). The table owns the created program group.
+        //     The modules need to outlive the table.
+        uint32_t addDeferredProgram(Module module_DC, const char* entryFunctionNameDC,
+                                    Module module_CC, const char* entryFunctionNameCC) const;
+        // JP: 要素を差し替える。次のローンチではこの要素のレコードのみが転送される。
+        // EN: Replace an entry. Only the record of this entry is transferred at the next launch.
+        void setProgram(uint32_t index, ProgramGroup program) const;
+
+        uint32_t getNumPrograms() const;
+        uint32_t getCapacity() const;
+    };
+
+
+
+    // JP: ローンチパラメターの束縛値の組ごとに特殊化したパイプラインを構築、記憶する。
+    //     バリアント数が上限を超えると最も長く使われていないものを破棄する。
+    //     破棄されるパイプラインを使ったローンチが完了していることはユーザーが保証する必要がある。
+    // EN: Build and memoize specialized pipelines for each set of bound launch parameter values.
+    //     When the number of variants exceeds the limit, the least recently used one is destroyed.
+    //     The user needs to guarantee that launches using a pipeline being destroyed have completed.
+    class PipelineVariantCache {
+        OPTIXU_PIMPL();
+
+    public:
+        void destroy();
+        OPTIXU_COMMON_FUNCTIONS(PipelineVariantCache);
+
+        void setMaxNumVariants(uint32_t maxNumVariants) const;
+        // JP: 束縛値の組に対応するパイプラインを返す。無ければ構築関数を呼んで生成する。
+        // EN: Return the pipeline corresponding to the set of bound values. Call the build function to create
+        //     one if not found.
+        Pipeline getPipeline(const OptixModuleCompileBoundValueEntry* boundValues, uint32_t numBoundValues) const;
+        void clear() const;
+
+        uint32_t getNumVariants() const;
+        void getStatistics(uint32_t* numHits, uint32_t* numMisses) const;
+    };
+
+
+
     class DenoisingTask {
         uint32_t placeHolder[6];
 
@@ -1287,11 +3591,75 @@ private: \
         void destroy();
         OPTIXU_COMMON_FUNCTIONS(Denoiser);
 
+        // JP: 返されるステートとスクラッチのサイズは画素フォーマットに依存しない。
+        //     入出力やAOVの各画像バッファーのサイズはgetImageBufferSize()で求められ、
+        //     OPTIX_PIXEL_FORMAT_HALF4を使うとFLOAT4の半分になる。
+        // EN: The returned state and scratch sizes do not depend on pixel formats.
+        //     The size of each input/output/AOV image buffer can be obtained by getImageBufferSize(),
+        //     and using OPTIX_PIXEL_FORMAT_HALF4 halves it compared to FLOAT4.
         void prepare(uint32_t imageWidth, uint32_t imageHeight, uint32_t tileWidth, uint32_t tileHeight,
                      size_t* stateBufferSize, size_t* scratchBufferSize, size_t* scratchBufferSizeForComputeIntensity,
                      uint32_t* numTasks) const;
+        // JP: prepare()で指定した画像サイズ以下の画像サイズに切り替えてタスクを再計算する。
+        //     ステートとスクラッチバッファーはそのまま使えるので、setupState()を再度呼ぶ必要は無い。
+        //     ウインドウのリサイズなどで最大の解像度でprepare()しておき、実際の解像度をこれで設定する。
+        // EN: Switch to an image size equal to or smaller than that given to prepare() and recompute tasks.
+        //     The state and scratch buffers remain usable, so calling setupState() again is not required.
+        //     For window resizing and the like, call prepare() with the maximum resolution beforehand,
+        //     then set the actual resolution with this.
+        void setImageSize(uint32_t imageWidth, uint32_t imageHeight, uint32_t* numTasks) const;
         void getTasks(DenoisingTask* tasks) const;
+        // JP: invoke()とcomputeIntensity(), computeAverageColor()で共有するスクラッチバッファーのサイズを返す。
+        //     これらは同じストリーム上で順に実行されるので、このサイズのスクラッチバッファーをsetupState()に渡せば
+        //     スクラッチバッファーを取らない版のcomputeIntensity(), computeAverageColor()が同じ領域を使う。
+        // EN: Return the size of the scratch buffer shared by invoke() and computeIntensity(), computeAverageColor().
+        //     These run sequentially on the same stream, so passing a scratch buffer of this size to setupState()
+        //     makes the versions of computeIntensity(), computeAverageColor() without a scratch buffer use
+        //     the same memory.
+        size_t getSharedScratchBufferSize() const;
+        // JP: 現在の画像サイズで指定の画素フォーマットの画像を保持するのに必要なバッファーのサイズを返す。
+        // EN: Return the buffer size required to hold an image of the given pixel format at the current image size.
+        size_t getImageBufferSize(OptixPixelFormat format) const;
+        // JP: タスクが入力として読む領域(タイルとオーバーラップ)を返す。
+        // EN: Return the region (tile and overlap) a task reads as input.
+        void getTaskInputWindow(const DenoisingTask &task,
+                                uint32_t* offsetX, uint32_t* offsetY, uint32_t* width, uint32_t* height) const;
+        // JP: タスクが書き込む領域(タイル)を返す。
+        // EN: Return the region (tile) a task writes.
+        void getTaskOutputWindow(const DenoisingTask &task,
+                                 uint32_t* offsetX, uint32_t* offsetY, uint32_t* width, uint32_t* height) const;
+        // JP: 局所的な編集のためのROIモード。変更のあった画面上の矩形に入力領域が重なるタスクのみを選んで返す。
+        //     各タスクは自身のタイルにのみ書き込むので、選んだタスクだけを既存のデノイズ済みバッファーに対して
+        //     invoke()すれば残りの領域は前回の結果のまま合成される。
+        //     入力領域(オーバーラップを含む)で判定するので、選ばれなかったタスクの結果は全体をデノイズした場合と一致する。
+        //     tasksにはprepare()が返したタスク数分の領域が必要。
+        // EN: ROI mode for localized edits. Select and return only tasks whose input regions overlap
+        //     the changed rectangle on the screen.
+        //     Each task writes only its own tile, so invoking only the selected tasks on the existing denoised buffer
+        //     composites them while the other regions keep the previous results.
+        //     The test uses input regions (including the overlap), so results of unselected tasks match
+        //     those of denoising the whole image.
+        //     tasks requires space for the number of tasks returned by prepare().
+        uint32_t getTasksInRegion(uint32_t regionOffsetX, uint32_t regionOffsetY,
+                                  uint32_t regionWidth, uint32_t regionHeight,
+                                  DenoisingTask* tasks) const;
+        // JP: getTasksInRegion()のタイルマスク版。tileMaskは画面をmaskTileSize四方のタイルに分けた
+        //     行優先の配列で、非ゼロが変更のあったタイルを示す。
+        //     蓄積の世代を比較するカーネルなどでデバイス上に生成し、読み戻したものを渡すことを想定している。
+        // EN: Tile mask version of getTasksInRegion(). tileMask is a row-major array dividing the screen into
+        //     tiles of maskTileSize squared, where non-zero indicates a changed tile.
+        //     This assumes passing a mask generated on the device by e.g. a kernel comparing accumulation epochs
+        //     and read back.
+        uint32_t getTasksInTileMask(const uint8_t* tileMask, uint32_t maskTileSize,
+                                    DenoisingTask* tasks) const;
         void setupState(CUstream stream, const BufferView &stateBuffer, const BufferView &scratchBuffer) const;
+        // JP: invokeConcurrently()用に、ストリームごとのステートとスクラッチバッファーをセットアップする。
+        //     各バッファーのサイズはprepare()が返すものと同じ。
+        // EN: Set up state and scratch buffers per stream for invokeConcurrently().
+        //     The size of each buffer is the same as returned by prepare().
+        void setupConcurrentStates(CUstream stream,
+                                   const BufferView* stateBuffers, const BufferView* scratchBuffers,
+                                   uint32_t numSlots) const;
 
         void computeIntensity(CUstream stream,
                               const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
@@ -1299,6 +3667,14 @@ private: \
         void computeAverageColor(CUstream stream,
                                  const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
                                  const BufferView &scratchBuffer, CUdeviceptr outputAverageColor) const;
+        // JP: setupState()に渡したスクラッチバッファーを使う版。
+        // EN: Versions using the scratch buffer given to setupState().
+        void computeIntensity(CUstream stream,
+                              const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                              CUdeviceptr outputIntensity) const;
+        void computeAverageColor(CUstream stream,
+                                 const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                                 CUdeviceptr outputAverageColor) const;
         void invoke(CUstream stream,
                     bool denoiseAlpha, CUdeviceptr hdrIntensity, float blendFactor,
                     const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
@@ -1308,6 +3684,26 @@ private: \
                     const BufferView &previousDenoisedBeauty,
                     const BufferView &denoisedBeauty,
                     const DenoisingTask &task) const;
+        // JP: タスクを複数のストリームに分散して並行にデノイズする。i番目のタスクは(i % numStreams)番目の
+        //     ストリームでsetupConcurrentStates()の同じ番号のバッファーを使って実行される。
+        //     taskReadyEventsを与えた場合、各タスクは対応するイベントを待ってから開始するので、
+        //     タイル単位のレンダリングの完了を待たずにデノイズを始められる。
+        //     イベントはgetTaskInputWindow()の領域全体のレンダリング完了後に記録する必要がある。
+        // EN: Denoise tasks concurrently distributing them to multiple streams.
+        //     The i-th task is executed on the (i % numStreams)-th stream with the buffers of the same number
+        //     given by setupConcurrentStates().
+        //     When taskReadyEvents is given, each task waits for the corresponding event before starting,
+        //     so denoising can start without waiting for the whole tiled rendering to finish.
+        //     An event needs to be recorded after rendering the whole region of getTaskInputWindow() finishes.
+        void invokeConcurrently(const CUstream* streams, uint32_t numStreams, const CUevent* taskReadyEvents,
+                                bool denoiseAlpha, CUdeviceptr hdrIntensity, float blendFactor,
+                                const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
+                                const BufferView &albedo, OptixPixelFormat albedoFormat,
+                                const BufferView &normal, OptixPixelFormat normalFormat,
+                                const BufferView &flow, OptixPixelFormat flowFormat,
+                                const BufferView &previousDenoisedBeauty,
+                                const BufferView &denoisedBeauty,
+                                const DenoisingTask* tasks, uint32_t numTasks) const;
         // JP: AOVデノイザー用。
         // EN: For AOV denoiser.
         void invoke(CUstream stream,
@@ -1322,6 +3718,136 @@ private: \
 
 
 
+
+    // JP: ジオメトリ入力を縮小するためのホスト側ユーティリティー。
+    // EN: Host-side utilities to shrink geometry inputs.
+
+    // JP: 16ビットインデックスに変換した三角形のまとまり。
+    //     まとまりごとにGeometryInstanceを作り、頂点バッファーをvertexOffsetから始まるnumVertices個の範囲に、
+    //     三角形バッファーを変換後のインデックスの該当範囲(OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3)に設定し、
+    //     setPrimitiveIndexOffset(firstTriangle)を呼ぶとプリミティブインデックスが元と一致する。
+    // EN: A chunk of triangles converted to 16-bit indices.
+    //     Creating a GeometryInstance per chunk, setting the vertex buffer to the range of numVertices vertices
+    //     starting from vertexOffset, setting the triangle buffer to the corresponding range of the converted indices
+    //     (OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3) and calling setPrimitiveIndexOffset(firstTriangle) makes
+    //     primitive indices match the original ones.
+    struct TriangleIndexChunk {
+        uint32_t firstTriangle;
+        uint32_t numTriangles;
+        uint32_t vertexOffset;
+        uint32_t numVertices;
+    };
+
+    // JP: 32ビットの三角形インデックスを、頂点範囲が16ビットに収まるまとまりに分割しながら16ビットに変換する。
+    //     変換後のインデックスは全まとまり分が連続してnarrowedIndicesに格納される。
+    // EN: Convert 32-bit triangle indices to 16-bit while splitting them into chunks whose vertex range
+    //     fits in 16 bits.
+    //     Converted indices of all the chunks are stored consecutively in narrowedIndices.
+    void narrowTriangleIndices(const uint32_t* indices, uint32_t numTriangles,
+                               std::vector<uint16_t>* narrowedIndices, std::vector<TriangleIndexChunk>* chunks);
+
+    // JP: float3の頂点座標を半精度(OPTIX_VERTEX_FORMAT_HALF3, ストライド6バイト)に変換する。
+    //     いずれかの座標の誤差がmaxErrorを超える、もしくは半精度の範囲を超える場合は何もせずfalseを返す。
+    // EN: Convert float3 vertex positions to half precision (OPTIX_VERTEX_FORMAT_HALF3, 6-byte stride).
+    //     Return false without doing anything if the error of any coordinate exceeds maxError or
+    //     the value exceeds the range of half precision.
+    bool quantizeVerticesToHalf(const float* positions, uint32_t numVertices, uint32_t strideInBytes,
+                                float maxError, std::vector<uint16_t>* halfPositions);
+
+    // JP: プリミティブごとのマテリアルインデックスを、マテリアル数に応じた最小のサイズ(1, 2, 4バイト)に詰める。
+    //     結果はGeometryInstance::setNumMaterials()のmatIndexBuffer(ストライドはindexSize)とindexSizeに使える。
+    //     primitiveOrderを与えた場合はプリミティブをマテリアル順に(安定に)並べ替え、
+    //     primitiveOrder[i]に並べ替え後のi番目のプリミティブの元のインデックスを返す。
+    //     この場合、呼び出し側は三角形(AABB)バッファーも同じ順序に並べ替える必要がある。
+    // EN: Pack per-primitive material indices into the smallest size (1, 2, 4 bytes) for the number of materials.
+    //     The result can be used as matIndexBuffer (with the stride of indexSize) and indexSize of
+    //     GeometryInstance::setNumMaterials().
+    //     When primitiveOrder is given, sort primitives by material (stably) and return the original index of
+    //     the i-th primitive after sorting in primitiveOrder[i].
+    //     In this case, the caller needs to reorder the triangle (AABB) buffer in the same order as well.
+    void packMaterialIndices(const uint32_t* materialIndices, uint32_t numPrimitives, uint32_t numMaterials,
+                             std::vector<uint8_t>* packedIndices, uint32_t* indexSize,
+                             std::vector<uint32_t>* primitiveOrder = nullptr);
+
+    struct TriangleMeshView {
+        const void* vertices;
+        uint32_t numVertices;
+        const uint32_t* indices;
+        uint32_t numTriangles;
+    };
+
+    // JP: 頂点レイアウトが同じ(ストライドがvertexStrideInBytes)複数の小さなメッシュを一つの頂点・インデックス列に結合する。
+    //     ジオメトリフラグとマテリアル構成が同じGASの子をまとめることで、ビルド入力とSBTレコードを減らせる。
+    //     primitiveOffsetsにはメッシュごとのプリミティブ範囲の累積和(numMeshes + 1要素)が格納され、
+    //     デバイス側でfindMergedMeshIndex()を使うと元のメッシュのインデックスを求められる。
+    // EN: Merge multiple small meshes with the same vertex layout (stride of vertexStrideInBytes) into
+    //     a single vertex and index sequence.
+    //     Merging children of a GAS with the same geometry flags and material layout reduces build inputs and
+    //     SBT records.
+    //     primitiveOffsets stores the prefix sum of primitive ranges per mesh (numMeshes + 1 elements),
+    //     and findMergedMeshIndex() on the device can recover the original mesh index.
+    void mergeTriangleMeshes(const TriangleMeshView* meshes, uint32_t numMeshes, uint32_t vertexStrideInBytes,
+                             std::vector<uint8_t>* mergedVertices, std::vector<uint32_t>* mergedIndices,
+                             std::vector<uint32_t>* primitiveOffsets);
+
+    // JP: カーブのセグメントを曲率と幅の変化に応じて適応的に二分割し、バウンディングボリュームを引き締める。
+    //     曲がり具合(制御点の弦からの最大距離 / 弦長)がmaxFlatnessを超えるか、幅の比(最大 / 最小)が
+    //     maxWidthRatioを超える間、最大maxDepth回まで分割する。分割はB-スプラインの細分により形状を保つ。
+    //     入力の頂点はfloat3、幅はfloat、セグメントインデックスは各セグメントの最初の制御点のインデックス。
+    //     出力の各セグメントは独立した制御点を持つ。sourceSegmentsには出力セグメントごとに元のセグメントの
+    //     インデックスが格納される。
+    // EN: Adaptively bisect curve segments according to curvature and width variation to tighten bounding volumes.
+    //     Split up to maxDepth times while the bend (max distance of control points from the chord / chord length)
+    //     exceeds maxFlatness or the width ratio (max / min) exceeds maxWidthRatio.
+    //     Splitting preserves the shape through B-spline subdivision.
+    //     Input vertices are float3, widths are float, and segment indices are the index of the first
+    //     control point of each segment.
+    //     Each output segment has independent control points. sourceSegments stores the index of the original
+    //     segment for each output segment.
+    void splitCurveSegments(GeometryType curveType,
+                            const float* positions, const float* widths,
+                            const uint32_t* segmentIndices, uint32_t numSegments,
+                            float maxFlatness, float maxWidthRatio, uint32_t maxDepth,
+                            std::vector<float>* splitPositions, std::vector<float>* splitWidths,
+                            std::vector<uint32_t>* splitSegmentIndices,
+                            std::vector<uint32_t>* sourceSegments = nullptr);
+
+    // JP: 等間隔のモーションキーを、元の動きとの誤差がtolerance以内に収まる最小数の等間隔のキーに削減する。
+    //     戻り値は削減後のキー数で、Transform::setConfiguration()やGAS::setMotionOptions()にそのまま使える。
+    //     変換の誤差はaabbMinP, aabbMaxPで与えるAABBの8頂点の変位の最大値、頂点の誤差は各頂点の変位の最大値。
+    //     relativeToBoundsが真の場合、toleranceはAABB(頂点の場合は全ステップの頂点のAABB)の対角線長に対する比。
+    //     行列は行優先の3x4をキーごとに並べる。SRTはTransform::setSRTMotionKey()と同じ成分をキーごとに並べる。
+    // EN: Reduce uniformly spaced motion keys to the minimum number of uniformly spaced keys whose error from
+    //     the original motion is within tolerance.
+    //     Returns the reduced number of keys, usable as is for Transform::setConfiguration() and
+    //     GAS::setMotionOptions().
+    //     The error of transforms is the maximum displacement of the 8 corners of the AABB given by
+    //     aabbMinP, aabbMaxP, and the error of vertices is the maximum displacement of each vertex.
+    //     When relativeToBounds is true, tolerance is a ratio to the diagonal length of the AABB
+    //     (for vertices, the AABB of vertices of all steps).
+    //     Matrices are row-major 3x4 arranged per key. SRTs arrange the same components as
+    //     Transform::setSRTMotionKey() per key.
+    uint32_t reduceMatrixMotionKeys(const float* matrices, uint32_t numKeys,
+                                    const float aabbMinP[3], const float aabbMaxP[3],
+                                    float tolerance, bool relativeToBounds,
+                                    std::vector<float>* reducedMatrices);
+    uint32_t reduceSRTMotionKeys(const float* scales, const float* orientations, const float* translations,
+                                 uint32_t numKeys,
+                                 const float aabbMinP[3], const float aabbMaxP[3],
+                                 float tolerance, bool relativeToBounds,
+                                 std::vector<float>* reducedScales, std::vector<float>* reducedOrientations,
+                                 std::vector<float>* reducedTranslations);
+    // JP: stepPositions[s]はステップsのfloat3の頂点座標(ストライドはstrideInBytes)。
+    //     削減後の頂点座標はステップごとに詰めたfloat3としてreducedPositionsに格納される。
+    // EN: stepPositions[s] is float3 vertex positions of step s (with the stride of strideInBytes).
+    //     Reduced vertex positions are stored in reducedPositions as packed float3 per step.
+    uint32_t reduceVertexMotionSteps(const float* const* stepPositions, uint32_t numSteps,
+                                     uint32_t numVertices, uint32_t strideInBytes,
+                                     float tolerance, bool relativeToBounds,
+                                     std::vector<float>* reducedPositions);
+
+
+
 #undef OPTIXU_COMMON_FUNCTIONS
 #undef OPTIXU_PIMPL
 
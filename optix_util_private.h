@@ -37,13 +37,35 @@
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <map>
+#include <deque>
+#include <list>
 #include <algorithm>
+#include <cmath>
 #include <variant>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <cstring>
 
 #include <intrin.h>
 
 #include <stdexcept>
 
+#if defined(OPTIXU_ENABLE_NVTX)
+#   include <nvtx3/nvToolsExt.h>
+#endif
+#if defined(OPTIXU_ENABLE_NVRTC)
+#   include <nvrtc.h>
+#endif
+#include <fstream>
+#include <filesystem>
+#include <string_view>
+
 #define CUDADRV_CHECK(call) \
     do { \
         CUresult error = call; \
@@ -69,6 +91,20 @@
         } \
     } while (0)
 
+#if defined(OPTIXU_ENABLE_NVRTC)
+#define NVRTC_CHECK(call) \
+    do { \
+        nvrtcResult error = call; \
+        if (error != NVRTC_SUCCESS) { \
+            std::stringstream ss; \
+            ss << "NVRTC call (" << #call << ") failed: " \
+               << nvrtcGetErrorString(error) \
+               << " (" __FILE__ << ":" << __LINE__ << ")\n"; \
+            throw std::runtime_error(ss.str().c_str()); \
+        } \
+    } while (0)
+#endif
+
 #define OPTIX_CHECK_LOG(call) \
     do { \
         OptixResult error = call; \
@@ -100,6 +136,7 @@ namespace optixu {
     static constexpr size_t s_maxGeometryInstanceUserDataSize = 512;
     static constexpr size_t s_maxGASChildUserDataSize = 512;
     static constexpr size_t s_maxGASUserDataSize = 512;
+    static constexpr size_t s_maxProgramRecordUserDataSize = 512;
 
 
 
@@ -183,23 +220,405 @@ namespace optixu {
         }
     };
 
+    // JP: 値が変わらない設定を検出して数える対象の種類。
+    // EN: Kinds of targets for which settings without value changes are detected and counted.
+    enum class RedundantUpdateKind {
+        Instance = 0,
+        Transform,
+        UserData,
+    };
+
+    // JP: 小さなホスト側のデータなのでmemcmpで比べる。
+    // EN: Compare with memcmp since this is small host-side data.
+    inline bool isSameUserData(const std::vector<uint8_t> &userData, const SizeAlign &userDataSizeAlign,
+                               const void* data, uint32_t size, uint32_t alignment) {
+        return userDataSizeAlign.size == size && userDataSizeAlign.alignment == alignment &&
+            userData.size() == size && (size == 0 || std::memcmp(userData.data(), data, size) == 0);
+    }
+
     SizeAlign max(const SizeAlign &sa0, const SizeAlign &sa1) {
         return SizeAlign{ std::max(sa0.size, sa1.size), std::max(sa0.alignment, sa1.alignment) };
     }
 
 
 
+    // JP: ストリームがCUDAグラフのキャプチャー中かを返す。キャプチャー中はホストとの同期を伴う処理を行えない。
+    // EN: Return whether the stream is being captured into a CUDA graph.
+    //     Operations involving synchronization with the host cannot be performed during capture.
+    static inline bool isStreamCapturing(CUstream stream) {
+        CUstreamCaptureStatus status;
+        CUDADRV_CHECK(cuStreamIsCapturing(stream, &status));
+        return status != CU_STREAM_CAPTURE_STATUS_NONE;
+    }
+
+
+
+    // JP: アップデートの回数とASのAABBの拡大率を追跡し、品質が閾値を超えて劣化したらリビルドを判断する。
+    //     AABBはビルド時にemitされ、ホストを止めないように非同期に読み戻される。
+    // EN: Track the number of updates and the growth of the AS's AABB, and decide to rebuild
+    //     when the quality degrades beyond the thresholds.
+    //     The AABB is emitted at build and read back asynchronously not to stall the host.
+    class AutoRebuildPolicy {
+        uint32_t maxNumUpdates;
+        float maxBoundsGrowth;
+        uint32_t numUpdatesSinceRebuild;
+        CUdeviceptr aabbOnDevice;
+        OptixAabb* aabbOnHost;
+        CUevent aabbReadbackEvent;
+        OptixAccelEmitDesc propertyAabb;
+        float referenceBoundsArea;
+        float latestBoundsArea;
+        struct {
+            unsigned int readbackPending : 1;
+            unsigned int pendingIsReference : 1;
+        };
+
+        void readBackResult();
+
+    public:
+        AutoRebuildPolicy() :
+            maxNumUpdates(0), maxBoundsGrowth(0.0f),
+            numUpdatesSinceRebuild(0),
+            aabbOnDevice(0), aabbOnHost(nullptr), aabbReadbackEvent(nullptr),
+            propertyAabb{},
+            referenceBoundsArea(0.0f), latestBoundsArea(0.0f),
+            readbackPending(false), pendingIsReference(false) {}
+        ~AutoRebuildPolicy() {
+            if (aabbReadbackEvent)
+                cuEventDestroy(aabbReadbackEvent);
+            if (aabbOnHost)
+                cuMemFreeHost(aabbOnHost);
+            if (aabbOnDevice)
+                cuMemFree(aabbOnDevice);
+        }
+
+        void set(uint32_t _maxNumUpdates, float _maxBoundsGrowth);
+        bool isEnabled() const {
+            return maxNumUpdates > 0 || maxBoundsGrowth > 0.0f;
+        }
+        bool tracksBounds() const {
+            return maxBoundsGrowth > 0.0f;
+        }
+        const OptixAccelEmitDesc &getAabbEmitDesc() const {
+            return propertyAabb;
+        }
+        void notifyBuild(CUstream stream, bool isRebuild);
+        bool shouldRebuild();
+    };
+
+
+
+    class ASStatisticsRecorder {
+    public:
+        enum class Operation {
+            Build = 0,
+            Update,
+            Compaction,
+            NumOperations
+        };
+
+    private:
+        struct Timing {
+            CUevent beginEvent;
+            CUevent endEvent;
+            float timeInMs;
+            bool pending;
+        };
+        Timing timings[static_cast<uint32_t>(Operation::NumOperations)];
+        uint32_t numBuilds;
+        uint32_t numUpdates;
+        uint32_t numCompactions;
+        bool enabled;
+
+    public:
+        ASStatisticsRecorder() :
+            timings{}, numBuilds(0), numUpdates(0), numCompactions(0), enabled(false) {}
+        ~ASStatisticsRecorder() {
+            for (Timing &timing : timings) {
+                if (timing.endEvent)
+                    cuEventDestroy(timing.endEvent);
+                if (timing.beginEvent)
+                    cuEventDestroy(timing.beginEvent);
+            }
+        }
+
+        void setEnabled(bool enable);
+        bool isEnabled() const {
+            return enabled;
+        }
+        void begin(CUstream stream, Operation op);
+        void end(CUstream stream, Operation op);
+        void getTimes(float* buildTime, float* updateTime, float* compactionTime);
+        void getCounts(uint32_t* _numBuilds, uint32_t* _numUpdates, uint32_t* _numCompactions) const {
+            *_numBuilds = numBuilds;
+            *_numUpdates = numUpdates;
+            *_numCompactions = numCompactions;
+        }
+    };
+
+
+
+    // JP: ページロックされたホストメモリーのリングバッファー。転送元として使った領域は
+    //     イベントでGPU側のコピー完了を確認してから再利用する。
+    // EN: Ring buffer of page-locked host memory. A region used as a transfer source is reused
+    //     after confirming the completion of the copy on the GPU side with an event.
+    class PinnedStagingRing {
+        struct Allocation {
+            size_t begin;
+            size_t end;
+            CUevent event;
+        };
+        uint8_t* buffer;
+        size_t capacity;
+        size_t head;
+        std::deque<Allocation> inFlightAllocations;
+        std::vector<CUevent> freeEvents;
+
+        void waitAll();
+
+    public:
+        PinnedStagingRing() : buffer(nullptr), capacity(0), head(0) {}
+        ~PinnedStagingRing();
+
+        void upload(CUstream stream, CUdeviceptr dst, const void* src, size_t size);
+    };
+
+
+
+    // JP: 同じ型のPrivオブジェクトを大きなスラブから切り出すプールアロケーター。
+    //     数十万のオブジェクトを生成、破棄してもグローバルヒープを断片化させず、
+    //     同時期に生成されたオブジェクトがメモリー上で近くに並ぶ。
+    //     スラブは解放されたオブジェクトのフリーリストとして再利用され、プロセス終了まで保持される。
+    // EN: A pool allocator carving Priv objects of the same type out of large slabs.
+    //     This doesn't fragment the global heap even when creating and destroying hundreds of thousands of objects,
+    //     and objects created around the same time are placed close in memory.
+    //     Slabs are reused as a free list of released objects and kept until the process exits.
+    template <typename T>
+    class PooledAllocator {
+        static constexpr size_t s_alignment = std::max(alignof(T), alignof(void*));
+        static constexpr size_t s_objectSize = (std::max(sizeof(T), sizeof(void*)) + s_alignment - 1) /
+            s_alignment * s_alignment;
+        static constexpr size_t s_numObjectsPerSlab = 256;
+
+        struct State {
+            std::mutex mutex;
+            void* freeList = nullptr;
+            std::vector<void*> slabs;
+
+            ~State() {
+                for (void* slab : slabs)
+                    ::operator delete(slab);
+            }
+        };
+
+        static State &getState() {
+            static State state;
+            return state;
+        }
+
+        static void addSlab(State &state, size_t numObjects) {
+            static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned type is not supported.");
+            auto slab = reinterpret_cast<uint8_t*>(::operator new(s_objectSize * numObjects));
+            state.slabs.push_back(slab);
+            // JP: 先頭から順に払い出されるようにリストを逆順に繋ぐ。
+            // EN: Link the list in reverse order so that objects are handed out from the beginning.
+            for (size_t i = numObjects; i > 0; --i) {
+                void* obj = slab + s_objectSize * (i - 1);
+                *reinterpret_cast<void**>(obj) = state.freeList;
+                state.freeList = obj;
+            }
+        }
+
+    public:
+        static void* allocate(size_t size) {
+            optixuAssert(size == sizeof(T), "Size mismatch for pooled allocation.");
+            State &state = getState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.freeList)
+                addSlab(state, s_numObjectsPerSlab);
+            void* obj = state.freeList;
+            state.freeList = *reinterpret_cast<void**>(obj);
+            return obj;
+        }
+        // JP: ロックを一度だけ取ってnumObjects個をまとめて払い出す。空きリストが足りない場合は
+        //     不足分を一つのスラブとして確保するので、新しく確保した分は連続した領域になる。
+        // EN: Hand out numObjects objects together taking the lock only once. When the free list is not enough,
+        //     the shortage is allocated as a single slab, so newly allocated ones are contiguous.
+        static void allocateMultiple(uint32_t numObjects, void** objs) {
+            State &state = getState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            uint32_t numFree = 0;
+            for (void* obj = state.freeList; obj && numFree < numObjects; obj = *reinterpret_cast<void**>(obj))
+                ++numFree;
+            if (numFree < numObjects)
+                addSlab(state, std::max<size_t>(numObjects - numFree, s_numObjectsPerSlab));
+            for (uint32_t i = 0; i < numObjects; ++i) {
+                objs[i] = state.freeList;
+                state.freeList = *reinterpret_cast<void**>(objs[i]);
+            }
+        }
+        static void deallocate(void* obj) {
+            if (!obj)
+                return;
+            State &state = getState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            *reinterpret_cast<void**>(obj) = state.freeList;
+            state.freeList = obj;
+        }
+    };
+
+#define OPTIXU_POOLED_ALLOCATION(BaseName) \
+    static void* operator new(size_t size) { \
+        return PooledAllocator<BaseName::Priv>::allocate(size); \
+    } \
+    static void operator delete(void* p) { \
+        PooledAllocator<BaseName::Priv>::deallocate(p); \
+    } \
+    static void allocateMultiple(uint32_t numObjects, void** objs) { \
+        PooledAllocator<BaseName::Priv>::allocateMultiple(numObjects, objs); \
+    }
+
+
+
+    // JP: 小さいユーザーデータをヒープ確保無しで保持するバイト列。容量を超えた場合のみヒープを使う。
+    // EN: A byte array holding small user data without heap allocation. This uses the heap only beyond the capacity.
+    class SmallByteBuffer {
+        static constexpr uint32_t s_inlineCapacity = 32;
+
+        union {
+            alignas(std::max_align_t) uint8_t m_inlineData[s_inlineCapacity];
+            uint8_t* m_heapData;
+        };
+        uint32_t m_size;
+        uint32_t m_capacity;
+
+        bool isInline() const {
+            return m_capacity <= s_inlineCapacity;
+        }
+
+    public:
+        SmallByteBuffer() : m_size(0), m_capacity(s_inlineCapacity) {}
+        explicit SmallByteBuffer(size_t size) : SmallByteBuffer() {
+            resize(size);
+        }
+        SmallByteBuffer(const SmallByteBuffer &b) : SmallByteBuffer() {
+            resize(b.m_size);
+            std::memcpy(data(), b.data(), m_size);
+        }
+        SmallByteBuffer(SmallByteBuffer &&b) noexcept : m_size(b.m_size), m_capacity(b.m_capacity) {
+            if (b.isInline()) {
+                std::memcpy(m_inlineData, b.m_inlineData, m_size);
+            }
+            else {
+                m_heapData = b.m_heapData;
+                b.m_capacity = s_inlineCapacity;
+            }
+            b.m_size = 0;
+        }
+        ~SmallByteBuffer() {
+            if (!isInline())
+                delete[] m_heapData;
+        }
+        SmallByteBuffer &operator=(const SmallByteBuffer &b) {
+            if (this != &b) {
+                resize(b.m_size);
+                std::memcpy(data(), b.data(), m_size);
+            }
+            return *this;
+        }
+        SmallByteBuffer &operator=(SmallByteBuffer &&b) noexcept {
+            if (this != &b) {
+                this->~SmallByteBuffer();
+                new (this) SmallByteBuffer(std::move(b));
+            }
+            return *this;
+        }
+
+        // JP: std::vectorと同様に増えた分はゼロで埋める。
+        // EN: Fill the increased part with zero like std::vector.
+        void resize(size_t size) {
+            const uint32_t newSize = static_cast<uint32_t>(size);
+            if (newSize > m_capacity) {
+                uint8_t* newData = new uint8_t[newSize];
+                std::memcpy(newData, data(), m_size);
+                if (!isInline())
+                    delete[] m_heapData;
+                m_heapData = newData;
+                m_capacity = newSize;
+            }
+            if (newSize > m_size)
+                std::memset(data() + m_size, 0, newSize - m_size);
+            m_size = newSize;
+        }
+
+        uint8_t* data() {
+            return isInline() ? m_inlineData : m_heapData;
+        }
+        const uint8_t* data() const {
+            return isInline() ? m_inlineData : m_heapData;
+        }
+        size_t size() const {
+            return m_size;
+        }
+    };
+
+
+
     class Context::Priv {
         CUcontext cuContext;
         OptixDeviceContext rawContext;
         uint32_t maxInstanceID;
         uint32_t numVisibilityMaskBits;
-        std::unordered_map<const void*, std::string> registeredNames;
+        // JP: オブジェクトの生成と破棄は複数スレッドから行われうるので、名前の登録はポインターで分割したシャードごとにロックする。
+        // EN: Object creation and destruction can happen from multiple threads,
+        //     so name registration locks per shard split by the pointer.
+        struct NameShard {
+            std::mutex mutex;
+            std::unordered_map<const void*, std::string> names;
+        };
+        static constexpr uint32_t s_numNameShards = 16;
+        mutable NameShard nameShards[s_numNameShards];
+        std::atomic<uint64_t> sbtRecordStampCounter;
+        std::unordered_set<uint64_t> moduleCacheKeys;
+        ModuleCacheStatistics moduleCacheStats;
+        std::mutex moduleCacheStatsMutex;
+        std::atomic<uint64_t> redundantUpdateCounts[3];
+        std::unordered_map<uint64_t, std::string> ptxCache;
+        std::string ptxCacheLocation;
+        std::mutex ptxCacheMutex;
+        ProfileScopeCallback profileBegin;
+        ProfileScopeCallback profileEnd;
+        void* profileUserData;
+        struct DeferredRelease {
+            CUevent event;
+            DeferredReleaseFunction func;
+            void* userData;
+        };
+        std::mutex deferredReleaseMutex;
+        std::vector<DeferredRelease> deferredReleases;
+        std::vector<CUevent> freeDeferredReleaseEvents;
+        // JP: 事前構築されたパイプラインは最初のcreatePipeline(recipeName)で受け取られるまでここで保持する。
+        // EN: A pipeline built in advance is held here until received by the first createPipeline(recipeName).
+        struct PipelineRecipe {
+            PipelineRecipeFunction func;
+            void* userData;
+            std::future<_Pipeline*> prewarmedPipeline;
+        };
+        mutable std::mutex pipelineRecipeMutex;
+        std::unordered_map<std::string, PipelineRecipe> pipelineRecipes;
+        std::mutex sceneRegistryMutex;
+        std::unordered_set<_Scene*> scenes;
+
+        void destroyPipelineRecipes();
 
     public:
         OPTIXU_OPAQUE_BRIDGE(Context);
 
-        Priv(CUcontext _cuContext, uint32_t logLevel, bool enableValidation) : cuContext(_cuContext) {
+        Priv(CUcontext _cuContext, uint32_t logLevel, bool enableValidation) :
+            cuContext(_cuContext), sbtRecordStampCounter(0), moduleCacheStats{},
+            profileBegin(nullptr), profileEnd(nullptr), profileUserData(nullptr) {
+            for (std::atomic<uint64_t> &count : redundantUpdateCounts)
+                count = 0;
             throwRuntimeError(logLevel <= 4, "Valid range for logLevel is [0, 4].");
             OPTIX_CHECK(optixInit());
 
@@ -217,9 +636,29 @@ namespace optixu {
                                                       &numVisibilityMaskBits, sizeof(numVisibilityMaskBits)));
         }
         ~Priv() {
+            // JP: 遅延破棄されたオブジェクトと受け取られなかった事前構築のパイプラインは
+            //     このコンテキストに属するので先に破棄する。
+            //     デストラクターから例外を投げないように、待機の失敗は報告するだけに留める。
+            // EN: Deferred-destroyed objects and pipelines built in advance but not received
+            //     belong to this context, so destroy them first.
+            //     Only report a failure of waiting so as not to throw from the destructor.
+            destroyPipelineRecipes();
+            try {
+                processDeferredReleases(true);
+            }
+            catch (const std::exception &e) {
+                devPrintf("Context: %s\n", e.what());
+            }
+            for (const DeferredRelease &release : deferredReleases)
+                cuEventDestroy(release.event);
+            for (CUevent event : freeDeferredReleaseEvents)
+                cuEventDestroy(event);
             optixDeviceContextDestroy(rawContext);
         }
 
+        CUcontext getCUcontext() const {
+            return cuContext;
+        }
         uint32_t getMaxInstanceID() const {
             return maxInstanceID;
         }
@@ -234,18 +673,110 @@ namespace optixu {
             return rawContext;
         }
 
+        // JP: SBTレコードの内容を変更したオブジェクトに単調増加するスタンプを発行する。
+        //     パイプラインは最後にレコードを転送した時点のスタンプと比較して差分のみを更新する。
+        // EN: Issue a monotonically increasing stamp to an object whose SBT record contents changed.
+        //     A pipeline compares it with the stamp at the last record transfer to update only the difference.
+        uint64_t issueSBTRecordStamp() {
+            return ++sbtRecordStampCounter;
+        }
+        uint64_t getLatestSBTRecordStamp() const {
+            return sbtRecordStampCounter;
+        }
+
+        void recordModuleCreation(uint64_t cacheKey, float compileTimeInMs) {
+            // JP: 非同期のモジュール生成からも呼ばれる。
+            // EN: This is called also from asynchronous module creations.
+            std::lock_guard<std::mutex> lock(moduleCacheStatsMutex);
+            ++moduleCacheStats.numModuleCreations;
+            if (moduleCacheKeys.insert(cacheKey).second)
+                ++moduleCacheStats.numKeyMisses;
+            else
+                ++moduleCacheStats.numKeyHits;
+            moduleCacheStats.totalCompileTimeInMs += compileTimeInMs;
+        }
+        const ModuleCacheStatistics &getModuleCacheStatistics() const {
+            return moduleCacheStats;
+        }
+
+        void countRedundantUpdate(RedundantUpdateKind kind) {
+            ++redundantUpdateCounts[static_cast<uint32_t>(kind)];
+        }
+        void getRedundantUpdateStatistics(RedundantUpdateStatistics* stats) const {
+            stats->numSkippedInstanceUpdates = redundantUpdateCounts[static_cast<uint32_t>(RedundantUpdateKind::Instance)];
+            stats->numSkippedTransformUpdates = redundantUpdateCounts[static_cast<uint32_t>(RedundantUpdateKind::Transform)];
+            stats->numSkippedUserDataUpdates = redundantUpdateCounts[static_cast<uint32_t>(RedundantUpdateKind::UserData)];
+        }
+        void resetRedundantUpdateStatistics() {
+            for (std::atomic<uint64_t> &count : redundantUpdateCounts)
+                count = 0;
+        }
+
+        void setPTXCacheLocation(const std::string &location) {
+            std::lock_guard<std::mutex> lock(ptxCacheMutex);
+            ptxCacheLocation = location;
+        }
+        // JP: CUDAソースをPTXにコンパイルする。同じソースとオプションの組み合わせはキャッシュから返す。
+        // EN: Compile CUDA source to PTX. The same combination of source and options is returned from the cache.
+        std::string compileCUDASource(const std::string &cudaSource, const std::vector<std::string> &options);
+
+        void deferRelease(CUstream stream, DeferredReleaseFunction func, void* userData);
+        uint32_t processDeferredReleases(bool wait);
+
+        void registerPipelineRecipe(const std::string &name, PipelineRecipeFunction recipe, void* userData);
+        bool isPipelineRecipeReady(const std::string &name) const;
+        _Pipeline* createPipelineFromRecipe(const std::string &name);
+        uint32_t getNumPendingDeferredReleases() {
+            std::lock_guard<std::mutex> lock(deferredReleaseMutex);
+            return static_cast<uint32_t>(deferredReleases.size());
+        }
+
+        void registerScene(_Scene* scene) {
+            std::lock_guard<std::mutex> lock(sceneRegistryMutex);
+            scenes.insert(scene);
+        }
+        void unregisterScene(_Scene* scene) {
+            std::lock_guard<std::mutex> lock(sceneRegistryMutex);
+            scenes.erase(scene);
+        }
+        // JP: エニーヒットが追加され得るヒットグループの変更時に、ジオメトリフラグの推定が有効なシーンの
+        //     SBTレイアウトをdirty状態にして、推定で設定したOPTIX_GEOMETRY_FLAG_DISABLE_ANYHITを見直させる。
+        // EN: At a change of hit groups that may add any-hit, mark the SBT layouts of scenes with the geometry flag
+        //     inference enabled dirty to make them reconsider OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT set by the inference.
+        void markSBTLayoutsDirtyForGeometryFlagInference();
+
+        void beginProfileScope(const char* name, CUstream stream) const {
+            if (profileBegin)
+                profileBegin(profileUserData, name, stream);
+        }
+        void endProfileScope(const char* name, CUstream stream) const {
+            if (profileEnd)
+                profileEnd(profileUserData, name, stream);
+        }
+
+        NameShard &getNameShard(const void* p) const {
+            return nameShards[(reinterpret_cast<uintptr_t>(p) >> 4) % s_numNameShards];
+        }
         void registerName(const void* p, const std::string &name) {
             optixuAssert(p, "Object must not be nullptr.");
-            registeredNames[p] = name;
+            NameShard &shard = getNameShard(p);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.names[p] = name;
         }
         void unregisterName(const void* p) {
             optixuAssert(p, "Object must not be nullptr.");
-            if (registeredNames.count(p) > 0)
-                registeredNames.erase(p);
+            NameShard &shard = getNameShard(p);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.names.erase(p);
         }
+        // JP: 返り値はそのオブジェクトの名前が変更、破棄されるまで有効。
+        // EN: The return value is valid until the name of the object is changed or the object is destroyed.
         const char* getRegisteredName(const void* p) const {
-            if (registeredNames.count(p) > 0)
-                return registeredNames.at(p).c_str();
+            NameShard &shard = getNameShard(p);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.names.find(p);
+            if (it != shard.names.cend())
+                return it->second.c_str();
             return nullptr;
         }
         std::string getName(const void* p) const {
@@ -281,6 +812,45 @@ namespace optixu {
         OPTIXU_THROW_RUNTIME_ERROR("Context");
     };
 
+    // JP: 関数の範囲をプロファイラーのスコープとして囲む。例外で抜けた場合も必ず閉じる。
+    // EN: Enclose a function's extent as a profiler scope. This closes the scope even on exceptions.
+    class ProfileScope {
+        const _Context* m_context;
+        const char* m_name;
+        CUstream m_stream;
+
+    public:
+        ProfileScope(const _Context* context, const char* name, CUstream stream) :
+            m_context(context), m_name(name), m_stream(stream) {
+            m_context->beginProfileScope(m_name, m_stream);
+        }
+        ~ProfileScope() {
+            m_context->endProfileScope(m_name, m_stream);
+        }
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+    };
+
+#if defined(OPTIXU_ENABLE_NVTX)
+    class NvtxRange {
+    public:
+        NvtxRange(const char* funcName, const std::string &objName) {
+            const std::string message = std::string(funcName) + " (" + objName + ")";
+            nvtxRangePushA(message.c_str());
+        }
+        ~NvtxRange() {
+            nvtxRangePop();
+        }
+        NvtxRange(const NvtxRange &) = delete;
+        NvtxRange &operator=(const NvtxRange &) = delete;
+    };
+    // JP: 無効時にはgetName()の評価も行わないようにマクロにする。
+    // EN: Make this a macro to avoid even evaluating getName() when disabled.
+#   define OPTIXU_NVTX_RANGE(FuncName, Obj) NvtxRange nvtxRange(FuncName, (Obj)->getName())
+#else
+#   define OPTIXU_NVTX_RANGE(FuncName, Obj)
+#endif
+
 
 
     class Material::Priv {
@@ -316,17 +886,36 @@ namespace optixu {
             }
         };
 
+        // JP: パイプラインごとにパック済みのヘッダーをレイタイプ順に並べたキャッシュ。
+        //     パイプラインの数は少ないので線形探索で十分。setHitGroup()で無効化される。
+        //     パイプラインの既定のヒットグループが変わった場合もリビジョンの不一致で作り直す。
+        // EN: Cache of packed headers in ray type order per pipeline.
+        //     Linear search is enough since the number of pipelines is small. Invalidated by setHitGroup().
+        //     Also rebuilt by a revision mismatch when the default hit groups of the pipeline change.
+        struct HeaderCache {
+            const _Pipeline* pipeline;
+            uint32_t defaultHitGroupRevision;
+            std::vector<uint8_t> headers;
+            std::vector<uint8_t> isValid;
+        };
+
         _Context* context;
         SizeAlign userDataSizeAlign;
-        std::vector<uint8_t> userData;
+        SmallByteBuffer userData;
+        uint64_t sbtRecordStamp;
+        uint64_t headerStamp;
 
         std::unordered_map<Key, _ProgramGroup*, Key::Hash> programs;
+        mutable std::vector<HeaderCache> headerCaches;
+
+        const HeaderCache &getHeaderCache(const _Pipeline* pipeline) const;
 
     public:
         OPTIXU_OPAQUE_BRIDGE(Material);
+        OPTIXU_POOLED_ALLOCATION(Material);
 
         Priv(_Context* ctxt) :
-            context(ctxt), userData(sizeof(uint32_t)) {}
+            context(ctxt), userData(sizeof(uint32_t)), sbtRecordStamp(0), headerStamp(0) {}
         ~Priv() {
             context->unregisterName(this);
         }
@@ -343,7 +932,46 @@ namespace optixu {
         SizeAlign getUserDataSizeAlign() const {
             return userDataSizeAlign;
         }
-        void setRecordData(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record, SizeAlign* curSizeAlign) const;
+        const uint8_t* getUserData() const {
+            return userData.data();
+        }
+        void markSBTRecordDirty() {
+            sbtRecordStamp = context->issueSBTRecordStamp();
+        }
+        uint64_t getSBTRecordStamp() const {
+            return sbtRecordStamp;
+        }
+        // JP: ヘッダーのみが変わったことを示すスタンプ。レコード全体のスタンプとは独立に扱い、
+        //     パイプラインは該当するレコードのヘッダーだけをその場で書き換える。
+        // EN: Stamp indicating that only headers changed. This is handled independently of the stamp
+        //     of entire records, and a pipeline rewrites only the headers of the corresponding records in place.
+        void markHeadersDirty() {
+            headerStamp = context->issueSBTRecordStamp();
+        }
+        uint64_t getHeaderStamp() const {
+            return headerStamp;
+        }
+        void invalidateHeaderCaches() {
+            headerCaches.clear();
+        }
+        void prepareHeaderCache(const _Pipeline* pipeline) const {
+            getHeaderCache(pipeline);
+        }
+        void collectProgramGroups(const _Pipeline* pipeline, std::vector<_ProgramGroup*>* groups) const {
+            for (const std::pair<const Key, _ProgramGroup*> &program : programs) {
+                if (program.first.pipeline == pipeline && program.second)
+                    groups->push_back(program.second);
+            }
+        }
+        // JP: 指定したレイタイプでエニーヒットプログラムが呼ばれうるか。
+        //     ヒットグループを一つも持たない場合は不明なので保守的にtrueを返す。
+        // EN: Whether an any-hit program may be invoked for the specified ray type.
+        //     This conservatively returns true when the material doesn't have any hit group since it is unknown.
+        bool mayInvokeAnyHit(uint32_t rayType) const;
+        void replaceProgram(const _Pipeline* pipeline, uint32_t rayType, _ProgramGroup* program);
+        void writeHeader(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record) const;
+        void setRecordData(const _Pipeline* pipeline, uint32_t rayType, uint8_t* record, SizeAlign* curSizeAlign,
+                           CUdeviceptr outOfRecordUserData) const;
     };
 
 
@@ -363,44 +991,207 @@ namespace optixu {
                 }
                 return false;
             }
-
-            struct Hash {
-                typedef std::size_t result_type;
-
-                std::size_t operator()(const SBTOffsetKey& key) const {
-                    size_t seed = 0;
-                    auto hash0 = std::hash<uint32_t>()(key.gasSerialID);
-                    auto hash1 = std::hash<uint32_t>()(key.matSetIndex);
-                    seed ^= hash0 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-                    seed ^= hash1 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-                    return seed;
-                }
-            };
             bool operator==(const SBTOffsetKey &rKey) const {
                 return gasSerialID == rKey.gasSerialID && matSetIndex == rKey.matSetIndex;
             }
         };
+        // JP: SBTレイアウトはキー順に並んだ配列で、各要素がレコードの範囲を持つ。
+        //     オフセットはキー順に単調とは限らない(追加されたものは末尾に割り当てられる)。
+        // EN: The SBT layout is an array sorted by the key, and each element has a range of records.
+        //     Offsets are not necessarily monotonic in the key order (added ones are allocated at the tail).
+        struct SBTLayoutEntry {
+            SBTOffsetKey key;
+            uint32_t offset;
+            uint32_t numRecords;
+            bool shared; // other entries have the same range
+            bool isAlias; // the range is owned by another entry
+        };
 
         _Context* context;
-        std::unordered_map<uint32_t, _GeometryAccelerationStructure*> geomASs;
-        std::unordered_map<SBTOffsetKey, uint32_t, SBTOffsetKey::Hash> sbtOffsets;
+        // JP: オブジェクトの生成、破棄、設定は複数スレッドから行われうるので、
+        //     シーン全体の登録情報はロックで、ダーティー状態はアトミックで保護する。
+        //     SBTレイアウト生成やまとめてのASビルドは同期点であり、これらとは並行に呼べない。
+        // EN: Object creation, destruction and configuration can happen from multiple threads,
+        //     so scene-wide registries are protected by locks and dirty states are atomic.
+        //     SBT layout generation and batched AS builds are sync points and cannot be called concurrently with them.
+        std::mutex registryMutex;
+        std::map<uint32_t, _GeometryAccelerationStructure*> geomASs;
+        std::vector<SBTLayoutEntry> sbtLayout;
         uint32_t nextGeomASSerialID;
+        // JP: 可視性カテゴリーの名前(インデックスがビット位置)とレイタイプごとのマスク。
+        // EN: Names of visibility categories (index is the bit position) and per-ray-type masks.
+        std::vector<std::string> visibilityCategories;
+        std::vector<uint32_t> rayTypeVisibilityMasks;
         uint32_t singleRecordSize;
         uint32_t numSBTRecords;
         std::unordered_set<_Transform*> transforms;
         std::unordered_set<_InstanceAccelerationStructure*> instASs;
+        std::vector<_GeometryAccelerationStructure*> geomASsToBuild;
+        OptixAccelBufferSizes batchedGASMemoryRequirement;
+        CUevent asBuildEvent;
+        BufferView lazyBuildAccelPool;
+        BufferView lazyBuildScratchBuffer;
+        size_t lazyBuildPoolOffset;
+        std::vector<_GeometryAccelerationStructure*> lazilyBuiltGASs;
+        size_t residencyBudget;
+        uint32_t residencyMinFramesToKeep;
+        uint64_t residencyStamp;
+        uint64_t numEvictions;
+        uint64_t numRestorations;
+        std::vector<_Transform*> transformsToBuild;
+        std::vector<size_t> transformOffsets;
+        size_t batchedTransformSize;
+        uint8_t* transformStagingBuffer;
+        size_t transformStagingBufferSize;
+        CUevent transformUploadEvent;
+
+        // JP: buildDirty()が実行するビルド・アップデートの計画。依存の深さ(GASが0)の順に並ぶ。
+        // EN: The plan of builds and updates executed by buildDirty(), sorted by the dependency depth (0 for GASs).
+        struct DirtyBuildTask {
+            _GeometryAccelerationStructure* gas;
+            _Transform* transform;
+            _InstanceAccelerationStructure* ias;
+            uint32_t level;
+        };
+        std::vector<DirtyBuildTask> dirtyBuildTasks;
+        size_t dirtyBuildScratchSize;
+
+        // JP: 処理中のフレームのスロット。各スロットはフレームの完了を示すイベントと遅延された解放を持つ。
+        // EN: Slots of frames in flight. Each slot has an event indicating the completion of the frame
+        //     and deferred releases.
+        struct FrameSlot {
+            CUevent finishEvent;
+            std::vector<std::pair<DeferredReleaseFunction, void*>> deferredReleases;
+        };
+        std::mutex frameMutex;
+        std::vector<FrameSlot> frameSlots;
+        uint64_t frameIndex;
+        uint64_t oldestFrameIndexInFlight;
+        bool frameIsOpen;
+
+        // JP: 全GAS/IASのコンパクション後のサイズを一つのデバイス配列に集め、
+        //     一回のコピーと一つのイベントでまとめて読み戻す。
+        // EN: Gather the sizes after compaction of all GASs/IASs into a single device array
+        //     and read them back together with a single copy and a single event.
+        // JP: 配列の拡張は排他ロック、ビルドによる書き込みアドレスの取得からエンキューまでは共有ロックで保護する。
+        // EN: Protect expanding the arrays with the exclusive lock,
+        //     and from taking the write address to enqueueing by a build with the shared lock.
+        std::shared_mutex compactedSizeStorageMutex;
+        std::mutex compactedSizeSlotMutex;
+        CUdeviceptr compactedSizesOnDevice;
+        size_t* compactedSizesOnHost;
+        uint32_t compactedSizeSlotCapacity;
+        uint32_t numCompactedSizeSlots;
+        std::vector<uint32_t> freeCompactedSizeSlots;
+        std::vector<CUstream> streamsForCompactedSizeReadback;
+        CUevent compactedSizeReadbackEvent;
+        uint64_t numCompactedSizeReadbacks;
+        uint32_t sbtLayoutGeneration;
+        uint64_t sbtLayoutRecordStamp;
+        // JP: シーンの準備状態が失われうる変更のたびに増える。ローンチ時の検証の省略に使う。
+        // EN: Incremented on every change that may lose the readiness of the scene. Used to skip validation at launch.
+        std::atomic<uint64_t> readinessEpoch;
+
+        // JP: しきい値より大きいマテリアルのユーザーデータはレコード外のテーブルに詰めて置き、
+        //     レコードにはそのアドレスのみを持たせる。
+        // EN: Pack user data of materials larger than the threshold into a table outside of records,
+        //     and let records hold only its address.
+        TaskExecutor taskExecutor;
+        void* taskExecutorData;
+
+        uint32_t materialDataThreshold;
+        std::vector<const _Material*> materialDataTableMaterials;
+        std::unordered_map<const _Material*, size_t> materialDataOffsets;
+        std::vector<uint8_t> materialDataTableOnHost;
+        CUdeviceptr materialDataTable;
+        size_t materialDataTableCapacity;
+
+        GeometryFlagInference geometryFlagInference;
+        std::vector<GeometryFlagSuggestion> geometryFlagSuggestions;
+
+        // JP: 共有モードでのヒットグループレコードのデータ部分。ヘッダー分の隙間を含めた元のレコードと
+        //     同じレイアウトでdataRecordSizeごとに並び、パイプラインのレコードはそのアドレスのみを持つ。
+        // EN: Data part of hit group records in the sharing mode. Laid out per dataRecordSize with the same layout
+        //     as the original records including the gap for the header, and records of pipelines hold only its address.
+        uint32_t dataRecordSize;
+        std::mutex sharedRecordDataMutex;
+        std::vector<uint8_t> sharedRecordDataOnHost;
+        CUdeviceptr sharedRecordDataTable;
+        size_t sharedRecordDataTableCapacity;
+        uint32_t sharedRecordDataGeneration;
+        uint64_t sharedRecordDataStamp;
+
+        std::atomic<bool> sbtLayoutIsUpToDate;
         struct {
-            unsigned int sbtLayoutIsUpToDate : 1;
+            unsigned int sbtRecordSharing : 1;
+            unsigned int recordDataSharing : 1;
+            unsigned int hasInferredGeometryFlags : 1;
         };
 
+        void updateSharedRecordData(CUstream stream, const _Pipeline* pipeline);
+
     public:
         OPTIXU_OPAQUE_BRIDGE(Scene);
 
         Priv(_Context* ctxt) : context(ctxt),
             nextGeomASSerialID(0),
             singleRecordSize(OPTIX_SBT_RECORD_HEADER_SIZE), numSBTRecords(0),
-            sbtLayoutIsUpToDate(false) {}
+            batchedGASMemoryRequirement{},
+            lazyBuildPoolOffset(0),
+            residencyBudget(0), residencyMinFramesToKeep(1), residencyStamp(0),
+            numEvictions(0), numRestorations(0),
+            batchedTransformSize(0), transformStagingBuffer(nullptr), transformStagingBufferSize(0),
+            dirtyBuildScratchSize(0),
+            frameIndex(0), oldestFrameIndexInFlight(0), frameIsOpen(false),
+            compactedSizesOnDevice(0), compactedSizesOnHost(nullptr),
+            compactedSizeSlotCapacity(0), numCompactedSizeSlots(0),
+            numCompactedSizeReadbacks(0),
+            sbtLayoutGeneration(0), sbtLayoutRecordStamp(0), readinessEpoch(0),
+            taskExecutor(nullptr), taskExecutorData(nullptr),
+            materialDataThreshold(0), materialDataTable(0), materialDataTableCapacity(0),
+            geometryFlagInference(GeometryFlagInference::Disabled),
+            dataRecordSize(OPTIX_SBT_RECORD_HEADER_SIZE),
+            sharedRecordDataTable(0), sharedRecordDataTableCapacity(0),
+            sharedRecordDataGeneration(0), sharedRecordDataStamp(0),
+            sbtLayoutIsUpToDate(false), sbtRecordSharing(false), recordDataSharing(false),
+            hasInferredGeometryFlags(false) {
+            CUDADRV_CHECK(cuEventCreate(&asBuildEvent, CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventCreate(&transformUploadEvent,
+                                        CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventCreate(&compactedSizeReadbackEvent,
+                                        CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+            setMaxFramesInFlight(2);
+            context->registerScene(this);
+        }
         ~Priv() {
+            context->unregisterScene(this);
+            // JP: デストラクターから例外を投げないように、待機の失敗は報告するだけに留める。
+            // EN: Only report a failure of waiting so as not to throw from the destructor.
+            try {
+                waitForAllFrames();
+            }
+            catch (const std::exception &e) {
+                devPrintf("Scene: %s\n", e.what());
+            }
+            for (FrameSlot &slot : frameSlots) {
+                for (const std::pair<DeferredReleaseFunction, void*> &release : slot.deferredReleases)
+                    release.first(release.second);
+                cuEventDestroy(slot.finishEvent);
+            }
+            if (sharedRecordDataTable)
+                cuMemFree(sharedRecordDataTable);
+            if (materialDataTable)
+                cuMemFree(materialDataTable);
+            if (compactedSizesOnHost)
+                cuMemFreeHost(compactedSizesOnHost);
+            if (compactedSizesOnDevice)
+                cuMemFree(compactedSizesOnDevice);
+            if (transformStagingBuffer)
+                cuMemFreeHost(transformStagingBuffer);
+            cuEventDestroy(transformUploadEvent);
+            cuEventDestroy(compactedSizeReadbackEvent);
+            cuEventDestroy(asBuildEvent);
+
             context->unregisterName(this);
         }
 
@@ -415,31 +1206,192 @@ namespace optixu {
 
 
 
+        uint32_t calcVisibilityMask(const std::vector<std::string> &categories);
+
+        uint32_t issueGASSerialID() {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            optixuAssert(geomASs.count(nextGeomASSerialID) == 0,
+                         "Too many GAS creation beyond expectation has been done.");
+            return nextGeomASSerialID++;
+        }
         void addGAS(_GeometryAccelerationStructure* gas);
         void removeGAS(_GeometryAccelerationStructure* gas);
         void addTransform(_Transform* tr) {
+            std::lock_guard<std::mutex> lock(registryMutex);
             transforms.insert(tr);
+            bumpReadinessEpoch();
         }
         void removeTransform(_Transform* tr) {
+            std::lock_guard<std::mutex> lock(registryMutex);
             transforms.erase(tr);
+            bumpReadinessEpoch();
+            auto it = std::find(transformsToBuild.cbegin(), transformsToBuild.cend(), tr);
+            if (it != transformsToBuild.cend()) {
+                transformOffsets.erase(transformOffsets.cbegin() + (it - transformsToBuild.cbegin()));
+                transformsToBuild.erase(it);
+            }
         }
         void addIAS(_InstanceAccelerationStructure* ias) {
+            std::lock_guard<std::mutex> lock(registryMutex);
             instASs.insert(ias);
+            bumpReadinessEpoch();
         }
         void removeIAS(_InstanceAccelerationStructure* ias) {
+            std::lock_guard<std::mutex> lock(registryMutex);
             instASs.erase(ias);
+            bumpReadinessEpoch();
+        }
+        void bumpReadinessEpoch() {
+            ++readinessEpoch;
+        }
+        // JP: 共有モードではisReady()自体がレイアウトを無効化しうるので検証を省略できない。
+        // EN: Validation cannot be skipped in the sharing mode since isReady() itself may invalidate the layout.
+        bool getReadinessEpoch(uint64_t* epoch) const {
+            *epoch = readinessEpoch;
+            return !sbtRecordSharing;
         }
 
         bool sbtLayoutGenerationDone() const {
             return sbtLayoutIsUpToDate;
         }
         void markSBTLayoutDirty();
+        void setSBTRecordSharing(bool enable) {
+            if (sbtRecordSharing != enable)
+                markSBTLayoutDirty();
+            sbtRecordSharing = enable;
+        }
+        void setRecordDataSharing(bool enable) {
+            if (recordDataSharing != enable)
+                markSBTLayoutDirty();
+            recordDataSharing = enable;
+        }
+        void setTaskExecutor(TaskExecutor executor, void* executorData) {
+            taskExecutor = executor;
+            taskExecutorData = executorData;
+        }
+        // JP: タスクをユーザーのエグゼキューターで(設定されていなければ逐次に)実行する。
+        //     タスク中で投げられた例外は全タスク完了後に呼び出し元で再送出する。
+        // EN: Run tasks with the user's executor (sequentially if not set).
+        //     An exception thrown in a task is rethrown in the caller after all the tasks complete.
+        template <typename Func>
+        void runTasks(uint32_t numTasks, const Func &func) {
+            if (!taskExecutor || numTasks < 2) {
+                for (uint32_t i = 0; i < numTasks; ++i)
+                    func(i);
+                return;
+            }
+
+            struct TaskData {
+                const Func* func;
+                std::exception_ptr exception;
+                std::mutex exceptionMutex;
+            };
+            TaskData taskData;
+            taskData.func = &func;
+            taskExecutor(taskExecutorData, numTasks, [](void* data, uint32_t taskIndex) {
+                auto &td = *reinterpret_cast<TaskData*>(data);
+                try {
+                    (*td.func)(taskIndex);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(td.exceptionMutex);
+                    if (!td.exception)
+                        td.exception = std::current_exception();
+                }
+            }, &taskData);
+            if (taskData.exception)
+                std::rethrow_exception(taskData.exception);
+        }
+        void generateSBTLayout();
+        void inferGeometryFlags();
+        void setGeometryFlagInference(GeometryFlagInference mode) {
+            if (geometryFlagInference != mode)
+                markSBTLayoutDirty();
+            geometryFlagInference = mode;
+        }
+        GeometryFlagInference getGeometryFlagInference() const {
+            return geometryFlagInference;
+        }
+        void setMaterialDataThreshold(uint32_t threshold) {
+            throwRuntimeError(threshold == 0 || threshold >= sizeof(CUdeviceptr),
+                              "Threshold must be 0 or at least %u bytes.", static_cast<uint32_t>(sizeof(CUdeviceptr)));
+            if (materialDataThreshold != threshold)
+                markSBTLayoutDirty();
+            materialDataThreshold = threshold;
+        }
+        bool isMaterialDataOutOfRecord(const _Material* mat) const {
+            return materialDataThreshold > 0 && mat->getUserDataSizeAlign().size > materialDataThreshold;
+        }
+        SizeAlign getMaterialRecordSizeAlign(const _Material* mat) const {
+            if (isMaterialDataOutOfRecord(mat))
+                return SizeAlign(sizeof(CUdeviceptr), alignof(CUdeviceptr));
+            return mat->getUserDataSizeAlign();
+        }
+        CUdeviceptr getOutOfRecordMaterialData(const _Material* mat) const {
+            if (!isMaterialDataOutOfRecord(mat))
+                return 0;
+            return materialDataTable + materialDataOffsets.at(mat);
+        }
+        size_t getMaterialDataTableSize() const {
+            return materialDataTableOnHost.size();
+        }
         uint32_t getSBTOffset(_GeometryAccelerationStructure* gas, uint32_t matSetIdx);
 
         uint32_t getSingleRecordSize() const {
             return singleRecordSize;
         }
+        // JP: レコードを埋める際のストライド。共有モード以外ではgetSingleRecordSize()と同じ。
+        // EN: Stride for filling records. Same as getSingleRecordSize() except in the sharing mode.
+        uint32_t getDataRecordSize() const {
+            return dataRecordSize;
+        }
+        uint32_t getNumSBTRecords() const {
+            return numSBTRecords;
+        }
+        uint32_t getSBTLayoutGeneration() const {
+            return sbtLayoutGeneration;
+        }
+        void collectMaterials(std::vector<const _Material*>* mats) const;
         void setupHitGroupSBT(CUstream stream, const _Pipeline* pipeline, const BufferView &sbt, void* hostMem);
+        void updateHitGroupSBT(CUstream stream, const _Pipeline* pipeline, const BufferView &sbt, void* hostMem,
+                               uint64_t lastStamp);
+
+        uint32_t allocateCompactedSizeSlot();
+        void releaseCompactedSizeSlot(uint32_t slot);
+        // JP: 返ったロックを保持している間はgetCompactedSizeAddress()のアドレスが有効。
+        // EN: The address from getCompactedSizeAddress() is valid while holding the returned lock.
+        std::shared_lock<std::shared_mutex> lockCompactedSizeStorage() {
+            return std::shared_lock<std::shared_mutex>(compactedSizeStorageMutex);
+        }
+        CUdeviceptr getCompactedSizeAddress(uint32_t slot) const {
+            return compactedSizesOnDevice + sizeof(size_t) * slot;
+        }
+        uint64_t requestCompactedSizeReadback(CUstream stream);
+        bool readCompactedSize(uint32_t slot, uint64_t readbackIndex, bool wait, size_t* size);
+
+        void setLazyBuildMemory(const BufferView &accelPool, const BufferView &scratchBuffer);
+        void buildLazyGAS(CUstream stream, _GeometryAccelerationStructure* gas);
+
+        // JP: IASのリビルド前に子のGASを参照済みとし、予算内に収まるよう退避してから退避済みのものを復帰する。
+        // EN: Mark child GASs as referenced before an IAS rebuild,
+        //     evict to fit within the budget, then restore evicted ones.
+        void prepareResidency(CUstream stream, const std::vector<_Instance*> &instances);
+        void enforceResidencyBudget(CUstream stream, size_t additionalSize);
+        void getResidencyStatistics(GASResidencyStatistics* stats) const;
+        void deferDeviceMemoryRelease(CUdeviceptr memory);
+
+        void collectDirtyBuildTasks();
+
+        // JP: 遅延された解放はロックを解放してから実行し、解放関数からのdeferRelease()を許す。
+        // EN: Deferred releases are executed after releasing the lock to allow deferRelease() from release functions.
+        void retireFrames(bool wait, uint64_t untilFrameIndex,
+                          std::vector<std::pair<DeferredReleaseFunction, void*>>* releases);
+        void setMaxFramesInFlight(uint32_t maxFramesInFlight);
+        void beginFrame(uint32_t* frameSlot);
+        void endFrame(CUstream stream);
+        void deferRelease(DeferredReleaseFunction func, void* userData);
+        void waitForAllFrames();
+        void joinWorkerStreams(const CUstream* workerStreams, uint32_t numWorkerStreams);
 
         bool isReady(bool* hasMotionAS);
     };
@@ -449,7 +1401,7 @@ namespace optixu {
     class GeometryInstance::Priv {
         _Scene* scene;
         SizeAlign userDataSizeAlign;
-        std::vector<uint8_t> userData;
+        SmallByteBuffer userData;
 
         struct TriangleGeometry {
             CUdeviceptr* vertexBufferArray;
@@ -482,18 +1434,25 @@ namespace optixu {
         uint32_t numMotionSteps;
         uint32_t primitiveIndexOffset;
         std::vector<OptixGeometryFlags> buildInputFlags; // per SBT record
+        // JP: OPTIX_GEOMETRY_FLAG_DISABLE_ANYHITが推定によって設定されたか。
+        // EN: Whether OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT has been set by the inference.
+        std::vector<uint8_t> anyHitDisabledByInference; // per SBT record
 
         std::vector<std::vector<_Material*>> materials;
+        uint64_t sbtRecordStamp;
 
     public:
         OPTIXU_OPAQUE_BRIDGE(GeometryInstance);
+        OPTIXU_POOLED_ALLOCATION(GeometryInstance);
 
         Priv(_Scene* _scene, GeometryType _geomType) :
             scene(_scene),
             userData(),
             geomType(_geomType),
-            primitiveIndexOffset(0) {
+            primitiveIndexOffset(0),
+            sbtRecordStamp(0) {
             buildInputFlags.resize(1, OPTIX_GEOMETRY_FLAG_NONE);
+            anyHitDisabledByInference.resize(1, false);
             materials.resize(1);
             materials[0].resize(1, nullptr);
 
@@ -576,20 +1535,76 @@ namespace optixu {
 
 
 
+        void retargetBuffer(BufferView* dstBuffer, const BufferView &srcBuffer, const char* bufferName);
+
         GeometryType getGeometryType() const {
             return geomType;
         }
         uint32_t getNumMotionSteps() const {
             return numMotionSteps;
         }
+        uint32_t getNumMaterials() const {
+            return static_cast<uint32_t>(materials.size());
+        }
+        // JP: SBTレコードの書き込みと同じく、マテリアルセットに無い場合は既定のマテリアルを返す。
+        // EN: Return the default material if absent in the material set, same as writing SBT records.
+        const _Material* getMaterial(uint32_t matSetIdx, uint32_t matIdx) const {
+            const std::vector<_Material*> &matSets = materials[matIdx];
+            const _Material* mat = matSetIdx < matSets.size() ? matSets[matSetIdx] : nullptr;
+            return mat ? mat : matSets[0];
+        }
+        bool isAnyHitFlagExplicit(uint32_t matIdx) const {
+            return !anyHitDisabledByInference[matIdx] &&
+                (buildInputFlags[matIdx] & OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
+        }
+        bool isAnyHitDisabledByInference(uint32_t matIdx) const {
+            return anyHitDisabledByInference[matIdx];
+        }
+        // JP: 推定によるフラグを設定または解除し、ビルド入力が変わった場合にtrueを返す。
+        // EN: Set or clear the flag by the inference, and return true if the build input changes.
+        bool setAnyHitDisabledByInference(uint32_t matIdx, bool disable) {
+            if (static_cast<bool>(anyHitDisabledByInference[matIdx]) == disable)
+                return false;
+            anyHitDisabledByInference[matIdx] = disable;
+            if (disable)
+                buildInputFlags[matIdx] |= OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+            else
+                buildInputFlags[matIdx] &= ~OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+            return true;
+        }
+        uint64_t calcContentHash() const;
+        // JP: 最初のモーションステップの各プリミティブのAABBを読み戻し、全体のAABBと表面積の和に加える。
+        // EN: Read back the AABB of each primitive at the first motion step,
+        //     then add them to the whole AABB and the sum of surface areas.
+        void accumulatePrimitiveBounds(const float* preTransform,
+                                       OptixAabb* bounds, double* sumSurfaceArea, uint32_t* numPrimitives) const;
         void fillBuildInput(OptixBuildInput* input, CUdeviceptr preTransform) const;
         void updateBuildInput(OptixBuildInput* input, CUdeviceptr preTransform) const;
-
+        void prefetchManagedInputs(CUstream stream, CUdevice device) const;
+
+        void markSBTRecordDirty() {
+            sbtRecordStamp = getContext()->issueSBTRecordStamp();
+        }
+        uint64_t getSBTRecordStamp() const;
+        uint64_t getHeaderStamp() const;
+        uint64_t calcSBTRecordContentHash(uint32_t gasMatSetIdx) const;
+        void collectMaterials(std::vector<const _Material*>* mats) const {
+            for (const std::vector<_Material*> &matSets : materials) {
+                for (const _Material* mat : matSets) {
+                    if (mat)
+                        mats->push_back(mat);
+                }
+            }
+        }
         void calcSBTRequirements(uint32_t gasMatSetIdx, SizeAlign* maxRecordSizeAlign, uint32_t* numSBTRecords) const;
         uint32_t fillSBTRecords(const _Pipeline* pipeline, uint32_t gasMatSetIdx,
                                 const void* gasChildUserData, const SizeAlign gasChildUserDataSizeAlign,
                                 const void* gasUserData, const SizeAlign gasUserDataSizeAlign,
-                                uint32_t numRayTypes, uint8_t* records) const;
+                                const uint32_t* rayTypes, uint32_t numRayTypes, uint8_t* records) const;
+        uint32_t patchSBTRecordHeaders(const _Pipeline* pipeline, uint32_t gasMatSetIdx,
+                                       const uint32_t* rayTypes, uint32_t numRayTypes,
+                                       uint64_t lastStamp, bool allHeaders,
+                                       uint8_t* records, std::vector<uint8_t*>* patchedRecords) const;
     };
 
 
@@ -599,32 +1614,71 @@ namespace optixu {
             _GeometryInstance* geomInst;
             CUdeviceptr preTransform;
             SizeAlign userDataSizeAlign;
-            std::vector<uint8_t> userData;
+            SmallByteBuffer userData;
 
             bool operator==(const Child &rChild) const {
                 return geomInst == rChild.geomInst && preTransform == rChild.preTransform;
             }
         };
+        struct ChildKey {
+            const _GeometryInstance* geomInst;
+            CUdeviceptr preTransform;
+
+            struct Hash {
+                typedef std::size_t result_type;
+
+                std::size_t operator()(const ChildKey& key) const {
+                    size_t seed = 0;
+                    auto hash0 = std::hash<const _GeometryInstance*>()(key.geomInst);
+                    auto hash1 = std::hash<CUdeviceptr>()(key.preTransform);
+                    seed ^= hash0 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+                    seed ^= hash1 + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+                    return seed;
+                }
+            };
+            bool operator==(const ChildKey &rKey) const {
+                return geomInst == rKey.geomInst && preTransform == rKey.preTransform;
+            }
+        };
 
         _Scene* scene;
         uint32_t serialID;
         GeometryType geomType;
         SizeAlign userDataSizeAlign;
-        std::vector<uint8_t> userData;
+        SmallByteBuffer userData;
 
         std::vector<uint32_t> numRayTypesPerMaterialSet;
+        // JP: 一様なレイタイプのマテリアル(一様でないレイタイプはnullptr)。
+        // EN: Materials of uniform ray types (nullptr for non-uniform ray types).
+        std::vector<std::vector<const _Material*>> uniformRayTypeMaterials;
 
         std::vector<Child> children;
+        std::unordered_map<ChildKey, uint32_t, ChildKey::Hash> childIndices;
         std::vector<OptixBuildInput> buildInputs;
 
         OptixAccelBuildOptions buildOptions;
         OptixAccelBufferSizes memoryRequirement;
 
         CUevent finishEvent;
-        CUdeviceptr compactedSizeOnDevice;
+        uint32_t compactedSizeSlot;
+        uint64_t compactedSizeReadbackIndex;
         size_t compactedSize;
         OptixAccelEmitDesc propertyCompactedSize;
 
+        AutoRebuildPolicy autoRebuildPolicy;
+        ASStatisticsRecorder statsRecorder;
+        uint64_t sbtRecordStamp;
+
+        // JP: 退避したASのピン留めされたホストメモリー上のコピー。内容が変わるまでは次の退避でも再利用する。
+        //     ownedAccelMemoryは復帰時にoptixuが確保したバッファー。
+        // EN: Copy of the evicted AS on pinned host memory. This is reused at the next eviction until the contents change.
+        //     ownedAccelMemory is the buffer allocated by optixu at restoration.
+        uint8_t* evictedData;
+        OptixAccelRelocationInfo evictedRelocationInfo;
+        CUdeviceptr ownedAccelMemory;
+        uint64_t lastReferencedFrameIndex;
+        uint64_t lastReferencedStamp;
+
         OptixTraversableHandle handle;
         OptixTraversableHandle compactedHandle;
         BufferView accelBuffer;
@@ -634,41 +1688,56 @@ namespace optixu {
             unsigned int allowUpdate : 1;
             unsigned int allowCompaction : 1;
             unsigned int allowRandomVertexAccess : 1;
+            unsigned int lazyBuild : 1;
+            unsigned int prefetchManagedInputs : 1;
             unsigned int readyToBuild : 1;
             unsigned int available : 1;
             unsigned int readyToCompact : 1;
             unsigned int compactedAvailable : 1;
+            unsigned int attachedShared : 1;
+            unsigned int evictable : 1;
+            unsigned int evicted : 1;
+            unsigned int evictedDataIsValid : 1;
         };
 
     public:
         OPTIXU_OPAQUE_BRIDGE(GeometryAccelerationStructure);
+        OPTIXU_POOLED_ALLOCATION(GeometryAccelerationStructure);
 
         Priv(_Scene* _scene, uint32_t _serialID, GeometryType _geomType) :
             scene(_scene),
             serialID(_serialID),
             geomType(_geomType),
             userData(sizeof(uint32_t)),
+            sbtRecordStamp(0),
+            evictedData(nullptr), evictedRelocationInfo{}, ownedAccelMemory(0),
+            lastReferencedFrameIndex(0), lastReferencedStamp(0),
             handle(0), compactedHandle(0),
             tradeoff(ASTradeoff::Default),
             allowUpdate(false), allowCompaction(false), allowRandomVertexAccess(false),
+            lazyBuild(false), prefetchManagedInputs(false),
             readyToBuild(false), available(false), 
-            readyToCompact(false), compactedAvailable(false) {
+            readyToCompact(false), compactedAvailable(false), attachedShared(false),
+            evictable(false), evicted(false), evictedDataIsValid(false) {
             scene->addGAS(this);
 
             numRayTypesPerMaterialSet.resize(1, 0);
+            uniformRayTypeMaterials.resize(1);
 
             buildOptions = {};
 
             CUDADRV_CHECK(cuEventCreate(&finishEvent,
                                         CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
-            CUDADRV_CHECK(cuMemAlloc(&compactedSizeOnDevice, sizeof(size_t)));
+            compactedSizeSlot = scene->allocateCompactedSizeSlot();
+            compactedSizeReadbackIndex = 0;
 
             propertyCompactedSize = OptixAccelEmitDesc{};
             propertyCompactedSize.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
-            propertyCompactedSize.result = compactedSizeOnDevice;
+            propertyCompactedSize.result = 0;
         }
         ~Priv() {
-            cuMemFree(compactedSizeOnDevice);
+            releaseResidencyStorage();
+            scene->releaseCompactedSizeSlot(compactedSizeSlot);
             cuEventDestroy(finishEvent);
 
             scene->removeGAS(this);
@@ -702,14 +1771,103 @@ namespace optixu {
 
         void calcSBTRequirements(uint32_t matSetIdx, SizeAlign* maxRecordSizeAlign, uint32_t* numSBTRecords) const;
         uint32_t fillSBTRecords(const _Pipeline* pipeline, uint32_t matSetIdx, uint8_t* records) const;
+        void patchSBTRecordHeaders(const _Pipeline* pipeline, uint32_t matSetIdx, uint64_t lastStamp, bool allHeaders,
+                                   uint8_t* records, std::vector<uint8_t*>* patchedRecords) const;
+        void markSBTRecordDirty() {
+            sbtRecordStamp = getContext()->issueSBTRecordStamp();
+        }
+        uint64_t getSBTRecordStamp() const;
+        uint64_t getHeaderStamp() const;
+        uint64_t calcSBTRecordContentHash(uint32_t matSetIdx) const;
+        void collectMaterials(std::vector<const _Material*>* mats) const {
+            for (const std::vector<const _Material*> &matSet : uniformRayTypeMaterials) {
+                for (const _Material* mat : matSet) {
+                    if (mat)
+                        mats->push_back(mat);
+                }
+            }
+            for (const Child &child : children)
+                child.geomInst->collectMaterials(mats);
+        }
         bool hasMotion() const {
             return buildOptions.motionOptions.numKeys >= 2;
         }
+        // JP: 子のマテリアルスロットごとに、このGASのいずれかのマテリアルセットとレイタイプで
+        //     エニーヒットが呼ばれうるかを集計する。
+        // EN: Accumulate for each material slot of children whether any-hit may be invoked
+        //     for any material set and ray type of this GAS.
+        void accumulateAnyHitUsage(std::vector<_GeometryInstance*>* geomInsts,
+                                   std::unordered_map<_GeometryInstance*, std::vector<uint8_t>>* usage) const;
+        bool hasChild(const _GeometryInstance* geomInst) const {
+            for (const Child &child : children) {
+                if (child.geomInst == geomInst)
+                    return true;
+            }
+            return false;
+        }
 
         void markDirty();
+        void prefetchChildInputs(CUstream stream) const;
+        bool readCompactedSize(bool wait);
+        uint64_t calcBuildInputHash() const;
+        float estimateTraversalCost(OptixAabb* bounds) const;
+        uint64_t calcContentHash(std::unordered_map<const _GeometryInstance*, uint64_t>* geomInstHashes) const;
+        uint32_t getNumChildren() const {
+            return static_cast<uint32_t>(children.size());
+        }
+        void getStatistics(ASStatistics* stats);
+        bool isReadyToBuild() const {
+            return readyToBuild;
+        }
+        bool isLazyBuild() const {
+            return lazyBuild;
+        }
+
+        bool isEvictable() const {
+            return evictable;
+        }
+        bool isEvicted() const {
+            return evicted;
+        }
+        bool isEvictionCandidate() const {
+            return evictable && !evicted && compactedAvailable && !available &&
+                !attachedShared && !lazyBuild && !children.empty();
+        }
+        size_t getCompactedSize() const {
+            return compactedSize;
+        }
+        void touchResidency(uint64_t frameIndex, uint64_t stamp) {
+            lastReferencedFrameIndex = frameIndex;
+            lastReferencedStamp = stamp;
+        }
+        uint64_t getLastReferencedFrameIndex() const {
+            return lastReferencedFrameIndex;
+        }
+        uint64_t getLastReferencedStamp() const {
+            return lastReferencedStamp;
+        }
+        void invalidateEvictedData() {
+            evictedDataIsValid = false;
+        }
+        void evict(CUstream stream);
+        void restore(CUstream stream);
+        // JP: 退避用のホストメモリーと復帰時に確保したバッファーを解放し、退避状態を解除する。
+        // EN: Release the host memory for eviction and the buffer allocated at restoration, and clear the evicted state.
+        void releaseResidencyStorage();
+
+        const OptixAccelBufferSizes &getMemoryRequirement() const {
+            return memoryRequirement;
+        }
+        const BufferView &getAccelBuffer() const {
+            return accelBuffer;
+        }
         bool isReady() const {
             return available || compactedAvailable;
         }
+        size_t getResidentSize() const {
+            return (available ? memoryRequirement.outputSizeInBytes : 0) +
+                (compactedAvailable ? compactedSize : 0);
+        }
 
         OptixTraversableHandle getHandle() const {
             throwRuntimeError(isReady(), "Traversable handle is not ready.");
@@ -738,12 +1896,14 @@ namespace optixu {
         OptixMotionOptions options;
 
         OptixTraversableHandle handle;
+        BufferView deviceBuffer;
         struct {
             unsigned int available : 1;
         };
 
     public:
         OPTIXU_OPAQUE_BRIDGE(Transform);
+        OPTIXU_POOLED_ALLOCATION(Transform);
 
         Priv(_Scene* _scene) :
             scene(_scene),
@@ -780,6 +1940,38 @@ namespace optixu {
 
 
         _GeometryAccelerationStructure* getDescendantGAS() const;
+        size_t getDataSize() const {
+            return dataSize;
+        }
+        OptixTraversableType getTraversableType() const;
+        void fillData(uint8_t* dst) const;
+        void setHandle(OptixTraversableHandle _handle) {
+            handle = _handle;
+            available = true;
+        }
+        // JP: 最後にアップロードしたデバイスメモリ。Scene::buildDirty()はここへ再アップロードする。
+        // EN: The device memory uploaded last. Scene::buildDirty() re-uploads to this.
+        void setDeviceBuffer(const BufferView &buffer) {
+            deviceBuffer = buffer;
+        }
+        const BufferView &getDeviceBuffer() const {
+            return deviceBuffer;
+        }
+        _GeometryAccelerationStructure* getChildGAS() const {
+            if (std::holds_alternative<_GeometryAccelerationStructure*>(child))
+                return std::get<_GeometryAccelerationStructure*>(child);
+            return nullptr;
+        }
+        _InstanceAccelerationStructure* getChildIAS() const {
+            if (std::holds_alternative<_InstanceAccelerationStructure*>(child))
+                return std::get<_InstanceAccelerationStructure*>(child);
+            return nullptr;
+        }
+        _Transform* getChildTransform() const {
+            if (std::holds_alternative<_Transform*>(child))
+                return std::get<_Transform*>(child);
+            return nullptr;
+        }
 
         void markDirty();
         bool isReady() const {
@@ -807,12 +1999,14 @@ namespace optixu {
         uint32_t visibilityMask;
         OptixInstanceFlags flags;
         float instTransform[12];
+        uint32_t revision;
 
     public:
         OPTIXU_OPAQUE_BRIDGE(Instance);
+        OPTIXU_POOLED_ALLOCATION(Instance);
 
         Priv(_Scene* _scene) :
-            scene(_scene) {
+            scene(_scene), revision(0) {
             matSetIndex = 0xFFFFFFFF;
             id = 0;
             visibilityMask = 0xFF;
@@ -839,8 +2033,57 @@ namespace optixu {
 
 
 
-        void fillInstance(OptixInstance* instance) const;
-        void updateInstance(OptixInstance* instance) const;
+        // JP: インスタンスのパラメターが変更されるたびに増加する。
+        //     IASはこれを見て変更されたインスタンスのみをアップロードする。
+        // EN: This increases every time the instance's parameters are changed.
+        //     An IAS uploads only the changed instances by looking at this.
+        void markDirty() {
+            ++revision;
+        }
+        uint32_t getRevision() const {
+            return revision;
+        }
+        _GeometryAccelerationStructure* getChildGAS() const {
+            if (std::holds_alternative<_GeometryAccelerationStructure*>(child))
+                return std::get<_GeometryAccelerationStructure*>(child);
+            return nullptr;
+        }
+        _InstanceAccelerationStructure* getChildIAS() const {
+            if (std::holds_alternative<_InstanceAccelerationStructure*>(child))
+                return std::get<_InstanceAccelerationStructure*>(child);
+            return nullptr;
+        }
+        _Transform* getChildTransform() const {
+            if (std::holds_alternative<_Transform*>(child))
+                return std::get<_Transform*>(child);
+            return nullptr;
+        }
+        uint32_t getMaterialSetIndex() const {
+            return matSetIndex;
+        }
+        const float* getTransform() const {
+            return instTransform;
+        }
+
+        // JP: 連続するインスタンスが同じ子とマテリアルセットを参照する場合に、
+        //     子のハンドルとSBTオフセットの解決(SBTレイアウトの二分探索等)を省くためのキャッシュ。
+        // EN: Cache to skip resolving the handle and the SBT offset of the child (binary search in the SBT layout, etc.)
+        //     when consecutive instances refer to the same child and material set.
+        struct ChildResolveCache {
+            const void* child;
+            uint32_t matSetIndex;
+            OptixTraversableHandle handle;
+            uint32_t sbtOffset;
+
+            ChildResolveCache() :
+                child(nullptr), matSetIndex(0xFFFFFFFF), handle(0), sbtOffset(0) {}
+        };
+        // JP: Scene::createInstances()で検証済みの設定を適用する。
+        // EN: Apply settings validated by Scene::createInstances().
+        void applyDesc(const InstanceDesc &desc);
+        void resolveChild(OptixTraversableHandle* handle, uint32_t* sbtOffset, ChildResolveCache* cache) const;
+        void fillInstance(OptixInstance* instance, ChildResolveCache* cache = nullptr) const;
+        void updateInstance(OptixInstance* instance, ChildResolveCache* cache = nullptr) const;
         bool isMotionAS() const;
         bool isTransform() const;
     };
@@ -851,17 +2094,27 @@ namespace optixu {
         _Scene* scene;
 
         std::vector<_Instance*> children;
+        std::unordered_map<const _Instance*, uint32_t> childIndices;
         OptixBuildInput buildInput;
         std::vector<OptixInstance> instances;
+        std::vector<uint32_t> uploadedRevisions;
+        std::vector<uint8_t> instanceChangedFlags;
+        uint32_t numDeviceInstances;
+        CUdeviceptr deviceInstanceCount;
+        uint32_t* deviceInstanceCountOnHost;
 
         OptixAccelBuildOptions buildOptions;
         OptixAccelBufferSizes memoryRequirement;
 
         CUevent finishEvent;
-        CUdeviceptr compactedSizeOnDevice;
+        uint32_t compactedSizeSlot;
+        uint64_t compactedSizeReadbackIndex;
         size_t compactedSize;
         OptixAccelEmitDesc propertyCompactedSize;
 
+        AutoRebuildPolicy autoRebuildPolicy;
+        ASStatisticsRecorder statsRecorder;
+
         OptixTraversableHandle handle;
         OptixTraversableHandle compactedHandle;
         BufferView instanceBuffer;
@@ -876,10 +2129,13 @@ namespace optixu {
             unsigned int available : 1;
             unsigned int readyToCompact : 1;
             unsigned int compactedAvailable : 1;
+            unsigned int instancesUploaded : 1;
+            unsigned int useDeviceInstances : 1;
         };
 
     public:
         OPTIXU_OPAQUE_BRIDGE(InstanceAccelerationStructure);
+        OPTIXU_POOLED_ALLOCATION(InstanceAccelerationStructure);
 
         Priv(_Scene* _scene) :
             scene(_scene),
@@ -887,21 +2143,28 @@ namespace optixu {
             tradeoff(ASTradeoff::Default),
             allowUpdate(false), allowCompaction(false), allowRandomInstanceAccess(false),
             readyToBuild(false), available(false),
-            readyToCompact(false), compactedAvailable(false) {
+            readyToCompact(false), compactedAvailable(false),
+            instancesUploaded(false), useDeviceInstances(false) {
+            numDeviceInstances = 0;
+            deviceInstanceCount = 0;
+            deviceInstanceCountOnHost = nullptr;
             scene->addIAS(this);
 
             buildOptions = {};
 
             CUDADRV_CHECK(cuEventCreate(&finishEvent,
                                         CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
-            CUDADRV_CHECK(cuMemAlloc(&compactedSizeOnDevice, sizeof(size_t)));
+            compactedSizeSlot = scene->allocateCompactedSizeSlot();
+            compactedSizeReadbackIndex = 0;
 
             std::memset(&propertyCompactedSize, 0, sizeof(propertyCompactedSize));
             propertyCompactedSize.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
-            propertyCompactedSize.result = compactedSizeOnDevice;
+            propertyCompactedSize.result = 0;
         }
         ~Priv() {
-            cuMemFree(compactedSizeOnDevice);
+            if (deviceInstanceCountOnHost)
+                cuMemFreeHost(deviceInstanceCountOnHost);
+            scene->releaseCompactedSizeSlot(compactedSizeSlot);
             cuEventDestroy(finishEvent);
 
             scene->removeIAS(this);
@@ -925,13 +2188,61 @@ namespace optixu {
         bool hasMotion() const {
             return buildOptions.motionOptions.numKeys >= 2;
         }
+        uint32_t getNumInstances() const {
+            return useDeviceInstances ? numDeviceInstances : static_cast<uint32_t>(children.size());
+        }
+        const std::vector<_Instance*> &getChildren() const {
+            return children;
+        }
+
 
 
+        // JP: インスタンス充填を分割する単位。チャンクごとにシーンのタスクエグゼキューターで並列に処理する。
+        // EN: Unit to split instance filling. Each chunk is processed in parallel by the scene's task executor.
+        static constexpr uint32_t instanceFillChunkSize = 4096;
+        template <typename Func>
+        void runInstanceChunks(const Func &func) const {
+            uint32_t numInstances = static_cast<uint32_t>(children.size());
+            uint32_t numChunks = (numInstances + instanceFillChunkSize - 1) / instanceFillChunkSize;
+            scene->runTasks(numChunks, [&](uint32_t chunkIdx) {
+                uint32_t beginIdx = chunkIdx * instanceFillChunkSize;
+                uint32_t endIdx = std::min(beginIdx + instanceFillChunkSize, numInstances);
+                func(beginIdx, endIdx);
+            });
+        }
 
         void markDirty(bool readyToBuild);
+        bool readCompactedSize(bool wait);
+        void uploadInstances(CUstream stream, const BufferView &instBuffer, bool forRebuild);
+        void getStatistics(ASStatistics* stats);
+        float estimateTraversalCost(OptixAabb* bounds) const;
+        bool hasPendingInstanceChanges() const;
+        bool childHandlesChanged() const;
+        bool usesDeviceInstances() const {
+            return useDeviceInstances;
+        }
+        bool allowsUpdate() const {
+            return (buildOptions.buildFlags & OPTIX_BUILD_FLAG_ALLOW_UPDATE) != 0;
+        }
+        bool isReadyToBuild() const {
+            return readyToBuild;
+        }
+        const OptixAccelBufferSizes &getMemoryRequirement() const {
+            return memoryRequirement;
+        }
+        const BufferView &getInstanceBuffer() const {
+            return instanceBuffer;
+        }
+        const BufferView &getAccelBuffer() const {
+            return accelBuffer;
+        }
         bool isReady() const {
             return available || compactedAvailable;
         }
+        size_t getResidentSize() const {
+            return (available ? memoryRequirement.outputSizeInBytes : 0) +
+                (compactedAvailable ? compactedSize : 0);
+        }
 
         OptixTraversableHandle getHandle() const {
             throwRuntimeError(isReady(), "Traversable handle is not ready.");
@@ -953,6 +2264,14 @@ namespace optixu {
         OptixPipelineCompileOptions pipelineCompileOptions;
         size_t sizeOfPipelineLaunchParams;
         std::unordered_set<OptixProgramGroup> programGroups;
+        std::unordered_set<_ProgramGroup*> registeredPrograms;
+        // JP: 遅延ヒットグループを生成した際の再リンクに使う。
+        // EN: Used to re-link when deferred hit groups are materialized.
+        OptixPipelineLinkOptions linkOptions;
+        // JP: 到達不能として最後のリンクから除外されたプログラムグループ。
+        // EN: Program groups excluded from the last link as unreachable.
+        std::vector<_ProgramGroup*> prunedPrograms;
+        std::unordered_set<OptixProgramGroup> linkedProgramGroups;
 
         _Scene* scene;
         uint32_t numMissRayTypes;
@@ -964,19 +2283,82 @@ namespace optixu {
         _ProgramGroup* exceptionProgram;
         std::vector<_ProgramGroup*> missPrograms;
         std::vector<_ProgramGroup*> callablePrograms;
+        _CallableProgramTable* callableTable;
+        // JP: レイ生成とミスのレコードのヘッダー直後に置くユーザーデータ。
+        // EN: User data placed right after the headers of the ray generation and miss records.
+        SizeAlign rayGenUserDataSizeAlign;
+        SmallByteBuffer rayGenUserData;
+        std::vector<SizeAlign> missUserDataSizeAligns;
+        std::vector<SmallByteBuffer> missUserData;
+        // JP: マテリアルがヒットグループを持たないレイタイプで使われるヒットグループ。
+        // EN: Hit groups used for ray types for which a material doesn't have a hit group.
+        std::vector<_ProgramGroup*> defaultHitGroups;
+        uint32_t defaultHitGroupRevision;
+        _Module* visibilityModule;
+        _ProgramGroup* visibilityMissProgram;
+        _ProgramGroup* visibilityHitGroup;
         BufferView sbt;
         void* sbtHostMem;
         BufferView hitGroupSbt;
         void* hitGroupSbtHostMem;
+        uint64_t hitGroupSbtStamp;
+        uint32_t hitGroupSbtLayoutGeneration;
         OptixShaderBindingTable sbtParams;
 
+        // JP: パイプラインが所有する多重バッファリングされたヒットグループSBT。
+        //     ローンチごとに順番に使い、イベントでGPUが使い終わるのを待ってから書き換える。
+        // EN: Multi-buffered hit group SBTs owned by the pipeline.
+        //     Use them in turn for each launch and rewrite one after waiting with an event for the GPU to finish it.
+        struct OwnedHitGroupSBT {
+            CUdeviceptr buffer;
+            void* hostMem;
+            size_t size;
+            CUevent fence;
+            uint64_t stamp;
+            uint32_t layoutGeneration;
+            bool isUpToDate;
+        };
+        std::vector<OwnedHitGroupSBT> ownedHitGroupSbts;
+        uint32_t curOwnedHitGroupSbtIndex;
+
+        mutable PinnedStagingRing stagingRing;
+
+        // JP: バックグラウンドでリンク中のパイプライン。
+        // EN: Pipeline being linked in the background.
+        std::future<OptixPipeline> pendingRawPipeline;
+
         struct {
             unsigned int pipelineLinked : 1;
+            unsigned int pipelineLinking : 1;
             unsigned int sbtLayoutIsUpToDate : 1;
             unsigned int sbtIsUpToDate : 1;
             unsigned int hitGroupSbtIsUpToDate : 1;
+            unsigned int usePinnedStaging : 1;
+            unsigned int pruneUnreachablePrograms : 1;
         };
 
+        // JP: 最後にローンチ時の検証に成功したシーンとその準備状態のエポック。
+        // EN: Scene and its readiness epoch for which the launch validation last succeeded.
+        const _Scene* validatedScene;
+        uint64_t validatedSceneEpoch;
+
+        uint32_t calcRayGenRecordSize() const {
+            SizeAlign sizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+            sizeAlign += rayGenUserDataSizeAlign;
+            return sizeAlign.alignUp().size;
+        }
+        // JP: ミスレコードのストライドはすべてのレイタイプのユーザーデータの最大値で決まる。
+        // EN: The stride of miss records is determined by the maximum of user data over all ray types.
+        uint32_t calcMissRecordStride() const {
+            SizeAlign maxSizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+            for (const SizeAlign &userDataSizeAlign : missUserDataSizeAligns) {
+                SizeAlign sizeAlign(OPTIX_SBT_RECORD_HEADER_SIZE, OPTIX_SBT_RECORD_ALIGNMENT);
+                sizeAlign += userDataSizeAlign;
+                maxSizeAlign = max(maxSizeAlign, sizeAlign);
+            }
+            return maxSizeAlign.alignUp().size;
+        }
+
         void setupShaderBindingTable(CUstream stream);
 
     public:
@@ -986,9 +2368,16 @@ namespace optixu {
             context(ctxt), rawPipeline(nullptr),
             sizeOfPipelineLaunchParams(0),
             scene(nullptr), numMissRayTypes(0), numCallablePrograms(0),
-            rayGenProgram(nullptr), exceptionProgram(nullptr),
-            pipelineLinked(false), sbtLayoutIsUpToDate(false), sbtIsUpToDate(false), hitGroupSbtIsUpToDate(false) {
+            rayGenProgram(nullptr), exceptionProgram(nullptr), callableTable(nullptr),
+            defaultHitGroupRevision(0),
+            visibilityModule(nullptr), visibilityMissProgram(nullptr), visibilityHitGroup(nullptr),
+            hitGroupSbtStamp(0), hitGroupSbtLayoutGeneration(0),
+            curOwnedHitGroupSbtIndex(0),
+            validatedScene(nullptr), validatedSceneEpoch(0),
+            pipelineLinked(false), pipelineLinking(false), sbtLayoutIsUpToDate(false), sbtIsUpToDate(false), hitGroupSbtIsUpToDate(false),
+            usePinnedStaging(false), pruneUnreachablePrograms(false) {
             sbtParams = {};
+            linkOptions = {};
         }
         ~Priv();
 
@@ -1004,22 +2393,89 @@ namespace optixu {
 
 
         void markDirty();
+        bool resolvePendingLink(bool wait);
+        void setNumOwnedHitGroupSBTs(uint32_t numBuffers);
+        void markOwnedHitGroupSBTsDirty() {
+            for (OwnedHitGroupSBT &ownedSbt : ownedHitGroupSbts)
+                ownedSbt.isUpToDate = false;
+        }
+        bool ownsHitGroupSBTs() const {
+            return !ownedHitGroupSbts.empty();
+        }
+        void acquireOwnedHitGroupSBT();
+        void releaseOwnedHitGroupSBT(CUstream stream);
+        void setPinnedStagingEnabled(bool enable) {
+            usePinnedStaging = enable;
+        }
+        // JP: 設定に応じてピン留めされたステージングリングを経由してホストからデバイスへ転送する。
+        // EN: Transfer from host to device via the pinned staging ring depending on the setting.
+        void upload(CUstream stream, CUdeviceptr dst, const void* src, size_t size) const {
+            if (usePinnedStaging)
+                stagingRing.upload(stream, dst, src, size);
+            else
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(dst, src, size, stream));
+        }
+        void uploadLaunchParams(CUstream stream, CUdeviceptr plpOnDevice, const void* params) const {
+            stagingRing.upload(stream, plpOnDevice, params, sizeOfPipelineLaunchParams);
+        }
         OptixModule getModuleForBuiltin(OptixPrimitiveType primType);
+        void setDefaultHitGroup(uint32_t rayType, _ProgramGroup* hitGroup);
+        const _ProgramGroup* getDefaultHitGroup(uint32_t rayType) const {
+            return rayType < defaultHitGroups.size() ? defaultHitGroups[rayType] : nullptr;
+        }
+        uint32_t getNumDefaultHitGroupRayTypes() const {
+            return static_cast<uint32_t>(defaultHitGroups.size());
+        }
+        uint32_t getDefaultHitGroupRevision() const {
+            return defaultHitGroupRevision;
+        }
+        const OptixPipelineCompileOptions &getPipelineCompileOptions() const {
+            return pipelineCompileOptions;
+        }
+        uint64_t calcModuleCacheKey(const std::string &ptxString, const OptixModuleCompileOptions &moduleOptions) const;
+        OptixModule compileModule(const std::string &ptxString, const OptixModuleCompileOptions &moduleOptions,
+                                  const OptixPipelineCompileOptions &pipelineOptions, uint64_t cacheKey) const;
         void createProgram(const OptixProgramGroupDesc &desc, const OptixProgramGroupOptions &options, OptixProgramGroup* group);
         void destroyProgram(OptixProgramGroup group);
+        void registerProgram(_ProgramGroup* program) {
+            registeredPrograms.insert(program);
+        }
+        void unregisterProgram(_ProgramGroup* program) {
+            registeredPrograms.erase(program);
+            auto it = std::find(prunedPrograms.cbegin(), prunedPrograms.cend(), program);
+            if (it != prunedPrograms.cend())
+                prunedPrograms.erase(it);
+        }
+        uint32_t materializeReferencedHitGroups();
+        uint32_t materializeCallableTable();
+        void resetCallableTable(const _CallableProgramTable* table) {
+            if (callableTable != table)
+                return;
+            callableTable = nullptr;
+            sbtIsUpToDate = false;
+        }
+        void collectLinkedProgramGroups(std::vector<OptixProgramGroup>* groups,
+                                        std::vector<_ProgramGroup*>* pruned) const;
+        void createRawPipeline(const std::vector<OptixProgramGroup> &groups);
     };
 
 
 
     class Module::Priv {
         const _Pipeline* pipeline;
-        OptixModule rawModule;
+        mutable OptixModule rawModule;
+        uint64_t cacheKey;
+        // JP: 非同期生成中のモジュール。最初に生のモジュールが必要になった時点で完了を待つ。
+        // EN: Module under asynchronous creation. Wait for its completion when the raw module is needed first.
+        mutable std::future<OptixModule> pendingModule;
 
     public:
         OPTIXU_OPAQUE_BRIDGE(Module);
 
-        Priv(const _Pipeline* pl, OptixModule _rawModule) :
-            pipeline(pl), rawModule(_rawModule) {}
+        Priv(const _Pipeline* pl, OptixModule _rawModule, uint64_t _cacheKey = 0) :
+            pipeline(pl), rawModule(_rawModule), cacheKey(_cacheKey) {}
+        Priv(const _Pipeline* pl, std::future<OptixModule> &&_pendingModule, uint64_t _cacheKey) :
+            pipeline(pl), rawModule(nullptr), cacheKey(_cacheKey), pendingModule(std::move(_pendingModule)) {}
         ~Priv() {
             getContext()->unregisterName(this);
         }
@@ -1033,22 +2489,58 @@ namespace optixu {
         OPTIXU_PRIV_NAME_INTERFACE();
 
         OptixModule getRawModule() const {
+            if (pendingModule.valid())
+                rawModule = pendingModule.get();
             return rawModule;
         }
+        bool isCompiled() const {
+            return !pendingModule.valid() ||
+                pendingModule.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }
+        uint64_t getCacheKey() const {
+            return cacheKey;
+        }
     };
 
 
 
     class ProgramGroup::Priv {
+    public:
+        // JP: 遅延ヒットグループの記述。モジュールとプログラムグループは
+        //     リンク時にシーン中のマテリアルから参照されている場合にのみ作られる。
+        // EN: Description of a deferred hit group. The module and the program group are created at link time
+        //     only when referenced from a material in the scene.
+        struct DeferredDesc {
+            std::string ptxString;
+            OptixModuleCompileOptions moduleCompileOptions;
+            OptixPrimitiveType primType;
+            std::string entryFunctionNameCH;
+            std::string entryFunctionNameAH;
+            const _Module* module_IS;
+            std::string entryFunctionNameIS;
+        };
+
+    private:
         _Pipeline* pipeline;
         OptixProgramGroup rawGroup;
+        std::unique_ptr<DeferredDesc> deferredDesc;
+        OptixModule deferredModule;
+        bool hasAnyHit;
 
     public:
         OPTIXU_OPAQUE_BRIDGE(ProgramGroup);
 
-        Priv(_Pipeline* pl, OptixProgramGroup _rawGroup) :
-            pipeline(pl), rawGroup(_rawGroup) {}
+        Priv(_Pipeline* pl, OptixProgramGroup _rawGroup, bool _hasAnyHit = false) :
+            pipeline(pl), rawGroup(_rawGroup), deferredModule(nullptr), hasAnyHit(_hasAnyHit) {
+            pipeline->registerProgram(this);
+        }
+        Priv(_Pipeline* pl, std::unique_ptr<DeferredDesc> &&desc) :
+            pipeline(pl), rawGroup(nullptr), deferredDesc(std::move(desc)), deferredModule(nullptr) {
+            hasAnyHit = !deferredDesc->entryFunctionNameAH.empty();
+            pipeline->registerProgram(this);
+        }
         ~Priv() {
+            pipeline->unregisterProgram(this);
             getContext()->unregisterName(this);
         }
 
@@ -1060,17 +2552,169 @@ namespace optixu {
         }
         OPTIXU_PRIV_NAME_INTERFACE();
 
+        OPTIXU_THROW_RUNTIME_ERROR("ProgramGroup");
+
         OptixProgramGroup getRawProgramGroup() const {
             return rawGroup;
         }
+        bool isDeferred() const {
+            return deferredDesc != nullptr;
+        }
+        bool isMaterialized() const {
+            return rawGroup != nullptr;
+        }
+        bool hasAnyHitProgram() const {
+            return hasAnyHit;
+        }
+        // JP: 遅延ヒットグループのモジュールをコンパイルしプログラムグループを作る。生成済みなら何もしない。
+        // EN: Compile the module of a deferred hit group and create the program group.
+        //     Do nothing if already created.
+        bool materialize();
+        void destroyRawObjects();
 
         void packHeader(uint8_t* record) const {
+            throwRuntimeError(rawGroup, "This deferred hit group has not been materialized. "
+                              "Link the pipeline with a scene referencing it.");
             OPTIX_CHECK(optixSbtRecordPackHeader(rawGroup, record));
         }
     };
 
 
 
+    class CallableProgramTable::Priv {
+        // JP: 遅延要素はprogramがnullptrの間モジュールとエントリー関数名を保持する。
+        // EN: A deferred entry holds the modules and entry function names while program is nullptr.
+        struct Entry {
+            _ProgramGroup* program;
+            _Module* module_DC;
+            std::string entryFunctionNameDC;
+            _Module* module_CC;
+            std::string entryFunctionNameCC;
+            bool ownsProgram;
+        };
+
+        _Pipeline* pipeline;
+        std::vector<Entry> entries;
+        std::vector<uint8_t> recordsOnHost;
+        CUdeviceptr recordsOnDevice;
+        uint32_t capacity;
+        // JP: 次のローンチで転送するレコードの範囲。
+        // EN: Range of records to transfer at the next launch.
+        uint32_t dirtyBegin;
+        uint32_t dirtyEnd;
+        uint32_t numPendingEntries;
+        // JP: 差し替えられたテーブル所有のプログラムグループ。破棄はパイプラインを無効化するのでテーブルの破棄まで遅らせる。
+        // EN: Table-owned program groups having been replaced. Destroying one invalidates the pipeline,
+        //     so defer it until the table is destroyed.
+        std::vector<_ProgramGroup*> retiredPrograms;
+
+        void markEntryDirty(uint32_t index) {
+            dirtyBegin = std::min(dirtyBegin, index);
+            dirtyEnd = std::max(dirtyEnd, index + 1);
+        }
+        void releaseEntry(Entry &entry);
+
+    public:
+        OPTIXU_OPAQUE_BRIDGE(CallableProgramTable);
+
+        Priv(_Pipeline* pl) :
+            pipeline(pl), recordsOnDevice(0), capacity(0),
+            dirtyBegin(UINT32_MAX), dirtyEnd(0), numPendingEntries(0) {}
+        ~Priv();
+
+        _Context* getContext() const {
+            return pipeline->getContext();
+        }
+        const _Pipeline* getPipeline() const {
+            return pipeline;
+        }
+        OPTIXU_PRIV_NAME_INTERFACE();
+        OPTIXU_THROW_RUNTIME_ERROR("CallableProgramTable");
+
+
+
+        void reserve(uint32_t newCapacity);
+        uint32_t addEntry(Entry &&entry);
+        void setProgram(uint32_t index, _ProgramGroup* program);
+        uint32_t getNumEntries() const {
+            return static_cast<uint32_t>(entries.size());
+        }
+        uint32_t getCapacity() const {
+            return capacity;
+        }
+
+        // JP: 遅延要素のプログラムグループを生成し、生成した数を返す。
+        // EN: Create program groups of deferred entries and return the number of created ones.
+        uint32_t materialize();
+        void collectProgramGroups(std::unordered_set<const _ProgramGroup*>* groups) const {
+            for (const Entry &entry : entries) {
+                if (entry.program)
+                    groups->insert(entry.program);
+            }
+        }
+        // JP: 変更のあったレコードを転送しSBTのコーラブルの範囲を設定する。
+        // EN: Transfer changed records and set the callable range of the SBT.
+        void setup(CUstream stream, OptixShaderBindingTable* sbtParams);
+    };
+
+
+
+    class PipelineVariantCache::Priv {
+        _Context* context;
+        PipelineVariantBuildFunction buildFunc;
+        PipelineVariantDestroyFunction destroyFunc;
+        void* userData;
+        uint32_t maxNumVariants;
+
+        // JP: バリアントは最近使われた順に並べる。キーは束縛値のオフセット、サイズ、中身を直列化したもの。
+        // EN: Variants are ordered by most recent use. A key is the serialized offsets, sizes and contents of
+        //     bound values.
+        struct Variant {
+            std::vector<uint8_t> key;
+            Pipeline pipeline;
+        };
+        std::list<Variant> variants;
+        std::map<std::vector<uint8_t>, std::list<Variant>::iterator> variantMap;
+        uint32_t numHits;
+        uint32_t numMisses;
+
+    public:
+        OPTIXU_OPAQUE_BRIDGE(PipelineVariantCache);
+
+        Priv(_Context* ctxt,
+             PipelineVariantBuildFunction _buildFunc, PipelineVariantDestroyFunction _destroyFunc,
+             void* _userData, uint32_t _maxNumVariants) :
+            context(ctxt), buildFunc(_buildFunc), destroyFunc(_destroyFunc), userData(_userData),
+            maxNumVariants(_maxNumVariants), numHits(0), numMisses(0) {}
+        ~Priv() {
+            clear();
+            context->unregisterName(this);
+        }
+
+        _Context* getContext() const {
+            return context;
+        }
+        OPTIXU_PRIV_NAME_INTERFACE();
+        OPTIXU_THROW_RUNTIME_ERROR("PipelineVariantCache");
+
+
+
+        void setMaxNumVariants(uint32_t num);
+        Pipeline getPipeline(const OptixModuleCompileBoundValueEntry* boundValues, uint32_t numBoundValues);
+        void evictLeastRecentlyUsed();
+        void clear();
+
+        uint32_t getNumVariants() const {
+            return static_cast<uint32_t>(variants.size());
+        }
+        void getStatistics(uint32_t* hits, uint32_t* misses) const {
+            *hits = numHits;
+            *misses = numMisses;
+        }
+    };
+
+
+
     static inline uint32_t getPixelSize(OptixPixelFormat format) {
         switch (format) {
         case OPTIX_PIXEL_FORMAT_HALF2:
@@ -1125,6 +2769,10 @@ namespace optixu {
 
         uint32_t imageWidth;
         uint32_t imageHeight;
+        uint32_t preparedImageWidth;
+        uint32_t preparedImageHeight;
+        uint32_t preparedTileWidth;
+        uint32_t preparedTileHeight;
         uint32_t tileWidth;
         uint32_t tileHeight;
         int32_t overlapWidth;
@@ -1137,6 +2785,8 @@ namespace optixu {
 
         BufferView stateBuffer;
         BufferView scratchBuffer;
+        std::vector<BufferView> concurrentStateBuffers;
+        std::vector<BufferView> concurrentScratchBuffers;
         struct {
             unsigned int guideAlbedo : 1;
             unsigned int guideNormal : 1;
@@ -1144,9 +2794,11 @@ namespace optixu {
             unsigned int useTiling : 1;
             unsigned int imageSizeSet : 1;
             unsigned int stateIsReady : 1;
+            unsigned int concurrentStatesAreReady : 1;
         };
 
         void invoke(CUstream stream,
+                    const BufferView &_stateBuffer, const BufferView &_scratchBuffer,
                     bool denoiseAlpha, CUdeviceptr hdrIntensity, CUdeviceptr hdrAverageColor, float blendFactor,
                     const BufferView &noisyBeauty, OptixPixelFormat beautyFormat,
                     const BufferView* noisyAovs, OptixPixelFormat* aovFormats, uint32_t numAovs,
@@ -1164,12 +2816,13 @@ namespace optixu {
 
         Priv(_Context* ctxt, OptixDenoiserModelKind _modelKind, bool _guideAlbedo, bool _guideNormal) :
             context(ctxt),
-            imageWidth(0), imageHeight(0), tileWidth(0), tileHeight(0),
+            imageWidth(0), imageHeight(0), preparedImageWidth(0), preparedImageHeight(0),
+            preparedTileWidth(0), preparedTileHeight(0), tileWidth(0), tileHeight(0),
             overlapWidth(0), maxInputWidth(0), maxInputHeight(0),
             stateSize(0), scratchSize(0),
             scratchSizeForComputeIntensity(0), scratchSizeForComputeAverageColor(0),
             modelKind(_modelKind), guideAlbedo(_guideAlbedo), guideNormal(_guideNormal),
-            useTiling(false), imageSizeSet(false), stateIsReady(false) {
+            useTiling(false), imageSizeSet(false), stateIsReady(false), concurrentStatesAreReady(false) {
             OptixDenoiserOptions options = {};
             options.guideAlbedo = _guideAlbedo;
             options.guideNormal = _guideNormal;
@@ -1186,6 +2839,14 @@ namespace optixu {
         OptixDeviceContext getRawContext() const {
             return context->getRawContext();
         }
+        void setImageSize(uint32_t width, uint32_t height);
+        uint32_t calcNumTasks() const;
+
+        void getMaxInputSize(uint32_t* width, uint32_t* height) const {
+            *width = useTiling ? (preparedTileWidth + 2 * overlapWidth) : preparedImageWidth;
+            *height = useTiling ? (preparedTileHeight + 2 * overlapWidth) : preparedImageHeight;
+        }
+
         OPTIXU_PRIV_NAME_INTERFACE();
         OPTIXU_THROW_RUNTIME_ERROR("Denoiser");
     };
@@ -3,6 +3,13 @@
 #include "cuda_util.h"
 #include "optix_util.h"
 
+#if !defined(__CUDA_ARCH__)
+#   include <cctype>
+#   include <cmath>
+#   include <cstring>
+#   include <map>
+#endif
+
 namespace optixu {
     template <typename T, typename... Ts>
     inline constexpr bool is_any_v = std::disjunction_v<std::is_same<T, Ts>...>;
@@ -140,8 +147,154 @@ namespace optixu {
 
 
 
-    template <typename T, uint32_t log2BlockWidth>
+    // JP: ブロックバッファーのブロック内のレイアウト。
+    //     RowMajorBlockLayoutは行優先、MortonBlockLayoutはZオーダー、HilbertBlockLayoutはヒルベルト曲線の順
+    //     (2次元のみ)で要素を並べる。calcPositionInBlock()はcalcIndexInBlock()の逆写像。
+    // EN: Layouts within a block of block buffers.
+    //     RowMajorBlockLayout arranges elements in row-major order, MortonBlockLayout in Z-order and
+    //     HilbertBlockLayout in Hilbert curve order (2D only).
+    //     calcPositionInBlock() is the inverse mapping of calcIndexInBlock().
+    struct RowMajorBlockLayout {
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint32_t calcIndexInBlock(uint32_t x, uint32_t y) {
+            return (y << log2BlockWidth) + x;
+        }
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint2 calcPositionInBlock(uint32_t index) {
+            return uint2{ index & ((1u << log2BlockWidth) - 1), index >> log2BlockWidth };
+        }
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint32_t calcIndexInBlock(uint32_t x, uint32_t y, uint32_t z) {
+            return (((z << log2BlockWidth) + y) << log2BlockWidth) + x;
+        }
+    };
+
+    struct MortonBlockLayout {
+        RT_DEVICE_FUNCTION static constexpr uint32_t spreadBits2D(uint32_t v) {
+            v &= 0x0000FFFF;
+            v = (v | (v << 8)) & 0x00FF00FF;
+            v = (v | (v << 4)) & 0x0F0F0F0F;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        }
+        RT_DEVICE_FUNCTION static constexpr uint32_t spreadBits3D(uint32_t v) {
+            v &= 0x000003FF;
+            v = (v | (v << 16)) & 0x030000FF;
+            v = (v | (v << 8)) & 0x0300F00F;
+            v = (v | (v << 4)) & 0x030C30C3;
+            v = (v | (v << 2)) & 0x09249249;
+            return v;
+        }
+        RT_DEVICE_FUNCTION static constexpr uint32_t compactBits2D(uint32_t v) {
+            v &= 0x55555555;
+            v = (v | (v >> 1)) & 0x33333333;
+            v = (v | (v >> 2)) & 0x0F0F0F0F;
+            v = (v | (v >> 4)) & 0x00FF00FF;
+            v = (v | (v >> 8)) & 0x0000FFFF;
+            return v;
+        }
+
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint32_t calcIndexInBlock(uint32_t x, uint32_t y) {
+            return spreadBits2D(x) | (spreadBits2D(y) << 1);
+        }
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint32_t calcIndexInBlock(uint32_t x, uint32_t y, uint32_t z) {
+            return spreadBits3D(x) | (spreadBits3D(y) << 1) | (spreadBits3D(z) << 2);
+        }
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint2 calcPositionInBlock(uint32_t index) {
+            return uint2{ compactBits2D(index), compactBits2D(index >> 1) };
+        }
+    };
+
+    struct HilbertBlockLayout {
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint32_t calcIndexInBlock(uint32_t x, uint32_t y) {
+            constexpr uint32_t mask = (1u << log2BlockWidth) - 1;
+            uint32_t index = 0;
+            for (uint32_t s = (1u << log2BlockWidth) >> 1; s > 0; s >>= 1) {
+                uint32_t rx = (x & s) ? 1 : 0;
+                uint32_t ry = (y & s) ? 1 : 0;
+                index += s * s * ((3 * rx) ^ ry);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = mask ^ x;
+                        y = mask ^ y;
+                    }
+                    uint32_t t = x;
+                    x = y;
+                    y = t;
+                }
+            }
+            return index;
+        }
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION static constexpr uint2 calcPositionInBlock(uint32_t index) {
+            uint32_t x = 0;
+            uint32_t y = 0;
+            for (uint32_t s = 1; s < (1u << log2BlockWidth); s <<= 1) {
+                uint32_t rx = 1 & (index >> 1);
+                uint32_t ry = 1 & (index ^ rx);
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = s - 1 - x;
+                        y = s - 1 - y;
+                    }
+                    uint32_t t = x;
+                    x = y;
+                    y = t;
+                }
+                x += s * rx;
+                y += s * ry;
+                index >>= 2;
+            }
+            return uint2{ x, y };
+        }
+    };
+
+    namespace detail {
+        // JP: 16バイトの型はuint4として読み書きしてベクトル化されたロード・ストアを保証する。
+        //     バッファーの先頭は16バイトにアラインされている必要がある。
+        // EN: Read/write 16-byte types as uint4 to guarantee vectorized loads/stores.
+        //     The head of the buffer needs to be aligned to 16 bytes.
+        template <typename T>
+        RT_DEVICE_FUNCTION T loadBlockBufferElement(const T* ptr) {
+            if constexpr (sizeof(T) == 16) {
+                union U {
+                    T targetType;
+                    uint4 uiValue;
+                    RT_DEVICE_FUNCTION U() {}
+                } u;
+                u.uiValue = *reinterpret_cast<const uint4*>(ptr);
+                return u.targetType;
+            }
+            else {
+                return *ptr;
+            }
+        }
+        template <typename T>
+        RT_DEVICE_FUNCTION void storeBlockBufferElement(T* ptr, const T &value) {
+            if constexpr (sizeof(T) == 16) {
+                union U {
+                    T targetType;
+                    uint4 uiValue;
+                    RT_DEVICE_FUNCTION U() {}
+                } u;
+                u.targetType = value;
+                *reinterpret_cast<uint4*>(ptr) = u.uiValue;
+            }
+            else {
+                *ptr = value;
+            }
+        }
+    }
+
+    template <typename T, uint32_t log2BlockWidth, typename Layout = RowMajorBlockLayout>
     class BlockBuffer2D {
+        static_assert(log2BlockWidth <= 8, "Block width is too large.");
+
         T* m_rawBuffer;
         uint32_t m_width;
         uint32_t m_height;
@@ -156,7 +309,7 @@ namespace optixu {
             uint32_t blockOffset = (blockIdxY * m_numXBlocks + blockIdxX) * (blockWidth * blockWidth);
             uint32_t idxXInBlock = idxX & mask;
             uint32_t idxYInBlock = idxY & mask;
-            uint32_t linearIndexInBlock = idxYInBlock * blockWidth + idxXInBlock;
+            uint32_t linearIndexInBlock = Layout::template calcIndexInBlock<log2BlockWidth>(idxXInBlock, idxYInBlock);
             return blockOffset + linearIndexInBlock;
         }
 #endif
@@ -197,23 +350,917 @@ namespace optixu {
         }
 
         RT_DEVICE_FUNCTION T read(uint2 idx) const {
-            return (*this)[idx];
+            return detail::loadBlockBufferElement(&(*this)[idx]);
         }
         RT_DEVICE_FUNCTION void write(uint2 idx, const T &value) {
-            (*this)[idx] = value;
+            detail::storeBlockBufferElement(&(*this)[idx], value);
         }
 
         RT_DEVICE_FUNCTION T read(int2 idx) const {
-            return (*this)[idx];
+            return detail::loadBlockBufferElement(&(*this)[idx]);
         }
         RT_DEVICE_FUNCTION void write(int2 idx, const T &value) {
-            (*this)[idx] = value;
+            detail::storeBlockBufferElement(&(*this)[idx], value);
+        }
+#endif
+    };
+
+
+
+    // JP: 実行時に選んだブロック幅をコンパイル時の定数としてfuncに渡す。
+    //     funcはstd::integral_constant<uint32_t, log2BlockWidth>を受け取る。候補は[minLog2, maxLog2]の範囲。
+    //     OptiXのプログラムではlog2BlockWidthにOptixModuleCompileBoundValueEntryで値を固定した
+    //     ローンチパラメターのメンバーを使うと、モジュールごとに分岐が畳み込まれて単一の幅のコードだけが残る。
+    // EN: Pass the block width chosen at runtime to func as a compile-time constant.
+    //     func receives std::integral_constant<uint32_t, log2BlockWidth>. Candidates are in [minLog2, maxLog2].
+    //     In OptiX programs, using a launch parameter member whose value is fixed by
+    //     OptixModuleCompileBoundValueEntry as log2BlockWidth folds the branches per module,
+    //     leaving only the code for a single width.
+    template <uint32_t minLog2 = 0, uint32_t maxLog2 = 3, typename Func>
+    RT_DEVICE_FUNCTION decltype(auto) dispatchLog2BlockWidth(uint32_t log2BlockWidth, Func &&func) {
+        static_assert(minLog2 <= maxLog2, "Invalid range of block widths.");
+        if constexpr (minLog2 < maxLog2) {
+            if (log2BlockWidth == minLog2)
+                return func(std::integral_constant<uint32_t, minLog2>());
+            return dispatchLog2BlockWidth<minLog2 + 1, maxLog2>(log2BlockWidth, std::forward<Func>(func));
+        }
+        else {
+            return func(std::integral_constant<uint32_t, maxLog2>());
+        }
+    }
+
+    // JP: ブロック幅を実行時に保持するブロックバッファー。アクセスはget<log2BlockWidth>()で得る
+    //     BlockBuffer2Dを通して行うので、インデックス計算はコンパイル時の幅に特殊化されたままになる。
+    //
+    //     // Ray Generationプログラム
+    //     optixu::dispatchLog2BlockWidth(plp.accumBuffer.getLog2BlockWidth(), [&](auto log2BlockWidth) {
+    //         auto accumBuffer = plp.accumBuffer.get<decltype(log2BlockWidth)::value>();
+    //         accumBuffer.write(launchIndex, color);
+    //     });
+    //
+    // EN: A block buffer holding the block width at runtime. Accesses are done through BlockBuffer2D
+    //     obtained by get<log2BlockWidth>(), so the index math stays specialized for the compile-time width.
+    //
+    //     // Ray generation program
+    //     optixu::dispatchLog2BlockWidth(plp.accumBuffer.getLog2BlockWidth(), [&](auto log2BlockWidth) {
+    //         auto accumBuffer = plp.accumBuffer.get<decltype(log2BlockWidth)::value>();
+    //         accumBuffer.write(launchIndex, color);
+    //     });
+    template <typename T, typename Layout = RowMajorBlockLayout>
+    class DynamicBlockBuffer2D {
+        T* m_rawBuffer;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_log2BlockWidth;
+
+    public:
+        // JP: ローンチパラメター内でのブロック幅のオフセット計算に使う。OptixModuleCompileBoundValueEntryの
+        //     pipelineParamOffsetInBytesにはこれとローンチパラメター内のメンバーのオフセットを足したものを指定する。
+        // EN: Used to compute the offset of the block width within launch parameters. Specify this plus
+        //     the offset of the member within launch parameters to pipelineParamOffsetInBytes of
+        //     OptixModuleCompileBoundValueEntry.
+        static constexpr size_t getLog2BlockWidthOffset() {
+            return offsetof(DynamicBlockBuffer2D, m_log2BlockWidth);
+        }
+
+        RT_DEVICE_FUNCTION DynamicBlockBuffer2D() {}
+        RT_DEVICE_FUNCTION DynamicBlockBuffer2D(T* rawBuffer, uint32_t width, uint32_t height, uint32_t log2BlockWidth) :
+            m_rawBuffer(rawBuffer), m_width(width), m_height(height), m_log2BlockWidth(log2BlockWidth) {}
+
+        RT_DEVICE_FUNCTION uint32_t getLog2BlockWidth() const {
+            return m_log2BlockWidth;
+        }
+
+        template <uint32_t log2BlockWidth>
+        RT_DEVICE_FUNCTION BlockBuffer2D<T, log2BlockWidth, Layout> get() const {
+            return BlockBuffer2D<T, log2BlockWidth, Layout>(m_rawBuffer, m_width, m_height);
+        }
+    };
+
+
+
+    // JP: ローンチインデックスの再配置。1次元でローンチし、各インデックスをブロック単位で並べたピクセルに写す。
+    //     ブロックの並びと各ブロック内のレイアウトは同じlog2BlockWidthとLayoutのBlockBuffer2Dと一致するので、
+    //     1次元のローンチインデックスはそのままバッファーの生の要素インデックスになり書き込みは合体される。
+    //     行優先のピクセルに比べてワープ内のレイが空間的にまとまり、二次レイのトラバーサルやSBT、
+    //     テクスチャーのキャッシュ効率が良くなる。
+    //
+    //     // ホスト
+    //     optixu::launchWithRemappedIndices<3>(pipeline, stream, plpOnDevice, width, height);
+    //     // Ray Generationプログラム
+    //     uint2 launchIndex;
+    //     if (!optixu::getRemappedLaunchIndex<3, optixu::MortonBlockLayout>(plp.imageSize, &launchIndex))
+    //         return;
+    //
+    // EN: Launch index remapping. Launch in 1D and map each index to pixels arranged per block.
+    //     The order of blocks and the layout within each block match BlockBuffer2D with the same log2BlockWidth and
+    //     Layout, so the 1D launch index is the raw element index of the buffer as is and writes are coalesced.
+    //     Compared to row-major pixels, rays in a warp are spatially grouped, and this improves cache efficiency of
+    //     traversal of secondary rays, the SBT and textures.
+    //
+    //     // Host
+    //     optixu::launchWithRemappedIndices<3>(pipeline, stream, plpOnDevice, width, height);
+    //     // Ray generation program
+    //     uint2 launchIndex;
+    //     if (!optixu::getRemappedLaunchIndex<3, optixu::MortonBlockLayout>(plp.imageSize, &launchIndex))
+    //         return;
+    template <uint32_t log2BlockWidth>
+    RT_DEVICE_FUNCTION constexpr uint32_t calcRemappedLaunchSize(uint32_t width, uint32_t height) {
+        constexpr uint32_t mask = (1u << log2BlockWidth) - 1;
+        uint32_t numXBlocks = (width + mask) >> log2BlockWidth;
+        uint32_t numYBlocks = (height + mask) >> log2BlockWidth;
+        return (numXBlocks * numYBlocks) << (2 * log2BlockWidth);
+    }
+
+    // JP: ブロックの端数でイメージからはみ出たピクセルに対してはfalseを返す。
+    // EN: Return false for pixels outside the image due to the remainder of blocks.
+    template <uint32_t log2BlockWidth, typename Layout = MortonBlockLayout>
+    RT_DEVICE_FUNCTION constexpr bool remapLaunchIndex(uint32_t linearIndex, uint32_t width, uint32_t height,
+                                                       uint2* pixel) {
+        constexpr uint32_t mask = (1u << log2BlockWidth) - 1;
+        uint32_t numXBlocks = (width + mask) >> log2BlockWidth;
+        uint32_t blockIndex = linearIndex >> (2 * log2BlockWidth);
+        uint2 posInBlock = Layout::template calcPositionInBlock<log2BlockWidth>(
+            linearIndex & ((1u << (2 * log2BlockWidth)) - 1));
+        pixel->x = ((blockIndex % numXBlocks) << log2BlockWidth) + posInBlock.x;
+        pixel->y = ((blockIndex / numXBlocks) << log2BlockWidth) + posInBlock.y;
+        return pixel->x < width && pixel->y < height;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    template <uint32_t log2BlockWidth, typename Layout = MortonBlockLayout>
+    RT_DEVICE_FUNCTION bool getRemappedLaunchIndex(const uint2 &imageSize, uint2* pixel) {
+        return remapLaunchIndex<log2BlockWidth, Layout>(optixGetLaunchIndex().x, imageSize.x, imageSize.y, pixel);
+    }
+    template <uint32_t log2BlockWidth, typename Layout = MortonBlockLayout>
+    RT_DEVICE_FUNCTION bool getRemappedLaunchIndex(const int2 &imageSize, uint2* pixel) {
+        return remapLaunchIndex<log2BlockWidth, Layout>(optixGetLaunchIndex().x, imageSize.x, imageSize.y, pixel);
+    }
+#endif
+
+
+
+    // JP: ボリュームキャッシュなどのための3次元ブロックバッファー。
+    // EN: 3D block buffer for volume caches and similar.
+    template <typename T, uint32_t log2BlockWidth, typename Layout = RowMajorBlockLayout>
+    class BlockBuffer3D {
+        static_assert(log2BlockWidth <= 5, "Block width is too large.");
+
+        T* m_rawBuffer;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_depth;
+        uint32_t m_numXBlocks;
+        uint32_t m_numYBlocks;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION constexpr uint32_t calcLinearIndex(uint32_t idxX, uint32_t idxY, uint32_t idxZ) const {
+            constexpr uint32_t blockWidth = 1 << log2BlockWidth;
+            constexpr uint32_t mask = blockWidth - 1;
+            uint32_t blockIdxX = idxX >> log2BlockWidth;
+            uint32_t blockIdxY = idxY >> log2BlockWidth;
+            uint32_t blockIdxZ = idxZ >> log2BlockWidth;
+            uint32_t blockOffset = ((blockIdxZ * m_numYBlocks + blockIdxY) * m_numXBlocks + blockIdxX) *
+                (blockWidth * blockWidth * blockWidth);
+            uint32_t linearIndexInBlock = Layout::template calcIndexInBlock<log2BlockWidth>(
+                idxX & mask, idxY & mask, idxZ & mask);
+            return blockOffset + linearIndexInBlock;
+        }
+#endif
+
+    public:
+        RT_DEVICE_FUNCTION BlockBuffer3D() {}
+        RT_DEVICE_FUNCTION BlockBuffer3D(T* rawBuffer, uint32_t width, uint32_t height, uint32_t depth) :
+            m_rawBuffer(rawBuffer), m_width(width), m_height(height), m_depth(depth) {
+            constexpr uint32_t blockWidth = 1 << log2BlockWidth;
+            constexpr uint32_t mask = blockWidth - 1;
+            m_numXBlocks = ((width + mask) & ~mask) >> log2BlockWidth;
+            m_numYBlocks = ((height + mask) & ~mask) >> log2BlockWidth;
+        }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION uint3 getSize() const {
+            return make_uint3(m_width, m_height, m_depth);
+        }
+
+        RT_DEVICE_FUNCTION const T &operator[](uint3 idx) const {
+            optixuAssert(idx.x < m_width && idx.y < m_height && idx.z < m_depth,
+                         "Out of bounds: %u, %u, %u", idx.x, idx.y, idx.z);
+            return m_rawBuffer[calcLinearIndex(idx.x, idx.y, idx.z)];
+        }
+        RT_DEVICE_FUNCTION T &operator[](uint3 idx) {
+            optixuAssert(idx.x < m_width && idx.y < m_height && idx.z < m_depth,
+                         "Out of bounds: %u, %u, %u", idx.x, idx.y, idx.z);
+            return m_rawBuffer[calcLinearIndex(idx.x, idx.y, idx.z)];
+        }
+
+        RT_DEVICE_FUNCTION T read(uint3 idx) const {
+            return detail::loadBlockBufferElement(&(*this)[idx]);
+        }
+        RT_DEVICE_FUNCTION void write(uint3 idx, const T &value) {
+            detail::storeBlockBufferElement(&(*this)[idx], value);
+        }
+#endif
+    };
+
+
+
+    // JP: 累積バッファーの格納形式。
+    //     Halfは平均色を半精度で保持して帯域を減らす。平均を更新していくため値の規模は大きくならないが、
+    //     千サンプル程度を超えると増分が半精度の分解能を下回り始め平均が偏るので、リファレンス画像にはFloatを使う。
+    //     Halfのサンプル数は65535で飽和し、以降は指数移動平均に近い振る舞いになる。
+    // EN: Storage formats of accumulation buffers.
+    //     Half holds the mean color in half precision to reduce bandwidth. The magnitude doesn't grow
+    //     since the mean is updated, but increments start falling below the resolution of half precision
+    //     beyond about a thousand samples and the mean gets biased, so use Float for reference images.
+    //     The sample count of Half saturates at 65535 and behaves close to an exponential moving average after that.
+    enum class AccumulationFormat {
+        Half = 0,
+        Float
+    };
+
+    namespace detail {
+        template <AccumulationFormat format>
+        struct AccumulationElementTypes;
+        // JP: 平均RGB(半精度x3)とサンプル数(16ビット)で8バイト、輝度の分散(半精度)で2バイト。
+        // EN: 8 bytes for mean RGB (half x3) and sample count (16 bits), 2 bytes for luminance variance (half).
+        template <>
+        struct AccumulationElementTypes<AccumulationFormat::Half> {
+            using Color = uint2;
+            using Variance = uint16_t;
+        };
+        // JP: 平均RGBとサンプル数で16バイト、輝度の分散で4バイト。
+        // EN: 16 bytes for mean RGB and sample count, 4 bytes for luminance variance.
+        template <>
+        struct AccumulationElementTypes<AccumulationFormat::Float> {
+            using Color = float4;
+            using Variance = float;
+        };
+    }
+
+    // JP: Welfordのオンラインアルゴリズムで平均色と輝度の分散を逐次更新する累積バッファー。
+    //     平均を直接保持するので解決時にサンプル数で割る必要がなく、read()はprepareDenoiserInputs()に
+    //     accumScale = 1で直接渡せる。分散は適応サンプリングの収束判定に使える。
+    // EN: Accumulation buffer incrementally updating the mean color and luminance variance
+    //     with Welford's online algorithm.
+    //     The mean is held directly so no division by the sample count is needed on resolve, and read() can be
+    //     passed directly to prepareDenoiserInputs() with accumScale = 1.
+    //     The variance can be used for convergence tests of adaptive sampling.
+    template <AccumulationFormat format, uint32_t log2BlockWidth = 1, typename Layout = RowMajorBlockLayout>
+    class AccumulationBuffer2D {
+        using ElementTypes = detail::AccumulationElementTypes<format>;
+        BlockBuffer2D<typename ElementTypes::Color, log2BlockWidth, Layout> m_colorBuffer;
+        BlockBuffer2D<typename ElementTypes::Variance, log2BlockWidth, Layout> m_varianceBuffer;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION static float calcLuminance(const float3 &v) {
+            return 0.212671f * v.x + 0.715160f * v.y + 0.072169f * v.z;
+        }
+
+        RT_DEVICE_FUNCTION void load(uint2 idx, float3* mean, uint32_t* numSamples) const {
+            typename ElementTypes::Color c = m_colorBuffer.read(idx);
+            if constexpr (format == AccumulationFormat::Half) {
+                float2 rg = Half2{ c.x }.decode();
+                float2 bn = Half2{ c.y & 0xFFFF }.decode();
+                *mean = make_float3(rg.x, rg.y, bn.x);
+                *numSamples = c.y >> 16;
+            }
+            else {
+                *mean = make_float3(c.x, c.y, c.z);
+                *numSamples = static_cast<uint32_t>(c.w);
+            }
+        }
+        RT_DEVICE_FUNCTION void store(uint2 idx, const float3 &mean, uint32_t numSamples) {
+            if constexpr (format == AccumulationFormat::Half) {
+                uint32_t rg = Half2::encode(make_float2(mean.x, mean.y)).bits;
+                uint32_t b = Half2::encode(make_float2(mean.z, 0.0f)).bits & 0xFFFF;
+                m_colorBuffer.write(idx, make_uint2(rg, b | (numSamples << 16)));
+            }
+            else {
+                m_colorBuffer.write(idx, make_float4(mean.x, mean.y, mean.z, static_cast<float>(numSamples)));
+            }
+        }
+        RT_DEVICE_FUNCTION float loadVariance(uint2 idx) const {
+            if constexpr (format == AccumulationFormat::Half)
+                return Half2{ m_varianceBuffer.read(idx) }.decode().x;
+            else
+                return m_varianceBuffer.read(idx);
+        }
+        RT_DEVICE_FUNCTION void storeVariance(uint2 idx, float variance) {
+            if constexpr (format == AccumulationFormat::Half)
+                m_varianceBuffer.write(idx, static_cast<uint16_t>(Half2::encode(make_float2(variance, 0.0f)).bits));
+            else
+                m_varianceBuffer.write(idx, variance);
+        }
+#endif
+
+    public:
+        static constexpr uint32_t maxNumSamples = format == AccumulationFormat::Half ? 0xFFFF : 0xFFFFFFFF;
+
+        RT_DEVICE_FUNCTION AccumulationBuffer2D() {}
+        RT_DEVICE_FUNCTION AccumulationBuffer2D(
+            typename ElementTypes::Color* colorRawBuffer, typename ElementTypes::Variance* varianceRawBuffer,
+            uint32_t width, uint32_t height) :
+            m_colorBuffer(colorRawBuffer, width, height), m_varianceBuffer(varianceRawBuffer, width, height) {}
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION uint2 getSize() const {
+            return m_colorBuffer.getSize();
+        }
+
+        // JP: サンプルを1つ加える。resetが真の場合はそれまでの累積を捨ててこのサンプルから始める。
+        //     分散は母分散(M2 / n)として保持し、半精度でも値の規模が大きくならないようにしている。
+        // EN: Add a sample. Discard the accumulation so far and start from this sample when reset is true.
+        //     The variance is held as population variance (M2 / n) so that the magnitude doesn't grow
+        //     even in half precision.
+        RT_DEVICE_FUNCTION void accumulate(uint2 idx, const float3 &value, bool reset = false) {
+            float3 mean = make_float3(0.0f, 0.0f, 0.0f);
+            uint32_t numSamples = 0;
+            float variance = 0.0f;
+            if (!reset) {
+                load(idx, &mean, &numSamples);
+                variance = loadVariance(idx);
+            }
+            uint32_t newNumSamples = min(numSamples, maxNumSamples - 1) + 1;
+            float invN = 1.0f / newNumSamples;
+            float prevMeanLum = calcLuminance(mean);
+            mean = make_float3(mean.x + (value.x - mean.x) * invN,
+                               mean.y + (value.y - mean.y) * invN,
+                               mean.z + (value.z - mean.z) * invN);
+            float lum = calcLuminance(value);
+            float m2 = variance * (newNumSamples - 1) + (lum - prevMeanLum) * (lum - calcLuminance(mean));
+            store(idx, mean, newNumSamples);
+            storeVariance(idx, fmaxf(m2 * invN, 0.0f));
+        }
+
+        RT_DEVICE_FUNCTION float3 getMean(uint2 idx) const {
+            float3 mean;
+            uint32_t numSamples;
+            load(idx, &mean, &numSamples);
+            return mean;
+        }
+        RT_DEVICE_FUNCTION uint32_t getNumSamples(uint2 idx) const {
+            float3 mean;
+            uint32_t numSamples;
+            load(idx, &mean, &numSamples);
+            return numSamples;
+        }
+        // JP: 輝度の不偏分散を返す。
+        // EN: Return the unbiased variance of luminance.
+        RT_DEVICE_FUNCTION float getVariance(uint2 idx) const {
+            uint32_t numSamples = getNumSamples(idx);
+            return numSamples > 1 ? loadVariance(idx) * numSamples / (numSamples - 1) : 0.0f;
+        }
+        // JP: 平均輝度の相対標準誤差を返す。サンプル数が2未満の場合は無限大を返す。
+        // EN: Return the relative standard error of the mean luminance.
+        //     Return infinity when the number of samples is less than 2.
+        RT_DEVICE_FUNCTION float getRelativeError(uint2 idx, float epsilon = 1e-3f) const {
+            float3 mean;
+            uint32_t numSamples;
+            load(idx, &mean, &numSamples);
+            if (numSamples < 2)
+                return __int_as_float(0x7F800000);
+            float sampleVariance = loadVariance(idx) * numSamples / (numSamples - 1);
+            return sqrtf(sampleVariance / numSamples) / (calcLuminance(mean) + epsilon);
+        }
+
+        // JP: 平均色をアルファ1で返す。prepareDenoiserInputs()などread(uint2)を要求する関数に渡せる。
+        // EN: Return the mean color with alpha 1.
+        //     This can be passed to functions requiring read(uint2) such as prepareDenoiserInputs().
+        RT_DEVICE_FUNCTION float4 read(uint2 idx) const {
+            float3 mean = getMean(idx);
+            return make_float4(mean.x, mean.y, mean.z, 1.0f);
+        }
+#endif
+    };
+
+
+
+    // JP: ウェーブフロント型のレンダリング用のキュー。シェーディングカーネルなどがappend()でアトミックに追加し、
+    //     追加された要素を次のカーネルやローンチが消費する。容量を超えた追加は破棄され無効なインデックスを返す。
+    // EN: Queue for wavefront-style rendering. Shading kernels and others append elements atomically by append(),
+    //     then the next kernel or launch consumes the appended elements.
+    //     Appending beyond the capacity is discarded and returns an invalid index.
+    template <typename T>
+    class WorkQueue {
+        T* m_items;
+        uint32_t* m_counter;
+        uint32_t m_capacity;
+
+    public:
+        static constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+
+        RT_DEVICE_FUNCTION WorkQueue() : m_items(nullptr), m_counter(nullptr), m_capacity(0) {}
+        RT_DEVICE_FUNCTION WorkQueue(T* items, uint32_t* counter, uint32_t capacity) :
+            m_items(items), m_counter(counter), m_capacity(capacity) {}
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION uint32_t getCapacity() const {
+            return m_capacity;
+        }
+        RT_DEVICE_FUNCTION uint32_t getNumItems() const {
+            return min(*m_counter, m_capacity);
+        }
+
+        RT_DEVICE_FUNCTION uint32_t append(const T &item) const {
+            uint32_t index = atomicAdd(m_counter, 1u);
+            if (index >= m_capacity)
+                return InvalidIndex;
+            m_items[index] = item;
+            return index;
+        }
+
+        RT_DEVICE_FUNCTION const T &operator[](uint32_t idx) const {
+            optixuAssert(idx < m_capacity, "Out of bounds: %u", idx);
+            return m_items[idx];
+        }
+        RT_DEVICE_FUNCTION T &operator[](uint32_t idx) {
+            optixuAssert(idx < m_capacity, "Out of bounds: %u", idx);
+            return m_items[idx];
+        }
+#endif
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: レイのキューを消費するトレース専用のRay Generationプログラム用のヘルパー。
+    //     キューの容量分の1次元ローンチで呼び、1スレッドでキューのレイを1つトレースする。
+    //     RayTypeはorigin, direction, tmin, tmax, timeのメンバーを持つ必要がある。
+    //     HitRecordTypeはペイロードとしてヒットプログラムに渡され(optixu::getPayloads()/setPayloads())、
+    //     トレース後にhitRecords[キュー内のインデックス]に書き込まれる。
+    // EN: Helper for a trace-only ray generation program consuming a ray queue.
+    //     Call this in a 1D launch of the queue capacity, and each thread traces one ray in the queue.
+    //     RayType needs to have members origin, direction, tmin, tmax and time.
+    //     HitRecordType is passed to hit programs as a payload (optixu::getPayloads()/setPayloads()),
+    //     then written to hitRecords[index in the queue] after the trace.
+    template <typename HitRecordType, typename RayType>
+    RT_DEVICE_FUNCTION void traceFromQueue(
+        OptixTraversableHandle handle, const WorkQueue<RayType> &rayQueue, HitRecordType* hitRecords,
+        OptixVisibilityMask visibilityMask, OptixRayFlags rayFlags,
+        uint32_t SBToffset, uint32_t SBTstride, uint32_t missSBTIndex) {
+        uint32_t index = optixGetLaunchIndex().x;
+        if (index >= rayQueue.getNumItems())
+            return;
+
+        const RayType &ray = rayQueue[index];
+        HitRecordType hitRecord = hitRecords[index];
+        trace(handle, ray.origin, ray.direction, ray.tmin, ray.tmax, ray.time,
+              visibilityMask, rayFlags, SBToffset, SBTstride, missSBTIndex,
+              hitRecord);
+        hitRecords[index] = hitRecord;
+    }
+
+
+
+    // JP: ヒットレコードをマテリアル(などの小さな範囲のキー)ごとにまとめるためのカウンティングソート。
+    //     ユーザーカーネルから以下の順に呼ぶ。スレッドインデックスはグローバルな1次元インデックス。
+    //     1. countSortKeys(): バケットごとの要素数を数える(bucketCountsはゼロ初期化しておく)。
+    //     2. scanBucketCounts(): 1スレッドで要素数を排他的プレフィックス和(各バケットの開始位置)に変換する。
+    //     3. scatterBySortKey(): 各要素のインデックスをバケットの位置に書き込む。バケット内の順序は不定。
+    // EN: Counting sort to group hit records by material (or other small-range keys).
+    //     Call in the following order from user kernels. The thread index is the global 1D index.
+    //     1. countSortKeys(): Count elements per bucket (zero-initialize bucketCounts beforehand).
+    //     2. scanBucketCounts(): Convert counts into the exclusive prefix sum (start of each bucket) with one thread.
+    //     3. scatterBySortKey(): Write the index of each element into its bucket. The order within a bucket is arbitrary.
+    RT_DEVICE_FUNCTION void countSortKeys(const uint32_t* keys, uint32_t numItems, uint32_t* bucketCounts) {
+        uint32_t index = blockDim.x * blockIdx.x + threadIdx.x;
+        if (index >= numItems)
+            return;
+        atomicAdd(&bucketCounts[keys[index]], 1u);
+    }
+
+    RT_DEVICE_FUNCTION void scanBucketCounts(uint32_t* bucketCountsToOffsets, uint32_t numBuckets) {
+        if (blockDim.x * blockIdx.x + threadIdx.x != 0)
+            return;
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < numBuckets; ++i) {
+            uint32_t count = bucketCountsToOffsets[i];
+            bucketCountsToOffsets[i] = sum;
+            sum += count;
+        }
+    }
+
+    // JP: bucketCursorsはscanBucketCounts()の結果で、呼び出し後は各バケットの終了位置になる。
+    // EN: bucketCursors is the result of scanBucketCounts(), and becomes the end of each bucket after the call.
+    RT_DEVICE_FUNCTION void scatterBySortKey(const uint32_t* keys, uint32_t numItems,
+                                             uint32_t* bucketCursors, uint32_t* sortedIndices) {
+        uint32_t index = blockDim.x * blockIdx.x + threadIdx.x;
+        if (index >= numItems)
+            return;
+        uint32_t dstIndex = atomicAdd(&bucketCursors[keys[index]], 1u);
+        sortedIndices[dstIndex] = index;
+    }
+
+    // JP: ソート済みの要素をキーごとのダイレクトコーラブルでシェーディングするRay Generationプログラム用のヘルパー。
+    //     要素数分の1次元ローンチで呼ぶ。隣接するスレッドは同じキーを持つので同じコーラブルを呼ぶ。
+    //     コーラブルには元の要素のインデックスが渡される。
+    // EN: Helper for a ray generation program to shade sorted elements with a direct callable per key.
+    //     Call in a 1D launch of the number of elements.
+    //     Adjacent threads have the same key and therefore call the same callable.
+    //     The callable receives the index of the original element.
+    RT_DEVICE_FUNCTION void dispatchSortedShading(
+        const uint32_t* keys, const uint32_t* sortedIndices, uint32_t numItems,
+        const DirectCallableProgramID<void(uint32_t)>* callablesPerKey) {
+        uint32_t index = optixGetLaunchIndex().x;
+        if (index >= numItems)
+            return;
+        uint32_t itemIndex = sortedIndices[index];
+        callablesPerKey[keys[itemIndex]](itemIndex);
+    }
+#endif
+
+
+
+    // JP: アルファテクスチャーから事前に求めた三角形ごとの不透明度の状態。
+    //     Any-Hitプログラムでテクスチャーをフェッチする前に参照し、Unknownの場合のみテクスチャーを調べる。
+    // EN: Per-triangle opacity state precomputed from an alpha texture.
+    //     Look this up before fetching the texture in an any-hit program, and test the texture only for Unknown.
+    enum class OpacityState : uint32_t {
+        Transparent = 0,
+        Opaque,
+        Unknown
+    };
+
+    // JP: 三角形ごとに2ビットで不透明度の状態を保持するビットマスク。
+    // EN: Bitmask holding an opacity state with 2 bits per triangle.
+    class OpacityStateMap {
+        uint32_t* m_bits;
+        uint32_t m_numTriangles;
+
+    public:
+        static constexpr uint32_t calcNumDwords(uint32_t numTriangles) {
+            return (numTriangles + 15) / 16;
+        }
+
+        RT_DEVICE_FUNCTION OpacityStateMap() : m_bits(nullptr), m_numTriangles(0) {}
+        RT_DEVICE_FUNCTION OpacityStateMap(uint32_t* bits, uint32_t numTriangles) :
+            m_bits(bits), m_numTriangles(numTriangles) {}
+
+        RT_DEVICE_FUNCTION uint32_t getNumTriangles() const {
+            return m_numTriangles;
+        }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION OpacityState get(uint32_t triIdx) const {
+            optixuAssert(triIdx < m_numTriangles, "Out of bounds: %u", triIdx);
+            return static_cast<OpacityState>((m_bits[triIdx / 16] >> (2 * (triIdx % 16))) & 0b11);
+        }
+        // JP: 事前にゼロクリア(全てTransparent)されたビットマスクに対して状態を書き込む。
+        // EN: Write a state to a bitmask cleared to zero (all Transparent) beforehand.
+        RT_DEVICE_FUNCTION void set(uint32_t triIdx, OpacityState state) const {
+            optixuAssert(triIdx < m_numTriangles, "Out of bounds: %u", triIdx);
+            atomicOr(&m_bits[triIdx / 16], static_cast<uint32_t>(state) << (2 * (triIdx % 16)));
+        }
+#endif
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 三角形のテクスチャー座標上でアルファ値を格子状にサンプルして不透明度の状態を求める。
+    //     三角形ごとに1スレッドのカーネルから呼び、結果をOpacityStateMap::set()で書き込む想定。
+    //     alphaAt(float2 texCoord)はアルファ値を返す関数。
+    //     サンプル間の細かな模様を見逃さないよう、resolutionはテクスチャー上の三角形のテクセル数程度にする。
+    // EN: Determine the opacity state by sampling alpha values in a grid over the triangle's texture coordinates.
+    //     Intended to be called from a kernel with a thread per triangle, writing the result by OpacityStateMap::set().
+    //     alphaAt(float2 texCoord) is a function returning an alpha value.
+    //     Set resolution around the number of texels the triangle covers so as not to miss details between samples.
+    template <typename AlphaFunc>
+    RT_DEVICE_FUNCTION OpacityState calcTriangleOpacityState(
+        const float2 &tc0, const float2 &tc1, const float2 &tc2, uint32_t resolution,
+        AlphaFunc &&alphaAt, float alphaCutoff = 0.5f) {
+        resolution = max(resolution, 1u);
+        bool hasOpaque = false;
+        bool hasTransparent = false;
+        const float invRes = 1.0f / resolution;
+        for (uint32_t i = 0; i <= resolution; ++i) {
+            for (uint32_t j = 0; j <= resolution - i; ++j) {
+                float b1 = i * invRes;
+                float b2 = j * invRes;
+                float b0 = 1.0f - (b1 + b2);
+                float2 tc = make_float2(b0 * tc0.x + b1 * tc1.x + b2 * tc2.x,
+                                        b0 * tc0.y + b1 * tc1.y + b2 * tc2.y);
+                if (alphaAt(tc) >= alphaCutoff)
+                    hasOpaque = true;
+                else
+                    hasTransparent = true;
+                if (hasOpaque && hasTransparent)
+                    return OpacityState::Unknown;
+            }
+        }
+        return hasOpaque ? OpacityState::Opaque : OpacityState::Transparent;
+    }
+
+    // JP: 確率的透明度用の不透明度の状態。アルファ値が全て1ならOpaque、全て0ならTransparentとなり、
+    //     いかなる閾値に対しても結果が決まる三角形だけがテクスチャーのフェッチを省ける。
+    // EN: Opacity state for stochastic transparency. Opaque if all alpha values are 1 and Transparent if all are 0,
+    //     so only triangles whose result is determined for any threshold can skip texture fetches.
+    template <typename AlphaFunc>
+    RT_DEVICE_FUNCTION OpacityState calcTriangleStochasticOpacityState(
+        const float2 &tc0, const float2 &tc1, const float2 &tc2, uint32_t resolution,
+        AlphaFunc &&alphaAt) {
+        OpacityState fullyOpaque = calcTriangleOpacityState(tc0, tc1, tc2, resolution, alphaAt, 1.0f);
+        if (fullyOpaque == OpacityState::Opaque)
+            return OpacityState::Opaque;
+        auto isVisible = [&alphaAt](const float2 &tc) {
+            return alphaAt(tc) > 0.0f ? 1.0f : 0.0f;
+        };
+        OpacityState partlyVisible = calcTriangleOpacityState(tc0, tc1, tc2, resolution, isVisible, 0.5f);
+        return partlyVisible == OpacityState::Transparent ? OpacityState::Transparent : OpacityState::Unknown;
+    }
+
+    // JP: traceStochasticVisibility()のレイタイプのAny-Hitプログラムから呼ぶ。
+    //     opacityStatesが有効なら先に三角形の状態を見て、Unknownの場合のみalphaAt()でアルファ値を求め、
+    //     ペイロードの閾値との1回の比較で候補を受け入れるか無視する。
+    //     alphaAt()は現在のヒットのアルファ値を返す関数。
+    // EN: Call this from an any-hit program of the ray type for traceStochasticVisibility().
+    //     If opacityStates is valid, look up the triangle's state first, and only for Unknown
+    //     obtain the alpha value by alphaAt(), then accept or ignore the candidate with a single comparison
+    //     against the threshold in the payload.
+    //     alphaAt() is a function returning the alpha value of the current hit.
+    template <typename AlphaFunc>
+    RT_DEVICE_FUNCTION void stochasticTransparencyAnyHit(const OpacityStateMap &opacityStates, AlphaFunc &&alphaAt) {
+        OpacityState state = OpacityState::Unknown;
+        if (opacityStates.getNumTriangles() > 0)
+            state = opacityStates.get(optixGetPrimitiveIndex());
+        if (state == OpacityState::Opaque)
+            return;
+        if (state == OpacityState::Transparent) {
+            optixIgnoreIntersection();
+            return;
+        }
+        float threshold;
+        getPayloads<uint32_t, float>(nullptr, &threshold);
+        if (alphaAt() <= threshold)
+            optixIgnoreIntersection();
+    }
+#endif
+
+
+
+    // JP: 共有ジオメトリプール中の、1つのGeometryInstanceが参照する頂点と三角形の範囲。
+    // EN: Range of vertices and triangles in a shared geometry pool referenced by a geometry instance.
+    struct GeometryPoolRange {
+        uint32_t vertexOffset;
+        uint32_t numVertices;
+        uint32_t triangleOffset;
+        uint32_t numTriangles;
+    };
+
+    // JP: 1つの頂点スラブと三角形スラブを複数のGeometryInstanceで共有するジオメトリプールのデバイス側のビュー。
+    //     三角形のインデックスは範囲の先頭の頂点からの相対値で、GeometryInstanceには範囲の先頭を
+    //     setPrimitiveIndexOffset()で設定するので、optixGetPrimitiveIndex()はプール全体での三角形インデックスになる。
+    // EN: Device-side view of a geometry pool sharing a vertex slab and a triangle slab among geometry instances.
+    //     Triangle indices are relative to the first vertex of the range, and the first triangle of the range is set
+    //     to a geometry instance by setPrimitiveIndexOffset(),
+    //     so optixGetPrimitiveIndex() becomes the triangle index in the whole pool.
+    template <typename VertexType>
+    struct GeometryPool {
+        VertexType* vertices;
+        const uint3* triangles;
+        const GeometryPoolRange* ranges;
+        uint32_t numRanges;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        // JP: primIndexはoptixGetPrimitiveIndex()の値。プール全体での頂点インデックスを返す。
+        // EN: primIndex is the value of optixGetPrimitiveIndex(). Return vertex indices in the whole pool.
+        RT_DEVICE_FUNCTION uint3 getTriangle(uint32_t rangeIndex, uint32_t primIndex) const {
+            optixuAssert(rangeIndex < numRanges, "Out of bounds: %u", rangeIndex);
+            const GeometryPoolRange &range = ranges[rangeIndex];
+            const uint3 &tri = triangles[primIndex];
+            return make_uint3(range.vertexOffset + tri.x,
+                              range.vertexOffset + tri.y,
+                              range.vertexOffset + tri.z);
+        }
+
+        // JP: 範囲のインデックスが分からない場合に、三角形インデックスから範囲を二分探索する。
+        //     範囲は三角形スラブ上で追加順に並んでいる。
+        // EN: Binary search a range from a triangle index when the range index is unknown.
+        //     Ranges are laid out in the order of addition in the triangle slab.
+        RT_DEVICE_FUNCTION uint32_t findRange(uint32_t primIndex) const {
+            uint32_t lo = 0;
+            uint32_t hi = numRanges;
+            while (hi - lo > 1) {
+                uint32_t mid = (lo + hi) / 2;
+                if (ranges[mid].triangleOffset <= primIndex)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+#endif
+    };
+
+
+
+    // JP: デノイザー入力の準備と同時に求める対数輝度の部分和。
+    // EN: Partial sum of log luminance computed alongside preparing denoiser inputs.
+    struct DenoiserInputReduction {
+        float sumLogLuminance;
+        uint32_t numPixels;
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    namespace detail {
+        RT_DEVICE_FUNCTION uint2 encodeHalf4(const float4 &v) {
+            return make_uint2(Half2::encode(make_float2(v.x, v.y)).bits,
+                              Half2::encode(make_float2(v.z, v.w)).bits);
+        }
+    }
+
+    // JP: 蓄積バッファーからデノイザーの入力(OPTIX_PIXEL_FORMAT_HALF4)を1パスで書き出し、
+    //     同時にcomputeIntensity()相当の対数輝度の部分和をreductionに加算する。
+    //     CUDAカーネルの全スレッドから呼ぶ(ワープ単位で集約するため画像外のスレッドも呼ぶ必要がある)。
+    //     AccumBufferTypeはread(uint2)を持つ型(BlockBuffer2D, NativeBlockBuffer2Dなど)。
+    //     albedo, normalが不要な場合は出力にnullptrを渡す。法線は正規化される。
+    //     dstの行ストライドはimageSize.x画素。reductionは事前にゼロクリアしておく。
+    // EN: Write denoiser inputs (OPTIX_PIXEL_FORMAT_HALF4) from accumulation buffers in one pass,
+    //     adding the partial sum of log luminance equivalent to computeIntensity() to reduction at the same time.
+    //     Call from all threads of a CUDA kernel (threads outside the image also need to call this
+    //     since results are aggregated per warp).
+    //     AccumBufferType is a type with read(uint2) (BlockBuffer2D, NativeBlockBuffer2D and so on).
+    //     Pass nullptr for outputs when albedo or normal is unnecessary. Normals get normalized.
+    //     The row stride of dst is imageSize.x pixels. Clear reduction to zero beforehand.
+    template <typename AccumBufferType>
+    RT_DEVICE_FUNCTION void prepareDenoiserInputs(
+        uint2 pixel, uint2 imageSize, float accumScale,
+        const AccumBufferType &colorAccum, const AccumBufferType &albedoAccum, const AccumBufferType &normalAccum,
+        uint2* dstBeauty, uint2* dstAlbedo, uint2* dstNormal,
+        DenoiserInputReduction* reduction) {
+        bool inImage = pixel.x < imageSize.x && pixel.y < imageSize.y;
+        float logLuminance = 0.0f;
+        uint32_t count = 0;
+        if (inImage) {
+            uint32_t linearIndex = pixel.y * imageSize.x + pixel.x;
+            float4 color = colorAccum.read(pixel);
+            color = make_float4(color.x * accumScale, color.y * accumScale, color.z * accumScale, color.w);
+            dstBeauty[linearIndex] = detail::encodeHalf4(color);
+            if (dstAlbedo) {
+                float4 albedo = albedoAccum.read(pixel);
+                albedo = make_float4(albedo.x * accumScale, albedo.y * accumScale, albedo.z * accumScale, 1.0f);
+                dstAlbedo[linearIndex] = detail::encodeHalf4(albedo);
+            }
+            if (dstNormal) {
+                float4 normal = normalAccum.read(pixel);
+                float sqLength = normal.x * normal.x + normal.y * normal.y + normal.z * normal.z;
+                float invLength = sqLength > 0.0f ? rsqrtf(sqLength) : 0.0f;
+                dstNormal[linearIndex] = detail::encodeHalf4(
+                    make_float4(normal.x * invLength, normal.y * invLength, normal.z * invLength, 1.0f));
+            }
+
+            float luminance = 0.212671f * color.x + 0.715160f * color.y + 0.072169f * color.z;
+            if (luminance > 1e-8f) {
+                logLuminance = logf(luminance);
+                count = 1;
+            }
+        }
+
+        for (uint32_t offset = 16; offset > 0; offset >>= 1) {
+            logLuminance += __shfl_down_sync(0xFFFFFFFF, logLuminance, offset);
+            count += __shfl_down_sync(0xFFFFFFFF, count, offset);
+        }
+        if ((threadIdx.x + threadIdx.y * blockDim.x + threadIdx.z * blockDim.x * blockDim.y) % 32 == 0 && count > 0) {
+            atomicAdd(&reduction->sumLogLuminance, logLuminance);
+            atomicAdd(&reduction->numPixels, count);
+        }
+    }
+
+    // JP: prepareDenoiserInputs()の集約結果からinvoke()に渡すHDR強度を求める。1スレッドから呼ぶ。
+    // EN: Compute the HDR intensity to pass to invoke() from the result aggregated by prepareDenoiserInputs().
+    //     Call from a single thread.
+    RT_DEVICE_FUNCTION void finalizeDenoiserIntensity(const DenoiserInputReduction* reduction, float* hdrIntensity) {
+        *hdrIntensity = reduction->numPixels > 0 ?
+            0.18f / expf(reduction->sumLogLuminance / reduction->numPixels) :
+            1.0f;
+    }
+#endif
+
+
+
+    // JP: デバイスログの固定長のレコード。書式はホスト側で書式IDから引く。
+    //     引数は32ビットのビット列として保持され、書式の変換指定子に従って解釈される。
+    // EN: Fixed-size record of the device log. The format is looked up from the format ID on the host.
+    //     Arguments are held as 32-bit bit patterns and interpreted according to the conversion specifiers.
+    struct DeviceLogRecord {
+        static constexpr uint32_t MaxNumArgs = 5;
+
+        uint32_t formatID;
+        uint32_t line;
+        uint32_t numArgs : 8;
+        uint32_t isAssertFailure : 1;
+        uint32_t args[MaxNumArgs];
+    };
+
+    namespace detail {
+        RT_DEVICE_FUNCTION uint32_t toDeviceLogArg(uint32_t v) {
+            return v;
+        }
+        RT_DEVICE_FUNCTION uint32_t toDeviceLogArg(int32_t v) {
+            return static_cast<uint32_t>(v);
+        }
+        RT_DEVICE_FUNCTION uint32_t toDeviceLogArg(bool v) {
+            return v ? 1 : 0;
+        }
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        RT_DEVICE_FUNCTION uint32_t toDeviceLogArg(float v) {
+            return __float_as_uint(v);
+        }
+#endif
+    }
+
+    // JP: printfの代わりに使う軽量なデバイスログ。
+    //     レコードをアトミックにリングバッファーに書き込み、ホストがローンチ後にまとめてデコードする。
+    //     容量を超えると古いレコードから上書きされる。
+    // EN: Lightweight device log to use instead of printf.
+    //     Records are written atomically to a ring buffer, and the host decodes them together after the launch.
+    //     Older records are overwritten once the capacity is exceeded.
+    class DeviceLogger {
+        DeviceLogRecord* m_records;
+        uint32_t* m_counters; // [0]: number of records, [1]: number of assert failures
+        uint32_t m_capacity;
+
+    public:
+        RT_DEVICE_FUNCTION DeviceLogger() : m_records(nullptr), m_counters(nullptr), m_capacity(0) {}
+        RT_DEVICE_FUNCTION DeviceLogger(DeviceLogRecord* records, uint32_t* counters, uint32_t capacity) :
+            m_records(records), m_counters(counters), m_capacity(capacity) {}
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+        template <typename... ArgTypes>
+        RT_DEVICE_FUNCTION void record(uint32_t formatID, uint32_t line, const ArgTypes &... args) const {
+            static_assert(sizeof...(ArgTypes) <= DeviceLogRecord::MaxNumArgs, "Too many arguments.");
+            if (m_capacity == 0)
+                return;
+            DeviceLogRecord rec;
+            rec.formatID = formatID;
+            rec.line = line;
+            rec.numArgs = sizeof...(ArgTypes);
+            rec.isAssertFailure = false;
+            uint32_t argIdx = 0;
+            ((rec.args[argIdx++] = detail::toDeviceLogArg(args)), ...);
+            uint32_t index = atomicAdd(&m_counters[0], 1u);
+            m_records[index % m_capacity] = rec;
+        }
+
+        // JP: アサーションの失敗を記録する。2^log2SampleInterval回の失敗ごとに1回だけレコードを書き込むので、
+        //     頻繁に失敗するアサーションでもログとタイミングを乱さない。失敗の総数は常に数えられる。
+        // EN: Record an assertion failure. A record is written only once every 2^log2SampleInterval failures,
+        //     so even a frequently failing assertion doesn't flood the log and perturb timing.
+        //     The total number of failures is always counted.
+        template <typename... ArgTypes>
+        RT_DEVICE_FUNCTION void recordAssertFailure(
+            uint32_t log2SampleInterval, uint32_t formatID, uint32_t line, const ArgTypes &... args) const {
+            static_assert(sizeof...(ArgTypes) <= DeviceLogRecord::MaxNumArgs, "Too many arguments.");
+            if (m_capacity == 0)
+                return;
+            uint32_t failureIndex = atomicAdd(&m_counters[1], 1u);
+            // JP: 32ビット以上のシフトは未定義なので、その場合は最初の失敗のみを記録する。
+            // EN: A shift by 32 bits or more is undefined, so record only the first failure in that case.
+            uint32_t sampleMask = log2SampleInterval >= 32 ? 0xFFFFFFFF : (1u << log2SampleInterval) - 1;
+            if (failureIndex & sampleMask)
+                return;
+            DeviceLogRecord rec;
+            rec.formatID = formatID;
+            rec.line = line;
+            rec.numArgs = sizeof...(ArgTypes);
+            rec.isAssertFailure = true;
+            uint32_t argIdx = 0;
+            ((rec.args[argIdx++] = detail::toDeviceLogArg(args)), ...);
+            uint32_t index = atomicAdd(&m_counters[0], 1u);
+            m_records[index % m_capacity] = rec;
         }
 #endif
     };
 
+#if !defined(OPTIXU_DISABLE_DEVICE_LOG)
+#   define optixuLog(logger, formatID, ...) \
+        (logger).record(formatID, __LINE__, ##__VA_ARGS__)
+#   define optixuLogAssert(logger, expr, formatID, ...) \
+        do { \
+            if (!(expr)) \
+                (logger).recordAssertFailure(0, formatID, __LINE__, ##__VA_ARGS__); \
+        } while (0)
+#   define optixuLogAssertSampled(logger, expr, log2SampleInterval, formatID, ...) \
+        do { \
+            if (!(expr)) \
+                (logger).recordAssertFailure(log2SampleInterval, formatID, __LINE__, ##__VA_ARGS__); \
+        } while (0)
+#else
+#   define optixuLog(logger, formatID, ...)
+#   define optixuLogAssert(logger, expr, formatID, ...)
+#   define optixuLogAssertSampled(logger, expr, log2SampleInterval, formatID, ...)
+#endif
+
 #if !defined(__CUDA_ARCH__)
-    template <typename T, uint32_t log2BlockWidth>
+    // JP: getRemappedLaunchIndex()と組み合わせて使う1次元のローンチ。
+    // EN: 1D launch used in combination with getRemappedLaunchIndex().
+    template <uint32_t log2BlockWidth>
+    inline void launchWithRemappedIndices(const Pipeline &pipeline, CUstream stream, CUdeviceptr plpOnDevice,
+                                          uint32_t width, uint32_t height) {
+        uint32_t launchSize = calcRemappedLaunchSize<log2BlockWidth>(width, height);
+        if (launchSize == 0)
+            return;
+        pipeline.launch(stream, plpOnDevice, launchSize, 1, 1);
+    }
+
+    template <typename T, uint32_t log2BlockWidth, typename Layout = RowMajorBlockLayout>
     class HostBlockBuffer2D {
         cudau::TypedBuffer<T> m_rawBuffer;
         uint32_t m_width;
@@ -229,7 +1276,7 @@ namespace optixu {
             uint32_t blockOffset = (blockIdxY * m_numXBlocks + blockIdxX) * (blockWidth * blockWidth);
             uint32_t idxXInBlock = x & mask;
             uint32_t idxYInBlock = y & mask;
-            uint32_t linearIndexInBlock = idxYInBlock * blockWidth + idxXInBlock;
+            uint32_t linearIndexInBlock = Layout::template calcIndexInBlock<log2BlockWidth>(idxXInBlock, idxYInBlock);
             return blockOffset + linearIndexInBlock;
         }
 
@@ -338,18 +1385,2175 @@ namespace optixu {
             return m_mappedPointer[calcLinearIndex(x, y)];
         }
 
-        BlockBuffer2D<T, log2BlockWidth> getBlockBuffer2D() const {
-            return BlockBuffer2D<T, log2BlockWidth>(m_rawBuffer.getDevicePointer(), m_width, m_height);
+        // JP: ブロックレイアウトのままの内容をホストメモリーに非同期に読み出す。
+        //     dstRawにはgetNumRawElements()個の要素分の領域が必要。ピン留めメモリーであれば真に非同期になる。
+        // EN: Asynchronously read the contents in the block layout as is to host memory.
+        //     dstRaw requires space for getNumRawElements() elements. Truly asynchronous when it is pinned memory.
+        uint32_t getNumRawElements() const {
+            return m_rawBuffer.numElements();
+        }
+        void readRawAsync(T* dstRaw, CUstream stream) const {
+            m_rawBuffer.read(dstRaw, m_rawBuffer.numElements(), stream);
         }
-    };
-#endif // !defined(__CUDA_ARCH__)
-}
-
-#if !defined(__CUDA_ARCH__)
 
-template <>
-cudau::Buffer::operator optixu::BufferView() const {
-    return optixu::BufferView(getCUdeviceptr(), numElements(), stride());
+        // JP: readRawAsync()で読み出した内容の[yBegin, yEnd)行を線形レイアウトに並べ替える。
+        //     行範囲ごとに独立しているので複数スレッドから呼んでも良い。
+        // EN: Rearrange rows [yBegin, yEnd) of contents read by readRawAsync() into linear layout.
+        //     Row ranges are independent, so this can be called from multiple threads.
+        void deswizzleRows(const T* srcRaw, T* dstLinear, uint32_t yBegin, uint32_t yEnd) const {
+            constexpr uint32_t blockWidth = 1 << log2BlockWidth;
+            yEnd = std::min(yEnd, m_height);
+            for (uint32_t y = yBegin; y < yEnd; ++y) {
+                T* dstRow = dstLinear + static_cast<size_t>(y) * m_width;
+                if constexpr (std::is_same_v<Layout, RowMajorBlockLayout>) {
+                    // JP: 行優先レイアウトではブロック内の各行が連続しているのでまとめてコピーする。
+                    // EN: Each row within a block is contiguous in row-major layout, so copy it at once.
+                    for (uint32_t x = 0; x < m_width; x += blockWidth) {
+                        uint32_t numElems = std::min(blockWidth, m_width - x);
+                        std::copy_n(srcRaw + calcLinearIndex(x, y), numElems, dstRow + x);
+                    }
+                }
+                else {
+                    for (uint32_t x = 0; x < m_width; ++x)
+                        dstRow[x] = srcRaw[calcLinearIndex(x, y)];
+                }
+            }
+        }
+
+        BlockBuffer2D<T, log2BlockWidth, Layout> getBlockBuffer2D() const {
+            return BlockBuffer2D<T, log2BlockWidth, Layout>(m_rawBuffer.getDevicePointer(), m_width, m_height);
+        }
+    };
+
+
+
+    // JP: ブロック幅を実行時に選ぶHostBlockBuffer2D。要素の並びは同じ幅のHostBlockBuffer2Dと同じ。
+    // EN: HostBlockBuffer2D with the block width chosen at runtime.
+    //     The element arrangement is the same as HostBlockBuffer2D with the same width.
+    template <typename T, typename Layout = RowMajorBlockLayout>
+    class HostDynamicBlockBuffer2D {
+        cudau::TypedBuffer<T> m_rawBuffer;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_log2BlockWidth;
+
+    public:
+        HostDynamicBlockBuffer2D() : m_width(0), m_height(0), m_log2BlockWidth(0) {}
+
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t log2BlockWidth,
+                        uint32_t width, uint32_t height) {
+            if (log2BlockWidth > 8)
+                throw std::runtime_error("Block width is too large.");
+            m_width = width;
+            m_height = height;
+            m_log2BlockWidth = log2BlockWidth;
+            const uint32_t blockWidth = 1 << log2BlockWidth;
+            const uint32_t mask = blockWidth - 1;
+            const uint32_t numXBlocks = ((width + mask) & ~mask) >> log2BlockWidth;
+            const uint32_t numYBlocks = ((height + mask) & ~mask) >> log2BlockWidth;
+            m_rawBuffer.initialize(context, type, numYBlocks * numXBlocks * blockWidth * blockWidth);
+        }
+        void finalize() {
+            m_rawBuffer.finalize();
+        }
+
+        // JP: 内容は保持されない。
+        // EN: Contents are not preserved.
+        void resize(uint32_t width, uint32_t height) {
+            if (!m_rawBuffer.isInitialized())
+                throw std::runtime_error("Buffer is not initialized.");
+            if (m_width == width && m_height == height)
+                return;
+            const CUcontext context = m_rawBuffer.getCUcontext();
+            const cudau::BufferType type = m_rawBuffer.getBufferType();
+            m_rawBuffer.finalize();
+            initialize(context, type, m_log2BlockWidth, width, height);
+        }
+
+        uint32_t getWidth() const {
+            return m_width;
+        }
+        uint32_t getHeight() const {
+            return m_height;
+        }
+        uint32_t getLog2BlockWidth() const {
+            return m_log2BlockWidth;
+        }
+        CUdeviceptr getCUdeviceptr() const {
+            return m_rawBuffer.getCUdeviceptr();
+        }
+        bool isInitialized() const {
+            return m_rawBuffer.isInitialized();
+        }
+
+        DynamicBlockBuffer2D<T, Layout> getBlockBuffer2D() const {
+            return DynamicBlockBuffer2D<T, Layout>(m_rawBuffer.getDevicePointer(), m_width, m_height,
+                                                   m_log2BlockWidth);
+        }
+    };
+
+    // JP: 候補のブロック幅それぞれについてenqueueWorkload(log2BlockWidth, stream)が積む処理の時間を計測し、
+    //     最も速い幅を返す。起動時のマイクロベンチマークとして使う。最初の1回はウォームアップとして計測しない。
+    //     幅ごとのモジュール(束縛値)やカーネルはenqueueWorkloadの中で選ぶ。
+    // EN: Measure the time of work enqueued by enqueueWorkload(log2BlockWidth, stream) for each candidate
+    //     block width and return the fastest width. Use this as a microbenchmark at startup.
+    //     The first run is a warm-up and not measured.
+    //     Choose the module (bound values) or kernel per width inside enqueueWorkload.
+    template <typename EnqueueWorkload>
+    uint32_t selectFastestLog2BlockWidth(
+        CUcontext context, CUstream stream,
+        const uint32_t* log2BlockWidthCandidates, uint32_t numCandidates,
+        uint32_t numIterations, EnqueueWorkload &&enqueueWorkload,
+        float* fastestTimeInMs = nullptr) {
+        if (numCandidates == 0)
+            throw std::runtime_error("No block width candidates.");
+        cudau::Timer timer;
+        timer.initialize(context);
+        uint32_t fastestLog2BlockWidth = log2BlockWidthCandidates[0];
+        float fastestTime = INFINITY;
+        for (uint32_t i = 0; i < numCandidates; ++i) {
+            const uint32_t log2BlockWidth = log2BlockWidthCandidates[i];
+            enqueueWorkload(log2BlockWidth, stream);
+            timer.start(stream);
+            for (uint32_t iter = 0; iter < std::max(numIterations, 1u); ++iter)
+                enqueueWorkload(log2BlockWidth, stream);
+            timer.stop(stream);
+            const float time = timer.report();
+            if (time < fastestTime) {
+                fastestTime = time;
+                fastestLog2BlockWidth = log2BlockWidth;
+            }
+        }
+        timer.finalize();
+        if (fastestTimeInMs)
+            *fastestTimeInMs = fastestTime;
+        return fastestLog2BlockWidth;
+    }
+
+
+
+    template <typename T, uint32_t log2BlockWidth, typename Layout = RowMajorBlockLayout>
+    class HostBlockBuffer3D {
+        cudau::TypedBuffer<T> m_rawBuffer;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_depth;
+        uint32_t m_numXBlocks;
+        uint32_t m_numYBlocks;
+        T* m_mappedPointer;
+
+        constexpr uint32_t calcLinearIndex(uint32_t x, uint32_t y, uint32_t z) const {
+            constexpr uint32_t blockWidth = 1 << log2BlockWidth;
+            constexpr uint32_t mask = blockWidth - 1;
+            uint32_t blockOffset =
+                (((z >> log2BlockWidth) * m_numYBlocks + (y >> log2BlockWidth)) * m_numXBlocks + (x >> log2BlockWidth)) *
+                (blockWidth * blockWidth * blockWidth);
+            uint32_t linearIndexInBlock = Layout::template calcIndexInBlock<log2BlockWidth>(x & mask, y & mask, z & mask);
+            return blockOffset + linearIndexInBlock;
+        }
+
+    public:
+        HostBlockBuffer3D() : m_mappedPointer(nullptr) {}
+
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t width, uint32_t height, uint32_t depth) {
+            m_width = width;
+            m_height = height;
+            m_depth = depth;
+            constexpr uint32_t blockWidth = 1 << log2BlockWidth;
+            constexpr uint32_t mask = blockWidth - 1;
+            m_numXBlocks = ((width + mask) & ~mask) >> log2BlockWidth;
+            m_numYBlocks = ((height + mask) & ~mask) >> log2BlockWidth;
+            uint32_t numZBlocks = ((depth + mask) & ~mask) >> log2BlockWidth;
+            uint32_t numElements = numZBlocks * m_numYBlocks * m_numXBlocks * blockWidth * blockWidth * blockWidth;
+            m_rawBuffer.initialize(context, type, numElements);
+        }
+        void finalize() {
+            m_rawBuffer.finalize();
+        }
+
+        uint32_t getWidth() const {
+            return m_width;
+        }
+        uint32_t getHeight() const {
+            return m_height;
+        }
+        uint32_t getDepth() const {
+            return m_depth;
+        }
+        CUdeviceptr getCUdeviceptr() const {
+            return m_rawBuffer.getCUdeviceptr();
+        }
+        bool isInitialized() const {
+            return m_rawBuffer.isInitialized();
+        }
+
+        void map() {
+            m_mappedPointer = reinterpret_cast<T*>(m_rawBuffer.map());
+        }
+        void unmap() {
+            m_rawBuffer.unmap();
+            m_mappedPointer = nullptr;
+        }
+        const T &operator()(uint32_t x, uint32_t y, uint32_t z) const {
+            return m_mappedPointer[calcLinearIndex(x, y, z)];
+        }
+        T &operator()(uint32_t x, uint32_t y, uint32_t z) {
+            return m_mappedPointer[calcLinearIndex(x, y, z)];
+        }
+
+        BlockBuffer3D<T, log2BlockWidth, Layout> getBlockBuffer3D() const {
+            return BlockBuffer3D<T, log2BlockWidth, Layout>(m_rawBuffer.getDevicePointer(), m_width, m_height, m_depth);
+        }
+    };
+
+
+
+    // JP: AccumulationBuffer2Dの色と分散のブロックバッファーを保持するホスト側のクラス。
+    // EN: Host-side class holding the color and variance block buffers of AccumulationBuffer2D.
+    template <AccumulationFormat format, uint32_t log2BlockWidth = 1, typename Layout = RowMajorBlockLayout>
+    class HostAccumulationBuffer2D {
+        using ElementTypes = detail::AccumulationElementTypes<format>;
+        HostBlockBuffer2D<typename ElementTypes::Color, log2BlockWidth, Layout> m_colorBuffer;
+        HostBlockBuffer2D<typename ElementTypes::Variance, log2BlockWidth, Layout> m_varianceBuffer;
+
+    public:
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t width, uint32_t height) {
+            m_colorBuffer.initialize(context, type, width, height);
+            m_varianceBuffer.initialize(context, type, width, height);
+        }
+        void finalize() {
+            m_varianceBuffer.finalize();
+            m_colorBuffer.finalize();
+        }
+
+        // JP: 累積の内容は保たれないので、リサイズ後の最初のサンプルはresetを真にしてaccumulate()する。
+        // EN: The accumulated contents are not kept,
+        //     so accumulate() the first sample after resizing with reset true.
+        void resize(uint32_t width, uint32_t height) {
+            if (!m_colorBuffer.isInitialized())
+                throw std::runtime_error("Buffer is not initialized.");
+            if (width == getWidth() && height == getHeight())
+                return;
+            CUcontext context = m_colorBuffer.getCUcontext();
+            cudau::BufferType type = m_colorBuffer.getBufferType();
+            finalize();
+            initialize(context, type, width, height);
+        }
+
+        uint32_t getWidth() const {
+            return m_colorBuffer.getWidth();
+        }
+        uint32_t getHeight() const {
+            return m_colorBuffer.getHeight();
+        }
+        bool isInitialized() const {
+            return m_colorBuffer.isInitialized();
+        }
+        // JP: 1画素あたりのバイト数(ブロックの端数を除く)。
+        // EN: Bytes per pixel (excluding block padding).
+        static constexpr size_t getNumBytesPerPixel() {
+            return sizeof(typename ElementTypes::Color) + sizeof(typename ElementTypes::Variance);
+        }
+
+        AccumulationBuffer2D<format, log2BlockWidth, Layout> getAccumulationBuffer2D() const {
+            return AccumulationBuffer2D<format, log2BlockWidth, Layout>(
+                reinterpret_cast<typename ElementTypes::Color*>(m_colorBuffer.getCUdeviceptr()),
+                reinterpret_cast<typename ElementTypes::Variance*>(m_varianceBuffer.getCUdeviceptr()),
+                getWidth(), getHeight());
+        }
+    };
+
+
+
+    template <typename T>
+    class HostWorkQueue {
+        cudau::TypedBuffer<T> m_items;
+        cudau::TypedBuffer<uint32_t> m_counter;
+
+    public:
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t capacity) {
+            m_items.initialize(context, type, capacity);
+            m_counter.initialize(context, type, 1, 0u);
+        }
+        void finalize() {
+            m_counter.finalize();
+            m_items.finalize();
+        }
+        bool isInitialized() const {
+            return m_items.isInitialized();
+        }
+
+        uint32_t getCapacity() const {
+            return m_items.numElements();
+        }
+        // JP: 次の追加に備えてカウンターをゼロにする。
+        // EN: Reset the counter to zero for the next appends.
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_counter.getCUdeviceptr(), 0, 1, stream));
+        }
+        // JP: 追加された要素数をホストに読み戻す。ストリームの同期を伴う。
+        //     容量を超えて追加しようとした要素も数に含まれる。
+        // EN: Read back the number of appended elements to the host. This involves stream synchronization.
+        //     Elements attempted to be appended beyond the capacity are also counted.
+        uint32_t readNumAppends(CUstream stream) const {
+            uint32_t count;
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(&count, m_counter.getCUdeviceptr(), sizeof(uint32_t), stream));
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            return count;
+        }
+
+        const cudau::TypedBuffer<T> &getItemBuffer() const {
+            return m_items;
+        }
+        CUdeviceptr getCounterAddress() const {
+            return m_counter.getCUdeviceptr();
+        }
+
+        WorkQueue<T> getWorkQueue() const {
+            return WorkQueue<T>(m_items.getDevicePointer(), m_counter.getDevicePointer(), m_items.numElements());
+        }
+    };
+
+
+
+    class HostOpacityStateMap {
+        cudau::TypedBuffer<uint32_t> m_bits;
+        uint32_t m_numTriangles;
+
+    public:
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t numTriangles) {
+            m_numTriangles = numTriangles;
+            m_bits.initialize(context, type, OpacityStateMap::calcNumDwords(numTriangles), 0u);
+        }
+        void finalize() {
+            m_bits.finalize();
+        }
+        bool isInitialized() const {
+            return m_bits.isInitialized();
+        }
+
+        uint32_t getNumTriangles() const {
+            return m_numTriangles;
+        }
+        // JP: 状態を全てTransparentに戻す。ベイクの前に呼ぶ。
+        // EN: Reset all the states to Transparent. Call this before baking.
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_bits.getCUdeviceptr(), 0, m_bits.numElements(), stream));
+        }
+
+        // JP: 状態をホストに読み戻す。ストリームの同期を伴う。
+        // EN: Read back the states to the host. This involves stream synchronization.
+        void readback(std::vector<OpacityState> &states, CUstream stream) const {
+            std::vector<uint32_t> bits(m_bits.numElements());
+            m_bits.read(bits.data(), m_bits.numElements(), stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            states.resize(m_numTriangles);
+            for (uint32_t triIdx = 0; triIdx < m_numTriangles; ++triIdx)
+                states[triIdx] = static_cast<OpacityState>((bits[triIdx / 16] >> (2 * (triIdx % 16))) & 0b11);
+        }
+
+        // JP: マテリアルに属する三角形が全てOpaqueであればそのマテリアルのジオメトリフラグに
+        //     OPTIX_GEOMETRY_FLAG_DISABLE_ANYHITを立て、そうでなければ下ろす。
+        //     materialIndicesは三角形ごとのマテリアルインデックス。nullptrの場合は全てマテリアル0とみなす。
+        //     フラグを変更した場合は所属するGASのmarkDirty()を呼ぶ必要がある。変更したかどうかを返す。
+        // EN: Set OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT in the geometry flags of a material
+        //     if all the triangles belonging to the material are Opaque, otherwise clear it.
+        //     materialIndices is the material index per triangle. nullptr means all are material 0.
+        //     Calling markDirty() of the GAS is required when the flags change. Returns whether anything changed.
+        bool updateGeometryFlags(const GeometryInstance &geomInst, CUstream stream,
+                                 const uint32_t* materialIndices = nullptr) const {
+            std::vector<OpacityState> states;
+            readback(states, stream);
+            const uint32_t numMaterials = geomInst.getNumMaterials();
+            std::vector<uint8_t> allOpaque(numMaterials, 1);
+            for (uint32_t triIdx = 0; triIdx < m_numTriangles; ++triIdx) {
+                uint32_t matIdx = materialIndices ? materialIndices[triIdx] : 0;
+                if (matIdx < numMaterials && states[triIdx] != OpacityState::Opaque)
+                    allOpaque[matIdx] = 0;
+            }
+            bool changed = false;
+            for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
+                OptixGeometryFlags flags = geomInst.getGeometryFlags(matIdx);
+                OptixGeometryFlags newFlags = allOpaque[matIdx] ?
+                    (flags | OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT) :
+                    (flags & ~OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
+                if (newFlags != flags) {
+                    geomInst.setGeometryFlags(matIdx, newFlags);
+                    changed = true;
+                }
+            }
+            return changed;
+        }
+
+        OpacityStateMap getOpacityStateMap() const {
+            return OpacityStateMap(m_bits.getDevicePointer(), m_numTriangles);
+        }
+    };
+
+
+
+    // JP: 大きなメッシュを分割した複数のGeometryInstanceが1つの頂点スラブと三角形スラブを共有するためのプール。
+    //     各GeometryInstanceはスラブの部分範囲をBufferViewとして参照するので、
+    //     頂点のアップロードや変形はメッシュごとに一度で済む。
+    //     デバイス側ではGASのSBTインデックス(optixGetSbtGASIndex())から範囲への表を使って範囲を特定する。
+    //
+    //     optixu::HostGeometryPool<Vertex> pool;
+    //     pool.initialize(cuContext, cudau::BufferType::Device, maxNumVertices, maxNumTriangles);
+    //     uint32_t rangeIdx = pool.addRange(stream, vertices, numVertices, triangles, numTriangles);
+    //     pool.setupGeometryInstance(geomInst, rangeIdx);
+    //     pool.uploadRanges(stream);
+    //     pool.getSbtGasIndexToRangeTable(gas, &table); // 表をアップロードしてGASのユーザーデータなどに置く
+    //
+    // EN: Pool to share a vertex slab and a triangle slab among geometry instances split from a large mesh.
+    //     Each geometry instance refers to sub-ranges of the slabs as BufferViews,
+    //     so uploading or deforming vertices is done once per mesh.
+    //     On the device side, identify the range using a table from the SBT index in the GAS (optixGetSbtGASIndex())
+    //     to the range.
+    //
+    //     optixu::HostGeometryPool<Vertex> pool;
+    //     pool.initialize(cuContext, cudau::BufferType::Device, maxNumVertices, maxNumTriangles);
+    //     uint32_t rangeIdx = pool.addRange(stream, vertices, numVertices, triangles, numTriangles);
+    //     pool.setupGeometryInstance(geomInst, rangeIdx);
+    //     pool.uploadRanges(stream);
+    //     pool.getSbtGasIndexToRangeTable(gas, &table); // Upload the table and place it e.g. in the GAS user data.
+    template <typename VertexType>
+    class HostGeometryPool {
+        cudau::TypedBuffer<VertexType> m_vertices;
+        cudau::TypedBuffer<uint3> m_triangles;
+        cudau::TypedBuffer<GeometryPoolRange> m_ranges;
+        std::vector<GeometryPoolRange> m_rangesOnHost;
+        std::map<GeometryInstance, uint32_t> m_geomInstRanges;
+        uint32_t m_numVertices;
+        uint32_t m_numTriangles;
+
+    public:
+        HostGeometryPool() : m_numVertices(0), m_numTriangles(0) {}
+
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t maxNumVertices, uint32_t maxNumTriangles,
+                        uint32_t maxNumRanges = 1024) {
+            m_vertices.initialize(context, type, maxNumVertices);
+            m_triangles.initialize(context, type, maxNumTriangles);
+            m_ranges.initialize(context, type, std::max(maxNumRanges, 1u));
+            m_rangesOnHost.clear();
+            m_geomInstRanges.clear();
+            m_numVertices = 0;
+            m_numTriangles = 0;
+        }
+        void finalize() {
+            m_geomInstRanges.clear();
+            m_rangesOnHost.clear();
+            m_ranges.finalize();
+            m_triangles.finalize();
+            m_vertices.finalize();
+        }
+        bool isInitialized() const {
+            return m_vertices.isInitialized();
+        }
+
+        // JP: 頂点と(範囲の先頭の頂点からの相対インデックスの)三角形をスラブの末尾に書き込み、範囲のインデックスを返す。
+        //     書き込みはストリーム上で非同期に行われる。
+        // EN: Write vertices and triangles (with indices relative to the first vertex of the range) to the tail
+        //     of the slabs, then return the range index. Writing is done asynchronously on the stream.
+        uint32_t addRange(CUstream stream,
+                          const VertexType* vertices, uint32_t numVertices,
+                          const uint3* triangles, uint32_t numTriangles) {
+            if (m_numVertices + numVertices > m_vertices.numElements() ||
+                m_numTriangles + numTriangles > m_triangles.numElements() ||
+                m_rangesOnHost.size() >= m_ranges.numElements())
+                throw std::runtime_error("Geometry pool capacity exceeded.");
+
+            GeometryPoolRange range;
+            range.vertexOffset = m_numVertices;
+            range.numVertices = numVertices;
+            range.triangleOffset = m_numTriangles;
+            range.numTriangles = numTriangles;
+            if (numVertices > 0)
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(
+                    m_vertices.getCUdeviceptr() + sizeof(VertexType) * range.vertexOffset,
+                    vertices, sizeof(VertexType) * numVertices, stream));
+            if (numTriangles > 0)
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(
+                    m_triangles.getCUdeviceptr() + sizeof(uint3) * range.triangleOffset,
+                    triangles, sizeof(uint3) * numTriangles, stream));
+            m_numVertices += numVertices;
+            m_numTriangles += numTriangles;
+            m_rangesOnHost.push_back(range);
+            return static_cast<uint32_t>(m_rangesOnHost.size() - 1);
+        }
+
+        uint32_t getNumRanges() const {
+            return static_cast<uint32_t>(m_rangesOnHost.size());
+        }
+        const GeometryPoolRange &getRange(uint32_t rangeIndex) const {
+            return m_rangesOnHost.at(rangeIndex);
+        }
+
+        // JP: GeometryInstanceに範囲の頂点と三角形の部分範囲とプリミティブインデックスのオフセットを設定する。
+        //     頂点の型の先頭はfloat3の位置である必要がある。
+        // EN: Set sub-ranges of vertices and triangles of the range and the primitive index offset
+        //     to a geometry instance. The vertex type needs to start with a float3 position.
+        void setupGeometryInstance(const GeometryInstance &geomInst, uint32_t rangeIndex) {
+            const GeometryPoolRange &range = m_rangesOnHost.at(rangeIndex);
+            geomInst.setVertexBuffer(BufferView(
+                m_vertices.getCUdeviceptr() + sizeof(VertexType) * range.vertexOffset,
+                range.numVertices, sizeof(VertexType)));
+            geomInst.setTriangleBuffer(BufferView(
+                m_triangles.getCUdeviceptr() + sizeof(uint3) * range.triangleOffset,
+                range.numTriangles, sizeof(uint3)));
+            geomInst.setPrimitiveIndexOffset(range.triangleOffset);
+            m_geomInstRanges[geomInst] = rangeIndex;
+        }
+
+        // JP: 範囲の表をデバイスに転送する。addRange()の後、ローンチの前に呼ぶ。
+        // EN: Transfer the range table to the device. Call this after addRange() and before launches.
+        void uploadRanges(CUstream stream) const {
+            if (!m_rangesOnHost.empty())
+                m_ranges.write(m_rangesOnHost.data(), static_cast<uint32_t>(m_rangesOnHost.size()), stream);
+        }
+
+        // JP: GASのSBTインデックス(optixGetSbtGASIndex())から範囲のインデックスへの表を作る。
+        //     子のGeometryInstanceはマテリアルの数だけSBTインデックスを占める。
+        //     プール外のGeometryInstanceには0xFFFFFFFFを入れる。
+        // EN: Make a table from the SBT index in the GAS (optixGetSbtGASIndex()) to the range index.
+        //     A child geometry instance occupies SBT indices as many as its materials.
+        //     0xFFFFFFFF is set for geometry instances outside of the pool.
+        void getSbtGasIndexToRangeTable(const GeometryAccelerationStructure &gas, std::vector<uint32_t>* table) const {
+            table->clear();
+            uint32_t numChildren = gas.getNumChildren();
+            for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx) {
+                GeometryInstance geomInst = gas.getChild(childIdx);
+                auto it = m_geomInstRanges.find(geomInst);
+                uint32_t rangeIndex = it != m_geomInstRanges.cend() ? it->second : 0xFFFFFFFF;
+                table->resize(table->size() + geomInst.getNumMaterials(), rangeIndex);
+            }
+        }
+
+        // JP: 頂点スラブ全体。変形を行うカーネルはここに一度書き込めば全てのGeometryInstanceに反映される。
+        // EN: The whole vertex slab. A deformation kernel writing here once is reflected to all geometry instances.
+        const cudau::TypedBuffer<VertexType> &getVertexBuffer() const {
+            return m_vertices;
+        }
+        uint32_t getNumVertices() const {
+            return m_numVertices;
+        }
+        uint32_t getNumTriangles() const {
+            return m_numTriangles;
+        }
+
+        GeometryPool<VertexType> getGeometryPool() const {
+            GeometryPool<VertexType> ret;
+            ret.vertices = m_vertices.getDevicePointer();
+            ret.triangles = m_triangles.getDevicePointer();
+            ret.ranges = m_ranges.getDevicePointer();
+            ret.numRanges = static_cast<uint32_t>(m_rangesOnHost.size());
+            return ret;
+        }
+    };
+
+
+
+    class HostTraversalCounters {
+        cudau::TypedBuffer<uint32_t> m_counters;
+        uint32_t m_width;
+        uint32_t m_height;
+
+    public:
+        static constexpr uint32_t NumEvents = static_cast<uint32_t>(TraversalEvent::NumEvents);
+
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t width, uint32_t height) {
+            m_width = width;
+            m_height = height;
+            m_counters.initialize(context, type, NumEvents * width * height, 0u);
+        }
+        void finalize() {
+            m_counters.finalize();
+        }
+        bool isInitialized() const {
+            return m_counters.isInitialized();
+        }
+
+        uint32_t getWidth() const {
+            return m_width;
+        }
+        uint32_t getHeight() const {
+            return m_height;
+        }
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_counters.getCUdeviceptr(), 0, m_counters.numElements(), stream));
+        }
+
+        // JP: カウンターをホストに読み戻す。ストリームの同期を伴う。
+        //     totalsとmaxValuesにはNumEvents個の要素が必要。
+        // EN: Read back the counters to the host. This involves stream synchronization.
+        //     totals and maxValues require NumEvents elements.
+        void readback(std::vector<uint32_t> &counters, CUstream stream,
+                      uint64_t* totals = nullptr, uint32_t* maxValues = nullptr) const {
+            counters.resize(m_counters.numElements());
+            m_counters.read(counters.data(), m_counters.numElements(), stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            const uint32_t numPixels = m_width * m_height;
+            for (uint32_t e = 0; e < NumEvents; ++e) {
+                uint64_t total = 0;
+                uint32_t maxValue = 0;
+                for (uint32_t i = 0; i < numPixels; ++i) {
+                    uint32_t v = counters[e * numPixels + i];
+                    total += v;
+                    maxValue = std::max(maxValue, v);
+                }
+                if (totals)
+                    totals[e] = total;
+                if (maxValues)
+                    maxValues[e] = maxValue;
+            }
+        }
+
+        // JP: readback()で読み出したカウンターから、あるイベントの[0, 1]のヒートマップを作る。
+        //     少数の極端なピクセルに埋もれないよう対数スケールで最大値により正規化する。
+        // EN: Make a [0, 1] heatmap of an event from the counters read by readback().
+        //     Normalized by the maximum in log scale so that a few extreme pixels don't hide the rest.
+        void makeHeatmap(const std::vector<uint32_t> &counters, TraversalEvent event,
+                         std::vector<float> &heatmap) const {
+            const uint32_t numPixels = m_width * m_height;
+            const uint32_t* src = counters.data() + static_cast<uint32_t>(event) * numPixels;
+            uint32_t maxValue = 0;
+            for (uint32_t i = 0; i < numPixels; ++i)
+                maxValue = std::max(maxValue, src[i]);
+            heatmap.resize(numPixels);
+            const float invLogMax = maxValue > 0 ? 1.0f / std::log1p(static_cast<float>(maxValue)) : 0.0f;
+            for (uint32_t i = 0; i < numPixels; ++i)
+                heatmap[i] = std::log1p(static_cast<float>(src[i])) * invLogMax;
+        }
+
+        TraversalCounters getTraversalCounters() const {
+            TraversalCounters ret;
+            ret.counters = m_counters.getDevicePointer();
+            ret.width = m_width;
+            ret.height = m_height;
+            return ret;
+        }
+    };
+
+
+
+    struct RayStatisticsSummary {
+        std::vector<uint64_t> numTracesPerRayType;
+        uint64_t numMisses;
+        uint64_t numAnyHits;
+
+        uint64_t getNumTraces() const {
+            uint64_t ret = 0;
+            for (uint64_t n : numTracesPerRayType)
+                ret += n;
+            return ret;
+        }
+        // JP: Missプログラムでの計上漏れがあると実際より多くなる。
+        // EN: This becomes larger than actual if some miss programs don't count.
+        uint64_t getNumHits() const {
+            uint64_t numTraces = getNumTraces();
+            return numTraces > numMisses ? numTraces - numMisses : 0;
+        }
+
+        // JP: 計測した期間(ミリ秒)からレイ数/秒を求める。
+        // EN: Compute rays per second from a measured duration in milliseconds.
+        double calcRaysPerSecond(float durationInMs) const {
+            if (durationInMs <= 0.0f)
+                return 0.0;
+            return static_cast<double>(getNumTraces()) / (1e-3 * durationInMs);
+        }
+        // JP: プロファイラーのフレーム中で名前が一致するスコープの長さの合計を期間として使う。
+        //     Context::setProfileScopeCallbacks()でアタッチしていればローンチは"optixu::Pipeline::launch"として記録される。
+        //     統計と同じフレームのFrameStatsを渡す必要がある。
+        // EN: Use the sum of durations of scopes with the matching name in a profiler frame as the duration.
+        //     Launches are recorded as "optixu::Pipeline::launch" when attached by Context::setProfileScopeCallbacks().
+        //     FrameStats of the same frame as the statistics needs to be passed.
+        double calcRaysPerSecond(const cudau::GpuProfiler::FrameStats &frameStats,
+                                 const char* scopeName = "optixu::Pipeline::launch") const {
+            float duration = 0.0f;
+            for (const cudau::GpuProfiler::ScopeStats &scope : frameStats.scopes) {
+                if (scope.name == scopeName)
+                    duration += scope.duration;
+            }
+            return calcRaysPerSecond(duration);
+        }
+    };
+
+    class HostRayStatistics {
+        cudau::TypedBuffer<unsigned long long> m_counters;
+        uint32_t m_numRayTypes;
+
+    public:
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t numRayTypes) {
+            if (numRayTypes == 0)
+                throw std::runtime_error("numRayTypes must be at least 1.");
+            m_numRayTypes = numRayTypes;
+            m_counters.initialize(context, type, numRayTypes + 2, 0ull);
+        }
+        void finalize() {
+            m_counters.finalize();
+        }
+        bool isInitialized() const {
+            return m_counters.isInitialized();
+        }
+
+        uint32_t getNumRayTypes() const {
+            return m_numRayTypes;
+        }
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_counters.getCUdeviceptr(), 0, 2 * m_counters.numElements(), stream));
+        }
+
+        // JP: カウンターをホストに読み戻す。ストリームの同期を伴う。
+        //     resetAfterReadがtrueの場合は読み戻しの後に次のローンチに向けてカウンターをリセットする。
+        // EN: Read back the counters to the host. This involves stream synchronization.
+        //     If resetAfterRead is true, the counters are reset for the next launch after the read back.
+        void readback(RayStatisticsSummary* summary, CUstream stream, bool resetAfterRead = true) const {
+            std::vector<unsigned long long> counters(m_counters.numElements());
+            m_counters.read(counters.data(), m_counters.numElements(), stream);
+            if (resetAfterRead)
+                reset(stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            summary->numTracesPerRayType.resize(m_numRayTypes);
+            for (uint32_t rayType = 0; rayType < m_numRayTypes; ++rayType)
+                summary->numTracesPerRayType[rayType] = counters[rayType];
+            summary->numMisses = counters[m_numRayTypes];
+            summary->numAnyHits = counters[m_numRayTypes + 1];
+        }
+
+        RayStatistics getRayStatistics() const {
+            RayStatistics ret;
+            ret.counters = m_counters.getDevicePointer();
+            ret.numRayTypes = m_numRayTypes;
+            return ret;
+        }
+    };
+
+
+
+    // JP: デバイスログのレコードを書式文字列に従って文字列に変換する。
+    //     f, e, g, aは浮動小数点数、d, iは符号付き整数、u, x, X, o, cは符号無し整数として引数を解釈し、
+    //     pは32ビットの値として0x%08xで表示する。%sやその他の変換指定子は使えない。
+    // EN: Convert a device log record to a string according to the format string.
+    //     Arguments are interpreted as floating point numbers for f, e, g, a, signed integers for d, i
+    //     and unsigned integers for u, x, X, o, c, and p is shown as a 32-bit value by 0x%08x.
+    //     %s and other conversion specifiers are not available.
+    inline std::string formatDeviceLogRecord(const char* format, const DeviceLogRecord &rec) {
+        std::string ret;
+        uint32_t argIdx = 0;
+        char buf[64];
+        for (const char* p = format; *p != '\0';) {
+            if (*p != '%') {
+                ret += *p++;
+                continue;
+            }
+            if (p[1] == '%') {
+                ret += '%';
+                p += 2;
+                continue;
+            }
+            const char* specBegin = p++;
+            while (*p != '\0' && !std::isalpha(static_cast<unsigned char>(*p)))
+                ++p;
+            // JP: 長さ修飾子は無視する。
+            // EN: Ignore length modifiers.
+            std::string spec(specBegin, p);
+            while (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't')
+                ++p;
+            if (*p == '\0')
+                break;
+            char conv = *p++;
+            spec += conv;
+            if (argIdx >= rec.numArgs) {
+                ret += "<missing>";
+                continue;
+            }
+            uint32_t arg = rec.args[argIdx++];
+            if (std::strchr("fFeEgGaA", conv)) {
+                float v;
+                std::memcpy(&v, &arg, sizeof(v));
+                snprintf(buf, sizeof(buf), spec.c_str(), static_cast<double>(v));
+            }
+            else if (conv == 'd' || conv == 'i') {
+                snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int32_t>(arg));
+            }
+            else if (std::strchr("uxXoc", conv)) {
+                snprintf(buf, sizeof(buf), spec.c_str(), arg);
+            }
+            else if (conv == 'p') {
+                snprintf(buf, sizeof(buf), "0x%08x", arg);
+            }
+            else {
+                snprintf(buf, sizeof(buf), "<%%%c unsupported>", conv);
+            }
+            ret += buf;
+        }
+        return ret;
+    }
+
+    class HostDeviceLogger {
+        cudau::TypedBuffer<DeviceLogRecord> m_records;
+        cudau::TypedBuffer<uint32_t> m_counters;
+
+    public:
+        void initialize(CUcontext context, cudau::BufferType type, uint32_t capacity) {
+            m_records.initialize(context, type, capacity);
+            m_counters.initialize(context, type, 2, 0u);
+        }
+        void finalize() {
+            m_counters.finalize();
+            m_records.finalize();
+        }
+        bool isInitialized() const {
+            return m_records.isInitialized();
+        }
+
+        uint32_t getCapacity() const {
+            return m_records.numElements();
+        }
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_counters.getCUdeviceptr(), 0, 2, stream));
+        }
+
+        // JP: レコードをホストに読み戻し、古いものから順にsink(const DeviceLogRecord &, const std::string &)を呼ぶ。
+        //     ストリームの同期を伴う。formatsは書式IDをインデックスとする書式文字列の配列。
+        //     書き込まれたレコードの総数(上書きされたものも含む)を返す。
+        // EN: Read back the records to the host and call sink(const DeviceLogRecord &, const std::string &)
+        //     from the oldest. This involves stream synchronization.
+        //     formats is an array of format strings indexed by format ID.
+        //     Returns the total number of written records, including overwritten ones.
+        template <typename SinkFunc>
+        uint32_t decode(const char* const* formats, uint32_t numFormats, SinkFunc &&sink,
+                        CUstream stream, uint32_t* numAssertFailures = nullptr) const {
+            uint32_t counters[2];
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(counters, m_counters.getCUdeviceptr(), sizeof(counters), stream));
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            if (numAssertFailures)
+                *numAssertFailures = counters[1];
+
+            const uint32_t capacity = m_records.numElements();
+            const uint32_t numValidRecords = std::min(counters[0], capacity);
+            if (numValidRecords == 0)
+                return counters[0];
+            std::vector<DeviceLogRecord> records(capacity);
+            m_records.read(records.data(), capacity, stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+            for (uint32_t i = counters[0] - numValidRecords; i < counters[0]; ++i) {
+                const DeviceLogRecord &rec = records[i % capacity];
+                const char* format = rec.formatID < numFormats ? formats[rec.formatID] : "<unknown format>";
+                sink(rec, formatDeviceLogRecord(format, rec));
+            }
+            return counters[0];
+        }
+
+        DeviceLogger getDeviceLogger() const {
+            return DeviceLogger(m_records.getDevicePointer(), m_counters.getDevicePointer(), m_records.numElements());
+        }
+    };
+
+
+
+    // JP: 同じデノイザーで多数のフレームを順にデノイズするためのパイプライン。
+    //     ピン留めメモリーのリングを介して、フレームN+1のアップロード、フレームNのデノイズ、
+    //     フレームN-1のダウンロードを別々のストリームでオーバーラップさせる。
+    //     テンポラルモデルの場合は前フレームのデノイズ結果を自動でpreviousDenoisedBeautyに使う。
+    //     submit()したフレームはretrieve()で投入順に受け取る。未受け取りのフレームはリングのサイズまで。
+    // EN: Pipeline to denoise many frames in sequence with the same denoiser.
+    //     Through a ring of pinned memory, this overlaps uploading frame N+1, denoising frame N and
+    //     downloading frame N-1 on separate streams.
+    //     With the temporal model, the denoised result of the previous frame is automatically used as
+    //     previousDenoisedBeauty.
+    //     Frames submitted by submit() are received in submission order by retrieve().
+    //     Up to the ring size frames can be pending.
+    class DenoiseBatch {
+        struct Slot {
+            uint8_t* hostBeauty;
+            uint8_t* hostAlbedo;
+            uint8_t* hostNormal;
+            uint8_t* hostFlow;
+            uint8_t* hostDenoised;
+            cudau::Buffer beauty;
+            cudau::Buffer albedo;
+            cudau::Buffer normal;
+            cudau::Buffer flow;
+            cudau::Buffer denoised;
+            cudau::TypedBuffer<float> hdrIntensity;
+            CUevent uploadDone;
+            CUevent denoiseDone;
+            CUevent downloadDone;
+        };
+
+        Denoiser m_denoiser;
+        CUstream m_uploadStream;
+        CUstream m_denoiseStream;
+        CUstream m_downloadStream;
+        cudau::Buffer m_stateBuffer;
+        cudau::Buffer m_scratchBuffer;
+        cudau::Buffer m_scratchBufferForIntensity;
+        std::vector<DenoisingTask> m_tasks;
+        std::vector<Slot> m_slots;
+        uint32_t m_width;
+        uint32_t m_height;
+        uint64_t m_numSubmittedFrames;
+        uint64_t m_numRetrievedFrames;
+        struct {
+            unsigned int m_guideAlbedo : 1;
+            unsigned int m_guideNormal : 1;
+            unsigned int m_temporal : 1;
+            unsigned int m_initialized : 1;
+        };
+
+        // JP: ホスト側ではCUDAのベクトル型がこのヘッダーより後に定義されることがあるので
+        //     非テンプレートのこのクラスではバイトサイズで扱う。
+        // EN: Deal with byte sizes in this non-template class since CUDA vector types may be defined
+        //     after this header on the host side.
+        static constexpr uint32_t sizeOfFloat4 = sizeof(float) * 4;
+        static constexpr uint32_t sizeOfFloat2 = sizeof(float) * 2;
+
+        static BufferView toBufferView(const cudau::Buffer &buffer) {
+            return BufferView(buffer.getCUdeviceptr(), buffer.numElements(), buffer.stride());
+        }
+
+    public:
+        DenoiseBatch() :
+            m_uploadStream(nullptr), m_denoiseStream(nullptr), m_downloadStream(nullptr),
+            m_width(0), m_height(0), m_numSubmittedFrames(0), m_numRetrievedFrames(0),
+            m_guideAlbedo(false), m_guideNormal(false), m_temporal(false), m_initialized(false) {}
+        ~DenoiseBatch() {
+            finalize();
+        }
+
+        // JP: guideAlbedo, guideNormal, temporalはデノイザー生成時の指定と一致させる。
+        //     デノイザーのprepare()とsetupState()はこの中で行われる。
+        // EN: guideAlbedo, guideNormal and temporal need to match those specified when creating the denoiser.
+        //     prepare() and setupState() of the denoiser are done inside this.
+        void initialize(CUcontext context, const Denoiser &denoiser, uint32_t width, uint32_t height,
+                        bool guideAlbedo, bool guideNormal, bool temporal, uint32_t ringSize = 3) {
+            if (m_initialized)
+                throw std::runtime_error("DenoiseBatch is already initialized.");
+            if (ringSize == 0 || (temporal && ringSize < 2))
+                throw std::runtime_error("Ring size must be at least 1, or 2 for the temporal model.");
+            m_denoiser = denoiser;
+            m_width = width;
+            m_height = height;
+            m_guideAlbedo = guideAlbedo;
+            m_guideNormal = guideNormal;
+            m_temporal = temporal;
+
+            size_t stateSize;
+            size_t scratchSize;
+            size_t scratchSizeForIntensity;
+            uint32_t numTasks;
+            m_denoiser.prepare(width, height, 0, 0, &stateSize, &scratchSize, &scratchSizeForIntensity, &numTasks);
+            m_tasks.resize(numTasks);
+            m_denoiser.getTasks(m_tasks.data());
+            m_stateBuffer.initialize(context, cudau::BufferType::Device, static_cast<uint32_t>(stateSize), 1);
+            m_scratchBuffer.initialize(context, cudau::BufferType::Device, static_cast<uint32_t>(scratchSize), 1);
+            m_scratchBufferForIntensity.initialize(
+                context, cudau::BufferType::Device, static_cast<uint32_t>(scratchSizeForIntensity), 1);
+
+            CUDADRV_CHECK(cuStreamCreate(&m_uploadStream, CU_STREAM_NON_BLOCKING));
+            CUDADRV_CHECK(cuStreamCreate(&m_denoiseStream, CU_STREAM_NON_BLOCKING));
+            CUDADRV_CHECK(cuStreamCreate(&m_downloadStream, CU_STREAM_NON_BLOCKING));
+            m_denoiser.setupState(m_denoiseStream, toBufferView(m_stateBuffer), toBufferView(m_scratchBuffer));
+
+            const uint32_t numPixels = width * height;
+            m_slots.resize(ringSize);
+            for (Slot &slot : m_slots) {
+                slot.hostAlbedo = nullptr;
+                slot.hostNormal = nullptr;
+                slot.hostFlow = nullptr;
+                CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.hostBeauty), sizeOfFloat4 * numPixels));
+                CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.hostDenoised), sizeOfFloat4 * numPixels));
+                slot.beauty.initialize(context, cudau::BufferType::Device, numPixels, sizeOfFloat4);
+                slot.denoised.initialize(context, cudau::BufferType::Device, numPixels, sizeOfFloat4);
+                slot.hdrIntensity.initialize(context, cudau::BufferType::Device, 1);
+                if (guideAlbedo) {
+                    CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.hostAlbedo), sizeOfFloat4 * numPixels));
+                    slot.albedo.initialize(context, cudau::BufferType::Device, numPixels, sizeOfFloat4);
+                }
+                if (guideNormal) {
+                    CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.hostNormal), sizeOfFloat4 * numPixels));
+                    slot.normal.initialize(context, cudau::BufferType::Device, numPixels, sizeOfFloat4);
+                }
+                if (temporal) {
+                    CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.hostFlow), sizeOfFloat2 * numPixels));
+                    slot.flow.initialize(context, cudau::BufferType::Device, numPixels, sizeOfFloat2);
+                }
+                CUDADRV_CHECK(cuEventCreate(&slot.uploadDone, CU_EVENT_DISABLE_TIMING));
+                CUDADRV_CHECK(cuEventCreate(&slot.denoiseDone, CU_EVENT_DISABLE_TIMING));
+                CUDADRV_CHECK(cuEventCreate(&slot.downloadDone, CU_EVENT_DISABLE_TIMING));
+            }
+            m_numSubmittedFrames = 0;
+            m_numRetrievedFrames = 0;
+            m_initialized = true;
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+            CUDADRV_CHECK(cuStreamSynchronize(m_uploadStream));
+            CUDADRV_CHECK(cuStreamSynchronize(m_denoiseStream));
+            CUDADRV_CHECK(cuStreamSynchronize(m_downloadStream));
+            for (Slot &slot : m_slots) {
+                CUDADRV_CHECK(cuEventDestroy(slot.downloadDone));
+                CUDADRV_CHECK(cuEventDestroy(slot.denoiseDone));
+                CUDADRV_CHECK(cuEventDestroy(slot.uploadDone));
+                slot.hdrIntensity.finalize();
+                slot.denoised.finalize();
+                slot.flow.finalize();
+                slot.normal.finalize();
+                slot.albedo.finalize();
+                slot.beauty.finalize();
+                for (void* p : { static_cast<void*>(slot.hostDenoised), static_cast<void*>(slot.hostFlow),
+                                 static_cast<void*>(slot.hostNormal), static_cast<void*>(slot.hostAlbedo),
+                                 static_cast<void*>(slot.hostBeauty) }) {
+                    if (p)
+                        CUDADRV_CHECK(cuMemFreeHost(p));
+                }
+            }
+            m_slots.clear();
+            CUDADRV_CHECK(cuStreamDestroy(m_downloadStream));
+            CUDADRV_CHECK(cuStreamDestroy(m_denoiseStream));
+            CUDADRV_CHECK(cuStreamDestroy(m_uploadStream));
+            m_scratchBufferForIntensity.finalize();
+            m_scratchBuffer.finalize();
+            m_stateBuffer.finalize();
+            m_initialized = false;
+        }
+
+        uint32_t getNumPendingFrames() const {
+            return static_cast<uint32_t>(m_numSubmittedFrames - m_numRetrievedFrames);
+        }
+        bool isFull() const {
+            return getNumPendingFrames() >= m_slots.size();
+        }
+
+        // JP: フレームを投入する。ホスト側の入力はピン留めメモリーにコピーされるので呼び出し後すぐに再利用できる。
+        //     ガイドを使わない場合やテンポラルモデルでない場合は対応する引数にnullptrを渡す。
+        // EN: Submit a frame. The host-side inputs are copied to pinned memory,
+        //     so they can be reused immediately after the call.
+        //     Pass nullptr for arguments corresponding to unused guides or when not using the temporal model.
+        //     beauty, albedo and normal are arrays of float4 and flow is an array of float2.
+        void submit(const void* beauty, const void* albedo, const void* normal, const void* flow,
+                    bool denoiseAlpha = false, float blendFactor = 0.0f) {
+            if (!m_initialized)
+                throw std::runtime_error("DenoiseBatch is not initialized.");
+            if (isFull())
+                throw std::runtime_error("Ring is full. Call retrieve() first.");
+            if ((m_guideAlbedo && !albedo) || (m_guideNormal && !normal) || (m_temporal && !flow))
+                throw std::runtime_error("Required guide input is missing.");
+
+            const uint32_t numPixels = m_width * m_height;
+            const uint32_t slotIdx = static_cast<uint32_t>(m_numSubmittedFrames % m_slots.size());
+            Slot &slot = m_slots[slotIdx];
+
+            // JP: スロットの前回の使用によるアップロードは受け取り済みフレームなので完了している。
+            // EN: Upload for the previous use of the slot has completed since that frame was retrieved.
+            std::memcpy(slot.hostBeauty, beauty, sizeOfFloat4 * numPixels);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(slot.beauty.getCUdeviceptr(), slot.hostBeauty,
+                                            sizeOfFloat4 * numPixels, m_uploadStream));
+            if (m_guideAlbedo) {
+                std::memcpy(slot.hostAlbedo, albedo, sizeOfFloat4 * numPixels);
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(slot.albedo.getCUdeviceptr(), slot.hostAlbedo,
+                                                sizeOfFloat4 * numPixels, m_uploadStream));
+            }
+            if (m_guideNormal) {
+                std::memcpy(slot.hostNormal, normal, sizeOfFloat4 * numPixels);
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(slot.normal.getCUdeviceptr(), slot.hostNormal,
+                                                sizeOfFloat4 * numPixels, m_uploadStream));
+            }
+            if (m_temporal) {
+                // JP: 最初のフレームでは前フレームが無いのでフローをゼロにする。
+                // EN: Zero the flow for the first frame since there is no previous frame.
+                if (m_numSubmittedFrames == 0)
+                    std::memset(slot.hostFlow, 0, sizeOfFloat2 * numPixels);
+                else
+                    std::memcpy(slot.hostFlow, flow, sizeOfFloat2 * numPixels);
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(slot.flow.getCUdeviceptr(), slot.hostFlow,
+                                                sizeOfFloat2 * numPixels, m_uploadStream));
+            }
+            CUDADRV_CHECK(cuEventRecord(slot.uploadDone, m_uploadStream));
+
+            CUDADRV_CHECK(cuStreamWaitEvent(m_denoiseStream, slot.uploadDone, 0));
+            m_denoiser.computeIntensity(m_denoiseStream,
+                                        toBufferView(slot.beauty), OPTIX_PIXEL_FORMAT_FLOAT4,
+                                        toBufferView(m_scratchBufferForIntensity),
+                                        slot.hdrIntensity.getCUdeviceptr());
+            // JP: テンポラルモデルでは前フレームのデノイズ結果を使う。最初のフレームではノイズのある入力を使う。
+            // EN: Use the denoised result of the previous frame for the temporal model.
+            //     Use the noisy input for the first frame.
+            BufferView previousDenoised;
+            if (m_temporal) {
+                if (m_numSubmittedFrames == 0) {
+                    previousDenoised = toBufferView(slot.beauty);
+                }
+                else {
+                    const Slot &prevSlot = m_slots[(slotIdx + m_slots.size() - 1) % m_slots.size()];
+                    previousDenoised = toBufferView(prevSlot.denoised);
+                }
+            }
+            for (const DenoisingTask &task : m_tasks) {
+                m_denoiser.invoke(m_denoiseStream,
+                                  denoiseAlpha, slot.hdrIntensity.getCUdeviceptr(), blendFactor,
+                                  toBufferView(slot.beauty), OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  m_guideAlbedo ? toBufferView(slot.albedo) : BufferView(), OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  m_guideNormal ? toBufferView(slot.normal) : BufferView(), OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  m_temporal ? toBufferView(slot.flow) : BufferView(), OPTIX_PIXEL_FORMAT_FLOAT2,
+                                  previousDenoised,
+                                  toBufferView(slot.denoised),
+                                  task);
+            }
+            CUDADRV_CHECK(cuEventRecord(slot.denoiseDone, m_denoiseStream));
+
+            CUDADRV_CHECK(cuStreamWaitEvent(m_downloadStream, slot.denoiseDone, 0));
+            CUDADRV_CHECK(cuMemcpyDtoHAsync(slot.hostDenoised, slot.denoised.getCUdeviceptr(),
+                                            sizeOfFloat4 * numPixels, m_downloadStream));
+            CUDADRV_CHECK(cuEventRecord(slot.downloadDone, m_downloadStream));
+
+            ++m_numSubmittedFrames;
+        }
+
+        // JP: 最も古い未受け取りのフレームのデノイズ完了を待ちdstにコピーする。未受け取りのフレームが無ければfalseを返す。
+        // EN: Wait for the oldest pending frame to finish denoising and copy it to dst.
+        //     Return false if there is no pending frame. dst is an array of float4.
+        bool retrieve(void* dst) {
+            if (getNumPendingFrames() == 0)
+                return false;
+            const Slot &slot = m_slots[m_numRetrievedFrames % m_slots.size()];
+            CUDADRV_CHECK(cuEventSynchronize(slot.downloadDone));
+            std::memcpy(dst, slot.hostDenoised, sizeOfFloat4 * m_width * m_height);
+            ++m_numRetrievedFrames;
+            return true;
+        }
+    };
+
+
+
+    // JP: コンテキストにGPUプロファイラーを接続し、ASのビルド、ローンチ、デノイズを自動的にスコープとして記録する。
+    //     nullptrを渡すと接続を解除する。プロファイラーはコンテキストより長く生存する必要がある。
+    // EN: Attach a GPU profiler to the context to automatically record AS builds, launches and denoising as scopes.
+    //     Passing nullptr detaches it. The profiler needs to outlive the context or be detached before destroyed.
+    inline void attachGpuProfiler(const Context &context, cudau::GpuProfiler* profiler) {
+        if (!profiler) {
+            context.setProfileScopeCallbacks(nullptr, nullptr, nullptr);
+            return;
+        }
+        context.setProfileScopeCallbacks(
+            [](void* userData, const char* name, CUstream stream) {
+                reinterpret_cast<cudau::GpuProfiler*>(userData)->pushScope(name, stream);
+            },
+            [](void* userData, const char* name, CUstream stream) {
+                (void)name;
+                reinterpret_cast<cudau::GpuProfiler*>(userData)->popScope(stream);
+            },
+            profiler);
+    }
+
+    // JP: stream上のそれまでの処理が完了した後にバッファー・配列を解放する。
+    //     所有権は移されるので、呼び出し後の元のオブジェクトはすぐに初期化し直せる。
+    // EN: Free the buffer/array after the preceding work on the stream completes.
+    //     The ownership is moved, so the original object can be initialized again right after the call.
+    inline void deferFinalize(const Context &context, CUstream stream, cudau::Buffer &&buffer) {
+        if (!buffer.isInitialized())
+            return;
+        context.deferRelease(
+            stream,
+            [](void* userData) {
+                auto buf = static_cast<cudau::Buffer*>(userData);
+                buf->finalize();
+                delete buf;
+            },
+            new cudau::Buffer(std::move(buffer)));
+    }
+
+    inline void deferFinalize(const Context &context, CUstream stream, cudau::Array &&array) {
+        if (!array.isInitialized())
+            return;
+        context.deferRelease(
+            stream,
+            [](void* userData) {
+                auto arr = static_cast<cudau::Array*>(userData);
+                arr->finalize();
+                delete arr;
+            },
+            new cudau::Array(std::move(array)));
+    }
+
+
+
+    // JP: 複数GPUへのローンチの分割と結果の収集を行う。
+    //     シーン、パイプライン、SBTはデバイスごとのContextで複製しておく。
+    //     GASは1つのデバイスでビルドしてserialize()し、他のデバイスでrelocate()すればビルドを1回で済ませられる。
+    //     各デバイスはフレーム全体の大きさの出力バッファーのうち割り当てられた行に書き込み、
+    //     gather()で1つのバッファーに集める。
+    //     SplitFrameモードでは前のフレームまでの各デバイスの計測時間から行数の割り当てを調整する。
+    // EN: Split launches across multiple GPUs and gather the results.
+    //     Replicate the scene, the pipeline and SBTs with a Context per device beforehand.
+    //     Building a GAS once is possible by serialize() on one device and relocate() on the others.
+    //     Each device writes assigned rows of a frame-sized output buffer, then gather() collects them into one buffer.
+    //     SplitFrame mode adjusts the row assignment from per-device timings measured up to the previous frame.
+    class MultiGPULauncher {
+    public:
+        enum class SplitMode {
+            // JP: 各デバイスに連続した行の帯を処理能力に応じて割り当てる。
+            // EN: Assign a contiguous band of rows to each device according to its throughput.
+            SplitFrame = 0,
+            // JP: 行をデバイス間で交互に割り当てる。負荷が画面上で偏る場合に向く。
+            // EN: Assign rows to devices alternately. This suits the case where the load is uneven on the screen.
+            InterleavedRows,
+        };
+        // JP: デバイスが処理する行はfirstRow + i * rowStride (i < numRows)。
+        // EN: Rows processed by a device are firstRow + i * rowStride (i < numRows).
+        struct Region {
+            uint32_t firstRow;
+            uint32_t numRows;
+            uint32_t rowStride;
+        };
+        // JP: デバイスごとに呼ばれ、領域をローンチパラメターに設定してstream上でローンチを行う。
+        //     ローンチの大きさは(幅, region.numRows)とし、レイ生成プログラムで行番号を変換する。
+        // EN: Called per device, set the region to the launch parameters then launch on the stream.
+        //     Launch with the size (width, region.numRows), and convert the row index in the ray generation program.
+        typedef std::function<void(uint32_t deviceIndex, const Region &region, CUstream stream)> LaunchFunction;
+
+    private:
+        struct Device {
+            CUcontext cuContext;
+            CUstream stream;
+            CUevent startEvent;
+            CUevent endEvent;
+            Region region;
+            float rowsPerMs;
+            bool timingPending;
+        };
+
+        std::vector<Device> m_devices;
+        SplitMode m_mode;
+        uint32_t m_height;
+        uint32_t m_rowGranularity;
+        float m_smoothing;
+        bool m_initialized;
+
+        void updateThroughputs() {
+            for (Device &dev : m_devices) {
+                if (!dev.timingPending)
+                    continue;
+                CUresult res = cuEventQuery(dev.endEvent);
+                if (res == CUDA_ERROR_NOT_READY)
+                    continue;
+                CUDADRV_CHECK(res);
+                float timeInMs;
+                CUDADRV_CHECK(cuEventElapsedTime(&timeInMs, dev.startEvent, dev.endEvent));
+                dev.timingPending = false;
+                if (dev.region.numRows == 0 || timeInMs <= 0.0f)
+                    continue;
+                const float rowsPerMs = dev.region.numRows / timeInMs;
+                dev.rowsPerMs = dev.rowsPerMs > 0.0f ?
+                    (1 - m_smoothing) * dev.rowsPerMs + m_smoothing * rowsPerMs :
+                    rowsPerMs;
+            }
+        }
+
+        void assignRegions() {
+            const uint32_t numDevices = static_cast<uint32_t>(m_devices.size());
+            if (m_mode == SplitMode::InterleavedRows) {
+                for (uint32_t i = 0; i < numDevices; ++i) {
+                    Region &region = m_devices[i].region;
+                    region.firstRow = i;
+                    region.numRows = m_height > i ? (m_height - i + numDevices - 1) / numDevices : 0;
+                    region.rowStride = numDevices;
+                }
+                return;
+            }
+
+            // JP: 未計測のデバイスは計測済みのデバイスの平均の処理能力とみなす。
+            // EN: Regard a device not measured yet as having the average throughput of the measured ones.
+            float sumMeasured = 0.0f;
+            uint32_t numMeasured = 0;
+            for (const Device &dev : m_devices) {
+                if (dev.rowsPerMs > 0.0f) {
+                    sumMeasured += dev.rowsPerMs;
+                    ++numMeasured;
+                }
+            }
+            const float defaultRowsPerMs = numMeasured > 0 ? sumMeasured / numMeasured : 1.0f;
+            float sumWeights = 0.0f;
+            for (const Device &dev : m_devices)
+                sumWeights += dev.rowsPerMs > 0.0f ? dev.rowsPerMs : defaultRowsPerMs;
+
+            const uint32_t numUnits = (m_height + m_rowGranularity - 1) / m_rowGranularity;
+            float cumWeight = 0.0f;
+            uint32_t firstUnit = 0;
+            for (uint32_t i = 0; i < numDevices; ++i) {
+                Device &dev = m_devices[i];
+                cumWeight += dev.rowsPerMs > 0.0f ? dev.rowsPerMs : defaultRowsPerMs;
+                const uint32_t endUnit = i == numDevices - 1 ?
+                    numUnits :
+                    std::min(static_cast<uint32_t>(std::round(numUnits * cumWeight / sumWeights)), numUnits);
+                const uint32_t firstRow = std::min(firstUnit * m_rowGranularity, m_height);
+                const uint32_t endRow = std::min(std::max(endUnit, firstUnit) * m_rowGranularity, m_height);
+                dev.region.firstRow = firstRow;
+                dev.region.numRows = endRow - firstRow;
+                dev.region.rowStride = 1;
+                firstUnit = std::max(endUnit, firstUnit);
+            }
+        }
+
+    public:
+        MultiGPULauncher() :
+            m_mode(SplitMode::SplitFrame), m_height(0), m_rowGranularity(1), m_smoothing(0.2f),
+            m_initialized(false) {}
+        ~MultiGPULauncher() {
+            finalize();
+        }
+
+        // JP: 可能なデバイス間ではピアアクセスを有効化する。
+        // EN: This enables peer access between devices where possible.
+        void initialize(const CUcontext* contexts, const CUstream* streams, uint32_t numDevices,
+                        uint32_t height, SplitMode mode, uint32_t rowGranularity = 16) {
+            if (m_initialized)
+                throw std::runtime_error("MultiGPULauncher is already initialized.");
+            if (numDevices == 0 || rowGranularity == 0)
+                throw std::runtime_error("Number of devices and row granularity must be at least 1.");
+
+            m_devices.resize(numDevices);
+            for (uint32_t i = 0; i < numDevices; ++i) {
+                Device &dev = m_devices[i];
+                dev.cuContext = contexts[i];
+                dev.stream = streams[i];
+                dev.region = Region{ 0, 0, 1 };
+                dev.rowsPerMs = 0.0f;
+                dev.timingPending = false;
+                CUDADRV_CHECK(cuCtxSetCurrent(dev.cuContext));
+                CUDADRV_CHECK(cuEventCreate(&dev.startEvent, CU_EVENT_DEFAULT));
+                CUDADRV_CHECK(cuEventCreate(&dev.endEvent, CU_EVENT_DEFAULT));
+            }
+
+            for (uint32_t i = 0; i < numDevices; ++i) {
+                CUdevice devI;
+                CUDADRV_CHECK(cuCtxSetCurrent(m_devices[i].cuContext));
+                CUDADRV_CHECK(cuCtxGetDevice(&devI));
+                for (uint32_t j = 0; j < numDevices; ++j) {
+                    if (i == j)
+                        continue;
+                    CUdevice devJ;
+                    CUDADRV_CHECK(cuCtxSetCurrent(m_devices[j].cuContext));
+                    CUDADRV_CHECK(cuCtxGetDevice(&devJ));
+                    CUDADRV_CHECK(cuCtxSetCurrent(m_devices[i].cuContext));
+                    int32_t canAccess = 0;
+                    CUDADRV_CHECK(cuDeviceCanAccessPeer(&canAccess, devI, devJ));
+                    if (!canAccess)
+                        continue;
+                    CUresult res = cuCtxEnablePeerAccess(m_devices[j].cuContext, 0);
+                    if (res != CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED)
+                        CUDADRV_CHECK(res);
+                }
+            }
+
+            m_mode = mode;
+            m_height = height;
+            m_rowGranularity = rowGranularity;
+            m_initialized = true;
+            assignRegions();
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+            for (Device &dev : m_devices) {
+                CUDADRV_CHECK(cuCtxSetCurrent(dev.cuContext));
+                CUDADRV_CHECK(cuEventDestroy(dev.endEvent));
+                CUDADRV_CHECK(cuEventDestroy(dev.startEvent));
+            }
+            m_devices.clear();
+            m_initialized = false;
+        }
+
+        // JP: 解像度の変更時に呼ぶ。計測済みの処理能力は保持される。
+        // EN: Call this on resolution changes. Measured throughputs are kept.
+        void resize(uint32_t height) {
+            m_height = height;
+            assignRegions();
+        }
+        // JP: 処理能力の指数移動平均の係数。
+        // EN: The coefficient of the exponential moving average of throughputs.
+        void setSmoothing(float smoothing) {
+            m_smoothing = std::min(std::max(smoothing, 0.0f), 1.0f);
+        }
+
+        // JP: 完了済みの計測から割り当てを更新してから各デバイスでローンチする。ホスト側で待つことはない。
+        // EN: Update the assignment from completed measurements, then launch on each device.
+        //     This never waits on the host.
+        void launch(const LaunchFunction &launchFunc) {
+            if (!m_initialized)
+                throw std::runtime_error("MultiGPULauncher is not initialized.");
+            updateThroughputs();
+            assignRegions();
+            for (uint32_t i = 0; i < m_devices.size(); ++i) {
+                Device &dev = m_devices[i];
+                if (dev.region.numRows == 0)
+                    continue;
+                CUDADRV_CHECK(cuCtxSetCurrent(dev.cuContext));
+                CUDADRV_CHECK(cuEventRecord(dev.startEvent, dev.stream));
+                launchFunc(i, dev.region, dev.stream);
+                CUDADRV_CHECK(cuEventRecord(dev.endEvent, dev.stream));
+                dev.timingPending = true;
+            }
+        }
+
+        // JP: 各デバイスの出力(フレーム全体の大きさ、行の詰め無し)の担当行をdstに集める。
+        //     dstStreamは各デバイスのローンチ完了を待ってからコピーする。srcs[i] == dstのデバイスはコピーを省略する。
+        // EN: Gather assigned rows of each device's output (frame-sized, tightly packed rows) into dst.
+        //     dstStream waits for each device's launch to complete before copying.
+        //     Copies are skipped for a device having srcs[i] == dst.
+        void gather(CUstream dstStream, CUdeviceptr dst, const CUdeviceptr* srcs,
+                    uint32_t width, uint32_t bytesPerPixel) const {
+            if (!m_initialized)
+                throw std::runtime_error("MultiGPULauncher is not initialized.");
+            const size_t rowSize = static_cast<size_t>(width) * bytesPerPixel;
+            for (uint32_t i = 0; i < m_devices.size(); ++i) {
+                const Device &dev = m_devices[i];
+                if (dev.region.numRows == 0 || srcs[i] == dst)
+                    continue;
+                CUDADRV_CHECK(cuStreamWaitEvent(dstStream, dev.endEvent, 0));
+                const size_t offset = rowSize * dev.region.firstRow;
+                CUDA_MEMCPY2D params = {};
+                params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.srcDevice = srcs[i] + offset;
+                params.srcPitch = rowSize * dev.region.rowStride;
+                params.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.dstDevice = dst + offset;
+                params.dstPitch = rowSize * dev.region.rowStride;
+                params.WidthInBytes = rowSize;
+                params.Height = dev.region.numRows;
+                CUDADRV_CHECK(cuMemcpy2DAsync(&params, dstStream));
+            }
+        }
+
+        uint32_t getNumDevices() const {
+            return static_cast<uint32_t>(m_devices.size());
+        }
+        const Region &getRegion(uint32_t deviceIndex) const {
+            return m_devices[deviceIndex].region;
+        }
+        // JP: 計測された処理能力(行/ミリ秒)。未計測の場合は0。
+        // EN: Measured throughput (rows per millisecond). 0 if not measured yet.
+        float getThroughput(uint32_t deviceIndex) const {
+            return m_devices[deviceIndex].rowsPerMs;
+        }
+    };
+
+
+
+    // JP: 出力画像をタイルに分割してレンダリングするためのヘルパー。
+    //     Gバッファー、累積バッファー、デノイザー入力などの作業用バッファーはタイルの大きさ(+オーバーラップ)で
+    //     numSlots組だけ確保すれば良く、フル解像度で常駐させる必要が無い。
+    //     タイルNのレンダリングの間にタイルN-1の後処理(デノイズなど)と読み出しを別ストリームで行う。
+    //     後処理の出力はオーバーラップを除いた領域だけが出力画像に書き込まれる。
+    //     レイ生成プログラムではローンチインデックスにTile::renderOriginを足したものがフル画像での画素位置、
+    //     ローンチインデックスそのものが作業用バッファーでの位置になる。
+    // EN: Helper to render an output image split into tiles.
+    //     Working buffers such as G-buffers, accumulation buffers and denoiser inputs only need numSlots sets
+    //     of the tile size (+overlap), and don't need to be resident at full resolution.
+    //     Post-processing (denoising and so on) and readback of tile N-1 run on a separate stream
+    //     during rendering tile N.
+    //     Only the region excluding the overlap of the post-processing output is written to the output image.
+    //     In the ray generation program, the launch index plus Tile::renderOrigin is the pixel position in the full
+    //     image, and the launch index itself is the position in the working buffers.
+    class TiledLauncher {
+    public:
+        struct Tile {
+            uint32_t index;
+            // JP: このタイルが使う作業用バッファーの組の番号。
+            // EN: The number of the working buffer set this tile uses.
+            uint32_t slotIndex;
+            // JP: オーバーラップを含むレンダリング領域。ローンチの大きさは(renderWidth, renderHeight)とする。
+            // EN: Rendering region including the overlap. Launch with the size (renderWidth, renderHeight).
+            uint32_t renderOriginX;
+            uint32_t renderOriginY;
+            uint32_t renderWidth;
+            uint32_t renderHeight;
+            // JP: 出力画像に書き込まれる領域と、その作業用バッファー内での位置。
+            // EN: Region written to the output image and its position in the working buffers.
+            uint32_t outputOriginX;
+            uint32_t outputOriginY;
+            uint32_t outputWidth;
+            uint32_t outputHeight;
+            uint32_t outputOffsetX;
+            uint32_t outputOffsetY;
+        };
+        // JP: 後処理の結果を保持する作業用バッファー。行のピッチはバイト単位。
+        // EN: Working buffer holding the result of post-processing. The row pitch is in bytes.
+        struct TileOutput {
+            CUdeviceptr buffer;
+            size_t pitch;
+        };
+        // JP: タイルの領域をローンチパラメターに設定し、slotIndexの作業用バッファーを使ってstream上でローンチする。
+        //     ローンチパラメターをデバイスに置く場合もスロットごとに分ける必要がある。
+        // EN: Set the tile's region to the launch parameters, then launch on the stream
+        //     using the working buffers of slotIndex.
+        //     When the launch parameters are placed on the device, they also need to be separated per slot.
+        typedef std::function<void(const Tile &tile, CUstream stream)> RenderFunction;
+        // JP: stream上でslotIndexの作業用バッファーに対してデノイズなどを行い、出力画像に書く画素の入ったバッファーを返す。
+        // EN: Perform denoising and so on for the working buffers of slotIndex on the stream,
+        //     then return the buffer containing the pixels to write to the output image.
+        typedef std::function<TileOutput(const Tile &tile, CUstream stream)> PostProcessFunction;
+
+    private:
+        struct Slot {
+            CUevent renderDone;
+            CUevent free;
+            bool used;
+        };
+
+        CUcontext m_cuContext;
+        CUstream m_renderStream;
+        CUstream m_postProcessStream;
+        std::vector<Slot> m_slots;
+        std::vector<Tile> m_tiles;
+        uint32_t m_imageWidth;
+        uint32_t m_imageHeight;
+        uint32_t m_tileWidth;
+        uint32_t m_tileHeight;
+        uint32_t m_overlap;
+        bool m_initialized;
+
+        TiledLauncher(const TiledLauncher &) = delete;
+        TiledLauncher &operator=(const TiledLauncher &) = delete;
+
+        void computeTiles() {
+            m_tiles.clear();
+            const uint32_t numTilesX = (m_imageWidth + m_tileWidth - 1) / m_tileWidth;
+            const uint32_t numTilesY = (m_imageHeight + m_tileHeight - 1) / m_tileHeight;
+            for (uint32_t ty = 0; ty < numTilesY; ++ty) {
+                for (uint32_t tx = 0; tx < numTilesX; ++tx) {
+                    Tile tile;
+                    tile.index = static_cast<uint32_t>(m_tiles.size());
+                    tile.slotIndex = tile.index % static_cast<uint32_t>(m_slots.size());
+                    tile.outputOriginX = tx * m_tileWidth;
+                    tile.outputOriginY = ty * m_tileHeight;
+                    tile.outputWidth = std::min(m_tileWidth, m_imageWidth - tile.outputOriginX);
+                    tile.outputHeight = std::min(m_tileHeight, m_imageHeight - tile.outputOriginY);
+                    tile.renderOriginX = tile.outputOriginX - std::min(m_overlap, tile.outputOriginX);
+                    tile.renderOriginY = tile.outputOriginY - std::min(m_overlap, tile.outputOriginY);
+                    const uint32_t renderEndX = std::min(tile.outputOriginX + tile.outputWidth + m_overlap, m_imageWidth);
+                    const uint32_t renderEndY = std::min(tile.outputOriginY + tile.outputHeight + m_overlap, m_imageHeight);
+                    tile.renderWidth = renderEndX - tile.renderOriginX;
+                    tile.renderHeight = renderEndY - tile.renderOriginY;
+                    tile.outputOffsetX = tile.outputOriginX - tile.renderOriginX;
+                    tile.outputOffsetY = tile.outputOriginY - tile.renderOriginY;
+                    m_tiles.push_back(tile);
+                }
+            }
+        }
+
+    public:
+        TiledLauncher() :
+            m_cuContext(nullptr), m_renderStream(nullptr), m_postProcessStream(nullptr),
+            m_imageWidth(0), m_imageHeight(0), m_tileWidth(0), m_tileHeight(0), m_overlap(0),
+            m_initialized(false) {}
+        ~TiledLauncher() {
+            finalize();
+        }
+
+        // JP: overlapはデノイザーなど近傍を参照する後処理のためにタイルの各辺に追加でレンダリングする画素数。
+        //     作業用バッファーは各スロットでgetMaxRenderWidth() x getMaxRenderHeight()の大きさが必要。
+        // EN: overlap is the number of pixels additionally rendered on each side of a tile for post-processing
+        //     referring neighbors such as the denoiser.
+        //     Working buffers need the size getMaxRenderWidth() x getMaxRenderHeight() in each slot.
+        void initialize(CUcontext context, CUstream renderStream, CUstream postProcessStream,
+                        uint32_t imageWidth, uint32_t imageHeight, uint32_t tileWidth, uint32_t tileHeight,
+                        uint32_t overlap = 0, uint32_t numSlots = 2) {
+            if (m_initialized)
+                throw std::runtime_error("TiledLauncher is already initialized.");
+            if (tileWidth == 0 || tileHeight == 0 || numSlots == 0)
+                throw std::runtime_error("Tile size and the number of slots must be at least 1.");
+            if (renderStream == postProcessStream)
+                throw std::runtime_error("Render and post-process streams must be different to overlap them.");
+
+            m_cuContext = context;
+            m_renderStream = renderStream;
+            m_postProcessStream = postProcessStream;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            m_slots.resize(numSlots);
+            for (Slot &slot : m_slots) {
+                CUDADRV_CHECK(cuEventCreate(&slot.renderDone, CU_EVENT_DISABLE_TIMING));
+                CUDADRV_CHECK(cuEventCreate(&slot.free, CU_EVENT_DISABLE_TIMING));
+                slot.used = false;
+            }
+            m_imageWidth = imageWidth;
+            m_imageHeight = imageHeight;
+            m_tileWidth = tileWidth;
+            m_tileHeight = tileHeight;
+            m_overlap = overlap;
+            computeTiles();
+            m_initialized = true;
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            for (int i = static_cast<int>(m_slots.size()) - 1; i >= 0; --i) {
+                Slot &slot = m_slots[i];
+                CUDADRV_CHECK(cuEventSynchronize(slot.free));
+                CUDADRV_CHECK(cuEventDestroy(slot.free));
+                CUDADRV_CHECK(cuEventDestroy(slot.renderDone));
+            }
+            m_slots.clear();
+            m_tiles.clear();
+            m_initialized = false;
+        }
+
+        uint32_t getNumTiles() const {
+            return static_cast<uint32_t>(m_tiles.size());
+        }
+        const Tile &getTile(uint32_t index) const {
+            return m_tiles[index];
+        }
+        uint32_t getNumSlots() const {
+            return static_cast<uint32_t>(m_slots.size());
+        }
+        uint32_t getMaxRenderWidth() const {
+            return std::min(m_tileWidth + 2 * m_overlap, m_imageWidth);
+        }
+        uint32_t getMaxRenderHeight() const {
+            return std::min(m_tileHeight + 2 * m_overlap, m_imageHeight);
+        }
+
+        // JP: 全タイルをレンダリング、後処理し、出力を画像dstに書き込む。dstの行のピッチはdstPitchバイト。
+        //     dstはホストメモリーかデバイスメモリーで、ホストの場合はピン留めメモリーでないと
+        //     読み出しの度にホストが待ってパイプラインが止まる。
+        //     呼び出しはすぐに戻るので、dstを読む前にpostProcessStreamを同期する。
+        // EN: Render and post-process all the tiles, then write outputs to the image dst.
+        //     The row pitch of dst is dstPitch bytes.
+        //     dst is host or device memory, and when host, it needs to be pinned memory,
+        //     otherwise the host waits for every readback and the pipeline stalls.
+        //     The call returns immediately, so synchronize postProcessStream before reading dst.
+        void launch(const RenderFunction &render, const PostProcessFunction &postProcess,
+                    void* dst, CUmemorytype dstMemoryType, size_t dstPitch, uint32_t bytesPerPixel) {
+            if (!m_initialized)
+                throw std::runtime_error("TiledLauncher is not initialized.");
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            for (const Tile &tile : m_tiles) {
+                Slot &slot = m_slots[tile.slotIndex];
+                // JP: 前回このスロットを使ったタイルの読み出しが終わるまで作業用バッファーに書かない。
+                // EN: Don't write to the working buffers until the readback of the tile previously using this slot ends.
+                if (slot.used)
+                    CUDADRV_CHECK(cuStreamWaitEvent(m_renderStream, slot.free, 0));
+                render(tile, m_renderStream);
+                CUDADRV_CHECK(cuEventRecord(slot.renderDone, m_renderStream));
+
+                CUDADRV_CHECK(cuStreamWaitEvent(m_postProcessStream, slot.renderDone, 0));
+                const TileOutput output = postProcess(tile, m_postProcessStream);
+
+                CUDA_MEMCPY2D params = {};
+                params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.srcDevice = output.buffer;
+                params.srcXInBytes = static_cast<size_t>(tile.outputOffsetX) * bytesPerPixel;
+                params.srcY = tile.outputOffsetY;
+                params.srcPitch = output.pitch;
+                params.dstMemoryType = dstMemoryType;
+                if (dstMemoryType == CU_MEMORYTYPE_DEVICE)
+                    params.dstDevice = reinterpret_cast<CUdeviceptr>(dst);
+                else
+                    params.dstHost = dst;
+                params.dstXInBytes = static_cast<size_t>(tile.outputOriginX) * bytesPerPixel;
+                params.dstY = tile.outputOriginY;
+                params.dstPitch = dstPitch;
+                params.WidthInBytes = static_cast<size_t>(tile.outputWidth) * bytesPerPixel;
+                params.Height = tile.outputHeight;
+                CUDADRV_CHECK(cuMemcpy2DAsync(&params, m_postProcessStream));
+                CUDADRV_CHECK(cuEventRecord(slot.free, m_postProcessStream));
+                slot.used = true;
+            }
+        }
+    };
+
+
+
+    // JP: ローンチパラメターのホスト側のシャドウコピーを持ち、変更されたバイト範囲だけをデバイスに転送するブロック。
+    //     転送はピン留めメモリーのチャンクのリングを経由するので、呼び出しから戻ればシャドウコピーを書き換えてよい。
+    //     デバイス側のアドレスは常に同じなので、ローンチには常にgetDevicePointer()を渡せば良い。
+    //     転送はストリーム順で行われるので、同じストリーム上でローンチごとにパラメターを変えても良い。
+    //     チャンクの再利用の同期は最後に使ったストリームで行うため、1つのストリームで使うことを想定している。
+    //
+    //     optixu::LaunchParameterBlock<PipelineLaunchParameters> plp;
+    //     plp.initialize(cuContext);
+    //     plp.set(&PipelineLaunchParameters::travHandle, travHandle);
+    //     plp.set(plp.get().camera.position, cameraPosition);
+    //     pipeline.launch(stream, plp.upload(stream), width, height, 1);
+    // EN: Block holding a host-side shadow copy of launch parameters and transferring only changed byte ranges
+    //     to the device.
+    //     Transfers go through a ring of chunks of pinned memory,
+    //     so the shadow copy can be rewritten once the call returns.
+    //     The device-side address is always the same, so just pass getDevicePointer() to launches.
+    //     Transfers are stream-ordered, so parameters can be changed per launch on the same stream.
+    //     This assumes use on a single stream since synchronization for reusing chunks is done on the stream
+    //     used last.
+    //
+    //     optixu::LaunchParameterBlock<PipelineLaunchParameters> plp;
+    //     plp.initialize(cuContext);
+    //     plp.set(&PipelineLaunchParameters::travHandle, travHandle);
+    //     plp.set(plp.get().camera.position, cameraPosition);
+    //     pipeline.launch(stream, plp.upload(stream), width, height, 1);
+    template <typename T>
+    class LaunchParameterBlock {
+        static_assert(std::is_trivially_copyable_v<T>, "Launch parameters must be trivially copyable.");
+
+        struct Range {
+            size_t begin;
+            size_t end;
+        };
+
+        CUcontext m_cuContext;
+        CUdeviceptr m_deviceMemory;
+        T m_shadow;
+        uint8_t* m_stagingMemory;
+        std::vector<CUevent> m_chunkEvents;
+        size_t m_chunkSize;
+        uint32_t m_curChunkIndex;
+        size_t m_chunkOffset;
+        CUstream m_lastStream;
+        std::vector<Range> m_dirtyRanges;
+        size_t m_mergeGap;
+        uint64_t m_numUploads;
+        uint64_t m_numUploadedBytes;
+        bool m_initialized;
+
+        LaunchParameterBlock(const LaunchParameterBlock &) = delete;
+        LaunchParameterBlock &operator=(const LaunchParameterBlock &) = delete;
+
+        uint8_t* allocateStaging(size_t size, CUstream stream) {
+            size = (size + 15) & ~static_cast<size_t>(15);
+            if (m_chunkOffset + size > m_chunkSize) {
+                // JP: 現在のチャンクを使った転送の完了をイベントで追跡し、次のチャンクの前回の使用の完了を待つ。
+                // EN: Track the completion of transfers using the current chunk by an event,
+                //     then wait for the previous use of the next chunk to complete.
+                CUDADRV_CHECK(cuEventRecord(m_chunkEvents[m_curChunkIndex], stream));
+                m_curChunkIndex = (m_curChunkIndex + 1) % m_chunkEvents.size();
+                CUDADRV_CHECK(cuEventSynchronize(m_chunkEvents[m_curChunkIndex]));
+                m_chunkOffset = 0;
+            }
+            uint8_t* ret = m_stagingMemory + m_chunkSize * m_curChunkIndex + m_chunkOffset;
+            m_chunkOffset += size;
+            return ret;
+        }
+
+    public:
+        LaunchParameterBlock() :
+            m_cuContext(nullptr), m_deviceMemory(0), m_stagingMemory(nullptr),
+            m_chunkSize(0), m_curChunkIndex(0), m_chunkOffset(0), m_lastStream(nullptr),
+            m_mergeGap(32), m_numUploads(0), m_numUploadedBytes(0),
+            m_initialized(false) {}
+        ~LaunchParameterBlock() {
+            finalize();
+        }
+
+        // JP: シャドウコピーはゼロで初期化され、最初のupload()で全体が転送される。
+        //     chunkSizeが0の場合はパラメター全体が複数回収まる大きさを自動で選ぶ。
+        // EN: The shadow copy is initialized with zeros, and the whole is transferred by the first upload().
+        //     When chunkSize is 0, a size fitting the whole parameters several times is chosen automatically.
+        void initialize(CUcontext context, size_t chunkSize = 0, uint32_t numChunks = 4) {
+            if (m_initialized)
+                throw std::runtime_error("LaunchParameterBlock is already initialized.");
+            if (numChunks == 0)
+                throw std::runtime_error("The number of chunks must be at least 1.");
+            if (chunkSize == 0)
+                chunkSize = std::max<size_t>(4 * ((sizeof(T) + 15) & ~static_cast<size_t>(15)), 64 * 1024);
+            if (chunkSize < sizeof(T))
+                throw std::runtime_error("Chunk size must be at least the size of the launch parameters.");
+
+            m_cuContext = context;
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            CUDADRV_CHECK(cuMemAlloc(&m_deviceMemory, sizeof(T)));
+            m_chunkSize = chunkSize;
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m_stagingMemory), m_chunkSize * numChunks));
+            m_chunkEvents.resize(numChunks);
+            for (uint32_t i = 0; i < numChunks; ++i)
+                CUDADRV_CHECK(cuEventCreate(&m_chunkEvents[i], CU_EVENT_DISABLE_TIMING));
+            m_curChunkIndex = 0;
+            m_chunkOffset = 0;
+            m_lastStream = nullptr;
+
+            std::memset(&m_shadow, 0, sizeof(T));
+            m_dirtyRanges.clear();
+            m_dirtyRanges.push_back(Range{ 0, sizeof(T) });
+            m_numUploads = 0;
+            m_numUploadedBytes = 0;
+
+            m_initialized = true;
+        }
+        void finalize() {
+            if (!m_initialized)
+                return;
+
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            CUDADRV_CHECK(cuEventRecord(m_chunkEvents[m_curChunkIndex], m_lastStream));
+            for (int i = static_cast<int>(m_chunkEvents.size()) - 1; i >= 0; --i) {
+                CUDADRV_CHECK(cuEventSynchronize(m_chunkEvents[i]));
+                CUDADRV_CHECK(cuEventDestroy(m_chunkEvents[i]));
+            }
+            m_chunkEvents.clear();
+            CUDADRV_CHECK(cuMemFreeHost(m_stagingMemory));
+            m_stagingMemory = nullptr;
+            CUDADRV_CHECK(cuMemFree(m_deviceMemory));
+            m_deviceMemory = 0;
+            m_dirtyRanges.clear();
+
+            m_cuContext = nullptr;
+
+            m_initialized = false;
+        }
+
+        // JP: この間隔(バイト)以下で隣り合う変更範囲はまとめて1回の転送にする。
+        // EN: Changed ranges adjacent within this gap (in bytes) are merged into a single transfer.
+        void setMergeGap(size_t gap) {
+            m_mergeGap = gap;
+        }
+
+        const T &get() const {
+            return m_shadow;
+        }
+        // JP: シャドウコピー全体を変更済みとしてから返す。
+        // EN: Return the shadow copy after marking the whole as changed.
+        T &getMutable() {
+            m_dirtyRanges.push_back(Range{ 0, sizeof(T) });
+            return m_shadow;
+        }
+
+        // JP: シャドウコピー内の[offset, offset + size)を変更済みとする。
+        // EN: Mark [offset, offset + size) in the shadow copy as changed.
+        void markDirty(size_t offset, size_t size) {
+            if (offset + size > sizeof(T))
+                throw std::runtime_error("Range is out of the launch parameters.");
+            if (size > 0)
+                m_dirtyRanges.push_back(Range{ offset, offset + size });
+        }
+        // JP: 値が変わった場合のみ書き込んで変更済みとする。fieldはget()が返すシャドウコピー内のメンバー。
+        // EN: Write and mark as changed only when the value changes.
+        //     field is a member within the shadow copy returned by get().
+        template <typename FieldType>
+        void set(const FieldType &field, const FieldType &value) {
+            static_assert(std::is_trivially_copyable_v<FieldType>, "Field must be trivially copyable.");
+            const uint8_t* fieldAddr = reinterpret_cast<const uint8_t*>(&field);
+            const uint8_t* base = reinterpret_cast<const uint8_t*>(&m_shadow);
+            if (fieldAddr < base || fieldAddr + sizeof(FieldType) > base + sizeof(T))
+                throw std::runtime_error("Field is not in the launch parameters.");
+            if (std::memcmp(fieldAddr, &value, sizeof(FieldType)) == 0)
+                return;
+            const size_t offset = fieldAddr - base;
+            std::memcpy(reinterpret_cast<uint8_t*>(&m_shadow) + offset, &value, sizeof(FieldType));
+            m_dirtyRanges.push_back(Range{ offset, offset + sizeof(FieldType) });
+        }
+        template <typename FieldType>
+        void set(FieldType T::*member, const FieldType &value) {
+            set(m_shadow.*member, value);
+        }
+
+        bool isDirty() const {
+            return !m_dirtyRanges.empty();
+        }
+
+        // JP: 変更範囲をまとめてストリームに転送を積み、デバイス側のアドレスを返す。変更が無ければ何もしない。
+        //     変更範囲の合計が全体の半分を超える場合は全体を1回で転送する。
+        // EN: Enqueue transfers of the merged changed ranges to the stream and return the device-side address.
+        //     This does nothing if there is no change.
+        //     The whole is transferred at once when the total of changed ranges exceeds half of it.
+        CUdeviceptr upload(CUstream stream) {
+            if (!m_initialized)
+                throw std::runtime_error("LaunchParameterBlock is not initialized.");
+            if (m_dirtyRanges.empty())
+                return m_deviceMemory;
+
+            std::sort(m_dirtyRanges.begin(), m_dirtyRanges.end(),
+                      [](const Range &a, const Range &b) { return a.begin < b.begin; });
+            size_t numMerged = 0;
+            size_t totalSize = 0;
+            for (const Range &range : m_dirtyRanges) {
+                if (numMerged > 0 && range.begin <= m_dirtyRanges[numMerged - 1].end + m_mergeGap) {
+                    Range &last = m_dirtyRanges[numMerged - 1];
+                    totalSize += std::max(range.end, last.end) - last.end;
+                    last.end = std::max(range.end, last.end);
+                }
+                else {
+                    m_dirtyRanges[numMerged++] = range;
+                    totalSize += range.end - range.begin;
+                }
+            }
+            m_dirtyRanges.resize(numMerged);
+            if (2 * totalSize > sizeof(T)) {
+                m_dirtyRanges.resize(1);
+                m_dirtyRanges[0] = Range{ 0, sizeof(T) };
+                totalSize = sizeof(T);
+            }
+
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+            const uint8_t* shadow = reinterpret_cast<const uint8_t*>(&m_shadow);
+            for (const Range &range : m_dirtyRanges) {
+                const size_t size = range.end - range.begin;
+                uint8_t* staging = allocateStaging(size, stream);
+                std::memcpy(staging, shadow + range.begin, size);
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(m_deviceMemory + range.begin, staging, size, stream));
+                ++m_numUploads;
+            }
+            m_numUploadedBytes += totalSize;
+            m_lastStream = stream;
+            m_dirtyRanges.clear();
+
+            return m_deviceMemory;
+        }
+
+        CUdeviceptr getDevicePointer() const {
+            return m_deviceMemory;
+        }
+        // JP: これまでの転送(cuMemcpyHtoDAsync)の回数と転送バイト数。
+        // EN: The number of transfers (cuMemcpyHtoDAsync) and transferred bytes so far.
+        void getStatistics(uint64_t* numUploads, uint64_t* numUploadedBytes) const {
+            *numUploads = m_numUploads;
+            *numUploadedBytes = m_numUploadedBytes;
+        }
+    };
+
+
+
+    enum class GASBuildSequencing {
+        // JP: 全GASをコンパクト前の状態でビルドしてからまとめてコンパクトする。
+        //     ピークメモリーはコンパクト前のサイズの合計になる。
+        // EN: Build all GASs uncompacted, then compact them together.
+        //     Peak memory becomes the sum of the uncompacted sizes.
+        BuildAllThenCompact = 0,
+        // JP: 小さなグループごとにビルド、コンパクト、removeUncompacted()を行い、
+        //     コンパクト前のバッファーをアリーナに返して次のグループで再利用する。
+        //     ピークメモリーはおおよそコンパクト後の合計と一グループ分の作業領域になる。
+        // EN: Perform build, compaction and removeUncompacted() per small group,
+        //     and return the uncompacted buffers to the arena to be reused by the next group.
+        //     Peak memory becomes roughly the compacted total plus one group's working set.
+        MinimizePeakMemory,
+    };
+
+    // JP: 多数のGASのビルドとコンパクションをまとめて行うスケジューラー。
+    //     バッファーはcudau::DeviceMemoryArenaから確保し、結果のバッファーはrelease()かfinalize()まで保持する。
+    //     ビルド・コンパクト後はGASが所属するTraversable (例: IAS)のmarkDirty()を呼ぶ必要がある。
+    //
+    //     optixu::GASBuildScheduler scheduler;
+    //     scheduler.initialize(&arena, &arena, optixu::GASBuildSequencing::MinimizePeakMemory, 256 << 20);
+    //     for (optixu::GeometryAccelerationStructure gas : gasList)
+    //         scheduler.addGAS(gas);
+    //     scheduler.build(stream);
+    // EN: Scheduler building and compacting many GASs together.
+    //     Buffers are allocated from cudau::DeviceMemoryArena, and result buffers are held until release() or finalize().
+    //     Calling markDirty() of traversables (e.g. IAS) to which the GASs belong is required after build/compaction.
+    //
+    //     optixu::GASBuildScheduler scheduler;
+    //     scheduler.initialize(&arena, &arena, optixu::GASBuildSequencing::MinimizePeakMemory, 256 << 20);
+    //     for (optixu::GeometryAccelerationStructure gas : gasList)
+    //         scheduler.addGAS(gas);
+    //     scheduler.build(stream);
+    class GASBuildScheduler {
+        struct Entry {
+            GeometryAccelerationStructure gas;
+            OptixAccelBufferSizes memReq;
+            cudau::DeviceMemoryArena::Allocation uncompactedBuffer;
+            cudau::DeviceMemoryArena::Allocation compactedBuffer;
+            bool allowCompaction;
+        };
+
+        cudau::DeviceMemoryArena* m_workArena;
+        cudau::DeviceMemoryArena* m_resultArena;
+        GASBuildSequencing m_sequencing;
+        size_t m_maxWorkingSetSize;
+        std::vector<Entry> m_pendingEntries;
+        std::vector<Entry> m_builtEntries;
+        size_t m_peakWorkingSetSize;
+
+        static void checkAlignment(const cudau::DeviceMemoryArena* arena) {
+            if (arena->getAlignment() % OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT != 0)
+                throw std::runtime_error("Arena alignment must be a multiple of OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT.");
+        }
+        // JP: 空のGASのサイズは0になり得るので最低1バイトを確保する。
+        // EN: Allocate at least one byte since the size of an empty GAS can be zero.
+        static cudau::DeviceMemoryArena::Allocation allocate(cudau::DeviceMemoryArena* arena, size_t size) {
+            return arena->allocate(std::max<size_t>(size, 1));
+        }
+        static BufferView toBufferView(const cudau::DeviceMemoryArena::Allocation &alloc) {
+            return BufferView(alloc.devicePointer, alloc.size, 1);
+        }
+
+        void buildGroup(CUstream stream, Entry* entries, uint32_t numEntries, const BufferView &scratchBuffer) {
+            size_t workingSetSize = 0;
+            for (uint32_t i = 0; i < numEntries; ++i) {
+                Entry &entry = entries[i];
+                cudau::DeviceMemoryArena* arena = entry.allowCompaction ? m_workArena : m_resultArena;
+                entry.uncompactedBuffer = allocate(arena, entry.memReq.outputSizeInBytes);
+                entry.gas.rebuild(stream, toBufferView(entry.uncompactedBuffer), scratchBuffer);
+                if (entry.allowCompaction)
+                    workingSetSize += entry.memReq.outputSizeInBytes;
+            }
+            m_peakWorkingSetSize = std::max(m_peakWorkingSetSize, workingSetSize);
+        }
+
+        void compactGroup(CUstream stream, Entry* entries, uint32_t numEntries) {
+            // JP: コンパクション後のサイズの読み戻しはグループ内でまとめて一度だけ待たれる。
+            // EN: Readback of the sizes after compaction is waited only once for a group.
+            for (uint32_t i = 0; i < numEntries; ++i) {
+                Entry &entry = entries[i];
+                if (!entry.allowCompaction)
+                    continue;
+                size_t compactedSize;
+                entry.gas.prepareForCompact(&compactedSize);
+                entry.compactedBuffer = allocate(m_resultArena, compactedSize);
+                entry.gas.compact(stream, toBufferView(entry.compactedBuffer));
+            }
+            for (uint32_t i = 0; i < numEntries; ++i) {
+                Entry &entry = entries[i];
+                if (!entry.allowCompaction)
+                    continue;
+                entry.gas.removeUncompacted();
+                m_workArena->release(entry.uncompactedBuffer);
+                entry.uncompactedBuffer = cudau::DeviceMemoryArena::Allocation();
+            }
+        }
+
+    public:
+        GASBuildScheduler() :
+            m_workArena(nullptr), m_resultArena(nullptr),
+            m_sequencing(GASBuildSequencing::BuildAllThenCompact), m_maxWorkingSetSize(0),
+            m_peakWorkingSetSize(0) {}
+        ~GASBuildScheduler() {
+            finalize();
+        }
+
+        // JP: workArenaからはスクラッチとコンパクト前のバッファーを、resultArenaからは最終的なバッファーを確保する。
+        //     両者に同じアリーナを渡しても良い。maxWorkingSetSizeはMinimizePeakMemoryでのグループ当たりの
+        //     コンパクト前のサイズの上限(0で1グループ1GAS)。
+        //     アリーナのアラインメントはOPTIX_ACCEL_BUFFER_BYTE_ALIGNMENTの倍数である必要がある。
+        // EN: Scratch and uncompacted buffers are allocated from workArena, and final buffers from resultArena.
+        //     The same arena can be passed to both. maxWorkingSetSize is the limit of uncompacted sizes per group
+        //     with MinimizePeakMemory (0 for one GAS per group).
+        //     Alignment of the arenas needs to be a multiple of OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT.
+        void initialize(cudau::DeviceMemoryArena* workArena, cudau::DeviceMemoryArena* resultArena,
+                        GASBuildSequencing sequencing, size_t maxWorkingSetSize = 0) {
+            checkAlignment(workArena);
+            checkAlignment(resultArena);
+            m_workArena = workArena;
+            m_resultArena = resultArena;
+            m_sequencing = sequencing;
+            m_maxWorkingSetSize = maxWorkingSetSize;
+            m_peakWorkingSetSize = 0;
+        }
+        // JP: 保持している結果のバッファーを全て解放する。GPUがGASを使い終わってから呼ぶ。
+        // EN: Release all the held result buffers. Call this after the GPU finishes using the GASs.
+        void finalize() {
+            for (Entry &entry : m_builtEntries) {
+                if (entry.compactedBuffer.isValid())
+                    m_resultArena->release(entry.compactedBuffer);
+                if (entry.uncompactedBuffer.isValid())
+                    m_resultArena->release(entry.uncompactedBuffer);
+            }
+            m_builtEntries.clear();
+            m_pendingEntries.clear();
+            m_workArena = nullptr;
+            m_resultArena = nullptr;
+        }
+
+        void addGAS(GeometryAccelerationStructure gas) {
+            Entry entry = {};
+            entry.gas = gas;
+            m_pendingEntries.push_back(entry);
+        }
+
+        // JP: 追加されたGASのprepareForBuild()からコンパクションまでを行う。
+        //     コンパクションのサイズの読み戻しやremoveUncompacted()でホスト側の同期を伴う。
+        // EN: Perform from prepareForBuild() to compaction of the added GASs.
+        //     This involves host-side synchronization by the readback of compaction sizes and removeUncompacted().
+        void build(CUstream stream) {
+            if (!m_workArena)
+                throw std::runtime_error("GASBuildScheduler is not initialized.");
+            if (m_pendingEntries.empty())
+                return;
+
+            size_t maxScratchSize = 0;
+            for (Entry &entry : m_pendingEntries) {
+                entry.gas.prepareForBuild(&entry.memReq);
+                entry.gas.getConfiguration(nullptr, nullptr, &entry.allowCompaction, nullptr);
+                maxScratchSize = std::max(maxScratchSize, entry.memReq.tempSizeInBytes);
+            }
+
+            // JP: 同じストリーム上のビルドは直列に実行されるので一つのスクラッチバッファーを共有できる。
+            //     MinimizePeakMemoryではコンパクト前のサイズの大きい順に処理し、大きな空き領域を先に使い回す。
+            // EN: Builds on the same stream execute serially, so one scratch buffer can be shared.
+            //     MinimizePeakMemory processes in descending order of uncompacted sizes
+            //     to reuse large free regions first.
+            cudau::DeviceMemoryArena::Allocation scratchBuffer = allocate(m_workArena, maxScratchSize);
+            uint32_t numEntries = static_cast<uint32_t>(m_pendingEntries.size());
+            if (m_sequencing == GASBuildSequencing::MinimizePeakMemory) {
+                std::stable_sort(m_pendingEntries.begin(), m_pendingEntries.end(),
+                                 [](const Entry &a, const Entry &b) {
+                                     return a.memReq.outputSizeInBytes > b.memReq.outputSizeInBytes;
+                                 });
+                for (uint32_t groupBegin = 0; groupBegin < numEntries;) {
+                    uint32_t groupEnd = groupBegin + 1;
+                    size_t groupSize = m_pendingEntries[groupBegin].memReq.outputSizeInBytes;
+                    while (groupEnd < numEntries &&
+                           groupSize + m_pendingEntries[groupEnd].memReq.outputSizeInBytes <= m_maxWorkingSetSize) {
+                        groupSize += m_pendingEntries[groupEnd].memReq.outputSizeInBytes;
+                        ++groupEnd;
+                    }
+                    buildGroup(stream, &m_pendingEntries[groupBegin], groupEnd - groupBegin,
+                               toBufferView(scratchBuffer));
+                    compactGroup(stream, &m_pendingEntries[groupBegin], groupEnd - groupBegin);
+                    groupBegin = groupEnd;
+                }
+            }
+            else {
+                buildGroup(stream, m_pendingEntries.data(), numEntries, toBufferView(scratchBuffer));
+                compactGroup(stream, m_pendingEntries.data(), numEntries);
+            }
+            // JP: スクラッチバッファーを使う最後のビルドを待ってから解放する。
+            // EN: Release the scratch buffer after waiting for the last build using it.
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            m_workArena->release(scratchBuffer);
+
+            m_builtEntries.insert(m_builtEntries.end(), m_pendingEntries.cbegin(), m_pendingEntries.cend());
+            m_pendingEntries.clear();
+        }
+
+        // JP: GASの結果のバッファーを解放する。GPUがGASを使い終わってから呼ぶ。
+        // EN: Release the result buffer of a GAS. Call this after the GPU finishes using the GAS.
+        void release(GeometryAccelerationStructure gas) {
+            for (auto it = m_builtEntries.begin(); it != m_builtEntries.end(); ++it) {
+                if (it->gas != gas)
+                    continue;
+                if (it->compactedBuffer.isValid())
+                    m_resultArena->release(it->compactedBuffer);
+                if (it->uncompactedBuffer.isValid())
+                    m_resultArena->release(it->uncompactedBuffer);
+                m_builtEntries.erase(it);
+                return;
+            }
+        }
+
+        // JP: これまでのbuild()で同時に保持したコンパクト前のバッファーの合計の最大値。
+        // EN: The maximum of the total of uncompacted buffers held at once in build() so far.
+        size_t getPeakWorkingSetSize() const {
+            return m_peakWorkingSetSize;
+        }
+    };
+#endif // !defined(__CUDA_ARCH__)
+}
+
+#if !defined(__CUDA_ARCH__)
+
+template <>
+cudau::Buffer::operator optixu::BufferView() const {
+    return optixu::BufferView(getCUdeviceptr(), numElements(), stride());
+}
+
+template <>
+cudau::DeviceMemoryArena::Allocation::operator optixu::BufferView() const {
+    return optixu::BufferView(devicePointer, size, 1);
+}
+
+template <>
+cudau::BufferSubRange::operator optixu::BufferView() const {
+    return optixu::BufferView(devicePointer, numElements, stride);
 }
 
 //inline optixu::BufferView getView(const cudau::Buffer &buffer) {
@@ -0,0 +1,492 @@
+﻿/*
+
+JP: このサンプルはGASのビルド設定ごとのビルド時間、サイズ、リフィット時間、トレース性能を計測します。
+    obj::loadで読み込んだアセットごとに、ASTradeoff、コンパクションとアップデートの許可、
+    頂点・インデックスのフォーマット、ビルド入力の統合(マテリアルグループを一つのジオメトリに
+    まとめるか否か)の全組み合わせを試し、結果をCSV形式で出力します。
+    トレース性能はアセットのAABBから決まる固定のレイ集合で計測するので、設定間で直接比較できます。
+    アセットの種類ごとの結果からsetConfiguration()の引数を自動で選ぶためのデータ収集を意図しています。
+
+EN: This sample measures build time, size, refit time and trace performance per GAS build configuration.
+    For each asset loaded by obj::load, it tries all the combinations of ASTradeoff, allowing compaction and
+    update, vertex/index formats and build input merging (whether to combine material groups into
+    a single geometry), then outputs the results in the CSV format.
+    Trace performance is measured with a fixed ray set determined by the AABB of the asset,
+    so it can be compared directly between configurations.
+    This is intended for collecting data to choose arguments of setConfiguration() automatically
+    per asset class.
+
+    Usage: as_benchmark [--iterations <N>] [--rays <N>] [<OBJ file> ...]
+
+*/
+
+#include "as_benchmark_shared.h"
+#include "../common/obj_loader.h"
+
+struct BenchmarkConfig {
+    optixu::ASTradeoff tradeoff;
+    bool allowCompaction;
+    bool allowUpdate;
+    OptixVertexFormat vertexFormat;
+    OptixIndicesFormat indexFormat;
+    // JP: 真の場合は全マテリアルグループを一つのビルド入力にまとめる。
+    // EN: Combine all the material groups into a single build input when true.
+    bool mergeInputs;
+};
+
+struct BenchmarkResult {
+    float buildTime;
+    size_t outputSize;
+    size_t compactedSize;
+    float compactionTime;
+    float refitTime;
+    float traceTime;
+    double raysPerSecond;
+};
+
+struct Triangle16 {
+    uint16_t v[3];
+};
+
+// JP: アセットのデバイス上のデータ。マテリアルグループごとの三角形バッファーと、
+//     全グループをひとつにまとめた三角形バッファーをそれぞれのインデックスフォーマットで持つ。
+//     16ビットインデックスは頂点数が収まる場合のみ用意する。
+// EN: Device-side data of an asset. Holds triangle buffers per material group and
+//     a triangle buffer combining all the groups, each in each index format.
+//     16-bit indices are prepared only when the number of vertices fits.
+struct AssetData {
+    std::string name;
+    uint32_t numTriangles;
+    cudau::TypedBuffer<float3> positions;
+    cudau::Buffer halfPositions;
+    std::vector<cudau::TypedBuffer<obj::Triangle>> groupTriangles;
+    std::vector<cudau::TypedBuffer<Triangle16>> groupTriangles16;
+    cudau::TypedBuffer<obj::Triangle> mergedTriangles;
+    cudau::TypedBuffer<Triangle16> mergedTriangles16;
+    cudau::TypedBuffer<Shared::Ray> rays;
+
+    bool supportsShortIndices() const {
+        return mergedTriangles16.isInitialized();
+    }
+
+    void finalize() {
+        rays.finalize();
+        mergedTriangles16.finalize();
+        mergedTriangles.finalize();
+        for (int i = static_cast<int>(groupTriangles16.size()) - 1; i >= 0; --i)
+            groupTriangles16[i].finalize();
+        for (int i = static_cast<int>(groupTriangles.size()) - 1; i >= 0; --i)
+            groupTriangles[i].finalize();
+        halfPositions.finalize();
+        positions.finalize();
+    }
+};
+
+struct PipelineData {
+    optixu::Pipeline pipeline;
+    optixu::Module moduleOptiX;
+    optixu::ProgramGroup rayGenProgram;
+    optixu::ProgramGroup missProgram;
+    optixu::ProgramGroup hitProgramGroup;
+    optixu::Material material;
+    cudau::Buffer shaderBindingTable;
+};
+
+static void loadAsset(CUcontext cuContext, const std::filesystem::path &filepath, uint32_t numRays,
+                      AssetData* asset) {
+    std::vector<obj::Vertex> vertices;
+    std::vector<obj::MaterialGroup> matGroups;
+    obj::load(filepath, &vertices, &matGroups, nullptr);
+    if (vertices.empty() || matGroups.empty())
+        throw std::runtime_error("Failed to load the asset or it is empty.");
+
+    asset->name = filepath.stem().string();
+
+    std::vector<float3> positions(vertices.size());
+    std::vector<uint16_t> halfPositions(3 * vertices.size());
+    AABB aabb;
+    for (uint32_t vIdx = 0; vIdx < vertices.size(); ++vIdx) {
+        const float3 &p = vertices[vIdx].position;
+        positions[vIdx] = p;
+        halfPositions[3 * vIdx + 0] = cudau::floatToHalf(p.x);
+        halfPositions[3 * vIdx + 1] = cudau::floatToHalf(p.y);
+        halfPositions[3 * vIdx + 2] = cudau::floatToHalf(p.z);
+        aabb.unify(p);
+    }
+    asset->positions.initialize(cuContext, cudau::BufferType::Device, positions);
+    // JP: HALF3の頂点は詰めた3つのuint16_tとしてストライド6バイトで置く。
+    // EN: HALF3 vertices are laid out as three packed uint16_t with a 6-byte stride.
+    asset->halfPositions.initialize(cuContext, cudau::BufferType::Device,
+                                    static_cast<uint32_t>(vertices.size()), 3 * sizeof(uint16_t));
+    asset->halfPositions.write(halfPositions);
+
+    const bool fitsShortIndices = vertices.size() <= 65536;
+    std::vector<obj::Triangle> mergedTriangles;
+    std::vector<Triangle16> mergedTriangles16;
+    asset->groupTriangles.resize(matGroups.size());
+    asset->groupTriangles16.resize(matGroups.size());
+    for (uint32_t groupIdx = 0; groupIdx < matGroups.size(); ++groupIdx) {
+        const std::vector<obj::Triangle> &triangles = matGroups[groupIdx].triangles;
+        asset->groupTriangles[groupIdx].initialize(cuContext, cudau::BufferType::Device, triangles);
+        mergedTriangles.insert(mergedTriangles.end(), triangles.cbegin(), triangles.cend());
+        if (fitsShortIndices) {
+            std::vector<Triangle16> triangles16(triangles.size());
+            for (uint32_t triIdx = 0; triIdx < triangles.size(); ++triIdx) {
+                for (uint32_t i = 0; i < 3; ++i)
+                    triangles16[triIdx].v[i] = static_cast<uint16_t>(triangles[triIdx].v[i]);
+            }
+            asset->groupTriangles16[groupIdx].initialize(cuContext, cudau::BufferType::Device, triangles16);
+            mergedTriangles16.insert(mergedTriangles16.end(), triangles16.cbegin(), triangles16.cend());
+        }
+    }
+    asset->numTriangles = static_cast<uint32_t>(mergedTriangles.size());
+    asset->mergedTriangles.initialize(cuContext, cudau::BufferType::Device, mergedTriangles);
+    if (fitsShortIndices)
+        asset->mergedTriangles16.initialize(cuContext, cudau::BufferType::Device, mergedTriangles16);
+
+    // JP: AABBの外接球上から、AABB内のランダムな点に向かうレイを固定のシードで生成する。
+    // EN: Generate rays from the circumscribed sphere of the AABB toward random points in the AABB
+    //     with a fixed seed.
+    std::mt19937 rng(161803398);
+    std::uniform_real_distribution<float> u01;
+    const float3 center = 0.5f * (aabb.minP + aabb.maxP);
+    const float3 extent = aabb.maxP - aabb.minP;
+    const float radius = 0.5f * length(extent);
+    std::vector<Shared::Ray> rays(numRays);
+    for (Shared::Ray &ray : rays) {
+        float z = 2 * u01(rng) - 1;
+        float phi = static_cast<float>(2 * M_PI) * u01(rng);
+        float r = std::sqrt(std::fmax(1 - z * z, 0.0f));
+        ray.origin = center + 2 * radius * make_float3(r * std::cos(phi), r * std::sin(phi), z);
+        float3 target = aabb.minP + make_float3(u01(rng), u01(rng), u01(rng)) * extent;
+        ray.direction = normalize(target - ray.origin);
+    }
+    asset->rays.initialize(cuContext, cudau::BufferType::Device, rays);
+}
+
+static BenchmarkResult runBenchmark(
+    CUcontext cuContext, CUstream cuStream, optixu::Context optixContext, PipelineData &pl,
+    const AssetData &asset, const BenchmarkConfig &config, uint32_t numIterations) {
+    const bool useShortIndices = config.indexFormat == OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3;
+
+    optixu::Scene scene = optixContext.createScene();
+
+    const uint32_t numGeomInsts = config.mergeInputs ? 1 : static_cast<uint32_t>(asset.groupTriangles.size());
+    std::vector<optixu::GeometryInstance> geomInsts(numGeomInsts);
+    for (uint32_t geomInstIdx = 0; geomInstIdx < numGeomInsts; ++geomInstIdx) {
+        optixu::GeometryInstance &geomInst = geomInsts[geomInstIdx];
+        geomInst = scene.createGeometryInstance();
+        geomInst.setVertexFormat(config.vertexFormat);
+        if (config.vertexFormat == OPTIX_VERTEX_FORMAT_HALF3)
+            geomInst.setVertexBuffer(asset.halfPositions);
+        else
+            geomInst.setVertexBuffer(asset.positions);
+        if (config.mergeInputs) {
+            if (useShortIndices)
+                geomInst.setTriangleBuffer(asset.mergedTriangles16, config.indexFormat);
+            else
+                geomInst.setTriangleBuffer(asset.mergedTriangles, config.indexFormat);
+        }
+        else {
+            if (useShortIndices)
+                geomInst.setTriangleBuffer(asset.groupTriangles16[geomInstIdx], config.indexFormat);
+            else
+                geomInst.setTriangleBuffer(asset.groupTriangles[geomInstIdx], config.indexFormat);
+        }
+        geomInst.setNumMaterials(1, optixu::BufferView());
+        geomInst.setMaterial(0, 0, pl.material);
+        geomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
+    }
+
+    OptixAccelBufferSizes asMemReqs;
+    optixu::GeometryAccelerationStructure gas = scene.createGeometryAccelerationStructure();
+    gas.setConfiguration(config.tradeoff, config.allowUpdate, config.allowCompaction, false);
+    gas.setNumMaterialSets(1);
+    gas.setNumRayTypes(0, Shared::NumRayTypes);
+    for (const optixu::GeometryInstance &geomInst : geomInsts)
+        gas.addChild(geomInst);
+    gas.prepareForBuild(&asMemReqs);
+
+    cudau::Buffer gasMem;
+    cudau::Buffer compactedGasMem;
+    cudau::Buffer asBuildScratchMem;
+    gasMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
+    asBuildScratchMem.initialize(cuContext, cudau::BufferType::Device,
+                                 std::max(asMemReqs.tempSizeInBytes, asMemReqs.tempUpdateSizeInBytes), 1);
+
+    BenchmarkResult result = {};
+    result.outputSize = asMemReqs.outputSizeInBytes;
+    result.compactedSize = asMemReqs.outputSizeInBytes;
+
+    cudau::Timer timer;
+    timer.initialize(cuContext);
+
+    // JP: 最初のビルドはウォームアップとして計測から除く。
+    // EN: Exclude the first build from the measurement as warm-up.
+    OptixTraversableHandle travHandle = gas.rebuild(cuStream, gasMem, asBuildScratchMem);
+    for (uint32_t it = 0; it < numIterations; ++it) {
+        timer.start(cuStream);
+        travHandle = gas.rebuild(cuStream, gasMem, asBuildScratchMem);
+        timer.stop(cuStream);
+        result.buildTime += timer.report();
+    }
+    result.buildTime /= numIterations;
+
+    if (config.allowCompaction) {
+        gas.prepareForCompact(&result.compactedSize);
+        compactedGasMem.initialize(cuContext, cudau::BufferType::Device, result.compactedSize, 1);
+        timer.start(cuStream);
+        travHandle = gas.compact(cuStream, compactedGasMem);
+        timer.stop(cuStream);
+        result.compactionTime = timer.report();
+        gas.removeUncompacted();
+    }
+
+    // JP: 頂点は変えずにアップデートするので、リフィット自体のコストを計測することになる。
+    // EN: Update without changing vertices, so this measures the cost of the refit itself.
+    if (config.allowUpdate) {
+        for (uint32_t it = 0; it < numIterations; ++it) {
+            timer.start(cuStream);
+            gas.update(cuStream, asBuildScratchMem);
+            timer.stop(cuStream);
+            result.refitTime += timer.report();
+        }
+        result.refitTime /= numIterations;
+    }
+
+    cudau::Buffer hitGroupSBT;
+    size_t hitGroupSbtSize;
+    scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
+    hitGroupSBT.initialize(cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
+    hitGroupSBT.setMappedMemoryPersistent(true);
+
+    pl.pipeline.setScene(scene);
+    pl.pipeline.setHitGroupShaderBindingTable(hitGroupSBT, hitGroupSBT.getMappedPointer());
+
+    cudau::TypedBuffer<uint32_t> resultBuffer;
+    resultBuffer.initialize(cuContext, cudau::BufferType::Device, asset.rays.numElements());
+
+    Shared::PipelineLaunchParameters plp;
+    plp.travHandle = travHandle;
+    plp.rays = asset.rays.getDevicePointer();
+    plp.resultBuffer = resultBuffer.getDevicePointer();
+    plp.numRays = asset.rays.numElements();
+
+    CUdeviceptr plpOnDevice;
+    CUDADRV_CHECK(cuMemAlloc(&plpOnDevice, sizeof(plp)));
+    CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+
+    // JP: 最初のローンチはSBTのセットアップを含むので計測から除く。
+    // EN: Exclude the first launch from the measurement since it includes SBT setup.
+    pl.pipeline.launch(cuStream, plpOnDevice, plp.numRays, 1, 1);
+    for (uint32_t it = 0; it < numIterations; ++it) {
+        timer.start(cuStream);
+        pl.pipeline.launch(cuStream, plpOnDevice, plp.numRays, 1, 1);
+        timer.stop(cuStream);
+        result.traceTime += timer.report();
+    }
+    result.traceTime /= numIterations;
+    result.raysPerSecond = plp.numRays / (result.traceTime * 1e-3);
+
+    timer.finalize();
+
+
+
+    CUDADRV_CHECK(cuMemFree(plpOnDevice));
+
+    resultBuffer.finalize();
+
+    hitGroupSBT.finalize();
+
+    asBuildScratchMem.finalize();
+    compactedGasMem.finalize();
+    gasMem.finalize();
+    gas.destroy();
+
+    for (int geomInstIdx = static_cast<int>(numGeomInsts) - 1; geomInstIdx >= 0; --geomInstIdx)
+        geomInsts[geomInstIdx].destroy();
+
+    scene.destroy();
+
+    return result;
+}
+
+int32_t main(int32_t argc, const char* argv[]) try {
+    uint32_t numIterations = 10;
+    uint32_t numRays = 1 << 22;
+    std::vector<std::filesystem::path> assetPaths;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg.size() < 2 || arg.substr(0, 2) != "--") {
+            assetPaths.push_back(arg);
+            ++argIdx;
+            continue;
+        }
+        if (argIdx + 1 >= argc)
+            throw std::runtime_error("Missing value for a command line argument.");
+        uint32_t value = std::max(std::atoi(argv[argIdx + 1]), 1);
+        if (arg == "--iterations")
+            numIterations = value;
+        else if (arg == "--rays")
+            numRays = value;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        argIdx += 2;
+    }
+    if (assetPaths.empty()) {
+        assetPaths.push_back("../../data/stanford_bunny_309_faces.obj");
+        assetPaths.push_back("../../data/subd_cube.obj");
+    }
+
+
+
+    CUcontext cuContext;
+    int32_t cuDeviceCount;
+    CUstream cuStream;
+    CUDADRV_CHECK(cuInit(0));
+    CUDADRV_CHECK(cuDeviceGetCount(&cuDeviceCount));
+    CUDADRV_CHECK(cuCtxCreate(&cuContext, 0, 0));
+    CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
+    CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
+
+    optixu::Context optixContext = optixu::Context::create(cuContext);
+
+    // JP: パイプラインは全設定で共通。GASを直接トレースする。
+    // EN: The pipeline is common to all the configurations. Trace the GAS directly.
+    PipelineData pl;
+    pl.pipeline = optixContext.createPipeline();
+    pl.pipeline.setPipelineOptions(optixu::calcSumDwords<uint32_t>(),
+                                   optixu::calcSumDwords<float2>(),
+                                   "plp", sizeof(Shared::PipelineLaunchParameters),
+                                   false, OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS,
+                                   OPTIX_EXCEPTION_FLAG_NONE,
+                                   OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE);
+
+    const std::string ptx = readTxtFile(getExecutableDirectory() / "as_benchmark/ptxes/optix_kernels.ptx");
+    pl.moduleOptiX = pl.pipeline.createModuleFromPTXString(
+        ptx, OPTIX_COMPILE_DEFAULT_MAX_REGISTER_COUNT,
+        OPTIX_COMPILE_OPTIMIZATION_DEFAULT, OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+
+    optixu::Module emptyModule;
+
+    pl.rayGenProgram = pl.pipeline.createRayGenProgram(pl.moduleOptiX, RT_RG_NAME_STR("raygen"));
+    pl.missProgram = pl.pipeline.createMissProgram(pl.moduleOptiX, RT_MS_NAME_STR("miss"));
+    pl.hitProgramGroup = pl.pipeline.createHitProgramGroupForBuiltinIS(
+        OPTIX_PRIMITIVE_TYPE_TRIANGLE,
+        pl.moduleOptiX, RT_CH_NAME_STR("closesthit"),
+        emptyModule, nullptr);
+
+    pl.pipeline.link(1, OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+    pl.pipeline.computeAndSetStackSize(1, 0, 0, 1);
+
+    pl.pipeline.setRayGenerationProgram(pl.rayGenProgram);
+    pl.pipeline.setNumMissRayTypes(Shared::NumRayTypes);
+    pl.pipeline.setMissProgram(Shared::RayType_Primary, pl.missProgram);
+
+    size_t sbtSize;
+    pl.pipeline.generateShaderBindingTableLayout(&sbtSize);
+    pl.shaderBindingTable.initialize(cuContext, cudau::BufferType::Device, sbtSize, 1);
+    pl.shaderBindingTable.setMappedMemoryPersistent(true);
+    pl.pipeline.setShaderBindingTable(pl.shaderBindingTable, pl.shaderBindingTable.getMappedPointer());
+
+    pl.material = optixContext.createMaterial();
+    pl.material.setHitGroup(Shared::RayType_Primary, pl.hitProgramGroup);
+
+    char deviceName[256];
+    CUdevice cuDevice;
+    CUDADRV_CHECK(cuCtxGetDevice(&cuDevice));
+    CUDADRV_CHECK(cuDeviceGetName(deviceName, sizeof(deviceName), cuDevice));
+    hpprintf("# Device: %s\n", deviceName);
+    hpprintf("# Rays: %u, Iterations: %u\n", numRays, numIterations);
+
+
+
+    struct TradeoffEntry {
+        optixu::ASTradeoff tradeoff;
+        const char* name;
+    };
+    const TradeoffEntry tradeoffs[] = {
+        { optixu::ASTradeoff::Default, "Default" },
+        { optixu::ASTradeoff::PreferFastTrace, "PreferFastTrace" },
+        { optixu::ASTradeoff::PreferFastBuild, "PreferFastBuild" },
+    };
+    const OptixVertexFormat vertexFormats[] = { OPTIX_VERTEX_FORMAT_FLOAT3, OPTIX_VERTEX_FORMAT_HALF3 };
+    const OptixIndicesFormat indexFormats[] = {
+        OPTIX_INDICES_FORMAT_UNSIGNED_INT3, OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3
+    };
+
+    hpprintf("asset,triangles,inputs,tradeoff,compaction,update,vertex,index,"
+             "build[ms],output[B],compacted[B],compaction[ms],refit[ms],trace[ms],Mrays/s\n");
+    for (const std::filesystem::path &assetPath : assetPaths) {
+        AssetData asset;
+        loadAsset(cuContext, assetPath, numRays, &asset);
+        hpprintf("# %s: %u triangles, %u material groups%s\n",
+                 asset.name.c_str(), asset.numTriangles, static_cast<uint32_t>(asset.groupTriangles.size()),
+                 asset.supportsShortIndices() ? "" : " (16-bit indices skipped)");
+
+        for (const TradeoffEntry &tradeoff : tradeoffs) {
+            for (uint32_t flags = 0; flags < 4; ++flags) {
+                for (OptixVertexFormat vertexFormat : vertexFormats) {
+                    for (OptixIndicesFormat indexFormat : indexFormats) {
+                        if (indexFormat == OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3 && !asset.supportsShortIndices())
+                            continue;
+                        for (uint32_t merge = 0; merge < 2; ++merge) {
+                            // JP: マテリアルグループがひとつの場合、統合の有無は同じビルド入力になる。
+                            // EN: With a single material group, merging or not results in the same build input.
+                            if (merge == 0 && asset.groupTriangles.size() == 1)
+                                continue;
+
+                            BenchmarkConfig config;
+                            config.tradeoff = tradeoff.tradeoff;
+                            config.allowCompaction = (flags & 0b01) != 0;
+                            config.allowUpdate = (flags & 0b10) != 0;
+                            config.vertexFormat = vertexFormat;
+                            config.indexFormat = indexFormat;
+                            config.mergeInputs = merge != 0;
+
+                            BenchmarkResult result = runBenchmark(
+                                cuContext, cuStream, optixContext, pl, asset, config, numIterations);
+                            uint32_t numInputs = config.mergeInputs ?
+                                1 : static_cast<uint32_t>(asset.groupTriangles.size());
+                            hpprintf("%s,%u,%u,%s,%u,%u,%s,%s,%.3f,%llu,%llu,%.3f,%.3f,%.3f,%.2f\n",
+                                     asset.name.c_str(), asset.numTriangles, numInputs, tradeoff.name,
+                                     config.allowCompaction ? 1 : 0, config.allowUpdate ? 1 : 0,
+                                     vertexFormat == OPTIX_VERTEX_FORMAT_HALF3 ? "half3" : "float3",
+                                     indexFormat == OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3 ? "short3" : "int3",
+                                     result.buildTime,
+                                     static_cast<unsigned long long>(result.outputSize),
+                                     static_cast<unsigned long long>(result.compactedSize),
+                                     result.compactionTime, result.refitTime,
+                                     result.traceTime, result.raysPerSecond * 1e-6);
+                        }
+                    }
+                }
+            }
+        }
+
+        asset.finalize();
+    }
+
+
+
+    pl.material.destroy();
+    pl.shaderBindingTable.finalize();
+    pl.hitProgramGroup.destroy();
+    pl.missProgram.destroy();
+    pl.rayGenProgram.destroy();
+    pl.moduleOptiX.destroy();
+    pl.pipeline.destroy();
+
+    optixContext.destroy();
+
+    CUDADRV_CHECK(cuStreamDestroy(cuStream));
+    CUDADRV_CHECK(cuCtxDestroy(cuContext));
+
+    return 0;
+}
+catch (const std::exception &ex) {
+    hpprintf("Error: %s\n", ex.what());
+    return -1;
+}
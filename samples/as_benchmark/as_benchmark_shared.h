@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include "../common/common.h"
+
+namespace Shared {
+    enum RayType {
+        RayType_Primary = 0,
+        NumRayTypes
+    };
+
+
+
+    struct Ray {
+        float3 origin;
+        float3 direction;
+    };
+
+    struct PipelineLaunchParameters {
+        OptixTraversableHandle travHandle;
+        const Ray* rays;
+        uint32_t* resultBuffer;
+        uint32_t numRays;
+    };
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "as_benchmark_shared.h"
+
+using namespace Shared;
+
+RT_PIPELINE_LAUNCH_PARAMETERS PipelineLaunchParameters plp;
+
+
+
+// JP: 固定のレイ集合をトレースし、ヒットしたプリミティブのインデックスを書き出す。
+//     ASの設定が変わってもトレースするレイは同じなので、秒間レイ数を設定間で直接比較できる。
+// EN: Trace the fixed ray set and write out the index of the hit primitive.
+//     Rays traced are the same even when the AS configuration changes,
+//     so rays per second can be compared directly between configurations.
+CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen)() {
+    uint32_t rayIdx = optixGetLaunchIndex().x;
+    if (rayIdx >= plp.numRays)
+        return;
+
+    const Ray &ray = plp.rays[rayIdx];
+    uint32_t hitInfo = 0xFFFFFFFF;
+    optixu::trace<uint32_t>(
+        plp.travHandle, ray.origin, ray.direction,
+        0.0f, FLT_MAX, 0.0f, 0xFF, OPTIX_RAY_FLAG_NONE,
+        RayType_Primary, NumRayTypes, RayType_Primary,
+        hitInfo);
+
+    plp.resultBuffer[rayIdx] = hitInfo;
+}
+
+CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
+}
+
+CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
+    uint32_t hitInfo = optixGetPrimitiveIndex() ^ (optixGetSbtGASIndex() << 24);
+    optixu::setPayloads<uint32_t>(&hitInfo);
+}
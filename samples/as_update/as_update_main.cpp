@@ -8,11 +8,20 @@ EN: This sample shows how to update GAS and IAS.
     Building an acceleration structure from scratch is costly in general so only updating is sometime
     preferrable instead of rebuild when the displacement of each vertex or instance is small.
 
+    --change-detection:
+    JP: 変形後の頂点バッファーの内容のハッシュをcontent_hash::ChangeDetectorで毎フレーム比較し、
+        変化していない場合はBunnyのGASのアップデートを省く。UIで変形を止めて省かれた回数を確認できる。
+    EN: Compare hashes of the contents of the deformed vertex buffer every frame with content_hash::ChangeDetector,
+        and skip updating the GAS of bunny when unchanged. Stop the deformation in the UI to see the skipped count.
+
 */
 
 #include "as_update_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/dynamic_mesh.h"
+#include "../common/render_loop.h"
+#include "../common/content_hash.h"
 
 // Include glfw3.h after our OpenGL definitions
 #include "../common/gl_util.h"
@@ -90,16 +99,29 @@ int32_t main(int32_t argc, const char* argv[]) try {
     const std::filesystem::path exeDir = getExecutableDirectory();
 
     bool takeScreenShot = false;
+    bool useRenderThread = false;
+    bool useChangeDetection = false;
+    BenchmarkOptions benchOptions;
 
     uint32_t argIdx = 1;
     while (argIdx < argc) {
+        if (parseBenchmarkArgument(argc, argv, &argIdx, &benchOptions))
+            continue;
         std::string_view arg = argv[argIdx];
         if (arg == "--screen-shot")
             takeScreenShot = true;
+        else if (arg == "--render-thread")
+            useRenderThread = true;
+        else if (arg == "--change-detection")
+            useChangeDetection = true;
         else
             throw std::runtime_error("Unknown command line argument.");
         ++argIdx;
     }
+    if (useRenderThread && benchOptions.enabled)
+        throw std::runtime_error("--render-thread cannot be combined with benchmarking.");
+    if (useRenderThread && useChangeDetection)
+        throw std::runtime_error("--render-thread cannot be combined with --change-detection.");
 
     // ----------------------------------------------------------------
     // JP: OpenGL, GLFWの初期化。
@@ -127,6 +149,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
         glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
 
     glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
+    // JP: ベンチマークモードではウインドウを表示しない。
+    // EN: Don't show the window in the benchmark mode.
+    if (benchOptions.enabled)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     int32_t renderTargetSizeX = 640;
     int32_t renderTargetSizeY = 640;
@@ -306,6 +332,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
     CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
 
+    BenchmarkRecorder bench;
+    if (benchOptions.enabled)
+        bench.initialize(cuContext, "as_update", benchOptions);
+
     optixu::Context optixContext = optixu::Context::create(cuContext);
 
     optixu::Pipeline pipeline = optixContext.createPipeline();
@@ -360,9 +390,14 @@ int32_t main(int32_t argc, const char* argv[]) try {
     // EN: Prepare kernels for vertex displacement and recalculate normals.
     CUmodule moduleDeform;
     CUDADRV_CHECK(cuModuleLoad(&moduleDeform, (getExecutableDirectory() / "as_update/ptxes/deform.ptx").string().c_str()));
-    cudau::Kernel deform(moduleDeform, "deform", cudau::dim3(32), 0);
-    cudau::Kernel accumulateVertexNormals(moduleDeform, "accumulateVertexNormals", cudau::dim3(32), 0);
-    cudau::Kernel normalizeVertexNormals(moduleDeform, "normalizeVertexNormals", cudau::dim3(32), 0);
+    cudau::Kernel deform(moduleDeform, "deform", cudau::AutoBlockDim(), 0);
+    cudau::Kernel recomputeVertexNormals(moduleDeform, "recomputeVertexNormals", cudau::AutoBlockDim(), 0);
+
+    CUmodule moduleContentHash = nullptr;
+    if (useChangeDetection)
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleContentHash,
+            (getExecutableDirectory() / "as_update/ptxes/content_hash_kernels.ptx").string().c_str()));
 
     // END: Settings for OptiX context and pipeline.
     // ----------------------------------------------------------------
@@ -481,6 +516,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cudau::TypedBuffer<Shared::Vertex> bunnyVertexBuffer;
     cudau::TypedBuffer<Shared::Triangle> bunnyTriangleBuffer;
     cudau::TypedBuffer<Shared::Vertex> deformedBunnyVertexBuffer;
+    cudau::TypedBuffer<uint32_t> bunnyAdjacencyOffsetBuffer;
+    cudau::TypedBuffer<uint32_t> bunnyAdjacentTriangleBuffer;
     {
         std::vector<Shared::Vertex> vertices;
         std::vector<Shared::Triangle> triangles;
@@ -506,6 +543,16 @@ int32_t main(int32_t argc, const char* argv[]) try {
         bunnyTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
         deformedBunnyVertexBuffer = bunnyVertexBuffer.copy();
 
+        // JP: 法線の再計算用に頂点→三角形の隣接情報を一度だけ構築しておく。
+        // EN: Build vertex-to-triangle adjacency once for recomputing normals.
+        std::vector<uint32_t> adjacencyOffsets;
+        std::vector<uint32_t> adjacentTriangles;
+        dynamic_mesh::buildVertexAdjacency(triangles.data(), static_cast<uint32_t>(triangles.size()),
+                                           static_cast<uint32_t>(vertices.size()),
+                                           &adjacencyOffsets, &adjacentTriangles);
+        bunnyAdjacencyOffsetBuffer.initialize(cuContext, cudau::BufferType::Device, adjacencyOffsets);
+        bunnyAdjacentTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, adjacentTriangles);
+
         Shared::GeometryData geomData = {};
         geomData.vertexBuffer = deformedBunnyVertexBuffer.getDevicePointer();
         geomData.triangleBuffer = bunnyTriangleBuffer.getDevicePointer();
@@ -552,6 +599,9 @@ int32_t main(int32_t argc, const char* argv[]) try {
     // JP: update()を使用するためにアップデート可能に設定しておく。
     // EN: Make the AS updatable to use update().
     bunnyGas.setConfiguration(optixu::ASTradeoff::PreferFastBuild, true, true, false);
+    // JP: 変形でAABBが大きく広がった場合はアップデートの代わりにリビルドさせる。
+    // EN: Let rebuild instead of update when the AABB has grown much by the deformation.
+    bunnyGas.setAutoRebuildPolicy(0, 1.5f);
     bunnyGas.setNumMaterialSets(1);
     bunnyGas.setNumRayTypes(0, Shared::NumRayTypes);
     bunnyGas.addChild(bunnyGeomInst);
@@ -676,9 +726,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     // JP: Geometry Acceleration Structureをビルドする。
     // EN: Build geometry acceleration structures.
+    bench.start(BenchmarkRecorder::Stage::ASBuild, cuStream);
     roomGas.rebuild(cuStream, roomGasMem, asBuildScratchMem);
     areaLightGas.rebuild(cuStream, areaLightGasMem, asBuildScratchMem);
     bunnyGas.rebuild(cuStream, bunnyGasMem, asBuildScratchMem);
+    bench.stop(BenchmarkRecorder::Stage::ASBuild, cuStream);
 
     // JP: 静的なメッシュはコンパクションもしておく。
     //     複数のメッシュのASをひとつのバッファーに詰めて記録する。
@@ -704,11 +756,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
     }
     cudau::Buffer compactedASMem;
     compactedASMem.initialize(cuContext, cudau::BufferType::Device, compactedASMemOffset, 1);
+    bench.start(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     for (int i = 0; i < lengthof(gasList); ++i) {
         const CompactedASInfo &info = gasList[i];
         info.gas.compact(cuStream, optixu::BufferView(compactedASMem.getCUdeviceptr() + info.offset,
                                                       info.size, 1));
     }
+    bench.stop(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     // JP: removeUncompacted()はcompact()がデバイス上で完了するまでホスト側で待つので呼び出しを分けたほうが良い。
     // EN: removeUncompacted() waits on host-side until the compact() completes on the device,
     //     so separating calls is recommended.
@@ -723,13 +777,20 @@ int32_t main(int32_t argc, const char* argv[]) try {
     //     確定している必要がある。
     // EN: Traversable handle and offset in the shader binding table must be fixed for each instance
     //     when building an IAS.
+    StopWatchHiRes<> sbtStopWatch;
+    sbtStopWatch.start();
     cudau::Buffer hitGroupSBT;
     size_t hitGroupSbtSize;
     scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
     hitGroupSBT.initialize(cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
     hitGroupSBT.setMappedMemoryPersistent(true);
+    bench.record(BenchmarkRecorder::Stage::SBTSetup,
+                 sbtStopWatch.getElapsed(StopWatchDurationType::Microseconds) * 1e-3f);
+    sbtStopWatch.stop();
 
+    bench.start(BenchmarkRecorder::Stage::ASBuild, cuStream);
     OptixTraversableHandle travHandle = ias.rebuild(cuStream, instanceBuffer, iasMem, asBuildScratchMem);
+    bench.stop(BenchmarkRecorder::Stage::ASBuild, cuStream);
 
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
@@ -740,13 +801,18 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     // JP: OpenGL用バッファーオブジェクトからCUDAバッファーを生成する。
     // EN: Create a CUDA buffer from an OpenGL buffer instObject0.
-    glu::Texture2D outputTexture;
-    cudau::Array outputArray;
-    cudau::InteropSurfaceObjectHolder<2> outputBufferSurfaceHolder;
-    outputTexture.initialize(GL_RGBA32F, renderTargetSizeX, renderTargetSizeY, 1);
-    outputArray.initializeFromGLTexture2D(cuContext, outputTexture.getHandle(),
-                                          cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
-    outputBufferSurfaceHolder.initialize(&outputArray);
+    // JP: CUDAが一方に描画している間にOpenGLがもう一方を表示するように2つ用意する。
+    // EN: Prepare two so that OpenGL displays one while CUDA renders into the other.
+    constexpr uint32_t numOutputBuffers = 2;
+    glu::Texture2D outputTextures[numOutputBuffers];
+    cudau::Array outputArrays[numOutputBuffers];
+    cudau::InteropSurfacePresenter<numOutputBuffers> outputPresenter;
+    for (int i = 0; i < numOutputBuffers; ++i) {
+        outputTextures[i].initialize(GL_RGBA32F, renderTargetSizeX, renderTargetSizeY, 1);
+        outputArrays[i].initializeFromGLTexture2D(cuContext, outputTextures[i].getHandle(),
+                                                  cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
+    }
+    outputPresenter.initialize(outputArrays);
 
     glu::Sampler outputSampler;
     outputSampler.initialize(glu::Sampler::MinFilter::Nearest, glu::Sampler::MagFilter::Nearest,
@@ -781,15 +847,123 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
     
+    // JP: --change-detectionでは変形後の頂点バッファーを監視する。変形を止めている間はハッシュが変わらない。
+    // EN: Watch the deformed vertex buffer with --change-detection. The hash doesn't change while the deformation stops.
+    content_hash::ChangeDetector changeDetector;
+    std::vector<uint32_t> changedEntries;
+    bool animateDeformation = true;
+    uint64_t deformFrameIdx = 0;
+    if (useChangeDetection) {
+        changeDetector.initialize(cuContext, moduleContentHash, 1);
+        changeDetector.addEntry(deformedBunnyVertexBuffer);
+    }
+
+    // JP: Bunnyの変形、ASの更新とローンチ。--render-threadではこれを描画スレッドがフレームごとに実行する。
+    // EN: Deformation of bunnies, AS updates and launch. With --render-thread, the render thread executes this every frame.
+    const auto renderScene = [&](CUstream stream, uint64_t frameIdx, Shared::PipelineLaunchParameters &curPlp) {
+        // JP: Bunnyの頂点に変異を加えてGASをアップデートする。
+        //     法線ベクトルも修正する。
+        // EN: Deform bunnys' vertices and update its GAS.
+        //     Modify normal vectors as well.
+        bool bunnyGasRebuilt = false;
+        {
+            if (animateDeformation)
+                deformFrameIdx = frameIdx;
+            float t = 0.5f + 0.5f * std::sin(2 * M_PI * static_cast<float>(deformFrameIdx % 180) / 180);
+            deform.launchPersistent(stream,
+                                    bunnyVertexBuffer.getDevicePointer(), deformedBunnyVertexBuffer.getDevicePointer(),
+                                    bunnyVertexBuffer.numElements(), 20.0f, t);
+            recomputeVertexNormals.launchPersistent(stream,
+                                                    deformedBunnyVertexBuffer.getDevicePointer(),
+                                                    bunnyVertexBuffer.numElements(),
+                                                    bunnyTriangleBuffer.getDevicePointer(),
+                                                    bunnyAdjacencyOffsetBuffer.getDevicePointer(),
+                                                    bunnyAdjacentTriangleBuffer.getDevicePointer());
+            bool deformed = true;
+            if (useChangeDetection) {
+                changeDetector.detectChanges(stream, &changedEntries);
+                deformed = !changedEntries.empty();
+            }
+            if (deformed) {
+                bench.start(BenchmarkRecorder::Stage::ASBuild, stream);
+                bunnyGas.updateOrRebuild(stream, asBuildScratchMem, &bunnyGasRebuilt);
+                bench.stop(BenchmarkRecorder::Stage::ASBuild, stream);
+            }
+        }
+
+        // JP: 各インスタンスのトランスフォームを更新する。
+        // EN: Update the transform of each instance.
+        for (int i = 0; i < bunnies.size(); ++i)
+            bunnies[i].update(1.0f / 60.0f);
+
+        // JP: IASのアップデートを行う。
+        //     品質を維持するためにたまにはリビルドする。
+        //     アップデートの代用としてのリビルドでは、インスタンスの追加・削除や
+        //     ASビルド設定の変更を行っていないのでmarkDirty()やprepareForBuild()は必要無い。
+        //     BunnyのGASがリビルドされた場合はハンドルが変わり得るので、リビルドで子のハンドルを取り直す。
+        // EN: Update the IAS.
+        //     Sometimes perform rebuild to maintain AS quality.
+        //     Rebuild as the alternative for update doesn't involves
+        //     add/remove of instances and changes of AS build settings
+        //     so neither of markDirty() nor prepareForBuild() is required.
+        //     The handle can change when the GAS of bunny has been rebuilt, so refetch child handles by rebuild.
+        bench.start(BenchmarkRecorder::Stage::ASBuild, stream);
+        if (frameIdx % 10 == 0 || bunnyGasRebuilt)
+            curPlp.travHandle = ias.rebuild(stream, instanceBuffer, iasMem, asBuildScratchMem);
+        else
+            ias.update(stream, asBuildScratchMem);
+        bench.stop(BenchmarkRecorder::Stage::ASBuild, stream);
+
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &curPlp, sizeof(curPlp), stream));
+        bench.start(BenchmarkRecorder::Stage::Launch, stream);
+        pipeline.launch(stream, plpOnDevice, curPlp.imageSize.x, curPlp.imageSize.y, 1);
+        bench.stop(BenchmarkRecorder::Stage::Launch, stream);
+    };
+
+    // JP: --render-threadではrender_loop::RenderThreadがストリームとoptixuの投入を所有し、UIスレッドはカメラの編集を
+    //     送って完成したフレームを表示するだけにする。描画スレッドは3つの出力スロットのいずれかに書き込む。
+    //     リサイズ時は描画スレッドを止めてからスロットを作り直す。
+    // EN: With --render-thread, render_loop::RenderThread owns the stream and optixu submissions, and the UI thread
+    //     only sends camera edits and presents completed frames. The render thread writes to one of three output
+    //     slots. On resizing, stop the render thread and then recreate the slots.
+    render_loop::RenderThread renderThread;
+    cudau::Array threadOutputArrays[render_loop::RenderThread::numFrameSlots];
+    Shared::PipelineLaunchParameters threadPlp = plp;
+    const auto startRenderThread = [&]() {
+        for (int i = 0; i < render_loop::RenderThread::numFrameSlots; ++i)
+            threadOutputArrays[i].initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                               cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                               renderTargetSizeX, renderTargetSizeY, 1);
+        threadPlp.imageSize = plp.imageSize;
+        threadPlp.camera = plp.camera;
+        renderThread.start(cuContext, [&](const render_loop::FrameContext &frame) {
+            threadPlp.resultBuffer = threadOutputArrays[frame.slotIndex].getSurfaceObject(0);
+            renderScene(frame.stream, frame.frameIndex, threadPlp);
+        }, 60.0f);
+    };
+    const auto stopRenderThread = [&]() {
+        renderThread.stop();
+        for (int i = render_loop::RenderThread::numFrameSlots - 1; i >= 0; --i)
+            threadOutputArrays[i].finalize();
+    };
+    if (useRenderThread) {
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+        startRenderThread();
+    }
+
+
+    
     uint64_t frameIndex = 0;
     glfwSetWindowUserPointer(window, &frameIndex);
     int32_t requestedSize[2];
+    bench.setImageSize(renderTargetSizeX, renderTargetSizeY);
     while (true) {
         uint32_t bufferIndex = frameIndex % 2;
 
-        if (glfwWindowShouldClose(window))
+        if (glfwWindowShouldClose(window) || bench.isFinished())
             break;
         glfwPollEvents();
+        bench.beginFrame();
 
         bool resized = false;
         int32_t newFBWidth;
@@ -804,17 +978,22 @@ int32_t main(int32_t argc, const char* argv[]) try {
             requestedSize[0] = renderTargetSizeX;
             requestedSize[1] = renderTargetSizeY;
 
-            outputTexture.finalize();
-            outputTexture.initialize(GL_RGBA32F, renderTargetSizeX, renderTargetSizeY, 1);
-            outputArray.finalize();
-            outputArray.initializeFromGLTexture2D(cuContext, outputTexture.getHandle(),
-                                                  cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
-
-            outputArray.resize(renderTargetSizeX, renderTargetSizeY);
+            if (useRenderThread)
+                stopRenderThread();
+            CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            for (int i = 0; i < numOutputBuffers; ++i) {
+                outputTextures[i].finalize();
+                outputTextures[i].initialize(GL_RGBA32F, renderTargetSizeX, renderTargetSizeY, 1);
+                outputArrays[i].finalize();
+                outputArrays[i].initializeFromGLTexture2D(cuContext, outputTextures[i].getHandle(),
+                                                          cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
+            }
 
             // EN: update the pipeline parameters.
             plp.imageSize = int2(renderTargetSizeX, renderTargetSizeY);
             plp.camera.aspect = (float)renderTargetSizeX / renderTargetSizeY;
+            if (useRenderThread)
+                startRenderThread();
 
             resized = true;
         }
@@ -898,6 +1077,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
             plp.camera.position = g_cameraPosition;
             plp.camera.orientation = g_tempCameraOrientation.toMatrix3x3();
+            if (bench.isEnabled())
+                calcBenchmarkCameraPose(bench.getFrameIndex(), bench.getNumTotalFrames(),
+                                        make_float3(0, 0, 0), 3.2f, 0.5f,
+                                        &plp.camera.position, &plp.camera.orientation);
         }
 
 
@@ -923,54 +1106,58 @@ int32_t main(int32_t argc, const char* argv[]) try {
             ImGui::End();
         }
 
+        if (useChangeDetection) {
+            ImGui::Begin("Change Detection", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
+            ImGui::Checkbox("Animate Deformation", &animateDeformation);
+            ImGui::Text("Skipped GAS Updates: %llu", changeDetector.getNumSkippedUpdates());
+            optixu::RedundantUpdateStatistics redundantStats;
+            optixContext.getRedundantUpdateStatistics(&redundantStats);
+            ImGui::Text("Skipped Instance/Transform/User Data Updates: %llu/%llu/%llu",
+                        redundantStats.numSkippedInstanceUpdates, redundantStats.numSkippedTransformUpdates,
+                        redundantStats.numSkippedUserDataUpdates);
 
-        // JP: Bunnyの頂点に変異を加えてGASをアップデートする。
-        //     法線ベクトルも修正する。
-        // EN: Deform bunnys' vertices and update its GAS.
-        //     Modify normal vectors as well.
-        {
-            float t = 0.5f + 0.5f * std::sin(2 * M_PI * static_cast<float>(frameIndex % 180) / 180);
-            deform(cuStream, deform.calcGridDim(bunnyVertexBuffer.numElements()),
-                   bunnyVertexBuffer.getDevicePointer(), deformedBunnyVertexBuffer.getDevicePointer(),
-                   bunnyVertexBuffer.numElements(), 20.0f, t);
-            accumulateVertexNormals(cuStream, accumulateVertexNormals.calcGridDim(bunnyTriangleBuffer.numElements()),
-                                    deformedBunnyVertexBuffer.getDevicePointer(), bunnyTriangleBuffer.getDevicePointer(),
-                                    bunnyTriangleBuffer.numElements());
-            normalizeVertexNormals(cuStream, normalizeVertexNormals.calcGridDim(bunnyVertexBuffer.numElements()),
-                                   deformedBunnyVertexBuffer.getDevicePointer(),
-                                   bunnyVertexBuffer.numElements());
-            bunnyGas.update(cuStream, asBuildScratchMem);
+            ImGui::End();
         }
 
-        // JP: 各インスタンスのトランスフォームを更新する。
-        // EN: Update the transform of each instance.
-        for (int i = 0; i < bunnies.size(); ++i)
-            bunnies[i].update(1.0f / 60.0f);
-        
-        // JP: IASのアップデートを行う。
-        //     品質を維持するためにたまにはリビルドする。
-        //     アップデートの代用としてのリビルドでは、インスタンスの追加・削除や
-        //     ASビルド設定の変更を行っていないのでmarkDirty()やprepareForBuild()は必要無い。
-        // EN: Update the IAS.
-        //     Sometimes perform rebuild to maintain AS quality.
-        //     Rebuild as the alternative for update doesn't involves
-        //     add/remove of instances and changes of AS build settings
-        //     so neither of markDirty() nor prepareForBuild() is required.
-        if (frameIndex % 10 == 0)
-            plp.travHandle = ias.rebuild(cuStream, instanceBuffer, iasMem, asBuildScratchMem);
-        else
-            ias.update(cuStream, asBuildScratchMem);
-        
-        // Render
-        outputBufferSurfaceHolder.beginCUDAAccess(cuStream);
+        if (useRenderThread) {
+            ImGui::Begin("Render Thread", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+            render_loop::RenderStatistics stats = renderThread.getStatistics();
+            ImGui::Text("Frames: %llu, Commands: %llu", stats.numFrames, stats.numCommands);
+            ImGui::Text("Submit: %.3f [ms], Interval: %.3f [ms]", stats.lastSubmitTime, stats.lastFrameInterval);
 
-        plp.resultBuffer = outputBufferSurfaceHolder.getNext();
+            ImGui::End();
+        }
 
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
-        pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
 
-        outputBufferSurfaceHolder.endCUDAAccess(cuStream);
+
+        if (useRenderThread) {
+            // JP: プレビュー用のスレッドにはカメラをコマンドとして送り、完成したフレームを表示用の配列にコピーする。
+            //     キューが満杯の場合は次のUIフレームで最新のカメラを送れば良い。
+            // EN: Send the camera to the render thread as a command, and copy a completed frame to the array for display.
+            //     When the queue is full, sending the latest camera in the next UI frame suffices.
+            Shared::PerspectiveCamera camera = plp.camera;
+            renderThread.enqueue([&threadPlp, camera](CUstream stream) {
+                threadPlp.camera = camera;
+            });
+            uint32_t slotIdx;
+            if (renderThread.acquireLatestFrame(cuStream, &slotIdx)) {
+                outputPresenter.beginCUDAAccess(cuStream);
+                outputPresenter.getRenderArray()->copyFrom(threadOutputArrays[slotIdx], cuStream);
+                outputPresenter.endCUDAAccess(cuStream);
+            }
+        }
+        else {
+            // Render
+            outputPresenter.beginCUDAAccess(cuStream);
+
+            plp.resultBuffer = outputPresenter.getSurfaceObject();
+            renderScene(cuStream, frameIndex, plp);
+
+            outputPresenter.endCUDAAccess(cuStream);
+        }
+        const glu::Texture2D &outputTexture = outputTextures[outputPresenter.getDisplayIndex()];
 
         if (takeScreenShot && frameIndex + 1 == 60) {
             CUDADRV_CHECK(cuStreamSynchronize(cuStream));
@@ -1011,11 +1198,19 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         glfwSwapBuffers(window);
 
+        bench.endFrame(static_cast<uint64_t>(renderTargetSizeX) * renderTargetSizeY);
         ++frameIndex;
     }
 
+    if (useRenderThread)
+        stopRenderThread();
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
+    if (bench.isEnabled()) {
+        bench.write();
+        bench.finalize();
+    }
+
 
 
     CUDADRV_CHECK(cuMemFree(plpOnDevice));
@@ -1024,9 +1219,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
     vertexArrayForFullScreen.finalize();
 
     outputSampler.finalize();
-    outputBufferSurfaceHolder.finalize();
-    outputArray.finalize();
-    outputTexture.finalize();
+    outputPresenter.finalize();
+    for (int i = numOutputBuffers - 1; i >= 0; --i) {
+        outputArrays[i].finalize();
+        outputTextures[i].finalize();
+    }
 
 
 
@@ -1050,6 +1247,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
     areaLightGas.destroy();
     roomGas.destroy();
 
+    bunnyAdjacentTriangleBuffer.finalize();
+    bunnyAdjacencyOffsetBuffer.finalize();
     deformedBunnyVertexBuffer.finalize();
     bunnyTriangleBuffer.finalize();
     bunnyVertexBuffer.finalize();
@@ -1069,6 +1268,9 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
+    changeDetector.finalize();
+    if (moduleContentHash)
+        CUDADRV_CHECK(cuModuleUnload(moduleContentHash));
     CUDADRV_CHECK(cuModuleUnload(moduleDeform));
 
     shaderBindingTable.finalize();
@@ -0,0 +1,293 @@
+﻿#include "asset_container.h"
+
+#if !defined(HP_Platform_Windows_MSVC)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace asset {
+    namespace {
+        constexpr char fileMagic[8] = { 'O', 'P', 'T', 'X', 'A', 'S', 'S', 'T' };
+        constexpr uint32_t fileVersion = 1;
+
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t numChunks;
+            uint64_t chunkTableOffset;
+            uint64_t fileSize;
+        };
+
+        uint64_t alignOffset(uint64_t offset, uint64_t alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+    }
+
+
+
+    ChunkDesc &ContainerWriter::addChunk(const char* name, ChunkType type) {
+        if (std::strlen(name) > maxChunkNameLength)
+            throw std::runtime_error("Chunk name is too long.");
+        PendingChunk chunk = {};
+        std::strncpy(chunk.desc.name, name, maxChunkNameLength);
+        chunk.desc.type = type;
+        m_chunks.push_back(chunk);
+        return m_chunks.back().desc;
+    }
+
+    void ContainerWriter::addBuffer(const char* name, const void* data, uint32_t elementSize, uint64_t numElements) {
+        ChunkDesc &desc = addChunk(name, ChunkType::Buffer);
+        desc.elementSize = elementSize;
+        desc.numElements = numElements;
+        desc.size = elementSize * numElements;
+        m_chunks.back().data = data;
+    }
+
+    void ContainerWriter::addMaterialTable(const char* name, const void* records, uint32_t recordSize, uint32_t numRecords) {
+        ChunkDesc &desc = addChunk(name, ChunkType::MaterialTable);
+        desc.elementSize = recordSize;
+        desc.numElements = numRecords;
+        desc.size = static_cast<uint64_t>(recordSize) * numRecords;
+        m_chunks.back().data = records;
+    }
+
+    void ContainerWriter::addTexture(const char* name, cudau::ArrayElementType format, uint32_t numChannels,
+                                     uint32_t width, uint32_t height, uint32_t numMipLevels,
+                                     const void* const* mipData, const size_t* mipSizes) {
+        if (numMipLevels == 0 || numMipLevels > maxNumMipLevels)
+            throw std::runtime_error("Invalid number of mip levels.");
+        ChunkDesc &desc = addChunk(name, ChunkType::Texture);
+        desc.elementSize = numChannels;
+        desc.format = format;
+        desc.width = width;
+        desc.height = height;
+        desc.numMipLevels = numMipLevels;
+        // JP: 各ミップレベルも16バイト境界に置く。
+        // EN: Place each mip level also at a 16-byte boundary.
+        uint64_t offset = 0;
+        for (uint32_t mipLevel = 0; mipLevel < numMipLevels; ++mipLevel) {
+            offset = alignOffset(offset, 16);
+            desc.mipOffsets[mipLevel] = offset;
+            desc.mipSizes[mipLevel] = mipSizes[mipLevel];
+            offset += mipSizes[mipLevel];
+        }
+        desc.size = offset;
+        m_chunks.back().mipData = mipData;
+    }
+
+    bool ContainerWriter::write(const std::filesystem::path &filepath) const {
+        std::vector<ChunkDesc> descs(m_chunks.size());
+        uint64_t offset = alignOffset(sizeof(FileHeader) + sizeof(ChunkDesc) * descs.size(), chunkAlignment);
+        for (uint32_t chunkIdx = 0; chunkIdx < m_chunks.size(); ++chunkIdx) {
+            descs[chunkIdx] = m_chunks[chunkIdx].desc;
+            descs[chunkIdx].offset = offset;
+            offset = alignOffset(offset + descs[chunkIdx].size, chunkAlignment);
+        }
+
+        FileHeader header = {};
+        std::copy_n(fileMagic, sizeof(fileMagic), header.magic);
+        header.version = fileVersion;
+        header.numChunks = static_cast<uint32_t>(descs.size());
+        header.chunkTableOffset = sizeof(FileHeader);
+        header.fileSize = offset;
+
+        std::ofstream ofs(filepath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            return false;
+        const auto padTo = [&ofs](uint64_t dstOffset) {
+            static const char zeros[4096] = {};
+            uint64_t curOffset = static_cast<uint64_t>(ofs.tellp());
+            while (curOffset < dstOffset) {
+                uint64_t size = std::min<uint64_t>(sizeof(zeros), dstOffset - curOffset);
+                ofs.write(zeros, size);
+                curOffset += size;
+            }
+        };
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(descs.data()), sizeof(ChunkDesc) * descs.size());
+        for (uint32_t chunkIdx = 0; chunkIdx < m_chunks.size(); ++chunkIdx) {
+            const PendingChunk &chunk = m_chunks[chunkIdx];
+            const ChunkDesc &desc = descs[chunkIdx];
+            padTo(desc.offset);
+            if (desc.type == ChunkType::Texture) {
+                for (uint32_t mipLevel = 0; mipLevel < desc.numMipLevels; ++mipLevel) {
+                    padTo(desc.offset + desc.mipOffsets[mipLevel]);
+                    ofs.write(reinterpret_cast<const char*>(chunk.mipData[mipLevel]), desc.mipSizes[mipLevel]);
+                }
+            }
+            else {
+                ofs.write(reinterpret_cast<const char*>(chunk.data), desc.size);
+            }
+        }
+        padTo(header.fileSize);
+
+        return static_cast<bool>(ofs);
+    }
+
+
+
+    bool MappedContainer::open(const std::filesystem::path &filepath) {
+        close();
+
+#if defined(HP_Platform_Windows_MSVC)
+        HANDLE file = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            hpprintf("Not found: %s\n", filepath.string().c_str());
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!view) {
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            hpprintf("Failed to map: %s\n", filepath.string().c_str());
+            return false;
+        }
+        m_fileHandle = file;
+        m_mappingHandle = mapping;
+        m_fileData = reinterpret_cast<const uint8_t*>(view);
+        m_fileSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filepath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            hpprintf("Not found: %s\n", filepath.string().c_str());
+            return false;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        void* view = st.st_size > 0 ?
+            mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (view == MAP_FAILED) {
+            ::close(fd);
+            hpprintf("Failed to map: %s\n", filepath.string().c_str());
+            return false;
+        }
+        m_fileHandle = reinterpret_cast<void*>(static_cast<intptr_t>(fd));
+        m_fileData = reinterpret_cast<const uint8_t*>(view);
+        m_fileSize = static_cast<size_t>(st.st_size);
+#endif
+
+        FileHeader header;
+        if (m_fileSize < sizeof(FileHeader)) {
+            hpprintf("Non asset container file: %s\n", filepath.string().c_str());
+            close();
+            return false;
+        }
+        std::memcpy(&header, m_fileData, sizeof(FileHeader));
+        if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 ||
+            header.version != fileVersion ||
+            header.fileSize > m_fileSize ||
+            header.chunkTableOffset + sizeof(ChunkDesc) * header.numChunks > m_fileSize) {
+            hpprintf("Non asset container file or version mismatch: %s\n", filepath.string().c_str());
+            close();
+            return false;
+        }
+        m_chunkDescs = reinterpret_cast<const ChunkDesc*>(m_fileData + header.chunkTableOffset);
+        m_numChunks = header.numChunks;
+        for (uint32_t chunkIdx = 0; chunkIdx < m_numChunks; ++chunkIdx) {
+            const ChunkDesc &desc = m_chunkDescs[chunkIdx];
+            if (desc.offset + desc.size > m_fileSize) {
+                hpprintf("Data size mismatch: %s\n", filepath.string().c_str());
+                close();
+                return false;
+            }
+        }
+
+#if !defined(HP_Platform_Windows_MSVC)
+        // JP: チャンクは順に読まれることが多いので先読みを促す。
+        // EN: Chunks are often read sequentially, so encourage read-ahead.
+        madvise(const_cast<uint8_t*>(m_fileData), m_fileSize, MADV_SEQUENTIAL);
+#endif
+
+        return true;
+    }
+
+    void MappedContainer::close() {
+        if (!m_fileData)
+            return;
+
+#if defined(HP_Platform_Windows_MSVC)
+        UnmapViewOfFile(m_fileData);
+        CloseHandle(reinterpret_cast<HANDLE>(m_mappingHandle));
+        CloseHandle(reinterpret_cast<HANDLE>(m_fileHandle));
+#else
+        munmap(const_cast<uint8_t*>(m_fileData), m_fileSize);
+        ::close(static_cast<int>(reinterpret_cast<intptr_t>(m_fileHandle)));
+#endif
+        m_fileData = nullptr;
+        m_fileSize = 0;
+        m_fileHandle = nullptr;
+        m_mappingHandle = nullptr;
+        m_chunkDescs = nullptr;
+        m_numChunks = 0;
+    }
+
+    uint32_t MappedContainer::findChunk(const char* name) const {
+        for (uint32_t chunkIdx = 0; chunkIdx < m_numChunks; ++chunkIdx) {
+            if (std::strncmp(m_chunkDescs[chunkIdx].name, name, maxChunkNameLength + 1) == 0)
+                return chunkIdx;
+        }
+        return 0xFFFFFFFF;
+    }
+
+    cudau::TransferToken MappedContainer::uploadBuffer(
+        uint32_t chunkIdx, CUcontext cuContext, cudau::BufferType type,
+        cudau::Buffer* buffer, cudau::PinnedStagingPool &pool, CUstream stream) const {
+        const ChunkDesc &desc = m_chunkDescs[chunkIdx];
+        if (desc.type == ChunkType::Texture)
+            throw std::runtime_error("Chunk is not a buffer.");
+        buffer->initialize(cuContext, type, static_cast<uint32_t>(desc.numElements), desc.elementSize);
+        buffer->setName(desc.name);
+        return pool.upload(buffer->getCUdeviceptr(), getChunkData(chunkIdx), desc.size, stream);
+    }
+
+    void MappedContainer::uploadTexture(uint32_t chunkIdx, CUcontext cuContext, cudau::Array* array,
+                                        cudau::PinnedStagingPool &pool, CUstream stream,
+                                        std::vector<cudau::TransferToken>* tokens) const {
+        const ChunkDesc &desc = m_chunkDescs[chunkIdx];
+        if (desc.type != ChunkType::Texture)
+            throw std::runtime_error("Chunk is not a texture.");
+        array->initialize2D(cuContext, desc.format, desc.elementSize,
+                            cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
+                            desc.width, desc.height, desc.numMipLevels);
+        array->setName(desc.name);
+        std::vector<cudau::TransferToken> mipTokens(desc.numMipLevels);
+        const uint8_t* chunkData = getChunkData(chunkIdx);
+        for (int32_t mipLevel = desc.numMipLevels - 1; mipLevel >= 0; --mipLevel)
+            mipTokens[mipLevel] = array->writeAsync(chunkData + desc.mipOffsets[mipLevel], desc.mipSizes[mipLevel],
+                                                    mipLevel, pool, stream);
+        for (cudau::TransferToken &token : mipTokens)
+            tokens->push_back(std::move(token));
+    }
+
+    bool MappedContainer::uploadMesh(const char* name, CUcontext cuContext, cudau::BufferType type,
+                                     cudau::Buffer* vertexBuffer, cudau::Buffer* triangleBuffer,
+                                     const optixu::GeometryInstance &geomInst,
+                                     cudau::PinnedStagingPool &pool, CUstream stream,
+                                     std::vector<cudau::TransferToken>* tokens) const {
+        uint32_t vertexChunkIdx = findChunk((std::string(name) + "/vertices").c_str());
+        uint32_t triangleChunkIdx = findChunk((std::string(name) + "/triangles").c_str());
+        if (vertexChunkIdx == 0xFFFFFFFF || triangleChunkIdx == 0xFFFFFFFF)
+            return false;
+
+        const ChunkDesc &triDesc = m_chunkDescs[triangleChunkIdx];
+        if (triDesc.elementSize != 3 * sizeof(uint16_t) && triDesc.elementSize != 3 * sizeof(uint32_t))
+            throw std::runtime_error("Unsupported triangle element size.");
+
+        tokens->push_back(uploadBuffer(vertexChunkIdx, cuContext, type, vertexBuffer, pool, stream));
+        tokens->push_back(uploadBuffer(triangleChunkIdx, cuContext, type, triangleBuffer, pool, stream));
+        geomInst.setVertexBuffer(*vertexBuffer);
+        geomInst.setTriangleBuffer(*triangleBuffer,
+                                   triDesc.elementSize == 3 * sizeof(uint16_t) ?
+                                   OPTIX_INDICES_FORMAT_UNSIGNED_SHORT3 :
+                                   OPTIX_INDICES_FORMAT_UNSIGNED_INT3);
+
+        return true;
+    }
+}
@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: メッシュ、ブロック圧縮テクスチャー、マテリアルテーブルを一つのファイルに詰めたアセットコンテナー。
+//     各チャンクはアップロード粒度(64KiB)に揃えて置かれるため、メモリーマップしたファイルから
+//     パースやコピー無しにステージングプール経由でデバイスへ直接転送できる。
+// EN: Asset container packing meshes, block-compressed textures and material tables into a single file.
+//     Each chunk is placed aligned to the upload granularity (64KiB), so it can be transferred to the device
+//     directly from the memory-mapped file via a staging pool without parsing or copies.
+namespace asset {
+    static constexpr uint64_t chunkAlignment = 64 * 1024;
+    static constexpr uint32_t maxChunkNameLength = 63;
+    static constexpr uint32_t maxNumMipLevels = 16;
+
+    enum class ChunkType : uint32_t {
+        Buffer = 0,
+        Texture,
+        MaterialTable,
+    };
+
+    struct ChunkDesc {
+        char name[maxChunkNameLength + 1];
+        ChunkType type;
+        // JP: Buffer/MaterialTableでは要素のサイズ、Textureではチャンネル数。
+        // EN: Element size for Buffer/MaterialTable, the number of channels for Texture.
+        uint32_t elementSize;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t numElements;
+        // JP: Texture専用。ミップレベルのデータはチャンク内で高解像度から順に並ぶ。
+        // EN: Texture only. Data of mip levels are ordered from the highest resolution in the chunk.
+        cudau::ArrayElementType format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t numMipLevels;
+        uint64_t mipOffsets[maxNumMipLevels];
+        uint64_t mipSizes[maxNumMipLevels];
+    };
+
+    // JP: 追加されたデータはwrite()を呼ぶまでコピーされずに参照されるので、呼び出し側で生存させておく必要がある。
+    // EN: Added data is referenced without copies until write() is called, so the caller needs to keep it alive.
+    class ContainerWriter {
+        struct PendingChunk {
+            ChunkDesc desc;
+            const void* data;
+            const void* const* mipData;
+        };
+        std::vector<PendingChunk> m_chunks;
+
+        ChunkDesc &addChunk(const char* name, ChunkType type);
+
+    public:
+        void addBuffer(const char* name, const void* data, uint32_t elementSize, uint64_t numElements);
+        template <typename T>
+        void addBuffer(const char* name, const std::vector<T> &values) {
+            addBuffer(name, values.data(), sizeof(T), values.size());
+        }
+        void addMaterialTable(const char* name, const void* records, uint32_t recordSize, uint32_t numRecords);
+        void addTexture(const char* name, cudau::ArrayElementType format, uint32_t numChannels,
+                        uint32_t width, uint32_t height, uint32_t numMipLevels,
+                        const void* const* mipData, const size_t* mipSizes);
+
+        // JP: メッシュは"<name>/vertices"と"<name>/triangles"の2つのBufferチャンクとして書き込まれる。
+        // EN: A mesh is written as two buffer chunks "<name>/vertices" and "<name>/triangles".
+        template <typename VertexType, typename TriangleType>
+        void addMesh(const char* name,
+                     const std::vector<VertexType> &vertices, const std::vector<TriangleType> &triangles) {
+            addBuffer((std::string(name) + "/vertices").c_str(), vertices);
+            addBuffer((std::string(name) + "/triangles").c_str(), triangles);
+        }
+
+        bool write(const std::filesystem::path &filepath) const;
+    };
+
+    class MappedContainer {
+        const uint8_t* m_fileData;
+        size_t m_fileSize;
+        void* m_fileHandle;
+        void* m_mappingHandle;
+        const ChunkDesc* m_chunkDescs;
+        uint32_t m_numChunks;
+
+        MappedContainer(const MappedContainer &) = delete;
+        MappedContainer &operator=(const MappedContainer &) = delete;
+
+    public:
+        MappedContainer() :
+            m_fileData(nullptr), m_fileSize(0), m_fileHandle(nullptr), m_mappingHandle(nullptr),
+            m_chunkDescs(nullptr), m_numChunks(0) {}
+        ~MappedContainer() {
+            close();
+        }
+
+        bool open(const std::filesystem::path &filepath);
+        void close();
+
+        bool isOpen() const {
+            return m_fileData != nullptr;
+        }
+        uint32_t getNumChunks() const {
+            return m_numChunks;
+        }
+        const ChunkDesc &getChunkDesc(uint32_t chunkIdx) const {
+            return m_chunkDescs[chunkIdx];
+        }
+        const uint8_t* getChunkData(uint32_t chunkIdx) const {
+            return m_fileData + m_chunkDescs[chunkIdx].offset;
+        }
+        // JP: 見つからない場合は0xFFFFFFFFを返す。
+        // EN: Return 0xFFFFFFFF if not found.
+        uint32_t findChunk(const char* name) const;
+
+        // JP: マテリアルテーブルはホスト側で使うことが多いので、マップされたメモリーを直接参照させる。
+        // EN: Material tables are often used on the host, so let the caller refer the mapped memory directly.
+        template <typename T>
+        const T* getMaterialTable(uint32_t chunkIdx, uint32_t* numRecords) const {
+            const ChunkDesc &desc = m_chunkDescs[chunkIdx];
+            if (desc.type != ChunkType::MaterialTable || desc.elementSize != sizeof(T))
+                throw std::runtime_error("Chunk is not a material table of the given type.");
+            *numRecords = static_cast<uint32_t>(desc.numElements);
+            return reinterpret_cast<const T*>(getChunkData(chunkIdx));
+        }
+
+        // JP: バッファーを初期化し、マップされたチャンクをステージングプール経由で非同期に転送する。
+        // EN: Initialize the buffer and asynchronously transfer the mapped chunk via the staging pool.
+        cudau::TransferToken uploadBuffer(uint32_t chunkIdx, CUcontext cuContext, cudau::BufferType type,
+                                          cudau::Buffer* buffer, cudau::PinnedStagingPool &pool, CUstream stream) const;
+        // JP: 配列を初期化し、低解像度のミップレベルから順に転送する。トークンはミップレベル順に並ぶ。
+        // EN: Initialize the array and transfer mip levels starting from low resolution.
+        //     Tokens are ordered by mip level.
+        void uploadTexture(uint32_t chunkIdx, CUcontext cuContext, cudau::Array* array,
+                           cudau::PinnedStagingPool &pool, CUstream stream,
+                           std::vector<cudau::TransferToken>* tokens) const;
+        // JP: addMesh()で書き込まれたメッシュを転送し、ジオメトリインスタンスの頂点・三角形バッファーに設定する。
+        //     三角形の要素サイズが6バイトの場合は16ビットインデックスとして扱う。
+        // EN: Transfer a mesh written by addMesh() and set the vertex/triangle buffers of the geometry instance.
+        //     Triangles with 6-byte elements are treated as 16-bit indices.
+        bool uploadMesh(const char* name, CUcontext cuContext, cudau::BufferType type,
+                        cudau::Buffer* vertexBuffer, cudau::Buffer* triangleBuffer,
+                        const optixu::GeometryInstance &geomInst,
+                        cudau::PinnedStagingPool &pool, CUstream stream,
+                        std::vector<cudau::TransferToken>* tokens) const;
+    };
+}
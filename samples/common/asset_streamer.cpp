@@ -0,0 +1,212 @@
+﻿#include "asset_streamer.h"
+
+namespace asset {
+    void AssetStreamer::initialize(CUcontext cuContext, cudau::BufferType bufferType,
+                                   uint32_t numReadThreads, uint32_t numDecodeThreads,
+                                   size_t stagingChunkSize, uint32_t numStagingChunks) {
+        if (m_initialized)
+            throw std::runtime_error("AssetStreamer is already initialized.");
+        if (numReadThreads == 0)
+            throw std::runtime_error("At least one read thread is required.");
+        if (numDecodeThreads == 0)
+            numDecodeThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+        m_cuContext = cuContext;
+        m_bufferType = bufferType;
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuStreamCreate(&m_uploadStream, CU_STREAM_NON_BLOCKING));
+        m_stagingPool.initialize(m_cuContext, stagingChunkSize, numStagingChunks);
+
+        m_readQueue.reopen();
+        m_decodeQueue.reopen();
+        m_uploadQueue.reopen();
+        for (uint32_t i = 0; i < numReadThreads; ++i)
+            m_readThreads.emplace_back(&AssetStreamer::readLoop, this);
+        for (uint32_t i = 0; i < numDecodeThreads; ++i)
+            m_decodeThreads.emplace_back(&AssetStreamer::decodeLoop, this);
+        m_uploadThread = std::thread(&AssetStreamer::uploadLoop, this);
+
+        m_initialized = true;
+    }
+
+    void AssetStreamer::finalize() {
+        if (!m_initialized)
+            return;
+
+        // JP: 前段から順に閉じて、各段に残った仕事を流し切る。
+        // EN: Close from the front stage in order to drain the work left in each stage.
+        m_readQueue.close();
+        for (std::thread &thread : m_readThreads)
+            thread.join();
+        m_readThreads.clear();
+        m_decodeQueue.close();
+        for (std::thread &thread : m_decodeThreads)
+            thread.join();
+        m_decodeThreads.clear();
+        m_uploadQueue.close();
+        m_uploadThread.join();
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuStreamSynchronize(m_uploadStream));
+        {
+            std::lock_guard<std::mutex> lock(m_completionMutex);
+            for (Job* job : m_inFlightJobs) {
+                if (job->doneEvent)
+                    CUDADRV_CHECK(cuEventDestroy(job->doneEvent));
+                delete job;
+            }
+            m_inFlightJobs.clear();
+        }
+        m_numPendingJobs = 0;
+
+        m_stagingPool.finalize();
+        CUDADRV_CHECK(cuStreamDestroy(m_uploadStream));
+        m_uploadStream = nullptr;
+
+        m_initialized = false;
+    }
+
+    uint32_t AssetStreamer::request(const std::filesystem::path &path, bool readFile,
+                                    const DecodeFunction &decode, const BuildFunction &build,
+                                    const ReadyCallback &onReady) {
+        if (!m_initialized)
+            throw std::runtime_error("AssetStreamer is not initialized.");
+        if (!decode)
+            throw std::runtime_error("Decode function must be set.");
+
+        Job* job = new Job();
+        job->asset.id = m_nextAssetId++;
+        job->asset.path = path;
+        job->asset.userData = nullptr;
+        job->asset.failed = false;
+        job->readFile = readFile;
+        job->decode = decode;
+        job->build = build;
+        job->onReady = onReady;
+        job->mesh.vertexStride = 0;
+        job->mesh.triangleStride = 0;
+        job->doneEvent = nullptr;
+        ++m_numPendingJobs;
+
+        if (readFile)
+            m_readQueue.push(job);
+        else
+            m_decodeQueue.push(job);
+
+        return job->asset.id;
+    }
+
+    void AssetStreamer::complete(Job* job) {
+        std::lock_guard<std::mutex> lock(m_completionMutex);
+        m_inFlightJobs.push_back(job);
+    }
+
+    void AssetStreamer::readLoop() {
+        Job* job;
+        while (m_readQueue.pop(&job)) {
+            std::ifstream ifs(job->asset.path, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!ifs) {
+                hpprintf("Not found: %s\n", job->asset.path.string().c_str());
+                job->asset.failed = true;
+                complete(job);
+                continue;
+            }
+            size_t fileSize = static_cast<size_t>(ifs.tellg());
+            ifs.seekg(0);
+            job->fileData.resize(fileSize);
+            if (!ifs.read(reinterpret_cast<char*>(job->fileData.data()), fileSize)) {
+                hpprintf("Failed to read: %s\n", job->asset.path.string().c_str());
+                job->asset.failed = true;
+                complete(job);
+                continue;
+            }
+            m_decodeQueue.push(job);
+        }
+    }
+
+    void AssetStreamer::decodeLoop() {
+        Job* job;
+        while (m_decodeQueue.pop(&job)) {
+            bool success = job->decode(job->asset.path, job->fileData, &job->mesh);
+            job->fileData.clear();
+            job->fileData.shrink_to_fit();
+            if (!success || job->mesh.vertexStride == 0 || job->mesh.triangleStride == 0 ||
+                job->mesh.vertexData.empty() || job->mesh.triangleData.empty()) {
+                job->asset.failed = true;
+                complete(job);
+                continue;
+            }
+            m_uploadQueue.push(job);
+        }
+    }
+
+    void AssetStreamer::uploadLoop() {
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+        Job* job;
+        while (m_uploadQueue.pop(&job)) {
+            StreamedAsset &asset = job->asset;
+            const DecodedMesh &mesh = job->mesh;
+            uint32_t numVertices = static_cast<uint32_t>(mesh.vertexData.size() / mesh.vertexStride);
+            uint32_t numTriangles = static_cast<uint32_t>(mesh.triangleData.size() / mesh.triangleStride);
+            asset.vertexBuffer.initialize(m_cuContext, m_bufferType, numVertices, mesh.vertexStride);
+            asset.triangleBuffer.initialize(m_cuContext, m_bufferType, numTriangles, mesh.triangleStride);
+            asset.vertexBuffer.setName(asset.path.filename().string() + "/vertices");
+            asset.triangleBuffer.setName(asset.path.filename().string() + "/triangles");
+
+            // JP: ステージングプールのチャンクが空くのを待つのはこのスレッドだけなので描画は止まらない。
+            // EN: Only this thread waits for a staging pool chunk to become free, so rendering does not stall.
+            m_stagingPool.upload(asset.vertexBuffer.getCUdeviceptr(), mesh.vertexData.data(),
+                                 mesh.vertexData.size(), m_uploadStream);
+            m_stagingPool.upload(asset.triangleBuffer.getCUdeviceptr(), mesh.triangleData.data(),
+                                 mesh.triangleData.size(), m_uploadStream);
+            job->mesh = DecodedMesh();
+
+            if (job->build)
+                job->build(asset, m_uploadStream);
+
+            CUDADRV_CHECK(cuEventCreate(&job->doneEvent, CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventRecord(job->doneEvent, m_uploadStream));
+            complete(job);
+        }
+    }
+
+    uint32_t AssetStreamer::poll() {
+        std::vector<Job*> readyJobs;
+        {
+            std::lock_guard<std::mutex> lock(m_completionMutex);
+            auto it = m_inFlightJobs.begin();
+            while (it != m_inFlightJobs.end()) {
+                Job* job = *it;
+                if (job->doneEvent) {
+                    CUresult res = cuEventQuery(job->doneEvent);
+                    if (res == CUDA_ERROR_NOT_READY) {
+                        ++it;
+                        continue;
+                    }
+                    CUDADRV_CHECK(res);
+                }
+                readyJobs.push_back(job);
+                it = m_inFlightJobs.erase(it);
+            }
+        }
+
+        for (Job* job : readyJobs) {
+            if (job->onReady)
+                job->onReady(job->asset);
+            if (job->doneEvent)
+                CUDADRV_CHECK(cuEventDestroy(job->doneEvent));
+            delete job;
+            --m_numPendingJobs;
+        }
+
+        return static_cast<uint32_t>(readyJobs.size());
+    }
+
+    void AssetStreamer::waitAll() {
+        while (m_numPendingJobs > 0) {
+            if (poll() == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
@@ -0,0 +1,177 @@
+﻿#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// JP: ディスク読み込み、デコード、pinnedメモリ経由のアップロード、ASビルドの各段を別スレッドで流す非同期アセットローダー。
+//     描画スレッドは毎フレームpoll()を呼ぶだけで、完了したアセットがコールバックで渡される。
+//     それまではプレースホルダーや低LODのGASで描画を続けられる。
+//
+//     asset::AssetStreamer streamer;
+//     streamer.initialize(cuContext, cudau::BufferType::Device);
+//     streamer.request(path, true, decodeFunc,
+//                      [&](asset::StreamedAsset &a, CUstream stream) { /* GeometryInstance/GASの設定とビルド */ },
+//                      [&](asset::StreamedAsset &a) { /* プレースホルダーと差し替える */ });
+//     while (rendering) { streamer.poll(); render(); }
+//
+// EN: Asynchronous asset loader flowing stages of disk reads, decoding, uploads via pinned memory and AS builds
+//     on separate threads.
+//     The render thread only calls poll() every frame, and completed assets are handed over by the callback.
+//     Rendering can continue with a placeholder or a low-LOD GAS until then.
+//
+//     asset::AssetStreamer streamer;
+//     streamer.initialize(cuContext, cudau::BufferType::Device);
+//     streamer.request(path, true, decodeFunc,
+//                      [&](asset::StreamedAsset &a, CUstream stream) { /* set up and build GeometryInstance/GAS */ },
+//                      [&](asset::StreamedAsset &a) { /* swap with the placeholder */ });
+//     while (rendering) { streamer.poll(); render(); }
+namespace asset {
+    struct DecodedMesh {
+        std::vector<uint8_t> vertexData;
+        uint32_t vertexStride;
+        std::vector<uint8_t> triangleData;
+        uint32_t triangleStride;
+    };
+
+    // JP: バッファーはコールバックの中でmoveして所有権を引き取る。引き取らなかったものはコールバック後に解放される。
+    // EN: Take the ownership of the buffers by moving them in the callbacks.
+    //     Buffers not taken are freed after the callback.
+    struct StreamedAsset {
+        uint32_t id;
+        std::filesystem::path path;
+        cudau::Buffer vertexBuffer;
+        cudau::Buffer triangleBuffer;
+        void* userData;
+        bool failed;
+    };
+
+    // JP: readFileが偽のリクエストではfileDataは空で、デコード関数が自身でpathを読む(例: obj::load)。
+    // EN: For a request with readFile false, fileData is empty and the decode function reads the path by itself
+    //     (e.g. obj::load).
+    using DecodeFunction = std::function<bool(const std::filesystem::path &path,
+                                              const std::vector<uint8_t> &fileData, DecodedMesh* mesh)>;
+    // JP: アップロードスレッド上でアップロードと同じストリームとともに呼ばれる。
+    //     optixuのシーン構築はスレッドセーフなので、ここでGeometryInstance/GASを設定してビルドをエンキューできる。
+    // EN: Called on the upload thread with the same stream as the upload.
+    //     Scene construction of optixu is thread-safe, so GeometryInstance/GAS can be set up and builds enqueued here.
+    using BuildFunction = std::function<void(StreamedAsset &asset, CUstream stream)>;
+    // JP: ビルドまで完了した後にpoll()の中、つまり描画スレッド上で呼ばれる。
+    // EN: Called in poll(), that is on the render thread, after the build completes.
+    using ReadyCallback = std::function<void(StreamedAsset &asset)>;
+
+    class AssetStreamer {
+        template <typename T>
+        class BlockingQueue {
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            std::deque<T> m_items;
+            bool m_closed;
+
+        public:
+            BlockingQueue() : m_closed(false) {}
+
+            void push(T item) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_items.push_back(std::move(item));
+                }
+                m_cond.notify_one();
+            }
+            // JP: 閉じられて空になった場合にfalseを返す。
+            // EN: Return false when closed and empty.
+            bool pop(T* item) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+                if (m_items.empty())
+                    return false;
+                *item = std::move(m_items.front());
+                m_items.pop_front();
+                return true;
+            }
+            void close() {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_closed = true;
+                }
+                m_cond.notify_all();
+            }
+            void reopen() {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed = false;
+            }
+        };
+
+        struct Job {
+            StreamedAsset asset;
+            bool readFile;
+            DecodeFunction decode;
+            BuildFunction build;
+            ReadyCallback onReady;
+            std::vector<uint8_t> fileData;
+            DecodedMesh mesh;
+            CUevent doneEvent;
+        };
+
+        CUcontext m_cuContext;
+        cudau::BufferType m_bufferType;
+        CUstream m_uploadStream;
+        cudau::PinnedStagingPool m_stagingPool;
+
+        BlockingQueue<Job*> m_readQueue;
+        BlockingQueue<Job*> m_decodeQueue;
+        BlockingQueue<Job*> m_uploadQueue;
+        std::vector<std::thread> m_readThreads;
+        std::vector<std::thread> m_decodeThreads;
+        std::thread m_uploadThread;
+
+        std::mutex m_completionMutex;
+        std::vector<Job*> m_inFlightJobs;
+        std::atomic<uint32_t> m_numPendingJobs;
+        uint32_t m_nextAssetId;
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        AssetStreamer(const AssetStreamer &) = delete;
+        AssetStreamer &operator=(const AssetStreamer &) = delete;
+
+        void readLoop();
+        void decodeLoop();
+        void uploadLoop();
+        void complete(Job* job);
+
+    public:
+        AssetStreamer() :
+            m_cuContext(nullptr), m_uploadStream(nullptr), m_numPendingJobs(0), m_nextAssetId(0),
+            m_initialized(false) {}
+        ~AssetStreamer() {
+            if (m_initialized)
+                finalize();
+        }
+
+        // JP: numDecodeThreadsが0の場合はハードウェアスレッド数から決める。
+        // EN: When numDecodeThreads is 0, it is determined from the number of hardware threads.
+        void initialize(CUcontext cuContext, cudau::BufferType bufferType,
+                        uint32_t numReadThreads = 2, uint32_t numDecodeThreads = 0,
+                        size_t stagingChunkSize = 4 * 1024 * 1024, uint32_t numStagingChunks = 8);
+        // JP: 処理中のアセットは全て完了を待ってから破棄される(コールバックは呼ばれない)。
+        // EN: All the assets in progress are waited for completion and then discarded (callbacks are not called).
+        void finalize();
+
+        uint32_t request(const std::filesystem::path &path, bool readFile,
+                         const DecodeFunction &decode, const BuildFunction &build, const ReadyCallback &onReady);
+        // JP: 完了したアセットのコールバックを呼び、その数を返す。イベントの問い合わせのみで待つことはない。
+        // EN: Call the callbacks of completed assets and return the number of them.
+        //     This only queries events and never waits.
+        uint32_t poll();
+        // JP: 全リクエストの完了を待つ。コールバックは描画スレッド上で呼ばれる。
+        // EN: Wait for the completion of all the requests. Callbacks are called on the render thread.
+        void waitAll();
+        uint32_t getNumPendingAssets() const {
+            return m_numPendingJobs;
+        }
+    };
+}
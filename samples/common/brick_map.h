@@ -0,0 +1,387 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 疎なブリックマップによるボリュームと、カスタムプリミティブによる空の領域のスキップのためのユーティリティー。
+//     ボリュームをbrickResolution^3ボクセルのブリックに分割し、空でないブリックだけを3Dのcudau::Array
+//     (ブリックプール)に詰めて格納する。グリッドの各ブリックからプール内のスロットへの間接参照グリッドを持つ。
+//     プールの各ブリックはトライリニア補間がブリックの境界で正しくなるように1ボクセルの縁を含む。
+//     空でないブリックごとのAABBをカスタムプリミティブのGASにすることで、OptiXのトラバーサルが空の領域を飛ばし、
+//     レイマーチングやデルタトラッキングはヒットしたブリックの区間の中だけで行えば良い。
+//
+//     brick_map::HostBrickMap volume;
+//     volume.build(cuContext, stream, make_uint3(2048, 1024, 2048), make_float3(-1.0f), voxelSize,
+//                  [&](int32_t x, int32_t y, int32_t z) { return vdbAccessor.getValue(x, y, z); }, 0.0f);
+//     volume.setupGeometryInstance(geomInst); // カスタムプリミティブのGeometryInstance
+//     plp.volume = volume.getBrickMap();
+//     // パイプラインのアトリビュート数にはoptixu::calcSumDwords<brick_map::BrickAttributeType>()を指定する。
+//
+//     // Intersectionプログラム
+//     brick_map::intersectAndReportBrick(plp.volume);
+//     // Closest-Hitプログラムでブリックの区間を返し、レイ生成プログラムで区間ごとにマーチする。
+//     float tExit = brick_map::getBrickExitDistance();
+//     brick_map::marchBrick(plp.volume, optixGetPrimitiveIndex(), org, dir, optixGetRayTmax(), tExit, step, jitter,
+//                           [&](float t, float density) { ...; return true; });
+//
+// EN: Utility for volumes as sparse brick maps and empty space skipping with custom primitives.
+//     Divide a volume into bricks of brickResolution^3 voxels, and pack only non-empty bricks into a 3D cudau::Array
+//     (brick pool). An indirection grid maps each brick of the grid to a slot in the pool.
+//     Each brick in the pool includes a one-voxel apron so that trilinear interpolation is correct at brick borders.
+//     Making the AABBs of non-empty bricks a custom primitive GAS lets OptiX traversal skip empty space,
+//     so ray marching or delta tracking only needs to run within the interval of a hit brick.
+//
+//     brick_map::HostBrickMap volume;
+//     volume.build(cuContext, stream, make_uint3(2048, 1024, 2048), make_float3(-1.0f), voxelSize,
+//                  [&](int32_t x, int32_t y, int32_t z) { return vdbAccessor.getValue(x, y, z); }, 0.0f);
+//     volume.setupGeometryInstance(geomInst); // A custom primitive geometry instance
+//     plp.volume = volume.getBrickMap();
+//     // Specify optixu::calcSumDwords<brick_map::BrickAttributeType>() as the number of attributes of the pipeline.
+//
+//     // Intersection program
+//     brick_map::intersectAndReportBrick(plp.volume);
+//     // Return the brick interval from the closest-hit program, and march per interval in the ray generation program.
+//     float tExit = brick_map::getBrickExitDistance();
+//     brick_map::marchBrick(plp.volume, optixGetPrimitiveIndex(), org, dir, optixGetRayTmax(), tExit, step, jitter,
+//                           [&](float t, float density) { ...; return true; });
+namespace brick_map {
+    static constexpr uint32_t brickResolution = 8;
+    static constexpr uint32_t brickApron = 1;
+    static constexpr uint32_t brickPhysicalResolution = brickResolution + 2 * brickApron;
+    static constexpr uint32_t invalidSlot = 0xFFFFFFFF;
+
+    // JP: 交差のアトリビュートはブリックから出る距離。
+    // EN: The intersection attribute is the distance exiting the brick.
+    using BrickAttributeType = float;
+
+    // JP: スロットごとの情報。maxValueはブリック内(縁を含む)の最大値で、デルタトラッキングのマジョラントに使える。
+    // EN: Information per slot. maxValue is the maximum value in the brick (including the apron)
+    //     usable as the majorant of delta tracking.
+    struct BrickInfo {
+        uint3 gridCoord;
+        float maxValue;
+    };
+
+    struct BrickMap {
+        CUtexObject pool;
+        const uint32_t* indirection;
+        const BrickInfo* bricks;
+        uint3 gridSizeInBricks;
+        uint3 poolSizeInBricks;
+        float3 origin;
+        float voxelSize;
+
+        CUDA_DEVICE_FUNCTION uint3 getPoolBrickCoord(uint32_t slot) const {
+            return make_uint3(slot % poolSizeInBricks.x,
+                              (slot / poolSizeInBricks.x) % poolSizeInBricks.y,
+                              slot / (poolSizeInBricks.x * poolSizeInBricks.y));
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcBrickAabb(const uint3 &gridCoord) const {
+            const float brickSize = brickResolution * voxelSize;
+            AABB ret;
+            ret.minP = origin + brickSize * make_float3(gridCoord.x, gridCoord.y, gridCoord.z);
+            ret.maxP = ret.minP + make_float3(brickSize);
+            return ret;
+        }
+
+        // JP: 位置を含むブリックのスロットを返す。ボリューム外や空のブリックではinvalidSlotを返す。
+        // EN: Return the slot of the brick containing the position. Return invalidSlot outside the volume or for empty bricks.
+        CUDA_DEVICE_FUNCTION uint32_t findSlot(const float3 &p) const {
+            const float3 v = (p - origin) / (brickResolution * voxelSize);
+            if (v.x < 0.0f || v.y < 0.0f || v.z < 0.0f)
+                return invalidSlot;
+            const uint3 b = make_uint3(static_cast<uint32_t>(v.x), static_cast<uint32_t>(v.y), static_cast<uint32_t>(v.z));
+            if (b.x >= gridSizeInBricks.x || b.y >= gridSizeInBricks.y || b.z >= gridSizeInBricks.z)
+                return invalidSlot;
+            return indirection[(b.z * gridSizeInBricks.y + b.y) * gridSizeInBricks.x + b.x];
+        }
+    };
+
+    // JP: レイとAABBのスラブテスト。[tMin, tMax]と重なる区間を返す。
+    // EN: Slab test between a ray and an AABB. Return the interval overlapping with [tMin, tMax].
+    CUDA_DEVICE_FUNCTION bool intersectAabb(
+        const AABB &aabb, const float3 &org, const float3 &dir, float tMin, float tMax,
+        float* tEnter, float* tExit) {
+        const float3 invDir = make_float3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+        const float3 t0 = (aabb.minP - org) * invDir;
+        const float3 t1 = (aabb.maxP - org) * invDir;
+        const float3 tNear = min(t0, t1);
+        const float3 tFar = max(t0, t1);
+        *tEnter = std::fmax(std::fmax(tNear.x, tNear.y), std::fmax(tNear.z, tMin));
+        *tExit = std::fmin(std::fmin(tFar.x, tFar.y), std::fmin(tFar.z, tMax));
+        return *tEnter < *tExit;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: スロットのブリック内の位置における値をトライリニア補間で取得する。
+    // EN: Fetch the value at a position within the brick of the slot with trilinear interpolation.
+    CUDA_DEVICE_FUNCTION float sampleBrick(const BrickMap &map, uint32_t slot, const float3 &p) {
+        const BrickInfo &brick = map.bricks[slot];
+        const uint3 poolCoord = map.getPoolBrickCoord(slot);
+        const float3 v = (p - map.origin) / map.voxelSize;
+        float3 local = v - brickResolution * make_float3(brick.gridCoord.x, brick.gridCoord.y, brick.gridCoord.z);
+        local = min(max(local, make_float3(0.0f)), make_float3(static_cast<float>(brickResolution)));
+        const float3 texCoord =
+            brickPhysicalResolution * make_float3(poolCoord.x, poolCoord.y, poolCoord.z) +
+            local + make_float3(static_cast<float>(brickApron));
+        return tex3D<float>(map.pool, texCoord.x, texCoord.y, texCoord.z);
+    }
+
+    // JP: ボリューム内の任意の位置の値を間接参照グリッド経由で取得する。空のブリックでは0を返す。
+    // EN: Fetch the value at an arbitrary position in the volume via the indirection grid. Return 0 for empty bricks.
+    CUDA_DEVICE_FUNCTION float sampleVolume(const BrickMap &map, const float3 &p) {
+        const uint32_t slot = map.findSlot(p);
+        if (slot == invalidSlot)
+            return 0.0f;
+        return sampleBrick(map, slot, p);
+    }
+
+    // JP: Intersectionプログラムから呼ぶ。ブリックに入る距離(レイの区間の始点でクランプ)を報告し、
+    //     出る距離をアトリビュートとして渡す。ボリュームのオブジェクト空間で計算する。
+    // EN: Call this from an intersection program. Report the distance entering the brick
+    //     (clamped to the start of the ray interval) and pass the exiting distance as the attribute.
+    //     Computation is done in the object space of the volume.
+    CUDA_DEVICE_FUNCTION bool intersectAndReportBrick(const BrickMap &map) {
+        const uint32_t slot = optixGetPrimitiveIndex();
+        const AABB aabb = map.calcBrickAabb(map.bricks[slot].gridCoord);
+        float tEnter, tExit;
+        if (!intersectAabb(aabb, optixGetObjectRayOrigin(), optixGetObjectRayDirection(),
+                           optixGetRayTmin(), optixGetRayTmax(), &tEnter, &tExit))
+            return false;
+        return optixu::reportIntersection<BrickAttributeType>(tEnter, 0, tExit);
+    }
+
+    // JP: Closest-Hit, Any-Hitプログラムでブリックから出る距離を取得する。入る距離はoptixGetRayTmax()。
+    // EN: Get the distance exiting the brick in closest-hit and any-hit programs. The entering distance is optixGetRayTmax().
+    CUDA_DEVICE_FUNCTION float getBrickExitDistance() {
+        float tExit;
+        optixu::getAttributes<BrickAttributeType>(&tExit);
+        return tExit;
+    }
+
+    // JP: ブリックの区間[tEnter, tExit]を一定の間隔でマーチする。jitterは[0, 1)の最初のサンプルのずれ。
+    //     funcは(t, 値)を受け取り、falseを返すとマーチを打ち切る。打ち切られた場合はfalseを返す。
+    // EN: March the brick interval [tEnter, tExit] with a constant step. jitter is the offset of the first sample in [0, 1).
+    //     func receives (t, value), and returning false terminates the march. Return false if terminated.
+    template <typename Func>
+    CUDA_DEVICE_FUNCTION bool marchBrick(
+        const BrickMap &map, uint32_t slot, const float3 &org, const float3 &dir, float tEnter, float tExit,
+        float stepSize, float jitter, Func func) {
+        for (float t = tEnter + jitter * stepSize; t < tExit; t += stepSize) {
+            if (!func(t, sampleBrick(map, slot, org + t * dir)))
+                return false;
+        }
+        return true;
+    }
+
+    // JP: ブリックの最大値をマジョラントとして区間内でデルタトラッキングを行う。densityScaleは値から消散係数への倍率。
+    //     rngはgetFloat0cTo1o()を持つ乱数生成器。実際の衝突があればその距離を返してtrueを返す。
+    // EN: Perform delta tracking within the interval using the maximum value of the brick as the majorant.
+    //     densityScale is the factor from the value to the extinction coefficient.
+    //     rng is a random number generator with getFloat0cTo1o(). Return true with the distance if a real collision occurs.
+    template <typename RNG>
+    CUDA_DEVICE_FUNCTION bool deltaTrackBrick(
+        const BrickMap &map, uint32_t slot, const float3 &org, const float3 &dir, float tEnter, float tExit,
+        float densityScale, RNG &rng, float* tCollision) {
+        const float majorant = densityScale * map.bricks[slot].maxValue;
+        if (majorant <= 0.0f)
+            return false;
+        float t = tEnter;
+        while (true) {
+            t -= std::log(1.0f - rng.getFloat0cTo1o()) / majorant;
+            if (t >= tExit)
+                return false;
+            const float sigma = densityScale * sampleBrick(map, slot, org + t * dir);
+            if (rng.getFloat0cTo1o() * majorant < sigma) {
+                *tCollision = t;
+                return true;
+            }
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    class HostBrickMap {
+        cudau::Array m_pool;
+        CUtexObject m_poolTexObj;
+        cudau::TypedBuffer<uint32_t> m_indirection;
+        cudau::TypedBuffer<BrickInfo> m_bricks;
+        cudau::TypedBuffer<OptixAabb> m_aabbs;
+        uint3 m_gridSizeInBricks;
+        uint3 m_poolSizeInBricks;
+        float3 m_origin;
+        float m_voxelSize;
+        uint32_t m_numBricks;
+
+    public:
+        HostBrickMap() : m_poolTexObj(0), m_numBricks(0) {}
+        ~HostBrickMap() {
+            finalize();
+        }
+
+        // JP: resolutionボクセルのボリュームを走査してブリックマップを作る。
+        //     fetchVoxelは整数のボクセル座標の値を返し、範囲外の座標(縁の読み出しで-1やresolutionになる)にも応える。
+        //     縁を含む最大値がemptyThreshold以下のブリックは空とみなして格納しない。
+        //     ボクセルvの中心は(v + 0.5) * voxelSize + originにある。
+        // EN: Traverse a volume of resolution voxels to make a brick map.
+        //     fetchVoxel returns the value at integer voxel coordinates, and needs to answer also for out-of-range
+        //     coordinates (-1 or resolution due to apron reads).
+        //     Bricks whose maximum including the apron is emptyThreshold or less are regarded as empty and not stored.
+        //     The center of voxel v is at (v + 0.5) * voxelSize + origin.
+        void build(CUcontext cuContext, CUstream stream, const uint3 &resolution, const float3 &origin, float voxelSize,
+                   const std::function<float(int32_t, int32_t, int32_t)> &fetchVoxel, float emptyThreshold) {
+            finalize();
+
+            constexpr uint32_t R = brickResolution;
+            constexpr uint32_t P = brickPhysicalResolution;
+            constexpr uint32_t numVoxelsPerBrick = P * P * P;
+            m_gridSizeInBricks = make_uint3((resolution.x + R - 1) / R,
+                                            (resolution.y + R - 1) / R,
+                                            (resolution.z + R - 1) / R);
+            m_origin = origin;
+            m_voxelSize = voxelSize;
+
+            const size_t numGridBricks =
+                static_cast<size_t>(m_gridSizeInBricks.x) * m_gridSizeInBricks.y * m_gridSizeInBricks.z;
+            std::vector<uint32_t> indirection(numGridBricks, invalidSlot);
+            std::vector<BrickInfo> bricks;
+            std::vector<float> brickVoxels;
+            float voxels[numVoxelsPerBrick];
+            for (uint32_t bz = 0; bz < m_gridSizeInBricks.z; ++bz) {
+                for (uint32_t by = 0; by < m_gridSizeInBricks.y; ++by) {
+                    for (uint32_t bx = 0; bx < m_gridSizeInBricks.x; ++bx) {
+                        float maxValue = -INFINITY;
+                        for (uint32_t k = 0; k < P; ++k) {
+                            for (uint32_t j = 0; j < P; ++j) {
+                                for (uint32_t i = 0; i < P; ++i) {
+                                    const float value = fetchVoxel(
+                                        static_cast<int32_t>(bx * R + i) - static_cast<int32_t>(brickApron),
+                                        static_cast<int32_t>(by * R + j) - static_cast<int32_t>(brickApron),
+                                        static_cast<int32_t>(bz * R + k) - static_cast<int32_t>(brickApron));
+                                    voxels[(k * P + j) * P + i] = value;
+                                    maxValue = std::max(maxValue, value);
+                                }
+                            }
+                        }
+                        if (maxValue <= emptyThreshold)
+                            continue;
+
+                        indirection[(static_cast<size_t>(bz) * m_gridSizeInBricks.y + by) * m_gridSizeInBricks.x + bx] =
+                            static_cast<uint32_t>(bricks.size());
+                        bricks.push_back(BrickInfo{ make_uint3(bx, by, bz), maxValue });
+                        brickVoxels.insert(brickVoxels.end(), voxels, voxels + numVoxelsPerBrick);
+                    }
+                }
+            }
+            m_numBricks = static_cast<uint32_t>(bricks.size());
+
+            // JP: 3D配列の各辺の上限に収まるようにプールのブリックの並びを決める。
+            // EN: Determine the arrangement of bricks in the pool to fit within the limit of each dimension of 3D arrays.
+            constexpr uint32_t maxArrayDim = 2048;
+            constexpr uint32_t maxBricksPerAxis = maxArrayDim / P;
+            const uint32_t numSlots = std::max(m_numBricks, 1u);
+            m_poolSizeInBricks.x = std::min(numSlots, maxBricksPerAxis);
+            m_poolSizeInBricks.y = std::min((numSlots + m_poolSizeInBricks.x - 1) / m_poolSizeInBricks.x,
+                                            maxBricksPerAxis);
+            m_poolSizeInBricks.z = (numSlots + m_poolSizeInBricks.x * m_poolSizeInBricks.y - 1) /
+                (m_poolSizeInBricks.x * m_poolSizeInBricks.y);
+            if (m_poolSizeInBricks.z > maxBricksPerAxis)
+                throw std::runtime_error("Too many bricks for a brick pool.");
+
+            const uint32_t poolWidth = m_poolSizeInBricks.x * P;
+            const uint32_t poolHeight = m_poolSizeInBricks.y * P;
+            const uint32_t poolDepth = m_poolSizeInBricks.z * P;
+            std::vector<float> poolData(static_cast<size_t>(poolWidth) * poolHeight * poolDepth, 0.0f);
+            for (uint32_t slot = 0; slot < m_numBricks; ++slot) {
+                const uint3 pc = make_uint3(slot % m_poolSizeInBricks.x,
+                                            (slot / m_poolSizeInBricks.x) % m_poolSizeInBricks.y,
+                                            slot / (m_poolSizeInBricks.x * m_poolSizeInBricks.y));
+                const float* src = brickVoxels.data() + static_cast<size_t>(slot) * numVoxelsPerBrick;
+                for (uint32_t k = 0; k < P; ++k) {
+                    for (uint32_t j = 0; j < P; ++j) {
+                        float* dst = poolData.data() +
+                            (static_cast<size_t>(pc.z * P + k) * poolHeight + pc.y * P + j) * poolWidth + pc.x * P;
+                        std::copy_n(src + (k * P + j) * P, P, dst);
+                    }
+                }
+            }
+            brickVoxels.clear();
+            brickVoxels.shrink_to_fit();
+
+            m_pool.initialize3D(cuContext, cudau::ArrayElementType::Float32, 1, cudau::ArraySurface::Disable,
+                                poolWidth, poolHeight, poolDepth, 1);
+            m_pool.write(poolData.data(), static_cast<uint32_t>(poolData.size()), 0, stream);
+
+            cudau::TextureSampler sampler;
+            sampler.setXyFilterMode(cudau::TextureFilterMode::Linear);
+            sampler.setMipMapFilterMode(cudau::TextureFilterMode::Point);
+            for (uint32_t dim = 0; dim < 3; ++dim)
+                sampler.setWrapMode(dim, cudau::TextureWrapMode::Clamp);
+            sampler.setIndexingMode(cudau::TextureIndexingMode::ArrayIndex);
+            sampler.setReadMode(cudau::TextureReadMode::NormalizedFloat);
+            m_poolTexObj = sampler.createTextureObject(m_pool);
+
+            std::vector<OptixAabb> aabbs(m_numBricks);
+            BrickMap map = {};
+            map.origin = m_origin;
+            map.voxelSize = m_voxelSize;
+            for (uint32_t slot = 0; slot < m_numBricks; ++slot) {
+                const AABB aabb = map.calcBrickAabb(bricks[slot].gridCoord);
+                aabbs[slot] = OptixAabb{ aabb.minP.x, aabb.minP.y, aabb.minP.z,
+                                         aabb.maxP.x, aabb.maxP.y, aabb.maxP.z };
+            }
+
+            m_indirection.initialize(cuContext, cudau::BufferType::Device, indirection);
+            m_bricks.initialize(cuContext, cudau::BufferType::Device, std::max(m_numBricks, 1u));
+            m_aabbs.initialize(cuContext, cudau::BufferType::Device, std::max(m_numBricks, 1u));
+            if (m_numBricks > 0) {
+                m_bricks.write(bricks, stream);
+                m_aabbs.write(aabbs, stream);
+            }
+        }
+        void finalize() {
+            if (m_poolTexObj) {
+                CUDADRV_CHECK(cuTexObjectDestroy(m_poolTexObj));
+                m_poolTexObj = 0;
+            }
+            m_aabbs.finalize();
+            m_bricks.finalize();
+            m_indirection.finalize();
+            m_pool.finalize();
+            m_numBricks = 0;
+        }
+
+        // JP: スロットの順にAABBが並ぶので、プリミティブインデックスがスロットになる。
+        // EN: AABBs are in the order of slots, so the primitive index becomes the slot.
+        void setupGeometryInstance(const optixu::GeometryInstance &geomInst) const {
+            geomInst.setCustomPrimitiveAABBBuffer(optixu::BufferView(
+                m_aabbs.getCUdeviceptr(), m_numBricks, sizeof(OptixAabb)));
+        }
+
+        uint32_t getNumBricks() const {
+            return m_numBricks;
+        }
+        // JP: ブリックプールと密なボリュームのサイズ(バイト)。
+        // EN: Sizes (in bytes) of the brick pool and the dense volume.
+        void getMemoryUsage(size_t* poolSize, size_t* denseSize) const {
+            constexpr size_t P = brickPhysicalResolution;
+            *poolSize = sizeof(float) * P * P * P *
+                m_poolSizeInBricks.x * m_poolSizeInBricks.y * m_poolSizeInBricks.z;
+            *denseSize = sizeof(float) * brickResolution * brickResolution * brickResolution *
+                m_gridSizeInBricks.x * m_gridSizeInBricks.y * m_gridSizeInBricks.z;
+        }
+
+        BrickMap getBrickMap() const {
+            BrickMap ret;
+            ret.pool = m_poolTexObj;
+            ret.indirection = m_indirection.getDevicePointer();
+            ret.bricks = m_bricks.getDevicePointer();
+            ret.gridSizeInBricks = m_gridSizeInBricks;
+            ret.poolSizeInBricks = m_poolSizeInBricks;
+            ret.origin = m_origin;
+            ret.voxelSize = m_voxelSize;
+            return ret;
+        }
+    };
+#endif
+}
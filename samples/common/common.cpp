@@ -408,6 +408,362 @@ void SlotFinder::debugPrint() const {
 
 
 
+// JP: e[hSĖ܂Ă邩AgĂ邩64܂Ƃ߂1[h̃tOɏW񂷂B
+// EN: Aggregate whether each word is full or has anything in use into a word of flags, 64 words at once.
+static void aggregateFlagWords(const uint64_t* fullSrc, const uint64_t* anySrc, uint32_t numWords,
+                               uint64_t* fullFlags, uint64_t* anyFlags) {
+    uint64_t full = 0;
+    uint64_t any = 0;
+    uint32_t wordIdx = 0;
+#if defined(__AVX2__)
+    const __m256i zeros = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    for (; wordIdx + 4 <= numWords; wordIdx += 4) {
+        __m256i fullValues = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(fullSrc + wordIdx));
+        __m256i anyValues = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(anySrc + wordIdx));
+        uint64_t fullMask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(fullValues, ones)));
+        uint64_t emptyMask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(anyValues, zeros)));
+        full |= fullMask << wordIdx;
+        any |= (~emptyMask & 0xF) << wordIdx;
+    }
+#endif
+    for (; wordIdx < numWords; ++wordIdx) {
+        if (fullSrc[wordIdx] == ~0ull)
+            full |= 1ull << wordIdx;
+        if (anySrc[wordIdx] != 0)
+            any |= 1ull << wordIdx;
+    }
+    *fullFlags = full;
+    *anyFlags = any;
+}
+
+void SlotFinder64::initialize(uint32_t numSlots) {
+    m_numSlots = numSlots;
+    m_numWords = nextMultiplierForPowOf2(numSlots, 6);
+    m_usageWords.assign(m_numWords, 0);
+
+    m_levels.clear();
+    uint32_t numWordsInLevel = m_numWords;
+    while (numWordsInLevel > 1) {
+        numWordsInLevel = nextMultiplierForPowOf2(numWordsInLevel, 6);
+        Level level;
+        level.fullWords.resize(numWordsInLevel);
+        level.anyWords.resize(numWordsInLevel);
+        level.numUsedUnderWord.resize(numWordsInLevel);
+        m_levels.push_back(std::move(level));
+    }
+
+    aggregate();
+}
+
+void SlotFinder64::finalize() {
+    m_levels.clear();
+    m_usageWords.clear();
+    m_numWords = 0;
+    m_numSlots = 0;
+}
+
+void SlotFinder64::aggregate() {
+    for (uint32_t level = 1; level <= m_levels.size(); ++level) {
+        Level &dstLevel = m_levels[level - 1];
+        uint32_t numChildWords = getNumWordsInLevel(level - 1);
+        const uint64_t* childFullWords = level == 1 ? m_usageWords.data() : m_levels[level - 2].fullWords.data();
+        const uint64_t* childAnyWords = level == 1 ? m_usageWords.data() : m_levels[level - 2].anyWords.data();
+        for (uint32_t wordIdx = 0; wordIdx < dstLevel.fullWords.size(); ++wordIdx) {
+            uint32_t childBegin = 64 * wordIdx;
+            uint32_t numChildren = std::min(64u, numChildWords - childBegin);
+            uint64_t fullFlags;
+            uint64_t anyFlags;
+            aggregateFlagWords(childFullWords + childBegin, childAnyWords + childBegin, numChildren,
+                               &fullFlags, &anyFlags);
+            // JP: ŉw̍Ō̃[h͗LȃrbgŔ肵A݂Ȃq͖܂Ă̂ƂB
+            // EN: Judge the last word of the lowest level only by its valid bits,
+            //     and treat nonexistent children as full.
+            if (level == 1 && childBegin + numChildren == m_numWords &&
+                isWordFull(0, m_numWords - 1))
+                fullFlags |= 1ull << (numChildren - 1);
+            if (numChildren < 64)
+                fullFlags |= ~((1ull << numChildren) - 1);
+            dstLevel.fullWords[wordIdx] = fullFlags;
+            dstLevel.anyWords[wordIdx] = anyFlags;
+
+            uint32_t numUsed = 0;
+            for (uint32_t i = 0; i < numChildren; ++i)
+                numUsed += getNumUsedUnderWord(level - 1, childBegin + i);
+            dstLevel.numUsedUnderWord[wordIdx] = numUsed;
+        }
+    }
+}
+
+void SlotFinder64::resize(uint32_t numSlots) {
+    if (numSlots == m_numSlots)
+        return;
+
+    std::vector<uint64_t> oldUsageWords = std::move(m_usageWords);
+    initialize(numSlots);
+    uint32_t numWords = std::min(static_cast<uint32_t>(oldUsageWords.size()), m_numWords);
+    std::copy_n(oldUsageWords.data(), numWords, m_usageWords.data());
+    if (m_numWords > 0)
+        m_usageWords[m_numWords - 1] &= getValidMask(m_numWords - 1);
+
+    aggregate();
+}
+
+void SlotFinder64::setUsageWords(const uint64_t* words) {
+    std::copy_n(words, m_numWords, m_usageWords.data());
+    if (m_numWords > 0)
+        m_usageWords[m_numWords - 1] &= getValidMask(m_numWords - 1);
+
+    aggregate();
+}
+
+void SlotFinder64::setInUse(uint32_t slotIdx) {
+    if (getUsage(slotIdx))
+        return;
+
+    uint32_t childIdx = slotIdx / 64;
+    m_usageWords[childIdx] |= 1ull << (slotIdx % 64);
+    bool childIsFull = isWordFull(0, childIdx);
+    for (Level &level : m_levels) {
+        uint32_t wordIdx = childIdx / 64;
+        uint64_t flag = 1ull << (childIdx % 64);
+        level.anyWords[wordIdx] |= flag;
+        if (childIsFull)
+            level.fullWords[wordIdx] |= flag;
+        ++level.numUsedUnderWord[wordIdx];
+
+        childIsFull = level.fullWords[wordIdx] == ~0ull;
+        childIdx = wordIdx;
+    }
+}
+
+void SlotFinder64::setNotInUse(uint32_t slotIdx) {
+    if (!getUsage(slotIdx))
+        return;
+
+    uint32_t childIdx = slotIdx / 64;
+    m_usageWords[childIdx] &= ~(1ull << (slotIdx % 64));
+    bool childIsEmpty = m_usageWords[childIdx] == 0;
+    for (Level &level : m_levels) {
+        uint32_t wordIdx = childIdx / 64;
+        uint64_t flag = 1ull << (childIdx % 64);
+        level.fullWords[wordIdx] &= ~flag;
+        if (childIsEmpty)
+            level.anyWords[wordIdx] &= ~flag;
+        --level.numUsedUnderWord[wordIdx];
+
+        childIsEmpty = level.anyWords[wordIdx] == 0;
+        childIdx = wordIdx;
+    }
+}
+
+uint32_t SlotFinder64::getFirstAvailableSlot() const {
+    if (m_numWords == 0)
+        return InvalidSlotIndex;
+
+    uint32_t wordIdx = 0;
+    for (int level = static_cast<int32_t>(m_levels.size()); level > 0; --level) {
+        uint64_t fullFlags = m_levels[level - 1].fullWords[wordIdx];
+        if (fullFlags == ~0ull)
+            return InvalidSlotIndex;
+        wordIdx = 64 * wordIdx + tzcnt64(~fullFlags);
+    }
+
+    uint64_t freeFlags = ~m_usageWords[wordIdx] & getValidMask(wordIdx);
+    if (freeFlags == 0)
+        return InvalidSlotIndex;
+    return 64 * wordIdx + tzcnt64(freeFlags);
+}
+
+uint32_t SlotFinder64::getFirstUsedSlot() const {
+    if (m_numWords == 0)
+        return InvalidSlotIndex;
+
+    uint32_t wordIdx = 0;
+    for (int level = static_cast<int32_t>(m_levels.size()); level > 0; --level) {
+        uint64_t anyFlags = m_levels[level - 1].anyWords[wordIdx];
+        if (anyFlags == 0)
+            return InvalidSlotIndex;
+        wordIdx = 64 * wordIdx + tzcnt64(anyFlags);
+    }
+
+    uint64_t usedFlags = m_usageWords[wordIdx];
+    if (usedFlags == 0)
+        return InvalidSlotIndex;
+    return 64 * wordIdx + tzcnt64(usedFlags);
+}
+
+uint32_t SlotFinder64::find_nthUsedSlot(uint32_t n) const {
+    if (n >= getNumUsed())
+        return InvalidSlotIndex;
+
+    uint32_t wordIdx = 0;
+    for (int level = static_cast<int32_t>(m_levels.size()); level > 0; --level) {
+        // JP: gpXbgq͐ɔ΂B
+        // EN: Skip children without used slots without counting.
+        uint64_t anyFlags = m_levels[level - 1].anyWords[wordIdx];
+        uint32_t childIdx;
+        while (true) {
+            childIdx = 64 * wordIdx + tzcnt64(anyFlags);
+            uint32_t numUsed = getNumUsedUnderWord(level - 1, childIdx);
+            if (n < numUsed)
+                break;
+            n -= numUsed;
+            anyFlags &= anyFlags - 1;
+        }
+        wordIdx = childIdx;
+    }
+
+    return 64 * wordIdx + nthSetBit64(m_usageWords[wordIdx], n);
+}
+
+uint32_t SlotFinder64::getNumUsed() const {
+    if (m_levels.empty())
+        return m_numWords > 0 ? popcnt64(m_usageWords[0]) : 0;
+    return m_levels.back().numUsedUnderWord[0];
+}
+
+
+
+std::vector<uint64_t> GPUSlotFinder::computeFullSummary(const uint64_t* usageWords) const {
+    uint32_t numWords = m_usageWords.numElements();
+    uint32_t numSummaryWords = m_fullSummaryWords.numElements();
+    DeviceSlotFinder view = getDeviceView();
+    std::vector<uint64_t> summary(numSummaryWords, 0);
+    for (uint32_t wordIdx = 0; wordIdx < numWords; ++wordIdx) {
+        if (usageWords[wordIdx] == view.getValidMask(wordIdx))
+            summary[wordIdx / 64] |= 1ull << (wordIdx % 64);
+    }
+    // JP: ݂Ȃ[h͖܂Ă̂ƂĒTOB
+    // EN: Exclude nonexistent words from the search by treating them as full.
+    if (numWords % 64 != 0)
+        summary[numSummaryWords - 1] |= ~((1ull << (numWords % 64)) - 1);
+    return summary;
+}
+
+void GPUSlotFinder::initialize(CUcontext cuContext, cudau::BufferType type, uint32_t numSlots) {
+    Assert(numSlots > 0, "At least one slot is required.");
+    m_numSlots = numSlots;
+    uint32_t numWords = nextMultiplierForPowOf2(numSlots, 6);
+    m_usageWords.initialize(cuContext, type, numWords);
+    m_fullSummaryWords.initialize(cuContext, type, nextMultiplierForPowOf2(numWords, 6));
+    m_numUsed.initialize(cuContext, type, 1);
+    reset(0);
+}
+
+void GPUSlotFinder::finalize() {
+    m_numUsed.finalize();
+    m_fullSummaryWords.finalize();
+    m_usageWords.finalize();
+    m_numSlots = 0;
+}
+
+void GPUSlotFinder::reset(CUstream stream) {
+    std::vector<uint64_t> usageWords(m_usageWords.numElements(), 0);
+    std::vector<uint64_t> summary = computeFullSummary(usageWords.data());
+    m_usageWords.fill(static_cast<uint64_t>(0), stream);
+    m_fullSummaryWords.write(summary.data(), static_cast<uint32_t>(summary.size()), stream);
+    m_numUsed.fill(0u, stream);
+}
+
+void GPUSlotFinder::upload(const SlotFinder64 &finder, CUstream stream) {
+    Assert(finder.getNumSlots() == m_numSlots, "The number of slots does not match.");
+    std::vector<uint64_t> summary = computeFullSummary(finder.getUsageWords());
+    uint32_t numUsed = finder.getNumUsed();
+    m_usageWords.write(finder.getUsageWords(), finder.getNumWords(), stream);
+    m_fullSummaryWords.write(summary.data(), static_cast<uint32_t>(summary.size()), stream);
+    m_numUsed.write(&numUsed, 1, stream);
+    CUDADRV_CHECK(cuStreamSynchronize(stream));
+}
+
+void GPUSlotFinder::download(SlotFinder64* finder, CUstream stream) const {
+    std::vector<uint64_t> usageWords(m_usageWords.numElements());
+    m_usageWords.read(usageWords.data(), static_cast<uint32_t>(usageWords.size()), stream);
+    CUDADRV_CHECK(cuStreamSynchronize(stream));
+    if (finder->getNumSlots() != m_numSlots)
+        finder->initialize(m_numSlots);
+    finder->setUsageWords(usageWords.data());
+}
+
+
+
+void PerlinNoise3D::evaluate(const float3* points, uint32_t numPoints, float frequency, float* values,
+                             float amplitude, bool accumulate) const {
+    // JP: gradient()switchƓzxNg̕\B
+    // EN: Table of the same gradient vectors as the switch in gradient().
+    static constexpr float gradX[] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0, 1, 0, -1, 0 };
+    static constexpr float gradY[] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1, 1, -1, 1, -1 };
+    static constexpr float gradZ[] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1, 0, 1, 0, -1 };
+    constexpr uint32_t groupSize = 64;
+
+    parallelFor(numPoints, [&](uint32_t begin, uint32_t end) {
+        float xus[groupSize], yus[groupSize], zus[groupSize];
+        uint8_t hashes[8][groupSize];
+        for (uint32_t groupBegin = begin; groupBegin < end; groupBegin += groupSize) {
+            uint32_t numInGroup = std::min(groupSize, end - groupBegin);
+
+            // JP: \𔺂_ƂɍsAʂSoAɒuB
+            // EN: Do only the part with table lookups per point and put the results in SoA.
+            for (uint32_t i = 0; i < numInGroup; ++i) {
+                int32_t xs[2], ys[2], zs[2];
+                computeCell(points[groupBegin + i], frequency, xs, ys, zs, &xus[i], &yus[i], &zus[i]);
+                uint8_t cornerHashes[8];
+                hashCorners(xs, ys, zs, cornerHashes);
+                for (int c = 0; c < 8; ++c)
+                    hashes[c][i] = cornerHashes[c];
+            }
+
+            // JP: c͕̖[vȂ̂ŃRpC[xNgłB
+            // EN: The rest is a branchless loop, so the compiler can vectorize it.
+            float* dstValues = values + groupBegin;
+            for (uint32_t i = 0; i < numInGroup; ++i) {
+                float xu = xus[i];
+                float yu = yus[i];
+                float zu = zus[i];
+                float corners[8];
+                for (int c = 0; c < 8; ++c) {
+                    uint32_t h = hashes[c][i];
+                    float dx = xu - (c & 0x1);
+                    float dy = yu - ((c >> 1) & 0x1);
+                    float dz = zu - ((c >> 2) & 0x1);
+                    corners[c] = gradX[h] * dx + gradY[h] * dy + gradZ[h] * dz;
+                }
+                float u = fade(xu);
+                float v = fade(yu);
+                float w = fade(zu);
+                float __lValue = lerp(lerp(corners[0], corners[1], u), lerp(corners[2], corners[3], u), v);
+                float __uValue = lerp(lerp(corners[4], corners[5], u), lerp(corners[6], corners[7], u), v);
+                float value = amplitude * lerp(__lValue, __uValue, w);
+                dstValues[i] = accumulate ? dstValues[i] + value : value;
+            }
+        }
+    });
+}
+
+
+
+void parallelFor(uint32_t numItems, const std::function<void(uint32_t, uint32_t)> &func) {
+    constexpr uint32_t minNumItemsPerThread = 16;
+    uint32_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    numThreads = std::min(numThreads, (numItems + minNumItemsPerThread - 1) / minNumItemsPerThread);
+    if (numThreads <= 1) {
+        func(0, numItems);
+        return;
+    }
+
+    uint32_t numItemsPerThread = (numItems + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (uint32_t i = 1; i < numThreads; ++i) {
+        uint32_t begin = std::min(i * numItemsPerThread, numItems);
+        uint32_t end = std::min(begin + numItemsPerThread, numItems);
+        threads.emplace_back(func, begin, end);
+    }
+    func(0, std::min(numItemsPerThread, numItems));
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
 void saveImage(const std::filesystem::path &filepath, uint32_t width, uint32_t height, const uint32_t* data) {
     if (filepath.extension() == ".png")
         stbi_write_png(filepath.string().c_str(), width, height, 4, data,
@@ -421,26 +777,28 @@ void saveImage(const std::filesystem::path &filepath, uint32_t width, uint32_t h
 void saveImage(const std::filesystem::path &filepath, uint32_t width, uint32_t height, const float4* data,
                bool applyToneMap, bool apply_sRGB_gammaCorrection) {
     auto image = new uint32_t[width * height];
-    for (int y = 0; y < static_cast<int32_t>(height); ++y) {
-        for (int x = 0; x < static_cast<int32_t>(width); ++x) {
-            float4 src = data[y * width + x];
-            if (applyToneMap) {
-                src.x = simpleToneMap_s(src.x);
-                src.y = simpleToneMap_s(src.y);
-                src.z = simpleToneMap_s(src.z);
-            }
-            if (apply_sRGB_gammaCorrection) {
-                src.x = sRGB_gamma_s(src.x);
-                src.y = sRGB_gamma_s(src.y);
-                src.z = sRGB_gamma_s(src.z);
+    parallelFor(height, [&](uint32_t yBegin, uint32_t yEnd) {
+        for (int y = yBegin; y < static_cast<int32_t>(yEnd); ++y) {
+            for (int x = 0; x < static_cast<int32_t>(width); ++x) {
+                float4 src = data[y * width + x];
+                if (applyToneMap) {
+                    src.x = simpleToneMap_s(src.x);
+                    src.y = simpleToneMap_s(src.y);
+                    src.z = simpleToneMap_s(src.z);
+                }
+                if (apply_sRGB_gammaCorrection) {
+                    src.x = sRGB_gamma_s(src.x);
+                    src.y = sRGB_gamma_s(src.y);
+                    src.z = sRGB_gamma_s(src.z);
+                }
+                uint32_t &dst = image[y * width + x];
+                dst = ((std::min<uint32_t>(static_cast<uint32_t>(src.x * 255), 255) << 0) |
+                       (std::min<uint32_t>(static_cast<uint32_t>(src.y * 255), 255) << 8) |
+                       (std::min<uint32_t>(static_cast<uint32_t>(src.z * 255), 255) << 16) |
+                       (std::min<uint32_t>(static_cast<uint32_t>(src.w * 255), 255) << 24));
             }
-            uint32_t &dst = image[y * width + x];
-            dst = ((std::min<uint32_t>(static_cast<uint32_t>(src.x * 255), 255) << 0) |
-                   (std::min<uint32_t>(static_cast<uint32_t>(src.y * 255), 255) << 8) |
-                   (std::min<uint32_t>(static_cast<uint32_t>(src.z * 255), 255) << 16) |
-                   (std::min<uint32_t>(static_cast<uint32_t>(src.w * 255), 255) << 24));
         }
-    }
+    });
 
     saveImage(filepath, width, height, image);
 
@@ -464,3 +822,426 @@ void saveImage(const std::filesystem::path &filepath,
     saveImage(filepath, array.getWidth(), array.getHeight(), data, applyToneMap, apply_sRGB_gammaCorrection);
     array.unmap();
 }
+
+
+
+void AsyncImageWriter::initialize(CUcontext cuContext, uint32_t numSlots) {
+    Assert(m_closed, "AsyncImageWriter is already initialized.");
+    Assert(numSlots > 0, "At least one slot is required.");
+    m_cuContext = cuContext;
+    CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+    CUDADRV_CHECK(cuStreamCreate(&m_stream, CU_STREAM_NON_BLOCKING));
+    m_slots.resize(numSlots);
+    for (uint32_t slotIdx = 0; slotIdx < numSlots; ++slotIdx) {
+        Slot &slot = m_slots[slotIdx];
+        slot.pinned = nullptr;
+        slot.capacity = 0;
+        CUDADRV_CHECK(cuEventCreate(&slot.srcReadyEvent, CU_EVENT_DISABLE_TIMING));
+        CUDADRV_CHECK(cuEventCreate(&slot.readbackDoneEvent, CU_EVENT_DISABLE_TIMING));
+        m_freeSlots.push_back(slotIdx);
+    }
+    m_numBusySlots = 0;
+    m_closed = false;
+    m_worker = std::thread(&AsyncImageWriter::workerLoop, this);
+}
+
+void AsyncImageWriter::finalize() {
+    if (m_closed)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_cond.notify_all();
+    m_worker.join();
+
+    for (Slot &slot : m_slots) {
+        if (slot.pinned)
+            CUDADRV_CHECK(cuMemFreeHost(slot.pinned));
+        CUDADRV_CHECK(cuEventDestroy(slot.readbackDoneEvent));
+        CUDADRV_CHECK(cuEventDestroy(slot.srcReadyEvent));
+    }
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_linear.clear();
+    m_linear.shrink_to_fit();
+    CUDADRV_CHECK(cuStreamDestroy(m_stream));
+    m_stream = nullptr;
+}
+
+uint32_t AsyncImageWriter::acquireSlot(size_t numElements, CUstream stream) {
+    Assert(!m_closed, "AsyncImageWriter is not initialized.");
+    uint32_t slotIdx;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return !m_freeSlots.empty(); });
+        slotIdx = m_freeSlots.front();
+        m_freeSlots.pop_front();
+        ++m_numBusySlots;
+    }
+
+    Slot &slot = m_slots[slotIdx];
+    if (numElements > slot.capacity) {
+        if (slot.pinned)
+            CUDADRV_CHECK(cuMemFreeHost(slot.pinned));
+        CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&slot.pinned), sizeof(float4) * numElements));
+        slot.capacity = numElements;
+    }
+
+    // JP: ǂݏop̃Xg[`̊ɈˑB`Xg[̂͑҂ȂB
+    // EN: Make the readback stream depend on the completion of the rendering.
+    //     The rendering stream itself is not stalled.
+    CUDADRV_CHECK(cuEventRecord(slot.srcReadyEvent, stream));
+    CUDADRV_CHECK(cuStreamWaitEvent(m_stream, slot.srcReadyEvent, 0));
+
+    return slotIdx;
+}
+
+void AsyncImageWriter::submit(
+    uint32_t slotIdx, const std::filesystem::path &filepath, uint32_t width, uint32_t height,
+    const DeswizzleFunction &deswizzle, bool applyToneMap, bool apply_sRGB_gammaCorrection) {
+    Slot &slot = m_slots[slotIdx];
+    CUDADRV_CHECK(cuEventRecord(slot.readbackDoneEvent, m_stream));
+    slot.filepath = filepath;
+    slot.width = width;
+    slot.height = height;
+    slot.deswizzle = deswizzle;
+    slot.applyToneMap = applyToneMap;
+    slot.apply_sRGB_gammaCorrection = apply_sRGB_gammaCorrection;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_submittedSlots.push_back(slotIdx);
+    }
+    m_cond.notify_all();
+}
+
+void AsyncImageWriter::workerLoop() {
+    CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+    while (true) {
+        uint32_t slotIdx;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_closed || !m_submittedSlots.empty(); });
+            if (m_submittedSlots.empty())
+                break;
+            slotIdx = m_submittedSlots.front();
+            m_submittedSlots.pop_front();
+        }
+
+        Slot &slot = m_slots[slotIdx];
+        CUDADRV_CHECK(cuEventSynchronize(slot.readbackDoneEvent));
+        const float4* data = slot.pinned;
+        if (slot.deswizzle) {
+            m_linear.resize(static_cast<size_t>(slot.width) * slot.height);
+            parallelFor(slot.height, [this, &slot](uint32_t yBegin, uint32_t yEnd) {
+                slot.deswizzle(slot.pinned, m_linear.data(), yBegin, yEnd);
+            });
+            data = m_linear.data();
+        }
+        saveImage(slot.filepath, slot.width, slot.height, data,
+                  slot.applyToneMap, slot.apply_sRGB_gammaCorrection);
+        slot.deswizzle = DeswizzleFunction();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_freeSlots.push_back(slotIdx);
+            --m_numBusySlots;
+        }
+        m_cond.notify_all();
+    }
+}
+
+void AsyncImageWriter::capture(
+    const std::filesystem::path &filepath,
+    uint32_t width, const cudau::TypedBuffer<float4> &buffer,
+    bool applyToneMap, bool apply_sRGB_gammaCorrection, CUstream stream) {
+    Assert(buffer.numElements() % width == 0, "Buffer's length is not divisible by the width.");
+    uint32_t height = buffer.numElements() / width;
+    uint32_t slotIdx = acquireSlot(buffer.numElements(), stream);
+    CUDADRV_CHECK(cuMemcpyDtoHAsync(m_slots[slotIdx].pinned, buffer.getCUdeviceptr(),
+                                    buffer.sizeInBytes(), m_stream));
+    submit(slotIdx, filepath, width, height, DeswizzleFunction(), applyToneMap, apply_sRGB_gammaCorrection);
+}
+
+void AsyncImageWriter::capture(
+    const std::filesystem::path &filepath,
+    const cudau::Array &array,
+    bool applyToneMap, bool apply_sRGB_gammaCorrection, CUstream stream) {
+    uint32_t width = array.getWidth();
+    uint32_t height = array.getHeight();
+    uint32_t slotIdx = acquireSlot(static_cast<size_t>(width) * height, stream);
+
+    CUDA_MEMCPY2D params = {};
+    params.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+    params.srcArray = array.getCUarray(0);
+    params.dstMemoryType = CU_MEMORYTYPE_HOST;
+    params.dstHost = m_slots[slotIdx].pinned;
+    params.dstPitch = sizeof(float4) * width;
+    params.WidthInBytes = sizeof(float4) * width;
+    params.Height = height;
+    CUDADRV_CHECK(cuMemcpy2DAsync(&params, m_stream));
+
+    submit(slotIdx, filepath, width, height, DeswizzleFunction(), applyToneMap, apply_sRGB_gammaCorrection);
+}
+
+void AsyncImageWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this]() { return m_numBusySlots == 0; });
+}
+
+
+
+bool parseBenchmarkArgument(int32_t argc, const char* argv[], uint32_t* argIdx, BenchmarkOptions* options) {
+    std::string_view arg = argv[*argIdx];
+    if (arg == "--benchmark") {
+        options->enabled = true;
+        *argIdx += 1;
+        return true;
+    }
+
+    if (arg != "--benchmark-frames" && arg != "--benchmark-warmup" && arg != "--benchmark-output")
+        return false;
+    if (*argIdx + 1 >= static_cast<uint32_t>(argc))
+        throw std::runtime_error("Benchmark argument requires a value.");
+    const char* value = argv[*argIdx + 1];
+    if (arg == "--benchmark-frames")
+        options->numFrames = std::max(std::atoi(value), 1);
+    else if (arg == "--benchmark-warmup")
+        options->numWarmupFrames = std::max(std::atoi(value), 0);
+    else
+        options->outputPath = value;
+    *argIdx += 2;
+    return true;
+}
+
+void calcBenchmarkCameraPose(uint32_t frameIndex, uint32_t numFrames,
+                             const float3 &center, float radius, float height,
+                             float3* position, Matrix3x3* orientation) {
+    float angle = 2 * static_cast<float>(M_PI) * frameIndex / std::max(numFrames, 1u);
+    *position = center + make_float3(radius * std::sin(angle), height, radius * std::cos(angle));
+
+    // JP: J̃[JWn+XA+YA+ZOB
+    // EN: The local coordinate system of the camera is +X left, +Y up and +Z forward.
+    float3 forward = normalize(center - *position);
+    float3 left = normalize(cross(make_float3(0, 1, 0), forward));
+    float3 up = cross(forward, left);
+    *orientation = Matrix3x3(left, up, forward);
+}
+
+
+
+static const char* getBenchmarkStageName(BenchmarkRecorder::Stage stage) {
+    switch (stage) {
+    case BenchmarkRecorder::Stage::ASBuild:
+        return "asBuild";
+    case BenchmarkRecorder::Stage::ASCompaction:
+        return "asCompaction";
+    case BenchmarkRecorder::Stage::SBTSetup:
+        return "sbtSetup";
+    case BenchmarkRecorder::Stage::Launch:
+        return "launch";
+    case BenchmarkRecorder::Stage::Denoise:
+        return "denoise";
+    case BenchmarkRecorder::Stage::Readback:
+        return "readback";
+    default:
+        Assert_ShouldNotBeCalled();
+        break;
+    }
+    return "";
+}
+
+static void writeBenchmarkStatistics(std::ostream &os, std::vector<float> values) {
+    if (values.empty()) {
+        os << "{ \"count\": 0 }";
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    double total = 0.0;
+    for (float v : values)
+        total += v;
+    size_t n = values.size();
+    float median = n % 2 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+    os << "{ \"count\": " << n
+        << ", \"total\": " << total
+        << ", \"mean\": " << total / n
+        << ", \"median\": " << median
+        << ", \"min\": " << values.front()
+        << ", \"max\": " << values.back() << " }";
+}
+
+void BenchmarkRecorder::initialize(CUcontext cuContext, const std::string &sampleName,
+                                   const BenchmarkOptions &options) {
+    m_cuContext = cuContext;
+    m_sampleName = sampleName;
+    m_options = options;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(Stage::NumStages); ++i) {
+        m_openMeasurements[i] = 0xFFFFFFFF;
+        m_setupStageTimes[i].clear();
+        m_stageTimes[i].clear();
+    }
+    m_frameTimes.clear();
+    m_numTracedRays = 0;
+    m_frameIndex = 0;
+    m_imageWidth = 0;
+    m_imageHeight = 0;
+    m_inFrame = false;
+
+    CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+    size_t freeMem, totalMem;
+    CUDADRV_CHECK(cuMemGetInfo(&freeMem, &totalMem));
+    m_initialMemoryUsage = totalMem - freeMem;
+    m_peakMemoryUsage = m_initialMemoryUsage;
+}
+
+void BenchmarkRecorder::finalize() {
+    if (!m_cuContext)
+        return;
+
+    CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+    resolve();
+    for (EventPair &events : m_freeEvents) {
+        CUDADRV_CHECK(cuEventDestroy(events.endEvent));
+        CUDADRV_CHECK(cuEventDestroy(events.startEvent));
+    }
+    m_freeEvents.clear();
+    m_cuContext = nullptr;
+}
+
+void BenchmarkRecorder::addTime(MeasurementTarget target, Stage stage, float time) {
+    if (target == MeasurementTarget::Setup)
+        m_setupStageTimes[static_cast<uint32_t>(stage)].push_back(time);
+    else if (target == MeasurementTarget::Frame)
+        m_stageTimes[static_cast<uint32_t>(stage)].push_back(time);
+}
+
+void BenchmarkRecorder::resolve() {
+    for (PendingMeasurement &pm : m_pendingMeasurements) {
+        if (pm.target != MeasurementTarget::Discard) {
+            float time;
+            CUDADRV_CHECK(cuEventSynchronize(pm.events.endEvent));
+            CUDADRV_CHECK(cuEventElapsedTime(&time, pm.events.startEvent, pm.events.endEvent));
+            addTime(pm.target, pm.stage, time);
+        }
+        m_freeEvents.push_back(pm.events);
+    }
+    m_pendingMeasurements.clear();
+}
+
+void BenchmarkRecorder::start(Stage stage, CUstream stream) {
+    if (!m_cuContext)
+        return;
+    uint32_t &openIdx = m_openMeasurements[static_cast<uint32_t>(stage)];
+    Assert(openIdx == 0xFFFFFFFF, "Stage %s is already being measured.", getBenchmarkStageName(stage));
+
+    PendingMeasurement pm;
+    if (m_freeEvents.empty()) {
+        CUDADRV_CHECK(cuEventCreate(&pm.events.startEvent, CU_EVENT_BLOCKING_SYNC));
+        CUDADRV_CHECK(cuEventCreate(&pm.events.endEvent, CU_EVENT_BLOCKING_SYNC));
+    }
+    else {
+        pm.events = m_freeEvents.back();
+        m_freeEvents.pop_back();
+    }
+    pm.stage = stage;
+    pm.target = getMeasurementTarget();
+    CUDADRV_CHECK(cuEventRecord(pm.events.startEvent, stream));
+    openIdx = static_cast<uint32_t>(m_pendingMeasurements.size());
+    m_pendingMeasurements.push_back(pm);
+}
+
+void BenchmarkRecorder::stop(Stage stage, CUstream stream) {
+    if (!m_cuContext)
+        return;
+    uint32_t &openIdx = m_openMeasurements[static_cast<uint32_t>(stage)];
+    Assert(openIdx != 0xFFFFFFFF, "Stage %s is not being measured.", getBenchmarkStageName(stage));
+    CUDADRV_CHECK(cuEventRecord(m_pendingMeasurements[openIdx].events.endEvent, stream));
+    openIdx = 0xFFFFFFFF;
+    sampleMemoryUsage();
+}
+
+void BenchmarkRecorder::record(Stage stage, float time) {
+    if (m_cuContext)
+        addTime(getMeasurementTarget(), stage, time);
+}
+
+void BenchmarkRecorder::beginFrame() {
+    if (!m_cuContext)
+        return;
+    m_inFrame = true;
+    m_frameStopWatch.start();
+}
+
+void BenchmarkRecorder::endFrame(uint64_t numTracedRays) {
+    if (!m_cuContext)
+        return;
+    resolve();
+    uint64_t frameTime = m_frameStopWatch.getElapsed(StopWatchDurationType::Microseconds);
+    m_frameStopWatch.stop();
+    m_frameStopWatch.clearAllMeasurements();
+    if (isMeasuringFrame()) {
+        m_frameTimes.push_back(frameTime * 1e-3f);
+        m_numTracedRays += numTracedRays;
+    }
+    sampleMemoryUsage();
+    m_inFrame = false;
+    ++m_frameIndex;
+}
+
+void BenchmarkRecorder::sampleMemoryUsage() {
+    if (!m_cuContext)
+        return;
+    size_t freeMem, totalMem;
+    CUDADRV_CHECK(cuMemGetInfo(&freeMem, &totalMem));
+    m_peakMemoryUsage = std::max(m_peakMemoryUsage, totalMem - freeMem);
+}
+
+bool BenchmarkRecorder::write() {
+    if (!m_cuContext)
+        return false;
+    resolve();
+
+    std::ofstream ofs(m_options.outputPath);
+    if (!ofs) {
+        hpprintf("Failed to open %s.\n", m_options.outputPath.string().c_str());
+        return false;
+    }
+
+    double totalLaunchTime = 0.0;
+    for (float t : m_stageTimes[static_cast<uint32_t>(Stage::Launch)])
+        totalLaunchTime += t;
+
+    ofs << "{\n";
+    ofs << "    \"sample\": \"" << m_sampleName << "\",\n";
+    ofs << "    \"numFrames\": " << m_frameTimes.size() << ",\n";
+    ofs << "    \"numWarmupFrames\": " << m_options.numWarmupFrames << ",\n";
+    ofs << "    \"imageSize\": [" << m_imageWidth << ", " << m_imageHeight << "],\n";
+    ofs << "    \"stages\": {\n";
+    for (uint32_t i = 0; i < static_cast<uint32_t>(Stage::NumStages); ++i) {
+        ofs << "        \"" << getBenchmarkStageName(static_cast<Stage>(i)) << "\": ";
+        writeBenchmarkStatistics(ofs, m_stageTimes[i]);
+        ofs << (i + 1 < static_cast<uint32_t>(Stage::NumStages) ? ",\n" : "\n");
+    }
+    ofs << "    },\n";
+    ofs << "    \"setupStages\": {\n";
+    for (uint32_t i = 0; i < static_cast<uint32_t>(Stage::NumStages); ++i) {
+        ofs << "        \"" << getBenchmarkStageName(static_cast<Stage>(i)) << "\": ";
+        writeBenchmarkStatistics(ofs, m_setupStageTimes[i]);
+        ofs << (i + 1 < static_cast<uint32_t>(Stage::NumStages) ? ",\n" : "\n");
+    }
+    ofs << "    },\n";
+    ofs << "    \"frame\": ";
+    writeBenchmarkStatistics(ofs, m_frameTimes);
+    ofs << ",\n";
+    ofs << "    \"initialDeviceMemory\": " << m_initialMemoryUsage << ",\n";
+    ofs << "    \"peakDeviceMemory\": " << m_peakMemoryUsage << ",\n";
+    ofs << "    \"numTracedRays\": " << m_numTracedRays << ",\n";
+    ofs << "    \"raysPerSecond\": " <<
+        (totalLaunchTime > 0.0 ? m_numTracedRays / (totalLaunchTime * 1e-3) : 0.0) << "\n";
+    ofs << "}\n";
+
+    hpprintf("Benchmark results written to %s.\n", m_options.outputPath.string().c_str());
+    return true;
+}
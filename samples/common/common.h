@@ -48,6 +48,9 @@
 #   include <filesystem>
 #   include <functional>
 #   include <thread>
+#   include <mutex>
+#   include <condition_variable>
+#   include <deque>
 #   include <chrono>
 #   include <variant>
 
@@ -123,6 +126,22 @@ CUDA_DEVICE_FUNCTION int32_t popcnt(uint32_t x) {
 #endif
 }
 
+CUDA_DEVICE_FUNCTION uint32_t tzcnt64(uint64_t x) {
+#if defined(__CUDA_ARCH__)
+    return __clzll(__brevll(x));
+#else
+    return static_cast<uint32_t>(_tzcnt_u64(x));
+#endif
+}
+
+CUDA_DEVICE_FUNCTION int32_t popcnt64(uint64_t x) {
+#if defined(__CUDA_ARCH__)
+    return __popcll(x);
+#else
+    return static_cast<int32_t>(_mm_popcnt_u64(x));
+#endif
+}
+
 //     0: 0
 //     1: 0
 //  2- 3: 1
@@ -208,6 +227,107 @@ CUDA_DEVICE_FUNCTION uint32_t nthSetBit(uint32_t value, int32_t n) {
     return idx;
 }
 
+CUDA_DEVICE_FUNCTION uint32_t nthSetBit64(uint64_t value, int32_t n) {
+    uint32_t lo = static_cast<uint32_t>(value);
+    int32_t numLo = popcnt(lo);
+    if (n < numLo)
+        return nthSetBit(lo, n);
+    uint32_t idx = nthSetBit(static_cast<uint32_t>(value >> 32), n - numLo);
+    return idx == 0xFFFFFFFF ? idx : 32 + idx;
+}
+
+
+
+// JP: GPU쓮̃CX^XȂǂŃfoCXAg~bNŃXbgmہE邽߂̃r[B
+//     64rbg̎gptOƁAgptÕ[h܂Ă邱Ƃ1ĩT}[B
+//     T}[͋Ɂu܂ĂvɌÂȂ蓾qgłAmۂ̎s͋󂫂Ƃۏ؂ȂB
+//     zXg̏L҂GPUSlotFinderB
+// EN: View to allocate and free slots with atomics from the device side, e.g. for GPU-driven instance spawning.
+//     This has 64-bit usage flags and a single summary level indicating that the words of usage flags are full.
+//     The summary is a hint which may become stale toward "full" under contention,
+//     so a failed allocation does not guarantee that there is no free slot.
+//     GPUSlotFinder is the owner on the host side.
+struct DeviceSlotFinder {
+    uint64_t* usageWords;
+    uint64_t* fullSummaryWords;
+    uint32_t* numUsed;
+    uint32_t numSlots;
+    uint32_t numWords;
+
+    static constexpr uint32_t InvalidSlotIndex = 0xFFFFFFFF;
+
+    CUDA_DEVICE_FUNCTION uint64_t getValidMask(uint32_t wordIdx) const {
+        uint32_t numFlagsInLastWord = numSlots % 64;
+        if (wordIdx == numWords - 1 && numFlagsInLastWord != 0)
+            return (1ull << numFlagsInLastWord) - 1;
+        return ~0ull;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: hintŒTJnʒu炷ƂŃXbhԂ̋炷BXbhCfbNXȂǂnB
+    // EN: Shifting the search start position by the hint reduces contention between threads.
+    //     Pass e.g. a thread index.
+    CUDA_DEVICE_FUNCTION uint32_t allocate(uint32_t hint) const {
+        uint32_t numSummaryWords = (numWords + 63) / 64;
+        uint32_t startSummaryIdx = hint % numSummaryWords;
+        for (uint32_t i = 0; i < numSummaryWords; ++i) {
+            uint32_t summaryIdx = (startSummaryIdx + i) % numSummaryWords;
+            uint64_t summary = *reinterpret_cast<volatile uint64_t*>(&fullSummaryWords[summaryIdx]);
+            while (~summary != 0) {
+                uint32_t bit = tzcnt64(~summary);
+                summary |= 1ull << bit;
+                uint32_t wordIdx = 64 * summaryIdx + bit;
+                if (wordIdx >= numWords)
+                    break;
+
+                uint64_t validMask = getValidMask(wordIdx);
+                uint64_t word = *reinterpret_cast<volatile uint64_t*>(&usageWords[wordIdx]);
+                uint64_t freeFlags;
+                while ((freeFlags = ~word & validMask) != 0) {
+                    uint64_t flag = 1ull << tzcnt64(freeFlags);
+                    uint64_t oldWord = atomicOr(reinterpret_cast<unsigned long long*>(&usageWords[wordIdx]),
+                                                static_cast<unsigned long long>(flag));
+                    if ((oldWord & flag) == 0) {
+                        if ((oldWord | flag) == validMask) {
+                            // JP: T}[𗧂ĂɑXbhĂꍇ͖߂B
+                            // EN: Revert the summary if another thread freed a slot after setting it.
+                            atomicOr(reinterpret_cast<unsigned long long*>(&fullSummaryWords[summaryIdx]),
+                                     1ull << bit);
+                            uint64_t curWord = *reinterpret_cast<volatile uint64_t*>(&usageWords[wordIdx]);
+                            if (curWord != validMask)
+                                atomicAnd(reinterpret_cast<unsigned long long*>(&fullSummaryWords[summaryIdx]),
+                                          ~(1ull << bit));
+                        }
+                        atomicAdd(numUsed, 1u);
+                        return 64 * wordIdx + tzcnt64(flag);
+                    }
+                    word = oldWord;
+                }
+            }
+        }
+
+        return InvalidSlotIndex;
+    }
+
+    CUDA_DEVICE_FUNCTION void free(uint32_t slotIdx) const {
+        uint32_t wordIdx = slotIdx / 64;
+        uint64_t flag = 1ull << (slotIdx % 64);
+        uint64_t oldWord = atomicAnd(reinterpret_cast<unsigned long long*>(&usageWords[wordIdx]),
+                                     ~static_cast<unsigned long long>(flag));
+        if (oldWord & flag) {
+            atomicAnd(reinterpret_cast<unsigned long long*>(&fullSummaryWords[wordIdx / 64]),
+                      ~(1ull << (wordIdx % 64)));
+            atomicSub(numUsed, 1u);
+        }
+    }
+
+    CUDA_DEVICE_FUNCTION bool getUsage(uint32_t slotIdx) const {
+        uint64_t word = *reinterpret_cast<volatile uint64_t*>(&usageWords[slotIdx / 64]);
+        return (word >> (slotIdx % 64)) & 0x1;
+    }
+#endif
+};
+
 
 
 // JP: CUDArgCɑΉ^E֐zXgŒ`ĂB
@@ -771,15 +891,42 @@ CUDA_CONSTANT_MEM static uint8_t PermutationTable[] = {
 // http://flafla2.github.io/2014/08/09/perlinnoise.html
 class PerlinNoise3D {
     int32_t m_repeat;
+    const uint8_t* m_permutationTable;
+
+    CUDA_DEVICE_FUNCTION uint8_t permute(int32_t idx) const {
+        return m_permutationTable ? m_permutationTable[idx] : PermutationTable[idx];
+    }
 
-    CUDA_DEVICE_FUNCTION static uint8_t hash(int32_t x, int32_t y, int32_t z) {
-        uint32_t sum = 0;
-        sum += PermutationTable[0 + (PermutationTable[0 + (PermutationTable[0 + x % 11] + y) % 11] + z) % 11];
-        sum += PermutationTable[11 + (PermutationTable[11 + (PermutationTable[11 + x % 13] + y) % 13] + z) % 13];
-        sum += PermutationTable[24 + (PermutationTable[24 + (PermutationTable[24 + x % 16] + y) % 16] + z) % 16];
-        sum += PermutationTable[40 + (PermutationTable[40 + (PermutationTable[40 + x % 17] + y) % 17] + z) % 17];
-        sum += PermutationTable[57 + (PermutationTable[57 + (PermutationTable[57 + x % 19] + y) % 19] + z) % 19];
-        return sum % 16;
+    // JP: iqZ8_̃nbV܂Ƃ߂ČvZBx, yɈˑi̕\𒸓_ԂŋL̂
+    //     _ƂɌvẐɔׂĕ\Ə]̉񐔂񔼕ɂȂB
+    //     _̔ԍx + 2 * y + 4 * z (e͉0A㑤1)B
+    //     ]͈ȑOhash()ƓtŎAʂȑOƓɕۂB
+    //     ̂ߕ̍Wł͈ȑOƓlɕ\̎OQƂB
+    // EN: Compute hashes of the 8 corners of a lattice cell at once.
+    //     Table lookups of the stages depending on x, y are shared between corners,
+    //     so the number of lookups and modulos is roughly halved compared to computing per corner.
+    //     Corner index is x + 2 * y + 4 * z (each component is 0 for lower and 1 for upper).
+    //     Residues are signed as in the previous hash() so that results stay identical to it.
+    //     Negative coordinates therefore index before the tables as before.
+    CUDA_DEVICE_FUNCTION void hashCorners(
+        const int32_t xs[2], const int32_t ys[2], const int32_t zs[2], uint8_t hashes[8]) const {
+        constexpr int32_t tableOffsets[] = { 0, 11, 24, 40, 57 };
+        constexpr int32_t tableSizes[] = { 11, 13, 16, 17, 19 };
+        uint32_t sums[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        for (int tIdx = 0; tIdx < 5; ++tIdx) {
+            const int32_t offset = tableOffsets[tIdx];
+            const int32_t size = tableSizes[tIdx];
+            for (int ix = 0; ix < 2; ++ix) {
+                int32_t hx = permute(offset + xs[ix] % size);
+                for (int iy = 0; iy < 2; ++iy) {
+                    int32_t hxy = permute(offset + (hx + ys[iy]) % size);
+                    for (int iz = 0; iz < 2; ++iz)
+                        sums[ix + 2 * iy + 4 * iz] += permute(offset + (hxy + zs[iz]) % size);
+                }
+            }
+        }
+        for (int i = 0; i < 8; ++i)
+            hashes[i] = sums[i] % 16;
     }
 
     CUDA_DEVICE_FUNCTION static float gradient(uint32_t hash, float xu, float yu, float zu) {
@@ -809,10 +956,24 @@ class PerlinNoise3D {
         }
     }
 
-public:
-    CUDA_DEVICE_FUNCTION PerlinNoise3D(int32_t repeat) : m_repeat(repeat) {}
+    CUDA_DEVICE_FUNCTION static float fade(float t) {
+        // Fade function as defined by Ken Perlin.
+        // This eases coordinate values so that they will "ease" towards integral values.
+        // This ends up smoothing the final output.
+        // 6t^5 - 15t^4 + 10t^3
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
 
-    CUDA_DEVICE_FUNCTION float evaluate(const float3 &p, float frequency) const {
+    CUDA_DEVICE_FUNCTION static float lerp(float v0, float v1, float t) {
+        return v0 * (1 - t) + v1 * t;
+    }
+
+    // JP: _܂ފiqZ̉E㑤̐WƃZ̈ʒu߂B
+    // EN: Compute the lower and upper integer coordinates of the lattice cell containing the point
+    //     and the position in the cell.
+    CUDA_DEVICE_FUNCTION void computeCell(
+        const float3 &p, float frequency,
+        int32_t xs[2], int32_t ys[2], int32_t zs[2], float* xu, float* yu, float* zu) const {
         float x = frequency * p.x;
         float y = frequency * p.y;
         float z = frequency * p.z;
@@ -849,58 +1010,86 @@ public:
         int32_t zi = static_cast<int32_t>(std::floor(z));
 #endif
 
-        const auto fade = [](float t) {
-            // Fade function as defined by Ken Perlin.
-            // This eases coordinate values so that they will "ease" towards integral values.
-            // This ends up smoothing the final output.
-            // 6t^5 - 15t^4 + 10t^3
-            return t * t * t * (t * (t * 6 - 15) + 10);
+        const auto inc = [repeat](int32_t num) {
+            ++num;
+            if (repeat > 0)
+                num %= repeat;
+            return num;
         };
 
+        xs[0] = xi;
+        xs[1] = inc(xi);
+        ys[0] = yi;
+        ys[1] = inc(yi);
+        zs[0] = zi;
+        zs[1] = inc(zi);
+
         // Next we calculate the location (from 0.0 to 1.0) in that cube.
+        *xu = x - xi;
+        *yu = y - yi;
+        *zu = z - zi;
+    }
+
+public:
+    // JP: permutationTablew肷PermutationTablȇɂQƂB
+    //     foCXłloadPermutationTable()ŋL[ɒûnƁA
+    //     [vŃAhXU萔[ւ̃ANZX̒񉻂B
+    // EN: When permutationTable is specified, it is referenced instead of PermutationTable.
+    //     On the device, passing the one placed in shared memory by loadPermutationTable() avoids
+    //     serialization of constant memory accesses with divergent addresses in a warp.
+    CUDA_DEVICE_FUNCTION PerlinNoise3D(int32_t repeat, const uint8_t* permutationTable = nullptr) :
+        m_repeat(repeat), m_permutationTable(permutationTable) {}
+
+    static constexpr uint32_t numPermutationTableEntries = 11 + 13 + 16 + 17 + 19;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ubÑXbhŋď\L[ɃRs[BubN̑SXbhĂԕKvB
+    // EN: Copy the permutation table to shared memory cooperatively by threads in the block.
+    //     All the threads in the block need to call this.
+    CUDA_DEVICE_FUNCTION static void loadPermutationTable(uint8_t sharedTable[numPermutationTableEntries]) {
+        for (uint32_t i = threadIdx.x; i < numPermutationTableEntries; i += blockDim.x)
+            sharedTable[i] = PermutationTable[i];
+        __syncthreads();
+    }
+#endif
+
+    CUDA_DEVICE_FUNCTION float evaluate(const float3 &p, float frequency) const {
+        int32_t xs[2], ys[2], zs[2];
+        float xu, yu, zu;
+        computeCell(p, frequency, xs, ys, zs, &xu, &yu, &zu);
+
         // We also fade the location to smooth the result.
-        float xu = x - xi;
-        float yu = y - yi;
-        float zu = z - zi;
         float u = fade(xu);
         float v = fade(yu);
         float w = fade(zu);
 
-        const auto inc = [this, repeat](int32_t num) {
-            ++num;
-            if (repeat > 0)
-                num %= repeat;
-            return num;
-        };
-
-        uint8_t lll, llu, lul, luu, ull, ulu, uul, uuu;
-        lll = hash(xi, yi, zi);
-        ull = hash(inc(xi), yi, zi);
-        lul = hash(xi, inc(yi), zi);
-        uul = hash(inc(xi), inc(yi), zi);
-        llu = hash(xi, yi, inc(zi));
-        ulu = hash(inc(xi), yi, inc(zi));
-        luu = hash(xi, inc(yi), inc(zi));
-        uuu = hash(inc(xi), inc(yi), inc(zi));
-
-        const auto lerp = [](float v0, float v1, float t) {
-            return v0 * (1 - t) + v1 * t;
-        };
+        uint8_t hashes[8];
+        hashCorners(xs, ys, zs, hashes);
 
         // The gradient function calculates the dot product between a pseudorandom gradient vector and 
         // the vector from the input coordinate to the 8 surrounding points in its unit cube.
         // This is all then lerped together as a sort of weighted average based on the faded (u,v,w) values we made earlier.
-        float _llValue = lerp(gradient(lll, xu, yu, zu), gradient(ull, xu - 1, yu, zu), u);
-        float _ulValue = lerp(gradient(lul, xu, yu - 1, zu), gradient(uul, xu - 1, yu - 1, zu), u);
+        float _llValue = lerp(gradient(hashes[0], xu, yu, zu), gradient(hashes[1], xu - 1, yu, zu), u);
+        float _ulValue = lerp(gradient(hashes[2], xu, yu - 1, zu), gradient(hashes[3], xu - 1, yu - 1, zu), u);
         float __lValue = lerp(_llValue, _ulValue, v);
 
-        float _luValue = lerp(gradient(llu, xu, yu, zu - 1), gradient(ulu, xu - 1, yu, zu - 1), u);
-        float _uuValue = lerp(gradient(luu, xu, yu - 1, zu - 1), gradient(uuu, xu - 1, yu - 1, zu - 1), u);
+        float _luValue = lerp(gradient(hashes[4], xu, yu, zu - 1), gradient(hashes[5], xu - 1, yu, zu - 1), u);
+        float _uuValue = lerp(gradient(hashes[6], xu, yu - 1, zu - 1), gradient(hashes[7], xu - 1, yu - 1, zu - 1), u);
         float __uValue = lerp(_luValue, _uuValue, v);
 
         float ret = lerp(__lValue, __uValue, w);
         return ret;
     }
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ̓_܂Ƃ߂ĕ]B_͏Ȃ܂Ƃ܂育ƂSoAɕבւČzƕԂ𕪊򖳂ŌvZA
+    //     XbhŏBaccumulate^̏ꍇvalues amplitude * mCY ZB
+    // EN: Evaluate many points at once. Points are rearranged into SoA per small group
+    //     so that gradients and interpolation are computed without branches, and processed with multiple threads.
+    //     When accumulate is true, amplitude * noise is added to values.
+    void evaluate(const float3* points, uint32_t numPoints, float frequency, float* values,
+                  float amplitude = 1.0f, bool accumulate = false) const;
+#endif
 };
 
 class MultiOctavePerlinNoise3D {
@@ -914,8 +1103,9 @@ class MultiOctavePerlinNoise3D {
 
 public:
     CUDA_DEVICE_FUNCTION MultiOctavePerlinNoise3D(uint32_t numOctaves, float initialFrequency, float supValueOrInitialAmplitude, bool supSpecified,
-                                                  float frequencyMultiplier, float persistence, uint32_t repeat) :
-        m_primaryNoiseGen(repeat),
+                                                  float frequencyMultiplier, float persistence, uint32_t repeat,
+                                                  const uint8_t* permutationTable = nullptr) :
+        m_primaryNoiseGen(repeat, permutationTable),
         m_numOctaves(numOctaves),
         m_initialFrequency(initialFrequency),
         m_frequencyMultiplier(frequencyMultiplier), m_persistence(persistence) {
@@ -953,6 +1143,21 @@ public:
 
         return total;
     }
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    void evaluate(const float3* points, uint32_t numPoints, float* values) const {
+        float frequency = m_initialFrequency;
+        float amplitude = m_initialAmplitude;
+        for (int i = 0; i < static_cast<int32_t>(m_numOctaves); ++i) {
+            m_primaryNoiseGen.evaluate(points, numPoints, frequency, values, amplitude, i > 0);
+
+            amplitude *= m_persistence;
+            frequency *= m_frequencyMultiplier;
+        }
+        if (m_numOctaves == 0)
+            std::fill_n(values, numPoints, 0.0f);
+    }
+#endif
 };
 
 
@@ -1087,7 +1292,135 @@ public:
     void debugPrint() const;
 };
 
+// JP: SlotFinderƓC^[tF[X64rbg̃[hPʂƂ́B
+//     eKw64[h1[hɏW񂷂邽ߊKwASXbgK͂ł̒TƍXVB
+//     ʊKw̏[UtOł݂͑Ȃq𖄂܂Ă̂ƂĈATSrbgrōςނ悤ɂĂB
+// EN: Variant of SlotFinder with the same interface using 64-bit words as the unit.
+//     Each level aggregates 64 words into a word, reducing the number of levels,
+//     so search and updates at millions of slots are faster.
+//     Full flags in upper levels treat nonexistent children as full so that searches need only all-bits compares.
+class SlotFinder64 {
+    struct Level {
+        std::vector<uint64_t> fullWords;
+        std::vector<uint64_t> anyWords;
+        std::vector<uint32_t> numUsedUnderWord;
+    };
+
+    uint32_t m_numSlots;
+    uint32_t m_numWords;
+    std::vector<uint64_t> m_usageWords;
+    std::vector<Level> m_levels;
+
+    uint64_t getValidMask(uint32_t wordIdx) const {
+        uint32_t numFlagsInLastWord = m_numSlots % 64;
+        if (wordIdx == m_numWords - 1 && numFlagsInLastWord != 0)
+            return (1ull << numFlagsInLastWord) - 1;
+        return ~0ull;
+    }
+    uint32_t getNumWordsInLevel(uint32_t level) const {
+        return level == 0 ? m_numWords : static_cast<uint32_t>(m_levels[level - 1].fullWords.size());
+    }
+    bool isWordFull(uint32_t level, uint32_t wordIdx) const {
+        return level == 0 ?
+            m_usageWords[wordIdx] == getValidMask(wordIdx) :
+            m_levels[level - 1].fullWords[wordIdx] == ~0ull;
+    }
+    bool isWordEmpty(uint32_t level, uint32_t wordIdx) const {
+        return level == 0 ?
+            m_usageWords[wordIdx] == 0 :
+            m_levels[level - 1].anyWords[wordIdx] == 0;
+    }
+    uint32_t getNumUsedUnderWord(uint32_t level, uint32_t wordIdx) const {
+        return level == 0 ?
+            popcnt64(m_usageWords[wordIdx]) :
+            m_levels[level - 1].numUsedUnderWord[wordIdx];
+    }
+
+    void aggregate();
+
+public:
+    static constexpr uint32_t InvalidSlotIndex = 0xFFFFFFFF;
+
+    SlotFinder64() : m_numSlots(0), m_numWords(0) {}
+
+    void initialize(uint32_t numSlots);
+    void finalize();
+
+    void resize(uint32_t numSlots);
+
+    void reset() {
+        std::fill(m_usageWords.begin(), m_usageWords.end(), 0);
+        aggregate();
+    }
+
+    void setInUse(uint32_t slotIdx);
+    void setNotInUse(uint32_t slotIdx);
+
+    bool getUsage(uint32_t slotIdx) const {
+        return (m_usageWords[slotIdx / 64] >> (slotIdx % 64)) & 0x1;
+    }
+
+    uint32_t getFirstAvailableSlot() const;
+    uint32_t getFirstUsedSlot() const;
+    uint32_t find_nthUsedSlot(uint32_t n) const;
+
+    uint32_t getNumSlots() const {
+        return m_numSlots;
+    }
+    uint32_t getNumUsed() const;
+
+    const uint64_t* getUsageWords() const {
+        return m_usageWords.data();
+    }
+    uint32_t getNumWords() const {
+        return m_numWords;
+    }
+    // JP: gptÕ[hꊇŐݒ肵AʊKwďW񂷂B
+    // EN: Set the words of usage flags at once and re-aggregate the upper levels.
+    void setUsageWords(const uint64_t* words);
+};
+
+// JP: DeviceSlotFinder̎̂foCX[ɏLBzXgSlotFinder64Ƒ݂ɃRs[łB
+// EN: Owns the storage of DeviceSlotFinder on device memory. This can be copied from/to a host-side SlotFinder64.
+class GPUSlotFinder {
+    cudau::TypedBuffer<uint64_t> m_usageWords;
+    cudau::TypedBuffer<uint64_t> m_fullSummaryWords;
+    cudau::TypedBuffer<uint32_t> m_numUsed;
+    uint32_t m_numSlots;
+
+    std::vector<uint64_t> computeFullSummary(const uint64_t* usageWords) const;
+
+public:
+    GPUSlotFinder() : m_numSlots(0) {}
+
+    void initialize(CUcontext cuContext, cudau::BufferType type, uint32_t numSlots);
+    void finalize();
+
+    void reset(CUstream stream);
+    void upload(const SlotFinder64 &finder, CUstream stream);
+    // JP: IɃ_E[hB
+    // EN: Download synchronously.
+    void download(SlotFinder64* finder, CUstream stream) const;
+
+    DeviceSlotFinder getDeviceView() const {
+        DeviceSlotFinder ret;
+        ret.usageWords = m_usageWords.getDevicePointer();
+        ret.fullSummaryWords = m_fullSummaryWords.getDevicePointer();
+        ret.numUsed = m_numUsed.getDevicePointer();
+        ret.numSlots = m_numSlots;
+        ret.numWords = m_usageWords.numElements();
+        return ret;
+    }
+    uint32_t getNumSlots() const {
+        return m_numSlots;
+    }
+};
+
+
 
+// JP: [0, numItems)𕡐XbhŕďB
+// EN: Process [0, numItems) split across multiple threads.
+void parallelFor(uint32_t numItems, const std::function<void(uint32_t, uint32_t)> &func);
 
 void saveImage(const std::filesystem::path &filepath, uint32_t width, uint32_t height, const uint32_t* data);
 
@@ -1102,22 +1435,329 @@ void saveImage(const std::filesystem::path &filepath,
                cudau::Array &array,
                bool applyToneMap, bool apply_sRGB_gammaCorrection);
 
-template <uint32_t log2BlockWidth>
-void saveImage(const std::filesystem::path &filepath,
-               optixu::HostBlockBuffer2D<float4, log2BlockWidth> &buffer,
-               bool applyToneMap, bool apply_sRGB_gammaCorrection) {
-    uint32_t width = buffer.getWidth();
-    uint32_t height = buffer.getHeight();
-    auto data = new float4[width * height];
-    buffer.map();
-    for (int y = 0; y < static_cast<int32_t>(height); ++y) {
-        for (int x = 0; x < static_cast<int32_t>(width); ++x) {
-            data[y * width + x] = buffer(x, y);
+// JP: ubNobt@[̓es߃[ɔ񓯊ɓǂݏoAŕבւƕۑsB
+//     Aԉ摜̏oŃ_OƓǂݏoI[o[bv邽߂ɎgB
+// EN: Asynchronously read the contents of a block buffer into pinned memory, then deswizzle and save later.
+//     Use this to overlap rendering with readback when writing image sequences.
+template <typename T, uint32_t log2BlockWidth, typename Layout = optixu::RowMajorBlockLayout>
+class BlockBufferReadback {
+    const optixu::HostBlockBuffer2D<T, log2BlockWidth, Layout>* m_buffer;
+    T* m_pinnedRaw;
+    uint32_t m_numRawElements;
+    CUevent m_event;
+    std::vector<T> m_linear;
+
+public:
+    BlockBufferReadback() : m_buffer(nullptr), m_pinnedRaw(nullptr), m_numRawElements(0), m_event(nullptr) {}
+    ~BlockBufferReadback() {
+        finalize();
+    }
+
+    void finalize() {
+        if (m_event)
+            CUDADRV_CHECK(cuEventDestroy(m_event));
+        m_event = nullptr;
+        if (m_pinnedRaw)
+            CUDADRV_CHECK(cuMemFreeHost(m_pinnedRaw));
+        m_pinnedRaw = nullptr;
+        m_numRawElements = 0;
+        m_buffer = nullptr;
+    }
+
+    void enqueue(const optixu::HostBlockBuffer2D<T, log2BlockWidth, Layout> &buffer, CUstream stream) {
+        uint32_t numRawElements = buffer.getNumRawElements();
+        if (numRawElements > m_numRawElements) {
+            if (m_pinnedRaw)
+                CUDADRV_CHECK(cuMemFreeHost(m_pinnedRaw));
+            CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&m_pinnedRaw), sizeof(T) * numRawElements));
+            m_numRawElements = numRawElements;
         }
+        if (!m_event)
+            CUDADRV_CHECK(cuEventCreate(&m_event, CU_EVENT_DISABLE_TIMING));
+        m_buffer = &buffer;
+        buffer.readRawAsync(m_pinnedRaw, stream);
+        CUDADRV_CHECK(cuEventRecord(m_event, stream));
+    }
+
+    // JP: ǂݏo̊҂AXbhŐ`CAEgɕבւB
+    // EN: Wait for the readback to complete, then deswizzle into linear layout with multiple threads.
+    const T* resolve() {
+        Assert(m_buffer, "Readback is not enqueued.");
+        CUDADRV_CHECK(cuEventSynchronize(m_event));
+        uint32_t width = m_buffer->getWidth();
+        uint32_t height = m_buffer->getHeight();
+        m_linear.resize(static_cast<size_t>(width) * height);
+        parallelFor(height, [this](uint32_t yBegin, uint32_t yEnd) {
+            m_buffer->deswizzleRows(m_pinnedRaw, m_linear.data(), yBegin, yEnd);
+        });
+        return m_linear.data();
+    }
+
+    uint32_t getWidth() const {
+        return m_buffer->getWidth();
     }
-    buffer.unmap();
-    saveImage(filepath, width, height, data, applyToneMap, apply_sRGB_gammaCorrection);
-    delete[] data;
+    uint32_t getHeight() const {
+        return m_buffer->getHeight();
+    }
+};
+
+template <uint32_t log2BlockWidth, typename Layout>
+void saveImage(const std::filesystem::path &filepath,
+               BlockBufferReadback<float4, log2BlockWidth, Layout> &readback,
+               bool applyToneMap, bool apply_sRGB_gammaCorrection) {
+    const float4* data = readback.resolve();
+    saveImage(filepath, readback.getWidth(), readback.getHeight(), data, applyToneMap, apply_sRGB_gammaCorrection);
 }
 
+template <uint32_t log2BlockWidth, typename Layout>
+void saveImage(const std::filesystem::path &filepath,
+               optixu::HostBlockBuffer2D<float4, log2BlockWidth, Layout> &buffer,
+               bool applyToneMap, bool apply_sRGB_gammaCorrection) {
+    BlockBufferReadback<float4, log2BlockWidth, Layout> readback;
+    readback.enqueue(buffer, 0);
+    saveImage(filepath, readback, applyToneMap, apply_sRGB_gammaCorrection);
+}
+
+// JP: XN[VbgAԉ摜`~߂ɏo߂̔񓯊Lv`[B
+//     pXg[Ńs߃[̃OɓǂݏoăCxgL^AבւAg[}bvA
+//     GR[h̓[J[XbhōsBOSĎgp̏ꍇ̂capture()҂B
+// EN: Asynchronous capture to write screenshots and image sequences without stalling rendering.
+//     Reads back into a ring of pinned memory on a dedicated stream and records an event,
+//     then deswizzling, tone mapping and encoding are done on a worker thread.
+//     capture() waits only when all the slots in the ring are in use.
+class AsyncImageWriter {
+    using DeswizzleFunction = std::function<void(const float4* srcRaw, float4* dstLinear,
+                                                 uint32_t yBegin, uint32_t yEnd)>;
+    struct Slot {
+        float4* pinned;
+        size_t capacity;
+        CUevent srcReadyEvent;
+        CUevent readbackDoneEvent;
+        std::filesystem::path filepath;
+        uint32_t width;
+        uint32_t height;
+        DeswizzleFunction deswizzle;
+        bool applyToneMap;
+        bool apply_sRGB_gammaCorrection;
+    };
+
+    CUcontext m_cuContext;
+    CUstream m_stream;
+    std::vector<Slot> m_slots;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<uint32_t> m_freeSlots;
+    std::deque<uint32_t> m_submittedSlots;
+    std::thread m_worker;
+    std::vector<float4> m_linear;
+    uint32_t m_numBusySlots;
+    bool m_closed;
+
+    AsyncImageWriter(const AsyncImageWriter &) = delete;
+    AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+    uint32_t acquireSlot(size_t numElements, CUstream stream);
+    void submit(uint32_t slotIdx, const std::filesystem::path &filepath, uint32_t width, uint32_t height,
+                const DeswizzleFunction &deswizzle, bool applyToneMap, bool apply_sRGB_gammaCorrection);
+    void workerLoop();
+
+public:
+    AsyncImageWriter() :
+        m_cuContext(nullptr), m_stream(nullptr), m_numBusySlots(0), m_closed(true) {}
+    ~AsyncImageWriter() {
+        finalize();
+    }
+
+    void initialize(CUcontext cuContext, uint32_t numSlots = 3);
+    // JP: o҂̉摜͑SĕۑĂIB
+    // EN: Save all the images waiting to be written before finishing.
+    void finalize();
+
+    // JP: streamɐς܂ꂽ`̊ɓǂݏosBĂяo߂Ɏ̕`ςŗǂB
+    // EN: Readback happens after the rendering enqueued in the stream completes.
+    //     The next rendering can be enqueued right after this returns.
+    void capture(const std::filesystem::path &filepath,
+                 uint32_t width, const cudau::TypedBuffer<float4> &buffer,
+                 bool applyToneMap, bool apply_sRGB_gammaCorrection, CUstream stream);
+    // JP: vffloat4̔z̃~bvx0ǂݏoBOpenGLAg̔z̏ꍇ̓}bvɌĂԕKvB
+    // EN: Read mip level 0 of an array with float4 elements.
+    //     For an OpenGL interop array, this needs to be called while it is mapped.
+    void capture(const std::filesystem::path &filepath,
+                 const cudau::Array &array,
+                 bool applyToneMap, bool apply_sRGB_gammaCorrection, CUstream stream);
+    template <uint32_t log2BlockWidth, typename Layout>
+    void capture(const std::filesystem::path &filepath,
+                 const optixu::HostBlockBuffer2D<float4, log2BlockWidth, Layout> &buffer,
+                 bool applyToneMap, bool apply_sRGB_gammaCorrection, CUstream stream) {
+        uint32_t slotIdx = acquireSlot(buffer.getNumRawElements(), stream);
+        buffer.readRawAsync(m_slots[slotIdx].pinned, m_stream);
+        // JP: בւ̓[J[Xbhōs邽߁Aۑ܂Ńobt@[̃TCYςĂ͂ȂȂB
+        // EN: Deswizzling is done on the worker thread, so the buffer must not be resized until saved.
+        const auto* srcBuffer = &buffer;
+        auto deswizzle = [srcBuffer](const float4* srcRaw, float4* dstLinear, uint32_t yBegin, uint32_t yEnd) {
+            srcBuffer->deswizzleRows(srcRaw, dstLinear, yBegin, yEnd);
+        };
+        submit(slotIdx, filepath, buffer.getWidth(), buffer.getHeight(), deswizzle,
+               applyToneMap, apply_sRGB_gammaCorrection);
+    }
+
+    // JP: ܂łɃLv`[摜Sĕۑ܂ő҂B
+    // EN: Wait until all the images captured so far are saved.
+    void flush();
+    uint32_t getNumPendingImages() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numBusySlots;
+    }
+};
+
+
+// JP: x`}[N[h̃R}hCݒB
+//     --benchmark: Œ̃JpXŃt[`悵AvʂJSONɏoďIB
+//     --benchmark-frames N, --benchmark-warmup N, --benchmark-output <path>
+// EN: Command line settings for the benchmark mode.
+//     --benchmark: render frames along a fixed camera path, write measurements to JSON and exit.
+//     --benchmark-frames N, --benchmark-warmup N, --benchmark-output <path>
+struct BenchmarkOptions {
+    std::filesystem::path outputPath;
+    uint32_t numFrames;
+    uint32_t numWarmupFrames;
+    bool enabled;
+
+    BenchmarkOptions() :
+        outputPath("benchmark.json"), numFrames(64), numWarmupFrames(8), enabled(false) {}
+};
+
+// JP: argv[*argIdx]x`}[N̈̏ꍇ͒l܂߂ďA*argIdẍɐi߂trueԂB
+// EN: When argv[*argIdx] is a benchmark argument, consume it including its value,
+//     advance *argIdx to the next argument and return true.
+bool parseBenchmarkArgument(int32_t argc, const char* argv[], uint32_t* argIdx, BenchmarkOptions* options);
+
+// JP: x`}[Np̌ŒJpXBcenter̎heightAaradiusňB
+// EN: Fixed camera path for benchmarks. Orbits around center once at the height and radius.
+void calcBenchmarkCameraPose(uint32_t frameIndex, uint32_t numFrames,
+                             const float3 &center, float radius, float height,
+                             float3* position, Matrix3x3* orientation);
+
+// JP: Xe[WƂGPUԁAfoCX[̃s[NgpʁAg[XCL^JSONɏoB
+//     t[O(V[ZbgAbvȂ)̌v̓t[̌vƂ͕ʂɃZbgAbv̌vƂċL^A
+//     EH[Abṽt[̌v͎̂ĂB
+//     x`}[N[hpȂ̂endFrame()ŃCxg̊҂B
+//     ĂȂꍇ͑SĂ̌v֐Ȃ̂ŁAʏ탂[hłĂяô܂܎cB
+// EN: Records the GPU time of each stage, the peak device memory usage and the number of traced rays
+//     and writes them to JSON.
+//     Measurements outside frames (e.g. during scene setup) are kept as setup measurements
+//     separately from per-frame measurements, and measurements in warm-up frames are discarded.
+//     This is only for the benchmark mode, so endFrame() waits for the events to complete.
+//     All the measurement functions do nothing when not initialized,
+//     so calls can be left as they are in the normal mode.
+class BenchmarkRecorder {
+public:
+    enum class Stage {
+        ASBuild = 0,
+        ASCompaction,
+        SBTSetup,
+        Launch,
+        Denoise,
+        Readback,
+        NumStages
+    };
+
+private:
+    struct EventPair {
+        CUevent startEvent;
+        CUevent endEvent;
+    };
+    enum class MeasurementTarget {
+        Setup = 0,
+        Frame,
+        Discard
+    };
+    struct PendingMeasurement {
+        EventPair events;
+        Stage stage;
+        MeasurementTarget target;
+    };
+
+    CUcontext m_cuContext;
+    std::string m_sampleName;
+    BenchmarkOptions m_options;
+    std::vector<EventPair> m_freeEvents;
+    std::vector<PendingMeasurement> m_pendingMeasurements;
+    uint32_t m_openMeasurements[static_cast<uint32_t>(Stage::NumStages)];
+    std::vector<float> m_setupStageTimes[static_cast<uint32_t>(Stage::NumStages)];
+    std::vector<float> m_stageTimes[static_cast<uint32_t>(Stage::NumStages)];
+    std::vector<float> m_frameTimes;
+    StopWatchHiRes<> m_frameStopWatch;
+    size_t m_initialMemoryUsage;
+    size_t m_peakMemoryUsage;
+    uint64_t m_numTracedRays;
+    uint32_t m_frameIndex;
+    uint32_t m_imageWidth;
+    uint32_t m_imageHeight;
+    bool m_inFrame;
+
+    BenchmarkRecorder(const BenchmarkRecorder &) = delete;
+    BenchmarkRecorder &operator=(const BenchmarkRecorder &) = delete;
+
+    bool isMeasuringFrame() const {
+        return m_inFrame && m_frameIndex >= m_options.numWarmupFrames;
+    }
+    MeasurementTarget getMeasurementTarget() const {
+        if (!m_inFrame)
+            return MeasurementTarget::Setup;
+        return isMeasuringFrame() ? MeasurementTarget::Frame : MeasurementTarget::Discard;
+    }
+    void addTime(MeasurementTarget target, Stage stage, float time);
+    void resolve();
+
+public:
+    BenchmarkRecorder() :
+        m_cuContext(nullptr), m_numTracedRays(0), m_frameIndex(0), m_imageWidth(0), m_imageHeight(0),
+        m_inFrame(false) {}
+    ~BenchmarkRecorder() {
+        if (m_cuContext)
+            finalize();
+    }
+
+    void initialize(CUcontext cuContext, const std::string &sampleName, const BenchmarkOptions &options);
+    void finalize();
+    bool isEnabled() const {
+        return m_cuContext != nullptr;
+    }
+
+    void setImageSize(uint32_t width, uint32_t height) {
+        m_imageWidth = width;
+        m_imageHeight = height;
+    }
+
+    // JP: Xe[W̋Ԃqɂ͂łȂBقȂXe[Wm͓qɂłB
+    // EN: Intervals of the same stage cannot be nested. Different stages can be nested.
+    void start(Stage stage, CUstream stream);
+    void stop(Stage stage, CUstream stream);
+    // JP: zXgŌv(~b)ǉB
+    // EN: Add a time (in milliseconds) measured on the host.
+    void record(Stage stage, float time);
+
+    void beginFrame();
+    // JP: numTracedRays͂̃t[Ńg[XC̐(: f x (1 + VhEC))B
+    // EN: numTracedRays is the number of rays traced in this frame
+    //     (e.g. the number of pixels x (1 + the number of shadow rays)).
+    void endFrame(uint64_t numTracedRays);
+    // JP: St[`悵B
+    // EN: Whether all the frames have been rendered.
+    bool isFinished() const {
+        return m_frameIndex >= m_options.numWarmupFrames + m_options.numFrames;
+    }
+    uint32_t getFrameIndex() const {
+        return m_frameIndex;
+    }
+    uint32_t getNumTotalFrames() const {
+        return m_options.numWarmupFrames + m_options.numFrames;
+    }
+
+    void sampleMemoryUsage();
+
+    bool write();
+};
+
 #endif
@@ -0,0 +1,191 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: GPU上のバッファー内容のハッシュを計算して、前回から変化したバッファーだけを検出するユーティリティー。
+//     毎フレーム頂点バッファーなどを書き直すアプリケーションでも、内容が実際に変わったものだけについて
+//     GASのリビルドやホストからのアップロードを行えるようにする。
+//     ハッシュはダブルワードごとの値とインデックスを混ぜたものの和(64ビット)なので、
+//     スレッドの実行順に依らず決まる。衝突の確率は無視できるほど小さいが0ではない。
+//     ホスト上の小さなデータ(ユーザーデータや変換行列)の同値判定はoptixuのセッター側で行われ、
+//     optixu::Context::getRedundantUpdateStatistics()で回避された数を取得できる。
+//
+//     content_hash::ChangeDetector detector;
+//     detector.initialize(cuContext, contentHashModule, maxNumEntries);
+//     uint32_t vbEntry = detector.addEntry(vertexBuffer);
+//     // 毎フレーム
+//     std::vector<uint32_t> changedEntries;
+//     detector.detectChanges(stream, &changedEntries);
+//     for (uint32_t entry : changedEntries)
+//         ...; // 該当するGASをmarkDirty()してリビルドする。
+//     hpprintf("Skipped: %llu\n", detector.getNumSkippedUpdates());
+//
+// EN: Utility computing hashes of buffer contents on the GPU to detect only buffers changed since the last time.
+//     Even an application rewriting vertex buffers or the like every frame can rebuild GASes or upload from the host
+//     only for the ones whose contents actually changed.
+//     A hash is the (64-bit) sum of values mixing each dword with its index,
+//     so it is determined regardless of the execution order of threads.
+//     The probability of a collision is negligibly small but not zero.
+//     Equality checks of small data on the host (user data and transform matrices) are done in optixu's setters,
+//     and the number of avoided updates can be obtained by optixu::Context::getRedundantUpdateStatistics().
+//
+//     content_hash::ChangeDetector detector;
+//     detector.initialize(cuContext, contentHashModule, maxNumEntries);
+//     uint32_t vbEntry = detector.addEntry(vertexBuffer);
+//     // every frame
+//     std::vector<uint32_t> changedEntries;
+//     detector.detectChanges(stream, &changedEntries);
+//     for (uint32_t entry : changedEntries)
+//         ...; // markDirty() and rebuild the corresponding GAS.
+//     hpprintf("Skipped: %llu\n", detector.getNumSkippedUpdates());
+namespace content_hash {
+    // JP: SplitMix64の最終化関数。
+    // EN: Finalizer of SplitMix64.
+    CUDA_DEVICE_FUNCTION uint64_t mix64(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    CUDA_DEVICE_FUNCTION uint64_t hashDword(uint32_t value, uint32_t index) {
+        return mix64((static_cast<uint64_t>(index) << 32) | value);
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: hashは事前にゼロクリアしておく。
+    // EN: Clear hash to zero beforehand.
+    CUDA_DEVICE_FUNCTION void computeHash(const uint32_t* data, uint32_t numDwords, uint64_t* hash) {
+        uint64_t localSum = 0;
+        for (uint32_t idx = blockDim.x * blockIdx.x + threadIdx.x; idx < numDwords;
+             idx += blockDim.x * gridDim.x)
+            localSum += hashDword(data[idx], idx);
+
+        // JP: ワープ内で和をとってからアトミック演算の数を減らす。
+        // EN: Sum within a warp first to reduce the number of atomic operations.
+        for (uint32_t offset = 16; offset > 0; offset >>= 1)
+            localSum += __shfl_down_sync(0xFFFFFFFF, localSum, offset);
+        if ((threadIdx.x & 31) == 0 && localSum != 0)
+            atomicAdd(reinterpret_cast<unsigned long long*>(hash), static_cast<unsigned long long>(localSum));
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ホスト上で同じハッシュを計算する。デバッグ用。
+    // EN: Compute the same hash on the host. For debugging.
+    inline uint64_t computeHashOnHost(const uint32_t* data, uint32_t numDwords) {
+        uint64_t sum = 0;
+        for (uint32_t idx = 0; idx < numDwords; ++idx)
+            sum += hashDword(data[idx], idx);
+        return sum;
+    }
+
+    class ChangeDetector {
+        struct Entry {
+            CUdeviceptr data;
+            uint32_t numDwords;
+            uint64_t hash;
+            struct {
+                unsigned int hasHash : 1;
+            };
+        };
+
+        cudau::Kernel m_computeHash;
+        cudau::TypedBuffer<uint64_t> m_hashes;
+        std::vector<Entry> m_entries;
+        std::vector<uint64_t> m_hashesOnHost;
+        uint64_t m_numSkippedUpdates;
+
+    public:
+        ChangeDetector() : m_numSkippedUpdates(0) {}
+
+        void initialize(CUcontext cuContext, CUmodule contentHashModule, uint32_t maxNumEntries) {
+            m_computeHash.set(contentHashModule, "computeHash", cudau::AutoBlockDim(), 0);
+            m_hashes.initialize(cuContext, cudau::BufferType::Device, std::max(maxNumEntries, 1u));
+            m_hashesOnHost.resize(m_hashes.numElements());
+            m_entries.clear();
+            m_numSkippedUpdates = 0;
+        }
+        void finalize() {
+            m_hashesOnHost.clear();
+            m_entries.clear();
+            m_hashes.finalize();
+        }
+
+        // JP: 監視するメモリ領域を追加してエントリーのIDを返す。サイズは4バイトの倍数である必要がある。
+        //     最初のdetectChanges()では常に変化したものとして報告される。
+        // EN: Add a memory region to watch and return the ID of the entry. The size must be a multiple of 4 bytes.
+        //     It is always reported as changed at the first detectChanges().
+        uint32_t addEntry(CUdeviceptr data, size_t sizeInBytes) {
+            if (m_entries.size() >= m_hashesOnHost.size())
+                throw std::runtime_error("Number of entries exceeds the maximum.");
+            if (sizeInBytes % sizeof(uint32_t) != 0)
+                throw std::runtime_error("Size must be a multiple of 4 bytes.");
+            Entry entry = {};
+            entry.data = data;
+            entry.numDwords = static_cast<uint32_t>(sizeInBytes / sizeof(uint32_t));
+            entry.hasHash = false;
+            m_entries.push_back(entry);
+            return static_cast<uint32_t>(m_entries.size() - 1);
+        }
+        uint32_t addEntry(const cudau::Buffer &buffer) {
+            return addEntry(buffer.getCUdeviceptr(), buffer.sizeInBytes());
+        }
+
+        // JP: バッファーをリサイズした場合などに呼ぶ。次のdetectChanges()で変化したものとして報告される。
+        // EN: Call this e.g. when resizing a buffer. It is reported as changed at the next detectChanges().
+        void updateEntry(uint32_t entryIdx, CUdeviceptr data, size_t sizeInBytes) {
+            if (sizeInBytes % sizeof(uint32_t) != 0)
+                throw std::runtime_error("Size must be a multiple of 4 bytes.");
+            Entry &entry = m_entries.at(entryIdx);
+            entry.data = data;
+            entry.numDwords = static_cast<uint32_t>(sizeInBytes / sizeof(uint32_t));
+            entry.hasHash = false;
+        }
+
+        // JP: 全エントリーのハッシュを計算して前回と異なるエントリーのIDを返す。ストリームを同期する。
+        // EN: Compute hashes of all entries and return IDs of entries different from the last time.
+        //     This synchronizes the stream.
+        void detectChanges(CUstream stream, std::vector<uint32_t>* changedEntries) {
+            changedEntries->clear();
+            const uint32_t numEntries = static_cast<uint32_t>(m_entries.size());
+            if (numEntries == 0)
+                return;
+
+            CUDADRV_CHECK(cuMemsetD32Async(m_hashes.getCUdeviceptr(), 0, 2 * numEntries, stream));
+            for (uint32_t entryIdx = 0; entryIdx < numEntries; ++entryIdx) {
+                const Entry &entry = m_entries[entryIdx];
+                if (entry.numDwords == 0)
+                    continue;
+                m_computeHash.launchPersistent(
+                    stream, entry.data, entry.numDwords, m_hashes.getCUdeviceptrAt(entryIdx));
+            }
+            m_hashes.read(m_hashesOnHost.data(), numEntries, stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+            for (uint32_t entryIdx = 0; entryIdx < numEntries; ++entryIdx) {
+                Entry &entry = m_entries[entryIdx];
+                uint64_t hash = m_hashesOnHost[entryIdx];
+                if (entry.hasHash && entry.hash == hash) {
+                    ++m_numSkippedUpdates;
+                    continue;
+                }
+                entry.hash = hash;
+                entry.hasHash = true;
+                changedEntries->push_back(entryIdx);
+            }
+        }
+
+        // JP: 内容が変わっていなかったために省略できた更新の累計数。
+        // EN: Accumulated number of updates omitted because the contents did not change.
+        uint64_t getNumSkippedUpdates() const {
+            return m_numSkippedUpdates;
+        }
+        void resetStatistics() {
+            m_numSkippedUpdates = 0;
+        }
+    };
+#endif
+}
@@ -0,0 +1,11 @@
+﻿#pragma once
+
+#include "content_hash.h"
+
+// JP: content_hash::ChangeDetectorが使うカーネル。変化検出を使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernel used by content_hash::ChangeDetector. A sample using change detection compiles this file
+//     to PTX as well.
+
+CUDA_DEVICE_KERNEL void computeHash(const uint32_t* data, uint32_t numDwords, uint64_t* hash) {
+    content_hash::computeHash(data, numDwords, hash);
+}
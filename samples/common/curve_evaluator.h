@@ -304,5 +304,189 @@ namespace curve {
             float3 tangent = m_interpolator.dPosition(u);
             return tangent; // non-normalized;
         }
+
+        CUDA_DEVICE_FUNCTION float3 calcPosition(float u) const {
+            return m_interpolator.position(u);
+        }
+        CUDA_DEVICE_FUNCTION float calcRadius(float u) const {
+            return m_interpolator.radius(u);
+        }
+
+        // Upper bound of |curve''(u)| over [0, 1].
+        // curve'' is constant for quadratic and linear in u for cubic, so it is maximal at an end.
+        CUDA_DEVICE_FUNCTION float calcMaxCurvatureBound() const {
+            if constexpr (curveType == OPTIX_PRIMITIVE_TYPE_ROUND_LINEAR)
+                return 0.0f;
+            else
+                return fmaxf(length(m_interpolator.ddPosition(0.0f)), length(m_interpolator.ddPosition(1.0f)));
+        }
+    };
+
+
+
+    // Strided views to the buffers set to a curve GeometryInstance.
+    // Widths are radii, same as the width buffer of OptiX.
+    struct CurveBufferView {
+        const uint8_t* positions;
+        const uint8_t* widths;
+        const uint32_t* segmentIndices;
+        uint32_t positionStride;
+        uint32_t widthStride;
+        uint32_t numSegments;
+    };
+
+    struct CurveSample {
+        float3 position;
+        float radius;
+        float3 tangent; // non-normalized
     };
+
+    // Same layout as the vertex of triangle meshes in the samples.
+    struct RibbonVertex {
+        float3 position;
+        float3 normal;
+        float2 texCoord;
+    };
+
+    struct RibbonTriangle {
+        uint32_t index0, index1, index2;
+    };
+
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION void loadControlPoints(
+        const CurveBufferView &curves, uint32_t segIdx, float4 controlPoints[getNumControlPoints<curveType>()]) {
+        uint32_t baseIndex = curves.segmentIndices[segIdx];
+        for (uint32_t i = 0; i < getNumControlPoints<curveType>(); ++i) {
+            uint32_t vIdx = baseIndex + i;
+            float3 p = *reinterpret_cast<const float3*>(curves.positions + curves.positionStride * vIdx);
+            float r = *reinterpret_cast<const float*>(curves.widths + curves.widthStride * vIdx);
+            controlPoints[i] = make_float4(p, r);
+        }
+    }
+
+    // Conservative bounds of a segment.
+    // A B-spline segment lies in the convex hull of its control points and the radius never exceeds
+    // the maximum radius of the control points.
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION AABB calcSegmentBounds(const float4 controlPoints[getNumControlPoints<curveType>()]) {
+        AABB aabb;
+        float maxRadius = 0.0f;
+        for (uint32_t i = 0; i < getNumControlPoints<curveType>(); ++i) {
+            aabb.unify(make_float3(controlPoints[i]));
+            maxRadius = fmaxf(maxRadius, controlPoints[i].w);
+        }
+        aabb.minP -= make_float3(maxRadius);
+        aabb.maxP += make_float3(maxRadius);
+        return aabb;
+    }
+
+    // Number of intervals to split a segment into so that the chord deviation of each interval is
+    // within the tolerance. Chord deviation of an interval of length h is bounded by |curve''|max * h^2 / 8.
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION uint32_t calcNumTessellationIntervals(
+        const float4 controlPoints[getNumControlPoints<curveType>()], float tolerance, uint32_t maxNumIntervals) {
+        Evaluator<curveType> evaluator(controlPoints);
+        float bound = evaluator.calcMaxCurvatureBound();
+        uint32_t numIntervals = static_cast<uint32_t>(ceilf(sqrtf(bound / (8 * tolerance))));
+        return numIntervals < 1 ? 1 : (numIntervals > maxNumIntervals ? maxNumIntervals : numIntervals);
+    }
+
+    // Emit a camera-facing ribbon of a segment.
+    // (numIntervals + 1) * 2 vertices starting at baseVertexIndex and numIntervals * 2 triangles starting at
+    // baseTriangleIndex are written. texCoord.x goes from texU0 to texU1 along the segment.
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION void emitRibbon(
+        const float4 controlPoints[getNumControlPoints<curveType>()], uint32_t numIntervals,
+        const float3 &viewPosition, float texU0, float texU1,
+        uint32_t baseVertexIndex, uint32_t baseTriangleIndex, RibbonVertex* vertices, RibbonTriangle* triangles) {
+        Evaluator<curveType> evaluator(controlPoints);
+        for (uint32_t i = 0; i <= numIntervals; ++i) {
+            float u = static_cast<float>(i) / numIntervals;
+            float3 p = evaluator.calcPosition(u);
+            float r = evaluator.calcRadius(u);
+            float3 t = evaluator.calcTangent(u);
+            float3 toView = viewPosition - p;
+            float3 side = cross(t, toView);
+            float sideLength = length(side);
+            side = sideLength > 0.0f ? side / sideLength : make_float3(0.0f, 0.0f, 0.0f);
+            float3 n = normalize(cross(side, t));
+            float texU = texU0 + (texU1 - texU0) * u;
+            vertices[baseVertexIndex + 2 * i + 0] = RibbonVertex{ p - r * side, n, make_float2(texU, 0.0f) };
+            vertices[baseVertexIndex + 2 * i + 1] = RibbonVertex{ p + r * side, n, make_float2(texU, 1.0f) };
+        }
+        for (uint32_t i = 0; i < numIntervals; ++i) {
+            uint32_t vIdx = baseVertexIndex + 2 * i;
+            triangles[baseTriangleIndex + 2 * i + 0] = RibbonTriangle{ vIdx + 0, vIdx + 2, vIdx + 1 };
+            triangles[baseTriangleIndex + 2 * i + 1] = RibbonTriangle{ vIdx + 1, vIdx + 2, vIdx + 3 };
+        }
+    }
+
+
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // Batched evaluation over the whole buffers of a curve GeometryInstance, written with grid-stride loops
+    // so that a user kernel can simply forward its arguments and launch with any grid size.
+    // samples receives numSamplesPerSegment uniformly spaced samples per segment (including both ends),
+    // segmentBounds receives the bounds per segment. Either can be nullptr.
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION void evaluateSegments(
+        const CurveBufferView &curves, uint32_t numSamplesPerSegment,
+        CurveSample* samples, AABB* segmentBounds) {
+        constexpr uint32_t numCPs = getNumControlPoints<curveType>();
+        if (segmentBounds) {
+            cudau::forEachGridStride(curves.numSegments, [&](uint32_t segIdx) {
+                float4 cps[numCPs];
+                loadControlPoints<curveType>(curves, segIdx, cps);
+                segmentBounds[segIdx] = calcSegmentBounds<curveType>(cps);
+            });
+        }
+        if (samples && numSamplesPerSegment > 0) {
+            const float uStep = numSamplesPerSegment > 1 ? 1.0f / (numSamplesPerSegment - 1) : 0.0f;
+            // One thread per sample keeps the work per thread uniform; threads of a segment are adjacent,
+            // so control point loads are coalesced and mostly hit the cache.
+            cudau::forEachGridStride(curves.numSegments * numSamplesPerSegment, [&](uint32_t sampleIdx) {
+                uint32_t segIdx = sampleIdx / numSamplesPerSegment;
+                float u = (sampleIdx % numSamplesPerSegment) * uStep;
+                float4 cps[numCPs];
+                loadControlPoints<curveType>(curves, segIdx, cps);
+                Evaluator<curveType> evaluator(cps);
+                CurveSample &sample = samples[sampleIdx];
+                sample.position = evaluator.calcPosition(u);
+                sample.radius = evaluator.calcRadius(u);
+                sample.tangent = evaluator.calcTangent(u);
+            });
+        }
+    }
+
+    // Adaptive tessellation into ribbons in two passes:
+    // 1. countRibbonIntervals(): Compute the number of intervals per segment.
+    // 2. Convert the counts into the exclusive prefix sum (e.g. optixu::scanBucketCounts() or on the host).
+    //    The total number of vertices is 2 * (totalIntervals + numSegments), triangles is 2 * totalIntervals.
+    // 3. emitRibbons(): Write vertices and triangles of every segment.
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION void countRibbonIntervals(
+        const CurveBufferView &curves, float tolerance, uint32_t maxNumIntervals, uint32_t* numIntervals) {
+        constexpr uint32_t numCPs = getNumControlPoints<curveType>();
+        cudau::forEachGridStride(curves.numSegments, [&](uint32_t segIdx) {
+            float4 cps[numCPs];
+            loadControlPoints<curveType>(curves, segIdx, cps);
+            numIntervals[segIdx] = calcNumTessellationIntervals<curveType>(cps, tolerance, maxNumIntervals);
+        });
+    }
+
+    template <OptixPrimitiveType curveType>
+    CUDA_DEVICE_FUNCTION void emitRibbons(
+        const CurveBufferView &curves, const uint32_t* intervalOffsets, float tolerance, uint32_t maxNumIntervals,
+        const float3 &viewPosition, RibbonVertex* vertices, RibbonTriangle* triangles) {
+        constexpr uint32_t numCPs = getNumControlPoints<curveType>();
+        cudau::forEachGridStride(curves.numSegments, [&](uint32_t segIdx) {
+            float4 cps[numCPs];
+            loadControlPoints<curveType>(curves, segIdx, cps);
+            uint32_t numIntervals = calcNumTessellationIntervals<curveType>(cps, tolerance, maxNumIntervals);
+            uint32_t intervalOffset = intervalOffsets[segIdx];
+            emitRibbon<curveType>(cps, numIntervals, viewPosition, 0.0f, 1.0f,
+                                  2 * (intervalOffset + segIdx), 2 * intervalOffset, vertices, triangles);
+        });
+    }
+#endif
 }
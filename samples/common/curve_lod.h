@@ -0,0 +1,164 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 遠くのキャラクターの髪のような曲線プリミティブのためのストランド間引きによるLOD。
+//     各LODレベルでストランドのランダムな部分集合を残し、残ったストランドの幅を広げて
+//     画面上の被覆率(投影面積の合計)を保つ。レベルごとに別々のGASをビルドし、
+//     カリング・LODの選択(optixu::selectLevelOfDetail())でインスタンスごとにGASを切り替える。
+//     部分集合は入れ子になっている(粗いレベルで残るストランドは細かいレベルでも残る)ので、
+//     レベルの切り替えでストランドが飛び飛びに入れ替わることはない。
+//
+//     const float keepRatios[] = { 1.0f, 0.25f, 0.0625f };
+//     std::vector<curve_lod::StrandLevel<Shared::CurveVertex>> levels;
+//     curve_lod::buildStrandLevels(vertices.data(), strandOffsets.data(), numStrands, curveDegree,
+//                                  keepRatios, lengthof(keepRatios), 0, &levels);
+//     for (uint32_t level = 0; level < levels.size(); ++level) {
+//         // levels[level].vertices, segmentIndicesからGeometryInstanceとGASを作る。
+//     }
+//     float lodDistances[lengthof(keepRatios)];
+//     curve_lod::calcLevelDistances(keepRatios, lengthof(keepRatios), baseWidth, fovY, imageHeight, 1.0f,
+//                                   lodDistances);
+//
+//     // カリング・LODのカーネル
+//     uint32_t level = optixu::selectLevelOfDetail(distance, lodDistances, numLevels);
+//     instance.traversableHandle = gasHandlesPerLevel[level];
+//
+// EN: LOD by strand decimation for curve primitives like hair of distant characters.
+//     Each LOD level keeps a random subset of strands and widens the remaining strands
+//     to preserve the coverage (total of projected areas) on the screen.
+//     Build a separate GAS per level, and switch GASs per instance by culling / LOD selection
+//     (optixu::selectLevelOfDetail()).
+//     Subsets are nested (strands remaining in a coarser level also remain in finer levels),
+//     so switching levels doesn't swap strands sporadically.
+//
+//     const float keepRatios[] = { 1.0f, 0.25f, 0.0625f };
+//     std::vector<curve_lod::StrandLevel<Shared::CurveVertex>> levels;
+//     curve_lod::buildStrandLevels(vertices.data(), strandOffsets.data(), numStrands, curveDegree,
+//                                  keepRatios, lengthof(keepRatios), 0, &levels);
+//     for (uint32_t level = 0; level < levels.size(); ++level) {
+//         // Create a GeometryInstance and a GAS from levels[level].vertices, segmentIndices.
+//     }
+//     float lodDistances[lengthof(keepRatios)];
+//     curve_lod::calcLevelDistances(keepRatios, lengthof(keepRatios), baseWidth, fovY, imageHeight, 1.0f,
+//                                   lodDistances);
+//
+//     // Culling / LOD kernel
+//     uint32_t level = optixu::selectLevelOfDetail(distance, lodDistances, numLevels);
+//     instance.traversableHandle = gasHandlesPerLevel[level];
+namespace curve_lod {
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 一つのLODレベルのストランド集合。
+    //     segmentIndicesはcurve_primitiveサンプルと同じく各ストランドのセグメントの先頭頂点のインデックス。
+    // EN: Strand set of a LOD level.
+    //     segmentIndices are the indices of the first vertex of each segment of strands
+    //     same as the curve_primitive sample.
+    template <typename VertexType>
+    struct StrandLevel {
+        std::vector<VertexType> vertices;
+        std::vector<uint32_t> segmentIndices;
+        uint32_t numStrands;
+        float widthScale;
+    };
+
+    namespace detail {
+        inline uint32_t hashStrand(uint32_t strandIdx, uint32_t seed) {
+            uint32_t h = strandIdx * 0x9E3779B9u ^ (seed + 0x7F4A7C15u);
+            h ^= h >> 16;
+            h *= 0x85EBCA6Bu;
+            h ^= h >> 13;
+            h *= 0xC2B2AE35u;
+            h ^= h >> 16;
+            return h;
+        }
+    }
+
+    // JP: 頂点の型はposition(float3)とwidth(float)のメンバーを持つ。
+    //     i番目のストランドの頂点はvertices[strandOffsets[i]]からvertices[strandOffsets[i + 1] - 1]まで。
+    //     curveDegreeは線形で1、2次B-スプラインで2、3次B-スプラインで3。
+    //     keepRatiosは(0, 1]の降順で、各レベルのストランドの残す割合を表す。
+    //     幅は(全ストランド数 / 残したストランド数)倍して投影面積の合計を保つ。
+    // EN: The vertex type has members position (float3) and width (float).
+    //     Vertices of the i-th strand are from vertices[strandOffsets[i]] to vertices[strandOffsets[i + 1] - 1].
+    //     curveDegree is 1 for linear, 2 for quadratic B-spline and 3 for cubic B-spline.
+    //     keepRatios are in descending order in (0, 1] and represent the ratio of strands to keep for each level.
+    //     Widths are multiplied by (total number of strands / number of kept strands)
+    //     to preserve the total of projected areas.
+    template <typename VertexType>
+    void buildStrandLevels(
+        const VertexType* vertices, const uint32_t* strandOffsets, uint32_t numStrands, uint32_t curveDegree,
+        const float* keepRatios, uint32_t numLevels, uint32_t seed,
+        std::vector<StrandLevel<VertexType>>* levels) {
+        if (curveDegree < 1 || curveDegree > 3)
+            throw std::runtime_error("Curve degree must be 1, 2 or 3.");
+        for (uint32_t level = 0; level < numLevels; ++level) {
+            if (!(keepRatios[level] > 0.0f && keepRatios[level] <= 1.0f))
+                throw std::runtime_error("Keep ratios must be in (0, 1].");
+            if (level > 0 && keepRatios[level] > keepRatios[level - 1])
+                throw std::runtime_error("Keep ratios must be in descending order.");
+        }
+
+        // JP: ストランドをハッシュ値の順に並べ、各レベルでは先頭から必要な数だけ残す。
+        //     これによって部分集合が入れ子になる。
+        // EN: Order strands by their hash values, and keep the required number from the beginning for each level.
+        //     This makes subsets nested.
+        std::vector<std::pair<uint32_t, uint32_t>> order(numStrands);
+        for (uint32_t strandIdx = 0; strandIdx < numStrands; ++strandIdx)
+            order[strandIdx] = std::make_pair(detail::hashStrand(strandIdx, seed), strandIdx);
+        std::sort(order.begin(), order.end());
+
+        levels->resize(numLevels);
+        std::vector<uint32_t> keptStrands;
+        for (uint32_t level = 0; level < numLevels; ++level) {
+            StrandLevel<VertexType> &dstLevel = (*levels)[level];
+            const uint32_t numKeptStrands = numStrands > 0 ?
+                std::max(static_cast<uint32_t>(std::round(numStrands * keepRatios[level])), 1u) : 0u;
+
+            // JP: 元の順番で出力して頂点のメモリー上の局所性を保つ。
+            // EN: Output in the original order to keep the memory locality of vertices.
+            keptStrands.resize(numKeptStrands);
+            for (uint32_t i = 0; i < numKeptStrands; ++i)
+                keptStrands[i] = order[i].second;
+            std::sort(keptStrands.begin(), keptStrands.end());
+
+            dstLevel.numStrands = numKeptStrands;
+            dstLevel.widthScale = numKeptStrands > 0 ? static_cast<float>(numStrands) / numKeptStrands : 1.0f;
+            dstLevel.vertices.clear();
+            dstLevel.segmentIndices.clear();
+            for (uint32_t strandIdx : keptStrands) {
+                const uint32_t vtxBegin = strandOffsets[strandIdx];
+                const uint32_t vtxEnd = strandOffsets[strandIdx + 1];
+                if (vtxEnd - vtxBegin <= curveDegree)
+                    continue;
+                const uint32_t dstVtxBegin = static_cast<uint32_t>(dstLevel.vertices.size());
+                for (uint32_t vIdx = vtxBegin; vIdx < vtxEnd; ++vIdx) {
+                    VertexType v = vertices[vIdx];
+                    v.width *= dstLevel.widthScale;
+                    dstLevel.vertices.push_back(v);
+                }
+                for (uint32_t s = 0; s < vtxEnd - vtxBegin - curveDegree; ++s)
+                    dstLevel.segmentIndices.push_back(dstVtxBegin + s);
+            }
+        }
+    }
+
+    // JP: optixu::selectLevelOfDetail()に渡すレベルごとの距離のしきい値を求める。
+    //     次のレベルで広げた幅が画面上でmaxPixelWidthピクセル以下になる距離までを各レベルの範囲とする。
+    //     最後のレベルはカリングしないようにFLT_MAXとする。
+    // EN: Compute distance thresholds per level to pass to optixu::selectLevelOfDetail().
+    //     The range of each level extends to the distance at which the widened width of the next level
+    //     becomes maxPixelWidth pixels or less on the screen.
+    //     The last level is FLT_MAX to avoid culling.
+    inline void calcLevelDistances(
+        const float* keepRatios, uint32_t numLevels, float baseWidth, float fovY, uint32_t imageHeight,
+        float maxPixelWidth, float* lodDistances) {
+        const float pixelAngle = 2 * std::tan(fovY / 2) / imageHeight;
+        for (uint32_t level = 0; level + 1 < numLevels; ++level) {
+            const float nextWidth = baseWidth / keepRatios[level + 1];
+            lodDistances[level] = nextWidth / (maxPixelWidth * pixelAngle);
+        }
+        if (numLevels > 0)
+            lodDistances[numLevels - 1] = FLT_MAX;
+    }
+#endif
+}
@@ -33,11 +33,17 @@
 #   undef near
 #   undef far
 #   undef RGB
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
 #endif
 
 #include "dds_loader.h"
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 
 #ifdef _DEBUG
@@ -227,6 +233,23 @@ namespace dds {
     };
     static_assert(sizeof(HeaderDX10) == 20, "sizeof(HeaderDX10) must be 20.");
 
+    static bool isBlockCompressedFormat(Format format) {
+        return format == Format::BC1_UNorm || format == Format::BC1_UNorm_sRGB ||
+            format == Format::BC2_UNorm || format == Format::BC2_UNorm_sRGB ||
+            format == Format::BC3_UNorm || format == Format::BC3_UNorm_sRGB ||
+            format == Format::BC4_UNorm || format == Format::BC4_SNorm ||
+            format == Format::BC5_UNorm || format == Format::BC5_SNorm ||
+            format == Format::BC6H_UF16 || format == Format::BC6H_SF16 ||
+            format == Format::BC7_UNorm || format == Format::BC7_UNorm_sRGB;
+    }
+
+    static uint32_t getBlockSize(Format format) {
+        if (format == Format::BC1_UNorm || format == Format::BC1_UNorm_sRGB ||
+            format == Format::BC4_UNorm || format == Format::BC4_SNorm)
+            return 8;
+        return 16;
+    }
+
 
 
     uint8_t** load(const char* filepath, int32_t* width, int32_t* height, int32_t* mipCount, size_t** sizes, Format* format) {
@@ -256,13 +279,7 @@ namespace dds {
         *height = header.m_height;
         *format = (Format)dx10Header.m_format;
 
-        if (*format != Format::BC1_UNorm && *format != Format::BC1_UNorm_sRGB &&
-            *format != Format::BC2_UNorm && *format != Format::BC2_UNorm_sRGB &&
-            *format != Format::BC3_UNorm && *format != Format::BC3_UNorm_sRGB &&
-            *format != Format::BC4_UNorm && *format != Format::BC4_SNorm &&
-            *format != Format::BC5_UNorm && *format != Format::BC5_SNorm &&
-            *format != Format::BC6H_UF16 && *format != Format::BC6H_SF16 &&
-            *format != Format::BC7_UNorm && *format != Format::BC7_UNorm_sRGB) {
+        if (!isBlockCompressedFormat(*format)) {
             hpprintf("No support for non block compressed formats: %s", filepath);
             return nullptr;
         }
@@ -280,10 +297,7 @@ namespace dds {
         *sizes = new size_t[*mipCount];
         int32_t mipWidth = *width;
         int32_t mipHeight = *height;
-        uint32_t blockSize = 16;
-        if (*format == Format::BC1_UNorm || *format == Format::BC1_UNorm_sRGB ||
-            *format == Format::BC4_UNorm || *format == Format::BC4_SNorm)
-            blockSize = 8;
+        uint32_t blockSize = getBlockSize(*format);
         size_t cumDataSize = 0;
         for (int i = 0; i < *mipCount; ++i) {
             int32_t bw = (mipWidth + 3) / 4;
@@ -308,4 +322,129 @@ namespace dds {
         delete[] data;
         delete singleData;
     }
+
+
+
+    bool MappedImage::open(const char* filepath) {
+        close();
+
+#if defined(Platform_Windows_MSVC)
+        HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            hpprintf("Not found: %s\n", filepath);
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!view) {
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            hpprintf("Failed to map: %s\n", filepath);
+            return false;
+        }
+        m_fileHandle = file;
+        m_mappingHandle = mapping;
+        m_fileData = reinterpret_cast<const uint8_t*>(view);
+        m_fileSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filepath, O_RDONLY);
+        if (fd < 0) {
+            hpprintf("Not found: %s\n", filepath);
+            return false;
+        }
+        struct stat st;
+        fstat(fd, &st);
+        void* view = st.st_size > 0 ?
+            mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (view == MAP_FAILED) {
+            ::close(fd);
+            hpprintf("Failed to map: %s\n", filepath);
+            return false;
+        }
+        m_fileHandle = reinterpret_cast<void*>(static_cast<intptr_t>(fd));
+        m_fileData = reinterpret_cast<const uint8_t*>(view);
+        m_fileSize = static_cast<size_t>(st.st_size);
+#endif
+
+        constexpr size_t headerSize = sizeof(Header) + sizeof(HeaderDX10);
+        if (m_fileSize < headerSize) {
+            hpprintf("Non dds (dx10) file: %s", filepath);
+            close();
+            return false;
+        }
+
+        Header header;
+        std::memcpy(&header, m_fileData, sizeof(Header));
+        if (header.m_magic != 0x20534444 || header.m_fourCC != 0x30315844) {
+            hpprintf("Non dds (dx10) file: %s", filepath);
+            close();
+            return false;
+        }
+
+        HeaderDX10 dx10Header;
+        std::memcpy(&dx10Header, m_fileData + sizeof(Header), sizeof(HeaderDX10));
+
+        m_width = header.m_width;
+        m_height = header.m_height;
+        m_format = dx10Header.m_format;
+        if (!isBlockCompressedFormat(m_format)) {
+            hpprintf("No support for non block compressed formats: %s", filepath);
+            close();
+            return false;
+        }
+
+        m_mipCount = 1;
+        if ((header.m_flags & Header::Flags::MipMapCount) != 0)
+            m_mipCount = header.m_mipmapCount;
+
+        m_mipOffsets.resize(m_mipCount);
+        m_mipSizes.resize(m_mipCount);
+        int32_t mipWidth = m_width;
+        int32_t mipHeight = m_height;
+        const uint32_t blockSize = getBlockSize(m_format);
+        size_t offset = headerSize;
+        for (int i = 0; i < m_mipCount; ++i) {
+            int32_t bw = (mipWidth + 3) / 4;
+            int32_t bh = (mipHeight + 3) / 4;
+            size_t mipDataSize = bw * bh * blockSize;
+
+            m_mipOffsets[i] = offset;
+            m_mipSizes[i] = mipDataSize;
+            offset += mipDataSize;
+
+            mipWidth = std::max<int32_t>(1, mipWidth / 2);
+            mipHeight = std::max<int32_t>(1, mipHeight / 2);
+        }
+        if (offset > m_fileSize) {
+            hpprintf("Data size mismatch: %s", filepath);
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void MappedImage::close() {
+        if (!m_fileData)
+            return;
+
+#if defined(Platform_Windows_MSVC)
+        UnmapViewOfFile(m_fileData);
+        CloseHandle(reinterpret_cast<HANDLE>(m_mappingHandle));
+        CloseHandle(reinterpret_cast<HANDLE>(m_fileHandle));
+#else
+        munmap(const_cast<uint8_t*>(m_fileData), m_fileSize);
+        ::close(static_cast<int>(reinterpret_cast<intptr_t>(m_fileHandle)));
+#endif
+        m_fileData = nullptr;
+        m_fileSize = 0;
+        m_fileHandle = nullptr;
+        m_mappingHandle = nullptr;
+        m_mipOffsets.clear();
+        m_mipSizes.clear();
+    }
 }
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 // For DDS image read (block compressed format)
 namespace dds {
@@ -42,4 +43,55 @@ namespace dds {
     [[nodiscard]]
     uint8_t** load(const char* filepath, int32_t* width, int32_t* height, int32_t* mipCount, size_t** sizes, Format* format);
     void free(uint8_t** data, int32_t mipCount, size_t* sizes);
+
+    // JP: DDSファイルをメモリーマップで開き、各ミップレベルのデータをコピー無しで参照する。
+    // EN: Open a DDS file with memory mapping to refer each mip level's data without copies.
+    class MappedImage {
+        const uint8_t* m_fileData;
+        size_t m_fileSize;
+        void* m_fileHandle;
+        void* m_mappingHandle;
+        int32_t m_width;
+        int32_t m_height;
+        int32_t m_mipCount;
+        Format m_format;
+        std::vector<size_t> m_mipOffsets;
+        std::vector<size_t> m_mipSizes;
+
+        MappedImage(const MappedImage &) = delete;
+        MappedImage &operator=(const MappedImage &) = delete;
+
+    public:
+        MappedImage() :
+            m_fileData(nullptr), m_fileSize(0), m_fileHandle(nullptr), m_mappingHandle(nullptr),
+            m_width(0), m_height(0), m_mipCount(0), m_format(Format::BC1_UNorm) {}
+        ~MappedImage() {
+            close();
+        }
+
+        bool open(const char* filepath);
+        void close();
+
+        bool isOpen() const {
+            return m_fileData != nullptr;
+        }
+        int32_t getWidth() const {
+            return m_width;
+        }
+        int32_t getHeight() const {
+            return m_height;
+        }
+        int32_t getMipCount() const {
+            return m_mipCount;
+        }
+        Format getFormat() const {
+            return m_format;
+        }
+        const uint8_t* getMipData(int32_t mipLevel) const {
+            return m_fileData + m_mipOffsets[mipLevel];
+        }
+        size_t getMipSize(int32_t mipLevel) const {
+            return m_mipSizes[mipLevel];
+        }
+    };
 }
@@ -0,0 +1,204 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 変形する三角形メッシュ用の再利用可能なデバイス関数群。
+//     1. deformVertices(): 任意の変形関数で頂点位置を変形し、同じパスでAABBをワープ単位で縮約する。
+//     2. recomputeVertexNormals(): 初回に一度だけ構築した頂点→三角形のCSR隣接情報から法線を集めて正規化する。
+//        アトミック操作が無いので結果は決定的で、正規化も同じパスで済む。
+//        面積による重み付けと、正規化した面法線を固定小数点で足す(アトミック加算による実装と同じ結果の)重み付けを選べる。
+//     ユーザーカーネルはこれらに引数を渡すだけで良く、その後GAS::update()かGAS::updateOrRebuild()を呼ぶ。
+//     縮約したAABBはカリングやLODの選択などに使える。
+// EN: Reusable device functions for deforming triangle meshes.
+//     1. deformVertices(): Deform vertex positions with an arbitrary deformation function
+//        and reduce the AABB per warp in the same pass.
+//     2. recomputeVertexNormals(): Gather normals from vertex-to-triangle CSR adjacency built once at the beginning
+//        and normalize them. Results are deterministic since there are no atomics,
+//        and normalization is done in the same pass.
+//        Either area weighting or summing normalized face normals in fixed point
+//        (same results as an implementation with atomic additions) can be chosen.
+//     User kernels only need to forward their arguments to these, then call GAS::update() or
+//     GAS::updateOrRebuild(). The reduced AABB can be used e.g. for culling or LOD selection.
+namespace dynamic_mesh {
+    // JP: offsets[vIdx]からoffsets[vIdx + 1]の範囲のtriangleIndicesが頂点vIdxを共有する三角形。
+    // EN: triangleIndices in the range from offsets[vIdx] to offsets[vIdx + 1] are triangles sharing vertex vIdx.
+    struct VertexAdjacency {
+        const uint32_t* offsets;
+        const uint32_t* triangleIndices;
+    };
+
+    // JP: 浮動小数点数の大小関係を保つ整数表現。整数のatomicMin/Maxで縮約するために使う。
+    // EN: Integer representation preserving the order of floating-point numbers.
+    //     Used to reduce with integer atomicMin/Max.
+    CUDA_DEVICE_FUNCTION uint32_t floatToOrderedUint(float v) {
+        uint32_t bits;
+#if defined(__CUDA_ARCH__)
+        bits = __float_as_uint(v);
+#else
+        std::memcpy(&bits, &v, sizeof(bits));
+#endif
+        return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+    }
+
+    CUDA_DEVICE_FUNCTION float orderedUintToFloat(uint32_t v) {
+        uint32_t bits = (v & 0x80000000) ? (v & 0x7FFFFFFF) : ~v;
+        float ret;
+#if defined(__CUDA_ARCH__)
+        ret = __uint_as_float(bits);
+#else
+        std::memcpy(&ret, &bits, sizeof(ret));
+#endif
+        return ret;
+    }
+
+    struct OrderedAABB {
+        uint32_t minP[3];
+        uint32_t maxP[3];
+
+        // JP: 縮約前に書き込んでおく空のAABB。
+        // EN: Empty AABB to write before the reduction.
+        CUDA_DEVICE_FUNCTION static OrderedAABB empty() {
+            OrderedAABB ret;
+            for (int i = 0; i < 3; ++i) {
+                ret.minP[i] = 0xFFFFFFFF;
+                ret.maxP[i] = 0;
+            }
+            return ret;
+        }
+
+        CUDA_DEVICE_FUNCTION AABB toAABB() const {
+            AABB ret;
+            ret.minP = make_float3(orderedUintToFloat(minP[0]), orderedUintToFloat(minP[1]), orderedUintToFloat(minP[2]));
+            ret.maxP = make_float3(orderedUintToFloat(maxP[0]), orderedUintToFloat(maxP[1]), orderedUintToFloat(maxP[2]));
+            return ret;
+        }
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: deformは(頂点インデックス, 元の頂点)から変形後の位置を返す関数。位置以外の属性は元の頂点からコピーされる。
+    //     aabbがnullptrでなければ変形後の位置のAABBを縮約する(事前にOrderedAABB::empty()で初期化しておく)。
+    //     ワープ内の全スレッドが呼ぶ必要がある(グリッドストライドループなのでブロックサイズが32の倍数であれば良い)。
+    // EN: deform is a function returning the deformed position from (vertex index, original vertex).
+    //     Attributes other than the position are copied from the original vertex.
+    //     When aabb is not nullptr, the AABB of the deformed positions is reduced
+    //     (initialize it with OrderedAABB::empty() beforehand).
+    //     All the threads in a warp need to call this
+    //     (it is a grid-stride loop, so it is enough that the block size is a multiple of 32).
+    template <typename VertexType, typename DeformFunc>
+    CUDA_DEVICE_FUNCTION void deformVertices(
+        const VertexType* originalVertices, VertexType* vertices, uint32_t numVertices,
+        DeformFunc &&deform, OrderedAABB* aabb) {
+        float3 minP = make_float3(INFINITY);
+        float3 maxP = make_float3(-INFINITY);
+        cudau::forEachGridStride(numVertices, [&](uint32_t vIdx) {
+            VertexType v = originalVertices[vIdx];
+            v.position = deform(vIdx, v);
+            vertices[vIdx] = v;
+            minP = min(minP, v.position);
+            maxP = max(maxP, v.position);
+        });
+
+        if (!aabb)
+            return;
+
+        for (uint32_t offset = 16; offset > 0; offset >>= 1) {
+            minP.x = fminf(minP.x, __shfl_xor_sync(0xFFFFFFFF, minP.x, offset));
+            minP.y = fminf(minP.y, __shfl_xor_sync(0xFFFFFFFF, minP.y, offset));
+            minP.z = fminf(minP.z, __shfl_xor_sync(0xFFFFFFFF, minP.z, offset));
+            maxP.x = fmaxf(maxP.x, __shfl_xor_sync(0xFFFFFFFF, maxP.x, offset));
+            maxP.y = fmaxf(maxP.y, __shfl_xor_sync(0xFFFFFFFF, maxP.y, offset));
+            maxP.z = fmaxf(maxP.z, __shfl_xor_sync(0xFFFFFFFF, maxP.z, offset));
+        }
+        if ((threadIdx.x % 32) == 0 && minP.x <= maxP.x) {
+            atomicMin(&aabb->minP[0], floatToOrderedUint(minP.x));
+            atomicMin(&aabb->minP[1], floatToOrderedUint(minP.y));
+            atomicMin(&aabb->minP[2], floatToOrderedUint(minP.z));
+            atomicMax(&aabb->maxP[0], floatToOrderedUint(maxP.x));
+            atomicMax(&aabb->maxP[1], floatToOrderedUint(maxP.y));
+            atomicMax(&aabb->maxP[2], floatToOrderedUint(maxP.z));
+        }
+    }
+
+    enum class NormalWeighting {
+        // JP: 面積で重み付けした面法線の和。
+        // EN: Sum of area-weighted face normals.
+        Area = 0,
+        // JP: 正規化した面法線の固定小数点(2^24倍)での和。アトミック加算で集める実装と同じ結果になる。
+        // EN: Sum of normalized face normals in fixed point (scaled by 2^24).
+        //     This gives the same results as an implementation gathering with atomic additions.
+        Uniform,
+    };
+
+    // JP: 重み付けした面法線を隣接三角形から集めて正規化する。
+    // EN: Gather weighted face normals from adjacent triangles and normalize.
+    template <typename VertexType, typename TriangleType>
+    CUDA_DEVICE_FUNCTION void recomputeVertexNormals(
+        VertexType* vertices, uint32_t numVertices,
+        const TriangleType* triangles, const VertexAdjacency &adjacency,
+        NormalWeighting weighting = NormalWeighting::Area) {
+        constexpr int32_t coeffFloatToFixed = 1 << 24;
+        constexpr float coeffFixedToFloat = 1.0f / (1 << 24);
+        cudau::forEachGridStride(numVertices, [&](uint32_t vIdx) {
+            float3 n = make_float3(0.0f, 0.0f, 0.0f);
+            int3 nFixed = make_int3(0, 0, 0);
+            uint32_t begin = adjacency.offsets[vIdx];
+            uint32_t end = adjacency.offsets[vIdx + 1];
+            for (uint32_t i = begin; i < end; ++i) {
+                const TriangleType &tri = triangles[adjacency.triangleIndices[i]];
+                float3 p0 = vertices[tri.index0].position;
+                float3 p1 = vertices[tri.index1].position;
+                float3 p2 = vertices[tri.index2].position;
+                float3 fn = cross(p1 - p0, p2 - p0);
+                if (weighting == NormalWeighting::Area) {
+                    n += fn;
+                }
+                else {
+                    // JP: 整数の和は順序に依存しないので結果は決定的。
+                    // EN: Integer sum doesn't depend on the order, so results are deterministic.
+                    fn = normalize(fn);
+                    nFixed.x += static_cast<int32_t>(fn.x * coeffFloatToFixed);
+                    nFixed.y += static_cast<int32_t>(fn.y * coeffFloatToFixed);
+                    nFixed.z += static_cast<int32_t>(fn.z * coeffFloatToFixed);
+                }
+            }
+            if (weighting == NormalWeighting::Uniform) {
+                n = make_float3(nFixed.x * coeffFixedToFloat,
+                                nFixed.y * coeffFixedToFloat,
+                                nFixed.z * coeffFixedToFloat);
+                vertices[vIdx].normal = normalize(n);
+                return;
+            }
+            float len = length(n);
+            vertices[vIdx].normal = len > 0.0f ? n / len : make_float3(0.0f, 0.0f, 1.0f);
+        });
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 頂点→三角形のCSR隣接情報を構築する。トポロジーが変わらない限り一度だけで良い。
+    // EN: Build vertex-to-triangle CSR adjacency. This is needed only once as long as the topology doesn't change.
+    template <typename TriangleType>
+    void buildVertexAdjacency(
+        const TriangleType* triangles, uint32_t numTriangles, uint32_t numVertices,
+        std::vector<uint32_t>* offsets, std::vector<uint32_t>* triangleIndices) {
+        offsets->assign(numVertices + 1, 0);
+        for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+            const TriangleType &tri = triangles[triIdx];
+            ++(*offsets)[tri.index0 + 1];
+            ++(*offsets)[tri.index1 + 1];
+            ++(*offsets)[tri.index2 + 1];
+        }
+        for (uint32_t vIdx = 0; vIdx < numVertices; ++vIdx)
+            (*offsets)[vIdx + 1] += (*offsets)[vIdx];
+
+        triangleIndices->resize(offsets->back());
+        std::vector<uint32_t> cursors(offsets->begin(), offsets->end() - 1);
+        for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+            const TriangleType &tri = triangles[triIdx];
+            (*triangleIndices)[cursors[tri.index0]++] = triIdx;
+            (*triangleIndices)[cursors[tri.index1]++] = triIdx;
+            (*triangleIndices)[cursors[tri.index2]++] = triIdx;
+        }
+    }
+#endif
+}
@@ -0,0 +1,220 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 例外プログラムでスレッドごとにprintfする代わりに例外を集計するコレクター。
+//     例外コードごとの発生数をアトミックに数え、最初のK個の例外についてはローンチインデックスと詳細を記録する。
+//     ローンチ後にホスト側でまとめを解決するので、OPTIX_EXCEPTION_FLAG_TRACE_DEPTHなどのチェックを
+//     有効にしたままでもprintfの嵐にならない。
+//
+//     exception_collector::ExceptionCollectorBuffer exceptions;
+//     exceptions.initialize(cuContext, cudau::BufferType::Device, 16);
+//     plp.exceptions = exceptions.getCollector();
+//     exceptions.reset(stream);
+//     pipeline.launch(...);
+//     exception_collector::Summary summary;
+//     exceptions.resolve(stream, &summary);
+//     summary.print();
+//
+//     // 例外プログラム
+//     CUDA_DEVICE_KERNEL void RT_EX_NAME(collect)() {
+//         exception_collector::collectException<2>(plp.exceptions);
+//     }
+//
+// EN: Collector aggregating exceptions instead of printf per thread in exception programs.
+//     Atomically count occurrences per exception code and record launch indices and details
+//     for the first K exceptions. The summary is resolved on the host after a launch, so checks like
+//     OPTIX_EXCEPTION_FLAG_TRACE_DEPTH can be kept enabled without printf storms.
+//
+//     exception_collector::ExceptionCollectorBuffer exceptions;
+//     exceptions.initialize(cuContext, cudau::BufferType::Device, 16);
+//     plp.exceptions = exceptions.getCollector();
+//     exceptions.reset(stream);
+//     pipeline.launch(...);
+//     exception_collector::Summary summary;
+//     exceptions.resolve(stream, &summary);
+//     summary.print();
+//
+//     // Exception program
+//     CUDA_DEVICE_KERNEL void RT_EX_NAME(collect)() {
+//         exception_collector::collectException<2>(plp.exceptions);
+//     }
+namespace exception_collector {
+    // JP: 組み込み例外(負のコード)とユーザー例外の小さなコードはそれぞれのスロットで数え、
+    //     それ以外のユーザー例外は最後のスロットにまとめる。
+    // EN: Built-in exceptions (negative codes) and small codes of user exceptions are counted in dedicated slots,
+    //     and the other user exceptions are gathered into the last slot.
+    static constexpr uint32_t numBuiltinCodeSlots = 32;
+    static constexpr uint32_t numUserCodeSlots = 32;
+    static constexpr uint32_t numCodeSlots = numBuiltinCodeSlots + numUserCodeSlots + 1;
+    static constexpr uint32_t maxNumDetailDwords = 8;
+
+    struct ExceptionRecord {
+        uint3 launchIndex;
+        int32_t code;
+        uint32_t details[maxNumDetailDwords];
+    };
+
+    struct ExceptionCollector {
+        uint32_t* codeCounts;
+        uint32_t* numExceptions;
+        ExceptionRecord* records;
+        uint32_t maxNumRecords;
+    };
+
+    CUDA_DEVICE_FUNCTION uint32_t calcCodeSlot(int32_t code) {
+        if (code < 0)
+            return -code <= static_cast<int32_t>(numBuiltinCodeSlots) ?
+                static_cast<uint32_t>(-code - 1) : numCodeSlots - 1;
+        return code < static_cast<int32_t>(numUserCodeSlots) ?
+            numBuiltinCodeSlots + static_cast<uint32_t>(code) : numCodeSlots - 1;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 例外プログラムから呼ぶ。numDetailDwordsにはoptixu::throwException()で渡したユーザー例外の詳細の
+    //     ダブルワード数を指定する。組み込み例外に対しては詳細は記録されない。
+    //     例外の発生したスレッドは終了するので、記録されるローンチインデックスは互いに異なる。
+    // EN: Call this from an exception program. Specify the number of dwords of user exception details
+    //     passed with optixu::throwException() to numDetailDwords. Details are not recorded for built-in exceptions.
+    //     A thread terminates on an exception, so recorded launch indices are distinct from each other.
+    template <uint32_t numDetailDwords = 0>
+    CUDA_DEVICE_FUNCTION void collectException(const ExceptionCollector &collector) {
+        static_assert(numDetailDwords <= maxNumDetailDwords, "Maximum number of exception details is 8 dwords.");
+        int32_t code = optixGetExceptionCode();
+        atomicAdd(&collector.codeCounts[calcCodeSlot(code)], 1u);
+        uint32_t recordIdx = atomicAdd(collector.numExceptions, 1u);
+        if (recordIdx >= collector.maxNumRecords)
+            return;
+
+        ExceptionRecord record = {};
+        record.launchIndex = optixGetLaunchIndex();
+        record.code = code;
+        if (code >= 0) {
+            if constexpr (numDetailDwords > 0) record.details[0] = optixGetExceptionDetail_0();
+            if constexpr (numDetailDwords > 1) record.details[1] = optixGetExceptionDetail_1();
+            if constexpr (numDetailDwords > 2) record.details[2] = optixGetExceptionDetail_2();
+            if constexpr (numDetailDwords > 3) record.details[3] = optixGetExceptionDetail_3();
+            if constexpr (numDetailDwords > 4) record.details[4] = optixGetExceptionDetail_4();
+            if constexpr (numDetailDwords > 5) record.details[5] = optixGetExceptionDetail_5();
+            if constexpr (numDetailDwords > 6) record.details[6] = optixGetExceptionDetail_6();
+            if constexpr (numDetailDwords > 7) record.details[7] = optixGetExceptionDetail_7();
+        }
+        collector.records[recordIdx] = record;
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    inline const char* getBuiltinExceptionName(int32_t code) {
+        switch (code) {
+        case OPTIX_EXCEPTION_CODE_STACK_OVERFLOW:
+            return "Stack overflow";
+        case OPTIX_EXCEPTION_CODE_TRACE_DEPTH_EXCEEDED:
+            return "Trace depth exceeded";
+        case OPTIX_EXCEPTION_CODE_TRAVERSAL_DEPTH_EXCEEDED:
+            return "Traversal depth exceeded";
+        case OPTIX_EXCEPTION_CODE_TRAVERSAL_INVALID_TRAVERSABLE:
+            return "Invalid traversable";
+        case OPTIX_EXCEPTION_CODE_TRAVERSAL_INVALID_MISS_SBT:
+            return "Invalid miss SBT index";
+        case OPTIX_EXCEPTION_CODE_TRAVERSAL_INVALID_HIT_SBT:
+            return "Invalid hit SBT index";
+        default:
+            return code < 0 ? "Built-in exception" : "User exception";
+        }
+    }
+
+    struct Summary {
+        // JP: 発生したコードとその数。専用のスロットを持たないコードの例外はotherExceptionCountにまとめられる。
+        // EN: Occurred codes and their counts.
+        //     Exceptions with codes not having dedicated slots are gathered into otherExceptionCount.
+        std::vector<std::pair<int32_t, uint32_t>> codeCounts;
+        uint32_t otherExceptionCount;
+        uint32_t totalCount;
+        std::vector<ExceptionRecord> records;
+
+        void print() const {
+            if (totalCount == 0)
+                return;
+            hpprintf("%u exceptions occurred.\n", totalCount);
+            for (const std::pair<int32_t, uint32_t> &codeCount : codeCounts)
+                hpprintf("  %s (%d): %u\n",
+                         getBuiltinExceptionName(codeCount.first), codeCount.first, codeCount.second);
+            if (otherExceptionCount > 0)
+                hpprintf("  Other exceptions: %u\n", otherExceptionCount);
+            for (const ExceptionRecord &record : records) {
+                hpprintf("  (%u, %u, %u): %s (%d)",
+                         record.launchIndex.x, record.launchIndex.y, record.launchIndex.z,
+                         getBuiltinExceptionName(record.code), record.code);
+                if (record.code >= 0) {
+                    for (uint32_t i = 0; i < maxNumDetailDwords; ++i)
+                        hpprintf(" %08x", record.details[i]);
+                }
+                hpprintf("\n");
+            }
+        }
+    };
+
+    class ExceptionCollectorBuffer {
+        cudau::TypedBuffer<uint32_t> m_codeCounts;
+        cudau::TypedBuffer<uint32_t> m_numExceptions;
+        cudau::TypedBuffer<ExceptionRecord> m_records;
+
+    public:
+        void initialize(CUcontext cuContext, cudau::BufferType type, uint32_t maxNumRecords) {
+            m_codeCounts.initialize(cuContext, type, numCodeSlots);
+            m_numExceptions.initialize(cuContext, type, 1);
+            m_records.initialize(cuContext, type, std::max(maxNumRecords, 1u));
+        }
+        void finalize() {
+            m_records.finalize();
+            m_numExceptions.finalize();
+            m_codeCounts.finalize();
+        }
+
+        // JP: 集計を始めるローンチの前に呼ぶ。呼ばなければ複数のローンチにわたって集計される。
+        // EN: Call this before a launch to begin the aggregation. Otherwise aggregation spans multiple launches.
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_codeCounts.getCUdeviceptr(), 0, numCodeSlots, stream));
+            CUDADRV_CHECK(cuMemsetD32Async(m_numExceptions.getCUdeviceptr(), 0, 1, stream));
+        }
+
+        ExceptionCollector getCollector() const {
+            ExceptionCollector ret;
+            ret.codeCounts = m_codeCounts.getDevicePointer();
+            ret.numExceptions = m_numExceptions.getDevicePointer();
+            ret.records = m_records.getDevicePointer();
+            ret.maxNumRecords = m_records.numElements();
+            return ret;
+        }
+
+        // JP: ストリームを同期してまとめを読み戻す。
+        // EN: Synchronize the stream and read back the summary.
+        void resolve(CUstream stream, Summary* summary) const {
+            uint32_t codeCounts[numCodeSlots];
+            uint32_t numExceptions;
+            m_codeCounts.read(codeCounts, numCodeSlots, stream);
+            m_numExceptions.read(&numExceptions, 1, stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+            summary->codeCounts.clear();
+            for (uint32_t slot = 0; slot < numBuiltinCodeSlots; ++slot) {
+                if (codeCounts[slot] > 0)
+                    summary->codeCounts.emplace_back(-static_cast<int32_t>(slot) - 1, codeCounts[slot]);
+            }
+            for (uint32_t slot = 0; slot < numUserCodeSlots; ++slot) {
+                if (codeCounts[numBuiltinCodeSlots + slot] > 0)
+                    summary->codeCounts.emplace_back(static_cast<int32_t>(slot),
+                                                     codeCounts[numBuiltinCodeSlots + slot]);
+            }
+            summary->otherExceptionCount = codeCounts[numCodeSlots - 1];
+            summary->totalCount = numExceptions;
+
+            summary->records.resize(std::min(numExceptions, m_records.numElements()));
+            if (!summary->records.empty()) {
+                m_records.read(summary->records, stream);
+                CUDADRV_CHECK(cuStreamSynchronize(stream));
+            }
+        }
+    };
+#endif
+}
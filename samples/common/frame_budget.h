@@ -0,0 +1,413 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 目標のフレーム時間を保つように描画設定を調整するガバナー。
+//     cudau::GpuProfilerのスコープごとの計測時間から、描画(解像度 x サンプル数に比例)、
+//     デノイズ(解像度に比例し、呼び出し間隔で償却)、それ以外(固定)のコストを推定し、
+//     PreviewUpscalerに渡す縮小率、1ローンチあたりのサンプル数、デノイザーの呼び出し間隔を変更する。
+//     予算を超えたときは予測時間が目標に収まる最も小さな削減を、収まるものが無ければ最も大きな削減を選ぶので、
+//     コストの大きいパスから優先的に削られる。予算に余裕があるときは増加分の小さい設定から戻す。
+//     劣化と回復のしきい値を分け、変更の後は古い設定で発行済みのフレームを読み飛ばして
+//     さらに一定フレームの間変更しないことで振動を防ぐ。
+//
+//     frame_budget::Governor governor;
+//     frame_budget::GovernorConfig config;
+//     config.targetFrameTime = 1000.0f / 60;
+//     config.renderScopeName = "Render";
+//     config.denoiseScopeName = "Denoise";
+//     governor.initialize(config);
+//     // 毎フレーム
+//     profiler.poll();
+//     if (governor.update(profiler)) {
+//         const frame_budget::Settings &settings = governor.getSettings();
+//         upscaler.resize(stream, width, height, settings.resolutionDivisor);
+//     }
+//     profiler.beginFrame(stream);
+//     {
+//         cudau::GpuProfileScope scope(&profiler, "Render", stream);
+//         plp.numSamplesPerLaunch = governor.getSettings().samplesPerLaunch;
+//         pipeline.launch(...);
+//     }
+//     if (governor.shouldDenoise(frameIndex)) {
+//         cudau::GpuProfileScope scope(&profiler, "Denoise", stream);
+//         denoiser.invoke(...);
+//     }
+//     profiler.endFrame(stream);
+//
+// EN: Governor adjusting render settings to hold a target frame time.
+//     Estimate the costs of rendering (proportional to resolution x sample count),
+//     denoising (proportional to resolution and amortized by the invocation interval), and the rest (fixed)
+//     from per-scope timings of cudau::GpuProfiler, then change the scale divisor passed to PreviewUpscaler,
+//     the number of samples per launch and the invocation interval of the denoiser.
+//     When over budget, the smallest reduction whose predicted time fits in the target is chosen,
+//     or the largest one if none fits, so the most costly pass is cut first.
+//     When there is headroom, settings are restored from the one with the smallest cost increase.
+//     Separate thresholds for degradation and recovery, skipping frames submitted with the old settings,
+//     and holding the settings for a number of frames after each change prevent oscillation.
+//
+//     frame_budget::Governor governor;
+//     frame_budget::GovernorConfig config;
+//     config.targetFrameTime = 1000.0f / 60;
+//     config.renderScopeName = "Render";
+//     config.denoiseScopeName = "Denoise";
+//     governor.initialize(config);
+//     // every frame
+//     profiler.poll();
+//     if (governor.update(profiler)) {
+//         const frame_budget::Settings &settings = governor.getSettings();
+//         upscaler.resize(stream, width, height, settings.resolutionDivisor);
+//     }
+//     profiler.beginFrame(stream);
+//     {
+//         cudau::GpuProfileScope scope(&profiler, "Render", stream);
+//         plp.numSamplesPerLaunch = governor.getSettings().samplesPerLaunch;
+//         pipeline.launch(...);
+//     }
+//     if (governor.shouldDenoise(frameIndex)) {
+//         cudau::GpuProfileScope scope(&profiler, "Denoise", stream);
+//         denoiser.invoke(...);
+//     }
+//     profiler.endFrame(stream);
+namespace frame_budget {
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    struct Settings {
+        // JP: PreviewUpscaler::resize()のscaleDivisor。1でフル解像度。
+        // EN: scaleDivisor for PreviewUpscaler::resize(). 1 means the full resolution.
+        uint32_t resolutionDivisor;
+        uint32_t samplesPerLaunch;
+        // JP: Nフレームに1回デノイザーを呼ぶ。
+        // EN: Invoke the denoiser once every N frames.
+        uint32_t denoiseInterval;
+
+        bool operator==(const Settings &r) const {
+            return resolutionDivisor == r.resolutionDivisor &&
+                samplesPerLaunch == r.samplesPerLaunch &&
+                denoiseInterval == r.denoiseInterval;
+        }
+        bool operator!=(const Settings &r) const {
+            return !(*this == r);
+        }
+    };
+
+    struct GovernorConfig {
+        // JP: 目標のフレーム時間(ミリ秒)。
+        // EN: Target frame time in milliseconds.
+        float targetFrameTime = 1000.0f / 60;
+        // JP: 平滑化した時間が目標 x (1 + degradeMargin)を超えたら劣化させ、
+        //     回復後の予測時間が目標 x (1 - upgradeMargin)以下なら回復させる。
+        // EN: Degrade when the smoothed time exceeds the target x (1 + degradeMargin),
+        //     and upgrade when the predicted time after the upgrade is at most the target x (1 - upgradeMargin).
+        float degradeMargin = 0.05f;
+        float upgradeMargin = 0.15f;
+        // JP: 計測時間の指数移動平均の重み。
+        // EN: Weight of the exponential moving average of measured times.
+        float smoothingFactor = 0.2f;
+        // JP: 変更後に新しい設定で計測したフレームがこの数だけ揃うまで次の変更をしない。
+        // EN: Do not make the next change until this number of frames measured with the new settings is collected.
+        uint32_t numHoldFrames = 8;
+        // JP: GpuProfiler::initialize()に渡したnumFramesInFlight。変更時に発行済みのフレームを読み飛ばすのに使う。
+        // EN: numFramesInFlight passed to GpuProfiler::initialize().
+        //     Used to skip frames already submitted at a change.
+        uint32_t numFramesInFlight = 4;
+
+        // JP: 描画とデノイズを計測するスコープの名前。同名のスコープは深さに関わらず合計する。
+        //     空の場合、そのパスのコストは固定の部分に含まれる。
+        // EN: Names of scopes measuring rendering and denoising.
+        //     Scopes with the same name are summed regardless of depth.
+        //     When empty, the cost of the pass is included in the fixed part.
+        std::string renderScopeName;
+        std::string denoiseScopeName;
+
+        Settings initialSettings = { 1, 1, 1 };
+        uint32_t maxResolutionDivisor = 4;
+        uint32_t minSamplesPerLaunch = 1;
+        uint32_t maxSamplesPerLaunch = 1;
+        uint32_t maxDenoiseInterval = 4;
+    };
+
+    class Governor {
+        // JP: 平滑化したコストのモデル。
+        //     frame = fixed + render x spp x pixelRatio + denoise x pixelRatio / interval
+        //     pixelRatioはフル解像度に対するピクセル数の比(1 / divisor^2)。
+        // EN: Model of smoothed costs.
+        //     frame = fixed + render x spp x pixelRatio + denoise x pixelRatio / interval
+        //     pixelRatio is the ratio of the number of pixels to the full resolution (1 / divisor^2).
+        struct CostModel {
+            float fixedTime;
+            float renderTimePerSample;
+            float denoiseTimePerInvocation;
+        };
+
+        GovernorConfig m_config;
+        Settings m_settings;
+        CostModel m_model;
+        float m_smoothedFrameTime;
+        uint64_t m_lastFrameIndex;
+        uint32_t m_numFramesToSkip;
+        uint32_t m_numFramesSinceChange;
+        uint32_t m_numChanges;
+        struct {
+            unsigned int m_hasFrame : 1;
+            unsigned int m_hasModel : 1;
+            unsigned int m_hasDenoiseSample : 1;
+        };
+
+        static float calcPixelRatio(uint32_t divisor) {
+            return 1.0f / (divisor * divisor);
+        }
+
+        static float sumScopeDurations(const cudau::GpuProfiler::FrameStats &stats, const std::string &name,
+                                       bool* found) {
+            *found = false;
+            float sum = 0.0f;
+            if (name.empty())
+                return sum;
+            for (const cudau::GpuProfiler::ScopeStats &scope : stats.scopes) {
+                if (scope.name != name)
+                    continue;
+                sum += scope.duration;
+                *found = true;
+            }
+            return sum;
+        }
+
+        float predictFrameTime(const Settings &settings) const {
+            float pixelRatio = calcPixelRatio(settings.resolutionDivisor);
+            return m_model.fixedTime +
+                m_model.renderTimePerSample * settings.samplesPerLaunch * pixelRatio +
+                m_model.denoiseTimePerInvocation * pixelRatio / settings.denoiseInterval;
+        }
+
+        void accumulate(const cudau::GpuProfiler::FrameStats &stats) {
+            bool renderFound;
+            bool denoiseFound;
+            float renderTime = sumScopeDurations(stats, m_config.renderScopeName, &renderFound);
+            float denoiseTime = sumScopeDurations(stats, m_config.denoiseScopeName, &denoiseFound);
+            float pixelRatio = calcPixelRatio(m_settings.resolutionDivisor);
+
+            CostModel sample;
+            sample.fixedTime = std::max(stats.frameDuration - renderTime - denoiseTime, 0.0f);
+            sample.renderTimePerSample = renderTime / (m_settings.samplesPerLaunch * pixelRatio);
+            sample.denoiseTimePerInvocation = denoiseTime / pixelRatio;
+
+            float alpha = m_config.smoothingFactor;
+            if (!m_hasModel) {
+                m_model = sample;
+                m_smoothedFrameTime = stats.frameDuration;
+                m_hasModel = true;
+                m_hasDenoiseSample = denoiseFound;
+                return;
+            }
+            m_smoothedFrameTime += alpha * (stats.frameDuration - m_smoothedFrameTime);
+            m_model.renderTimePerSample += alpha * (sample.renderTimePerSample - m_model.renderTimePerSample);
+            // JP: デノイザーを呼ばないフレームの固定の部分はデノイズの償却分を含まないので、
+            //     デノイズのコストは呼んだフレームでのみ更新し、固定の部分はデノイズを除いて平滑化する。
+            // EN: The fixed part of a frame without denoising doesn't include the amortized denoising,
+            //     so update the denoising cost only on frames invoking it,
+            //     and smooth the fixed part excluding denoising.
+            if (denoiseFound) {
+                if (m_hasDenoiseSample)
+                    m_model.denoiseTimePerInvocation +=
+                        alpha * (sample.denoiseTimePerInvocation - m_model.denoiseTimePerInvocation);
+                else
+                    m_model.denoiseTimePerInvocation = sample.denoiseTimePerInvocation;
+                m_hasDenoiseSample = true;
+            }
+            m_model.fixedTime += alpha * (sample.fixedTime - m_model.fixedTime);
+        }
+
+        // JP: 各設定を1段階だけ変えた候補を列挙する。
+        // EN: Enumerate candidates changing one of the settings by a single step.
+        uint32_t enumerateDegradations(Settings candidates[3]) const {
+            uint32_t numCandidates = 0;
+            if (m_settings.resolutionDivisor < m_config.maxResolutionDivisor) {
+                candidates[numCandidates] = m_settings;
+                ++candidates[numCandidates++].resolutionDivisor;
+            }
+            if (m_settings.samplesPerLaunch > m_config.minSamplesPerLaunch) {
+                candidates[numCandidates] = m_settings;
+                --candidates[numCandidates++].samplesPerLaunch;
+            }
+            if (m_hasDenoiseSample && m_settings.denoiseInterval < m_config.maxDenoiseInterval) {
+                candidates[numCandidates] = m_settings;
+                ++candidates[numCandidates++].denoiseInterval;
+            }
+            return numCandidates;
+        }
+        uint32_t enumerateUpgrades(Settings candidates[3]) const {
+            uint32_t numCandidates = 0;
+            if (m_settings.resolutionDivisor > 1) {
+                candidates[numCandidates] = m_settings;
+                --candidates[numCandidates++].resolutionDivisor;
+            }
+            if (m_settings.samplesPerLaunch < m_config.maxSamplesPerLaunch) {
+                candidates[numCandidates] = m_settings;
+                ++candidates[numCandidates++].samplesPerLaunch;
+            }
+            if (m_settings.denoiseInterval > 1) {
+                candidates[numCandidates] = m_settings;
+                --candidates[numCandidates++].denoiseInterval;
+            }
+            return numCandidates;
+        }
+
+        bool tryDegrade() {
+            Settings candidates[3];
+            uint32_t numCandidates = enumerateDegradations(candidates);
+            float target = m_config.targetFrameTime;
+            int32_t smallestFitIdx = -1;
+            int32_t largestIdx = -1;
+            float smallestFitTime = 0.0f;
+            float largestTime = INFINITY;
+            for (uint32_t i = 0; i < numCandidates; ++i) {
+                float t = predictFrameTime(candidates[i]);
+                // JP: 予測時間が目標に収まる候補のうち、削減量が最小(予測時間が最大)のもの。
+                // EN: The candidate with the smallest reduction (the largest predicted time) among those fitting.
+                if (t <= target && t > smallestFitTime) {
+                    smallestFitIdx = i;
+                    smallestFitTime = t;
+                }
+                if (t < largestTime) {
+                    largestIdx = i;
+                    largestTime = t;
+                }
+            }
+            int32_t chosenIdx = smallestFitIdx >= 0 ? smallestFitIdx : largestIdx;
+            if (chosenIdx < 0)
+                return false;
+            m_settings = candidates[chosenIdx];
+            return true;
+        }
+        bool tryUpgrade() {
+            Settings candidates[3];
+            uint32_t numCandidates = enumerateUpgrades(candidates);
+            float threshold = m_config.targetFrameTime * (1 - m_config.upgradeMargin);
+            int32_t chosenIdx = -1;
+            float chosenTime = INFINITY;
+            for (uint32_t i = 0; i < numCandidates; ++i) {
+                float t = predictFrameTime(candidates[i]);
+                if (t <= threshold && t < chosenTime) {
+                    chosenIdx = i;
+                    chosenTime = t;
+                }
+            }
+            if (chosenIdx < 0)
+                return false;
+            m_settings = candidates[chosenIdx];
+            return true;
+        }
+
+    public:
+        Governor() :
+            m_settings{ 1, 1, 1 }, m_model{}, m_smoothedFrameTime(0.0f),
+            m_lastFrameIndex(0), m_numFramesToSkip(0), m_numFramesSinceChange(0), m_numChanges(0),
+            m_hasFrame(false), m_hasModel(false), m_hasDenoiseSample(false) {}
+
+        void initialize(const GovernorConfig &config) {
+            if (config.targetFrameTime <= 0.0f)
+                throw std::runtime_error("Target frame time must be positive.");
+            if (config.maxResolutionDivisor == 0 ||
+                config.minSamplesPerLaunch == 0 || config.minSamplesPerLaunch > config.maxSamplesPerLaunch ||
+                config.maxDenoiseInterval == 0)
+                throw std::runtime_error("Invalid setting range.");
+            m_config = config;
+            m_settings.resolutionDivisor =
+                std::min(std::max(config.initialSettings.resolutionDivisor, 1u), config.maxResolutionDivisor);
+            m_settings.samplesPerLaunch =
+                std::min(std::max(config.initialSettings.samplesPerLaunch, config.minSamplesPerLaunch),
+                         config.maxSamplesPerLaunch);
+            m_settings.denoiseInterval =
+                std::min(std::max(config.initialSettings.denoiseInterval, 1u), config.maxDenoiseInterval);
+            reset();
+        }
+
+        // JP: 計測を捨て、次のフレームから推定をやり直す。シーンの切り替え時などに呼ぶ。
+        // EN: Discard measurements and restart estimation from the next frame. Call this at scene switches etc.
+        void reset() {
+            m_model = {};
+            m_smoothedFrameTime = 0.0f;
+            m_numFramesToSkip = m_config.numFramesInFlight;
+            m_numFramesSinceChange = 0;
+            m_hasModel = false;
+            m_hasDenoiseSample = false;
+        }
+
+        void setTargetFrameTime(float targetFrameTime) {
+            if (targetFrameTime <= 0.0f)
+                throw std::runtime_error("Target frame time must be positive.");
+            m_config.targetFrameTime = targetFrameTime;
+            m_numFramesSinceChange = 0;
+        }
+        float getTargetFrameTime() const {
+            return m_config.targetFrameTime;
+        }
+
+        // JP: 1フレームの結果を取り込む。設定を変えた場合はtrueを返す。
+        //     結果はフレームの順に渡し、同じフレームを2回渡してはならない。
+        // EN: Take in the result of a frame. Return true when the settings are changed.
+        //     Pass results in frame order and never pass the same frame twice.
+        bool update(const cudau::GpuProfiler::FrameStats &stats) {
+            m_lastFrameIndex = stats.frameIndex;
+            m_hasFrame = true;
+            if (m_numFramesToSkip > 0) {
+                --m_numFramesToSkip;
+                return false;
+            }
+            accumulate(stats);
+            ++m_numFramesSinceChange;
+            if (m_numFramesSinceChange < m_config.numHoldFrames)
+                return false;
+
+            bool changed = false;
+            if (m_smoothedFrameTime > m_config.targetFrameTime * (1 + m_config.degradeMargin))
+                changed = tryDegrade();
+            else if (m_smoothedFrameTime < m_config.targetFrameTime * (1 - m_config.upgradeMargin))
+                changed = tryUpgrade();
+            if (!changed)
+                return false;
+
+            // JP: 古い設定で発行済みのフレームと新しい設定での計測の立ち上がりを平均に混ぜないように、
+            //     平滑化した時間を予測値から始める。
+            // EN: Start the smoothed time from the prediction in order not to mix frames submitted
+            //     with the old settings and the ramp-up of measurements with the new settings into the average.
+            m_smoothedFrameTime = predictFrameTime(m_settings);
+            m_numFramesToSkip = m_config.numFramesInFlight;
+            m_numFramesSinceChange = 0;
+            ++m_numChanges;
+            return true;
+        }
+        // JP: プロファイラーの履歴から未処理のフレームを全て取り込む。設定を変えた場合はtrueを返す。
+        // EN: Take in all unprocessed frames from the profiler's history. Return true when the settings are changed.
+        bool update(const cudau::GpuProfiler &profiler) {
+            bool changed = false;
+            for (const cudau::GpuProfiler::FrameStats &stats : profiler.getHistory()) {
+                if (m_hasFrame && stats.frameIndex <= m_lastFrameIndex)
+                    continue;
+                changed |= update(stats);
+            }
+            return changed;
+        }
+
+        const Settings &getSettings() const {
+            return m_settings;
+        }
+        bool shouldDenoise(uint64_t frameIndex) const {
+            return frameIndex % m_settings.denoiseInterval == 0;
+        }
+
+        // JP: 現在の設定での予測フレーム時間(ミリ秒)。最初の計測が揃うまでは0。
+        // EN: Predicted frame time with the current settings in milliseconds.
+        //     This is 0 until the first measurement is collected.
+        float getPredictedFrameTime() const {
+            return m_hasModel ? predictFrameTime(m_settings) : 0.0f;
+        }
+        float getSmoothedFrameTime() const {
+            return m_smoothedFrameTime;
+        }
+        uint32_t getNumChanges() const {
+            return m_numChanges;
+        }
+    };
+#endif
+}
@@ -0,0 +1,277 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: テクスチャー(環境マップや発光テクスチャー)の輝度に比例した重点サンプリングのための区分的定数2次元分布。
+//     行ごとの条件付きCDFと行の周辺CDFを全てGPU上の並列スキャンで構築するので、16Kの環境マップでもCPUを使わない。
+//     1. buildConditionalCDFs(): 1ブロックが1行を担当し、テクセルの輝度(と重み)をスキャンして正規化する。
+//     2. buildMarginalCDF(): 1ブロックで行の積分値をスキャンして正規化する。
+//     テクスチャーの一部の行だけが変わった場合は、その行に対してだけ1を実行し、2を実行し直せば良い。
+//     ユーザーカーネルはこれらに引数を渡すだけで良い。
+//
+//     CUDA_DEVICE_KERNEL void buildConditionalCDFs(CUtexObject texture, ..., uint32_t rowOffset, ...) {
+//         importance_map::buildConditionalCDFs(texture, ..., rowOffset, ...);
+//     }
+//     kernelBuildConditionalCDFs(stream, dim3(numRows), texture, ..., firstRow, ...); // block size: 256
+//     kernelBuildMarginalCDF(stream, dim3(1), ...);
+//
+// EN: Piecewise constant 2D distribution for importance sampling proportional to the luminance of a texture
+//     (an environment map or an emissive texture).
+//     Both conditional CDFs per row and the marginal CDF of rows are built entirely by parallel scans on the GPU,
+//     so even a 16K environment map doesn't use the CPU.
+//     1. buildConditionalCDFs(): A block is in charge of a row and scans and normalizes
+//        the texel luminances (and weights).
+//     2. buildMarginalCDF(): A single block scans and normalizes the integrals of rows.
+//     When only some rows of the texture change, it is enough to run 1 only for those rows then rerun 2.
+//     User kernels only need to forward their arguments to these.
+//
+//     CUDA_DEVICE_KERNEL void buildConditionalCDFs(CUtexObject texture, ..., uint32_t rowOffset, ...) {
+//         importance_map::buildConditionalCDFs(texture, ..., rowOffset, ...);
+//     }
+//     kernelBuildConditionalCDFs(stream, dim3(numRows), texture, ..., firstRow, ...); // block size: 256
+//     kernelBuildMarginalCDF(stream, dim3(1), ...);
+namespace importance_map {
+    enum class Weighting : uint32_t {
+        // JP: テクスチャー空間で一様な重み。発光テクスチャー向け。
+        // EN: Uniform weight in the texture space. For emissive textures.
+        TexelArea = 0,
+        // JP: 正距円筒図法の環境マップの立体角に比例するsinθの重み。
+        // EN: sinθ weight proportional to the solid angle of an equirectangular environment map.
+        EquirectangularSinTheta,
+    };
+
+    // JP: テクスチャー座標[0, 1]^2上の分布。pdfはテクスチャー座標の面積に関する確率密度。
+    //     正距円筒図法の環境マップで立体角に関する密度が必要な場合は2π^2sinθで割る。
+    // EN: Distribution over texture coordinates [0, 1]^2. A pdf is the probability density
+    //     with respect to the area of texture coordinates.
+    //     Divide it by 2π^2sinθ when the density with respect to the solid angle is needed
+    //     for an equirectangular environment map.
+    struct Distribution2D {
+        const float* conditionalCdfs;
+        const float* marginalCdf;
+        const float* integral;
+        uint32_t width;
+        uint32_t height;
+
+        // JP: cdf[idx] > uとなる最初のインデックスを返す。
+        // EN: Return the first index where cdf[idx] > u.
+        CUDA_DEVICE_FUNCTION static uint32_t findInterval(const float* cdf, uint32_t num, float u) {
+            uint32_t lo = 0;
+            uint32_t hi = num - 1;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (cdf[mid] > u)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            return lo;
+        }
+
+        CUDA_DEVICE_FUNCTION float evaluateTexelPdf(uint32_t x, uint32_t y) const {
+            const float* cdf = conditionalCdfs + static_cast<size_t>(width) * y;
+            float condProb = cdf[x] - (x > 0 ? cdf[x - 1] : 0.0f);
+            float margProb = marginalCdf[y] - (y > 0 ? marginalCdf[y - 1] : 0.0f);
+            return margProb * condProb * width * height;
+        }
+
+        CUDA_DEVICE_FUNCTION float2 sample(float u0, float u1, float* pdf) const {
+            uint32_t y = findInterval(marginalCdf, height, u1);
+            float margCdfPrev = y > 0 ? marginalCdf[y - 1] : 0.0f;
+            float margProb = marginalCdf[y] - margCdfPrev;
+            float dv = margProb > 0.0f ? fminf((u1 - margCdfPrev) / margProb, 1.0f) : 0.5f;
+
+            const float* cdf = conditionalCdfs + static_cast<size_t>(width) * y;
+            uint32_t x = findInterval(cdf, width, u0);
+            float condCdfPrev = x > 0 ? cdf[x - 1] : 0.0f;
+            float condProb = cdf[x] - condCdfPrev;
+            float du = condProb > 0.0f ? fminf((u0 - condCdfPrev) / condProb, 1.0f) : 0.5f;
+
+            *pdf = margProb * condProb * width * height;
+            return make_float2((x + du) / width, (y + dv) / height);
+        }
+
+        CUDA_DEVICE_FUNCTION float evaluatePdf(const float2 &texCoord) const {
+            uint32_t x = static_cast<uint32_t>(fmaxf(texCoord.x, 0.0f) * width);
+            uint32_t y = static_cast<uint32_t>(fmaxf(texCoord.y, 0.0f) * height);
+            return evaluateTexelPdf(x < width ? x : width - 1, y < height ? y : height - 1);
+        }
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    static constexpr uint32_t maxNumWarpsPerBlock = 32;
+
+    // JP: ブロック内の包含スキャン。ブロック内の全スレッドが呼ぶ必要がある。ブロックサイズは32の倍数。
+    // EN: Inclusive scan within a block. All the threads in the block need to call this.
+    //     The block size must be a multiple of 32.
+    CUDA_DEVICE_FUNCTION float blockInclusiveScan(float value, float* total) {
+        __shared__ float s_warpSums[maxNumWarpsPerBlock];
+        uint32_t laneIdx = threadIdx.x % 32;
+        uint32_t warpIdx = threadIdx.x / 32;
+        uint32_t numWarps = blockDim.x / 32;
+
+        for (uint32_t delta = 1; delta < 32; delta <<= 1) {
+            float v = __shfl_up_sync(0xFFFFFFFF, value, delta);
+            if (laneIdx >= delta)
+                value += v;
+        }
+        if (laneIdx == 31)
+            s_warpSums[warpIdx] = value;
+        __syncthreads();
+
+        if (warpIdx == 0) {
+            float warpSum = laneIdx < numWarps ? s_warpSums[laneIdx] : 0.0f;
+            for (uint32_t delta = 1; delta < 32; delta <<= 1) {
+                float v = __shfl_up_sync(0xFFFFFFFF, warpSum, delta);
+                if (laneIdx >= delta)
+                    warpSum += v;
+            }
+            if (laneIdx < numWarps)
+                s_warpSums[laneIdx] = warpSum;
+        }
+        __syncthreads();
+
+        if (warpIdx > 0)
+            value += s_warpSums[warpIdx - 1];
+        *total = s_warpSums[numWarps - 1];
+        // JP: 続けて呼ばれた場合に備えて共有メモリーの読み出し完了を待つ。
+        // EN: Wait for reads of the shared memory to complete in case of a subsequent call.
+        __syncthreads();
+
+        return value;
+    }
+
+    // JP: スキャン済みの配列を正規化してCDFにする。全てゼロの場合は一様なCDFにする。
+    // EN: Normalize a scanned array into a CDF. Make a uniform CDF when all zero.
+    CUDA_DEVICE_FUNCTION void normalizeCDF(float* cdf, uint32_t num, float total) {
+        for (uint32_t idx = threadIdx.x; idx < num; idx += blockDim.x) {
+            if (total > 0.0f)
+                cdf[idx] = idx == num - 1 ? 1.0f : cdf[idx] / total;
+            else
+                cdf[idx] = static_cast<float>(idx + 1) / num;
+        }
+    }
+
+    // JP: テクスチャーは正規化座標、浮動小数点数で読み出すサンプラーで作られている必要がある。
+    //     blockIdx.x + rowOffset行目を処理する。
+    // EN: The texture needs to be created with a sampler reading with normalized coordinates as floating-point.
+    //     Process the (blockIdx.x + rowOffset)-th row.
+    CUDA_DEVICE_FUNCTION void buildConditionalCDFs(
+        CUtexObject texture, uint32_t width, uint32_t height, Weighting weighting, uint32_t rowOffset,
+        float* conditionalCdfs, float* rowIntegrals) {
+        uint32_t y = blockIdx.x + rowOffset;
+        if (y >= height)
+            return;
+
+        float rowWeight = 1.0f;
+        if (weighting == Weighting::EquirectangularSinTheta)
+            rowWeight = std::sin(3.14159265358979323846f * (y + 0.5f) / height);
+        float v = (y + 0.5f) / height;
+
+        float* cdf = conditionalCdfs + static_cast<size_t>(width) * y;
+        float carry = 0.0f;
+        for (uint32_t base = 0; base < width; base += blockDim.x) {
+            uint32_t x = base + threadIdx.x;
+            float value = 0.0f;
+            if (x < width) {
+                float4 texel = tex2DLod<float4>(texture, (x + 0.5f) / width, v, 0.0f);
+                value = fmaxf(0.2126f * texel.x + 0.7152f * texel.y + 0.0722f * texel.z, 0.0f) * rowWeight;
+            }
+            float chunkTotal;
+            float scanned = blockInclusiveScan(value, &chunkTotal);
+            if (x < width)
+                cdf[x] = carry + scanned;
+            carry += chunkTotal;
+        }
+        __syncthreads();
+
+        normalizeCDF(cdf, width, carry);
+        if (threadIdx.x == 0)
+            rowIntegrals[y] = carry / width;
+    }
+
+    // JP: 単一のブロックで実行する。integralには分布の元となる関数のテクスチャー空間での積分値が書き込まれる。
+    // EN: Run with a single block. integral receives the integral of the function underlying the distribution
+    //     over the texture space.
+    CUDA_DEVICE_FUNCTION void buildMarginalCDF(
+        const float* rowIntegrals, uint32_t height, float* marginalCdf, float* integral) {
+        float carry = 0.0f;
+        for (uint32_t base = 0; base < height; base += blockDim.x) {
+            uint32_t y = base + threadIdx.x;
+            float value = y < height ? rowIntegrals[y] : 0.0f;
+            float chunkTotal;
+            float scanned = blockInclusiveScan(value, &chunkTotal);
+            if (y < height)
+                marginalCdf[y] = carry + scanned;
+            carry += chunkTotal;
+        }
+        __syncthreads();
+
+        normalizeCDF(marginalCdf, height, carry);
+        if (threadIdx.x == 0)
+            *integral = carry / height;
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 分布のテーブルを保持するバッファー群。構築はユーザーカーネル経由で行う。
+    // EN: Buffers holding the tables of a distribution. Building is done via user kernels.
+    class Distribution2DBuffers {
+        cudau::TypedBuffer<float> m_conditionalCdfs;
+        cudau::TypedBuffer<float> m_rowIntegrals;
+        cudau::TypedBuffer<float> m_marginalCdf;
+        cudau::TypedBuffer<float> m_integral;
+        uint32_t m_width;
+        uint32_t m_height;
+
+    public:
+        Distribution2DBuffers() : m_width(0), m_height(0) {}
+
+        void initialize(CUcontext cuContext, cudau::BufferType type, uint32_t width, uint32_t height) {
+            m_width = width;
+            m_height = height;
+            m_conditionalCdfs.initialize(cuContext, type, width * height);
+            m_rowIntegrals.initialize(cuContext, type, height);
+            m_marginalCdf.initialize(cuContext, type, height);
+            m_integral.initialize(cuContext, type, 1);
+        }
+        void finalize() {
+            m_integral.finalize();
+            m_marginalCdf.finalize();
+            m_rowIntegrals.finalize();
+            m_conditionalCdfs.finalize();
+            m_width = 0;
+            m_height = 0;
+        }
+
+        uint32_t getWidth() const {
+            return m_width;
+        }
+        uint32_t getHeight() const {
+            return m_height;
+        }
+        float* getConditionalCDFs() const {
+            return m_conditionalCdfs.getDevicePointer();
+        }
+        float* getRowIntegrals() const {
+            return m_rowIntegrals.getDevicePointer();
+        }
+        float* getMarginalCDF() const {
+            return m_marginalCdf.getDevicePointer();
+        }
+        float* getIntegral() const {
+            return m_integral.getDevicePointer();
+        }
+
+        Distribution2D getDeviceView() const {
+            Distribution2D ret;
+            ret.conditionalCdfs = m_conditionalCdfs.getDevicePointer();
+            ret.marginalCdf = m_marginalCdf.getDevicePointer();
+            ret.integral = m_integral.getDevicePointer();
+            ret.width = m_width;
+            ret.height = m_height;
+            return ret;
+        }
+    };
+#endif
+}
@@ -0,0 +1,20 @@
+﻿#pragma once
+
+#include "importance_map.h"
+
+// JP: importance_map::Distribution2DBuffersを構築するカーネル。重点サンプリング用の分布を使うサンプルは
+//     このファイルもPTXにコンパイルする。ブロックサイズは256を想定する。
+// EN: Kernels building importance_map::Distribution2DBuffers. A sample using distributions for importance sampling
+//     compiles this file to PTX as well. The block size is assumed to be 256.
+
+CUDA_DEVICE_KERNEL void buildConditionalCDFs(
+    CUtexObject texture, uint32_t width, uint32_t height, importance_map::Weighting weighting, uint32_t rowOffset,
+    float* conditionalCdfs, float* rowIntegrals) {
+    importance_map::buildConditionalCDFs(texture, width, height, weighting, rowOffset,
+                                         conditionalCdfs, rowIntegrals);
+}
+
+CUDA_DEVICE_KERNEL void buildMarginalCDF(
+    const float* rowIntegrals, uint32_t height, float* marginalCdf, float* integral) {
+    importance_map::buildMarginalCDF(rowIntegrals, height, marginalCdf, integral);
+}
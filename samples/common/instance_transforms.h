@@ -0,0 +1,206 @@
+﻿#pragma once
+
+#include "common.h"
+
+#if !defined(__CUDA_ARCH__)
+#   if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#       include <immintrin.h>
+#   elif defined(__ARM_NEON)
+#       include <arm_neon.h>
+#   endif
+#endif
+
+// JP: 大量のインスタンスの変換(スケール、クォータニオンによる回転、平行移動)を
+//     Instance::setTransform()やOptixInstance::transformと同じ行優先の3x4行列にまとめて変換するユーティリティー。
+//     入力は成分ごとの配列(SoA)で、ホスト側ではSIMD(AVX, SSE, NEON)で複数のインスタンスを同時に処理する。
+//     IAS::setDeviceInstances()を使う場合はGPU上でOptixInstanceの配列に直接書き込むこともできる。
+//
+//     instance_transforms::SRTArrays srts = { { sx, sy, sz }, { qx, qy, qz, qw }, { tx, ty, tz } };
+//     instance_transforms::composeSRTTransforms(srts, numInstances, transforms.data());
+//     instance_transforms::setTransforms(instances.data(), numInstances, transforms.data());
+//
+//     // GPU上
+//     instance_transforms::DeviceComposer composer;
+//     composer.initialize(instanceTransformModule);
+//     composer.compose(stream, srtsOnDevice, numInstances, instanceBuffer.getDevicePointer());
+//
+// EN: Utility to convert transforms (scale, rotation by quaternion, translation) of many instances together into
+//     row-major 3x4 matrices same as Instance::setTransform() and OptixInstance::transform.
+//     Inputs are arrays per component (SoA), and the host side processes multiple instances at once with SIMD
+//     (AVX, SSE, NEON).
+//     When using IAS::setDeviceInstances(), this can also write directly into an array of OptixInstance on the GPU.
+//
+//     instance_transforms::SRTArrays srts = { { sx, sy, sz }, { qx, qy, qz, qw }, { tx, ty, tz } };
+//     instance_transforms::composeSRTTransforms(srts, numInstances, transforms.data());
+//     instance_transforms::setTransforms(instances.data(), numInstances, transforms.data());
+//
+//     // On the GPU
+//     instance_transforms::DeviceComposer composer;
+//     composer.initialize(instanceTransformModule);
+//     composer.compose(stream, srtsOnDevice, numInstances, instanceBuffer.getDevicePointer());
+namespace instance_transforms {
+    // JP: 各成分の配列へのポインター。回転は正規化されたクォータニオン(x, y, z, w)。
+    //     GPU版ではデバイスのポインターを指定する。
+    // EN: Pointers to arrays of each component. Rotations are normalized quaternions (x, y, z, w).
+    //     Specify device pointers for the GPU version.
+    struct SRTArrays {
+        const float* scale[3];
+        const float* rotation[4];
+        const float* translation[3];
+    };
+
+    // JP: M = T * R * Sを行優先の3x4行列として求める。Quaternion::toMatrix3x3()と同じ回転。
+    // EN: Compute M = T * R * S as a row-major 3x4 matrix. The rotation is the same as Quaternion::toMatrix3x3().
+    template <typename RealType>
+    CUDA_DEVICE_FUNCTION void composeSRT(
+        const RealType s[3], const RealType q[4], const RealType t[3], RealType transform[12]) {
+        const RealType one = RealType(1.0f);
+        const RealType two = RealType(2.0f);
+        RealType xx = q[0] * q[0], yy = q[1] * q[1], zz = q[2] * q[2];
+        RealType xy = q[0] * q[1], yz = q[1] * q[2], zx = q[2] * q[0];
+        RealType xw = q[0] * q[3], yw = q[1] * q[3], zw = q[2] * q[3];
+        transform[0] = (one - two * (yy + zz)) * s[0];
+        transform[1] = two * (xy - zw) * s[1];
+        transform[2] = two * (zx + yw) * s[2];
+        transform[3] = t[0];
+        transform[4] = two * (xy + zw) * s[0];
+        transform[5] = (one - two * (xx + zz)) * s[1];
+        transform[6] = two * (yz - xw) * s[2];
+        transform[7] = t[1];
+        transform[8] = two * (zx - yw) * s[0];
+        transform[9] = two * (yz + xw) * s[1];
+        transform[10] = (one - two * (xx + yy)) * s[2];
+        transform[11] = t[2];
+    }
+
+    CUDA_DEVICE_FUNCTION void composeSRT(const SRTArrays &srts, uint32_t index, float transform[12]) {
+        float s[3], q[4], t[3];
+        for (uint32_t i = 0; i < 3; ++i) {
+            s[i] = srts.scale[i][index];
+            t[i] = srts.translation[i][index];
+        }
+        for (uint32_t i = 0; i < 4; ++i)
+            q[i] = srts.rotation[i][index];
+        composeSRT(s, q, t, transform);
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: OptixInstanceの変換のみを書き込み、他のメンバーは変えない。
+    // EN: Write only transforms of OptixInstances, leaving the other members unchanged.
+    CUDA_DEVICE_FUNCTION void composeSRTTransforms(
+        const SRTArrays &srts, uint32_t numInstances, OptixInstance* instances) {
+        for (uint32_t instIdx = blockDim.x * blockIdx.x + threadIdx.x; instIdx < numInstances;
+             instIdx += blockDim.x * gridDim.x)
+            composeSRT(srts, instIdx, instances[instIdx].transform);
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    namespace detail {
+        // JP: composeSRT()をSIMDレーンの型でそのまま使うための薄いラッパー。
+        // EN: Thin wrapper to use composeSRT() as is with SIMD lane types.
+#if defined(__AVX__)
+        struct Lanes {
+            static constexpr uint32_t width = 8;
+            __m256 v;
+            Lanes() {}
+            explicit Lanes(float s) : v(_mm256_set1_ps(s)) {}
+            Lanes(__m256 _v) : v(_v) {}
+            static Lanes load(const float* p) { return _mm256_loadu_ps(p); }
+            void store(float* p) const { _mm256_store_ps(p, v); }
+            friend Lanes operator+(const Lanes &a, const Lanes &b) { return _mm256_add_ps(a.v, b.v); }
+            friend Lanes operator-(const Lanes &a, const Lanes &b) { return _mm256_sub_ps(a.v, b.v); }
+            friend Lanes operator*(const Lanes &a, const Lanes &b) { return _mm256_mul_ps(a.v, b.v); }
+        };
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        struct Lanes {
+            static constexpr uint32_t width = 4;
+            __m128 v;
+            Lanes() {}
+            explicit Lanes(float s) : v(_mm_set1_ps(s)) {}
+            Lanes(__m128 _v) : v(_v) {}
+            static Lanes load(const float* p) { return _mm_loadu_ps(p); }
+            void store(float* p) const { _mm_store_ps(p, v); }
+            friend Lanes operator+(const Lanes &a, const Lanes &b) { return _mm_add_ps(a.v, b.v); }
+            friend Lanes operator-(const Lanes &a, const Lanes &b) { return _mm_sub_ps(a.v, b.v); }
+            friend Lanes operator*(const Lanes &a, const Lanes &b) { return _mm_mul_ps(a.v, b.v); }
+        };
+#elif defined(__ARM_NEON)
+        struct Lanes {
+            static constexpr uint32_t width = 4;
+            float32x4_t v;
+            Lanes() {}
+            explicit Lanes(float s) : v(vdupq_n_f32(s)) {}
+            Lanes(float32x4_t _v) : v(_v) {}
+            static Lanes load(const float* p) { return vld1q_f32(p); }
+            void store(float* p) const { vst1q_f32(p, v); }
+            friend Lanes operator+(const Lanes &a, const Lanes &b) { return vaddq_f32(a.v, b.v); }
+            friend Lanes operator-(const Lanes &a, const Lanes &b) { return vsubq_f32(a.v, b.v); }
+            friend Lanes operator*(const Lanes &a, const Lanes &b) { return vmulq_f32(a.v, b.v); }
+        };
+#else
+#   define INSTANCE_TRANSFORMS_NO_SIMD
+#endif
+    }
+
+    // JP: transformsにはnumInstances * 12個のfloatを書き込む。
+    // EN: numInstances * 12 floats are written to transforms.
+    inline void composeSRTTransforms(const SRTArrays &srts, uint32_t numInstances, float* transforms) {
+        uint32_t instIdx = 0;
+#if !defined(INSTANCE_TRANSFORMS_NO_SIMD)
+        using detail::Lanes;
+        constexpr uint32_t W = Lanes::width;
+        for (; instIdx + W <= numInstances; instIdx += W) {
+            Lanes s[3], q[4], t[3], m[12];
+            for (uint32_t i = 0; i < 3; ++i) {
+                s[i] = Lanes::load(srts.scale[i] + instIdx);
+                t[i] = Lanes::load(srts.translation[i] + instIdx);
+            }
+            for (uint32_t i = 0; i < 4; ++i)
+                q[i] = Lanes::load(srts.rotation[i] + instIdx);
+            composeSRT(s, q, t, m);
+
+            // JP: 成分ごとのレーンをインスタンスごとの行列に並べ替えて書き出す。
+            // EN: Rearrange lanes per component into matrices per instance and write them out.
+            alignas(32) float lanes[12][W];
+            for (uint32_t i = 0; i < 12; ++i)
+                m[i].store(lanes[i]);
+            float* dst = transforms + 12 * static_cast<size_t>(instIdx);
+            for (uint32_t l = 0; l < W; ++l) {
+                for (uint32_t i = 0; i < 12; ++i)
+                    dst[12 * l + i] = lanes[i][l];
+            }
+        }
+#endif
+        for (; instIdx < numInstances; ++instIdx)
+            composeSRT(srts, instIdx, transforms + 12 * static_cast<size_t>(instIdx));
+    }
+
+    inline void setTransforms(const optixu::Instance* instances, uint32_t numInstances, const float* transforms) {
+        for (uint32_t instIdx = 0; instIdx < numInstances; ++instIdx)
+            instances[instIdx].setTransform(transforms + 12 * static_cast<size_t>(instIdx));
+    }
+
+    class DeviceComposer {
+        cudau::Kernel m_composeSRTTransforms;
+
+    public:
+        // JP: instanceTransformModuleはinstance_transforms_kernels.cuをコンパイルしたモジュール。
+        // EN: instanceTransformModule is a module compiled from instance_transforms_kernels.cu.
+        void initialize(CUmodule instanceTransformModule) {
+            m_composeSRTTransforms.set(instanceTransformModule, "composeSRTTransforms", cudau::AutoBlockDim(), 0);
+        }
+
+        // JP: instancesはIAS::setDeviceInstances()で使うインスタンスバッファー。
+        //     変換以外のメンバーは事前に書き込んでおく必要がある。IASのリビルドかアップデートは呼び出し側で行う。
+        // EN: instances is the instance buffer used with IAS::setDeviceInstances().
+        //     Members other than transforms need to be written beforehand.
+        //     The caller needs to rebuild or update the IAS.
+        void compose(CUstream stream, const SRTArrays &srts, uint32_t numInstances, CUdeviceptr instances) const {
+            if (numInstances == 0)
+                return;
+            m_composeSRTTransforms.launchPersistent(stream, srts, numInstances, instances);
+        }
+    };
+#endif
+}
@@ -0,0 +1,12 @@
+﻿#pragma once
+
+#include "instance_transforms.h"
+
+// JP: instance_transforms::DeviceComposerが使うカーネル。GPU上で変換を求めるサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernel used by instance_transforms::DeviceComposer. A sample computing transforms on the GPU compiles this file
+//     to PTX as well.
+
+CUDA_DEVICE_KERNEL void composeSRTTransforms(
+    instance_transforms::SRTArrays srts, uint32_t numInstances, OptixInstance* instances) {
+    instance_transforms::composeSRTTransforms(srts, numInstances, instances);
+}
@@ -0,0 +1,402 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: カスタムプリミティブ用の数値的に頑健な交差判定ルーチン集。
+//     球、ディスク、箱、カプセル、角の丸い四角形について、オブジェクト空間の判定、
+//     Intersectionプログラムから呼ぶ報告関数、optixu::computeCustomPrimitiveAABBs()に渡すAABBファンクターを提供する。
+//     交差はアトリビュート無しでヒット種別(表/裏)のみをoptixu::reportIntersection()で報告し、
+//     法線などはClosest-Hitプログラムでオブジェクト空間のヒット位置から求め直す。
+//     二次方程式は桁落ちを避ける形で解き(Ray Tracing Gems 第7章)、箱のスラブ判定では遠い側の距離を
+//     浮動小数点誤差の分だけ広げる。
+//
+//     // Intersectionプログラム
+//     intersection::intersectAndReport(geom.spheres[optixGetPrimitiveIndex()]);
+//     // Closest-Hitプログラム
+//     const intersection::Sphere &sphere = geom.spheres[optixGetPrimitiveIndex()];
+//     float3 n = sphere.calcNormal(intersection::getObjectSpaceHitPoint());
+//     // AABB計算用カーネル
+//     optixu::computeCustomPrimitiveAABBs(intersection::BoundsFunctor<intersection::Sphere>{ spheres },
+//                                         aabbBuffers, 1, 0.0f, 0.0f, numSpheres);
+//
+// EN: Collection of numerically robust intersection routines for custom primitives.
+//     For spheres, discs, boxes, capsules and rounded quads, this provides object space tests,
+//     report functions called from intersection programs and AABB functors to pass to
+//     optixu::computeCustomPrimitiveAABBs().
+//     Intersections are reported by optixu::reportIntersection() with only the hit kind (front/back)
+//     and no attributes, and normals and so on are recomputed in closest-hit programs
+//     from the hit position in object space.
+//     Quadratics are solved in a form avoiding catastrophic cancellation (Ray Tracing Gems chapter 7),
+//     and the slab test of boxes widens the far distance by the floating-point error.
+//
+//     // Intersection program
+//     intersection::intersectAndReport(geom.spheres[optixGetPrimitiveIndex()]);
+//     // Closest-hit program
+//     const intersection::Sphere &sphere = geom.spheres[optixGetPrimitiveIndex()];
+//     float3 n = sphere.calcNormal(intersection::getObjectSpaceHitPoint());
+//     // Kernel computing AABBs
+//     optixu::computeCustomPrimitiveAABBs(intersection::BoundsFunctor<intersection::Sphere>{ spheres },
+//                                         aabbBuffers, 1, 0.0f, 0.0f, numSpheres);
+namespace intersection {
+    enum HitKind : uint32_t {
+        HitKind_FrontFace = 0,
+        HitKind_BackFace,
+    };
+
+    CUDA_DEVICE_FUNCTION float pow2(float x) {
+        return x * x;
+    }
+
+    // JP: レイに沿って近い順に並んだ交差候補。閉じた形状では入る点と出る点の二つになる。
+    // EN: Intersection candidates ordered along the ray. Closed shapes give two of the entry and the exit.
+    struct Candidates {
+        float ts[2];
+        HitKind hitKinds[2];
+        uint32_t count;
+    };
+
+    // JP: 中心fからの球(半径radius)とレイ(方向d, 二乗長a)の交差距離を求める。
+    //     判別式はa * r^2 - |f x d|^2として差の大きな二乗の引き算を避け、
+    //     根は片方をq / a、もう片方をc / qとして求める。
+    // EN: Compute the intersection distances between a sphere (radius) and a ray (direction d, squared length a)
+    //     where f is the ray origin relative to the center.
+    //     The discriminant is a * r^2 - |f x d|^2 avoiding subtraction of large squares,
+    //     and roots are obtained as q / a for one and c / q for the other.
+    CUDA_DEVICE_FUNCTION bool calcSphereRoots(
+        const float3 &f, const float3 &d, float a, float radius, float* tNear, float* tFar) {
+        float b = -dot(f, d);
+        float discr = a * pow2(radius) - sqLength(cross(f, d));
+        if (discr < 0.0f || a == 0.0f)
+            return false;
+        float q = b + std::copysign(std::sqrt(discr), b);
+        float c = sqLength(f) - pow2(radius);
+        float t0 = q != 0.0f ? c / q : 0.0f;
+        float t1 = q / a;
+        *tNear = std::fmin(t0, t1);
+        *tFar = std::fmax(t0, t1);
+        return true;
+    }
+
+    CUDA_DEVICE_FUNCTION void setClosedCandidates(float tNear, float tFar, Candidates* candidates) {
+        candidates->ts[0] = tNear;
+        candidates->hitKinds[0] = HitKind_FrontFace;
+        candidates->ts[1] = tFar;
+        candidates->hitKinds[1] = HitKind_BackFace;
+        candidates->count = 2;
+    }
+
+    CUDA_DEVICE_FUNCTION void setPlanarCandidate(float t, float dirDotNormal, Candidates* candidates) {
+        candidates->ts[0] = t;
+        candidates->hitKinds[0] = dirDotNormal < 0.0f ? HitKind_FrontFace : HitKind_BackFace;
+        candidates->count = 1;
+    }
+
+
+
+    struct Sphere {
+        float3 center;
+        float radius;
+
+        CUDA_DEVICE_FUNCTION bool intersect(const float3 &org, const float3 &dir, Candidates* candidates) const {
+            float tNear, tFar;
+            if (!calcSphereRoots(org - center, dir, sqLength(dir), radius, &tNear, &tFar))
+                return false;
+            setClosedCandidates(tNear, tFar, candidates);
+            return true;
+        }
+
+        CUDA_DEVICE_FUNCTION float3 calcNormal(const float3 &p) const {
+            return normalize(p - center);
+        }
+
+        // JP: (theta, phi)を[0, 1]^2に写したテクスチャー座標。
+        // EN: Texture coordinates mapping (theta, phi) to [0, 1]^2.
+        CUDA_DEVICE_FUNCTION float2 calcTexCoord(const float3 &p) const {
+            float3 n = calcNormal(p);
+            float theta = std::acos(std::fmin(std::fmax(n.z, -1.0f), 1.0f));
+            float phi = std::atan2(n.y, n.x);
+            return make_float2(phi / (2 * 3.14159265358979323846f) + 0.5f, theta / 3.14159265358979323846f);
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            AABB ret;
+            ret.minP = center - make_float3(radius);
+            ret.maxP = center + make_float3(radius);
+            return ret;
+        }
+    };
+
+
+
+    // JP: normalは正規化されている必要がある。normalの向きが表面。
+    // EN: normal must be normalized. The side normal points to is the front face.
+    struct Disc {
+        float3 center;
+        float3 normal;
+        float radius;
+
+        CUDA_DEVICE_FUNCTION bool intersect(const float3 &org, const float3 &dir, Candidates* candidates) const {
+            float dirDotN = dot(dir, normal);
+            if (dirDotN == 0.0f)
+                return false;
+            float t = dot(center - org, normal) / dirDotN;
+            if (sqLength(org + t * dir - center) > pow2(radius))
+                return false;
+            setPlanarCandidate(t, dirDotN, candidates);
+            return true;
+        }
+
+        CUDA_DEVICE_FUNCTION float3 calcNormal(const float3 &/*p*/) const {
+            return normal;
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            float3 extent = radius * make_float3(
+                std::sqrt(std::fmax(1.0f - pow2(normal.x), 0.0f)),
+                std::sqrt(std::fmax(1.0f - pow2(normal.y), 0.0f)),
+                std::sqrt(std::fmax(1.0f - pow2(normal.z), 0.0f)));
+            AABB ret;
+            ret.minP = center - extent;
+            ret.maxP = center + extent;
+            return ret;
+        }
+    };
+
+
+
+    // JP: オブジェクト空間の軸に沿った箱。向きはインスタンスの変換で与える。
+    // EN: Box aligned to the object space axes. Orientation is given by the instance transform.
+    struct Box {
+        float3 minP;
+        float3 maxP;
+
+        CUDA_DEVICE_FUNCTION bool intersect(const float3 &org, const float3 &dir, Candidates* candidates) const {
+            // JP: 軸に平行なレイでは0 * infがNaNになるが、fmin/fmaxはNaNを無視するので他の軸の結果が残る。
+            //     遠い側の距離は3回の丸め誤差の分だけ広げて箱の辺でのすり抜けを防ぐ。
+            // EN: 0 * inf becomes NaN for rays parallel to an axis, but fmin/fmax ignore NaN,
+            //     so the results of the other axes remain.
+            //     Widen the far distance by the error of three roundings to prevent leaks at box edges.
+            constexpr float machEps = 0.5f * 1.1920929e-7f;
+            constexpr float gamma3 = 3 * machEps / (1 - 3 * machEps);
+            float3 invDir = make_float3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+            float3 t0 = (minP - org) * invDir;
+            float3 t1 = (maxP - org) * invDir;
+            float3 tNears = min(t0, t1);
+            float3 tFars = max(t0, t1);
+            float tNear = std::fmax(std::fmax(tNears.x, tNears.y), tNears.z);
+            float tFar = std::fmin(std::fmin(tFars.x, tFars.y), tFars.z) * (1 + 2 * gamma3);
+            if (tNear > tFar)
+                return false;
+            setClosedCandidates(tNear, tFar, candidates);
+            return true;
+        }
+
+        // JP: 中心からの距離を半分の大きさで正規化したときに最も大きな軸を法線とする。
+        // EN: The normal is the axis with the largest distance from the center normalized by the half extent.
+        CUDA_DEVICE_FUNCTION float3 calcNormal(const float3 &p) const {
+            float3 halfExtent = 0.5f * (maxP - minP);
+            float3 lp = (p - 0.5f * (minP + maxP)) / halfExtent;
+            float3 alp = make_float3(std::fabs(lp.x), std::fabs(lp.y), std::fabs(lp.z));
+            if (alp.x >= alp.y && alp.x >= alp.z)
+                return make_float3(std::copysign(1.0f, lp.x), 0.0f, 0.0f);
+            else if (alp.y >= alp.z)
+                return make_float3(0.0f, std::copysign(1.0f, lp.y), 0.0f);
+            else
+                return make_float3(0.0f, 0.0f, std::copysign(1.0f, lp.z));
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            AABB ret;
+            ret.minP = minP;
+            ret.maxP = maxP;
+            return ret;
+        }
+    };
+
+
+
+    // JP: 線分p0-p1からの距離がradius以内の領域。
+    //     円柱部分と両端の半球の交差のうち、それぞれの担当範囲にあるものの最小と最大を入る点と出る点とする。
+    // EN: Region within radius from the segment p0-p1.
+    //     The minimum and maximum of the intersections with the cylinder part and the hemispheres at both ends
+    //     lying in their own ranges are the entry and the exit.
+    struct Capsule {
+        float3 p0;
+        float3 p1;
+        float radius;
+
+        CUDA_DEVICE_FUNCTION bool intersect(const float3 &org, const float3 &dir, Candidates* candidates) const {
+            float3 axis = p1 - p0;
+            float len = length(axis);
+            axis = len > 0.0f ? axis / len : make_float3(0.0f, 0.0f, 1.0f);
+            float3 f = org - p0;
+            float fDotAxis = dot(f, axis);
+            float dDotAxis = dot(dir, axis);
+
+            float tNear = INFINITY;
+            float tFar = -INFINITY;
+            const auto unifyIfInRange = [&](float t, float hMin, float hMax) {
+                float h = fDotAxis + t * dDotAxis;
+                if (h >= hMin && h <= hMax) {
+                    tNear = std::fmin(tNear, t);
+                    tFar = std::fmax(tFar, t);
+                }
+            };
+
+            float3 fPerp = f - fDotAxis * axis;
+            float3 dPerp = dir - dDotAxis * axis;
+            float t0, t1;
+            if (calcSphereRoots(fPerp, dPerp, sqLength(dPerp), radius, &t0, &t1)) {
+                unifyIfInRange(t0, 0.0f, len);
+                unifyIfInRange(t1, 0.0f, len);
+            }
+            float a = sqLength(dir);
+            if (calcSphereRoots(f, dir, a, radius, &t0, &t1)) {
+                unifyIfInRange(t0, -INFINITY, 0.0f);
+                unifyIfInRange(t1, -INFINITY, 0.0f);
+            }
+            if (calcSphereRoots(org - p1, dir, a, radius, &t0, &t1)) {
+                unifyIfInRange(t0, len, INFINITY);
+                unifyIfInRange(t1, len, INFINITY);
+            }
+            if (tNear > tFar)
+                return false;
+            setClosedCandidates(tNear, tFar, candidates);
+            return true;
+        }
+
+        CUDA_DEVICE_FUNCTION float3 calcNormal(const float3 &p) const {
+            float3 axis = p1 - p0;
+            float h = std::fmin(std::fmax(dot(p - p0, axis) / std::fmax(sqLength(axis), 1e-30f), 0.0f), 1.0f);
+            return normalize(p - (p0 + h * axis));
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            AABB ret;
+            ret.minP = min(p0, p1) - make_float3(radius);
+            ret.maxP = max(p0, p1) + make_float3(radius);
+            return ret;
+        }
+    };
+
+
+
+    // JP: 中心から辺の中点へのベクトルhalfAxisU, halfAxisV(互いに直交)で張られる四角形の角を
+    //     半径cornerRadiusで丸めたもの。cornerRadiusは各辺の長さの半分以下とする。
+    //     cross(halfAxisU, halfAxisV)の向きが表面。
+    // EN: Quad spanned by vectors halfAxisU, halfAxisV (orthogonal to each other) from the center to edge midpoints,
+    //     with corners rounded by cornerRadius. cornerRadius must be at most half the length of each edge.
+    //     The side cross(halfAxisU, halfAxisV) points to is the front face.
+    struct RoundedQuad {
+        float3 center;
+        float3 halfAxisU;
+        float3 halfAxisV;
+        float cornerRadius;
+
+        CUDA_DEVICE_FUNCTION bool intersect(const float3 &org, const float3 &dir, Candidates* candidates) const {
+            float3 n = cross(halfAxisU, halfAxisV);
+            float dirDotN = dot(dir, n);
+            if (dirDotN == 0.0f)
+                return false;
+            float t = dot(center - org, n) / dirDotN;
+            float2 uv = calcLocalCoordinates(org + t * dir);
+            if (std::fabs(uv.x) > 1.0f || std::fabs(uv.y) > 1.0f)
+                return false;
+
+            // JP: 角の領域では角の円の中心からの距離で判定する。
+            // EN: In corner regions, test by the distance from the center of the corner circle.
+            float halfLengthU = length(halfAxisU);
+            float halfLengthV = length(halfAxisV);
+            float qu = std::fabs(uv.x) * halfLengthU - (halfLengthU - cornerRadius);
+            float qv = std::fabs(uv.y) * halfLengthV - (halfLengthV - cornerRadius);
+            if (qu > 0.0f && qv > 0.0f && pow2(qu) + pow2(qv) > pow2(cornerRadius))
+                return false;
+            setPlanarCandidate(t, dirDotN, candidates);
+            return true;
+        }
+
+        // JP: 四角形の範囲を[-1, 1]^2とする座標。
+        // EN: Coordinates where the quad range is [-1, 1]^2.
+        CUDA_DEVICE_FUNCTION float2 calcLocalCoordinates(const float3 &p) const {
+            float3 lp = p - center;
+            return make_float2(dot(lp, halfAxisU) / sqLength(halfAxisU),
+                               dot(lp, halfAxisV) / sqLength(halfAxisV));
+        }
+
+        CUDA_DEVICE_FUNCTION float3 calcNormal(const float3 &/*p*/) const {
+            return normalize(cross(halfAxisU, halfAxisV));
+        }
+
+        CUDA_DEVICE_FUNCTION float2 calcTexCoord(const float3 &p) const {
+            return 0.5f * calcLocalCoordinates(p) + make_float2(0.5f);
+        }
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            float3 extent = make_float3(std::fabs(halfAxisU.x) + std::fabs(halfAxisV.x),
+                                        std::fabs(halfAxisU.y) + std::fabs(halfAxisV.y),
+                                        std::fabs(halfAxisU.z) + std::fabs(halfAxisV.z));
+            AABB ret;
+            ret.minP = center - extent;
+            ret.maxP = center + extent;
+            return ret;
+        }
+    };
+
+
+
+    // JP: optixu::computeCustomPrimitiveAABBs()に渡すファンクター。モーションは扱わない。
+    // EN: Functor to pass to optixu::computeCustomPrimitiveAABBs(). This doesn't handle motion.
+    template <typename PrimitiveType>
+    struct BoundsFunctor {
+        const PrimitiveType* primitives;
+
+        CUDA_DEVICE_FUNCTION void operator()(uint32_t primIndex, float /*time*/, OptixAabb* aabb) const {
+            AABB bounds = primitives[primIndex].calcAABB();
+            aabb->minX = bounds.minP.x;
+            aabb->minY = bounds.minP.y;
+            aabb->minZ = bounds.minP.z;
+            aabb->maxX = bounds.maxP.x;
+            aabb->maxY = bounds.maxP.y;
+            aabb->maxZ = bounds.maxP.z;
+        }
+    };
+
+
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: Intersectionプログラムから呼ぶ。レイの区間にある候補を近い順に報告し、
+    //     Any-Hitプログラムで棄却された場合は次の候補を試す。
+    //     hitKindはoptixGetHitKind()で読め、アトリビュートは使わない。
+    // EN: Call from an intersection program. Report candidates within the ray interval in near-to-far order,
+    //     and try the next candidate when rejected in the any-hit program.
+    //     hitKind can be read by optixGetHitKind(), and no attributes are used.
+    template <typename PrimitiveType>
+    CUDA_DEVICE_FUNCTION bool intersectAndReport(const PrimitiveType &primitive) {
+        Candidates candidates;
+        if (!primitive.intersect(optixGetObjectRayOrigin(), optixGetObjectRayDirection(), &candidates))
+            return false;
+        float tMin = optixGetRayTmin();
+        float tMax = optixGetRayTmax();
+        for (uint32_t i = 0; i < candidates.count; ++i) {
+            float t = candidates.ts[i];
+            if (t < tMin || t > tMax)
+                continue;
+            if (optixu::reportIntersection(t, candidates.hitKinds[i]))
+                return true;
+        }
+        return false;
+    }
+
+    // JP: Closest-Hit, Any-Hitプログラムでのオブジェクト空間のヒット位置。
+    //     オブジェクト空間のレイはワールド空間と同じ距離のパラメターを持つ。
+    // EN: Hit position in object space in closest-hit and any-hit programs.
+    //     The object space ray has the same distance parameter as the world space one.
+    CUDA_DEVICE_FUNCTION float3 getObjectSpaceHitPoint() {
+        return optixGetObjectRayOrigin() + optixGetRayTmax() * optixGetObjectRayDirection();
+    }
+
+    CUDA_DEVICE_FUNCTION bool isFrontFaceHit() {
+        return optixGetHitKind() == HitKind_FrontFace;
+    }
+#endif
+}
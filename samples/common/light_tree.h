@@ -0,0 +1,563 @@
+﻿#pragma once
+
+#include "dynamic_mesh.h"
+
+// JP: 多数の光源(発光三角形や点光源)から重要度に比例して1つを選ぶためのライトツリー。
+//     光源のAABB、パワー、向きのコーン(Conty and Kulla 2018)を持つノードからなるBVHで、
+//     構築はモートンコードのバイトニックソートとKarras (2012)の手法により全てGPU上で行う。
+//     光源が動いた場合はトポロジーを保ったままボトムアップにリフィットするか、作り直す。
+//     ヒット点からの確率的な走査はClosest-Hitなどから呼べる。
+//     ホスト側のBuilderはlight_tree_kernels.cuをPTXにコンパイルしたモジュールを必要とする。
+// EN: Light tree to choose one light proportionally to importance from many lights
+//     (emissive triangles and point lights).
+//     This is a BVH consisting of nodes with AABB, power and orientation cone (Conty and Kulla 2018) of lights,
+//     and is built entirely on the GPU by bitonic sort of Morton codes and Karras (2012)'s method.
+//     When lights move, refit it bottom-up keeping the topology or rebuild it.
+//     Stochastic traversal from a hit point can be called from closest-hit and so on.
+//     Builder on the host requires a module compiled from light_tree_kernels.cu to PTX.
+namespace light_tree {
+    static constexpr uint32_t LeafFlag = 0x80000000;
+    static constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+
+    enum class LightType : uint32_t {
+        Triangle = 0,
+        Point,
+    };
+
+    // JP: 三角形の場合emittanceは放射輝度、点光源の場合は放射強度。点光源はpositions[0]のみを使う。
+    // EN: emittance is radiance for a triangle and intensity for a point light.
+    //     A point light uses only positions[0].
+    struct LightSource {
+        float3 positions[3];
+        float3 emittance;
+        LightType type;
+        uint32_t twoSided;
+    };
+
+    // JP: cosThetaOは放射方向の軸まわりの広がり、cosThetaEはそこからの放射の広がり。
+    // EN: cosThetaO is the spread of emission directions around the axis,
+    //     cosThetaE is the spread of emission from there.
+    struct LightBounds {
+        float3 minP;
+        float3 maxP;
+        float3 axis;
+        float cosThetaO;
+        float cosThetaE;
+        float power;
+    };
+
+    // JP: 子のインデックスはLeafFlagが立っていれば光源のインデックス、そうでなければ内部ノードのインデックス。
+    // EN: A child index is a light index if LeafFlag is set, otherwise an internal node index.
+    struct Node {
+        LightBounds bounds;
+        uint32_t children[2];
+    };
+
+    CUDA_DEVICE_FUNCTION float safeAcos(float v) {
+        return std::acos(fminf(fmaxf(v, -1.0f), 1.0f));
+    }
+
+    CUDA_DEVICE_FUNCTION LightBounds computeLightBounds(const LightSource &light) {
+        constexpr float Pi = 3.14159265358979323846f;
+        LightBounds ret;
+        float lum = 0.2126f * light.emittance.x + 0.7152f * light.emittance.y + 0.0722f * light.emittance.z;
+        if (light.type == LightType::Point) {
+            ret.minP = light.positions[0];
+            ret.maxP = light.positions[0];
+            ret.axis = make_float3(0, 0, 1);
+            ret.cosThetaO = -1.0f;
+            ret.cosThetaE = 0.0f;
+            ret.power = 4 * Pi * lum;
+        }
+        else {
+            const float3 &p0 = light.positions[0];
+            const float3 &p1 = light.positions[1];
+            const float3 &p2 = light.positions[2];
+            ret.minP = min(min(p0, p1), p2);
+            ret.maxP = max(max(p0, p1), p2);
+            float3 n = cross(p1 - p0, p2 - p0);
+            float area = 0.5f * length(n);
+            ret.axis = area > 0.0f ? normalize(n) : make_float3(0, 0, 1);
+            ret.cosThetaO = light.twoSided ? -1.0f : 1.0f;
+            ret.cosThetaE = 0.0f;
+            ret.power = (light.twoSided ? 2 : 1) * Pi * lum * area;
+        }
+        return ret;
+    }
+
+    CUDA_DEVICE_FUNCTION LightBounds unifyLightBounds(const LightBounds &a, const LightBounds &b) {
+        if (a.power <= 0.0f)
+            return b;
+        if (b.power <= 0.0f)
+            return a;
+
+        LightBounds ret;
+        ret.minP = min(a.minP, b.minP);
+        ret.maxP = max(a.maxP, b.maxP);
+        ret.power = a.power + b.power;
+        ret.cosThetaE = fminf(a.cosThetaE, b.cosThetaE);
+
+        // JP: 広い方のコーンを基準に、もう片方を含む最小のコーンを求める。
+        // EN: Find the minimum cone containing the other one based on the wider cone.
+        constexpr float Pi = 3.14159265358979323846f;
+        const LightBounds &wide = a.cosThetaO <= b.cosThetaO ? a : b;
+        const LightBounds &narrow = a.cosThetaO <= b.cosThetaO ? b : a;
+        float thetaW = safeAcos(wide.cosThetaO);
+        float thetaN = safeAcos(narrow.cosThetaO);
+        float thetaD = safeAcos(dot(wide.axis, narrow.axis));
+        if (fminf(thetaD + thetaN, Pi) <= thetaW) {
+            ret.axis = wide.axis;
+            ret.cosThetaO = wide.cosThetaO;
+            return ret;
+        }
+
+        float thetaO = 0.5f * (thetaW + thetaD + thetaN);
+        if (thetaO >= Pi) {
+            ret.axis = wide.axis;
+            ret.cosThetaO = -1.0f;
+            return ret;
+        }
+
+        // JP: 広い方の軸を狭い方の軸に向けてthetaO - thetaWだけ回転する。
+        // EN: Rotate the axis of the wider one toward the axis of the narrower one by thetaO - thetaW.
+        float thetaR = thetaO - thetaW;
+        float3 ortho = narrow.axis - dot(wide.axis, narrow.axis) * wide.axis;
+        if (sqLength(ortho) < 1e-12f) {
+            ret.axis = wide.axis;
+            ret.cosThetaO = -1.0f;
+            return ret;
+        }
+        ret.axis = normalize(std::cos(thetaR) * wide.axis + std::sin(thetaR) * normalize(ortho));
+        ret.cosThetaO = std::cos(thetaO);
+        return ret;
+    }
+
+    // JP: 点pから見た光源群の重要度の推定値。nがゼロベクトルの場合は受光面の向きを考慮しない。
+    // EN: Estimated importance of lights seen from point p.
+    //     The orientation of the receiving surface is not considered when n is a zero vector.
+    CUDA_DEVICE_FUNCTION float evaluateImportance(const LightBounds &bounds, const float3 &p, const float3 &n) {
+        if (bounds.power <= 0.0f)
+            return 0.0f;
+
+        float3 center = 0.5f * (bounds.minP + bounds.maxP);
+        float sqHalfDiag = 0.25f * sqLength(bounds.maxP - bounds.minP);
+        float sqDist = sqLength(p - center);
+        float3 dirToP = sqDist > 0.0f ? (p - center) / std::sqrt(sqDist) : bounds.axis;
+
+        // JP: AABBを包む球がpに対して張る角度。
+        // EN: Angle subtended by the sphere bounding the AABB with respect to p.
+        bool inside =
+            p.x >= bounds.minP.x && p.y >= bounds.minP.y && p.z >= bounds.minP.z &&
+            p.x <= bounds.maxP.x && p.y <= bounds.maxP.y && p.z <= bounds.maxP.z;
+        constexpr float Pi = 3.14159265358979323846f;
+        float thetaB = Pi;
+        if (!inside && sqHalfDiag < sqDist)
+            thetaB = std::asin(std::sqrt(sqHalfDiag / sqDist));
+
+        float thetaW = safeAcos(dot(bounds.axis, dirToP));
+        float thetaO = safeAcos(bounds.cosThetaO);
+        float thetaE = safeAcos(bounds.cosThetaE);
+        float thetaP = fmaxf(thetaW - thetaO - thetaB, 0.0f);
+        if (thetaP >= thetaE)
+            return 0.0f;
+
+        float importance = bounds.power * std::cos(thetaP) / fmaxf(sqDist, fmaxf(sqHalfDiag, 1e-8f));
+        if (sqLength(n) > 0.0f) {
+            float thetaI = safeAcos(std::fabs(dot(-dirToP, n)));
+            importance *= std::cos(fmaxf(thetaI - thetaB, 0.0f));
+        }
+        return importance;
+    }
+
+    struct LightTree {
+        const Node* nodes;
+        const LightBounds* leafBounds;
+        const uint32_t* nodeParents;
+        const uint32_t* leafParents;
+        uint32_t numLights;
+
+        CUDA_DEVICE_FUNCTION const LightBounds &getChildBounds(uint32_t child) const {
+            return (child & LeafFlag) ? leafBounds[child & ~LeafFlag] : nodes[child].bounds;
+        }
+
+        // JP: 内部ノードの0番目の子を選ぶ確率。両方の重要度がゼロの場合は負値を返す。
+        // EN: Probability to choose the 0th child of an internal node.
+        //     Return a negative value when both importances are zero.
+        CUDA_DEVICE_FUNCTION float computeChild0Probability(uint32_t nodeIdx, const float3 &p, const float3 &n) const {
+            const Node &node = nodes[nodeIdx];
+            float imp0 = evaluateImportance(getChildBounds(node.children[0]), p, n);
+            float imp1 = evaluateImportance(getChildBounds(node.children[1]), p, n);
+            float sum = imp0 + imp1;
+            return sum > 0.0f ? imp0 / sum : -1.0f;
+        }
+
+        // JP: 光源のインデックスを返す。選べる光源が無い場合はInvalidIndexを返す。
+        // EN: Return a light index. Return InvalidIndex when there is no light to choose.
+        CUDA_DEVICE_FUNCTION uint32_t sample(const float3 &p, const float3 &n, float u, float* prob) const {
+            *prob = 0.0f;
+            if (numLights == 0)
+                return InvalidIndex;
+            if (numLights == 1) {
+                if (evaluateImportance(leafBounds[0], p, n) <= 0.0f)
+                    return InvalidIndex;
+                *prob = 1.0f;
+                return 0;
+            }
+
+            float curProb = 1.0f;
+            uint32_t nodeIdx = 0;
+            while (true) {
+                float prob0 = computeChild0Probability(nodeIdx, p, n);
+                if (prob0 < 0.0f)
+                    return InvalidIndex;
+                uint32_t child;
+                if (u < prob0) {
+                    child = nodes[nodeIdx].children[0];
+                    u = fminf(u / prob0, 0.99999994f);
+                    curProb *= prob0;
+                }
+                else {
+                    child = nodes[nodeIdx].children[1];
+                    u = fminf((u - prob0) / (1 - prob0), 0.99999994f);
+                    curProb *= 1 - prob0;
+                }
+                if (child & LeafFlag) {
+                    *prob = curProb;
+                    return child & ~LeafFlag;
+                }
+                nodeIdx = child;
+            }
+        }
+
+        // JP: MIS用に、sample()が与えられた光源を選ぶ確率を根への経路を辿って求める。
+        // EN: For MIS, compute the probability that sample() chooses the given light by walking up to the root.
+        CUDA_DEVICE_FUNCTION float evaluateProbability(uint32_t lightIdx, const float3 &p, const float3 &n) const {
+            if (numLights == 1)
+                return evaluateImportance(leafBounds[0], p, n) > 0.0f ? 1.0f : 0.0f;
+
+            float prob = 1.0f;
+            uint32_t child = lightIdx | LeafFlag;
+            uint32_t nodeIdx = leafParents[lightIdx];
+            while (nodeIdx != InvalidIndex) {
+                float prob0 = computeChild0Probability(nodeIdx, p, n);
+                if (prob0 < 0.0f)
+                    return 0.0f;
+                prob *= nodes[nodeIdx].children[0] == child ? prob0 : 1 - prob0;
+                child = nodeIdx;
+                nodeIdx = nodeParents[nodeIdx];
+            }
+            return prob;
+        }
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 葉のバウンドを計算し、centroidBoundsがnullptrでなければ重心のAABBを縮約する。
+    // EN: Compute leaf bounds, and reduce the AABB of centroids when centroidBounds is not nullptr.
+    CUDA_DEVICE_FUNCTION void computeLeafBounds(
+        const LightSource* lights, uint32_t numLights,
+        LightBounds* leafBounds, dynamic_mesh::OrderedAABB* centroidBounds) {
+        cudau::forEachGridStride(numLights, [&](uint32_t lightIdx) {
+            LightBounds bounds = computeLightBounds(lights[lightIdx]);
+            leafBounds[lightIdx] = bounds;
+            if (!centroidBounds)
+                return;
+            float3 c = 0.5f * (bounds.minP + bounds.maxP);
+            atomicMin(&centroidBounds->minP[0], dynamic_mesh::floatToOrderedUint(c.x));
+            atomicMin(&centroidBounds->minP[1], dynamic_mesh::floatToOrderedUint(c.y));
+            atomicMin(&centroidBounds->minP[2], dynamic_mesh::floatToOrderedUint(c.z));
+            atomicMax(&centroidBounds->maxP[0], dynamic_mesh::floatToOrderedUint(c.x));
+            atomicMax(&centroidBounds->maxP[1], dynamic_mesh::floatToOrderedUint(c.y));
+            atomicMax(&centroidBounds->maxP[2], dynamic_mesh::floatToOrderedUint(c.z));
+        });
+    }
+
+    CUDA_DEVICE_FUNCTION uint32_t expandBits(uint32_t v) {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // JP: ソートのために要素数を2の冪に切り上げ、余った要素には最大のコードを入れる。
+    // EN: Round up the number of elements to a power of two for sorting and fill the rest with the maximum code.
+    CUDA_DEVICE_FUNCTION void computeMortonCodes(
+        const LightBounds* leafBounds, uint32_t numLights, uint32_t numPaddedLights,
+        const dynamic_mesh::OrderedAABB* centroidBounds,
+        uint32_t* mortonCodes, uint32_t* sortedIndices) {
+        AABB cb = centroidBounds->toAABB();
+        float3 extent = cb.maxP - cb.minP;
+        cudau::forEachGridStride(numPaddedLights, [&](uint32_t idx) {
+            if (idx >= numLights) {
+                mortonCodes[idx] = 0xFFFFFFFF;
+                sortedIndices[idx] = InvalidIndex;
+                return;
+            }
+            const LightBounds &bounds = leafBounds[idx];
+            float3 c = 0.5f * (bounds.minP + bounds.maxP) - cb.minP;
+            float3 nc = make_float3(extent.x > 0 ? c.x / extent.x : 0.5f,
+                                    extent.y > 0 ? c.y / extent.y : 0.5f,
+                                    extent.z > 0 ? c.z / extent.z : 0.5f);
+            uint32_t x = min(static_cast<uint32_t>(fmaxf(nc.x * 1024, 0.0f)), 1023u);
+            uint32_t y = min(static_cast<uint32_t>(fmaxf(nc.y * 1024, 0.0f)), 1023u);
+            uint32_t z = min(static_cast<uint32_t>(fmaxf(nc.z * 1024, 0.0f)), 1023u);
+            mortonCodes[idx] = (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+            sortedIndices[idx] = idx;
+        });
+    }
+
+    // JP: バイトニックソートの1ステップ。ホスト側でk, jを変えながら繰り返しローンチする。
+    // EN: A step of bitonic sort. Launched repeatedly from the host while changing k and j.
+    CUDA_DEVICE_FUNCTION void bitonicSortStep(
+        uint32_t* mortonCodes, uint32_t* sortedIndices, uint32_t numPaddedLights, uint32_t k, uint32_t j) {
+        cudau::forEachGridStride(numPaddedLights, [&](uint32_t idx) {
+            uint32_t partner = idx ^ j;
+            if (partner <= idx)
+                return;
+            bool ascending = (idx & k) == 0;
+            uint32_t codeA = mortonCodes[idx];
+            uint32_t codeB = mortonCodes[partner];
+            if ((codeA > codeB) == ascending) {
+                mortonCodes[idx] = codeB;
+                mortonCodes[partner] = codeA;
+                uint32_t tmp = sortedIndices[idx];
+                sortedIndices[idx] = sortedIndices[partner];
+                sortedIndices[partner] = tmp;
+            }
+        });
+    }
+
+    // JP: 同じコードはインデックスで区別する。
+    // EN: Distinguish the same codes by indices.
+    CUDA_DEVICE_FUNCTION int32_t commonPrefixLength(const uint32_t* mortonCodes, uint32_t numLights,
+                                                    int32_t i, int32_t j) {
+        if (j < 0 || j >= static_cast<int32_t>(numLights))
+            return -1;
+        uint32_t codeI = mortonCodes[i];
+        uint32_t codeJ = mortonCodes[j];
+        if (codeI == codeJ)
+            return 32 + __clz(static_cast<uint32_t>(i ^ j));
+        return __clz(codeI ^ codeJ);
+    }
+
+    // JP: Karras (2012)の手法でソート済みのコードから内部ノードを並列に作る。光源は2つ以上である必要がある。
+    // EN: Create internal nodes in parallel from sorted codes by Karras (2012)'s method.
+    //     There need to be at least two lights.
+    CUDA_DEVICE_FUNCTION void buildHierarchy(
+        const uint32_t* mortonCodes, const uint32_t* sortedIndices, uint32_t numLights,
+        Node* nodes, uint32_t* nodeParents, uint32_t* leafParents) {
+        cudau::forEachGridStride(numLights - 1, [&](uint32_t nodeIdx) {
+            int32_t i = static_cast<int32_t>(nodeIdx);
+            int32_t d = commonPrefixLength(mortonCodes, numLights, i, i + 1) >
+                commonPrefixLength(mortonCodes, numLights, i, i - 1) ? 1 : -1;
+
+            // JP: 範囲のもう一端を求める。
+            // EN: Find the other end of the range.
+            int32_t minPrefix = commonPrefixLength(mortonCodes, numLights, i, i - d);
+            int32_t maxLength = 2;
+            while (commonPrefixLength(mortonCodes, numLights, i, i + maxLength * d) > minPrefix)
+                maxLength *= 2;
+            int32_t length = 0;
+            for (int32_t t = maxLength / 2; t >= 1; t /= 2) {
+                if (commonPrefixLength(mortonCodes, numLights, i, i + (length + t) * d) > minPrefix)
+                    length += t;
+            }
+            int32_t j = i + length * d;
+
+            // JP: 分割位置を求める。
+            // EN: Find the split position.
+            int32_t nodePrefix = commonPrefixLength(mortonCodes, numLights, i, j);
+            int32_t split = 0;
+            for (int32_t div = 2; ; div *= 2) {
+                int32_t t = (length + div - 1) / div;
+                if (commonPrefixLength(mortonCodes, numLights, i, i + (split + t) * d) > nodePrefix)
+                    split += t;
+                if (t == 1)
+                    break;
+            }
+            int32_t gamma = i + split * d + ::min(d, 0);
+
+            Node &node = nodes[nodeIdx];
+            uint32_t children[2] = {
+                static_cast<uint32_t>(gamma),
+                static_cast<uint32_t>(gamma + 1)
+            };
+            bool childIsLeaf[2] = {
+                ::min(i, j) == gamma,
+                ::max(i, j) == gamma + 1
+            };
+            for (int c = 0; c < 2; ++c) {
+                if (childIsLeaf[c]) {
+                    uint32_t lightIdx = sortedIndices[children[c]];
+                    node.children[c] = lightIdx | LeafFlag;
+                    leafParents[lightIdx] = nodeIdx;
+                }
+                else {
+                    node.children[c] = children[c];
+                    nodeParents[children[c]] = nodeIdx;
+                }
+            }
+            if (nodeIdx == 0)
+                nodeParents[0] = InvalidIndex;
+        });
+    }
+
+    // JP: 葉から根に向かってバウンドを統合する。2番目に到達したスレッドだけが親に進む。
+    //     refitCountersは事前にゼロで初期化する必要がある。
+    // EN: Unify bounds from leaves toward the root. Only the thread arriving second proceeds to the parent.
+    //     refitCounters needs to be initialized with zero beforehand.
+    CUDA_DEVICE_FUNCTION void refitNodes(
+        const LightBounds* leafBounds, uint32_t numLights,
+        Node* nodes, const uint32_t* nodeParents, const uint32_t* leafParents, uint32_t* refitCounters) {
+        cudau::forEachGridStride(numLights, [&](uint32_t lightIdx) {
+            uint32_t nodeIdx = leafParents[lightIdx];
+            while (nodeIdx != InvalidIndex) {
+                __threadfence();
+                if (atomicAdd(&refitCounters[nodeIdx], 1u) == 0)
+                    return;
+
+                Node &node = nodes[nodeIdx];
+                const uint32_t c0 = node.children[0];
+                const uint32_t c1 = node.children[1];
+                const LightBounds &b0 = (c0 & LeafFlag) ? leafBounds[c0 & ~LeafFlag] : nodes[c0].bounds;
+                const LightBounds &b1 = (c1 & LeafFlag) ? leafBounds[c1 & ~LeafFlag] : nodes[c1].bounds;
+                node.bounds = unifyLightBounds(b0, b1);
+                nodeIdx = nodeParents[nodeIdx];
+            }
+        });
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ライトツリーのバッファーを保持し、light_tree_kernels.cuのカーネルで構築、リフィットする。
+    //     光源の配列はユーザーが(例えば発光するGeometryInstanceの三角形から)デバイス上で用意する。
+    // EN: Hold buffers of a light tree and build or refit it with kernels of light_tree_kernels.cu.
+    //     The light array is prepared by the user on the device (e.g. from triangles of emissive GeometryInstances).
+    class Builder {
+        cudau::Kernel m_computeLeafBounds;
+        cudau::Kernel m_computeMortonCodes;
+        cudau::Kernel m_bitonicSortStep;
+        cudau::Kernel m_buildHierarchy;
+        cudau::Kernel m_refitNodes;
+
+        cudau::TypedBuffer<LightBounds> m_leafBounds;
+        cudau::TypedBuffer<Node> m_nodes;
+        cudau::TypedBuffer<uint32_t> m_nodeParents;
+        cudau::TypedBuffer<uint32_t> m_leafParents;
+        cudau::TypedBuffer<uint32_t> m_mortonCodes;
+        cudau::TypedBuffer<uint32_t> m_sortedIndices;
+        cudau::TypedBuffer<uint32_t> m_refitCounters;
+        cudau::TypedBuffer<dynamic_mesh::OrderedAABB> m_centroidBounds;
+        uint32_t m_maxNumLights;
+        uint32_t m_numLights;
+
+        static uint32_t nextPowerOf2(uint32_t v) {
+            uint32_t ret = 1;
+            while (ret < v)
+                ret <<= 1;
+            return ret;
+        }
+
+    public:
+        Builder() : m_maxNumLights(0), m_numLights(0) {}
+
+        void initialize(CUcontext cuContext, CUmodule lightTreeModule, cudau::BufferType type,
+                        uint32_t maxNumLights) {
+            m_computeLeafBounds.set(lightTreeModule, "computeLeafBounds", cudau::AutoBlockDim(), 0);
+            m_computeMortonCodes.set(lightTreeModule, "computeMortonCodes", cudau::AutoBlockDim(), 0);
+            m_bitonicSortStep.set(lightTreeModule, "bitonicSortStep", cudau::AutoBlockDim(), 0);
+            m_buildHierarchy.set(lightTreeModule, "buildHierarchy", cudau::AutoBlockDim(), 0);
+            m_refitNodes.set(lightTreeModule, "refitNodes", cudau::AutoBlockDim(), 0);
+
+            m_maxNumLights = std::max(maxNumLights, 1u);
+            uint32_t numPadded = nextPowerOf2(m_maxNumLights);
+            m_leafBounds.initialize(cuContext, type, m_maxNumLights);
+            m_nodes.initialize(cuContext, type, std::max(m_maxNumLights - 1, 1u));
+            m_nodeParents.initialize(cuContext, type, std::max(m_maxNumLights - 1, 1u));
+            m_leafParents.initialize(cuContext, type, m_maxNumLights);
+            m_mortonCodes.initialize(cuContext, type, numPadded);
+            m_sortedIndices.initialize(cuContext, type, numPadded);
+            m_refitCounters.initialize(cuContext, type, std::max(m_maxNumLights - 1, 1u));
+            m_centroidBounds.initialize(cuContext, type, 1);
+        }
+        void finalize() {
+            m_centroidBounds.finalize();
+            m_refitCounters.finalize();
+            m_sortedIndices.finalize();
+            m_mortonCodes.finalize();
+            m_leafParents.finalize();
+            m_nodeParents.finalize();
+            m_nodes.finalize();
+            m_leafBounds.finalize();
+            m_maxNumLights = 0;
+            m_numLights = 0;
+        }
+
+        // JP: トポロジーを作り直す。光源の数や分布が大きく変わった場合に使う。
+        // EN: Rebuild the topology. Use this when the number or distribution of lights changes significantly.
+        void build(CUstream stream, const LightSource* lights, uint32_t numLights) {
+            if (numLights > m_maxNumLights)
+                throw std::runtime_error("The number of lights exceeds the maximum.");
+            m_numLights = numLights;
+            if (numLights == 0)
+                return;
+
+            const dynamic_mesh::OrderedAABB emptyAabb = dynamic_mesh::OrderedAABB::empty();
+            m_centroidBounds.write(&emptyAabb, 1, stream);
+            m_computeLeafBounds.launchPersistent(stream, lights, numLights,
+                                                 m_leafBounds.getDevicePointer(),
+                                                 m_centroidBounds.getDevicePointer());
+            if (numLights == 1)
+                return;
+
+            uint32_t numPadded = nextPowerOf2(numLights);
+            m_computeMortonCodes.launchPersistent(stream, m_leafBounds.getDevicePointer(), numLights, numPadded,
+                                                  m_centroidBounds.getDevicePointer(),
+                                                  m_mortonCodes.getDevicePointer(),
+                                                  m_sortedIndices.getDevicePointer());
+            for (uint32_t k = 2; k <= numPadded; k <<= 1) {
+                for (uint32_t j = k >> 1; j > 0; j >>= 1) {
+                    m_bitonicSortStep.launchPersistent(stream, m_mortonCodes.getDevicePointer(),
+                                                       m_sortedIndices.getDevicePointer(), numPadded, k, j);
+                }
+            }
+            m_buildHierarchy.launchPersistent(stream, m_mortonCodes.getDevicePointer(),
+                                              m_sortedIndices.getDevicePointer(), numLights,
+                                              m_nodes.getDevicePointer(), m_nodeParents.getDevicePointer(),
+                                              m_leafParents.getDevicePointer());
+            refitNodes(stream);
+        }
+        // JP: トポロジーを保ったまま光源の移動や明るさの変化に追従する。光源の数は変えられない。
+        // EN: Follow moves or brightness changes of lights keeping the topology.
+        //     The number of lights cannot be changed.
+        void refit(CUstream stream, const LightSource* lights) {
+            if (m_numLights == 0)
+                return;
+            m_computeLeafBounds.launchPersistent(stream, lights, m_numLights,
+                                                 m_leafBounds.getDevicePointer(),
+                                                 static_cast<dynamic_mesh::OrderedAABB*>(nullptr));
+            if (m_numLights == 1)
+                return;
+            refitNodes(stream);
+        }
+
+        LightTree getDeviceView() const {
+            LightTree ret;
+            ret.nodes = m_nodes.getDevicePointer();
+            ret.leafBounds = m_leafBounds.getDevicePointer();
+            ret.nodeParents = m_nodeParents.getDevicePointer();
+            ret.leafParents = m_leafParents.getDevicePointer();
+            ret.numLights = m_numLights;
+            return ret;
+        }
+
+    private:
+        void refitNodes(CUstream stream) {
+            CUDADRV_CHECK(cuMemsetD32Async(m_refitCounters.getCUdeviceptr(), 0, m_numLights - 1, stream));
+            m_refitNodes.launchPersistent(stream, m_leafBounds.getDevicePointer(), m_numLights,
+                                          m_nodes.getDevicePointer(), m_nodeParents.getDevicePointer(),
+                                          m_leafParents.getDevicePointer(), m_refitCounters.getDevicePointer());
+        }
+    };
+#endif
+}
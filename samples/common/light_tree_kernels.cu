@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "light_tree.h"
+
+// JP: light_tree::Builderが使うカーネル。ライトツリーを使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernels used by light_tree::Builder. A sample using the light tree compiles this file to PTX as well.
+
+CUDA_DEVICE_KERNEL void computeLeafBounds(
+    const light_tree::LightSource* lights, uint32_t numLights,
+    light_tree::LightBounds* leafBounds, dynamic_mesh::OrderedAABB* centroidBounds) {
+    light_tree::computeLeafBounds(lights, numLights, leafBounds, centroidBounds);
+}
+
+CUDA_DEVICE_KERNEL void computeMortonCodes(
+    const light_tree::LightBounds* leafBounds, uint32_t numLights, uint32_t numPaddedLights,
+    const dynamic_mesh::OrderedAABB* centroidBounds,
+    uint32_t* mortonCodes, uint32_t* sortedIndices) {
+    light_tree::computeMortonCodes(leafBounds, numLights, numPaddedLights, centroidBounds,
+                                   mortonCodes, sortedIndices);
+}
+
+CUDA_DEVICE_KERNEL void bitonicSortStep(
+    uint32_t* mortonCodes, uint32_t* sortedIndices, uint32_t numPaddedLights, uint32_t k, uint32_t j) {
+    light_tree::bitonicSortStep(mortonCodes, sortedIndices, numPaddedLights, k, j);
+}
+
+CUDA_DEVICE_KERNEL void buildHierarchy(
+    const uint32_t* mortonCodes, const uint32_t* sortedIndices, uint32_t numLights,
+    light_tree::Node* nodes, uint32_t* nodeParents, uint32_t* leafParents) {
+    light_tree::buildHierarchy(mortonCodes, sortedIndices, numLights, nodes, nodeParents, leafParents);
+}
+
+CUDA_DEVICE_KERNEL void refitNodes(
+    const light_tree::LightBounds* leafBounds, uint32_t numLights,
+    light_tree::Node* nodes, const uint32_t* nodeParents, const uint32_t* leafParents,
+    uint32_t* refitCounters) {
+    light_tree::refitNodes(leafBounds, numLights, nodes, nodeParents, leafParents, refitCounters);
+}
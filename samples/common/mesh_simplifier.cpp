@@ -0,0 +1,419 @@
+﻿#include "mesh_simplifier.h"
+#include <atomic>
+#include <queue>
+
+namespace mesh_simplifier {
+    namespace {
+        // JP: 対称な4x4行列を上三角の10要素で保持する二次誤差。
+        // EN: Quadric error holding a symmetric 4x4 matrix as 10 elements of the upper triangle.
+        struct Quadric {
+            double a00, a01, a02, a03;
+            double a11, a12, a13;
+            double a22, a23;
+            double a33;
+
+            void addPlane(double nx, double ny, double nz, double d, double weight) {
+                a00 += weight * nx * nx; a01 += weight * nx * ny; a02 += weight * nx * nz; a03 += weight * nx * d;
+                a11 += weight * ny * ny; a12 += weight * ny * nz; a13 += weight * ny * d;
+                a22 += weight * nz * nz; a23 += weight * nz * d;
+                a33 += weight * d * d;
+            }
+            Quadric &operator+=(const Quadric &q) {
+                a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+                a11 += q.a11; a12 += q.a12; a13 += q.a13;
+                a22 += q.a22; a23 += q.a23;
+                a33 += q.a33;
+                return *this;
+            }
+            double evaluate(const float3 &p) const {
+                const double x = p.x, y = p.y, z = p.z;
+                const double e =
+                    a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+                    a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                    a22 * z * z + 2 * a23 * z +
+                    a33;
+                return std::max(e, 0.0);
+            }
+        };
+
+        struct Collapse {
+            double cost;
+            uint32_t src;
+            uint32_t dst;
+            uint32_t srcVersion;
+            uint32_t dstVersion;
+
+            bool operator>(const Collapse &r) const {
+                return cost > r.cost;
+            }
+        };
+
+        // JP: 境界の辺を保つための、辺を含み面に垂直な平面の重み。
+        // EN: Weight of planes containing boundary edges and perpendicular to faces to preserve boundaries.
+        constexpr double boundaryWeight = 10.0;
+        // JP: 縮約後の法線と元の法線のなす角の余弦の下限。
+        // EN: Lower limit of the cosine of the angle between the normal after a collapse and the original normal.
+        constexpr float minNormalCosine = 0.2f;
+
+        class Simplifier {
+            std::vector<float3> m_positions;
+            std::vector<uint3> m_triangles;
+            std::vector<uint8_t> m_triangleAlive;
+            std::vector<std::vector<uint32_t>> m_vertexTriangles;
+            std::vector<Quadric> m_quadrics;
+            std::vector<uint32_t> m_versions;
+            std::vector<uint8_t> m_vertexAlive;
+            std::vector<uint8_t> m_locked;
+            std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> m_queue;
+            std::vector<uint32_t> m_srcNeighbors;
+            std::vector<uint32_t> m_dstNeighbors;
+            uint32_t m_numAliveTriangles;
+            float m_diagonal;
+            double m_maxCost;
+            double m_maxAppliedCost;
+
+            static uint32_t getVertex(const uint3 &tri, uint32_t i) {
+                return i == 0 ? tri.x : (i == 1 ? tri.y : tri.z);
+            }
+            static bool contains(const uint3 &tri, uint32_t v) {
+                return tri.x == v || tri.y == v || tri.z == v;
+            }
+
+            float3 calcTriangleNormal(const uint3 &tri) const {
+                const float3 &p0 = m_positions[tri.x];
+                const float3 &p1 = m_positions[tri.y];
+                const float3 &p2 = m_positions[tri.z];
+                return cross(p1 - p0, p2 - p0);
+            }
+
+            void collectNeighbors(uint32_t v, std::vector<uint32_t>* neighbors) const {
+                neighbors->clear();
+                for (uint32_t triIdx : m_vertexTriangles[v]) {
+                    if (!m_triangleAlive[triIdx])
+                        continue;
+                    const uint3 &tri = m_triangles[triIdx];
+                    for (uint32_t i = 0; i < 3; ++i) {
+                        const uint32_t n = getVertex(tri, i);
+                        if (n != v)
+                            neighbors->push_back(n);
+                    }
+                }
+                std::sort(neighbors->begin(), neighbors->end());
+                neighbors->erase(std::unique(neighbors->begin(), neighbors->end()), neighbors->end());
+            }
+
+            double calcCost(uint32_t src, uint32_t dst) const {
+                if (m_locked[src])
+                    return INFINITY;
+                Quadric q = m_quadrics[src];
+                q += m_quadrics[dst];
+                return q.evaluate(m_positions[dst]);
+            }
+
+            void pushEdge(uint32_t u, uint32_t v) {
+                const double costUV = calcCost(u, v);
+                const double costVU = calcCost(v, u);
+                Collapse c;
+                c.cost = std::min(costUV, costVU);
+                c.src = costUV <= costVU ? u : v;
+                c.dst = costUV <= costVU ? v : u;
+                if (!std::isfinite(c.cost) || c.cost > m_maxCost)
+                    return;
+                c.srcVersion = m_versions[c.src];
+                c.dstVersion = m_versions[c.dst];
+                m_queue.push(c);
+            }
+
+            // JP: リンク条件(共通の隣接頂点の数が辺を挟む三角形の数と等しいこと)で非多様体化を防ぎ、
+            //     法線が大きく変わる三角形があれば裏返りとして縮約を拒否する。
+            // EN: Prevent non-manifold results by the link condition (the number of common neighbors equals
+            //     the number of triangles sharing the edge), and reject the collapse as a foldover
+            //     if there is a triangle whose normal changes significantly.
+            bool isValidCollapse(uint32_t src, uint32_t dst) {
+                uint32_t numSharedTriangles = 0;
+                for (uint32_t triIdx : m_vertexTriangles[src]) {
+                    if (m_triangleAlive[triIdx] && contains(m_triangles[triIdx], dst))
+                        ++numSharedTriangles;
+                }
+                if (numSharedTriangles == 0)
+                    return false;
+
+                collectNeighbors(src, &m_srcNeighbors);
+                collectNeighbors(dst, &m_dstNeighbors);
+                uint32_t numCommonNeighbors = 0;
+                for (auto itS = m_srcNeighbors.cbegin(), itD = m_dstNeighbors.cbegin();
+                     itS != m_srcNeighbors.cend() && itD != m_dstNeighbors.cend();) {
+                    if (*itS < *itD) {
+                        ++itS;
+                    }
+                    else if (*itD < *itS) {
+                        ++itD;
+                    }
+                    else {
+                        ++numCommonNeighbors;
+                        ++itS;
+                        ++itD;
+                    }
+                }
+                if (numCommonNeighbors != numSharedTriangles)
+                    return false;
+
+                for (uint32_t triIdx : m_vertexTriangles[src]) {
+                    if (!m_triangleAlive[triIdx])
+                        continue;
+                    const uint3 &tri = m_triangles[triIdx];
+                    if (contains(tri, dst))
+                        continue;
+                    const float3 oldNormal = calcTriangleNormal(tri);
+                    uint3 newTri = tri;
+                    if (newTri.x == src) newTri.x = dst;
+                    if (newTri.y == src) newTri.y = dst;
+                    if (newTri.z == src) newTri.z = dst;
+                    const float3 newNormal = calcTriangleNormal(newTri);
+                    const float oldLength = length(oldNormal);
+                    const float newLength = length(newNormal);
+                    if (newLength == 0.0f ||
+                        dot(oldNormal, newNormal) < minNormalCosine * oldLength * newLength)
+                        return false;
+                }
+                return true;
+            }
+
+            void collapse(uint32_t src, uint32_t dst) {
+                for (uint32_t triIdx : m_vertexTriangles[src]) {
+                    if (!m_triangleAlive[triIdx])
+                        continue;
+                    uint3 &tri = m_triangles[triIdx];
+                    if (contains(tri, dst)) {
+                        m_triangleAlive[triIdx] = false;
+                        --m_numAliveTriangles;
+                        continue;
+                    }
+                    if (tri.x == src) tri.x = dst;
+                    if (tri.y == src) tri.y = dst;
+                    if (tri.z == src) tri.z = dst;
+                    m_vertexTriangles[dst].push_back(triIdx);
+                }
+                m_vertexTriangles[src].clear();
+                m_vertexTriangles[src].shrink_to_fit();
+                m_vertexAlive[src] = false;
+                m_quadrics[dst] += m_quadrics[src];
+                ++m_versions[dst];
+
+                std::vector<uint32_t> &dstTris = m_vertexTriangles[dst];
+                dstTris.erase(std::remove_if(dstTris.begin(), dstTris.end(),
+                                             [this](uint32_t triIdx) { return !m_triangleAlive[triIdx]; }),
+                              dstTris.end());
+
+                // JP: dstの二次誤差が変わったので、dstに接続する辺だけを評価し直す。
+                // EN: The quadric of dst changed, so re-evaluate only the edges connected to dst.
+                collectNeighbors(dst, &m_dstNeighbors);
+                for (uint32_t n : m_dstNeighbors)
+                    pushEdge(dst, n);
+            }
+
+        public:
+            Simplifier(const MeshPositions &mesh, float maxRelativeError) :
+                m_numAliveTriangles(0), m_diagonal(0.0f), m_maxCost(0), m_maxAppliedCost(0) {
+                m_positions.resize(mesh.numVertices);
+                AABB aabb;
+                for (uint32_t vIdx = 0; vIdx < mesh.numVertices; ++vIdx) {
+                    m_positions[vIdx] = *reinterpret_cast<const float3*>(
+                        reinterpret_cast<const uint8_t*>(mesh.positions) +
+                        static_cast<size_t>(mesh.positionStride) * vIdx);
+                    aabb.unify(m_positions[vIdx]);
+                }
+                m_diagonal = mesh.numVertices > 0 ? length(aabb.maxP - aabb.minP) : 0.0f;
+                const double maxError = static_cast<double>(maxRelativeError) * m_diagonal;
+                m_maxCost = maxError * maxError;
+
+                m_triangles.assign(mesh.triangles, mesh.triangles + mesh.numTriangles);
+                m_triangleAlive.resize(mesh.numTriangles);
+                m_vertexTriangles.resize(mesh.numVertices);
+                m_quadrics.resize(mesh.numVertices, Quadric{});
+                m_versions.resize(mesh.numVertices, 0);
+                m_vertexAlive.resize(mesh.numVertices, true);
+                m_locked.resize(mesh.numVertices, false);
+
+                // JP: 同じ位置を持つ頂点が複数ある場合はシームとして固定する。
+                // EN: Lock vertices as seams when multiple vertices have the same position.
+                {
+                    std::vector<uint32_t> order(mesh.numVertices);
+                    for (uint32_t vIdx = 0; vIdx < mesh.numVertices; ++vIdx)
+                        order[vIdx] = vIdx;
+                    const auto lessPos = [this](uint32_t a, uint32_t b) {
+                        const float3 &pa = m_positions[a];
+                        const float3 &pb = m_positions[b];
+                        if (pa.x != pb.x)
+                            return pa.x < pb.x;
+                        if (pa.y != pb.y)
+                            return pa.y < pb.y;
+                        return pa.z < pb.z;
+                    };
+                    std::sort(order.begin(), order.end(), lessPos);
+                    for (uint32_t i = 1; i < mesh.numVertices; ++i) {
+                        if (!lessPos(order[i - 1], order[i])) {
+                            m_locked[order[i - 1]] = true;
+                            m_locked[order[i]] = true;
+                        }
+                    }
+                }
+
+                std::vector<uint64_t> edges;
+                edges.reserve(3 * static_cast<size_t>(mesh.numTriangles));
+                for (uint32_t triIdx = 0; triIdx < mesh.numTriangles; ++triIdx) {
+                    const uint3 &tri = m_triangles[triIdx];
+                    if (tri.x >= mesh.numVertices || tri.y >= mesh.numVertices || tri.z >= mesh.numVertices)
+                        throw std::runtime_error("Vertex index is out of range.");
+                    if (tri.x == tri.y || tri.y == tri.z || tri.z == tri.x)
+                        continue;
+                    m_triangleAlive[triIdx] = true;
+                    ++m_numAliveTriangles;
+
+                    float3 n = calcTriangleNormal(tri);
+                    const float area2 = length(n);
+                    if (area2 > 0.0f)
+                        n = n / area2;
+                    Quadric q = {};
+                    q.addPlane(n.x, n.y, n.z, -dot(n, m_positions[tri.x]), 0.5 * area2);
+                    for (uint32_t i = 0; i < 3; ++i) {
+                        const uint32_t v = getVertex(tri, i);
+                        m_quadrics[v] += q;
+                        m_vertexTriangles[v].push_back(triIdx);
+                        const uint32_t w = getVertex(tri, (i + 1) % 3);
+                        edges.push_back((static_cast<uint64_t>(v) << 32) | w);
+                    }
+                }
+
+                // JP: 逆向きの辺が存在しない辺は境界とみなし、面に垂直な平面で動きを抑える。
+                // EN: Regard edges without the opposite edge as boundaries,
+                //     and restrict movement with planes perpendicular to faces.
+                std::sort(edges.begin(), edges.end());
+                for (uint32_t triIdx = 0; triIdx < mesh.numTriangles; ++triIdx) {
+                    if (!m_triangleAlive[triIdx])
+                        continue;
+                    const uint3 &tri = m_triangles[triIdx];
+                    float3 faceNormal = calcTriangleNormal(tri);
+                    if (length(faceNormal) == 0.0f)
+                        continue;
+                    faceNormal = normalize(faceNormal);
+                    for (uint32_t i = 0; i < 3; ++i) {
+                        const uint32_t v = getVertex(tri, i);
+                        const uint32_t w = getVertex(tri, (i + 1) % 3);
+                        const uint64_t opposite = (static_cast<uint64_t>(w) << 32) | v;
+                        if (std::binary_search(edges.cbegin(), edges.cend(), opposite))
+                            continue;
+                        const float3 e = m_positions[w] - m_positions[v];
+                        const float edgeLength = length(e);
+                        if (edgeLength == 0.0f)
+                            continue;
+                        const float3 n = normalize(cross(e, faceNormal));
+                        Quadric q = {};
+                        q.addPlane(n.x, n.y, n.z, -dot(n, m_positions[v]),
+                                   boundaryWeight * edgeLength * edgeLength);
+                        m_quadrics[v] += q;
+                        m_quadrics[w] += q;
+                    }
+                }
+
+                for (uint64_t edge : edges) {
+                    const uint32_t v = static_cast<uint32_t>(edge >> 32);
+                    const uint32_t w = static_cast<uint32_t>(edge);
+                    // JP: 両方向の辺は小さい方から一度だけ登録する。
+                    // EN: Register edges in both directions only once from the smaller one.
+                    const uint64_t opposite = (static_cast<uint64_t>(w) << 32) | v;
+                    if (v > w && std::binary_search(edges.cbegin(), edges.cend(), opposite))
+                        continue;
+                    pushEdge(v, w);
+                }
+            }
+
+            void simplify(uint32_t targetNumTriangles) {
+                while (m_numAliveTriangles > targetNumTriangles && !m_queue.empty()) {
+                    const Collapse c = m_queue.top();
+                    m_queue.pop();
+                    if (!m_vertexAlive[c.src] || !m_vertexAlive[c.dst] ||
+                        m_versions[c.src] != c.srcVersion || m_versions[c.dst] != c.dstVersion)
+                        continue;
+                    if (!isValidCollapse(c.src, c.dst))
+                        continue;
+                    collapse(c.src, c.dst);
+                    m_maxAppliedCost = std::max(m_maxAppliedCost, c.cost);
+                }
+            }
+
+            void getResult(SimplifiedLevel* level) const {
+                level->triangles.clear();
+                level->triangles.reserve(m_numAliveTriangles);
+                for (size_t triIdx = 0; triIdx < m_triangles.size(); ++triIdx) {
+                    if (m_triangleAlive[triIdx])
+                        level->triangles.push_back(m_triangles[triIdx]);
+                }
+                level->error = m_diagonal > 0.0f ?
+                    static_cast<float>(std::sqrt(m_maxAppliedCost) / m_diagonal) : 0.0f;
+            }
+        };
+    }
+
+
+
+    void simplifyChain(const MeshPositions &mesh, const float* targetRatios, uint32_t numLevels,
+                       float maxRelativeError, std::vector<SimplifiedLevel>* levels) {
+        for (uint32_t level = 0; level < numLevels; ++level) {
+            if (!(targetRatios[level] > 0.0f && targetRatios[level] <= 1.0f))
+                throw std::runtime_error("Target ratios must be in (0, 1].");
+            if (level > 0 && targetRatios[level] > targetRatios[level - 1])
+                throw std::runtime_error("Target ratios must be in descending order.");
+        }
+
+        Simplifier simplifier(mesh, maxRelativeError);
+        levels->resize(numLevels);
+        for (uint32_t level = 0; level < numLevels; ++level) {
+            const uint32_t targetNumTriangles =
+                static_cast<uint32_t>(std::round(mesh.numTriangles * targetRatios[level]));
+            simplifier.simplify(targetNumTriangles);
+            simplifier.getResult(&(*levels)[level]);
+        }
+    }
+
+    void simplifyChains(const MeshPositions* meshes, uint32_t numMeshes,
+                        const float* targetRatios, uint32_t numLevels, float maxRelativeError,
+                        std::vector<std::vector<SimplifiedLevel>>* levelsPerMesh, uint32_t numThreads) {
+        levelsPerMesh->resize(numMeshes);
+        if (numThreads == 0)
+            numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        numThreads = std::min(numThreads, numMeshes);
+
+        // JP: メッシュの大きさはまちまちなので、スレッドはアトミックなカウンターから次のメッシュを取る。
+        //     例外は最初のものを保存して呼び出し側のスレッドで投げ直す。
+        // EN: Mesh sizes vary, so threads take the next mesh from an atomic counter.
+        //     Store the first exception and rethrow it on the caller's thread.
+        std::atomic<uint32_t> nextMeshIndex(0);
+        std::exception_ptr firstException;
+        std::mutex exceptionMutex;
+        const auto work = [&]() {
+            while (true) {
+                const uint32_t meshIdx = nextMeshIndex++;
+                if (meshIdx >= numMeshes)
+                    break;
+                try {
+                    simplifyChain(meshes[meshIdx], targetRatios, numLevels, maxRelativeError,
+                                  &(*levelsPerMesh)[meshIdx]);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(exceptionMutex);
+                    if (!firstException)
+                        firstException = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < numThreads; ++i)
+            threads.emplace_back(work);
+        work();
+        for (std::thread &thread : threads)
+            thread.join();
+        if (firstException)
+            std::rethrow_exception(firstException);
+    }
+}
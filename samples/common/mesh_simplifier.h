@@ -0,0 +1,180 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 二次誤差計量(QEM)による辺の縮約でメッシュを簡略化し、GASのLODチェーンを生成するユーティリティー。
+//     各GeometryInstanceについて目標の三角形数の割合ごとにインデックスと頂点のバッファーを作り、
+//     optixu::HostGeometryPoolに範囲として格納して、レベルごとにコンパクション付きのGASを
+//     optixu::GASBuildSchedulerでビルドする。簡略化はメッシュ単位でCPUのスレッドに並列に割り振る。
+//     縮約は既存の頂点への片側縮約なので、頂点の属性(法線やテクスチャー座標)はそのまま使える。
+//     同じ位置に複数の頂点があるテクスチャーのシームや法線の不連続点は動かさない。
+//     LODの選択はoptixu::selectLevelOfDetail()などでインスタンスごとにGASを切り替えて行う。
+//
+//     std::vector<mesh_simplifier::MeshDesc<obj::Vertex>> meshes; // obj::load()の結果からメッシュごとに作る
+//     const float targetRatios[] = { 1.0f, 0.25f, 0.0625f };
+//     std::vector<mesh_simplifier::GeometryLodChain> chains;
+//     mesh_simplifier::buildLodChains(
+//         stream, scene, &geomPool, meshes, targetRatios, lengthof(targetRatios), 0.05f,
+//         [&](optixu::GeometryInstance geomInst, uint32_t meshIdx) {
+//             geomInst.setMaterial(0, 0, materials[meshIdx]);
+//         }, Shared::NumRayTypes, &gasScheduler, &chains);
+//     geomPool.uploadRanges(stream);
+//     gasScheduler.build(stream);
+//     // chains[meshIdx].gases[level].getHandle()をLODの選択に使う。
+//
+// EN: Utility simplifying meshes by edge collapses with quadric error metrics (QEM) and generating LOD chains of GASs.
+//     For each geometry instance, create index and vertex buffers per target ratio of the triangle count,
+//     store them as ranges in optixu::HostGeometryPool, and build a GAS with compaction per level
+//     via optixu::GASBuildScheduler. Simplification is distributed to CPU threads in parallel per mesh.
+//     Collapses are half-edge collapses onto existing vertices,
+//     so vertex attributes (normals and texture coordinates) can be used as-is.
+//     Texture seams and normal discontinuities where multiple vertices share a position are not moved.
+//     Select LODs by switching GASs per instance e.g. with optixu::selectLevelOfDetail().
+//
+//     std::vector<mesh_simplifier::MeshDesc<obj::Vertex>> meshes; // Make per mesh from results of obj::load()
+//     const float targetRatios[] = { 1.0f, 0.25f, 0.0625f };
+//     std::vector<mesh_simplifier::GeometryLodChain> chains;
+//     mesh_simplifier::buildLodChains(
+//         stream, scene, &geomPool, meshes, targetRatios, lengthof(targetRatios), 0.05f,
+//         [&](optixu::GeometryInstance geomInst, uint32_t meshIdx) {
+//             geomInst.setMaterial(0, 0, materials[meshIdx]);
+//         }, Shared::NumRayTypes, &gasScheduler, &chains);
+//     geomPool.uploadRanges(stream);
+//     gasScheduler.build(stream);
+//     // Use chains[meshIdx].gases[level].getHandle() for LOD selection.
+namespace mesh_simplifier {
+    // JP: 簡略化の入力。位置は頂点の先頭から始まるfloat3で、positionStrideバイトごとに並ぶ。
+    //     obj::Triangleはuint3と同じレイアウトなのでreinterpret_castして渡せる。
+    // EN: Input of simplification. Positions are float3 at the beginning of vertices lined up every positionStride bytes.
+    //     obj::Triangle has the same layout as uint3, so it can be passed with reinterpret_cast.
+    struct MeshPositions {
+        const float3* positions;
+        uint32_t positionStride;
+        uint32_t numVertices;
+        const uint3* triangles;
+        uint32_t numTriangles;
+    };
+
+    // JP: errorはそのレベルまでに行った縮約の最大誤差(距離)をメッシュのAABBの対角線の長さで割ったもの。
+    // EN: error is the maximum error (distance) of collapses done up to the level
+    //     divided by the diagonal length of the AABB of the mesh.
+    struct SimplifiedLevel {
+        std::vector<uint3> triangles;
+        float error;
+    };
+
+    // JP: targetRatiosは(0, 1]の降順で、各レベルの元の三角形数に対する目標の割合を表す。
+    //     簡略化は前のレベルの結果から続けて行うので、チェーン全体でも一回分のコストで済む。
+    //     誤差がmaxRelativeErrorを超える縮約は行わないので、目標の三角形数に届かない場合がある。
+    //     出力の三角形は元の頂点のインデックスを参照する。
+    // EN: targetRatios are in descending order in (0, 1] and represent target ratios to the original triangle count
+    //     for each level. Simplification continues from the result of the previous level,
+    //     so the whole chain costs about one pass.
+    //     Collapses with errors exceeding maxRelativeError are not done, so the target triangle count may not be reached.
+    //     Output triangles refer to indices of the original vertices.
+    void simplifyChain(const MeshPositions &mesh, const float* targetRatios, uint32_t numLevels,
+                       float maxRelativeError, std::vector<SimplifiedLevel>* levels);
+
+    // JP: 複数のメッシュのsimplifyChain()をスレッドに分配して並列に実行する。numThreadsが0の場合はハードウェアの並列数。
+    // EN: Run simplifyChain() for multiple meshes in parallel distributing them to threads.
+    //     numThreads 0 means the hardware concurrency.
+    void simplifyChains(const MeshPositions* meshes, uint32_t numMeshes,
+                        const float* targetRatios, uint32_t numLevels, float maxRelativeError,
+                        std::vector<std::vector<SimplifiedLevel>>* levelsPerMesh, uint32_t numThreads = 0);
+
+    template <typename VertexType>
+    struct MeshDesc {
+        const VertexType* vertices;
+        uint32_t numVertices;
+        const uint3* triangles;
+        uint32_t numTriangles;
+    };
+
+    // JP: 一つのメッシュのLODチェーン。各配列はレベルごと。
+    // EN: LOD chain of a mesh. Each array is per level.
+    struct GeometryLodChain {
+        std::vector<optixu::GeometryInstance> geomInsts;
+        std::vector<optixu::GeometryAccelerationStructure> gases;
+        std::vector<uint32_t> rangeIndices;
+        std::vector<float> errors;
+    };
+
+    // JP: メッシュを簡略化し、レベルごとに使われる頂点だけを詰めてプールに追加し、
+    //     GeometryInstanceとGASを作ってスケジューラーに登録する。
+    //     setupMaterialsではGeometryInstanceのマテリアルやジオメトリーフラグを設定する(マテリアル数は1)。
+    //     プールのuploadRanges()とスケジューラーのbuild()は呼び出し側で行う。
+    // EN: Simplify meshes, pack only vertices used per level to add them to the pool,
+    //     and create geometry instances and GASs to register them to the scheduler.
+    //     Set materials and geometry flags of a geometry instance in setupMaterials (the number of materials is 1).
+    //     The caller performs uploadRanges() of the pool and build() of the scheduler.
+    template <typename VertexType>
+    void buildLodChains(
+        CUstream stream, optixu::Scene scene, optixu::HostGeometryPool<VertexType>* pool,
+        const std::vector<MeshDesc<VertexType>> &meshes, const float* targetRatios, uint32_t numLevels,
+        float maxRelativeError,
+        const std::function<void(optixu::GeometryInstance, uint32_t)> &setupMaterials,
+        uint32_t numRayTypes, optixu::GASBuildScheduler* scheduler, std::vector<GeometryLodChain>* chains) {
+        const uint32_t numMeshes = static_cast<uint32_t>(meshes.size());
+        std::vector<MeshPositions> meshPositions(numMeshes);
+        for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
+            const MeshDesc<VertexType> &mesh = meshes[meshIdx];
+            MeshPositions &dst = meshPositions[meshIdx];
+            dst.positions = reinterpret_cast<const float3*>(mesh.vertices);
+            dst.positionStride = sizeof(VertexType);
+            dst.numVertices = mesh.numVertices;
+            dst.triangles = mesh.triangles;
+            dst.numTriangles = mesh.numTriangles;
+        }
+        std::vector<std::vector<SimplifiedLevel>> levelsPerMesh;
+        simplifyChains(meshPositions.data(), numMeshes, targetRatios, numLevels, maxRelativeError, &levelsPerMesh);
+
+        chains->resize(numMeshes);
+        std::vector<uint32_t> remap;
+        std::vector<VertexType> levelVertices;
+        std::vector<uint3> levelTriangles;
+        for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
+            const MeshDesc<VertexType> &mesh = meshes[meshIdx];
+            GeometryLodChain &chain = (*chains)[meshIdx];
+            chain = GeometryLodChain();
+            for (const SimplifiedLevel &level : levelsPerMesh[meshIdx]) {
+                // JP: レベルで使われる頂点だけを詰める。
+                // EN: Pack only vertices used in the level.
+                remap.assign(mesh.numVertices, 0xFFFFFFFF);
+                levelVertices.clear();
+                levelTriangles.resize(level.triangles.size());
+                for (size_t triIdx = 0; triIdx < level.triangles.size(); ++triIdx) {
+                    const uint3 &tri = level.triangles[triIdx];
+                    uint32_t* dstIdx = &levelTriangles[triIdx].x;
+                    for (const uint32_t vIdx : { tri.x, tri.y, tri.z }) {
+                        if (remap[vIdx] == 0xFFFFFFFF) {
+                            remap[vIdx] = static_cast<uint32_t>(levelVertices.size());
+                            levelVertices.push_back(mesh.vertices[vIdx]);
+                        }
+                        *dstIdx++ = remap[vIdx];
+                    }
+                }
+                const uint32_t rangeIdx = pool->addRange(
+                    stream,
+                    levelVertices.data(), static_cast<uint32_t>(levelVertices.size()),
+                    levelTriangles.data(), static_cast<uint32_t>(levelTriangles.size()));
+
+                optixu::GeometryInstance geomInst = scene.createGeometryInstance();
+                pool->setupGeometryInstance(geomInst, rangeIdx);
+                geomInst.setNumMaterials(1, optixu::BufferView());
+                setupMaterials(geomInst, meshIdx);
+
+                optixu::GeometryAccelerationStructure gas = scene.createGeometryAccelerationStructure();
+                gas.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, true, false);
+                gas.setNumMaterialSets(1);
+                gas.setNumRayTypes(0, numRayTypes);
+                gas.addChild(geomInst);
+                scheduler->addGAS(gas);
+
+                chain.geomInsts.push_back(geomInst);
+                chain.gases.push_back(gas);
+                chain.rangeIndices.push_back(rangeIdx);
+                chain.errors.push_back(level.error);
+            }
+        }
+    }
+}
@@ -0,0 +1,172 @@
+﻿#pragma once
+
+#include "common.h"
+#if defined(__CUDACC__)
+#include <cuda_fp16.h>
+#endif
+
+// JP: 時間方向のデノイザー用のスクリーン空間モーションベクター(フロー)を生成するユーティリティー。
+//     最初のヒットのGバッファー(オブジェクト空間の位置とインスタンスインデックス)から、
+//     現在と前フレームのカメラ、インスタンスの現在と前フレームの変換を使ってフローを求め、
+//     デノイザーのフローレイヤーが受け付けるOPTIX_PIXEL_FORMAT_HALF2で直接書き込む。
+//     レイ生成プログラムがfloat2を書いてからコピーする必要が無くなる。
+//
+//     motion_vectors::Generator motionVectors;
+//     motionVectors.initialize(cuContext, motionVectorModule, cudau::BufferType::Device, maxNumInstances);
+//     // 毎フレーム
+//     motionVectors.updateTransforms(instances.data(), numInstances, stream);
+//     pipeline.launch(...); // 最初のヒットでFirstHitを書き込む
+//     motionVectors.generate(stream, gBuffer, imageSize, camera, flowBuffer);
+//     denoiser.invoke(..., flowBuffer, OPTIX_PIXEL_FORMAT_HALF2, ...);
+//
+// EN: Utility generating screen space motion vectors (flow) for the temporal denoiser.
+//     Compute flow from the first hit G-buffer (position in object space and instance index)
+//     using the current and previous cameras and the current and previous transforms of instances,
+//     and write it directly in OPTIX_PIXEL_FORMAT_HALF2 accepted by the flow layer of the denoiser.
+//     This removes the need for the ray generation program to write float2 and then copy it.
+//
+//     motion_vectors::Generator motionVectors;
+//     motionVectors.initialize(cuContext, motionVectorModule, cudau::BufferType::Device, maxNumInstances);
+//     // every frame
+//     motionVectors.updateTransforms(instances.data(), numInstances, stream);
+//     pipeline.launch(...); // write FirstHit at the first hit
+//     motionVectors.generate(stream, gBuffer, imageSize, camera, flowBuffer);
+//     denoiser.invoke(..., flowBuffer, OPTIX_PIXEL_FORMAT_HALF2, ...);
+namespace motion_vectors {
+    static constexpr uint32_t invalidInstanceIndex = 0xFFFFFFFF;
+
+    // JP: サンプルのPerspectiveCameraと同じ規約のカメラ。
+    // EN: Camera with the same convention as PerspectiveCamera of the samples.
+    struct Camera {
+        float aspect;
+        float fovY;
+        float3 position;
+        Matrix3x3 orientation;
+
+        CUDA_DEVICE_FUNCTION float2 calcScreenPosition(const float3 &posInWorld) const {
+            Matrix3x3 invOri = inverse(orientation);
+            float3 posInView = invOri * (posInWorld - position);
+            float2 posAtZ1 = make_float2(posInView.x / posInView.z, posInView.y / posInView.z);
+            float h = 2 * std::tan(fovY / 2);
+            float w = aspect * h;
+            return make_float2(1 - (posAtZ1.x + 0.5f * w) / w,
+                               1 - (posAtZ1.y + 0.5f * h) / h);
+        }
+    };
+
+    // JP: Instance::getTransform()と同じ行優先の3x4行列。
+    // EN: Row-major 3x4 matrices same as Instance::getTransform().
+    struct InstanceTransform {
+        float current[12];
+        float previous[12];
+    };
+
+    // JP: 最初のヒットで書き込むGバッファーの要素。
+    //     ヒットでは(optixTransformPointFromWorldToObjectSpace()で求めた位置, optixGetInstanceIndex())を、
+    //     ミスではinstanceIndexにinvalidInstanceIndexを書く。
+    // EN: Element of the G-buffer written at the first hit.
+    //     Write (the position obtained by optixTransformPointFromWorldToObjectSpace(), optixGetInstanceIndex())
+    //     on a hit, and invalidInstanceIndex to instanceIndex on a miss.
+    struct FirstHit {
+        float3 positionInObject;
+        uint32_t instanceIndex;
+    };
+
+    CUDA_DEVICE_FUNCTION float3 transformPoint(const float m[12], const float3 &p) {
+        return make_float3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+                           m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+                           m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: flowBufferの各要素はOPTIX_PIXEL_FORMAT_HALF2の1ピクセル(x, yの順のhalf)。
+    //     ミスしたピクセルやtransformsがnullptr(履歴のリセット)の場合はゼロを書く。
+    // EN: Each element of flowBuffer is a pixel of OPTIX_PIXEL_FORMAT_HALF2 (halves in the order of x, y).
+    //     Write zero for missed pixels or when transforms is nullptr (history reset).
+    CUDA_DEVICE_FUNCTION void computeMotionVectors(
+        const FirstHit* gBuffer, const InstanceTransform* transforms, uint32_t numInstances,
+        const Camera &camera, const Camera &prevCamera, uint2 imageSize, __half2* flowBuffer) {
+        uint32_t numPixels = imageSize.x * imageSize.y;
+        for (uint32_t pixIdx = blockDim.x * blockIdx.x + threadIdx.x; pixIdx < numPixels;
+             pixIdx += blockDim.x * gridDim.x) {
+            const FirstHit &hit = gBuffer[pixIdx];
+            float2 flow = make_float2(0.0f, 0.0f);
+            if (transforms && hit.instanceIndex < numInstances) {
+                const InstanceTransform &xfm = transforms[hit.instanceIndex];
+                float3 curPosInWorld = transformPoint(xfm.current, hit.positionInObject);
+                float3 prevPosInWorld = transformPoint(xfm.previous, hit.positionInObject);
+                float2 curScreenPos = camera.calcScreenPosition(curPosInWorld);
+                float2 prevScreenPos = prevCamera.calcScreenPosition(prevPosInWorld);
+                flow = (curScreenPos - prevScreenPos) * make_float2(imageSize.x, imageSize.y);
+                if (!isfinite(flow.x) || !isfinite(flow.y))
+                    flow = make_float2(0.0f, 0.0f);
+            }
+            flowBuffer[pixIdx] = __floats2half2_rn(flow.x, flow.y);
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    class Generator {
+        cudau::Kernel m_computeMotionVectors;
+        cudau::TypedBuffer<InstanceTransform> m_transforms;
+        std::vector<InstanceTransform> m_transformsOnHost;
+        uint32_t m_numInstances;
+        Camera m_prevCamera;
+        struct {
+            unsigned int m_hasHistory : 1;
+        };
+
+    public:
+        Generator() : m_numInstances(0), m_hasHistory(false) {}
+
+        void initialize(CUcontext cuContext, CUmodule motionVectorModule, cudau::BufferType type,
+                        uint32_t maxNumInstances) {
+            m_computeMotionVectors.set(motionVectorModule, "computeMotionVectors", cudau::AutoBlockDim(), 0);
+            m_transforms.initialize(cuContext, type, std::max(maxNumInstances, 1u));
+            m_transformsOnHost.resize(m_transforms.numElements());
+            m_numInstances = 0;
+            m_hasHistory = false;
+        }
+        void finalize() {
+            m_transforms.finalize();
+            m_transformsOnHost.clear();
+        }
+
+        // JP: 前フレームの変換を保存してから現在の変換を取得する。
+        //     instancesの並びはIASに追加した順(optixGetInstanceIndex()の値)と一致させる。
+        // EN: Save the transforms of the previous frame, then obtain the current transforms.
+        //     Order instances equally to the order added to the IAS (the value of optixGetInstanceIndex()).
+        void updateTransforms(const optixu::Instance* instances, uint32_t numInstances, CUstream stream) {
+            if (numInstances > m_transformsOnHost.size())
+                throw std::runtime_error("Number of instances exceeds the maximum.");
+            bool keepHistory = m_hasHistory && numInstances == m_numInstances;
+            for (uint32_t instIdx = 0; instIdx < numInstances; ++instIdx) {
+                InstanceTransform &xfm = m_transformsOnHost[instIdx];
+                float transform[12];
+                instances[instIdx].getTransform(transform);
+                std::copy_n(keepHistory ? xfm.current : transform, 12, xfm.previous);
+                std::copy_n(transform, 12, xfm.current);
+            }
+            m_numInstances = numInstances;
+            m_transforms.write(m_transformsOnHost.data(), numInstances, stream);
+        }
+
+        // JP: 次のgenerate()でフローをゼロにする。カメラのジャンプやシーンの切り替え時に呼ぶ。
+        // EN: Make flow zero at the next generate(). Call this at camera jumps or scene switches.
+        void reset() {
+            m_hasHistory = false;
+        }
+
+        void generate(CUstream stream, const FirstHit* gBuffer, const uint2 &imageSize, const Camera &camera,
+                      CUdeviceptr flowBuffer) {
+            m_computeMotionVectors.launchPersistent(
+                stream, gBuffer,
+                m_hasHistory ? m_transforms.getDevicePointer() : static_cast<const InstanceTransform*>(nullptr),
+                m_numInstances, camera, m_hasHistory ? m_prevCamera : camera, imageSize, flowBuffer);
+            m_prevCamera = camera;
+            m_hasHistory = true;
+        }
+    };
+#endif
+}
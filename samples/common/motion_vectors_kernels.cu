@@ -0,0 +1,15 @@
+﻿#pragma once
+
+#include "motion_vectors.h"
+
+// JP: motion_vectors::Generatorが使うカーネル。モーションベクター生成を使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernel used by motion_vectors::Generator. A sample using motion vector generation compiles this file
+//     to PTX as well.
+
+CUDA_DEVICE_KERNEL void computeMotionVectors(
+    const motion_vectors::FirstHit* gBuffer, const motion_vectors::InstanceTransform* transforms,
+    uint32_t numInstances, motion_vectors::Camera camera, motion_vectors::Camera prevCamera,
+    uint2 imageSize, __half2* flowBuffer) {
+    motion_vectors::computeMotionVectors(gBuffer, transforms, numInstances, camera, prevCamera,
+                                         imageSize, flowBuffer);
+}
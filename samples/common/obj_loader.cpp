@@ -1,9 +1,338 @@
 #include "obj_loader.h"
+#include <unordered_map>
 
 namespace obj {
+    namespace {
+        struct VertexKey {
+            uint32_t smoothGroupIdx;
+            int32_t positionIdx;
+            int32_t normalIdx;
+            int32_t texCoordIdx;
+
+            bool operator==(const VertexKey &r) const {
+                return smoothGroupIdx == r.smoothGroupIdx &&
+                    positionIdx == r.positionIdx &&
+                    normalIdx == r.normalIdx &&
+                    texCoordIdx == r.texCoordIdx;
+            }
+        };
+
+        struct VertexKeyHash {
+            size_t operator()(const VertexKey &key) const {
+                uint64_t h = (static_cast<uint64_t>(key.smoothGroupIdx) << 32) ^
+                    static_cast<uint32_t>(key.positionIdx);
+                h ^= (static_cast<uint64_t>(static_cast<uint32_t>(key.normalIdx)) << 32) ^
+                    (static_cast<uint64_t>(static_cast<uint32_t>(key.texCoordIdx)) * 0x9E3779B97F4A7C15ull);
+                // splitmix64 finalizer
+                h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+                h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+                return static_cast<size_t>(h ^ (h >> 31));
+            }
+        };
+
+        struct FaceRef {
+            uint32_t shapeIdx;
+            uint32_t faceIdx;
+            size_t idxOffset;
+        };
+
+        // MaterialFileReader that records every material library the OBJ refers to as a cache dependency.
+        class RecordingMaterialReader : public tinyobj::MaterialReader {
+            tinyobj::MaterialFileReader m_reader;
+            std::vector<std::string>* m_matIds;
+
+        public:
+            RecordingMaterialReader(const std::string &mtlBaseDir, std::vector<std::string>* matIds) :
+                m_reader(mtlBaseDir), m_matIds(matIds) {}
+
+            bool operator()(const std::string &matId,
+                            std::vector<tinyobj::material_t>* materials,
+                            std::map<std::string, int>* matMap,
+                            std::string* warn, std::string* err) override {
+                m_matIds->push_back(matId);
+                return m_reader(matId, materials, matMap, warn, err);
+            }
+        };
+
+
+
+        // The cache places each section at a 16-byte boundary so that it can be memory-mapped and uploaded as is.
+        // Paths of material libraries and textures are stored relative to the directory of the OBJ.
+        constexpr char cacheMagic[8] = { 'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E' };
+        constexpr uint32_t cacheVersion = 2;
+        constexpr uint64_t cacheAlignment = 16;
+
+        struct CacheHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t numMaterials;
+            uint64_t sourceFileSize;
+            int64_t sourceWriteTime;
+            uint64_t numVertices;
+            uint64_t numTriangles;
+            uint64_t numMatGroups;
+            uint64_t numDependencies;
+            uint64_t matGroupsOffset;
+            uint64_t verticesOffset;
+            uint64_t trianglesOffset;
+            uint64_t materialsOffset;
+            uint64_t dependenciesOffset;
+            uint64_t padding;
+        };
+        static_assert(sizeof(CacheHeader) % cacheAlignment == 0, "Unexpected cache header size.");
+
+        struct CacheMatGroup {
+            uint64_t triangleOffset;
+            uint32_t numTriangles;
+            uint32_t materialIndex;
+        };
+
+        struct CacheMaterial {
+            float diffuse[3];
+            uint32_t texPathLength;
+        };
+
+        // A material library the OBJ refers to. A missing file is stamped with a size of UINT64_MAX.
+        struct CacheDependency {
+            uint64_t fileSize;
+            int64_t writeTime;
+            uint32_t pathLength;
+            uint32_t padding;
+        };
+
+        uint64_t alignCacheOffset(uint64_t offset) {
+            return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+        }
+
+        std::filesystem::path getCachePath(const std::filesystem::path &filepath) {
+            std::filesystem::path cachePath = filepath;
+            cachePath += ".meshcache";
+            return cachePath;
+        }
+
+        bool getSourceStamp(const std::filesystem::path &filepath, uint64_t* fileSize, int64_t* writeTime) {
+            std::error_code ec;
+            *fileSize = std::filesystem::file_size(filepath, ec);
+            if (ec)
+                return false;
+            *writeTime = std::filesystem::last_write_time(filepath, ec).time_since_epoch().count();
+            return !ec;
+        }
+
+        void getDependencyStamp(const std::filesystem::path &filepath, uint64_t* fileSize, int64_t* writeTime) {
+            if (!getSourceStamp(filepath, fileSize, writeTime)) {
+                *fileSize = UINT64_MAX;
+                *writeTime = 0;
+            }
+        }
+
+        std::filesystem::path makeRelativeTo(const std::filesystem::path &path, const std::filesystem::path &baseDir) {
+            if (baseDir.empty())
+                return path;
+            return path.lexically_relative(baseDir);
+        }
+
+        // Check that a section of numElements elements of elementSize bytes at offset fits in the file
+        // without overflowing.
+        bool isSectionInFile(uint64_t fileSize, uint64_t offset, uint64_t numElements, uint64_t elementSize) {
+            if (offset > fileSize)
+                return false;
+            return numElements <= (fileSize - offset) / elementSize;
+        }
+
+        bool loadCache(const std::filesystem::path &filepath,
+                       std::vector<Vertex>* vertices, std::vector<MaterialGroup>* matGroups,
+                       std::vector<Material>* materials) {
+            uint64_t sourceFileSize;
+            int64_t sourceWriteTime;
+            if (!getSourceStamp(filepath, &sourceFileSize, &sourceWriteTime))
+                return false;
+
+            const std::filesystem::path cachePath = getCachePath(filepath);
+            std::error_code ec;
+            const uint64_t cacheFileSize = std::filesystem::file_size(cachePath, ec);
+            if (ec)
+                return false;
+            std::ifstream ifs(cachePath, std::ios::in | std::ios::binary);
+            if (!ifs)
+                return false;
+
+            CacheHeader header;
+            if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+                return false;
+            if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+                header.version != cacheVersion ||
+                header.sourceFileSize != sourceFileSize ||
+                header.sourceWriteTime != sourceWriteTime)
+                return false;
+            // Don't trust the counts in the header before allocating memory for them.
+            if (!isSectionInFile(cacheFileSize, header.matGroupsOffset, header.numMatGroups, sizeof(CacheMatGroup)) ||
+                !isSectionInFile(cacheFileSize, header.verticesOffset, header.numVertices, sizeof(Vertex)) ||
+                !isSectionInFile(cacheFileSize, header.trianglesOffset, header.numTriangles, sizeof(Triangle)) ||
+                !isSectionInFile(cacheFileSize, header.materialsOffset, header.numMaterials, sizeof(CacheMaterial)) ||
+                !isSectionInFile(cacheFileSize, header.dependenciesOffset, header.numDependencies,
+                                 sizeof(CacheDependency)))
+                return false;
+
+            std::filesystem::path baseDir = filepath;
+            baseDir.remove_filename();
+
+            // The cache is also stale when a material library has been edited, added or removed.
+            ifs.seekg(header.dependenciesOffset);
+            for (uint64_t depIdx = 0; depIdx < header.numDependencies; ++depIdx) {
+                CacheDependency cacheDep;
+                if (!ifs.read(reinterpret_cast<char*>(&cacheDep), sizeof(cacheDep)) ||
+                    cacheDep.pathLength > cacheFileSize - static_cast<uint64_t>(ifs.tellg()))
+                    return false;
+                std::string depPath(cacheDep.pathLength, '\0');
+                if (!ifs.read(depPath.data(), cacheDep.pathLength))
+                    return false;
+                uint64_t depFileSize;
+                int64_t depWriteTime;
+                getDependencyStamp(baseDir / std::filesystem::u8path(depPath), &depFileSize, &depWriteTime);
+                if (depFileSize != cacheDep.fileSize || depWriteTime != cacheDep.writeTime)
+                    return false;
+            }
+
+            std::vector<CacheMatGroup> cacheMatGroups(header.numMatGroups);
+            std::vector<Triangle> triangles(header.numTriangles);
+            vertices->resize(header.numVertices);
+            ifs.seekg(header.matGroupsOffset);
+            ifs.read(reinterpret_cast<char*>(cacheMatGroups.data()), cacheMatGroups.size() * sizeof(CacheMatGroup));
+            ifs.seekg(header.verticesOffset);
+            ifs.read(reinterpret_cast<char*>(vertices->data()), vertices->size() * sizeof(Vertex));
+            ifs.seekg(header.trianglesOffset);
+            ifs.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(Triangle));
+            if (!ifs)
+                return false;
+
+            std::vector<Material> cachedMaterials(header.numMaterials);
+            ifs.seekg(header.materialsOffset);
+            for (Material &mat : cachedMaterials) {
+                CacheMaterial cacheMat;
+                if (!ifs.read(reinterpret_cast<char*>(&cacheMat), sizeof(cacheMat)) ||
+                    cacheMat.texPathLength > cacheFileSize - static_cast<uint64_t>(ifs.tellg()))
+                    return false;
+                std::string texPath(cacheMat.texPathLength, '\0');
+                ifs.read(texPath.data(), cacheMat.texPathLength);
+                if (!ifs)
+                    return false;
+                std::copy_n(cacheMat.diffuse, 3, mat.diffuse);
+                if (!texPath.empty())
+                    mat.diffuseTexPath = baseDir / std::filesystem::u8path(texPath);
+            }
+
+            for (const CacheMatGroup &cacheMatGroup : cacheMatGroups) {
+                if (cacheMatGroup.triangleOffset > triangles.size() ||
+                    cacheMatGroup.numTriangles > triangles.size() - cacheMatGroup.triangleOffset)
+                    return false;
+                MaterialGroup matGroup;
+                matGroup.materialIndex = cacheMatGroup.materialIndex;
+                matGroup.triangles.assign(triangles.cbegin() + cacheMatGroup.triangleOffset,
+                                          triangles.cbegin() + cacheMatGroup.triangleOffset + cacheMatGroup.numTriangles);
+                matGroups->push_back(std::move(matGroup));
+            }
+            if (materials)
+                *materials = std::move(cachedMaterials);
+
+            return true;
+        }
+
+        void saveCache(const std::filesystem::path &filepath,
+                       const std::vector<Vertex> &vertices, const std::vector<MaterialGroup> &matGroups,
+                       const std::vector<Material> &materials, const std::vector<std::string> &matLibIds) {
+            CacheHeader header = {};
+            std::copy_n(cacheMagic, sizeof(cacheMagic), header.magic);
+            header.version = cacheVersion;
+            if (!getSourceStamp(filepath, &header.sourceFileSize, &header.sourceWriteTime))
+                return;
+
+            std::filesystem::path baseDir = filepath;
+            baseDir.remove_filename();
+
+            std::vector<CacheMatGroup> cacheMatGroups(matGroups.size());
+            uint64_t numTriangles = 0;
+            for (uint32_t mgIdx = 0; mgIdx < matGroups.size(); ++mgIdx) {
+                CacheMatGroup &cacheMatGroup = cacheMatGroups[mgIdx];
+                cacheMatGroup.triangleOffset = numTriangles;
+                cacheMatGroup.numTriangles = static_cast<uint32_t>(matGroups[mgIdx].triangles.size());
+                cacheMatGroup.materialIndex = matGroups[mgIdx].materialIndex;
+                numTriangles += cacheMatGroup.numTriangles;
+            }
+
+            std::vector<std::string> texPaths(materials.size());
+            uint64_t materialsSize = 0;
+            for (uint32_t mIdx = 0; mIdx < materials.size(); ++mIdx) {
+                const Material &mat = materials[mIdx];
+                if (!mat.diffuseTexPath.empty())
+                    texPaths[mIdx] = makeRelativeTo(mat.diffuseTexPath, baseDir).generic_u8string();
+                materialsSize += sizeof(CacheMaterial) + texPaths[mIdx].size();
+            }
+
+            header.numMaterials = static_cast<uint32_t>(materials.size());
+            header.numVertices = vertices.size();
+            header.numTriangles = numTriangles;
+            header.numMatGroups = matGroups.size();
+            header.numDependencies = matLibIds.size();
+            header.matGroupsOffset = sizeof(CacheHeader);
+            header.verticesOffset = alignCacheOffset(header.matGroupsOffset + sizeof(CacheMatGroup) * header.numMatGroups);
+            header.trianglesOffset = alignCacheOffset(header.verticesOffset + sizeof(Vertex) * header.numVertices);
+            header.materialsOffset = alignCacheOffset(header.trianglesOffset + sizeof(Triangle) * header.numTriangles);
+            header.dependenciesOffset = alignCacheOffset(header.materialsOffset + materialsSize);
+
+            std::ofstream ofs(getCachePath(filepath), std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!ofs)
+                return;
+            const auto padTo = [&ofs](uint64_t offset) {
+                static const char zeros[cacheAlignment] = {};
+                uint64_t curOffset = static_cast<uint64_t>(ofs.tellp());
+                ofs.write(zeros, offset - curOffset);
+            };
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(cacheMatGroups.data()), sizeof(CacheMatGroup) * cacheMatGroups.size());
+            padTo(header.verticesOffset);
+            ofs.write(reinterpret_cast<const char*>(vertices.data()), sizeof(Vertex) * vertices.size());
+            padTo(header.trianglesOffset);
+            for (const MaterialGroup &matGroup : matGroups)
+                ofs.write(reinterpret_cast<const char*>(matGroup.triangles.data()),
+                          sizeof(Triangle) * matGroup.triangles.size());
+            padTo(header.materialsOffset);
+            for (uint32_t mIdx = 0; mIdx < materials.size(); ++mIdx) {
+                const std::string &texPath = texPaths[mIdx];
+                CacheMaterial cacheMat;
+                std::copy_n(materials[mIdx].diffuse, 3, cacheMat.diffuse);
+                cacheMat.texPathLength = static_cast<uint32_t>(texPath.size());
+                ofs.write(reinterpret_cast<const char*>(&cacheMat), sizeof(cacheMat));
+                ofs.write(texPath.data(), texPath.size());
+            }
+            padTo(header.dependenciesOffset);
+            for (const std::string &matLibId : matLibIds) {
+                CacheDependency cacheDep = {};
+                getDependencyStamp(baseDir / std::filesystem::u8path(matLibId), &cacheDep.fileSize, &cacheDep.writeTime);
+                cacheDep.pathLength = static_cast<uint32_t>(matLibId.size());
+                ofs.write(reinterpret_cast<const char*>(&cacheDep), sizeof(cacheDep));
+                ofs.write(matLibId.data(), matLibId.size());
+            }
+            if (!ofs) {
+                ofs.close();
+                std::error_code ec;
+                std::filesystem::remove(getCachePath(filepath), ec);
+            }
+        }
+    }
+
+
+
     void load(const std::filesystem::path &filepath,
               std::vector<Vertex>* vertices, std::vector<MaterialGroup>* matGroups,
               std::vector<Material>* materials) {
+        vertices->clear();
+        matGroups->clear();
+        if (loadCache(filepath, vertices, matGroups, materials))
+            return;
+        vertices->clear();
+        matGroups->clear();
+
         std::filesystem::path matBaseDir = filepath;
         matBaseDir.remove_filename();
 
@@ -12,8 +341,19 @@ namespace obj {
         std::vector<tinyobj::material_t> objMaterials;
         std::string warn;
         std::string err;
+        std::vector<std::string> matLibIds;
+        std::ifstream objStream(filepath);
+        if (!objStream) {
+            printf("failed to open obj %s.\n", filepath.string().c_str());
+            return;
+        }
+        // Same as the file name version of tinyobj::LoadObj() except recording the material libraries.
+        std::string mtlBaseDir = matBaseDir.string();
+        if (!mtlBaseDir.empty() && mtlBaseDir.back() != std::filesystem::path::preferred_separator)
+            mtlBaseDir += static_cast<char>(std::filesystem::path::preferred_separator);
+        RecordingMaterialReader matReader(mtlBaseDir, &matLibIds);
         bool ret = tinyobj::LoadObj(&attrib, &objShapes, &objMaterials, &warn, &err,
-                                    filepath.string().c_str(), matBaseDir.string().c_str());
+                                    &objStream, &matReader);
         if (!ret) {
             printf("failed to load obj %s.n\n", filepath.string().c_str());
             printf("error: %s\n", err.c_str());
@@ -21,168 +361,210 @@ namespace obj {
             return;
         }
 
-        if (materials) {
-            materials->resize(objMaterials.size());
-            for (int mIdx = 0; mIdx < objMaterials.size(); ++mIdx) {
-                const tinyobj::material_t &srcMat = objMaterials[mIdx];
-                Material &dstMat = (*materials)[mIdx];
-                dstMat.diffuse[0] = srcMat.diffuse[0];
-                dstMat.diffuse[1] = srcMat.diffuse[1];
-                dstMat.diffuse[2] = srcMat.diffuse[2];
-                if (!srcMat.diffuse_texname.empty())
-                    dstMat.diffuseTexPath = matBaseDir / srcMat.diffuse_texname;
-            }
+        std::vector<Material> loadedMaterials(objMaterials.size());
+        for (int mIdx = 0; mIdx < objMaterials.size(); ++mIdx) {
+            const tinyobj::material_t &srcMat = objMaterials[mIdx];
+            Material &dstMat = loadedMaterials[mIdx];
+            dstMat.diffuse[0] = srcMat.diffuse[0];
+            dstMat.diffuse[1] = srcMat.diffuse[1];
+            dstMat.diffuse[2] = srcMat.diffuse[2];
+            if (!srcMat.diffuse_texname.empty())
+                dstMat.diffuseTexPath = matBaseDir / srcMat.diffuse_texname;
         }
 
-        // Record unified unique vertices.
-        using VertexKey = std::tuple<uint32_t, int32_t, int32_t, int32_t>;
-        std::map<VertexKey, Vertex> unifiedVertexMap;
+        // Enumerate triangle faces.
+        std::vector<FaceRef> faces;
         for (uint32_t sIdx = 0; sIdx < objShapes.size(); ++sIdx) {
             const tinyobj::shape_t &shape = objShapes[sIdx];
             size_t idxOffset = 0;
             for (uint32_t fIdx = 0; fIdx < shape.mesh.num_face_vertices.size(); ++fIdx) {
                 uint32_t numFaceVertices = shape.mesh.num_face_vertices[fIdx];
-                if (numFaceVertices != 3) {
-                    idxOffset += numFaceVertices;
-                    continue;
-                }
+                if (numFaceVertices == 3)
+                    faces.push_back(FaceRef{ sIdx, fIdx, idxOffset });
+                idxOffset += numFaceVertices;
+            }
+        }
+        size_t numCorners = 3 * faces.size();
 
-                uint32_t smoothGroupIdx = shape.mesh.smoothing_group_ids[fIdx];
+        // parallelFor() gives each thread at least 16 items, so split the corners into that many chunks and buckets
+        // per thread. The chunk boundaries depend only on the number of corners and chunks.
+        const uint32_t numChunks = 16 * std::max(1u, std::thread::hardware_concurrency());
+        const uint32_t numBuckets = numChunks;
 
-                VertexKey vKeys[3];
-                Vertex vs[3];
+        // Compute the key and its hash of each face corner.
+        if (numCorners > UINT32_MAX) {
+            printf("too many triangles in obj %s.\n", filepath.string().c_str());
+            return;
+        }
+        const uint32_t chunkSize = static_cast<uint32_t>((numCorners + numChunks - 1) / numChunks);
+        const auto forEachCornerInChunks = [&](uint32_t chunkBegin, uint32_t chunkEnd,
+                                               const auto &func) {
+            for (uint32_t chunkIdx = chunkBegin; chunkIdx < chunkEnd; ++chunkIdx) {
+                size_t begin = std::min<size_t>(static_cast<size_t>(chunkSize) * chunkIdx, numCorners);
+                size_t end = std::min<size_t>(begin + chunkSize, numCorners);
+                for (size_t cIdx = begin; cIdx < end; ++cIdx)
+                    func(chunkIdx, cIdx);
+            }
+        };
+        std::vector<VertexKey> cornerKeys(numCorners);
+        std::vector<uint32_t> cornerBuckets(numCorners);
+        parallelFor(static_cast<uint32_t>(faces.size()), [&](uint32_t begin, uint32_t end) {
+            VertexKeyHash hasher;
+            for (uint32_t faceIdx = begin; faceIdx < end; ++faceIdx) {
+                const FaceRef &face = faces[faceIdx];
+                const tinyobj::mesh_t &mesh = objShapes[face.shapeIdx].mesh;
+                uint32_t smoothGroupIdx = mesh.smoothing_group_ids[face.faceIdx];
                 for (uint32_t vIdx = 0; vIdx < 3; ++vIdx) {
-                    tinyobj::index_t idx = shape.mesh.indices[idxOffset + vIdx];
-
-                    vKeys[vIdx] = std::make_tuple(smoothGroupIdx,
-                                                  idx.vertex_index,
-                                                  idx.normal_index >= 0 ? idx.normal_index : static_cast<int32_t>(fIdx),
-                                                  idx.texcoord_index);
-                    if (unifiedVertexMap.count(vKeys[vIdx])) {
-                        vs[vIdx] = unifiedVertexMap.at(vKeys[vIdx]);
-                        continue;
-                    }
-
-                    vs[vIdx].position = float3(attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 0)],
-                                               attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 1)],
-                                               attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 2)]);
-                    if (attrib.normals.size() && idx.normal_index >= 0)
-                        vs[vIdx].normal = float3(attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 0)],
-                                                 attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 1)],
-                                                 attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 2)]);
-                    else
-                        vs[vIdx].normal = float3(NAN, NAN, NAN);
-                    if (attrib.texcoords.size() && idx.texcoord_index >= 0)
-                        vs[vIdx].texCoord = float2(attrib.texcoords[static_cast<uint32_t>(2 * idx.texcoord_index + 0)],
-                                                   1 - attrib.texcoords[static_cast<uint32_t>(2 * idx.texcoord_index + 1)]); // flip V dir
-                    else
-                        vs[vIdx].texCoord = float2(0.0f, 0.0f);
+                    tinyobj::index_t idx = mesh.indices[face.idxOffset + vIdx];
+                    VertexKey &key = cornerKeys[3 * faceIdx + vIdx];
+                    key.smoothGroupIdx = smoothGroupIdx;
+                    key.positionIdx = idx.vertex_index;
+                    key.normalIdx = idx.normal_index >= 0 ? idx.normal_index : static_cast<int32_t>(face.faceIdx);
+                    key.texCoordIdx = idx.texcoord_index;
+                    cornerBuckets[3 * faceIdx + vIdx] = static_cast<uint32_t>(hasher(key) % numBuckets);
                 }
+            }
+        });
 
-                float3 gn = normalize(cross(vs[1].position - vs[0].position,
-                                            vs[2].position - vs[0].position));
-
-                for (int32_t vIdx = 0; vIdx < 3; ++vIdx) {
-                    const VertexKey &key = vKeys[vIdx];
-                    Vertex &v = vs[vIdx];
-                    if (std::isnan(v.normal.x))
-                        v.normal = gn;
-                    unifiedVertexMap[key] = v;
+        // Sort corners by bucket with a stable counting sort.
+        std::vector<uint32_t> chunkBucketCounts(static_cast<size_t>(numChunks) * numBuckets, 0);
+        parallelFor(numChunks, [&](uint32_t chunkBegin, uint32_t chunkEnd) {
+            forEachCornerInChunks(chunkBegin, chunkEnd, [&](uint32_t chunkIdx, size_t cIdx) {
+                ++chunkBucketCounts[static_cast<size_t>(chunkIdx) * numBuckets + cornerBuckets[cIdx]];
+            });
+        });
+        std::vector<uint32_t> bucketStarts(numBuckets + 1, 0);
+        std::vector<uint32_t> chunkBucketOffsets(static_cast<size_t>(numChunks) * numBuckets);
+        {
+            uint32_t offset = 0;
+            for (uint32_t bucketIdx = 0; bucketIdx < numBuckets; ++bucketIdx) {
+                bucketStarts[bucketIdx] = offset;
+                for (uint32_t chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx) {
+                    chunkBucketOffsets[static_cast<size_t>(chunkIdx) * numBuckets + bucketIdx] = offset;
+                    offset += chunkBucketCounts[static_cast<size_t>(chunkIdx) * numBuckets + bucketIdx];
                 }
-
-                idxOffset += numFaceVertices;
             }
+            bucketStarts[numBuckets] = offset;
         }
+        std::vector<uint32_t> sortedCorners(numCorners);
+        parallelFor(numChunks, [&](uint32_t chunkBegin, uint32_t chunkEnd) {
+            forEachCornerInChunks(chunkBegin, chunkEnd, [&](uint32_t chunkIdx, size_t cIdx) {
+                uint32_t &offset = chunkBucketOffsets[static_cast<size_t>(chunkIdx) * numBuckets + cornerBuckets[cIdx]];
+                sortedCorners[offset++] = static_cast<uint32_t>(cIdx);
+            });
+        });
+        chunkBucketCounts.clear();
+        chunkBucketOffsets.clear();
 
-        // Assign a vertex index to each of unified unique vertices.
-        std::map<VertexKey, uint32_t> vertexIndices;
-        vertices->resize(unifiedVertexMap.size());
-        uint32_t vertexIndex = 0;
-        for (const auto &kv : unifiedVertexMap) {
-            (*vertices)[vertexIndex] = kv.second;
-            vertexIndices[kv.first] = vertexIndex++;
-        }
-        unifiedVertexMap.clear();
-
-        // Extract material groups and accumulate vertex normals.
-        for (uint32_t sIdx = 0; sIdx < objShapes.size(); ++sIdx) {
-            const tinyobj::shape_t &shape = objShapes[sIdx];
-            size_t idxOffset;
-
-            // Count the number of faces of each material group.
-            std::unordered_map<uint32_t, uint32_t> matGroupNumFaces;
-            idxOffset = 0;
-            for (uint32_t fIdx = 0; fIdx < shape.mesh.num_face_vertices.size(); ++fIdx) {
-                uint32_t numFaceVertices = shape.mesh.num_face_vertices[fIdx];
-                if (numFaceVertices != 3) {
-                    idxOffset += numFaceVertices;
-                    continue;
+        // Each thread unifies vertices independently per bucket split by the hash.
+        // Vertices in each bucket are ordered by first appearance so the result is deterministic.
+        std::vector<uint32_t> cornerLocalIndices(numCorners);
+        std::vector<std::vector<uint32_t>> bucketFirstCorners(numBuckets);
+        parallelFor(numBuckets, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t bucketIdx = begin; bucketIdx < end; ++bucketIdx) {
+                std::unordered_map<VertexKey, uint32_t, VertexKeyHash> localIndices;
+                localIndices.reserve(bucketStarts[bucketIdx + 1] - bucketStarts[bucketIdx]);
+                std::vector<uint32_t> &firstCorners = bucketFirstCorners[bucketIdx];
+                for (uint32_t i = bucketStarts[bucketIdx]; i < bucketStarts[bucketIdx + 1]; ++i) {
+                    uint32_t cIdx = sortedCorners[i];
+                    auto res = localIndices.try_emplace(cornerKeys[cIdx], static_cast<uint32_t>(firstCorners.size()));
+                    if (res.second)
+                        firstCorners.push_back(cIdx);
+                    cornerLocalIndices[cIdx] = res.first->second;
                 }
-
-                uint32_t matIdx = uint32_t(shape.mesh.material_ids[fIdx]);
-                if (matGroupNumFaces.count(matIdx) == 0)
-                    matGroupNumFaces[matIdx] = 0;
-                ++matGroupNumFaces[matIdx];
-
-                idxOffset += numFaceVertices;
             }
+        });
+        sortedCorners.clear();
+        sortedCorners.shrink_to_fit();
+        cornerKeys.clear();
+        cornerKeys.shrink_to_fit();
 
-            // Prepare triangle list array for each material group.
-            std::unordered_map<uint32_t, MaterialGroup> shapeMatGroups;
-            for (auto it = matGroupNumFaces.cbegin(); it != matGroupNumFaces.cend(); ++it) {
-                MaterialGroup &matGroup = shapeMatGroups[it->first];
-                matGroup.triangles.reserve(it->second);
-                matGroup.materialIndex = it->first;
-            }
+        std::vector<uint32_t> bucketOffsets(numBuckets + 1, 0);
+        for (uint32_t bucketIdx = 0; bucketIdx < numBuckets; ++bucketIdx)
+            bucketOffsets[bucketIdx + 1] = bucketOffsets[bucketIdx] +
+                static_cast<uint32_t>(bucketFirstCorners[bucketIdx].size());
+        vertices->resize(bucketOffsets[numBuckets]);
 
-            // Write triangle list for each material group.
-            idxOffset = 0;
-            for (uint32_t fIdx = 0; fIdx < shape.mesh.num_face_vertices.size(); ++fIdx) {
-                uint32_t numFaceVertices = shape.mesh.num_face_vertices[fIdx];
-                if (numFaceVertices != 3) {
-                    idxOffset += numFaceVertices;
-                    continue;
+        // Fetch the attributes of each unified vertex from its first corner.
+        const auto fetchPosition = [&attrib](const tinyobj::index_t &idx) {
+            return float3(attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 0)],
+                          attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 1)],
+                          attrib.vertices[static_cast<uint32_t>(3 * idx.vertex_index + 2)]);
+        };
+        parallelFor(numBuckets, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t bucketIdx = begin; bucketIdx < end; ++bucketIdx) {
+                const std::vector<uint32_t> &firstCorners = bucketFirstCorners[bucketIdx];
+                for (uint32_t lvIdx = 0; lvIdx < firstCorners.size(); ++lvIdx) {
+                    uint32_t cIdx = firstCorners[lvIdx];
+                    const FaceRef &face = faces[cIdx / 3];
+                    const tinyobj::mesh_t &mesh = objShapes[face.shapeIdx].mesh;
+                    tinyobj::index_t idx = mesh.indices[face.idxOffset + cIdx % 3];
+
+                    Vertex &v = (*vertices)[bucketOffsets[bucketIdx] + lvIdx];
+                    v.position = fetchPosition(idx);
+                    if (attrib.normals.size() && idx.normal_index >= 0) {
+                        v.normal = float3(attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 0)],
+                                          attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 1)],
+                                          attrib.normals[static_cast<uint32_t>(3 * idx.normal_index + 2)]);
+                    }
+                    else {
+                        // A key of a vertex without a normal differs per face, so use the geometric normal of the face.
+                        float3 p0 = fetchPosition(mesh.indices[face.idxOffset + 0]);
+                        float3 p1 = fetchPosition(mesh.indices[face.idxOffset + 1]);
+                        float3 p2 = fetchPosition(mesh.indices[face.idxOffset + 2]);
+                        v.normal = cross(p1 - p0, p2 - p0);
+                    }
+                    v.normal = normalize(v.normal);
+                    if (attrib.texcoords.size() && idx.texcoord_index >= 0)
+                        v.texCoord = float2(attrib.texcoords[static_cast<uint32_t>(2 * idx.texcoord_index + 0)],
+                                            1 - attrib.texcoords[static_cast<uint32_t>(2 * idx.texcoord_index + 1)]); // flip V dir
+                    else
+                        v.texCoord = float2(0.0f, 0.0f);
                 }
+            }
+        });
+        bucketFirstCorners.clear();
 
-                uint32_t smoothGroupIdx = shape.mesh.smoothing_group_ids[fIdx];
-
-                tinyobj::index_t idx0 = shape.mesh.indices[idxOffset + 0];
-                tinyobj::index_t idx1 = shape.mesh.indices[idxOffset + 1];
-                tinyobj::index_t idx2 = shape.mesh.indices[idxOffset + 2];
-                auto key0 = std::make_tuple(smoothGroupIdx,
-                                            idx0.vertex_index,
-                                            idx0.normal_index >= 0 ? idx0.normal_index : static_cast<int32_t>(fIdx),
-                                            idx0.texcoord_index);
-                auto key1 = std::make_tuple(smoothGroupIdx,
-                                            idx1.vertex_index,
-                                            idx1.normal_index >= 0 ? idx1.normal_index : static_cast<int32_t>(fIdx),
-                                            idx1.texcoord_index);
-                auto key2 = std::make_tuple(smoothGroupIdx,
-                                            idx2.vertex_index,
-                                            idx2.normal_index >= 0 ? idx2.normal_index : static_cast<int32_t>(fIdx),
-                                            idx2.texcoord_index);
+        // Resolve the global vertex index of each corner.
+        std::vector<uint32_t> cornerVertexIndices(numCorners);
+        parallelFor(static_cast<uint32_t>(numCorners), [&](uint32_t begin, uint32_t end) {
+            for (uint32_t cIdx = begin; cIdx < end; ++cIdx)
+                cornerVertexIndices[cIdx] = bucketOffsets[cornerBuckets[cIdx]] + cornerLocalIndices[cIdx];
+        });
+        cornerBuckets.clear();
+        cornerLocalIndices.clear();
 
-                Triangle triangle;
-                triangle.v[0] = vertexIndices.at(key0);
-                triangle.v[1] = vertexIndices.at(key1);
-                triangle.v[2] = vertexIndices.at(key2);
+        // Extract material groups of each shape in order of first appearance.
+        size_t faceIdx = 0;
+        for (uint32_t sIdx = 0; sIdx < objShapes.size(); ++sIdx) {
+            const tinyobj::shape_t &shape = objShapes[sIdx];
+            size_t faceBegin = faceIdx;
+            while (faceIdx < faces.size() && faces[faceIdx].shapeIdx == sIdx)
+                ++faceIdx;
 
-                uint32_t matIdx = uint32_t(shape.mesh.material_ids[fIdx]);
-                shapeMatGroups[matIdx].triangles.push_back(triangle);
+            std::unordered_map<uint32_t, uint32_t> matGroupIndices;
+            size_t baseMatGroupIdx = matGroups->size();
+            for (size_t i = faceBegin; i < faceIdx; ++i) {
+                uint32_t matIdx = uint32_t(shape.mesh.material_ids[faces[i].faceIdx]);
+                auto res = matGroupIndices.try_emplace(
+                    matIdx, static_cast<uint32_t>(matGroups->size() - baseMatGroupIdx));
+                if (res.second) {
+                    MaterialGroup matGroup;
+                    matGroup.materialIndex = matIdx;
+                    matGroups->push_back(std::move(matGroup));
+                }
 
-                idxOffset += numFaceVertices;
+                Triangle triangle;
+                triangle.v[0] = cornerVertexIndices[3 * i + 0];
+                triangle.v[1] = cornerVertexIndices[3 * i + 1];
+                triangle.v[2] = cornerVertexIndices[3 * i + 2];
+                (*matGroups)[baseMatGroupIdx + res.first->second].triangles.push_back(triangle);
             }
-
-            for (auto it = shapeMatGroups.cbegin(); it != shapeMatGroups.cend(); ++it)
-                matGroups->push_back(std::move(it->second));
         }
-        vertexIndices.clear();
 
-        // Normalize accumulated vertex normals.
-        for (uint32_t vIdx = 0; vIdx < vertices->size(); ++vIdx) {
-            Vertex &v = (*vertices)[vIdx];
-            v.normal = normalize(v.normal);
-        }
+        saveCache(filepath, *vertices, *matGroups, loadedMaterials, matLibIds);
+        if (materials)
+            *materials = std::move(loadedMaterials);
     }
 
     void load(const std::filesystem::path &filepath,
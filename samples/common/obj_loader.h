@@ -24,6 +24,12 @@ namespace obj {
         uint32_t materialIndex;
     };
 
+    // JP: 2ڈȍ~OBJׂ̗ɏooCiLbV(*.meshcache)ǂݍށB
+    //     LbVOBJt@CQƂMTLt@C̃TCYXVςƍ蒼B
+    //     eNX`[̃pXOBJ̃fBNg̑΃pXŕۑB
+    // EN: Loads from the second time read the binary cache (*.meshcache) written next to the OBJ.
+    //     The cache is rebuilt when the size or the modification time of the OBJ file or the MTL files it refers to
+    //     changes. Texture paths are stored relative to the directory of the OBJ.
     void load(const std::filesystem::path &filepath,
               std::vector<Vertex>* vertices, std::vector<MaterialGroup>* matGroups,
               std::vector<Material>* materials);
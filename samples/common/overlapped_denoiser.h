@@ -0,0 +1,206 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: フレームNのTemporalデノイズを専用のストリームで実行し、フレームN+1のレンダリングとオーバーラップさせるヘルパー。
+//     デノイザーの入力(ビューティー、アルベド、法線、フロー)と出力を2組持ち、フレームごとに交互に使う。
+//     前フレームのデノイズ結果は他方の組の出力なので、previousDenoisedBeautyとdenoisedBeautyが重なることは無い。
+//     ストリーム間の依存はイベントで表し、ホストが待つことは無い。
+//     レンダーストリームはある組に書き込む前に、その組を最後に使ったデノイズ(2フレーム前)の完了のみを待つ。
+//
+//     denoise_overlap::OverlappedDenoiser overlappedDenoiser;
+//     overlappedDenoiser.initialize(cuContext, width, height);
+//     // 毎フレーム
+//     uint32_t slot = overlappedDenoiser.beginFrame(renderStream);
+//     const denoise_overlap::FrameBuffers &frame = overlappedDenoiser.getFrameBuffers(slot);
+//     pipeline.launch(renderStream, ...); // frameの入力に書き込む
+//     overlappedDenoiser.denoise(renderStream, denoiser, scratchBuffer, tasks, numTasks, resetHistory);
+//     uint32_t displaySlot = overlappedDenoiser.acquireFrameForDisplay(renderStream);
+//     // overlappedDenoiser.getFrameBuffers(displaySlot).denoisedBeautyを表示する
+//
+// EN: Helper to run temporal denoising of frame N on a dedicated stream, overlapping it with rendering frame N+1.
+//     This holds two sets of denoiser inputs (beauty, albedo, normal, flow) and outputs and alternates them per frame.
+//     The denoised result of the previous frame is the output of the other set,
+//     so previousDenoisedBeauty and denoisedBeauty never alias.
+//     Dependencies between streams are expressed with events, and the host never waits.
+//     The render stream waits only for completion of the denoising that last used a set (two frames before)
+//     before writing to it.
+//
+//     denoise_overlap::OverlappedDenoiser overlappedDenoiser;
+//     overlappedDenoiser.initialize(cuContext, width, height);
+//     // every frame
+//     uint32_t slot = overlappedDenoiser.beginFrame(renderStream);
+//     const denoise_overlap::FrameBuffers &frame = overlappedDenoiser.getFrameBuffers(slot);
+//     pipeline.launch(renderStream, ...); // write to the inputs of frame
+//     overlappedDenoiser.denoise(renderStream, denoiser, scratchBuffer, tasks, numTasks, resetHistory);
+//     uint32_t displaySlot = overlappedDenoiser.acquireFrameForDisplay(renderStream);
+//     // display overlappedDenoiser.getFrameBuffers(displaySlot).denoisedBeauty
+namespace denoise_overlap {
+    static constexpr uint32_t numSlots = 2;
+
+    struct FrameBuffers {
+        cudau::TypedBuffer<float4> beauty;
+        cudau::TypedBuffer<float4> albedo;
+        cudau::TypedBuffer<float4> normal;
+        cudau::TypedBuffer<float2> flow;
+        cudau::TypedBuffer<float4> denoisedBeauty;
+
+        void initialize(CUcontext cuContext, uint32_t numPixels) {
+            beauty.initialize(cuContext, cudau::BufferType::Device, numPixels);
+            albedo.initialize(cuContext, cudau::BufferType::Device, numPixels);
+            normal.initialize(cuContext, cudau::BufferType::Device, numPixels);
+            flow.initialize(cuContext, cudau::BufferType::Device, numPixels);
+            denoisedBeauty.initialize(cuContext, cudau::BufferType::Device, numPixels);
+        }
+        void finalize() {
+            denoisedBeauty.finalize();
+            flow.finalize();
+            normal.finalize();
+            albedo.finalize();
+            beauty.finalize();
+        }
+    };
+
+    class OverlappedDenoiser {
+        CUcontext m_cuContext;
+        CUstream m_denoiseStream;
+        FrameBuffers m_frames[numSlots];
+        CUevent m_inputsReadyEvents[numSlots];
+        CUevent m_denoiseDoneEvents[numSlots];
+        CUdeviceptr m_hdrIntensity;
+        uint32_t m_curSlot;
+        uint32_t m_numDenoisedFrames;
+
+        OverlappedDenoiser(const OverlappedDenoiser &) = delete;
+        OverlappedDenoiser &operator=(const OverlappedDenoiser &) = delete;
+
+    public:
+        OverlappedDenoiser() : m_cuContext(nullptr), m_denoiseStream(nullptr), m_hdrIntensity(0),
+            m_curSlot(numSlots - 1), m_numDenoisedFrames(0) {}
+
+        void initialize(CUcontext cuContext, uint32_t width, uint32_t height) {
+            m_cuContext = cuContext;
+            CUDADRV_CHECK(cuStreamCreate(&m_denoiseStream, 0));
+            for (uint32_t slot = 0; slot < numSlots; ++slot) {
+                m_frames[slot].initialize(cuContext, width * height);
+                CUDADRV_CHECK(cuEventCreate(&m_inputsReadyEvents[slot], CU_EVENT_DISABLE_TIMING));
+                CUDADRV_CHECK(cuEventCreate(&m_denoiseDoneEvents[slot], CU_EVENT_DISABLE_TIMING));
+            }
+            CUDADRV_CHECK(cuMemAlloc(&m_hdrIntensity, sizeof(float)));
+            m_curSlot = numSlots - 1;
+            m_numDenoisedFrames = 0;
+        }
+        void finalize() {
+            if (!m_cuContext)
+                return;
+            CUDADRV_CHECK(cuStreamSynchronize(m_denoiseStream));
+            CUDADRV_CHECK(cuMemFree(m_hdrIntensity));
+            for (int32_t slot = numSlots - 1; slot >= 0; --slot) {
+                CUDADRV_CHECK(cuEventDestroy(m_denoiseDoneEvents[slot]));
+                CUDADRV_CHECK(cuEventDestroy(m_inputsReadyEvents[slot]));
+                m_frames[slot].finalize();
+            }
+            CUDADRV_CHECK(cuStreamDestroy(m_denoiseStream));
+            m_denoiseStream = nullptr;
+            m_cuContext = nullptr;
+        }
+
+        // JP: デノイズのストリームを同期してから全ての組をリサイズする。デノイズの履歴は失われる。
+        // EN: Synchronize the denoise stream, then resize all the sets. History of denoising is lost.
+        void resize(uint32_t width, uint32_t height) {
+            synchronize();
+            for (uint32_t slot = 0; slot < numSlots; ++slot) {
+                FrameBuffers &frame = m_frames[slot];
+                frame.beauty.resize(width * height);
+                frame.albedo.resize(width * height);
+                frame.normal.resize(width * height);
+                frame.flow.resize(width * height);
+                frame.denoisedBeauty.resize(width * height);
+            }
+            m_numDenoisedFrames = 0;
+        }
+
+        // JP: デノイザーの再prepareやsetupState()の前に呼び、実行中のデノイズの完了を待つ。
+        // EN: Call this before re-preparing the denoiser or setupState() to wait for denoising in flight.
+        void synchronize() const {
+            CUDADRV_CHECK(cuStreamSynchronize(m_denoiseStream));
+        }
+
+        CUstream getDenoiseStream() const {
+            return m_denoiseStream;
+        }
+
+        // JP: 次の組に切り替え、レンダーストリームがその組を最後に使ったデノイズの完了を待つようにする。
+        //     返された組の入力へは、レンダーストリーム上でこの呼び出しの後に書き込む。
+        // EN: Switch to the next set and make the render stream wait for completion of the denoising that last used it.
+        //     Write to the inputs of the returned set on the render stream after this call.
+        uint32_t beginFrame(CUstream renderStream) {
+            m_curSlot = (m_curSlot + 1) % numSlots;
+            if (m_numDenoisedFrames >= numSlots)
+                CUDADRV_CHECK(cuStreamWaitEvent(renderStream, m_denoiseDoneEvents[m_curSlot], 0));
+            return m_curSlot;
+        }
+
+        const FrameBuffers &getFrameBuffers(uint32_t slot) const {
+            return m_frames[slot];
+        }
+
+        // JP: レンダーストリーム上で入力の書き込みが終わった時点を記録し、デノイズのストリームでそれを待ってから
+        //     computeIntensity()とinvoke()を実行する。resetHistoryが真か最初のフレームでは前フレームの結果の代わりに
+        //     ノイジーなビューティーを渡す。timerを与えた場合はデノイズの区間を計測する。
+        //     デノイザーのステートとスクラッチはデノイズのストリームでのみ使われるので1組で良い。
+        // EN: Record the point where writing inputs finished on the render stream, then run computeIntensity() and
+        //     invoke() on the denoise stream after waiting for it. Pass the noisy beauty instead of the result of
+        //     the previous frame when resetHistory is true or at the first frame.
+        //     When timer is given, this measures the denoising duration.
+        //     The state and scratch of the denoiser are used only on the denoise stream, so a single set suffices.
+        void denoise(CUstream renderStream, const optixu::Denoiser &denoiser,
+                     const optixu::BufferView &scratchBufferForIntensity,
+                     const optixu::DenoisingTask* tasks, uint32_t numTasks, bool resetHistory,
+                     const cudau::Timer* timer = nullptr) {
+            const FrameBuffers &frame = m_frames[m_curSlot];
+            const FrameBuffers &prevFrame = m_frames[(m_curSlot + numSlots - 1) % numSlots];
+            if (m_numDenoisedFrames == 0)
+                resetHistory = true;
+
+            CUDADRV_CHECK(cuEventRecord(m_inputsReadyEvents[m_curSlot], renderStream));
+            CUDADRV_CHECK(cuStreamWaitEvent(m_denoiseStream, m_inputsReadyEvents[m_curSlot], 0));
+            if (timer)
+                timer->start(m_denoiseStream);
+            denoiser.computeIntensity(m_denoiseStream,
+                                      frame.beauty, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                      scratchBufferForIntensity, m_hdrIntensity);
+            for (uint32_t taskIdx = 0; taskIdx < numTasks; ++taskIdx)
+                denoiser.invoke(m_denoiseStream,
+                                false, m_hdrIntensity, 0.0f,
+                                frame.beauty, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                frame.albedo, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                frame.normal, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                frame.flow, OPTIX_PIXEL_FORMAT_FLOAT2,
+                                resetHistory ? frame.beauty : prevFrame.denoisedBeauty,
+                                frame.denoisedBeauty,
+                                tasks[taskIdx]);
+            if (timer)
+                timer->stop(m_denoiseStream);
+            CUDADRV_CHECK(cuEventRecord(m_denoiseDoneEvents[m_curSlot], m_denoiseStream));
+            ++m_numDenoisedFrames;
+        }
+
+        // JP: 表示する組を返し、streamがそのデノイズの完了を待つようにする。
+        //     オーバーラップを保つため、前フレームの結果があればそれを返す(1フレームの遅延)。
+        //     スクリーンショットなど現在のフレームの結果が必要な場合はcurrentFrameをtrueにする。
+        //     この場合オーバーラップは失われる。
+        //     返された組の読み出しは次のbeginFrame()より前にstreamに積む必要がある。
+        // EN: Return the set to display and make stream wait for completion of its denoising.
+        //     To keep the overlap, this returns the result of the previous frame if any (one frame of latency).
+        //     Set currentFrame to true when the result of the current frame is required like for a screenshot.
+        //     The overlap is lost in this case.
+        //     Reads of the returned set need to be enqueued to stream before the next beginFrame().
+        uint32_t acquireFrameForDisplay(CUstream stream, bool currentFrame = false) const {
+            uint32_t slot = (m_numDenoisedFrames >= 2 && !currentFrame) ?
+                (m_curSlot + numSlots - 1) % numSlots : m_curSlot;
+            CUDADRV_CHECK(cuStreamWaitEvent(stream, m_denoiseDoneEvents[slot], 0));
+            return slot;
+        }
+    };
+}
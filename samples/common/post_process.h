@@ -0,0 +1,178 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 累積バッファーの解決、露出、トーンマップ、ガンマ補正、デノイズ結果とのブレンド、デバッグ用AOVの選択を
+//     1パスで行い、表示用のサーフェス(InteropSurfaceObjectHolderの返すCUsurfObject)に直接書き込むポストプロセス。
+//     中間のリニアバッファーへのコピーやパスごとの全画面の読み書きが不要になる。
+//
+//     各サンプルは自身のカーネルからpostProcess()を呼ぶ(uberのpost_process.cuを参照)。
+//
+//     CUDA_DEVICE_KERNEL void postProcess(
+//         optixu::BlockBuffer2D<float4, 1> accumBuffer, uint2 imageSize,
+//         post_process::Inputs inputs, post_process::Settings settings, CUsurfObject outputSurface) {
+//         post_process::postProcess(accumBuffer, imageSize, inputs, settings, outputSurface);
+//     }
+//
+// EN: Post process doing accumulation buffer resolve, exposure, tone mapping, gamma correction,
+//     blending with the denoised result and selection of a debug AOV in one pass,
+//     and writing directly into the display surface (CUsurfObject returned by InteropSurfaceObjectHolder).
+//     This removes copies to intermediate linear buffers and full-screen reads/writes per pass.
+//
+//     Each sample calls postProcess() from its own kernel (see uber's post_process.cu).
+//
+//     CUDA_DEVICE_KERNEL void postProcess(
+//         optixu::BlockBuffer2D<float4, 1> accumBuffer, uint2 imageSize,
+//         post_process::Inputs inputs, post_process::Settings settings, CUsurfObject outputSurface) {
+//         post_process::postProcess(accumBuffer, imageSize, inputs, settings, outputSurface);
+//     }
+namespace post_process {
+    enum class ToneMap : uint32_t {
+        None = 0,
+        Exponential, // 1 - exp(-x)
+        Reinhard, // x / (1 + x)
+        ACES, // Narkowicz's fit
+    };
+
+    // JP: 表示用サーフェスに書く前の伝達関数。
+    //     ウィンドウのフレームバッファーがsRGBの場合などはNoneのままにする。
+    // EN: Transfer function before writing to the display surface.
+    //     Keep None for example when the framebuffer of the window is sRGB.
+    enum class Transfer : uint32_t {
+        None = 0,
+        sRGB,
+        Gamma,
+    };
+
+    enum class AOV : uint32_t {
+        Beauty = 0, // Blend of noisy and denoised according to denoisedWeight.
+        NoisyBeauty,
+        DenoisedBeauty,
+        Albedo,
+        Normal,
+    };
+
+    struct Settings {
+        float exposure; // EV
+        ToneMap toneMap;
+        Transfer transfer;
+        float gamma;
+        float denoisedWeight;
+        AOV aov;
+
+        static Settings getDefault() {
+            Settings ret;
+            ret.exposure = 0.0f;
+            ret.toneMap = ToneMap::Exponential;
+            ret.transfer = Transfer::None;
+            ret.gamma = 2.2f;
+            ret.denoisedWeight = 1.0f;
+            ret.aov = AOV::Beauty;
+            return ret;
+        }
+    };
+
+    // JP: デノイザーの出力やガイドレイヤーなどのリニアなfloat4バッファー(行優先、幅はimageSize.x)。
+    //     使わないものはnullptrにする。denoisedBeautyがnullptrの場合はノイジーな結果を使う。
+    // EN: Linear float4 buffers (row-major, width is imageSize.x) like the output of the denoiser and guide layers.
+    //     Set nullptr for unused ones. The noisy result is used when denoisedBeauty is nullptr.
+    struct Inputs {
+        const float4* denoisedBeauty;
+        const float4* albedo;
+        const float4* normal;
+    };
+
+    CUDA_DEVICE_FUNCTION float applyToneMap(ToneMap toneMap, float value) {
+        value = std::fmax(value, 0.0f);
+        switch (toneMap) {
+        case ToneMap::Exponential:
+            return 1 - std::exp(-value);
+        case ToneMap::Reinhard:
+            return value / (1 + value);
+        case ToneMap::ACES:
+            return std::fmin(std::fmax((value * (2.51f * value + 0.03f)) /
+                                       (value * (2.43f * value + 0.59f) + 0.14f), 0.0f), 1.0f);
+        default:
+            return value;
+        }
+    }
+
+    CUDA_DEVICE_FUNCTION float applyTransfer(const Settings &settings, float value) {
+        value = std::fmax(value, 0.0f);
+        if (settings.transfer == Transfer::sRGB)
+            return sRGB_gamma_s(value);
+        else if (settings.transfer == Transfer::Gamma)
+            return std::pow(value, 1.0f / settings.gamma);
+        return value;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    CUDA_DEVICE_FUNCTION float4 readAccumulation(
+        const optixu::NativeBlockBuffer2D<float4> &accumBuffer, const uint2 &pix) {
+        return accumBuffer.read(pix);
+    }
+    template <uint32_t log2BlockWidth>
+    CUDA_DEVICE_FUNCTION float4 readAccumulation(
+        const optixu::BlockBuffer2D<float4, log2BlockWidth> &accumBuffer, const uint2 &pix) {
+        return accumBuffer[pix];
+    }
+
+    // JP: 累積バッファーのwには累積したサンプル数(または重み)が入っていることを想定して割る。
+    //     wがゼロのピクセルは黒になる。
+    // EN: Assume w of the accumulation buffer holds the accumulated number of samples (or weight) to divide by.
+    //     Pixels with zero w become black.
+    template <typename AccumBufferType>
+    CUDA_DEVICE_FUNCTION void postProcess(
+        const AccumBufferType &accumBuffer, const uint2 &imageSize,
+        const Inputs &inputs, const Settings &settings, CUsurfObject outputSurface) {
+        uint2 pix = make_uint2(blockDim.x * blockIdx.x + threadIdx.x,
+                               blockDim.y * blockIdx.y + threadIdx.y);
+        if (pix.x >= imageSize.x || pix.y >= imageSize.y)
+            return;
+        uint32_t linearIndex = pix.y * imageSize.x + pix.x;
+
+        float3 value = make_float3(0.0f, 0.0f, 0.0f);
+        bool isColor = true;
+        if (settings.aov == AOV::Albedo) {
+            if (inputs.albedo)
+                value = getXYZ(inputs.albedo[linearIndex]);
+            isColor = false;
+        }
+        else if (settings.aov == AOV::Normal) {
+            if (inputs.normal) {
+                float3 normal = getXYZ(inputs.normal[linearIndex]);
+                if (normal.x != 0 || normal.y != 0 || normal.z != 0)
+                    value = 0.5f * normalize(normal) + make_float3(0.5f, 0.5f, 0.5f);
+            }
+            isColor = false;
+        }
+        else {
+            float3 noisy = make_float3(0.0f, 0.0f, 0.0f);
+            if (settings.aov != AOV::DenoisedBeauty || !inputs.denoisedBeauty) {
+                float4 accum = readAccumulation(accumBuffer, pix);
+                if (accum.w > 0.0f)
+                    noisy = getXYZ(accum) / accum.w;
+            }
+            if (inputs.denoisedBeauty && settings.aov != AOV::NoisyBeauty) {
+                float3 denoised = getXYZ(inputs.denoisedBeauty[linearIndex]);
+                float weight = settings.aov == AOV::DenoisedBeauty ? 1.0f : settings.denoisedWeight;
+                value = noisy + weight * (denoised - noisy);
+            }
+            else {
+                value = noisy;
+            }
+        }
+
+        if (isColor) {
+            float scale = std::exp2(settings.exposure);
+            value.x = applyToneMap(settings.toneMap, scale * value.x);
+            value.y = applyToneMap(settings.toneMap, scale * value.y);
+            value.z = applyToneMap(settings.toneMap, scale * value.z);
+        }
+        value.x = applyTransfer(settings, value.x);
+        value.y = applyTransfer(settings, value.y);
+        value.z = applyTransfer(settings, value.z);
+        surf2Dwrite(make_float4(value, 1.0f), outputSurface, pix.x * sizeof(float4), pix.y);
+    }
+#endif
+}
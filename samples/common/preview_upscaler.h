@@ -0,0 +1,287 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: インタラクティブなプレビュー用に、解像度を落としてレンダリングした画像をデノイズし、
+//     フル解像度のアルベドと法線をガイドに使ってアップスケールするステージ。
+//     低解像度のバッファー群とDenoiser::prepare()のサイズ計算を管理する。
+//     アップスケールはアルベドで割った照明成分をジョイントバイラテラルフィルターで補間し、
+//     フル解像度のアルベドを掛け戻すので、テクスチャーの細部とエッジはフル解像度のまま保たれる。
+//     ガイドはプライマリーレイのみのトレースやラスタライズなど安価な方法で生成すれば良い。
+//
+//     preview_upscaler::PreviewUpscaler upscaler;
+//     upscaler.initialize(cuContext, upscalerModule, optixContext, cudau::BufferType::Device);
+//     upscaler.resize(stream, windowWidth, windowHeight, 2); // 縦横1/2で描画
+//     // 毎フレーム
+//     // upscaler.getLowResBeautyBuffer()へupscaler.getLowResImageSize()の解像度でレンダリングする。
+//     // fullResAlbedo/Normalにはフル解像度のガイドを書く。
+//     upscaler.process(stream, fullResAlbedo, fullResNormal, outputBuffer);
+//
+// EN: Stage for interactive preview which denoises an image rendered at a reduced resolution
+//     and upscales it using full resolution albedo and normal as guides.
+//     This manages the low resolution buffers and the sizing of Denoiser::prepare().
+//     The upscaling interpolates the illumination divided by albedo with a joint bilateral filter
+//     and multiplies back the full resolution albedo, so texture details and edges are kept at full resolution.
+//     The guides can be generated by cheap means like tracing only primary rays or rasterization.
+//
+//     preview_upscaler::PreviewUpscaler upscaler;
+//     upscaler.initialize(cuContext, upscalerModule, optixContext, cudau::BufferType::Device);
+//     upscaler.resize(stream, windowWidth, windowHeight, 2); // render at 1/2 width and height
+//     // every frame
+//     // Render into upscaler.getLowResBeautyBuffer() at the resolution of upscaler.getLowResImageSize().
+//     // Write full resolution guides to fullResAlbedo/Normal.
+//     upscaler.process(stream, fullResAlbedo, fullResNormal, outputBuffer);
+namespace preview_upscaler {
+    static constexpr float albedoEpsilon = 1e-3f;
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: フル解像度のガイドをボックスフィルターで低解像度に縮小する。デノイザーのガイドとアップスケールの両方に使う。
+    // EN: Downsample full resolution guides to low resolution with a box filter.
+    //     These are used both as guides for the denoiser and for the upscaling.
+    CUDA_DEVICE_FUNCTION void downsampleGuides(
+        const float4* fullResAlbedo, const float4* fullResNormal, uint2 fullResSize,
+        uint2 lowResSize, uint32_t scaleDivisor,
+        float4* lowResAlbedo, float4* lowResNormal) {
+        uint32_t numPixels = lowResSize.x * lowResSize.y;
+        for (uint32_t pixIdx = blockDim.x * blockIdx.x + threadIdx.x; pixIdx < numPixels;
+             pixIdx += blockDim.x * gridDim.x) {
+            uint2 lowResPix = make_uint2(pixIdx % lowResSize.x, pixIdx / lowResSize.x);
+            float4 albedoSum = make_float4(0.0f);
+            float3 normalSum = make_float3(0.0f, 0.0f, 0.0f);
+            uint32_t numSamples = 0;
+            for (uint32_t dy = 0; dy < scaleDivisor; ++dy) {
+                uint32_t y = lowResPix.y * scaleDivisor + dy;
+                if (y >= fullResSize.y)
+                    break;
+                for (uint32_t dx = 0; dx < scaleDivisor; ++dx) {
+                    uint32_t x = lowResPix.x * scaleDivisor + dx;
+                    if (x >= fullResSize.x)
+                        break;
+                    uint32_t fullResPixIdx = y * fullResSize.x + x;
+                    albedoSum += fullResAlbedo[fullResPixIdx];
+                    normalSum += getXYZ(fullResNormal[fullResPixIdx]);
+                    ++numSamples;
+                }
+            }
+            float recNumSamples = numSamples > 0 ? 1.0f / numSamples : 0.0f;
+            lowResAlbedo[pixIdx] = albedoSum * recNumSamples;
+            lowResNormal[pixIdx] = make_float4(normalSum * recNumSamples, 0.0f);
+        }
+    }
+
+    // JP: 低解像度のデノイズ結果をアルベドで割った照明成分を、双線形の重みにフル解像度のピクセルとの
+    //     法線とアルベドの類似度を掛けた重みで補間し、フル解像度のアルベドを掛け戻す。
+    //     全ての重みが小さい場合(細い物体など)は双線形補間に戻す。
+    // EN: Interpolate the illumination component, low resolution denoised result divided by albedo,
+    //     with weights of bilinear multiplied by normal and albedo similarity to the full resolution pixel,
+    //     then multiply back the full resolution albedo.
+    //     Fall back to bilinear interpolation when all the weights are small (e.g. thin objects).
+    CUDA_DEVICE_FUNCTION void upscaleGuided(
+        const float4* lowResDenoised, const float4* lowResAlbedo, const float4* lowResNormal, uint2 lowResSize,
+        const float4* fullResAlbedo, const float4* fullResNormal, uint2 fullResSize, uint32_t scaleDivisor,
+        float normalSharpness, float albedoSharpness,
+        float4* output) {
+        uint32_t numPixels = fullResSize.x * fullResSize.y;
+        for (uint32_t pixIdx = blockDim.x * blockIdx.x + threadIdx.x; pixIdx < numPixels;
+             pixIdx += blockDim.x * gridDim.x) {
+            uint2 pix = make_uint2(pixIdx % fullResSize.x, pixIdx / fullResSize.x);
+            float4 albedo = fullResAlbedo[pixIdx];
+            float3 normal = getXYZ(fullResNormal[pixIdx]);
+
+            float2 lowResPos = make_float2((pix.x + 0.5f) / scaleDivisor - 0.5f,
+                                           (pix.y + 0.5f) / scaleDivisor - 0.5f);
+            int32_t baseX = static_cast<int32_t>(floorf(lowResPos.x));
+            int32_t baseY = static_cast<int32_t>(floorf(lowResPos.y));
+            float fx = lowResPos.x - baseX;
+            float fy = lowResPos.y - baseY;
+
+            float3 guidedSum = make_float3(0.0f, 0.0f, 0.0f);
+            float guidedWeightSum = 0.0f;
+            float3 bilinearSum = make_float3(0.0f, 0.0f, 0.0f);
+            float alpha = 0.0f;
+            for (int32_t j = 0; j < 2; ++j) {
+                int32_t y = min(max(baseY + j, 0), static_cast<int32_t>(lowResSize.y) - 1);
+                float wy = j == 0 ? 1 - fy : fy;
+                for (int32_t i = 0; i < 2; ++i) {
+                    int32_t x = min(max(baseX + i, 0), static_cast<int32_t>(lowResSize.x) - 1);
+                    float wBilinear = (i == 0 ? 1 - fx : fx) * wy;
+                    uint32_t lowResPixIdx = y * lowResSize.x + x;
+                    float4 denoised = lowResDenoised[lowResPixIdx];
+                    float3 sampleAlbedo = getXYZ(lowResAlbedo[lowResPixIdx]);
+                    float3 illumination = getXYZ(denoised) / max(sampleAlbedo, make_float3(albedoEpsilon));
+
+                    float3 sampleNormal = getXYZ(lowResNormal[lowResPixIdx]);
+                    float normalSim = max(dot(normal, sampleNormal), 0.0f);
+                    float albedoDiff = length(getXYZ(albedo) - sampleAlbedo);
+                    float wGuide = powf(normalSim, normalSharpness) * expf(-albedoSharpness * albedoDiff);
+                    float w = wBilinear * wGuide;
+
+                    guidedSum += w * illumination;
+                    guidedWeightSum += w;
+                    bilinearSum += wBilinear * illumination;
+                    alpha += wBilinear * denoised.w;
+                }
+            }
+
+            float3 illumination = guidedWeightSum > 1e-4f ? guidedSum / guidedWeightSum : bilinearSum;
+            float3 value = illumination * max(getXYZ(albedo), make_float3(albedoEpsilon));
+            output[pixIdx] = make_float4(value, alpha);
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    class PreviewUpscaler {
+        CUcontext m_cuContext;
+        cudau::BufferType m_bufferType;
+        optixu::Denoiser m_denoiser;
+        cudau::Kernel m_downsampleGuides;
+        cudau::Kernel m_upscaleGuided;
+
+        uint2 m_fullResSize;
+        uint2 m_lowResSize;
+        uint32_t m_scaleDivisor;
+        cudau::TypedBuffer<float4> m_lowResBeauty;
+        cudau::TypedBuffer<float4> m_lowResAlbedo;
+        cudau::TypedBuffer<float4> m_lowResNormal;
+        cudau::TypedBuffer<float4> m_lowResDenoised;
+        cudau::Buffer m_denoiserState;
+        cudau::Buffer m_denoiserScratch;
+        cudau::TypedBuffer<float> m_hdrIntensity;
+        std::vector<optixu::DenoisingTask> m_denoisingTasks;
+
+        float m_normalSharpness;
+        float m_albedoSharpness;
+
+        void finalizeBuffers() {
+            m_hdrIntensity.finalize();
+            m_denoiserScratch.finalize();
+            m_denoiserState.finalize();
+            m_lowResDenoised.finalize();
+            m_lowResNormal.finalize();
+            m_lowResAlbedo.finalize();
+            m_lowResBeauty.finalize();
+            m_denoisingTasks.clear();
+        }
+
+    public:
+        PreviewUpscaler() :
+            m_cuContext(nullptr),
+            m_fullResSize(make_uint2(0, 0)), m_lowResSize(make_uint2(0, 0)), m_scaleDivisor(1),
+            m_normalSharpness(8.0f), m_albedoSharpness(8.0f) {}
+
+        void initialize(CUcontext cuContext, CUmodule upscalerModule, optixu::Context optixContext,
+                        cudau::BufferType type) {
+            m_cuContext = cuContext;
+            m_bufferType = type;
+            m_denoiser = optixContext.createDenoiser(OPTIX_DENOISER_MODEL_KIND_HDR, true, true);
+            m_downsampleGuides.set(upscalerModule, "downsampleGuides", cudau::AutoBlockDim(), 0);
+            m_upscaleGuided.set(upscalerModule, "upscaleGuided", cudau::AutoBlockDim(), 0);
+        }
+        void finalize() {
+            finalizeBuffers();
+            if (m_denoiser)
+                m_denoiser.destroy();
+            m_denoiser = optixu::Denoiser();
+        }
+
+        // JP: フル解像度と縮小率を設定して低解像度のバッファーを確保し、デノイザーのステートをセットアップする。
+        //     ウインドウのリサイズやプレビューの品質の切り替え時に呼ぶ。
+        // EN: Set the full resolution and the scale divisor, allocate low resolution buffers
+        //     and set up the denoiser state. Call this on window resizing or switching the preview quality.
+        void resize(CUstream stream, uint32_t fullResWidth, uint32_t fullResHeight, uint32_t scaleDivisor) {
+            if (scaleDivisor == 0 || scaleDivisor > 8)
+                throw std::runtime_error("Scale divisor must be in the range [1, 8].");
+            finalizeBuffers();
+
+            m_fullResSize = make_uint2(fullResWidth, fullResHeight);
+            m_scaleDivisor = scaleDivisor;
+            m_lowResSize = make_uint2((fullResWidth + scaleDivisor - 1) / scaleDivisor,
+                                      (fullResHeight + scaleDivisor - 1) / scaleDivisor);
+            uint32_t numLowResPixels = m_lowResSize.x * m_lowResSize.y;
+
+            size_t stateSize;
+            size_t scratchSize;
+            size_t scratchSizeForComputeIntensity;
+            uint32_t numTasks;
+            m_denoiser.prepare(m_lowResSize.x, m_lowResSize.y, 0, 0,
+                               &stateSize, &scratchSize, &scratchSizeForComputeIntensity,
+                               &numTasks);
+
+            m_lowResBeauty.initialize(m_cuContext, m_bufferType, numLowResPixels);
+            m_lowResAlbedo.initialize(m_cuContext, m_bufferType, numLowResPixels);
+            m_lowResNormal.initialize(m_cuContext, m_bufferType, numLowResPixels);
+            m_lowResDenoised.initialize(m_cuContext, m_bufferType, numLowResPixels);
+            m_denoiserState.initialize(m_cuContext, m_bufferType, stateSize, 1);
+            m_denoiserScratch.initialize(m_cuContext, m_bufferType,
+                                         std::max(scratchSize, scratchSizeForComputeIntensity), 1);
+            m_hdrIntensity.initialize(m_cuContext, m_bufferType, 1);
+
+            m_denoisingTasks.resize(numTasks);
+            m_denoiser.getTasks(m_denoisingTasks.data());
+            m_denoiser.setupState(stream, m_denoiserState, m_denoiserScratch);
+        }
+
+        // JP: アップスケールのガイドの鋭さ。大きいほど法線やアルベドの異なる低解像度ピクセルからの寄与が減る。
+        // EN: Sharpness of the upscaling guides. The larger, the less contribution from low resolution pixels
+        //     with different normal or albedo.
+        void setGuideSharpness(float normalSharpness, float albedoSharpness) {
+            m_normalSharpness = normalSharpness;
+            m_albedoSharpness = albedoSharpness;
+        }
+
+        uint2 getLowResImageSize() const {
+            return m_lowResSize;
+        }
+        uint32_t getScaleDivisor() const {
+            return m_scaleDivisor;
+        }
+        // JP: レンダラーはこのバッファーに線形色空間のRGBAでレンダリングする。
+        // EN: The renderer renders into this buffer in RGBA of linear color space.
+        const cudau::TypedBuffer<float4> &getLowResBeautyBuffer() const {
+            return m_lowResBeauty;
+        }
+
+        // JP: fullResAlbedo, fullResNormal, outputはフル解像度のfloat4画像。
+        //     法線はデノイザーと同じくカメラ空間で正規化されたものを与える。
+        // EN: fullResAlbedo, fullResNormal, output are full resolution float4 images.
+        //     Give normals normalized in camera space as the same as for the denoiser.
+        void process(CUstream stream,
+                     const cudau::TypedBuffer<float4> &fullResAlbedo, const cudau::TypedBuffer<float4> &fullResNormal,
+                     const cudau::TypedBuffer<float4> &output) const {
+            uint32_t numFullResPixels = m_fullResSize.x * m_fullResSize.y;
+            if (fullResAlbedo.numElements() < numFullResPixels ||
+                fullResNormal.numElements() < numFullResPixels ||
+                output.numElements() < numFullResPixels)
+                throw std::runtime_error("Full resolution buffers are too small.");
+
+            m_downsampleGuides.launchPersistent(
+                stream,
+                fullResAlbedo.getDevicePointer(), fullResNormal.getDevicePointer(), m_fullResSize,
+                m_lowResSize, m_scaleDivisor,
+                m_lowResAlbedo.getDevicePointer(), m_lowResNormal.getDevicePointer());
+
+            m_denoiser.computeIntensity(stream, m_lowResBeauty, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                        m_denoiserScratch, m_hdrIntensity.getCUdeviceptr());
+            for (const optixu::DenoisingTask &task : m_denoisingTasks)
+                m_denoiser.invoke(stream,
+                                  false, m_hdrIntensity.getCUdeviceptr(), 0.0f,
+                                  m_lowResBeauty, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  m_lowResAlbedo, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  m_lowResNormal, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT2,
+                                  optixu::BufferView(),
+                                  m_lowResDenoised,
+                                  task);
+
+            m_upscaleGuided.launchPersistent(
+                stream,
+                m_lowResDenoised.getDevicePointer(), m_lowResAlbedo.getDevicePointer(),
+                m_lowResNormal.getDevicePointer(), m_lowResSize,
+                fullResAlbedo.getDevicePointer(), fullResNormal.getDevicePointer(), m_fullResSize, m_scaleDivisor,
+                m_normalSharpness, m_albedoSharpness,
+                output.getDevicePointer());
+        }
+    };
+#endif
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include "preview_upscaler.h"
+
+// JP: preview_upscaler::PreviewUpscalerが使うカーネル。プレビューのアップスケールを使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernels used by preview_upscaler::PreviewUpscaler. A sample using the preview upscaling compiles this file
+//     to PTX as well.
+
+CUDA_DEVICE_KERNEL void downsampleGuides(
+    const float4* fullResAlbedo, const float4* fullResNormal, uint2 fullResSize,
+    uint2 lowResSize, uint32_t scaleDivisor,
+    float4* lowResAlbedo, float4* lowResNormal) {
+    preview_upscaler::downsampleGuides(fullResAlbedo, fullResNormal, fullResSize,
+                                       lowResSize, scaleDivisor,
+                                       lowResAlbedo, lowResNormal);
+}
+
+CUDA_DEVICE_KERNEL void upscaleGuided(
+    const float4* lowResDenoised, const float4* lowResAlbedo, const float4* lowResNormal, uint2 lowResSize,
+    const float4* fullResAlbedo, const float4* fullResNormal, uint2 fullResSize, uint32_t scaleDivisor,
+    float normalSharpness, float albedoSharpness,
+    float4* output) {
+    preview_upscaler::upscaleGuided(lowResDenoised, lowResAlbedo, lowResNormal, lowResSize,
+                                    fullResAlbedo, fullResNormal, fullResSize, scaleDivisor,
+                                    normalSharpness, albedoSharpness,
+                                    output);
+}
@@ -0,0 +1,186 @@
+﻿#include "raster_gbuffer.h"
+
+namespace raster_gbuffer {
+    static const char* s_vertexShaderSource = R"(#version 460
+
+layout(location = 0) in vec3 position;
+
+layout(location = 0) uniform mat3 invOrientation;
+layout(location = 1) uniform vec3 cameraPosition;
+// (2 / vw, 2 / vh, zNear, zFar)
+layout(location = 2) uniform vec4 projParams;
+layout(location = 3) uniform vec4 transform[3];
+
+out vec3 vPosInWorld;
+
+void main(void) {
+    vec4 p = vec4(position, 1.0f);
+    vPosInWorld = vec3(dot(transform[0], p), dot(transform[1], p), dot(transform[2], p));
+    vec3 posInView = invOrientation * (vPosInWorld - cameraPosition);
+    float n = projParams.z;
+    float f = projParams.w;
+    // The x axis is flipped to match the camera convention of the ray generation programs.
+    gl_Position = vec4(-posInView.x * projParams.x, posInView.y * projParams.y,
+                       ((f + n) * posInView.z - 2 * f * n) / (f - n), posInView.z);
+}
+)";
+
+    static const char* s_fragmentShaderSource = R"(#version 460
+#extension GL_NV_fragment_shader_barycentric : require
+
+layout(location = 1) uniform vec3 cameraPosition;
+// (instanceID, geometryIndex)
+layout(location = 6) uniform uvec2 ids;
+
+in vec3 vPosInWorld;
+
+layout(location = 0) out uvec4 outIDs;
+layout(location = 1) out vec4 outAttributes;
+
+void main(void) {
+    outIDs = uvec4(ids.x, ids.y, uint(gl_PrimitiveID), 0);
+    outAttributes = vec4(gl_BaryCoordNV.y, gl_BaryCoordNV.z, length(vPosInWorld - cameraPosition), 0.0f);
+}
+)";
+
+    void Rasterizer::initializeTargets(uint32_t width, uint32_t height) {
+        const GLenum colorFormats[] = { GL_RGBA32UI, GL_RGBA32F };
+        const GLenum depthFormat = GL_DEPTH_COMPONENT32F;
+        m_frameBuffer.initialize(width, height, 1, colorFormats, 0, 2, &depthFormat, false);
+
+        m_idArray.initializeFromGLTexture2D(
+            m_cuContext, m_frameBuffer.getRenderTargetTexture(0, 0).getHandle(),
+            cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
+        m_attributeArray.initializeFromGLTexture2D(
+            m_cuContext, m_frameBuffer.getRenderTargetTexture(1, 0).getHandle(),
+            cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable);
+        m_mapBatch.clear();
+        m_mapBatch.add(&m_idArray);
+        m_mapBatch.add(&m_attributeArray);
+    }
+
+    void Rasterizer::finalizeTargets() {
+        if (m_attributeSurfObj)
+            CUDADRV_CHECK(cuSurfObjectDestroy(m_attributeSurfObj));
+        if (m_idSurfObj)
+            CUDADRV_CHECK(cuSurfObjectDestroy(m_idSurfObj));
+        m_attributeSurfObj = 0;
+        m_idSurfObj = 0;
+        m_mapBatch.clear();
+        m_attributeArray.finalize();
+        m_idArray.finalize();
+        m_frameBuffer.finalize();
+    }
+
+    void Rasterizer::initialize(CUcontext cuContext, uint32_t width, uint32_t height) {
+        if (m_initialized)
+            throw std::runtime_error("Rasterizer is already initialized.");
+
+        m_cuContext = cuContext;
+        m_program.initializeVSPS(s_vertexShaderSource, s_fragmentShaderSource);
+
+        m_vertexArray.initialize();
+        GLuint vao = m_vertexArray.getHandle();
+        glEnableVertexArrayAttrib(vao, 0);
+        glVertexArrayAttribFormat(vao, 0, 3, GL_FLOAT, GL_FALSE, 0);
+        glVertexArrayAttribBinding(vao, 0, 0);
+
+        initializeTargets(width, height);
+
+        m_initialized = true;
+    }
+
+    void Rasterizer::finalize() {
+        if (!m_initialized)
+            return;
+
+        finalizeTargets();
+        m_vertexArray.finalize();
+        m_program.finalize();
+        m_cuContext = nullptr;
+
+        m_initialized = false;
+    }
+
+    void Rasterizer::resize(uint32_t width, uint32_t height) {
+        if (!m_initialized)
+            throw std::runtime_error("Rasterizer is not initialized.");
+        finalizeTargets();
+        initializeTargets(width, height);
+    }
+
+    void Rasterizer::draw(const Camera &camera, float zNear, float zFar, const DrawItem* items, uint32_t numItems) {
+        if (!m_initialized)
+            throw std::runtime_error("Rasterizer is not initialized.");
+
+        GLint prevViewport[4];
+        GLint prevDrawFrameBuffer;
+        glGetIntegerv(GL_VIEWPORT, prevViewport);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevDrawFrameBuffer);
+        GLboolean prevDepthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean prevCullFace = glIsEnabled(GL_CULL_FACE);
+
+        GLuint fb = m_frameBuffer.getHandle(0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fb);
+        m_frameBuffer.setDrawBuffers();
+        glViewport(0, 0, m_frameBuffer.getWidth(), m_frameBuffer.getHeight());
+        // JP: レイトレーシングと同様に裏面も描く。
+        // EN: Draw back faces as well as ray tracing.
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_CULL_FACE);
+
+        const GLuint clearIDs[4] = { invalidInstanceID, 0, 0, 0 };
+        const GLfloat clearAttributes[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const GLfloat clearDepth = 1.0f;
+        glClearNamedFramebufferuiv(fb, GL_COLOR, 0, clearIDs);
+        glClearNamedFramebufferfv(fb, GL_COLOR, 1, clearAttributes);
+        glClearNamedFramebufferfv(fb, GL_DEPTH, 0, &clearDepth);
+
+        GLuint program = m_program.getHandle();
+        glUseProgram(program);
+        Matrix3x3 invOrientation = inverse(camera.orientation);
+        float vh = 2 * std::tan(camera.fovY * 0.5f);
+        float vw = camera.aspect * vh;
+        glProgramUniformMatrix3fv(program, 0, 1, GL_FALSE, &invOrientation.m00);
+        glProgramUniform3f(program, 1, camera.position.x, camera.position.y, camera.position.z);
+        glProgramUniform4f(program, 2, 2 / vw, 2 / vh, zNear, zFar);
+
+        GLuint vao = m_vertexArray.getHandle();
+        glBindVertexArray(vao);
+        for (uint32_t i = 0; i < numItems; ++i) {
+            const DrawItem &item = items[i];
+            glVertexArrayVertexBuffer(vao, 0, item.vertexBuffer, item.positionOffset, item.vertexStride);
+            glVertexArrayElementBuffer(vao, item.triangleBuffer);
+            glProgramUniform4fv(program, 3, 3, item.transform);
+            glProgramUniform2ui(program, 6, item.instanceID, item.geometryIndex);
+            glDrawElements(GL_TRIANGLES, 3 * item.numTriangles, GL_UNSIGNED_INT, nullptr);
+        }
+        glBindVertexArray(0);
+
+        m_frameBuffer.resetDrawBuffers();
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevDrawFrameBuffer);
+        glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+        if (!prevDepthTest)
+            glDisable(GL_DEPTH_TEST);
+        if (prevCullFace)
+            glEnable(GL_CULL_FACE);
+    }
+
+    void Rasterizer::beginCUDAAccess(CUstream stream) {
+        m_mapBatch.beginCUDAAccess(stream);
+        // JP: 前のフレームの面オブジェクトはここまで使われ得るので、作り直す直前に破棄する。
+        // EN: Surface objects of the previous frame can be in use until here,
+        //     so destroy them right before recreating.
+        if (m_attributeSurfObj)
+            CUDADRV_CHECK(cuSurfObjectDestroy(m_attributeSurfObj));
+        if (m_idSurfObj)
+            CUDADRV_CHECK(cuSurfObjectDestroy(m_idSurfObj));
+        m_idSurfObj = m_idArray.createGLSurfaceObject(0);
+        m_attributeSurfObj = m_attributeArray.createGLSurfaceObject(0);
+    }
+
+    void Rasterizer::endCUDAAccess(CUstream stream) {
+        m_mapBatch.endCUDAAccess(stream);
+    }
+}
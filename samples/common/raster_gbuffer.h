@@ -0,0 +1,181 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 一次可視性をラスタライズしたGバッファーからレイ生成を始めるハイブリッド描画のユーティリティー。
+//     インタラクティブな描画では一次レイは最もコヒーレントでラスタライズが安価なので、
+//     OpenGLでインスタンスID、ジオメトリインデックス、プリミティブインデックス、重心座標、距離をGバッファーに描き、
+//     CUDAと共有してレイ生成プログラムはカメラレイをトレースせずに最初のヒットから始める。
+//     ピクセルあたり1回のトレースがフレームごとに省ける。
+//     prim. indexはgl_PrimitiveIDなので、三角形バッファーはGeometryInstanceに設定したものと同じ並びで描く必要がある。
+//     重心座標の取得にGL_NV_fragment_shader_barycentricを使う。
+//
+//     raster_gbuffer::Rasterizer rasterizer;
+//     rasterizer.initialize(cuContext, width, height);
+//     // 毎フレーム
+//     rasterizer.draw(camera, 0.01f, 1000.0f, drawItems.data(), numDrawItems);
+//     rasterizer.beginCUDAAccess(stream);
+//     plp.gBuffer = rasterizer.getGBuffer();
+//     pipeline.launch(...);
+//     rasterizer.endCUDAAccess(stream);
+//
+//     // レイ生成プログラム
+//     raster_gbuffer::FirstHit hit;
+//     if (raster_gbuffer::readFirstHit(plp.gBuffer, launchIndex, &hit)) { /* 最初のヒットからシェーディング */ }
+//
+// EN: Utility for hybrid rendering starting ray generation from a G-buffer with rasterized primary visibility.
+//     Primary rays are the most coherent and cheapest to rasterize in interactive rendering,
+//     so draw instance IDs, geometry indices, primitive indices, barycentrics and distances into a G-buffer with
+//     OpenGL, then share it with CUDA so that the ray generation program starts from the first hit without tracing
+//     camera rays. This saves one trace per pixel per frame.
+//     The primitive index is gl_PrimitiveID, so a triangle buffer needs to be drawn in the same order as
+//     set to the GeometryInstance.
+//     GL_NV_fragment_shader_barycentric is used to obtain barycentrics.
+//
+//     raster_gbuffer::Rasterizer rasterizer;
+//     rasterizer.initialize(cuContext, width, height);
+//     // every frame
+//     rasterizer.draw(camera, 0.01f, 1000.0f, drawItems.data(), numDrawItems);
+//     rasterizer.beginCUDAAccess(stream);
+//     plp.gBuffer = rasterizer.getGBuffer();
+//     pipeline.launch(...);
+//     rasterizer.endCUDAAccess(stream);
+//
+//     // Ray generation program
+//     raster_gbuffer::FirstHit hit;
+//     if (raster_gbuffer::readFirstHit(plp.gBuffer, launchIndex, &hit)) { /* shade from the first hit */ }
+namespace raster_gbuffer {
+    static constexpr uint32_t invalidInstanceID = 0xFFFFFFFF;
+
+    // JP: サンプルのPerspectiveCameraと同じ規約のカメラ。
+    // EN: Camera with the same convention as PerspectiveCamera of the samples.
+    struct Camera {
+        float aspect;
+        float fovY;
+        float3 position;
+        Matrix3x3 orientation;
+    };
+
+    struct GBuffer {
+        // JP: (instanceID, geometryIndex, primitiveIndex, 未使用)のRGBA32UI
+        // EN: RGBA32UI of (instanceID, geometryIndex, primitiveIndex, unused)
+        CUsurfObject ids;
+        // JP: (b1, b2, カメラからの距離, 未使用)のRGBA32F
+        // EN: RGBA32F of (b1, b2, distance from the camera, unused)
+        CUsurfObject attributes;
+        uint2 imageSize;
+    };
+
+    // JP: baryCentricsはoptixGetTriangleBarycentrics()と同じ(b1, b2)。
+    //     最初のヒットの位置はcamera.position + distance * (正規化したカメラレイの方向)で求められる。
+    //     ラスタライズとレイトレーシングの精度は異なるので、二次レイの原点は通常通りオフセットする。
+    // EN: barycentrics is (b1, b2) same as optixGetTriangleBarycentrics().
+    //     The position of the first hit can be computed as camera.position + distance * (normalized camera ray direction).
+    //     Precision differs between rasterization and ray tracing, so offset the origins of secondary rays as usual.
+    struct FirstHit {
+        uint32_t instanceID;
+        uint32_t geometryIndex;
+        uint32_t primitiveIndex;
+        float2 barycentrics;
+        float distance;
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: launchIndexはサンプルのレイ生成プログラムと同じく画像の上端が0。OpenGLのテクスチャーは下端が0なので反転して読む。
+    //     背景のピクセルではfalseを返す。
+    // EN: launchIndex is 0 at the top of the image same as the ray generation programs of the samples.
+    //     OpenGL textures are 0 at the bottom, so read it flipped. Return false for background pixels.
+    CUDA_DEVICE_FUNCTION bool readFirstHit(const GBuffer &gBuffer, const uint2 &launchIndex, FirstHit* hit) {
+        int32_t x = launchIndex.x;
+        int32_t y = gBuffer.imageSize.y - 1 - launchIndex.y;
+        uint4 ids = surf2Dread<uint4>(gBuffer.ids, x * sizeof(uint4), y);
+        if (ids.x == invalidInstanceID)
+            return false;
+        float4 attrs = surf2Dread<float4>(gBuffer.attributes, x * sizeof(float4), y);
+        hit->instanceID = ids.x;
+        hit->geometryIndex = ids.y;
+        hit->primitiveIndex = ids.z;
+        hit->barycentrics = make_float2(attrs.x, attrs.y);
+        hit->distance = attrs.z;
+        return true;
+    }
+#endif
+}
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+#include "gl_util.h"
+
+namespace raster_gbuffer {
+    // JP: 描画する三角形の集まり。頂点・三角形バッファーはOpenGL連携のcudau::Bufferなどと共有するOpenGLバッファー。
+    //     三角形は3つのuint32_tのインデックス(shared::Triangleと同じ)、頂点は先頭からpositionOffsetバイトの位置に
+    //     float3の位置を持つものとする。transformはInstance::getTransform()と同じ行優先の3x4行列。
+    // EN: A set of triangles to draw. Vertex and triangle buffers are OpenGL buffers shared with
+    //     OpenGL interop cudau::Buffer or similar.
+    //     A triangle is assumed to be three uint32_t indices (same as shared::Triangle), and a vertex to have
+    //     a float3 position at positionOffset bytes from the beginning.
+    //     transform is a row-major 3x4 matrix same as Instance::getTransform().
+    struct DrawItem {
+        GLuint vertexBuffer;
+        uint32_t vertexStride;
+        uint32_t positionOffset;
+        GLuint triangleBuffer;
+        uint32_t numTriangles;
+        float transform[12];
+        uint32_t instanceID;
+        uint32_t geometryIndex;
+    };
+
+    class Rasterizer {
+        CUcontext m_cuContext;
+        glu::FrameBuffer m_frameBuffer;
+        glu::GraphicsProgram m_program;
+        glu::VertexArray m_vertexArray;
+        cudau::Array m_idArray;
+        cudau::Array m_attributeArray;
+        cudau::InteropMapBatch m_mapBatch;
+        CUsurfObject m_idSurfObj;
+        CUsurfObject m_attributeSurfObj;
+        struct {
+            unsigned int m_initialized : 1;
+        };
+
+        Rasterizer(const Rasterizer &) = delete;
+        Rasterizer &operator=(const Rasterizer &) = delete;
+
+        void initializeTargets(uint32_t width, uint32_t height);
+        void finalizeTargets();
+
+    public:
+        Rasterizer() : m_cuContext(nullptr), m_idSurfObj(0), m_attributeSurfObj(0), m_initialized(false) {}
+        ~Rasterizer() {
+            if (m_initialized)
+                finalize();
+        }
+
+        void initialize(CUcontext cuContext, uint32_t width, uint32_t height);
+        void finalize();
+        void resize(uint32_t width, uint32_t height);
+
+        // JP: OpenGLのコンテキストがカレントのスレッドで呼ぶ。ビューポートとフレームバッファーの束縛は元に戻される。
+        // EN: Call this on the thread where the OpenGL context is current.
+        //     Viewport and framebuffer bindings are restored.
+        void draw(const Camera &camera, float zNear, float zFar, const DrawItem* items, uint32_t numItems);
+
+        // JP: レイ生成プログラムがGバッファーを読む間はマップしておく。
+        // EN: Keep mapped while the ray generation program reads the G-buffer.
+        void beginCUDAAccess(CUstream stream);
+        void endCUDAAccess(CUstream stream);
+
+        GBuffer getGBuffer() const {
+            GBuffer ret;
+            ret.ids = m_idSurfObj;
+            ret.attributes = m_attributeSurfObj;
+            ret.imageSize = make_uint2(m_frameBuffer.getWidth(), m_frameBuffer.getHeight());
+            return ret;
+        }
+        const glu::FrameBuffer &getFrameBuffer() const {
+            return m_frameBuffer;
+        }
+    };
+}
+#endif
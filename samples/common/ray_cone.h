@@ -0,0 +1,117 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: レイコーンによるテクスチャーLOD選択のユーティリティー。
+//     レイはコーンの幅と広がり角をペイロードで持ち運び、ヒット点でのコーン幅、入射角の余弦とロード時に求めた
+//     三角形ごとのLOD定数からミップレベルを決める。tex2DLod()に渡せば縮小された表面でのキャッシュスラッシングと
+//     エイリアシングのノイズを抑えられる。
+//     参考: Akenine-Möller et al. "Improved Shader and Texture Level of Detail Using Ray Cones", JCGT 2021
+//
+//     // ロード時
+//     ray_cone::computeTriangleLODConstants(vertices.data(), triangles.data(), numTriangles, lodConstants.data());
+//     // レイ生成プログラム
+//     ray_cone::RayCone cone = ray_cone::RayCone::fromPinholeCamera(plp.camera.fovY, plp.imageSize.y);
+//     // 最近傍ヒットプログラム
+//     cone = cone.propagate(optixGetRayTmax());
+//     float lod = cone.calcTextureLOD(geom.triangleLODConstants[primIndex], dot(rayDir, gn), texSize);
+//     float4 texValue = tex2DLod<float4>(texture, u, v, lod);
+//
+// EN: Utility for texture LOD selection by ray cones.
+//     Rays carry the cone width and spread angle in the payload, and the mip level is decided from the cone width at
+//     the hit point, the cosine of the incident angle and the per-triangle LOD constant computed at load time.
+//     Passing it to tex2DLod() suppresses cache thrashing and aliasing noise on minified surfaces.
+//     Reference: Akenine-Möller et al. "Improved Shader and Texture Level of Detail Using Ray Cones", JCGT 2021
+//
+//     // at load time
+//     ray_cone::computeTriangleLODConstants(vertices.data(), triangles.data(), numTriangles, lodConstants.data());
+//     // ray generation program
+//     ray_cone::RayCone cone = ray_cone::RayCone::fromPinholeCamera(plp.camera.fovY, plp.imageSize.y);
+//     // closest-hit program
+//     cone = cone.propagate(optixGetRayTmax());
+//     float lod = cone.calcTextureLOD(geom.triangleLODConstants[primIndex], dot(rayDir, gn), texSize);
+//     float4 texValue = tex2DLod<float4>(texture, u, v, lod);
+namespace ray_cone {
+    // JP: ペイロードに載せるレイコーン(2ダブルワード)。
+    // EN: Ray cone to put on the payload (2 dwords).
+    struct RayCone {
+        float width;
+        float spreadAngle;
+
+        // JP: ピンホールカメラのピクセルの広がり角から始まる幅0のコーン。
+        // EN: A cone of zero width starting from the spread angle of a pixel of a pinhole camera.
+        CUDA_DEVICE_FUNCTION static RayCone fromPinholeCamera(float fovY, uint32_t imageHeight) {
+            RayCone ret;
+            ret.width = 0.0f;
+            ret.spreadAngle = std::atan(2 * std::tan(0.5f * fovY) / imageHeight);
+            return ret;
+        }
+
+        // JP: 距離distだけ進んだ位置でのコーン。レイの方向は正規化されているものとする。
+        // EN: The cone at the position advanced by dist. The ray direction is assumed to be normalized.
+        CUDA_DEVICE_FUNCTION RayCone propagate(float dist) const {
+            RayCone ret;
+            ret.width = width + spreadAngle * dist;
+            ret.spreadAngle = spreadAngle;
+            return ret;
+        }
+
+        // JP: 表面での散乱後のコーン。surfaceSpreadAngleは曲率やラフネスによる広がり角の増分で、
+        //     鏡面反射では0、拡散反射では大きな値(例: 0.2)を与える経験的なもの。
+        // EN: The cone after scattering at a surface. surfaceSpreadAngle is the increment of the spread angle
+        //     by curvature or roughness, an empirical value like 0 for specular and a large value (e.g. 0.2) for diffuse.
+        CUDA_DEVICE_FUNCTION RayCone scatter(float surfaceSpreadAngle) const {
+            RayCone ret;
+            ret.width = width;
+            ret.spreadAngle = spreadAngle + surfaceSpreadAngle;
+            return ret;
+        }
+
+        // JP: ヒット点まで進めた後のコーンに対して呼ぶ。cosThetaはレイの方向と幾何法線の内積。
+        //     triangleLODConstantはcomputeTriangleLODConstant()の値で、インスタンスの変換に拡大縮小が
+        //     含まれる場合はその分だけずれる。
+        // EN: Call this for the cone after advancing to the hit point.
+        //     cosTheta is the dot product of the ray direction and the geometric normal.
+        //     triangleLODConstant is the value of computeTriangleLODConstant(), and it deviates by the amount
+        //     of scaling when the transform of the instance contains scaling.
+        CUDA_DEVICE_FUNCTION float calcTextureLOD(float triangleLODConstant, float cosTheta,
+                                                  const int2 &textureSize) const {
+            float lod = triangleLODConstant +
+                0.5f * std::log2(static_cast<float>(textureSize.x) * textureSize.y) +
+                std::log2(std::fabs(width) / std::fmax(std::fabs(cosTheta), 1e-4f));
+            return std::fmax(lod, 0.0f);
+        }
+    };
+
+    // JP: 三角形ごとのLOD定数0.5 * log2(テクスチャー座標の面積 / 物体空間の面積)。
+    //     テクスチャーの解像度に依らないので、同じジオメトリーに異なるテクスチャーを使い回せる。
+    // EN: Per-triangle LOD constant 0.5 * log2(area in texture coordinates / area in object space).
+    //     This doesn't depend on the texture resolution, so the same geometry can be reused with different textures.
+    CUDA_DEVICE_FUNCTION float computeTriangleLODConstant(const float3 &p0, const float3 &p1, const float3 &p2,
+                                                          const float2 &tc0, const float2 &tc1, const float2 &tc2) {
+        float2 dtc1 = tc1 - tc0;
+        float2 dtc2 = tc2 - tc0;
+        float texArea = std::fabs(dtc1.x * dtc2.y - dtc1.y * dtc2.x);
+        float geomArea = length(cross(p1 - p0, p2 - p0));
+        if (texArea <= 0.0f || geomArea <= 0.0f)
+            return 0.0f;
+        return 0.5f * std::log2(texArea / geomArea);
+    }
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: VertexTypeはposition, texCoordを、TriangleTypeはindex0, index1, index2を持つものとする。
+    // EN: VertexType is assumed to have position and texCoord, TriangleType index0, index1 and index2.
+    template <typename VertexType, typename TriangleType>
+    void computeTriangleLODConstants(const VertexType* vertices, const TriangleType* triangles, uint32_t numTriangles,
+                                     float* lodConstants) {
+        for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+            const TriangleType &tri = triangles[triIdx];
+            const VertexType &v0 = vertices[tri.index0];
+            const VertexType &v1 = vertices[tri.index1];
+            const VertexType &v2 = vertices[tri.index2];
+            lodConstants[triIdx] = computeTriangleLODConstant(v0.position, v1.position, v2.position,
+                                                              v0.texCoord, v1.texCoord, v2.texCoord);
+        }
+    }
+#endif
+}
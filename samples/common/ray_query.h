@@ -0,0 +1,338 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 視線判定や衝突、センサーなど描画以外の用途でホスト側から大量のレイを問い合わせるエンジン。
+//     最小限のパイプライン(レイ生成、ミス、最近接ヒット)を内部に持ち、レイの配列を受け取って
+//     距離、インスタンスID、プリミティブインデックス、重心座標を非同期に返す。
+//     ホスト配列のバッチはピン留めメモリーを介してダブルバッファリングされるので、
+//     あるバッチの結果を待つ間に次のバッチを投入できる。
+//     このファイルを使うサンプルはray_query_kernels.cuもPTXにコンパイルする。
+//
+//     ray_query::RayQueryEngine engine;
+//     engine.initialize(cuContext, optixContext, ptx, RayType_Query, NumRayTypes, maxNumRaysPerBatch);
+//     engine.setupMaterial(material); // シーン中の全マテリアルに対して
+//     engine.setScene(scene);
+//     engine.setTraversable(travHandle);
+//     uint64_t ticket = engine.submit(stream, rays.data(), numRays, ray_query::QueryType::Closest);
+//     const ray_query::Hit* hits = engine.wait(ticket);
+//
+// EN: Engine to query a large number of rays from the host side for non-rendering workloads like line-of-sight,
+//     collisions and sensors.
+//     This internally holds a minimal pipeline (ray generation, miss, closest-hit), takes an array of rays
+//     and asynchronously returns the distance, instance ID, primitive index and barycentrics.
+//     Batches of host arrays are double-buffered through pinned memory,
+//     so the next batch can be submitted while waiting for the result of a batch.
+//     A sample using this file compiles ray_query_kernels.cu to PTX as well.
+//
+//     ray_query::RayQueryEngine engine;
+//     engine.initialize(cuContext, optixContext, ptx, RayType_Query, NumRayTypes, maxNumRaysPerBatch);
+//     engine.setupMaterial(material); // for all the materials in the scene
+//     engine.setScene(scene);
+//     engine.setTraversable(travHandle);
+//     uint64_t ticket = engine.submit(stream, rays.data(), numRays, ray_query::QueryType::Closest);
+//     const ray_query::Hit* hits = engine.wait(ticket);
+namespace ray_query {
+    struct Ray {
+        float3 origin;
+        float tMin;
+        float3 direction;
+        float tMax;
+    };
+
+    // JP: ミスの場合tは負になる。
+    // EN: t becomes negative for a miss.
+    struct Hit {
+        float t;
+        uint32_t instanceID;
+        uint32_t primitiveIndex;
+        float b1;
+        float b2;
+
+        CUDA_DEVICE_FUNCTION bool isHit() const {
+            return t >= 0.0f;
+        }
+    };
+
+    // JP: Anyは最初に見つかった交差で走査を打ち切るので、最も近い交差とは限らない。遮蔽判定に使う。
+    // EN: Any terminates traversal at the first found intersection, so it is not necessarily the closest one.
+    //     Use this for occlusion tests.
+    enum class QueryType : uint32_t {
+        Closest = 0,
+        Any,
+    };
+
+    struct LaunchParameters {
+        OptixTraversableHandle travHandle;
+        const Ray* rays;
+        Hit* hits;
+        uint32_t numRays;
+        uint32_t rayType;
+        uint32_t numRayTypes;
+        uint32_t visibilityMask;
+        OptixRayFlags rayFlags;
+    };
+}
+
+#define RayQueryPayloadSignature ray_query::Hit
+
+namespace ray_query {
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    class RayQueryEngine {
+        static constexpr uint32_t numBatches = 2;
+
+        struct Batch {
+            Ray* raysOnHost;
+            Hit* hitsOnHost;
+            LaunchParameters* plpOnHost;
+            cudau::TypedBuffer<Ray> rays;
+            cudau::TypedBuffer<Hit> hits;
+            cudau::TypedBuffer<LaunchParameters> plp;
+            CUevent finishEvent;
+            uint64_t ticket;
+        };
+
+        CUcontext m_cuContext;
+        optixu::Pipeline m_pipeline;
+        optixu::Module m_module;
+        optixu::ProgramGroup m_rayGenProgram;
+        optixu::ProgramGroup m_missProgram;
+        optixu::ProgramGroup m_hitProgramGroup;
+        cudau::Buffer m_shaderBindingTable;
+        cudau::Buffer m_hitGroupShaderBindingTable;
+        Batch m_batches[numBatches];
+        OptixTraversableHandle m_travHandle;
+        uint32_t m_rayType;
+        uint32_t m_numRayTypes;
+        uint32_t m_visibilityMask;
+        uint32_t m_maxNumRaysPerBatch;
+        uint64_t m_nextTicket;
+
+        Batch &getBatch(uint64_t ticket) {
+            if (ticket == 0 || ticket >= m_nextTicket)
+                throw std::runtime_error("Invalid ticket.");
+            Batch &batch = m_batches[ticket % numBatches];
+            if (batch.ticket != ticket)
+                throw std::runtime_error("The batch of the ticket has already been reused.");
+            return batch;
+        }
+
+        // JP: バッチを再利用する前に、前回の使用が完了するのを待つ。
+        // EN: Wait for the completion of the previous use before reusing a batch.
+        Batch &acquireBatch(uint64_t* ticket) {
+            *ticket = m_nextTicket++;
+            Batch &batch = m_batches[*ticket % numBatches];
+            if (batch.ticket != 0)
+                CUDADRV_CHECK(cuEventSynchronize(batch.finishEvent));
+            batch.ticket = *ticket;
+            return batch;
+        }
+
+        void launch(CUstream stream, Batch &batch, const Ray* rays, Hit* hits, uint32_t numRays, QueryType type) {
+            LaunchParameters &plp = *batch.plpOnHost;
+            plp.travHandle = m_travHandle;
+            plp.rays = rays;
+            plp.hits = hits;
+            plp.numRays = numRays;
+            plp.rayType = m_rayType;
+            plp.numRayTypes = m_numRayTypes;
+            plp.visibilityMask = m_visibilityMask;
+            plp.rayFlags = type == QueryType::Any ?
+                OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT : OPTIX_RAY_FLAG_NONE;
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(batch.plp.getCUdeviceptr(), &plp, sizeof(plp), stream));
+            if (numRays > 0)
+                m_pipeline.launch(stream, batch.plp.getCUdeviceptr(), numRays, 1, 1);
+        }
+
+    public:
+        RayQueryEngine() :
+            m_cuContext(nullptr), m_batches{},
+            m_travHandle(0), m_rayType(0), m_numRayTypes(1), m_visibilityMask(0xFF),
+            m_maxNumRaysPerBatch(0), m_nextTicket(1) {}
+
+        // JP: ptxはray_query_kernels.cuをコンパイルしたもの。rayTypeとnumRayTypesはシーン中のGASに設定した
+        //     レイタイプ数のうち、問い合わせ用に割り当てたレイタイプとその総数。
+        // EN: ptx is the compiled ray_query_kernels.cu. rayType and numRayTypes are the ray type allocated
+        //     for queries among the ray types set to GASs in the scene and the total number of them.
+        void initialize(CUcontext cuContext, optixu::Context optixContext, const std::string &ptx,
+                        uint32_t rayType, uint32_t numRayTypes, uint32_t maxNumRaysPerBatch) {
+            m_cuContext = cuContext;
+            m_rayType = rayType;
+            m_numRayTypes = numRayTypes;
+            m_maxNumRaysPerBatch = maxNumRaysPerBatch;
+
+            m_pipeline = optixContext.createPipeline();
+            m_pipeline.setPipelineOptions(
+                optixu::calcSumDwords<RayQueryPayloadSignature>(),
+                optixu::calcSumDwords<float2>(),
+                "plp", sizeof(LaunchParameters),
+                false, OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_ANY,
+                OPTIX_EXCEPTION_FLAG_NONE,
+                OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE);
+            m_module = m_pipeline.createModuleFromPTXString(
+                ptx, OPTIX_COMPILE_DEFAULT_MAX_REGISTER_COUNT,
+                OPTIX_COMPILE_OPTIMIZATION_DEFAULT,
+                OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+
+            optixu::Module emptyModule;
+            m_rayGenProgram = m_pipeline.createRayGenProgram(m_module, RT_RG_NAME_STR("rayQuery"));
+            m_missProgram = m_pipeline.createMissProgram(m_module, RT_MS_NAME_STR("rayQuery"));
+            m_hitProgramGroup = m_pipeline.createHitProgramGroupForBuiltinIS(
+                OPTIX_PRIMITIVE_TYPE_TRIANGLE,
+                m_module, RT_CH_NAME_STR("rayQuery"),
+                emptyModule, nullptr);
+
+            m_pipeline.link(1, OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+
+            m_pipeline.setRayGenerationProgram(m_rayGenProgram);
+            m_pipeline.setNumMissRayTypes(m_numRayTypes);
+            m_pipeline.setMissProgram(m_rayType, m_missProgram);
+
+            size_t sbtSize;
+            m_pipeline.generateShaderBindingTableLayout(&sbtSize);
+            m_shaderBindingTable.initialize(m_cuContext, cudau::BufferType::Device, sbtSize, 1);
+            m_shaderBindingTable.setMappedMemoryPersistent(true);
+            m_pipeline.setShaderBindingTable(m_shaderBindingTable, m_shaderBindingTable.getMappedPointer());
+
+            for (Batch &batch : m_batches) {
+                CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&batch.raysOnHost),
+                                             sizeof(Ray) * std::max(m_maxNumRaysPerBatch, 1u)));
+                CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&batch.hitsOnHost),
+                                             sizeof(Hit) * std::max(m_maxNumRaysPerBatch, 1u)));
+                CUDADRV_CHECK(cuMemAllocHost(reinterpret_cast<void**>(&batch.plpOnHost), sizeof(LaunchParameters)));
+                batch.rays.initialize(m_cuContext, cudau::BufferType::Device, std::max(m_maxNumRaysPerBatch, 1u));
+                batch.hits.initialize(m_cuContext, cudau::BufferType::Device, std::max(m_maxNumRaysPerBatch, 1u));
+                batch.plp.initialize(m_cuContext, cudau::BufferType::Device, 1);
+                CUDADRV_CHECK(cuEventCreate(&batch.finishEvent, CU_EVENT_BLOCKING_SYNC | CU_EVENT_DISABLE_TIMING));
+                batch.ticket = 0;
+            }
+            m_nextTicket = 1;
+        }
+        void finalize() {
+            for (Batch &batch : m_batches) {
+                if (batch.ticket != 0)
+                    CUDADRV_CHECK(cuEventSynchronize(batch.finishEvent));
+                if (batch.finishEvent)
+                    CUDADRV_CHECK(cuEventDestroy(batch.finishEvent));
+                batch.plp.finalize();
+                batch.hits.finalize();
+                batch.rays.finalize();
+                if (batch.plpOnHost)
+                    CUDADRV_CHECK(cuMemFreeHost(batch.plpOnHost));
+                if (batch.hitsOnHost)
+                    CUDADRV_CHECK(cuMemFreeHost(batch.hitsOnHost));
+                if (batch.raysOnHost)
+                    CUDADRV_CHECK(cuMemFreeHost(batch.raysOnHost));
+                batch.plpOnHost = nullptr;
+                batch.hitsOnHost = nullptr;
+                batch.raysOnHost = nullptr;
+                batch.finishEvent = nullptr;
+                batch.ticket = 0;
+            }
+            m_hitGroupShaderBindingTable.finalize();
+            m_shaderBindingTable.finalize();
+            if (m_pipeline) {
+                m_hitProgramGroup.destroy();
+                m_missProgram.destroy();
+                m_rayGenProgram.destroy();
+                m_module.destroy();
+                m_pipeline.destroy();
+            }
+            m_pipeline = optixu::Pipeline();
+        }
+
+        // JP: マテリアルの問い合わせ用レイタイプに内部のヒットグループを設定する。
+        //     シーン中の全マテリアルに対してsetScene()の前に呼ぶ。
+        // EN: Set the internal hit group to the query ray type of a material.
+        //     Call this for all the materials in the scene before setScene().
+        void setupMaterial(optixu::Material material) const {
+            material.setHitGroup(m_rayType, m_hitProgramGroup);
+        }
+
+        // JP: シーンのSBTレイアウトに合わせてヒットグループSBTを確保する。レイアウトが変わった場合は再度呼ぶ。
+        // EN: Allocate the hit group SBT according to the SBT layout of the scene.
+        //     Call this again when the layout changes.
+        void setScene(optixu::Scene scene) {
+            size_t hitGroupSbtSize;
+            scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
+            hitGroupSbtSize = std::max<size_t>(hitGroupSbtSize, 1);
+            if (m_hitGroupShaderBindingTable.isInitialized() &&
+                m_hitGroupShaderBindingTable.sizeInBytes() < hitGroupSbtSize)
+                m_hitGroupShaderBindingTable.finalize();
+            if (!m_hitGroupShaderBindingTable.isInitialized()) {
+                m_hitGroupShaderBindingTable.initialize(m_cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
+                m_hitGroupShaderBindingTable.setMappedMemoryPersistent(true);
+            }
+            m_pipeline.setScene(scene);
+            m_pipeline.setHitGroupShaderBindingTable(m_hitGroupShaderBindingTable,
+                                                     m_hitGroupShaderBindingTable.getMappedPointer());
+        }
+
+        void setTraversable(OptixTraversableHandle travHandle) {
+            m_travHandle = travHandle;
+        }
+        void setVisibilityMask(uint32_t mask) {
+            m_visibilityMask = mask;
+        }
+
+        uint32_t getMaxNumRaysPerBatch() const {
+            return m_maxNumRaysPerBatch;
+        }
+
+        // JP: ホスト上のレイ配列をピン留めメモリーにコピーして問い合わせを投入し、チケットを返す。
+        //     同じバッチを使っていた2回前の投入の完了を待つ場合がある。
+        // EN: Copy a host ray array into pinned memory, submit queries and return a ticket.
+        //     This may wait for the completion of the submission two times before, which used the same batch.
+        uint64_t submit(CUstream stream, const Ray* rays, uint32_t numRays, QueryType type) {
+            if (numRays > m_maxNumRaysPerBatch)
+                throw std::runtime_error("Number of rays exceeds the maximum per batch.");
+            uint64_t ticket;
+            Batch &batch = acquireBatch(&ticket);
+            std::copy_n(rays, numRays, batch.raysOnHost);
+            if (numRays > 0) {
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(batch.rays.getCUdeviceptr(), batch.raysOnHost,
+                                                sizeof(Ray) * numRays, stream));
+            }
+            launch(stream, batch, batch.rays.getDevicePointer(), batch.hits.getDevicePointer(), numRays, type);
+            if (numRays > 0) {
+                CUDADRV_CHECK(cuMemcpyDtoHAsync(batch.hitsOnHost, batch.hits.getCUdeviceptr(),
+                                                sizeof(Hit) * numRays, stream));
+            }
+            CUDADRV_CHECK(cuEventRecord(batch.finishEvent, stream));
+            return ticket;
+        }
+
+        // JP: デバイス上のレイ配列に対して問い合わせを投入し、結果をデバイス上のhitsに書き込む。
+        //     ホストとの転送は行われず、バッチの大きさの制限も無い。
+        // EN: Submit queries for a device ray array and write the results to hits on the device.
+        //     No transfers from/to the host are performed and there is no limit on the batch size.
+        uint64_t submitOnDevice(CUstream stream, const Ray* raysOnDevice, Hit* hitsOnDevice, uint32_t numRays,
+                                QueryType type) {
+            uint64_t ticket;
+            Batch &batch = acquireBatch(&ticket);
+            launch(stream, batch, raysOnDevice, hitsOnDevice, numRays, type);
+            CUDADRV_CHECK(cuEventRecord(batch.finishEvent, stream));
+            return ticket;
+        }
+
+        bool isComplete(uint64_t ticket) {
+            CUresult res = cuEventQuery(getBatch(ticket).finishEvent);
+            if (res == CUDA_ERROR_NOT_READY)
+                return false;
+            CUDADRV_CHECK(res);
+            return true;
+        }
+
+        // JP: 問い合わせの完了を待ち、submit()の場合はピン留めメモリー上の結果を返す。
+        //     結果は同じバッチが再利用される(2回後の投入)まで有効。submitOnDevice()の場合はnullptrを返す。
+        // EN: Wait for the completion of the queries and return the results on pinned memory for submit().
+        //     The results remain valid until the same batch is reused (the submission two times later).
+        //     Return nullptr for submitOnDevice().
+        const Hit* wait(uint64_t ticket) {
+            Batch &batch = getBatch(ticket);
+            CUDADRV_CHECK(cuEventSynchronize(batch.finishEvent));
+            return batch.plpOnHost->hits == batch.hits.getDevicePointer() ? batch.hitsOnHost : nullptr;
+        }
+    };
+#endif
+}
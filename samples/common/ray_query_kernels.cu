@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include "ray_query.h"
+
+// JP: ray_query::RayQueryEngineが使うプログラム。レイ問い合わせを使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Programs used by ray_query::RayQueryEngine. A sample using ray queries compiles this file to PTX as well.
+
+RT_PIPELINE_LAUNCH_PARAMETERS ray_query::LaunchParameters plp;
+
+CUDA_DEVICE_KERNEL void RT_RG_NAME(rayQuery)() {
+    uint32_t rayIdx = optixGetLaunchIndex().x;
+    if (rayIdx >= plp.numRays)
+        return;
+
+    const ray_query::Ray &ray = plp.rays[rayIdx];
+    ray_query::Hit hit;
+    hit.t = -1.0f;
+    hit.instanceID = 0xFFFFFFFF;
+    hit.primitiveIndex = 0xFFFFFFFF;
+    hit.b1 = 0.0f;
+    hit.b2 = 0.0f;
+    optixu::trace<RayQueryPayloadSignature>(
+        plp.travHandle, ray.origin, ray.direction, ray.tMin, ray.tMax, 0.0f,
+        plp.visibilityMask, plp.rayFlags,
+        plp.rayType, plp.numRayTypes, plp.rayType,
+        hit);
+    plp.hits[rayIdx] = hit;
+}
+
+CUDA_DEVICE_KERNEL void RT_MS_NAME(rayQuery)() {
+    ray_query::Hit hit;
+    hit.t = -1.0f;
+    hit.instanceID = 0xFFFFFFFF;
+    hit.primitiveIndex = 0xFFFFFFFF;
+    hit.b1 = 0.0f;
+    hit.b2 = 0.0f;
+    optixu::setPayloads<RayQueryPayloadSignature>(&hit);
+}
+
+CUDA_DEVICE_KERNEL void RT_CH_NAME(rayQuery)() {
+    float2 bc = optixGetTriangleBarycentrics();
+    ray_query::Hit hit;
+    hit.t = optixGetRayTmax();
+    hit.instanceID = optixGetInstanceId();
+    hit.primitiveIndex = optixGetPrimitiveIndex();
+    hit.b1 = bc.x;
+    hit.b2 = bc.y;
+    optixu::setPayloads<RayQueryPayloadSignature>(&hit);
+}
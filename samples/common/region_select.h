@@ -0,0 +1,268 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: エディターの矩形選択や投げ縄選択のために、画面上の領域内のインスタンスIDとGeometryInstanceのIDの集合を
+//     GPU上で求めるユーティリティー。レイ生成プログラムが書いたIDのGバッファーを領域内で読み、
+//     ビットセットとアトミック演算で重複を除いたIDのリストを作る。
+//     結果はcudau::QueryRingで数フレーム後に非同期に受け取るので、ピクセルごとのピックを繰り返したり
+//     ホストで待ったりする必要が無い。
+//     このファイルを使うサンプルはregion_select_kernels.cuもPTXにコンパイルする。
+//
+//     region_select::RegionSelector<4096> selector;
+//     selector.initialize(cuContext, regionSelectModule, maxInstanceID + 1, maxGeomInstID + 1, 1024);
+//     // 最初のヒットで(optixGetInstanceId(), ジオメトリのID)をidBufferに書く。
+//     selector.selectRectangle(stream, idBuffer, imageSize, dragBegin, dragEnd, frameIndex);
+//     // 毎フレーム
+//     selector.poll([](const region_select::RegionSelector<4096>::Result &result, uint64_t tag) {
+//         for (uint32_t i = 0; i < result.getNumInstanceIDs(); ++i)
+//             select(result.instanceIDs[i]);
+//     });
+//
+// EN: Utility to compute, on the GPU, sets of instance IDs and GeometryInstance IDs inside a screen region
+//     for box and lasso selection in editors. It reads an ID G-buffer written by a ray generation program
+//     within the region and builds deduplicated lists of IDs with bitsets and atomics.
+//     The results are received asynchronously a few frames later through cudau::QueryRing,
+//     so neither repeated per-pixel picks nor host waits are needed.
+//     A sample using this file compiles region_select_kernels.cu to PTX as well.
+//
+//     region_select::RegionSelector<4096> selector;
+//     selector.initialize(cuContext, regionSelectModule, maxInstanceID + 1, maxGeomInstID + 1, 1024);
+//     // Write (optixGetInstanceId(), the ID of the geometry) into idBuffer at the first hit.
+//     selector.selectRectangle(stream, idBuffer, imageSize, dragBegin, dragEnd, frameIndex);
+//     // every frame
+//     selector.poll([](const region_select::RegionSelector<4096>::Result &result, uint64_t tag) {
+//         for (uint32_t i = 0; i < result.getNumInstanceIDs(); ++i)
+//             select(result.instanceIDs[i]);
+//     });
+namespace region_select {
+    static constexpr uint32_t invalidID = 0xFFFFFFFF;
+
+    // JP: IDのGバッファーの要素。ミスしたピクセルには両方にinvalidIDを書く。
+    //     geomInstIDにはGeometryInstanceのユーザーデータなどに持たせたアプリケーション側のIDを書く。
+    // EN: Element of the ID G-buffer. Write invalidID to both for missed pixels.
+    //     Write an application-side ID held by e.g. the user data of a GeometryInstance to geomInstID.
+    struct IDPixel {
+        uint32_t instanceID;
+        uint32_t geomInstID;
+    };
+
+    // JP: カーネルが書き込む先。countsとIDの配列はQueryRingのスロット内の結果を指す。
+    // EN: Destination the kernel writes into. counts and the ID arrays point into the result in a QueryRing slot.
+    struct SelectionTarget {
+        uint32_t* instanceIDBits;
+        uint32_t* geomInstIDBits;
+        uint32_t numInstanceIDBits;
+        uint32_t numGeomInstIDBits;
+        uint32_t* counts; // instance, GeometryInstance
+        uint32_t* instanceIDs;
+        uint32_t* geomInstIDs;
+        uint32_t maxNumIDs;
+    };
+
+    // JP: lassoVerticesの多角形に対する偶奇規則の内外判定。
+    // EN: Inside/outside test with the even-odd rule against the polygon of lassoVertices.
+    CUDA_DEVICE_FUNCTION bool isInsideLasso(const float2* lassoVertices, uint32_t numLassoVertices,
+                                            float px, float py) {
+        bool inside = false;
+        for (uint32_t i = 0, j = numLassoVertices - 1; i < numLassoVertices; j = i++) {
+            float2 vi = lassoVertices[i];
+            float2 vj = lassoVertices[j];
+            if ((vi.y > py) != (vj.y > py) &&
+                px < (vj.x - vi.x) * (py - vi.y) / (vj.y - vi.y) + vi.x)
+                inside = !inside;
+        }
+        return inside;
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: ビットを立てた最初のスレッドだけがIDをリストに追加する。
+    //     隣接するピクセルは同じIDを持つことが多いので、アトミック演算の前に通常の読み込みで確認する。
+    // EN: Only the first thread setting the bit appends the ID to the list.
+    //     Adjacent pixels often have the same ID, so check by an ordinary read before the atomic operation.
+    CUDA_DEVICE_FUNCTION void insertID(uint32_t id, uint32_t* bits, uint32_t numBits,
+                                       uint32_t* count, uint32_t* ids, uint32_t maxNumIDs) {
+        if (id >= numBits)
+            return;
+        uint32_t wordIdx = id / 32;
+        uint32_t bit = 1u << (id % 32);
+        if (*reinterpret_cast<volatile uint32_t*>(&bits[wordIdx]) & bit)
+            return;
+        if (atomicOr(&bits[wordIdx], bit) & bit)
+            return;
+        uint32_t idx = atomicAdd(count, 1u);
+        if (idx < maxNumIDs)
+            ids[idx] = id;
+    }
+
+    // JP: regionMin, regionMaxで表される矩形(端を含む)内のピクセルを調べる。
+    //     numLassoVerticesが0より大きい場合はさらにピクセル中心が投げ縄の内側にあるものに限る。
+    // EN: Examine pixels inside the rectangle (inclusive) represented by regionMin, regionMax.
+    //     When numLassoVertices is greater than 0, further limit to pixels whose centers are inside the lasso.
+    CUDA_DEVICE_FUNCTION void selectInRegion(
+        const IDPixel* idBuffer, uint2 imageSize, int2 regionMin, int2 regionMax,
+        const float2* lassoVertices, uint32_t numLassoVertices, SelectionTarget target) {
+        uint32_t regionWidth = regionMax.x - regionMin.x + 1;
+        uint32_t numPixels = regionWidth * (regionMax.y - regionMin.y + 1);
+        for (uint32_t linearIdx = blockDim.x * blockIdx.x + threadIdx.x; linearIdx < numPixels;
+             linearIdx += blockDim.x * gridDim.x) {
+            uint32_t px = regionMin.x + linearIdx % regionWidth;
+            uint32_t py = regionMin.y + linearIdx / regionWidth;
+            if (numLassoVertices > 0 &&
+                !isInsideLasso(lassoVertices, numLassoVertices, px + 0.5f, py + 0.5f))
+                continue;
+            const IDPixel &pixel = idBuffer[py * imageSize.x + px];
+            insertID(pixel.instanceID, target.instanceIDBits, target.numInstanceIDBits,
+                     &target.counts[0], target.instanceIDs, target.maxNumIDs);
+            insertID(pixel.geomInstID, target.geomInstIDBits, target.numGeomInstIDBits,
+                     &target.counts[1], target.geomInstIDs, target.maxNumIDs);
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: maxNumIDsは一回の選択で返すIDの最大数。超えた分はリストに入らず、isTruncated()が真になる。
+    // EN: maxNumIDs is the maximum number of IDs returned by a selection.
+    //     The excess does not go into the lists, and isTruncated() becomes true.
+    template <uint32_t maxNumIDs>
+    class RegionSelector {
+    public:
+        struct Result {
+            uint32_t numInstanceIDs;
+            uint32_t numGeomInstIDs;
+            uint32_t instanceIDs[maxNumIDs];
+            uint32_t geomInstIDs[maxNumIDs];
+
+            uint32_t getNumInstanceIDs() const {
+                return std::min(numInstanceIDs, maxNumIDs);
+            }
+            uint32_t getNumGeometryInstanceIDs() const {
+                return std::min(numGeomInstIDs, maxNumIDs);
+            }
+            // JP: 領域内の異なるIDの数はnumInstanceIDs, numGeomInstIDsで得られる。
+            // EN: The numbers of distinct IDs in the region are obtained by numInstanceIDs, numGeomInstIDs.
+            bool isTruncated() const {
+                return numInstanceIDs > maxNumIDs || numGeomInstIDs > maxNumIDs;
+            }
+        };
+
+    private:
+        cudau::Kernel m_selectInRegion;
+        cudau::TypedBuffer<uint32_t> m_instanceIDBits;
+        cudau::TypedBuffer<uint32_t> m_geomInstIDBits;
+        cudau::TypedBuffer<float2> m_lassoVertices;
+        cudau::QueryRing<Result> m_queries;
+        uint32_t m_numInstanceIDBits;
+        uint32_t m_numGeomInstIDBits;
+
+        void select(CUstream stream, const IDPixel* idBuffer, const uint2 &imageSize,
+                    int2 regionMin, int2 regionMax, uint32_t numLassoVertices, uint64_t tag) {
+            Result* result = m_queries.beginQuery(tag);
+            auto resultAddr = reinterpret_cast<CUdeviceptr>(result);
+            CUDADRV_CHECK(cuMemsetD32Async(resultAddr, 0, 2, stream));
+
+            regionMin = make_int2(std::max(regionMin.x, 0), std::max(regionMin.y, 0));
+            regionMax = make_int2(std::min(regionMax.x, static_cast<int32_t>(imageSize.x) - 1),
+                                  std::min(regionMax.y, static_cast<int32_t>(imageSize.y) - 1));
+            if (regionMin.x <= regionMax.x && regionMin.y <= regionMax.y) {
+                // JP: 結果の重複除去に使うビットセットは選択ごとにクリアする。
+                // EN: Clear the bitsets used for deduplicating results per selection.
+                CUDADRV_CHECK(cuMemsetD32Async(m_instanceIDBits.getCUdeviceptr(), 0,
+                                               m_instanceIDBits.numElements(), stream));
+                CUDADRV_CHECK(cuMemsetD32Async(m_geomInstIDBits.getCUdeviceptr(), 0,
+                                               m_geomInstIDBits.numElements(), stream));
+
+                SelectionTarget target;
+                target.instanceIDBits = m_instanceIDBits.getDevicePointer();
+                target.geomInstIDBits = m_geomInstIDBits.getDevicePointer();
+                target.numInstanceIDBits = m_numInstanceIDBits;
+                target.numGeomInstIDBits = m_numGeomInstIDBits;
+                target.counts = reinterpret_cast<uint32_t*>(resultAddr + offsetof(Result, numInstanceIDs));
+                target.instanceIDs = reinterpret_cast<uint32_t*>(resultAddr + offsetof(Result, instanceIDs));
+                target.geomInstIDs = reinterpret_cast<uint32_t*>(resultAddr + offsetof(Result, geomInstIDs));
+                target.maxNumIDs = maxNumIDs;
+                m_selectInRegion.launchPersistent(
+                    stream, idBuffer, imageSize, regionMin, regionMax,
+                    m_lassoVertices.getDevicePointer(), numLassoVertices, target);
+            }
+            m_queries.endQuery(stream);
+        }
+
+    public:
+        RegionSelector() : m_numInstanceIDBits(0), m_numGeomInstIDBits(0) {}
+
+        // JP: numInstanceIDBits, numGeomInstIDBitsはIDの上限+1。範囲外のIDは無視される。
+        // EN: numInstanceIDBits, numGeomInstIDBits are the maximum IDs + 1. IDs out of the range are ignored.
+        void initialize(CUcontext cuContext, CUmodule regionSelectModule,
+                        uint32_t numInstanceIDBits, uint32_t numGeomInstIDBits, uint32_t maxNumLassoVertices,
+                        uint32_t numSlots = 4) {
+            m_selectInRegion.set(regionSelectModule, "selectInRegion", cudau::AutoBlockDim(), 0);
+            m_numInstanceIDBits = numInstanceIDBits;
+            m_numGeomInstIDBits = numGeomInstIDBits;
+            m_instanceIDBits.initialize(cuContext, cudau::BufferType::Device,
+                                        std::max((numInstanceIDBits + 31) / 32, 1u));
+            m_geomInstIDBits.initialize(cuContext, cudau::BufferType::Device,
+                                        std::max((numGeomInstIDBits + 31) / 32, 1u));
+            m_lassoVertices.initialize(cuContext, cudau::BufferType::Device, std::max(maxNumLassoVertices, 1u));
+            m_queries.initialize(cuContext, numSlots);
+        }
+        void finalize() {
+            m_queries.finalize();
+            m_lassoVertices.finalize();
+            m_geomInstIDBits.finalize();
+            m_instanceIDBits.finalize();
+        }
+
+        // JP: 2つの角(順不同、端を含む)で表される矩形内を選択する。tagはpoll()で結果とともに返される。
+        // EN: Select inside the rectangle (inclusive) represented by two corners in any order.
+        //     tag is returned with the result by poll().
+        void selectRectangle(CUstream stream, const IDPixel* idBuffer, const uint2 &imageSize,
+                             const int2 &corner0, const int2 &corner1, uint64_t tag = 0) {
+            select(stream, idBuffer, imageSize,
+                   make_int2(std::min(corner0.x, corner1.x), std::min(corner0.y, corner1.y)),
+                   make_int2(std::max(corner0.x, corner1.x), std::max(corner0.y, corner1.y)),
+                   0, tag);
+        }
+
+        // JP: ピクセル座標の多角形(自動的に閉じる)の内側を選択する。
+        // EN: Select inside a polygon (closed automatically) in pixel coordinates.
+        void selectLasso(CUstream stream, const IDPixel* idBuffer, const uint2 &imageSize,
+                         const float2* vertices, uint32_t numVertices, uint64_t tag = 0) {
+            if (numVertices > m_lassoVertices.numElements())
+                throw std::runtime_error("Number of lasso vertices exceeds the maximum.");
+            if (numVertices < 3) {
+                select(stream, idBuffer, imageSize, make_int2(0, 0), make_int2(-1, -1), 0, tag);
+                return;
+            }
+            float2 minP = vertices[0];
+            float2 maxP = vertices[0];
+            for (uint32_t i = 1; i < numVertices; ++i) {
+                minP = make_float2(std::min(minP.x, vertices[i].x), std::min(minP.y, vertices[i].y));
+                maxP = make_float2(std::max(maxP.x, vertices[i].x), std::max(maxP.y, vertices[i].y));
+            }
+            // JP: 同じストリーム上のコピーなので、先行する選択のカーネルが読み終わってから上書きされる。
+            // EN: This is a copy on the same stream, so it overwrites after the kernel of a preceding selection
+            //     finishes reading.
+            m_lassoVertices.write(vertices, numVertices, stream);
+            select(stream, idBuffer, imageSize,
+                   make_int2(static_cast<int32_t>(std::floor(minP.x)), static_cast<int32_t>(std::floor(minP.y))),
+                   make_int2(static_cast<int32_t>(std::floor(maxP.x)), static_cast<int32_t>(std::floor(maxP.y))),
+                   numVertices, tag);
+        }
+
+        template <typename Func>
+        uint32_t poll(const Func &onComplete) {
+            return m_queries.poll(onComplete);
+        }
+        bool poll() {
+            return m_queries.poll();
+        }
+        void waitAll() {
+            m_queries.waitAll();
+        }
+        bool getLatestResult(Result* result, uint64_t* tag = nullptr) const {
+            return m_queries.getLatestResult(result, tag);
+        }
+    };
+#endif
+}
@@ -0,0 +1,14 @@
+﻿#pragma once
+
+#include "region_select.h"
+
+// JP: region_select::RegionSelectorが使うカーネル。領域選択を使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernel used by region_select::RegionSelector. A sample using region selection compiles this file
+//     to PTX as well.
+
+CUDA_DEVICE_KERNEL void selectInRegion(
+    const region_select::IDPixel* idBuffer, uint2 imageSize, int2 regionMin, int2 regionMax,
+    const float2* lassoVertices, uint32_t numLassoVertices, region_select::SelectionTarget target) {
+    region_select::selectInRegion(idBuffer, imageSize, regionMin, regionMax,
+                                  lassoVertices, numLassoVertices, target);
+}
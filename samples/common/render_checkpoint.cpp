@@ -0,0 +1,197 @@
+﻿#include "render_checkpoint.h"
+
+namespace render_checkpoint {
+    namespace {
+        constexpr char checkpointMagic[8] = { 'O', 'P', 'T', 'X', 'C', 'K', 'P', 'T' };
+        constexpr uint32_t checkpointVersion = 1;
+
+        struct CheckpointHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t numAccumFrames;
+            uint64_t compatibilityTag;
+            uint32_t numLayers;
+            uint32_t reserved;
+        };
+
+        struct LayerHeader {
+            char name[maxLayerNameLength + 1];
+            uint64_t size;
+        };
+    }
+
+
+
+    void Checkpointer::initialize(CUcontext cuContext, const std::filesystem::path &filepath, float intervalInSeconds,
+                                  uint64_t compatibilityTag, size_t stagingChunkSize, uint32_t numStagingChunks) {
+        m_cuContext = cuContext;
+        m_filepath = filepath;
+        m_intervalInSeconds = intervalInSeconds;
+        m_compatibilityTag = compatibilityTag;
+        m_stagingPool.initialize(cuContext, stagingChunkSize, numStagingChunks);
+        m_lastSaveTime = std::chrono::steady_clock::now();
+    }
+
+    void Checkpointer::finalize() {
+        if (!m_cuContext)
+            return;
+        if (m_pendingWrite.valid())
+            m_pendingWrite.get();
+        m_stagingPool.finalize();
+        m_layers.clear();
+        m_hostData.clear();
+        m_cuContext = nullptr;
+    }
+
+    void Checkpointer::addLayer(const char* name, CUdeviceptr deviceAddress, size_t size) {
+        if (std::strlen(name) > maxLayerNameLength)
+            throw std::runtime_error("Layer name is too long.");
+        if (isWriting())
+            throw std::runtime_error("Layers cannot be changed while a checkpoint is being written.");
+        Layer layer = {};
+        std::memcpy(layer.name, name, std::strlen(name));
+        layer.deviceAddress = deviceAddress;
+        layer.size = size;
+        m_layers.push_back(layer);
+    }
+
+    void Checkpointer::clearLayers() {
+        if (isWriting())
+            throw std::runtime_error("Layers cannot be changed while a checkpoint is being written.");
+        m_layers.clear();
+    }
+
+    size_t Checkpointer::calcTotalDataSize() const {
+        size_t totalSize = 0;
+        for (const Layer &layer : m_layers)
+            totalSize += layer.size;
+        return totalSize;
+    }
+
+    bool Checkpointer::isWriting() const {
+        return m_pendingWrite.valid() &&
+            m_pendingWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+
+    bool Checkpointer::update(CUstream stream, uint32_t numAccumFrames) {
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<float>(now - m_lastSaveTime).count() < m_intervalInSeconds || isWriting())
+            return false;
+        save(stream, numAccumFrames);
+        return true;
+    }
+
+    void Checkpointer::save(CUstream stream, uint32_t numAccumFrames) {
+        if (!m_cuContext)
+            throw std::runtime_error("Checkpointer is not initialized.");
+
+        // JP: 前の書き込みの完了を待つ。書き込み中の例外はここで伝わる。
+        // EN: Wait for completion of the previous write. Exceptions during the write are propagated here.
+        if (m_pendingWrite.valid()) {
+            if (!m_pendingWrite.get())
+                hpprintf("Failed to write the checkpoint: %s\n", m_filepath.string().c_str());
+        }
+
+        // JP: 読み戻しは描画ストリームに積まれるので、この時点までの蓄積の内容が保存される。
+        // EN: Readbacks are enqueued to the render stream, so the accumulation up to this point is saved.
+        m_hostData.resize(calcTotalDataSize());
+        std::vector<cudau::TransferToken> tokens;
+        tokens.reserve(m_layers.size());
+        size_t offset = 0;
+        for (const Layer &layer : m_layers) {
+            tokens.push_back(m_stagingPool.download(m_hostData.data() + offset, layer.deviceAddress, layer.size,
+                                                    stream));
+            offset += layer.size;
+        }
+        m_lastSaveTime = std::chrono::steady_clock::now();
+
+        m_pendingWrite = std::async(
+            std::launch::async,
+            [this, numAccumFrames](std::vector<cudau::TransferToken> tokens) {
+                return writeFile(tokens, numAccumFrames);
+            },
+            std::move(tokens));
+    }
+
+    bool Checkpointer::writeFile(const std::vector<cudau::TransferToken> &tokens, uint32_t numAccumFrames) const {
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        for (const cudau::TransferToken &token : tokens)
+            token.wait();
+
+        CheckpointHeader header = {};
+        std::memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+        header.version = checkpointVersion;
+        header.numAccumFrames = numAccumFrames;
+        header.compatibilityTag = m_compatibilityTag;
+        header.numLayers = static_cast<uint32_t>(m_layers.size());
+
+        std::filesystem::path tmpFilepath = m_filepath;
+        tmpFilepath += ".tmp";
+        {
+            std::ofstream ofs(tmpFilepath, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!ofs)
+                return false;
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (const Layer &layer : m_layers) {
+                LayerHeader layerHeader = {};
+                std::memcpy(layerHeader.name, layer.name, sizeof(layer.name));
+                layerHeader.size = layer.size;
+                ofs.write(reinterpret_cast<const char*>(&layerHeader), sizeof(layerHeader));
+            }
+            ofs.write(reinterpret_cast<const char*>(m_hostData.data()), m_hostData.size());
+            if (!ofs)
+                return false;
+        }
+
+        // JP: 書き込みが完了したファイルで置き換えるので、途中で中断されても壊れたチェックポイントは残らない。
+        // EN: Replace with the completely written file, so no broken checkpoint remains even on preemption midway.
+        std::error_code ec;
+        std::filesystem::rename(tmpFilepath, m_filepath, ec);
+        return !ec;
+    }
+
+    bool Checkpointer::resume(CUstream stream, uint32_t* numAccumFrames) {
+        if (!m_cuContext)
+            throw std::runtime_error("Checkpointer is not initialized.");
+        if (m_pendingWrite.valid())
+            m_pendingWrite.get();
+
+        std::ifstream ifs(m_filepath, std::ios::in | std::ios::binary);
+        if (!ifs)
+            return false;
+
+        CheckpointHeader header;
+        ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!ifs ||
+            std::memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0 ||
+            header.version != checkpointVersion ||
+            header.compatibilityTag != m_compatibilityTag ||
+            header.numLayers != m_layers.size())
+            return false;
+        for (const Layer &layer : m_layers) {
+            LayerHeader layerHeader;
+            ifs.read(reinterpret_cast<char*>(&layerHeader), sizeof(layerHeader));
+            if (!ifs ||
+                std::strncmp(layerHeader.name, layer.name, sizeof(layer.name)) != 0 ||
+                layerHeader.size != layer.size)
+                return false;
+        }
+
+        m_hostData.resize(calcTotalDataSize());
+        ifs.read(reinterpret_cast<char*>(m_hostData.data()), m_hostData.size());
+        if (!ifs)
+            return false;
+
+        // JP: アップロードではステージングへのコピーが戻る前に済むので、ホストのデータはすぐに再利用できる。
+        // EN: Copies to staging finish before returning for uploads, so the host data can be reused immediately.
+        size_t offset = 0;
+        for (const Layer &layer : m_layers) {
+            m_stagingPool.upload(layer.deviceAddress, m_hostData.data() + offset, layer.size, stream);
+            offset += layer.size;
+        }
+        *numAccumFrames = header.numAccumFrames;
+        m_lastSaveTime = std::chrono::steady_clock::now();
+
+        return true;
+    }
+}
@@ -0,0 +1,121 @@
+﻿#pragma once
+
+#include "common.h"
+#include <future>
+
+// JP: 長時間のプログレッシブレンダリングの蓄積状態をチェックポイントとして保存し、再開するユーティリティー。
+//     登録したデバイスのバッファー(蓄積、分散、乱数の状態など)をピン留めメモリーのステージングプール経由で
+//     非同期に読み戻し、バックグラウンドのスレッドでファイルに書き出す。描画ストリームは止めない。
+//     ファイルは一時ファイルに書いてから置き換えるので、書き込み中にジョブが中断されても前のチェックポイントが残る。
+//     再開時は内容をアップロードしてnumAccumFramesから蓄積を続ける。
+//
+//     render_checkpoint::Checkpointer checkpointer;
+//     checkpointer.initialize(cuContext, "render.oxckpt", 600.0f, settingsHash);
+//     checkpointer.addLayer("accum", accumBuffer);
+//     checkpointer.addLayer("rng", rngBuffer);
+//     if (!checkpointer.resume(stream, &numAccumFrames))
+//         numAccumFrames = 0;
+//     while (rendering) {
+//         pipeline.launch(...);
+//         ++numAccumFrames;
+//         checkpointer.update(stream, numAccumFrames);
+//     }
+//     checkpointer.finalize();
+//
+// EN: Utility to save the accumulation state of a long progressive render as a checkpoint and resume it.
+//     Registered device buffers (accumulation, variance, RNG states and so on) are asynchronously read back
+//     via a staging pool of pinned memory and written to a file on a background thread.
+//     The render stream is not stalled.
+//     The file is written to a temporary file and then replaced, so the previous checkpoint remains
+//     even if the job is preempted during writing.
+//     Resuming uploads the contents and continues the accumulation from numAccumFrames.
+//
+//     render_checkpoint::Checkpointer checkpointer;
+//     checkpointer.initialize(cuContext, "render.oxckpt", 600.0f, settingsHash);
+//     checkpointer.addLayer("accum", accumBuffer);
+//     checkpointer.addLayer("rng", rngBuffer);
+//     if (!checkpointer.resume(stream, &numAccumFrames))
+//         numAccumFrames = 0;
+//     while (rendering) {
+//         pipeline.launch(...);
+//         ++numAccumFrames;
+//         checkpointer.update(stream, numAccumFrames);
+//     }
+//     checkpointer.finalize();
+namespace render_checkpoint {
+    static constexpr uint32_t maxLayerNameLength = 31;
+
+    class Checkpointer {
+        struct Layer {
+            char name[maxLayerNameLength + 1];
+            CUdeviceptr deviceAddress;
+            size_t size;
+        };
+
+        CUcontext m_cuContext;
+        std::filesystem::path m_filepath;
+        float m_intervalInSeconds;
+        uint64_t m_compatibilityTag;
+        cudau::PinnedStagingPool m_stagingPool;
+        std::vector<Layer> m_layers;
+        std::vector<uint8_t> m_hostData;
+        std::future<bool> m_pendingWrite;
+        std::chrono::steady_clock::time_point m_lastSaveTime;
+
+        Checkpointer(const Checkpointer &) = delete;
+        Checkpointer &operator=(const Checkpointer &) = delete;
+
+        size_t calcTotalDataSize() const;
+        bool writeFile(const std::vector<cudau::TransferToken> &tokens, uint32_t numAccumFrames) const;
+
+    public:
+        Checkpointer() : m_cuContext(nullptr), m_intervalInSeconds(0.0f), m_compatibilityTag(0) {}
+        ~Checkpointer() {
+            if (m_cuContext)
+                finalize();
+        }
+
+        // JP: compatibilityTagにはシーンやレンダリング設定のハッシュなどを渡し、
+        //     異なる設定で保存されたチェックポイントから再開しないようにする。
+        // EN: Pass a hash of the scene or render settings and so on to compatibilityTag
+        //     to avoid resuming from a checkpoint saved with different settings.
+        void initialize(CUcontext cuContext, const std::filesystem::path &filepath, float intervalInSeconds,
+                        uint64_t compatibilityTag = 0,
+                        size_t stagingChunkSize = 4 * 1024 * 1024, uint32_t numStagingChunks = 4);
+        // JP: 書き込み中のチェックポイントの完了を待つ。
+        // EN: Wait for completion of a checkpoint being written.
+        void finalize();
+
+        // JP: 保存、再開の対象となるデバイスのメモリー領域を登録する。保存と再開で同じ順番、サイズで登録する。
+        // EN: Register a device memory region to be saved and resumed.
+        //     Register in the same order and sizes for saving and resuming.
+        void addLayer(const char* name, CUdeviceptr deviceAddress, size_t size);
+        void addLayer(const char* name, const cudau::Buffer &buffer) {
+            addLayer(name, buffer.getCUdeviceptr(), buffer.sizeInBytes());
+        }
+        template <typename T, uint32_t log2BlockWidth, typename Layout>
+        void addLayer(const char* name, const optixu::HostBlockBuffer2D<T, log2BlockWidth, Layout> &buffer) {
+            addLayer(name, buffer.getCUdeviceptr(), sizeof(T) * buffer.getNumRawElements());
+        }
+        // JP: バッファーのリサイズ後などに登録し直すために使う。
+        // EN: Use this to re-register after resizing buffers and so on.
+        void clearLayers();
+
+        // JP: 毎フレーム、蓄積を行うローンチの後に同じストリームで呼ぶ。前回の保存から間隔が経過していて、
+        //     書き込み中のチェックポイントが無ければ保存を始めてtrueを返す。
+        // EN: Call every frame after the launch doing accumulation on the same stream.
+        //     Start saving and return true when the interval has elapsed since the last save
+        //     and no checkpoint is being written.
+        bool update(CUstream stream, uint32_t numAccumFrames);
+        // JP: 間隔によらず保存を始める。書き込み中のチェックポイントがあればその完了を待つ。
+        // EN: Start saving regardless of the interval. Wait for completion of a checkpoint being written if any.
+        void save(CUstream stream, uint32_t numAccumFrames);
+        bool isWriting() const;
+
+        // JP: チェックポイントが存在し、タグと全レイヤーの名前とサイズが一致した場合にアップロードしてtrueを返す。
+        //     アップロードはstreamに積まれるので、後続のローンチは同じストリームで行う。
+        // EN: Upload and return true when a checkpoint exists and the tag, names and sizes of all layers match.
+        //     Uploads are enqueued to stream, so perform subsequent launches on the same stream.
+        bool resume(CUstream stream, uint32_t* numAccumFrames);
+    };
+}
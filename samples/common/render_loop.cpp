@@ -0,0 +1,159 @@
+﻿#include "render_loop.h"
+
+namespace render_loop {
+    void RenderThread::start(CUcontext cuContext, const FrameFunction &renderFrame, float targetFrameRate,
+                             uint32_t maxFramesInFlight, uint32_t commandQueueCapacity) {
+        if (m_running || m_thread.joinable())
+            throw std::runtime_error("RenderThread is already running.");
+        if (!renderFrame)
+            throw std::runtime_error("Frame function must be set.");
+        if (maxFramesInFlight == 0)
+            throw std::runtime_error("At least one frame in flight is required.");
+
+        m_cuContext = cuContext;
+        m_renderFrame = renderFrame;
+        m_commands.initialize(commandQueueCapacity);
+        m_targetFrameInterval = targetFrameRate > 0.0f ? 1.0f / targetFrameRate : 0.0f;
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuStreamCreate(&m_stream, CU_STREAM_NON_BLOCKING));
+        for (uint32_t i = 0; i < numFrameSlots; ++i) {
+            CUDADRV_CHECK(cuEventCreate(&m_renderDoneEvents[i], CU_EVENT_DISABLE_TIMING));
+            CUDADRV_CHECK(cuEventCreate(&m_releaseEvents[i], CU_EVENT_DISABLE_TIMING));
+        }
+        m_inFlightFences.resize(maxFramesInFlight);
+        for (CUevent &fence : m_inFlightFences)
+            CUDADRV_CHECK(cuEventCreate(&fence, CU_EVENT_DISABLE_TIMING));
+
+        m_backSlot = 0;
+        m_frontSlot = 1;
+        m_frontSlotIsValid = false;
+        m_readySlot = 2;
+        m_numFrames = 0;
+        m_numCommands = 0;
+        m_error = nullptr;
+        m_hasError = false;
+
+        m_running = true;
+        m_thread = std::thread(&RenderThread::threadLoop, this);
+    }
+
+    void RenderThread::stop() {
+        if (!m_thread.joinable())
+            return;
+
+        m_running = false;
+        m_thread.join();
+
+        CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+        CUDADRV_CHECK(cuStreamSynchronize(m_stream));
+        for (CUevent &fence : m_inFlightFences)
+            CUDADRV_CHECK(cuEventDestroy(fence));
+        m_inFlightFences.clear();
+        for (uint32_t i = 0; i < numFrameSlots; ++i) {
+            CUDADRV_CHECK(cuEventDestroy(m_releaseEvents[i]));
+            CUDADRV_CHECK(cuEventDestroy(m_renderDoneEvents[i]));
+            m_releaseEvents[i] = nullptr;
+            m_renderDoneEvents[i] = nullptr;
+        }
+        CUDADRV_CHECK(cuStreamDestroy(m_stream));
+        m_stream = nullptr;
+        m_renderFrame = FrameFunction();
+    }
+
+    uint32_t RenderThread::executeCommands() {
+        uint32_t numCommands = 0;
+        Command command;
+        while (m_commands.pop(&command)) {
+            command(m_stream);
+            ++numCommands;
+        }
+        m_numCommands += numCommands;
+        return numCommands;
+    }
+
+    void RenderThread::threadLoop() {
+        using clock = std::chrono::steady_clock;
+        try {
+            CUDADRV_CHECK(cuCtxSetCurrent(m_cuContext));
+
+            const auto targetInterval = std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<float>(m_targetFrameInterval));
+            clock::time_point prevFrameBegin = clock::now();
+            clock::time_point nextFrameBegin = prevFrameBegin;
+            uint64_t frameIndex = 0;
+            while (m_running) {
+                // JP: フレーム間隔はUIスレッドとは独立にここで決める。
+                // EN: Frame intervals are decided here independently of the UI thread.
+                if (m_targetFrameInterval > 0.0f) {
+                    std::this_thread::sleep_until(nextFrameBegin);
+                    nextFrameBegin += targetInterval;
+                    // JP: 大きく遅れた場合は追いつこうとせずに基準をリセットする。
+                    // EN: Reset the reference instead of trying to catch up when largely behind.
+                    if (nextFrameBegin < clock::now())
+                        nextFrameBegin = clock::now() + targetInterval;
+                }
+
+                // JP: GPU上で処理中のフレーム数を制限して遅延を抑える。
+                // EN: Limit the number of frames in process on the GPU to bound latency.
+                CUevent fence = m_inFlightFences[frameIndex % m_inFlightFences.size()];
+                CUDADRV_CHECK(cuEventSynchronize(fence));
+
+                clock::time_point frameBegin = clock::now();
+                executeCommands();
+
+                // JP: UIスレッドがこのスロットを使い終わるまでGPU上で待つ。
+                // EN: Wait on the GPU until the UI thread finishes using this slot.
+                CUDADRV_CHECK(cuStreamWaitEvent(m_stream, m_releaseEvents[m_backSlot], 0));
+
+                FrameContext frame;
+                frame.stream = m_stream;
+                frame.frameIndex = frameIndex;
+                frame.slotIndex = m_backSlot;
+                frame.deltaTime = std::chrono::duration<float>(frameBegin - prevFrameBegin).count();
+                m_renderFrame(frame);
+
+                CUDADRV_CHECK(cuEventRecord(m_renderDoneEvents[m_backSlot], m_stream));
+                CUDADRV_CHECK(cuEventRecord(fence, m_stream));
+                uint32_t prevReady = m_readySlot.exchange(m_backSlot | s_freshBit, std::memory_order_acq_rel);
+                m_backSlot = prevReady & s_slotMask;
+
+                clock::time_point frameEnd = clock::now();
+                m_lastSubmitTime = std::chrono::duration<float, std::milli>(frameEnd - frameBegin).count();
+                m_lastFrameInterval = std::chrono::duration<float, std::milli>(frameBegin - prevFrameBegin).count();
+                prevFrameBegin = frameBegin;
+                ++frameIndex;
+                m_numFrames = frameIndex;
+            }
+
+            // JP: 停止前に送られた編集を取りこぼさない。
+            // EN: Don't drop edits sent before stopping.
+            executeCommands();
+        }
+        catch (...) {
+            m_error = std::current_exception();
+            m_hasError.store(true, std::memory_order_release);
+            m_running = false;
+        }
+    }
+
+    bool RenderThread::acquireLatestFrame(CUstream uiStream, uint32_t* slotIndex) {
+        if (m_hasError.load(std::memory_order_acquire)) {
+            std::exception_ptr error = m_error;
+            m_hasError = false;
+            std::rethrow_exception(error);
+        }
+
+        if (m_readySlot.load(std::memory_order_acquire) & s_freshBit) {
+            if (m_frontSlotIsValid)
+                CUDADRV_CHECK(cuEventRecord(m_releaseEvents[m_frontSlot], uiStream));
+            uint32_t prevReady = m_readySlot.exchange(m_frontSlot, std::memory_order_acq_rel);
+            m_frontSlot = prevReady & s_slotMask;
+            m_frontSlotIsValid = true;
+            CUDADRV_CHECK(cuStreamWaitEvent(uiStream, m_renderDoneEvents[m_frontSlot], 0));
+        }
+
+        *slotIndex = m_frontSlot;
+        return m_frontSlotIsValid;
+    }
+}
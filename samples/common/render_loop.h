@@ -0,0 +1,229 @@
+﻿#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+// JP: UIスレッドと描画投入スレッドを分離するアプリケーションループ。
+//     描画スレッドがCUDAストリームとoptixuの投入(ASの更新、ローンチ)を所有し、
+//     UIスレッドはロックフリーのコマンドキューでシーンの編集を送り、完成したフレームを受け取って表示するだけにする。
+//     フレームの間隔はUIのコストとは独立に描画スレッド側で決まる。
+//     コマンドは描画スレッド上でフレームの間に実行されるので、シーンの編集とローンチが交錯することはない。
+//     optixuのシーン構築はスレッドセーフだが、ローンチ・ASビルド中に同じオブジェクトを書き換えてはならないため、
+//     UIスレッドからは直接optixuオブジェクトを触らずにコマンドとして送る。
+//
+//     render_loop::RenderThread renderThread;
+//     renderThread.start(cuContext, [&](const render_loop::FrameContext &frame) {
+//         scene.beginFrame();
+//         ias.rebuild(frame.stream, ...);
+//         pipeline.launch(frame.stream, ...); // frame.slotIndexの出力バッファーに書く
+//         scene.endFrame(frame.stream);
+//     }, 60.0f);
+//     // UIスレッド
+//     while (!glfwWindowShouldClose(window)) {
+//         renderThread.enqueue([=](CUstream stream) { inst.setTransform(xfm); });
+//         uint32_t slotIdx;
+//         if (renderThread.acquireLatestFrame(uiStream, &slotIdx))
+//             present(outputBuffers[slotIdx], uiStream);
+//         drawImGui();
+//     }
+//     renderThread.stop();
+//
+// EN: Application loop decoupling the UI thread and the render submission thread.
+//     The render thread owns the CUDA stream and optixu submissions (AS updates, launches),
+//     and the UI thread only sends scene edits via a lock-free command queue and receives completed frames
+//     to present. Frame pacing is decided on the render thread independently of UI cost.
+//     Commands are executed on the render thread between frames, so scene edits never interleave with launches.
+//     Scene construction of optixu is thread-safe, but the same objects must not be modified during launches or
+//     AS builds, so the UI thread sends edits as commands instead of touching optixu objects directly.
+//
+//     render_loop::RenderThread renderThread;
+//     renderThread.start(cuContext, [&](const render_loop::FrameContext &frame) {
+//         scene.beginFrame();
+//         ias.rebuild(frame.stream, ...);
+//         pipeline.launch(frame.stream, ...); // write to the output buffer of frame.slotIndex
+//         scene.endFrame(frame.stream);
+//     }, 60.0f);
+//     // UI thread
+//     while (!glfwWindowShouldClose(window)) {
+//         renderThread.enqueue([=](CUstream stream) { inst.setTransform(xfm); });
+//         uint32_t slotIdx;
+//         if (renderThread.acquireLatestFrame(uiStream, &slotIdx))
+//             present(outputBuffers[slotIdx], uiStream);
+//         drawImGui();
+//     }
+//     renderThread.stop();
+namespace render_loop {
+    // JP: 単一の生産者と単一の消費者のための固定容量のロックフリーリングキュー。
+    // EN: Fixed-capacity lock-free ring queue for a single producer and a single consumer.
+    template <typename T>
+    class SPSCQueue {
+        std::vector<T> m_items;
+        uint32_t m_mask;
+        alignas(64) std::atomic<uint32_t> m_head; // JP: 消費者が進める。 EN: Advanced by the consumer.
+        alignas(64) std::atomic<uint32_t> m_tail; // JP: 生産者が進める。 EN: Advanced by the producer.
+
+        SPSCQueue(const SPSCQueue &) = delete;
+        SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+    public:
+        SPSCQueue() : m_mask(0), m_head(0), m_tail(0) {}
+
+        // JP: 容量は2の冪に切り上げられる。使用中でない時に呼ぶ。
+        // EN: The capacity is rounded up to a power of two. Call this while not in use.
+        void initialize(uint32_t capacity) {
+            uint32_t pow2Capacity = 1;
+            while (pow2Capacity < capacity)
+                pow2Capacity <<= 1;
+            m_items.clear();
+            m_items.resize(pow2Capacity);
+            m_mask = pow2Capacity - 1;
+            m_head = 0;
+            m_tail = 0;
+        }
+
+        // JP: キューが満杯の場合はfalseを返す。
+        // EN: Return false when the queue is full.
+        bool push(T &&item) {
+            uint32_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+                return false;
+            m_items[tail & m_mask] = std::move(item);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(T* item) {
+            uint32_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+                return false;
+            *item = std::move(m_items[head & m_mask]);
+            m_items[head & m_mask] = T();
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    struct FrameContext {
+        CUstream stream;
+        uint64_t frameIndex;
+        // JP: このフレームが書き込むべき出力スロット。[0, numFrameSlots)
+        // EN: Output slot this frame should write to. [0, numFrameSlots)
+        uint32_t slotIndex;
+        // JP: 前フレームの開始からの経過時間[s]。
+        // EN: Elapsed time from the beginning of the previous frame [s].
+        float deltaTime;
+    };
+
+    using Command = std::function<void(CUstream stream)>;
+    using FrameFunction = std::function<void(const FrameContext &frame)>;
+
+    struct RenderStatistics {
+        uint64_t numFrames;
+        uint64_t numCommands;
+        // JP: 描画スレッドがフレームの投入に費やしたCPU時間[ms]。
+        // EN: CPU time spent by the render thread to submit a frame [ms].
+        float lastSubmitTime;
+        float lastFrameInterval;
+    };
+
+    class RenderThread {
+    public:
+        // JP: 出力スロットは三重バッファリングされる。描画スレッド、UIスレッド、受け渡し待ちがそれぞれ1枚を持つ。
+        // EN: Output slots are triple buffered.
+        //     The render thread, the UI thread and the handover each hold one of them.
+        static constexpr uint32_t numFrameSlots = 3;
+
+    private:
+        static constexpr uint32_t s_slotMask = 0x3;
+        static constexpr uint32_t s_freshBit = 0x4;
+
+        CUcontext m_cuContext;
+        CUstream m_stream;
+        FrameFunction m_renderFrame;
+        SPSCQueue<Command> m_commands;
+        std::thread m_thread;
+        std::atomic<bool> m_running;
+        std::exception_ptr m_error;
+        std::atomic<bool> m_hasError;
+
+        // JP: 各スロットについて、描画完了を示すイベントとUIスレッドの使用終了を示すイベント。
+        // EN: For each slot, an event indicating the rendering completion and one indicating the end of UI use.
+        CUevent m_renderDoneEvents[numFrameSlots];
+        CUevent m_releaseEvents[numFrameSlots];
+        uint32_t m_backSlot; // JP: 描画スレッドが所有。 EN: Owned by the render thread.
+        uint32_t m_frontSlot; // JP: UIスレッドが所有。 EN: Owned by the UI thread.
+        bool m_frontSlotIsValid;
+        std::atomic<uint32_t> m_readySlot;
+
+        std::vector<CUevent> m_inFlightFences;
+        float m_targetFrameInterval;
+
+        std::atomic<uint64_t> m_numFrames;
+        std::atomic<uint64_t> m_numCommands;
+        std::atomic<float> m_lastSubmitTime;
+        std::atomic<float> m_lastFrameInterval;
+
+        RenderThread(const RenderThread &) = delete;
+        RenderThread &operator=(const RenderThread &) = delete;
+
+        void threadLoop();
+        uint32_t executeCommands();
+
+    public:
+        RenderThread() :
+            m_cuContext(nullptr), m_stream(nullptr), m_running(false), m_hasError(false),
+            m_backSlot(0), m_frontSlot(1), m_frontSlotIsValid(false), m_readySlot(2), m_targetFrameInterval(0.0f),
+            m_numFrames(0), m_numCommands(0), m_lastSubmitTime(0.0f), m_lastFrameInterval(0.0f) {
+            for (uint32_t i = 0; i < numFrameSlots; ++i) {
+                m_renderDoneEvents[i] = nullptr;
+                m_releaseEvents[i] = nullptr;
+            }
+        }
+        ~RenderThread() {
+            stop();
+        }
+
+        // JP: targetFrameRateが0の場合は間隔を空けずに(maxFramesInFlightの範囲で)描画する。
+        //     maxFramesInFlightはGPU上で同時に処理中になり得るフレーム数で、遅延の上限になる。
+        // EN: When targetFrameRate is 0, render without intervals (within maxFramesInFlight).
+        //     maxFramesInFlight is the number of frames which can be in process on the GPU at once,
+        //     and it bounds the latency.
+        void start(CUcontext cuContext, const FrameFunction &renderFrame, float targetFrameRate = 0.0f,
+                   uint32_t maxFramesInFlight = 2, uint32_t commandQueueCapacity = 1024);
+        // JP: キューに残ったコマンドを実行し、投入済みのフレームの完了を待ってから終了する。
+        // EN: Execute commands left in the queue and wait for the completion of submitted frames, then finish.
+        void stop();
+
+        // JP: UIスレッド(単一の生産者)から呼ぶ。キューが満杯の場合はfalseを返すので、次のUIフレームで再度送る。
+        // EN: Call this from the UI thread (single producer).
+        //     This returns false when the queue is full, so send it again in the next UI frame.
+        bool enqueue(Command &&command) {
+            return m_commands.push(std::move(command));
+        }
+
+        // JP: UIスレッドから呼ぶ。新しいフレームがあれば受け取ったスロットを返す。
+        //     新しいフレームが無い場合も前回のスロットを返し、まだ一度も完成していない場合のみfalseを返す。
+        //     uiStreamはスロットの描画完了を待つようになり、それまでのuiStream上の処理は前回のスロットを
+        //     使い終わったものとして扱われる。描画スレッドのエラーはここで再送出される。
+        // EN: Call this from the UI thread. Return the received slot if there is a new frame.
+        //     Return the previous slot even if there is no new frame, and return false only when no frame has
+        //     completed yet. uiStream is made waiting for the completion of the slot's rendering, and the work so far
+        //     on uiStream is treated as the end of use of the previous slot.
+        //     An error on the render thread is rethrown here.
+        bool acquireLatestFrame(CUstream uiStream, uint32_t* slotIndex);
+
+        RenderStatistics getStatistics() const {
+            RenderStatistics stats;
+            stats.numFrames = m_numFrames;
+            stats.numCommands = m_numCommands;
+            stats.lastSubmitTime = m_lastSubmitTime;
+            stats.lastFrameInterval = m_lastFrameInterval;
+            return stats;
+        }
+        bool isRunning() const {
+            return m_running;
+        }
+    };
+}
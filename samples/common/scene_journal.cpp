@@ -0,0 +1,1352 @@
+﻿#include "scene_journal.h"
+
+namespace asset {
+    namespace {
+        constexpr char journalMagic[8] = { 'O', 'P', 'T', 'X', 'J', 'R', 'N', 'L' };
+        constexpr uint32_t journalVersion = 1;
+        constexpr uint32_t invalidId = 0xFFFFFFFF;
+
+        struct JournalPacketHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t numRecords;
+            uint64_t sequence;
+            uint64_t bodySize;
+        };
+
+        // JP: レコードは1バイトのオペコードに続く固定順のフィールドからなる。
+        //     新しいオペコードは末尾に追加し、既存のレコードの形式を変える場合はjournalVersionを上げる。
+        // EN: A record consists of a 1-byte opcode followed by fields in a fixed order.
+        //     Append new opcodes at the end, and bump journalVersion when changing the format of existing records.
+        enum Opcode : uint8_t {
+            Opcode_CreateBuffer = 0,
+            Opcode_WriteBuffer,
+            Opcode_DestroyBuffer,
+
+            Opcode_CreateGeometryInstance,
+            Opcode_SetNumMotionSteps,
+            Opcode_SetVertexFormat,
+            Opcode_SetVertexBuffer,
+            Opcode_SetWidthBuffer,
+            Opcode_SetTriangleBuffer,
+            Opcode_SetSegmentIndexBuffer,
+            Opcode_SetCustomPrimitiveAABBBuffer,
+            Opcode_SetPrimitiveIndexOffset,
+            Opcode_SetNumMaterials,
+            Opcode_SetGeometryFlags,
+            Opcode_SetMaterial,
+            Opcode_SetGeometryInstanceUserData,
+            Opcode_DestroyGeometryInstance,
+
+            Opcode_CreateGAS,
+            Opcode_SetGASConfiguration,
+            Opcode_SetGASMotionOptions,
+            Opcode_SetNumMaterialSets,
+            Opcode_SetNumRayTypes,
+            Opcode_AddGASChild,
+            Opcode_RemoveGASChildAt,
+            Opcode_ClearGASChildren,
+            Opcode_SetGASChildUserData,
+            Opcode_SetGASUserData,
+            Opcode_MarkGASDirty,
+            Opcode_DestroyGAS,
+
+            Opcode_CreateTransform,
+            Opcode_SetTransformConfiguration,
+            Opcode_SetTransformMotionOptions,
+            Opcode_SetMatrixMotionKey,
+            Opcode_SetSRTMotionKey,
+            Opcode_SetStaticTransform,
+            Opcode_SetTransformChild,
+            Opcode_MarkTransformDirty,
+            Opcode_DestroyTransform,
+
+            Opcode_CreateInstance,
+            Opcode_SetInstanceChild,
+            Opcode_SetInstanceID,
+            Opcode_SetVisibilityMask,
+            Opcode_SetInstanceFlags,
+            Opcode_SetInstanceTransform,
+            Opcode_DestroyInstance,
+
+            Opcode_CreateIAS,
+            Opcode_SetIASConfiguration,
+            Opcode_SetIASMotionOptions,
+            Opcode_AddIASChild,
+            Opcode_RemoveIASChildAt,
+            Opcode_ClearIASChildren,
+            Opcode_MarkIASDirty,
+            Opcode_DestroyIAS,
+        };
+
+        class RecordReader {
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_offset;
+
+            void require(size_t size) const {
+                if (m_offset + size > m_size)
+                    throw std::runtime_error("Scene journal record is truncated.");
+            }
+
+        public:
+            RecordReader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_offset(0) {}
+
+            const uint8_t* getBytes(size_t size) {
+                require(size);
+                const uint8_t* ret = m_data + m_offset;
+                m_offset += size;
+                return ret;
+            }
+            template <typename T>
+            T get() {
+                static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable.");
+                T value;
+                std::memcpy(&value, getBytes(sizeof(T)), sizeof(T));
+                return value;
+            }
+            std::string getString() {
+                uint32_t length = get<uint32_t>();
+                auto chars = reinterpret_cast<const char*>(getBytes(length));
+                return std::string(chars, length);
+            }
+            const uint8_t* getUserData(uint32_t* size, uint32_t* alignment) {
+                *size = get<uint32_t>();
+                *alignment = get<uint32_t>();
+                return getBytes(*size);
+            }
+            bool isEnd() const {
+                return m_offset >= m_size;
+            }
+        };
+
+        // JP: 生成のレコードのIDは各種類で連番になっている必要がある。
+        // EN: IDs of creation records need to be sequential for each type.
+        template <typename T>
+        void checkNewId(const std::vector<T> &objects, uint32_t id) {
+            if (id != objects.size())
+                throw std::runtime_error("Scene journal has an out-of-order object ID.");
+        }
+
+        template <typename Vector>
+        auto &getObject(Vector &objects, uint32_t id, const char* typeName) {
+            if (id >= objects.size())
+                throw std::runtime_error(std::string("Scene journal has an invalid ") + typeName + " reference.");
+            return objects[id];
+        }
+
+        enum VisitState : uint8_t {
+            VisitState_Unvisited = 0,
+            VisitState_InProgress,
+            VisitState_Unchanged,
+            VisitState_Changed,
+        };
+    }
+
+
+
+    optixu::BufferView SceneMirror::getBuffer(uint32_t id) const {
+        if (id == invalidId)
+            return optixu::BufferView();
+        const cudau::Buffer &buffer = getObject(m_buffers, id, "buffer");
+        if (!buffer.isInitialized())
+            throw std::runtime_error("Scene journal references a destroyed buffer.");
+        return static_cast<optixu::BufferView>(buffer);
+    }
+
+    optixu::GeometryInstance SceneMirror::getGeometryInstance(uint32_t id) const {
+        optixu::GeometryInstance geomInst = getObject(m_geomInsts, id, "geometry instance");
+        if (!geomInst)
+            throw std::runtime_error("Scene journal references a destroyed geometry instance.");
+        return geomInst;
+    }
+
+    const SceneMirror::GeometryAS &SceneMirror::getGeometryAS(uint32_t id) const {
+        const GeometryAS &geomAS = getObject(m_geomASs, id, "GAS");
+        if (!geomAS.gas)
+            throw std::runtime_error("Scene journal references a destroyed GAS.");
+        return geomAS;
+    }
+
+    SceneMirror::TransformNode &SceneMirror::getTransformNode(uint32_t id) {
+        TransformNode &node = getObject(m_transforms, id, "transform");
+        if (!node.transform)
+            throw std::runtime_error("Scene journal references a destroyed transform.");
+        return node;
+    }
+
+    SceneMirror::InstanceNode &SceneMirror::getInstanceNode(uint32_t id) {
+        InstanceNode &node = getObject(m_instances, id, "instance");
+        if (!node.inst)
+            throw std::runtime_error("Scene journal references a destroyed instance.");
+        return node;
+    }
+
+    SceneMirror::InstanceAS &SceneMirror::getInstanceAS(uint32_t id) {
+        InstanceAS &instAS = getObject(m_instASs, id, "IAS");
+        if (!instAS.ias)
+            throw std::runtime_error("Scene journal references a destroyed IAS.");
+        return instAS;
+    }
+
+    void SceneMirror::checkReference(const Reference &ref) {
+        if (ref.type == optixu::ChildType::GAS)
+            getGeometryAS(ref.id);
+        else if (ref.type == optixu::ChildType::IAS)
+            getInstanceAS(ref.id);
+        else if (ref.type == optixu::ChildType::Transform)
+            getTransformNode(ref.id);
+        else
+            throw std::runtime_error("Scene journal has an invalid child type.");
+    }
+
+    void SceneMirror::initialize(CUcontext cuContext, optixu::Scene scene, const MaterialLookup &lookupMaterial,
+                                 optixu::GASBuildScheduler* scheduler) {
+        if (!scheduler)
+            throw std::runtime_error("SceneMirror requires a GAS build scheduler.");
+        m_cuContext = cuContext;
+        m_scene = scene;
+        m_lookupMaterial = lookupMaterial;
+        m_scheduler = scheduler;
+        m_nextSequence = 0;
+    }
+
+    void SceneMirror::finalize() {
+        if (m_scratchBuffer.isInitialized())
+            m_scratchBuffer.finalize();
+        for (optixu::GeometryAccelerationStructure gas : m_pendingGASReleases) {
+            m_scheduler->release(gas);
+            gas.destroy();
+        }
+        m_pendingGASReleases.clear();
+        for (cudau::Buffer &buffer : m_pendingBufferReleases)
+            buffer.finalize();
+        m_pendingBufferReleases.clear();
+        for (int i = static_cast<int>(m_instASs.size()) - 1; i >= 0; --i) {
+            InstanceAS &instAS = m_instASs[i];
+            if (instAS.accelBuffer.isInitialized())
+                instAS.accelBuffer.finalize();
+            if (instAS.instanceBuffer.isInitialized())
+                instAS.instanceBuffer.finalize();
+            if (instAS.ias)
+                instAS.ias.destroy();
+        }
+        m_instASs.clear();
+        for (int i = static_cast<int>(m_instances.size()) - 1; i >= 0; --i) {
+            if (m_instances[i].inst)
+                m_instances[i].inst.destroy();
+        }
+        m_instances.clear();
+        for (int i = static_cast<int>(m_transforms.size()) - 1; i >= 0; --i) {
+            TransformNode &node = m_transforms[i];
+            if (node.buffer.isInitialized())
+                node.buffer.finalize();
+            if (node.transform)
+                node.transform.destroy();
+        }
+        m_transforms.clear();
+        for (int i = static_cast<int>(m_geomASs.size()) - 1; i >= 0; --i) {
+            GeometryAS &geomAS = m_geomASs[i];
+            if (geomAS.gas) {
+                m_scheduler->release(geomAS.gas);
+                geomAS.gas.destroy();
+            }
+        }
+        m_geomASs.clear();
+        for (int i = static_cast<int>(m_geomInsts.size()) - 1; i >= 0; --i) {
+            if (m_geomInsts[i])
+                m_geomInsts[i].destroy();
+        }
+        m_geomInsts.clear();
+        for (int i = static_cast<int>(m_buffers.size()) - 1; i >= 0; --i) {
+            if (m_buffers[i].isInitialized())
+                m_buffers[i].finalize();
+        }
+        m_buffers.clear();
+        m_nextSequence = 0;
+    }
+
+    void SceneMirror::apply(const uint8_t* records, size_t size, CUstream stream) {
+        RecordReader reader(records, size);
+        auto findMaterial = [this](const std::string &name) {
+            return name.empty() ? optixu::Material() : m_lookupMaterial(name);
+        };
+        auto getReference = [this, &reader]() {
+            Reference ref;
+            ref.type = static_cast<optixu::ChildType>(reader.get<uint8_t>());
+            ref.id = reader.get<uint32_t>();
+            checkReference(ref);
+            return ref;
+        };
+
+        while (!reader.isEnd()) {
+            auto opcode = static_cast<Opcode>(reader.get<uint8_t>());
+            switch (opcode) {
+            case Opcode_CreateBuffer: {
+                uint32_t id = reader.get<uint32_t>();
+                uint32_t numElements = reader.get<uint32_t>();
+                uint32_t stride = reader.get<uint32_t>();
+                checkNewId(m_buffers, id);
+                cudau::Buffer buffer;
+                buffer.initialize(m_cuContext, cudau::BufferType::Device, numElements, stride);
+                m_buffers.push_back(std::move(buffer));
+                break;
+            }
+            case Opcode_WriteBuffer: {
+                optixu::BufferView buffer = getBuffer(reader.get<uint32_t>());
+                uint64_t offset = reader.get<uint64_t>();
+                uint64_t writeSize = reader.get<uint64_t>();
+                const uint8_t* contents = reader.getBytes(writeSize);
+                if (offset + writeSize > buffer.sizeInBytes())
+                    throw std::runtime_error("Scene journal writes out of the buffer range.");
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(buffer.getCUdeviceptr() + offset, contents, writeSize, stream));
+                break;
+            }
+            case Opcode_DestroyBuffer: {
+                uint32_t id = reader.get<uint32_t>();
+                getBuffer(id);
+                // JP: 使用中の可能性があるので解放は次のbuild()まで遅延する。
+                // EN: Defer the release to the next build() since the buffer may be in use.
+                m_pendingBufferReleases.push_back(std::move(m_buffers[id]));
+                break;
+            }
+
+            case Opcode_CreateGeometryInstance: {
+                uint32_t id = reader.get<uint32_t>();
+                auto geomType = static_cast<optixu::GeometryType>(reader.get<uint32_t>());
+                checkNewId(m_geomInsts, id);
+                m_geomInsts.push_back(m_scene.createGeometryInstance(geomType));
+                break;
+            }
+            case Opcode_SetNumMotionSteps: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                geomInst.setNumMotionSteps(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetVertexFormat: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                geomInst.setVertexFormat(static_cast<OptixVertexFormat>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetVertexBuffer:
+            case Opcode_SetWidthBuffer:
+            case Opcode_SetCustomPrimitiveAABBBuffer: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                optixu::BufferView buffer = getBuffer(reader.get<uint32_t>());
+                uint32_t motionStep = reader.get<uint32_t>();
+                if (opcode == Opcode_SetVertexBuffer)
+                    geomInst.setVertexBuffer(buffer, motionStep);
+                else if (opcode == Opcode_SetWidthBuffer)
+                    geomInst.setWidthBuffer(buffer, motionStep);
+                else
+                    geomInst.setCustomPrimitiveAABBBuffer(buffer, motionStep);
+                break;
+            }
+            case Opcode_SetTriangleBuffer: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                optixu::BufferView buffer = getBuffer(reader.get<uint32_t>());
+                geomInst.setTriangleBuffer(buffer, static_cast<OptixIndicesFormat>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetSegmentIndexBuffer: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                geomInst.setSegmentIndexBuffer(getBuffer(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetPrimitiveIndexOffset: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                geomInst.setPrimitiveIndexOffset(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetNumMaterials: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                uint32_t numMaterials = reader.get<uint32_t>();
+                optixu::BufferView matIndexBuffer = getBuffer(reader.get<uint32_t>());
+                geomInst.setNumMaterials(numMaterials, matIndexBuffer, reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetGeometryFlags: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                uint32_t matIdx = reader.get<uint32_t>();
+                geomInst.setGeometryFlags(matIdx, static_cast<OptixGeometryFlags>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetMaterial: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                uint32_t matSetIdx = reader.get<uint32_t>();
+                uint32_t matIdx = reader.get<uint32_t>();
+                geomInst.setMaterial(matSetIdx, matIdx, findMaterial(reader.getString()));
+                break;
+            }
+            case Opcode_SetGeometryInstanceUserData: {
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                uint32_t userDataSize, userDataAlignment;
+                const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+                geomInst.setUserData(userData, userDataSize, userDataAlignment);
+                break;
+            }
+            case Opcode_DestroyGeometryInstance: {
+                uint32_t id = reader.get<uint32_t>();
+                getGeometryInstance(id).destroy();
+                m_geomInsts[id] = optixu::GeometryInstance();
+                break;
+            }
+
+            case Opcode_CreateGAS: {
+                uint32_t id = reader.get<uint32_t>();
+                auto geomType = static_cast<optixu::GeometryType>(reader.get<uint32_t>());
+                checkNewId(m_geomASs, id);
+                GeometryAS geomAS;
+                geomAS.gas = m_scene.createGeometryAccelerationStructure(geomType);
+                m_geomASs.push_back(geomAS);
+                break;
+            }
+            case Opcode_SetGASConfiguration: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                auto tradeoff = static_cast<optixu::ASTradeoff>(reader.get<uint32_t>());
+                bool allowUpdate = reader.get<uint8_t>() != 0;
+                bool allowCompaction = reader.get<uint8_t>() != 0;
+                bool allowRandomVertexAccess = reader.get<uint8_t>() != 0;
+                gas.setConfiguration(tradeoff, allowUpdate, allowCompaction, allowRandomVertexAccess);
+                break;
+            }
+            case Opcode_SetGASMotionOptions: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                uint32_t numKeys = reader.get<uint32_t>();
+                float timeBegin = reader.get<float>();
+                float timeEnd = reader.get<float>();
+                gas.setMotionOptions(numKeys, timeBegin, timeEnd,
+                                     static_cast<OptixMotionFlags>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetNumMaterialSets: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                gas.setNumMaterialSets(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetNumRayTypes: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                uint32_t matSetIdx = reader.get<uint32_t>();
+                gas.setNumRayTypes(matSetIdx, reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_AddGASChild: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                optixu::GeometryInstance geomInst = getGeometryInstance(reader.get<uint32_t>());
+                optixu::BufferView preTransform = getBuffer(reader.get<uint32_t>());
+                uint32_t userDataSize, userDataAlignment;
+                const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+                gas.addChild(geomInst, preTransform.getCUdeviceptr(),
+                             userDataSize > 0 ? userData : nullptr, userDataSize, userDataAlignment);
+                break;
+            }
+            case Opcode_RemoveGASChildAt: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                gas.removeChildAt(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_ClearGASChildren: {
+                getGeometryAS(reader.get<uint32_t>()).gas.clearChildren();
+                break;
+            }
+            case Opcode_SetGASChildUserData: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                uint32_t index = reader.get<uint32_t>();
+                uint32_t userDataSize, userDataAlignment;
+                const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+                gas.setChildUserData(index, userData, userDataSize, userDataAlignment);
+                break;
+            }
+            case Opcode_SetGASUserData: {
+                optixu::GeometryAccelerationStructure gas = getGeometryAS(reader.get<uint32_t>()).gas;
+                uint32_t userDataSize, userDataAlignment;
+                const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+                gas.setUserData(userData, userDataSize, userDataAlignment);
+                break;
+            }
+            case Opcode_MarkGASDirty: {
+                getGeometryAS(reader.get<uint32_t>()).gas.markDirty();
+                break;
+            }
+            case Opcode_DestroyGAS: {
+                uint32_t id = reader.get<uint32_t>();
+                // JP: アクセラレーションバッファーが使用中の可能性があるので破棄は次のbuild()まで遅延する。
+                // EN: Defer the destruction to the next build() since the acceleration buffer may be in use.
+                m_pendingGASReleases.push_back(getGeometryAS(id).gas);
+                m_geomASs[id].gas = optixu::GeometryAccelerationStructure();
+                break;
+            }
+
+            case Opcode_CreateTransform: {
+                uint32_t id = reader.get<uint32_t>();
+                checkNewId(m_transforms, id);
+                TransformNode node;
+                node.transform = m_scene.createTransform();
+                node.size = 0;
+                node.child = Reference{ optixu::ChildType::Invalid, invalidId };
+                m_transforms.push_back(std::move(node));
+                break;
+            }
+            case Opcode_SetTransformConfiguration: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                auto type = static_cast<optixu::TransformType>(reader.get<uint32_t>());
+                uint32_t numKeys = reader.get<uint32_t>();
+                node.transform.setConfiguration(type, numKeys, &node.size);
+                break;
+            }
+            case Opcode_SetTransformMotionOptions: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                float timeBegin = reader.get<float>();
+                float timeEnd = reader.get<float>();
+                node.transform.setMotionOptions(timeBegin, timeEnd,
+                                                static_cast<OptixMotionFlags>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetMatrixMotionKey: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                uint32_t keyIdx = reader.get<uint32_t>();
+                auto matrix = reader.get<std::array<float, 12>>();
+                node.transform.setMatrixMotionKey(keyIdx, matrix.data());
+                break;
+            }
+            case Opcode_SetSRTMotionKey: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                uint32_t keyIdx = reader.get<uint32_t>();
+                auto srt = reader.get<std::array<float, 10>>();
+                node.transform.setSRTMotionKey(keyIdx, srt.data(), srt.data() + 3, srt.data() + 7);
+                break;
+            }
+            case Opcode_SetStaticTransform: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                auto matrix = reader.get<std::array<float, 12>>();
+                node.transform.setStaticTransform(matrix.data());
+                break;
+            }
+            case Opcode_SetTransformChild: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                Reference child = getReference();
+                if (child.type == optixu::ChildType::GAS)
+                    node.transform.setChild(getGeometryAS(child.id).gas);
+                else if (child.type == optixu::ChildType::IAS)
+                    node.transform.setChild(getInstanceAS(child.id).ias);
+                else
+                    node.transform.setChild(getTransformNode(child.id).transform);
+                node.child = child;
+                break;
+            }
+            case Opcode_MarkTransformDirty: {
+                getTransformNode(reader.get<uint32_t>()).transform.markDirty();
+                break;
+            }
+            case Opcode_DestroyTransform: {
+                TransformNode &node = getTransformNode(reader.get<uint32_t>());
+                if (node.buffer.isInitialized())
+                    m_pendingBufferReleases.push_back(std::move(node.buffer));
+                node.transform.destroy();
+                node.transform = optixu::Transform();
+                break;
+            }
+
+            case Opcode_CreateInstance: {
+                uint32_t id = reader.get<uint32_t>();
+                checkNewId(m_instances, id);
+                InstanceNode node;
+                node.inst = m_scene.createInstance();
+                node.child = Reference{ optixu::ChildType::Invalid, invalidId };
+                m_instances.push_back(node);
+                break;
+            }
+            case Opcode_SetInstanceChild: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                Reference child = getReference();
+                uint32_t matSetIdx = reader.get<uint32_t>();
+                if (child.type == optixu::ChildType::GAS)
+                    node.inst.setChild(getGeometryAS(child.id).gas, matSetIdx);
+                else if (child.type == optixu::ChildType::IAS)
+                    node.inst.setChild(getInstanceAS(child.id).ias);
+                else
+                    node.inst.setChild(getTransformNode(child.id).transform, matSetIdx);
+                node.child = child;
+                break;
+            }
+            case Opcode_SetInstanceID: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                node.inst.setID(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetVisibilityMask: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                node.inst.setVisibilityMask(reader.get<uint32_t>());
+                break;
+            }
+            case Opcode_SetInstanceFlags: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                node.inst.setFlags(static_cast<OptixInstanceFlags>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_SetInstanceTransform: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                auto transform = reader.get<std::array<float, 12>>();
+                node.inst.setTransform(transform.data());
+                break;
+            }
+            case Opcode_DestroyInstance: {
+                InstanceNode &node = getInstanceNode(reader.get<uint32_t>());
+                node.inst.destroy();
+                node.inst = optixu::Instance();
+                break;
+            }
+
+            case Opcode_CreateIAS: {
+                uint32_t id = reader.get<uint32_t>();
+                checkNewId(m_instASs, id);
+                InstanceAS instAS;
+                instAS.ias = m_scene.createInstanceAccelerationStructure();
+                m_instASs.push_back(std::move(instAS));
+                break;
+            }
+            case Opcode_SetIASConfiguration: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                auto tradeoff = static_cast<optixu::ASTradeoff>(reader.get<uint32_t>());
+                bool allowUpdate = reader.get<uint8_t>() != 0;
+                bool allowCompaction = reader.get<uint8_t>() != 0;
+                instAS.ias.setConfiguration(tradeoff, allowUpdate, allowCompaction, false);
+                break;
+            }
+            case Opcode_SetIASMotionOptions: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                uint32_t numKeys = reader.get<uint32_t>();
+                float timeBegin = reader.get<float>();
+                float timeEnd = reader.get<float>();
+                instAS.ias.setMotionOptions(numKeys, timeBegin, timeEnd,
+                                            static_cast<OptixMotionFlags>(reader.get<uint32_t>()));
+                break;
+            }
+            case Opcode_AddIASChild: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                uint32_t instId = reader.get<uint32_t>();
+                instAS.ias.addChild(getInstanceNode(instId).inst);
+                instAS.children.push_back(instId);
+                break;
+            }
+            case Opcode_RemoveIASChildAt: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                uint32_t index = reader.get<uint32_t>();
+                instAS.ias.removeChildAt(index);
+                instAS.children.erase(instAS.children.begin() + index);
+                break;
+            }
+            case Opcode_ClearIASChildren: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                instAS.ias.clearChildren();
+                instAS.children.clear();
+                break;
+            }
+            case Opcode_MarkIASDirty: {
+                getInstanceAS(reader.get<uint32_t>()).ias.markDirty();
+                break;
+            }
+            case Opcode_DestroyIAS: {
+                InstanceAS &instAS = getInstanceAS(reader.get<uint32_t>());
+                if (instAS.instanceBuffer.isInitialized())
+                    m_pendingBufferReleases.push_back(std::move(instAS.instanceBuffer));
+                if (instAS.accelBuffer.isInitialized())
+                    m_pendingBufferReleases.push_back(std::move(instAS.accelBuffer));
+                instAS.ias.destroy();
+                instAS.ias = optixu::InstanceAccelerationStructure();
+                instAS.children.clear();
+                break;
+            }
+
+            default:
+                throw std::runtime_error("Scene journal has an unknown opcode.");
+            }
+        }
+    }
+
+    void SceneMirror::replay(const uint8_t* packet, size_t size, CUstream stream) {
+        if (size < sizeof(JournalPacketHeader))
+            throw std::runtime_error("Scene journal packet is truncated.");
+        JournalPacketHeader header;
+        std::memcpy(&header, packet, sizeof(header));
+        if (std::memcmp(header.magic, journalMagic, sizeof(journalMagic)) != 0)
+            throw std::runtime_error("Not a scene journal packet.");
+        if (header.version != journalVersion)
+            throw std::runtime_error("Unsupported scene journal version.");
+        if (header.bodySize != size - sizeof(header))
+            throw std::runtime_error("Scene journal packet is truncated.");
+        if (header.sequence != m_nextSequence)
+            throw std::runtime_error("Scene journal packet is out of sequence.");
+        apply(packet + sizeof(header), header.bodySize, stream);
+        ++m_nextSequence;
+    }
+
+    bool SceneMirror::buildNode(CUstream stream, const Reference &ref, std::vector<uint8_t>* visited,
+                                SceneMirrorBuildResult* result) {
+        // JP: visitedはGAS, Transform, IASの順に並べた各ノードの状態。GASの状態はbuild()で設定済み。
+        // EN: visited holds the state of each node laid out in the order of GASs, transforms and IASs.
+        //     States of GASs have already been set in build().
+        size_t stateIdx = ref.id;
+        if (ref.type == optixu::ChildType::Transform ||
+            ref.type == optixu::ChildType::IAS)
+            stateIdx += m_geomASs.size();
+        if (ref.type == optixu::ChildType::IAS)
+            stateIdx += m_transforms.size();
+        uint8_t &state = (*visited)[stateIdx];
+        if (state == VisitState_InProgress)
+            throw std::runtime_error("Scene mirror has a cyclic reference.");
+        if (state != VisitState_Unvisited)
+            return state == VisitState_Changed;
+        state = VisitState_InProgress;
+
+        bool built = false;
+        if (ref.type == optixu::ChildType::Transform) {
+            TransformNode &node = getTransformNode(ref.id);
+            bool childChanged = false;
+            if (node.child.type != optixu::ChildType::Invalid)
+                childChanged = buildNode(stream, node.child, visited, result);
+            if (childChanged || !node.transform.isReady()) {
+                if (!node.buffer.isInitialized() || node.buffer.sizeInBytes() < node.size) {
+                    if (node.buffer.isInitialized())
+                        node.buffer.finalize();
+                    node.buffer.initialize(m_cuContext, cudau::BufferType::Device,
+                                           static_cast<uint32_t>(std::max<size_t>(node.size, 1)), 1);
+                }
+                node.transform.rebuild(stream, node.buffer);
+                ++result->numBuiltTransforms;
+                built = true;
+            }
+        }
+        else {
+            InstanceAS &instAS = getInstanceAS(ref.id);
+            bool childChanged = false;
+            for (uint32_t instId : instAS.children) {
+                const InstanceNode &node = getInstanceNode(instId);
+                if (node.child.type != optixu::ChildType::Invalid)
+                    childChanged |= buildNode(stream, node.child, visited, result);
+            }
+            if (childChanged || !instAS.ias.isReady()) {
+                OptixAccelBufferSizes asSizes;
+                instAS.ias.prepareForBuild(&asSizes);
+                uint32_t numChildren = std::max(static_cast<uint32_t>(instAS.children.size()), 1u);
+                if (!instAS.instanceBuffer.isInitialized() || instAS.instanceBuffer.numElements() < numChildren) {
+                    if (instAS.instanceBuffer.isInitialized())
+                        instAS.instanceBuffer.finalize();
+                    instAS.instanceBuffer.initialize(m_cuContext, cudau::BufferType::Device, numChildren);
+                }
+                if (!instAS.accelBuffer.isInitialized() ||
+                    instAS.accelBuffer.sizeInBytes() < asSizes.outputSizeInBytes) {
+                    if (instAS.accelBuffer.isInitialized())
+                        instAS.accelBuffer.finalize();
+                    instAS.accelBuffer.initialize(m_cuContext, cudau::BufferType::Device,
+                                                  static_cast<uint32_t>(asSizes.outputSizeInBytes), 1);
+                }
+                if (!m_scratchBuffer.isInitialized() || m_scratchBuffer.sizeInBytes() < asSizes.tempSizeInBytes) {
+                    // JP: 先行するビルドがスクラッチバッファーを使い終わるのを待ってから確保し直す。
+                    // EN: Wait for preceding builds to finish using the scratch buffer before reallocating it.
+                    if (m_scratchBuffer.isInitialized()) {
+                        CUDADRV_CHECK(cuStreamSynchronize(stream));
+                        m_scratchBuffer.finalize();
+                    }
+                    m_scratchBuffer.initialize(m_cuContext, cudau::BufferType::Device,
+                                               static_cast<uint32_t>(std::max<size_t>(asSizes.tempSizeInBytes, 1)), 1);
+                }
+                instAS.ias.rebuild(stream, instAS.instanceBuffer, instAS.accelBuffer, m_scratchBuffer);
+                ++result->numBuiltIASs;
+                built = true;
+            }
+        }
+
+        state = built ? VisitState_Changed : VisitState_Unchanged;
+        return built;
+    }
+
+    void SceneMirror::build(CUstream stream, SceneMirrorBuildResult* result) {
+        *result = {};
+
+        // JP: SBTレイアウトをGASのビルドより先に生成しておくと、ジオメトリーフラグの推論を使う場合にも
+        //     ビルドが一度で済む。
+        // EN: Generating the SBT layout before GAS builds makes a single build suffice
+        //     even when using geometry flag inference.
+        if (!m_scene.shaderBindingTableLayoutIsReady()) {
+            m_scene.generateShaderBindingTableLayout(&result->hitGroupSbtSize);
+            result->sbtLayoutRegenerated = true;
+        }
+
+        std::vector<uint32_t> dirtyGASs;
+        for (uint32_t gasId = 0; gasId < m_geomASs.size(); ++gasId) {
+            const GeometryAS &geomAS = m_geomASs[gasId];
+            if (geomAS.gas && !geomAS.gas.isReady())
+                dirtyGASs.push_back(gasId);
+        }
+        bool hasDirtyNodes = false;
+        for (const TransformNode &node : m_transforms)
+            hasDirtyNodes |= node.transform && !node.transform.isReady();
+        for (const InstanceAS &instAS : m_instASs)
+            hasDirtyNodes |= instAS.ias && !instAS.ias.isReady();
+        if (dirtyGASs.empty() && !hasDirtyNodes &&
+            m_pendingGASReleases.empty() && m_pendingBufferReleases.empty())
+            return;
+
+        // JP: 以降は解放とリサイズを伴うので先行するフレームのGPUの処理を待つ。
+        // EN: Wait for GPU work of preceding frames since releases and resizes follow.
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        for (optixu::GeometryAccelerationStructure gas : m_pendingGASReleases) {
+            m_scheduler->release(gas);
+            gas.destroy();
+        }
+        m_pendingGASReleases.clear();
+        for (cudau::Buffer &buffer : m_pendingBufferReleases)
+            buffer.finalize();
+        m_pendingBufferReleases.clear();
+
+        std::vector<uint8_t> visited(m_geomASs.size() + m_transforms.size() + m_instASs.size(),
+                                     VisitState_Unvisited);
+        std::fill_n(visited.begin(), m_geomASs.size(), VisitState_Unchanged);
+        for (uint32_t gasId : dirtyGASs) {
+            optixu::GeometryAccelerationStructure gas = m_geomASs[gasId].gas;
+            m_scheduler->release(gas);
+            m_scheduler->addGAS(gas);
+            visited[gasId] = VisitState_Changed;
+        }
+        m_scheduler->build(stream);
+        result->numBuiltGASs = static_cast<uint32_t>(dirtyGASs.size());
+
+        for (uint32_t trId = 0; trId < m_transforms.size(); ++trId) {
+            if (m_transforms[trId].transform)
+                buildNode(stream, Reference{ optixu::ChildType::Transform, trId }, &visited, result);
+        }
+        for (uint32_t iasId = 0; iasId < m_instASs.size(); ++iasId) {
+            if (m_instASs[iasId].ias)
+                buildNode(stream, Reference{ optixu::ChildType::IAS, iasId }, &visited, result);
+        }
+    }
+
+
+
+    void SceneJournal::beginRecord(uint8_t opcode) {
+        if (!m_mirror)
+            throw std::runtime_error("SceneJournal is not initialized.");
+        m_recordBegin = m_records.size();
+        put(opcode);
+    }
+
+    // JP: ローカルのミラーへの適用に失敗したレコードは取り除いてから例外を伝える。
+    // EN: Remove a record failed to be applied to the local mirror before propagating the exception.
+    void SceneJournal::endRecord(CUstream stream) {
+        try {
+            m_mirror->apply(m_records.data() + m_recordBegin, m_records.size() - m_recordBegin, stream);
+        }
+        catch (...) {
+            m_records.resize(m_recordBegin);
+            throw;
+        }
+        ++m_numRecords;
+    }
+
+    void SceneJournal::putBytes(const void* data, size_t size) {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        m_records.insert(m_records.end(), bytes, bytes + size);
+    }
+
+    void SceneJournal::putString(const std::string &str) {
+        put(static_cast<uint32_t>(str.size()));
+        putBytes(str.data(), str.size());
+    }
+
+    void SceneJournal::putUserData(const void* data, uint32_t size, uint32_t alignment) {
+        put(size);
+        put(alignment);
+        putBytes(data, size);
+    }
+
+    void SceneJournal::initialize(SceneMirror* localMirror) {
+        m_mirror = localMirror;
+        m_records.clear();
+        m_recordBegin = 0;
+        m_numRecords = 0;
+        std::fill_n(m_nextIds, static_cast<uint32_t>(JournalObjectType::NumTypes), 0u);
+        m_nextSequence = 0;
+        m_numFlushedBytes = 0;
+    }
+
+    void SceneJournal::flush(std::vector<uint8_t>* packet) {
+        packet->clear();
+        if (m_numRecords == 0)
+            return;
+
+        JournalPacketHeader header;
+        std::copy_n(journalMagic, sizeof(journalMagic), header.magic);
+        header.version = journalVersion;
+        header.numRecords = m_numRecords;
+        header.sequence = m_nextSequence++;
+        header.bodySize = m_records.size();
+        packet->resize(sizeof(header) + m_records.size());
+        std::memcpy(packet->data(), &header, sizeof(header));
+        std::copy(m_records.cbegin(), m_records.cend(), packet->begin() + sizeof(header));
+        m_numFlushedBytes += packet->size();
+
+        m_records.clear();
+        m_recordBegin = 0;
+        m_numRecords = 0;
+    }
+
+
+
+    JournalBufferId SceneJournal::createBuffer(uint32_t numElements, uint32_t stride) {
+        beginRecord(Opcode_CreateBuffer);
+        put(getNextId<JournalObjectType::Buffer>().value);
+        put(numElements);
+        put(stride);
+        endRecord();
+        return commitId<JournalObjectType::Buffer>();
+    }
+
+    void SceneJournal::writeBuffer(JournalBufferId buffer, size_t offsetInBytes, const void* data, size_t sizeInBytes,
+                                   CUstream stream) {
+        beginRecord(Opcode_WriteBuffer);
+        put(buffer.value);
+        put(static_cast<uint64_t>(offsetInBytes));
+        put(static_cast<uint64_t>(sizeInBytes));
+        putBytes(data, sizeInBytes);
+        endRecord(stream);
+    }
+
+    void SceneJournal::destroy(JournalBufferId buffer) {
+        beginRecord(Opcode_DestroyBuffer);
+        put(buffer.value);
+        endRecord();
+    }
+
+
+
+    JournalGeomInstId SceneJournal::createGeometryInstance(optixu::GeometryType geomType) {
+        beginRecord(Opcode_CreateGeometryInstance);
+        put(getNextId<JournalObjectType::GeometryInstance>().value);
+        put(static_cast<uint32_t>(geomType));
+        endRecord();
+        return commitId<JournalObjectType::GeometryInstance>();
+    }
+
+    void SceneJournal::setNumMotionSteps(JournalGeomInstId geomInst, uint32_t n) {
+        beginRecord(Opcode_SetNumMotionSteps);
+        put(geomInst.value);
+        put(n);
+        endRecord();
+    }
+
+    void SceneJournal::setVertexFormat(JournalGeomInstId geomInst, OptixVertexFormat format) {
+        beginRecord(Opcode_SetVertexFormat);
+        put(geomInst.value);
+        put(static_cast<uint32_t>(format));
+        endRecord();
+    }
+
+    void SceneJournal::setVertexBuffer(JournalGeomInstId geomInst, JournalBufferId buffer, uint32_t motionStep) {
+        beginRecord(Opcode_SetVertexBuffer);
+        put(geomInst.value);
+        put(buffer.value);
+        put(motionStep);
+        endRecord();
+    }
+
+    void SceneJournal::setWidthBuffer(JournalGeomInstId geomInst, JournalBufferId buffer, uint32_t motionStep) {
+        beginRecord(Opcode_SetWidthBuffer);
+        put(geomInst.value);
+        put(buffer.value);
+        put(motionStep);
+        endRecord();
+    }
+
+    void SceneJournal::setTriangleBuffer(JournalGeomInstId geomInst, JournalBufferId buffer,
+                                         OptixIndicesFormat format) {
+        beginRecord(Opcode_SetTriangleBuffer);
+        put(geomInst.value);
+        put(buffer.value);
+        put(static_cast<uint32_t>(format));
+        endRecord();
+    }
+
+    void SceneJournal::setSegmentIndexBuffer(JournalGeomInstId geomInst, JournalBufferId buffer) {
+        beginRecord(Opcode_SetSegmentIndexBuffer);
+        put(geomInst.value);
+        put(buffer.value);
+        endRecord();
+    }
+
+    void SceneJournal::setCustomPrimitiveAABBBuffer(JournalGeomInstId geomInst, JournalBufferId buffer,
+                                                    uint32_t motionStep) {
+        beginRecord(Opcode_SetCustomPrimitiveAABBBuffer);
+        put(geomInst.value);
+        put(buffer.value);
+        put(motionStep);
+        endRecord();
+    }
+
+    void SceneJournal::setPrimitiveIndexOffset(JournalGeomInstId geomInst, uint32_t offset) {
+        beginRecord(Opcode_SetPrimitiveIndexOffset);
+        put(geomInst.value);
+        put(offset);
+        endRecord();
+    }
+
+    void SceneJournal::setNumMaterials(JournalGeomInstId geomInst, uint32_t numMaterials,
+                                       JournalBufferId matIndexBuffer, uint32_t indexSize) {
+        beginRecord(Opcode_SetNumMaterials);
+        put(geomInst.value);
+        put(numMaterials);
+        put(matIndexBuffer.value);
+        put(indexSize);
+        endRecord();
+    }
+
+    void SceneJournal::setGeometryFlags(JournalGeomInstId geomInst, uint32_t matIdx, OptixGeometryFlags flags) {
+        beginRecord(Opcode_SetGeometryFlags);
+        put(geomInst.value);
+        put(matIdx);
+        put(static_cast<uint32_t>(flags));
+        endRecord();
+    }
+
+    void SceneJournal::setMaterial(JournalGeomInstId geomInst, uint32_t matSetIdx, uint32_t matIdx,
+                                   const std::string &materialName) {
+        beginRecord(Opcode_SetMaterial);
+        put(geomInst.value);
+        put(matSetIdx);
+        put(matIdx);
+        putString(materialName);
+        endRecord();
+    }
+
+    void SceneJournal::setUserData(JournalGeomInstId geomInst, const void* data, uint32_t size, uint32_t alignment) {
+        beginRecord(Opcode_SetGeometryInstanceUserData);
+        put(geomInst.value);
+        putUserData(data, size, alignment);
+        endRecord();
+    }
+
+    void SceneJournal::destroy(JournalGeomInstId geomInst) {
+        beginRecord(Opcode_DestroyGeometryInstance);
+        put(geomInst.value);
+        endRecord();
+    }
+
+
+
+    JournalGASId SceneJournal::createGAS(optixu::GeometryType geomType) {
+        beginRecord(Opcode_CreateGAS);
+        put(getNextId<JournalObjectType::GAS>().value);
+        put(static_cast<uint32_t>(geomType));
+        endRecord();
+        return commitId<JournalObjectType::GAS>();
+    }
+
+    void SceneJournal::setConfiguration(JournalGASId gas, optixu::ASTradeoff tradeoff,
+                                        bool allowUpdate, bool allowCompaction, bool allowRandomVertexAccess) {
+        beginRecord(Opcode_SetGASConfiguration);
+        put(gas.value);
+        put(static_cast<uint32_t>(tradeoff));
+        put(static_cast<uint8_t>(allowUpdate));
+        put(static_cast<uint8_t>(allowCompaction));
+        put(static_cast<uint8_t>(allowRandomVertexAccess));
+        endRecord();
+    }
+
+    void SceneJournal::setMotionOptions(JournalGASId gas, uint32_t numKeys, float timeBegin, float timeEnd,
+                                        OptixMotionFlags flags) {
+        beginRecord(Opcode_SetGASMotionOptions);
+        put(gas.value);
+        put(numKeys);
+        put(timeBegin);
+        put(timeEnd);
+        put(static_cast<uint32_t>(flags));
+        endRecord();
+    }
+
+    void SceneJournal::setNumMaterialSets(JournalGASId gas, uint32_t numMatSets) {
+        beginRecord(Opcode_SetNumMaterialSets);
+        put(gas.value);
+        put(numMatSets);
+        endRecord();
+    }
+
+    void SceneJournal::setNumRayTypes(JournalGASId gas, uint32_t matSetIdx, uint32_t numRayTypes) {
+        beginRecord(Opcode_SetNumRayTypes);
+        put(gas.value);
+        put(matSetIdx);
+        put(numRayTypes);
+        endRecord();
+    }
+
+    void SceneJournal::addChild(JournalGASId gas, JournalGeomInstId geomInst, JournalBufferId preTransform,
+                                const void* data, uint32_t size, uint32_t alignment) {
+        beginRecord(Opcode_AddGASChild);
+        put(gas.value);
+        put(geomInst.value);
+        put(preTransform.value);
+        putUserData(data, size, alignment);
+        endRecord();
+    }
+
+    void SceneJournal::removeChildAt(JournalGASId gas, uint32_t index) {
+        beginRecord(Opcode_RemoveGASChildAt);
+        put(gas.value);
+        put(index);
+        endRecord();
+    }
+
+    void SceneJournal::clearChildren(JournalGASId gas) {
+        beginRecord(Opcode_ClearGASChildren);
+        put(gas.value);
+        endRecord();
+    }
+
+    void SceneJournal::setChildUserData(JournalGASId gas, uint32_t index,
+                                        const void* data, uint32_t size, uint32_t alignment) {
+        beginRecord(Opcode_SetGASChildUserData);
+        put(gas.value);
+        put(index);
+        putUserData(data, size, alignment);
+        endRecord();
+    }
+
+    void SceneJournal::setUserData(JournalGASId gas, const void* data, uint32_t size, uint32_t alignment) {
+        beginRecord(Opcode_SetGASUserData);
+        put(gas.value);
+        putUserData(data, size, alignment);
+        endRecord();
+    }
+
+    void SceneJournal::markDirty(JournalGASId gas) {
+        beginRecord(Opcode_MarkGASDirty);
+        put(gas.value);
+        endRecord();
+    }
+
+    void SceneJournal::destroy(JournalGASId gas) {
+        beginRecord(Opcode_DestroyGAS);
+        put(gas.value);
+        endRecord();
+    }
+
+
+
+    JournalTransformId SceneJournal::createTransform() {
+        beginRecord(Opcode_CreateTransform);
+        put(getNextId<JournalObjectType::Transform>().value);
+        endRecord();
+        return commitId<JournalObjectType::Transform>();
+    }
+
+    void SceneJournal::setConfiguration(JournalTransformId transform, optixu::TransformType type, uint32_t numKeys) {
+        beginRecord(Opcode_SetTransformConfiguration);
+        put(transform.value);
+        put(static_cast<uint32_t>(type));
+        put(numKeys);
+        endRecord();
+    }
+
+    void SceneJournal::setMotionOptions(JournalTransformId transform, float timeBegin, float timeEnd,
+                                        OptixMotionFlags flags) {
+        beginRecord(Opcode_SetTransformMotionOptions);
+        put(transform.value);
+        put(timeBegin);
+        put(timeEnd);
+        put(static_cast<uint32_t>(flags));
+        endRecord();
+    }
+
+    void SceneJournal::setMatrixMotionKey(JournalTransformId transform, uint32_t keyIdx, const float matrix[12]) {
+        beginRecord(Opcode_SetMatrixMotionKey);
+        put(transform.value);
+        put(keyIdx);
+        putBytes(matrix, sizeof(float) * 12);
+        endRecord();
+    }
+
+    void SceneJournal::setSRTMotionKey(JournalTransformId transform, uint32_t keyIdx,
+                                       const float scale[3], const float orientation[4], const float translation[3]) {
+        beginRecord(Opcode_SetSRTMotionKey);
+        put(transform.value);
+        put(keyIdx);
+        putBytes(scale, sizeof(float) * 3);
+        putBytes(orientation, sizeof(float) * 4);
+        putBytes(translation, sizeof(float) * 3);
+        endRecord();
+    }
+
+    void SceneJournal::setStaticTransform(JournalTransformId transform, const float matrix[12]) {
+        beginRecord(Opcode_SetStaticTransform);
+        put(transform.value);
+        putBytes(matrix, sizeof(float) * 12);
+        endRecord();
+    }
+
+    void SceneJournal::setChild(JournalTransformId transform, JournalGASId child) {
+        beginRecord(Opcode_SetTransformChild);
+        put(transform.value);
+        put(static_cast<uint8_t>(optixu::ChildType::GAS));
+        put(child.value);
+        endRecord();
+    }
+
+    void SceneJournal::setChild(JournalTransformId transform, JournalIASId child) {
+        beginRecord(Opcode_SetTransformChild);
+        put(transform.value);
+        put(static_cast<uint8_t>(optixu::ChildType::IAS));
+        put(child.value);
+        endRecord();
+    }
+
+    void SceneJournal::setChild(JournalTransformId transform, JournalTransformId child) {
+        beginRecord(Opcode_SetTransformChild);
+        put(transform.value);
+        put(static_cast<uint8_t>(optixu::ChildType::Transform));
+        put(child.value);
+        endRecord();
+    }
+
+    void SceneJournal::markDirty(JournalTransformId transform) {
+        beginRecord(Opcode_MarkTransformDirty);
+        put(transform.value);
+        endRecord();
+    }
+
+    void SceneJournal::destroy(JournalTransformId transform) {
+        beginRecord(Opcode_DestroyTransform);
+        put(transform.value);
+        endRecord();
+    }
+
+
+
+    JournalInstanceId SceneJournal::createInstance() {
+        beginRecord(Opcode_CreateInstance);
+        put(getNextId<JournalObjectType::Instance>().value);
+        endRecord();
+        return commitId<JournalObjectType::Instance>();
+    }
+
+    void SceneJournal::setChild(JournalInstanceId inst, JournalGASId child, uint32_t matSetIdx) {
+        beginRecord(Opcode_SetInstanceChild);
+        put(inst.value);
+        put(static_cast<uint8_t>(optixu::ChildType::GAS));
+        put(child.value);
+        put(matSetIdx);
+        endRecord();
+    }
+
+    void SceneJournal::setChild(JournalInstanceId inst, JournalIASId child) {
+        beginRecord(Opcode_SetInstanceChild);
+        put(inst.value);
+        put(static_cast<uint8_t>(optixu::ChildType::IAS));
+        put(child.value);
+        put(0u);
+        endRecord();
+    }
+
+    void SceneJournal::setChild(JournalInstanceId inst, JournalTransformId child, uint32_t matSetIdx) {
+        beginRecord(Opcode_SetInstanceChild);
+        put(inst.value);
+        put(static_cast<uint8_t>(optixu::ChildType::Transform));
+        put(child.value);
+        put(matSetIdx);
+        endRecord();
+    }
+
+    void SceneJournal::setID(JournalInstanceId inst, uint32_t value) {
+        beginRecord(Opcode_SetInstanceID);
+        put(inst.value);
+        put(value);
+        endRecord();
+    }
+
+    void SceneJournal::setVisibilityMask(JournalInstanceId inst, uint32_t mask) {
+        beginRecord(Opcode_SetVisibilityMask);
+        put(inst.value);
+        put(mask);
+        endRecord();
+    }
+
+    void SceneJournal::setFlags(JournalInstanceId inst, OptixInstanceFlags flags) {
+        beginRecord(Opcode_SetInstanceFlags);
+        put(inst.value);
+        put(static_cast<uint32_t>(flags));
+        endRecord();
+    }
+
+    void SceneJournal::setTransform(JournalInstanceId inst, const float transform[12]) {
+        beginRecord(Opcode_SetInstanceTransform);
+        put(inst.value);
+        putBytes(transform, sizeof(float) * 12);
+        endRecord();
+    }
+
+    void SceneJournal::destroy(JournalInstanceId inst) {
+        beginRecord(Opcode_DestroyInstance);
+        put(inst.value);
+        endRecord();
+    }
+
+
+
+    JournalIASId SceneJournal::createIAS() {
+        beginRecord(Opcode_CreateIAS);
+        put(getNextId<JournalObjectType::IAS>().value);
+        endRecord();
+        return commitId<JournalObjectType::IAS>();
+    }
+
+    void SceneJournal::setConfiguration(JournalIASId ias, optixu::ASTradeoff tradeoff,
+                                        bool allowUpdate, bool allowCompaction) {
+        beginRecord(Opcode_SetIASConfiguration);
+        put(ias.value);
+        put(static_cast<uint32_t>(tradeoff));
+        put(static_cast<uint8_t>(allowUpdate));
+        put(static_cast<uint8_t>(allowCompaction));
+        endRecord();
+    }
+
+    void SceneJournal::setMotionOptions(JournalIASId ias, uint32_t numKeys, float timeBegin, float timeEnd,
+                                        OptixMotionFlags flags) {
+        beginRecord(Opcode_SetIASMotionOptions);
+        put(ias.value);
+        put(numKeys);
+        put(timeBegin);
+        put(timeEnd);
+        put(static_cast<uint32_t>(flags));
+        endRecord();
+    }
+
+    void SceneJournal::addChild(JournalIASId ias, JournalInstanceId inst) {
+        beginRecord(Opcode_AddIASChild);
+        put(ias.value);
+        put(inst.value);
+        endRecord();
+    }
+
+    void SceneJournal::removeChildAt(JournalIASId ias, uint32_t index) {
+        beginRecord(Opcode_RemoveIASChildAt);
+        put(ias.value);
+        put(index);
+        endRecord();
+    }
+
+    void SceneJournal::clearChildren(JournalIASId ias) {
+        beginRecord(Opcode_ClearIASChildren);
+        put(ias.value);
+        endRecord();
+    }
+
+    void SceneJournal::markDirty(JournalIASId ias) {
+        beginRecord(Opcode_MarkIASDirty);
+        put(ias.value);
+        endRecord();
+    }
+
+    void SceneJournal::destroy(JournalIASId ias) {
+        beginRecord(Opcode_DestroyIAS);
+        put(ias.value);
+        endRecord();
+    }
+}
@@ -0,0 +1,351 @@
+﻿#pragma once
+
+#include "scene_snapshot.h"
+
+// JP: シーンへの変更(オブジェクトの生成と破棄、セッター、バッファーの範囲書き込み)を小さなバイナリーレコードとして
+//     記録し、別のContext上で再生して同じ状態を再現するためのジャーナル。
+//     対話的なシーンを複数のレンダーノードにミラーする分散レンダリングで、編集ごとにシーン全体を送る代わりに
+//     差分だけを送ることができる。
+//     ローカル側もジャーナルが生成したレコードを同じSceneMirrorで適用するので、両者の状態は同じコードパスで作られる。
+//     ジャーナル開始以前のシーンは対象外なので、途中から参加するノードにはSceneSnapshotなどで初期状態を送る。
+//
+//     // 送信側
+//     asset::SceneMirror localMirror;
+//     localMirror.initialize(cuContext, scene, lookupMaterial, &scheduler);
+//     asset::SceneJournal journal;
+//     journal.initialize(&localMirror);
+//     asset::JournalBufferId vb = journal.createBuffer(numVertices, sizeof(Vertex));
+//     journal.writeBuffer(vb, 0, vertices, numVertices * sizeof(Vertex), stream);
+//     asset::JournalGASId gas = journal.createGAS(optixu::GeometryType::Triangles);
+//     ...
+//     localMirror.build(stream, &buildResult);
+//     std::vector<uint8_t> packet;
+//     journal.flush(&packet);
+//     sendToNodes(packet);
+//
+//     // 受信側
+//     asset::SceneMirror mirror;
+//     mirror.initialize(cuContext, scene, lookupMaterial, &scheduler);
+//     mirror.replay(packet.data(), packet.size(), stream);
+//     mirror.build(stream, &buildResult);
+//     plp.travHandle = mirror.getHandle(rootIAS);
+//
+// EN: Journal recording changes to a scene (creation and destruction of objects, setters and range writes to buffers)
+//     as compact binary records, which can be replayed on another context to reproduce the same state.
+//     In distributed rendering mirroring an interactive scene onto multiple render nodes, this allows sending only
+//     deltas instead of the whole scene per edit.
+//     The local side also applies the records generated by the journal with the same SceneMirror,
+//     so the states of both sides are made by the same code path.
+//     The scene before the journal starts is not covered, so send the initial state to late-joining nodes
+//     by e.g. SceneSnapshot.
+//
+//     // Sending side
+//     asset::SceneMirror localMirror;
+//     localMirror.initialize(cuContext, scene, lookupMaterial, &scheduler);
+//     asset::SceneJournal journal;
+//     journal.initialize(&localMirror);
+//     asset::JournalBufferId vb = journal.createBuffer(numVertices, sizeof(Vertex));
+//     journal.writeBuffer(vb, 0, vertices, numVertices * sizeof(Vertex), stream);
+//     asset::JournalGASId gas = journal.createGAS(optixu::GeometryType::Triangles);
+//     ...
+//     localMirror.build(stream, &buildResult);
+//     std::vector<uint8_t> packet;
+//     journal.flush(&packet);
+//     sendToNodes(packet);
+//
+//     // Receiving side
+//     asset::SceneMirror mirror;
+//     mirror.initialize(cuContext, scene, lookupMaterial, &scheduler);
+//     mirror.replay(packet.data(), packet.size(), stream);
+//     mirror.build(stream, &buildResult);
+//     plp.travHandle = mirror.getHandle(rootIAS);
+namespace asset {
+    enum class JournalObjectType : uint8_t {
+        Buffer = 0,
+        GeometryInstance,
+        GAS,
+        Transform,
+        Instance,
+        IAS,
+        NumTypes
+    };
+
+    // JP: ジャーナル中のオブジェクトの識別子。送信側と受信側で共通で、破棄されたIDは再利用されない。
+    // EN: Identifier of an object in a journal. Common between the sending and receiving sides,
+    //     and IDs of destroyed objects are not reused.
+    template <JournalObjectType type>
+    struct JournalId {
+        static constexpr uint32_t invalidValue = 0xFFFFFFFF;
+        uint32_t value;
+
+        JournalId() : value(invalidValue) {}
+        explicit JournalId(uint32_t _value) : value(_value) {}
+
+        bool isValid() const {
+            return value != invalidValue;
+        }
+    };
+    using JournalBufferId = JournalId<JournalObjectType::Buffer>;
+    using JournalGeomInstId = JournalId<JournalObjectType::GeometryInstance>;
+    using JournalGASId = JournalId<JournalObjectType::GAS>;
+    using JournalTransformId = JournalId<JournalObjectType::Transform>;
+    using JournalInstanceId = JournalId<JournalObjectType::Instance>;
+    using JournalIASId = JournalId<JournalObjectType::IAS>;
+
+    struct SceneMirrorBuildResult {
+        uint32_t numBuiltGASs;
+        uint32_t numBuiltTransforms;
+        uint32_t numBuiltIASs;
+        // JP: 真の場合はヒットグループのSBTをhitGroupSbtSize以上で確保し直してPipeline::setScene()などを呼ぶ。
+        // EN: When true, reallocate the hit group SBT with at least hitGroupSbtSize and call Pipeline::setScene() etc.
+        bool sbtLayoutRegenerated;
+        size_t hitGroupSbtSize;
+    };
+
+    // JP: ジャーナルのレコードを適用してシーンのオブジェクトとそのデバイスメモリーを保持する。
+    //     GASのメモリーはGASBuildSchedulerから、Transform, IASのメモリーはこのクラスが確保する。
+    // EN: Apply records of a journal and hold scene objects and their device memory.
+    //     Memory for GASs is allocated from GASBuildScheduler, and memory for transforms and IASs by this class.
+    class SceneMirror {
+        struct Reference {
+            optixu::ChildType type;
+            uint32_t id;
+        };
+        struct GeometryAS {
+            optixu::GeometryAccelerationStructure gas;
+        };
+        struct TransformNode {
+            optixu::Transform transform;
+            cudau::Buffer buffer;
+            size_t size;
+            Reference child;
+        };
+        struct InstanceNode {
+            optixu::Instance inst;
+            Reference child;
+        };
+        struct InstanceAS {
+            optixu::InstanceAccelerationStructure ias;
+            cudau::TypedBuffer<OptixInstance> instanceBuffer;
+            cudau::Buffer accelBuffer;
+            std::vector<uint32_t> children;
+        };
+
+        CUcontext m_cuContext;
+        optixu::Scene m_scene;
+        MaterialLookup m_lookupMaterial;
+        optixu::GASBuildScheduler* m_scheduler;
+        std::vector<cudau::Buffer> m_buffers;
+        std::vector<optixu::GeometryInstance> m_geomInsts;
+        std::vector<GeometryAS> m_geomASs;
+        std::vector<TransformNode> m_transforms;
+        std::vector<InstanceNode> m_instances;
+        std::vector<InstanceAS> m_instASs;
+        std::vector<optixu::GeometryAccelerationStructure> m_pendingGASReleases;
+        std::vector<cudau::Buffer> m_pendingBufferReleases;
+        cudau::Buffer m_scratchBuffer;
+        uint64_t m_nextSequence;
+
+        SceneMirror(const SceneMirror &) = delete;
+        SceneMirror &operator=(const SceneMirror &) = delete;
+
+        optixu::BufferView getBuffer(uint32_t id) const;
+        optixu::GeometryInstance getGeometryInstance(uint32_t id) const;
+        const GeometryAS &getGeometryAS(uint32_t id) const;
+        TransformNode &getTransformNode(uint32_t id);
+        InstanceNode &getInstanceNode(uint32_t id);
+        InstanceAS &getInstanceAS(uint32_t id);
+        void checkReference(const Reference &ref);
+        bool buildNode(CUstream stream, const Reference &ref, std::vector<uint8_t>* visited,
+                       SceneMirrorBuildResult* result);
+
+    public:
+        SceneMirror() : m_cuContext(nullptr), m_scheduler(nullptr), m_nextSequence(0) {}
+        ~SceneMirror() {
+            finalize();
+        }
+
+        void initialize(CUcontext cuContext, optixu::Scene scene, const MaterialLookup &lookupMaterial,
+                        optixu::GASBuildScheduler* scheduler);
+        // JP: GPUがシーンを使い終わってから呼ぶ。
+        // EN: Call this after the GPU finishes using the scene.
+        void finalize();
+
+        // JP: ヘッダーを含まないレコードの並びを適用する。SceneJournalが内部で使う。
+        // EN: Apply a sequence of records without a header. SceneJournal uses this internally.
+        void apply(const uint8_t* records, size_t size, CUstream stream);
+        // JP: SceneJournal::flush()で作られたパケットを適用する。
+        //     パケットは生成順に一つずつ適用する必要があり、抜けや重複があると例外を投げる。
+        // EN: Apply a packet made by SceneJournal::flush().
+        //     Packets need to be applied one by one in the generated order, and a gap or duplicate throws an exception.
+        void replay(const uint8_t* packet, size_t size, CUstream stream);
+
+        // JP: 必要に応じてSBTレイアウトを生成し、dirtyなGASをスケジューラーでまとめてビルドしてから、
+        //     dirtyか子がビルドされたTransform, IASを子が先に来る順でビルドする。
+        //     解放やリサイズを伴うので、先行するフレームのGPUの処理を待ってから実行する。
+        // EN: Generate the SBT layout if needed, build dirty GASs together with the scheduler, then build
+        //     transforms and IASs that are dirty or whose children were built, in the order children come first.
+        //     This involves releases and resizes, so it is executed after waiting for GPU work of preceding frames.
+        void build(CUstream stream, SceneMirrorBuildResult* result);
+
+        const cudau::Buffer &getBuffer(JournalBufferId id) const {
+            return m_buffers.at(id.value);
+        }
+        optixu::GeometryInstance getGeometryInstance(JournalGeomInstId id) const {
+            return getGeometryInstance(id.value);
+        }
+        optixu::GeometryAccelerationStructure getGAS(JournalGASId id) const {
+            return getGeometryAS(id.value).gas;
+        }
+        optixu::Transform getTransform(JournalTransformId id) const {
+            return m_transforms.at(id.value).transform;
+        }
+        optixu::Instance getInstance(JournalInstanceId id) const {
+            return m_instances.at(id.value).inst;
+        }
+        optixu::InstanceAccelerationStructure getIAS(JournalIASId id) const {
+            return m_instASs.at(id.value).ias;
+        }
+        OptixTraversableHandle getHandle(JournalGASId id) const {
+            return getGAS(id).getHandle();
+        }
+        OptixTraversableHandle getHandle(JournalTransformId id) const {
+            return getTransform(id).getHandle();
+        }
+        OptixTraversableHandle getHandle(JournalIASId id) const {
+            return getIAS(id).getHandle();
+        }
+    };
+
+    // JP: シーンへの変更を記録しつつローカルのSceneMirrorに適用する。
+    //     領域外の引数などは適用時にoptixuが例外を投げ、そのレコードは記録されない。
+    // EN: Record changes to a scene while applying them to the local SceneMirror.
+    //     optixu throws an exception at application for out-of-range arguments and so on,
+    //     and such a record is not recorded.
+    class SceneJournal {
+        SceneMirror* m_mirror;
+        std::vector<uint8_t> m_records;
+        size_t m_recordBegin;
+        uint32_t m_numRecords;
+        uint32_t m_nextIds[static_cast<uint32_t>(JournalObjectType::NumTypes)];
+        uint64_t m_nextSequence;
+        uint64_t m_numFlushedBytes;
+
+        void beginRecord(uint8_t opcode);
+        void endRecord(CUstream stream = 0);
+        void putBytes(const void* data, size_t size);
+        template <typename T>
+        void put(const T &value) {
+            static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable.");
+            putBytes(&value, sizeof(T));
+        }
+        void putString(const std::string &str);
+        void putUserData(const void* data, uint32_t size, uint32_t alignment);
+        template <JournalObjectType type>
+        JournalId<type> getNextId() const {
+            return JournalId<type>(m_nextIds[static_cast<uint32_t>(type)]);
+        }
+        template <JournalObjectType type>
+        JournalId<type> commitId() {
+            return JournalId<type>(m_nextIds[static_cast<uint32_t>(type)]++);
+        }
+
+    public:
+        SceneJournal() : m_mirror(nullptr), m_recordBegin(0), m_numRecords(0), m_nextSequence(0),
+            m_numFlushedBytes(0) {}
+
+        void initialize(SceneMirror* localMirror);
+
+        JournalBufferId createBuffer(uint32_t numElements, uint32_t stride);
+        // JP: ジオメトリのバッファーを書き換えた場合は、それを使うGASのmarkDirty()も記録する。
+        // EN: When rewriting a geometry buffer, record markDirty() of GASs using it as well.
+        void writeBuffer(JournalBufferId buffer, size_t offsetInBytes, const void* data, size_t sizeInBytes,
+                         CUstream stream);
+        void destroy(JournalBufferId buffer);
+
+        JournalGeomInstId createGeometryInstance(optixu::GeometryType geomType);
+        void setNumMotionSteps(JournalGeomInstId geomInst, uint32_t n);
+        void setVertexFormat(JournalGeomInstId geomInst, OptixVertexFormat format);
+        void setVertexBuffer(JournalGeomInstId geomInst, JournalBufferId buffer, uint32_t motionStep = 0);
+        void setWidthBuffer(JournalGeomInstId geomInst, JournalBufferId buffer, uint32_t motionStep = 0);
+        void setTriangleBuffer(JournalGeomInstId geomInst, JournalBufferId buffer,
+                               OptixIndicesFormat format = OPTIX_INDICES_FORMAT_UNSIGNED_INT3);
+        void setSegmentIndexBuffer(JournalGeomInstId geomInst, JournalBufferId buffer);
+        void setCustomPrimitiveAABBBuffer(JournalGeomInstId geomInst, JournalBufferId buffer,
+                                          uint32_t motionStep = 0);
+        void setPrimitiveIndexOffset(JournalGeomInstId geomInst, uint32_t offset);
+        void setNumMaterials(JournalGeomInstId geomInst, uint32_t numMaterials,
+                             JournalBufferId matIndexBuffer = JournalBufferId(),
+                             uint32_t indexSize = sizeof(uint32_t));
+        void setGeometryFlags(JournalGeomInstId geomInst, uint32_t matIdx, OptixGeometryFlags flags);
+        // JP: マテリアルは名前で指定し、各側のMaterialLookupで解決される。
+        // EN: A material is specified by name and resolved by MaterialLookup of each side.
+        void setMaterial(JournalGeomInstId geomInst, uint32_t matSetIdx, uint32_t matIdx,
+                         const std::string &materialName);
+        void setUserData(JournalGeomInstId geomInst, const void* data, uint32_t size, uint32_t alignment);
+        void destroy(JournalGeomInstId geomInst);
+
+        JournalGASId createGAS(optixu::GeometryType geomType);
+        void setConfiguration(JournalGASId gas, optixu::ASTradeoff tradeoff,
+                              bool allowUpdate, bool allowCompaction, bool allowRandomVertexAccess);
+        void setMotionOptions(JournalGASId gas, uint32_t numKeys, float timeBegin, float timeEnd,
+                              OptixMotionFlags flags);
+        void setNumMaterialSets(JournalGASId gas, uint32_t numMatSets);
+        void setNumRayTypes(JournalGASId gas, uint32_t matSetIdx, uint32_t numRayTypes);
+        void addChild(JournalGASId gas, JournalGeomInstId geomInst,
+                      JournalBufferId preTransform = JournalBufferId(),
+                      const void* data = nullptr, uint32_t size = 0, uint32_t alignment = 1);
+        void removeChildAt(JournalGASId gas, uint32_t index);
+        void clearChildren(JournalGASId gas);
+        void setChildUserData(JournalGASId gas, uint32_t index, const void* data, uint32_t size, uint32_t alignment);
+        void setUserData(JournalGASId gas, const void* data, uint32_t size, uint32_t alignment);
+        void markDirty(JournalGASId gas);
+        void destroy(JournalGASId gas);
+
+        JournalTransformId createTransform();
+        void setConfiguration(JournalTransformId transform, optixu::TransformType type, uint32_t numKeys);
+        void setMotionOptions(JournalTransformId transform, float timeBegin, float timeEnd, OptixMotionFlags flags);
+        void setMatrixMotionKey(JournalTransformId transform, uint32_t keyIdx, const float matrix[12]);
+        void setSRTMotionKey(JournalTransformId transform, uint32_t keyIdx,
+                             const float scale[3], const float orientation[4], const float translation[3]);
+        void setStaticTransform(JournalTransformId transform, const float matrix[12]);
+        void setChild(JournalTransformId transform, JournalGASId child);
+        void setChild(JournalTransformId transform, JournalIASId child);
+        void setChild(JournalTransformId transform, JournalTransformId child);
+        void markDirty(JournalTransformId transform);
+        void destroy(JournalTransformId transform);
+
+        JournalInstanceId createInstance();
+        void setChild(JournalInstanceId inst, JournalGASId child, uint32_t matSetIdx = 0);
+        void setChild(JournalInstanceId inst, JournalIASId child);
+        void setChild(JournalInstanceId inst, JournalTransformId child, uint32_t matSetIdx = 0);
+        void setID(JournalInstanceId inst, uint32_t value);
+        void setVisibilityMask(JournalInstanceId inst, uint32_t mask);
+        void setFlags(JournalInstanceId inst, OptixInstanceFlags flags);
+        void setTransform(JournalInstanceId inst, const float transform[12]);
+        void destroy(JournalInstanceId inst);
+
+        JournalIASId createIAS();
+        void setConfiguration(JournalIASId ias, optixu::ASTradeoff tradeoff, bool allowUpdate, bool allowCompaction);
+        void setMotionOptions(JournalIASId ias, uint32_t numKeys, float timeBegin, float timeEnd,
+                              OptixMotionFlags flags);
+        void addChild(JournalIASId ias, JournalInstanceId inst);
+        void removeChildAt(JournalIASId ias, uint32_t index);
+        void clearChildren(JournalIASId ias);
+        void markDirty(JournalIASId ias);
+        void destroy(JournalIASId ias);
+
+        bool hasPendingRecords() const {
+            return m_numRecords > 0;
+        }
+        // JP: 保留中のレコードをヘッダー付きのパケットとして書き出して保留を空にする。
+        //     レコードが無い場合はpacketを空にし、シーケンス番号を進めない。
+        // EN: Write pending records as a packet with a header and clear the pending records.
+        //     When there are no records, make packet empty without advancing the sequence number.
+        void flush(std::vector<uint8_t>* packet);
+
+        uint64_t getNumFlushedBytes() const {
+            return m_numFlushedBytes;
+        }
+    };
+}
@@ -0,0 +1,960 @@
+﻿#include "scene_snapshot.h"
+
+namespace asset {
+    namespace {
+        constexpr char snapshotMagic[8] = { 'O', 'P', 'T', 'X', 'S', 'N', 'A', 'P' };
+        constexpr uint32_t snapshotVersion = 1;
+        constexpr uint32_t invalidIndex = 0xFFFFFFFF;
+
+        enum SnapshotFlag : uint32_t {
+            SnapshotFlag_EmbeddedAS = 1 << 0,
+        };
+
+        struct SnapshotHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t flags;
+            uint64_t bodySize;
+            uint32_t numBuffers;
+            uint32_t numGeomInsts;
+            uint32_t numGeomASs;
+            uint32_t numTransforms;
+            uint32_t numInstances;
+            uint32_t numInstASs;
+            uint32_t numBuildOrderEntries;
+            uint32_t numRoots;
+        };
+
+        class ByteWriter {
+            std::vector<uint8_t> m_data;
+
+        public:
+            void putBytes(const void* data, size_t size) {
+                auto bytes = reinterpret_cast<const uint8_t*>(data);
+                m_data.insert(m_data.end(), bytes, bytes + size);
+            }
+            template <typename T>
+            void put(const T &value) {
+                static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable.");
+                putBytes(&value, sizeof(T));
+            }
+            void putString(const char* str) {
+                uint32_t length = static_cast<uint32_t>(std::strlen(str));
+                put(length);
+                putBytes(str, length);
+            }
+            void putUserData(const std::vector<uint8_t> &data, uint32_t alignment) {
+                put(static_cast<uint32_t>(data.size()));
+                put(alignment);
+                putBytes(data.data(), data.size());
+            }
+
+            const std::vector<uint8_t> &getData() const {
+                return m_data;
+            }
+        };
+
+        class ByteReader {
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_offset;
+
+            void require(size_t size) const {
+                if (m_offset + size > m_size)
+                    throw std::runtime_error("Scene snapshot is truncated.");
+            }
+
+        public:
+            ByteReader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_offset(0) {}
+
+            const uint8_t* getBytes(size_t size) {
+                require(size);
+                const uint8_t* ret = m_data + m_offset;
+                m_offset += size;
+                return ret;
+            }
+            template <typename T>
+            T get() {
+                static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable.");
+                T value;
+                std::memcpy(&value, getBytes(sizeof(T)), sizeof(T));
+                return value;
+            }
+            std::string getString() {
+                uint32_t length = get<uint32_t>();
+                auto chars = reinterpret_cast<const char*>(getBytes(length));
+                return std::string(chars, length);
+            }
+            const uint8_t* getUserData(uint32_t* size, uint32_t* alignment) {
+                *size = get<uint32_t>();
+                *alignment = get<uint32_t>();
+                return getBytes(*size);
+            }
+            size_t tell() const {
+                return m_offset;
+            }
+        };
+
+        struct BufferKey {
+            CUdeviceptr address;
+            size_t numElements;
+            uint32_t stride;
+
+            bool operator<(const BufferKey &r) const {
+                if (address != r.address)
+                    return address < r.address;
+                if (numElements != r.numElements)
+                    return numElements < r.numElements;
+                return stride < r.stride;
+            }
+        };
+
+        // JP: ルートから子へ辿り、子が先に来る順(ビルド可能な順)でオブジェクトに番号を振る。
+        // EN: Traverse from roots to children and number objects in the order children come first
+        //     (buildable order).
+        struct GraphCollector {
+            std::map<BufferKey, uint32_t> bufferIndices;
+            std::vector<optixu::BufferView> buffers;
+            std::map<optixu::GeometryInstance, uint32_t> geomInstIndices;
+            std::vector<optixu::GeometryInstance> geomInsts;
+            std::map<optixu::GeometryAccelerationStructure, uint32_t> geomASIndices;
+            std::vector<optixu::GeometryAccelerationStructure> geomASs;
+            std::map<optixu::Transform, uint32_t> transformIndices;
+            std::vector<optixu::Transform> transforms;
+            std::map<optixu::Instance, uint32_t> instanceIndices;
+            std::vector<optixu::Instance> instances;
+            std::map<optixu::InstanceAccelerationStructure, uint32_t> instASIndices;
+            std::vector<optixu::InstanceAccelerationStructure> instASs;
+            std::vector<std::pair<optixu::ChildType, uint32_t>> buildOrder;
+
+            uint32_t addBuffer(const optixu::BufferView &buffer) {
+                if (!buffer.isValid())
+                    return invalidIndex;
+                BufferKey key{ buffer.getCUdeviceptr(), buffer.numElements(), buffer.stride() };
+                auto it = bufferIndices.find(key);
+                if (it != bufferIndices.cend())
+                    return it->second;
+                uint32_t index = static_cast<uint32_t>(buffers.size());
+                bufferIndices[key] = index;
+                buffers.push_back(buffer);
+                return index;
+            }
+
+            uint32_t visit(optixu::GeometryInstance geomInst) {
+                auto it = geomInstIndices.find(geomInst);
+                if (it != geomInstIndices.cend())
+                    return it->second;
+                uint32_t index = static_cast<uint32_t>(geomInsts.size());
+                geomInstIndices[geomInst] = index;
+                geomInsts.push_back(geomInst);
+                return index;
+            }
+
+            uint32_t visit(optixu::GeometryAccelerationStructure gas) {
+                auto it = geomASIndices.find(gas);
+                if (it != geomASIndices.cend())
+                    return it->second;
+                for (uint32_t childIdx = 0; childIdx < gas.getNumChildren(); ++childIdx)
+                    visit(gas.getChild(childIdx));
+                uint32_t index = static_cast<uint32_t>(geomASs.size());
+                geomASIndices[gas] = index;
+                geomASs.push_back(gas);
+                buildOrder.emplace_back(optixu::ChildType::GAS, index);
+                return index;
+            }
+
+            uint32_t visitChild(optixu::ChildType type, optixu::GeometryAccelerationStructure gas,
+                                optixu::InstanceAccelerationStructure ias, optixu::Transform transform) {
+                if (type == optixu::ChildType::GAS)
+                    return visit(gas);
+                else if (type == optixu::ChildType::IAS)
+                    return visit(ias);
+                else if (type == optixu::ChildType::Transform)
+                    return visit(transform);
+                throw std::runtime_error("Invalid child type.");
+            }
+
+            uint32_t visit(optixu::Transform transform) {
+                auto it = transformIndices.find(transform);
+                if (it != transformIndices.cend())
+                    return it->second;
+                optixu::ChildType childType = transform.getChildType();
+                visitChild(childType,
+                           childType == optixu::ChildType::GAS ?
+                           transform.getChild<optixu::GeometryAccelerationStructure>() :
+                           optixu::GeometryAccelerationStructure(),
+                           childType == optixu::ChildType::IAS ?
+                           transform.getChild<optixu::InstanceAccelerationStructure>() :
+                           optixu::InstanceAccelerationStructure(),
+                           childType == optixu::ChildType::Transform ?
+                           transform.getChild<optixu::Transform>() :
+                           optixu::Transform());
+                uint32_t index = static_cast<uint32_t>(transforms.size());
+                transformIndices[transform] = index;
+                transforms.push_back(transform);
+                buildOrder.emplace_back(optixu::ChildType::Transform, index);
+                return index;
+            }
+
+            uint32_t visit(optixu::Instance inst) {
+                auto it = instanceIndices.find(inst);
+                if (it != instanceIndices.cend())
+                    return it->second;
+                optixu::ChildType childType = inst.getChildType();
+                visitChild(childType,
+                           childType == optixu::ChildType::GAS ?
+                           inst.getChild<optixu::GeometryAccelerationStructure>() :
+                           optixu::GeometryAccelerationStructure(),
+                           childType == optixu::ChildType::IAS ?
+                           inst.getChild<optixu::InstanceAccelerationStructure>() :
+                           optixu::InstanceAccelerationStructure(),
+                           childType == optixu::ChildType::Transform ?
+                           inst.getChild<optixu::Transform>() :
+                           optixu::Transform());
+                uint32_t index = static_cast<uint32_t>(instances.size());
+                instanceIndices[inst] = index;
+                instances.push_back(inst);
+                return index;
+            }
+
+            uint32_t visit(optixu::InstanceAccelerationStructure ias) {
+                auto it = instASIndices.find(ias);
+                if (it != instASIndices.cend())
+                    return it->second;
+                for (uint32_t childIdx = 0; childIdx < ias.getNumChildren(); ++childIdx)
+                    visit(ias.getChild(childIdx));
+                uint32_t index = static_cast<uint32_t>(instASs.size());
+                instASIndices[ias] = index;
+                instASs.push_back(ias);
+                buildOrder.emplace_back(optixu::ChildType::IAS, index);
+                return index;
+            }
+
+            uint32_t getChildIndex(optixu::ChildType type, optixu::GeometryAccelerationStructure gas,
+                                   optixu::InstanceAccelerationStructure ias, optixu::Transform transform) const {
+                if (type == optixu::ChildType::GAS)
+                    return geomASIndices.at(gas);
+                else if (type == optixu::ChildType::IAS)
+                    return instASIndices.at(ias);
+                else
+                    return transformIndices.at(transform);
+            }
+        };
+
+        const char* getMaterialName(optixu::Material mat) {
+            return mat ? mat.getName() : "";
+        }
+
+        void putMotionOptions(ByteWriter &writer, uint32_t numKeys, float timeBegin, float timeEnd,
+                              OptixMotionFlags flags) {
+            writer.put(numKeys);
+            writer.put(timeBegin);
+            writer.put(timeEnd);
+            writer.put(static_cast<uint32_t>(flags));
+        }
+
+        void getMotionOptions(ByteReader &reader, uint32_t* numKeys, float* timeBegin, float* timeEnd,
+                              OptixMotionFlags* flags) {
+            *numKeys = reader.get<uint32_t>();
+            *timeBegin = reader.get<float>();
+            *timeEnd = reader.get<float>();
+            *flags = static_cast<OptixMotionFlags>(reader.get<uint32_t>());
+        }
+    }
+
+
+
+    void SceneSnapshotWriter::addRoot(optixu::GeometryAccelerationStructure gas) {
+        Root root = {};
+        root.type = optixu::ChildType::GAS;
+        root.gas = gas;
+        m_roots.push_back(root);
+    }
+
+    void SceneSnapshotWriter::addRoot(optixu::InstanceAccelerationStructure ias) {
+        Root root = {};
+        root.type = optixu::ChildType::IAS;
+        root.ias = ias;
+        m_roots.push_back(root);
+    }
+
+    void SceneSnapshotWriter::addRoot(optixu::Transform transform) {
+        Root root = {};
+        root.type = optixu::ChildType::Transform;
+        root.transform = transform;
+        m_roots.push_back(root);
+    }
+
+    bool SceneSnapshotWriter::write(const std::filesystem::path &filepath, bool embedAccelerationStructures) const {
+        GraphCollector graph;
+        std::vector<uint32_t> rootIndices(m_roots.size());
+        for (uint32_t rootIdx = 0; rootIdx < m_roots.size(); ++rootIdx) {
+            const Root &root = m_roots[rootIdx];
+            rootIndices[rootIdx] = graph.visitChild(root.type, root.gas, root.ias, root.transform);
+        }
+
+        ByteWriter writer;
+
+        // JP: ジオメトリインスタンスの記録の前に参照されるバッファーを全て集める。
+        // EN: Collect all the referenced buffers before recording geometry instances.
+        ByteWriter geomInstWriter;
+        for (optixu::GeometryInstance geomInst : graph.geomInsts) {
+            optixu::GeometryType geomType = geomInst.getGeometryType();
+            uint32_t numMotionSteps = geomInst.getNumMotionSteps();
+            geomInstWriter.putString(geomInst.getName());
+            geomInstWriter.put(static_cast<uint32_t>(geomType));
+            geomInstWriter.put(numMotionSteps);
+            geomInstWriter.put(geomInst.getPrimitiveIndexOffset());
+            if (geomType == optixu::GeometryType::Triangles) {
+                OptixIndicesFormat indexFormat;
+                optixu::BufferView triangleBuffer = geomInst.getTriangleBuffer(&indexFormat);
+                geomInstWriter.put(static_cast<uint32_t>(geomInst.getVertexFormat()));
+                for (uint32_t step = 0; step < numMotionSteps; ++step)
+                    geomInstWriter.put(graph.addBuffer(geomInst.getVertexBuffer(step)));
+                geomInstWriter.put(static_cast<uint32_t>(indexFormat));
+                geomInstWriter.put(graph.addBuffer(triangleBuffer));
+            }
+            else if (geomType == optixu::GeometryType::CustomPrimitives) {
+                for (uint32_t step = 0; step < numMotionSteps; ++step)
+                    geomInstWriter.put(graph.addBuffer(geomInst.getCustomPrimitiveAABBBuffer(step)));
+            }
+            else {
+                for (uint32_t step = 0; step < numMotionSteps; ++step) {
+                    geomInstWriter.put(graph.addBuffer(geomInst.getVertexBuffer(step)));
+                    geomInstWriter.put(graph.addBuffer(geomInst.getWidthBuffer(step)));
+                }
+                geomInstWriter.put(graph.addBuffer(geomInst.getSegmentIndexBuffer()));
+            }
+
+            optixu::BufferView matIndexBuffer;
+            uint32_t matIndexSize;
+            uint32_t numMaterials = geomInst.getNumMaterials(&matIndexBuffer, &matIndexSize);
+            geomInstWriter.put(numMaterials);
+            geomInstWriter.put(graph.addBuffer(matIndexBuffer));
+            geomInstWriter.put(matIndexSize);
+            for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
+                geomInstWriter.put(static_cast<uint32_t>(geomInst.getGeometryFlags(matIdx)));
+                uint32_t numMatSets = geomInst.getNumMaterialSets(matIdx);
+                geomInstWriter.put(numMatSets);
+                for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx)
+                    geomInstWriter.putString(getMaterialName(geomInst.getMaterial(matSetIdx, matIdx)));
+            }
+
+            uint32_t userDataSize, userDataAlignment;
+            geomInst.getUserData(nullptr, &userDataSize, &userDataAlignment);
+            std::vector<uint8_t> userData(userDataSize);
+            geomInst.getUserData(userData.data(), nullptr, nullptr);
+            geomInstWriter.putUserData(userData, userDataAlignment);
+        }
+
+        ByteWriter geomASWriter;
+        for (optixu::GeometryAccelerationStructure gas : graph.geomASs) {
+            geomASWriter.putString(gas.getName());
+            geomASWriter.put(static_cast<uint32_t>(gas.getGeometryType()));
+            optixu::ASTradeoff tradeoff;
+            bool allowUpdate, allowCompaction, allowRandomVertexAccess;
+            gas.getConfiguration(&tradeoff, &allowUpdate, &allowCompaction, &allowRandomVertexAccess);
+            geomASWriter.put(static_cast<uint32_t>(tradeoff));
+            geomASWriter.put(static_cast<uint8_t>(allowUpdate));
+            geomASWriter.put(static_cast<uint8_t>(allowCompaction));
+            geomASWriter.put(static_cast<uint8_t>(allowRandomVertexAccess));
+            uint32_t numKeys;
+            float timeBegin, timeEnd;
+            OptixMotionFlags motionFlags;
+            gas.getMotionOptions(&numKeys, &timeBegin, &timeEnd, &motionFlags);
+            putMotionOptions(geomASWriter, numKeys, timeBegin, timeEnd, motionFlags);
+
+            uint32_t numMatSets = gas.getNumMaterialSets();
+            geomASWriter.put(numMatSets);
+            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                uint32_t numRayTypes = gas.getNumRayTypes(matSetIdx);
+                geomASWriter.put(numRayTypes);
+                for (uint32_t rayType = 0; rayType < numRayTypes; ++rayType)
+                    geomASWriter.putString(getMaterialName(gas.getUniformRayTypeMaterial(matSetIdx, rayType)));
+            }
+
+            uint32_t numChildren = gas.getNumChildren();
+            geomASWriter.put(numChildren);
+            for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx) {
+                CUdeviceptr preTransform;
+                optixu::GeometryInstance geomInst = gas.getChild(childIdx, &preTransform);
+                geomASWriter.put(graph.geomInstIndices.at(geomInst));
+                geomASWriter.put(graph.addBuffer(preTransform ?
+                                                 optixu::BufferView(preTransform, 1, sizeof(float) * 12) :
+                                                 optixu::BufferView()));
+                uint32_t userDataSize, userDataAlignment;
+                gas.getChildUserData(childIdx, nullptr, &userDataSize, &userDataAlignment);
+                std::vector<uint8_t> userData(userDataSize);
+                gas.getChildUserData(childIdx, userData.data(), nullptr, nullptr);
+                geomASWriter.putUserData(userData, userDataAlignment);
+            }
+
+            uint32_t userDataSize, userDataAlignment;
+            gas.getUserData(nullptr, &userDataSize, &userDataAlignment);
+            std::vector<uint8_t> userData(userDataSize);
+            gas.getUserData(userData.data(), nullptr, nullptr);
+            geomASWriter.putUserData(userData, userDataAlignment);
+
+            // JP: リロケート可能なASはGAS::serialize()の形式のまま埋め込む。
+            // EN: Embed the relocatable AS as is in the format of GAS::serialize().
+            std::vector<uint8_t> asData;
+            if (embedAccelerationStructures)
+                gas.serialize(&asData);
+            geomASWriter.put(static_cast<uint64_t>(asData.size()));
+            geomASWriter.putBytes(asData.data(), asData.size());
+        }
+
+        // JP: バッファーの内容をまとめて読み戻す。
+        // EN: Read back buffer contents together.
+        CUDADRV_CHECK(cuCtxSynchronize());
+        for (const optixu::BufferView &buffer : graph.buffers) {
+            writer.put(static_cast<uint32_t>(buffer.numElements()));
+            writer.put(buffer.stride());
+            std::vector<uint8_t> contents(buffer.sizeInBytes());
+            CUDADRV_CHECK(cuMemcpyDtoH(contents.data(), buffer.getCUdeviceptr(), contents.size()));
+            writer.putBytes(contents.data(), contents.size());
+        }
+        writer.putBytes(geomInstWriter.getData().data(), geomInstWriter.getData().size());
+        writer.putBytes(geomASWriter.getData().data(), geomASWriter.getData().size());
+
+        for (optixu::Transform transform : graph.transforms) {
+            writer.putString(transform.getName());
+            optixu::TransformType type;
+            uint32_t numKeys;
+            transform.getConfiguration(&type, &numKeys);
+            writer.put(static_cast<uint32_t>(type));
+            writer.put(numKeys);
+            float timeBegin, timeEnd;
+            OptixMotionFlags motionFlags;
+            transform.getMotionOptions(&timeBegin, &timeEnd, &motionFlags);
+            writer.put(timeBegin);
+            writer.put(timeEnd);
+            writer.put(static_cast<uint32_t>(motionFlags));
+            if (type == optixu::TransformType::MatrixMotion) {
+                for (uint32_t keyIdx = 0; keyIdx < numKeys; ++keyIdx) {
+                    float matrix[12];
+                    transform.getMatrixMotionKey(keyIdx, matrix);
+                    writer.put(matrix);
+                }
+            }
+            else if (type == optixu::TransformType::SRTMotion) {
+                for (uint32_t keyIdx = 0; keyIdx < numKeys; ++keyIdx) {
+                    float srt[10];
+                    transform.getSRTMotionKey(keyIdx, srt, srt + 3, srt + 7);
+                    writer.put(srt);
+                }
+            }
+            else if (type == optixu::TransformType::Static) {
+                float matrix[12];
+                transform.getStaticTransform(matrix);
+                writer.put(matrix);
+            }
+            optixu::ChildType childType = transform.getChildType();
+            writer.put(static_cast<uint32_t>(childType));
+            writer.put(graph.getChildIndex(
+                childType,
+                childType == optixu::ChildType::GAS ?
+                transform.getChild<optixu::GeometryAccelerationStructure>() : optixu::GeometryAccelerationStructure(),
+                childType == optixu::ChildType::IAS ?
+                transform.getChild<optixu::InstanceAccelerationStructure>() : optixu::InstanceAccelerationStructure(),
+                childType == optixu::ChildType::Transform ?
+                transform.getChild<optixu::Transform>() : optixu::Transform()));
+        }
+
+        for (optixu::Instance inst : graph.instances) {
+            writer.putString(inst.getName());
+            optixu::ChildType childType = inst.getChildType();
+            writer.put(static_cast<uint32_t>(childType));
+            writer.put(graph.getChildIndex(
+                childType,
+                childType == optixu::ChildType::GAS ?
+                inst.getChild<optixu::GeometryAccelerationStructure>() : optixu::GeometryAccelerationStructure(),
+                childType == optixu::ChildType::IAS ?
+                inst.getChild<optixu::InstanceAccelerationStructure>() : optixu::InstanceAccelerationStructure(),
+                childType == optixu::ChildType::Transform ?
+                inst.getChild<optixu::Transform>() : optixu::Transform()));
+            writer.put(inst.getMaterialSetIndex());
+            writer.put(inst.getID());
+            writer.put(inst.getVisibilityMask());
+            writer.put(static_cast<uint32_t>(inst.getFlags()));
+            float transform[12];
+            inst.getTransform(transform);
+            writer.put(transform);
+        }
+
+        for (optixu::InstanceAccelerationStructure ias : graph.instASs) {
+            writer.putString(ias.getName());
+            optixu::ASTradeoff tradeoff;
+            bool allowUpdate, allowCompaction;
+            ias.getConfiguration(&tradeoff, &allowUpdate, &allowCompaction);
+            writer.put(static_cast<uint32_t>(tradeoff));
+            writer.put(static_cast<uint8_t>(allowUpdate));
+            writer.put(static_cast<uint8_t>(allowCompaction));
+            uint32_t numKeys;
+            float timeBegin, timeEnd;
+            OptixMotionFlags motionFlags;
+            ias.getMotionOptions(&numKeys, &timeBegin, &timeEnd, &motionFlags);
+            putMotionOptions(writer, numKeys, timeBegin, timeEnd, motionFlags);
+            uint32_t numChildren = ias.getNumChildren();
+            writer.put(numChildren);
+            for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx)
+                writer.put(graph.instanceIndices.at(ias.getChild(childIdx)));
+        }
+
+        for (const std::pair<optixu::ChildType, uint32_t> &entry : graph.buildOrder) {
+            writer.put(static_cast<uint32_t>(entry.first));
+            writer.put(entry.second);
+        }
+        for (uint32_t rootIdx = 0; rootIdx < m_roots.size(); ++rootIdx) {
+            writer.put(static_cast<uint32_t>(m_roots[rootIdx].type));
+            writer.put(rootIndices[rootIdx]);
+        }
+
+        SnapshotHeader header = {};
+        std::copy_n(snapshotMagic, sizeof(snapshotMagic), header.magic);
+        header.version = snapshotVersion;
+        header.flags = embedAccelerationStructures ? SnapshotFlag_EmbeddedAS : 0;
+        header.bodySize = writer.getData().size();
+        header.numBuffers = static_cast<uint32_t>(graph.buffers.size());
+        header.numGeomInsts = static_cast<uint32_t>(graph.geomInsts.size());
+        header.numGeomASs = static_cast<uint32_t>(graph.geomASs.size());
+        header.numTransforms = static_cast<uint32_t>(graph.transforms.size());
+        header.numInstances = static_cast<uint32_t>(graph.instances.size());
+        header.numInstASs = static_cast<uint32_t>(graph.instASs.size());
+        header.numBuildOrderEntries = static_cast<uint32_t>(graph.buildOrder.size());
+        header.numRoots = static_cast<uint32_t>(m_roots.size());
+
+        std::ofstream ofs(filepath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            return false;
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(writer.getData().data()), writer.getData().size());
+
+        return static_cast<bool>(ofs);
+    }
+
+
+
+    OptixTraversableHandle SceneSnapshot::getHandle(const Reference &ref) const {
+        if (ref.type == optixu::ChildType::GAS)
+            return m_geomASs[ref.index].gas.getHandle();
+        else if (ref.type == optixu::ChildType::IAS)
+            return m_instASs[ref.index].ias.getHandle();
+        else if (ref.type == optixu::ChildType::Transform)
+            return m_transforms[ref.index].transform.getHandle();
+        return 0;
+    }
+
+    bool SceneSnapshot::load(const std::filesystem::path &filepath) {
+        finalize();
+
+        std::ifstream ifs(filepath, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!ifs)
+            return false;
+        size_t fileSize = static_cast<size_t>(ifs.tellg());
+        if (fileSize < sizeof(SnapshotHeader))
+            return false;
+        m_data.resize(fileSize);
+        ifs.seekg(0);
+        ifs.read(reinterpret_cast<char*>(m_data.data()), fileSize);
+        if (!ifs) {
+            m_data.clear();
+            return false;
+        }
+
+        SnapshotHeader header;
+        std::memcpy(&header, m_data.data(), sizeof(header));
+        if (std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0 ||
+            header.version != snapshotVersion ||
+            header.bodySize != fileSize - sizeof(header)) {
+            m_data.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    void SceneSnapshot::instantiate(CUcontext cuContext, optixu::Scene scene, const MaterialLookup &lookupMaterial,
+                                    CUstream stream) {
+        if (m_data.empty())
+            throw std::runtime_error("Scene snapshot is not loaded.");
+        if (!m_geomASs.empty() || !m_instASs.empty() || !m_transforms.empty())
+            throw std::runtime_error("Scene snapshot has already been instantiated.");
+
+        SnapshotHeader header;
+        std::memcpy(&header, m_data.data(), sizeof(header));
+        const bool hasEmbeddedAS = (header.flags & SnapshotFlag_EmbeddedAS) != 0;
+        ByteReader reader(m_data.data() + sizeof(header), header.bodySize);
+        const uint8_t* body = m_data.data() + sizeof(header);
+
+        auto findMaterial = [&lookupMaterial](const std::string &name) {
+            return name.empty() ? optixu::Material() : lookupMaterial(name);
+        };
+        auto getBuffer = [this](uint32_t index) {
+            if (index == invalidIndex)
+                return optixu::BufferView();
+            if (index >= m_buffers.size())
+                throw std::runtime_error("Scene snapshot has an invalid buffer reference.");
+            return static_cast<optixu::BufferView>(m_buffers[index]);
+        };
+        auto readReference = [&reader, &header]() {
+            Reference ref;
+            ref.type = static_cast<optixu::ChildType>(reader.get<uint32_t>());
+            ref.index = reader.get<uint32_t>();
+            uint32_t numObjects =
+                ref.type == optixu::ChildType::GAS ? header.numGeomASs :
+                ref.type == optixu::ChildType::IAS ? header.numInstASs :
+                ref.type == optixu::ChildType::Transform ? header.numTransforms : 0;
+            if (ref.index >= numObjects)
+                throw std::runtime_error("Scene snapshot has an invalid child reference.");
+            return ref;
+        };
+
+        // JP: 他のオブジェクトを前方参照できるよう、先に全オブジェクトを生成しておく。
+        // EN: Create all the objects first so that other objects can be forward-referenced.
+        m_geomASs.resize(header.numGeomASs);
+        m_transforms.resize(header.numTransforms);
+        m_instASs.resize(header.numInstASs);
+        for (TransformNode &node : m_transforms)
+            node.transform = scene.createTransform();
+        m_instances.resize(header.numInstances);
+        for (optixu::Instance &inst : m_instances)
+            inst = scene.createInstance();
+        for (InstanceAS &instAS : m_instASs)
+            instAS.ias = scene.createInstanceAccelerationStructure();
+
+        m_buffers.resize(header.numBuffers);
+        for (cudau::Buffer &buffer : m_buffers) {
+            uint32_t numElements = reader.get<uint32_t>();
+            uint32_t stride = reader.get<uint32_t>();
+            const uint8_t* contents = reader.getBytes(static_cast<size_t>(numElements) * stride);
+            buffer.initialize(cuContext, cudau::BufferType::Device, numElements, stride);
+            buffer.write(contents, numElements * stride, stream);
+        }
+
+        m_geomInsts.resize(header.numGeomInsts);
+        for (optixu::GeometryInstance &geomInst : m_geomInsts) {
+            std::string name = reader.getString();
+            auto geomType = static_cast<optixu::GeometryType>(reader.get<uint32_t>());
+            uint32_t numMotionSteps = reader.get<uint32_t>();
+            geomInst = scene.createGeometryInstance(geomType);
+            geomInst.setName(name);
+            geomInst.setNumMotionSteps(numMotionSteps);
+            geomInst.setPrimitiveIndexOffset(reader.get<uint32_t>());
+            if (geomType == optixu::GeometryType::Triangles) {
+                geomInst.setVertexFormat(static_cast<OptixVertexFormat>(reader.get<uint32_t>()));
+                for (uint32_t step = 0; step < numMotionSteps; ++step)
+                    geomInst.setVertexBuffer(getBuffer(reader.get<uint32_t>()), step);
+                auto indexFormat = static_cast<OptixIndicesFormat>(reader.get<uint32_t>());
+                geomInst.setTriangleBuffer(getBuffer(reader.get<uint32_t>()), indexFormat);
+            }
+            else if (geomType == optixu::GeometryType::CustomPrimitives) {
+                for (uint32_t step = 0; step < numMotionSteps; ++step)
+                    geomInst.setCustomPrimitiveAABBBuffer(getBuffer(reader.get<uint32_t>()), step);
+            }
+            else {
+                for (uint32_t step = 0; step < numMotionSteps; ++step) {
+                    geomInst.setVertexBuffer(getBuffer(reader.get<uint32_t>()), step);
+                    geomInst.setWidthBuffer(getBuffer(reader.get<uint32_t>()), step);
+                }
+                geomInst.setSegmentIndexBuffer(getBuffer(reader.get<uint32_t>()));
+            }
+
+            uint32_t numMaterials = reader.get<uint32_t>();
+            optixu::BufferView matIndexBuffer = getBuffer(reader.get<uint32_t>());
+            uint32_t matIndexSize = reader.get<uint32_t>();
+            geomInst.setNumMaterials(numMaterials, matIndexBuffer, matIndexSize);
+            for (uint32_t matIdx = 0; matIdx < numMaterials; ++matIdx) {
+                geomInst.setGeometryFlags(matIdx, static_cast<OptixGeometryFlags>(reader.get<uint32_t>()));
+                uint32_t numMatSets = reader.get<uint32_t>();
+                for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx)
+                    geomInst.setMaterial(matSetIdx, matIdx, findMaterial(reader.getString()));
+            }
+
+            uint32_t userDataSize, userDataAlignment;
+            const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+            if (userDataSize > 0)
+                geomInst.setUserData(userData, userDataSize, userDataAlignment);
+        }
+
+        OptixAccelBufferSizes asSizes;
+        size_t maxScratchSize = 0;
+        std::vector<uint8_t> gasNeedsRebuild(m_geomASs.size(), 0);
+        for (uint32_t gasIdx = 0; gasIdx < m_geomASs.size(); ++gasIdx) {
+            GeometryAS &geomAS = m_geomASs[gasIdx];
+            std::string name = reader.getString();
+            auto geomType = static_cast<optixu::GeometryType>(reader.get<uint32_t>());
+            optixu::GeometryAccelerationStructure gas = scene.createGeometryAccelerationStructure(geomType);
+            geomAS.gas = gas;
+            gas.setName(name);
+            auto tradeoff = static_cast<optixu::ASTradeoff>(reader.get<uint32_t>());
+            bool allowUpdate = reader.get<uint8_t>() != 0;
+            bool allowCompaction = reader.get<uint8_t>() != 0;
+            bool allowRandomVertexAccess = reader.get<uint8_t>() != 0;
+            gas.setConfiguration(tradeoff, allowUpdate, allowCompaction, allowRandomVertexAccess);
+            uint32_t numKeys;
+            float timeBegin, timeEnd;
+            OptixMotionFlags motionFlags;
+            getMotionOptions(reader, &numKeys, &timeBegin, &timeEnd, &motionFlags);
+            gas.setMotionOptions(numKeys, timeBegin, timeEnd, motionFlags);
+
+            uint32_t numMatSets = reader.get<uint32_t>();
+            gas.setNumMaterialSets(numMatSets);
+            for (uint32_t matSetIdx = 0; matSetIdx < numMatSets; ++matSetIdx) {
+                uint32_t numRayTypes = reader.get<uint32_t>();
+                gas.setNumRayTypes(matSetIdx, numRayTypes);
+                for (uint32_t rayType = 0; rayType < numRayTypes; ++rayType) {
+                    optixu::Material mat = findMaterial(reader.getString());
+                    if (mat)
+                        gas.setUniformRayTypeMaterial(matSetIdx, rayType, mat);
+                }
+            }
+
+            uint32_t numChildren = reader.get<uint32_t>();
+            for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx) {
+                uint32_t geomInstIdx = reader.get<uint32_t>();
+                if (geomInstIdx >= m_geomInsts.size())
+                    throw std::runtime_error("Scene snapshot has an invalid geometry instance reference.");
+                optixu::BufferView preTransform = getBuffer(reader.get<uint32_t>());
+                uint32_t userDataSize, userDataAlignment;
+                const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+                gas.addChild(m_geomInsts[geomInstIdx], preTransform.getCUdeviceptr(),
+                             userDataSize > 0 ? userData : nullptr, userDataSize, userDataAlignment);
+            }
+
+            uint32_t userDataSize, userDataAlignment;
+            const uint8_t* userData = reader.getUserData(&userDataSize, &userDataAlignment);
+            if (userDataSize > 0)
+                gas.setUserData(userData, userDataSize, userDataAlignment);
+
+            geomAS.blobSize = reader.get<uint64_t>();
+            geomAS.blobOffset = reader.tell();
+            reader.getBytes(geomAS.blobSize);
+
+            // JP: 埋め込まれたASが現在のビルド入力とデバイスに適合すればリロケートで済ませる。
+            // EN: Only relocate the embedded AS if it matches the current build inputs and device.
+            gas.prepareForBuild(&asSizes);
+            size_t accelBufferSize;
+            if (hasEmbeddedAS && geomAS.blobSize > 0 &&
+                gas.checkRelocatable(body + geomAS.blobOffset, geomAS.blobSize, &accelBufferSize)) {
+                geomAS.accelBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                              static_cast<uint32_t>(accelBufferSize), 1);
+                gas.relocate(stream, body + geomAS.blobOffset, geomAS.blobSize, geomAS.accelBuffer);
+                ++m_numRelocatedGASs;
+            }
+            else {
+                geomAS.accelBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                              static_cast<uint32_t>(asSizes.outputSizeInBytes), 1);
+                maxScratchSize = std::max(maxScratchSize, asSizes.tempSizeInBytes);
+                gasNeedsRebuild[gasIdx] = 1;
+            }
+        }
+
+        for (TransformNode &node : m_transforms) {
+            optixu::Transform transform = node.transform;
+            transform.setName(reader.getString());
+            auto type = static_cast<optixu::TransformType>(reader.get<uint32_t>());
+            uint32_t numKeys = reader.get<uint32_t>();
+            size_t transformSize;
+            transform.setConfiguration(type, numKeys, &transformSize);
+            float timeBegin = reader.get<float>();
+            float timeEnd = reader.get<float>();
+            auto motionFlags = static_cast<OptixMotionFlags>(reader.get<uint32_t>());
+            transform.setMotionOptions(timeBegin, timeEnd, motionFlags);
+            if (type == optixu::TransformType::MatrixMotion) {
+                for (uint32_t keyIdx = 0; keyIdx < numKeys; ++keyIdx) {
+                    auto matrix = reader.get<std::array<float, 12>>();
+                    transform.setMatrixMotionKey(keyIdx, matrix.data());
+                }
+            }
+            else if (type == optixu::TransformType::SRTMotion) {
+                for (uint32_t keyIdx = 0; keyIdx < numKeys; ++keyIdx) {
+                    auto srt = reader.get<std::array<float, 10>>();
+                    transform.setSRTMotionKey(keyIdx, srt.data(), srt.data() + 3, srt.data() + 7);
+                }
+            }
+            else if (type == optixu::TransformType::Static) {
+                auto matrix = reader.get<std::array<float, 12>>();
+                transform.setStaticTransform(matrix.data());
+            }
+            Reference child = readReference();
+            if (child.type == optixu::ChildType::GAS)
+                transform.setChild(m_geomASs[child.index].gas);
+            else if (child.type == optixu::ChildType::IAS)
+                transform.setChild(m_instASs[child.index].ias);
+            else
+                transform.setChild(m_transforms[child.index].transform);
+            node.buffer.initialize(cuContext, cudau::BufferType::Device, static_cast<uint32_t>(transformSize), 1);
+        }
+
+        for (optixu::Instance inst : m_instances) {
+            inst.setName(reader.getString());
+            Reference child = readReference();
+            uint32_t matSetIdx = reader.get<uint32_t>();
+            if (child.type == optixu::ChildType::GAS)
+                inst.setChild(m_geomASs[child.index].gas, matSetIdx);
+            else if (child.type == optixu::ChildType::IAS)
+                inst.setChild(m_instASs[child.index].ias);
+            else
+                inst.setChild(m_transforms[child.index].transform, matSetIdx);
+            inst.setID(reader.get<uint32_t>());
+            inst.setVisibilityMask(reader.get<uint32_t>());
+            inst.setFlags(static_cast<OptixInstanceFlags>(reader.get<uint32_t>()));
+            auto transform = reader.get<std::array<float, 12>>();
+            inst.setTransform(transform.data());
+        }
+
+        for (InstanceAS &instAS : m_instASs) {
+            optixu::InstanceAccelerationStructure ias = instAS.ias;
+            ias.setName(reader.getString());
+            auto tradeoff = static_cast<optixu::ASTradeoff>(reader.get<uint32_t>());
+            bool allowUpdate = reader.get<uint8_t>() != 0;
+            bool allowCompaction = reader.get<uint8_t>() != 0;
+            ias.setConfiguration(tradeoff, allowUpdate, allowCompaction, false);
+            uint32_t numKeys;
+            float timeBegin, timeEnd;
+            OptixMotionFlags motionFlags;
+            getMotionOptions(reader, &numKeys, &timeBegin, &timeEnd, &motionFlags);
+            ias.setMotionOptions(numKeys, timeBegin, timeEnd, motionFlags);
+            uint32_t numChildren = reader.get<uint32_t>();
+            for (uint32_t childIdx = 0; childIdx < numChildren; ++childIdx) {
+                uint32_t instIdx = reader.get<uint32_t>();
+                if (instIdx >= m_instances.size())
+                    throw std::runtime_error("Scene snapshot has an invalid instance reference.");
+                ias.addChild(m_instances[instIdx]);
+            }
+            ias.prepareForBuild(&asSizes);
+            instAS.instanceBuffer.initialize(cuContext, cudau::BufferType::Device, std::max(numChildren, 1u));
+            instAS.accelBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                          static_cast<uint32_t>(asSizes.outputSizeInBytes), 1);
+            maxScratchSize = std::max(maxScratchSize, asSizes.tempSizeInBytes);
+        }
+
+        m_buildOrder.resize(header.numBuildOrderEntries);
+        for (Reference &ref : m_buildOrder)
+            ref = readReference();
+        m_roots.resize(header.numRoots);
+        for (Reference &ref : m_roots)
+            ref = readReference();
+
+        // JP: 子が先に来るビルド順に従って、リロケートできなかったGAS、Transform、IASをビルドする。
+        //     IASとTransformは子のハンドルが変わるため常にビルドし直す。
+        // EN: Build GASs that could not be relocated, transforms and IASs following the build order
+        //     in which children come first.
+        //     IASs and transforms are always rebuilt because handles of their children change.
+        cudau::Buffer scratchBuffer;
+        if (maxScratchSize > 0)
+            scratchBuffer.initialize(cuContext, cudau::BufferType::Device, static_cast<uint32_t>(maxScratchSize), 1);
+        for (const Reference &ref : m_buildOrder) {
+            if (ref.type == optixu::ChildType::GAS) {
+                GeometryAS &geomAS = m_geomASs[ref.index];
+                if (gasNeedsRebuild[ref.index])
+                    geomAS.gas.rebuild(stream, geomAS.accelBuffer, scratchBuffer);
+            }
+            else if (ref.type == optixu::ChildType::Transform) {
+                TransformNode &node = m_transforms[ref.index];
+                node.transform.rebuild(stream, node.buffer);
+            }
+            else {
+                InstanceAS &instAS = m_instASs[ref.index];
+                instAS.ias.rebuild(stream, instAS.instanceBuffer, instAS.accelBuffer, scratchBuffer);
+            }
+        }
+
+        // JP: アップロード元のファイルデータとスクラッチバッファーは完了を待ってから解放する。
+        // EN: Free the file data as the upload source and the scratch buffer after waiting for completion.
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        if (scratchBuffer.isInitialized())
+            scratchBuffer.finalize();
+        m_data.clear();
+        m_data.shrink_to_fit();
+    }
+
+    void SceneSnapshot::finalize() {
+        m_roots.clear();
+        m_buildOrder.clear();
+        for (int i = static_cast<int>(m_instASs.size()) - 1; i >= 0; --i) {
+            InstanceAS &instAS = m_instASs[i];
+            if (instAS.accelBuffer.isInitialized())
+                instAS.accelBuffer.finalize();
+            if (instAS.instanceBuffer.isInitialized())
+                instAS.instanceBuffer.finalize();
+            if (instAS.ias)
+                instAS.ias.destroy();
+        }
+        m_instASs.clear();
+        for (int i = static_cast<int>(m_instances.size()) - 1; i >= 0; --i) {
+            if (m_instances[i])
+                m_instances[i].destroy();
+        }
+        m_instances.clear();
+        for (int i = static_cast<int>(m_transforms.size()) - 1; i >= 0; --i) {
+            TransformNode &node = m_transforms[i];
+            if (node.buffer.isInitialized())
+                node.buffer.finalize();
+            if (node.transform)
+                node.transform.destroy();
+        }
+        m_transforms.clear();
+        for (int i = static_cast<int>(m_geomASs.size()) - 1; i >= 0; --i) {
+            GeometryAS &geomAS = m_geomASs[i];
+            if (geomAS.accelBuffer.isInitialized())
+                geomAS.accelBuffer.finalize();
+            if (geomAS.gas)
+                geomAS.gas.destroy();
+        }
+        m_geomASs.clear();
+        for (int i = static_cast<int>(m_geomInsts.size()) - 1; i >= 0; --i) {
+            if (m_geomInsts[i])
+                m_geomInsts[i].destroy();
+        }
+        m_geomInsts.clear();
+        for (int i = static_cast<int>(m_buffers.size()) - 1; i >= 0; --i) {
+            if (m_buffers[i].isInitialized())
+                m_buffers[i].finalize();
+        }
+        m_buffers.clear();
+        m_data.clear();
+        m_numRelocatedGASs = 0;
+    }
+
+    optixu::GeometryInstance SceneSnapshot::findGeometryInstance(const std::string &name) const {
+        for (const optixu::GeometryInstance &geomInst : m_geomInsts) {
+            if (name == geomInst.getName())
+                return geomInst;
+        }
+        return optixu::GeometryInstance();
+    }
+
+    optixu::GeometryAccelerationStructure SceneSnapshot::findGeometryAS(const std::string &name) const {
+        for (const GeometryAS &geomAS : m_geomASs) {
+            if (name == geomAS.gas.getName())
+                return geomAS.gas;
+        }
+        return optixu::GeometryAccelerationStructure();
+    }
+
+    optixu::InstanceAccelerationStructure SceneSnapshot::findInstanceAS(const std::string &name) const {
+        for (const InstanceAS &instAS : m_instASs) {
+            if (name == instAS.ias.getName())
+                return instAS.ias;
+        }
+        return optixu::InstanceAccelerationStructure();
+    }
+
+    optixu::Transform SceneSnapshot::findTransform(const std::string &name) const {
+        for (const TransformNode &node : m_transforms) {
+            if (name == node.transform.getName())
+                return node.transform;
+        }
+        return optixu::Transform();
+    }
+
+    optixu::Instance SceneSnapshot::findInstance(const std::string &name) const {
+        for (const optixu::Instance &inst : m_instances) {
+            if (name == inst.getName())
+                return inst;
+        }
+        return optixu::Instance();
+    }
+}
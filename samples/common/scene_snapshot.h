@@ -0,0 +1,138 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: optixuのシーングラフをバージョン付きのバイナリースナップショットとして保存・復元する。
+//     ルートから辿れるGeometryInstance(バッファーの内容を含む)、GAS/IAS/Transform/Instanceの設定、
+//     名前によるマテリアルの割り当て、ユーザーデータを書き出す。
+//     GASはリロケート可能なASを埋め込むことができ、復元側ではインポートもGASのビルドも行わない。
+//     IASとTransformはインスタンスのハンドルが変わるので復元時に常にビルドする(軽量)。
+//
+//     asset::SceneSnapshotWriter writer;
+//     writer.addRoot(ias);
+//     writer.write("scene.oxsnap", true);
+//     ...
+//     asset::SceneSnapshot snapshot;
+//     snapshot.load("scene.oxsnap");
+//     snapshot.instantiate(cuContext, scene, [&](const std::string &name) { return materials.at(name); }, stream);
+//     plp.travHandle = snapshot.getRootHandle(0);
+//
+// EN: Save/restore a scene graph of optixu as a versioned binary snapshot.
+//     It writes GeometryInstances reachable from roots (including buffer contents), configurations of
+//     GAS/IAS/Transform/Instance, material bindings by name and user data.
+//     GASs can embed relocatable ASs, and the restoring side performs neither import nor GAS builds.
+//     IASs and transforms are always built at restoration (lightweight) since handles of instances change.
+//
+//     asset::SceneSnapshotWriter writer;
+//     writer.addRoot(ias);
+//     writer.write("scene.oxsnap", true);
+//     ...
+//     asset::SceneSnapshot snapshot;
+//     snapshot.load("scene.oxsnap");
+//     snapshot.instantiate(cuContext, scene, [&](const std::string &name) { return materials.at(name); }, stream);
+//     plp.travHandle = snapshot.getRootHandle(0);
+namespace asset {
+    // JP: 名前が空のマテリアルは割り当てが無かったことを示し、この関数は呼ばれない。
+    // EN: A material with an empty name indicates no binding, and this function isn't called for it.
+    using MaterialLookup = std::function<optixu::Material(const std::string &name)>;
+
+    class SceneSnapshotWriter {
+        struct Root {
+            optixu::ChildType type;
+            optixu::GeometryAccelerationStructure gas;
+            optixu::InstanceAccelerationStructure ias;
+            optixu::Transform transform;
+        };
+        std::vector<Root> m_roots;
+
+    public:
+        void addRoot(optixu::GeometryAccelerationStructure gas);
+        void addRoot(optixu::InstanceAccelerationStructure ias);
+        void addRoot(optixu::Transform transform);
+
+        // JP: バッファーの内容とASはデバイスから同期的に読み戻される。
+        //     embedAccelerationStructuresが真の場合、GASはビルド済みである必要がある。
+        // EN: Buffer contents and ASs are synchronously read back from the device.
+        //     GASs need to have been built when embedAccelerationStructures is true.
+        bool write(const std::filesystem::path &filepath, bool embedAccelerationStructures) const;
+    };
+
+    class SceneSnapshot {
+        struct Reference {
+            optixu::ChildType type;
+            uint32_t index;
+        };
+        struct GeometryAS {
+            optixu::GeometryAccelerationStructure gas;
+            cudau::Buffer accelBuffer;
+            uint64_t blobOffset;
+            uint64_t blobSize;
+        };
+        struct TransformNode {
+            optixu::Transform transform;
+            cudau::Buffer buffer;
+        };
+        struct InstanceAS {
+            optixu::InstanceAccelerationStructure ias;
+            cudau::TypedBuffer<OptixInstance> instanceBuffer;
+            cudau::Buffer accelBuffer;
+        };
+
+        std::vector<uint8_t> m_data;
+        std::vector<cudau::Buffer> m_buffers;
+        std::vector<optixu::GeometryInstance> m_geomInsts;
+        std::vector<GeometryAS> m_geomASs;
+        std::vector<TransformNode> m_transforms;
+        std::vector<optixu::Instance> m_instances;
+        std::vector<InstanceAS> m_instASs;
+        std::vector<Reference> m_buildOrder;
+        std::vector<Reference> m_roots;
+        uint32_t m_numRelocatedGASs;
+
+        SceneSnapshot(const SceneSnapshot &) = delete;
+        SceneSnapshot &operator=(const SceneSnapshot &) = delete;
+
+        OptixTraversableHandle getHandle(const Reference &ref) const;
+
+    public:
+        SceneSnapshot() : m_numRelocatedGASs(0) {}
+        ~SceneSnapshot() {
+            finalize();
+        }
+
+        bool load(const std::filesystem::path &filepath);
+        // JP: バッファーとシーンのオブジェクトを生成し、GASのリロケート(埋め込まれていないか、
+        //     現在のデバイスと互換が無い場合はビルド)、Transform、IASのビルドまでを行う。
+        //     ロードしたファイルの内容はこの後は不要なので解放される。
+        // EN: Create buffers and scene objects, then relocate GASs (or build them when not embedded or
+        //     not compatible with the current device), build transforms and IASs.
+        //     The loaded file contents are no longer needed after this, so they are freed.
+        void instantiate(CUcontext cuContext, optixu::Scene scene, const MaterialLookup &lookupMaterial,
+                         CUstream stream);
+        void finalize();
+
+        uint32_t getNumRoots() const {
+            return static_cast<uint32_t>(m_roots.size());
+        }
+        optixu::ChildType getRootType(uint32_t rootIdx) const {
+            return m_roots[rootIdx].type;
+        }
+        OptixTraversableHandle getRootHandle(uint32_t rootIdx) const {
+            return getHandle(m_roots[rootIdx]);
+        }
+        uint32_t getNumRelocatedGeometryASs() const {
+            return m_numRelocatedGASs;
+        }
+        uint32_t getNumGeometryASs() const {
+            return static_cast<uint32_t>(m_geomASs.size());
+        }
+
+        // JP: 名前で検索する。見つからない場合は無効なオブジェクトを返す。
+        // EN: Find by name. Return an invalid object if not found.
+        optixu::GeometryInstance findGeometryInstance(const std::string &name) const;
+        optixu::GeometryAccelerationStructure findGeometryAS(const std::string &name) const;
+        optixu::InstanceAccelerationStructure findInstanceAS(const std::string &name) const;
+        optixu::Transform findTransform(const std::string &name) const;
+        optixu::Instance findInstance(const std::string &name) const;
+    };
+}
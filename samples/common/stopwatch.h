@@ -2,6 +2,18 @@
 
 #include <chrono>
 #include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <ostream>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 #include <stdint.h>
 
 using namespace std::chrono;
@@ -74,3 +86,394 @@ template <uint32_t MaxNumMeasurements = 512>
 using StopWatch = StopWatchTemplate<system_clock, MaxNumMeasurements>;
 template <uint32_t MaxNumMeasurements = 512>
 using StopWatchHiRes = StopWatchTemplate<high_resolution_clock, MaxNumMeasurements>;
+
+
+
+// JP: 複数スレッドから名前付きの入れ子区間を計測するCPUプロファイラー。
+//     各スレッドは自身専用のリングバッファーにロック無しで記録し、endFrame()を呼ぶスレッドが
+//     それらを回収してフレームごとの履歴にまとめる。ロックを取るのは各スレッドの初回記録時の登録のみ。
+//     区間名は文字列リテラルなどプロファイラーより長生きするものである必要がある。
+//     原点は最初のbeginFrame()なので、cudau::GpuProfilerと同時にbeginFrame()を呼べば
+//     両者のトレースの時間軸がおおよそ揃う。
+// EN: A CPU profiler measuring named nested scopes from multiple threads.
+//     Each thread records into its own ring buffer without locks, and the thread calling endFrame()
+//     collects them into per-frame history. A lock is taken only for registration at the first record of each thread.
+//     Scope names need to outlive the profiler, e.g. string literals.
+//     The origin is the first beginFrame(), so calling beginFrame() together with cudau::GpuProfiler
+//     roughly aligns the time axes of both traces.
+class CpuProfiler {
+public:
+    struct ScopeStats {
+        const char* name;
+        uint32_t threadIndex;
+        uint32_t depth;
+        // JP: フレーム開始からの開始時刻と長さ(ミリ秒)。他のスレッドの区間はフレーム開始前に始まり得る。
+        // EN: Start time from the frame begin and duration in milliseconds.
+        //     Scopes on other threads can begin before the frame begin.
+        float startTime;
+        float duration;
+    };
+    struct FrameStats {
+        uint64_t frameIndex;
+        // JP: 最初のフレームの開始からのフレーム開始時刻(ミリ秒)。
+        // EN: Frame begin time from the begin of the first frame in milliseconds.
+        double frameStartTime;
+        float frameDuration;
+        std::vector<ScopeStats> scopes;
+    };
+    // JP: 履歴中のフレームごとの合計時間(全スレッド、全出現の和)の統計。
+    // EN: Statistics of per-frame total time (sum over all threads and occurrences) in the history.
+    struct ScopeSummary {
+        const char* name;
+        uint32_t numFrames;
+        float avgCountPerFrame;
+        float minTime;
+        float avgTime;
+        float p99Time;
+    };
+
+private:
+    using Clock = steady_clock;
+
+    struct Event {
+        const char* name;
+        Clock::time_point beginTime;
+        Clock::time_point endTime;
+        uint32_t depth;
+    };
+    struct ThreadBuffer {
+        std::thread::id threadId;
+        std::string name;
+        uint32_t threadIndex;
+        // JP: 所有スレッドのみが触る。
+        // EN: Touched only by the owner thread.
+        uint32_t depth;
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> head;
+        // JP: 回収スレッドのみが触る。
+        // EN: Touched only by the collecting thread.
+        uint64_t tail;
+    };
+
+    uint64_t m_id;
+    uint32_t m_bufferCapacity;
+    mutable std::mutex m_registrationMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threadBuffers;
+    Clock::time_point m_origin;
+    Clock::time_point m_frameBeginTime;
+    uint32_t m_frameThreadIndex;
+    uint64_t m_frameIndex;
+    uint64_t m_numDroppedScopes;
+    uint32_t m_maxNumHistoryFrames;
+    std::deque<FrameStats> m_history;
+    bool m_originRecorded;
+    bool m_inFrame;
+
+    CpuProfiler(const CpuProfiler &) = delete;
+    CpuProfiler &operator=(const CpuProfiler &) = delete;
+
+    static uint64_t issueId() {
+        static std::atomic<uint64_t> s_nextId(1);
+        return s_nextId++;
+    }
+
+    ThreadBuffer* getThreadBuffer() {
+        struct Cache {
+            uint64_t profilerId;
+            ThreadBuffer* buffer;
+        };
+        static thread_local Cache s_cache = { 0, nullptr };
+        if (s_cache.profilerId == m_id)
+            return s_cache.buffer;
+
+        // JP: 同じスレッドが複数のプロファイラーを交互に使う場合に備え、まず既存のバッファーを探す。
+        // EN: Look up an existing buffer first in case the same thread uses multiple profilers alternately.
+        std::lock_guard<std::mutex> lock(m_registrationMutex);
+        const std::thread::id threadId = std::this_thread::get_id();
+        ThreadBuffer* buffer = nullptr;
+        for (const std::unique_ptr<ThreadBuffer> &b : m_threadBuffers) {
+            if (b->threadId == threadId) {
+                buffer = b.get();
+                break;
+            }
+        }
+        if (!buffer) {
+            auto newBuffer = std::make_unique<ThreadBuffer>();
+            newBuffer->threadId = threadId;
+            newBuffer->threadIndex = static_cast<uint32_t>(m_threadBuffers.size());
+            newBuffer->name = "Thread " + std::to_string(newBuffer->threadIndex);
+            newBuffer->depth = 0;
+            newBuffer->events = std::make_unique<Event[]>(m_bufferCapacity);
+            newBuffer->head = 0;
+            newBuffer->tail = 0;
+            buffer = newBuffer.get();
+            m_threadBuffers.push_back(std::move(newBuffer));
+        }
+        s_cache.profilerId = m_id;
+        s_cache.buffer = buffer;
+        return buffer;
+    }
+
+    void pushEvent(ThreadBuffer* buffer, const Event &event) {
+        uint64_t index = buffer->head.load(std::memory_order_relaxed);
+        buffer->events[index % m_bufferCapacity] = event;
+        buffer->head.store(index + 1, std::memory_order_release);
+    }
+
+    // JP: 前回の回収以降に完了した区間をfuncに渡す。回収中に上書きされた可能性のある区間は捨てる。
+    // EN: Pass scopes completed since the last collection to func.
+    //     Scopes possibly overwritten during the collection are discarded.
+    template <typename Func>
+    void collect(const Func &func) {
+        std::lock_guard<std::mutex> lock(m_registrationMutex);
+        for (const std::unique_ptr<ThreadBuffer> &buffer : m_threadBuffers) {
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t tail = buffer->tail;
+            if (head - tail > m_bufferCapacity) {
+                m_numDroppedScopes += head - m_bufferCapacity - tail;
+                tail = head - m_bufferCapacity;
+            }
+            std::vector<Event> events(head - tail);
+            for (uint64_t i = tail; i < head; ++i)
+                events[i - tail] = buffer->events[i % m_bufferCapacity];
+            uint64_t headAfterCopy = buffer->head.load(std::memory_order_acquire);
+            uint64_t validBegin = headAfterCopy > m_bufferCapacity ? headAfterCopy - m_bufferCapacity : 0;
+            for (uint64_t i = tail; i < head; ++i) {
+                if (i < validBegin) {
+                    ++m_numDroppedScopes;
+                    continue;
+                }
+                func(*buffer, events[i - tail]);
+            }
+            buffer->tail = head;
+        }
+    }
+
+    double toMilliseconds(Clock::time_point from, Clock::time_point to) const {
+        return duration_cast<nanoseconds>(to - from).count() * 1e-6;
+    }
+
+    static void writeEscaped(std::ostream &os, const std::string_view &str) {
+        for (char c : str) {
+            if (c == '"' || c == '\\')
+                os << '\\';
+            os << c;
+        }
+    }
+
+public:
+    // JP: bufferCapacityは各スレッドが回収の間に記録できる区間数の上限。
+    // EN: bufferCapacity is the maximum number of scopes each thread can record between collections.
+    CpuProfiler(uint32_t bufferCapacity = 16384, uint32_t maxNumHistoryFrames = 256) :
+        m_id(issueId()), m_bufferCapacity(bufferCapacity),
+        m_frameThreadIndex(0), m_frameIndex(0), m_numDroppedScopes(0),
+        m_maxNumHistoryFrames(maxNumHistoryFrames),
+        m_originRecorded(false), m_inFrame(false) {}
+
+    // JP: 呼び出したスレッドにトレース上の名前を付ける。
+    // EN: Name the calling thread in the trace.
+    void setThreadName(const char* name) {
+        ThreadBuffer* buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(m_registrationMutex);
+        buffer->name = name;
+    }
+
+    void beginFrame() {
+        if (m_inFrame)
+            throw std::runtime_error("beginFrame() has already been called.");
+        ThreadBuffer* buffer = getThreadBuffer();
+        m_frameBeginTime = Clock::now();
+        m_frameThreadIndex = buffer->threadIndex;
+        if (!m_originRecorded) {
+            // JP: 原点より前の区間は捨てる。
+            // EN: Discard scopes before the origin.
+            collect([](const ThreadBuffer &, const Event &) {});
+            m_origin = m_frameBeginTime;
+            m_originRecorded = true;
+        }
+        m_inFrame = true;
+    }
+
+    void endFrame() {
+        if (!m_inFrame)
+            throw std::runtime_error("beginFrame() has not been called.");
+        Clock::time_point frameEndTime = Clock::now();
+
+        FrameStats stats;
+        stats.frameIndex = m_frameIndex;
+        stats.frameStartTime = toMilliseconds(m_origin, m_frameBeginTime);
+        stats.frameDuration = static_cast<float>(toMilliseconds(m_frameBeginTime, frameEndTime));
+        collect([this, &stats](const ThreadBuffer &buffer, const Event &event) {
+            ScopeStats scope;
+            scope.name = event.name;
+            scope.threadIndex = buffer.threadIndex;
+            scope.depth = event.depth;
+            scope.startTime = static_cast<float>(toMilliseconds(m_frameBeginTime, event.beginTime));
+            scope.duration = static_cast<float>(toMilliseconds(event.beginTime, event.endTime));
+            stats.scopes.push_back(scope);
+        });
+        m_history.push_back(std::move(stats));
+        while (m_history.size() > m_maxNumHistoryFrames)
+            m_history.pop_front();
+
+        m_inFrame = false;
+        ++m_frameIndex;
+    }
+
+    // JP: CpuProfileScopeから呼ばれる。
+    // EN: Called from CpuProfileScope.
+    void* beginScope(uint32_t* depth) {
+        ThreadBuffer* buffer = getThreadBuffer();
+        *depth = buffer->depth++;
+        return buffer;
+    }
+    void endScope(void* threadBuffer, const char* name, uint32_t depth, Clock::time_point beginTime) {
+        ThreadBuffer* buffer = reinterpret_cast<ThreadBuffer*>(threadBuffer);
+        Event event;
+        event.name = name;
+        event.beginTime = beginTime;
+        event.endTime = Clock::now();
+        event.depth = depth;
+        --buffer->depth;
+        pushEvent(buffer, event);
+    }
+
+    bool getLatestFrameStats(FrameStats* stats) const {
+        if (m_history.empty())
+            return false;
+        *stats = m_history.back();
+        return true;
+    }
+    const std::deque<FrameStats> &getHistory() const {
+        return m_history;
+    }
+    uint64_t getNumDroppedScopes() const {
+        return m_numDroppedScopes;
+    }
+
+    void getScopeSummaries(std::vector<ScopeSummary>* summaries) const {
+        struct PerFrame {
+            const char* name;
+            std::vector<float> totals;
+            uint32_t count;
+        };
+        std::map<std::string_view, PerFrame> perName;
+        std::map<std::string_view, std::pair<float, uint32_t>> frameTotals;
+        for (const FrameStats &frame : m_history) {
+            frameTotals.clear();
+            for (const ScopeStats &scope : frame.scopes) {
+                std::pair<float, uint32_t> &total = frameTotals[scope.name];
+                total.first += scope.duration;
+                ++total.second;
+                perName.emplace(scope.name, PerFrame{ scope.name, {}, 0 });
+            }
+            for (const auto &it : frameTotals) {
+                PerFrame &pf = perName[it.first];
+                pf.totals.push_back(it.second.first);
+                pf.count += it.second.second;
+            }
+        }
+
+        summaries->clear();
+        for (auto &it : perName) {
+            PerFrame &pf = it.second;
+            std::sort(pf.totals.begin(), pf.totals.end());
+            const uint32_t n = static_cast<uint32_t>(pf.totals.size());
+            double sum = 0.0;
+            for (float t : pf.totals)
+                sum += t;
+            ScopeSummary summary;
+            summary.name = pf.name;
+            summary.numFrames = n;
+            summary.avgCountPerFrame = static_cast<float>(pf.count) / n;
+            summary.minTime = pf.totals.front();
+            summary.avgTime = static_cast<float>(sum / n);
+            summary.p99Time = pf.totals[std::max<uint32_t>(static_cast<uint32_t>(std::ceil(0.99 * n)), 1) - 1];
+            summaries->push_back(summary);
+        }
+    }
+
+    // JP: 解決済みの履歴をChromeのトレース形式のイベント列として書き出す。
+    //     cudau::GpuProfiler::writeChromeTraceEvents()と同じストリームに書けば一つのトレースにまとめられる。
+    // EN: Write the resolved history as a sequence of events in Chrome's trace format.
+    //     Writing into the same stream as cudau::GpuProfiler::writeChromeTraceEvents() merges them into one trace.
+    void writeChromeTraceEvents(std::ostream &os, bool* first, uint32_t pid = 1) const {
+        const auto separator = [&os, first]() {
+            os << (*first ? "" : ",") << "\n";
+            *first = false;
+        };
+
+        separator();
+        os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+           << ",\"args\":{\"name\":\"CPU\"}}";
+        {
+            std::lock_guard<std::mutex> lock(m_registrationMutex);
+            for (const std::unique_ptr<ThreadBuffer> &buffer : m_threadBuffers) {
+                separator();
+                os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                   << ",\"tid\":" << buffer->threadIndex << ",\"args\":{\"name\":\"";
+                writeEscaped(os, buffer->name);
+                os << "\"}}";
+            }
+        }
+
+        for (const FrameStats &frame : m_history) {
+            const double frameStart = frame.frameStartTime * 1000.0;
+            separator();
+            os << "{\"name\":\"Frame " << frame.frameIndex << "\",\"ph\":\"X\",\"pid\":" << pid
+               << ",\"tid\":" << m_frameThreadIndex
+               << ",\"ts\":" << frameStart << ",\"dur\":" << frame.frameDuration * 1000.0 << "}";
+            for (const ScopeStats &scope : frame.scopes) {
+                separator();
+                os << "{\"name\":\"";
+                writeEscaped(os, scope.name);
+                os << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << scope.threadIndex
+                   << ",\"ts\":" << frameStart + scope.startTime * 1000.0
+                   << ",\"dur\":" << scope.duration * 1000.0
+                   << ",\"args\":{\"depth\":" << scope.depth << "}}";
+            }
+        }
+    }
+
+    void writeChromeTrace(std::ostream &os) const {
+        os << "{\"traceEvents\":[";
+        bool first = true;
+        writeChromeTraceEvents(os, &first);
+        os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+};
+
+// JP: スコープの間だけ区間を計測するヘルパー。
+// EN: A helper to measure a range for the duration of the scope.
+class CpuProfileScope {
+    CpuProfiler* m_profiler;
+    void* m_threadBuffer;
+    const char* m_name;
+    uint32_t m_depth;
+    steady_clock::time_point m_beginTime;
+
+public:
+    CpuProfileScope(CpuProfiler* profiler, const char* name) :
+        m_profiler(profiler), m_name(name) {
+        if (m_profiler) {
+            m_threadBuffer = m_profiler->beginScope(&m_depth);
+            m_beginTime = steady_clock::now();
+        }
+    }
+    ~CpuProfileScope() {
+        if (m_profiler)
+            m_profiler->endScope(m_threadBuffer, m_name, m_depth, m_beginTime);
+    }
+};
+
+// JP: cudau::GpuProfilerなどwriteChromeTraceEvents()を持つプロファイラーとCPUの計測を一つのトレースにまとめる。
+// EN: Merge CPU measurements with a profiler having writeChromeTraceEvents(), e.g. cudau::GpuProfiler,
+//     into one trace.
+template <typename GpuProfilerType>
+void writeChromeTrace(std::ostream &os, const GpuProfilerType &gpuProfiler, const CpuProfiler &cpuProfiler) {
+    os << "{\"traceEvents\":[";
+    bool first = true;
+    gpuProfiler.writeChromeTraceEvents(os, &first, 0);
+    cpuProfiler.writeChromeTraceEvents(os, &first, 1);
+    os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
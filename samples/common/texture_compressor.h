@@ -0,0 +1,602 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: PNGやJPEGから読み込んだRGBA8の画像をアップロード時にGPU上でブロック圧縮するユーティリティー。
+//     一時的なRGBA8の配列にアップロードしてGPU上でミップマップを生成し、各レベルをBC1/BC3/BC4/BC5/BC7に圧縮して
+//     BCフォーマットの配列にサーフェス経由で直接書き込む。非圧縮のテクスチャーに比べてVRAMと帯域を4から8分の1にできる。
+//     品質はFast(バウンディングボックスの端点)、Normal(主軸に沿った端点)、High(主軸の後に最小二乗法で端点を改善)から選ぶ。
+//     BC1はアルファを無視する。BC7はモード6(単一サブセット、RGBA、4ビットインデックス)のみを使う。
+//     このファイルを使うサンプルはtexture_compressor_kernels.cuもPTXにコンパイルする。
+//
+//     texture_compressor::TextureCompressor compressor;
+//     compressor.initialize(compressorModule);
+//     cudau::Array array;
+//     compressor.compress(cuContext, stream, rgba8, width, height,
+//                         texture_compressor::Format::BC1, texture_compressor::Quality::Normal,
+//                         true, true, &array);
+//
+// EN: Utility to block-compress RGBA8 images loaded from PNG or JPEG on the GPU at upload.
+//     Upload into a temporary RGBA8 array, generate mipmaps on the GPU, then compress each level into
+//     BC1/BC3/BC4/BC5/BC7 and write directly to an array with a BC format via surfaces.
+//     This reduces VRAM and bandwidth to 1/4 to 1/8 compared to uncompressed textures.
+//     Choose the quality from Fast (bounding box endpoints), Normal (endpoints along the principal axis) and
+//     High (endpoints improved by least squares after the principal axis).
+//     BC1 ignores alpha. BC7 uses only mode 6 (single subset, RGBA, 4-bit indices).
+//     A sample using this file compiles texture_compressor_kernels.cu to PTX as well.
+//
+//     texture_compressor::TextureCompressor compressor;
+//     compressor.initialize(compressorModule);
+//     cudau::Array array;
+//     compressor.compress(cuContext, stream, rgba8, width, height,
+//                         texture_compressor::Format::BC1, texture_compressor::Quality::Normal,
+//                         true, true, &array);
+namespace texture_compressor {
+    enum class Format : uint32_t {
+        BC1 = 0, // RGB
+        BC3, // RGBA
+        BC4, // R
+        BC5, // RG
+        BC7, // RGBA
+    };
+
+    enum class Quality : uint32_t {
+        Fast = 0,
+        Normal,
+        High,
+    };
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    CUDA_DEVICE_FUNCTION float dot4(const float4 &a, const float4 &b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    }
+
+    CUDA_DEVICE_FUNCTION float4 saturate4(const float4 &v) {
+        return make_float4(fminf(fmaxf(v.x, 0.0f), 1.0f),
+                           fminf(fmaxf(v.y, 0.0f), 1.0f),
+                           fminf(fmaxf(v.z, 0.0f), 1.0f),
+                           fminf(fmaxf(v.w, 0.0f), 1.0f));
+    }
+
+    // JP: チャンネルマスクで有効なチャンネルに対して、16テクセルを近似する線分の端点を求める。
+    // EN: Find the endpoints of a line segment approximating 16 texels for the channels enabled by the mask.
+    CUDA_DEVICE_FUNCTION void fitEndpoints(
+        const float4 texels[16], const float4 &channelMask, Quality quality,
+        float4* e0, float4* e1) {
+        float4 minValue = make_float4(INFINITY, INFINITY, INFINITY, INFINITY);
+        float4 maxValue = make_float4(-INFINITY, -INFINITY, -INFINITY, -INFINITY);
+        float4 mean = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        for (uint32_t i = 0; i < 16; ++i) {
+            const float4 x = texels[i] * channelMask;
+            minValue = make_float4(fminf(minValue.x, x.x), fminf(minValue.y, x.y),
+                                   fminf(minValue.z, x.z), fminf(minValue.w, x.w));
+            maxValue = make_float4(fmaxf(maxValue.x, x.x), fmaxf(maxValue.y, x.y),
+                                   fmaxf(maxValue.z, x.z), fmaxf(maxValue.w, x.w));
+            mean += x;
+        }
+        mean /= 16.0f;
+
+        if (quality == Quality::Fast) {
+            *e0 = minValue;
+            *e1 = maxValue;
+            return;
+        }
+
+        // JP: 共分散行列の主軸をべき乗法で求める。
+        // EN: Find the principal axis of the covariance matrix by power iteration.
+        float cov[10] = {};
+        for (uint32_t i = 0; i < 16; ++i) {
+            const float4 d = texels[i] * channelMask - mean;
+            cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z; cov[3] += d.x * d.w;
+            cov[4] += d.y * d.y; cov[5] += d.y * d.z; cov[6] += d.y * d.w;
+            cov[7] += d.z * d.z; cov[8] += d.z * d.w;
+            cov[9] += d.w * d.w;
+        }
+        float4 axis = maxValue - minValue;
+        for (uint32_t iter = 0; iter < 8; ++iter) {
+            axis = make_float4(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z + cov[3] * axis.w,
+                               cov[1] * axis.x + cov[4] * axis.y + cov[5] * axis.z + cov[6] * axis.w,
+                               cov[2] * axis.x + cov[5] * axis.y + cov[7] * axis.z + cov[8] * axis.w,
+                               cov[3] * axis.x + cov[6] * axis.y + cov[8] * axis.z + cov[9] * axis.w);
+            const float maxComp = fmaxf(fmaxf(fabsf(axis.x), fabsf(axis.y)), fmaxf(fabsf(axis.z), fabsf(axis.w)));
+            if (maxComp < 1e-20f)
+                break;
+            axis /= maxComp;
+        }
+        const float sqLength = dot4(axis, axis);
+        if (sqLength < 1e-12f) {
+            *e0 = mean;
+            *e1 = mean;
+            return;
+        }
+        axis /= std::sqrt(sqLength);
+
+        float tMin = INFINITY;
+        float tMax = -INFINITY;
+        for (uint32_t i = 0; i < 16; ++i) {
+            const float t = dot4(texels[i] * channelMask - mean, axis);
+            tMin = fminf(tMin, t);
+            tMax = fmaxf(tMax, t);
+        }
+        *e0 = saturate4(mean + tMin * axis);
+        *e1 = saturate4(mean + tMax * axis);
+    }
+
+    // JP: 各テクセルの補間の重み(0でe0、1でe1)を固定して、二乗誤差を最小化する端点を求める。
+    // EN: Find the endpoints minimizing the squared error with fixed interpolation weights of texels
+    //     (0 for e0, 1 for e1).
+    CUDA_DEVICE_FUNCTION bool refineEndpoints(
+        const float4 texels[16], const float4 &channelMask, const float weights[16],
+        float4* e0, float4* e1) {
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        float4 r0 = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        float4 r1 = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        for (uint32_t i = 0; i < 16; ++i) {
+            const float w = weights[i];
+            const float4 x = texels[i] * channelMask;
+            a += (1 - w) * (1 - w);
+            b += (1 - w) * w;
+            c += w * w;
+            r0 += (1 - w) * x;
+            r1 += w * x;
+        }
+        const float det = a * c - b * b;
+        if (fabsf(det) < 1e-8f)
+            return false;
+        *e0 = saturate4((c * r0 - b * r1) / det);
+        *e1 = saturate4((a * r1 - b * r0) / det);
+        return true;
+    }
+
+
+
+    // JP: BC1/BC3のカラーブロック。
+    // EN: Color block of BC1/BC3.
+
+    CUDA_DEVICE_FUNCTION uint32_t quantizeRGB565(const float4 &c) {
+        const uint32_t r = min(static_cast<uint32_t>(c.x * 31 + 0.5f), 31u);
+        const uint32_t g = min(static_cast<uint32_t>(c.y * 63 + 0.5f), 63u);
+        const uint32_t b = min(static_cast<uint32_t>(c.z * 31 + 0.5f), 31u);
+        return (r << 11) | (g << 5) | b;
+    }
+
+    CUDA_DEVICE_FUNCTION float4 dequantizeRGB565(uint32_t c) {
+        const uint32_t r = (c >> 11) & 31;
+        const uint32_t g = (c >> 5) & 63;
+        const uint32_t b = c & 31;
+        return make_float4(((r << 3) | (r >> 2)) / 255.0f,
+                           ((g << 2) | (g >> 4)) / 255.0f,
+                           ((b << 3) | (b >> 2)) / 255.0f,
+                           0.0f);
+    }
+
+    // JP: 4色モードになるようにc0 > c1に並べ、各テクセルのインデックスを選んで二乗誤差を返す。
+    // EN: Order so that c0 > c1 for the 4-color mode, choose the index of each texel and return the squared error.
+    CUDA_DEVICE_FUNCTION float assignColorIndices(
+        const float4 texels[16], uint32_t* c0, uint32_t* c1, uint32_t* indices, float weights[16]) {
+        const float4 rgbMask = make_float4(1.0f, 1.0f, 1.0f, 0.0f);
+        if (*c0 < *c1) {
+            const uint32_t temp = *c0;
+            *c0 = *c1;
+            *c1 = temp;
+        }
+        const float4 p0 = dequantizeRGB565(*c0);
+        const float4 p1 = dequantizeRGB565(*c1);
+        const float4 palette[4] = {
+            p0, p1, (2.0f * p0 + p1) / 3.0f, (p0 + 2.0f * p1) / 3.0f
+        };
+        constexpr float paletteWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        const uint32_t numColors = *c0 == *c1 ? 1 : 4;
+
+        float error = 0.0f;
+        *indices = 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            const float4 x = texels[i] * rgbMask;
+            uint32_t bestIdx = 0;
+            float bestError = INFINITY;
+            for (uint32_t k = 0; k < numColors; ++k) {
+                const float4 d = x - palette[k];
+                const float e = dot4(d, d);
+                if (e < bestError) {
+                    bestError = e;
+                    bestIdx = k;
+                }
+            }
+            *indices |= bestIdx << (2 * i);
+            weights[i] = paletteWeights[bestIdx];
+            error += bestError;
+        }
+        return error;
+    }
+
+    CUDA_DEVICE_FUNCTION uint2 encodeColorBlock(const float4 texels[16], Quality quality) {
+        const float4 rgbMask = make_float4(1.0f, 1.0f, 1.0f, 0.0f);
+        float4 e0, e1;
+        fitEndpoints(texels, rgbMask, quality, &e0, &e1);
+        // JP: 端点を少し内側に寄せると補間色の量子化誤差が平均的に減る。
+        // EN: Insetting the endpoints slightly reduces the quantization error of the interpolated colors on average.
+        const float4 inset = (e1 - e0) / 16.0f;
+        e0 = saturate4(e0 + inset);
+        e1 = saturate4(e1 - inset);
+
+        uint32_t c0 = quantizeRGB565(e0);
+        uint32_t c1 = quantizeRGB565(e1);
+        uint32_t indices;
+        float weights[16];
+        float error = assignColorIndices(texels, &c0, &c1, &indices, weights);
+        if (quality == Quality::High) {
+            for (uint32_t iter = 0; iter < 2; ++iter) {
+                float4 f0, f1;
+                if (!refineEndpoints(texels, rgbMask, weights, &f0, &f1))
+                    break;
+                uint32_t newC0 = quantizeRGB565(f0);
+                uint32_t newC1 = quantizeRGB565(f1);
+                uint32_t newIndices;
+                float newWeights[16];
+                const float newError = assignColorIndices(texels, &newC0, &newC1, &newIndices, newWeights);
+                if (newError >= error)
+                    break;
+                c0 = newC0;
+                c1 = newC1;
+                indices = newIndices;
+                for (uint32_t i = 0; i < 16; ++i)
+                    weights[i] = newWeights[i];
+                error = newError;
+            }
+        }
+        return make_uint2(c0 | (c1 << 16), indices);
+    }
+
+
+
+    // JP: BC3のアルファブロック、BC4/BC5の単一チャンネルブロック。
+    // EN: Alpha block of BC3, single-channel block of BC4/BC5.
+
+    // JP: a0 > a1の8値モードで各テクセルのインデックスを選んで二乗誤差を返す。
+    // EN: Choose the index of each texel in the 8-value mode with a0 > a1 and return the squared error.
+    CUDA_DEVICE_FUNCTION float assignSingleChannelIndices(
+        const float values[16], int32_t a0, int32_t a1, uint64_t* indexBits) {
+        float palette[8];
+        palette[0] = a0 / 255.0f;
+        palette[1] = a1 / 255.0f;
+        for (int32_t k = 2; k < 8; ++k)
+            palette[k] = ((8 - k) * a0 + (k - 1) * a1) / (7 * 255.0f);
+
+        float error = 0.0f;
+        *indexBits = 0;
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t bestIdx = 0;
+            float bestError = INFINITY;
+            for (uint32_t k = 0; k < 8; ++k) {
+                const float d = values[i] - palette[k];
+                if (d * d < bestError) {
+                    bestError = d * d;
+                    bestIdx = k;
+                }
+            }
+            *indexBits |= static_cast<uint64_t>(bestIdx) << (3 * i);
+            error += bestError;
+        }
+        return error;
+    }
+
+    CUDA_DEVICE_FUNCTION uint2 encodeSingleChannelBlock(const float values[16], Quality quality) {
+        float minValue = values[0];
+        float maxValue = values[0];
+        for (uint32_t i = 1; i < 16; ++i) {
+            minValue = fminf(minValue, values[i]);
+            maxValue = fmaxf(maxValue, values[i]);
+        }
+        int32_t a0 = static_cast<int32_t>(fminf(fmaxf(maxValue, 0.0f), 1.0f) * 255 + 0.5f);
+        int32_t a1 = static_cast<int32_t>(fminf(fmaxf(minValue, 0.0f), 1.0f) * 255 + 0.5f);
+        if (a0 == a1)
+            return make_uint2(a0 | (a1 << 8), 0);
+
+        uint64_t indexBits;
+        float error = assignSingleChannelIndices(values, a0, a1, &indexBits);
+        // JP: 端点を内側にずらした組み合わせを試す。
+        // EN: Try combinations of endpoints shifted inward.
+        if (quality != Quality::Fast) {
+            const int32_t searchRange = quality == Quality::High ? 4 : 1;
+            const int32_t baseA0 = a0;
+            const int32_t baseA1 = a1;
+            for (int32_t d0 = 0; d0 <= searchRange; ++d0) {
+                for (int32_t d1 = 0; d1 <= searchRange; ++d1) {
+                    const int32_t newA0 = baseA0 - d0;
+                    const int32_t newA1 = baseA1 + d1;
+                    if ((d0 == 0 && d1 == 0) || newA0 <= newA1)
+                        continue;
+                    uint64_t newIndexBits;
+                    const float newError = assignSingleChannelIndices(values, newA0, newA1, &newIndexBits);
+                    if (newError < error) {
+                        a0 = newA0;
+                        a1 = newA1;
+                        indexBits = newIndexBits;
+                        error = newError;
+                    }
+                }
+            }
+        }
+        return make_uint2(a0 | (a1 << 8) | (static_cast<uint32_t>(indexBits) << 16),
+                          static_cast<uint32_t>(indexBits >> 16));
+    }
+
+
+
+    // JP: BC7のモード6のブロック。
+    // EN: Mode 6 block of BC7.
+
+    CUDA_CONSTANT_MEM uint32_t bc7Weights4[16] = {
+        0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+    };
+
+    struct BitWriter {
+        uint32_t words[4];
+        uint32_t position;
+
+        CUDA_DEVICE_FUNCTION BitWriter() : words{}, position(0) {}
+        CUDA_DEVICE_FUNCTION void put(uint32_t value, uint32_t numBits) {
+            for (uint32_t b = 0; b < numBits; ++b, ++position)
+                words[position >> 5] |= ((value >> b) & 1) << (position & 31);
+        }
+    };
+
+    // JP: 7ビットの値とpビットからなる端点に量子化する。pビットは4チャンネルで共有される。
+    // EN: Quantize into an endpoint consisting of 7-bit values and a p-bit. The p-bit is shared by 4 channels.
+    CUDA_DEVICE_FUNCTION void quantizeBC7Endpoint(const float4 &e, uint32_t q[4], uint32_t* pBit) {
+        const float v[4] = { e.x * 255, e.y * 255, e.z * 255, e.w * 255 };
+        float bestError = INFINITY;
+        for (uint32_t p = 0; p < 2; ++p) {
+            uint32_t cq[4];
+            float error = 0.0f;
+            for (uint32_t c = 0; c < 4; ++c) {
+                cq[c] = static_cast<uint32_t>(fminf(fmaxf((v[c] - p) * 0.5f + 0.5f, 0.0f), 127.0f));
+                const float d = static_cast<float>((cq[c] << 1) | p) - v[c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                for (uint32_t c = 0; c < 4; ++c)
+                    q[c] = cq[c];
+                *pBit = p;
+            }
+        }
+    }
+
+    CUDA_DEVICE_FUNCTION float assignBC7Indices(
+        const float4 texels[16],
+        const uint32_t q0[4], uint32_t p0, const uint32_t q1[4], uint32_t p1,
+        uint32_t indices[16], float weights[16]) {
+        float4 palette[16];
+        for (uint32_t k = 0; k < 16; ++k) {
+            const uint32_t w = bc7Weights4[k];
+            float v[4];
+            for (uint32_t c = 0; c < 4; ++c) {
+                const uint32_t v0 = (q0[c] << 1) | p0;
+                const uint32_t v1 = (q1[c] << 1) | p1;
+                v[c] = (((64 - w) * v0 + w * v1 + 32) >> 6) / 255.0f;
+            }
+            palette[k] = make_float4(v[0], v[1], v[2], v[3]);
+        }
+
+        float error = 0.0f;
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t bestIdx = 0;
+            float bestError = INFINITY;
+            for (uint32_t k = 0; k < 16; ++k) {
+                const float4 d = texels[i] - palette[k];
+                const float e = dot4(d, d);
+                if (e < bestError) {
+                    bestError = e;
+                    bestIdx = k;
+                }
+            }
+            indices[i] = bestIdx;
+            weights[i] = bc7Weights4[bestIdx] / 64.0f;
+            error += bestError;
+        }
+        return error;
+    }
+
+    CUDA_DEVICE_FUNCTION uint4 encodeBC7Block(const float4 texels[16], Quality quality) {
+        const float4 rgbaMask = make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+        float4 e0, e1;
+        fitEndpoints(texels, rgbaMask, quality, &e0, &e1);
+
+        uint32_t q0[4], q1[4];
+        uint32_t p0, p1;
+        quantizeBC7Endpoint(e0, q0, &p0);
+        quantizeBC7Endpoint(e1, q1, &p1);
+        uint32_t indices[16];
+        float weights[16];
+        float error = assignBC7Indices(texels, q0, p0, q1, p1, indices, weights);
+        if (quality == Quality::High) {
+            for (uint32_t iter = 0; iter < 2; ++iter) {
+                float4 f0, f1;
+                if (!refineEndpoints(texels, rgbaMask, weights, &f0, &f1))
+                    break;
+                uint32_t newQ0[4], newQ1[4];
+                uint32_t newP0, newP1;
+                quantizeBC7Endpoint(f0, newQ0, &newP0);
+                quantizeBC7Endpoint(f1, newQ1, &newP1);
+                uint32_t newIndices[16];
+                float newWeights[16];
+                const float newError = assignBC7Indices(texels, newQ0, newP0, newQ1, newP1, newIndices, newWeights);
+                if (newError >= error)
+                    break;
+                for (uint32_t c = 0; c < 4; ++c) {
+                    q0[c] = newQ0[c];
+                    q1[c] = newQ1[c];
+                }
+                p0 = newP0;
+                p1 = newP1;
+                for (uint32_t i = 0; i < 16; ++i) {
+                    indices[i] = newIndices[i];
+                    weights[i] = newWeights[i];
+                }
+                error = newError;
+            }
+        }
+
+        // JP: 最初のテクセルのインデックスの最上位ビットは暗黙的に0なので、必要なら端点を入れ替える。
+        // EN: The MSB of the index of the first texel is implicitly 0, so swap the endpoints if necessary.
+        if (indices[0] >= 8) {
+            for (uint32_t c = 0; c < 4; ++c) {
+                const uint32_t temp = q0[c];
+                q0[c] = q1[c];
+                q1[c] = temp;
+            }
+            const uint32_t temp = p0;
+            p0 = p1;
+            p1 = temp;
+            for (uint32_t i = 0; i < 16; ++i)
+                indices[i] = 15 - indices[i];
+        }
+
+        BitWriter writer;
+        writer.put(1 << 6, 7);
+        for (uint32_t c = 0; c < 4; ++c) {
+            writer.put(q0[c], 7);
+            writer.put(q1[c], 7);
+        }
+        writer.put(p0, 1);
+        writer.put(p1, 1);
+        writer.put(indices[0], 3);
+        for (uint32_t i = 1; i < 16; ++i)
+            writer.put(indices[i], 4);
+        return make_uint4(writer.words[0], writer.words[1], writer.words[2], writer.words[3]);
+    }
+
+    // JP: RGBA8のサーフェスから4x4ブロックを読み込み、圧縮してBCフォーマットの配列のサーフェスに書き込む。
+    // EN: Load a 4x4 block from an RGBA8 surface, compress it and write to the surface of an array with a BC format.
+    CUDA_DEVICE_FUNCTION void compressBlock(
+        CUsurfObject srcSurf, uint32_t srcWidth, uint32_t srcHeight,
+        CUsurfObject dstSurf, uint32_t blockX, uint32_t blockY,
+        Format format, Quality quality) {
+        float4 texels[16];
+        for (uint32_t i = 0; i < 16; ++i) {
+            const uint32_t x = min(4 * blockX + (i % 4), srcWidth - 1);
+            const uint32_t y = min(4 * blockY + (i / 4), srcHeight - 1);
+            const uchar4 v = surf2Dread<uchar4>(srcSurf, x * sizeof(uchar4), y);
+            texels[i] = make_float4(v.x / 255.0f, v.y / 255.0f, v.z / 255.0f, v.w / 255.0f);
+        }
+
+        float values[16];
+        if (format == Format::BC1) {
+            surf2Dwrite(encodeColorBlock(texels, quality), dstSurf, blockX * sizeof(uint2), blockY);
+        }
+        else if (format == Format::BC3) {
+            for (uint32_t i = 0; i < 16; ++i)
+                values[i] = texels[i].w;
+            const uint2 alphaBlock = encodeSingleChannelBlock(values, quality);
+            const uint2 colorBlock = encodeColorBlock(texels, quality);
+            surf2Dwrite(make_uint4(alphaBlock.x, alphaBlock.y, colorBlock.x, colorBlock.y),
+                        dstSurf, blockX * sizeof(uint4), blockY);
+        }
+        else if (format == Format::BC4) {
+            for (uint32_t i = 0; i < 16; ++i)
+                values[i] = texels[i].x;
+            surf2Dwrite(encodeSingleChannelBlock(values, quality), dstSurf, blockX * sizeof(uint2), blockY);
+        }
+        else if (format == Format::BC5) {
+            for (uint32_t i = 0; i < 16; ++i)
+                values[i] = texels[i].x;
+            const uint2 redBlock = encodeSingleChannelBlock(values, quality);
+            for (uint32_t i = 0; i < 16; ++i)
+                values[i] = texels[i].y;
+            const uint2 greenBlock = encodeSingleChannelBlock(values, quality);
+            surf2Dwrite(make_uint4(redBlock.x, redBlock.y, greenBlock.x, greenBlock.y),
+                        dstSurf, blockX * sizeof(uint4), blockY);
+        }
+        else /*if (format == Format::BC7)*/ {
+            surf2Dwrite(encodeBC7Block(texels, quality), dstSurf, blockX * sizeof(uint4), blockY);
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    inline cudau::ArrayElementType getArrayElementType(Format format) {
+        switch (format) {
+        case Format::BC1:
+            return cudau::ArrayElementType::BC1_UNorm;
+        case Format::BC3:
+            return cudau::ArrayElementType::BC3_UNorm;
+        case Format::BC4:
+            return cudau::ArrayElementType::BC4_UNorm;
+        case Format::BC5:
+            return cudau::ArrayElementType::BC5_UNorm;
+        case Format::BC7:
+            return cudau::ArrayElementType::BC7_UNorm;
+        default:
+            throw std::runtime_error("Invalid format.");
+        }
+    }
+
+    // JP: 各レベルの大きさが4の倍数である間だけミップレベルを作る。
+    //     CUDAはBCフォーマットの最小レベルを4x4と仮定しているように見えるので(Array::map()を参照)、
+    //     端数ブロックを持つレベルは作らない。
+    // EN: Make mip levels only while the size of each level is a multiple of 4.
+    //     CUDA seems to suppose that the smallest level of a BC format is 4x4 (see Array::map()),
+    //     so levels having fractional blocks are not made.
+    inline uint32_t calcNumMipmapLevels(uint32_t width, uint32_t height) {
+        uint32_t numLevels = 1;
+        while ((width >> numLevels) >= 4 && (height >> numLevels) >= 4 &&
+               (width >> numLevels) % 4 == 0 && (height >> numLevels) % 4 == 0)
+            ++numLevels;
+        return numLevels;
+    }
+
+    class TextureCompressor {
+        cudau::Kernel m_downsampleMipmap;
+        cudau::Kernel m_compressBlocks;
+
+    public:
+        void initialize(CUmodule compressorModule) {
+            m_downsampleMipmap.set(compressorModule, "downsampleMipmapRGBA8", cudau::dim3(8, 8), 0);
+            m_compressBlocks.set(compressorModule, "compressBlocks", cudau::dim3(8, 8), 0);
+        }
+        void finalize() {}
+
+        // JP: widthとheightは4の倍数である必要がある。dstArrayは未初期化の配列で、
+        //     サーフェスのロード/ストアを有効にしたBCフォーマットの2D配列として初期化される。
+        //     sRGBはミップマップ生成時のフィルターにのみ影響し、値は格納された色空間のまま圧縮される。
+        //     一時配列を解放するために、呼び出しから戻る前にストリームを同期する。
+        // EN: width and height need to be multiples of 4. dstArray is an uninitialized array, and is initialized
+        //     as a 2D array with a BC format and surface load/store enabled.
+        //     sRGB affects only the filter at mipmap generation, and values are compressed in the stored color space.
+        //     The stream is synchronized before returning to release the temporary array.
+        void compress(CUcontext cuContext, CUstream stream, const uint8_t* rgba8, uint32_t width, uint32_t height,
+                      Format format, Quality quality, bool generateMipmaps, bool sRGB,
+                      cudau::Array* dstArray) const {
+            if (width % 4 != 0 || height % 4 != 0)
+                throw std::runtime_error("Texture size must be a multiple of 4 for block compression.");
+            const uint32_t numMipmapLevels = generateMipmaps ? calcNumMipmapLevels(width, height) : 1;
+
+            cudau::Array srcArray;
+            srcArray.initialize2D(cuContext, cudau::ArrayElementType::UInt8, 4,
+                                  cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                  width, height, numMipmapLevels);
+            srcArray.write<uint8_t>(rgba8, width * height * 4, 0, stream);
+            if (numMipmapLevels > 1)
+                srcArray.generateMipmaps(stream, m_downsampleMipmap, cudau::MipmapFilter::Kaiser, sRGB);
+
+            dstArray->initialize2D(cuContext, getArrayElementType(format), 1,
+                                   cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                   width, height, numMipmapLevels);
+            for (uint32_t level = 0; level < numMipmapLevels; ++level) {
+                const uint32_t levelWidth = width >> level;
+                const uint32_t levelHeight = height >> level;
+                const uint32_t numBlocksX = levelWidth / 4;
+                const uint32_t numBlocksY = levelHeight / 4;
+                m_compressBlocks(stream, m_compressBlocks.calcGridDim(numBlocksX, numBlocksY),
+                                 srcArray.getSurfaceObject(level), levelWidth, levelHeight,
+                                 dstArray->getSurfaceObject(level), numBlocksX, numBlocksY,
+                                 format, quality);
+            }
+
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            srcArray.finalize();
+        }
+    };
+#endif
+}
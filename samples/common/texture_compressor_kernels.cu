@@ -0,0 +1,20 @@
+﻿#pragma once
+
+#include "texture_compressor.h"
+
+// JP: texture_compressor::TextureCompressorが使うカーネル。GPUでのテクスチャー圧縮を使うサンプルはこのファイルもPTXにコンパイルする。
+// EN: Kernels used by texture_compressor::TextureCompressor. A sample using GPU texture compression compiles
+//     this file to PTX as well.
+
+CUDAU_DEFINE_MIPMAP_KERNEL(downsampleMipmapRGBA8, uchar4)
+
+CUDA_DEVICE_KERNEL void compressBlocks(
+    CUsurfObject srcSurf, uint32_t srcWidth, uint32_t srcHeight,
+    CUsurfObject dstSurf, uint32_t numBlocksX, uint32_t numBlocksY,
+    texture_compressor::Format format, texture_compressor::Quality quality) {
+    const uint32_t blockX = blockDim.x * blockIdx.x + threadIdx.x;
+    const uint32_t blockY = blockDim.y * blockIdx.y + threadIdx.y;
+    if (blockX >= numBlocksX || blockY >= numBlocksY)
+        return;
+    texture_compressor::compressBlock(srcSurf, srcWidth, srcHeight, dstSurf, blockX, blockY, format, quality);
+}
@@ -0,0 +1,129 @@
+﻿#pragma once
+
+#include "common.h"
+
+// JP: 永続スレッド型のレイ生成のためのタイルワークキュー。
+//     ピクセルあたり1スレッドのローンチではガラスや髪の毛のような重いタイルがあると負荷が偏る。
+//     占有率に合わせた固定数のスレッドでローンチし、各スレッドはデバイス上のアトミックカウンターから
+//     キューが尽きるまでタイルインデックスを取得し、タイル内をモートン順に処理する。
+//
+//     tile_queue::TileQueueBuffer tileQueue;
+//     tileQueue.initialize(cuContext, cudau::BufferType::Device);
+//     plp.tileQueue = tileQueue.getTileQueue(imageSize, 3); // 8x8タイル
+//     tileQueue.reset(stream);
+//     pipeline.launch(stream, plpOnDevice, tile_queue::calcNumPersistentThreads(cuDevice), 1, 1);
+//
+//     // レイ生成プログラム
+//     tile_queue::processTiles(plp.tileQueue, [&](const uint2 &pixel) { /* ピクセルの処理 */ });
+//
+// EN: Tile work queue for persistent-thread ray generation.
+//     A launch with one thread per pixel leaves load imbalance when there are costly tiles like glass or hair.
+//     Launch with a fixed number of threads sized to occupancy, then each thread pulls tile indices from
+//     a device atomic counter until the queue is exhausted and processes the tile in Morton order.
+//
+//     tile_queue::TileQueueBuffer tileQueue;
+//     tileQueue.initialize(cuContext, cudau::BufferType::Device);
+//     plp.tileQueue = tileQueue.getTileQueue(imageSize, 3); // 8x8 tiles
+//     tileQueue.reset(stream);
+//     pipeline.launch(stream, plpOnDevice, tile_queue::calcNumPersistentThreads(cuDevice), 1, 1);
+//
+//     // Ray generation program
+//     tile_queue::processTiles(plp.tileQueue, [&](const uint2 &pixel) { /* process the pixel */ });
+namespace tile_queue {
+    struct TileQueue {
+        uint32_t* counter;
+        uint2 imageSize;
+        uint32_t numTilesX;
+        uint32_t numTiles;
+        uint32_t tileSizeLog2;
+    };
+
+    // JP: 偶数番目のビットを詰める。モートンコードから座標を取り出すのに使う。
+    // EN: Compact even bits. Used to extract a coordinate from a Morton code.
+    CUDA_DEVICE_FUNCTION uint32_t compactEvenBits(uint32_t v) {
+        v &= 0x55555555;
+        v = (v | (v >> 1)) & 0x33333333;
+        v = (v | (v >> 2)) & 0x0F0F0F0F;
+        v = (v | (v >> 4)) & 0x00FF00FF;
+        v = (v | (v >> 8)) & 0x0000FFFF;
+        return v;
+    }
+
+    CUDA_DEVICE_FUNCTION uint2 calcTilePixel(const TileQueue &queue, uint32_t tileIdx, uint32_t mortonIdx) {
+        uint32_t tileX = tileIdx % queue.numTilesX;
+        uint32_t tileY = tileIdx / queue.numTilesX;
+        return make_uint2((tileX << queue.tileSizeLog2) + compactEvenBits(mortonIdx),
+                          (tileY << queue.tileSizeLog2) + compactEvenBits(mortonIdx >> 1));
+    }
+
+#if defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: processPixelは画像内のピクセル座標を受け取る関数。画像の端からはみ出たピクセルは呼ばれない。
+    //     同じワープ内の隣り合うスレッドは隣り合うタイルの同じモートンインデックスを処理するので、
+    //     小さなタイルサイズ(4x4から8x8)の方がワープ内のレイのコヒーレンスは高い。
+    // EN: processPixel is a function receiving a pixel coordinate in the image.
+    //     It is not called for pixels outside the image edges.
+    //     Adjacent threads in the same warp process the same Morton index of adjacent tiles,
+    //     so a small tile size (4x4 to 8x8) gives higher coherence of rays within a warp.
+    template <typename ProcessPixel>
+    CUDA_DEVICE_FUNCTION void processTiles(const TileQueue &queue, ProcessPixel &&processPixel) {
+        const uint32_t numPixelsInTile = 1 << (2 * queue.tileSizeLog2);
+        while (true) {
+            uint32_t tileIdx = atomicAdd(queue.counter, 1u);
+            if (tileIdx >= queue.numTiles)
+                break;
+            for (uint32_t mortonIdx = 0; mortonIdx < numPixelsInTile; ++mortonIdx) {
+                uint2 pixel = calcTilePixel(queue, tileIdx, mortonIdx);
+                if (pixel.x >= queue.imageSize.x || pixel.y >= queue.imageSize.y)
+                    continue;
+                processPixel(pixel);
+            }
+        }
+    }
+#endif
+
+#if !defined(__CUDA_ARCH__) || defined(OPTIXU_Platform_CodeCompletion)
+    // JP: 全SMを埋めるのに必要なスレッド数。レイ生成プログラムのレジスター使用量によっては実際の占有率はより低いが、
+    //     余ったスレッドはキューが空なのを確認してすぐに終了するだけである。
+    // EN: The number of threads required to fill all the SMs. The actual occupancy may be lower depending on
+    //     the register usage of the ray generation program, but excess threads just find the queue empty and exit.
+    inline uint32_t calcNumPersistentThreads(CUdevice device) {
+        int32_t numSMs;
+        int32_t maxThreadsPerSM;
+        CUDADRV_CHECK(cuDeviceGetAttribute(&numSMs, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT, device));
+        CUDADRV_CHECK(cuDeviceGetAttribute(
+            &maxThreadsPerSM, CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR, device));
+        return static_cast<uint32_t>(numSMs * maxThreadsPerSM);
+    }
+
+    class TileQueueBuffer {
+        cudau::TypedBuffer<uint32_t> m_counter;
+
+    public:
+        void initialize(CUcontext cuContext, cudau::BufferType type) {
+            m_counter.initialize(cuContext, type, 1);
+        }
+        void finalize() {
+            m_counter.finalize();
+        }
+
+        // JP: ローンチの前に毎回呼ぶ必要がある。
+        // EN: This needs to be called every time before a launch.
+        void reset(CUstream stream) const {
+            CUDADRV_CHECK(cuMemsetD32Async(m_counter.getCUdeviceptr(), 0, 1, stream));
+        }
+
+        TileQueue getTileQueue(const uint2 &imageSize, uint32_t tileSizeLog2) const {
+            if (tileSizeLog2 > 8)
+                throw std::runtime_error("Tile size is too large.");
+            uint32_t tileSize = 1 << tileSizeLog2;
+            TileQueue ret;
+            ret.counter = m_counter.getDevicePointer();
+            ret.imageSize = imageSize;
+            ret.numTilesX = (imageSize.x + tileSize - 1) >> tileSizeLog2;
+            ret.numTiles = ret.numTilesX * ((imageSize.y + tileSize - 1) >> tileSizeLog2);
+            ret.tileSizeLog2 = tileSizeLog2;
+            return ret;
+        }
+    };
+#endif
+}
@@ -10,11 +10,44 @@ EN: This sample shows how to handle curves.
     OptiX supports three types of curves, linear, quadratic, and cubic B-splines.
     Curves consist of a vertex buffer and a buffer for the width at each vertex and an index buffer.
 
+    --curve-lod:
+    JP: 3次B-スプラインのストランドをcurve_lod::buildStrandLevels()で間引いたLODレベルごとにGASを作り、
+        カメラからの距離に応じてインスタンスの参照するGASを選ぶ。
+    EN: Build a GAS per LOD level of the cubic B-spline strands decimated by curve_lod::buildStrandLevels(),
+        and select the GAS the instance refers to according to the distance from the camera.
+    --curve-lod-level <level>:
+    JP: --curve-lodのレベルを距離によらず指定する。
+    EN: Specify the level of --curve-lod regardless of the distance.
+
 */
 
 #include "curve_primitive_shared.h"
 
+#include "../common/curve_lod.h"
+
 int32_t main(int32_t argc, const char* argv[]) try {
+    bool curveLod = false;
+    int32_t curveLodLevel = -1;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--curve-lod") {
+            curveLod = true;
+        }
+        else if (arg == "--curve-lod-level") {
+            if (argIdx + 1 >= argc)
+                throw std::runtime_error("Missing value for a command line argument.");
+            curveLod = true;
+            curveLodLevel = std::stoi(argv[argIdx + 1]);
+            ++argIdx;
+        }
+        else {
+            throw std::runtime_error("Unknown command line argument.");
+        }
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -159,7 +192,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
                                    std::vector<uint32_t>* indices,
                                    float xStart, float xEnd, uint32_t numX,
                                    float zStart, float zEnd, uint32_t numZ,
-                                   float baseWidth, uint32_t curveDegree)
+                                   float baseWidth, uint32_t curveDegree,
+                                   std::vector<uint32_t>* strandOffsets = nullptr)
     {
         std::mt19937 rng(390318410);
         std::uniform_int_distribution<uint32_t> uSeg(3, 5);
@@ -167,6 +201,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         vertices->clear();
         indices->clear();
+        if (strandOffsets)
+            strandOffsets->clear();
 
         const float deltaX = (xEnd - xStart) / numX;
         const float deltaZ = (zEnd - zStart) / numZ;
@@ -179,6 +215,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
                 uint32_t numSegments = uSeg(rng);
                 uint32_t indexStart = vertices->size();
+                if (strandOffsets)
+                    strandOffsets->push_back(indexStart);
 
                 // Beginning phantom points
                 if (curveDegree > 1) {
@@ -228,8 +266,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
                     indices->push_back(indexStart + s);
             }
         }
+        if (strandOffsets)
+            strandOffsets->push_back(vertices->size());
     };
 
+    constexpr uint32_t renderTargetSizeX = 1024;
+    constexpr uint32_t renderTargetSizeY = 1024;
+    const float3 cameraPosition = make_float3(0, 1.0f, 2.5f);
+    const float cameraFovY = 50 * M_PI / 180;
+
     uint32_t numX = 5;
     uint32_t numZ = 15;
     float baseWidth = 0.03f;
@@ -330,6 +375,62 @@ int32_t main(int32_t argc, const char* argv[]) try {
         cubicCurveGeomInst.setUserData(geomData);
     }
 
+    // JP: --curve-lodの場合は3次B-スプラインのストランドを間引いた粗いLODレベルを作る。
+    //     レベル0は上の元のカーブそのもの。
+    // EN: Create coarser LOD levels by decimating strands of the cubic B-splines for --curve-lod.
+    //     Level 0 is the original curves above.
+    constexpr uint32_t numCubicCurveLevels = 3;
+    const float cubicCurveKeepRatios[numCubicCurveLevels] = { 1.0f, 0.25f, 0.0625f };
+    optixu::GeometryInstance cubicCurveLodGeomInsts[numCubicCurveLevels - 1];
+    cudau::TypedBuffer<Shared::CurveVertex> cubicCurveLodVertexBuffers[numCubicCurveLevels - 1];
+    cudau::TypedBuffer<uint32_t> cubicCurveLodSegmentIndexBuffers[numCubicCurveLevels - 1];
+    if (curveLod) {
+        if (curveLodLevel >= static_cast<int32_t>(numCubicCurveLevels))
+            throw std::runtime_error("Curve LOD level is out of range.");
+
+        std::vector<Shared::CurveVertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> strandOffsets;
+        generateCurves(&vertices, &indices,
+                       -1.0f / 3.0f + 0.05f, 1.0f / 3.0f - 0.05f, numX,
+                       -1.0f + 0.05f, 1.0f - 0.05f, numZ,
+                       baseWidth, 3, &strandOffsets);
+
+        std::vector<curve_lod::StrandLevel<Shared::CurveVertex>> levels;
+        curve_lod::buildStrandLevels(
+            vertices.data(), strandOffsets.data(), static_cast<uint32_t>(strandOffsets.size() - 1), 3,
+            cubicCurveKeepRatios, numCubicCurveLevels, 0, &levels);
+
+        for (uint32_t level = 1; level < numCubicCurveLevels; ++level) {
+            const curve_lod::StrandLevel<Shared::CurveVertex> &srcLevel = levels[level];
+            optixu::GeometryInstance &geomInst = cubicCurveLodGeomInsts[level - 1];
+            cudau::TypedBuffer<Shared::CurveVertex> &vertexBuffer = cubicCurveLodVertexBuffers[level - 1];
+            cudau::TypedBuffer<uint32_t> &segmentIndexBuffer = cubicCurveLodSegmentIndexBuffers[level - 1];
+            hpprintf("Curve LOD %u: %u strands, %u segments, width x%.2f\n",
+                     level, srcLevel.numStrands,
+                     static_cast<uint32_t>(srcLevel.segmentIndices.size()), srcLevel.widthScale);
+
+            vertexBuffer.initialize(cuContext, cudau::BufferType::Device, srcLevel.vertices);
+            segmentIndexBuffer.initialize(cuContext, cudau::BufferType::Device, srcLevel.segmentIndices);
+
+            Shared::GeometryData geomData = {};
+            geomData.curveVertexBuffer = vertexBuffer.getDevicePointer();
+            geomData.segmentIndexBuffer = segmentIndexBuffer.getDevicePointer();
+
+            geomInst = scene.createGeometryInstance(optixu::GeometryType::CubicBSplines);
+            geomInst.setVertexBuffer(optixu::BufferView(
+                vertexBuffer.getCUdeviceptr() + offsetof(Shared::CurveVertex, position),
+                vertexBuffer.numElements(), vertexBuffer.stride()));
+            geomInst.setWidthBuffer(optixu::BufferView(
+                vertexBuffer.getCUdeviceptr() + offsetof(Shared::CurveVertex, width),
+                vertexBuffer.numElements(), vertexBuffer.stride()));
+            geomInst.setSegmentIndexBuffer(segmentIndexBuffer);
+            geomInst.setMaterial(0, 0, matForCubicCurves);
+            geomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
+            geomInst.setUserData(geomData);
+        }
+    }
+
 
 
     size_t maxSizeOfScratchBuffer = 0;
@@ -390,6 +491,23 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cubicCurvesGasMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
 
+    optixu::GeometryAccelerationStructure cubicCurvesLodGases[numCubicCurveLevels - 1];
+    cudau::Buffer cubicCurvesLodGasMems[numCubicCurveLevels - 1];
+    if (curveLod) {
+        for (uint32_t i = 0; i < numCubicCurveLevels - 1; ++i) {
+            optixu::GeometryAccelerationStructure &gas = cubicCurvesLodGases[i];
+            gas = scene.createGeometryAccelerationStructure(optixu::GeometryType::CubicBSplines);
+            gas.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, false, useVertexData);
+            gas.setNumMaterialSets(1);
+            gas.setNumRayTypes(0, Shared::NumRayTypes);
+            gas.addChild(cubicCurveLodGeomInsts[i]);
+            gas.prepareForBuild(&asMemReqs);
+            cubicCurvesLodGasMems[i].initialize(
+                cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
+            maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
+        }
+    }
+
 
 
     // JP: GASを元にインスタンスを作成する。
@@ -424,6 +542,29 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cubicCurvesInst.setChild(cubicCurvesGas);
     cubicCurvesInst.setTransform(cubicCurvesInstXfm);
 
+    // JP: カメラからインスタンスの中心までの距離でLODレベルを選ぶ。
+    // EN: Select a LOD level by the distance from the camera to the center of the instance.
+    if (curveLod) {
+        uint32_t level = 0;
+        if (curveLodLevel >= 0) {
+            level = curveLodLevel;
+        }
+        else {
+            float lodDistances[numCubicCurveLevels];
+            curve_lod::calcLevelDistances(
+                cubicCurveKeepRatios, numCubicCurveLevels, baseWidth, cameraFovY, renderTargetSizeY, 1.0f,
+                lodDistances);
+            const float3 instCenter = make_float3(
+                cubicCurvesInstXfm[3], cubicCurvesInstXfm[7], cubicCurvesInstXfm[11]);
+            const float distance = length(instCenter - cameraPosition);
+            while (level + 1 < numCubicCurveLevels && distance > lodDistances[level])
+                ++level;
+        }
+        hpprintf("Curve LOD: use level %u\n", level);
+        if (level > 0)
+            cubicCurvesInst.setChild(cubicCurvesLodGases[level - 1]);
+    }
+
 
 
     // JP: Instance Acceleration Structureを生成する。
@@ -455,6 +596,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
     linearCurvesGas.rebuild(cuStream, linearCurvesGasMem, asBuildScratchMem);
     quadraticCurvesGas.rebuild(cuStream, quadraticCurvesGasMem, asBuildScratchMem);
     cubicCurvesGas.rebuild(cuStream, cubicCurvesGasMem, asBuildScratchMem);
+    if (curveLod) {
+        for (uint32_t i = 0; i < numCubicCurveLevels - 1; ++i)
+            cubicCurvesLodGases[i].rebuild(cuStream, cubicCurvesLodGasMems[i], asBuildScratchMem);
+    }
 
     // JP: 静的なメッシュはコンパクションもしておく。
     //     複数のメッシュのASをひとつのバッファーに詰めて記録する。
@@ -516,8 +661,6 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
-    constexpr uint32_t renderTargetSizeX = 1024;
-    constexpr uint32_t renderTargetSizeY = 1024;
     optixu::HostBlockBuffer2D<Shared::PCG32RNG, 4> rngBuffer;
     rngBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX, renderTargetSizeY);
     {
@@ -543,9 +686,9 @@ int32_t main(int32_t argc, const char* argv[]) try {
     plp.imageSize.y = renderTargetSizeY;
     plp.rngBuffer = rngBuffer.getBlockBuffer2D();
     plp.accumBuffer = accumBuffer.getBlockBuffer2D();
-    plp.camera.fovY = 50 * M_PI / 180;
+    plp.camera.fovY = cameraFovY;
     plp.camera.aspect = static_cast<float>(renderTargetSizeX) / renderTargetSizeY;
-    plp.camera.position = make_float3(0, 1.0f, 2.5f);
+    plp.camera.position = cameraPosition;
     plp.camera.orientation = rotateX3x3(-M_PI / 8) * rotateY3x3(M_PI);
     //plp.camera.position = make_float3(0, 0.01f, 2.5f);
     //plp.camera.orientation = rotateY3x3(M_PI);
@@ -592,11 +735,21 @@ int32_t main(int32_t argc, const char* argv[]) try {
     floorInst.destroy();
 
     asBuildScratchMem.finalize();
+    for (int i = numCubicCurveLevels - 2; i >= 0; --i) {
+        cubicCurvesLodGasMems[i].finalize();
+        cubicCurvesLodGases[i].destroy();
+    }
     cubicCurvesGas.destroy();
     quadraticCurvesGas.destroy();
     linearCurvesGas.destroy();
     floorGas.destroy();
 
+    for (int i = numCubicCurveLevels - 2; i >= 0; --i) {
+        cubicCurveLodSegmentIndexBuffers[i].finalize();
+        cubicCurveLodVertexBuffers[i].finalize();
+        cubicCurveLodGeomInsts[i].destroy();
+    }
+
     cubicCurveSegmentIndexBuffer.finalize();
     cubicCurveVertexBuffer.finalize();
     cubicCurveGeomInst.destroy();
@@ -10,11 +10,37 @@ EN: This sample shows how to handle custom primitives other than triangles or cu
     but in the case of custom primitives the user writes own program to test intersection.
     A geometry acceleration structure is built over an array of AABBs, where each encloses a primitive.
 
+    --intersection-shapes:
+    JP: 球の代わりにintersection.hの5種類の形状を並べる。
+    EN: Line up the five kinds of shapes in intersection.h instead of spheres.
+    --brick-volume:
+    JP: 球の代わりに疎なブリックマップ(brick_map::HostBrickMap)のボリュームを置き、
+        空でないブリックのAABBをカスタムプリミティブとして、ヒットしたブリックの区間だけをマーチする。
+    EN: Place a volume as a sparse brick map (brick_map::HostBrickMap) instead of spheres,
+        make AABBs of non-empty bricks custom primitives, and march only intervals of hit bricks.
+
 */
 
 #include "custom_primitive_shared.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    bool useIntersectionShapes = false;
+    bool useBrickVolume = false;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--intersection-shapes")
+            useIntersectionShapes = true;
+        else if (arg == "--brick-volume")
+            useBrickVolume = true;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        ++argIdx;
+    }
+    if (useIntersectionShapes && useBrickVolume)
+        throw std::runtime_error("--intersection-shapes and --brick-volume cannot be used together.");
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -34,9 +60,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     // JP: カスタムプリミティブとの衝突判定を使うためプリミティブ種別のフラグを適切に設定する必要がある。
     // EN: Appropriately setting primitive type flags is required since this sample uses custom primitive intersection.
-    pipeline.setPipelineOptions(optixu::calcSumDwords<PayloadSignature>(),
-                                std::max(optixu::calcSumDwords<float2>(),
-                                         optixu::calcSumDwords<SphereAttributeSignature>()),
+    pipeline.setPipelineOptions(std::max(optixu::calcSumDwords<PayloadSignature>(),
+                                         optixu::calcSumDwords<VolumePayloadSignature>()),
+                                std::max({ optixu::calcSumDwords<float2>(),
+                                           optixu::calcSumDwords<SphereAttributeSignature>(),
+                                           optixu::calcSumDwords<brick_map::BrickAttributeType>() }),
                                 "plp", sizeof(Shared::PipelineLaunchParameters),
                                 false, OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING,
                                 OPTIX_EXCEPTION_FLAG_STACK_OVERFLOW | OPTIX_EXCEPTION_FLAG_TRACE_DEPTH |
@@ -51,9 +79,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     optixu::Module emptyModule;
 
-    optixu::ProgramGroup rayGenProgram = pipeline.createRayGenProgram(moduleOptiX, RT_RG_NAME_STR("raygen"));
+    optixu::ProgramGroup rayGenProgram = pipeline.createRayGenProgram(
+        moduleOptiX, useBrickVolume ? RT_RG_NAME_STR("raygenVolume") : RT_RG_NAME_STR("raygen"));
     //optixu::ProgramGroup exceptionProgram = pipeline.createExceptionProgram(moduleOptiX, "__exception__print");
     optixu::ProgramGroup missProgram = pipeline.createMissProgram(moduleOptiX, RT_MS_NAME_STR("miss"));
+    optixu::ProgramGroup missProgramForVolume = pipeline.createMissProgram(moduleOptiX, RT_MS_NAME_STR("missVolume"));
 
     optixu::ProgramGroup hitProgramGroupForTriangles = pipeline.createHitProgramGroupForBuiltinIS(
         OPTIX_PRIMITIVE_TYPE_TRIANGLE,
@@ -67,6 +97,24 @@ int32_t main(int32_t argc, const char* argv[]) try {
         emptyModule, nullptr,
         moduleOptiX, RT_IS_NAME_STR("intersectSphere"));
 
+    // JP: --intersection-shapes用にintersection.hのルーチンを使うヒットグループ。
+    // EN: Hit group using the routines in intersection.h for --intersection-shapes.
+    optixu::ProgramGroup hitProgramGroupForShapes = pipeline.createHitProgramGroupForCustomIS(
+        moduleOptiX, RT_CH_NAME_STR("closesthitShape"),
+        emptyModule, nullptr,
+        moduleOptiX, RT_IS_NAME_STR("intersectShape"));
+
+    // JP: --brick-volume用にブリックの区間を返すヒットグループ。
+    //     ボリューム用のレイは他のマテリアルには当たらないので、既定のヒットグループは空のものにする。
+    // EN: Hit group returning the interval of a brick for --brick-volume.
+    //     Rays for the volume don't hit other materials, so make the default hit group an empty one.
+    optixu::ProgramGroup hitProgramGroupForBricks = pipeline.createHitProgramGroupForCustomIS(
+        moduleOptiX, RT_CH_NAME_STR("closesthitBrick"),
+        emptyModule, nullptr,
+        moduleOptiX, RT_IS_NAME_STR("intersectBrick"));
+    optixu::ProgramGroup emptyHitProgramGroup = pipeline.createEmptyHitProgramGroup();
+    pipeline.setDefaultHitGroup(Shared::RayType_Volume, emptyHitProgramGroup);
+
     // JP: このサンプルはRay Generation Programからしかレイトレースを行わないのでTrace Depthは1になる。
     // EN: Trace depth is 1 because this sample trace rays only from the ray generation program.
     pipeline.link(1, DEBUG_SELECT(OPTIX_COMPILE_DEBUG_LEVEL_FULL, OPTIX_COMPILE_DEBUG_LEVEL_NONE));
@@ -76,6 +124,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     //pipeline.setExceptionProgram(exceptionProgram);
     pipeline.setNumMissRayTypes(Shared::NumRayTypes);
     pipeline.setMissProgram(Shared::RayType_Primary, missProgram);
+    pipeline.setMissProgram(Shared::RayType_Volume, missProgramForVolume);
 
     cudau::Buffer shaderBindingTable;
     size_t sbtSize;
@@ -97,6 +146,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
     matForTriangles.setHitGroup(Shared::RayType_Primary, hitProgramGroupForTriangles);
     optixu::Material matForSpheres = optixContext.createMaterial();
     matForSpheres.setHitGroup(Shared::RayType_Primary, hitProgramGroupForSpheres);
+    optixu::Material matForShapes = optixContext.createMaterial();
+    matForShapes.setHitGroup(Shared::RayType_Primary, hitProgramGroupForShapes);
+    optixu::Material matForBricks = optixContext.createMaterial();
+    matForBricks.setHitGroup(Shared::RayType_Primary, emptyHitProgramGroup);
+    matForBricks.setHitGroup(Shared::RayType_Volume, hitProgramGroupForBricks);
 
     // END: Setup materials.
     // ----------------------------------------------------------------
@@ -245,6 +299,130 @@ int32_t main(int32_t argc, const char* argv[]) try {
         spheresGeomInst.setUserData(geomData);
     }
 
+    // JP: --intersection-shapesでは球の代わりに5種類の形状を並べる。AABBはintersection::BoundsFunctorを
+    //     使うカーネルで求める。
+    // EN: With --intersection-shapes, line up the five kinds of shapes instead of spheres.
+    //     AABBs are computed by a kernel using intersection::BoundsFunctor.
+    optixu::GeometryInstance shapesGeomInst;
+    cudau::TypedBuffer<OptixAabb> shapesAabbBuffer;
+    cudau::TypedBuffer<Shared::ShapeParameter> shapesParamBuffer;
+    if (useIntersectionShapes) {
+        constexpr uint32_t numPrimitives = 25;
+        shapesGeomInst = scene.createGeometryInstance(optixu::GeometryType::CustomPrimitives);
+        shapesAabbBuffer.initialize(cuContext, cudau::BufferType::Device, numPrimitives);
+        shapesParamBuffer.initialize(cuContext, cudau::BufferType::Device, numPrimitives);
+
+        Shared::ShapeParameter* shapes = shapesParamBuffer.map();
+        std::mt19937 rng(1290527201);
+        std::uniform_real_distribution u01;
+        for (int i = 0; i < numPrimitives; ++i) {
+            Shared::ShapeParameter &shape = shapes[i];
+            float x = -0.8f + 1.6f * (i % 5) / 4.0f;
+            float y = -0.8f + 1.6f * u01(rng);
+            float z = -0.8f + 1.6f * (i / 5) / 4.0f;
+            float3 center = make_float3(x, y, z);
+            float size = 0.1f + 0.1f * (u01(rng) - 0.5f);
+            shape.type = static_cast<Shared::ShapeType>(i % Shared::NumShapeTypes);
+            switch (shape.type) {
+            case Shared::ShapeType_Sphere:
+                shape.sphere.center = center;
+                shape.sphere.radius = size;
+                break;
+            case Shared::ShapeType_Disc:
+                shape.disc.center = center;
+                shape.disc.normal = normalize(make_float3(0.0f, 1.0f, 1.0f));
+                shape.disc.radius = size;
+                break;
+            case Shared::ShapeType_Box:
+                shape.box.minP = center - make_float3(0.8f * size);
+                shape.box.maxP = center + make_float3(0.8f * size);
+                break;
+            case Shared::ShapeType_Capsule:
+                shape.capsule.p0 = center - make_float3(size, 0.0f, 0.0f);
+                shape.capsule.p1 = center + make_float3(size, 0.0f, 0.0f);
+                shape.capsule.radius = 0.5f * size;
+                break;
+            default:
+                shape.roundedQuad.center = center;
+                shape.roundedQuad.halfAxisU = make_float3(size, 0.0f, 0.0f);
+                shape.roundedQuad.halfAxisV = make_float3(0.0f, size * std::sqrt(0.5f), -size * std::sqrt(0.5f));
+                shape.roundedQuad.cornerRadius = 0.3f * size;
+                break;
+            }
+        }
+        shapesParamBuffer.unmap();
+
+        CUmodule moduleShapeAABBs;
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleShapeAABBs,
+            (getExecutableDirectory() / "custom_primitive/ptxes/shape_aabbs.ptx").string().c_str()));
+        cudau::Kernel computeShapeAABBs(moduleShapeAABBs, "computeShapeAABBs", cudau::AutoBlockDim(), 0);
+        OptixAabb* aabbBufferPointer = shapesAabbBuffer.getDevicePointer();
+        cudau::TypedBuffer<OptixAabb*> aabbBufferPointers;
+        aabbBufferPointers.initialize(cuContext, cudau::BufferType::Device, &aabbBufferPointer, 1);
+        computeShapeAABBs(cuStream, computeShapeAABBs.calcGridDim(numPrimitives),
+                          shapesParamBuffer.getDevicePointer(), aabbBufferPointers.getDevicePointer(),
+                          numPrimitives);
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+        aabbBufferPointers.finalize();
+        CUDADRV_CHECK(cuModuleUnload(moduleShapeAABBs));
+
+        Shared::GeometryData geomData = {};
+        geomData.shapeAabbBuffer = shapesAabbBuffer.getDevicePointer();
+        geomData.shapeBuffer = shapesParamBuffer.getDevicePointer();
+
+        shapesGeomInst.setCustomPrimitiveAABBBuffer(shapesAabbBuffer);
+        shapesGeomInst.setNumMaterials(1, optixu::BufferView());
+        shapesGeomInst.setMaterial(0, 0, matForShapes);
+        shapesGeomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
+        shapesGeomInst.setUserData(geomData);
+    }
+
+    // JP: --brick-volumeでは球と同じ位置に置いた煙の塊をブリックマップに格納する。
+    //     塊の間の空のブリックはプールにもGASにも含まれない。
+    // EN: With --brick-volume, store puffs of smoke placed at the same positions as the spheres into a brick map.
+    //     Empty bricks between puffs are included in neither the pool nor the GAS.
+    brick_map::HostBrickMap brickVolume;
+    optixu::GeometryInstance brickVolumeGeomInst;
+    if (useBrickVolume) {
+        constexpr uint32_t numPuffs = 25;
+        float3 puffCenters[numPuffs];
+        float puffRadii[numPuffs];
+        std::mt19937 rng(1290527201);
+        std::uniform_real_distribution u01;
+        for (int i = 0; i < numPuffs; ++i) {
+            float x = -0.8f + 1.6f * (i % 5) / 4.0f;
+            float y = -0.8f + 1.6f * u01(rng);
+            float z = -0.8f + 1.6f * (i / 5) / 4.0f;
+            puffCenters[i] = make_float3(x, y, z);
+            puffRadii[i] = 1.5f * (0.1f + 0.1f * (u01(rng) - 0.5f));
+        }
+
+        constexpr uint32_t resolution = 96;
+        const float3 origin = make_float3(-1.0f);
+        const float voxelSize = 2.0f / resolution;
+        brickVolume.build(
+            cuContext, cuStream, make_uint3(resolution, resolution, resolution), origin, voxelSize,
+            [&](int32_t x, int32_t y, int32_t z) {
+                float3 p = origin + voxelSize * make_float3(x + 0.5f, y + 0.5f, z + 0.5f);
+                float density = 0.0f;
+                for (int i = 0; i < numPuffs; ++i)
+                    density = std::max(density, 1.0f - length(p - puffCenters[i]) / puffRadii[i]);
+                return density;
+            }, 0.0f);
+
+        size_t poolSize, denseSize;
+        brickVolume.getMemoryUsage(&poolSize, &denseSize);
+        hpprintf("Brick volume: %u bricks, pool %.2f MB (dense %.2f MB)\n",
+                 brickVolume.getNumBricks(), poolSize / (1024.0f * 1024.0f), denseSize / (1024.0f * 1024.0f));
+
+        brickVolumeGeomInst = scene.createGeometryInstance(optixu::GeometryType::CustomPrimitives);
+        brickVolume.setupGeometryInstance(brickVolumeGeomInst);
+        brickVolumeGeomInst.setNumMaterials(1, optixu::BufferView());
+        brickVolumeGeomInst.setMaterial(0, 0, matForBricks);
+        brickVolumeGeomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
+    }
+
 
 
     size_t maxSizeOfScratchBuffer = 0;
@@ -274,7 +452,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
     customPrimitivesGas.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, true, false);
     customPrimitivesGas.setNumMaterialSets(1);
     customPrimitivesGas.setNumRayTypes(0, Shared::NumRayTypes);
-    customPrimitivesGas.addChild(spheresGeomInst);
+    if (useBrickVolume)
+        customPrimitivesGas.addChild(brickVolumeGeomInst);
+    else
+        customPrimitivesGas.addChild(useIntersectionShapes ? shapesGeomInst : spheresGeomInst);
     customPrimitivesGas.prepareForBuild(&asMemReqs);
     customPrimitivesGasMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
     maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
@@ -288,6 +469,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     optixu::Instance customPrimitivesInst = scene.createInstance();
     customPrimitivesInst.setChild(customPrimitivesGas);
+    if (useBrickVolume) {
+        roomInst.setVisibilityMask(Shared::VisibilityGroup_Surface);
+        customPrimitivesInst.setVisibilityMask(Shared::VisibilityGroup_Volume);
+    }
 
 
 
@@ -391,6 +576,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
     plp.camera.aspect = static_cast<float>(renderTargetSizeX) / renderTargetSizeY;
     plp.camera.position = make_float3(0, 0, 3.5);
     plp.camera.orientation = rotateY3x3(M_PI);
+    if (useBrickVolume) {
+        plp.volume = brickVolume.getBrickMap();
+        plp.volumeDensityScale = 20.0f;
+    }
 
     pipeline.setScene(scene);
     pipeline.setHitGroupShaderBindingTable(hitGroupSBT, hitGroupSBT.getMappedPointer());
@@ -431,6 +620,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
     customPrimitivesGas.destroy();
     roomGas.destroy();
 
+    brickVolumeGeomInst.destroy();
+    brickVolume.finalize();
+
+    shapesParamBuffer.finalize();
+    shapesAabbBuffer.finalize();
+    shapesGeomInst.destroy();
+
     spheresParamBuffer.finalize();
     spheresAabbBuffer.finalize();
     spheresGeomInst.destroy();
@@ -445,6 +641,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     scene.destroy();
 
+    matForBricks.destroy();
+    matForShapes.destroy();
     matForSpheres.destroy();
     matForTriangles.destroy();
 
@@ -452,9 +650,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     shaderBindingTable.finalize();
 
+    emptyHitProgramGroup.destroy();
+    hitProgramGroupForBricks.destroy();
+    hitProgramGroupForShapes.destroy();
     hitProgramGroupForSpheres.destroy();
     hitProgramGroupForTriangles.destroy();
 
+    missProgramForVolume.destroy();
     missProgram.destroy();
     rayGenProgram.destroy();
 
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "../common/common.h"
+#include "../common/intersection.h"
+#include "../common/brick_map.h"
 
 namespace Shared {
     static constexpr float Pi = 3.14159265358979323846f;
@@ -9,9 +11,18 @@ namespace Shared {
 
     enum RayType {
         RayType_Primary = 0,
+        RayType_Volume,
         NumRayTypes
     };
 
+    // JP: --brick-volumeではボリュームのブリックを別の可視性グループに置き、表面とは別のレイで辿る。
+    // EN: With --brick-volume, bricks of the volume are placed in a separate visibility group
+    //     and traversed by rays separate from surfaces.
+    enum VisibilityGroup {
+        VisibilityGroup_Surface = 1 << 0,
+        VisibilityGroup_Volume = 1 << 1,
+    };
+
 
 
     struct Vertex {
@@ -30,6 +41,43 @@ namespace Shared {
         float texCoordMultiplier;
     };
 
+    // JP: --intersection-shapesで使う、intersection.hの形状のいずれかを持つプリミティブ。
+    // EN: Primitive holding one of the shapes in intersection.h used with --intersection-shapes.
+    enum ShapeType : uint32_t {
+        ShapeType_Sphere = 0,
+        ShapeType_Disc,
+        ShapeType_Box,
+        ShapeType_Capsule,
+        ShapeType_RoundedQuad,
+        NumShapeTypes
+    };
+
+    struct ShapeParameter {
+        ShapeType type;
+        union {
+            intersection::Sphere sphere;
+            intersection::Disc disc;
+            intersection::Box box;
+            intersection::Capsule capsule;
+            intersection::RoundedQuad roundedQuad;
+        };
+
+        CUDA_DEVICE_FUNCTION AABB calcAABB() const {
+            switch (type) {
+            case ShapeType_Sphere:
+                return sphere.calcAABB();
+            case ShapeType_Disc:
+                return disc.calcAABB();
+            case ShapeType_Box:
+                return box.calcAABB();
+            case ShapeType_Capsule:
+                return capsule.calcAABB();
+            default:
+                return roundedQuad.calcAABB();
+            }
+        }
+    };
+
 
 
     struct PerspectiveCamera {
@@ -51,6 +99,10 @@ namespace Shared {
                 const AABB* aabbBuffer;
                 const SphereParameter* paramBuffer;
             };
+            struct {
+                const OptixAabb* shapeAabbBuffer;
+                const ShapeParameter* shapeBuffer;
+            };
         };
     };
 
@@ -62,8 +114,13 @@ namespace Shared {
         int2 imageSize; // Note that CUDA/OptiX built-in vector types with width 2 require 8-byte alignment.
         optixu::BlockBuffer2D<float4, 1> resultBuffer;
         PerspectiveCamera camera;
+        brick_map::BrickMap volume;
+        float volumeDensityScale;
     };
 }
 
 #define SphereAttributeSignature float, float
 #define PayloadSignature float3
+// JP: ブリックに入る距離、出る距離とスロット。ミスの場合はスロットがinvalidSlotになる。
+// EN: Distances entering and exiting a brick, and the slot. The slot becomes invalidSlot on miss.
+#define VolumePayloadSignature float, float, uint32_t
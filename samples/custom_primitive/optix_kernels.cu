@@ -80,16 +80,52 @@ CUDA_DEVICE_KERNEL void RT_IS_NAME(intersectSphere)() {
     optixu::reportIntersection<SphereAttributeSignature>(t, isFront ? 0 : 1, theta, phi);
 }
 
-CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen)() {
-    uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+// JP: intersection.hのルーチンによる交差判定。アトリビュートは使わずヒット種別のみを報告する。
+// EN: Intersection test by the routines in intersection.h. Only the hit kind is reported without attributes.
+CUDA_DEVICE_KERNEL void RT_IS_NAME(intersectShape)() {
+    auto sbtr = HitGroupSBTRecordData::get();
+    const GeometryData &geom = sbtr.geomData;
+    const ShapeParameter &shape = geom.shapeBuffer[optixGetPrimitiveIndex()];
+    switch (shape.type) {
+    case ShapeType_Sphere:
+        intersection::intersectAndReport(shape.sphere);
+        break;
+    case ShapeType_Disc:
+        intersection::intersectAndReport(shape.disc);
+        break;
+    case ShapeType_Box:
+        intersection::intersectAndReport(shape.box);
+        break;
+    case ShapeType_Capsule:
+        intersection::intersectAndReport(shape.capsule);
+        break;
+    default:
+        intersection::intersectAndReport(shape.roundedQuad);
+        break;
+    }
+}
 
+// JP: --brick-volumeで使うブリックとの交差判定。プリミティブインデックスがブリックのスロットになる。
+// EN: Intersection test with bricks used with --brick-volume. The primitive index becomes the slot of a brick.
+CUDA_DEVICE_KERNEL void RT_IS_NAME(intersectBrick)() {
+    brick_map::intersectAndReportBrick(plp.volume);
+}
+
+CUDA_DEVICE_FUNCTION void generateCameraRay(const uint2 &launchIndex, float3* origin, float3* direction) {
     float x = static_cast<float>(launchIndex.x + 0.5f) / plp.imageSize.x;
     float y = static_cast<float>(launchIndex.y + 0.5f) / plp.imageSize.y;
     float vh = 2 * std::tan(plp.camera.fovY * 0.5f);
     float vw = plp.camera.aspect * vh;
 
-    float3 origin = plp.camera.position;
-    float3 direction = normalize(plp.camera.orientation * make_float3(vw * (0.5f - x), vh * (0.5f - y), 1));
+    *origin = plp.camera.position;
+    *direction = normalize(plp.camera.orientation * make_float3(vw * (0.5f - x), vh * (0.5f - y), 1));
+}
+
+CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen)() {
+    uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+
+    float3 origin, direction;
+    generateCameraRay(launchIndex, &origin, &direction);
 
     float3 color;
     optixu::trace<PayloadSignature>(
@@ -101,11 +137,66 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen)() {
     plp.resultBuffer[launchIndex] = make_float4(color, 1.0f);
 }
 
+// JP: 表面の色を求めた後、ボリュームのブリックだけを辿るレイを繰り返し飛ばし、
+//     ヒットしたブリックの区間の中だけでマーチして光学的距離を積算する。空の領域はトラバーサルが飛ばす。
+//     このサンプルのボリュームは部屋の中にあり、カメラから見て表面より手前にあるので表面までの距離は考慮しない。
+// EN: After computing the surface color, repeatedly trace rays traversing only the bricks of the volume,
+//     and march only within the interval of a hit brick to accumulate the optical depth.
+//     Traversal skips empty space. The volume of this sample is in the room and in front of surfaces
+//     when viewed from the camera, so the distance to a surface is not considered.
+CUDA_DEVICE_KERNEL void RT_RG_NAME(raygenVolume)() {
+    uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+
+    float3 origin, direction;
+    generateCameraRay(launchIndex, &origin, &direction);
+
+    float3 color;
+    optixu::trace<PayloadSignature>(
+        plp.travHandle, origin, direction,
+        0.0f, FLT_MAX, 0.0f, VisibilityGroup_Surface, OPTIX_RAY_FLAG_NONE,
+        RayType_Primary, NumRayTypes, RayType_Primary,
+        color);
+
+    const float stepSize = 0.5f * plp.volume.voxelSize;
+    float opticalDepth = 0.0f;
+    float tMin = 0.0f;
+    while (opticalDepth < 10.0f) {
+        float tEnter;
+        float tExit;
+        uint32_t slot;
+        optixu::trace<VolumePayloadSignature>(
+            plp.travHandle, origin, direction,
+            tMin, FLT_MAX, 0.0f, VisibilityGroup_Volume, OPTIX_RAY_FLAG_DISABLE_ANYHIT,
+            RayType_Volume, NumRayTypes, RayType_Volume,
+            tEnter, tExit, slot);
+        if (slot == brick_map::invalidSlot)
+            break;
+
+        brick_map::marchBrick(
+            plp.volume, slot, origin, direction, tEnter, tExit, stepSize, 0.5f,
+            [&](float t, float density) {
+                opticalDepth += plp.volumeDensityScale * density * stepSize;
+                return opticalDepth < 10.0f;
+            });
+        tMin = tExit;
+    }
+
+    const float transmittance = std::exp(-opticalDepth);
+    color = transmittance * color + (1 - transmittance) * make_float3(0.9f);
+
+    plp.resultBuffer[launchIndex] = make_float4(color, 1.0f);
+}
+
 CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
     float3 color = make_float3(0, 0, 0.1f);
     optixu::setPayloads<PayloadSignature>(&color);
 }
 
+CUDA_DEVICE_KERNEL void RT_MS_NAME(missVolume)() {
+    uint32_t slot = brick_map::invalidSlot;
+    optixu::setPayloads<VolumePayloadSignature>(nullptr, nullptr, &slot);
+}
+
 CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
     auto sbtr = HitGroupSBTRecordData::get();
     const GeometryData &geom = sbtr.geomData;
@@ -140,3 +231,47 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
     float3 color = 0.5f * sn + make_float3(0.5f);
     optixu::setPayloads<PayloadSignature>(&color);
 }
+
+CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthitShape)() {
+    auto sbtr = HitGroupSBTRecordData::get();
+    const GeometryData &geom = sbtr.geomData;
+    const ShapeParameter &shape = geom.shapeBuffer[optixGetPrimitiveIndex()];
+
+    // JP: 法線はオブジェクト空間のヒット位置から求め直す。平面形状は裏面から見た場合に法線を反転する。
+    // EN: Recompute the normal from the hit position in object space.
+    //     Flip the normal of planar shapes when viewed from the back face.
+    float3 p = intersection::getObjectSpaceHitPoint();
+    float3 sn;
+    switch (shape.type) {
+    case ShapeType_Sphere:
+        sn = shape.sphere.calcNormal(p);
+        break;
+    case ShapeType_Disc:
+        sn = shape.disc.calcNormal(p);
+        break;
+    case ShapeType_Box:
+        sn = shape.box.calcNormal(p);
+        break;
+    case ShapeType_Capsule:
+        sn = shape.capsule.calcNormal(p);
+        break;
+    default:
+        sn = shape.roundedQuad.calcNormal(p);
+        break;
+    }
+    if (!intersection::isFrontFaceHit() &&
+        (shape.type == ShapeType_Disc || shape.type == ShapeType_RoundedQuad))
+        sn = -sn;
+
+    sn = normalize(optixTransformNormalFromObjectToWorldSpace(sn));
+
+    float3 color = 0.5f * sn + make_float3(0.5f);
+    optixu::setPayloads<PayloadSignature>(&color);
+}
+
+CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthitBrick)() {
+    float tEnter = optixGetRayTmax();
+    float tExit = brick_map::getBrickExitDistance();
+    uint32_t slot = optixGetPrimitiveIndex();
+    optixu::setPayloads<VolumePayloadSignature>(&tEnter, &tExit, &slot);
+}
@@ -0,0 +1,13 @@
+﻿#pragma once
+
+#include "custom_primitive_shared.h"
+
+using namespace Shared;
+
+// JP: --intersection-shapesの各形状のAABBをintersection::BoundsFunctorで求める。
+// EN: Compute AABBs of the shapes for --intersection-shapes with intersection::BoundsFunctor.
+CUDA_DEVICE_KERNEL void computeShapeAABBs(
+    const ShapeParameter* shapes, OptixAabb* const* aabbBuffers, uint32_t numShapes) {
+    optixu::computeCustomPrimitiveAABBs(
+        intersection::BoundsFunctor<ShapeParameter>{ shapes }, aabbBuffers, 1, 0.0f, 0.0f, numShapes);
+}
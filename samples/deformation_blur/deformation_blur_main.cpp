@@ -6,13 +6,37 @@ JP: このサンプルはデフォーメーション(変形)ブラーを扱うGA
 EN: This sample shows how to build a GAS to handle deformation blur.
     Set a vertex (or AABB) buffer to each of multiple motion steps of GeometryInstance and
     set appropriate motion configuration to a GAS to build a GAS capable of deformation blur.
+
+    --checkpoint <path>:
+    JP: 蓄積と乱数の状態をrender_checkpoint::Checkpointerで定期的に保存し、既存のチェックポイントがあれば
+        そのフレームから蓄積を再開する。
+    EN: Periodically save the accumulation and RNG states with render_checkpoint::Checkpointer,
+        and resume the accumulation from the frame of an existing checkpoint if any.
 */
 
 #include "deformation_blur_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/render_checkpoint.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    std::filesystem::path checkpointPath;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--checkpoint") {
+            if (argIdx + 1 >= argc)
+                throw std::runtime_error("Missing value for a command line argument.");
+            checkpointPath = argv[argIdx + 1];
+            ++argIdx;
+        }
+        else {
+            throw std::runtime_error("Unknown command line argument.");
+        }
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -583,12 +607,38 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUdeviceptr plpOnDevice;
     CUDADRV_CHECK(cuMemAlloc(&plpOnDevice, sizeof(plp)));
 
-    for (int frameIndex = 0; frameIndex < 1024; ++frameIndex) {
+    constexpr uint32_t numFrames = 1024;
+
+    // JP: タグには蓄積の結果を左右する設定を含め、異なる設定のチェックポイントからは再開しない。
+    // EN: The tag includes settings affecting the accumulation results so as not to resume
+    //     from a checkpoint with different settings.
+    render_checkpoint::Checkpointer checkpointer;
+    uint32_t startFrameIndex = 0;
+    if (!checkpointPath.empty()) {
+        const uint64_t compatibilityTag =
+            (static_cast<uint64_t>(renderTargetSizeX) << 48) |
+            (static_cast<uint64_t>(renderTargetSizeY) << 32) |
+            numFrames;
+        checkpointer.initialize(cuContext, checkpointPath, 10.0f, compatibilityTag);
+        checkpointer.addLayer("accum", accumBuffer);
+        checkpointer.addLayer("rng", rngBuffer);
+        if (checkpointer.resume(cuStream, &startFrameIndex))
+            hpprintf("Resumed from frame %u.\n", startFrameIndex);
+        else
+            startFrameIndex = 0;
+    }
+
+    for (uint32_t frameIndex = startFrameIndex; frameIndex < numFrames; ++frameIndex) {
         plp.numAccumFrames = frameIndex;
         CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
         pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        if (!checkpointPath.empty())
+            checkpointer.update(cuStream, frameIndex + 1);
     }
+    if (!checkpointPath.empty() && startFrameIndex < numFrames)
+        checkpointer.save(cuStream, numFrames);
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+    checkpointer.finalize();
 
     saveImage("output.png", accumBuffer, false, false);
 
@@ -14,10 +14,42 @@ EN: This sample shows how to use the denoiser.
 
 #include "../common/obj_loader.h"
 #include "../common/dds_loader.h"
+#include "../common/preview_upscaler.h"
+#include "../common/frame_budget.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../../ext/stb_image.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    BenchmarkOptions benchOptions;
+    uint32_t previewScaleDivisor = 0;
+    bool useFrameBudget = false;
+    float targetFrameTime = 0.0f;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        if (parseBenchmarkArgument(argc, argv, &argIdx, &benchOptions))
+            continue;
+        std::string_view arg = argv[argIdx];
+        if (arg == "--preview-upscale") {
+            if (argIdx + 1 >= argc)
+                throw std::runtime_error("Missing value for a command line argument.");
+            previewScaleDivisor = std::max(std::atoi(argv[argIdx + 1]), 1);
+            argIdx += 2;
+            continue;
+        }
+        if (arg == "--frame-budget") {
+            if (argIdx + 1 >= argc)
+                throw std::runtime_error("Missing value for a command line argument.");
+            useFrameBudget = true;
+            targetFrameTime = static_cast<float>(std::atof(argv[argIdx + 1]));
+            argIdx += 2;
+            continue;
+        }
+        // JP: このサンプルは従来通りベンチマーク以外の引数を無視する。
+        // EN: This sample ignores arguments other than the benchmark ones as before.
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -31,6 +63,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
     CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
 
+    BenchmarkRecorder bench;
+    if (benchOptions.enabled)
+        bench.initialize(cuContext, "denoiser", benchOptions);
+
     optixu::Context optixContext = optixu::Context::create(cuContext);
 
     optixu::Pipeline pipeline = optixContext.createPipeline();
@@ -497,9 +533,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     // JP: Geometry Acceleration Structureをビルドする。
     // EN: Build geometry acceleration structures.
+    bench.start(BenchmarkRecorder::Stage::ASBuild, cuStream);
     room.optixGas.rebuild(cuStream, room.gasMem, asBuildScratchMem);
     areaLight.optixGas.rebuild(cuStream, areaLight.gasMem, asBuildScratchMem);
     bunny.optixGas.rebuild(cuStream, bunny.gasMem, asBuildScratchMem);
+    bench.stop(BenchmarkRecorder::Stage::ASBuild, cuStream);
 
     // JP: 静的なメッシュはコンパクションもしておく。
     //     複数のメッシュのASをひとつのバッファーに詰めて記録する。
@@ -525,11 +563,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
     }
     cudau::Buffer compactedASMem;
     compactedASMem.initialize(cuContext, cudau::BufferType::Device, compactedASMemOffset, 1);
+    bench.start(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     for (int i = 0; i < lengthof(gasList); ++i) {
         const CompactedASInfo &info = gasList[i];
         info.geom->optixGas.compact(cuStream, optixu::BufferView(compactedASMem.getCUdeviceptr() + info.offset,
                                                       info.size, 1));
     }
+    bench.stop(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     // JP: removeUncompacted()はcompact()がデバイス上で完了するまでホスト側で待つので呼び出しを分けたほうが良い。
     // EN: removeUncompacted() waits on host-side until the compact() completes on the device,
     //     so separating calls is recommended.
@@ -544,13 +584,20 @@ int32_t main(int32_t argc, const char* argv[]) try {
     //     確定している必要がある。
     // EN: Traversable handle and offset in the shader binding table must be fixed for each instance
     //     when building an IAS.
+    StopWatchHiRes<> sbtStopWatch;
+    sbtStopWatch.start();
     cudau::Buffer hitGroupSBT;
     size_t hitGroupSbtSize;
     scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
     hitGroupSBT.initialize(cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
     hitGroupSBT.setMappedMemoryPersistent(true);
+    bench.record(BenchmarkRecorder::Stage::SBTSetup,
+                 sbtStopWatch.getElapsed(StopWatchDurationType::Microseconds) * 1e-3f);
+    sbtStopWatch.stop();
 
+    bench.start(BenchmarkRecorder::Stage::ASBuild, cuStream);
     OptixTraversableHandle travHandle = ias.rebuild(cuStream, instanceBuffer, iasMem, asBuildScratchMem);
+    bench.stop(BenchmarkRecorder::Stage::ASBuild, cuStream);
 
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
@@ -622,7 +669,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cudau::Buffer denoiserScratchBuffer;
     denoiserStateBuffer.initialize(cuContext, cudau::BufferType::Device, stateSize, 1);
     denoiserScratchBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                     std::max(scratchSize, scratchSizeForComputeIntensity), 1);
+                                     denoiser.getSharedScratchBufferSize(), 1);
 
     std::vector<optixu::DenoisingTask> denoisingTasks(numTasks);
     denoiser.getTasks(denoisingTasks.data());
@@ -663,90 +710,349 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
-    cudau::Timer timerRender;
-    cudau::Timer timerDenoise;
-    timerRender.initialize(cuContext);
-    timerDenoise.initialize(cuContext);
-    
-    // JP: レンダリング
-    // EN: Render
-    constexpr uint32_t numSamples = 8;
-    timerRender.start(cuStream);
-    for (int frameIndex = 0; frameIndex < numSamples; ++frameIndex) {
-        plp.numAccumFrames = frameIndex;
-        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
-        pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+    if (bench.isEnabled()) {
+        // JP: ベンチマークモードでは固定のカメラパスに沿って描画とデノイズを行い、結果をJSONに書き出す。
+        //     トレースしたレイ数にはプライマリーレイのみを数える。
+        // EN: Render and denoise along the fixed camera path in the benchmark mode and write the results to JSON.
+        //     Only primary rays are counted as traced rays.
+        constexpr uint32_t numSamples = 8;
+        cudau::dim3 dimCopyBuffers = kernelCopyBuffers.calcGridDim(renderTargetSizeX, renderTargetSizeY);
+        std::vector<float4> denoisedPixels(renderTargetSizeX * renderTargetSizeY);
+        bench.setImageSize(renderTargetSizeX, renderTargetSizeY);
+        while (!bench.isFinished()) {
+            bench.beginFrame();
+            calcBenchmarkCameraPose(bench.getFrameIndex(), bench.getNumTotalFrames(),
+                                    make_float3(0, 0, 0), 2.5f, 0.3f,
+                                    &plp.camera.position, &plp.camera.orientation);
+            bench.start(BenchmarkRecorder::Stage::Launch, cuStream);
+            for (int frameIndex = 0; frameIndex < numSamples; ++frameIndex) {
+                plp.numAccumFrames = frameIndex;
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+                pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+            }
+            bench.stop(BenchmarkRecorder::Stage::Launch, cuStream);
+            kernelCopyBuffers(cuStream, dimCopyBuffers,
+                              colorAccumBuffer.getSurfaceObject(0),
+                              albedoAccumBuffer.getSurfaceObject(0),
+                              normalAccumBuffer.getSurfaceObject(0),
+                              linearColorBuffer.getDevicePointer(),
+                              linearAlbedoBuffer.getDevicePointer(),
+                              linearNormalBuffer.getDevicePointer(),
+                              uint2(renderTargetSizeX, renderTargetSizeY));
+            bench.start(BenchmarkRecorder::Stage::Denoise, cuStream);
+            denoiser.computeIntensity(cuStream,
+                                      linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                      hdrIntensity);
+            for (int i = 0; i < denoisingTasks.size(); ++i)
+                denoiser.invoke(cuStream,
+                                false, hdrIntensity, 0.0f,
+                                linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                linearAlbedoBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                linearNormalBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT4,
+                                optixu::BufferView(),
+                                linearOutputBuffer,
+                                denoisingTasks[i]);
+            bench.stop(BenchmarkRecorder::Stage::Denoise, cuStream);
+            bench.start(BenchmarkRecorder::Stage::Readback, cuStream);
+            linearOutputBuffer.read(denoisedPixels, cuStream);
+            bench.stop(BenchmarkRecorder::Stage::Readback, cuStream);
+            bench.endFrame(static_cast<uint64_t>(numSamples) * renderTargetSizeX * renderTargetSizeY);
+        }
+        bench.write();
+        bench.finalize();
     }
+    else {
+        cudau::Timer timerRender;
+        cudau::Timer timerDenoise;
+        timerRender.initialize(cuContext);
+        timerDenoise.initialize(cuContext);
+    
+        // JP: レンダリング
+        // EN: Render
+        constexpr uint32_t numSamples = 8;
+        timerRender.start(cuStream);
+        for (int frameIndex = 0; frameIndex < numSamples; ++frameIndex) {
+            plp.numAccumFrames = frameIndex;
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+            pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        }
 
-    // JP: 結果をリニアバッファーにコピーする。(法線の正規化も行う。)
-    // EN: Copy the results to the linear buffers (and normalize normals).
-    cudau::dim3 dimCopyBuffers = kernelCopyBuffers.calcGridDim(renderTargetSizeX, renderTargetSizeY);
-    kernelCopyBuffers(cuStream, dimCopyBuffers,
-                      colorAccumBuffer.getSurfaceObject(0),
-                      albedoAccumBuffer.getSurfaceObject(0),
-                      normalAccumBuffer.getSurfaceObject(0),
-                      linearColorBuffer.getDevicePointer(),
-                      linearAlbedoBuffer.getDevicePointer(),
-                      linearNormalBuffer.getDevicePointer(),
-                      uint2(renderTargetSizeX, renderTargetSizeY));
-    timerRender.stop(cuStream);
-
-    // JP: パストレーシング結果のデノイズ。
-    //     毎フレーム呼ぶ必要があるのはcomputeIntensity()とinvoke()。
-    //     computeIntensity()は自作することもできる。
-    //     サイズが足りていればcomputeIntensity()のスクラッチバッファーとしてデノイザーのものが再利用できる。
-    // EN: Denoise the path tracing result.
-    //     computeIntensity() and invoke() should be calld every frame.
-    //     You can also create a custom computeIntensity().
-    //     Reusing the scratch buffer for denoising for computeIntensity() is possible if its size is enough.
-    timerDenoise.start(cuStream);
-    denoiser.computeIntensity(cuStream,
-                              linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                              denoiserScratchBuffer, hdrIntensity);
-    for (int i = 0; i < denoisingTasks.size(); ++i)
-        denoiser.invoke(cuStream,
-                        false, hdrIntensity, 0.0f,
-                        linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                        linearAlbedoBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                        linearNormalBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                        optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT4,
-                        optixu::BufferView(),
-                        linearOutputBuffer,
-                        denoisingTasks[i]);
-    timerDenoise.stop(cuStream);
-
-    CUDADRV_CHECK(cuStreamSynchronize(cuStream));
-
-    hpprintf("Render %u [spp]: %.3f[ms]\n", numSamples, timerRender.report());
-    hpprintf("Denoise: %.3f[ms]\n", timerDenoise.report());
-
-    timerDenoise.finalize();
-    timerRender.finalize();
-
-
+        // JP: 結果をリニアバッファーにコピーする。(法線の正規化も行う。)
+        // EN: Copy the results to the linear buffers (and normalize normals).
+        cudau::dim3 dimCopyBuffers = kernelCopyBuffers.calcGridDim(renderTargetSizeX, renderTargetSizeY);
+        kernelCopyBuffers(cuStream, dimCopyBuffers,
+                          colorAccumBuffer.getSurfaceObject(0),
+                          albedoAccumBuffer.getSurfaceObject(0),
+                          normalAccumBuffer.getSurfaceObject(0),
+                          linearColorBuffer.getDevicePointer(),
+                          linearAlbedoBuffer.getDevicePointer(),
+                          linearNormalBuffer.getDevicePointer(),
+                          uint2(renderTargetSizeX, renderTargetSizeY));
+        timerRender.stop(cuStream);
+
+        // JP: パストレーシング結果のデノイズ。
+        //     毎フレーム呼ぶ必要があるのはcomputeIntensity()とinvoke()。
+        //     computeIntensity()は自作することもできる。
+        //     getSharedScratchBufferSize()のサイズでsetupState()しておけば、
+        //     computeIntensity()はデノイザーのスクラッチバッファーを再利用する。
+        // EN: Denoise the path tracing result.
+        //     computeIntensity() and invoke() should be calld every frame.
+        //     You can also create a custom computeIntensity().
+        //     computeIntensity() reuses the denoiser's scratch buffer when setupState() was called with
+        //     a buffer of getSharedScratchBufferSize().
+        timerDenoise.start(cuStream);
+        denoiser.computeIntensity(cuStream,
+                                  linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                                  hdrIntensity);
+        for (int i = 0; i < denoisingTasks.size(); ++i)
+            denoiser.invoke(cuStream,
+                            false, hdrIntensity, 0.0f,
+                            linearColorBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                            linearAlbedoBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                            linearNormalBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
+                            optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT4,
+                            optixu::BufferView(),
+                            linearOutputBuffer,
+                            denoisingTasks[i]);
+        timerDenoise.stop(cuStream);
+
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+
+        hpprintf("Render %u [spp]: %.3f[ms]\n", numSamples, timerRender.report());
+        hpprintf("Denoise: %.3f[ms]\n", timerDenoise.report());
+
+        timerDenoise.finalize();
+        timerRender.finalize();
+
+
+
+        // JP: 結果とデノイズ用付随バッファーの画像出力。
+        // EN: Output the result and buffers associated to the denoiser as images.
+        auto normalPixels = normalAccumBuffer.map<float4>();
+        std::vector<uint32_t> normalImageData(renderTargetSizeX * renderTargetSizeY);
+        for (int y = 0; y < renderTargetSizeY; ++y) {
+            for (int x = 0; x < renderTargetSizeX; ++x) {
+                uint32_t linearIndex = renderTargetSizeX * y + x;
+
+                float4 normal = normalPixels[linearIndex];
+                uint32_t &dstNormal = normalImageData[linearIndex];
+                dstNormal = (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.x)) << 0) |
+                            (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.y)) << 8) |
+                            (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.z)) << 16) |
+                            (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.w)) << 24);
+            }
+        }
+        normalAccumBuffer.unmap();
+
+        saveImage("color.png", colorAccumBuffer, true, true);
+        saveImage("albedo.png", albedoAccumBuffer, false, false);
+        saveImage("normal.png", renderTargetSizeX, renderTargetSizeY, normalImageData.data());
+        saveImage("color_denoised.png", renderTargetSizeX, linearOutputBuffer, true, true);
+
+        // JP: --preview-upscaleでは縦横1/Nの解像度で描画してデノイズし、上で求めたフル解像度の
+        //     アルベドと法線をガイドにアップスケールしたプレビューも出力する。
+        // EN: With --preview-upscale, also output a preview rendered at 1/N width and height, denoised and
+        //     upscaled with the full resolution albedo and normal obtained above as guides.
+        if (previewScaleDivisor > 0) {
+            CUmodule moduleUpscaler;
+            CUDADRV_CHECK(cuModuleLoad(
+                &moduleUpscaler,
+                (getExecutableDirectory() / "denoiser/ptxes/preview_upscaler_kernels.ptx").string().c_str()));
+            preview_upscaler::PreviewUpscaler upscaler;
+            upscaler.initialize(cuContext, moduleUpscaler, optixContext, cudau::BufferType::Device);
+            upscaler.resize(cuStream, renderTargetSizeX, renderTargetSizeY, previewScaleDivisor);
+            const uint2 lowResSize = upscaler.getLowResImageSize();
+
+            cudau::Array lowResColorAccumBuffer;
+            cudau::Array lowResAlbedoAccumBuffer;
+            cudau::Array lowResNormalAccumBuffer;
+            lowResColorAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                lowResSize.x, lowResSize.y, 1);
+            lowResAlbedoAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                 cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                 lowResSize.x, lowResSize.y, 1);
+            lowResNormalAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                 cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                 lowResSize.x, lowResSize.y, 1);
+            // JP: 低解像度のアルベドと法線はアップスケーラーがフル解像度のガイドから求めるので、
+            //     コピーカーネルの出力先としてのみ使う。
+            // EN: The upscaler derives low resolution albedo and normal from the full resolution guides,
+            //     so these serve only as destinations of the copy kernel.
+            cudau::TypedBuffer<float4> lowResLinearAlbedoBuffer;
+            cudau::TypedBuffer<float4> lowResLinearNormalBuffer;
+            lowResLinearAlbedoBuffer.initialize(cuContext, cudau::BufferType::Device, lowResSize.x * lowResSize.y);
+            lowResLinearNormalBuffer.initialize(cuContext, cudau::BufferType::Device, lowResSize.x * lowResSize.y);
+            cudau::TypedBuffer<float4> upscaledBuffer;
+            upscaledBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+
+            Shared::PipelineLaunchParameters lowResPlp = plp;
+            lowResPlp.imageSize = int2(lowResSize.x, lowResSize.y);
+            lowResPlp.colorAccumBuffer = lowResColorAccumBuffer.getSurfaceObject(0);
+            lowResPlp.albedoAccumBuffer = lowResAlbedoAccumBuffer.getSurfaceObject(0);
+            lowResPlp.normalAccumBuffer = lowResNormalAccumBuffer.getSurfaceObject(0);
+
+            cudau::Timer timerPreview;
+            timerPreview.initialize(cuContext);
+            timerPreview.start(cuStream);
+            for (int frameIndex = 0; frameIndex < numSamples; ++frameIndex) {
+                lowResPlp.numAccumFrames = frameIndex;
+                CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &lowResPlp, sizeof(lowResPlp), cuStream));
+                pipeline.launch(cuStream, plpOnDevice, lowResSize.x, lowResSize.y, 1);
+            }
+            kernelCopyBuffers(cuStream, kernelCopyBuffers.calcGridDim(lowResSize.x, lowResSize.y),
+                              lowResColorAccumBuffer.getSurfaceObject(0),
+                              lowResAlbedoAccumBuffer.getSurfaceObject(0),
+                              lowResNormalAccumBuffer.getSurfaceObject(0),
+                              upscaler.getLowResBeautyBuffer().getDevicePointer(),
+                              lowResLinearAlbedoBuffer.getDevicePointer(),
+                              lowResLinearNormalBuffer.getDevicePointer(),
+                              lowResSize);
+            upscaler.process(cuStream, linearAlbedoBuffer, linearNormalBuffer, upscaledBuffer);
+            timerPreview.stop(cuStream);
+
+            CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            hpprintf("Preview 1/%u (%ux%u) Render + Denoise + Upscale: %.3f[ms]\n",
+                     previewScaleDivisor, lowResSize.x, lowResSize.y, timerPreview.report());
+            saveImage("color_preview_upscaled.png", renderTargetSizeX, upscaledBuffer, true, true);
+
+            timerPreview.finalize();
+            upscaledBuffer.finalize();
+            lowResLinearNormalBuffer.finalize();
+            lowResLinearAlbedoBuffer.finalize();
+            lowResNormalAccumBuffer.finalize();
+            lowResAlbedoAccumBuffer.finalize();
+            lowResColorAccumBuffer.finalize();
+            upscaler.finalize();
+            CUDADRV_CHECK(cuModuleUnload(moduleUpscaler));
+        }
 
-    // JP: 結果とデノイズ用付随バッファーの画像出力。
-    // EN: Output the result and buffers associated to the denoiser as images.
-    auto normalPixels = normalAccumBuffer.map<float4>();
-    std::vector<uint32_t> normalImageData(renderTargetSizeX * renderTargetSizeY);
-    for (int y = 0; y < renderTargetSizeY; ++y) {
-        for (int x = 0; x < renderTargetSizeX; ++x) {
-            uint32_t linearIndex = renderTargetSizeX * y + x;
+        // JP: --frame-budgetでは目標のフレーム時間(ミリ秒)を与え、インタラクティブなプレビューを模して
+        //     数百フレームを描画する。frame_budget::GovernorがGpuProfilerの"Render"と"Denoise"の計測時間から
+        //     PreviewUpscalerの縮小率、フレームごとのサンプル数、デノイズの間隔を調整する。
+        //     低解像度の蓄積バッファーはフル解像度で確保し、縮小率の変更時にはアップスケーラーのみを作り直す。
+        // EN: With --frame-budget, give a target frame time in milliseconds and render hundreds of frames
+        //     mimicking an interactive preview. frame_budget::Governor adjusts the scale divisor of PreviewUpscaler,
+        //     the number of samples per frame and the denoising interval from "Render" and "Denoise" timings
+        //     of GpuProfiler.
+        //     Low resolution accumulation buffers are allocated at the full resolution,
+        //     and only the upscaler is recreated when the scale divisor changes.
+        if (useFrameBudget) {
+            CUmodule moduleUpscaler;
+            CUDADRV_CHECK(cuModuleLoad(
+                &moduleUpscaler,
+                (getExecutableDirectory() / "denoiser/ptxes/preview_upscaler_kernels.ptx").string().c_str()));
+
+            frame_budget::GovernorConfig config;
+            config.targetFrameTime = targetFrameTime;
+            config.renderScopeName = "Render";
+            config.denoiseScopeName = "Denoise";
+            config.initialSettings = { 1, numSamples, 1 };
+            config.maxResolutionDivisor = 4;
+            config.minSamplesPerLaunch = 1;
+            config.maxSamplesPerLaunch = numSamples;
+            config.maxDenoiseInterval = 4;
+            frame_budget::Governor governor;
+            governor.initialize(config);
+
+            cudau::GpuProfiler profiler;
+            profiler.initialize(cuContext, config.numFramesInFlight);
+
+            preview_upscaler::PreviewUpscaler upscaler;
+            upscaler.initialize(cuContext, moduleUpscaler, optixContext, cudau::BufferType::Device);
+            upscaler.resize(cuStream, renderTargetSizeX, renderTargetSizeY,
+                            governor.getSettings().resolutionDivisor);
+
+            cudau::Array budgetColorAccumBuffer;
+            cudau::Array budgetAlbedoAccumBuffer;
+            cudau::Array budgetNormalAccumBuffer;
+            budgetColorAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                renderTargetSizeX, renderTargetSizeY, 1);
+            budgetAlbedoAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                 cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                 renderTargetSizeX, renderTargetSizeY, 1);
+            budgetNormalAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
+                                                 cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
+                                                 renderTargetSizeX, renderTargetSizeY, 1);
+            cudau::TypedBuffer<float4> budgetLinearAlbedoBuffer;
+            cudau::TypedBuffer<float4> budgetLinearNormalBuffer;
+            budgetLinearAlbedoBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                                renderTargetSizeX * renderTargetSizeY);
+            budgetLinearNormalBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                                renderTargetSizeX * renderTargetSizeY);
+            cudau::TypedBuffer<float4> budgetOutputBuffer;
+            budgetOutputBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+
+            Shared::PipelineLaunchParameters budgetPlp = plp;
+            budgetPlp.colorAccumBuffer = budgetColorAccumBuffer.getSurfaceObject(0);
+            budgetPlp.albedoAccumBuffer = budgetAlbedoAccumBuffer.getSurfaceObject(0);
+            budgetPlp.normalAccumBuffer = budgetNormalAccumBuffer.getSurfaceObject(0);
+
+            constexpr uint32_t numBudgetFrames = 300;
+            for (uint32_t frameIndex = 0; frameIndex < numBudgetFrames; ++frameIndex) {
+                profiler.poll();
+                if (governor.update(profiler)) {
+                    const frame_budget::Settings &settings = governor.getSettings();
+                    if (settings.resolutionDivisor != upscaler.getScaleDivisor()) {
+                        // JP: 発行済みのフレームが使うバッファーを解放する前に待つ。
+                        // EN: Wait before releasing buffers used by submitted frames.
+                        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+                        upscaler.resize(cuStream, renderTargetSizeX, renderTargetSizeY,
+                                        settings.resolutionDivisor);
+                    }
+                    hpprintf("Frame %u: 1/%u res, %u spp, denoise every %u frames (%.3f[ms] -> %.3f[ms])\n",
+                             frameIndex, settings.resolutionDivisor, settings.samplesPerLaunch,
+                             settings.denoiseInterval,
+                             governor.getSmoothedFrameTime(), governor.getPredictedFrameTime());
+                }
+                const frame_budget::Settings &settings = governor.getSettings();
+                const uint2 lowResSize = upscaler.getLowResImageSize();
+                budgetPlp.imageSize = int2(lowResSize.x, lowResSize.y);
+
+                profiler.beginFrame(cuStream);
+                {
+                    cudau::GpuProfileScope scope(&profiler, "Render", cuStream);
+                    for (uint32_t sampleIdx = 0; sampleIdx < settings.samplesPerLaunch; ++sampleIdx) {
+                        budgetPlp.numAccumFrames = sampleIdx;
+                        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &budgetPlp, sizeof(budgetPlp), cuStream));
+                        pipeline.launch(cuStream, plpOnDevice, lowResSize.x, lowResSize.y, 1);
+                    }
+                    kernelCopyBuffers(cuStream, kernelCopyBuffers.calcGridDim(lowResSize.x, lowResSize.y),
+                                      budgetColorAccumBuffer.getSurfaceObject(0),
+                                      budgetAlbedoAccumBuffer.getSurfaceObject(0),
+                                      budgetNormalAccumBuffer.getSurfaceObject(0),
+                                      upscaler.getLowResBeautyBuffer().getDevicePointer(),
+                                      budgetLinearAlbedoBuffer.getDevicePointer(),
+                                      budgetLinearNormalBuffer.getDevicePointer(),
+                                      lowResSize);
+                }
+                if (governor.shouldDenoise(frameIndex)) {
+                    cudau::GpuProfileScope scope(&profiler, "Denoise", cuStream);
+                    upscaler.process(cuStream, linearAlbedoBuffer, linearNormalBuffer, budgetOutputBuffer);
+                }
+                profiler.endFrame(cuStream);
+            }
 
-            float4 normal = normalPixels[linearIndex];
-            uint32_t &dstNormal = normalImageData[linearIndex];
-            dstNormal = (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.x)) << 0) |
-                        (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.y)) << 8) |
-                        (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.z)) << 16) |
-                        (std::min<uint32_t>(255, 255 * (0.5f + 0.5f * normal.w)) << 24);
+            CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            const frame_budget::Settings &settings = governor.getSettings();
+            hpprintf("Frame budget %.3f[ms]: 1/%u res, %u spp, denoise every %u frames, %u changes\n",
+                     governor.getTargetFrameTime(), settings.resolutionDivisor, settings.samplesPerLaunch,
+                     settings.denoiseInterval, governor.getNumChanges());
+            saveImage("color_budget.png", renderTargetSizeX, budgetOutputBuffer, true, true);
+
+            budgetOutputBuffer.finalize();
+            budgetLinearNormalBuffer.finalize();
+            budgetLinearAlbedoBuffer.finalize();
+            budgetNormalAccumBuffer.finalize();
+            budgetAlbedoAccumBuffer.finalize();
+            budgetColorAccumBuffer.finalize();
+            upscaler.finalize();
+            profiler.finalize();
+            CUDADRV_CHECK(cuModuleUnload(moduleUpscaler));
         }
     }
-    normalAccumBuffer.unmap();
-
-    saveImage("color.png", colorAccumBuffer, true, true);
-    saveImage("albedo.png", albedoAccumBuffer, false, false);
-    saveImage("normal.png", renderTargetSizeX, renderTargetSizeY, normalImageData.data());
-    saveImage("color_denoised.png", renderTargetSizeX, linearOutputBuffer, true, true);
 
 
 
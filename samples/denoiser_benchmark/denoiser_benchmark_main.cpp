@@ -0,0 +1,471 @@
+﻿/*
+
+JP: このサンプルはデノイザーの設定ごとの性能と品質を計測します。
+    入力画像に対してモデル、ガイドレイヤー、タイルサイズ、画素フォーマット、ストリーム数を総当たりし、
+    cudau::TimerによるステージごとのGPU時間、prepare()が返すメモリー量、リファレンスに対する誤差を
+    CSV形式で出力します。
+    入力は.hdrファイルか、幅と高さ(uint32_t)に続けてfloat4の画素が並ぶ生のバイナリーファイルです。
+
+EN: This sample measures performance and quality of the denoiser per configuration.
+    It sweeps model kinds, guide layers, tile sizes, pixel formats and stream counts for the input images,
+    then outputs GPU time per stage measured by cudau::Timer, memory amounts returned by prepare() and
+    an error against the reference in the CSV format.
+    Inputs are .hdr files or raw binary files with width and height (uint32_t) followed by float4 pixels.
+
+    Usage: denoiser_benchmark --beauty <path> --reference <path> [--albedo <path>] [--normal <path>]
+                              [--iterations <N>]
+
+*/
+
+#include "../common/common.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../../ext/stb_image.h"
+
+struct Image {
+    uint32_t width;
+    uint32_t height;
+    std::vector<float4> pixels;
+};
+
+static Image loadImage(const std::filesystem::path &filepath) {
+    Image image;
+    if (filepath.extension() == ".hdr") {
+        int32_t width, height, n;
+        float* data = stbi_loadf(filepath.string().c_str(), &width, &height, &n, 4);
+        if (!data)
+            throw std::runtime_error("Failed to load an image: " + filepath.string());
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(width * height);
+        for (int i = 0; i < width * height; ++i)
+            image.pixels[i] = float4(data[4 * i + 0], data[4 * i + 1], data[4 * i + 2], data[4 * i + 3]);
+        stbi_image_free(data);
+    }
+    else {
+        std::ifstream ifs(filepath, std::ios::in | std::ios::binary);
+        if (!ifs)
+            throw std::runtime_error("Failed to open a file: " + filepath.string());
+        ifs.read(reinterpret_cast<char*>(&image.width), sizeof(image.width));
+        ifs.read(reinterpret_cast<char*>(&image.height), sizeof(image.height));
+        image.pixels.resize(image.width * image.height);
+        ifs.read(reinterpret_cast<char*>(image.pixels.data()), sizeof(float4) * image.pixels.size());
+        if (!ifs)
+            throw std::runtime_error("Failed to read a raw float4 image: " + filepath.string());
+    }
+    return image;
+}
+
+
+
+struct BenchmarkConfig {
+    OptixDenoiserModelKind modelKind;
+    bool guideAlbedo;
+    bool guideNormal;
+    uint32_t tileSize;
+    OptixPixelFormat format;
+    uint32_t numStreams;
+};
+
+struct BenchmarkResult {
+    uint32_t numTasks;
+    size_t stateSize;
+    size_t scratchSize;
+    size_t scratchSizeForComputeIntensity;
+    size_t totalMemorySize;
+    float setupTime;
+    float intensityTime;
+    float invokeTime;
+    float rmse;
+    float relMSE;
+};
+
+// JP: HALF4の画素はoptixu::Half2と同じく2つの半精度数を1つのuint32_tに詰めたuint2で表す。
+// EN: A HALF4 pixel is represented as uint2 packing two half-precision numbers into a uint32_t
+//     in the same way as optixu::Half2.
+static uint32_t packHalf2(float x, float y) {
+    return static_cast<uint32_t>(cudau::floatToHalf(x)) | (static_cast<uint32_t>(cudau::floatToHalf(y)) << 16);
+}
+
+// JP: 入力をデバイスに転送する。HALF4の場合はホスト側で変換する。
+// EN: Transfer an input to the device. Convert on the host side for HALF4.
+static void uploadImage(CUcontext cuContext, CUstream stream, const Image &image, OptixPixelFormat format,
+                        cudau::Buffer* buffer) {
+    const uint32_t numPixels = image.width * image.height;
+    if (format == OPTIX_PIXEL_FORMAT_HALF4) {
+        std::vector<uint2> halfPixels(numPixels);
+        for (uint32_t i = 0; i < numPixels; ++i) {
+            const float4 &p = image.pixels[i];
+            halfPixels[i] = make_uint2(packHalf2(p.x, p.y), packHalf2(p.z, p.w));
+        }
+        buffer->initialize(cuContext, cudau::BufferType::Device, numPixels, sizeof(uint2));
+        buffer->write(halfPixels.data(), numPixels, stream);
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+    }
+    else {
+        buffer->initialize(cuContext, cudau::BufferType::Device, numPixels, sizeof(float4));
+        buffer->write(image.pixels.data(), numPixels, stream);
+    }
+}
+
+static void downloadImage(CUstream stream, const cudau::Buffer &buffer, OptixPixelFormat format,
+                          std::vector<float4>* pixels) {
+    const uint32_t numPixels = buffer.numElements();
+    pixels->resize(numPixels);
+    if (format == OPTIX_PIXEL_FORMAT_HALF4) {
+        std::vector<uint2> halfPixels(numPixels);
+        buffer.read(halfPixels.data(), numPixels, stream);
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        for (uint32_t i = 0; i < numPixels; ++i) {
+            const uint2 &p = halfPixels[i];
+            (*pixels)[i] = float4(cudau::halfToFloat(p.x & 0xFFFF), cudau::halfToFloat(p.x >> 16),
+                                  cudau::halfToFloat(p.y & 0xFFFF), cudau::halfToFloat(p.y >> 16));
+        }
+    }
+    else {
+        buffer.read(pixels->data(), numPixels, stream);
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+    }
+}
+
+// JP: RGBのRMSEと相対MSE(分母に0.01を加えたもの)を求める。
+// EN: Compute RMSE and relative MSE (with 0.01 added to the denominator) of RGB.
+static void computeErrors(const std::vector<float4> &result, const std::vector<float4> &reference,
+                          float* rmse, float* relMSE) {
+    double sumSqError = 0.0;
+    double sumRelSqError = 0.0;
+    for (size_t i = 0; i < result.size(); ++i) {
+        const float4 &d = result[i];
+        const float4 &r = reference[i];
+        const float diffs[] = { d.x - r.x, d.y - r.y, d.z - r.z };
+        const float refs[] = { r.x, r.y, r.z };
+        for (int c = 0; c < 3; ++c) {
+            const double sqError = static_cast<double>(diffs[c]) * diffs[c];
+            sumSqError += sqError;
+            sumRelSqError += sqError / (static_cast<double>(refs[c]) * refs[c] + 0.01);
+        }
+    }
+    const double numValues = 3.0 * result.size();
+    *rmse = static_cast<float>(std::sqrt(sumSqError / numValues));
+    *relMSE = static_cast<float>(sumRelSqError / numValues);
+}
+
+static BenchmarkResult runBenchmark(CUcontext cuContext, const optixu::Context &optixContext,
+                                    const CUstream* streams, const BenchmarkConfig &config,
+                                    const Image &beauty, const Image* albedo, const Image* normal,
+                                    const Image &reference, uint32_t numIterations) {
+    const uint32_t width = beauty.width;
+    const uint32_t height = beauty.height;
+    const bool useAov = config.modelKind == OPTIX_DENOISER_MODEL_KIND_AOV;
+    const bool useConcurrency = config.numStreams > 1;
+    CUstream stream = streams[0];
+
+    BenchmarkResult result = {};
+
+    cudau::Timer timerSetup;
+    cudau::Timer timerIntensity;
+    cudau::Timer timerInvoke;
+    timerSetup.initialize(cuContext);
+    timerIntensity.initialize(cuContext);
+    timerInvoke.initialize(cuContext);
+
+    // JP: デノイザーのセットアップ。
+    // EN: Setup the denoiser.
+    // JP: 画像より大きいタイルにならないようにタイルサイズを軸ごとに画像サイズでクランプする。
+    // EN: Clamp the tile size per axis to the image size so that a tile never exceeds the image.
+    optixu::Denoiser denoiser = optixContext.createDenoiser(config.modelKind, config.guideAlbedo, config.guideNormal);
+    const uint32_t tileWidth = config.tileSize > 0 ? std::min(config.tileSize, width) : 0;
+    const uint32_t tileHeight = config.tileSize > 0 ? std::min(config.tileSize, height) : 0;
+    denoiser.prepare(width, height, tileWidth, tileHeight,
+                     &result.stateSize, &result.scratchSize, &result.scratchSizeForComputeIntensity,
+                     &result.numTasks);
+    std::vector<optixu::DenoisingTask> tasks(result.numTasks);
+    denoiser.getTasks(tasks.data());
+
+    const size_t sharedScratchSize = denoiser.getSharedScratchBufferSize();
+    cudau::Buffer stateBuffer;
+    cudau::Buffer scratchBuffer;
+    stateBuffer.initialize(cuContext, cudau::BufferType::Device, result.stateSize, 1);
+    scratchBuffer.initialize(cuContext, cudau::BufferType::Device, sharedScratchSize, 1);
+    result.totalMemorySize = result.stateSize + sharedScratchSize;
+
+    // JP: 複数ストリームの場合はストリームごとにステートとスクラッチを用意する。
+    // EN: Prepare state and scratch per stream for multiple streams.
+    std::vector<cudau::Buffer> concurrentStateBuffers(useConcurrency ? config.numStreams : 0);
+    std::vector<cudau::Buffer> concurrentScratchBuffers(useConcurrency ? config.numStreams : 0);
+    std::vector<optixu::BufferView> concurrentStateViews;
+    std::vector<optixu::BufferView> concurrentScratchViews;
+    for (uint32_t i = 0; i < concurrentStateBuffers.size(); ++i) {
+        concurrentStateBuffers[i].initialize(cuContext, cudau::BufferType::Device, result.stateSize, 1);
+        concurrentScratchBuffers[i].initialize(cuContext, cudau::BufferType::Device, result.scratchSize, 1);
+        concurrentStateViews.push_back(concurrentStateBuffers[i]);
+        concurrentScratchViews.push_back(concurrentScratchBuffers[i]);
+        result.totalMemorySize += result.stateSize + result.scratchSize;
+    }
+
+    timerSetup.start(stream);
+    denoiser.setupState(stream, stateBuffer, scratchBuffer);
+    if (useConcurrency)
+        denoiser.setupConcurrentStates(stream, concurrentStateViews.data(), concurrentScratchViews.data(),
+                                       config.numStreams);
+    timerSetup.stop(stream);
+
+    cudau::Buffer beautyBuffer;
+    cudau::Buffer albedoBuffer;
+    cudau::Buffer normalBuffer;
+    cudau::Buffer outputBuffer;
+    uploadImage(cuContext, stream, beauty, config.format, &beautyBuffer);
+    if (config.guideAlbedo)
+        uploadImage(cuContext, stream, *albedo, config.format, &albedoBuffer);
+    if (config.guideNormal)
+        uploadImage(cuContext, stream, *normal, config.format, &normalBuffer);
+    outputBuffer.initialize(cuContext, cudau::BufferType::Device, width * height,
+                            static_cast<uint32_t>(denoiser.getImageBufferSize(config.format) / (width * height)));
+    const uint32_t numImages = 2 + (config.guideAlbedo ? 1 : 0) + (config.guideNormal ? 1 : 0);
+    result.totalMemorySize += numImages * denoiser.getImageBufferSize(config.format);
+
+    // JP: HDRの場合は輝度(float)、AOVの場合は平均色(float3)を計算する。
+    // EN: Compute intensity (float) for HDR or average color (float3) for AOV.
+    CUdeviceptr hdrNormalizer;
+    CUDADRV_CHECK(cuMemAlloc(&hdrNormalizer, 3 * sizeof(float)));
+
+    std::vector<CUevent> joinEvents(config.numStreams);
+    for (uint32_t i = 0; i < config.numStreams; ++i)
+        CUDADRV_CHECK(cuEventCreate(&joinEvents[i], CU_EVENT_DISABLE_TIMING));
+
+    const auto denoise = [&]() {
+        timerIntensity.start(stream);
+        if (useAov)
+            denoiser.computeAverageColor(stream, beautyBuffer, config.format, hdrNormalizer);
+        else
+            denoiser.computeIntensity(stream, beautyBuffer, config.format, hdrNormalizer);
+        timerIntensity.stop(stream);
+
+        timerInvoke.start(stream);
+        if (useConcurrency) {
+            // JP: 主ストリームから各ストリームへ分岐し、終了後に主ストリームで合流する。
+            // EN: Fork from the main stream to each stream, then join on the main stream after finishing.
+            CUDADRV_CHECK(cuEventRecord(joinEvents[0], stream));
+            for (uint32_t i = 1; i < config.numStreams; ++i)
+                CUDADRV_CHECK(cuStreamWaitEvent(streams[i], joinEvents[0], 0));
+            denoiser.invokeConcurrently(streams, config.numStreams, nullptr,
+                                        false, hdrNormalizer, 0.0f,
+                                        beautyBuffer, config.format,
+                                        config.guideAlbedo ? albedoBuffer : optixu::BufferView(), config.format,
+                                        config.guideNormal ? normalBuffer : optixu::BufferView(), config.format,
+                                        optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT2,
+                                        optixu::BufferView(),
+                                        outputBuffer,
+                                        tasks.data(), result.numTasks);
+            for (uint32_t i = 1; i < config.numStreams; ++i) {
+                CUDADRV_CHECK(cuEventRecord(joinEvents[i], streams[i]));
+                CUDADRV_CHECK(cuStreamWaitEvent(stream, joinEvents[i], 0));
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < result.numTasks; ++i) {
+                if (useAov)
+                    denoiser.invoke(stream,
+                                    false, hdrNormalizer, 0.0f,
+                                    beautyBuffer, config.format,
+                                    nullptr, nullptr, 0,
+                                    config.guideAlbedo ? albedoBuffer : optixu::BufferView(), config.format,
+                                    config.guideNormal ? normalBuffer : optixu::BufferView(), config.format,
+                                    outputBuffer, nullptr,
+                                    tasks[i]);
+                else
+                    denoiser.invoke(stream,
+                                    false, hdrNormalizer, 0.0f,
+                                    beautyBuffer, config.format,
+                                    config.guideAlbedo ? albedoBuffer : optixu::BufferView(), config.format,
+                                    config.guideNormal ? normalBuffer : optixu::BufferView(), config.format,
+                                    optixu::BufferView(), OPTIX_PIXEL_FORMAT_FLOAT2,
+                                    optixu::BufferView(),
+                                    outputBuffer,
+                                    tasks[i]);
+            }
+        }
+        timerInvoke.stop(stream);
+    };
+
+    // JP: 初回の呼び出しはウォームアップとして計測から除く。
+    // EN: Exclude the first call from measurement as warmup.
+    denoise();
+    CUDADRV_CHECK(cuStreamSynchronize(stream));
+    result.setupTime = timerSetup.report();
+    for (uint32_t it = 0; it < numIterations; ++it) {
+        denoise();
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        result.intensityTime += timerIntensity.report();
+        result.invokeTime += timerInvoke.report();
+    }
+    result.intensityTime /= numIterations;
+    result.invokeTime /= numIterations;
+
+    std::vector<float4> denoised;
+    downloadImage(stream, outputBuffer, config.format, &denoised);
+    computeErrors(denoised, reference.pixels, &result.rmse, &result.relMSE);
+
+    for (int i = static_cast<int>(config.numStreams) - 1; i >= 0; --i)
+        CUDADRV_CHECK(cuEventDestroy(joinEvents[i]));
+    CUDADRV_CHECK(cuMemFree(hdrNormalizer));
+
+    outputBuffer.finalize();
+    normalBuffer.finalize();
+    albedoBuffer.finalize();
+    beautyBuffer.finalize();
+
+    for (int i = static_cast<int>(concurrentStateBuffers.size()) - 1; i >= 0; --i) {
+        concurrentScratchBuffers[i].finalize();
+        concurrentStateBuffers[i].finalize();
+    }
+    scratchBuffer.finalize();
+    stateBuffer.finalize();
+
+    denoiser.destroy();
+
+    timerInvoke.finalize();
+    timerIntensity.finalize();
+    timerSetup.finalize();
+
+    return result;
+}
+
+
+
+int32_t main(int32_t argc, const char* argv[]) try {
+    std::filesystem::path beautyPath;
+    std::filesystem::path albedoPath;
+    std::filesystem::path normalPath;
+    std::filesystem::path referencePath;
+    uint32_t numIterations = 10;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (argIdx + 1 >= argc)
+            throw std::runtime_error("Missing value for a command line argument.");
+        if (arg == "--beauty")
+            beautyPath = argv[argIdx + 1];
+        else if (arg == "--albedo")
+            albedoPath = argv[argIdx + 1];
+        else if (arg == "--normal")
+            normalPath = argv[argIdx + 1];
+        else if (arg == "--reference")
+            referencePath = argv[argIdx + 1];
+        else if (arg == "--iterations")
+            numIterations = std::max(std::atoi(argv[argIdx + 1]), 1);
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        argIdx += 2;
+    }
+    if (beautyPath.empty() || referencePath.empty())
+        throw std::runtime_error("--beauty and --reference are required.");
+    if (!normalPath.empty() && albedoPath.empty())
+        throw std::runtime_error("The normal guide requires the albedo guide.");
+
+    const Image beauty = loadImage(beautyPath);
+    const Image reference = loadImage(referencePath);
+    Image albedo;
+    Image normal;
+    if (!albedoPath.empty())
+        albedo = loadImage(albedoPath);
+    if (!normalPath.empty())
+        normal = loadImage(normalPath);
+    const auto sizeMatches = [&beauty](const Image &image) {
+        return image.width == beauty.width && image.height == beauty.height;
+    };
+    if (!sizeMatches(reference) ||
+        (!albedoPath.empty() && !sizeMatches(albedo)) ||
+        (!normalPath.empty() && !sizeMatches(normal)))
+        throw std::runtime_error("All the images must have the same size.");
+
+
+
+    CUcontext cuContext;
+    int32_t cuDeviceCount;
+    CUDADRV_CHECK(cuInit(0));
+    CUDADRV_CHECK(cuDeviceGetCount(&cuDeviceCount));
+    CUDADRV_CHECK(cuCtxCreate(&cuContext, 0, 0));
+    CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
+
+    constexpr uint32_t maxNumStreams = 4;
+    CUstream cuStreams[maxNumStreams];
+    for (uint32_t i = 0; i < maxNumStreams; ++i)
+        CUDADRV_CHECK(cuStreamCreate(&cuStreams[i], CU_STREAM_NON_BLOCKING));
+
+    optixu::Context optixContext = optixu::Context::create(cuContext);
+
+    char deviceName[256];
+    CUdevice cuDevice;
+    CUDADRV_CHECK(cuCtxGetDevice(&cuDevice));
+    CUDADRV_CHECK(cuDeviceGetName(deviceName, sizeof(deviceName), cuDevice));
+    hpprintf("# Device: %s\n", deviceName);
+    hpprintf("# Image: %ux%u, Iterations: %u\n", beauty.width, beauty.height, numIterations);
+
+
+
+    // JP: 設定の総当たり。複数ストリームはタスクが複数になるHDRモデルのタイル分割でのみ意味を持つ。
+    // EN: Sweep configurations. Multiple streams are meaningful only for tiled HDR model with multiple tasks.
+    const OptixDenoiserModelKind modelKinds[] = { OPTIX_DENOISER_MODEL_KIND_HDR, OPTIX_DENOISER_MODEL_KIND_AOV };
+    const uint32_t maxNumGuides = normalPath.empty() ? (albedoPath.empty() ? 0 : 1) : 2;
+    const uint32_t tileSizes[] = { 0, 256, 512 };
+    const OptixPixelFormat formats[] = { OPTIX_PIXEL_FORMAT_FLOAT4, OPTIX_PIXEL_FORMAT_HALF4 };
+    const uint32_t streamCounts[] = { 1, 2, 4 };
+
+    hpprintf("model,guides,tile,format,streams,tasks,"
+             "state[B],scratch[B],intensityScratch[B],total[B],"
+             "setup[ms],intensity[ms],invoke[ms],rmse,relMSE\n");
+    for (OptixDenoiserModelKind modelKind : modelKinds) {
+        for (uint32_t numGuides = 0; numGuides <= maxNumGuides; ++numGuides) {
+            for (uint32_t tileSize : tileSizes) {
+                // JP: 両軸とも1タイルに収まる場合はタイル分割無しと同じなので飛ばす。
+                // EN: Skip the case where both axes fit in a single tile since it is the same as no tiling.
+                if (tileSize > 0 && tileSize >= std::max(beauty.width, beauty.height))
+                    continue;
+                for (OptixPixelFormat format : formats) {
+                    for (uint32_t numStreams : streamCounts) {
+                        if (numStreams > 1 && (tileSize == 0 || modelKind == OPTIX_DENOISER_MODEL_KIND_AOV))
+                            continue;
+
+                        BenchmarkConfig config;
+                        config.modelKind = modelKind;
+                        config.guideAlbedo = numGuides >= 1;
+                        config.guideNormal = numGuides >= 2;
+                        config.tileSize = tileSize;
+                        config.format = format;
+                        config.numStreams = numStreams;
+                        BenchmarkResult result = runBenchmark(
+                            cuContext, optixContext, cuStreams, config,
+                            beauty, &albedo, &normal, reference, numIterations);
+
+                        const char* guideNames[] = { "none", "albedo", "albedo+normal" };
+                        hpprintf("%s,%s,%u,%s,%u,%u,%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f,%g,%g\n",
+                                 modelKind == OPTIX_DENOISER_MODEL_KIND_HDR ? "HDR" : "AOV",
+                                 guideNames[numGuides], tileSize,
+                                 format == OPTIX_PIXEL_FORMAT_HALF4 ? "HALF4" : "FLOAT4",
+                                 numStreams, result.numTasks,
+                                 result.stateSize, result.scratchSize, result.scratchSizeForComputeIntensity,
+                                 result.totalMemorySize,
+                                 result.setupTime, result.intensityTime, result.invokeTime,
+                                 result.rmse, result.relMSE);
+                    }
+                }
+            }
+        }
+    }
+
+
+
+    optixContext.destroy();
+
+    for (int i = maxNumStreams - 1; i >= 0; --i)
+        CUDADRV_CHECK(cuStreamDestroy(cuStreams[i]));
+    CUDADRV_CHECK(cuCtxDestroy(cuContext));
+
+    return 0;
+}
+catch (const std::exception &ex) {
+    hpprintf("Error: %s\n", ex.what());
+    return -1;
+}
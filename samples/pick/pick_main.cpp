@@ -13,6 +13,7 @@ EN: This sample demonstrates an example of implementing object picking in an int
 #include "pick_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/ray_query.h"
 
 // Include glfw3.h after our OpenGL definitions
 #include "../common/gl_util.h"
@@ -68,6 +69,8 @@ KeyState g_keyTiltRight;
 KeyState g_keyFasterPosMovSpeed;
 KeyState g_keySlowerPosMovSpeed;
 KeyState g_buttonRotate;
+KeyState g_buttonSelect;
+bool g_selectWithLasso = false;
 double g_mouseX;
 double g_mouseY;
 
@@ -93,20 +96,42 @@ namespace ImGui {
     }
 }
 
+// JP: ラスタライズ用にデバイスバッファーの内容をOpenGLバッファーに複製する。
+// EN: Duplicate the contents of a device buffer into an OpenGL buffer for rasterization.
+template <typename T>
+static void copyToGLBuffer(const cudau::TypedBuffer<T> &src, glu::Buffer* dst) {
+    std::vector<T> values(src.numElements());
+    src.read(values);
+    dst->initialize(sizeof(T), static_cast<uint32_t>(values.size()), glu::Buffer::Usage::StaticDraw);
+    std::copy(values.cbegin(), values.cend(), dst->map<T>());
+    dst->unmap();
+}
+
 int32_t main(int32_t argc, const char* argv[]) try {
     const std::filesystem::path exeDir = getExecutableDirectory();
 
     bool takeScreenShot = false;
+    bool checkRayQueries = false;
+    bool useRasterGBuffer = false;
+    bool useRegionSelect = false;
 
     uint32_t argIdx = 1;
     while (argIdx < argc) {
         std::string_view arg = argv[argIdx];
         if (arg == "--screen-shot")
             takeScreenShot = true;
+        else if (arg == "--ray-query-check")
+            checkRayQueries = true;
+        else if (arg == "--raster-gbuffer")
+            useRasterGBuffer = true;
+        else if (arg == "--region-select")
+            useRegionSelect = true;
         else
             throw std::runtime_error("Unknown command line argument.");
         ++argIdx;
     }
+    if (useRegionSelect && useRasterGBuffer)
+        throw std::runtime_error("--region-select cannot be combined with --raster-gbuffer.");
 
     // ----------------------------------------------------------------
     // JP: OpenGL, GLFWの初期化。
@@ -231,6 +256,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
             g_buttonRotate.recordStateChange(action == GLFW_PRESS, frameIndex);
             break;
         }
+        case GLFW_MOUSE_BUTTON_RIGHT: {
+            devPrintf("Mouse Right\n");
+            if (action == GLFW_PRESS)
+                g_selectWithLasso = (mods & GLFW_MOD_SHIFT) != 0;
+            g_buttonSelect.recordStateChange(action == GLFW_PRESS, frameIndex);
+            break;
+        }
         default:
             break;
         }
@@ -404,6 +436,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         p.rayGenPrograms["perspective"] = optixPipeline.createRayGenProgram(p.module, RT_RG_NAME_STR("perspectiveRaygen"));
         p.rayGenPrograms["equirectangular"] = optixPipeline.createRayGenProgram(p.module, RT_RG_NAME_STR("equirectangularRaygen"));
+        p.rayGenPrograms["perspectiveFromGBuffer"] = optixPipeline.createRayGenProgram(
+            p.module, RT_RG_NAME_STR("perspectiveRaygenFromGBuffer"));
 
         p.missProgram = optixPipeline.createMissProgram(p.module, RT_MS_NAME_STR("miss"));
 
@@ -955,15 +989,44 @@ int32_t main(int32_t argc, const char* argv[]) try {
     renderPlp.perspCamera = perspCamera;
     renderPlp.equirecCamera = equirecCamera;
     renderPlp.colorInterp = 0.1f;
-
-    cudau::TypedBuffer<Shared::PickInfo> pickInfos[2];
-    for (int i = 0; i < lengthof(pickInfos); ++i) {
-        pickInfos[i].initialize(cuContext, cudau::BufferType::Device, 1);
-        pickInfos[i].setMappedMemoryPersistent(true);
-        auto value = pickInfos[i].map();
-        *value = {};
-        pickInfos[i].unmap();
+    renderPlp.gBuffer = {};
+    renderPlp.rasterDrawData = nullptr;
+    renderPlp.rasterMaterials = nullptr;
+    renderPlp.idBuffer = nullptr;
+
+    // JP: ピック結果は数フレーム遅れて読み出し、描画ループがGPUの完了を待たないようにする。
+    // EN: Read back pick results a few frames later so that the render loop doesn't wait for the GPU to finish.
+    cudau::QueryRing<Shared::PickInfo> pickQueries;
+    pickQueries.initialize(cuContext);
+    Shared::PickInfo latestPickInfo = {};
+
+    // JP: --region-selectでは描画パイプラインが書くIDのGバッファーから、マウス右ドラッグの矩形
+    //     (Shift併用で投げ縄)内のインスタンスとジオメトリをregion_select::RegionSelectorで求める。
+    //     結果はピックと同様に数フレーム遅れて受け取る。
+    // EN: With --region-select, compute instances and geometries inside the rectangle of a mouse right drag
+    //     (a lasso with Shift) by region_select::RegionSelector from the ID G-buffer written by the render pipeline.
+    //     Results are received a few frames later as picking does.
+    using RegionSelector = region_select::RegionSelector<256>;
+    constexpr uint32_t maxNumLassoVertices = 1024;
+    CUmodule regionSelectModule = nullptr;
+    RegionSelector regionSelector;
+    cudau::TypedBuffer<region_select::IDPixel> idBuffer;
+    RegionSelector::Result latestSelection = {};
+    bool hasSelection = false;
+    if (useRegionSelect) {
+        CUDADRV_CHECK(cuModuleLoad(
+            &regionSelectModule,
+            (getExecutableDirectory() / "pick/ptxes/region_select_kernels.ptx").string().c_str()));
+        regionSelector.initialize(cuContext, regionSelectModule,
+                                  static_cast<uint32_t>(instInfos.size()), static_cast<uint32_t>(geomInfos.size()),
+                                  maxNumLassoVertices);
+        idBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+        renderPlp.idBuffer = idBuffer.getDevicePointer();
     }
+    std::vector<float2> lassoVertices;
+    int2 selectBegin(0, 0);
+    int2 selectEnd(0, 0);
+    bool selecting = false;
 
     pickPipeline.pipeline.setScene(scene);
     pickPipeline.pipeline.setHitGroupShaderBindingTable(pickPipeline.hitGroupShaderBindingTable,
@@ -978,8 +1041,179 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUdeviceptr renderPlpOnDevice;
     CUDADRV_CHECK(cuMemAlloc(&renderPlpOnDevice, sizeof(renderPlp)));
 
+    const char* renderPerspectiveRayGenName = useRasterGBuffer ? "perspectiveFromGBuffer" : "perspective";
     pickPipeline.pipeline.setRayGenerationProgram(pickPipeline.rayGenPrograms.at("perspective"));
-    renderPipeline.pipeline.setRayGenerationProgram(renderPipeline.rayGenPrograms.at("perspective"));
+    renderPipeline.pipeline.setRayGenerationProgram(renderPipeline.rayGenPrograms.at(renderPerspectiveRayGenName));
+
+    // JP: --raster-gbufferでは一次可視性をOpenGLでGバッファーにラスタライズし、描画パイプラインは
+    //     透視投影カメラのレイをトレースせずにGバッファーの最初のヒットからシェーディングする。
+    //     ジオメトリインスタンスごと(バニーはインスタンスごと)に描画アイテムを作り、
+    //     Gバッファーのジオメトリインデックスには対応するRasterDrawDataのインデックスを描く。
+    // EN: With --raster-gbuffer, rasterize primary visibility into a G-buffer with OpenGL, and the render pipeline
+    //     shades from the first hits in the G-buffer without tracing perspective camera rays.
+    //     Make a draw item per geometry instance (per instance for the bunnies), and draw the index of
+    //     the corresponding RasterDrawData as the geometry index of the G-buffer.
+    raster_gbuffer::Rasterizer rasterizer;
+    glu::Buffer roomGLVertexBuffer;
+    glu::Buffer roomGLTriangleBuffer;
+    glu::Buffer areaLightGLVertexBuffer;
+    glu::Buffer areaLightGLTriangleBuffer;
+    glu::Buffer bunnyGLVertexBuffer;
+    glu::Buffer bunnyGLTriangleBuffer;
+    std::vector<raster_gbuffer::DrawItem> rasterDrawItems;
+    cudau::TypedBuffer<Shared::RasterDrawData> rasterDrawDataBuffer;
+    cudau::TypedBuffer<Shared::MaterialData> rasterMaterialBuffer;
+    if (useRasterGBuffer) {
+        rasterizer.initialize(cuContext, renderTargetSizeX, renderTargetSizeY);
+
+        copyToGLBuffer(room.vertexBuffer, &roomGLVertexBuffer);
+        copyToGLBuffer(room.groups[0].triangleBuffer, &roomGLTriangleBuffer);
+        copyToGLBuffer(areaLight.vertexBuffer, &areaLightGLVertexBuffer);
+        copyToGLBuffer(areaLight.groups[0].triangleBuffer, &areaLightGLTriangleBuffer);
+        copyToGLBuffer(bunny.vertexBuffer, &bunnyGLVertexBuffer);
+        copyToGLBuffer(bunny.groups[0].triangleBuffer, &bunnyGLTriangleBuffer);
+
+        std::vector<Shared::RasterDrawData> drawDataList;
+        std::vector<Shared::MaterialData> materials;
+        const auto addDrawItem = [&](const Mesh &mesh, const Mesh::Group &group,
+                                     const glu::Buffer &glVertexBuffer, const glu::Buffer &glTriangleBuffer,
+                                     const optixu::Instance &inst, uint32_t instIndex, uint32_t sbtGASIndexOffset,
+                                     std::initializer_list<Shared::MaterialData> matDataList) {
+            raster_gbuffer::DrawItem item = {};
+            item.vertexBuffer = glVertexBuffer.getHandle();
+            item.vertexStride = sizeof(Shared::Vertex);
+            item.positionOffset = offsetof(Shared::Vertex, position);
+            item.triangleBuffer = glTriangleBuffer.getHandle();
+            item.numTriangles = group.triangleBuffer.numElements();
+            inst.getTransform(item.transform);
+            item.instanceID = inst.getID();
+            item.geometryIndex = static_cast<uint32_t>(drawDataList.size());
+            rasterDrawItems.push_back(item);
+
+            const float* xfm = item.transform;
+            Matrix3x3 objToWorld(make_float3(xfm[0], xfm[4], xfm[8]),
+                                 make_float3(xfm[1], xfm[5], xfm[9]),
+                                 make_float3(xfm[2], xfm[6], xfm[10]));
+            Shared::RasterDrawData drawData = {};
+            drawData.geomData.vertexBuffer = mesh.vertexBuffer.getDevicePointer();
+            drawData.geomData.triangleBuffer = group.triangleBuffer.getDevicePointer();
+            drawData.matIndexBuffer = group.matIndexBuffer.isInitialized() ?
+                group.matIndexBuffer.getDevicePointer() : nullptr;
+            drawData.normalMatrix = transpose(inverse(objToWorld));
+            drawData.instanceIndex = instIndex;
+            drawData.sbtGASIndexOffset = sbtGASIndexOffset;
+            drawData.materialOffset = static_cast<uint32_t>(materials.size());
+            drawDataList.push_back(drawData);
+            materials.insert(materials.end(), matDataList);
+        };
+        // JP: 各ジオメトリのマテリアルはsetMaterial()と同じ順に並べる。SBTのGAS内インデックスは
+        //     GASの子の順に各子のマテリアル数だけ進む。
+        // EN: Line up materials of each geometry in the same order as setMaterial().
+        //     The SBT GAS index advances by the number of materials of each child in the order of the GAS children.
+        addDrawItem(room, room.groups[0], roomGLVertexBuffer, roomGLTriangleBuffer, roomInst, 0, 0,
+                    { floorMatData, farSideWallMatData, ceilingMatData, leftWallMatData, rightWallMatData });
+        addDrawItem(areaLight, areaLight.groups[0], areaLightGLVertexBuffer, areaLightGLTriangleBuffer,
+                    roomInst, 0, 5, { areaLightMatData });
+        for (int i = 0; i < NumBunnies; ++i) {
+            Shared::MaterialData bunnyMatData;
+            bunnyMats[i].getUserData(&bunnyMatData);
+            addDrawItem(bunny, bunny.groups[0], bunnyGLVertexBuffer, bunnyGLTriangleBuffer,
+                        bunnyInsts[i], 1 + i, 0, { bunnyMatData });
+        }
+
+        rasterDrawDataBuffer.initialize(cuContext, cudau::BufferType::Device, drawDataList);
+        rasterMaterialBuffer.initialize(cuContext, cudau::BufferType::Device, materials);
+        renderPlp.rasterDrawData = rasterDrawDataBuffer.getDevicePointer();
+        renderPlp.rasterMaterials = rasterMaterialBuffer.getDevicePointer();
+    }
+
+    // JP: --ray-query-checkではピックと同じシーンに対してray_query::RayQueryEngineで初期カメラからの
+    //     レイの格子を問い合わせる。マテリアルのヒットグループはパイプラインごとに保持されるので、
+    //     エンジンはピック用のレイタイプをそのまま共有できる。ホスト配列の最近接とAnyの結果、
+    //     デバイス配列の最近接の結果が互いに矛盾しないことを確かめる。
+    //     マテリアルはエンジンのヒットグループを参照するので、エンジンはマテリアルの破棄後まで保持する。
+    // EN: With --ray-query-check, query a grid of rays from the initial camera against the same scene as picking
+    //     using ray_query::RayQueryEngine. Hit groups of materials are held per pipeline,
+    //     so the engine can share the ray type for picking as is. Verify that the closest and any results for
+    //     a host array and the closest results for a device array don't contradict each other.
+    //     Materials refer to the hit group of the engine, so keep the engine until the materials are destroyed.
+    ray_query::RayQueryEngine rayQueryEngine;
+    if (checkRayQueries) {
+        constexpr uint32_t numRaysX = 64;
+        constexpr uint32_t numRaysY = 64;
+        rayQueryEngine.initialize(cuContext, optixContext,
+                                  readTxtFile(getExecutableDirectory() / "pick/ptxes/ray_query_kernels.ptx"),
+                                  Shared::PickRayType_Primary, maxNumRayTypes, numRaysX * numRaysY);
+        rayQueryEngine.setupMaterial(ceilingMat);
+        rayQueryEngine.setupMaterial(farSideWallMat);
+        rayQueryEngine.setupMaterial(leftWallMat);
+        rayQueryEngine.setupMaterial(rightWallMat);
+        rayQueryEngine.setupMaterial(floorMat);
+        rayQueryEngine.setupMaterial(areaLightMat);
+        for (int i = 0; i < NumBunnies; ++i)
+            rayQueryEngine.setupMaterial(bunnyMats[i]);
+        rayQueryEngine.setScene(scene);
+        rayQueryEngine.setTraversable(travHandle);
+
+        Matrix3x3 oriMat = g_cameraOrientation.toMatrix3x3();
+        float vh = 2 * std::tan(perspCamera.fovY * 0.5f);
+        float vw = perspCamera.aspect * vh;
+        std::vector<ray_query::Ray> rays(numRaysX * numRaysY);
+        for (uint32_t iy = 0; iy < numRaysY; ++iy) {
+            for (uint32_t ix = 0; ix < numRaysX; ++ix) {
+                float x = (ix + 0.5f) / numRaysX;
+                float y = (iy + 0.5f) / numRaysY;
+                ray_query::Ray &ray = rays[iy * numRaysX + ix];
+                ray.origin = g_cameraPosition;
+                ray.tMin = 0.0f;
+                ray.direction = normalize(oriMat * make_float3(vw * (0.5f - x), vh * (y - 0.5f), 1));
+                ray.tMax = FLT_MAX;
+            }
+        }
+
+        // JP: 2つのバッチはピン留めメモリーでダブルバッファリングされるので、両方を投入してから待つ。
+        // EN: The two batches are double-buffered on pinned memory, so submit both and then wait.
+        uint64_t closestTicket = rayQueryEngine.submit(
+            cuStream, rays.data(), static_cast<uint32_t>(rays.size()), ray_query::QueryType::Closest);
+        uint64_t anyTicket = rayQueryEngine.submit(
+            cuStream, rays.data(), static_cast<uint32_t>(rays.size()), ray_query::QueryType::Any);
+        const ray_query::Hit* closestHits = rayQueryEngine.wait(closestTicket);
+        const ray_query::Hit* anyHits = rayQueryEngine.wait(anyTicket);
+
+        cudau::TypedBuffer<ray_query::Ray> raysOnDevice;
+        cudau::TypedBuffer<ray_query::Hit> hitsOnDevice;
+        raysOnDevice.initialize(cuContext, cudau::BufferType::Device, rays);
+        hitsOnDevice.initialize(cuContext, cudau::BufferType::Device, static_cast<uint32_t>(rays.size()));
+        uint64_t deviceTicket = rayQueryEngine.submitOnDevice(
+            cuStream, raysOnDevice.getDevicePointer(), hitsOnDevice.getDevicePointer(),
+            static_cast<uint32_t>(rays.size()), ray_query::QueryType::Closest);
+        rayQueryEngine.wait(deviceTicket);
+        std::vector<ray_query::Hit> deviceHits(rays.size());
+        hitsOnDevice.read(deviceHits, cuStream);
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+
+        uint32_t numHits = 0;
+        uint32_t numErrors = 0;
+        for (uint32_t rayIdx = 0; rayIdx < rays.size(); ++rayIdx) {
+            const ray_query::Hit &closest = closestHits[rayIdx];
+            const ray_query::Hit &any = anyHits[rayIdx];
+            const ray_query::Hit &device = deviceHits[rayIdx];
+            bool consistent =
+                any.isHit() == closest.isHit() &&
+                (!closest.isHit() || (any.t >= closest.t && closest.instanceID < instInfos.size())) &&
+                device.t == closest.t && device.instanceID == closest.instanceID &&
+                device.primitiveIndex == closest.primitiveIndex;
+            if (closest.isHit())
+                ++numHits;
+            if (!consistent)
+                ++numErrors;
+        }
+        hpprintf("Ray query check: %u/%u rays hit, %u inconsistent results: %s\n",
+                 numHits, static_cast<uint32_t>(rays.size()), numErrors, numErrors == 0 ? "passed" : "FAILED");
+
+        hitsOnDevice.finalize();
+        raysOnDevice.finalize();
+    }
 
     enum class CameraType {
         Perspective = 0,
@@ -993,9 +1227,12 @@ int32_t main(int32_t argc, const char* argv[]) try {
     glfwSetWindowUserPointer(window, &frameIndex);
     int32_t requestedSize[2];
     while (true) {
-        uint32_t bufferIndex = frameIndex % 2;
-
-        cudau::TypedBuffer<Shared::PickInfo> &curPickInfo = pickInfos[bufferIndex];
+        pickQueries.poll();
+        pickQueries.getLatestResult(&latestPickInfo);
+        if (useRegionSelect) {
+            regionSelector.poll();
+            hasSelection = regionSelector.getLatestResult(&latestSelection);
+        }
 
         if (glfwWindowShouldClose(window))
             break;
@@ -1034,6 +1271,16 @@ int32_t main(int32_t argc, const char* argv[]) try {
             renderPlp.perspCamera = perspCamera;
             renderPlp.equirecCamera = equirecCamera;
 
+            if (useRasterGBuffer)
+                rasterizer.resize(renderTargetSizeX, renderTargetSizeY);
+            if (useRegionSelect) {
+                // JP: 実行中の選択が古いサイズのIDのGバッファーを読み終えるのを待つ。
+                // EN: Wait for in-flight selections to finish reading the ID G-buffer of the old size.
+                regionSelector.waitAll();
+                idBuffer.resize(renderTargetSizeX * renderTargetSizeY);
+                renderPlp.idBuffer = idBuffer.getDevicePointer();
+            }
+
             resized = true;
         }
 
@@ -1141,7 +1388,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
             if (ImGui::RadioButtonE("Perspective", &cameraType, CameraType::Perspective)) {
                 pickPipeline.pipeline.setRayGenerationProgram(pickPipeline.rayGenPrograms.at("perspective"));
-                renderPipeline.pipeline.setRayGenerationProgram(renderPipeline.rayGenPrograms.at("perspective"));
+                renderPipeline.pipeline.setRayGenerationProgram(
+                    renderPipeline.rayGenPrograms.at(renderPerspectiveRayGenName));
             }
             if (ImGui::RadioButtonE("Equirectangular", &cameraType, CameraType::Equirectangular)) {
                 pickPipeline.pipeline.setRayGenerationProgram(pickPipeline.rayGenPrograms.at("equirectangular"));
@@ -1167,8 +1415,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
                 }
             };
 
-            Shared::PickInfo pickInfo = curPickInfo.map()[0];
-            curPickInfo.unmap();
+            const Shared::PickInfo &pickInfo = latestPickInfo;
             char instIndexStr[32], matIndexStr[32], primIndexStr[32];
             char instIDStr[32], gasIDStr[32], gasChildIDStr[32], geomIDStr[32], matIDStr[32];
             char instNameStr[64], gasNameStr[64], geomNameStr[64], matNameStr[64];
@@ -1232,6 +1479,69 @@ int32_t main(int32_t argc, const char* argv[]) try {
             ImGui::End();
         }
 
+        bool requestSelection = false;
+        if (useRegionSelect) {
+            const int2 mousePos(static_cast<int32_t>(g_mouseX), static_cast<int32_t>(g_mouseY));
+            if (g_buttonSelect.getState() == true && g_buttonSelect.getTime() == frameIndex &&
+                !ImGui::GetIO().WantCaptureMouse) {
+                selecting = true;
+                selectBegin = mousePos;
+                lassoVertices.clear();
+            }
+            if (selecting) {
+                selectEnd = mousePos;
+                const float2 p = make_float2(mousePos.x + 0.5f, mousePos.y + 0.5f);
+                if (g_selectWithLasso && lassoVertices.size() < maxNumLassoVertices &&
+                    (lassoVertices.empty() ||
+                     std::fabs(p.x - lassoVertices.back().x) + std::fabs(p.y - lassoVertices.back().y) >= 2.0f))
+                    lassoVertices.push_back(p);
+
+                ImDrawList* drawList = ImGui::GetForegroundDrawList();
+                const ImU32 col = IM_COL32(255, 255, 0, 255);
+                if (g_selectWithLasso) {
+                    std::vector<ImVec2> points(lassoVertices.size());
+                    for (uint32_t i = 0; i < lassoVertices.size(); ++i)
+                        points[i] = ImVec2(lassoVertices[i].x, lassoVertices[i].y);
+                    drawList->AddPolyline(points.data(), static_cast<int32_t>(points.size()), col, true, 1.0f);
+                }
+                else {
+                    drawList->AddRect(ImVec2(static_cast<float>(selectBegin.x), static_cast<float>(selectBegin.y)),
+                                      ImVec2(static_cast<float>(selectEnd.x), static_cast<float>(selectEnd.y)),
+                                      col);
+                }
+
+                if (g_buttonSelect.getState() == false) {
+                    selecting = false;
+                    requestSelection = true;
+                }
+            }
+
+            ImGui::Begin("Region Select", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+            ImGui::Text("Mouse Right Drag: Rectangle");
+            ImGui::Text("Shift + Mouse Right Drag: Lasso");
+
+            ImGui::Separator();
+            if (hasSelection) {
+                ImGui::Text("Instances: %u%s", latestSelection.numInstanceIDs,
+                            latestSelection.isTruncated() ? " (truncated)" : "");
+                for (uint32_t i = 0; i < latestSelection.getNumInstanceIDs(); ++i) {
+                    uint32_t instID = latestSelection.instanceIDs[i];
+                    ImGui::Text(" %3u: %s", instID, instInfos[instID].c_str());
+                }
+                ImGui::Text("Geometries: %u", latestSelection.numGeomInstIDs);
+                for (uint32_t i = 0; i < latestSelection.getNumGeometryInstanceIDs(); ++i) {
+                    uint32_t geomID = latestSelection.geomInstIDs[i];
+                    ImGui::Text(" %3u: %s", geomID, geomInfos[geomID].c_str());
+                }
+            }
+            else {
+                ImGui::Text("No selection");
+            }
+
+            ImGui::End();
+        }
+
 
 
         Matrix3x3 oriMat = g_tempCameraOrientation.toMatrix3x3();
@@ -1241,24 +1551,53 @@ int32_t main(int32_t argc, const char* argv[]) try {
         pickPlp.orientation = oriMat;
         pickPlp.mousePosition = int2(static_cast<int32_t>(g_mouseX),
                                      static_cast<int32_t>(g_mouseY));
-        pickPlp.pickInfo = curPickInfo.getDevicePointer();
+        Shared::PickInfo* curPickInfo = pickQueries.beginQuery(frameIndex);
+        pickPlp.pickInfo = curPickInfo;
 
         CUDADRV_CHECK(cuMemcpyHtoDAsync(pickPlpOnDevice, &pickPlp, sizeof(pickPlp), cuStream));
         pickPipeline.pipeline.launch(cuStream, pickPlpOnDevice, 1, 1, 1);
+        pickQueries.endQuery(cuStream);
 
         
         // Render
+        bool readGBuffer = useRasterGBuffer && cameraType == CameraType::Perspective;
+        if (readGBuffer) {
+            raster_gbuffer::Camera rasterCamera;
+            rasterCamera.aspect = perspCamera.aspect;
+            rasterCamera.fovY = perspCamera.fovY;
+            rasterCamera.position = g_cameraPosition;
+            rasterCamera.orientation = oriMat;
+            rasterizer.draw(rasterCamera, 0.01f, 100.0f,
+                            rasterDrawItems.data(), static_cast<uint32_t>(rasterDrawItems.size()));
+            rasterizer.beginCUDAAccess(cuStream);
+            renderPlp.gBuffer = rasterizer.getGBuffer();
+        }
         outputBufferSurfaceHolder.beginCUDAAccess(cuStream);
 
         renderPlp.position = g_cameraPosition;
         renderPlp.orientation = oriMat;
-        renderPlp.pickInfo = curPickInfo.getDevicePointer();
+        renderPlp.pickInfo = curPickInfo;
         renderPlp.resultBuffer = outputBufferSurfaceHolder.getNext();
 
         CUDADRV_CHECK(cuMemcpyHtoDAsync(renderPlpOnDevice, &renderPlp, sizeof(renderPlp), cuStream));
         renderPipeline.pipeline.launch(cuStream, renderPlpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
 
         outputBufferSurfaceHolder.endCUDAAccess(cuStream);
+        if (readGBuffer)
+            rasterizer.endCUDAAccess(cuStream);
+
+        // JP: 同じストリーム上なので、このフレームの描画が書いたIDのGバッファーから選択する。
+        // EN: This is on the same stream, so select from the ID G-buffer written by this frame's rendering.
+        if (requestSelection) {
+            const uint2 imageSize = make_uint2(renderTargetSizeX, renderTargetSizeY);
+            if (g_selectWithLasso)
+                regionSelector.selectLasso(cuStream, idBuffer.getDevicePointer(), imageSize,
+                                           lassoVertices.data(), static_cast<uint32_t>(lassoVertices.size()),
+                                           frameIndex);
+            else
+                regionSelector.selectRectangle(cuStream, idBuffer.getDevicePointer(), imageSize,
+                                               selectBegin, selectEnd, frameIndex);
+        }
 
         if (takeScreenShot && frameIndex + 1 == 60) {
             CUDADRV_CHECK(cuStreamSynchronize(cuStream));
@@ -1309,8 +1648,22 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUDADRV_CHECK(cuMemFree(renderPlpOnDevice));
     CUDADRV_CHECK(cuMemFree(pickPlpOnDevice));
 
-    for (int i = lengthof(pickInfos) - 1; i >= 0; --i)
-        pickInfos[i].finalize();
+    regionSelector.finalize();
+    idBuffer.finalize();
+    if (regionSelectModule)
+        CUDADRV_CHECK(cuModuleUnload(regionSelectModule));
+
+    pickQueries.finalize();
+
+    rasterMaterialBuffer.finalize();
+    rasterDrawDataBuffer.finalize();
+    bunnyGLTriangleBuffer.finalize();
+    bunnyGLVertexBuffer.finalize();
+    areaLightGLTriangleBuffer.finalize();
+    areaLightGLVertexBuffer.finalize();
+    roomGLTriangleBuffer.finalize();
+    roomGLVertexBuffer.finalize();
+    rasterizer.finalize();
 
     drawOptiXResultShader.finalize();
     vertexArrayForFullScreen.finalize();
@@ -1354,6 +1707,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
+    rayQueryEngine.finalize();
     renderPipeline.finalize();
     pickPipeline.finalize();
 
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "../common/common.h"
+#include "../common/raster_gbuffer.h"
+#include "../common/region_select.h"
 
 namespace Shared {
     static constexpr float Pi = 3.14159265358979323846f;
@@ -78,6 +80,21 @@ namespace Shared {
 
 
 
+    // JP: --raster-gbufferでラスタライズしたGバッファーからシェーディングするための描画アイテムごとの情報。
+    //     Gバッファーのジオメトリインデックスにこの配列のインデックスを描く。
+    // EN: Per-draw-item information to shade from a rasterized G-buffer with --raster-gbuffer.
+    //     The index into this array is drawn as the geometry index of the G-buffer.
+    struct RasterDrawData {
+        GeometryData geomData;
+        const uint8_t* matIndexBuffer;
+        Matrix3x3 normalMatrix;
+        uint32_t instanceIndex;
+        uint32_t sbtGASIndexOffset;
+        uint32_t materialOffset;
+    };
+
+
+
     struct PickPipelineLaunchParameters {
         OptixTraversableHandle travHandle;
         int2 imageSize;
@@ -99,6 +116,14 @@ namespace Shared {
         float colorInterp;
         const PickInfo* pickInfo;
         optixu::NativeBlockBuffer2D<float4> resultBuffer;
+
+        raster_gbuffer::GBuffer gBuffer;
+        const RasterDrawData* rasterDrawData;
+        const MaterialData* rasterMaterials;
+
+        // JP: --region-selectで領域選択に使うIDのGバッファー。無効時はnullptr。
+        // EN: ID G-buffer used for region selection with --region-select. nullptr when disabled.
+        region_select::IDPixel* idBuffer;
     };
 }
 
@@ -35,6 +35,27 @@ struct HitGroupSBTRecordData {
 
 
 
+// JP: --region-selectではカメラレイの最初のヒットのIDをIDのGバッファーに書く。
+// EN: With --region-select, write the IDs of the first hit of the camera ray into the ID G-buffer.
+CUDA_DEVICE_FUNCTION void writeIDPixel(uint32_t instanceID, uint32_t geomInstID) {
+    if (!plp.idBuffer)
+        return;
+    uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+    region_select::IDPixel &pixel = plp.idBuffer[launchIndex.y * plp.imageSize.x + launchIndex.x];
+    pixel.instanceID = instanceID;
+    pixel.geomInstID = geomInstID;
+}
+
+CUDA_DEVICE_FUNCTION float3 shade(const MaterialData &mat, const float3 &sn, bool picked) {
+    float3 snColor = 0.5f * sn + make_float3(0.5f);
+    float3 color = (1 - plp.colorInterp) * mat.color + plp.colorInterp * snColor;
+    if (picked)
+        color = 0.5f * color;
+    return color;
+}
+
+
+
 CUDA_DEVICE_KERNEL void RT_RG_NAME(perspectiveRaygen)() {
     uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
 
@@ -56,6 +77,43 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(perspectiveRaygen)() {
     plp.resultBuffer.write(launchIndex, make_float4(color, 1.0f));
 }
 
+// JP: ラスタライズしたGバッファーの最初のヒットから直接シェーディングし、カメラレイのトレースを省く。
+// EN: Shade directly from the first hit of the rasterized G-buffer, skipping tracing camera rays.
+CUDA_DEVICE_KERNEL void RT_RG_NAME(perspectiveRaygenFromGBuffer)() {
+    uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+
+    float3 color = make_float3(0, 0, 0.1f);
+    raster_gbuffer::FirstHit hit;
+    if (raster_gbuffer::readFirstHit(plp.gBuffer, launchIndex, &hit)) {
+        const RasterDrawData &drawData = plp.rasterDrawData[hit.geometryIndex];
+        const GeometryData &geom = drawData.geomData;
+
+        const Triangle &triangle = geom.triangleBuffer[hit.primitiveIndex];
+        const Vertex &v0 = geom.vertexBuffer[triangle.index0];
+        const Vertex &v1 = geom.vertexBuffer[triangle.index1];
+        const Vertex &v2 = geom.vertexBuffer[triangle.index2];
+
+        float b1 = hit.barycentrics.x;
+        float b2 = hit.barycentrics.y;
+        float b0 = 1 - (b1 + b2);
+        float3 sn = b0 * v0.normal + b1 * v1.normal + b2 * v2.normal;
+
+        sn = normalize(drawData.normalMatrix * sn);
+
+        uint32_t matIndex = drawData.matIndexBuffer ? drawData.matIndexBuffer[hit.primitiveIndex] : 0;
+        const MaterialData &mat = plp.rasterMaterials[drawData.materialOffset + matIndex];
+        const PickInfo &pickInfo = *plp.pickInfo;
+        bool picked =
+            pickInfo.hit &&
+            drawData.instanceIndex == pickInfo.instanceIndex &&
+            drawData.sbtGASIndexOffset + matIndex == pickInfo.matIndex &&
+            hit.primitiveIndex == pickInfo.primIndex;
+        color = shade(mat, sn, picked);
+    }
+
+    plp.resultBuffer.write(launchIndex, make_float4(color, 1.0f));
+}
+
 CUDA_DEVICE_KERNEL void RT_RG_NAME(equirectangularRaygen)() {
     uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
 
@@ -83,6 +141,7 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(equirectangularRaygen)() {
 CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
     float3 color = make_float3(0, 0, 0.1f);
     optixu::setPayloads<RenderPayloadSignature>(&color);
+    writeIDPixel(region_select::invalidID, region_select::invalidID);
 }
 
 CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
@@ -101,13 +160,13 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
 
     sn = normalize(optixTransformNormalFromObjectToWorldSpace(sn));
 
-    float3 snColor = 0.5f * sn + make_float3(0.5f);
-    float3 color = (1 - plp.colorInterp) * mat.color + plp.colorInterp * snColor;
     const PickInfo &pickInfo = *plp.pickInfo;
-    if (pickInfo.hit &&
+    bool picked =
+        pickInfo.hit &&
         optixGetInstanceIndex() == pickInfo.instanceIndex &&
         optixGetSbtGASIndex() == pickInfo.matIndex &&
-        optixGetPrimitiveIndex() == pickInfo.primIndex)
-        color = 0.5f * color;
+        optixGetPrimitiveIndex() == pickInfo.primIndex;
+    float3 color = shade(mat, sn, picked);
     optixu::setPayloads<RenderPayloadSignature>(&color);
+    writeIDPixel(optixGetInstanceId(), geom.geomID);
 }
@@ -27,6 +27,8 @@ EN: This sample demonstrates an example of dynamically add, remove and move obje
 #define STB_IMAGE_IMPLEMENTATION
 #include "../../ext/stb_image.h"
 #include "../common/dds_loader.h"
+#include "../common/scene_journal.h"
+#include "../common/scene_snapshot.h"
 
 
 
@@ -931,9 +933,307 @@ namespace ImGui {
     }
 }
 
+// JP: 小さなシーンとその編集をasset::SceneJournalで記録し、パケットを別のシーン上のミラーで再生して、
+//     両側が同じ状態になったことを確認する。
+// EN: Record a small scene and its edit with asset::SceneJournal and replay the packets by a mirror on another scene,
+//     then check that both sides reached the same state.
+static bool runJournalRoundTripCheck(CUcontext cuContext, optixu::Context optixContext, optixu::Material material,
+                                     CUstream stream) {
+    const asset::MaterialLookup lookupMaterial = [&material](const std::string &name) {
+        if (name != "default")
+            throw std::runtime_error("Unknown material.");
+        return material;
+    };
+
+    cudau::DeviceMemoryArena arena;
+    arena.initialize(cuContext, 16 * 1024 * 1024, OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT);
+    optixu::GASBuildScheduler localScheduler;
+    optixu::GASBuildScheduler remoteScheduler;
+    localScheduler.initialize(&arena, &arena, optixu::GASBuildSequencing::BuildAllThenCompact);
+    remoteScheduler.initialize(&arena, &arena, optixu::GASBuildSequencing::BuildAllThenCompact);
+    optixu::Scene localScene = optixContext.createScene();
+    optixu::Scene remoteScene = optixContext.createScene();
+
+    bool success = true;
+    {
+        asset::SceneMirror localMirror;
+        asset::SceneMirror remoteMirror;
+        localMirror.initialize(cuContext, localScene, lookupMaterial, &localScheduler);
+        remoteMirror.initialize(cuContext, remoteScene, lookupMaterial, &remoteScheduler);
+        asset::SceneJournal journal;
+        journal.initialize(&localMirror);
+
+        asset::SceneMirrorBuildResult localResult;
+        asset::SceneMirrorBuildResult remoteResult;
+        std::vector<uint8_t> packet;
+        const auto sync = [&]() {
+            localMirror.build(stream, &localResult);
+            journal.flush(&packet);
+            remoteMirror.replay(packet.data(), packet.size(), stream);
+            remoteMirror.build(stream, &remoteResult);
+        };
+
+        // JP: 四角形一枚のGASを二つのインスタンスから参照するIASを作る。
+        // EN: Make an IAS referring to a GAS of a single quad from two instances.
+        Shared::Vertex vertices[] = {
+            { float3(-1.0f, -1.0f, 0.0f), float3(0, 0, 1), float2(0, 0) },
+            { float3(1.0f, -1.0f, 0.0f), float3(0, 0, 1), float2(1, 0) },
+            { float3(1.0f, 1.0f, 0.0f), float3(0, 0, 1), float2(1, 1) },
+            { float3(-1.0f, 1.0f, 0.0f), float3(0, 0, 1), float2(0, 1) },
+        };
+        const Shared::Triangle triangles[] = {
+            { 0, 1, 2 }, { 0, 2, 3 }
+        };
+        asset::JournalBufferId vertexBuffer = journal.createBuffer(lengthof(vertices), sizeof(Shared::Vertex));
+        journal.writeBuffer(vertexBuffer, 0, vertices, sizeof(vertices), stream);
+        asset::JournalBufferId triangleBuffer = journal.createBuffer(lengthof(triangles), sizeof(Shared::Triangle));
+        journal.writeBuffer(triangleBuffer, 0, triangles, sizeof(triangles), stream);
+
+        asset::JournalGeomInstId geomInst = journal.createGeometryInstance(optixu::GeometryType::Triangles);
+        journal.setVertexBuffer(geomInst, vertexBuffer);
+        journal.setTriangleBuffer(geomInst, triangleBuffer);
+        journal.setNumMaterials(geomInst, 1);
+        journal.setMaterial(geomInst, 0, 0, "default");
+
+        asset::JournalGASId gas = journal.createGAS(optixu::GeometryType::Triangles);
+        journal.setConfiguration(gas, optixu::ASTradeoff::PreferFastTrace, false, true, false);
+        journal.setNumMaterialSets(gas, 1);
+        journal.setNumRayTypes(gas, 0, Shared::NumRayTypes);
+        journal.addChild(gas, geomInst);
+
+        asset::JournalIASId ias = journal.createIAS();
+        journal.setConfiguration(ias, optixu::ASTradeoff::PreferFastTrace, false, false);
+        asset::JournalInstanceId insts[2];
+        for (uint32_t i = 0; i < lengthof(insts); ++i) {
+            const float transform[] = {
+                1, 0, 0, 2.5f * i,
+                0, 1, 0, 0,
+                0, 0, 1, 0,
+            };
+            insts[i] = journal.createInstance();
+            journal.setChild(insts[i], gas);
+            journal.setID(insts[i], i);
+            journal.setTransform(insts[i], transform);
+            journal.addChild(ias, insts[i]);
+        }
+        sync();
+
+        // JP: 編集をもう一パケット分記録する。
+        // EN: Record one more packet of edits.
+        const float movedTransform[] = {
+            1, 0, 0, -2.5f,
+            0, 1, 0, 1.0f,
+            0, 0, 1, 0,
+        };
+        journal.setTransform(insts[1], movedTransform);
+        vertices[2].position.z = 0.5f;
+        journal.writeBuffer(vertexBuffer, 2 * sizeof(Shared::Vertex), &vertices[2], sizeof(Shared::Vertex), stream);
+        journal.markDirty(gas);
+        journal.markDirty(ias);
+        sync();
+
+        const auto readBuffer = [stream](const cudau::Buffer &buffer) {
+            std::vector<uint8_t> data(buffer.sizeInBytes());
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+            CUDADRV_CHECK(cuMemcpyDtoH(data.data(), buffer.getCUdeviceptr(), data.size()));
+            return data;
+        };
+        success &= readBuffer(localMirror.getBuffer(vertexBuffer)) == readBuffer(remoteMirror.getBuffer(vertexBuffer));
+        success &= readBuffer(localMirror.getBuffer(triangleBuffer)) ==
+            readBuffer(remoteMirror.getBuffer(triangleBuffer));
+        for (asset::JournalInstanceId inst : insts) {
+            float localTransform[12];
+            float remoteTransform[12];
+            localMirror.getInstance(inst).getTransform(localTransform);
+            remoteMirror.getInstance(inst).getTransform(remoteTransform);
+            success &= std::equal(localTransform, localTransform + 12, remoteTransform);
+            success &= localMirror.getInstance(inst).getID() == remoteMirror.getInstance(inst).getID();
+        }
+        success &= localMirror.getIAS(ias).getNumChildren() == remoteMirror.getIAS(ias).getNumChildren();
+        success &= localResult.numBuiltGASs == remoteResult.numBuiltGASs &&
+            localResult.numBuiltIASs == remoteResult.numBuiltIASs;
+        success &= localMirror.getHandle(ias) != 0 && remoteMirror.getHandle(ias) != 0;
+        hpprintf("Journal: %llu bytes for %u GAS and %u IAS builds on the remote side.\n",
+                 journal.getNumFlushedBytes(), remoteResult.numBuiltGASs, remoteResult.numBuiltIASs);
+
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        remoteMirror.finalize();
+        localMirror.finalize();
+    }
+
+    remoteScene.destroy();
+    localScene.destroy();
+    remoteScheduler.finalize();
+    localScheduler.finalize();
+    arena.finalize();
+
+    return success;
+}
+
+// JP: 小さなシーンをasset::SceneSnapshotWriterで一時ファイルに書き出し、別のシーン上に復元して、
+//     グラフの構成とインスタンスの設定が保たれたことを確認する。
+// EN: Write a small scene to a temporary file with asset::SceneSnapshotWriter and restore it on another scene,
+//     then check that the graph structure and instance settings are preserved.
+static bool runSnapshotRoundTripCheck(CUcontext cuContext, optixu::Context optixContext, optixu::Material material,
+                                      CUstream stream) {
+    // JP: スナップショットはマテリアルを名前で結び付ける。
+    // EN: Snapshots bind materials by name.
+    if (std::string_view(material.getName()).empty())
+        material.setName("default");
+    const std::string materialName = material.getName();
+    const asset::MaterialLookup lookupMaterial = [&material, &materialName](const std::string &name) {
+        if (name != materialName)
+            throw std::runtime_error("Unknown material.");
+        return material;
+    };
+    const std::filesystem::path snapshotPath =
+        std::filesystem::temp_directory_path() / "scene_edit_snapshot_check.oxsnap";
+
+    optixu::Scene srcScene = optixContext.createScene();
+    optixu::Scene dstScene = optixContext.createScene();
+
+    // JP: 四角形一枚のGASを二つのインスタンスから参照するIASを作ってビルドする。
+    // EN: Make and build an IAS referring to a GAS of a single quad from two instances.
+    const Shared::Vertex vertices[] = {
+        { float3(-1.0f, -1.0f, 0.0f), float3(0, 0, 1), float2(0, 0) },
+        { float3(1.0f, -1.0f, 0.0f), float3(0, 0, 1), float2(1, 0) },
+        { float3(1.0f, 1.0f, 0.0f), float3(0, 0, 1), float2(1, 1) },
+        { float3(-1.0f, 1.0f, 0.0f), float3(0, 0, 1), float2(0, 1) },
+    };
+    const Shared::Triangle triangles[] = {
+        { 0, 1, 2 }, { 0, 2, 3 }
+    };
+    cudau::TypedBuffer<Shared::Vertex> vertexBuffer(cuContext, cudau::BufferType::Device,
+                                                    vertices, lengthof(vertices));
+    cudau::TypedBuffer<Shared::Triangle> triangleBuffer(cuContext, cudau::BufferType::Device,
+                                                        triangles, lengthof(triangles));
+
+    optixu::GeometryInstance geomInst = srcScene.createGeometryInstance();
+    geomInst.setName("quad");
+    geomInst.setVertexBuffer(vertexBuffer);
+    geomInst.setTriangleBuffer(triangleBuffer);
+    geomInst.setNumMaterials(1, optixu::BufferView());
+    geomInst.setMaterial(0, 0, material);
+    geomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
+
+    optixu::GeometryAccelerationStructure gas = srcScene.createGeometryAccelerationStructure();
+    gas.setName("quadGAS");
+    gas.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, false, false);
+    gas.setNumMaterialSets(1);
+    gas.setNumRayTypes(0, Shared::NumRayTypes);
+    gas.addChild(geomInst);
+
+    optixu::Instance insts[2];
+    optixu::InstanceAccelerationStructure ias = srcScene.createInstanceAccelerationStructure();
+    ias.setName("root");
+    ias.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, false);
+    for (uint32_t i = 0; i < lengthof(insts); ++i) {
+        const float transform[] = {
+            1, 0, 0, 2.5f * i,
+            0, 1, 0, 0.5f * i,
+            0, 0, 1, 0,
+        };
+        insts[i] = srcScene.createInstance();
+        insts[i].setName("inst" + std::to_string(i));
+        insts[i].setChild(gas);
+        insts[i].setID(i);
+        insts[i].setTransform(transform);
+        ias.addChild(insts[i]);
+    }
+
+    OptixAccelBufferSizes asSizes;
+    cudau::Buffer gasMem;
+    cudau::Buffer iasMem;
+    cudau::Buffer scratchMem;
+    cudau::TypedBuffer<OptixInstance> instanceBuffer;
+    gas.prepareForBuild(&asSizes);
+    gasMem.initialize(cuContext, cudau::BufferType::Device, asSizes.outputSizeInBytes, 1);
+    size_t scratchSize = asSizes.tempSizeInBytes;
+    ias.prepareForBuild(&asSizes);
+    iasMem.initialize(cuContext, cudau::BufferType::Device, asSizes.outputSizeInBytes, 1);
+    scratchSize = std::max(scratchSize, asSizes.tempSizeInBytes);
+    instanceBuffer.initialize(cuContext, cudau::BufferType::Device, ias.getNumChildren());
+    scratchMem.initialize(cuContext, cudau::BufferType::Device, scratchSize, 1);
+    gas.rebuild(stream, gasMem, scratchMem);
+    ias.rebuild(stream, instanceBuffer, iasMem, scratchMem);
+    CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+    bool success = true;
+    {
+        asset::SceneSnapshotWriter writer;
+        writer.addRoot(ias);
+        success &= writer.write(snapshotPath, true);
+
+        asset::SceneSnapshot snapshot;
+        success = success && snapshot.load(snapshotPath);
+        if (success) {
+            snapshot.instantiate(cuContext, dstScene, lookupMaterial, stream);
+            CUDADRV_CHECK(cuStreamSynchronize(stream));
+
+            success &= snapshot.getNumRoots() == 1 &&
+                snapshot.getRootType(0) == optixu::ChildType::IAS &&
+                snapshot.getRootHandle(0) != 0;
+            success &= snapshot.getNumGeometryASs() == 1 && snapshot.findGeometryAS("quadGAS");
+            optixu::GeometryInstance dstGeomInst = snapshot.findGeometryInstance("quad");
+            success &= dstGeomInst && dstGeomInst.getMaterial(0, 0) == material;
+            optixu::InstanceAccelerationStructure dstIAS = snapshot.findInstanceAS("root");
+            success &= dstIAS && dstIAS.getNumChildren() == ias.getNumChildren();
+            for (uint32_t i = 0; i < lengthof(insts); ++i) {
+                optixu::Instance dstInst = snapshot.findInstance(insts[i].getName());
+                if (!dstInst) {
+                    success = false;
+                    continue;
+                }
+                float srcTransform[12];
+                float dstTransform[12];
+                insts[i].getTransform(srcTransform);
+                dstInst.getTransform(dstTransform);
+                success &= std::equal(srcTransform, srcTransform + 12, dstTransform);
+                success &= dstInst.getID() == insts[i].getID();
+            }
+            hpprintf("Snapshot: %u of %u GASs relocated without rebuilding.\n",
+                     snapshot.getNumRelocatedGeometryASs(), snapshot.getNumGeometryASs());
+        }
+        snapshot.finalize();
+    }
+    std::error_code ec;
+    std::filesystem::remove(snapshotPath, ec);
+
+    instanceBuffer.finalize();
+    scratchMem.finalize();
+    iasMem.finalize();
+    gasMem.finalize();
+    ias.destroy();
+    for (int i = lengthof(insts) - 1; i >= 0; --i)
+        insts[i].destroy();
+    gas.destroy();
+    geomInst.destroy();
+    triangleBuffer.finalize();
+    vertexBuffer.finalize();
+    dstScene.destroy();
+    srcScene.destroy();
+
+    return success;
+}
+
 int32_t main(int32_t argc, const char* argv[]) try {
     const std::filesystem::path exeDir = getExecutableDirectory();
 
+    bool checkJournal = false;
+    bool checkSnapshot = false;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--journal-check")
+            checkJournal = true;
+        else if (arg == "--snapshot-check")
+            checkSnapshot = true;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OpenGL, GLFWの初期化。
     // EN: Initialize OpenGL and GLFW.
@@ -1256,6 +1556,19 @@ int32_t main(int32_t argc, const char* argv[]) try {
     optixEnv.iasSerialID = 0;
     optixEnv.asScratchBuffer.initialize(cuContext, g_bufferType, 32 * 1024 * 1024, 1);
 
+    // JP: --journal-checkが指定された場合、シーンジャーナルの往復を確認する。
+    // EN: Check a round trip of the scene journal when --journal-check is specified.
+    if (checkJournal) {
+        bool journalOK = runJournalRoundTripCheck(cuContext, optixContext, optixEnv.material, cuStream);
+        hpprintf("Journal round-trip check: %s\n", journalOK ? "passed" : "FAILED");
+    }
+    // JP: --snapshot-checkが指定された場合、シーンスナップショットの往復を確認する。
+    // EN: Check a round trip of the scene snapshot when --snapshot-check is specified.
+    if (checkSnapshot) {
+        bool snapshotOK = runSnapshotRoundTripCheck(cuContext, optixContext, optixEnv.material, cuStream);
+        hpprintf("Snapshot round-trip check: %s\n", snapshotOK ? "passed" : "FAILED");
+    }
+
     // END: Setup a scene.
     // ----------------------------------------------------------------
 
@@ -1323,6 +1636,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
             break;
         glfwPollEvents();
 
+        // JP: GPUの使用が完了した古いバッファーを解放する。
+        // EN: Free old buffers whose use by the GPU has completed.
+        optixContext.processDeferredReleases();
+
         bool resized = false;
         int32_t newFBWidth;
         int32_t newFBHeight;
@@ -2009,21 +2326,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
             hpprintf("GAS: %s\n", kv.second->name.c_str());
             hpprintf("AS Size: %llu bytes\n", bufferSizes.outputSizeInBytes);
             hpprintf("Scratch Size: %llu bytes\n", bufferSizes.tempSizeInBytes);
-            // JP: ASのメモリをGPUが使用中に確保しなおすのは危険なため使用の完了を待つ。
-            //     CPU/GPUの非同期実行を邪魔したくない場合、完全に別のバッファーを用意してそれと切り替える必要がある。
+            // JP: ASのメモリをGPUが使用中に確保しなおすのは危険なため、
+            //     古いバッファーはストリーム上の処理の完了後に解放されるよう遅延させ、新たなバッファーに切り替える。
+            //     これによりCPU/GPUの非同期実行を邪魔せずに済む。
             // EN: It is dangerous to reallocate AS memory during the GPU is using it,
-            //     so wait the completion of use.
-            //     You need to prepare a completely separated buffer and switch the current with it
-            //     if you don't want to interfere CPU/GPU asynchronous execution.
-            if (geomGroup->optixGasMem.isInitialized()) {
-                if (bufferSizes.outputSizeInBytes > geomGroup->optixGasMem.sizeInBytes()) {
-                    CUDADRV_CHECK(cuStreamSynchronize(cuStream));
-                    geomGroup->optixGasMem.resize(bufferSizes.outputSizeInBytes, 1, cuStream);
-                    // TODO: cuStreamを待つのではなくresize()にdefault streamを渡して待つようにしても良いかもしれない。
-                }
-            }
-            else {
-                CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            //     so defer freeing the old buffer until the work on the stream completes and switch to a new buffer.
+            //     This avoids interfering CPU/GPU asynchronous execution.
+            if (!geomGroup->optixGasMem.isInitialized() ||
+                bufferSizes.outputSizeInBytes > geomGroup->optixGasMem.sizeInBytes()) {
+                optixu::deferFinalize(optixContext, cuStream, std::move(geomGroup->optixGasMem));
                 geomGroup->optixGasMem.initialize(optixEnv.cuContext, g_bufferType, bufferSizes.outputSizeInBytes, 1);
             }
             geomGroup->optixGAS.rebuild(cuStream, geomGroup->optixGasMem, optixEnv.asScratchBuffer);
@@ -2057,23 +2368,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
             hpprintf("Scratch Size: %llu bytes\n", bufferSizes.tempSizeInBytes);
             if (bufferSizes.tempSizeInBytes >= optixEnv.asScratchBuffer.sizeInBytes())
                 optixEnv.asScratchBuffer.resize(bufferSizes.tempSizeInBytes, 1, cuStream);
-            // JP: ASのメモリをGPUが使用中に確保しなおすのは危険なため使用の完了を待つ。
-            //     CPU/GPUの非同期実行を邪魔しないためには、完全に別のバッファーを用意してそれと切り替える必要がある。
-            // EN: It is dangerous to reallocate AS memory during the GPU is using it,
-            //     so wait the completion of use.
-            //     You need to prepare a completely separated buffer and switch the current with it
-            //     if you don't want to interfere CPU/GPU asynchronous execution.
-            if (group->optixIasMem.isInitialized()) {
-                if (bufferSizes.outputSizeInBytes > group->optixIasMem.sizeInBytes() ||
-                    group->optixIAS.getNumChildren() > group->optixInstanceBuffer.numElements()) {
-                    CUDADRV_CHECK(cuStreamSynchronize(cuStream));
-                    group->optixIasMem.resize(bufferSizes.outputSizeInBytes, 1, cuStream);
-                    group->optixInstanceBuffer.resize(group->optixIAS.getNumChildren());
-                    // TODO: cuStreamを待つのではなくresize()にdefault streamを渡して待つようにしても良いかもしれない。
-                }
-            }
-            else {
-                CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            // JP: GASと同様に古いバッファーの解放を遅延させて新たなバッファーに切り替える。
+            // EN: Defer freeing the old buffers and switch to new buffers as with GASs.
+            if (!group->optixIasMem.isInitialized() ||
+                bufferSizes.outputSizeInBytes > group->optixIasMem.sizeInBytes() ||
+                group->optixIAS.getNumChildren() > group->optixInstanceBuffer.numElements()) {
+                optixu::deferFinalize(optixContext, cuStream, std::move(group->optixIasMem));
+                optixu::deferFinalize(optixContext, cuStream, std::move(group->optixInstanceBuffer));
                 group->optixIasMem.initialize(optixEnv.cuContext, g_bufferType, bufferSizes.outputSizeInBytes, 1);
                 group->optixInstanceBuffer.initialize(optixEnv.cuContext, g_bufferType, group->optixIAS.getNumChildren());
             }
@@ -8,13 +8,36 @@ EN: This sample shows how to build a single geometry acceleration structure (GAS
     which is the simplest graph configuration the OptiX supports.
     A GAS builds from multiple geometries (and their static transforms).
 
+    --stream-assets:
+    JP: バニーのメッシュをasset::AssetStreamerで別スレッドで読み込み、その間にパイプラインを設定する。
+    EN: Load the bunny mesh on separate threads with asset::AssetStreamer while setting up the pipeline.
+
 */
 
 #include "single_gas_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/asset_streamer.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    BenchmarkOptions benchOptions;
+    bool streamAssets = false;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        if (parseBenchmarkArgument(argc, argv, &argIdx, &benchOptions))
+            continue;
+        std::string_view arg = argv[argIdx];
+        if (arg == "--stream-assets") {
+            streamAssets = true;
+            ++argIdx;
+            continue;
+        }
+        // JP: このサンプルは従来通りベンチマーク以外の引数を無視する。
+        // EN: This sample ignores arguments other than the benchmark ones as before.
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -28,6 +51,52 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
     CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
 
+    BenchmarkRecorder bench;
+    if (benchOptions.enabled)
+        bench.initialize(cuContext, "single_gas", benchOptions);
+
+    // JP: ストリーミングする場合はバニーの読み込みを先に発行し、パイプラインの設定と重ねる。
+    //     TypedBufferは追加のメンバーを持たないので、完了したバッファーを基底クラスとしてmoveで受け取れる。
+    // EN: Issue loading the bunny first to overlap it with the pipeline setup when streaming.
+    //     TypedBuffer has no additional members, so completed buffers can be received by move as the base class.
+    asset::AssetStreamer streamer;
+    cudau::TypedBuffer<Shared::Vertex> bunnyVertexBuffer;
+    cudau::TypedBuffer<Shared::Triangle> bunnyTriangleBuffer;
+    bool bunnyStreamed = false;
+    if (streamAssets) {
+        streamer.initialize(cuContext, cudau::BufferType::Device);
+        streamer.request(
+            "../../data/stanford_bunny_309_faces.obj", false,
+            [](const std::filesystem::path &path, const std::vector<uint8_t> &, asset::DecodedMesh* mesh) {
+                std::vector<obj::Vertex> objVertices;
+                std::vector<obj::Triangle> objTriangles;
+                obj::load(path, &objVertices, &objTriangles);
+
+                mesh->vertexStride = sizeof(Shared::Vertex);
+                mesh->vertexData.resize(objVertices.size() * sizeof(Shared::Vertex));
+                auto vertices = reinterpret_cast<Shared::Vertex*>(mesh->vertexData.data());
+                for (int vIdx = 0; vIdx < objVertices.size(); ++vIdx) {
+                    const obj::Vertex &objVertex = objVertices[vIdx];
+                    vertices[vIdx] = Shared::Vertex{ objVertex.position, objVertex.normal, objVertex.texCoord };
+                }
+                static_assert(sizeof(Shared::Triangle) == sizeof(obj::Triangle),
+                              "Assume triangle formats are the same.");
+                mesh->triangleStride = sizeof(Shared::Triangle);
+                mesh->triangleData.resize(objTriangles.size() * sizeof(Shared::Triangle));
+                std::copy_n(reinterpret_cast<const uint8_t*>(objTriangles.data()),
+                            mesh->triangleData.size(), mesh->triangleData.data());
+                return true;
+            },
+            nullptr,
+            [&](asset::StreamedAsset &a) {
+                if (a.failed)
+                    return;
+                static_cast<cudau::Buffer &>(bunnyVertexBuffer) = std::move(a.vertexBuffer);
+                static_cast<cudau::Buffer &>(bunnyTriangleBuffer) = std::move(a.triangleBuffer);
+                bunnyStreamed = true;
+            });
+    }
+
     optixu::Context optixContext = optixu::Context::create(cuContext);
 
     optixu::Pipeline pipeline = optixContext.createPipeline();
@@ -254,9 +323,13 @@ int32_t main(int32_t argc, const char* argv[]) try {
     }
 
     optixu::GeometryInstance bunnyGeomInst = scene.createGeometryInstance();
-    cudau::TypedBuffer<Shared::Vertex> bunnyVertexBuffer;
-    cudau::TypedBuffer<Shared::Triangle> bunnyTriangleBuffer;
-    {
+    if (streamAssets) {
+        streamer.waitAll();
+        streamer.finalize();
+        if (!bunnyStreamed)
+            throw std::runtime_error("Failed to stream the bunny mesh.");
+    }
+    else {
         std::vector<Shared::Vertex> vertices;
         std::vector<Shared::Triangle> triangles;
         {
@@ -279,7 +352,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         bunnyVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices);
         bunnyTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
-
+    }
+    {
         Matrix3x3 matSR = rotateY3x3(M_PI / 4) * scale3x3(0.012f);
 
         Shared::GeometryData geomData = {};
@@ -332,14 +406,18 @@ int32_t main(int32_t argc, const char* argv[]) try {
     // JP: Geometry Acceleration Structureをビルドする。
     // EN: Build geometry acceleration structures.
     asBuildScratchMem.initialize(cuContext, cudau::BufferType::Device, maxSizeOfScratchBuffer, 1);
+    bench.start(BenchmarkRecorder::Stage::ASBuild, cuStream);
     OptixTraversableHandle travHandle = gas.rebuild(cuStream, gasMem, asBuildScratchMem);
+    bench.stop(BenchmarkRecorder::Stage::ASBuild, cuStream);
 
     // JP: 静的なメッシュはコンパクションもしておく。
     // EN: Perform compaction for static meshes.
     size_t compactedASSize;
     gas.prepareForCompact(&compactedASSize);
     gasCompactedMem.initialize(cuContext, cudau::BufferType::Device, compactedASSize, 1);
+    bench.start(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     travHandle = gas.compact(cuStream, gasCompactedMem);
+    bench.stop(BenchmarkRecorder::Stage::ASCompaction, cuStream);
     gas.removeUncompacted();
     gasMem.finalize();
 
@@ -347,11 +425,16 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     // JP: シーンのシェーダーバインディングテーブルの確保。
     // EN: Allocate the shader binding table for the scene.
+    StopWatchHiRes<> sbtStopWatch;
+    sbtStopWatch.start();
     cudau::Buffer hitGroupSBT;
     size_t hitGroupSbtSize;
     scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
     hitGroupSBT.initialize(cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
     hitGroupSBT.setMappedMemoryPersistent(true);
+    bench.record(BenchmarkRecorder::Stage::SBTSetup,
+                 sbtStopWatch.getElapsed(StopWatchDurationType::Microseconds) * 1e-3f);
+    sbtStopWatch.stop();
 
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
@@ -385,11 +468,35 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
-    CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
-    pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
-    CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+    if (bench.isEnabled()) {
+        // JP: ベンチマークモードでは固定のカメラパスに沿って描画し、結果をJSONに書き出す。
+        // EN: Render along the fixed camera path in the benchmark mode and write the results to JSON.
+        bench.setImageSize(renderTargetSizeX, renderTargetSizeY);
+        BlockBufferReadback<float4, 1> readback;
+        while (!bench.isFinished()) {
+            bench.beginFrame();
+            calcBenchmarkCameraPose(bench.getFrameIndex(), bench.getNumTotalFrames(),
+                                    make_float3(0, 0, 0), 3.5f, 0.5f,
+                                    &plp.camera.position, &plp.camera.orientation);
+            CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+            bench.start(BenchmarkRecorder::Stage::Launch, cuStream);
+            pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+            bench.stop(BenchmarkRecorder::Stage::Launch, cuStream);
+            bench.start(BenchmarkRecorder::Stage::Readback, cuStream);
+            readback.enqueue(accumBuffer, cuStream);
+            bench.stop(BenchmarkRecorder::Stage::Readback, cuStream);
+            bench.endFrame(static_cast<uint64_t>(renderTargetSizeX) * renderTargetSizeY);
+        }
+        bench.write();
+        bench.finalize();
+    }
+    else {
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+        pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
-    saveImage("output.png", accumBuffer, false, false);
+        saveImage("output.png", accumBuffer, false, false);
+    }
 
 
 
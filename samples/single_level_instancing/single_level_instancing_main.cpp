@@ -13,13 +13,53 @@ EN: This sample shows how to build an instance acceleration structure (IAS) from
     Additionally, only rebuilding or updating an IAS is required when updating an instance's transform so
     you can handle dynamic scene with low cost.
 
+    --asset-container:
+    JP: バニーのメッシュをasset::ContainerWriterで一時ファイルに詰め、メモリーマップしたコンテナーから転送する。
+    EN: Pack the bunny mesh into a temporary file with asset::ContainerWriter and transfer it from
+        the memory-mapped container.
+
+    --srt-transforms:
+    JP: バニーのスケール・回転・平行移動の配列からinstance_transforms::composeSRTTransforms()で変換をまとめて求める。
+        GPU版のinstance_transforms::DeviceComposerでインスタンスバッファーの複製に書き込んだ変換とも比較する。
+    EN: Compose transforms of the bunnies together from arrays of scales, rotations and translations
+        with instance_transforms::composeSRTTransforms().
+        Compare them also with transforms written into a copy of the instance buffer by
+        GPU-side instance_transforms::DeviceComposer.
+
+    --mesh-lod:
+    JP: バニーをmesh_simplifier::buildLodChains()で簡略化してレベルごとにコンパクション付きのGASを作り、
+        各インスタンスはスケールから求めた画面上の大きさに応じたレベルのGASを参照する。
+    EN: Simplify the bunny with mesh_simplifier::buildLodChains() to make a GAS with compaction per level,
+        and each instance refers to the GAS of the level according to its on-screen size computed from the scale.
+
 */
 
 #include "single_level_instancing_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/asset_container.h"
+#include "../common/instance_transforms.h"
+#include "../common/mesh_simplifier.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    bool useAssetContainer = false;
+    bool useSRTTransforms = false;
+    bool useMeshLod = false;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--asset-container")
+            useAssetContainer = true;
+        else if (arg == "--srt-transforms")
+            useSRTTransforms = true;
+        else if (arg == "--mesh-lod")
+            useMeshLod = true;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -196,6 +236,14 @@ int32_t main(int32_t argc, const char* argv[]) try {
         areaLightGeomInst.setUserData(geomData);
     }
 
+    // JP: --mesh-lodの場合のバニーのLODチェーン。全レベルの頂点と三角形は一つのプールに格納する。
+    // EN: LOD chain of the bunny for --mesh-lod. Vertices and triangles of all levels are stored in a single pool.
+    const float bunnyLodTargetRatios[] = { 1.0f, 0.25f, 0.0625f };
+    cudau::DeviceMemoryArena bunnyLodArena;
+    optixu::GASBuildScheduler bunnyLodScheduler;
+    optixu::HostGeometryPool<Shared::Vertex> bunnyLodPool;
+    std::vector<mesh_simplifier::GeometryLodChain> bunnyLodChains;
+
     optixu::GeometryInstance bunnyGeomInst = scene.createGeometryInstance();
     cudau::TypedBuffer<Shared::Vertex> bunnyVertexBuffer;
     cudau::TypedBuffer<Shared::Triangle> bunnyTriangleBuffer;
@@ -220,8 +268,35 @@ int32_t main(int32_t argc, const char* argv[]) try {
                         triangles.data());
         }
 
-        bunnyVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices);
-        bunnyTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
+        if (useAssetContainer) {
+            const std::filesystem::path containerPath =
+                std::filesystem::temp_directory_path() / "single_level_instancing_bunny.oxac";
+            asset::ContainerWriter writer;
+            writer.addMesh("bunny", vertices, triangles);
+            if (!writer.write(containerPath))
+                throw std::runtime_error("Failed to write the asset container.");
+
+            asset::MappedContainer container;
+            if (!container.open(containerPath))
+                throw std::runtime_error("Failed to open the asset container.");
+            cudau::PinnedStagingPool stagingPool;
+            stagingPool.initialize(cuContext);
+            std::vector<cudau::TransferToken> tokens;
+            if (!container.uploadMesh("bunny", cuContext, cudau::BufferType::Device,
+                                      &bunnyVertexBuffer, &bunnyTriangleBuffer, bunnyGeomInst,
+                                      stagingPool, cuStream, &tokens))
+                throw std::runtime_error("Bunny mesh is not found in the asset container.");
+            CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+            tokens.clear();
+            stagingPool.finalize();
+            container.close();
+            std::error_code ec;
+            std::filesystem::remove(containerPath, ec);
+        }
+        else {
+            bunnyVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices);
+            bunnyTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
+        }
 
         Shared::GeometryData geomData = {};
         geomData.vertexBuffer = bunnyVertexBuffer.getDevicePointer();
@@ -233,6 +308,44 @@ int32_t main(int32_t argc, const char* argv[]) try {
         bunnyGeomInst.setMaterial(0, 0, mat0);
         bunnyGeomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
         bunnyGeomInst.setUserData(geomData);
+
+        if (useMeshLod) {
+            bunnyLodArena.initialize(cuContext, 16 * 1024 * 1024, OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT);
+            bunnyLodScheduler.initialize(&bunnyLodArena, &bunnyLodArena, optixu::GASBuildSequencing::BuildAllThenCompact);
+            bunnyLodPool.initialize(
+                cuContext, cudau::BufferType::Device,
+                static_cast<uint32_t>(vertices.size() * lengthof(bunnyLodTargetRatios)),
+                static_cast<uint32_t>(triangles.size() * lengthof(bunnyLodTargetRatios)));
+
+            std::vector<mesh_simplifier::MeshDesc<Shared::Vertex>> meshes(1);
+            meshes[0].vertices = vertices.data();
+            meshes[0].numVertices = static_cast<uint32_t>(vertices.size());
+            meshes[0].triangles = reinterpret_cast<const uint3*>(triangles.data());
+            meshes[0].numTriangles = static_cast<uint32_t>(triangles.size());
+            mesh_simplifier::buildLodChains(
+                cuStream, scene, &bunnyLodPool, meshes, bunnyLodTargetRatios, lengthof(bunnyLodTargetRatios), 0.05f,
+                [&](optixu::GeometryInstance geomInst, uint32_t meshIdx) {
+                    geomInst.setMaterial(0, 0, mat0);
+                    geomInst.setGeometryFlags(0, OPTIX_GEOMETRY_FLAG_NONE);
+                }, Shared::NumRayTypes, &bunnyLodScheduler, &bunnyLodChains);
+            bunnyLodPool.uploadRanges(cuStream);
+
+            // JP: プール中の三角形はレベルの先頭の頂点からの相対インデックスを持ち、
+            //     プリミティブインデックスにはプール全体でのオフセットが付く。
+            // EN: Triangles in the pool have indices relative to the first vertex of the level,
+            //     and the primitive index has the offset in the whole pool.
+            const optixu::GeometryPool<Shared::Vertex> pool = bunnyLodPool.getGeometryPool();
+            const mesh_simplifier::GeometryLodChain &chain = bunnyLodChains[0];
+            for (uint32_t level = 0; level < chain.geomInsts.size(); ++level) {
+                const optixu::GeometryPoolRange &range = bunnyLodPool.getRange(chain.rangeIndices[level]);
+                Shared::GeometryData lodGeomData = {};
+                lodGeomData.vertexBuffer = pool.vertices + range.vertexOffset;
+                lodGeomData.triangleBuffer = reinterpret_cast<const Shared::Triangle*>(pool.triangles);
+                chain.geomInsts[level].setUserData(lodGeomData);
+                hpprintf("Bunny LOD %u: %u triangles, error %g\n",
+                         level, range.numTriangles, chain.errors[level]);
+            }
+        }
     }
 
 
@@ -294,6 +407,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     std::vector<optixu::Instance> bunnyInsts(NumBunnies);
     const float GoldenRatio = (1 + std::sqrt(5.0f)) / 2;
     const float GoldenAngle = 2 * M_PI / (GoldenRatio * GoldenRatio);
+    std::vector<float> bunnySRTComponents[10];
     for (int i = 0; i < NumBunnies; ++i) {
         float t = static_cast<float>(i) / (NumBunnies - 1);
         float r = 0.9f * std::pow(t, 0.5f);
@@ -302,16 +416,61 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         float tt = std::pow(t, 0.25f);
         float scale = (1 - tt) * 0.003f + tt * 0.0006f;
-        float bunnyInstXfm[] = {
-            scale, 0, 0, x,
-            0, scale, 0, -0.999f + (1 - tt),
-            0, 0, scale, z
-        };
         optixu::Instance bunnyInst = scene.createInstance();
-        bunnyInst.setChild(bunnyGas);
-        bunnyInst.setTransform(bunnyInstXfm);
+        if (useMeshLod) {
+            // JP: 最大のバニーに対する投影面積の比を超えない最も細かいレベルを選ぶ。
+            // EN: Select the finest level not exceeding the ratio of the projected area relative to the largest bunny.
+            const std::vector<optixu::GeometryAccelerationStructure> &lodGases = bunnyLodChains[0].gases;
+            const float relScale = scale / 0.003f;
+            uint32_t level = 0;
+            while (level + 1 < lodGases.size() && bunnyLodTargetRatios[level + 1] >= relScale * relScale)
+                ++level;
+            bunnyInst.setChild(lodGases[level]);
+        }
+        else {
+            bunnyInst.setChild(bunnyGas);
+        }
+        if (useSRTTransforms) {
+            // JP: 成分ごとの配列に(スケール, Y軸回りの回転のクォータニオン, 平行移動)を積む。
+            // EN: Push (scale, quaternion of rotation around Y axis, translation) to arrays per component.
+            float halfAngle = 0.5f * GoldenAngle * i;
+            const float srt[10] = {
+                scale, scale, scale,
+                0.0f, std::sin(halfAngle), 0.0f, std::cos(halfAngle),
+                x, -0.999f + (1 - tt), z
+            };
+            for (int cIdx = 0; cIdx < lengthof(srt); ++cIdx)
+                bunnySRTComponents[cIdx].push_back(srt[cIdx]);
+        }
+        else {
+            float bunnyInstXfm[] = {
+                scale, 0, 0, x,
+                0, scale, 0, -0.999f + (1 - tt),
+                0, 0, scale, z
+            };
+            bunnyInst.setTransform(bunnyInstXfm);
+        }
         bunnyInsts[i] = bunnyInst;
     }
+    const auto getSRTArrays = [](const float* const components[10]) {
+        instance_transforms::SRTArrays srts;
+        for (int i = 0; i < 3; ++i) {
+            srts.scale[i] = components[i];
+            srts.translation[i] = components[7 + i];
+        }
+        for (int i = 0; i < 4; ++i)
+            srts.rotation[i] = components[3 + i];
+        return srts;
+    };
+    std::vector<float> bunnyTransforms;
+    if (useSRTTransforms) {
+        const float* components[10];
+        for (int cIdx = 0; cIdx < lengthof(components); ++cIdx)
+            components[cIdx] = bunnySRTComponents[cIdx].data();
+        bunnyTransforms.resize(12 * NumBunnies);
+        instance_transforms::composeSRTTransforms(getSRTArrays(components), NumBunnies, bunnyTransforms.data());
+        instance_transforms::setTransforms(bunnyInsts.data(), NumBunnies, bunnyTransforms.data());
+    }
 
 
 
@@ -343,6 +502,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
     roomGas.rebuild(cuStream, roomGasMem, asBuildScratchMem);
     areaLightGas.rebuild(cuStream, areaLightGasMem, asBuildScratchMem);
     bunnyGas.rebuild(cuStream, bunnyGasMem, asBuildScratchMem);
+    if (useMeshLod)
+        bunnyLodScheduler.build(cuStream);
 
     // JP: 静的なメッシュはコンパクションもしておく。
     //     複数のメッシュのASをひとつのバッファーに詰めて記録する。
@@ -398,6 +559,53 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
 
+    // JP: GPU版ではIAS::setDeviceInstances()で使うインスタンスバッファーに直接書き込むが、
+    //     ここではビルドに使ったインスタンスバッファーの複製のバニーの範囲に書き込んでホスト版の結果と比べる。
+    // EN: The GPU version writes directly into an instance buffer used with IAS::setDeviceInstances(),
+    //     but here write into the range of the bunnies in a copy of the instance buffer used for the build
+    //     and compare with the results of the host version.
+    if (useSRTTransforms) {
+        CUmodule moduleInstanceTransforms;
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleInstanceTransforms,
+            (getExecutableDirectory() /
+             "single_level_instancing/ptxes/instance_transforms_kernels.ptx").string().c_str()));
+        instance_transforms::DeviceComposer composer;
+        composer.initialize(moduleInstanceTransforms);
+
+        cudau::TypedBuffer<float> srtComponentsOnDevice[10];
+        const float* components[10];
+        for (int cIdx = 0; cIdx < lengthof(srtComponentsOnDevice); ++cIdx) {
+            srtComponentsOnDevice[cIdx].initialize(cuContext, cudau::BufferType::Device, bunnySRTComponents[cIdx]);
+            components[cIdx] = srtComponentsOnDevice[cIdx].getDevicePointer();
+        }
+        cudau::TypedBuffer<OptixInstance> composedInstances = instanceBuffer.copy(cuStream);
+        const uint32_t bunnyInstOffset = 2;
+        composer.compose(cuStream, getSRTArrays(components), NumBunnies,
+                         composedInstances.getCUdeviceptr() + sizeof(OptixInstance) * bunnyInstOffset);
+        std::vector<OptixInstance> composedInstancesOnHost(composedInstances.numElements());
+        composedInstances.read(composedInstancesOnHost, cuStream);
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+
+        uint32_t numMismatches = 0;
+        for (uint32_t i = 0; i < NumBunnies; ++i) {
+            const float* devXfm = composedInstancesOnHost[bunnyInstOffset + i].transform;
+            const float* hostXfm = &bunnyTransforms[12 * i];
+            bool match = true;
+            for (int eIdx = 0; eIdx < 12; ++eIdx)
+                match &= std::fabs(devXfm[eIdx] - hostXfm[eIdx]) <= 1e-6f * std::fmax(1.0f, std::fabs(hostXfm[eIdx]));
+            if (!match)
+                ++numMismatches;
+        }
+        hpprintf("SRT transform check: %u/%u mismatches: %s\n",
+                 numMismatches, NumBunnies, numMismatches == 0 ? "passed" : "FAILED");
+
+        composedInstances.finalize();
+        for (int cIdx = lengthof(srtComponentsOnDevice) - 1; cIdx >= 0; --cIdx)
+            srtComponentsOnDevice[cIdx].finalize();
+        CUDADRV_CHECK(cuModuleUnload(moduleInstanceTransforms));
+    }
+
     // END: Setup a scene.
     // ----------------------------------------------------------------
 
@@ -463,6 +671,16 @@ int32_t main(int32_t argc, const char* argv[]) try {
     areaLightGas.destroy();
     roomGas.destroy();
 
+    bunnyLodScheduler.finalize();
+    for (mesh_simplifier::GeometryLodChain &chain : bunnyLodChains) {
+        for (int level = chain.gases.size() - 1; level >= 0; --level) {
+            chain.gases[level].destroy();
+            chain.geomInsts[level].destroy();
+        }
+    }
+    bunnyLodPool.finalize();
+    bunnyLodArena.finalize();
+
     bunnyTriangleBuffer.finalize();
     bunnyVertexBuffer.finalize();
     bunnyGeomInst.destroy();
@@ -55,6 +55,7 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(pathTracing)() {
     DenoiserData denoiserData;
     denoiserData.firstHitAlbedo = make_float3(0.0f, 0.0f, 0.0f);
     denoiserData.firstHitNormal = make_float3(0.0f, 0.0f, 0.0f);
+    denoiserData.firstHitInstanceIndex = motion_vectors::invalidInstanceIndex;
     DenoiserData* denoiserDataPtr = &denoiserData;
     while (true) {
         optixu::trace<SearchRayPayloadSignature>(
@@ -99,6 +100,15 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(pathTracing)() {
     if (plp.resetFlowBuffer || isnan(denoiserData.firstHitPrevPositionInWorld.x))
         flow = make_float2(0.0f, 0.0f);
     plp.linearFlowBuffer[launchIndex.y * plp.imageSize.x + launchIndex.x] = make_float2(flow.x, flow.y/*, 0.0f, 0.0f*/);
+
+    // JP: motion_vectors::Generatorで同じフローを求めるためのGバッファー。
+    // EN: G-buffer to compute the same flow with motion_vectors::Generator.
+    if (plp.firstHitBuffer) {
+        motion_vectors::FirstHit firstHit;
+        firstHit.positionInObject = denoiserData.firstHitPositionInObject;
+        firstHit.instanceIndex = denoiserData.firstHitInstanceIndex;
+        plp.firstHitBuffer[launchIndex.y * plp.imageSize.x + launchIndex.x] = firstHit;
+    }
 }
 
 CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
@@ -111,6 +121,7 @@ CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
         denoiserData->firstHitAlbedo = make_float3(0.0f, 0.0f, 0.0f);
         denoiserData->firstHitNormal = make_float3(0.0f, 0.0f, 0.0f);
         denoiserData->firstHitPrevPositionInWorld = make_float3(NAN, NAN, NAN);
+        denoiserData->firstHitInstanceIndex = motion_vectors::invalidInstanceIndex;
     }
 }
 
@@ -154,6 +165,8 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(shading)() {
         denoiserData->firstHitAlbedo = albedo;
         denoiserData->firstHitNormal = sn;
         denoiserData->firstHitPrevPositionInWorld = inst.prevScale * (inst.prevRotation * p) + inst.prevTranslation;
+        denoiserData->firstHitPositionInObject = p;
+        denoiserData->firstHitInstanceIndex = optixGetInstanceIndex();
     }
 
     p = optixTransformPointFromObjectToWorldSpace(p);
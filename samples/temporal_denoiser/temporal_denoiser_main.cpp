@@ -16,6 +16,8 @@ EN: This sample shows how to use the temporal denoiser.
 
 #include "../common/obj_loader.h"
 #include "../common/dds_loader.h"
+#include "../common/overlapped_denoiser.h"
+#include <cuda_fp16.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "../../ext/stb_image.h"
 
@@ -102,12 +104,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
     const std::filesystem::path exeDir = getExecutableDirectory();
 
     bool takeScreenShot = false;
+    bool checkMotionVectors = false;
 
     uint32_t argIdx = 1;
     while (argIdx < argc) {
         std::string_view arg = argv[argIdx];
         if (arg == "--screen-shot")
             takeScreenShot = true;
+        else if (arg == "--motion-vector-check")
+            checkMotionVectors = true;
         else
             throw std::runtime_error("Unknown command line argument.");
         ++argIdx;
@@ -947,21 +952,12 @@ int32_t main(int32_t argc, const char* argv[]) try {
     normalAccumBuffer.initialize2D(cuContext, cudau::ArrayElementType::Float32, 4,
                                    cudau::ArraySurface::Enable, cudau::ArrayTextureGather::Disable,
                                    renderTargetSizeX, renderTargetSizeY, 1);
-    cudau::TypedBuffer<float4> linearBeautyBuffer;
-    cudau::TypedBuffer<float4> linearAlbedoBuffer;
-    cudau::TypedBuffer<float4> linearNormalBuffer;
-    cudau::TypedBuffer<float2> linearFlowBuffer;
-    cudau::TypedBuffer<float4> linearDenoisedBeautyBuffer;
-    linearBeautyBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                 renderTargetSizeX * renderTargetSizeY);
-    linearAlbedoBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                  renderTargetSizeX * renderTargetSizeY);
-    linearNormalBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                  renderTargetSizeX * renderTargetSizeY);
-    linearFlowBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                renderTargetSizeX * renderTargetSizeY);
-    linearDenoisedBeautyBuffer.initialize(cuContext, cudau::BufferType::Device,
-                                  renderTargetSizeX * renderTargetSizeY);
+    // JP: デノイザーの入出力のリニアバッファーはフレームごとに交互に使う2組を持ち、
+    //     フレームNのデノイズを専用のストリームでフレームN+1のレンダリングと並行して行う。
+    // EN: Linear buffers for the denoiser inputs/outputs have two sets alternated per frame,
+    //     and denoising of frame N runs on a dedicated stream in parallel with rendering frame N+1.
+    denoise_overlap::OverlappedDenoiser overlappedDenoiser;
+    overlappedDenoiser.initialize(cuContext, renderTargetSizeX, renderTargetSizeY);
 
     optixu::HostBlockBuffer2D<Shared::PCG32RNG, 1> rngBuffer;
     rngBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX, renderTargetSizeY);
@@ -1015,8 +1011,6 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cudau::Kernel kernelCopyToLinearBuffers(moduleCopyBuffers, "copyToLinearBuffers", cudau::dim3(8, 8), 0);
     cudau::Kernel kernelVisualizeToOutputBuffer(moduleCopyBuffers, "visualizeToOutputBuffer", cudau::dim3(8, 8), 0);
 
-    CUdeviceptr hdrIntensity;
-    CUDADRV_CHECK(cuMemAlloc(&hdrIntensity, sizeof(float)));
 
     // END: Setup a denoiser.
     // ----------------------------------------------------------------
@@ -1059,13 +1053,40 @@ int32_t main(int32_t argc, const char* argv[]) try {
     plp.beautyAccumBuffer = beautyAccumBuffer.getSurfaceObject(0);
     plp.albedoAccumBuffer = albedoAccumBuffer.getSurfaceObject(0);
     plp.normalAccumBuffer = normalAccumBuffer.getSurfaceObject(0);
-    plp.linearFlowBuffer = linearFlowBuffer.getDevicePointer();
     plp.camera.fovY = 50 * M_PI / 180;
     plp.camera.aspect = static_cast<float>(renderTargetSizeX) / renderTargetSizeY;
     plp.camera.position = make_float3(0, 0, 3.16f);
     plp.camera.orientation = rotateY3x3(M_PI);
     plp.prevCamera = plp.camera;
     plp.instances = instDataBuffer.getDevicePointer();
+    plp.firstHitBuffer = nullptr;
+
+    // JP: --motion-vector-checkではレイ生成プログラムが最初のヒットのGバッファーも書き、
+    //     motion_vectors::GeneratorがそこからHALF2で求めたフローをレイ生成プログラムのフローと比較する。
+    //     インスタンスの並びはIASに追加した順に合わせる。
+    // EN: With --motion-vector-check, the ray generation program writes the first hit G-buffer as well,
+    //     and the HALF2 flow that motion_vectors::Generator computes from it is compared with the flow of
+    //     the ray generation program. Order instances equally to the order added to the IAS.
+    constexpr uint64_t motionVectorCheckFrame = 30;
+    CUmodule moduleMotionVectors = nullptr;
+    motion_vectors::Generator motionVectors;
+    cudau::TypedBuffer<motion_vectors::FirstHit> firstHitBuffer;
+    cudau::TypedBuffer<__half2> halfFlowBuffer;
+    std::vector<optixu::Instance> iasInstances;
+    if (checkMotionVectors) {
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleMotionVectors,
+            (getExecutableDirectory() / "temporal_denoiser/ptxes/motion_vectors_kernels.ptx").string().c_str()));
+        iasInstances.push_back(roomInst);
+        iasInstances.push_back(areaLightInst);
+        for (int i = 0; i < bunnyInsts.size(); ++i)
+            iasInstances.push_back(bunnyInsts[i].inst);
+        motionVectors.initialize(cuContext, moduleMotionVectors, cudau::BufferType::Device,
+                                 static_cast<uint32_t>(iasInstances.size()));
+        firstHitBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+        halfFlowBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+        plp.firstHitBuffer = firstHitBuffer.getDevicePointer();
+    }
 
     pipeline.setScene(scene);
     pipeline.setHitGroupShaderBindingTable(hitGroupSBT, hitGroupSBT.getMappedPointer());
@@ -1128,11 +1149,12 @@ int32_t main(int32_t argc, const char* argv[]) try {
             beautyAccumBuffer.resize(renderTargetSizeX, renderTargetSizeY);
             albedoAccumBuffer.resize(renderTargetSizeX, renderTargetSizeY);
             normalAccumBuffer.resize(renderTargetSizeX, renderTargetSizeY);
-            linearBeautyBuffer.resize(renderTargetSizeX * renderTargetSizeY);
-            linearAlbedoBuffer.resize(renderTargetSizeX * renderTargetSizeY);
-            linearNormalBuffer.resize(renderTargetSizeX * renderTargetSizeY);
-            linearFlowBuffer.resize(renderTargetSizeX * renderTargetSizeY);
-            linearDenoisedBeautyBuffer.resize(renderTargetSizeX * renderTargetSizeY);
+            overlappedDenoiser.resize(renderTargetSizeX, renderTargetSizeY);
+            if (checkMotionVectors) {
+                firstHitBuffer.resize(renderTargetSizeX * renderTargetSizeY);
+                halfFlowBuffer.resize(renderTargetSizeX * renderTargetSizeY);
+                plp.firstHitBuffer = firstHitBuffer.getDevicePointer();
+            }
 
             rngBuffer.resize(renderTargetSizeX, renderTargetSizeY);
             {
@@ -1149,7 +1171,6 @@ int32_t main(int32_t argc, const char* argv[]) try {
             plp.beautyAccumBuffer = beautyAccumBuffer.getSurfaceObject(0);
             plp.albedoAccumBuffer = albedoAccumBuffer.getSurfaceObject(0);
             plp.normalAccumBuffer = normalAccumBuffer.getSurfaceObject(0);
-            plp.linearFlowBuffer = linearFlowBuffer.getDevicePointer();
 
             {
                 size_t stateSize;
@@ -1306,6 +1327,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
             if (ImGui::Checkbox("Temporal Denoiser", &useTemporalDenosier)) {
                 CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+                overlappedDenoiser.synchronize();
                 denoiser.destroy();
 
                 OptixDenoiserModelKind modelKind = useTemporalDenosier ?
@@ -1399,15 +1421,56 @@ int32_t main(int32_t argc, const char* argv[]) try {
             numAccumFrames = 0;
         else
             ++numAccumFrames;
+        uint32_t slot = overlappedDenoiser.beginFrame(cuStream);
+        const denoise_overlap::FrameBuffers &frameBuffers = overlappedDenoiser.getFrameBuffers(slot);
         plp.numAccumFrames = numAccumFrames;
         plp.enableJittering = enableJittering;
         plp.resetFlowBuffer = resetFlowBuffer;
+        plp.linearFlowBuffer = frameBuffers.flow.getDevicePointer();
         CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
         curGPUTimer.render.start(cuStream);
         pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
         curGPUTimer.render.stop(cuStream);
 
-        curGPUTimer.denoise.start(cuStream);
+        if (checkMotionVectors) {
+            if (resetFlowBuffer)
+                motionVectors.reset();
+            motionVectors.updateTransforms(iasInstances.data(), static_cast<uint32_t>(iasInstances.size()),
+                                           cuStream);
+            motion_vectors::Camera camera;
+            camera.aspect = plp.camera.aspect;
+            camera.fovY = plp.camera.fovY;
+            camera.position = plp.camera.position;
+            camera.orientation = plp.camera.orientation;
+            motionVectors.generate(cuStream, firstHitBuffer.getDevicePointer(),
+                                   uint2(renderTargetSizeX, renderTargetSizeY), camera,
+                                   halfFlowBuffer.getCUdeviceptr());
+
+            if (frameIndex == motionVectorCheckFrame) {
+                // JP: ヒット点の現在のスクリーン位置はジッターしたピクセル位置と一致するので、
+                //     差はHALFの精度程度に収まるはず。
+                // EN: The current screen position of a hit point matches the jittered pixel position,
+                //     so the difference should stay within the precision of HALF.
+                std::vector<float2> refFlow(frameBuffers.flow.numElements());
+                std::vector<__half2> halfFlow(halfFlowBuffer.numElements());
+                frameBuffers.flow.read(refFlow, cuStream);
+                halfFlowBuffer.read(halfFlow, cuStream);
+                CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+                float maxError = 0.0f;
+                uint32_t numMismatches = 0;
+                for (uint32_t pixIdx = 0; pixIdx < halfFlow.size(); ++pixIdx) {
+                    float2 flow = make_float2(__low2float(halfFlow[pixIdx]), __high2float(halfFlow[pixIdx]));
+                    float2 ref = refFlow[pixIdx];
+                    float error = std::fmax(std::fabs(flow.x - ref.x), std::fabs(flow.y - ref.y));
+                    float tolerance = 0.05f + 2e-3f * std::fmax(std::fabs(ref.x), std::fabs(ref.y));
+                    maxError = std::fmax(maxError, error);
+                    if (!(error <= tolerance))
+                        ++numMismatches;
+                }
+                hpprintf("Motion vector check (frame %llu): max error %g px, %u mismatches: %s\n",
+                         frameIndex, maxError, numMismatches, numMismatches == 0 ? "passed" : "FAILED");
+            }
+        }
 
         // JP: 結果をリニアバッファーにコピーする。(法線の正規化も行う。)
         // EN: Copy the results to the linear buffers (and normalize normals).
@@ -1416,35 +1479,33 @@ int32_t main(int32_t argc, const char* argv[]) try {
                           beautyAccumBuffer.getSurfaceObject(0),
                           albedoAccumBuffer.getSurfaceObject(0),
                           normalAccumBuffer.getSurfaceObject(0),
-                          linearBeautyBuffer.getDevicePointer(),
-                          linearAlbedoBuffer.getDevicePointer(),
-                          linearNormalBuffer.getDevicePointer(),
+                          frameBuffers.beauty.getDevicePointer(),
+                          frameBuffers.albedo.getDevicePointer(),
+                          frameBuffers.normal.getDevicePointer(),
                           uint2(renderTargetSizeX, renderTargetSizeY));
 
         // JP: パストレーシング結果のデノイズ。
         //     毎フレーム呼ぶ必要があるのはcomputeIntensity()とinvoke()。
         //     computeIntensity()は自作することもできる。
         //     サイズが足りていればcomputeIntensity()のスクラッチバッファーとしてデノイザーのものが再利用できる。
+        //     デノイズは専用のストリームで実行され、このストリームは完了を待たずに次のフレームに進む。
         // EN: Denoise the path tracing result.
         //     computeIntensity() and invoke() should be calld every frame.
         //     You can also create a custom computeIntensity().
         //     Reusing the scratch buffer for denoising for computeIntensity() is possible if its size is enough.
-        denoiser.computeIntensity(cuStream,
-                                  linearBeautyBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                                  denoiserScratchBuffer, hdrIntensity);
-        //float hdrIntensityOnHost;
-        //CUDADRV_CHECK(cuMemcpyDtoH(&hdrIntensityOnHost, hdrIntensity, sizeof(hdrIntensityOnHost)));
-        //printf("%g\n", hdrIntensityOnHost);
-        for (int i = 0; i < denoisingTasks.size(); ++i)
-            denoiser.invoke(cuStream,
-                            false, hdrIntensity, 0.0f,
-                            linearBeautyBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                            linearAlbedoBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                            linearNormalBuffer, OPTIX_PIXEL_FORMAT_FLOAT4,
-                            linearFlowBuffer, OPTIX_PIXEL_FORMAT_FLOAT2,
-                            resetFlowBuffer ? linearBeautyBuffer : linearDenoisedBeautyBuffer,
-                            linearDenoisedBeautyBuffer,
-                            denoisingTasks[i]);
+        //     Denoising runs on the dedicated stream, and this stream proceeds to the next frame without waiting.
+        overlappedDenoiser.denoise(cuStream, denoiser, denoiserScratchBuffer,
+                                   denoisingTasks.data(), static_cast<uint32_t>(denoisingTasks.size()),
+                                   resetFlowBuffer, &curGPUTimer.denoise);
+
+        // JP: デノイズとのオーバーラップを保つため、表示は前フレームの結果を使う。
+        //     スクリーンショットのフレームでは現在のフレームの結果を待って表示する。
+        // EN: Display uses the result of the previous frame to keep the overlap with denoising.
+        //     The screenshot frame waits for and displays the result of the current frame.
+        const bool isScreenShotFrame = takeScreenShot && frameIndex + 1 == 60;
+        const denoise_overlap::FrameBuffers &displayBuffers =
+            overlappedDenoiser.getFrameBuffers(
+                overlappedDenoiser.acquireFrameForDisplay(cuStream, isScreenShotFrame));
 
         outputBufferSurfaceHolder.beginCUDAAccess(cuStream);
 
@@ -1453,19 +1514,19 @@ int32_t main(int32_t argc, const char* argv[]) try {
         void* bufferToDisplay = nullptr;
         switch (bufferTypeToDisplay) {
         case Shared::BufferToDisplay::NoisyBeauty:
-            bufferToDisplay = linearBeautyBuffer.getDevicePointer();
+            bufferToDisplay = displayBuffers.beauty.getDevicePointer();
             break;
         case Shared::BufferToDisplay::Albedo:
-            bufferToDisplay = linearAlbedoBuffer.getDevicePointer();
+            bufferToDisplay = displayBuffers.albedo.getDevicePointer();
             break;
         case Shared::BufferToDisplay::Normal:
-            bufferToDisplay = linearNormalBuffer.getDevicePointer();
+            bufferToDisplay = displayBuffers.normal.getDevicePointer();
             break;
         case Shared::BufferToDisplay::Flow:
-            bufferToDisplay = linearFlowBuffer.getDevicePointer();
+            bufferToDisplay = displayBuffers.flow.getDevicePointer();
             break;
         case Shared::BufferToDisplay::DenoisedBeauty:
-            bufferToDisplay = linearDenoisedBeautyBuffer.getDevicePointer();
+            bufferToDisplay = displayBuffers.denoisedBeauty.getDevicePointer();
             break;
         default:
             Assert_ShouldNotBeCalled();
@@ -1480,11 +1541,9 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         outputBufferSurfaceHolder.endCUDAAccess(cuStream);
 
-        curGPUTimer.denoise.stop(cuStream);
-
         curGPUTimer.frame.stop(cuStream);
 
-        if (takeScreenShot && frameIndex + 1 == 60) {
+        if (isScreenShotFrame) {
             CUDADRV_CHECK(cuStreamSynchronize(cuStream));
             auto rawImage = new float4[renderTargetSizeX * renderTargetSizeY];
             glGetTextureSubImage(
@@ -1539,6 +1598,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     }
 
     CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+    overlappedDenoiser.synchronize();
     gpuTimers[1].finalize();
     gpuTimers[0].finalize();
 
@@ -1556,9 +1616,14 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
     
-    CUDADRV_CHECK(cuMemFree(hdrIntensity));
-
     CUDADRV_CHECK(cuModuleUnload(moduleCopyBuffers));
+
+    if (checkMotionVectors) {
+        halfFlowBuffer.finalize();
+        firstHitBuffer.finalize();
+        motionVectors.finalize();
+        CUDADRV_CHECK(cuModuleUnload(moduleMotionVectors));
+    }
     
     denoiserScratchBuffer.finalize();
     denoiserStateBuffer.finalize();
@@ -1567,11 +1632,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     
     rngBuffer.finalize();
 
-    linearDenoisedBeautyBuffer.finalize();
-    linearFlowBuffer.finalize();
-    linearNormalBuffer.finalize();
-    linearAlbedoBuffer.finalize();
-    linearBeautyBuffer.finalize();
+    overlappedDenoiser.finalize();
 
     normalAccumBuffer.finalize();
     albedoAccumBuffer.finalize();
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "../common/common.h"
+#include "../common/motion_vectors.h"
 
 namespace Shared {
     static constexpr float Pi = 3.14159265358979323846f;
@@ -120,6 +121,7 @@ namespace Shared {
         PerspectiveCamera camera;
         PerspectiveCamera prevCamera;
         const InstanceData* instances;
+        motion_vectors::FirstHit* firstHitBuffer;
         unsigned int enableJittering : 1;
         unsigned int resetFlowBuffer : 1;
     };
@@ -141,6 +143,8 @@ namespace Shared {
         float3 firstHitAlbedo;
         float3 firstHitNormal;
         float3 firstHitPrevPositionInWorld;
+        float3 firstHitPositionInObject;
+        uint32_t firstHitInstanceIndex;
     };
 
 
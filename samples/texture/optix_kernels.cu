@@ -60,18 +60,19 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen)() {
     float3 direction = normalize(plp.camera.orientation * make_float3(vw * (0.5f - x), vh * (0.5f - y), 1));
 
     float3 color;
+    ray_cone::RayCone cone = ray_cone::RayCone::fromPinholeCamera(plp.camera.fovY, plp.imageSize.y);
     optixu::trace<PayloadSignature>(
         plp.travHandle, origin, direction,
         0.0f, FLT_MAX, 0.0f, 0xFF, OPTIX_RAY_FLAG_NONE,
         RayType_Primary, NumRayTypes, RayType_Primary,
-        color);
+        color, cone);
 
     plp.resultBuffer[launchIndex] = make_float4(color, 1.0f);
 }
 
 CUDA_DEVICE_KERNEL void RT_MS_NAME(miss)() {
     float3 color = make_float3(0, 0, 0.1f);
-    optixu::setPayloads<PayloadSignature>(&color);
+    optixu::setPayloads<PayloadSignature>(&color, nullptr);
 }
 
 CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
@@ -88,12 +89,24 @@ CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit)() {
     float b0 = 1 - (hp.b1 + hp.b2);
     float2 texCoord = b0 * v0.texCoord + hp.b1 * v1.texCoord + hp.b2 * v2.texCoord;
 
+    // JP: ヒット点まで進めたレイコーンからミップレベルを決める。
+    //     ミップレベル0のみの配列(DDSから作ったもの)ではレベル0が使われる。
+    // EN: Determine the mip level from the ray cone advanced to the hit point.
+    //     Level 0 is used for arrays only with mip level 0 (ones made from DDSs).
+    ray_cone::RayCone cone;
+    optixu::getPayloads<PayloadSignature>(nullptr, &cone);
+    cone = cone.propagate(optixGetRayTmax());
+    float3 gn = normalize(optixTransformNormalFromObjectToWorldSpace(
+        cross(v1.position - v0.position, v2.position - v0.position)));
+    float lod = cone.calcTextureLOD(geom.triangleLODConstants[hp.primIndex],
+                                    dot(optixGetWorldRayDirection(), gn), mat.textureSize);
+
     // JP: テクスチャーのサンプリングは純粋なCUDAの組み込み関数を使う。
     // EN: Use a pure CUDA intrinsic function to sample a texture.
     float3 color;
     if (mat.texture)
-        color = getXYZ(tex2DLod<float4>(mat.texture, texCoord.x, texCoord.y, 0.0f));
+        color = getXYZ(tex2DLod<float4>(mat.texture, texCoord.x, texCoord.y, lod));
     else
         color = mat.albedo;
-    optixu::setPayloads<PayloadSignature>(&color);
+    optixu::setPayloads<PayloadSignature>(&color, nullptr);
 }
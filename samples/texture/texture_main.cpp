@@ -14,10 +14,32 @@ EN: This sample shows how to use textures.
 
 #include "../common/obj_loader.h"
 #include "../common/dds_loader.h"
+#include "../common/texture_compressor.h"
+#include "../common/importance_map.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../../ext/stb_image.h"
 
 int32_t main(int32_t argc, const char* argv[]) try {
+    // JP: --compress-pngを指定するとDDSの代わりにPNGを読み込み、アップロード時にGPU上でBC1に圧縮する。
+    // EN: Specifying --compress-png loads PNGs instead of DDSs and compresses them into BC1 on the GPU at upload.
+    bool compressPngOnUpload = false;
+    // JP: --importance-mapを指定すると床テクスチャーの輝度に比例した分布をGPU上で構築して確認する。
+    // EN: Specifying --importance-map builds a distribution proportional to the luminance of the floor texture
+    //     on the GPU and checks it.
+    bool buildImportanceMap = false;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (arg == "--compress-png")
+            compressPngOnUpload = true;
+        else if (arg == "--importance-map")
+            buildImportanceMap = true;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        ++argIdx;
+    }
+
     // ----------------------------------------------------------------
     // JP: OptiXのコンテキストとパイプラインの設定。
     // EN: Settings for OptiX context and pipeline.
@@ -88,34 +110,70 @@ int32_t main(int32_t argc, const char* argv[]) try {
     // JP: マテリアルのセットアップ。
     // EN: Setup materials.
 
-    constexpr bool useBlockCompressedTexture = true;
+    // JP: DDSのBCテクスチャーを使う。--compress-pngの指定時やDDSファイルが無い場合はPNGを読み込み、
+    //     アップロード時にGPU上でBC1に圧縮してミップマップも同時に生成する。
+    // EN: Use BC textures from DDSs. When --compress-png is specified or DDS files are absent,
+    //     load PNGs and compress them into BC1 on the GPU at upload generating mipmaps at the same time.
+    const bool useBlockCompressedTexture = !compressPngOnUpload &&
+        std::filesystem::exists("../../data/checkerboard_line.DDS") &&
+        std::filesystem::exists("../../data/wood_bunny.DDS");
+
+    // JP: 圧縮器のモジュールはPNGを圧縮する場合のみ読み込む。
+    // EN: Load the module of the compressor only when compressing PNGs.
+    CUmodule moduleTextureCompressor = nullptr;
+    texture_compressor::TextureCompressor textureCompressor;
+    if (!useBlockCompressedTexture) {
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleTextureCompressor,
+            (getExecutableDirectory() / "texture/ptxes/texture_compressor_kernels.ptx").string().c_str()));
+        textureCompressor.initialize(moduleTextureCompressor);
+    }
 
-    const auto createTexture = [&cuContext](const std::filesystem::path &filepath) {
+    // JP: DDSファイルはメモリーマップで開き、ステージングプール経由で非同期にアップロードする。
+    //     低解像度のミップから転送するので、トークンを見れば高解像度のミップの到着前に描画を始められる。
+    // EN: Open DDS files with memory mapping and upload them asynchronously via a staging pool.
+    //     Transfers start from low-resolution mips, so rendering can begin before high-resolution mips arrive
+    //     by looking at the tokens.
+    cudau::PinnedStagingPool stagingPool;
+    stagingPool.initialize(cuContext);
+    std::vector<cudau::TransferToken> textureUploads;
+
+    const auto createTexture = [&cuContext, &cuStream, &stagingPool, &textureUploads, &textureCompressor,
+                                &moduleTextureCompressor]
+    (const std::filesystem::path &filepath) {
         cudau::Array array;
 
         if (filepath.extension() == ".DDS") {
-            int32_t width, height, mipCount;
-            size_t* sizes;
-            dds::Format format;
-            uint8_t** ddsData = dds::load(filepath.string().c_str(),
-                                          &width, &height, &mipCount, &sizes, &format);
-
+            dds::MappedImage ddsImage;
+            if (!ddsImage.open(filepath.string().c_str()))
+                throw std::runtime_error("Failed to open a DDS file.");
+
+            // JP: DDSの配列はミップレベル0のみで作るので、レイコーンで求めたLODはこの場合効果が無い。
+            //     LODによるミップの選択が効くのは--compress-pngでミップマップ付きの配列を作った場合のみ。
+            // EN: Arrays from DDSs are created only with mip level 0, so the LOD from the ray cone has no effect
+            //     in this case. Mip selection by the LOD takes effect only with mipmapped arrays made by --compress-png.
             array.initialize2D(cuContext, cudau::ArrayElementType::BC1_UNorm, 1,
                                cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                               width, height, /*mipCount*/1); // CUDA's bug?
-            for (int i = 0; i < array.getNumMipmapLevels(); ++i)
-                array.write<uint8_t>(ddsData[i], sizes[i], i);
-
-            dds::free(ddsData, mipCount, sizes);
+                               ddsImage.getWidth(), ddsImage.getHeight(), /*mipCount*/1); // CUDA's bug?
+            for (int i = array.getNumMipmapLevels() - 1; i >= 0; --i)
+                textureUploads.push_back(array.writeAsync(ddsImage.getMipData(i), ddsImage.getMipSize(i), i,
+                                                          stagingPool, cuStream));
         }
         else {
             int32_t width, height, n;
             uint8_t* linearImageData = stbi_load(filepath.string().c_str(),
                                                  &width, &height, &n, 4);
-            array.initialize2D(cuContext, cudau::ArrayElementType::UInt8, 4,
-                               cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
-                               width, height, 1);
-            array.write<uint8_t>(linearImageData, width * height * 4);
+            if (moduleTextureCompressor && width % 4 == 0 && height % 4 == 0) {
+                textureCompressor.compress(cuContext, cuStream, linearImageData, width, height,
+                                           texture_compressor::Format::BC1, texture_compressor::Quality::Normal,
+                                           true, true, &array);
+            }
+            else {
+                array.initialize2D(cuContext, cudau::ArrayElementType::UInt8, 4,
+                                   cudau::ArraySurface::Disable, cudau::ArrayTextureGather::Disable,
+                                   width, height, 1);
+                array.write<uint8_t>(linearImageData, width * height * 4);
+            }
             stbi_image_free(linearImageData);
         }
 
@@ -163,6 +221,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
         texSampler.setReadMode(cudau::TextureReadMode::NormalizedFloat_sRGB);
 
         floorMatData.texture = texSampler.createTextureObject(floorArray);
+        floorMatData.textureSize = make_int2(floorArray.getWidth(), floorArray.getHeight());
     }
     floorMat.setUserData(floorMatData);
 
@@ -187,6 +246,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
         texSampler.setReadMode(cudau::TextureReadMode::NormalizedFloat_sRGB);
 
         bunnyMatData.texture = texSampler.createTextureObject(bunnyArray);
+        bunnyMatData.textureSize = make_int2(bunnyArray.getWidth(), bunnyArray.getHeight());
     }
     bunnyMat.setUserData(bunnyMatData);
 
@@ -205,6 +265,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     cudau::TypedBuffer<Shared::Vertex> roomVertexBuffer;
     cudau::TypedBuffer<Shared::Triangle> roomTriangleBuffer;
     cudau::TypedBuffer<uint8_t> roomMatIndexBuffer;
+    cudau::TypedBuffer<float> roomLODConstantBuffer;
     {
         Shared::Vertex vertices[] = {
             // floor
@@ -258,10 +319,14 @@ int32_t main(int32_t argc, const char* argv[]) try {
         roomVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices, lengthof(vertices));
         roomTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles, lengthof(triangles));
         roomMatIndexBuffer.initialize(cuContext, cudau::BufferType::Device, matIndices, lengthof(matIndices));
+        float lodConstants[lengthof(triangles)];
+        ray_cone::computeTriangleLODConstants(vertices, triangles, lengthof(triangles), lodConstants);
+        roomLODConstantBuffer.initialize(cuContext, cudau::BufferType::Device, lodConstants, lengthof(lodConstants));
 
         Shared::GeometryData geomData = {};
         geomData.vertexBuffer = roomVertexBuffer.getDevicePointer();
         geomData.triangleBuffer = roomTriangleBuffer.getDevicePointer();
+        geomData.triangleLODConstants = roomLODConstantBuffer.getDevicePointer();
 
         roomGeomInst.setVertexBuffer(roomVertexBuffer);
         roomGeomInst.setTriangleBuffer(roomTriangleBuffer);
@@ -286,6 +351,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     optixu::GeometryInstance areaLightGeomInst = scene.createGeometryInstance();
     cudau::TypedBuffer<Shared::Vertex> areaLightVertexBuffer;
     cudau::TypedBuffer<Shared::Triangle> areaLightTriangleBuffer;
+    cudau::TypedBuffer<float> areaLightLODConstantBuffer;
     {
         Shared::Vertex vertices[] = {
             { make_float3(-0.25f, 0.0f, -0.25f), make_float3(0, -1, 0), make_float2(0, 0) },
@@ -300,10 +366,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         areaLightVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices, lengthof(vertices));
         areaLightTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles, lengthof(triangles));
+        float lodConstants[lengthof(triangles)];
+        ray_cone::computeTriangleLODConstants(vertices, triangles, lengthof(triangles), lodConstants);
+        areaLightLODConstantBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                              lodConstants, lengthof(lodConstants));
 
         Shared::GeometryData geomData = {};
         geomData.vertexBuffer = areaLightVertexBuffer.getDevicePointer();
         geomData.triangleBuffer = areaLightTriangleBuffer.getDevicePointer();
+        geomData.triangleLODConstants = areaLightLODConstantBuffer.getDevicePointer();
 
         areaLightGeomInst.setVertexBuffer(areaLightVertexBuffer);
         areaLightGeomInst.setTriangleBuffer(areaLightTriangleBuffer);
@@ -316,6 +387,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     optixu::GeometryInstance bunnyGeomInst = scene.createGeometryInstance();
     cudau::TypedBuffer<Shared::Vertex> bunnyVertexBuffer;
     cudau::TypedBuffer<Shared::Triangle> bunnyTriangleBuffer;
+    cudau::TypedBuffer<float> bunnyLODConstantBuffer;
     {
         std::vector<Shared::Vertex> vertices;
         std::vector<Shared::Triangle> triangles;
@@ -339,10 +411,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         bunnyVertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices);
         bunnyTriangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
+        std::vector<float> lodConstants(triangles.size());
+        ray_cone::computeTriangleLODConstants(vertices.data(), triangles.data(),
+                                              static_cast<uint32_t>(triangles.size()), lodConstants.data());
+        bunnyLODConstantBuffer.initialize(cuContext, cudau::BufferType::Device, lodConstants);
 
         Shared::GeometryData geomData = {};
         geomData.vertexBuffer = bunnyVertexBuffer.getDevicePointer();
         geomData.triangleBuffer = bunnyTriangleBuffer.getDevicePointer();
+        geomData.triangleLODConstants = bunnyLODConstantBuffer.getDevicePointer();
 
         bunnyGeomInst.setVertexBuffer(bunnyVertexBuffer);
         bunnyGeomInst.setTriangleBuffer(bunnyTriangleBuffer);
@@ -506,6 +583,74 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
+    if (buildImportanceMap) {
+        CUmodule moduleImportanceMap;
+        CUDADRV_CHECK(cuModuleLoad(
+            &moduleImportanceMap,
+            (getExecutableDirectory() / "texture/ptxes/importance_map_kernels.ptx").string().c_str()));
+        cudau::Kernel kernelBuildConditionalCDFs(moduleImportanceMap, "buildConditionalCDFs", cudau::dim3(256), 0);
+        cudau::Kernel kernelBuildMarginalCDF(moduleImportanceMap, "buildMarginalCDF", cudau::dim3(256), 0);
+
+        const uint32_t width = floorArray.getWidth();
+        const uint32_t height = floorArray.getHeight();
+        importance_map::Distribution2DBuffers floorDist;
+        floorDist.initialize(cuContext, cudau::BufferType::Device, width, height);
+        kernelBuildConditionalCDFs(cuStream, cudau::dim3(height),
+                                   floorMatData.texture, width, height, importance_map::Weighting::TexelArea, 0u,
+                                   floorDist.getConditionalCDFs(), floorDist.getRowIntegrals());
+        kernelBuildMarginalCDF(cuStream, cudau::dim3(1),
+                               floorDist.getRowIntegrals(), height,
+                               floorDist.getMarginalCDF(), floorDist.getIntegral());
+
+        // JP: テーブルを読み戻し、CDFの単調性と、ホスト側で引いたサンプルのpdfが評価したpdfと一致することを確かめる。
+        // EN: Read back the tables, then check the monotonicity of the CDFs and that the pdfs of samples drawn
+        //     on the host match the evaluated pdfs.
+        std::vector<float> conditionalCdfs(static_cast<size_t>(width) * height);
+        std::vector<float> marginalCdf(height);
+        float integral;
+        CUDADRV_CHECK(cuStreamSynchronize(cuStream));
+        CUDADRV_CHECK(cuMemcpyDtoH(conditionalCdfs.data(),
+                                   reinterpret_cast<CUdeviceptr>(floorDist.getConditionalCDFs()),
+                                   conditionalCdfs.size() * sizeof(float)));
+        CUDADRV_CHECK(cuMemcpyDtoH(marginalCdf.data(), reinterpret_cast<CUdeviceptr>(floorDist.getMarginalCDF()),
+                                   marginalCdf.size() * sizeof(float)));
+        CUDADRV_CHECK(cuMemcpyDtoH(&integral, reinterpret_cast<CUdeviceptr>(floorDist.getIntegral()),
+                                   sizeof(float)));
+
+        bool success = integral > 0.0f && std::isfinite(integral);
+        const auto isValidCDF = [](const float* cdf, uint32_t num) {
+            for (uint32_t i = 1; i < num; ++i) {
+                if (cdf[i] < cdf[i - 1])
+                    return false;
+            }
+            return cdf[num - 1] == 1.0f;
+        };
+        success &= isValidCDF(marginalCdf.data(), height);
+        for (uint32_t y = 0; y < height; ++y)
+            success &= isValidCDF(conditionalCdfs.data() + static_cast<size_t>(width) * y, width);
+
+        importance_map::Distribution2D hostDist;
+        hostDist.conditionalCdfs = conditionalCdfs.data();
+        hostDist.marginalCdf = marginalCdf.data();
+        hostDist.integral = &integral;
+        hostDist.width = width;
+        hostDist.height = height;
+        constexpr uint32_t numStrata = 32;
+        for (uint32_t i = 0; i < numStrata * numStrata; ++i) {
+            float pdf;
+            float2 texCoord = hostDist.sample((i % numStrata + 0.5f) / numStrata, (i / numStrata + 0.5f) / numStrata,
+                                              &pdf);
+            success &= pdf > 0.0f && std::fabs(hostDist.evaluatePdf(texCoord) - pdf) <= 1e-3f * pdf;
+        }
+        hpprintf("Importance map of the floor texture (%ux%u, integral: %g): %s\n",
+                 width, height, integral, success ? "passed" : "FAILED");
+
+        floorDist.finalize();
+        CUDADRV_CHECK(cuModuleUnload(moduleImportanceMap));
+    }
+
+
+
     constexpr uint32_t renderTargetSizeX = 1024;
     constexpr uint32_t renderTargetSizeY = 1024;
     optixu::HostBlockBuffer2D<float4, 1> accumBuffer;
@@ -565,14 +710,17 @@ int32_t main(int32_t argc, const char* argv[]) try {
     areaLightGas.destroy();
     roomGas.destroy();
 
+    bunnyLODConstantBuffer.finalize();
     bunnyTriangleBuffer.finalize();
     bunnyVertexBuffer.finalize();
     bunnyGeomInst.destroy();
     
+    areaLightLODConstantBuffer.finalize();
     areaLightTriangleBuffer.finalize();
     areaLightVertexBuffer.finalize();
     areaLightGeomInst.destroy();
 
+    roomLODConstantBuffer.finalize();
     roomMatIndexBuffer.finalize();
     roomTriangleBuffer.finalize();
     roomVertexBuffer.finalize();
@@ -592,6 +740,14 @@ int32_t main(int32_t argc, const char* argv[]) try {
     farSideWallMat.destroy();
     ceilingMat.destroy();
 
+    textureUploads.clear();
+    stagingPool.finalize();
+
+    if (moduleTextureCompressor) {
+        textureCompressor.finalize();
+        CUDADRV_CHECK(cuModuleUnload(moduleTextureCompressor));
+    }
+
 
 
     shaderBindingTable.finalize();
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "../common/common.h"
+#include "../common/ray_cone.h"
 
 namespace Shared {
     enum RayType {
@@ -36,14 +37,19 @@ namespace Shared {
     struct GeometryData {
         const Vertex* vertexBuffer;
         const Triangle* triangleBuffer;
+        // JP: レイコーンによるテクスチャーLOD選択のための三角形ごとの定数。ロード時に求める。
+        // EN: Per-triangle constants for texture LOD selection by ray cones. Computed at load time.
+        const float* triangleLODConstants;
     };
 
     struct MaterialData {
         CUtexObject texture;
+        int2 textureSize;
         float3 albedo;
 
         MaterialData() :
             texture(0),
+            textureSize(make_int2(0, 0)),
             albedo(make_float3(0.0f, 0.0f, 0.0f)) {}
     };
 
@@ -57,4 +63,4 @@ namespace Shared {
     };
 }
 
-#define PayloadSignature float3
+#define PayloadSignature float3, ray_cone::RayCone
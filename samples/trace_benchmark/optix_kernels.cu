@@ -0,0 +1,109 @@
+﻿#pragma once
+
+#include "trace_benchmark_shared.h"
+
+using namespace Shared;
+
+RT_PIPELINE_LAUNCH_PARAMETERS PipelineLaunchParameters plp;
+
+
+
+CUDA_DEVICE_FUNCTION uint32_t pcgHash(uint32_t v) {
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+CUDA_DEVICE_FUNCTION float toUnitFloat(uint32_t v) {
+    return (v >> 8) * (1.0f / (1 << 24));
+}
+
+// JP: 全ペイロードを読み書きし、結果をチェックサムとして書き出してコンパイラーに処理を消させない。
+// EN: Read and write all the payloads, and write the result out as a checksum
+//     to prevent the compiler from eliminating the work.
+template <uint32_t numDwords>
+CUDA_DEVICE_FUNCTION void tracePixel(const uint2 &launchIndex) {
+    uint32_t pixelIndex = launchIndex.y * plp.imageSize.x + launchIndex.x;
+
+    float3 forward = normalize(-plp.cameraPosition);
+    float3 left = normalize(cross(make_float3(0, 1, 0), forward));
+    float3 up = cross(forward, left);
+
+    uint32_t checksum = 0;
+    for (uint32_t rayIdx = 0; rayIdx < plp.numRaysPerPixel; ++rayIdx) {
+        uint32_t seed = pcgHash(pixelIndex ^ pcgHash(rayIdx + plp.frameIndex * plp.numRaysPerPixel));
+        float x = (launchIndex.x + toUnitFloat(seed)) / plp.imageSize.x;
+        float y = (launchIndex.y + toUnitFloat(pcgHash(seed))) / plp.imageSize.y;
+        float3 direction = normalize(forward + (0.5f - x) * left + (0.5f - y) * up);
+
+        Payload<numDwords> payload;
+        for (uint32_t i = 0; i < numDwords; ++i)
+            payload.values[i] = seed + i;
+        optixu::trace<Payload<numDwords>>(
+            plp.travHandle, plp.cameraPosition, direction,
+            0.0f, FLT_MAX, 0.0f, 0xFF, OPTIX_RAY_FLAG_NONE,
+            RayType_Primary, NumRayTypes, RayType_Primary,
+            payload);
+        for (uint32_t i = 0; i < numDwords; ++i)
+            checksum += payload.values[i];
+    }
+
+    plp.resultBuffer[pixelIndex] = checksum;
+}
+
+template <uint32_t numDwords>
+CUDA_DEVICE_FUNCTION void raygen() {
+    tracePixel<numDwords>(make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y));
+}
+
+// JP: 永続スレッドでローンチされ、キューが尽きるまでタイルを処理する。
+// EN: Launched with persistent threads and processes tiles until the queue is exhausted.
+template <uint32_t numDwords>
+CUDA_DEVICE_FUNCTION void raygenTiles() {
+    tile_queue::processTiles(plp.tileQueue, [](const uint2 &pixel) {
+        tracePixel<numDwords>(pixel);
+    });
+}
+
+template <uint32_t numDwords>
+CUDA_DEVICE_FUNCTION void miss() {
+    Payload<numDwords> payload;
+    optixu::getPayloads<Payload<numDwords>>(&payload);
+    for (uint32_t i = 0; i < numDwords; ++i)
+        payload.values[i] = ~payload.values[i];
+    optixu::setPayloads<Payload<numDwords>>(&payload);
+}
+
+// JP: SBTレコード中のジオメトリインスタンスのデータを全て読むことで、レコードサイズのコストを計測する。
+// EN: Read all the geometry instance's data in the SBT record to measure the cost of the record size.
+template <uint32_t numDwords>
+CUDA_DEVICE_FUNCTION void closesthit() {
+    auto record = reinterpret_cast<const uint8_t*>(optixGetSbtDataPointer());
+    auto &matData = *reinterpret_cast<const MaterialData*>(record);
+    auto geomData = reinterpret_cast<const uint4*>(record + geometryDataOffsetInRecord);
+
+    uint32_t sum = matData.materialIndex + optixGetPrimitiveIndex();
+    for (uint32_t i = 0; i < plp.numRecordDwords / 4; ++i) {
+        uint4 v = geomData[i];
+        sum += v.x ^ v.y ^ v.z ^ v.w;
+    }
+
+    Payload<numDwords> payload;
+    optixu::getPayloads<Payload<numDwords>>(&payload);
+    for (uint32_t i = 0; i < numDwords; ++i)
+        payload.values[i] += sum ^ i;
+    optixu::setPayloads<Payload<numDwords>>(&payload);
+}
+
+#define DEFINE_PROGRAMS(N) \
+    CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen_payload ## N)() { raygen<N>(); } \
+    CUDA_DEVICE_KERNEL void RT_RG_NAME(raygen_tiles_payload ## N)() { raygenTiles<N>(); } \
+    CUDA_DEVICE_KERNEL void RT_MS_NAME(miss_payload ## N)() { miss<N>(); } \
+    CUDA_DEVICE_KERNEL void RT_CH_NAME(closesthit_payload ## N)() { closesthit<N>(); }
+
+DEFINE_PROGRAMS(1)
+DEFINE_PROGRAMS(2)
+DEFINE_PROGRAMS(4)
+DEFINE_PROGRAMS(8)
+
+#undef DEFINE_PROGRAMS
@@ -0,0 +1,465 @@
+﻿/*
+
+JP: このサンプルはレイトレースのコストがデータレイアウトによってどう変わるかを計測します。
+    基準となる設定から、ペイロードのdword数、ヒットグループのSBTレコードのサイズ、マテリアル数、
+    インスタンスの階層数をひとつずつ変化させ、cudau::Timerで計測したローンチ時間と
+    秒間レイ数をCSV形式で出力します。
+    ペイロードのdword数とトラバーサブルグラフのフラグはパイプラインオプションに反映されるので、
+    設定ごとにパイプラインを作り直します。
+    最後のスイープではピクセルあたり1スレッドのローンチと、tile_queue::TileQueueBufferから
+    タイルを取得する永続スレッドのローンチを比較します。
+
+EN: This sample measures how the cost of ray tracing changes depending on data layouts.
+    It varies the number of payload dwords, the size of hit group SBT records, the number of materials
+    and the number of instance levels one at a time from a base configuration, then outputs the launch time
+    measured by cudau::Timer and rays per second in the CSV format.
+    The number of payload dwords and the traversable graph flags are reflected in the pipeline options,
+    so the pipeline is recreated per configuration.
+    The last sweep compares the launch with one thread per pixel against that with persistent threads
+    pulling tiles from tile_queue::TileQueueBuffer.
+
+    Usage: trace_benchmark [--iterations <N>] [--width <N>] [--height <N>] [--rays-per-pixel <N>]
+                           [--triangles <N>]
+
+*/
+
+#include "trace_benchmark_shared.h"
+
+struct BenchmarkConfig {
+    uint32_t numPayloadDwords;
+    uint32_t numRecordDwords;
+    uint32_t numMaterials;
+    // JP: GASの上に積むIASの数。0の場合はGASを直接トレースする。
+    // EN: The number of IASs stacked on the GAS. The GAS is traced directly for 0.
+    uint32_t numInstanceLevels;
+    // JP: 真の場合は永続スレッドでローンチし、タイルキューからタイルを取得する。
+    // EN: Launch with persistent threads pulling tiles from the tile queue when true.
+    bool persistentTiles;
+};
+
+struct BenchmarkResult {
+    float launchTime;
+    double raysPerSecond;
+};
+
+struct LaunchSettings {
+    uint32_t width;
+    uint32_t height;
+    uint32_t numRaysPerPixel;
+    uint32_t numIterations;
+};
+
+struct ProgramNames {
+    uint32_t numPayloadDwords;
+    const char* rayGen;
+    const char* rayGenTiles;
+    const char* miss;
+    const char* closestHit;
+};
+
+static const ProgramNames programNamesList[] = {
+    { 1, RT_RG_NAME_STR("raygen_payload1"), RT_RG_NAME_STR("raygen_tiles_payload1"),
+      RT_MS_NAME_STR("miss_payload1"), RT_CH_NAME_STR("closesthit_payload1") },
+    { 2, RT_RG_NAME_STR("raygen_payload2"), RT_RG_NAME_STR("raygen_tiles_payload2"),
+      RT_MS_NAME_STR("miss_payload2"), RT_CH_NAME_STR("closesthit_payload2") },
+    { 4, RT_RG_NAME_STR("raygen_payload4"), RT_RG_NAME_STR("raygen_tiles_payload4"),
+      RT_MS_NAME_STR("miss_payload4"), RT_CH_NAME_STR("closesthit_payload4") },
+    { 8, RT_RG_NAME_STR("raygen_payload8"), RT_RG_NAME_STR("raygen_tiles_payload8"),
+      RT_MS_NAME_STR("miss_payload8"), RT_CH_NAME_STR("closesthit_payload8") },
+};
+
+static BenchmarkResult runBenchmark(
+    CUcontext cuContext, CUstream cuStream, optixu::Context optixContext, const std::string &ptx,
+    const cudau::TypedBuffer<Shared::Vertex> &vertexBuffer,
+    const cudau::TypedBuffer<Shared::Triangle> &triangleBuffer,
+    const BenchmarkConfig &config, const LaunchSettings &settings) {
+    const ProgramNames* programNames = nullptr;
+    for (const ProgramNames &names : programNamesList) {
+        if (names.numPayloadDwords == config.numPayloadDwords)
+            programNames = &names;
+    }
+    if (programNames == nullptr)
+        throw std::runtime_error("Unsupported number of payload dwords.");
+    if (config.numRecordDwords % 4 != 0 || config.numRecordDwords > Shared::maxNumRecordDwords)
+        throw std::runtime_error("Unsupported SBT record size.");
+
+    // JP: インスタンスの階層数に応じた最も制限の強いトラバーサブルグラフのフラグを使う。
+    // EN: Use the most restrictive traversable graph flags for the number of instance levels.
+    OptixTraversableGraphFlags graphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_ANY;
+    if (config.numInstanceLevels == 0)
+        graphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS;
+    else if (config.numInstanceLevels == 1)
+        graphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING;
+
+    optixu::Pipeline pipeline = optixContext.createPipeline();
+    pipeline.setPipelineOptions(config.numPayloadDwords,
+                                optixu::calcSumDwords<float2>(),
+                                "plp", sizeof(Shared::PipelineLaunchParameters),
+                                false, graphFlags,
+                                OPTIX_EXCEPTION_FLAG_NONE,
+                                OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE);
+
+    optixu::Module moduleOptiX = pipeline.createModuleFromPTXString(
+        ptx, OPTIX_COMPILE_DEFAULT_MAX_REGISTER_COUNT,
+        OPTIX_COMPILE_OPTIMIZATION_DEFAULT, OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+
+    optixu::Module emptyModule;
+
+    optixu::ProgramGroup rayGenProgram = pipeline.createRayGenProgram(
+        moduleOptiX, config.persistentTiles ? programNames->rayGenTiles : programNames->rayGen);
+    optixu::ProgramGroup missProgram = pipeline.createMissProgram(moduleOptiX, programNames->miss);
+    optixu::ProgramGroup hitProgramGroup = pipeline.createHitProgramGroupForBuiltinIS(
+        OPTIX_PRIMITIVE_TYPE_TRIANGLE,
+        moduleOptiX, programNames->closestHit,
+        emptyModule, nullptr);
+
+    pipeline.link(1, OPTIX_COMPILE_DEBUG_LEVEL_NONE);
+    // JP: トラバーサブルグラフの深さはGASを1として数える。
+    // EN: The depth of the traversable graph counts a GAS as 1.
+    pipeline.computeAndSetStackSize(1, 0, 0, config.numInstanceLevels + 1);
+
+    pipeline.setRayGenerationProgram(rayGenProgram);
+    pipeline.setNumMissRayTypes(Shared::NumRayTypes);
+    pipeline.setMissProgram(Shared::RayType_Primary, missProgram);
+
+    cudau::Buffer shaderBindingTable;
+    size_t sbtSize;
+    pipeline.generateShaderBindingTableLayout(&sbtSize);
+    shaderBindingTable.initialize(cuContext, cudau::BufferType::Device, sbtSize, 1);
+    shaderBindingTable.setMappedMemoryPersistent(true);
+    pipeline.setShaderBindingTable(shaderBindingTable, shaderBindingTable.getMappedPointer());
+
+
+
+    // JP: 全マテリアルが同じヒットグループを持ち、ユーザーデータのみ異なる。
+    // EN: All the materials have the same hit group and differ only in user data.
+    std::vector<optixu::Material> materials(config.numMaterials);
+    for (uint32_t matIdx = 0; matIdx < config.numMaterials; ++matIdx) {
+        optixu::Material &mat = materials[matIdx];
+        mat = optixContext.createMaterial();
+        mat.setHitGroup(Shared::RayType_Primary, hitProgramGroup);
+        Shared::MaterialData matData;
+        matData.materialIndex = matIdx;
+        mat.setUserData(matData);
+    }
+
+    optixu::Scene scene = optixContext.createScene();
+
+    // JP: マテリアルは三角形ごとにランダムに割り当て、SBTレコードへのアクセスを分散させる。
+    // EN: Assign materials randomly per triangle to scatter accesses to SBT records.
+    cudau::TypedBuffer<uint32_t> matIndexBuffer;
+    optixu::GeometryInstance geomInst = scene.createGeometryInstance();
+    geomInst.setVertexBuffer(vertexBuffer);
+    geomInst.setTriangleBuffer(triangleBuffer);
+    if (config.numMaterials > 1) {
+        std::mt19937 rng(2718281828);
+        std::uniform_int_distribution<uint32_t> dist(0, config.numMaterials - 1);
+        std::vector<uint32_t> matIndices(triangleBuffer.numElements());
+        for (uint32_t &matIndex : matIndices)
+            matIndex = dist(rng);
+        matIndexBuffer.initialize(cuContext, cudau::BufferType::Device, matIndices);
+        geomInst.setNumMaterials(config.numMaterials, matIndexBuffer);
+    }
+    else {
+        geomInst.setNumMaterials(1, optixu::BufferView());
+    }
+    for (uint32_t matIdx = 0; matIdx < config.numMaterials; ++matIdx) {
+        geomInst.setMaterial(0, matIdx, materials[matIdx]);
+        geomInst.setGeometryFlags(matIdx, OPTIX_GEOMETRY_FLAG_NONE);
+    }
+    uint32_t recordData[Shared::maxNumRecordDwords];
+    for (uint32_t i = 0; i < Shared::maxNumRecordDwords; ++i)
+        recordData[i] = i;
+    geomInst.setUserData(recordData, sizeof(uint32_t) * config.numRecordDwords, 16);
+
+    OptixAccelBufferSizes asMemReqs;
+    size_t maxSizeOfScratchBuffer = 0;
+
+    optixu::GeometryAccelerationStructure gas = scene.createGeometryAccelerationStructure();
+    cudau::Buffer gasMem;
+    gas.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, false, false);
+    gas.setNumMaterialSets(1);
+    gas.setNumRayTypes(0, Shared::NumRayTypes);
+    gas.addChild(geomInst);
+    gas.prepareForBuild(&asMemReqs);
+    gasMem.initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
+    maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
+
+    // JP: 単位変換のインスタンスをひとつだけ持つIASを積み重ねて階層の深さだけを変える。
+    // EN: Stack IASs each with a single identity instance to change only the depth of the hierarchy.
+    std::vector<optixu::Instance> instances(config.numInstanceLevels);
+    std::vector<optixu::InstanceAccelerationStructure> iases(config.numInstanceLevels);
+    std::vector<cudau::Buffer> iasMems(config.numInstanceLevels);
+    std::vector<cudau::TypedBuffer<OptixInstance>> instanceBuffers(config.numInstanceLevels);
+    for (uint32_t level = 0; level < config.numInstanceLevels; ++level) {
+        optixu::Instance &inst = instances[level];
+        inst = scene.createInstance();
+        if (level == 0)
+            inst.setChild(gas);
+        else
+            inst.setChild(iases[level - 1]);
+
+        optixu::InstanceAccelerationStructure &ias = iases[level];
+        ias = scene.createInstanceAccelerationStructure();
+        ias.setConfiguration(optixu::ASTradeoff::PreferFastTrace, false, false, false);
+        ias.addChild(inst);
+        ias.prepareForBuild(&asMemReqs);
+        iasMems[level].initialize(cuContext, cudau::BufferType::Device, asMemReqs.outputSizeInBytes, 1);
+        instanceBuffers[level].initialize(cuContext, cudau::BufferType::Device, ias.getNumChildren());
+        maxSizeOfScratchBuffer = std::max(maxSizeOfScratchBuffer, asMemReqs.tempSizeInBytes);
+    }
+
+    cudau::Buffer asBuildScratchMem;
+    asBuildScratchMem.initialize(cuContext, cudau::BufferType::Device, maxSizeOfScratchBuffer, 1);
+
+    OptixTraversableHandle travHandle = gas.rebuild(cuStream, gasMem, asBuildScratchMem);
+
+    cudau::Buffer hitGroupSBT;
+    size_t hitGroupSbtSize;
+    scene.generateShaderBindingTableLayout(&hitGroupSbtSize);
+    hitGroupSBT.initialize(cuContext, cudau::BufferType::Device, hitGroupSbtSize, 1);
+    hitGroupSBT.setMappedMemoryPersistent(true);
+
+    for (uint32_t level = 0; level < config.numInstanceLevels; ++level)
+        travHandle = iases[level].rebuild(cuStream, instanceBuffers[level], iasMems[level], asBuildScratchMem);
+
+
+
+    cudau::TypedBuffer<uint32_t> resultBuffer;
+    resultBuffer.initialize(cuContext, cudau::BufferType::Device, settings.width * settings.height);
+
+    Shared::PipelineLaunchParameters plp;
+    plp.travHandle = travHandle;
+    plp.imageSize = int2(settings.width, settings.height);
+    plp.resultBuffer = resultBuffer.getDevicePointer();
+    plp.cameraPosition = make_float3(0, 0.5f, 2.5f);
+    plp.numRaysPerPixel = settings.numRaysPerPixel;
+    plp.numRecordDwords = config.numRecordDwords;
+    plp.frameIndex = 0;
+
+    // JP: 8x8タイルのキュー。永続スレッドの数は全SMを埋める数にする。
+    // EN: Queue of 8x8 tiles. The number of persistent threads is that filling all the SMs.
+    tile_queue::TileQueueBuffer tileQueue;
+    tileQueue.initialize(cuContext, cudau::BufferType::Device);
+    plp.tileQueue = tileQueue.getTileQueue(make_uint2(settings.width, settings.height), 3);
+    uint32_t launchWidth = settings.width;
+    uint32_t launchHeight = settings.height;
+    if (config.persistentTiles) {
+        CUdevice cuDevice;
+        CUDADRV_CHECK(cuCtxGetDevice(&cuDevice));
+        launchWidth = tile_queue::calcNumPersistentThreads(cuDevice);
+        launchHeight = 1;
+    }
+
+    pipeline.setScene(scene);
+    pipeline.setHitGroupShaderBindingTable(hitGroupSBT, hitGroupSBT.getMappedPointer());
+
+    CUdeviceptr plpOnDevice;
+    CUDADRV_CHECK(cuMemAlloc(&plpOnDevice, sizeof(plp)));
+
+    const auto launch = [&]() {
+        if (config.persistentTiles)
+            tileQueue.reset(cuStream);
+        pipeline.launch(cuStream, plpOnDevice, launchWidth, launchHeight, 1);
+    };
+
+    // JP: 最初のローンチはSBTのセットアップを含むので計測から除く。
+    // EN: Exclude the first launch from the measurement since it includes SBT setup.
+    CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+    launch();
+
+    cudau::Timer timer;
+    timer.initialize(cuContext);
+    float totalTime = 0.0f;
+    for (uint32_t it = 0; it < settings.numIterations; ++it) {
+        plp.frameIndex = 1 + it;
+        CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
+        timer.start(cuStream);
+        launch();
+        timer.stop(cuStream);
+        totalTime += timer.report();
+    }
+    timer.finalize();
+
+    BenchmarkResult result;
+    result.launchTime = totalTime / settings.numIterations;
+    result.raysPerSecond = static_cast<double>(settings.width) * settings.height * settings.numRaysPerPixel /
+        (result.launchTime * 1e-3);
+
+
+
+    CUDADRV_CHECK(cuMemFree(plpOnDevice));
+
+    tileQueue.finalize();
+
+    resultBuffer.finalize();
+
+    hitGroupSBT.finalize();
+
+    asBuildScratchMem.finalize();
+    for (int level = static_cast<int>(config.numInstanceLevels) - 1; level >= 0; --level) {
+        instanceBuffers[level].finalize();
+        iasMems[level].finalize();
+        iases[level].destroy();
+        instances[level].destroy();
+    }
+    gasMem.finalize();
+    gas.destroy();
+
+    geomInst.destroy();
+    matIndexBuffer.finalize();
+
+    scene.destroy();
+
+    for (int matIdx = static_cast<int>(config.numMaterials) - 1; matIdx >= 0; --matIdx)
+        materials[matIdx].destroy();
+
+    shaderBindingTable.finalize();
+
+    hitProgramGroup.destroy();
+    missProgram.destroy();
+    rayGenProgram.destroy();
+
+    moduleOptiX.destroy();
+
+    pipeline.destroy();
+
+    return result;
+}
+
+int32_t main(int32_t argc, const char* argv[]) try {
+    LaunchSettings settings;
+    settings.width = 1920;
+    settings.height = 1080;
+    settings.numRaysPerPixel = 4;
+    settings.numIterations = 20;
+    uint32_t numTriangles = 1000000;
+
+    uint32_t argIdx = 1;
+    while (argIdx < argc) {
+        std::string_view arg = argv[argIdx];
+        if (argIdx + 1 >= argc)
+            throw std::runtime_error("Missing value for a command line argument.");
+        uint32_t value = std::max(std::atoi(argv[argIdx + 1]), 1);
+        if (arg == "--iterations")
+            settings.numIterations = value;
+        else if (arg == "--width")
+            settings.width = value;
+        else if (arg == "--height")
+            settings.height = value;
+        else if (arg == "--rays-per-pixel")
+            settings.numRaysPerPixel = value;
+        else if (arg == "--triangles")
+            numTriangles = value;
+        else
+            throw std::runtime_error("Unknown command line argument.");
+        argIdx += 2;
+    }
+
+
+
+    CUcontext cuContext;
+    int32_t cuDeviceCount;
+    CUstream cuStream;
+    CUDADRV_CHECK(cuInit(0));
+    CUDADRV_CHECK(cuDeviceGetCount(&cuDeviceCount));
+    CUDADRV_CHECK(cuCtxCreate(&cuContext, 0, 0));
+    CUDADRV_CHECK(cuCtxSetCurrent(cuContext));
+    CUDADRV_CHECK(cuStreamCreate(&cuStream, 0));
+
+    optixu::Context optixContext = optixu::Context::create(cuContext);
+
+    const std::string ptx = readTxtFile(getExecutableDirectory() / "trace_benchmark/ptxes/optix_kernels.ptx");
+
+    // JP: 単位立方体の中にランダムな小さい三角形を敷き詰め、大半のレイがヒットするシーンにする。
+    // EN: Scatter small random triangles in the unit cube so that most rays hit.
+    cudau::TypedBuffer<Shared::Vertex> vertexBuffer;
+    cudau::TypedBuffer<Shared::Triangle> triangleBuffer;
+    {
+        std::mt19937 rng(314159265);
+        std::uniform_real_distribution<float> u01;
+        std::vector<Shared::Vertex> vertices(3 * numTriangles);
+        std::vector<Shared::Triangle> triangles(numTriangles);
+        const float triangleSize = 2.0f / std::cbrt(static_cast<float>(numTriangles));
+        for (uint32_t triIdx = 0; triIdx < numTriangles; ++triIdx) {
+            float3 center = make_float3(2 * u01(rng) - 1, 2 * u01(rng) - 1, 2 * u01(rng) - 1);
+            for (uint32_t i = 0; i < 3; ++i) {
+                float3 offset = make_float3(u01(rng) - 0.5f, u01(rng) - 0.5f, u01(rng) - 0.5f);
+                vertices[3 * triIdx + i].position = center + triangleSize * offset;
+            }
+            triangles[triIdx] = Shared::Triangle{ 3 * triIdx + 0, 3 * triIdx + 1, 3 * triIdx + 2 };
+        }
+        vertexBuffer.initialize(cuContext, cudau::BufferType::Device, vertices);
+        triangleBuffer.initialize(cuContext, cudau::BufferType::Device, triangles);
+    }
+
+    char deviceName[256];
+    CUdevice cuDevice;
+    CUDADRV_CHECK(cuCtxGetDevice(&cuDevice));
+    CUDADRV_CHECK(cuDeviceGetName(deviceName, sizeof(deviceName), cuDevice));
+    hpprintf("# Device: %s\n", deviceName);
+    hpprintf("# Image: %ux%u, Rays/Pixel: %u, Iterations: %u, Triangles: %u\n",
+             settings.width, settings.height, settings.numRaysPerPixel, settings.numIterations, numTriangles);
+
+
+
+    // JP: 基準設定からパラメターをひとつずつ変化させる。
+    // EN: Vary parameters one at a time from the base configuration.
+    const BenchmarkConfig baseConfig = { 4, 8, 1, 1, false };
+    const uint32_t payloadDwordCounts[] = { 1, 2, 4, 8 };
+    const uint32_t recordDwordCounts[] = { 4, 8, 16, 32, 64 };
+    const uint32_t materialCounts[] = { 1, 4, 16, 64 };
+    const uint32_t instanceLevelCounts[] = { 0, 1, 2, 3 };
+
+    const auto run = [&](const char* sweepName, const BenchmarkConfig &config) {
+        BenchmarkResult result = runBenchmark(
+            cuContext, cuStream, optixContext, ptx, vertexBuffer, triangleBuffer, config, settings);
+        hpprintf("%s,%u,%u,%u,%u,%s,%.3f,%.2f\n",
+                 sweepName, config.numPayloadDwords, 4 * config.numRecordDwords,
+                 config.numMaterials, config.numInstanceLevels, config.persistentTiles ? "yes" : "no",
+                 result.launchTime, result.raysPerSecond * 1e-6);
+    };
+
+    hpprintf("sweep,payload[DW],record[B],materials,instanceLevels,tiles,launch[ms],Mrays/s\n");
+    for (uint32_t numPayloadDwords : payloadDwordCounts) {
+        BenchmarkConfig config = baseConfig;
+        config.numPayloadDwords = numPayloadDwords;
+        run("payload", config);
+    }
+    for (uint32_t numRecordDwords : recordDwordCounts) {
+        BenchmarkConfig config = baseConfig;
+        config.numRecordDwords = numRecordDwords;
+        run("record", config);
+    }
+    for (uint32_t numMaterials : materialCounts) {
+        BenchmarkConfig config = baseConfig;
+        config.numMaterials = numMaterials;
+        run("materials", config);
+    }
+    for (uint32_t numInstanceLevels : instanceLevelCounts) {
+        BenchmarkConfig config = baseConfig;
+        config.numInstanceLevels = numInstanceLevels;
+        run("depth", config);
+    }
+    for (bool persistentTiles : { false, true }) {
+        BenchmarkConfig config = baseConfig;
+        config.persistentTiles = persistentTiles;
+        run("tiles", config);
+    }
+
+
+
+    triangleBuffer.finalize();
+    vertexBuffer.finalize();
+
+    optixContext.destroy();
+
+    CUDADRV_CHECK(cuStreamDestroy(cuStream));
+    CUDADRV_CHECK(cuCtxDestroy(cuContext));
+
+    return 0;
+}
+catch (const std::exception &ex) {
+    hpprintf("Error: %s\n", ex.what());
+    return -1;
+}
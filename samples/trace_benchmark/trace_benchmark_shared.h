@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include "../common/common.h"
+#include "../common/tile_queue.h"
+
+namespace Shared {
+    enum RayType {
+        RayType_Primary = 0,
+        NumRayTypes
+    };
+
+    // JP: ジオメトリインスタンスのユーザーデータの最大サイズ(dword単位)。
+    // EN: Maximum size of geometry instance's user data in dwords.
+    static constexpr uint32_t maxNumRecordDwords = 64;
+
+
+
+    struct Vertex {
+        float3 position;
+    };
+
+    struct Triangle {
+        uint32_t index0, index1, index2;
+    };
+
+
+
+    // JP: マテリアルのユーザーデータ。ジオメトリインスタンスのユーザーデータは16バイトアラインメントで
+    //     この後ろに並ぶので、ヒットグループのSBTレコード中のオフセットは16バイトになる。
+    // EN: User data of material. User data of geometry instance lines up after this with 16-byte alignment,
+    //     so its offset in the hit group SBT record is 16 bytes.
+    struct MaterialData {
+        uint32_t materialIndex;
+    };
+    static constexpr uint32_t geometryDataOffsetInRecord = 16;
+
+
+
+    struct PipelineLaunchParameters {
+        OptixTraversableHandle travHandle;
+        int2 imageSize; // Note that CUDA/OptiX built-in vector types with width 2 require 8-byte alignment.
+        uint32_t* resultBuffer;
+        float3 cameraPosition;
+        uint32_t numRaysPerPixel;
+        uint32_t numRecordDwords;
+        uint32_t frameIndex;
+        // JP: 永続スレッドでローンチする場合にレイ生成プログラムがタイルを取得するキュー。
+        // EN: Queue from which the ray generation program pulls tiles when launched with persistent threads.
+        tile_queue::TileQueue tileQueue;
+    };
+
+
+
+    template <uint32_t numDwords>
+    struct Payload {
+        uint32_t values[numDwords];
+    };
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+
+#include "uber_shared.h"
+
+// JP: タイル(ブロック)ごとに収束を判定し、未収束タイルのピクセルを詰めたリストを作る。
+//     ピクセルの輝度の平均の相対標準誤差がタイル内の全ピクセルで閾値を下回ったらタイルを収束済みとする。
+//     収束済みフラグは累積のリセットまで保持されるので、未収束ピクセル数はリセット間で単調に減少する。
+// EN: Test convergence per tile (block) and build a compacted list of the pixels of unconverged tiles.
+//     A tile is regarded as converged when the relative standard error of the mean luminance
+//     falls below the threshold for all the pixels in the tile.
+//     Converged flags are kept until the accumulation resets,
+//     so the number of unconverged pixels monotonically decreases between resets.
+CUDA_DEVICE_KERNEL void buildActivePixelList(
+#if defined(USE_NATIVE_BLOCK_BUFFER2D)
+    optixu::NativeBlockBuffer2D<float4> accumBuffer,
+#else
+    optixu::BlockBuffer2D<float4, 1> accumBuffer,
+#endif
+    const float* sqLuminanceBuffer,
+    uint32_t imageSizeX, uint32_t imageSizeY,
+    uint32_t minNumSamples, float threshold,
+    uint32_t* tileConvergedFlags, uint32_t* activePixels, uint32_t* numActivePixels) {
+    __shared__ uint32_t s_unconverged;
+    __shared__ uint32_t s_baseIndex;
+
+    uint32_t ipx = blockDim.x * blockIdx.x + threadIdx.x;
+    uint32_t ipy = blockDim.y * blockIdx.y + threadIdx.y;
+    uint32_t tileIdx = gridDim.x * blockIdx.y + blockIdx.x;
+    bool inImage = ipx < imageSizeX && ipy < imageSizeY;
+    if (tileConvergedFlags[tileIdx])
+        return;
+
+    if (threadIdx.x == 0 && threadIdx.y == 0)
+        s_unconverged = 0;
+    __syncthreads();
+
+    if (inImage) {
+#if defined(USE_NATIVE_BLOCK_BUFFER2D)
+        float4 accum = accumBuffer.read(make_uint2(ipx, ipy));
+#else
+        float4 accum = accumBuffer[make_uint2(ipx, ipy)];
+#endif
+        float numSamples = accum.w;
+        bool converged = false;
+        if (numSamples >= minNumSamples) {
+            float mean = luminance(getXYZ(accum)) / numSamples;
+            float sqMean = sqLuminanceBuffer[ipy * imageSizeX + ipx] / numSamples;
+            float variance = fmaxf(sqMean - mean * mean, 0.0f) * numSamples / (numSamples - 1);
+            float relError = std::sqrt(variance / numSamples) / (mean + 1e-3f);
+            converged = relError < threshold;
+        }
+        if (!converged)
+            atomicOr(&s_unconverged, 1u);
+    }
+    __syncthreads();
+
+    if (!s_unconverged) {
+        if (threadIdx.x == 0 && threadIdx.y == 0)
+            tileConvergedFlags[tileIdx] = 1;
+        return;
+    }
+
+    // JP: タイル単位で一度だけアトミック加算して領域を確保する。
+    // EN: Allocate the range with a single atomic add per tile.
+    uint32_t tileWidth = min(blockDim.x, imageSizeX - blockDim.x * blockIdx.x);
+    uint32_t tileHeight = min(blockDim.y, imageSizeY - blockDim.y * blockIdx.y);
+    if (threadIdx.x == 0 && threadIdx.y == 0)
+        s_baseIndex = atomicAdd(numActivePixels, tileWidth * tileHeight);
+    __syncthreads();
+
+    if (inImage)
+        activePixels[s_baseIndex + threadIdx.y * tileWidth + threadIdx.x] = (ipy << 16) | ipx;
+}
@@ -47,6 +47,16 @@ struct HitGroupSBTRecordData {
 
 CUDA_DEVICE_KERNEL void RT_RG_NAME(pathtracing)() {
     uint2 launchIndex = make_uint2(optixGetLaunchIndex().x, optixGetLaunchIndex().y);
+    // JP: 適応サンプリング中は未収束ピクセルのリストを1次元で起動する。
+    //     起動サイズは数フレーム前の個数なので、それを超えるスレッドは何もしない。
+    // EN: Launch over the list of unconverged pixels in 1D during adaptive sampling.
+    //     The launch size is the count from a few frames ago, so threads beyond the current count do nothing.
+    if (plp.activePixels) {
+        if (launchIndex.x >= *plp.numActivePixels)
+            return;
+        uint32_t packedIndex = plp.activePixels[launchIndex.x];
+        launchIndex = make_uint2(packedIndex & 0xFFFF, packedIndex >> 16);
+    }
 
     PCG32RNG rng = plp.rngBuffer[launchIndex];
 
@@ -87,19 +97,25 @@ CUDA_DEVICE_KERNEL void RT_RG_NAME(pathtracing)() {
     }
 
     plp.rngBuffer[launchIndex] = rng;
-    float3 accResult = make_float3(0.0f, 0.0f, 0.0f);
+    // JP: w成分にピクセルごとのサンプル数を累積する。適応サンプリングではピクセルごとに異なる。
+    // EN: Accumulate the per-pixel sample count into the w component. It differs per pixel in adaptive sampling.
+    float4 accResult = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+    float sqLuminance = 0.0f;
+    uint32_t linearIndex = launchIndex.y * plp.imageSize.x + launchIndex.x;
     if (plp.numAccumFrames > 1) {
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
-        float4 accResultF4 = plp.accumBuffer.read(launchIndex);
+        accResult = plp.accumBuffer.read(launchIndex);
 #else
-        float4 accResultF4 = plp.accumBuffer[launchIndex];
+        accResult = plp.accumBuffer[launchIndex];
 #endif
-        accResult = make_float3(accResultF4.x, accResultF4.y, accResultF4.z);
+        sqLuminance = plp.sqLuminanceBuffer[linearIndex];
     }
+    float lum = luminance(payload.contribution);
+    plp.sqLuminanceBuffer[linearIndex] = sqLuminance + lum * lum;
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
-    plp.accumBuffer.write(launchIndex, make_float4(accResult + payload.contribution, 1.0f));
+    plp.accumBuffer.write(launchIndex, make_float4(getXYZ(accResult) + payload.contribution, accResult.w + 1.0f));
 #else
-    plp.accumBuffer[launchIndex] = make_float4(accResult + payload.contribution, 1.0f);
+    plp.accumBuffer[launchIndex] = make_float4(getXYZ(accResult) + payload.contribution, accResult.w + 1.0f);
 #endif
 }
 
@@ -400,3 +416,9 @@ CUDA_DEVICE_KERNEL void RT_EX_NAME(print)() {
     int32_t code = optixGetExceptionCode();
     printf("(%u, %u, %u): Exception: %u\n", launchIndex.x, launchIndex.y, launchIndex.z, code);
 }
+
+// JP: スレッドごとにprintfする代わりに例外を集計する。
+// EN: Aggregate exceptions instead of printf per thread.
+CUDA_DEVICE_KERNEL void RT_EX_NAME(collect)() {
+    exception_collector::collectException(plp.exceptions);
+}
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "uber_shared.h"
+#include "../common/post_process.h"
 
 CUDA_DEVICE_KERNEL void postProcess(
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
@@ -8,19 +9,13 @@ CUDA_DEVICE_KERNEL void postProcess(
 #else
     optixu::BlockBuffer2D<float4, 1> accumBuffer,
 #endif
-    uint32_t imageSizeX, uint32_t imageSizeY, uint32_t numAccumFrames,
+    uint32_t imageSizeX, uint32_t imageSizeY,
+    post_process::Settings settings,
     CUsurfObject outputBuffer) {
-    uint32_t ipx = blockDim.x * blockIdx.x + threadIdx.x;
-    uint32_t ipy = blockDim.y * blockIdx.y + threadIdx.y;
-    if (ipx >= imageSizeX || ipy >= imageSizeY)
-        return;
-#if defined(USE_NATIVE_BLOCK_BUFFER2D)
-    float3 pix = getXYZ(accumBuffer.read(make_uint2(ipx, ipy))) / (float)numAccumFrames;
-#else
-    float3 pix = getXYZ(accumBuffer[make_uint2(ipx, ipy)]) / (float)numAccumFrames;
-#endif
-    pix.x = 1 - std::exp(-pix.x);
-    pix.y = 1 - std::exp(-pix.y);
-    pix.z = 1 - std::exp(-pix.z);
-    surf2Dwrite(make_float4(pix, 1.0f), outputBuffer, ipx * sizeof(float4), ipy);
+    // JP: 適応サンプリングではピクセルごとにサンプル数が異なるので、累積したサンプル数で割る。
+    //     解決、露出、トーンマップは1パスで行い表示用サーフェスに直接書く。
+    // EN: The number of samples differs per pixel with adaptive sampling, so divide by the accumulated count.
+    //     Resolve, exposure and tone mapping are done in one pass writing directly into the display surface.
+    post_process::Inputs inputs = {};
+    post_process::postProcess(accumBuffer, make_uint2(imageSizeX, imageSizeY), inputs, settings, outputBuffer);
 }
@@ -11,6 +11,8 @@ EN: This sample is a spaghetti test place for the author.
 #include "uber_shared.h"
 
 #include "../common/obj_loader.h"
+#include "../common/post_process.h"
+#include "../common/light_tree.h"
 
 // Include glfw3.h after our OpenGL definitions
 #include "../common/gl_util.h"
@@ -185,16 +187,121 @@ static void glfw_error_callback(int32_t error, const char* description) {
     hpprintf("Error %d: %s\n", error, description);
 }
 
+// JP: 天井に並べた多数の発光三角形からライトツリーをGPU上で構築し、ホスト側に読み戻して
+//     サンプルした光源の確率と評価した確率の一致、全光源の確率の和が1になることを確認する。
+//     光源を動かしてリフィットした後にも同じ確認を行う。
+// EN: Build a light tree on the GPU from many emissive triangles lined on the ceiling and read it back to the host,
+//     then check that the probabilities of sampled lights match the evaluated ones and
+//     the probabilities of all the lights sum to one.
+//     Perform the same check after moving the lights and refitting.
+static bool runLightTreeCheck(CUcontext cuContext, CUstream stream) {
+    constexpr uint32_t gridSize = 16;
+    constexpr uint32_t numLights = gridSize * gridSize;
+
+    CUmodule moduleLightTree;
+    CUDADRV_CHECK(cuModuleLoad(&moduleLightTree,
+                               (getExecutableDirectory() / "uber/ptxes/light_tree_kernels.ptx").string().c_str()));
+    light_tree::Builder builder;
+    builder.initialize(cuContext, moduleLightTree, cudau::BufferType::Device, numLights);
+
+    std::vector<light_tree::LightSource> lights(numLights);
+    const auto placeLights = [&lights](float offsetX) {
+        for (uint32_t lightIdx = 0; lightIdx < numLights; ++lightIdx) {
+            float x = -1.0f + 2.0f * (lightIdx % gridSize + 0.5f) / gridSize + offsetX;
+            float z = -1.0f + 2.0f * (lightIdx / gridSize + 0.5f) / gridSize;
+            constexpr float h = 0.5f / gridSize;
+            light_tree::LightSource &light = lights[lightIdx];
+            // JP: 下向きの三角形。
+            // EN: Downward-facing triangle.
+            light.positions[0] = make_float3(x - h, 1.0f, z - h);
+            light.positions[1] = make_float3(x + h, 1.0f, z - h);
+            light.positions[2] = make_float3(x, 1.0f, z + h);
+            float e = 1.0f + (lightIdx * 7 % 13);
+            light.emittance = make_float3(e, 0.5f * e, 0.25f * e);
+            light.type = light_tree::LightType::Triangle;
+            light.twoSided = 0;
+        }
+    };
+    cudau::TypedBuffer<light_tree::LightSource> lightBuffer(cuContext, cudau::BufferType::Device, numLights);
+
+    std::vector<light_tree::Node> nodes(numLights - 1);
+    std::vector<light_tree::LightBounds> leafBounds(numLights);
+    std::vector<uint32_t> nodeParents(numLights - 1);
+    std::vector<uint32_t> leafParents(numLights);
+    const auto checkTree = [&]() {
+        const light_tree::LightTree devTree = builder.getDeviceView();
+        CUDADRV_CHECK(cuStreamSynchronize(stream));
+        CUDADRV_CHECK(cuMemcpyDtoH(nodes.data(), reinterpret_cast<CUdeviceptr>(devTree.nodes),
+                                   nodes.size() * sizeof(nodes[0])));
+        CUDADRV_CHECK(cuMemcpyDtoH(leafBounds.data(), reinterpret_cast<CUdeviceptr>(devTree.leafBounds),
+                                   leafBounds.size() * sizeof(leafBounds[0])));
+        CUDADRV_CHECK(cuMemcpyDtoH(nodeParents.data(), reinterpret_cast<CUdeviceptr>(devTree.nodeParents),
+                                   nodeParents.size() * sizeof(nodeParents[0])));
+        CUDADRV_CHECK(cuMemcpyDtoH(leafParents.data(), reinterpret_cast<CUdeviceptr>(devTree.leafParents),
+                                   leafParents.size() * sizeof(leafParents[0])));
+
+        light_tree::LightTree tree;
+        tree.nodes = nodes.data();
+        tree.leafBounds = leafBounds.data();
+        tree.nodeParents = nodeParents.data();
+        tree.leafParents = leafParents.data();
+        tree.numLights = devTree.numLights;
+
+        bool success = true;
+        const float3 shadingPoints[] = {
+            make_float3(0.0f, 0.0f, 0.0f), make_float3(0.7f, 0.0f, -0.3f), make_float3(-0.9f, 0.5f, 0.9f)
+        };
+        const float3 n = make_float3(0, 1, 0);
+        for (const float3 &p : shadingPoints) {
+            float sumProb = 0.0f;
+            for (uint32_t lightIdx = 0; lightIdx < numLights; ++lightIdx)
+                sumProb += tree.evaluateProbability(lightIdx, p, n);
+            success &= std::fabs(sumProb - 1.0f) < 1e-3f;
+
+            constexpr uint32_t numSamples = 1024;
+            for (uint32_t i = 0; i < numSamples; ++i) {
+                float prob;
+                uint32_t lightIdx = tree.sample(p, n, (i + 0.5f) / numSamples, &prob);
+                if (lightIdx == light_tree::InvalidIndex) {
+                    success = false;
+                    continue;
+                }
+                success &= std::fabs(tree.evaluateProbability(lightIdx, p, n) - prob) <= 1e-4f * prob;
+            }
+        }
+        return success;
+    };
+
+    placeLights(0.0f);
+    lightBuffer.write(lights, stream);
+    builder.build(stream, lightBuffer.getDevicePointer(), numLights);
+    bool success = checkTree();
+
+    placeLights(0.25f);
+    lightBuffer.write(lights, stream);
+    builder.refit(stream, lightBuffer.getDevicePointer());
+    success &= checkTree();
+
+    lightBuffer.finalize();
+    builder.finalize();
+    CUDADRV_CHECK(cuModuleUnload(moduleLightTree));
+
+    return success;
+}
+
 
 
 int32_t main(int32_t argc, const char* argv[]) try {
     bool takeScreenShot = false;
+    bool checkLightTree = false;
 
     uint32_t argIdx = 1;
     while (argIdx < argc) {
         std::string_view arg = argv[argIdx];
         if (arg == "--screen-shot")
             takeScreenShot = true;
+        else if (arg == "--light-tree-check")
+            checkLightTree = true;
         else
             throw std::runtime_error("Unknown command line argument.");
         ++argIdx;
@@ -444,16 +551,20 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     optixu::Pipeline pipeline = optixContext.createPipeline();
 
+    // JP: 例外のチェックはデバッグビルドでのみ有効にし、発生した例外はフレームごとに集計して表示する。
+    // EN: Enable exception checks only in debug builds, and show exceptions aggregated per frame.
+    constexpr bool enableExceptionChecks = DEBUG_SELECT(true, false);
     pipeline.setPipelineOptions(std::max(optixu::calcSumDwords<SearchRayPayloadSignature>(),
                                          optixu::calcSumDwords<VisibilityRayPayloadSignature>()),
                                 std::max(optixu::calcSumDwords<float2>(),
                                          optixu::calcSumDwords<SphereAttributeSignature>()),
                                 "plp", sizeof(Shared::PipelineLaunchParameters),
                                 false, OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_ANY,
-                                DEBUG_SELECT((OPTIX_EXCEPTION_FLAG_STACK_OVERFLOW |
-                                              OPTIX_EXCEPTION_FLAG_TRACE_DEPTH |
-                                              OPTIX_EXCEPTION_FLAG_DEBUG),
-                                             OPTIX_EXCEPTION_FLAG_NONE),
+                                enableExceptionChecks ?
+                                (OPTIX_EXCEPTION_FLAG_STACK_OVERFLOW |
+                                 OPTIX_EXCEPTION_FLAG_TRACE_DEPTH |
+                                 OPTIX_EXCEPTION_FLAG_DEBUG) :
+                                OPTIX_EXCEPTION_FLAG_NONE,
                                 OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE |
                                 OPTIX_PRIMITIVE_TYPE_FLAGS_ROUND_CUBIC_BSPLINE |
                                 OPTIX_PRIMITIVE_TYPE_FLAGS_CUSTOM);
@@ -467,7 +578,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
     optixu::Module emptyModule;
 
     optixu::ProgramGroup rayGenProgram = pipeline.createRayGenProgram(moduleOptiX, RT_RG_NAME_STR("pathtracing"));
-    //optixu::ProgramGroup exceptionProgram = pipeline.createExceptionProgram(moduleOptiX, "__exception__print");
+    optixu::ProgramGroup exceptionProgram = pipeline.createExceptionProgram(moduleOptiX, RT_EX_NAME_STR("collect"));
     optixu::ProgramGroup searchRayMissProgram = pipeline.createMissProgram(moduleOptiX, RT_MS_NAME_STR("searchRay"));
     optixu::ProgramGroup visibilityRayMissProgram = pipeline.createMissProgram(emptyModule, nullptr);
 
@@ -511,7 +622,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     pipeline.setRayGenerationProgram(rayGenProgram);
     // If an exception program is not set but exception flags are set, the default exception program will by provided by OptiX.
-    //pipeline.setExceptionProgram(exceptionProgram);
+    pipeline.setExceptionProgram(exceptionProgram);
     pipeline.setNumMissRayTypes(Shared::NumRayTypes);
     pipeline.setMissProgram(Shared::RayType_Search, searchRayMissProgram);
     pipeline.setMissProgram(Shared::RayType_Visibility, visibilityRayMissProgram);
@@ -569,6 +680,12 @@ int32_t main(int32_t argc, const char* argv[]) try {
     CUDADRV_CHECK(cuModuleLoad(&modulePostProcess, (getExecutableDirectory() / "uber/ptxes/post_process.ptx").string().c_str()));
     cudau::Kernel kernelPostProcess(modulePostProcess, "postProcess", cudau::dim3(8, 8), 0);
 
+    CUmodule moduleAdaptiveSampling;
+    CUDADRV_CHECK(cuModuleLoad(&moduleAdaptiveSampling, (getExecutableDirectory() / "uber/ptxes/adaptive_sampling.ptx").string().c_str()));
+    cudau::Kernel kernelBuildActivePixelList(moduleAdaptiveSampling, "buildActivePixelList",
+                                             cudau::dim3(Shared::AdaptiveSamplingTileSize,
+                                                         Shared::AdaptiveSamplingTileSize), 0);
+
     CUmodule moduleDeform;
     CUDADRV_CHECK(cuModuleLoad(&moduleDeform, (getExecutableDirectory() / "uber/ptxes/deform.ptx").string().c_str()));
     cudau::Kernel kernelDeform(moduleDeform, "deform", cudau::dim3(32), 0);
@@ -1251,6 +1368,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
 
 
+    if (checkLightTree)
+        hpprintf("Light tree check: %s\n", runLightTreeCheck(cuContext, cuStream) ? "passed" : "FAILED");
+
+
+
     hpprintf("Setup resources for composite.\n");
     
     // JP: OpenGL用バッファーオブジェクトからCUDAバッファーを生成する。
@@ -1330,6 +1452,25 @@ int32_t main(int32_t argc, const char* argv[]) try {
     accumBuffer.initialize(cuContext, g_bufferType, renderTargetSizeX, renderTargetSizeY);
 #endif
 
+    // JP: 適応サンプリング用のバッファー。
+    //     未収束ピクセル数は数フレーム遅れで読み出して次の起動サイズに使う。
+    // EN: Buffers for adaptive sampling.
+    //     The number of unconverged pixels is read back a few frames later and used for the next launch size.
+    const auto calcNumTiles = [](uint32_t sizeX, uint32_t sizeY) {
+        constexpr uint32_t tileSize = Shared::AdaptiveSamplingTileSize;
+        return ((sizeX + tileSize - 1) / tileSize) * ((sizeY + tileSize - 1) / tileSize);
+    };
+    cudau::TypedBuffer<float> sqLuminanceBuffer;
+    sqLuminanceBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+    cudau::TypedBuffer<uint32_t> tileConvergedFlagBuffer;
+    tileConvergedFlagBuffer.initialize(cuContext, cudau::BufferType::Device,
+                                       calcNumTiles(renderTargetSizeX, renderTargetSizeY));
+    cudau::TypedBuffer<uint32_t> activePixelBuffer;
+    activePixelBuffer.initialize(cuContext, cudau::BufferType::Device, renderTargetSizeX * renderTargetSizeY);
+    cudau::QueryRing<uint32_t> numActivePixelQueries;
+    numActivePixelQueries.initialize(cuContext);
+    uint64_t adaptiveSamplingEpoch = 0;
+
 
 
     Shared::PipelineLaunchParameters plp;
@@ -1346,11 +1487,19 @@ int32_t main(int32_t argc, const char* argv[]) try {
 #else
     plp.accumBuffer = accumBuffer.getBlockBuffer2D();
 #endif
+    plp.sqLuminanceBuffer = sqLuminanceBuffer.getDevicePointer();
+    plp.activePixels = nullptr;
+    plp.numActivePixels = nullptr;
     plp.camera.fovY = 50 * M_PI / 180;
     plp.camera.aspect = (float)renderTargetSizeX / renderTargetSizeY;
     plp.matLightIndex = matLightIndex;
     plp.textures = textureObjectBuffer.getDevicePointer();
 
+    exception_collector::ExceptionCollectorBuffer exceptions;
+    exceptions.initialize(cuContext, cudau::BufferType::Device, 16);
+    exceptions.reset(cuStream);
+    plp.exceptions = exceptions.getCollector();
+
     pipeline.setScene(scene);
     pipeline.setHitGroupShaderBindingTable(hitGroupSBT, hitGroupSBT.getMappedPointer());
 
@@ -1439,6 +1588,9 @@ int32_t main(int32_t argc, const char* argv[]) try {
 #endif
             rngBuffer.resize(renderTargetSizeX, renderTargetSizeY);
             initializeRNGSeeds(rngBuffer);
+            sqLuminanceBuffer.resize(renderTargetSizeX * renderTargetSizeY);
+            tileConvergedFlagBuffer.resize(calcNumTiles(renderTargetSizeX, renderTargetSizeY));
+            activePixelBuffer.resize(renderTargetSizeX * renderTargetSizeY);
 
             // EN: update the pipeline parameters.
             plp.imageSize.x = renderTargetSizeX;
@@ -1450,6 +1602,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 #else
             plp.accumBuffer = accumBuffer.getBlockBuffer2D();
 #endif
+            plp.sqLuminanceBuffer = sqLuminanceBuffer.getDevicePointer();
             plp.camera.aspect = (float)renderTargetSizeX / renderTargetSizeY;
 
             resized = true;
@@ -1644,6 +1797,11 @@ int32_t main(int32_t argc, const char* argv[]) try {
         static int32_t gasRebuildInterval = 30;
         static bool enablePeriodicIASRebuild = true;
         static int32_t iasRebuildInterval = 30;
+        static bool enableAdaptiveSampling = false;
+        static int32_t adaptiveMinNumSamples = 16;
+        static float convergenceThreshold = 0.01f;
+        static float activePixelRatio = 1.0f;
+        static post_process::Settings postProcessSettings = post_process::Settings::getDefault();
         {
             ImGui::Begin("Settings", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
@@ -1652,6 +1810,19 @@ int32_t main(int32_t argc, const char* argv[]) try {
             ImGui::Checkbox("Enable IAS Rebuild", &enablePeriodicIASRebuild);
             ImGui::SliderInt("IAS Rebuild Interval", &iasRebuildInterval, 1, 60);
 
+            ImGui::Separator();
+            ImGui::Checkbox("Adaptive Sampling", &enableAdaptiveSampling);
+            ImGui::SliderInt("Min Samples", &adaptiveMinNumSamples, 2, 256);
+            ImGui::SliderFloat("Convergence Threshold", &convergenceThreshold, 0.001f, 0.1f, "%.4f", 3.0f);
+            ImGui::Text("Active Pixels: %.1f%%", enableAdaptiveSampling ? 100.0f * activePixelRatio : 100.0f);
+
+            ImGui::Separator();
+            ImGui::SliderFloat("Exposure (EV)", &postProcessSettings.exposure, -8.0f, 8.0f);
+            static const char* toneMapNames[] = { "None", "Exponential", "Reinhard", "ACES" };
+            int32_t toneMap = static_cast<int32_t>(postProcessSettings.toneMap);
+            if (ImGui::Combo("Tone Map", &toneMap, toneMapNames, IM_ARRAYSIZE(toneMapNames)))
+                postProcessSettings.toneMap = static_cast<post_process::ToneMap>(toneMap);
+
             ImGui::End();
         }
 
@@ -1840,11 +2011,65 @@ int32_t main(int32_t argc, const char* argv[]) try {
         if (play || playStep || sceneEdited || cameraIsActuallyMoving)
             plp.numAccumFrames = 1;
 
+        // JP: 累積のリセット時には収束済みフラグもクリアし、
+        //     以前の累積の未収束ピクセル数を使わないようにエポックを進める。
+        // EN: Clear converged flags as well on accumulation reset,
+        //     and advance the epoch not to use the numbers of unconverged pixels of the previous accumulation.
+        if (plp.numAccumFrames == 1) {
+            CUDADRV_CHECK(cuMemsetD32Async(tileConvergedFlagBuffer.getCUdeviceptr(), 0,
+                                           tileConvergedFlagBuffer.numElements(), cuStream));
+            ++adaptiveSamplingEpoch;
+        }
+
         // Render
         sw.start();
         curGPUTimer.render.start(cuStream);
+        const uint32_t numPixels = renderTargetSizeX * renderTargetSizeY;
+        // JP: 最低サンプル数までは全ピクセルを一様にサンプルし、その後は未収束ピクセルのリストに対して起動する。
+        //     収束済みフラグはリセットまで保持されるため未収束ピクセル数は単調に減少し、
+        //     数フレーム前に読み出した個数を起動サイズの上限として使える。
+        // EN: Sample all pixels uniformly until the minimum number of samples,
+        //     then launch over the list of unconverged pixels.
+        //     Converged flags are kept until reset, so the number of unconverged pixels decreases monotonically,
+        //     and the count read back a few frames ago can be used as an upper bound of the launch size.
+        const bool adaptiveLaunch =
+            enableAdaptiveSampling && plp.numAccumFrames > static_cast<uint32_t>(adaptiveMinNumSamples);
+        uint32_t launchSize = numPixels;
+        plp.activePixels = nullptr;
+        plp.numActivePixels = nullptr;
+        if (adaptiveLaunch) {
+            uint32_t numActivePixels;
+            uint64_t epoch;
+            numActivePixelQueries.poll();
+            if (numActivePixelQueries.getLatestResult(&numActivePixels, &epoch) &&
+                epoch == adaptiveSamplingEpoch)
+                launchSize = std::min(numActivePixels, numPixels);
+
+            uint32_t* numActivePixelsOnDevice = numActivePixelQueries.beginQuery(adaptiveSamplingEpoch);
+            CUDADRV_CHECK(cuMemsetD32Async(reinterpret_cast<CUdeviceptr>(numActivePixelsOnDevice), 0, 1, cuStream));
+            kernelBuildActivePixelList(
+                cuStream, kernelBuildActivePixelList.calcGridDim(renderTargetSizeX, renderTargetSizeY),
+#if defined(USE_NATIVE_BLOCK_BUFFER2D)
+                arrayAccumBuffer.getSurfaceObject(0),
+#else
+                accumBuffer.getBlockBuffer2D(),
+#endif
+                sqLuminanceBuffer.getDevicePointer(),
+                renderTargetSizeX, renderTargetSizeY,
+                static_cast<uint32_t>(adaptiveMinNumSamples), convergenceThreshold,
+                tileConvergedFlagBuffer.getDevicePointer(),
+                activePixelBuffer.getDevicePointer(), numActivePixelsOnDevice);
+            numActivePixelQueries.endQuery(cuStream);
+
+            plp.activePixels = activePixelBuffer.getDevicePointer();
+            plp.numActivePixels = numActivePixelsOnDevice;
+            activePixelRatio = static_cast<float>(launchSize) / numPixels;
+        }
         CUDADRV_CHECK(cuMemcpyHtoDAsync(plpOnDevice, &plp, sizeof(plp), cuStream));
-        pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        if (!adaptiveLaunch)
+            pipeline.launch(cuStream, plpOnDevice, renderTargetSizeX, renderTargetSizeY, 1);
+        else if (launchSize > 0)
+            pipeline.launch(cuStream, plpOnDevice, launchSize, 1, 1);
         curGPUTimer.render.stop(cuStream);
         cpuTimeRecord.renderCmdTime = sw.getMeasurement(sw.stop(), StopWatchDurationType::Microseconds) * 1e-3f;
 
@@ -1859,7 +2084,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 #else
                           accumBuffer.getBlockBuffer2D(),
 #endif
-                          renderTargetSizeX, renderTargetSizeY, plp.numAccumFrames,
+                          renderTargetSizeX, renderTargetSizeY,
+                          postProcessSettings,
                           outputBufferSurfaceHolder.getNext());
         outputBufferSurfaceHolder.endCUDAAccess(cuStream);
         curGPUTimer.postProcess.stop(cuStream);
@@ -1868,6 +2094,15 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
         curGPUTimer.frame.stop(cuStream);
 
+        if constexpr (enableExceptionChecks) {
+            exception_collector::Summary exceptionSummary;
+            exceptions.resolve(cuStream, &exceptionSummary);
+            if (exceptionSummary.totalCount > 0) {
+                exceptionSummary.print();
+                exceptions.reset(cuStream);
+            }
+        }
+
         if (takeScreenShot && frameIndex + 1 == 60) {
             CUDADRV_CHECK(cuStreamSynchronize(cuStream));
             auto rawImage = new float4[renderTargetSizeX * renderTargetSizeY];
@@ -1959,6 +2194,8 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     CUDADRV_CHECK(cuMemFree(plpOnDevice));
 
+    exceptions.finalize();
+
 
 
 #if defined(USE_NATIVE_BLOCK_BUFFER2D)
@@ -1966,6 +2203,10 @@ int32_t main(int32_t argc, const char* argv[]) try {
 #else
     accumBuffer.finalize();
 #endif
+    numActivePixelQueries.finalize();
+    activePixelBuffer.finalize();
+    tileConvergedFlagBuffer.finalize();
+    sqLuminanceBuffer.finalize();
     rngBuffer.finalize();
     
     scaleSampler.finalize();
@@ -2050,6 +2291,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     CUDADRV_CHECK(cuModuleUnload(moduleBoundingBoxProgram));
     CUDADRV_CHECK(cuModuleUnload(moduleDeform));
+    CUDADRV_CHECK(cuModuleUnload(moduleAdaptiveSampling));
     CUDADRV_CHECK(cuModuleUnload(modulePostProcess));
 
     shaderBindingTable.finalize();
@@ -2072,6 +2314,7 @@ int32_t main(int32_t argc, const char* argv[]) try {
 
     visibilityRayMissProgram.destroy();
     searchRayMissProgram.destroy();
+    exceptionProgram.destroy();
     rayGenProgram.destroy();
 
     moduleOptiX.destroy();
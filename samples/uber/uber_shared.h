@@ -1,12 +1,21 @@
 ﻿#pragma once
 
 #include "../common/common.h"
+#include "../common/exception_collector.h"
 
 #define USE_NATIVE_BLOCK_BUFFER2D
 
 namespace Shared {
     static constexpr float Pi = 3.14159265358979323846f;
 
+    // JP: 適応サンプリングの収束判定に使うタイルのサイズ。
+    // EN: Tile size used for convergence tests of adaptive sampling.
+    static constexpr uint32_t AdaptiveSamplingTileSize = 8;
+
+    CUDA_DEVICE_FUNCTION float luminance(const float3 &rgb) {
+        return 0.2126f * rgb.x + 0.7152f * rgb.y + 0.0722f * rgb.z;
+    }
+
 
 
     enum RayType {
@@ -154,9 +163,18 @@ namespace Shared {
 #else
         optixu::BlockBuffer2D<float4, 1> accumBuffer;
 #endif
+        // JP: 輝度の二乗和。適応サンプリングの分散推定に使う。
+        // EN: Sum of squared luminance used for variance estimation of adaptive sampling.
+        float* sqLuminanceBuffer;
+        // JP: nullptrでない場合、レイ生成は1次元の起動インデックスをこのリストで間接参照してピクセルを決める。
+        // EN: When not nullptr, ray generation determines the pixel by indirection through this list
+        //     with the 1D launch index.
+        const uint32_t* activePixels;
+        const uint32_t* numActivePixels;
         PerspectiveCamera camera;
         uint32_t matLightIndex;
         CUtexObject* textures;
+        exception_collector::ExceptionCollector exceptions;
     };
 
 
@@ -0,0 +1,125 @@
+import os
+import sys
+import subprocess
+import json
+import argparse
+
+def chdir(dst):
+    oldDir = os.getcwd()
+    os.chdir(dst)
+    return oldDir
+
+# JP: 各指標の値と、値が大きいほど良いかどうか。
+# EN: Value of each metric and whether larger is better.
+def collectMetrics(result):
+    metrics = {}
+    for stage, stats in result['stages'].items():
+        if stats['count'] > 0:
+            metrics['stages.' + stage + '.median'] = (stats['median'], False)
+    for stage, stats in result.get('setupStages', {}).items():
+        if stats['count'] > 0:
+            metrics['setupStages.' + stage + '.total'] = (stats['total'], False)
+    if result['frame']['count'] > 0:
+        metrics['frame.median'] = (result['frame']['median'], False)
+    metrics['peakDeviceMemory'] = (result['peakDeviceMemory'] - result['initialDeviceMemory'], False)
+    metrics['raysPerSecond'] = (result['raysPerSecond'], True)
+    return metrics
+
+def compare(results, baseline, threshold):
+    regressions = []
+    for testName, result in results.items():
+        if testName not in baseline:
+            print(testName + ': no baseline')
+            continue
+        curMetrics = collectMetrics(result)
+        refMetrics = collectMetrics(baseline[testName])
+        for name, (value, higherIsBetter) in curMetrics.items():
+            if name not in refMetrics:
+                continue
+            refValue = refMetrics[name][0]
+            if refValue == 0:
+                continue
+            ratio = value / refValue
+            regressed = ratio < 1 - threshold if higherIsBetter else ratio > 1 + threshold
+            print('{}: {}: {:.6g} (baseline {:.6g}, {:+.1f}%){}'.format(
+                testName, name, value, refValue, (ratio - 1) * 100, ' REGRESSION' if regressed else ''))
+            if regressed:
+                regressions.append((testName, name))
+    return regressions
+
+def run():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--no-build', action='store_true')
+    parser.add_argument('--baseline', default='benchmark_baseline.json')
+    parser.add_argument('--output', default='benchmark_results.json')
+    parser.add_argument('--threshold', type=float, default=0.05)
+    parser.add_argument('--update-baseline', action='store_true')
+    args = parser.parse_args()
+
+    msbuild = R'C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\MSBuild\Current\Bin\MSBuild.exe'
+    sln = os.path.abspath(R'..\samples\OptiX_Utility.sln')
+    baselinePath = os.path.abspath(args.baseline)
+    outputPath = os.path.abspath(args.output)
+
+    with open(R'benchmarks.json') as f:
+        benchmarks = json.load(f)
+
+    config = 'Release'
+
+    # Build
+    if not args.no_build:
+        cmd = [msbuild, '/m', '/p:Configuration=' + config, '/p:Platform=x64']
+        cmd += [sln]
+        print(' '.join(cmd))
+        ret = subprocess.run(cmd, check=True)
+
+    # Run benchmarks
+    results = {}
+    outDir = os.path.abspath(os.path.join(R'..\samples\x64', config))
+    for benchmark in benchmarks:
+        testName = benchmark['sample']
+        testDir = benchmark['sample']
+        exeName = benchmark['sample'] + '.exe'
+
+        print('Run ' + testName + ':')
+
+        oldDir = chdir(os.path.join(R'..\samples', testDir))
+        exe = os.path.join(outDir, exeName)
+        resultPath = 'benchmark.json'
+        cmd = [exe, '--benchmark', '--benchmark-output', resultPath]
+        if 'options' in benchmark:
+            cmd += benchmark['options']
+        ret = subprocess.run(cmd, check=True)
+
+        with open(resultPath) as f:
+            results[testName] = json.load(f)
+        os.remove(resultPath)
+
+        chdir(oldDir)
+
+    with open(outputPath, 'w') as f:
+        json.dump(results, f, indent=4)
+
+    if args.update_baseline:
+        with open(baselinePath, 'w') as f:
+            json.dump(results, f, indent=4)
+        print('Baseline updated: ' + baselinePath)
+        return 0
+
+    # Compare with the baseline
+    if not os.path.exists(baselinePath):
+        print('Baseline not found: ' + baselinePath)
+        return 0
+    with open(baselinePath) as f:
+        baseline = json.load(f)
+    regressions = compare(results, baseline, args.threshold)
+    print('Regressions: {}, Threshold: {:.1f}%'.format(len(regressions), args.threshold * 100))
+
+    return 1 if len(regressions) > 0 else 0
+
+if __name__ == '__main__':
+    try:
+        sys.exit(run())
+    except Exception as e:
+        print(e)
+        sys.exit(1)
@@ -2,6 +2,7 @@ import os
 import sys
 import subprocess
 import json
+import shutil
 from PIL import Image, ImageChops
 
 def chdir(dst):
@@ -9,7 +10,25 @@ def chdir(dst):
     os.chdir(dst)
     return oldDir
 
+# --update-references [sample ...]: 比較の代わりに出力で参照画像を置き換える。
+#                                   サンプル名を省略すると全てのテストの参照画像を置き換える。
+# --update-references [sample ...]: Replace reference images with the outputs instead of comparing.
+#                                   All the tests' reference images are replaced when sample names are omitted.
+def parseArgs(argv):
+    updateReferences = False
+    samplesToUpdate = []
+    for arg in argv[1:]:
+        if arg == '--update-references':
+            updateReferences = True
+        elif updateReferences:
+            samplesToUpdate.append(arg)
+        else:
+            raise ValueError('Unknown argument: ' + arg)
+    return updateReferences, samplesToUpdate
+
 def run():
+    updateReferences, samplesToUpdate = parseArgs(sys.argv)
+
     msbuild = R'C:\Program Files (x86)\Microsoft Visual Studio\2019\Community\MSBuild\Current\Bin\MSBuild.exe'
     sln = os.path.abspath(R'..\samples\OptiX_Utility.sln')
     refImgDir = os.path.abspath(R'ref_images')
@@ -52,9 +71,15 @@ def run():
                 cmd.append(test['options'])
             ret = subprocess.run(cmd, check=True)
 
+            refImgPath = os.path.join(refImgDir, testDir, 'reference.png')
+            if updateReferences and config == configs[0] and (not samplesToUpdate or testName in samplesToUpdate):
+                os.makedirs(os.path.dirname(refImgPath), exist_ok=True)
+                shutil.copyfile(test['image'], refImgPath)
+                print('Updated ' + refImgPath)
+
             # RGBAでdiffをとると差が無いことになってしまう。
             img = Image.open(test['image']).convert('RGB')
-            refImg = Image.open(os.path.join(refImgDir, testDir, 'reference.png')).convert('RGB')
+            refImg = Image.open(refImgPath).convert('RGB')
             diffImg = ImageChops.difference(img, refImg)
             diffBBox = diffImg.getbbox()
             if diffBBox is None: